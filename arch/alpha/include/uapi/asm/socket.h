@@ -105,4 +105,6 @@
 
 #define SO_COOKIE		57
 
+#define SO_ZEROCOPY		58
+
 #endif /* _UAPI_ASM_SOCKET_H */
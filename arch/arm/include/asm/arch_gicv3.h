@@ -275,6 +275,38 @@ static inline u64 __gic_readq_nonatomic(const volatile void __iomem *addr)
 #define gicr_read_pendbaser(c)		__gic_readq_nonatomic(c)
 #define gicr_write_pendbaser(v, c)	__gic_writeq_nonatomic(v, c)
 
+/*
+ * GICR_INVLPIR - only the bottom half holds the INTID, and the top one
+ * is written last.
+ */
+#define gic_write_lpir(v, c)		__gic_writeq_nonatomic(v, c)
+
+/*
+ * GICR_VPROPBASER is only written while no vPE is resident, and so can be
+ * changed non-atomically.
+ */
+#define gits_write_vpropbaser(v, c)	__gic_writeq_nonatomic(v, c)
+
+/*
+ * GICR_VPENDBASER - the Valid bit must be cleared before changing
+ * anything else. __gic_writeq_nonatomic() writes the top half, which
+ * holds Valid, after the bottom one.
+ */
+static inline void gits_write_vpendbaser(u64 val, void __iomem *addr)
+{
+	u32 tmp;
+
+	tmp = readl_relaxed(addr + 4);
+	if (tmp & (GICR_VPENDBASER_Valid >> 32)) {
+		tmp &= ~(GICR_VPENDBASER_Valid >> 32);
+		writel_relaxed(tmp, addr + 4);
+	}
+
+	__gic_writeq_nonatomic(val, addr);
+}
+
+#define gits_read_vpendbaser(c)		__gic_readq_nonatomic(c)
+
 /*
  * GITS_TYPER is an ID register and doesn't need atomicity.
  */
@@ -229,6 +229,11 @@
 	{6, "FIQ" },		\
 	{7, "HVC" }
 
+#define KVM_GUEST_CTXT_NONE	0
+
+#define kvm_arm_guest_ctxt	\
+	{KVM_GUEST_CTXT_NONE, "" }
+
 #define HSRECN(x) { HSR_EC_##x, #x }
 
 #define kvm_arm_exception_class \
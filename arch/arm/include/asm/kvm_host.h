@@ -21,6 +21,7 @@
 
 #include <linux/types.h>
 #include <linux/kvm_types.h>
+#include <linux/workqueue.h>
 #include <asm/kvm.h>
 #include <asm/kvm_asm.h>
 #include <asm/kvm_mmio.h>
@@ -28,6 +29,8 @@
 #include <kvm/arm_arch_timer.h>
 
 #define __KVM_HAVE_ARCH_INTC_INITIALIZED
+#define KVM_HAVE_MMU_RWLOCK
+#define KVM_HAVE_MMU_LOCK_STAT
 
 #define KVM_USER_MEM_SLOTS 32
 #define KVM_HAVE_ONE_REG
@@ -65,6 +68,13 @@ struct kvm_s2_mmu {
 
 	/* Stage-2 page table */
 	pgd_t *pgd;
+
+	/*
+	 * Set while a large unmap batches the TLB invalidation of its leaf
+	 * entries into a single one for the whole VMID, under kvm->mmu_lock.
+	 */
+	bool tlb_flush_deferred;
+	bool tlb_flush_pending;
 };
 
 /* Per shadow VMID mmu structure. This is only for nested virtualization */
@@ -76,13 +86,33 @@ struct kvm_nested_s2_mmu {
 	struct list_head list;
 };
 
+/*
+ * Zeroed pages kept per VM for its stage 2 tables, so that the fault path
+ * can top up its cache without going to the page allocator. A worker keeps
+ * it filled to a target that follows the rate at which it is drained.
+ */
+struct kvm_s2_page_pool {
+	spinlock_t lock;
+	struct list_head pages;
+	unsigned int nr_pages;
+	unsigned int target;
+	/* Top-ups that had to allocate since the last refill */
+	unsigned int nr_missed;
+	unsigned long last_refill;
+	struct work_struct refill;
+};
+
 struct kvm_arch {
 	/* Stage 2 paging state for the VM */
 	struct kvm_s2_mmu mmu;
+	struct kvm_s2_page_pool s2_pool;
 
 	/* The last vcpu id that ran on each physical CPU */
 	int __percpu *last_vcpu_ran;
 
+	/* Sampled callsite of the last writer of kvm->mmu_lock */
+	unsigned long mmu_lock_holder;
+
 	/*
 	 * Anything that is not used directly from assembly code goes
 	 * here.
@@ -198,6 +228,8 @@ struct kvm_vcpu_arch {
 
 	/* IO related fields */
 	struct kvm_decode mmio_decode;
+	/* kvm_io_bus cookie of the device that handled the last MMIO access */
+	long mmio_cookie;
 
 	/* Cache some mmu pages needed inside spinlock regions */
 	struct kvm_mmu_memory_cache mmu_page_cache;
@@ -216,12 +248,16 @@ struct kvm_vcpu_arch {
 
 struct kvm_vm_stat {
 	ulong remote_tlb_flush;
+	ulong mmu_lock_contended;
+	ulong mmu_lock_wait_ns;
 };
 
 struct kvm_vcpu_stat {
 	u64 halt_successful_poll;
 	u64 halt_attempted_poll;
 	u64 halt_poll_invalid;
+	u64 halt_poll_success_ns;
+	u64 halt_poll_fail_ns;
 	u64 halt_wakeup;
 	u64 hvc_exit_stat;
 	u64 wfe_exit_stat;
@@ -229,6 +265,16 @@ struct kvm_vcpu_stat {
 	u64 mmio_exit_user;
 	u64 mmio_exit_kernel;
 	u64 exits;
+	u64 nested_s2_fault;
+	u64 s2_remote_table;
+	u64 vgic_lr_underflow;
+	u64 timer_irq;
+	u64 mmu_lock_read_contended;
+	u64 mmu_lock_read_wait_ns;
+	u64 ap_list_lock_contended;
+	u64 ap_list_lock_wait_ns;
+	u64 irq_lock_contended;
+	u64 irq_lock_wait_ns;
 };
 
 #define vcpu_cp15(v,r)	(v)->arch.ctxt.cp15[r]
@@ -242,6 +288,7 @@ unsigned long kvm_call_hyp(void *hypfn, ...);
 void force_vm_exit(const cpumask_t *mask);
 
 #define KVM_ARCH_WANT_MMU_NOTIFIER
+#define KVM_ARCH_WANT_AGE_HVA_BITMAP
 int kvm_unmap_hva(struct kvm *kvm, unsigned long hva);
 int kvm_unmap_hva_range(struct kvm *kvm,
 			unsigned long start, unsigned long end);
@@ -251,6 +298,8 @@ unsigned long kvm_arm_num_regs(struct kvm_vcpu *vcpu);
 int kvm_arm_copy_reg_indices(struct kvm_vcpu *vcpu, u64 __user *indices);
 int kvm_age_hva(struct kvm *kvm, unsigned long start, unsigned long end);
 int kvm_test_age_hva(struct kvm *kvm, unsigned long hva);
+void kvm_age_hva_bitmap(struct kvm *kvm, unsigned long start,
+			unsigned long end, unsigned long *young);
 
 /* We do not have shadow page tables, hence the empty hooks */
 static inline void kvm_arch_mmu_notifier_invalidate_page(struct kvm *kvm,
@@ -272,6 +321,62 @@ int kvm_arm_coproc_set_reg(struct kvm_vcpu *vcpu, const struct kvm_one_reg *);
 int handle_exit(struct kvm_vcpu *vcpu, struct kvm_run *run,
 		int exception_index);
 
+static inline struct kvm_s2_mmu *kvm_arm_fast_eret_mmu(struct kvm_vcpu *vcpu,
+						       int exception_index)
+{
+	return NULL;
+}
+static inline void kvm_arm_fast_eret(struct kvm_vcpu *vcpu) {}
+
+static inline bool kvm_arm_setup_async_pf(struct kvm_vcpu *vcpu,
+					  phys_addr_t ipa, gfn_t gfn,
+					  unsigned long hva)
+{
+	return false;
+}
+static inline bool kvm_arm_async_pf_done(struct kvm_vcpu *vcpu)
+{
+	return false;
+}
+static inline void kvm_arm_async_pf_wait(struct kvm_vcpu *vcpu) {}
+static inline void kvm_arm_async_pf_clear(struct kvm_vcpu *vcpu) {}
+
+/* The FP state of a 32bit guest is switched eagerly */
+static inline int kvm_arch_vcpu_run_map_fp(struct kvm_vcpu *vcpu)
+{
+	return 0;
+}
+static inline void kvm_arch_vcpu_load_fp(struct kvm_vcpu *vcpu) {}
+static inline void kvm_arch_vcpu_ctxflush_fp(struct kvm_vcpu *vcpu) {}
+static inline void kvm_arch_vcpu_ctxsync_fp(struct kvm_vcpu *vcpu) {}
+static inline void kvm_arch_vcpu_put_fp(struct kvm_vcpu *vcpu) {}
+
+/* Without VHE, the system registers are switched on every run */
+static inline void kvm_vcpu_put_sysregs(struct kvm_vcpu *vcpu) {}
+static inline void kvm_pvsched_vcpu_load(struct kvm_vcpu *vcpu) {}
+static inline void kvm_pvsched_vcpu_put(struct kvm_vcpu *vcpu) {}
+static inline bool kvm_pvsched_defer_preempt(struct kvm_vcpu *vcpu)
+{
+	return false;
+}
+static inline bool kvm_pvsched_preempt_deferred(struct kvm_vcpu *vcpu)
+{
+	return false;
+}
+
+static inline bool kvm_arm_has_vcpu_debugfs(void)
+{
+	return false;
+}
+static inline int kvm_arm_create_vcpu_debugfs(struct kvm_vcpu *vcpu)
+{
+	return 0;
+}
+static inline int kvm_arm_create_vm_debugfs(struct kvm *kvm)
+{
+	return 0;
+}
+
 static inline void __cpu_init_hyp_mode(phys_addr_t pgd_ptr,
 				       unsigned long hyp_stack_ptr,
 				       unsigned long vector_ptr)
@@ -306,6 +411,7 @@ int kvm_perf_init(void);
 int kvm_perf_teardown(void);
 
 void kvm_mmu_wp_memory_region(struct kvm *kvm, int slot);
+void kvm_mmu_sync_dirty_log(struct kvm *kvm, u32 slot);
 
 struct kvm_vcpu *kvm_mpidr_to_vcpu(struct kvm *kvm, unsigned long mpidr);
 
@@ -326,6 +432,10 @@ int kvm_arm_vcpu_arch_get_attr(struct kvm_vcpu *vcpu,
 			       struct kvm_device_attr *attr);
 int kvm_arm_vcpu_arch_has_attr(struct kvm_vcpu *vcpu,
 			       struct kvm_device_attr *attr);
+long kvm_arm_vcpu_arch_ioctl(struct kvm_vcpu *vcpu, unsigned int ioctl,
+			     void __user *argp);
+long kvm_arm_vm_arch_ioctl(struct kvm *kvm, unsigned int ioctl,
+			   void __user *argp);
 
 static inline int __init kvmarm_nested_cfg(char *buf)
 {
@@ -342,8 +452,13 @@ static inline bool nested_virt_in_use(struct kvm_vcpu *vcpu)
 	return false;
 }
 
-static inline char *kvm_guest_state(struct kvm_vcpu *vcpu)
+static inline bool kvm_arm_nested_irq_pending(struct kvm_vcpu *vcpu)
+{
+	return false;
+}
+
+static inline int kvm_guest_ctxt(struct kvm_vcpu *vcpu)
 {
-	return "";
+	return KVM_GUEST_CTXT_NONE;
 }
 #endif /* __ARM_KVM_HOST_H__ */
@@ -47,6 +47,8 @@ void free_hyp_pgds(void);
 void stage2_unmap_vm(struct kvm *kvm);
 int kvm_alloc_stage2_pgd(struct kvm *kvm);
 void kvm_free_stage2_pgd(struct kvm *kvm);
+void kvm_s2_pool_init(struct kvm *kvm);
+void kvm_s2_pool_destroy(struct kvm *kvm);
 int kvm_phys_addr_ioremap(struct kvm *kvm, phys_addr_t guest_ipa,
 			  phys_addr_t pa, unsigned long size, bool writable);
 
@@ -103,6 +105,27 @@ static inline bool kvm_s2pmd_readonly(pmd_t *pmd)
 	return (pmd_val(*pmd) & L_PMD_S2_RDWR) == L_PMD_S2_RDONLY;
 }
 
+/* No hardware dirty bit management on 32bit */
+static inline bool kvm_stage2_has_dbm(void)
+{
+	return false;
+}
+
+static inline pte_t kvm_s2pte_mkdbm(pte_t pte)
+{
+	return pte;
+}
+
+static inline void kvm_set_s2pte_clean(pte_t *pte)
+{
+	kvm_set_s2pte_readonly(pte);
+}
+
+static inline bool kvm_s2pte_dbm_dirty(pte_t *pte)
+{
+	return false;
+}
+
 static inline bool kvm_page_empty(void *ptr)
 {
 	struct page *ptr_page = virt_to_page(ptr);
@@ -244,11 +267,20 @@ static inline int kvm_s2_handle_perm_fault(struct kvm_vcpu *vcpu,
 	return 0;
 }
 
+static inline void kvm_nested_s2_init(struct kvm *kvm) { }
+static inline void kvm_nested_s2_prefault(struct kvm_vcpu *vcpu) { }
+long kvm_s2_prefault(struct kvm_vcpu *vcpu, struct kvm_s2_mmu *mmu,
+		     phys_addr_t l2_ipa, struct kvm_s2_trans *trans);
+static inline void kvm_nested_s2_track_map(struct kvm *kvm,
+					   struct kvm_s2_mmu *mmu,
+					   phys_addr_t ipa,
+					   phys_addr_t size) { }
 static inline void kvm_nested_s2_unmap(struct kvm_vcpu *vcpu) { }
 static inline void kvm_nested_s2_free(struct kvm *kvm) { }
 static inline void kvm_nested_s2_wp(struct kvm *kvm) { }
 static inline void kvm_nested_s2_clear(struct kvm *kvm) { }
 static inline void kvm_nested_s2_flush(struct kvm *kvm) { }
+static inline void kvm_nested_s2_flush_tlbs(struct kvm *kvm) { }
 static inline int kvm_nested_mmio_ondemand(struct kvm_vcpu *vcpu,
 					   phys_addr_t fault_ipa,
 					   phys_addr_t ipa) { return 0; }
@@ -32,12 +32,28 @@
 #define VCPU_STAT(x) { #x, offsetof(struct kvm_vcpu, stat.x), KVM_STAT_VCPU }
 
 struct kvm_stats_debugfs_item debugfs_entries[] = {
+	VCPU_STAT(halt_successful_poll),
+	VCPU_STAT(halt_attempted_poll),
+	VCPU_STAT(halt_poll_invalid),
+	VCPU_STAT(halt_poll_success_ns),
+	VCPU_STAT(halt_poll_fail_ns),
+	VCPU_STAT(halt_wakeup),
 	VCPU_STAT(hvc_exit_stat),
 	VCPU_STAT(wfe_exit_stat),
 	VCPU_STAT(wfi_exit_stat),
 	VCPU_STAT(mmio_exit_user),
 	VCPU_STAT(mmio_exit_kernel),
 	VCPU_STAT(exits),
+	VCPU_STAT(vgic_lr_underflow),
+	VCPU_STAT(timer_irq),
+	VCPU_STAT(mmu_lock_read_contended),
+	VCPU_STAT(mmu_lock_read_wait_ns),
+	VCPU_STAT(ap_list_lock_contended),
+	VCPU_STAT(ap_list_lock_wait_ns),
+	VCPU_STAT(irq_lock_contended),
+	VCPU_STAT(irq_lock_wait_ns),
+	VM_STAT(mmu_lock_contended),
+	VM_STAT(mmu_lock_wait_ns),
 	{ NULL }
 };
 
@@ -352,3 +368,15 @@ int kvm_arm_vcpu_arch_has_attr(struct kvm_vcpu *vcpu,
 
 	return ret;
 }
+
+long kvm_arm_vcpu_arch_ioctl(struct kvm_vcpu *vcpu, unsigned int ioctl,
+			     void __user *argp)
+{
+	return -EINVAL;
+}
+
+long kvm_arm_vm_arch_ioctl(struct kvm *kvm, unsigned int ioctl,
+			   void __user *argp)
+{
+	return -EINVAL;
+}
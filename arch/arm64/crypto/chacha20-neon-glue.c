@@ -20,12 +20,18 @@
 
 #include <crypto/algapi.h>
 #include <crypto/chacha20.h>
+#include <crypto/internal/aead.h>
 #include <crypto/internal/skcipher.h>
+#include <crypto/poly1305.h>
+#include <crypto/scatterwalk.h>
 #include <linux/kernel.h>
 #include <linux/module.h>
 
 #include <asm/hwcap.h>
 #include <asm/neon.h>
+#include <asm/unaligned.h>
+
+#include "poly1305-arm64.h"
 
 asmlinkage void chacha20_block_xor_neon(u32 *state, u8 *dst, const u8 *src);
 asmlinkage void chacha20_4block_xor_neon(u32 *state, u8 *dst, const u8 *src);
@@ -105,16 +111,295 @@ static struct skcipher_alg alg = {
 	.decrypt		= chacha20_neon,
 };
 
+/*
+ * RFC7539 ChaCha20-Poly1305, in a single pass over the data: each chunk
+ * of the walk is MAC'ed right before it is decrypted, or right after it
+ * is encrypted, while it is still in the cache.
+ */
+struct chachapoly_ctx {
+	struct chacha20_ctx chacha;
+	u8 salt[4];
+	unsigned int saltlen;
+};
+
+static int chachapoly_setkey(struct crypto_aead *tfm, const u8 *key,
+			     unsigned int keylen)
+{
+	struct chachapoly_ctx *ctx = crypto_aead_ctx(tfm);
+	int i;
+
+	if (keylen != CHACHA20_KEY_SIZE + ctx->saltlen) {
+		crypto_aead_set_flags(tfm, CRYPTO_TFM_RES_BAD_KEY_LEN);
+		return -EINVAL;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(ctx->chacha.key); i++)
+		ctx->chacha.key[i] = get_unaligned_le32(key + i * sizeof(u32));
+	memcpy(ctx->salt, key + CHACHA20_KEY_SIZE, ctx->saltlen);
+
+	return 0;
+}
+
+static int chachapoly_setauthsize(struct crypto_aead *tfm,
+				  unsigned int authsize)
+{
+	return authsize == POLY1305_DIGEST_SIZE ? 0 : -EINVAL;
+}
+
+static void chachapoly_update(struct poly1305_arm64_state *st, const u8 *src,
+			      unsigned int len)
+{
+	u8 buf[POLY1305_BLOCK_SIZE] = {};
+
+	poly1305_arm64_blocks(st, src, len / POLY1305_BLOCK_SIZE,
+			      POLY1305_ARM64_HIBIT);
+
+	/* anything but the last chunk is a multiple of the block size */
+	if (len % POLY1305_BLOCK_SIZE) {
+		memcpy(buf, src + round_down(len, POLY1305_BLOCK_SIZE),
+		       len % POLY1305_BLOCK_SIZE);
+		poly1305_arm64_blocks(st, buf, 1, POLY1305_ARM64_HIBIT);
+	}
+}
+
+static void chachapoly_auth_ad(struct aead_request *req,
+			       struct poly1305_arm64_state *st,
+			       unsigned int assoclen)
+{
+	u8 buf[POLY1305_BLOCK_SIZE];
+	struct scatter_walk walk;
+	unsigned int len = assoclen;
+	int buf_count = 0;
+
+	if (!len)
+		return;
+
+	scatterwalk_start(&walk, req->src);
+
+	do {
+		u32 seg = scatterwalk_clamp(&walk, len);
+		u32 n;
+		u8 *p, *q;
+
+		if (!seg) {
+			scatterwalk_start(&walk, sg_next(walk.sg));
+			seg = scatterwalk_clamp(&walk, len);
+		}
+		p = q = scatterwalk_map(&walk);
+		n = seg;
+		len -= seg;
+
+		if (buf_count) {
+			int l = min_t(int, n, POLY1305_BLOCK_SIZE - buf_count);
+
+			memcpy(&buf[buf_count], q, l);
+			buf_count += l;
+			q += l;
+			n -= l;
+
+			if (buf_count == POLY1305_BLOCK_SIZE) {
+				poly1305_arm64_blocks(st, buf, 1,
+						      POLY1305_ARM64_HIBIT);
+				buf_count = 0;
+			}
+		}
+		if (n >= POLY1305_BLOCK_SIZE) {
+			poly1305_arm64_blocks(st, q, n / POLY1305_BLOCK_SIZE,
+					      POLY1305_ARM64_HIBIT);
+			q += round_down(n, POLY1305_BLOCK_SIZE);
+			n %= POLY1305_BLOCK_SIZE;
+		}
+		if (n) {
+			memcpy(buf, q, n);
+			buf_count = n;
+		}
+
+		scatterwalk_unmap(p);
+		scatterwalk_advance(&walk, seg);
+		scatterwalk_done(&walk, 0, len);
+	} while (len);
+
+	/* the AD is zero padded to a whole block */
+	if (buf_count) {
+		memset(&buf[buf_count], 0, POLY1305_BLOCK_SIZE - buf_count);
+		poly1305_arm64_blocks(st, buf, 1, POLY1305_ARM64_HIBIT);
+	}
+}
+
+static int chachapoly_crypt(struct aead_request *req, u8 *tag, bool enc)
+{
+	struct crypto_aead *tfm = crypto_aead_reqtfm(req);
+	struct chachapoly_ctx *ctx = crypto_aead_ctx(tfm);
+	unsigned int assoclen = req->assoclen;
+	struct poly1305_arm64_state st;
+	struct skcipher_walk walk;
+	u8 key[CHACHA20_BLOCK_SIZE] = {};
+	u8 iv[CHACHA20_IV_SIZE];
+	__le64 lens[2];
+	u32 state[16];
+	int err;
+
+	/* the rfc7539esp IV is at the end of the AD, but not part of it */
+	if (ctx->saltlen) {
+		if (assoclen < 8)
+			return -EINVAL;
+		assoclen -= 8;
+	}
+
+	put_unaligned_le32(0, iv);
+	memcpy(iv + 4, ctx->salt, ctx->saltlen);
+	memcpy(iv + 4 + ctx->saltlen, req->iv, crypto_aead_ivsize(tfm));
+
+	crypto_chacha20_init(state, &ctx->chacha, iv);
+
+	/* the one-time Poly1305 key is the first 32 bytes of block 0 */
+	kernel_neon_begin();
+	chacha20_block_xor_neon(state, key, key);
+	kernel_neon_end();
+	state[12]++;
+
+	poly1305_arm64_init(&st, key);
+	chachapoly_auth_ad(req, &st, assoclen);
+
+	if (enc)
+		err = skcipher_walk_aead_encrypt(&walk, req, true);
+	else
+		err = skcipher_walk_aead_decrypt(&walk, req, true);
+
+	kernel_neon_begin();
+	while (walk.nbytes > 0) {
+		unsigned int nbytes = walk.nbytes;
+
+		if (nbytes < walk.total)
+			nbytes = round_down(nbytes, walk.stride);
+
+		if (!enc)
+			chachapoly_update(&st, walk.src.virt.addr, nbytes);
+		chacha20_doneon(state, walk.dst.virt.addr, walk.src.virt.addr,
+				nbytes);
+		if (enc)
+			chachapoly_update(&st, walk.dst.virt.addr, nbytes);
+
+		err = skcipher_walk_done(&walk, walk.nbytes - nbytes);
+	}
+	kernel_neon_end();
+
+	if (err)
+		return err;
+
+	lens[0] = cpu_to_le64(assoclen);
+	lens[1] = cpu_to_le64(enc ? req->cryptlen
+				  : req->cryptlen - POLY1305_DIGEST_SIZE);
+	poly1305_arm64_blocks(&st, (u8 *)lens, 1, POLY1305_ARM64_HIBIT);
+	poly1305_arm64_emit(&st, tag, key + POLY1305_BLOCK_SIZE);
+
+	memzero_explicit(key, sizeof(key));
+	memzero_explicit(state, sizeof(state));
+
+	return 0;
+}
+
+static int chachapoly_encrypt(struct aead_request *req)
+{
+	u8 tag[POLY1305_DIGEST_SIZE];
+	int err;
+
+	err = chachapoly_crypt(req, tag, true);
+	if (err)
+		return err;
+
+	/* copy authtag to end of dst */
+	scatterwalk_map_and_copy(tag, req->dst, req->assoclen + req->cryptlen,
+				 POLY1305_DIGEST_SIZE, 1);
+
+	return 0;
+}
+
+static int chachapoly_decrypt(struct aead_request *req)
+{
+	unsigned int cryptlen = req->cryptlen - POLY1305_DIGEST_SIZE;
+	u8 tag[POLY1305_DIGEST_SIZE];
+	u8 otag[POLY1305_DIGEST_SIZE];
+	int err;
+
+	if (req->cryptlen < POLY1305_DIGEST_SIZE)
+		return -EINVAL;
+
+	err = chachapoly_crypt(req, tag, false);
+	if (err)
+		return err;
+
+	/* compare calculated auth tag with the stored one */
+	scatterwalk_map_and_copy(otag, req->src, req->assoclen + cryptlen,
+				 POLY1305_DIGEST_SIZE, 0);
+
+	if (crypto_memneq(tag, otag, POLY1305_DIGEST_SIZE))
+		return -EBADMSG;
+
+	return 0;
+}
+
+static int rfc7539esp_init(struct crypto_aead *tfm)
+{
+	struct chachapoly_ctx *ctx = crypto_aead_ctx(tfm);
+
+	ctx->saltlen = sizeof(ctx->salt);
+	return 0;
+}
+
+static struct aead_alg aead_algs[] = { {
+	.base.cra_name		= "rfc7539(chacha20,poly1305)",
+	.base.cra_driver_name	= "rfc7539-chacha20-poly1305-neon",
+	.base.cra_priority	= 300,
+	.base.cra_blocksize	= 1,
+	.base.cra_ctxsize	= sizeof(struct chachapoly_ctx),
+	.base.cra_module	= THIS_MODULE,
+
+	.ivsize			= CHACHA20_IV_SIZE - 4,
+	.chunksize		= CHACHA20_BLOCK_SIZE,
+	.maxauthsize		= POLY1305_DIGEST_SIZE,
+	.setkey			= chachapoly_setkey,
+	.setauthsize		= chachapoly_setauthsize,
+	.encrypt		= chachapoly_encrypt,
+	.decrypt		= chachapoly_decrypt,
+}, {
+	.base.cra_name		= "rfc7539esp(chacha20,poly1305)",
+	.base.cra_driver_name	= "rfc7539esp-chacha20-poly1305-neon",
+	.base.cra_priority	= 300,
+	.base.cra_blocksize	= 1,
+	.base.cra_ctxsize	= sizeof(struct chachapoly_ctx),
+	.base.cra_module	= THIS_MODULE,
+
+	.ivsize			= 8,
+	.chunksize		= CHACHA20_BLOCK_SIZE,
+	.maxauthsize		= POLY1305_DIGEST_SIZE,
+	.init			= rfc7539esp_init,
+	.setkey			= chachapoly_setkey,
+	.setauthsize		= chachapoly_setauthsize,
+	.encrypt		= chachapoly_encrypt,
+	.decrypt		= chachapoly_decrypt,
+} };
+
 static int __init chacha20_simd_mod_init(void)
 {
+	int err;
+
 	if (!(elf_hwcap & HWCAP_ASIMD))
 		return -ENODEV;
 
-	return crypto_register_skcipher(&alg);
+	err = crypto_register_skcipher(&alg);
+	if (err)
+		return err;
+
+	err = crypto_register_aeads(aead_algs, ARRAY_SIZE(aead_algs));
+	if (err)
+		crypto_unregister_skcipher(&alg);
+	return err;
 }
 
 static void __exit chacha20_simd_mod_fini(void)
 {
+	crypto_unregister_aeads(aead_algs, ARRAY_SIZE(aead_algs));
 	crypto_unregister_skcipher(&alg);
 }
 
@@ -124,3 +409,5 @@ module_exit(chacha20_simd_mod_fini);
 MODULE_AUTHOR("Ard Biesheuvel <ard.biesheuvel@linaro.org>");
 MODULE_LICENSE("GPL v2");
 MODULE_ALIAS_CRYPTO("chacha20");
+MODULE_ALIAS_CRYPTO("rfc7539(chacha20,poly1305)");
+MODULE_ALIAS_CRYPTO("rfc7539esp(chacha20,poly1305)");
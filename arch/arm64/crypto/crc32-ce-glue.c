@@ -17,6 +17,7 @@
 
 #include <crypto/internal/hash.h>
 
+#include <asm/crc32.h>
 #include <asm/hwcap.h>
 #include <asm/neon.h>
 #include <asm/unaligned.h>
@@ -24,6 +25,9 @@
 #define PMULL_MIN_LEN		64L	/* minimum size of buffer
 					 * for crc32_pmull_le_16 */
 #define SCALE_F			16L	/* size of NEON register */
+#define PMULL_CRC32_MIN_LEN	1024L	/* below this, the CRC32
+					 * instructions are faster than
+					 * saving the NEON state */
 
 asmlinkage u32 crc32_pmull_le(const u8 buf[], u64 len, u32 init_crc);
 asmlinkage u32 crc32_armv8_le(u32 init_crc, const u8 buf[], size_t len);
@@ -34,6 +38,61 @@ asmlinkage u32 crc32c_armv8_le(u32 init_crc, const u8 buf[], size_t len);
 static u32 (*fallback_crc32)(u32 init_crc, const u8 buf[], size_t len);
 static u32 (*fallback_crc32c)(u32 init_crc, const u8 buf[], size_t len);
 
+/* SIZE_MAX without PMULL */
+static size_t pmull_min_len = SIZE_MAX;
+
+static u32 crc32_adaptive(u32 crc, const u8 *data, size_t length,
+			  u32 (*pmull)(const u8 buf[], u64 len, u32 init_crc),
+			  u32 (*fallback)(u32 init_crc, const u8 buf[],
+					  size_t len))
+{
+	size_t l;
+
+	if (length < pmull_min_len)
+		return fallback(crc, data, length);
+
+	if ((u64)data % SCALE_F) {
+		l = SCALE_F - ((u64)data % SCALE_F);
+
+		crc = fallback(crc, data, l);
+
+		data += l;
+		length -= l;
+	}
+
+	if (length >= PMULL_MIN_LEN) {
+		l = round_down(length, SCALE_F);
+
+		kernel_neon_begin_partial(18);
+		crc = pmull(data, l, crc);
+		kernel_neon_end();
+
+		data += l;
+		length -= l;
+	}
+
+	if (length > 0)
+		crc = fallback(crc, data, length);
+
+	return crc;
+}
+
+/**
+ * crc32c_arm64_le - CRC32C of a buffer, without going through the crypto API
+ * @crc: seed, as for __crc32c_le()
+ * @data: buffer
+ * @length: size of the buffer
+ *
+ * Uses the CRC32 instructions for small buffers, and PMULL folding for
+ * large ones.
+ */
+u32 crc32c_arm64_le(u32 crc, const u8 *data, size_t length)
+{
+	return crc32_adaptive(crc, data, length, crc32c_pmull_le,
+			      fallback_crc32c);
+}
+EXPORT_SYMBOL_GPL(crc32c_arm64_le);
+
 static int crc32_pmull_cra_init(struct crypto_tfm *tfm)
 {
 	u32 *key = crypto_tfm_ctx(tfm);
@@ -91,67 +150,21 @@ static int crc32c_update(struct shash_desc *desc, const u8 *data,
 }
 
 static int crc32_pmull_update(struct shash_desc *desc, const u8 *data,
-			 unsigned int length)
+			      unsigned int length)
 {
 	u32 *crc = shash_desc_ctx(desc);
-	unsigned int l;
-
-	if ((u64)data % SCALE_F) {
-		l = min_t(u32, length, SCALE_F - ((u64)data % SCALE_F));
-
-		*crc = fallback_crc32(*crc, data, l);
-
-		data += l;
-		length -= l;
-	}
-
-	if (length >= PMULL_MIN_LEN) {
-		l = round_down(length, SCALE_F);
-
-		kernel_neon_begin_partial(10);
-		*crc = crc32_pmull_le(data, l, *crc);
-		kernel_neon_end();
-
-		data += l;
-		length -= l;
-	}
-
-	if (length > 0)
-		*crc = fallback_crc32(*crc, data, length);
 
+	*crc = crc32_adaptive(*crc, data, length, crc32_pmull_le,
+			      fallback_crc32);
 	return 0;
 }
 
 static int crc32c_pmull_update(struct shash_desc *desc, const u8 *data,
-			 unsigned int length)
+			       unsigned int length)
 {
 	u32 *crc = shash_desc_ctx(desc);
-	unsigned int l;
-
-	if ((u64)data % SCALE_F) {
-		l = min_t(u32, length, SCALE_F - ((u64)data % SCALE_F));
-
-		*crc = fallback_crc32c(*crc, data, l);
-
-		data += l;
-		length -= l;
-	}
-
-	if (length >= PMULL_MIN_LEN) {
-		l = round_down(length, SCALE_F);
-
-		kernel_neon_begin_partial(10);
-		*crc = crc32c_pmull_le(data, l, *crc);
-		kernel_neon_end();
-
-		data += l;
-		length -= l;
-	}
-
-	if (length > 0) {
-		*crc = fallback_crc32c(*crc, data, length);
-	}
 
+	*crc = crc32c_arm64_le(*crc, data, length);
 	return 0;
 }
 
@@ -205,17 +218,20 @@ static struct shash_alg crc32_pmull_algs[] = { {
 
 static int __init crc32_pmull_mod_init(void)
 {
+	if (elf_hwcap & HWCAP_CRC32) {
+		fallback_crc32 = crc32_armv8_le;
+		fallback_crc32c = crc32c_armv8_le;
+	} else {
+		fallback_crc32 = crc32_le;
+		fallback_crc32c = __crc32c_le;
+	}
+
 	if (IS_ENABLED(CONFIG_KERNEL_MODE_NEON) && (elf_hwcap & HWCAP_PMULL)) {
 		crc32_pmull_algs[0].update = crc32_pmull_update;
 		crc32_pmull_algs[1].update = crc32c_pmull_update;
 
-		if (elf_hwcap & HWCAP_CRC32) {
-			fallback_crc32 = crc32_armv8_le;
-			fallback_crc32c = crc32c_armv8_le;
-		} else {
-			fallback_crc32 = crc32_le;
-			fallback_crc32c = __crc32c_le;
-		}
+		pmull_min_len = (elf_hwcap & HWCAP_CRC32) ? PMULL_CRC32_MIN_LEN
+							  : PMULL_MIN_LEN;
 	} else if (!(elf_hwcap & HWCAP_CRC32)) {
 		return -ENODEV;
 	}
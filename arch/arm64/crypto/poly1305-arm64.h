@@ -0,0 +1,35 @@
+/*
+ * Poly1305 authenticator, arm64 scalar implementation
+ *
+ * Copyright (C) 2017 - Linaro Ltd
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef __ASM_POLY1305_ARM64_H
+#define __ASM_POLY1305_ARM64_H
+
+#include <linux/types.h>
+
+/*
+ * The accumulator and the clamped key are kept in radix 2^44 (44/44/42
+ * bits), so that a block only takes nine 64x64->128 bit multiplications.
+ */
+struct poly1305_arm64_state {
+	u64 r[3];
+	u64 s[2];	/* r[1] * 20 and r[2] * 20, for the reduction */
+	u64 h[3];
+};
+
+void poly1305_arm64_init(struct poly1305_arm64_state *st, const u8 *key);
+void poly1305_arm64_blocks(struct poly1305_arm64_state *st, const u8 *src,
+			   unsigned int blocks, u64 hibit);
+void poly1305_arm64_emit(const struct poly1305_arm64_state *st, u8 *mac,
+			 const u8 *nonce);
+
+/* hibit value for full 16 byte blocks, i.e. 2^128 in the top limb */
+#define POLY1305_ARM64_HIBIT	(1ULL << 40)
+
+#endif
@@ -0,0 +1,270 @@
+/*
+ * Poly1305 authenticator, arm64 scalar implementation
+ *
+ * Copyright (C) 2017 - Linaro Ltd
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <crypto/internal/hash.h>
+#include <crypto/poly1305.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/string.h>
+
+#include <asm/unaligned.h>
+
+#include "poly1305-arm64.h"
+
+/*
+ * The generic code works in radix 2^26, which is what a 32x32->64 bit
+ * multiplier wants. With 64 bit registers and UMULH, radix 2^44 halves
+ * the number of multiplications per block, and needs no SIMD registers:
+ * those are left to the cipher, when used from the ChaCha20-Poly1305
+ * AEAD.
+ */
+
+typedef unsigned __int128 u128;
+
+#define MASK44	((1ULL << 44) - 1)
+#define MASK42	((1ULL << 42) - 1)
+
+void poly1305_arm64_init(struct poly1305_arm64_state *st, const u8 *key)
+{
+	u64 t0 = get_unaligned_le64(key);
+	u64 t1 = get_unaligned_le64(key + 8);
+
+	/* r &= 0xffffffc0ffffffc0ffffffc0fffffff */
+	st->r[0] = t0 & 0xffc0fffffffULL;
+	st->r[1] = ((t0 >> 44) | (t1 << 20)) & 0xfffffc0ffffULL;
+	st->r[2] = (t1 >> 24) & 0x00ffffffc0fULL;
+
+	st->s[0] = st->r[1] * 20;
+	st->s[1] = st->r[2] * 20;
+
+	st->h[0] = st->h[1] = st->h[2] = 0;
+}
+EXPORT_SYMBOL_GPL(poly1305_arm64_init);
+
+void poly1305_arm64_blocks(struct poly1305_arm64_state *st, const u8 *src,
+			   unsigned int blocks, u64 hibit)
+{
+	u64 r0 = st->r[0], r1 = st->r[1], r2 = st->r[2];
+	u64 s1 = st->s[0], s2 = st->s[1];
+	u64 h0 = st->h[0], h1 = st->h[1], h2 = st->h[2];
+	u128 d0, d1, d2;
+	u64 t0, t1, c;
+
+	while (blocks--) {
+		t0 = get_unaligned_le64(src);
+		t1 = get_unaligned_le64(src + 8);
+
+		/* h += m */
+		h0 += t0 & MASK44;
+		h1 += ((t0 >> 44) | (t1 << 20)) & MASK44;
+		h2 += ((t1 >> 24) & MASK42) | hibit;
+
+		/* h *= r, with 2^130 == 5 folded into s1 and s2 */
+		d0 = (u128)h0 * r0 + (u128)h1 * s2 + (u128)h2 * s1;
+		d1 = (u128)h0 * r1 + (u128)h1 * r0 + (u128)h2 * s2;
+		d2 = (u128)h0 * r2 + (u128)h1 * r1 + (u128)h2 * r0;
+
+		/* partial reduction mod 2^130 - 5 */
+		c = (u64)(d0 >> 44);
+		h0 = (u64)d0 & MASK44;
+		d1 += c;
+		c = (u64)(d1 >> 44);
+		h1 = (u64)d1 & MASK44;
+		d2 += c;
+		c = (u64)(d2 >> 42);
+		h2 = (u64)d2 & MASK42;
+		h0 += c * 5;
+		c = h0 >> 44;
+		h0 &= MASK44;
+		h1 += c;
+
+		src += POLY1305_BLOCK_SIZE;
+	}
+
+	st->h[0] = h0;
+	st->h[1] = h1;
+	st->h[2] = h2;
+}
+EXPORT_SYMBOL_GPL(poly1305_arm64_blocks);
+
+void poly1305_arm64_emit(const struct poly1305_arm64_state *st, u8 *mac,
+			 const u8 *nonce)
+{
+	u64 h0 = st->h[0], h1 = st->h[1], h2 = st->h[2];
+	u64 g0, g1, g2, c, t0, t1;
+
+	/* fully carry h */
+	c = h1 >> 44; h1 &= MASK44;
+	h2 += c;      c = h2 >> 42; h2 &= MASK42;
+	h0 += c * 5;  c = h0 >> 44; h0 &= MASK44;
+	h1 += c;      c = h1 >> 44; h1 &= MASK44;
+	h2 += c;      c = h2 >> 42; h2 &= MASK42;
+	h0 += c * 5;  c = h0 >> 44; h0 &= MASK44;
+	h1 += c;
+
+	/* compute h + -p */
+	g0 = h0 + 5;      c = g0 >> 44; g0 &= MASK44;
+	g1 = h1 + c;      c = g1 >> 44; g1 &= MASK44;
+	g2 = h2 + c - (1ULL << 42);
+
+	/* select h if h < p, or h + -p if h >= p */
+	c = (g2 >> 63) - 1;
+	g0 &= c;
+	g1 &= c;
+	g2 &= c;
+	c = ~c;
+	h0 = (h0 & c) | g0;
+	h1 = (h1 & c) | g1;
+	h2 = (h2 & c) | g2;
+
+	/* mac = (h + s) % (2^128) */
+	t0 = get_unaligned_le64(nonce);
+	t1 = get_unaligned_le64(nonce + 8);
+
+	h0 += t0 & MASK44;                              c = h0 >> 44; h0 &= MASK44;
+	h1 += (((t0 >> 44) | (t1 << 20)) & MASK44) + c; c = h1 >> 44; h1 &= MASK44;
+	h2 += ((t1 >> 24) & MASK42) + c;
+
+	put_unaligned_le64(h0 | (h1 << 44), mac);
+	put_unaligned_le64((h1 >> 20) | (h2 << 24), mac + 8);
+}
+EXPORT_SYMBOL_GPL(poly1305_arm64_emit);
+
+struct poly1305_arm64_desc_ctx {
+	struct poly1305_arm64_state st;
+	u8 s[POLY1305_BLOCK_SIZE];
+	u8 buf[POLY1305_BLOCK_SIZE];
+	unsigned int buflen;
+	bool rset;
+	bool sset;
+};
+
+static int poly1305_arm64_desc_init(struct shash_desc *desc)
+{
+	struct poly1305_arm64_desc_ctx *dctx = shash_desc_ctx(desc);
+
+	dctx->buflen = 0;
+	dctx->rset = false;
+	dctx->sset = false;
+
+	return 0;
+}
+
+/*
+ * As with the generic code, the key is passed as the first 32 bytes of
+ * the data. Returns the number of bytes left over, less than a block.
+ */
+static unsigned int poly1305_arm64_do_update(struct poly1305_arm64_desc_ctx *dctx,
+					     const u8 *src, unsigned int srclen)
+{
+	if (!dctx->rset) {
+		poly1305_arm64_init(&dctx->st, src);
+		src += POLY1305_BLOCK_SIZE;
+		srclen -= POLY1305_BLOCK_SIZE;
+		dctx->rset = true;
+	}
+	if (!dctx->sset && srclen >= POLY1305_BLOCK_SIZE) {
+		memcpy(dctx->s, src, POLY1305_BLOCK_SIZE);
+		src += POLY1305_BLOCK_SIZE;
+		srclen -= POLY1305_BLOCK_SIZE;
+		dctx->sset = true;
+	}
+
+	poly1305_arm64_blocks(&dctx->st, src, srclen / POLY1305_BLOCK_SIZE,
+			      POLY1305_ARM64_HIBIT);
+
+	return srclen % POLY1305_BLOCK_SIZE;
+}
+
+static int poly1305_arm64_update(struct shash_desc *desc,
+				 const u8 *src, unsigned int srclen)
+{
+	struct poly1305_arm64_desc_ctx *dctx = shash_desc_ctx(desc);
+	unsigned int bytes;
+
+	if (unlikely(dctx->buflen)) {
+		bytes = min(srclen, POLY1305_BLOCK_SIZE - dctx->buflen);
+		memcpy(dctx->buf + dctx->buflen, src, bytes);
+		src += bytes;
+		srclen -= bytes;
+		dctx->buflen += bytes;
+
+		if (dctx->buflen == POLY1305_BLOCK_SIZE) {
+			poly1305_arm64_do_update(dctx, dctx->buf,
+						 POLY1305_BLOCK_SIZE);
+			dctx->buflen = 0;
+		}
+	}
+
+	if (likely(srclen >= POLY1305_BLOCK_SIZE)) {
+		bytes = poly1305_arm64_do_update(dctx, src, srclen);
+		src += srclen - bytes;
+		srclen = bytes;
+	}
+
+	if (unlikely(srclen)) {
+		dctx->buflen = srclen;
+		memcpy(dctx->buf, src, srclen);
+	}
+
+	return 0;
+}
+
+static int poly1305_arm64_final(struct shash_desc *desc, u8 *dst)
+{
+	struct poly1305_arm64_desc_ctx *dctx = shash_desc_ctx(desc);
+
+	if (unlikely(!dctx->sset))
+		return -ENOKEY;
+
+	if (unlikely(dctx->buflen)) {
+		dctx->buf[dctx->buflen++] = 1;
+		memset(dctx->buf + dctx->buflen, 0,
+		       POLY1305_BLOCK_SIZE - dctx->buflen);
+		poly1305_arm64_blocks(&dctx->st, dctx->buf, 1, 0);
+	}
+
+	poly1305_arm64_emit(&dctx->st, dst, dctx->s);
+
+	return 0;
+}
+
+static struct shash_alg alg = {
+	.digestsize		= POLY1305_DIGEST_SIZE,
+	.init			= poly1305_arm64_desc_init,
+	.update			= poly1305_arm64_update,
+	.final			= poly1305_arm64_final,
+	.setkey			= crypto_poly1305_setkey,
+	.descsize		= sizeof(struct poly1305_arm64_desc_ctx),
+	.base.cra_name		= "poly1305",
+	.base.cra_driver_name	= "poly1305-arm64",
+	.base.cra_priority	= 200,
+	.base.cra_flags		= CRYPTO_ALG_TYPE_SHASH,
+	.base.cra_blocksize	= POLY1305_BLOCK_SIZE,
+	.base.cra_module	= THIS_MODULE,
+};
+
+static int __init poly1305_arm64_mod_init(void)
+{
+	return crypto_register_shash(&alg);
+}
+
+static void __exit poly1305_arm64_mod_exit(void)
+{
+	crypto_unregister_shash(&alg);
+}
+
+module_init(poly1305_arm64_mod_init);
+module_exit(poly1305_arm64_mod_exit);
+
+MODULE_DESCRIPTION("Poly1305 authenticator, arm64 scalar implementation");
+MODULE_LICENSE("GPL v2");
+MODULE_ALIAS_CRYPTO("poly1305");
+MODULE_ALIAS_CRYPTO("poly1305-arm64");
@@ -32,6 +32,9 @@ struct sha256_ce_state {
 asmlinkage void sha2_ce_transform(struct sha256_ce_state *sst, u8 const *src,
 				  int blocks);
 
+asmlinkage void sha2_ce_transform2x(u32 *state1, u32 *state2, u8 const *src1,
+				    u8 const *src2, int blocks);
+
 static int sha256_ce_update(struct shash_desc *desc, const u8 *data,
 			    unsigned int len)
 {
@@ -84,12 +87,94 @@ static int sha256_ce_final(struct shash_desc *desc, u8 *out)
 	return sha256_base_finish(desc, out);
 }
 
+/*
+ * Finish two messages of the same length from a common state, e.g. a salt,
+ * as used by dm-verity. Both streams go through the same number of blocks,
+ * so the padding and the bit count can be worked out once, in C, and the
+ * asm only has to interleave the block transforms.
+ */
+static int sha256_ce_finup_mb(struct shash_desc *desc, const u8 * const data[],
+			      unsigned int len, u8 * const outs[],
+			      unsigned int num_msgs)
+{
+	struct sha256_ce_state *sctx = shash_desc_ctx(desc);
+	unsigned int digestsize = crypto_shash_digestsize(desc->tfm);
+	unsigned int partial = sctx->sst.count % SHA256_BLOCK_SIZE;
+	u64 bits = (sctx->sst.count + len) << 3;
+	u8 buf[2][2 * SHA256_BLOCK_SIZE];
+	const u8 *src[2] = { data[0], data[1] };
+	u32 state[2][8];
+	unsigned int blocks;
+	int i, j;
+
+	if (num_msgs != 2)
+		return -EOPNOTSUPP;
+
+	for (i = 0; i < 2; i++) {
+		memcpy(state[i], sctx->sst.state, sizeof(state[i]));
+		memcpy(buf[i], sctx->sst.buf, partial);
+	}
+
+	kernel_neon_begin_partial(28);
+
+	/* complete the pending partial block, if any */
+	if (partial) {
+		unsigned int n = min(len, SHA256_BLOCK_SIZE - partial);
+
+		for (i = 0; i < 2; i++) {
+			memcpy(buf[i] + partial, src[i], n);
+			src[i] += n;
+		}
+		len -= n;
+		partial += n;
+
+		if (partial == SHA256_BLOCK_SIZE) {
+			sha2_ce_transform2x(state[0], state[1], buf[0], buf[1],
+					    1);
+			partial = 0;
+		}
+	}
+
+	blocks = len / SHA256_BLOCK_SIZE;
+	if (blocks) {
+		sha2_ce_transform2x(state[0], state[1], src[0], src[1],
+				    blocks);
+		src[0] += blocks * SHA256_BLOCK_SIZE;
+		src[1] += blocks * SHA256_BLOCK_SIZE;
+		len %= SHA256_BLOCK_SIZE;
+	}
+
+	/* the tail, the padding and the bit count, in one or two blocks */
+	for (i = 0; i < 2; i++) {
+		memcpy(buf[i] + partial, src[i], len);
+		buf[i][partial + len] = 0x80;
+		memset(buf[i] + partial + len + 1, 0,
+		       sizeof(buf[i]) - partial - len - 1);
+	}
+	blocks = partial + len < SHA256_BLOCK_SIZE - sizeof(u64) ? 1 : 2;
+	for (i = 0; i < 2; i++)
+		put_unaligned_be64(bits,
+				   buf[i] + blocks * SHA256_BLOCK_SIZE - 8);
+
+	sha2_ce_transform2x(state[0], state[1], buf[0], buf[1], blocks);
+
+	kernel_neon_end();
+
+	for (i = 0; i < 2; i++)
+		for (j = 0; j < digestsize / sizeof(u32); j++)
+			put_unaligned_be32(state[i][j], outs[i] + j * 4);
+
+	return 0;
+}
+
 static struct shash_alg algs[] = { {
 	.init			= sha224_base_init,
 	.update			= sha256_ce_update,
 	.final			= sha256_ce_final,
 	.finup			= sha256_ce_finup,
+	.finup_mb		= sha256_ce_finup_mb,
 	.descsize		= sizeof(struct sha256_ce_state),
+	.mb_max_msgs		= 2,
 	.digestsize		= SHA224_DIGEST_SIZE,
 	.base			= {
 		.cra_name		= "sha224",
@@ -104,7 +189,9 @@ static struct shash_alg algs[] = { {
 	.update			= sha256_ce_update,
 	.final			= sha256_ce_final,
 	.finup			= sha256_ce_finup,
+	.finup_mb		= sha256_ce_finup_mb,
 	.descsize		= sizeof(struct sha256_ce_state),
+	.mb_max_msgs		= 2,
 	.digestsize		= SHA256_DIGEST_SIZE,
 	.base			= {
 		.cra_name		= "sha256",
@@ -209,6 +209,19 @@ alternative_endif
 		_asm_extable	8889b,\l;
 	.endm
 
+	.macro uao_stnp l, reg1, reg2, addr, offset
+		alternative_if_not ARM64_HAS_UAO
+8888:			stnp	\reg1, \reg2, [\addr, \offset];
+8889:			nop;
+		alternative_else
+			sttr	\reg1, [\addr, \offset];
+			sttr	\reg2, [\addr, \offset + 8];
+		alternative_endif
+
+		_asm_extable	8888b,\l;
+		_asm_extable	8889b,\l;
+	.endm
+
 	.macro uao_user_alternative l, inst, alt_inst, reg, addr, post_inc
 		alternative_if_not ARM64_HAS_UAO
 8888:			\inst	\reg, [\addr], \post_inc;
@@ -227,6 +240,9 @@ alternative_endif
 	.macro uao_stp l, reg1, reg2, addr, post_inc
 		USER(\l, stp \reg1, \reg2, [\addr], \post_inc)
 	.endm
+	.macro uao_stnp l, reg1, reg2, addr, offset
+		USER(\l, stnp \reg1, \reg2, [\addr, \offset])
+	.endm
 	.macro uao_user_alternative l, inst, alt_inst, reg, addr, post_inc
 		USER(\l, \inst \reg, [\addr], \post_inc)
 	.endm
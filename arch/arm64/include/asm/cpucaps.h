@@ -40,7 +40,10 @@
 #define ARM64_WORKAROUND_858921			19
 #define ARM64_WORKAROUND_CAVIUM_30115		20
 #define ARM64_HAS_NESTED_VIRT			21
+#define ARM64_HAS_STAGE2_FWB			22
+#define ARM64_HAS_CACHE_DIC			23
+#define ARM64_HAS_NT_USER_COPY			24
 
-#define ARM64_NCAPS				22
+#define ARM64_NCAPS				25
 
 #endif /* __ASM_CPUCAPS_H */
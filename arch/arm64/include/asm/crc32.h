@@ -0,0 +1,17 @@
+/*
+ * Copyright (C) 2017 - Linaro Ltd
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef __ASM_CRC32_H
+#define __ASM_CRC32_H
+
+#include <linux/types.h>
+
+/* Provided by the crc32-ce module (CONFIG_CRYPTO_CRC32_ARM64_CE) */
+u32 crc32c_arm64_le(u32 crc, const u8 *data, size_t length);
+
+#endif /* __ASM_CRC32_H */
@@ -20,12 +20,32 @@
 
 #include <asm-generic/hugetlb.h>
 #include <asm/page.h>
+#include <asm/tlbflush.h>
 
 static inline pte_t huge_ptep_get(pte_t *ptep)
 {
 	return *ptep;
 }
 
+/*
+ * Invalidate one TLB entry per huge page. The contiguous sizes are made
+ * of several last level entries, which each have to be invalidated.
+ */
+#define __HAVE_ARCH_FLUSH_HUGETLB_TLB_RANGE
+static inline void flush_hugetlb_tlb_range(struct vm_area_struct *vma,
+					   unsigned long start,
+					   unsigned long end)
+{
+	unsigned long stride = huge_page_size(hstate_vma(vma));
+
+	if (stride == CONT_PMD_SIZE)
+		stride = PMD_SIZE;
+	else if (stride == CONT_PTE_SIZE)
+		stride = PAGE_SIZE;
+
+	__flush_tlb_range(vma, start, end, stride, false);
+}
+
 
 
 static inline void hugetlb_free_pgd_range(struct mmu_gather *tlb,
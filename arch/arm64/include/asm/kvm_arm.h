@@ -23,6 +23,7 @@
 #include <asm/types.h>
 
 /* Hyp Configuration Register (HCR) bits */
+#define HCR_FWB		(UL(1) << 46)
 #define HCR_AT		(UL(1) << 44)
 #define HCR_NV1		(UL(1) << 43)
 #define HCR_NV		(UL(1) << 42)
@@ -217,17 +218,30 @@
 
 #define kvm_arm_exception_type	\
 	{0, "IRQ" }, 		\
-	{1, "TRAP" }
+	{1, "SERROR" },		\
+	{2, "TRAP" }
+
+/* What the vcpu was running, as recorded by the kvm_entry/exit tracepoints */
+#define KVM_GUEST_CTXT_NONE	0	/* No nested virt */
+#define KVM_GUEST_CTXT_L1_GUEST	1
+#define KVM_GUEST_CTXT_L1_HYP	2
+#define KVM_GUEST_CTXT_L2_GUEST	3
+
+#define kvm_arm_guest_ctxt					\
+	{KVM_GUEST_CTXT_NONE,		"" },			\
+	{KVM_GUEST_CTXT_L1_GUEST,	"L1 Guest" },		\
+	{KVM_GUEST_CTXT_L1_HYP,		"L1 Hypervisor" },	\
+	{KVM_GUEST_CTXT_L2_GUEST,	"L2 Guest" }
 
 #define ECN(x) { ESR_ELx_EC_##x, #x }
 
 #define kvm_arm_exception_class \
 	ECN(UNKNOWN), ECN(WFx), ECN(CP15_32), ECN(CP15_64), ECN(CP14_MR), \
 	ECN(CP14_LS), ECN(FP_ASIMD), ECN(CP10_ID), ECN(CP14_64), ECN(SVC64), \
-	ECN(HVC64), ECN(SMC64), ECN(SYS64), ECN(IMP_DEF), ECN(IABT_LOW), \
-	ECN(IABT_CUR), ECN(PC_ALIGN), ECN(DABT_LOW), ECN(DABT_CUR), \
-	ECN(SP_ALIGN), ECN(FP_EXC32), ECN(FP_EXC64), ECN(SERROR), \
-	ECN(BREAKPT_LOW), ECN(BREAKPT_CUR), ECN(SOFTSTP_LOW), \
+	ECN(HVC64), ECN(SMC64), ECN(SYS64), ECN(ERET), ECN(IMP_DEF), \
+	ECN(IABT_LOW), ECN(IABT_CUR), ECN(PC_ALIGN), ECN(DABT_LOW), \
+	ECN(DABT_CUR), ECN(SP_ALIGN), ECN(FP_EXC32), ECN(FP_EXC64), \
+	ECN(SERROR), ECN(BREAKPT_LOW), ECN(BREAKPT_CUR), ECN(SOFTSTP_LOW), \
 	ECN(SOFTSTP_CUR), ECN(WATCHPT_LOW), ECN(WATCHPT_CUR), \
 	ECN(BKPT32), ECN(VECTOR32), ECN(BRK64)
 
@@ -32,6 +32,14 @@
 
 #define KVM_ARM64_DEBUG_DIRTY_SHIFT	0
 #define KVM_ARM64_DEBUG_DIRTY		(1 << KVM_ARM64_DEBUG_DIRTY_SHIFT)
+#define KVM_ARM64_DEBUG_EXTERNAL_SHIFT	1
+#define KVM_ARM64_DEBUG_EXTERNAL	(1 << KVM_ARM64_DEBUG_EXTERNAL_SHIFT)
+
+/* vcpu->arch.fp_flags */
+#define KVM_ARM64_FP_ENABLED_SHIFT	0
+#define KVM_ARM64_FP_ENABLED		(1 << KVM_ARM64_FP_ENABLED_SHIFT)
+#define KVM_ARM64_FP_HOST_SHIFT		1
+#define KVM_ARM64_FP_HOST		(1 << KVM_ARM64_FP_HOST_SHIFT)
 
 #define kvm_ksym_ref(sym)						\
 	({								\
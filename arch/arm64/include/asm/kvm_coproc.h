@@ -55,4 +55,11 @@ int kvm_arm_sys_reg_get_reg(struct kvm_vcpu *vcpu, const struct kvm_one_reg *);
 int kvm_arm_sys_reg_set_reg(struct kvm_vcpu *vcpu, const struct kvm_one_reg *);
 unsigned long kvm_arm_num_sys_reg_descs(struct kvm_vcpu *vcpu);
 
+struct kvm_arm_nested_reg;
+unsigned int kvm_arm_nested_get_regs(struct kvm_vcpu *vcpu,
+				     struct kvm_arm_nested_reg *regs);
+int kvm_arm_nested_set_regs(struct kvm_vcpu *vcpu,
+			    const struct kvm_arm_nested_reg *regs,
+			    unsigned int nr);
+
 #endif /* __ARM64_KVM_COPROC_H__ */
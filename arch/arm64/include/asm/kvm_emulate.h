@@ -63,11 +63,21 @@ void kvm_arm_init_cpu_context(kvm_cpu_context_t *cpu_ctxt);
 u64 cptr_to_cpacr(u64 cptr_el2);
 u64 cpacr_to_cptr(u64 cpacr_el1);
 
+#ifdef CONFIG_KVM_ARM_NESTED_PV
+void kvm_pv_el2_page_flush(struct kvm_vcpu *vcpu);
+void kvm_pv_el2_page_sync(struct kvm_vcpu *vcpu);
+#else
+static inline void kvm_pv_el2_page_flush(struct kvm_vcpu *vcpu) {}
+static inline void kvm_pv_el2_page_sync(struct kvm_vcpu *vcpu) {}
+#endif
+
 static inline void vcpu_reset_hcr(struct kvm_vcpu *vcpu)
 {
 	vcpu->arch.hcr_el2 = HCR_GUEST_FLAGS;
 	if (is_kernel_in_hyp_mode())
 		vcpu->arch.hcr_el2 |= HCR_E2H;
+	if (cpus_have_const_cap(ARM64_HAS_STAGE2_FWB))
+		vcpu->arch.hcr_el2 |= HCR_FWB;
 	if (test_bit(KVM_ARM_VCPU_EL1_32BIT, vcpu->arch.features))
 		vcpu->arch.hcr_el2 &= ~HCR_RW;
 }
@@ -198,6 +208,21 @@ static inline bool vcpu_el2_e2h_is_set(const struct kvm_vcpu *vcpu)
 	return (vcpu_sys_reg(vcpu, HCR_EL2) & HCR_E2H);
 }
 
+/*
+ * Record that @reg changed behind the shadow EL1 state of the virtual EL2, so
+ * that it is copied again on the next entry to the virtual EL2.
+ */
+static inline void vcpu_shadow_reg_dirty(struct kvm_vcpu *vcpu, int reg)
+{
+	__set_bit(reg, vcpu->arch.shadow_dirty);
+}
+
+/* Rebuild the whole shadow EL1 state on the next entry to the virtual EL2 */
+static inline void vcpu_shadow_invalidate(struct kvm_vcpu *vcpu)
+{
+	vcpu->arch.shadow_valid = false;
+}
+
 static inline bool vcpu_el2_tge_is_set(const struct kvm_vcpu *vcpu)
 {
 	return (vcpu_sys_reg(vcpu, HCR_EL2) & HCR_TGE);
@@ -354,7 +379,8 @@ static inline void kvm_vcpu_set_be(struct kvm_vcpu *vcpu)
 	if (vcpu_mode_is_32bit(vcpu))
 		*vcpu_cpsr(vcpu) |= COMPAT_PSR_E_BIT;
 	else
-		vcpu_sys_reg(vcpu, SCTLR_EL1) |= (1 << 25);
+		vcpu_write_sys_reg(vcpu, vcpu_read_sys_reg(vcpu, SCTLR_EL1) |
+				   (1 << 25), SCTLR_EL1);
 }
 
 static inline bool kvm_vcpu_is_be(struct kvm_vcpu *vcpu)
@@ -362,7 +388,7 @@ static inline bool kvm_vcpu_is_be(struct kvm_vcpu *vcpu)
 	if (vcpu_mode_is_32bit(vcpu))
 		return !!(*vcpu_cpsr(vcpu) & COMPAT_PSR_E_BIT);
 
-	return !!(vcpu_sys_reg(vcpu, SCTLR_EL1) & (1 << 25));
+	return !!(vcpu_read_sys_reg(vcpu, SCTLR_EL1) & (1 << 25));
 }
 
 static inline unsigned long vcpu_data_guest_to_host(struct kvm_vcpu *vcpu,
@@ -23,12 +23,19 @@
 #define __ARM64_KVM_HOST_H__
 
 #include <linux/types.h>
+#include <linux/bitmap.h>
+#include <linux/hashtable.h>
 #include <linux/kvm_types.h>
+#include <linux/workqueue.h>
+#include <asm/esr.h>
 #include <asm/kvm.h>
 #include <asm/kvm_asm.h>
 #include <asm/kvm_mmio.h>
+#include <asm/pvsched-abi.h>
 
 #define __KVM_HAVE_ARCH_INTC_INITIALIZED
+#define KVM_HAVE_MMU_RWLOCK
+#define KVM_HAVE_MMU_LOCK_STAT
 
 #define KVM_USER_MEM_SLOTS 512
 #define KVM_HALT_POLL_NS_DEFAULT 500000
@@ -45,6 +52,17 @@
 	KVM_ARCH_REQ_FLAGS(0, KVM_REQUEST_WAIT | KVM_REQUEST_NO_WAKEUP)
 #define KVM_REQ_IRQ_PENDING	KVM_ARCH_REQ(1)
 
+/*
+ * The guest is not told about the pages being faulted in behind its back, so
+ * the vcpu waits for each of them in turn: a second fault is resolved
+ * synchronously.
+ */
+#define ASYNC_PF_PER_VCPU	1
+
+struct kvm_arch_async_pf {
+	gfn_t gfn;
+};
+
 int __attribute_const__ kvm_target_cpu(void);
 int kvm_reset_vcpu(struct kvm_vcpu *vcpu);
 int kvm_arch_dev_ioctl_check_extension(struct kvm *kvm, long ext);
@@ -63,6 +81,13 @@ struct kvm_s2_mmu {
 	/* 1-level 2nd stage table and lock */
 	spinlock_t pgd_lock;
 	pgd_t *pgd;
+
+	/*
+	 * Set while a large unmap batches the TLB invalidation of its leaf
+	 * entries into a single one for the whole VMID, under kvm->mmu_lock.
+	 */
+	bool tlb_flush_deferred;
+	bool tlb_flush_pending;
 };
 
 /* Per shadow VMID mmu structure */
@@ -71,29 +96,162 @@ struct kvm_nested_s2_mmu {
 
 	/*
 	 * virtual_vttbr contains vttbr_el2 value from the guest hypervisor.
-	 * We use vmid field as a key to search for this mmu object in the list,
-	 * and ignore baddr field.
-	 *
-	 * Note that we may use both of vmid field and baddr field respectively
-	 * to find a shadow VMID and a pointer to the shadow stage-2 page
-	 * table, then combine them to set up hw_vttbr. The only benefit of
-	 * doing that would be reusing shadow stage-2 page tables for different
-	 * VMIDs, which is not usual. So, we choose the current design for the
-	 * simplicity.
+	 * We use both the vmid field and the baddr field to find this mmu
+	 * object, the vmid field being the hash key.
 	 *
+	 * Shadow page tables are handed over to a new vmid that uses the same
+	 * baddr when no vcpu holds them (see adopt_nested_mmu()), but are
+	 * never used by two vmids at once: the shadow VMID also tags the
+	 * nested VM's stage 1 TLB entries, so sharing them concurrently would
+	 * require separate shadow VMIDs for the same page tables.
 	 */
 	u64 virtual_vttbr;
 
 	struct list_head list;
+
+	/* Entry in kvm->arch.nested_mmu_hash, keyed on the virtual VMID */
+	struct hlist_node hash_node;
+
+	/* Number of vcpus holding this mmu, protected by kvm->mmu_lock */
+	int users;
+
+	/* jiffies at the last entry to the nested VM, used for recycling */
+	unsigned long last_used;
+
+	/*
+	 * L2 IPA range [mapped_start, mapped_end) covering every mapping
+	 * installed in the shadow page tables since they were last cleared,
+	 * so that invalidations don't have to scan the whole IPA space.
+	 * Protected by kvm->mmu_lock, empty when mapped_start >= mapped_end.
+	 */
+	phys_addr_t mapped_start;
+	phys_addr_t mapped_end;
+
+	/*
+	 * Stage 2 invalidations from the guest hypervisor that have not been
+	 * applied to the shadow page tables yet. They are only deferred while
+	 * no other vcpu holds this mmu, and are applied before any vcpu enters
+	 * the nested VM with it. Protected by kvm->mmu_lock.
+	 */
+	bool tlbi_all;
+	int tlbi_nr;
+	struct {
+		phys_addr_t start;
+		phys_addr_t end;
+	} tlbi_queue[NESTED_TLBI_QUEUE_LEN];
+
+	/*
+	 * Next L2 IPA to populate from the guest hypervisor's stage 2 page
+	 * tables when kvm-arm.nested_prefault is set, reset whenever the
+	 * shadow page tables are handed to a new virtual VMID.
+	 */
+	phys_addr_t prefault_next;
+
+	/*
+	 * Set when the shadow page tables are emptied, for the next entry to
+	 * map the passthrough regions where the previous nested VM had them.
+	 */
+	bool passthrough_pending;
+};
+
+/*
+ * A region passed through to nested VMs: @ipa is where the guest hypervisor
+ * has it and @l2_ipa where the last nested VM faulting on it had it, each
+ * KVM_ARM_NESTED_PASSTHROUGH_NONE if unknown. Written under kvm->mmu_lock.
+ */
+struct kvm_nested_passthrough {
+	phys_addr_t ipa;
+	phys_addr_t l2_ipa;
+};
+
+#define KVM_ARM_NESTED_PASSTHROUGH_NR	1
+
+#define NESTED_MMU_HASH_BITS	6
+#define NESTED_TLBI_QUEUE_LEN	16
+
+/*
+ * Software TLB caching the result of walking the guest hypervisor's stage 2
+ * page tables, so that shadow stage 2 faults don't have to read the guest's
+ * descriptors again for an L2 IPA that was recently translated.
+ */
+#define NESTED_S2_TLB_ENTRIES	8
+
+struct kvm_nested_s2_tlb_entry {
+	u64 vttbr;		/* virtual VTTBR_EL2 the walk was done with */
+	u64 vtcr;		/* virtual VTCR_EL2 the walk was done with */
+	phys_addr_t ipa;	/* L2 IPA, aligned to block_size */
+	phys_addr_t output;	/* L1 IPA, aligned to block_size */
+	phys_addr_t block_size;	/* 0 if the entry is invalid */
+	u64 upper_attr;
+	int level;
+	bool readable;
+	bool writable;
+};
+
+struct kvm_nested_s2_tlb {
+	/* kvm->arch.nested_s2_tlb_gen at the time the entries were filled */
+	u64 gen;
+	unsigned int next;
+	struct kvm_nested_s2_tlb_entry entries[NESTED_S2_TLB_ENTRIES];
+};
+
+/*
+ * Exit classes of the per-vcpu exit profile: the ESR_EL2 exception classes,
+ * followed by the PV instruction kinds and the non-trap exits.
+ */
+#define KVM_EXIT_PROF_PV	(ESR_ELx_EC_MAX + 1)
+#define KVM_EXIT_PROF_IRQ	(KVM_EXIT_PROF_PV + 8)
+#define KVM_EXIT_PROF_SERROR	(KVM_EXIT_PROF_IRQ + 1)
+#define KVM_EXIT_PROF_OTHER	(KVM_EXIT_PROF_SERROR + 1)
+#define KVM_EXIT_PROF_NR	(KVM_EXIT_PROF_OTHER + 1)
+
+/* Bucket n counts exits handled in [2^(n + 7), 2^(n + 8)) ns */
+#define KVM_EXIT_PROF_BUCKETS	16
+
+enum kvm_exit_origin {
+	KVM_EXIT_FROM_GUEST,		/* no nested virtualization */
+	KVM_EXIT_FROM_VEL2,		/* the guest hypervisor */
+	KVM_EXIT_FROM_NESTED,		/* a nested VM */
+	KVM_EXIT_ORIGINS,
+};
+
+struct kvm_exit_profile {
+	/* The exit currently being handled */
+	int class;
+	int origin;
+
+	u64 count[KVM_EXIT_PROF_NR][KVM_EXIT_ORIGINS];
+	u64 time_ns[KVM_EXIT_PROF_NR][KVM_EXIT_ORIGINS];
+	u64 hist[KVM_EXIT_PROF_NR][KVM_EXIT_PROF_BUCKETS];
+};
+
+/*
+ * Zeroed pages kept per VM for its stage 2 tables, so that the fault path
+ * can top up its cache without going to the page allocator. A worker keeps
+ * it filled to a target that follows the rate at which it is drained.
+ */
+struct kvm_s2_page_pool {
+	spinlock_t lock;
+	struct list_head pages;
+	unsigned int nr_pages;
+	unsigned int target;
+	/* Top-ups that had to allocate since the last refill */
+	unsigned int nr_missed;
+	unsigned long last_refill;
+	struct work_struct refill;
 };
 
 struct kvm_arch {
 	/* Stage 2 paging state for the VM */
 	struct kvm_s2_mmu mmu;
+	struct kvm_s2_page_pool s2_pool;
 
 	/* The last vcpu id that ran on each physical CPU */
 	int __percpu *last_vcpu_ran;
 
+	/* Sampled callsite of the last writer of kvm->mmu_lock */
+	unsigned long mmu_lock_holder;
+
 	/* The maximum number of vCPUs depends on the used GIC model */
 	int max_vcpus;
 
@@ -102,6 +260,19 @@ struct kvm_arch {
 
 	/* Stage 2 shadow paging contexts for nested L2 VM */
 	struct list_head nested_mmu_list;
+
+	/* Shadow stage 2 contexts hashed on the virtual VMID for fast lookup */
+	DECLARE_HASHTABLE(nested_mmu_hash, NESTED_MMU_HASH_BITS);
+
+	/* Number of shadow stage 2 contexts kept before recycling them */
+	unsigned int nested_mmu_max;
+
+	/* Bumped by stage 2 TLBI emulation to invalidate every nested_s2_tlb */
+	atomic64_t nested_s2_tlb_gen;
+
+	/* KVM_ARM_NESTED_PASSTHROUGH_* regions, indexed on their type */
+	struct kvm_nested_passthrough
+		nested_passthrough[KVM_ARM_NESTED_PASSTHROUGH_NR];
 };
 
 #define KVM_NR_MEM_OBJS     40
@@ -295,6 +466,12 @@ struct kvm_vcpu_arch {
 	/* Guest debug state */
 	u64 debug_flags;
 
+	/* Ownership of the FP registers, KVM_ARM64_FP_* */
+	u64 fp_flags;
+
+	/* The EL1 registers are live on the CPU, see kvm_vcpu_load_sysregs() */
+	bool sysregs_loaded_on_cpu;
+
 	/*
 	 * We maintain more than a single set of debug registers to support
 	 * debugging the guest from the host and to maintain separate host and
@@ -314,6 +491,9 @@ struct kvm_vcpu_arch {
 
 	/* Pointer to host CPU context */
 	kvm_cpu_context_t *host_cpu_context;
+
+	/* Userland FP state of the task running the vcpu, mapped at EL2 */
+	struct user_fpsimd_state *host_fpsimd_state;
 	struct {
 		/* {Break,watch}point registers */
 		struct kvm_guest_debug_arch regs;
@@ -350,6 +530,8 @@ struct kvm_vcpu_arch {
 
 	/* IO related fields */
 	struct kvm_decode mmio_decode;
+	/* kvm_io_bus cookie of the device that handled the last MMIO access */
+	long mmio_cookie;
 
 	/* Interrupt related fields */
 	u64 irq_lines;		/* IRQ and FIQ levels */
@@ -371,11 +553,59 @@ struct kvm_vcpu_arch {
 	u64 hw_vttbr;
 
 	struct kvm_mmu_memory_cache mmu_rmap_list_desc_cache;
+
+	/*
+	 * The shadow stage 2 context this vcpu last entered a nested VM with.
+	 * It stays held, and therefore never recycled, until the vcpu enters
+	 * another nested VM.
+	 */
+	struct kvm_nested_s2_mmu *last_nested_mmu;
+
+	/* Recent translations of the guest hypervisor's stage 2 tables */
+	struct kvm_nested_s2_tlb nested_s2_tlb;
+
+	/*
+	 * Registers written since the shadow EL1 state of the virtual EL2 was
+	 * last built from them. While shadow_valid is set, only those need to
+	 * be copied again on the next entry to the virtual EL2, provided that
+	 * HCR_EL2.E2H still matches shadow_e2h.
+	 */
+	DECLARE_BITMAP(shadow_dirty, NR_SYS_REGS);
+	bool shadow_valid;
+	bool shadow_e2h;
+
+	/* Virtual EL2 register page shared with a PV guest hypervisor */
+	struct gfn_to_hva_cache pv_el2_ghc;
+	bool pv_el2_enabled;
+
+	/* Exit counts and handling times, if enabled with kvm-arm.exit_profile */
+	struct kvm_exit_profile *exit_profile;
+
+	/* Halt polling window of the nested VM, see kvm_vcpu_block_nested() */
+	unsigned int nested_halt_poll_ns;
+
+	/* PV scheduling state shared with the guest, if registered */
+	struct gfn_to_hva_cache pvsched_ghc;
+	bool pvsched_enabled;
+	u64 pvsched_stolen_time;
+	u64 pvsched_last_run_delay;
+	/* A reschedule was deferred on the guest's preempt_delay request */
+	bool pvsched_deferred;
 };
 
 #define vcpu_gp_regs(v)		(&(v)->arch.ctxt.gp_regs)
 #define vcpu_sys_reg(v,r)	((v)->arch.ctxt.sys_regs[(r)])
 #define vcpu_el2_sreg(v,r)	((v)->arch.ctxt.el2_special_regs[(r)])
+
+/*
+ * Accessors for the registers that may be live on the CPU rather than in
+ * the vcpu while it is loaded.
+ */
+u64 vcpu_read_sys_reg(struct kvm_vcpu *vcpu, int reg);
+void vcpu_write_sys_reg(struct kvm_vcpu *vcpu, u64 val, int reg);
+void vcpu_write_elr_el1(struct kvm_vcpu *vcpu, u64 val);
+void vcpu_write_spsr_el1(struct kvm_vcpu *vcpu, u64 val);
+
 /*
  * CP14 and CP15 live in the same array, as they are backed by the
  * same system registers.
@@ -393,12 +623,23 @@ struct kvm_vcpu_arch {
 
 struct kvm_vm_stat {
 	ulong remote_tlb_flush;
+	ulong nested_mmu_count;
+	ulong nested_mmu_recycled;
+	ulong nested_mmu_adopted;
+	ulong nested_rmap_add;
+	ulong nested_rmap_remove;
+	ulong mmu_lock_contended;
+	ulong mmu_lock_wait_ns;
+	ulong its_lock_contended;
+	ulong its_lock_wait_ns;
 };
 
 struct kvm_vcpu_stat {
 	u64 halt_successful_poll;
 	u64 halt_attempted_poll;
 	u64 halt_poll_invalid;
+	u64 halt_poll_success_ns;
+	u64 halt_poll_fail_ns;
 	u64 halt_wakeup;
 	u64 hvc_exit_stat;
 	u64 wfe_exit_stat;
@@ -406,6 +647,29 @@ struct kvm_vcpu_stat {
 	u64 mmio_exit_user;
 	u64 mmio_exit_kernel;
 	u64 exits;
+	u64 nested_s2_fault;
+	u64 nested_s2_walk;
+	u64 nested_s2_walk_cached;
+	u64 nested_tlbi;
+	u64 nested_at;
+	u64 nested_at_walk;
+	u64 nested_pv_exit;
+	u64 nested_el2_entry;
+	u64 nested_eret;
+	u64 nested_fast_eret;
+	u64 nested_hyp_sysreg;
+	u64 nested_wfi_exit;
+	u64 pv_yield;
+	u64 pv_preempt_deferred;
+	u64 s2_remote_table;
+	u64 vgic_lr_underflow;
+	u64 timer_irq;
+	u64 mmu_lock_read_contended;
+	u64 mmu_lock_read_wait_ns;
+	u64 ap_list_lock_contended;
+	u64 ap_list_lock_wait_ns;
+	u64 irq_lock_contended;
+	u64 irq_lock_wait_ns;
 };
 
 int kvm_vcpu_preferred_target(struct kvm_vcpu_init *init);
@@ -415,12 +679,15 @@ int kvm_arm_get_reg(struct kvm_vcpu *vcpu, const struct kvm_one_reg *reg);
 int kvm_arm_set_reg(struct kvm_vcpu *vcpu, const struct kvm_one_reg *reg);
 
 #define KVM_ARCH_WANT_MMU_NOTIFIER
+#define KVM_ARCH_WANT_AGE_HVA_BITMAP
 int kvm_unmap_hva(struct kvm *kvm, unsigned long hva);
 int kvm_unmap_hva_range(struct kvm *kvm,
 			unsigned long start, unsigned long end);
 void kvm_set_spte_hva(struct kvm *kvm, unsigned long hva, pte_t pte);
 int kvm_age_hva(struct kvm *kvm, unsigned long start, unsigned long end);
 int kvm_test_age_hva(struct kvm *kvm, unsigned long hva);
+void kvm_age_hva_bitmap(struct kvm *kvm, unsigned long start,
+			unsigned long end, unsigned long *young);
 
 /* We do not have shadow page tables, hence the empty hooks */
 static inline void kvm_arch_mmu_notifier_invalidate_page(struct kvm *kvm,
@@ -439,9 +706,49 @@ u64 __kvm_call_hyp(void *hypfn, ...);
 
 void force_vm_exit(const cpumask_t *mask);
 void kvm_mmu_wp_memory_region(struct kvm *kvm, int slot);
+void kvm_mmu_sync_dirty_log(struct kvm *kvm, u32 slot);
 
 int handle_exit(struct kvm_vcpu *vcpu, struct kvm_run *run,
 		int exception_index);
+struct kvm_s2_mmu *kvm_arm_fast_eret_mmu(struct kvm_vcpu *vcpu,
+					 int exception_index);
+void kvm_arm_fast_eret(struct kvm_vcpu *vcpu);
+
+bool kvm_arm_has_vcpu_debugfs(void);
+int kvm_arm_create_vcpu_debugfs(struct kvm_vcpu *vcpu);
+void kvm_arm_exit_profile_free(struct kvm_vcpu *vcpu);
+int kvm_arm_create_vm_debugfs(struct kvm *kvm);
+
+bool kvm_arm_setup_async_pf(struct kvm_vcpu *vcpu, phys_addr_t ipa,
+			    gfn_t gfn, unsigned long hva);
+bool kvm_arm_async_pf_done(struct kvm_vcpu *vcpu);
+void kvm_arm_async_pf_wait(struct kvm_vcpu *vcpu);
+void kvm_arm_async_pf_clear(struct kvm_vcpu *vcpu);
+
+int kvm_arch_vcpu_run_map_fp(struct kvm_vcpu *vcpu);
+void kvm_arch_vcpu_load_fp(struct kvm_vcpu *vcpu);
+void kvm_arch_vcpu_ctxflush_fp(struct kvm_vcpu *vcpu);
+void kvm_arch_vcpu_ctxsync_fp(struct kvm_vcpu *vcpu);
+void kvm_arch_vcpu_put_fp(struct kvm_vcpu *vcpu);
+
+void kvm_vcpu_load_sysregs(struct kvm_vcpu *vcpu);
+void kvm_vcpu_put_sysregs(struct kvm_vcpu *vcpu);
+
+struct kvm_async_pf;
+void kvm_arch_async_page_not_present(struct kvm_vcpu *vcpu,
+				     struct kvm_async_pf *work);
+void kvm_arch_async_page_present(struct kvm_vcpu *vcpu,
+				 struct kvm_async_pf *work);
+void kvm_arch_async_page_ready(struct kvm_vcpu *vcpu,
+			       struct kvm_async_pf *work);
+bool kvm_arch_can_inject_async_page_present(struct kvm_vcpu *vcpu);
+
+/* Account the exit being handled to another class, e.g. a PV instruction */
+static inline void kvm_exit_profile_set_class(struct kvm_vcpu *vcpu, int class)
+{
+	if (unlikely(vcpu->arch.exit_profile))
+		vcpu->arch.exit_profile->class = class;
+}
 
 int kvm_perf_init(void);
 int kvm_perf_teardown(void);
@@ -461,7 +768,42 @@ static inline void __cpu_init_hyp_mode(phys_addr_t pgd_ptr,
 
 static inline void kvm_arch_hardware_unsetup(void) {}
 static inline void kvm_arch_sync_events(struct kvm *kvm) {}
-static inline void kvm_arch_vcpu_uninit(struct kvm_vcpu *vcpu) {}
+#ifdef CONFIG_KVM_ARM_NESTED_PV
+void kvm_pv_el2_page_release(struct kvm_vcpu *vcpu);
+#else
+static inline void kvm_pv_el2_page_release(struct kvm_vcpu *vcpu) {}
+#endif
+
+void kvm_pvsched_release(struct kvm_vcpu *vcpu);
+void kvm_pvsched_vcpu_load(struct kvm_vcpu *vcpu);
+void kvm_pvsched_vcpu_put(struct kvm_vcpu *vcpu);
+bool kvm_pvsched_call(struct kvm_vcpu *vcpu);
+bool kvm_pvsched_defer_preempt(struct kvm_vcpu *vcpu);
+
+static inline bool kvm_pvsched_preempt_deferred(struct kvm_vcpu *vcpu)
+{
+	return vcpu->arch.pvsched_deferred;
+}
+
+/* The PV_SCHED_FEATURES answer, also given by the hyp code */
+static inline long kvm_pvsched_features(u32 func)
+{
+	switch (func) {
+	case ARM_SMCCC_HV_PV_SCHED_FEATURES:
+	case ARM_SMCCC_HV_PV_SCHED_IPA_INIT:
+	case ARM_SMCCC_HV_PV_SCHED_YIELD:
+		return SMCCC_RET_SUCCESS;
+	default:
+		return SMCCC_RET_NOT_SUPPORTED;
+	}
+}
+
+static inline void kvm_arch_vcpu_uninit(struct kvm_vcpu *vcpu)
+{
+	kvm_pv_el2_page_release(vcpu);
+	kvm_pvsched_release(vcpu);
+	kvm_arm_exit_profile_free(vcpu);
+}
 static inline void kvm_arch_sched_in(struct kvm_vcpu *vcpu, int cpu) {}
 static inline void kvm_arch_vcpu_block_finish(struct kvm_vcpu *vcpu) {}
 
@@ -475,6 +817,10 @@ int kvm_arm_vcpu_arch_get_attr(struct kvm_vcpu *vcpu,
 			       struct kvm_device_attr *attr);
 int kvm_arm_vcpu_arch_has_attr(struct kvm_vcpu *vcpu,
 			       struct kvm_device_attr *attr);
+long kvm_arm_vcpu_arch_ioctl(struct kvm_vcpu *vcpu, unsigned int ioctl,
+			     void __user *argp);
+long kvm_arm_vm_arch_ioctl(struct kvm *kvm, unsigned int ioctl,
+			   void __user *argp);
 
 static inline void __cpu_init_stage2(void)
 {
@@ -486,9 +832,16 @@ static inline void __cpu_init_stage2(void)
 
 int __init kvmarm_nested_cfg(char *buf);
 int init_nested_virt(void);
+bool kvm_arm_nested_supported(void);
 bool nested_virt_in_use(struct kvm_vcpu *vcpu);
+int kvm_arm_get_nested_state(struct kvm_vcpu *vcpu,
+			     struct kvm_arm_nested_state *state);
+int kvm_arm_set_nested_state(struct kvm_vcpu *vcpu,
+			     const struct kvm_arm_nested_state *state);
 int handle_wfx_nested(struct kvm_vcpu *vcpu, bool is_wfe);
+void kvm_vcpu_block_nested(struct kvm_vcpu *vcpu);
+bool kvm_arm_nested_irq_pending(struct kvm_vcpu *vcpu);
 int handle_hvc_nested(struct kvm_vcpu *vcpu);
-char *kvm_guest_state(struct kvm_vcpu *vcpu);
+int kvm_guest_ctxt(struct kvm_vcpu *vcpu);
 
 #endif /* __ARM64_KVM_HOST_H__ */
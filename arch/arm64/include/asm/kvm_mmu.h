@@ -148,6 +148,8 @@ void stage2_unmap_vm(struct kvm *kvm);
 int kvm_alloc_stage2_pgd(struct kvm *kvm);
 int __kvm_alloc_stage2_pgd(struct kvm_s2_mmu *mmu);
 void kvm_free_stage2_pgd(struct kvm *kvm);
+void kvm_s2_pool_init(struct kvm *kvm);
+void kvm_s2_pool_destroy(struct kvm *kvm);
 void __kvm_free_stage2_pgd(struct kvm *kvm, struct kvm_s2_mmu *mmu);
 int __kvm_phys_addr_ioremap(struct kvm *kvm, struct kvm_s2_mmu *mmu,
 			    phys_addr_t guest_ipa, phys_addr_t pa,
@@ -158,7 +160,7 @@ void kvm_unmap_stage2_range(struct kvm *kvm, struct kvm_s2_mmu *mmu,
 			    phys_addr_t start, u64 size);
 void kvm_stage2_wp_range(struct kvm *kvm, struct kvm_s2_mmu *mmu,
 			 phys_addr_t addr, phys_addr_t end);
-void kvm_stage2_flush_range(struct kvm_s2_mmu *mmu,
+void kvm_stage2_flush_range(struct kvm *kvm, struct kvm_s2_mmu *mmu,
 			    phys_addr_t start, phys_addr_t end);
 
 
@@ -218,6 +220,54 @@ static inline bool kvm_s2pmd_readonly(pmd_t *pmd)
 	return kvm_s2pte_readonly((pte_t *)pmd);
 }
 
+/*
+ * Stage 2 dirty bit management: with VTCR_EL2.HD set, a write to a page
+ * mapped with DBM and read-only sets S2AP[1] in the descriptor instead of
+ * taking a permission fault. VTCR_EL2.HD is set on each CPU implementing it.
+ */
+#define PTE_S2_DBM		PTE_DBM
+
+static inline bool kvm_stage2_has_dbm(void)
+{
+	u64 mmfr1 = read_sanitised_ftr_reg(SYS_ID_AA64MMFR1_EL1);
+
+	return IS_ENABLED(CONFIG_ARM64_HW_AFDBM) &&
+	       cpuid_feature_extract_unsigned_field(mmfr1,
+					ID_AA64MMFR1_HADBS_SHIFT) >= 2;
+}
+
+static inline pte_t kvm_s2pte_mkdbm(pte_t pte)
+{
+	pte_val(pte) |= PTE_S2_DBM;
+	return pte;
+}
+
+/* Make @pte read-only with DBM, racing with hardware updates of its flags */
+static inline void kvm_set_s2pte_clean(pte_t *pte)
+{
+	pteval_t pteval;
+	unsigned long tmp;
+
+	asm volatile("//	kvm_set_s2pte_clean\n"
+	"	prfm	pstl1strm, %2\n"
+	"1:	ldxr	%0, %2\n"
+	"	and	%0, %0, %3		// clear PTE_S2_RDWR\n"
+	"	orr	%0, %0, %4		// set PTE_S2_RDONLY and DBM\n"
+	"	stxr	%w1, %0, %2\n"
+	"	cbnz	%w1, 1b\n"
+	: "=&r" (pteval), "=&r" (tmp), "+Q" (pte_val(*pte))
+	: "L" (~PTE_S2_RDWR), "r" (PTE_S2_RDONLY | PTE_S2_DBM));
+}
+
+/* Written through a DBM mapping since it was last made clean */
+static inline bool kvm_s2pte_dbm_dirty(pte_t *pte)
+{
+	pteval_t pteval = READ_ONCE(pte_val(*pte));
+
+	return (pteval & PTE_S2_DBM) &&
+	       (pteval & PTE_S2_RDWR) == PTE_S2_RDWR;
+}
+
 static inline bool kvm_page_empty(void *ptr)
 {
 	struct page *ptr_page = virt_to_page(ptr);
@@ -247,7 +297,7 @@ static inline bool vcpu_has_cache_enabled(struct kvm_vcpu *vcpu)
 	u32 mode = vcpu->arch.ctxt.gp_regs.regs.pstate & PSR_MODE_MASK;
 
 	if (mode != PSR_MODE_EL2h && mode != PSR_MODE_EL2t)
-		return (vcpu_sys_reg(vcpu, SCTLR_EL1) & 0b101) == 0b101;
+		return (vcpu_read_sys_reg(vcpu, SCTLR_EL1) & 0b101) == 0b101;
 	else
 		return (vcpu_sys_reg(vcpu, SCTLR_EL2) & 0b101) == 0b101;
 }
@@ -258,7 +308,18 @@ static inline void __coherent_cache_guest_page(struct kvm_vcpu *vcpu,
 {
 	void *va = page_address(pfn_to_page(pfn));
 
-	kvm_flush_dcache_to_poc(va, size);
+	/*
+	 * With FWB, the guest always accesses memory with cacheable
+	 * attributes, so the page doesn't have to be cleaned to PoC. FWB
+	 * also implies CTR_EL0.IDC, so no clean to PoU is needed before
+	 * invalidating the I-cache either.
+	 */
+	if (!cpus_have_const_cap(ARM64_HAS_STAGE2_FWB))
+		kvm_flush_dcache_to_poc(va, size);
+
+	/* With DIC, the I-cache is coherent with the D-cache */
+	if (cpus_have_const_cap(ARM64_HAS_CACHE_DIC))
+		return;
 
 	if (icache_is_aliasing()) {
 		/* any kind of VIPT cache */
@@ -272,19 +333,34 @@ static inline void __coherent_cache_guest_page(struct kvm_vcpu *vcpu,
 
 static inline void __kvm_flush_dcache_pte(pte_t pte)
 {
-	struct page *page = pte_page(pte);
+	struct page *page;
+
+	if (cpus_have_const_cap(ARM64_HAS_STAGE2_FWB))
+		return;
+
+	page = pte_page(pte);
 	kvm_flush_dcache_to_poc(page_address(page), PAGE_SIZE);
 }
 
 static inline void __kvm_flush_dcache_pmd(pmd_t pmd)
 {
-	struct page *page = pmd_page(pmd);
+	struct page *page;
+
+	if (cpus_have_const_cap(ARM64_HAS_STAGE2_FWB))
+		return;
+
+	page = pmd_page(pmd);
 	kvm_flush_dcache_to_poc(page_address(page), PMD_SIZE);
 }
 
 static inline void __kvm_flush_dcache_pud(pud_t pud)
 {
-	struct page *page = pud_page(pud);
+	struct page *page;
+
+	if (cpus_have_const_cap(ARM64_HAS_STAGE2_FWB))
+		return;
+
+	page = pud_page(pud);
 	kvm_flush_dcache_to_poc(page_address(page), PUD_SIZE);
 }
 
@@ -343,22 +419,39 @@ struct kvm_s2_trans {
 
 struct kvm_nested_s2_mmu *get_nested_mmu(struct kvm_vcpu *vcpu, u64 vttbr);
 struct kvm_s2_mmu *vcpu_get_active_s2_mmu(struct kvm_vcpu *vcpu);
+struct kvm_s2_mmu *kvm_nested_s2_held_mmu(struct kvm_vcpu *vcpu);
 void update_nested_s2_mmu(struct kvm_vcpu *vcpu);
 int kvm_walk_nested_s2(struct kvm_vcpu *vcpu, phys_addr_t gipa,
 		       struct kvm_s2_trans *result);
+void kvm_nested_s2_tlb_invalidate(struct kvm *kvm);
+void kvm_nested_at_s1(struct kvm_vcpu *vcpu, u64 va, bool el2_format,
+		      int sys_encoding);
 int kvm_s2_handle_perm_fault(struct kvm_vcpu *vcpu, phys_addr_t fault_ipa,
 			     struct kvm_s2_trans *trans);
+void kvm_nested_s2_init(struct kvm *kvm);
+void kvm_nested_s2_prefault(struct kvm_vcpu *vcpu);
+long kvm_s2_prefault(struct kvm_vcpu *vcpu, struct kvm_s2_mmu *mmu,
+		     phys_addr_t l2_ipa, struct kvm_s2_trans *trans);
+void kvm_nested_s2_track_map(struct kvm *kvm, struct kvm_s2_mmu *mmu,
+			     phys_addr_t ipa, phys_addr_t size);
 void kvm_nested_s2_unmap(struct kvm_vcpu *vcpu);
 void kvm_nested_s2_free(struct kvm *kvm);
 void kvm_nested_s2_wp(struct kvm *kvm);
 void kvm_nested_s2_clear(struct kvm *kvm);
+void kvm_nested_s2_clear_all(struct kvm_vcpu *vcpu);
 void kvm_nested_s2_flush(struct kvm *kvm);
+void kvm_nested_s2_flush_tlbs(struct kvm *kvm);
 int kvm_inject_s2_fault(struct kvm_vcpu *vcpu, u64 esr_el2);
 bool kvm_nested_s2_clear_curr_vmid(struct kvm_vcpu *vcpu, phys_addr_t start,
 				   u64 size);
 struct kvm_nested_s2_mmu *lookup_nested_mmu(struct kvm_vcpu *vcpu, u64 vttbr);
+unsigned int kvm_nested_s2_get_hints(struct kvm_vcpu *vcpu, u64 *vttbrs,
+				     unsigned int max);
+int kvm_nested_s2_add_hint(struct kvm_vcpu *vcpu, u64 vttbr);
 int kvm_nested_mmio_ondemand(struct kvm_vcpu *vcpu, phys_addr_t fault_ipa,
 			     phys_addr_t ipa);
+int kvm_nested_set_passthrough(struct kvm *kvm,
+			       struct kvm_arm_nested_passthrough *pt);
 
 static inline u64 kvm_get_vttbr(struct kvm_s2_vmid *vmid,
 				struct kvm_s2_mmu *mmu)
@@ -63,6 +63,16 @@ int handle_pv(struct kvm_vcpu *vcpu);
 	/* hvc|instr|imm */
 	.inst	0xd4000002|(.L__hvc)
 	.endm
+
+	.macro batch_pv rt
+	/* hvc|instr|gpreg */
+	.inst	0xd4000002|(.L__batch)|(.L__gpreg_num_\rt)
+	.endm
+
+	.macro el2_page_pv rt
+	/* hvc|instr|func|gpreg */
+	.inst	0xd4000002|(.L__batch)|(.L__batch_el2_page)|(.L__gpreg_num_\rt)
+	.endm
 #endif /* CONFIG_PV_EL2 */
 #else /* __ASSEMBLY__ */
 
@@ -129,8 +139,42 @@ PV_CONST
 "	.macro hvc_pv imm\n"
 "	.inst	0xd4000002|(.L__hvc)\n"
 "	.endm\n"
+"\n"
+"	.macro batch_pv rt\n"
+"	.inst	0xd4000002|(.L__batch)|(.L__gpreg_num_\\rt)\n"
+"	.endm\n"
+"\n"
+"	.macro el2_page_pv rt\n"
+"	.inst	0xd4000002|(.L__batch)|(.L__batch_el2_page)|(.L__gpreg_num_\\rt)\n"
+"	.endm\n"
 );
 
+/* Execute the struct pv_el2_batch at IPA @pa in a single trap */
+#define kvm_pv_el2_batch(pa) do {				\
+	u64 __pa = (u64)(pa);					\
+	asm volatile("mov	x1, %0\n\t"				\
+		     "batch_pv x1\n\t"				\
+		     : : "r" (__pa) : "x1", "memory");		\
+} while (0)
+
+/* Invalidate the stage 2 IPA range [start, end) of the current VMID */
+#define kvm_pv_tlbi_ipa_range(start, end) do {			\
+	u64 __start = (u64)(start), __end = (u64)(end);		\
+	asm volatile("mov	x1, %0\n\t"				\
+		     "mov	x2, %1\n\t"				\
+		     "tlbi_pv1 ipas2_range, x1\n\t"		\
+		     : : "r" (__start), "r" (__end)		\
+		     : "x1", "x2", "memory");			\
+} while (0)
+
+/* Register the struct pv_el2_page at IPA @pa, or unregister it if 0 */
+#define kvm_pv_el2_page(pa) do {				\
+	u64 __pa = (u64)(pa);					\
+	asm volatile("mov	x1, %0\n\t"				\
+		     "el2_page_pv x1\n\t"			\
+		     : : "r" (__pa) : "x1", "memory");		\
+} while (0)
+
 #define read_s_sysreg(sreg) ({                          \
         u64 __val = 0;                                  \
 	asm volatile( "mrs_pv x1, " __stringify(sreg)"\n\t"	\
@@ -14,7 +14,7 @@
  * 100 ERET
  * 101 TLBI
  * 110 HVC
- * 111 Reserved
+ * 111 Batched MRS/MSR
  *
  */
 
@@ -26,6 +26,7 @@
 #define ERET_PV		0x4
 #define TLBI_PV		0x5
 #define HVC_PV		0x6
+#define BATCH_PV	0x7
 
 /*
  * MRS and MSR
@@ -57,9 +58,124 @@
 #define	VMALLS12E1IS	3
 #define	ALLE2		4
 #define	ALLE1IS		5
+#define	VAE1IS		6
+#define	ASIDE1IS	7
+#define	VAAE1IS		8
+#define	VALE1IS		9
+#define	VAALE1IS	10
+#define	VMALLE1		11
+#define	VAE1		12
+#define	ASIDE1		13
+#define	VAAE1		14
+#define	VALE1		15
+#define	VAALE1		16
+#define	IPAS2LE1IS	17
+#define	ALLE2IS		18
+#define	VAE2IS		19
+#define	VALE2IS		20
+#define	IPAS2E1		21
+#define	IPAS2LE1	22
+#define	VAE2		23
+#define	ALLE1		24
+#define	VALE2		25
+#define	VMALLS12E1	26
+/*
+ * Not an instruction: invalidate the stage 2 IPA range [Xt, Xt+1) of the
+ * current VMID in VTTBR_EL2, in place of one IPAS2E1IS per page.
+ */
+#define	IPAS2_RANGE	27
+#define	TLBI_PV_NR	28
 
 #define get_tlbi_idx(x)		(((x) & TLBI_IDX_MASK) >> TLBI_INSTR_SHIFT)
 
+/*
+ * Batched MRS/MSR
+ * 16bit = 3bit (intr) + 8bit (function) + 5bit (gpregs)
+ *
+ * PV_BATCH_EXEC: The gpreg holds the IPA of a struct pv_el2_batch, which must
+ * not cross a 4K boundary. Each entry is executed in order as an MRS or MSR
+ * of the sysreg numbered as in the MRS/MSR encoding above, MRS results being
+ * written back to the entry's val field.
+ *
+ * PV_BATCH_EL2_PAGE: The gpreg holds the IPA of a struct pv_el2_page, which
+ * must not cross a 4K boundary, or 0 to unregister the current one.
+ */
+#define PV_BATCH_FUNC_SHIFT	5
+#define PV_BATCH_FUNC_MASK	(0xFF << PV_BATCH_FUNC_SHIFT) /* 8 bits [5:12]*/
+
+#define PV_BATCH_EXEC		0
+#define PV_BATCH_EL2_PAGE	1
+
+#define get_batch_func(x)	(((x) & PV_BATCH_FUNC_MASK) >> PV_BATCH_FUNC_SHIFT)
+
+#define PV_BATCH_MRS	0
+#define PV_BATCH_MSR	1
+#define PV_BATCH_MAX	255
+
+/*
+ * Virtual EL2 register page
+ *
+ * Before each entry to the virtual EL2, KVM stores the current value of the
+ * registers below in the registered page, so that the guest hypervisor can
+ * read them with plain loads instead of mrs_pv. The registers in
+ * PV_EL2_PAGE_RW_MASK only take effect once the nested VM is entered, and may
+ * also be written with plain stores, followed by setting their bit in the
+ * written field. KVM picks those up on the next exit from the virtual EL2,
+ * before handling it. Stores to the other slots are overwritten on the next
+ * entry and these registers must still be written with msr_pv.
+ *
+ * The page is accessed through the kernel mapping and must be mapped as
+ * Normal cacheable memory by the guest hypervisor.
+ */
+#define PV_EL2_PAGE_HCR		0
+#define PV_EL2_PAGE_VTTBR	1
+#define PV_EL2_PAGE_VTCR	2
+#define PV_EL2_PAGE_ESR		3
+#define PV_EL2_PAGE_FAR		4
+#define PV_EL2_PAGE_HPFAR	5
+#define PV_EL2_PAGE_ELR		6
+#define PV_EL2_PAGE_SPSR	7
+#define PV_EL2_PAGE_VMPIDR	8
+#define PV_EL2_PAGE_VPIDR	9
+#define PV_EL2_PAGE_HSTR	10
+#define PV_EL2_PAGE_HACR	11
+#define PV_EL2_PAGE_VBAR	12
+#define PV_EL2_PAGE_SCTLR	13
+#define PV_EL2_PAGE_TCR		14
+#define PV_EL2_PAGE_TTBR0	15
+#define PV_EL2_PAGE_MAIR	16
+#define PV_EL2_PAGE_TPIDR	17
+#define PV_EL2_PAGE_MDCR	18
+#define PV_EL2_PAGE_CPTR	19
+#define PV_EL2_PAGE_CNTHCTL	20
+#define PV_EL2_PAGE_CNTVOFF	21
+#define PV_EL2_PAGE_NR		22
+
+/* Slots 0 to 11 except HCR_EL2 */
+#define PV_EL2_PAGE_RW_MASK	0xffeUL
+
+#ifndef __ASSEMBLY__
+#include <linux/types.h>
+
+struct pv_el2_batch_entry {
+	__u16	op;
+	__u16	sysreg;
+	__u32	__reserved;
+	__u64	val;
+};
+
+struct pv_el2_batch {
+	__u32	nr;
+	__u32	__reserved;
+	struct pv_el2_batch_entry entries[];
+};
+
+struct pv_el2_page {
+	__u64	written;
+	__u64	regs[PV_EL2_PAGE_NR];
+};
+#endif
+
 /* Macros for encoding */
 #define HVC_IMM_OFFSET		5	/* imm field is in hvc[20:5] */
 #define HVC_IMM_SHIFT(x)	((x) << HVC_IMM_OFFSET)
@@ -75,6 +191,9 @@
 /* For TLBI*/
 #define ENCODE_TLBI_INSTR(x)	(HVC_IMM_SHIFT((x) << TLBI_INSTR_SHIFT))
 
+/* For batched MRS/MSR */
+#define ENCODE_BATCH_FUNC(x)	(HVC_IMM_SHIFT((x) << PV_BATCH_FUNC_SHIFT))
+
 #ifdef __ASSEMBLY__
 /* Instructions */
 .equ .L__mrs,	(ENCODE_INSTR(MRS_PV))
@@ -83,6 +202,7 @@
 .equ .L__eret,	(ENCODE_INSTR(ERET_PV))
 .equ .L__tlbi,	(ENCODE_INSTR(TLBI_PV))
 .equ .L__hvc,	(ENCODE_INSTR(HVC_PV))
+.equ .L__batch,	(ENCODE_INSTR(BATCH_PV))
 
 /* EL2 system registers */
 .equ .L__elr_el2,	(ENCODE_EL2_SYSREG(ELR_EL2))
@@ -126,6 +246,31 @@
 .equ .L__vmalls12e1is,	(ENCODE_TLBI_INSTR(VMALLS12E1IS))
 .equ .L__alle2,		(ENCODE_TLBI_INSTR(ALLE2))
 .equ .L__alle1is,	(ENCODE_TLBI_INSTR(ALLE1IS))
+.equ .L__vae1is,	(ENCODE_TLBI_INSTR(VAE1IS))
+.equ .L__aside1is,	(ENCODE_TLBI_INSTR(ASIDE1IS))
+.equ .L__vaae1is,	(ENCODE_TLBI_INSTR(VAAE1IS))
+.equ .L__vale1is,	(ENCODE_TLBI_INSTR(VALE1IS))
+.equ .L__vaale1is,	(ENCODE_TLBI_INSTR(VAALE1IS))
+.equ .L__vmalle1,	(ENCODE_TLBI_INSTR(VMALLE1))
+.equ .L__vae1,		(ENCODE_TLBI_INSTR(VAE1))
+.equ .L__aside1,	(ENCODE_TLBI_INSTR(ASIDE1))
+.equ .L__vaae1,		(ENCODE_TLBI_INSTR(VAAE1))
+.equ .L__vale1,		(ENCODE_TLBI_INSTR(VALE1))
+.equ .L__vaale1,	(ENCODE_TLBI_INSTR(VAALE1))
+.equ .L__ipas2le1is,	(ENCODE_TLBI_INSTR(IPAS2LE1IS))
+.equ .L__alle2is,	(ENCODE_TLBI_INSTR(ALLE2IS))
+.equ .L__vae2is,	(ENCODE_TLBI_INSTR(VAE2IS))
+.equ .L__vale2is,	(ENCODE_TLBI_INSTR(VALE2IS))
+.equ .L__ipas2e1,	(ENCODE_TLBI_INSTR(IPAS2E1))
+.equ .L__ipas2le1,	(ENCODE_TLBI_INSTR(IPAS2LE1))
+.equ .L__vae2,		(ENCODE_TLBI_INSTR(VAE2))
+.equ .L__alle1,		(ENCODE_TLBI_INSTR(ALLE1))
+.equ .L__vale2,		(ENCODE_TLBI_INSTR(VALE2))
+.equ .L__vmalls12e1,	(ENCODE_TLBI_INSTR(VMALLS12E1))
+.equ .L__ipas2_range,	(ENCODE_TLBI_INSTR(IPAS2_RANGE))
+
+/* Batched MRS/MSR functions */
+.equ .L__batch_el2_page,	(ENCODE_BATCH_FUNC(PV_BATCH_EL2_PAGE))
 
 /* GP registers*/
 .irp	num,0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20,21,22,23,24,25,26,27,28,29,30
@@ -144,6 +289,7 @@
 ".equ .L__eret,"	__stringify(ENCODE_INSTR(ERET_PV))"\n"		\
 ".equ .L__tlbi,"	__stringify(ENCODE_INSTR(TLBI_PV))"\n"		\
 ".equ .L__hvc,"		__stringify(ENCODE_INSTR(HVC_PV))"\n"		\
+".equ .L__batch,"	__stringify(ENCODE_INSTR(BATCH_PV))"\n"		\
 "\n"									\
 ".equ .L__elr_el2,"	__stringify(ENCODE_EL2_SYSREG(ELR_EL2))"\n"	\
 ".equ .L__spsr_el2,"	__stringify(ENCODE_EL2_SYSREG(SPSR_EL2))"\n"	\
@@ -185,6 +331,30 @@
 ".equ .L__vmalls12e1is,"	__stringify(ENCODE_TLBI_INSTR(VMALLS12E1IS))"\n"	\
 ".equ .L__alle2,"	__stringify(ENCODE_TLBI_INSTR(ALLE2))"\n"	\
 ".equ .L__alle1is,"	__stringify(ENCODE_TLBI_INSTR(ALLE1IS))"\n"	\
+".equ .L__vae1is,"	__stringify(ENCODE_TLBI_INSTR(VAE1IS))"\n"	\
+".equ .L__aside1is,"	__stringify(ENCODE_TLBI_INSTR(ASIDE1IS))"\n"	\
+".equ .L__vaae1is,"	__stringify(ENCODE_TLBI_INSTR(VAAE1IS))"\n"	\
+".equ .L__vale1is,"	__stringify(ENCODE_TLBI_INSTR(VALE1IS))"\n"	\
+".equ .L__vaale1is,"	__stringify(ENCODE_TLBI_INSTR(VAALE1IS))"\n"	\
+".equ .L__vmalle1,"	__stringify(ENCODE_TLBI_INSTR(VMALLE1))"\n"	\
+".equ .L__vae1,"	__stringify(ENCODE_TLBI_INSTR(VAE1))"\n"	\
+".equ .L__aside1,"	__stringify(ENCODE_TLBI_INSTR(ASIDE1))"\n"	\
+".equ .L__vaae1,"	__stringify(ENCODE_TLBI_INSTR(VAAE1))"\n"	\
+".equ .L__vale1,"	__stringify(ENCODE_TLBI_INSTR(VALE1))"\n"	\
+".equ .L__vaale1,"	__stringify(ENCODE_TLBI_INSTR(VAALE1))"\n"	\
+".equ .L__ipas2le1is,"	__stringify(ENCODE_TLBI_INSTR(IPAS2LE1IS))"\n"	\
+".equ .L__alle2is,"	__stringify(ENCODE_TLBI_INSTR(ALLE2IS))"\n"	\
+".equ .L__vae2is,"	__stringify(ENCODE_TLBI_INSTR(VAE2IS))"\n"	\
+".equ .L__vale2is,"	__stringify(ENCODE_TLBI_INSTR(VALE2IS))"\n"	\
+".equ .L__ipas2e1,"	__stringify(ENCODE_TLBI_INSTR(IPAS2E1))"\n"	\
+".equ .L__ipas2le1,"	__stringify(ENCODE_TLBI_INSTR(IPAS2LE1))"\n"	\
+".equ .L__vae2,"	__stringify(ENCODE_TLBI_INSTR(VAE2))"\n"	\
+".equ .L__alle1,"	__stringify(ENCODE_TLBI_INSTR(ALLE1))"\n"	\
+".equ .L__vale2,"	__stringify(ENCODE_TLBI_INSTR(VALE2))"\n"	\
+".equ .L__vmalls12e1,"	__stringify(ENCODE_TLBI_INSTR(VMALLS12E1))"\n"	\
+".equ .L__ipas2_range,"	__stringify(ENCODE_TLBI_INSTR(IPAS2_RANGE))"\n"	\
+"\n"									\
+".equ .L__batch_el2_page,"	__stringify(ENCODE_BATCH_FUNC(PV_BATCH_EL2_PAGE))"\n"	\
 "\n"									\
 ".irp	num,0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20,21,22,23,24,25,26,27,28,29,30\n"	\
 ".equ .L__gpreg_num_x\\num," 	__stringify(ENCODE_GP_REG(\\num))"\n"	\
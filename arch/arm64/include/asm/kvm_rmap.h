@@ -4,6 +4,9 @@ struct kvm_rmap_head {
 	/*
 	 * An L2 IPA or a pointer to a descriptor, which contains multiple
 	 * kvm_rmap_head structures.
+	 *
+	 * L2 IPAs are page aligned, which leaves room in the low bits to
+	 * encode the level the translation ends at, see RMAP_LEVEL_MASK.
 	 */
 	unsigned long val;
 
@@ -12,19 +15,39 @@ struct kvm_rmap_head {
 	 * mmu->vmid is also used to invalidate TLB entries.
 	 */
 	struct kvm_s2_mmu *mmu;
-
-	/* used to differentiate between a page mapping and a block mapping */
-	int last_level;
 };
 
-/* Max number of struct kvm_map_head objects fits in a page */
-#define RMAP_LIST_MAX (PAGE_SIZE/sizeof(struct kvm_rmap_head) - 1)
+/* Bit 0 of val is set when it points to a struct rmap_list_desc */
+#define RMAP_LEVEL_SHIFT	1
+#define RMAP_LEVEL_MASK		(3UL << RMAP_LEVEL_SHIFT)
+
+static inline gpa_t rmap_l2_ipa(struct kvm_rmap_head *rmap_entry)
+{
+	return rmap_entry->val & PAGE_MASK;
+}
+
+/* used to differentiate between a page mapping and a block mapping */
+static inline int rmap_last_level(struct kvm_rmap_head *rmap_entry)
+{
+	return (rmap_entry->val & RMAP_LEVEL_MASK) >> RMAP_LEVEL_SHIFT;
+}
+
+/*
+ * Descriptors are allocated from a dedicated kmem_cache and sized so that
+ * a descriptor, including the pointer to the next one, fits in 128 bytes.
+ */
+#define RMAP_LIST_MAX	7
 
 struct rmap_list_desc {
 	struct kvm_rmap_head rmap_entries[RMAP_LIST_MAX];
 	struct rmap_list_desc *more;
 };
 
+int kvm_rmap_init(void);
+
+int kvm_rmap_topup_desc_cache(struct kvm_mmu_memory_cache *cache, int min);
+void kvm_rmap_free_desc_cache(struct kvm_mmu_memory_cache *cache);
+
 void kvm_rmap_add_pmd(struct kvm *kvm, struct kvm_s2_mmu *mmu,
 		      gpa_t l2_ipa, gpa_t l1_ipa,
 		      struct kvm_mmu_memory_cache *rmap_cache);
@@ -39,12 +39,24 @@
 extern void __cpu_clear_user_page(void *p, unsigned long user);
 extern void __cpu_copy_user_page(void *to, const void *from,
 				 unsigned long user);
+extern void __cpu_clear_user_pages(void *p, unsigned long user,
+				   unsigned int nr);
+extern void __cpu_copy_user_pages(void *to, const void *from,
+				  unsigned long user, unsigned int nr);
 extern void copy_page(void *to, const void *from);
 extern void clear_page(void *to);
+extern void __copy_pages(void *to, const void *from, unsigned long size);
+extern void __clear_pages_nocache(void *to, unsigned long size);
 
 #define clear_user_page(addr,vaddr,pg)  __cpu_clear_user_page(addr, vaddr)
 #define copy_user_page(to,from,vaddr,pg) __cpu_copy_user_page(to, from, vaddr)
 
+/* Runs of subpages of a huge page, see clear_huge_page() */
+#define clear_user_pages(addr,vaddr,pg,nr)	\
+	__cpu_clear_user_pages(addr, vaddr, nr)
+#define copy_user_pages(to,from,vaddr,pg,nr)	\
+	__cpu_copy_user_pages(to, from, vaddr, nr)
+
 typedef struct page *pgtable_t;
 
 #ifdef CONFIG_HAVE_ARCH_PFN_VALID
@@ -128,6 +128,7 @@
 #define PMD_TYPE_TABLE		(_AT(pmdval_t, 3) << 0)
 #define PMD_TYPE_SECT		(_AT(pmdval_t, 1) << 0)
 #define PMD_TABLE_BIT		(_AT(pmdval_t, 1) << 1)
+#define PMD_TABLE_RDONLY	(_AT(pmdval_t, 1) << 62)	/* APTable[1] */
 
 /*
  * Section
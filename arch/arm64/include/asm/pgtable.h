@@ -382,6 +382,11 @@ extern pgprot_t phys_mem_access_prot(struct file *file, unsigned long pfn,
 #define pmd_sect(pmd)		((pmd_val(pmd) & PMD_TYPE_MASK) == \
 				 PMD_TYPE_SECT)
 
+/* Write permission for everything a table maps, on top of its ptes' */
+#define pmd_table_write(pmd)	(!(pmd_val(pmd) & PMD_TABLE_RDONLY))
+#define pmd_table_wrprotect(pmd) __pmd(pmd_val(pmd) | PMD_TABLE_RDONLY)
+#define pmd_table_mkwrite(pmd)	__pmd(pmd_val(pmd) & ~PMD_TABLE_RDONLY)
+
 #if defined(CONFIG_ARM64_64K_PAGES) || CONFIG_PGTABLE_LEVELS < 3
 #define pud_sect(pud)		(0)
 #define pud_table(pud)		(1)
@@ -718,6 +723,18 @@ extern pgd_t idmap_pg_dir[PTRS_PER_PGD];
 
 extern int kern_addr_valid(unsigned long addr);
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/*
+ * A huge mapping is covered by a single TLB entry, so there is no need
+ * to invalidate it one page at a time.
+ */
+#define __HAVE_ARCH_FLUSH_PMD_TLB_RANGE
+#define flush_pmd_tlb_range(vma, addr, end)	\
+	__flush_tlb_range(vma, addr, end, PMD_SIZE, false)
+#define flush_pud_tlb_range(vma, addr, end)	\
+	__flush_tlb_range(vma, addr, end, PUD_SIZE, false)
+#endif /* CONFIG_TRANSPARENT_HUGEPAGE */
+
 #include <asm-generic/pgtable.h>
 
 void pgd_cache_init(void);
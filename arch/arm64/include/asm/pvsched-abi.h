@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2017 - Linaro Ltd
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __ASM_PVSCHED_ABI_H
+#define __ASM_PVSCHED_ABI_H
+
+#include <linux/arm-smccc.h>
+
+/*
+ * Paravirtualized scheduling services of KVM, called with HVC following the
+ * SMC calling convention:
+ *
+ * HV_CALL_UID: the SMCCC Call UID query of the vendor hypervisor service
+ *	range, returning ARM_SMCCC_HV_UID_KVM_{0,1,2,3} in x0-x3. As it is
+ *	defined for any SMCCC implementation, this is what a guest probes
+ *	first before making any of the calls below.
+ *
+ * PV_SCHED_FEATURES(x1 = function ID): SMCCC_RET_SUCCESS if the service
+ *	called by x1 is implemented, SMCCC_RET_NOT_SUPPORTED otherwise.
+ *
+ * PV_SCHED_IPA_INIT(x1 = IPA): register the calling vcpu's struct
+ *	pvsched_vcpu_state at IPA x1, which must not cross a 4kB boundary,
+ *	or unregister it if x1 is 0.
+ *
+ * PV_SCHED_YIELD(x1 = MPIDR): give the rest of the calling vcpu's time
+ *	slice to the vcpu with affinity x1, typically the preempted holder
+ *	of a lock. SMCCC_RET_NOT_REQUIRED if there was nothing to yield to.
+ */
+#define ARM_SMCCC_HV_CALL_UID						\
+	ARM_SMCCC_CALL_VAL(ARM_SMCCC_FAST_CALL, ARM_SMCCC_SMC_32,	\
+			   ARM_SMCCC_OWNER_VENDOR_HYP, 0xff01)
+
+/* 28b46fb6-2ec5-11e9-a9ca-4b564d003a74 */
+#define ARM_SMCCC_HV_UID_KVM_0		0xb66fb428U
+#define ARM_SMCCC_HV_UID_KVM_1		0xe911c52eU
+#define ARM_SMCCC_HV_UID_KVM_2		0x564bcaa9U
+#define ARM_SMCCC_HV_UID_KVM_3		0x743a004dU
+
+#define ARM_SMCCC_HV_PV_SCHED_FEATURES					\
+	ARM_SMCCC_CALL_VAL(ARM_SMCCC_FAST_CALL, ARM_SMCCC_SMC_64,	\
+			   ARM_SMCCC_OWNER_VENDOR_HYP, 0x20)
+#define ARM_SMCCC_HV_PV_SCHED_IPA_INIT					\
+	ARM_SMCCC_CALL_VAL(ARM_SMCCC_FAST_CALL, ARM_SMCCC_SMC_64,	\
+			   ARM_SMCCC_OWNER_VENDOR_HYP, 0x21)
+#define ARM_SMCCC_HV_PV_SCHED_YIELD					\
+	ARM_SMCCC_CALL_VAL(ARM_SMCCC_FAST_CALL, ARM_SMCCC_SMC_64,	\
+			   ARM_SMCCC_OWNER_VENDOR_HYP, 0x22)
+
+#ifndef __ASSEMBLY__
+/*
+ * preempted is set to 1 when the vcpu is scheduled out while still runnable,
+ * and back to 0 once it is loaded again.
+ *
+ * stolen_time accumulates the nanoseconds the vcpu spent runnable but not
+ * running on the host since the state was registered. It is only updated by
+ * the vcpu itself before it next enters the guest, and can be read with a
+ * single 64-bit load.
+ *
+ * preempt_delay is owned by the guest, which sets it to nonzero around short
+ * critical sections, such as while holding a spinlock other vcpus may spin
+ * on. A host reschedule that becomes due while it is set is then deferred
+ * until the next exit, and never past it. In that case the host sets
+ * preempt_pending, and the guest should make an HVC (PV_SCHED_YIELD to
+ * itself will do) as soon as it clears preempt_delay. The host clears
+ * preempt_pending at that exit, and reschedules the vcpu there if needed.
+ */
+struct pvsched_vcpu_state {
+	__le32 preempted;
+	__le32 preempt_delay;
+	__le64 stolen_time;
+	__le32 preempt_pending;
+	__le32 pad[11];
+} __aligned(64);
+#endif
+
+#endif /* __ASM_PVSCHED_ABI_H */
@@ -40,24 +40,32 @@ static inline void tlb_flush(struct mmu_gather *tlb)
 	struct vm_area_struct vma = { .vm_mm = tlb->mm, };
 
 	/*
-	 * The ASID allocator will either invalidate the ASID or mark
-	 * it as used.
+	 * The walk caches only need invalidating if intermediate page
+	 * table levels were freed, which the __(pte|pmd|pud)_free_tlb()
+	 * functions defer to here: the freed tables lie within the range,
+	 * and aren't released until it has been flushed. Last level TLBI
+	 * is sufficient otherwise.
 	 */
-	if (tlb->fullmm)
-		return;
+	bool last_level = !tlb->freed_tables;
 
 	/*
-	 * The intermediate page table levels are already handled by
-	 * the __(pte|pmd|pud)_free_tlb() functions, so last level
-	 * TLBI is sufficient here.
+	 * The ASID allocator will either invalidate the ASID or mark
+	 * it as used, but the mm may still be live on this CPU while
+	 * its tables are freed.
 	 */
-	__flush_tlb_range(&vma, tlb->start, tlb->end, true);
+	if (tlb->fullmm) {
+		if (!last_level)
+			flush_tlb_mm(tlb->mm);
+		return;
+	}
+
+	__flush_tlb_range(&vma, tlb->start, tlb->end, PAGE_SIZE, last_level);
 }
 
 static inline void __pte_free_tlb(struct mmu_gather *tlb, pgtable_t pte,
 				  unsigned long addr)
 {
-	__flush_tlb_pgtable(tlb->mm, addr);
+	tlb->freed_tables = 1;
 	pgtable_page_dtor(pte);
 	tlb_remove_entry(tlb, pte);
 }
@@ -66,7 +74,7 @@ static inline void __pte_free_tlb(struct mmu_gather *tlb, pgtable_t pte,
 static inline void __pmd_free_tlb(struct mmu_gather *tlb, pmd_t *pmdp,
 				  unsigned long addr)
 {
-	__flush_tlb_pgtable(tlb->mm, addr);
+	tlb->freed_tables = 1;
 	tlb_remove_entry(tlb, virt_to_page(pmdp));
 }
 #endif
@@ -75,7 +83,7 @@ static inline void __pmd_free_tlb(struct mmu_gather *tlb, pmd_t *pmdp,
 static inline void __pud_free_tlb(struct mmu_gather *tlb, pud_t *pudp,
 				  unsigned long addr)
 {
-	__flush_tlb_pgtable(tlb->mm, addr);
+	tlb->freed_tables = 1;
 	tlb_remove_entry(tlb, virt_to_page(pudp));
 }
 #endif
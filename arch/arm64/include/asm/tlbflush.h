@@ -129,19 +129,31 @@ static inline void flush_tlb_page(struct vm_area_struct *vma,
 }
 
 /*
- * This is meant to avoid soft lock-ups on large TLB flushing ranges and not
- * necessarily a performance improvement.
+ * Above this many TLBI operations, a range flush invalidates the whole
+ * ASID (or the whole TLB for kernel ranges) instead. This avoids soft
+ * lock-ups on large ranges, and with broadcast TLBIs being expensive,
+ * flushing everything is often cheaper well before that. Tunable through
+ * the tlb_single_page_flush_ceiling debugfs file.
  */
-#define MAX_TLB_RANGE	(1024UL << PAGE_SHIFT)
+extern unsigned long tlb_flush_ceiling;
 
+/*
+ * Invalidate [start, end) one @stride at a time, @stride being the size
+ * of the mappings in the range (PAGE_SIZE, or a block size for huge
+ * mappings), and with a single DSB for the whole range. @last_level
+ * only invalidates leaf entries, keeping the walk caches.
+ */
 static inline void __flush_tlb_range(struct vm_area_struct *vma,
 				     unsigned long start, unsigned long end,
-				     bool last_level)
+				     unsigned long stride, bool last_level)
 {
 	unsigned long asid = ASID(vma->vm_mm) << 48;
 	unsigned long addr;
 
-	if ((end - start) > MAX_TLB_RANGE) {
+	start = round_down(start, stride);
+	end = round_up(end, stride);
+
+	if ((end - start) / stride > tlb_flush_ceiling) {
 		flush_tlb_mm(vma->vm_mm);
 		return;
 	}
@@ -150,7 +162,7 @@ static inline void __flush_tlb_range(struct vm_area_struct *vma,
 	end = asid | (end >> 12);
 
 	dsb(ishst);
-	for (addr = start; addr < end; addr += 1 << (PAGE_SHIFT - 12)) {
+	for (addr = start; addr < end; addr += stride >> 12) {
 		if (last_level)
 			__tlbi(vale1is, addr);
 		else
@@ -162,14 +174,14 @@ static inline void __flush_tlb_range(struct vm_area_struct *vma,
 static inline void flush_tlb_range(struct vm_area_struct *vma,
 				   unsigned long start, unsigned long end)
 {
-	__flush_tlb_range(vma, start, end, false);
+	__flush_tlb_range(vma, start, end, PAGE_SIZE, false);
 }
 
 static inline void flush_tlb_kernel_range(unsigned long start, unsigned long end)
 {
 	unsigned long addr;
 
-	if ((end - start) > MAX_TLB_RANGE) {
+	if ((end - start) >> PAGE_SHIFT > tlb_flush_ceiling) {
 		flush_tlb_all();
 		return;
 	}
@@ -184,19 +196,6 @@ static inline void flush_tlb_kernel_range(unsigned long start, unsigned long end
 	isb();
 }
 
-/*
- * Used to invalidate the TLB (walk caches) corresponding to intermediate page
- * table levels (pgd/pud/pmd).
- */
-static inline void __flush_tlb_pgtable(struct mm_struct *mm,
-				       unsigned long uaddr)
-{
-	unsigned long addr = uaddr >> 12 | (ASID(mm) << 48);
-
-	__tlbi(vae1is, addr);
-	dsb(ish);
-}
-
 #endif
 
 #endif
@@ -340,6 +340,17 @@ extern unsigned long __must_check __clear_user(void __user *addr, unsigned long
 #define INLINE_COPY_TO_USER
 #define INLINE_COPY_FROM_USER
 
+/*
+ * Batched copies switch PAN once for all of them, the _unsafe copy
+ * routines leave it alone.
+ */
+#define user_copy_begin()	uaccess_enable_not_uao()
+#define user_copy_end()		uaccess_disable_not_uao()
+extern unsigned long __must_check __arch_copy_from_user_unsafe(void *to, const void __user *from, unsigned long n);
+#define unsafe_copy_from_user __arch_copy_from_user_unsafe
+extern unsigned long __must_check __arch_copy_to_user_unsafe(void __user *to, const void *from, unsigned long n);
+#define unsafe_copy_to_user __arch_copy_to_user_unsafe
+
 static inline unsigned long __must_check clear_user(void __user *to, unsigned long n)
 {
 	if (access_ok(VERIFY_WRITE, to, n))
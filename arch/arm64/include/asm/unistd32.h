@@ -817,6 +817,8 @@ __SYSCALL(__NR_pkey_alloc, sys_pkey_alloc)
 __SYSCALL(__NR_pkey_free, sys_pkey_free)
 #define __NR_statx 397
 __SYSCALL(__NR_statx, sys_statx)
+#define __NR_io_setup2 398
+__SYSCALL(__NR_io_setup2, compat_sys_io_setup2)
 
 /*
  * Please add new compat syscalls above this comment and update
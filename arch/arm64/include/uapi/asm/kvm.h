@@ -40,6 +40,7 @@
 #define __KVM_HAVE_READONLY_MEM
 
 #define KVM_COALESCED_MMIO_PAGE_OFFSET 1
+#define KVM_DIRTY_LOG_PAGE_OFFSET 64
 
 #define KVM_REG_SIZE(id)						\
 	(1U << (((id) & KVM_REG_SIZE_MASK) >> KVM_REG_SIZE_SHIFT))
@@ -154,6 +155,73 @@ struct kvm_arch_memory_slot {
 	struct kvm_rmap_head *rmap;
 };
 
+/*
+ * Nested virtualization state of a vcpu, for KVM_ARM_{GET,SET}_NESTED_STATE.
+ *
+ * regs[] holds the EL2 system registers, including SPSR_EL2, ELR_EL2 and
+ * SP_EL2, indexed with their KVM_REG_ARM64_SYSREG encoding. vgic holds the
+ * virtual GIC hypervisor interface, in the format of the VGIC_V2 or VGIC_V3
+ * flag: GICH_APR is ap0r[0] and the GICv2 LRs are zero-extended. The shadow
+ * state KVM derives from all this is rebuilt on the next entry.
+ *
+ * hints[] are virtual VTTBR_EL2 values of nested VMs that ran recently, the
+ * one the vcpu is running first. They are VM wide: setting them on any vcpu
+ * makes KVM allocate their shadow stage 2 ahead of the first entry, where
+ * kvm-arm.nested_prefault warms it up. Hints are dropped once the VM has
+ * kvm-arm.nested_mmu_max shadow stage 2s.
+ */
+#define KVM_ARM_NESTED_STATE_VGIC_V2	(1 << 0)
+#define KVM_ARM_NESTED_STATE_VGIC_V3	(1 << 1)
+
+#define KVM_ARM_NESTED_MAX_REGS		64
+#define KVM_ARM_NESTED_MAX_LRS		64
+#define KVM_ARM_NESTED_MAX_HINTS	16
+
+struct kvm_arm_nested_reg {
+	__u64 id;
+	__u64 val;
+};
+
+struct kvm_arm_nested_vgic {
+	__u32 hcr;
+	__u32 vmcr;
+	__u32 ap0r[4];
+	__u32 ap1r[4];
+	__u64 lr[KVM_ARM_NESTED_MAX_LRS];
+};
+
+struct kvm_arm_nested_state {
+	__u32 flags;
+	__u32 nr_regs;
+	__u32 nr_lrs;
+	__u32 nr_hints;
+	struct kvm_arm_nested_reg regs[KVM_ARM_NESTED_MAX_REGS];
+	struct kvm_arm_nested_vgic vgic;
+	__u64 hints[KVM_ARM_NESTED_MAX_HINTS];
+};
+
+/*
+ * A host device region the guest hypervisor passes through to its nested
+ * VMs, for KVM_ARM_NESTED_SET_PASSTHROUGH. addr is the page aligned address
+ * of the region in the guest hypervisor's IPA space, or
+ * KVM_ARM_NESTED_PASSTHROUGH_NONE to stop passing it through. KVM maps the
+ * region into each nested VM as a whole, from the first fault on it or ahead
+ * of it where the previous nested VM had it.
+ *
+ * The GIC virtual CPU interface, KVM_VGIC_V2_CPU_SIZE long, defaults to
+ * 0x08010000.
+ */
+#define KVM_ARM_NESTED_PASSTHROUGH_VGIC_VCPU	0
+
+#define KVM_ARM_NESTED_PASSTHROUGH_NONE		(~0ULL)
+
+struct kvm_arm_nested_passthrough {
+	__u32 type;
+	__u32 flags;
+	__u64 addr;
+	__u64 reserved[2];
+};
+
 /* If you need to interpret the index values, here is the key: */
 #define KVM_REG_ARM_COPROC_MASK		0x000000000FFF0000
 #define KVM_REG_ARM_COPROC_SHIFT	16
@@ -33,10 +33,14 @@
 
 EXPORT_SYMBOL(copy_page);
 EXPORT_SYMBOL(clear_page);
+EXPORT_SYMBOL(__copy_pages);
+EXPORT_SYMBOL(__clear_pages_nocache);
 
 	/* user mem (segment) */
 EXPORT_SYMBOL(__arch_copy_from_user);
 EXPORT_SYMBOL(__arch_copy_to_user);
+EXPORT_SYMBOL(__arch_copy_from_user_unsafe);
+EXPORT_SYMBOL(__arch_copy_to_user_unsafe);
 EXPORT_SYMBOL(__clear_user);
 EXPORT_SYMBOL(raw_copy_in_user);
 
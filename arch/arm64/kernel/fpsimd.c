@@ -86,8 +86,28 @@
  * - the task gets preempted after kernel_neon_end() is called; as we have not
  *   returned from the 2nd syscall yet, TIF_FOREIGN_FPSTATE is still set so
  *   whatever is in the FPSIMD registers is not saved to memory, but discarded.
+ *
+ * KVM can also bind the state of a vcpu to the CPU with
+ * fpsimd_bind_state_to_cpu(), once current's userland state is saved, so that
+ * the guest's registers stay loaded between two guest entries. The registers
+ * are then saved to whatever fpsimd_last_state points to when they are needed
+ * for anything else.
+ */
+static DEFINE_PER_CPU(struct user_fpsimd_state *, fpsimd_last_state);
+
+/*
+ * Save the FPSIMD registers to the state they were last loaded from. The
+ * caller checks that they are live, i.e. that TIF_FOREIGN_FPSTATE is clear.
  */
-static DEFINE_PER_CPU(struct fpsimd_state *, fpsimd_last_state);
+static void fpsimd_save(void)
+{
+	struct user_fpsimd_state *st = __this_cpu_read(fpsimd_last_state);
+
+	if (!st)
+		st = &current->thread.fpsimd_state.user_fpsimd;
+
+	fpsimd_save_state(st);
+}
 
 /*
  * Trapped FP/ASIMD access.
@@ -135,7 +155,7 @@ void fpsimd_thread_switch(struct task_struct *next)
 	 * 'current'.
 	 */
 	if (current->mm && !test_thread_flag(TIF_FOREIGN_FPSTATE))
-		fpsimd_save_state(&current->thread.fpsimd_state);
+		fpsimd_save();
 
 	if (next->mm) {
 		/*
@@ -147,7 +167,7 @@ void fpsimd_thread_switch(struct task_struct *next)
 		 */
 		struct fpsimd_state *st = &next->thread.fpsimd_state;
 
-		if (__this_cpu_read(fpsimd_last_state) == st
+		if (__this_cpu_read(fpsimd_last_state) == &st->user_fpsimd
 		    && st->cpu == smp_processor_id())
 			clear_ti_thread_flag(task_thread_info(next),
 					     TIF_FOREIGN_FPSTATE);
@@ -176,7 +196,7 @@ void fpsimd_preserve_current_state(void)
 		return;
 	preempt_disable();
 	if (!test_thread_flag(TIF_FOREIGN_FPSTATE))
-		fpsimd_save_state(&current->thread.fpsimd_state);
+		fpsimd_save();
 	preempt_enable();
 }
 
@@ -193,8 +213,8 @@ void fpsimd_restore_current_state(void)
 	if (test_and_clear_thread_flag(TIF_FOREIGN_FPSTATE)) {
 		struct fpsimd_state *st = &current->thread.fpsimd_state;
 
-		fpsimd_load_state(st);
-		this_cpu_write(fpsimd_last_state, st);
+		fpsimd_load_state(&st->user_fpsimd);
+		this_cpu_write(fpsimd_last_state, &st->user_fpsimd);
 		st->cpu = smp_processor_id();
 	}
 	preempt_enable();
@@ -210,11 +230,11 @@ void fpsimd_update_current_state(struct fpsimd_state *state)
 	if (!system_supports_fpsimd())
 		return;
 	preempt_disable();
-	fpsimd_load_state(state);
+	fpsimd_load_state(&state->user_fpsimd);
 	if (test_and_clear_thread_flag(TIF_FOREIGN_FPSTATE)) {
 		struct fpsimd_state *st = &current->thread.fpsimd_state;
 
-		this_cpu_write(fpsimd_last_state, st);
+		this_cpu_write(fpsimd_last_state, &st->user_fpsimd);
 		st->cpu = smp_processor_id();
 	}
 	preempt_enable();
@@ -228,6 +248,34 @@ void fpsimd_flush_task_state(struct task_struct *t)
 	t->thread.fpsimd_state.cpu = NR_CPUS;
 }
 
+/*
+ * Associate the FPSIMD registers of this CPU with @st, which was just loaded
+ * into them, e.g. by KVM with the state of a vcpu. current's userland state
+ * must already be saved to memory, it is reloaded on return to userland.
+ */
+void fpsimd_bind_state_to_cpu(struct user_fpsimd_state *st)
+{
+	WARN_ON(!irqs_disabled());
+
+	__this_cpu_write(fpsimd_last_state, st);
+	clear_thread_flag(TIF_FOREIGN_FPSTATE);
+}
+
+/*
+ * Save the FPSIMD registers to the state they belong to, and dissociate them
+ * from it, so that they are reloaded from memory when next needed.
+ */
+void fpsimd_save_and_flush_cpu_state(void)
+{
+	WARN_ON(!irqs_disabled());
+
+	if (current->mm && !test_thread_flag(TIF_FOREIGN_FPSTATE))
+		fpsimd_save();
+
+	__this_cpu_write(fpsimd_last_state, NULL);
+	set_thread_flag(TIF_FOREIGN_FPSTATE);
+}
+
 #ifdef CONFIG_KERNEL_MODE_NEON
 
 static DEFINE_PER_CPU(struct fpsimd_partial_state, hardirq_fpsimdstate);
@@ -256,7 +304,7 @@ void kernel_neon_begin_partial(u32 num_regs)
 		preempt_disable();
 		if (current->mm &&
 		    !test_and_set_thread_flag(TIF_FOREIGN_FPSTATE))
-			fpsimd_save_state(&current->thread.fpsimd_state);
+			fpsimd_save();
 		this_cpu_write(fpsimd_last_state, NULL);
 	}
 }
@@ -285,7 +333,7 @@ static int fpsimd_cpu_pm_notifier(struct notifier_block *self,
 	switch (cmd) {
 	case CPU_PM_ENTER:
 		if (current->mm && !test_thread_flag(TIF_FOREIGN_FPSTATE))
-			fpsimd_save_state(&current->thread.fpsimd_state);
+			fpsimd_save();
 		this_cpu_write(fpsimd_last_state, NULL);
 		break;
 	case CPU_PM_EXIT:
@@ -13,13 +13,108 @@
  * Author: Stefano Stabellini <stefano.stabellini@eu.citrix.com>
  */
 
+#define pr_fmt(fmt) "kvm-pvsched: " fmt
+
+#include <linux/arm-smccc.h>
+#include <linux/cpuhotplug.h>
 #include <linux/export.h>
+#include <linux/init.h>
 #include <linux/jump_label.h>
+#include <linux/percpu.h>
+#include <linux/printk.h>
+#include <linux/psci.h>
 #include <linux/types.h>
 #include <asm/paravirt.h>
+#include <asm/pvsched-abi.h>
 
 struct static_key paravirt_steal_enabled;
 struct static_key paravirt_steal_rq_enabled;
 
 struct pv_time_ops pv_time_ops;
 EXPORT_SYMBOL_GPL(pv_time_ops);
+
+/*
+ * Per-cpu scheduling state shared with KVM, see asm/pvsched-abi.h. Each cpu
+ * registers its own copy when it comes online, as the hypercall applies to
+ * the calling vcpu.
+ */
+static DEFINE_PER_CPU_ALIGNED(struct pvsched_vcpu_state, pvsched_state);
+
+static long pvsched_hvc(u32 func, unsigned long arg)
+{
+	struct arm_smccc_res res;
+
+	arm_smccc_hvc(func, arg, 0, 0, 0, 0, 0, 0, &res);
+	return res.a0;
+}
+
+/*
+ * The vendor hypervisor range of function IDs is anybody's: only make the
+ * PV scheduling calls to a hypervisor that identifies itself as KVM. The
+ * Call UID query is part of SMCCC from its first version, so any hypervisor
+ * that takes SMCCC calls, PSCI included, answers it, if only with
+ * SMCCC_RET_NOT_SUPPORTED.
+ */
+static bool __init pvsched_hyp_is_kvm(void)
+{
+	struct arm_smccc_res res;
+
+	arm_smccc_hvc(ARM_SMCCC_HV_CALL_UID, 0, 0, 0, 0, 0, 0, 0, &res);
+
+	return (u32)res.a0 == ARM_SMCCC_HV_UID_KVM_0 &&
+	       (u32)res.a1 == ARM_SMCCC_HV_UID_KVM_1 &&
+	       (u32)res.a2 == ARM_SMCCC_HV_UID_KVM_2 &&
+	       (u32)res.a3 == ARM_SMCCC_HV_UID_KVM_3;
+}
+
+static u64 kvm_steal_clock(int cpu)
+{
+	struct pvsched_vcpu_state *st = &per_cpu(pvsched_state, cpu);
+
+	return le64_to_cpu(READ_ONCE(st->stolen_time));
+}
+
+static int pvsched_cpu_online(unsigned int cpu)
+{
+	struct pvsched_vcpu_state *st = per_cpu_ptr(&pvsched_state, cpu);
+	long ret;
+
+	ret = pvsched_hvc(ARM_SMCCC_HV_PV_SCHED_IPA_INIT,
+			  per_cpu_ptr_to_phys(st));
+	if (ret != SMCCC_RET_SUCCESS)
+		pr_warn("failed to register the state of CPU%u\n", cpu);
+
+	return 0;
+}
+
+static int pvsched_cpu_down_prepare(unsigned int cpu)
+{
+	pvsched_hvc(ARM_SMCCC_HV_PV_SCHED_IPA_INIT, 0);
+	return 0;
+}
+
+static int __init kvm_pvsched_init(void)
+{
+	int ret;
+
+	/* Only probe a hypervisor we're already making SMCCC calls to */
+	if (psci_ops.conduit != PSCI_CONDUIT_HVC || !pvsched_hyp_is_kvm())
+		return 0;
+
+	if (pvsched_hvc(ARM_SMCCC_HV_PV_SCHED_FEATURES,
+			ARM_SMCCC_HV_PV_SCHED_IPA_INIT) != SMCCC_RET_SUCCESS)
+		return 0;
+
+	ret = cpuhp_setup_state(CPUHP_AP_ONLINE_DYN, "arm64/pvsched:online",
+				pvsched_cpu_online, pvsched_cpu_down_prepare);
+	if (ret < 0)
+		return ret;
+
+	pv_time_ops.steal_clock = kvm_steal_clock;
+	static_key_slow_inc(&paravirt_steal_enabled);
+	static_key_slow_inc(&paravirt_steal_rq_enabled);
+
+	pr_info("using stolen time PV\n");
+	return 0;
+}
+early_initcall(kvm_pvsched_init);
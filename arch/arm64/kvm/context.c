@@ -20,6 +20,8 @@
 #include <asm/esr.h>
 #include <asm/kvm_mmu.h>
 
+#include "trace.h"
+
 struct el1_el2_map {
 	int	el1;
 	int	el2;
@@ -118,7 +120,17 @@ static void sync_shadow_el1_sysregs(struct kvm_vcpu *vcpu)
 	}
 }
 
-static void flush_shadow_el1_sysregs_nvhe(struct kvm_vcpu *vcpu)
+/*
+ * Whether @reg has to be copied to the shadow state. A NULL @dirty bitmap
+ * means that the whole shadow state is rebuilt.
+ */
+static bool shadow_reg_is_dirty(const unsigned long *dirty, int reg)
+{
+	return !dirty || test_bit(reg, dirty);
+}
+
+static void flush_shadow_el1_sysregs_nvhe(struct kvm_vcpu *vcpu,
+					  const unsigned long *dirty)
 {
 	u64 *s_sys_regs = vcpu->arch.ctxt.shadow_sys_regs;
 	u64 tcr_el2;
@@ -127,27 +139,34 @@ static void flush_shadow_el1_sysregs_nvhe(struct kvm_vcpu *vcpu)
 	for (i = 0; i < ARRAY_SIZE(el1_el2_map); i++) {
 		const struct el1_el2_map *map = &el1_el2_map[i];
 
-		s_sys_regs[map->el1] = vcpu_sys_reg(vcpu, map->el2);
+		if (shadow_reg_is_dirty(dirty, map->el2))
+			s_sys_regs[map->el1] = vcpu_sys_reg(vcpu, map->el2);
 	}
 
-	tcr_el2 = vcpu_sys_reg(vcpu, TCR_EL2);
-	s_sys_regs[TCR_EL1] =
-		TCR_EPD1 |	/* disable TTBR1_EL1 */
-		((tcr_el2 & TCR_EL2_TBI) ? TCR_TBI0 : 0) |
-		tcr_el2_ips_to_tcr_el1_ps(tcr_el2) |
-		(tcr_el2 & TCR_EL2_TG0_MASK) |
-		(tcr_el2 & TCR_EL2_ORGN0_MASK) |
-		(tcr_el2 & TCR_EL2_IRGN0_MASK) |
-		(tcr_el2 & TCR_EL2_T0SZ_MASK);
+	if (shadow_reg_is_dirty(dirty, TCR_EL2)) {
+		tcr_el2 = vcpu_sys_reg(vcpu, TCR_EL2);
+		s_sys_regs[TCR_EL1] =
+			TCR_EPD1 |	/* disable TTBR1_EL1 */
+			((tcr_el2 & TCR_EL2_TBI) ? TCR_TBI0 : 0) |
+			tcr_el2_ips_to_tcr_el1_ps(tcr_el2) |
+			(tcr_el2 & TCR_EL2_TG0_MASK) |
+			(tcr_el2 & TCR_EL2_ORGN0_MASK) |
+			(tcr_el2 & TCR_EL2_IRGN0_MASK) |
+			(tcr_el2 & TCR_EL2_T0SZ_MASK);
+	}
 
 	/* Rely on separate VMID for VA context, always use ASID 0 */
-	s_sys_regs[TTBR0_EL1] &= ~GENMASK_ULL(63, 48);
+	if (shadow_reg_is_dirty(dirty, TTBR0_EL2))
+		s_sys_regs[TTBR0_EL1] &= ~GENMASK_ULL(63, 48);
 	s_sys_regs[TTBR1_EL1] = 0;
 
-	s_sys_regs[CPACR_EL1] = cptr_to_cpacr(vcpu_sys_reg(vcpu, CPTR_EL2));
+	if (shadow_reg_is_dirty(dirty, CPTR_EL2))
+		s_sys_regs[CPACR_EL1] =
+			cptr_to_cpacr(vcpu_sys_reg(vcpu, CPTR_EL2));
 }
 
-static void flush_shadow_el1_sysregs_vhe(struct kvm_vcpu *vcpu)
+static void flush_shadow_el1_sysregs_vhe(struct kvm_vcpu *vcpu,
+					 const unsigned long *dirty)
 {
 	u64 *s_sys_regs = vcpu->arch.ctxt.shadow_sys_regs;
 	int i;
@@ -160,6 +179,9 @@ static void flush_shadow_el1_sysregs_vhe(struct kvm_vcpu *vcpu)
 		const struct el1_el2_map *map = &vhe_map[i];
 		u64 *el1_reg = &s_sys_regs[map->el1];
 
+		if (!shadow_reg_is_dirty(dirty, map->el2))
+			continue;
+
 		if (map->el2 == CPTR_EL2)
 			*el1_reg = cptr_to_cpacr(vcpu_sys_reg(vcpu, map->el2));
 		else
@@ -167,12 +189,13 @@ static void flush_shadow_el1_sysregs_vhe(struct kvm_vcpu *vcpu)
 	}
 }
 
-static void flush_shadow_el1_sysregs(struct kvm_vcpu *vcpu)
+static void flush_shadow_el1_sysregs(struct kvm_vcpu *vcpu,
+				     const unsigned long *dirty)
 {
 	if (vcpu_el2_e2h_is_set(vcpu))
-		flush_shadow_el1_sysregs_vhe(vcpu);
+		flush_shadow_el1_sysregs_vhe(vcpu, dirty);
 	else
-		flush_shadow_el1_sysregs_nvhe(vcpu);
+		flush_shadow_el1_sysregs_nvhe(vcpu, dirty);
 }
 
 static void setup_s2_mmu(struct kvm_vcpu *vcpu)
@@ -209,8 +232,10 @@ static const int el1_non_trap_regs[] = {
  * they in no way affect execution state in virtual EL2.   However, we must
  * still ensure that virtual EL2 observes the same state of the EL1 registers
  * as the normal VM's EL1 mode, so copy this state as needed on setup/restore.
+ * On setup, only the registers set in @dirty are copied unless it is NULL.
  */
-static void copy_shadow_non_trap_el1_state(struct kvm_vcpu *vcpu, bool setup)
+static void copy_shadow_non_trap_el1_state(struct kvm_vcpu *vcpu, bool setup,
+					   const unsigned long *dirty)
 {
 	u64 *s_sys_regs = vcpu->arch.ctxt.shadow_sys_regs;
 	int i;
@@ -225,21 +250,61 @@ static void copy_shadow_non_trap_el1_state(struct kvm_vcpu *vcpu, bool setup)
 		if (vcpu_el2_e2h_is_set(vcpu) && sr == CNTKCTL_EL1)
 			continue;
 
-		if (setup)
-			s_sys_regs[sr] = vcpu_sys_reg(vcpu, sr);
-		else
+		if (setup) {
+			if (shadow_reg_is_dirty(dirty, sr))
+				s_sys_regs[sr] = vcpu_sys_reg(vcpu, sr);
+		} else
 			vcpu_sys_reg(vcpu, sr) = s_sys_regs[sr];
 	}
 }
 
+/*
+ * The shadow EL1 state is left alone while the nested VM runs on the EL1
+ * registers, except for the registers both share.
+ */
+static void dirty_shadow_non_trap_el1_state(struct kvm_vcpu *vcpu)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(el1_non_trap_regs); i++)
+		vcpu_shadow_reg_dirty(vcpu, el1_non_trap_regs[i]);
+}
+
 static void sync_shadow_non_trap_el1_state(struct kvm_vcpu *vcpu)
 {
-	copy_shadow_non_trap_el1_state(vcpu, false);
+	copy_shadow_non_trap_el1_state(vcpu, false, NULL);
 }
 
-static void flush_shadow_non_trap_el1_state(struct kvm_vcpu *vcpu)
+static void flush_shadow_non_trap_el1_state(struct kvm_vcpu *vcpu,
+					    const unsigned long *dirty)
 {
-	copy_shadow_non_trap_el1_state(vcpu, true);
+	copy_shadow_non_trap_el1_state(vcpu, true, dirty);
+}
+
+/*
+ * Bring the shadow EL1 state in line with the virtual EL2 state. The shadow
+ * state is left untouched while the vcpu runs in virtual EL2, and synced back
+ * on each exit, so back to back entries to virtual EL2 only need to copy the
+ * registers that have been written in between. Entering from EL1, a change
+ * of HCR_EL2.E2H, or a write we don't track one register at a time rebuilds
+ * everything.
+ */
+static void flush_shadow_el1_state(struct kvm_vcpu *vcpu)
+{
+	const unsigned long *dirty = vcpu->arch.shadow_dirty;
+	bool e2h = vcpu_el2_e2h_is_set(vcpu);
+
+	if (!vcpu->arch.shadow_valid || vcpu->arch.shadow_e2h != e2h)
+		dirty = NULL;
+	else if (bitmap_empty(dirty, NR_SYS_REGS))
+		return;
+
+	flush_shadow_el1_sysregs(vcpu, dirty);
+	flush_shadow_non_trap_el1_state(vcpu, dirty);
+
+	bitmap_zero(vcpu->arch.shadow_dirty, NR_SYS_REGS);
+	vcpu->arch.shadow_valid = true;
+	vcpu->arch.shadow_e2h = e2h;
 }
 
 static void flush_shadow_special_regs(struct kvm_vcpu *vcpu)
@@ -272,6 +337,11 @@ static void flush_special_regs(struct kvm_vcpu *vcpu)
 
 	ctxt->hw_pstate = *vcpu_cpsr(vcpu);
 	ctxt->hw_sys_regs = ctxt->sys_regs;
+
+	/* Otherwise the EL1 registers are already on the CPU */
+	if (vcpu->arch.sysregs_loaded_on_cpu)
+		return;
+
 	ctxt->hw_sp_el1 = ctxt->gp_regs.sp_el1;
 	ctxt->hw_elr_el1 = ctxt->gp_regs.elr_el1;
 	ctxt->hw_spsr_el1 = ctxt->gp_regs.spsr[KVM_SPSR_EL1];
@@ -299,6 +369,10 @@ static void sync_special_regs(struct kvm_vcpu *vcpu)
 	struct kvm_cpu_context *ctxt = &vcpu->arch.ctxt;
 
 	*vcpu_cpsr(vcpu) = ctxt->hw_pstate;
+
+	if (vcpu->arch.sysregs_loaded_on_cpu)
+		return;
+
 	ctxt->gp_regs.sp_el1 = ctxt->hw_sp_el1;
 	ctxt->gp_regs.elr_el1 = ctxt->hw_elr_el1;
 	ctxt->gp_regs.spsr[KVM_SPSR_EL1] = ctxt->hw_spsr_el1;
@@ -312,7 +386,8 @@ static void setup_mpidr_el1(struct kvm_vcpu *vcpu)
 	 * it comes from the virtual VMPIDR_EL2.
 	 */
 	if (nested_virt_in_use(vcpu))
-		vcpu_sys_reg(vcpu, MPIDR_EL1) = vcpu_sys_reg(vcpu, VMPIDR_EL2);
+		vcpu_write_sys_reg(vcpu, vcpu_sys_reg(vcpu, VMPIDR_EL2),
+				   MPIDR_EL1);
 }
 
 /**
@@ -322,23 +397,51 @@ static void setup_mpidr_el1(struct kvm_vcpu *vcpu)
 void kvm_arm_setup_shadow_state(struct kvm_vcpu *vcpu)
 {
 	struct kvm_cpu_context *ctxt = &vcpu->arch.ctxt;
+	u64 start = 0;
+
+	if (trace_kvm_nested_shadow_state_enabled())
+		start = ktime_get_ns();
 
-	vgic_handle_nested_maint_irq(vcpu);
+	if (kvm_vgic_global_state.type == VGIC_V3)
+		vgic_v3_handle_nested_maint_irq(vcpu);
+	else
+		vgic_handle_nested_maint_irq(vcpu);
 
+	/*
+	 * The EL1 registers of the vcpu can stay loaded on the CPU across
+	 * runs, but the virtual EL2 runs on the shadow registers, which are
+	 * switched on every run. Entering it, save the EL1 state so that it
+	 * is seen by the shadow state, and load it again on the way back.
+	 */
 	if (unlikely(is_hyp_ctxt(vcpu))) {
+		kvm_vcpu_put_sysregs(vcpu);
 		flush_shadow_special_regs(vcpu);
-		flush_shadow_el1_sysregs(vcpu);
-		flush_shadow_non_trap_el1_state(vcpu);
+		flush_shadow_el1_state(vcpu);
 		ctxt->hw_sys_regs = ctxt->shadow_sys_regs;
+		kvm_pv_el2_page_flush(vcpu);
 	} else {
+		/* Running EL1 changes the non-trapped EL1 registers */
+		dirty_shadow_non_trap_el1_state(vcpu);
 		flush_special_regs(vcpu);
 		setup_mpidr_el1(vcpu);
 		ctxt->hw_sys_regs = ctxt->sys_regs;
+		kvm_vcpu_load_sysregs(vcpu);
 	}
 
 	setup_s2_mmu(vcpu);
 
-	vgic_v2_setup_shadow_state(vcpu);
+	/*
+	 * The hyp code saves and restores the CPU interface of the host GIC,
+	 * so that is the flavour of shadow state to build.
+	 */
+	if (kvm_vgic_global_state.type == VGIC_V3)
+		vgic_v3_setup_shadow_state(vcpu);
+	else
+		vgic_v2_setup_shadow_state(vcpu);
+
+	if (trace_kvm_nested_shadow_state_enabled())
+		trace_kvm_nested_shadow_state(vcpu, is_hyp_ctxt(vcpu),
+					      ktime_get_ns() - start);
 }
 
 /**
@@ -351,10 +454,14 @@ void kvm_arm_restore_shadow_state(struct kvm_vcpu *vcpu)
 		sync_shadow_special_regs(vcpu);
 		sync_shadow_non_trap_el1_state(vcpu);
 		sync_shadow_el1_sysregs(vcpu);
+		kvm_pv_el2_page_sync(vcpu);
 	} else
 		sync_special_regs(vcpu);
 
-	vgic_v2_restore_shadow_state(vcpu);
+	if (kvm_vgic_global_state.type == VGIC_V3)
+		vgic_v3_restore_shadow_state(vcpu);
+	else
+		vgic_v2_restore_shadow_state(vcpu);
 }
 
 void kvm_arm_init_cpu_context(kvm_cpu_context_t *cpu_ctxt)
@@ -0,0 +1,384 @@
+/*
+ * Copyright (C) 2017 - Linaro Ltd
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/debugfs.h>
+#include <linux/kvm_host.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+
+#include <asm/kvm_mmu.h>
+#include <asm/kvm_nested_pv_encoding.h>
+#include <asm/kvm_rmap.h>
+#include <kvm/arm_lock_stat.h>
+
+/*
+ * Collect the exit profile of every vcpu, readable and reset through the
+ * vcpu's debugfs exit_profile file. Off by default, as it costs two clock
+ * reads per exit and some memory per vcpu.
+ */
+static bool exit_profile;
+
+static int __init early_exit_profile_cfg(char *buf)
+{
+	return strtobool(buf, &exit_profile);
+}
+early_param("kvm-arm.exit_profile", early_exit_profile_cfg);
+
+static const char * const pv_class_names[] = {
+	[MRS_PV]	= "pv_mrs",
+	[MSR_REG_PV]	= "pv_msr",
+	[MSR_IMM_PV]	= "pv_msr_imm",
+	[ERET_PV]	= "pv_eret",
+	[TLBI_PV]	= "pv_tlbi",
+	[HVC_PV]	= "pv_hvc",
+	[BATCH_PV]	= "pv_batch",
+};
+
+static void exit_profile_show_class(struct seq_file *m, int class)
+{
+	int pv = class - KVM_EXIT_PROF_PV;
+
+	if (class < KVM_EXIT_PROF_PV)
+		seq_printf(m, "ec_0x%02x", class);
+	else if (class == KVM_EXIT_PROF_IRQ)
+		seq_puts(m, "irq");
+	else if (class == KVM_EXIT_PROF_SERROR)
+		seq_puts(m, "serror");
+	else if (class == KVM_EXIT_PROF_OTHER)
+		seq_puts(m, "other");
+	else if (pv < ARRAY_SIZE(pv_class_names) && pv_class_names[pv])
+		seq_puts(m, pv_class_names[pv]);
+	else
+		seq_printf(m, "pv_%d", pv);
+}
+
+/*
+ * One line per exit class that was seen: the number of exits and the total
+ * time spent handling them for each origin, then the histogram of handling
+ * times. The header names the upper bound of each histogram bucket.
+ */
+static int exit_profile_show(struct seq_file *m, void *v)
+{
+	struct kvm_vcpu *vcpu = m->private;
+	struct kvm_exit_profile *prof = vcpu->arch.exit_profile;
+	int class, i;
+
+	seq_puts(m, "# class guest vel2 nested guest_ns vel2_ns nested_ns");
+	for (i = 0; i < KVM_EXIT_PROF_BUCKETS - 1; i++)
+		seq_printf(m, " lt_%luns", 1UL << (i + 8));
+	seq_puts(m, " more\n");
+
+	for (class = 0; class < KVM_EXIT_PROF_NR; class++) {
+		u64 *count = prof->count[class];
+		u64 *time_ns = prof->time_ns[class];
+
+		if (!count[KVM_EXIT_FROM_GUEST] && !count[KVM_EXIT_FROM_VEL2] &&
+		    !count[KVM_EXIT_FROM_NESTED])
+			continue;
+
+		exit_profile_show_class(m, class);
+		seq_printf(m, " %llu %llu %llu %llu %llu %llu",
+			   count[KVM_EXIT_FROM_GUEST],
+			   count[KVM_EXIT_FROM_VEL2],
+			   count[KVM_EXIT_FROM_NESTED],
+			   time_ns[KVM_EXIT_FROM_GUEST],
+			   time_ns[KVM_EXIT_FROM_VEL2],
+			   time_ns[KVM_EXIT_FROM_NESTED]);
+		for (i = 0; i < KVM_EXIT_PROF_BUCKETS; i++)
+			seq_printf(m, " %llu", prof->hist[class][i]);
+		seq_putc(m, '\n');
+	}
+
+	return 0;
+}
+
+static int exit_profile_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, exit_profile_show, inode->i_private);
+}
+
+/* Any write clears the profile */
+static ssize_t exit_profile_write(struct file *file, const char __user *buf,
+				  size_t len, loff_t *ppos)
+{
+	struct kvm_vcpu *vcpu = file_inode(file)->i_private;
+	struct kvm_exit_profile *prof = vcpu->arch.exit_profile;
+
+	memset(prof->count, 0, sizeof(prof->count));
+	memset(prof->time_ns, 0, sizeof(prof->time_ns));
+	memset(prof->hist, 0, sizeof(prof->hist));
+
+	return len;
+}
+
+static const struct file_operations exit_profile_fops = {
+	.owner		= THIS_MODULE,
+	.open		= exit_profile_open,
+	.read		= seq_read,
+	.write		= exit_profile_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+bool kvm_arm_has_vcpu_debugfs(void)
+{
+	return exit_profile;
+}
+
+int kvm_arm_create_vcpu_debugfs(struct kvm_vcpu *vcpu)
+{
+	vcpu->arch.exit_profile = kzalloc(sizeof(*vcpu->arch.exit_profile),
+					  GFP_KERNEL);
+	if (!vcpu->arch.exit_profile)
+		return -ENOMEM;
+
+	if (!debugfs_create_file("exit_profile", 0644, vcpu->debugfs_dentry,
+				 vcpu, &exit_profile_fops))
+		return -ENOMEM;
+
+	return 0;
+}
+
+void kvm_arm_exit_profile_free(struct kvm_vcpu *vcpu)
+{
+	kfree(vcpu->arch.exit_profile);
+	vcpu->arch.exit_profile = NULL;
+}
+
+/*
+ * What a stage 2 table maps. A pte table that is full could have been a
+ * block, had the memory behind it been contiguous.
+ */
+struct s2_census {
+	unsigned long pte;
+	unsigned long pmd_block;
+	unsigned long pud_block;
+	unsigned long pte_table;
+	unsigned long pte_table_full;
+};
+
+static void s2_census_ptes(pmd_t *pmd, phys_addr_t addr, phys_addr_t end,
+			   struct s2_census *c)
+{
+	pte_t *pte = pte_offset_kernel(pmd, addr);
+	unsigned long n = 0;
+
+	do {
+		if (!pte_none(*pte))
+			n++;
+	} while (pte++, addr += PAGE_SIZE, addr != end);
+
+	c->pte += n;
+	c->pte_table++;
+	if (n == PTRS_PER_PTE)
+		c->pte_table_full++;
+}
+
+static void s2_census_pmds(pud_t *pud, phys_addr_t addr, phys_addr_t end,
+			   struct s2_census *c)
+{
+	pmd_t *pmd = stage2_pmd_offset(pud, addr);
+	phys_addr_t next;
+
+	do {
+		next = stage2_pmd_addr_end(addr, end);
+		if (!pmd_none(*pmd)) {
+			if (pmd_thp_or_huge(*pmd))
+				c->pmd_block++;
+			else
+				s2_census_ptes(pmd, addr, next, c);
+		}
+	} while (pmd++, addr = next, addr != end);
+}
+
+static void s2_census_puds(pgd_t *pgd, phys_addr_t addr, phys_addr_t end,
+			   struct s2_census *c)
+{
+	pud_t *pud = stage2_pud_offset(pgd, addr);
+	phys_addr_t next;
+
+	do {
+		next = stage2_pud_addr_end(addr, end);
+		if (!stage2_pud_none(*pud)) {
+			if (stage2_pud_huge(*pud))
+				c->pud_block++;
+			else
+				s2_census_pmds(pud, addr, next, c);
+		}
+	} while (pud++, addr = next, addr != end);
+}
+
+/*
+ * Faults only ever add to the tables under the read side of mmu_lock, so
+ * that is enough to walk them. It is dropped between pgd entries, as the
+ * walk of a large VM can take a while.
+ */
+static void s2_census(struct kvm *kvm, struct kvm_s2_mmu *mmu,
+		      struct s2_census *c)
+{
+	phys_addr_t addr = 0, end = KVM_PHYS_SIZE, next;
+	pgd_t *pgd;
+
+	do {
+		next = stage2_pgd_addr_end(addr, end);
+		read_lock(&kvm->mmu_lock);
+		if (!mmu->pgd) {
+			kvm_mmu_read_unlock(kvm);
+			break;
+		}
+		pgd = mmu->pgd + stage2_pgd_index(addr);
+		if (stage2_pgd_present(*pgd))
+			s2_census_puds(pgd, addr, next, c);
+		kvm_mmu_read_unlock(kvm);
+		cond_resched();
+	} while (addr = next, addr != end);
+}
+
+static void s2_census_show(struct seq_file *m, struct kvm *kvm,
+			   struct kvm_s2_mmu *mmu, const char *name, u64 id)
+{
+	struct s2_census c = { 0 };
+	unsigned long block_kb;
+
+	s2_census(kvm, mmu, &c);
+	block_kb = (c.pmd_block * (PMD_SIZE >> 10)) +
+		   (c.pud_block * (PUD_SIZE >> 10));
+
+	seq_printf(m, "%s %#llx %lu %lu %lu %lu %lu %lu %lu\n", name, id,
+		   c.pte, c.pmd_block, c.pud_block, c.pte_table,
+		   c.pte_table_full, c.pte * (PAGE_SIZE >> 10) + block_kb,
+		   block_kb);
+}
+
+/* Bucket i counts the L1 pages with [2^(i-1), 2^i] shadow mappings */
+#define RMAP_HIST_BUCKETS	6
+#define RMAP_CENSUS_BATCH	512
+
+static void rmap_census(struct kvm *kvm, unsigned long *hist)
+{
+	struct kvm_memslots *slots;
+	struct kvm_memory_slot *memslot;
+	int idx;
+
+	idx = srcu_read_lock(&kvm->srcu);
+	slots = kvm_memslots(kvm);
+	kvm_for_each_memslot(memslot, slots) {
+		unsigned long i = 0, next;
+
+		if (!memslot->arch.rmap)
+			continue;
+
+		while (i < memslot->npages) {
+			next = min(i + RMAP_CENSUS_BATCH, memslot->npages);
+
+			read_lock(&kvm->mmu_lock);
+			for (; i < next; i++) {
+				struct kvm_rmap_head *curr;
+				struct rmap_iterator iter;
+				int len = 0;
+
+				for_each_rmap_head(&memslot->arch.rmap[i],
+						   &iter, curr)
+					len++;
+				if (len)
+					hist[min(fls(len - 1),
+						 RMAP_HIST_BUCKETS - 1)]++;
+			}
+			kvm_mmu_read_unlock(kvm);
+			cond_resched();
+		}
+	}
+	srcu_read_unlock(&kvm->srcu, idx);
+}
+
+/*
+ * One line for the VM's stage 2, then one per shadow stage 2 with the
+ * virtual VTTBR it shadows, then the histogram of the number of shadow
+ * mappings of each L1 page.
+ */
+static int stage2_show(struct seq_file *m, void *v)
+{
+	struct kvm *kvm = m->private;
+	struct kvm_nested_s2_mmu *nested_mmu;
+	unsigned long hist[RMAP_HIST_BUCKETS] = { 0 };
+	int i;
+
+	seq_puts(m, "# mmu id pte pmd_block pud_block pte_table pte_table_full"
+		    " mapped_kb block_kb\n");
+	s2_census_show(m, kvm, &kvm->arch.mmu, "s2", kvm->arch.mmu.vmid.vmid);
+
+	/* Shadow stage 2 contexts are only ever freed with the VM */
+	list_for_each_entry_rcu(nested_mmu, &kvm->arch.nested_mmu_list, list) {
+		if (nested_mmu->mapped_start >= nested_mmu->mapped_end)
+			continue;
+		s2_census_show(m, kvm, &nested_mmu->mmu, "nested",
+			       nested_mmu->virtual_vttbr);
+	}
+
+	rmap_census(kvm, hist);
+	seq_puts(m, "# rmap 1 2 3-4 5-8 9-16 more\nrmap");
+	for (i = 0; i < RMAP_HIST_BUCKETS; i++)
+		seq_printf(m, " %lu", hist[i]);
+	seq_putc(m, '\n');
+
+	return 0;
+}
+
+static int stage2_open(struct inode *inode, struct file *file)
+{
+	struct kvm *kvm = inode->i_private;
+	int ret;
+
+	/* The file can be opened while the VM is being torn down */
+	if (!refcount_inc_not_zero(&kvm->users_count))
+		return -ENOENT;
+
+	ret = single_open(file, stage2_show, kvm);
+	if (ret)
+		kvm_put_kvm(kvm);
+
+	return ret;
+}
+
+static int stage2_release(struct inode *inode, struct file *file)
+{
+	struct kvm *kvm = inode->i_private;
+
+	single_release(inode, file);
+	kvm_put_kvm(kvm);
+
+	return 0;
+}
+
+static const struct file_operations stage2_fops = {
+	.owner		= THIS_MODULE,
+	.open		= stage2_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= stage2_release,
+};
+
+int kvm_arm_create_vm_debugfs(struct kvm *kvm)
+{
+	if (!kvm->debugfs_dentry)
+		return -ENOENT;
+
+	if (!debugfs_create_file("stage2", 0444, kvm->debugfs_dentry, kvm,
+				 &stage2_fops))
+		return -ENOMEM;
+
+	return 0;
+}
@@ -73,6 +73,12 @@ static int kvm_inject_nested(struct kvm_vcpu *vcpu, u64 esr_el2,
 	*vcpu_cpsr(vcpu) |=  (PSR_A_BIT | PSR_F_BIT | PSR_I_BIT | PSR_D_BIT);
 
 	trace_kvm_inject_nested_exception(vcpu, esr_el2, *vcpu_pc(vcpu));
+	vcpu->stat.nested_el2_entry++;
+
+	/* Also cover the fault registers our callers may have set */
+	vcpu_shadow_reg_dirty(vcpu, ESR_EL2);
+	vcpu_shadow_reg_dirty(vcpu, FAR_EL2);
+	vcpu_shadow_reg_dirty(vcpu, HPFAR_EL2);
 
 	return ret;
 }
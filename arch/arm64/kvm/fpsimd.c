@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2017 - Linaro Ltd
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/irqflags.h>
+#include <linux/kvm_host.h>
+#include <linux/sched.h>
+#include <linux/thread_info.h>
+
+#include <asm/fpsimd.h>
+#include <asm/kvm_asm.h>
+#include <asm/kvm_mmu.h>
+
+/*
+ * The guest FP state is loaded by the first FP access of the guest after
+ * kvm_arch_vcpu_load(), which traps to EL2. It then stays in the registers,
+ * bound to the CPU as with any userland state, until kvm_arch_vcpu_put() or
+ * until the host needs the registers for something else: a context switch or
+ * kernel mode NEON save it to the vcpu through the usual fpsimd code.
+ *
+ * KVM_ARM64_FP_ENABLED is set while the guest state is in the registers, so
+ * that EL2 doesn't trap the guest's accesses. KVM_ARM64_FP_HOST is set while
+ * they still hold the userland state of current, which EL2 saves to
+ * vcpu->arch.host_fpsimd_state before loading the guest state.
+ */
+
+/*
+ * Map the userland FP state of current at EL2, for it to be saved there.
+ * The vcpu is nearly always run by the same task, which needs to be done
+ * once.
+ */
+int kvm_arch_vcpu_run_map_fp(struct kvm_vcpu *vcpu)
+{
+	struct user_fpsimd_state *fpsimd = &current->thread.fpsimd_state.user_fpsimd;
+	int ret;
+
+	if (vcpu->arch.host_fpsimd_state == fpsimd)
+		return 0;
+
+	ret = create_hyp_mappings(fpsimd, fpsimd + 1, PAGE_HYP);
+	if (ret)
+		return ret;
+
+	vcpu->arch.host_fpsimd_state = fpsimd;
+	return 0;
+}
+
+void kvm_arch_vcpu_load_fp(struct kvm_vcpu *vcpu)
+{
+	vcpu->arch.fp_flags &= ~(KVM_ARM64_FP_ENABLED | KVM_ARM64_FP_HOST);
+
+	if (current->mm && !test_thread_flag(TIF_FOREIGN_FPSTATE))
+		vcpu->arch.fp_flags |= KVM_ARM64_FP_HOST;
+}
+
+/*
+ * Called with interrupts disabled before entering the guest: the host may
+ * have taken the registers over since they were last checked, in which case
+ * their content was saved where it belongs.
+ */
+void kvm_arch_vcpu_ctxflush_fp(struct kvm_vcpu *vcpu)
+{
+	if (test_thread_flag(TIF_FOREIGN_FPSTATE))
+		vcpu->arch.fp_flags &= ~(KVM_ARM64_FP_ENABLED |
+					 KVM_ARM64_FP_HOST);
+}
+
+/*
+ * Called with interrupts disabled after returning from the guest: if it
+ * loaded its FP state, hand the registers over to it, current's userland
+ * state having been saved by EL2.
+ */
+void kvm_arch_vcpu_ctxsync_fp(struct kvm_vcpu *vcpu)
+{
+	if (vcpu->arch.fp_flags & KVM_ARM64_FP_ENABLED)
+		fpsimd_bind_state_to_cpu(&vcpu->arch.ctxt.gp_regs.fp_regs);
+}
+
+/* Write the guest FP state back to the vcpu if it was still live */
+void kvm_arch_vcpu_put_fp(struct kvm_vcpu *vcpu)
+{
+	unsigned long flags;
+
+	local_irq_save(flags);
+
+	if (vcpu->arch.fp_flags & KVM_ARM64_FP_ENABLED)
+		fpsimd_save_and_flush_cpu_state();
+
+	vcpu->arch.fp_flags &= ~(KVM_ARM64_FP_ENABLED | KVM_ARM64_FP_HOST);
+
+	local_irq_restore(flags);
+}
@@ -30,19 +30,64 @@
 #include <asm/kvm.h>
 #include <asm/kvm_emulate.h>
 #include <asm/kvm_coproc.h>
+#include <asm/kvm_mmu.h>
 
 #include "trace.h"
 
 #define VM_STAT(x) { #x, offsetof(struct kvm, stat.x), KVM_STAT_VM }
 #define VCPU_STAT(x) { #x, offsetof(struct kvm_vcpu, stat.x), KVM_STAT_VCPU }
+#define VM_STAT_INSTANT(x) { #x, offsetof(struct kvm, stat.x), KVM_STAT_VM, \
+			     KVM_STATS_TYPE_INSTANT }
+#define VCPU_STAT_NS(x) { #x, offsetof(struct kvm_vcpu, stat.x), \
+			  KVM_STAT_VCPU, KVM_STATS_UNIT_SECONDS, -9 }
+#define VM_STAT_NS(x) { #x, offsetof(struct kvm, stat.x), KVM_STAT_VM, \
+			KVM_STATS_UNIT_SECONDS, -9 }
 
 struct kvm_stats_debugfs_item debugfs_entries[] = {
+	VCPU_STAT(halt_successful_poll),
+	VCPU_STAT(halt_attempted_poll),
+	VCPU_STAT(halt_poll_invalid),
+	VCPU_STAT_NS(halt_poll_success_ns),
+	VCPU_STAT_NS(halt_poll_fail_ns),
+	VCPU_STAT(halt_wakeup),
 	VCPU_STAT(hvc_exit_stat),
 	VCPU_STAT(wfe_exit_stat),
 	VCPU_STAT(wfi_exit_stat),
 	VCPU_STAT(mmio_exit_user),
 	VCPU_STAT(mmio_exit_kernel),
 	VCPU_STAT(exits),
+	VCPU_STAT(nested_s2_fault),
+	VCPU_STAT(nested_s2_walk),
+	VCPU_STAT(nested_s2_walk_cached),
+	VCPU_STAT(nested_tlbi),
+	VCPU_STAT(nested_at),
+	VCPU_STAT(nested_at_walk),
+	VCPU_STAT(nested_pv_exit),
+	VCPU_STAT(nested_el2_entry),
+	VCPU_STAT(nested_eret),
+	VCPU_STAT(nested_fast_eret),
+	VCPU_STAT(nested_hyp_sysreg),
+	VCPU_STAT(nested_wfi_exit),
+	VCPU_STAT(pv_yield),
+	VCPU_STAT(pv_preempt_deferred),
+	VCPU_STAT(s2_remote_table),
+	VCPU_STAT(vgic_lr_underflow),
+	VCPU_STAT(timer_irq),
+	VCPU_STAT(mmu_lock_read_contended),
+	VCPU_STAT_NS(mmu_lock_read_wait_ns),
+	VCPU_STAT(ap_list_lock_contended),
+	VCPU_STAT_NS(ap_list_lock_wait_ns),
+	VCPU_STAT(irq_lock_contended),
+	VCPU_STAT_NS(irq_lock_wait_ns),
+	VM_STAT_INSTANT(nested_mmu_count),
+	VM_STAT(nested_mmu_recycled),
+	VM_STAT(nested_mmu_adopted),
+	VM_STAT(nested_rmap_add),
+	VM_STAT(nested_rmap_remove),
+	VM_STAT(mmu_lock_contended),
+	VM_STAT_NS(mmu_lock_wait_ns),
+	VM_STAT(its_lock_contended),
+	VM_STAT_NS(its_lock_wait_ns),
 	{ NULL }
 };
 
@@ -442,3 +487,54 @@ int kvm_arm_vcpu_arch_has_attr(struct kvm_vcpu *vcpu,
 
 	return ret;
 }
+
+long kvm_arm_vcpu_arch_ioctl(struct kvm_vcpu *vcpu, unsigned int ioctl,
+			     void __user *argp)
+{
+	struct kvm_arm_nested_state *state;
+	long ret;
+
+	switch (ioctl) {
+	case KVM_ARM_GET_NESTED_STATE:
+	case KVM_ARM_SET_NESTED_STATE:
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	/* Not through KVM_ARM_VCPU_INIT yet */
+	if (unlikely(vcpu->arch.target < 0))
+		return -ENOEXEC;
+
+	state = kzalloc(sizeof(*state), GFP_KERNEL);
+	if (!state)
+		return -ENOMEM;
+
+	if (ioctl == KVM_ARM_GET_NESTED_STATE) {
+		ret = kvm_arm_get_nested_state(vcpu, state);
+		if (!ret && copy_to_user(argp, state, sizeof(*state)))
+			ret = -EFAULT;
+	} else {
+		ret = -EFAULT;
+		if (!copy_from_user(state, argp, sizeof(*state)))
+			ret = kvm_arm_set_nested_state(vcpu, state);
+	}
+
+	kfree(state);
+	return ret;
+}
+
+long kvm_arm_vm_arch_ioctl(struct kvm *kvm, unsigned int ioctl,
+			   void __user *argp)
+{
+	struct kvm_arm_nested_passthrough pt;
+
+	switch (ioctl) {
+	case KVM_ARM_NESTED_SET_PASSTHROUGH:
+		if (copy_from_user(&pt, argp, sizeof(pt)))
+			return -EFAULT;
+		return kvm_nested_set_passthrough(kvm, &pt);
+	default:
+		return -EINVAL;
+	}
+}
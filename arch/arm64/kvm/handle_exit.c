@@ -27,6 +27,7 @@
 #include <asm/kvm_coproc.h>
 #include <asm/kvm_emulate.h>
 #include <asm/kvm_mmu.h>
+#include <asm/kvm_nested_pv_encoding.h>
 #include <asm/kvm_psci.h>
 
 #define CREATE_TRACE_POINTS
@@ -56,6 +57,9 @@ static int handle_hvc(struct kvm_vcpu *vcpu, struct kvm_run *run)
 #endif
 	}
 
+	if (kvm_pvsched_call(vcpu))
+		return 1;
+
 	ret = kvm_psci_call(vcpu);
 	if (ret < 0) {
 		kvm_inject_undefined(vcpu);
@@ -146,7 +150,11 @@ static int kvm_handle_wfx(struct kvm_vcpu *vcpu, struct kvm_run *run)
 	} else {
 		trace_kvm_wfx_arm64(*vcpu_pc(vcpu), false);
 		vcpu->stat.wfi_exit_stat++;
-		kvm_vcpu_block(vcpu);
+		if (nested_virt_in_use(vcpu) && !vcpu_mode_el2(vcpu) &&
+		    vcpu_el2_imo_is_set(vcpu))
+			kvm_vcpu_block_nested(vcpu);
+		else
+			kvm_vcpu_block(vcpu);
 		kvm_clear_request(KVM_REQ_UNHALT, vcpu);
 	}
 
@@ -209,6 +217,7 @@ int kvm_handle_eret(struct kvm_vcpu *vcpu, struct kvm_run *run)
 {
 	trace_kvm_nested_eret(vcpu, vcpu_el2_sreg(vcpu, ELR_EL2),
 			      vcpu_el2_sreg(vcpu, SPSR_EL2));
+	vcpu->stat.nested_eret++;
 
 	/*
 	 * Forward this trap to the virtual EL2 if the virtual HCR_EL2.NV
@@ -245,6 +254,133 @@ int kvm_handle_eret(struct kvm_vcpu *vcpu, struct kvm_run *run)
 	return 1;
 }
 
+static bool kvm_exit_is_eret(struct kvm_vcpu *vcpu)
+{
+	switch (kvm_vcpu_trap_get_class(vcpu)) {
+	case ESR_ELx_EC_ERET:
+		return !forward_nv_traps(vcpu);
+#ifdef CONFIG_KVM_ARM_NESTED_PV
+	case ESR_ELx_EC_HVC64:
+		return (kvm_vcpu_hvc_get_imm(vcpu) >> PV_INSTR_SHIFT) == ERET_PV;
+#endif
+	default:
+		return false;
+	}
+}
+
+/**
+ * kvm_arm_fast_eret_mmu - check for an ERET that can skip the exit path
+ * @vcpu:		the vcpu that just exited, with interrupts disabled
+ * @exception_index:	the exit code of __kvm_vcpu_run
+ *
+ * An ERET from the virtual EL2 into an AArch64 nested VM, whose shadow
+ * stage 2 is already held by the vcpu, doesn't need anything from the
+ * preemptible part of the run loop. Return the stage 2 mmu the nested VM will
+ * run with so the caller can check its VMID, or NULL if the exit must take the
+ * normal path.
+ */
+struct kvm_s2_mmu *kvm_arm_fast_eret_mmu(struct kvm_vcpu *vcpu,
+					 int exception_index)
+{
+	u64 spsr;
+
+	if (ARM_EXCEPTION_CODE(exception_index) != ARM_EXCEPTION_TRAP ||
+	    ARM_SERROR_PENDING(exception_index))
+		return NULL;
+
+	if (!nested_virt_in_use(vcpu) || !vcpu_mode_el2(vcpu) ||
+	    !kvm_exit_is_eret(vcpu))
+		return NULL;
+
+	/* A VHE guest hypervisor returning to itself stays in virtual EL2 */
+	if (vcpu_el2_e2h_is_set(vcpu) && vcpu_el2_tge_is_set(vcpu))
+		return NULL;
+
+	spsr = vcpu_el2_sreg(vcpu, SPSR_EL2);
+	if (spsr & PSR_MODE32_BIT)
+		return NULL;
+
+	switch (spsr & PSR_MODE_MASK) {
+	case PSR_MODE_EL0t:
+	case PSR_MODE_EL1t:
+	case PSR_MODE_EL1h:
+		break;
+	default:
+		return NULL;
+	}
+
+	if (!vcpu_nested_stage2_enabled(vcpu))
+		return &vcpu->kvm->arch.mmu;
+
+	return kvm_nested_s2_held_mmu(vcpu);
+}
+
+static void exit_profile_begin(struct kvm_vcpu *vcpu, int exception_index,
+			       u64 *start)
+{
+	struct kvm_exit_profile *prof = vcpu->arch.exit_profile;
+
+	switch (ARM_EXCEPTION_CODE(exception_index)) {
+	case ARM_EXCEPTION_TRAP:
+		prof->class = kvm_vcpu_trap_get_class(vcpu);
+		break;
+	case ARM_EXCEPTION_IRQ:
+		prof->class = KVM_EXIT_PROF_IRQ;
+		break;
+	case ARM_EXCEPTION_EL1_SERROR:
+		prof->class = KVM_EXIT_PROF_SERROR;
+		break;
+	default:
+		prof->class = KVM_EXIT_PROF_OTHER;
+		break;
+	}
+
+	if (!nested_virt_in_use(vcpu))
+		prof->origin = KVM_EXIT_FROM_GUEST;
+	else if (vcpu_mode_el2(vcpu))
+		prof->origin = KVM_EXIT_FROM_VEL2;
+	else
+		prof->origin = KVM_EXIT_FROM_NESTED;
+
+	*start = ktime_get_ns();
+}
+
+static void exit_profile_end(struct kvm_vcpu *vcpu, u64 start)
+{
+	struct kvm_exit_profile *prof = vcpu->arch.exit_profile;
+	u64 delta = ktime_get_ns() - start;
+	int bucket;
+
+	bucket = clamp_t(int, ilog2(delta | 1) - 7, 0,
+			 KVM_EXIT_PROF_BUCKETS - 1);
+
+	prof->count[prof->class][prof->origin]++;
+	prof->time_ns[prof->class][prof->origin] += delta;
+	prof->hist[prof->class][bucket]++;
+}
+
+/*
+ * Emulate the ERET found by kvm_arm_fast_eret_mmu(), once the caller has
+ * committed to re-entering the guest.
+ */
+void kvm_arm_fast_eret(struct kvm_vcpu *vcpu)
+{
+	u64 start;
+
+	vcpu->stat.nested_fast_eret++;
+
+	if (likely(!vcpu->arch.exit_profile)) {
+		kvm_handle_eret(vcpu, NULL);
+		return;
+	}
+
+	exit_profile_begin(vcpu, ARM_EXCEPTION_TRAP, &start);
+	if (kvm_vcpu_trap_get_class(vcpu) == ESR_ELx_EC_HVC64)
+		kvm_exit_profile_set_class(vcpu, KVM_EXIT_PROF_PV + ERET_PV);
+	kvm_handle_eret(vcpu, NULL);
+	exit_profile_end(vcpu, start);
+}
+
 static exit_handle_fn arm_exit_handlers[] = {
 	[0 ... ESR_ELx_EC_MAX]	= kvm_handle_unknown_ec,
 	[ESR_ELx_EC_WFx]	= kvm_handle_wfx,
@@ -277,12 +413,8 @@ static exit_handle_fn kvm_get_exit_handler(struct kvm_vcpu *vcpu)
 	return arm_exit_handlers[hsr_ec];
 }
 
-/*
- * Return > 0 to return to guest, < 0 on error, 0 (and set exit_reason) on
- * proper exit to userspace.
- */
-int handle_exit(struct kvm_vcpu *vcpu, struct kvm_run *run,
-		       int exception_index)
+static int __handle_exit(struct kvm_vcpu *vcpu, struct kvm_run *run,
+			 int exception_index)
 {
 	exit_handle_fn exit_handler;
 
@@ -339,3 +471,23 @@ int handle_exit(struct kvm_vcpu *vcpu, struct kvm_run *run,
 		return 0;
 	}
 }
+
+/*
+ * Return > 0 to return to guest, < 0 on error, 0 (and set exit_reason) on
+ * proper exit to userspace.
+ */
+int handle_exit(struct kvm_vcpu *vcpu, struct kvm_run *run,
+		       int exception_index)
+{
+	u64 start;
+	int ret;
+
+	if (likely(!vcpu->arch.exit_profile))
+		return __handle_exit(vcpu, run, exception_index);
+
+	exit_profile_begin(vcpu, exception_index, &start);
+	ret = __handle_exit(vcpu, run, exception_index);
+	exit_profile_end(vcpu, start);
+
+	return ret;
+}
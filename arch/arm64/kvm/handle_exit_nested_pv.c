@@ -17,10 +17,12 @@
 
 #include <linux/kvm.h>
 #include <linux/kvm_host.h>
+#include <linux/uaccess.h>
 
 #include <asm/kvm_emulate.h>
 #include <asm/kvm_mmu.h>
 #include <asm/kvm_nested_pv.h>
+#include <kvm/arm_lock_stat.h>
 
 #include "sys_regs.h"
 
@@ -46,9 +48,8 @@ static u64 *get_special_reg(struct kvm_vcpu *vcpu, u32 sreg_num)
 	};
 }
 
-static u64* get_sys_regp(struct kvm_vcpu *vcpu, u16 imm)
+static u64 *__get_sys_regp(struct kvm_vcpu *vcpu, u16 imm, u32 sreg_num)
 {
-	u32 sreg_num = get_sysreg_num(imm);
 	u64 *sysregp;
 
 	if (is_el2_reg(imm))
@@ -69,6 +70,11 @@ static u64* get_sys_regp(struct kvm_vcpu *vcpu, u16 imm)
 	return sysregp;
 }
 
+static u64* get_sys_regp(struct kvm_vcpu *vcpu, u16 imm)
+{
+	return __get_sys_regp(vcpu, imm, get_sysreg_num(imm));
+}
+
 static u64* get_gp_regp(struct kvm_vcpu *vcpu, u16 imm)
 {
 	u32 gpreg_num = get_gpreg_num(imm);
@@ -120,48 +126,345 @@ static int handle_msr_pv(struct kvm_vcpu *vcpu)
 				is_el2_reg(imm));
 
 	*sysregp = val;
+	if (get_sysreg_num(imm) < NR_SYS_REGS)
+		vcpu_shadow_reg_dirty(vcpu, get_sysreg_num(imm));
+
+	return ret;
+}
+
+/* Number of batch entries copied from the guest at a time */
+#define PV_BATCH_CHUNK	16
+
+/*
+ * Emulate a whole list of MRS/MSR at once, so that the guest hypervisor can
+ * save and restore a world switch worth of EL2 registers in a single trap.
+ */
+static int pv_batch_exec(struct kvm_vcpu *vcpu, gpa_t gpa)
+{
+	struct pv_el2_batch_entry entries[PV_BATCH_CHUNK];
+	u32 nr, i, n;
+	int idx, ret;
+
+	idx = srcu_read_lock(&vcpu->kvm->srcu);
+
+	ret = kvm_read_guest(vcpu->kvm, gpa, &nr, sizeof(nr));
+	if (ret)
+		goto out;
+
+	if (nr > PV_BATCH_MAX ||
+	    (gpa & (SZ_4K - 1)) + sizeof(struct pv_el2_batch) +
+	    nr * sizeof(struct pv_el2_batch_entry) > SZ_4K) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	gpa += offsetof(struct pv_el2_batch, entries);
+	for (; nr; nr -= n, gpa += n * sizeof(entries[0])) {
+		bool mrs = false;
+
+		n = min_t(u32, nr, PV_BATCH_CHUNK);
+		ret = kvm_read_guest(vcpu->kvm, gpa, entries,
+				     n * sizeof(entries[0]));
+		if (ret)
+			goto out;
+
+		for (i = 0; i < n; i++) {
+			struct pv_el2_batch_entry *e = &entries[i];
+			u64 *sysregp;
+
+			if (e->sysreg > (MS_SYSREG_MASK >> MS_SYSREG_SHIFT) ||
+			    e->sysreg == NR_SYS_REGS) {
+				ret = -EINVAL;
+				goto out;
+			}
+
+			sysregp = __get_sys_regp(vcpu, 0, e->sysreg);
+			if (IS_ERR(sysregp)) {
+				ret = PTR_ERR(sysregp);
+				goto out;
+			}
+
+			switch (e->op) {
+			case PV_BATCH_MRS:
+				e->val = *sysregp;
+				mrs = true;
+				break;
+			case PV_BATCH_MSR:
+				*sysregp = e->val;
+				if (e->sysreg < NR_SYS_REGS)
+					vcpu_shadow_reg_dirty(vcpu, e->sysreg);
+				break;
+			default:
+				ret = -EINVAL;
+				goto out;
+			}
+		}
+
+		if (mrs) {
+			ret = kvm_write_guest(vcpu->kvm, gpa, entries,
+					      n * sizeof(entries[0]));
+			if (ret)
+				goto out;
+		}
+	}
+
+	ret = 1;
+out:
+	srcu_read_unlock(&vcpu->kvm->srcu, idx);
+	return ret;
+}
+
+/* Sysreg numbers of the struct pv_el2_page slots */
+static const u32 pv_el2_page_sysregs[PV_EL2_PAGE_NR] = {
+	[PV_EL2_PAGE_HCR]	= HCR_EL2,
+	[PV_EL2_PAGE_VTTBR]	= VTTBR_EL2,
+	[PV_EL2_PAGE_VTCR]	= VTCR_EL2,
+	[PV_EL2_PAGE_ESR]	= ESR_EL2,
+	[PV_EL2_PAGE_FAR]	= FAR_EL2,
+	[PV_EL2_PAGE_HPFAR]	= HPFAR_EL2,
+	[PV_EL2_PAGE_ELR]	= ELR_EL2_PV,
+	[PV_EL2_PAGE_SPSR]	= SPSR_EL2_PV,
+	[PV_EL2_PAGE_VMPIDR]	= VMPIDR_EL2,
+	[PV_EL2_PAGE_VPIDR]	= VPIDR_EL2,
+	[PV_EL2_PAGE_HSTR]	= HSTR_EL2,
+	[PV_EL2_PAGE_HACR]	= HACR_EL2,
+	[PV_EL2_PAGE_VBAR]	= VBAR_EL2,
+	[PV_EL2_PAGE_SCTLR]	= SCTLR_EL2,
+	[PV_EL2_PAGE_TCR]	= TCR_EL2,
+	[PV_EL2_PAGE_TTBR0]	= TTBR0_EL2,
+	[PV_EL2_PAGE_MAIR]	= MAIR_EL2,
+	[PV_EL2_PAGE_TPIDR]	= TPIDR_EL2,
+	[PV_EL2_PAGE_MDCR]	= MDCR_EL2,
+	[PV_EL2_PAGE_CPTR]	= CPTR_EL2,
+	[PV_EL2_PAGE_CNTHCTL]	= CNTHCTL_EL2,
+	[PV_EL2_PAGE_CNTVOFF]	= CNTVOFF_EL2,
+};
+
+void kvm_pv_el2_page_release(struct kvm_vcpu *vcpu)
+{
+	vcpu->arch.pv_el2_enabled = false;
+}
+
+/*
+ * The register page is accessed through the guest's userspace mapping, so
+ * that the host writes are dirty-logged. The flush and sync run on every
+ * entry to and exit from the virtual EL2 with interrupts disabled: page
+ * faults are disabled, and if the page isn't mapped then, the access fails.
+ * The guest hypervisor then sees stale values, as it would for a page being
+ * migrated, or gets its writes ignored until the next exit.
+ */
+static int pv_el2_page_access(struct kvm_vcpu *vcpu, void *data,
+			      unsigned long len, bool write)
+{
+	struct gfn_to_hva_cache *ghc = &vcpu->arch.pv_el2_ghc;
+	int idx, ret;
+
+	idx = srcu_read_lock(&vcpu->kvm->srcu);
+	pagefault_disable();
+	if (write)
+		ret = kvm_write_guest_cached(vcpu->kvm, ghc, data, len);
+	else
+		ret = kvm_read_guest_cached(vcpu->kvm, ghc, data, len);
+	pagefault_enable();
+	srcu_read_unlock(&vcpu->kvm->srcu, idx);
 
 	return ret;
 }
 
+/*
+ * Publish the virtual EL2 registers to the register page, on every entry to
+ * the virtual EL2. The written mask was cleared by the last sync.
+ */
+void kvm_pv_el2_page_flush(struct kvm_vcpu *vcpu)
+{
+	struct pv_el2_page p;
+	int i;
+
+	if (!vcpu->arch.pv_el2_enabled)
+		return;
+
+	p.written = 0;
+	for (i = 0; i < PV_EL2_PAGE_NR; i++)
+		p.regs[i] = *__get_sys_regp(vcpu, 0, pv_el2_page_sysregs[i]);
+
+	pv_el2_page_access(vcpu, &p, sizeof(p), true);
+}
+
+/*
+ * Pick up the registers the guest hypervisor wrote to the register page
+ * while running in virtual EL2, ahead of the handling of the exit.
+ */
+void kvm_pv_el2_page_sync(struct kvm_vcpu *vcpu)
+{
+	struct pv_el2_page p;
+	unsigned long written;
+	int i;
+
+	if (!vcpu->arch.pv_el2_enabled)
+		return;
+
+	if (pv_el2_page_access(vcpu, &p, sizeof(p), false))
+		return;
+
+	written = p.written & PV_EL2_PAGE_RW_MASK;
+	if (!written)
+		return;
+
+	for_each_set_bit(i, &written, PV_EL2_PAGE_NR) {
+		u32 sreg_num = pv_el2_page_sysregs[i];
+
+		*__get_sys_regp(vcpu, 0, sreg_num) = p.regs[i];
+		if (sreg_num < NR_SYS_REGS)
+			vcpu_shadow_reg_dirty(vcpu, sreg_num);
+	}
+
+	p.written = 0;
+	pv_el2_page_access(vcpu, &p.written, sizeof(p.written), true);
+}
+
+static int pv_el2_page_register(struct kvm_vcpu *vcpu, gpa_t gpa)
+{
+	int idx, ret;
+
+	kvm_pv_el2_page_release(vcpu);
+
+	if (!gpa)
+		return 1;
+
+	if ((gpa & (SZ_4K - 1)) + sizeof(struct pv_el2_page) > SZ_4K)
+		return -EINVAL;
+
+	idx = srcu_read_lock(&vcpu->kvm->srcu);
+	ret = kvm_gfn_to_hva_cache_init(vcpu->kvm, &vcpu->arch.pv_el2_ghc,
+					gpa, sizeof(struct pv_el2_page));
+	srcu_read_unlock(&vcpu->kvm->srcu, idx);
+
+	if (ret)
+		return -EFAULT;
+
+	vcpu->arch.pv_el2_enabled = true;
+	kvm_pv_el2_page_flush(vcpu);
+
+	return 1;
+}
+
+static int handle_batch_pv(struct kvm_vcpu *vcpu)
+{
+	u16 imm = kvm_vcpu_hvc_get_imm(vcpu);
+	u64 *gpregp = get_gp_regp(vcpu, imm);
+	gpa_t gpa = gpregp ? *gpregp : 0;
+
+	switch (get_batch_func(imm)) {
+	case PV_BATCH_EXEC:
+		if (!gpregp)
+			return -EINVAL;
+		return pv_batch_exec(vcpu, gpa);
+	case PV_BATCH_EL2_PAGE:
+		return pv_el2_page_register(vcpu, gpa);
+	default:
+		return -EINVAL;
+	}
+}
+
+/* System instruction encodings of the PV TLBI indexes */
+static const u32 pv_tlbi_insns[TLBI_PV_NR] = {
+	[IPAS2E1IS]	= TLBI_IPAS2E1IS,
+	[VMALLE1IS]	= TLBI_VMALLE1IS,
+	[VMALLS12E1IS]	= TLBI_VMALLS12E1IS,
+	[ALLE2]		= TLBI_ALLE2,
+	[ALLE1IS]	= TLBI_ALLE1IS,
+	[VAE1IS]	= TLBI_VAE1IS,
+	[ASIDE1IS]	= TLBI_ASIDE1IS,
+	[VAAE1IS]	= TLBI_VAAE1IS,
+	[VALE1IS]	= TLBI_VALE1IS,
+	[VAALE1IS]	= TLBI_VAALE1IS,
+	[VMALLE1]	= TLBI_VMALLE1,
+	[VAE1]		= TLBI_VAE1,
+	[ASIDE1]	= TLBI_ASIDE1,
+	[VAAE1]		= TLBI_VAAE1,
+	[VALE1]		= TLBI_VALE1,
+	[VAALE1]	= TLBI_VAALE1,
+	[IPAS2LE1IS]	= TLBI_IPAS2LE1IS,
+	[ALLE2IS]	= TLBI_ALLE2IS,
+	[VAE2IS]	= TLBI_VAE2IS,
+	[VALE2IS]	= TLBI_VALE2IS,
+	[IPAS2E1]	= TLBI_IPAS2E1,
+	[IPAS2LE1]	= TLBI_IPAS2LE1,
+	[VAE2]		= TLBI_VAE2,
+	[ALLE1]		= TLBI_ALLE1,
+	[VALE2]		= TLBI_VALE2,
+	[VMALLS12E1]	= TLBI_VMALLS12E1,
+};
+
+/*
+ * Invalidate the IPA range [start, end) of the current VMID with a single
+ * range unmap of its shadow stage 2 page table.
+ */
+static int handle_tlbi_ipa_range(struct kvm_vcpu *vcpu, u16 imm)
+{
+	u32 gpreg_num = get_gpreg_num(imm);
+	struct kvm_s2_mmu *mmu;
+	phys_addr_t start, end;
+	bool ret;
+
+	/* The range end is in the next register */
+	if (gpreg_num >= 30)
+		return -EINVAL;
+
+	start = vcpu_get_reg(vcpu, gpreg_num);
+	end = min_t(phys_addr_t, vcpu_get_reg(vcpu, gpreg_num + 1),
+		    KVM_PHYS_SIZE);
+	if (start >= end)
+		return 1;
+
+	vcpu->stat.nested_tlbi++;
+
+	kvm_nested_s2_tlb_invalidate(vcpu->kvm);
+
+	kvm_mmu_write_lock(vcpu->kvm);
+	ret = kvm_nested_s2_clear_curr_vmid(vcpu, start, end - start);
+	kvm_mmu_write_unlock(vcpu->kvm);
+
+	if (!ret) {
+		/*
+		 * As for IPAS2E1IS, the current VMID may be for the host OS
+		 * in the VM, which has no shadow stage 2 page table.
+		 */
+		mmu = &vcpu->kvm->arch.mmu;
+		kvm_call_hyp(__kvm_tlb_flush_vmid,
+			     kvm_get_vttbr(&mmu->vmid, mmu));
+	}
+
+	return 1;
+}
+
 static int handle_tlbi_pv(struct kvm_vcpu *vcpu)
 {
 	struct sys_reg_params p;
 	u16 imm = kvm_vcpu_hvc_get_imm(vcpu);
 	int tlbi_idx = get_tlbi_idx(imm);
 	u64 *gpregp = get_gp_regp(vcpu, imm);
+	u32 insn;
 
-	p.Op0 = 1;
-	p.Op1 = 4;
-	p.CRn = 8;
-	p.regval = *gpregp;
-
-	switch(tlbi_idx) {
-	case IPAS2E1IS:
-		p.CRm = 0;
-		p.Op2 = 1;
-		break;
-	case VMALLE1IS:
-		/* Remove this */
-		BUG();
-		break;
-	case VMALLS12E1IS:
-		p.CRm = 3;
-		p.Op2 = 6;
-		break;
-	case ALLE2:
-		p.CRm = 7;
-		p.Op2 = 0;
-		break;
-	case ALLE1IS:
-		p.CRm = 3;
-		p.Op2 = 4;
-		break;
-	default:
-		pr_err("Not supported tlbi instruction via pv");
-		BUG();
+	if (tlbi_idx == IPAS2_RANGE)
+		return handle_tlbi_ipa_range(vcpu, imm);
+
+	if (tlbi_idx >= TLBI_PV_NR || !pv_tlbi_insns[tlbi_idx]) {
+		kvm_err("Unknown PV tlbi instruction: imm: %#04x\n", imm);
+		return -EINVAL;
 	}
 
+	insn = pv_tlbi_insns[tlbi_idx];
+	p.Op0 = sys_reg_Op0(insn);
+	p.Op1 = sys_reg_Op1(insn);
+	p.CRn = sys_reg_CRn(insn);
+	p.CRm = sys_reg_CRm(insn);
+	p.Op2 = sys_reg_Op2(insn);
+	p.regval = gpregp ? *gpregp : 0;
+	p.is_write = true;
+	p.is_aarch32 = false;
+	p.is_32bit = false;
+
 	return __emulate_sys_instr(vcpu, &p, false);
 }
 
@@ -197,6 +500,7 @@ static pv_handle_fn pv_handlers[] = {
 	[MSR_REG_PV]	= handle_msr_pv,
 	[ERET_PV]	= handle_eret_pv,
 	[TLBI_PV]	= handle_tlbi_pv,
+	[BATCH_PV]	= handle_batch_pv,
 };
 
 static pv_handle_fn kvm_get_pv_handler(struct kvm_vcpu *vcpu)
@@ -215,11 +519,26 @@ static pv_handle_fn kvm_get_pv_handler(struct kvm_vcpu *vcpu)
 int handle_pv(struct kvm_vcpu *vcpu)
 {
 	pv_handle_fn pv_handler;
+	u64 start = 0;
+	int ret;
 
 	pv_handler = kvm_get_pv_handler(vcpu);
 	if (!pv_handler)
 		return -ENXIO;
 
-	return pv_handler(vcpu);
+	vcpu->stat.nested_pv_exit++;
+	kvm_exit_profile_set_class(vcpu, KVM_EXIT_PROF_PV +
+				   (kvm_vcpu_hvc_get_imm(vcpu) >> PV_INSTR_SHIFT));
+
+	if (trace_kvm_nested_pv_enabled())
+		start = ktime_get_ns();
+
+	ret = pv_handler(vcpu);
+
+	if (trace_kvm_nested_pv_enabled())
+		trace_kvm_nested_pv(vcpu, kvm_vcpu_hvc_get_imm(vcpu), ret,
+				    ktime_get_ns() - start);
+
+	return ret;
 }
 
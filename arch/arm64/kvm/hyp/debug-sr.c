@@ -65,6 +65,27 @@
 	default:	write_debug(ptr[0], reg, 0);			\
 	}
 
+/* Only load the value registers of the enabled break/watchpoints */
+#define restore_debug_enabled(ptr,reg,nr,ctl)				\
+	switch (nr) {							\
+	case 15:	if (ctl[15] & 1) write_debug(ptr[15], reg, 15);	\
+	case 14:	if (ctl[14] & 1) write_debug(ptr[14], reg, 14);	\
+	case 13:	if (ctl[13] & 1) write_debug(ptr[13], reg, 13);	\
+	case 12:	if (ctl[12] & 1) write_debug(ptr[12], reg, 12);	\
+	case 11:	if (ctl[11] & 1) write_debug(ptr[11], reg, 11);	\
+	case 10:	if (ctl[10] & 1) write_debug(ptr[10], reg, 10);	\
+	case 9:		if (ctl[9] & 1) write_debug(ptr[9], reg, 9);	\
+	case 8:		if (ctl[8] & 1) write_debug(ptr[8], reg, 8);	\
+	case 7:		if (ctl[7] & 1) write_debug(ptr[7], reg, 7);	\
+	case 6:		if (ctl[6] & 1) write_debug(ptr[6], reg, 6);	\
+	case 5:		if (ctl[5] & 1) write_debug(ptr[5], reg, 5);	\
+	case 4:		if (ctl[4] & 1) write_debug(ptr[4], reg, 4);	\
+	case 3:		if (ctl[3] & 1) write_debug(ptr[3], reg, 3);	\
+	case 2:		if (ctl[2] & 1) write_debug(ptr[2], reg, 2);	\
+	case 1:		if (ctl[1] & 1) write_debug(ptr[1], reg, 1);	\
+	default:	if (ctl[0] & 1) write_debug(ptr[0], reg, 0);	\
+	}
+
 #define PMSCR_EL1		sys_reg(3, 0, 9, 9, 0)
 
 #define PMBLIMITR_EL1		sys_reg(3, 0, 9, 10, 0)
@@ -125,16 +146,12 @@ static void __hyp_text __debug_restore_spe(u64 pmscr_el1)
 	write_sysreg_s(pmscr_el1, PMSCR_EL1);
 }
 
-void __hyp_text __debug_save_state(struct kvm_vcpu *vcpu,
-				   struct kvm_guest_debug_arch *dbg,
-				   struct kvm_cpu_context *ctxt)
+static void __hyp_text __debug_save_regs(struct kvm_guest_debug_arch *dbg,
+					 struct kvm_cpu_context *ctxt)
 {
 	u64 aa64dfr0;
 	int brps, wrps;
 
-	if (!(vcpu->arch.debug_flags & KVM_ARM64_DEBUG_DIRTY))
-		return;
-
 	aa64dfr0 = read_sysreg(id_aa64dfr0_el1);
 	brps = (aa64dfr0 >> 12) & 0xf;
 	wrps = (aa64dfr0 >> 20) & 0xf;
@@ -147,16 +164,12 @@ void __hyp_text __debug_save_state(struct kvm_vcpu *vcpu,
 	ctxt->sys_regs[MDCCINT_EL1] = read_sysreg(mdccint_el1);
 }
 
-void __hyp_text __debug_restore_state(struct kvm_vcpu *vcpu,
-				      struct kvm_guest_debug_arch *dbg,
-				      struct kvm_cpu_context *ctxt)
+static void __hyp_text __debug_restore_regs(struct kvm_guest_debug_arch *dbg,
+					    struct kvm_cpu_context *ctxt)
 {
 	u64 aa64dfr0;
 	int brps, wrps;
 
-	if (!(vcpu->arch.debug_flags & KVM_ARM64_DEBUG_DIRTY))
-		return;
-
 	aa64dfr0 = read_sysreg(id_aa64dfr0_el1);
 
 	brps = (aa64dfr0 >> 12) & 0xf;
@@ -170,6 +183,59 @@ void __hyp_text __debug_restore_state(struct kvm_vcpu *vcpu,
 	write_sysreg(ctxt->sys_regs[MDCCINT_EL1], mdccint_el1);
 }
 
+/*
+ * Break/watchpoints programmed by userspace (KVM_GUESTDBG_USE_HW) are only
+ * installed for the guest to run with: it cannot access the debug registers,
+ * as MDCR_EL2.TDA is set, so they never need saving back. All the control
+ * registers still have to be written to disable the host's slots, but the
+ * value registers of the disabled ones don't matter.
+ */
+static void __hyp_text
+__debug_restore_external(struct kvm_guest_debug_arch *dbg,
+			 struct kvm_cpu_context *ctxt)
+{
+	u64 aa64dfr0;
+	int brps, wrps;
+
+	aa64dfr0 = read_sysreg(id_aa64dfr0_el1);
+
+	brps = (aa64dfr0 >> 12) & 0xf;
+	wrps = (aa64dfr0 >> 20) & 0xf;
+
+	restore_debug_enabled(dbg->dbg_bvr, dbgbvr, brps, dbg->dbg_bcr);
+	restore_debug(dbg->dbg_bcr, dbgbcr, brps);
+	restore_debug_enabled(dbg->dbg_wvr, dbgwvr, wrps, dbg->dbg_wcr);
+	restore_debug(dbg->dbg_wcr, dbgwcr, wrps);
+
+	write_sysreg(ctxt->sys_regs[MDCCINT_EL1], mdccint_el1);
+}
+
+void __hyp_text __debug_save_state(struct kvm_vcpu *vcpu,
+				   struct kvm_guest_debug_arch *dbg,
+				   struct kvm_cpu_context *ctxt)
+{
+	if (!(vcpu->arch.debug_flags & KVM_ARM64_DEBUG_DIRTY))
+		return;
+
+	if (vcpu->arch.debug_flags & KVM_ARM64_DEBUG_EXTERNAL)
+		return;
+
+	__debug_save_regs(dbg, ctxt);
+}
+
+void __hyp_text __debug_restore_state(struct kvm_vcpu *vcpu,
+				      struct kvm_guest_debug_arch *dbg,
+				      struct kvm_cpu_context *ctxt)
+{
+	if (!(vcpu->arch.debug_flags & KVM_ARM64_DEBUG_DIRTY))
+		return;
+
+	if (vcpu->arch.debug_flags & KVM_ARM64_DEBUG_EXTERNAL)
+		__debug_restore_external(dbg, ctxt);
+	else
+		__debug_restore_regs(dbg, ctxt);
+}
+
 void __hyp_text __debug_cond_save_host_state(struct kvm_vcpu *vcpu)
 {
 	/* If any of KDE, MDE or KVM_ARM64_DEBUG_DIRTY is set, perform
@@ -178,19 +244,20 @@ void __hyp_text __debug_cond_save_host_state(struct kvm_vcpu *vcpu)
 	    (vcpu->arch.ctxt.sys_regs[MDSCR_EL1] & DBG_MDSCR_MDE))
 		vcpu->arch.debug_flags |= KVM_ARM64_DEBUG_DIRTY;
 
-	__debug_save_state(vcpu, &vcpu->arch.host_debug_state.regs,
-			   kern_hyp_va(vcpu->arch.host_cpu_context));
+	if (vcpu->arch.debug_flags & KVM_ARM64_DEBUG_DIRTY)
+		__debug_save_regs(&vcpu->arch.host_debug_state.regs,
+				  kern_hyp_va(vcpu->arch.host_cpu_context));
 	__debug_save_spe()(&vcpu->arch.host_debug_state.pmscr_el1);
 }
 
 void __hyp_text __debug_cond_restore_host_state(struct kvm_vcpu *vcpu)
 {
 	__debug_restore_spe(vcpu->arch.host_debug_state.pmscr_el1);
-	__debug_restore_state(vcpu, &vcpu->arch.host_debug_state.regs,
-			      kern_hyp_va(vcpu->arch.host_cpu_context));
-
-	if (vcpu->arch.debug_flags & KVM_ARM64_DEBUG_DIRTY)
+	if (vcpu->arch.debug_flags & KVM_ARM64_DEBUG_DIRTY) {
+		__debug_restore_regs(&vcpu->arch.host_debug_state.regs,
+				     kern_hyp_va(vcpu->arch.host_cpu_context));
 		vcpu->arch.debug_flags &= ~KVM_ARM64_DEBUG_DIRTY;
+	}
 }
 
 u32 __hyp_text __kvm_get_mdcr_el2(void)
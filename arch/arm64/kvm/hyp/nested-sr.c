@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2017 - Linaro Ltd
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/types.h>
+
+#include <asm/esr.h>
+#include <asm/kvm_emulate.h>
+#include <asm/kvm_hyp.h>
+#include <asm/kvm_nested_pv_encoding.h>
+#include <asm/sysreg.h>
+
+/*
+ * EL2 registers whose emulation, for an access from the virtual EL2, is a
+ * plain read or write of vcpu->arch.ctxt.sys_regs[]. None of them is part of
+ * the shadow EL1 state nor changed by the hardware while the virtual EL2
+ * runs, so the in-memory copy is always current.
+ *
+ * Writes are only completed at EL2 for the registers that take effect when
+ * the nested VM is entered, as the virtual EL2 is resumed without rebuilding
+ * its shadow state.
+ */
+static bool __hyp_text __nested_sysreg_fast(int reg, bool is_write)
+{
+	switch (reg) {
+	case VTTBR_EL2:
+	case VTCR_EL2:
+	case VMPIDR_EL2:
+	case VPIDR_EL2:
+	case HSTR_EL2:
+	case HACR_EL2:
+	case HPFAR_EL2:
+	case TPIDR_EL2:
+		return true;
+	case HCR_EL2:
+	case MDCR_EL2:
+	case CPTR_EL2:
+	case CNTVOFF_EL2:
+		return !is_write;
+	default:
+		return false;
+	}
+}
+
+static int __hyp_text __nested_sys64_to_reg(u32 sysreg)
+{
+	switch (sysreg) {
+	case SYS_VTTBR_EL2:	return VTTBR_EL2;
+	case SYS_VTCR_EL2:	return VTCR_EL2;
+	case SYS_VMPIDR_EL2:	return VMPIDR_EL2;
+	case SYS_VPIDR_EL2:	return VPIDR_EL2;
+	case SYS_HSTR_EL2:	return HSTR_EL2;
+	case SYS_HACR_EL2:	return HACR_EL2;
+	case SYS_HPFAR_EL2:	return HPFAR_EL2;
+	case SYS_TPIDR_EL2:	return TPIDR_EL2;
+	case SYS_HCR_EL2:	return HCR_EL2;
+	case SYS_MDCR_EL2:	return MDCR_EL2;
+	case SYS_CPTR_EL2:	return CPTR_EL2;
+	case SYS_CNTVOFF_EL2:	return CNTVOFF_EL2;
+	default:		return -1;
+	}
+}
+
+static void __hyp_text __nested_sysreg_access(struct kvm_vcpu *vcpu, int reg,
+					      int rt, bool is_write)
+{
+	if (is_write) {
+		vcpu_sys_reg(vcpu, reg) = vcpu_get_reg(vcpu, rt);
+		vcpu_shadow_reg_dirty(vcpu, reg);
+	} else {
+		vcpu_set_reg(vcpu, rt, vcpu_sys_reg(vcpu, reg));
+	}
+
+	vcpu->stat.nested_hyp_sysreg++;
+}
+
+/*
+ * Complete a trapped EL2 register access from the virtual EL2 without
+ * leaving EL2. Returns 1 if the access was handled and the instruction has to
+ * be skipped, 2 if it was handled by a PV hvc that needs no skipping, and 0
+ * if the exit must be handled by the host.
+ */
+int __hyp_text __nested_perform_sysreg_access(struct kvm_vcpu *vcpu)
+{
+	u32 esr = kvm_vcpu_get_hsr(vcpu);
+	bool is_write;
+	int reg, rt;
+
+	if (!vcpu_mode_el2(vcpu))
+		return 0;
+
+	/*
+	 * With a shared EL2 register page, the guest may have pending stores
+	 * to these registers that only the host applies.
+	 */
+	if (vcpu->arch.pv_el2_regs)
+		return 0;
+
+	switch (kvm_vcpu_trap_get_class(vcpu)) {
+	case ESR_ELx_EC_SYS64:
+		reg = __nested_sys64_to_reg(esr_sys64_to_sysreg(esr));
+		rt = (esr & ESR_ELx_SYS64_ISS_RT_MASK) >>
+			ESR_ELx_SYS64_ISS_RT_SHIFT;
+		is_write = (esr & ESR_ELx_SYS64_ISS_DIR_MASK) ==
+			ESR_ELx_SYS64_ISS_DIR_WRITE;
+		if (reg < 0 || !__nested_sysreg_fast(reg, is_write))
+			return 0;
+
+		__nested_sysreg_access(vcpu, reg, rt, is_write);
+		return 1;
+#ifdef CONFIG_KVM_ARM_NESTED_PV
+	case ESR_ELx_EC_HVC64: {
+		u16 imm = esr & ESR_ELx_xVC_IMM_MASK;
+
+		switch (imm >> PV_INSTR_SHIFT) {
+		case MRS_PV:
+			is_write = false;
+			break;
+		case MSR_REG_PV:
+			is_write = true;
+			break;
+		default:
+			return 0;
+		}
+
+		reg = get_sysreg_num(imm);
+		if (!__nested_sysreg_fast(reg, is_write))
+			return 0;
+
+		__nested_sysreg_access(vcpu, reg, get_gpreg_num(imm), is_write);
+		return 2;
+	}
+#endif
+	default:
+		return 0;
+	}
+}
@@ -68,10 +68,13 @@ u32 __hyp_text __init_stage2_translation(void)
 	/*
 	 * Check the availability of Hardware Access Flag / Dirty Bit
 	 * Management in ID_AA64MMFR1_EL1 and enable the feature in VTCR_EL2.
+	 * Dirty bit management only affects the entries KVM maps with DBM.
 	 */
 	tmp = (read_sysreg(id_aa64mmfr1_el1) >> ID_AA64MMFR1_HADBS_SHIFT) & 0xf;
 	if (IS_ENABLED(CONFIG_ARM64_HW_AFDBM) && tmp)
 		val |= VTCR_EL2_HA;
+	if (IS_ENABLED(CONFIG_ARM64_HW_AFDBM) && tmp >= 2)
+		val |= VTCR_EL2_HD;
 
 	/*
 	 * Read the VMIDBits bits from ID_AA64MMFR1_EL1 and set the VS
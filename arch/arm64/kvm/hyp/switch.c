@@ -17,6 +17,7 @@
 
 #include <linux/types.h>
 #include <linux/jump_label.h>
+#include <uapi/linux/psci.h>
 
 #include <asm/kvm_asm.h>
 #include <asm/kvm_emulate.h>
@@ -42,6 +43,18 @@ bool __hyp_text __fpsimd_enabled(void)
 	return __fpsimd_is_enabled()();
 }
 
+/*
+ * The first FP access of the guest is trapped to load its state, which then
+ * stays in the registers across exits (see arch/arm64/kvm/fpsimd.c). The
+ * accesses of a nested VM are also trapped when the guest hypervisor asks
+ * for it, to forward them.
+ */
+static bool __hyp_text __fpsimd_trap(struct kvm_vcpu *vcpu)
+{
+	return !(vcpu->arch.fp_flags & KVM_ARM64_FP_ENABLED) ||
+	       (vcpu_sys_reg(vcpu, CPTR_EL2) & CPTR_EL2_TFP);
+}
+
 static void __hyp_text __activate_traps_vhe(struct kvm_vcpu *vcpu)
 
 {
@@ -49,7 +62,10 @@ static void __hyp_text __activate_traps_vhe(struct kvm_vcpu *vcpu)
 
 	val = read_sysreg(cpacr_el1);
 	val |= CPACR_EL1_TTA;
-	val &= ~CPACR_EL1_FPEN;
+	if (__fpsimd_trap(vcpu))
+		val &= ~CPACR_EL1_FPEN;
+	else
+		val |= CPACR_EL1_FPEN;
 	if (is_hyp_ctxt(vcpu))
 		val |= CPTR_EL2_TCPAC;
 	write_sysreg(val, cpacr_el1);
@@ -63,7 +79,9 @@ static void __hyp_text __activate_traps_nvhe(struct kvm_vcpu *vcpu)
 	u64 val;
 
 	val = CPTR_EL2_DEFAULT;
-	val |= CPTR_EL2_TTA | CPTR_EL2_TFP;
+	val |= CPTR_EL2_TTA;
+	if (__fpsimd_trap(vcpu))
+		val |= CPTR_EL2_TFP;
 	if (vcpu_mode_el2(vcpu))
 		val |= CPTR_EL2_TCPAC;
 	write_sysreg(val, cptr_el2);
@@ -85,12 +103,17 @@ static void __hyp_text __activate_traps(struct kvm_vcpu *vcpu)
 	 * trap to EL1.  Therefore, always make sure that for 32-bit guests,
 	 * we set FPEXC.EN to prevent traps to EL1, when setting the TFP bit.
 	 * If FP/ASIMD is not implemented, FPEXC is UNDEFINED and any access to
-	 * it will cause an exception.
+	 * it will cause an exception. With the guest FP state still loaded,
+	 * its own FPEXC goes back in instead.
 	 */
 	val = vcpu->arch.hcr_el2;
 
 	if (!(val & HCR_RW) && system_supports_fpsimd()) {
-		write_sysreg(1 << 30, fpexc32_el2);
+		if (__fpsimd_trap(vcpu))
+			write_sysreg(1 << 30, fpexc32_el2);
+		else
+			write_sysreg(vcpu_sys_reg(vcpu, FPEXC32_EL2),
+				     fpexc32_el2);
 		isb();
 	}
 
@@ -312,11 +335,47 @@ static void __hyp_text __skip_instr(struct kvm_vcpu *vcpu)
 	write_sysreg_el2(*vcpu_pc(vcpu), elr);
 }
 
+/*
+ * Answer the HVC calls whose result doesn't depend on any host state,
+ * without leaving EL2. The return address of an HVC is already the next
+ * instruction, so there is nothing to skip.
+ *
+ * A guest with (PV) nested virtualization sees its HVCs forwarded to its
+ * virtual EL2 instead, which is left to handle_hvc().
+ */
+static bool __hyp_text __hyp_handle_hvc(struct kvm_vcpu *vcpu)
+{
+	long val;
+
+	if (IS_ENABLED(CONFIG_KVM_ARM_NESTED_PV) ||
+	    test_bit(KVM_ARM_VCPU_NESTED_VIRT, vcpu->arch.features))
+		return false;
+
+	if (kvm_vcpu_trap_get_class(vcpu) != ESR_ELx_EC_HVC64 ||
+	    kvm_vcpu_hvc_get_imm(vcpu))
+		return false;
+
+	switch ((u32)vcpu_get_reg(vcpu, 0)) {
+	case PSCI_0_2_FN_PSCI_VERSION:
+		if (!test_bit(KVM_ARM_VCPU_PSCI_0_2, vcpu->arch.features))
+			return false;
+		val = 2;
+		break;
+	case ARM_SMCCC_HV_PV_SCHED_FEATURES:
+		val = kvm_pvsched_features(vcpu_get_reg(vcpu, 1));
+		break;
+	default:
+		return false;
+	}
+
+	vcpu_set_reg(vcpu, 0, val);
+	return true;
+}
+
 int __hyp_text __kvm_vcpu_run(struct kvm_vcpu *vcpu)
 {
 	struct kvm_cpu_context *host_ctxt;
 	struct kvm_cpu_context *guest_ctxt;
-	bool fp_enabled;
 	u64 exit_code;
 
 	vcpu = kern_hyp_va(vcpu);
@@ -339,7 +398,7 @@ int __hyp_text __kvm_vcpu_run(struct kvm_vcpu *vcpu)
 	 * to erratum #852523 (Cortex-A57) or #853709 (Cortex-A72).
 	 */
 	__sysreg32_restore_state(vcpu);
-	__sysreg_restore_guest_state(guest_ctxt);
+	__sysreg_restore_guest_state(vcpu);
 	__debug_restore_state(vcpu, kern_hyp_va(vcpu->arch.debug_ptr), guest_ctxt);
 
 	/* Jump in the fire! */
@@ -398,9 +457,22 @@ int __hyp_text __kvm_vcpu_run(struct kvm_vcpu *vcpu)
 		/* 0 falls through to be handled out of EL2 */
 	}
 
-	fp_enabled = __fpsimd_enabled();
+	if (exit_code == ARM_EXCEPTION_TRAP && __hyp_handle_hvc(vcpu))
+		goto again;
+
+	if (exit_code == ARM_EXCEPTION_TRAP) {
+		int ret = __nested_perform_sysreg_access(vcpu);
+
+		if (ret == 1)
+			__skip_instr(vcpu);
 
-	__sysreg_save_guest_state(guest_ctxt);
+		if (ret)
+			goto again;
+
+		/* 0 falls through to be handled out of EL2 */
+	}
+
+	__sysreg_save_guest_state(vcpu);
 	__sysreg32_save_state(vcpu);
 	__timer_save_state(vcpu);
 	__vgic_save_state(vcpu);
@@ -410,11 +482,6 @@ int __hyp_text __kvm_vcpu_run(struct kvm_vcpu *vcpu)
 
 	__sysreg_restore_host_state(host_ctxt);
 
-	if (fp_enabled) {
-		__fpsimd_save_state(&guest_ctxt->gp_regs.fp_regs);
-		__fpsimd_restore_state(&host_ctxt->gp_regs.fp_regs);
-	}
-
 	__debug_save_state(vcpu, kern_hyp_va(vcpu->arch.debug_ptr), guest_ctxt);
 	/*
 	 * This must come after restoring the host sysregs, since a non-VHE
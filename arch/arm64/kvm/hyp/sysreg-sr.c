@@ -28,8 +28,10 @@ static void __hyp_text __sysreg_do_nothing(struct kvm_cpu_context *ctxt) { }
 /*
  * Non-VHE: Both host and guest must save everything.
  *
- * VHE: Host must save tpidr*_el[01], actlr_el1, mdscr_el1, sp0, pc,
- * pstate, and guest must save everything.
+ * VHE: Host must save tpidr*_el[01], actlr_el1, mdscr_el1, csselr_el1,
+ * sp0, pc, pstate, and guest must save everything. The rest of the guest
+ * state, which the host doesn't use, can stay loaded on the CPU between
+ * runs: see kvm_vcpu_load_sysregs().
  */
 
 static void __hyp_text __sysreg_save_common_state(struct kvm_cpu_context *ctxt)
@@ -41,6 +43,7 @@ static void __hyp_text __sysreg_save_common_state(struct kvm_cpu_context *ctxt)
 	sys_regs[TPIDRRO_EL0]	= read_sysreg(tpidrro_el0);
 	sys_regs[TPIDR_EL1]	= read_sysreg(tpidr_el1);
 	sys_regs[MDSCR_EL1]	= read_sysreg(mdscr_el1);
+	sys_regs[CSSELR_EL1]	= read_sysreg(csselr_el1);
 	ctxt->gp_regs.regs.sp		= read_sysreg(sp_el0);
 	ctxt->gp_regs.regs.pc		= read_sysreg_el2(elr);
 	ctxt->hw_pstate			= read_sysreg_el2(spsr);
@@ -51,7 +54,6 @@ static void __hyp_text __sysreg_save_state(struct kvm_cpu_context *ctxt)
 	u64 *sys_regs = kern_hyp_va(ctxt->hw_sys_regs);
 
 	sys_regs[MPIDR_EL1]	= read_sysreg(vmpidr_el2);
-	sys_regs[CSSELR_EL1]	= read_sysreg(csselr_el1);
 	sys_regs[SCTLR_EL1]	= read_sysreg_el1(sctlr);
 	sys_regs[CPACR_EL1]	= read_sysreg_el1(cpacr);
 	sys_regs[TTBR0_EL1]	= read_sysreg_el1(ttbr0);
@@ -83,9 +85,12 @@ void __hyp_text __sysreg_save_host_state(struct kvm_cpu_context *ctxt)
 	__sysreg_save_common_state(ctxt);
 }
 
-void __hyp_text __sysreg_save_guest_state(struct kvm_cpu_context *ctxt)
+void __hyp_text __sysreg_save_guest_state(struct kvm_vcpu *vcpu)
 {
-	__sysreg_save_state(ctxt);
+	struct kvm_cpu_context *ctxt = &vcpu->arch.ctxt;
+
+	if (!vcpu->arch.sysregs_loaded_on_cpu)
+		__sysreg_save_state(ctxt);
 	__sysreg_save_common_state(ctxt);
 }
 
@@ -98,6 +103,7 @@ static void __hyp_text __sysreg_restore_common_state(struct kvm_cpu_context *ctx
 	write_sysreg(sys_regs[TPIDRRO_EL0],	tpidrro_el0);
 	write_sysreg(sys_regs[TPIDR_EL1],	  tpidr_el1);
 	write_sysreg(sys_regs[MDSCR_EL1],	  mdscr_el1);
+	write_sysreg(sys_regs[CSSELR_EL1],	  csselr_el1);
 	write_sysreg(ctxt->gp_regs.regs.sp,	  sp_el0);
 	write_sysreg_el2(ctxt->gp_regs.regs.pc,	  elr);
 	write_sysreg_el2(ctxt->hw_pstate,	  spsr);
@@ -108,7 +114,6 @@ static void __hyp_text __sysreg_restore_state(struct kvm_cpu_context *ctxt)
 	u64 *sys_regs = kern_hyp_va(ctxt->hw_sys_regs);
 
 	write_sysreg(sys_regs[MPIDR_EL1],	vmpidr_el2);
-	write_sysreg(sys_regs[CSSELR_EL1],	csselr_el1);
 	write_sysreg_el1(sys_regs[SCTLR_EL1],	sctlr);
 	write_sysreg_el1(sys_regs[CPACR_EL1],	cpacr);
 	write_sysreg_el1(sys_regs[TTBR0_EL1],	ttbr0);
@@ -140,9 +145,12 @@ void __hyp_text __sysreg_restore_host_state(struct kvm_cpu_context *ctxt)
 	__sysreg_restore_common_state(ctxt);
 }
 
-void __hyp_text __sysreg_restore_guest_state(struct kvm_cpu_context *ctxt)
+void __hyp_text __sysreg_restore_guest_state(struct kvm_vcpu *vcpu)
 {
-	__sysreg_restore_state(ctxt);
+	struct kvm_cpu_context *ctxt = &vcpu->arch.ctxt;
+
+	if (!vcpu->arch.sysregs_loaded_on_cpu)
+		__sysreg_restore_state(ctxt);
 	__sysreg_restore_common_state(ctxt);
 }
 
@@ -192,3 +200,58 @@ void __hyp_text __sysreg32_restore_state(struct kvm_vcpu *vcpu)
 	if (vcpu->arch.debug_flags & KVM_ARM64_DEBUG_DIRTY)
 		write_sysreg(sysreg[DBGVCR32_EL2], dbgvcr32_el2);
 }
+
+/**
+ * kvm_vcpu_load_sysregs - Leave the guest EL1 state loaded on the CPU
+ * @vcpu: The VCPU pointer
+ *
+ * With VHE, the host runs at EL2 and doesn't use most of the EL1 registers,
+ * so they can keep the guest state across exits instead of being switched
+ * on every run. Called with interrupts disabled before entering the guest,
+ * with ctxt->hw_sys_regs pointing at the vcpu's own EL1 registers. The state
+ * stays on the CPU until kvm_vcpu_put_sysregs(), and is meanwhile accessed
+ * through vcpu_read_sys_reg() and friends.
+ *
+ * The 32bit EL1 state, aliased by the cp15 view of the registers, is still
+ * switched on every run.
+ */
+void kvm_vcpu_load_sysregs(struct kvm_vcpu *vcpu)
+{
+	struct kvm_cpu_context *ctxt = &vcpu->arch.ctxt;
+
+	if (!has_vhe() || vcpu->arch.sysregs_loaded_on_cpu ||
+	    !(vcpu->arch.hcr_el2 & HCR_RW))
+		return;
+
+	ctxt->hw_sp_el1 = ctxt->gp_regs.sp_el1;
+	ctxt->hw_elr_el1 = ctxt->gp_regs.elr_el1;
+	ctxt->hw_spsr_el1 = ctxt->gp_regs.spsr[KVM_SPSR_EL1];
+	__sysreg_restore_state(ctxt);
+
+	vcpu->arch.sysregs_loaded_on_cpu = true;
+}
+
+/**
+ * kvm_vcpu_put_sysregs - Save the guest EL1 state left on the CPU
+ * @vcpu: The VCPU pointer
+ *
+ * Called from kvm_arch_vcpu_put(), and wherever the whole in-memory EL1
+ * state needs to be up to date. The next entry loads it again.
+ */
+void kvm_vcpu_put_sysregs(struct kvm_vcpu *vcpu)
+{
+	struct kvm_cpu_context *ctxt = &vcpu->arch.ctxt;
+
+	preempt_disable();
+
+	if (vcpu->arch.sysregs_loaded_on_cpu) {
+		__sysreg_save_state(ctxt);
+		ctxt->gp_regs.sp_el1 = ctxt->hw_sp_el1;
+		ctxt->gp_regs.elr_el1 = ctxt->hw_elr_el1;
+		ctxt->gp_regs.spsr[KVM_SPSR_EL1] = ctxt->hw_spsr_el1;
+
+		vcpu->arch.sysregs_loaded_on_cpu = false;
+	}
+
+	preempt_enable();
+}
@@ -21,6 +21,35 @@
 #include <asm/kvm_arm.h>
 #include <asm/kvm_emulate.h>
 #include <asm/kvm_mmu.h>
+#include <kvm/arm_lock_stat.h>
+
+#include "trace.h"
+
+/*
+ * Maximum number of shadow stage 2 page tables kept per VM before the least
+ * recently entered one gets recycled for a new virtual VMID. 0 means no
+ * limit.
+ */
+static unsigned int nested_mmu_max = 64;
+
+static int __init early_nested_mmu_max_cfg(char *buf)
+{
+	return kstrtouint(buf, 0, &nested_mmu_max);
+}
+early_param("kvm-arm.nested_mmu_max", early_nested_mmu_max_cfg);
+
+/*
+ * Number of pages of a new nested VM's address space populated from the
+ * guest hypervisor's stage 2 page tables on each entry, until the whole
+ * input range has been covered. 0 disables prefaulting.
+ */
+static unsigned int nested_prefault_pages;
+
+static int __init early_nested_prefault_cfg(char *buf)
+{
+	return kstrtouint(buf, 0, &nested_prefault_pages);
+}
+early_param("kvm-arm.nested_prefault", early_nested_prefault_cfg);
 
 struct s2_walk_info {
 	unsigned int pgshift;
@@ -244,15 +273,104 @@ static int walk_nested_s2_pgd(struct kvm_vcpu *vcpu, phys_addr_t ipa,
 	return 0;
 }
 
+/*
+ * Invalidate the cached translations of the guest hypervisor's stage 2 page
+ * tables on all vcpus. Each vcpu notices the new generation and drops its
+ * entries on its next lookup.
+ */
+void kvm_nested_s2_tlb_invalidate(struct kvm *kvm)
+{
+	atomic64_inc(&kvm->arch.nested_s2_tlb_gen);
+}
+
+static struct kvm_nested_s2_tlb *nested_s2_tlb_get(struct kvm_vcpu *vcpu)
+{
+	struct kvm_nested_s2_tlb *tlb = &vcpu->arch.nested_s2_tlb;
+	u64 gen = atomic64_read(&vcpu->kvm->arch.nested_s2_tlb_gen);
+
+	if (unlikely(tlb->gen != gen)) {
+		memset(tlb->entries, 0, sizeof(tlb->entries));
+		tlb->gen = gen;
+	}
+
+	return tlb;
+}
+
+static bool nested_s2_tlb_lookup(struct kvm_vcpu *vcpu, phys_addr_t gipa,
+				 struct kvm_s2_trans *out)
+{
+	struct kvm_nested_s2_tlb *tlb = nested_s2_tlb_get(vcpu);
+	u64 vttbr = vcpu_sys_reg(vcpu, VTTBR_EL2);
+	u64 vtcr = vcpu_sys_reg(vcpu, VTCR_EL2);
+	int i;
+
+	for (i = 0; i < NESTED_S2_TLB_ENTRIES; i++) {
+		struct kvm_nested_s2_tlb_entry *e = &tlb->entries[i];
+
+		if (!e->block_size || e->vttbr != vttbr || e->vtcr != vtcr ||
+		    (gipa & ~(e->block_size - 1)) != e->ipa)
+			continue;
+
+		out->output = e->output | (gipa & (e->block_size - 1));
+		out->block_size = e->block_size;
+		out->readable = e->readable;
+		out->writable = e->writable;
+		out->level = e->level;
+		out->upper_attr = e->upper_attr;
+		out->esr = 0;
+		return true;
+	}
+
+	return false;
+}
+
+static void nested_s2_tlb_fill(struct kvm_vcpu *vcpu, u64 gen,
+			       phys_addr_t gipa, struct kvm_s2_trans *trans)
+{
+	struct kvm_nested_s2_tlb *tlb = nested_s2_tlb_get(vcpu);
+	struct kvm_nested_s2_tlb_entry *e;
+
+	/* A TLBI hit while we were walking, the result may be stale already */
+	if (tlb->gen != gen)
+		return;
+
+	e = &tlb->entries[tlb->next];
+	tlb->next = (tlb->next + 1) % NESTED_S2_TLB_ENTRIES;
+
+	e->vttbr = vcpu_sys_reg(vcpu, VTTBR_EL2);
+	e->vtcr = vcpu_sys_reg(vcpu, VTCR_EL2);
+	e->ipa = gipa & ~(trans->block_size - 1);
+	e->output = trans->output & ~(trans->block_size - 1);
+	e->block_size = trans->block_size;
+	e->upper_attr = trans->upper_attr;
+	e->level = trans->level;
+	e->readable = trans->readable;
+	e->writable = trans->writable;
+}
+
 int kvm_walk_nested_s2(struct kvm_vcpu *vcpu, phys_addr_t gipa,
 		       struct kvm_s2_trans *result)
 {
 	u64 vtcr = vcpu->arch.ctxt.sys_regs[VTCR_EL2];
 	struct s2_walk_info wi;
+	u64 gen, start = 0;
+	int ret;
 
 	if (!nested_virt_in_use(vcpu))
 		return 0;
 
+	vcpu->stat.nested_s2_walk++;
+	if (nested_s2_tlb_lookup(vcpu, gipa, result)) {
+		vcpu->stat.nested_s2_walk_cached++;
+		trace_kvm_nested_s2_walk(vcpu, gipa, result->output, 0, true, 0);
+		return 0;
+	}
+
+	if (trace_kvm_nested_s2_walk_enabled())
+		start = ktime_get_ns();
+
+	gen = atomic64_read(&vcpu->kvm->arch.nested_s2_tlb_gen);
+
 	wi.t0sz = vtcr & TCR_EL2_T0SZ_MASK;
 
 	switch (vtcr & VTCR_EL2_TG0_MASK) {
@@ -268,7 +386,279 @@ int kvm_walk_nested_s2(struct kvm_vcpu *vcpu, phys_addr_t gipa,
 	wi.ps = (vtcr & VTCR_EL2_PS_MASK) >> VTCR_EL2_PS_SHIFT;
 	wi.sl = (vtcr & VTCR_EL2_SL0_MASK) >> VTCR_EL2_SL0_SHIFT;
 
-	return walk_nested_s2_pgd(vcpu, gipa, &wi, result);
+	ret = walk_nested_s2_pgd(vcpu, gipa, &wi, result);
+
+	/* Like a hardware TLB, only cache translations that didn't fault */
+	if (!ret)
+		nested_s2_tlb_fill(vcpu, gen, gipa, result);
+
+	if (trace_kvm_nested_s2_walk_enabled())
+		trace_kvm_nested_s2_walk(vcpu, gipa, ret ? 0 : result->output,
+					 ret, false, ktime_get_ns() - start);
+
+	return ret;
+}
+
+/*
+ * Stage 1 translation regime an AT instruction of the guest hypervisor is
+ * emulated against, in the EL1 register format it is also run with.
+ */
+struct s1_walk_info {
+	u64 ttbr0;
+	u64 ttbr1;
+	u64 tcr;
+	u64 sctlr;
+	u64 mair;
+	bool el2_format;	/* EL2 descriptor format, as with HCR_EL2.NV1 */
+	bool s2;		/* table addresses go through the virtual stage 2 */
+};
+
+static u64 par_s1_fault(u32 fsc, int level)
+{
+	/* RES1 [11], FST [6:1], F [0] */
+	return BIT(11) | ((u64)(fsc | (level & 0x3)) << 1) | 1;
+}
+
+static u64 par_s1_attrs(u64 mair, u64 desc)
+{
+	u64 attr = (mair >> (8 * ((desc >> 2) & 0x7))) & 0xff;
+	u64 sh = (desc >> 8) & 0x3;
+
+	/* Device and Normal Non-cacheable memory are always Outer Shareable */
+	if (!(attr & 0xf0) || attr == 0x44)
+		sh = 0x2;
+
+	/* ATTR [63:56], SH [8:7] */
+	return (attr << 56) | (sh << 7);
+}
+
+/*
+ * Walk the guest's AArch64 stage 1 page tables in software, following the
+ * same ARM ARM pseudocode as walk_nested_s2_pgd(). Returns 0 with the
+ * resulting PAR_EL1 value in *par, or -EAGAIN if the translation depends on
+ * something not emulated here and needs the hardware to do it.
+ *
+ * Must be called with the kvm->srcu read lock held
+ */
+static int walk_nested_s1(struct kvm_vcpu *vcpu, u64 va, struct s1_walk_info *wi,
+			  bool unpriv, bool write, u64 *par)
+{
+	int level = 0, first_block_level, stride, pgshift, input_size;
+	int base_lower_bound;
+	unsigned int addr_top, addr_bottom;
+	bool upper = va & BIT(55);
+	bool no_write = false, no_unpriv = false;
+	phys_addr_t base_addr, paddr;
+	u64 tcr = wi->tcr;
+	u64 desc, mask, oa;
+	bool tbi;
+	int ret;
+
+	if (upper) {
+		if (tcr & TCR_EPD1)
+			goto translation_fault;
+		input_size = 64 - ((tcr >> TCR_T1SZ_OFFSET) & 0x3f);
+		tbi = tcr & BIT(38);	/* TBI1 */
+		switch (tcr & TCR_TG1_MASK) {
+		case TCR_TG1_4K:
+			pgshift = 12;	break;
+		case TCR_TG1_16K:
+			pgshift = 14;	break;
+		case TCR_TG1_64K:
+			pgshift = 16;	break;
+		default:
+			return -EAGAIN;
+		}
+		base_addr = wi->ttbr1;
+	} else {
+		if (tcr & TCR_EPD0)
+			goto translation_fault;
+		input_size = 64 - ((tcr >> TCR_T0SZ_OFFSET) & 0x3f);
+		tbi = tcr & TCR_TBI0;
+		switch (tcr & TCR_TG0_MASK) {
+		case TCR_TG0_4K:
+			pgshift = 12;	break;
+		case TCR_TG0_16K:
+			pgshift = 14;	break;
+		case TCR_TG0_64K:
+			pgshift = 16;	break;
+		default:
+			return -EAGAIN;
+		}
+		base_addr = wi->ttbr0;
+	}
+
+	if (input_size > 48 || input_size < 25)
+		return -EAGAIN;
+
+	/* The bits above the input range must all match bit 55 */
+	mask = GENMASK_ULL(tbi ? 55 : 63, input_size);
+	if ((va & mask) != (upper ? mask : 0))
+		goto translation_fault;
+
+	stride = pgshift - 3;
+	level = 3 - (input_size - pgshift - 1) / stride;
+	first_block_level = (pgshift == 12) ? 1 : 2;
+
+	base_lower_bound = 3 + input_size - ((3 - level) * stride + pgshift);
+	base_addr &= GENMASK_ULL(47, base_lower_bound);
+
+	addr_top = input_size - 1;
+
+	while (1) {
+		phys_addr_t index;
+
+		addr_bottom = (3 - level) * stride + pgshift;
+		index = (va & GENMASK_ULL(addr_top, addr_bottom))
+			>> (addr_bottom - 3);
+
+		paddr = base_addr | index;
+		if (wi->s2) {
+			struct kvm_s2_trans s2_trans;
+
+			/* Leave reporting stage 2 faults on a walk to the hardware */
+			ret = kvm_walk_nested_s2(vcpu, paddr, &s2_trans);
+			if (ret || !s2_trans.readable)
+				return -EAGAIN;
+
+			paddr = s2_trans.output;
+		}
+
+		ret = kvm_read_guest(vcpu->kvm, paddr, &desc, sizeof(desc));
+		if (ret < 0)
+			return -EAGAIN;
+
+		if (wi->sctlr & SCTLR_ELx_EE)
+			desc = be64_to_cpu(desc);
+		else
+			desc = le64_to_cpu(desc);
+
+		/* Check for valid descriptor at this point */
+		if (!(desc & 1) || ((desc & 3) == 1 && level == 3))
+			goto translation_fault;
+
+		/* We're at the final level or block translation level */
+		if ((desc & 3) == 1 || level == 3)
+			break;
+
+		/* APTable [62:61], which has no EL0 half in the EL2 format */
+		no_write |= !!(desc & BIT_ULL(62));
+		if (!wi->el2_format)
+			no_unpriv |= !!(desc & BIT_ULL(61));
+
+		base_addr = desc & GENMASK_ULL(47, pgshift);
+
+		level += 1;
+		addr_top = addr_bottom - 1;
+	}
+
+	if (level < first_block_level)
+		goto translation_fault;
+
+	if (!(desc & BIT(10))) {
+		/* A hardware managed access flag would be set instead */
+		if (tcr & TCR_HA)
+			return -EAGAIN;
+
+		*par = par_s1_fault(ESR_ELx_FSC_ACCESS, level);
+		return 0;
+	}
+
+	/* AP [7:6], of which AP[1] is RES1 in the EL2 format */
+	no_write |= !!(desc & BIT(7));
+	if (wi->el2_format || !(desc & BIT(6)))
+		no_unpriv = true;
+
+	if ((unpriv && no_unpriv) || (write && no_write)) {
+		*par = par_s1_fault(ESR_ELx_FSC_PERM, level);
+		return 0;
+	}
+
+	oa = (desc & GENMASK_ULL(47, addr_bottom)) |
+	     (va & GENMASK_ULL(addr_bottom - 1, 0));
+
+	/* RES1 [11], PA [47:12] */
+	*par = BIT(11) | (oa & GENMASK_ULL(47, 12)) |
+	       par_s1_attrs(wi->mair, desc);
+	return 0;
+
+translation_fault:
+	*par = par_s1_fault(ESR_ELx_FSC_FAULT, level);
+	return 0;
+}
+
+/*
+ * Emulate the stage 1 translation of an AT instruction executed by the guest
+ * hypervisor, against the EL1 regime registers currently selected by
+ * ctxt->hw_sys_regs, and return the result in PAR_EL1.
+ *
+ * The guest's page tables are walked in software, and only what that walker
+ * doesn't cover takes the slow path of running the instruction with the
+ * guest context loaded. Nothing is cached: the guest's own TLB maintenance
+ * at EL1 doesn't trap, so there would be no telling when a result went
+ * stale.
+ */
+void kvm_nested_at_s1(struct kvm_vcpu *vcpu, u64 va, bool el2_format,
+		      int sys_encoding)
+{
+	struct kvm_cpu_context *ctxt = &vcpu->arch.ctxt;
+	u64 *regs = ctxt->hw_sys_regs;
+	u64 hcr = vcpu_sys_reg(vcpu, HCR_EL2);
+	struct s1_walk_info wi;
+	bool unpriv = false, write = false;
+	int idx, ret = -EAGAIN;
+	u64 par;
+
+	vcpu->stat.nested_at++;
+
+	/* Both the walk and the AT instruction use the in-memory registers */
+	kvm_vcpu_put_sysregs(vcpu);
+
+	switch (sys_encoding) {
+	case AT_S1E0W:
+		write = true;
+		/* Fall through */
+	case AT_S1E0R:
+		unpriv = true;
+		break;
+	case AT_S1E1W:
+	case AT_S1E2W:
+		write = true;
+		break;
+	case AT_S1E1R:
+	case AT_S1E2R:
+		break;
+	default:
+		/* The PAN variants also depend on PSTATE */
+		kvm_call_hyp(__kvm_at_insn, vcpu, va, el2_format, sys_encoding);
+		vcpu_shadow_reg_dirty(vcpu, PAR_EL1);
+		return;
+	}
+
+	wi.ttbr0 = regs[TTBR0_EL1];
+	wi.ttbr1 = regs[TTBR1_EL1];
+	wi.tcr = regs[TCR_EL1];
+	wi.sctlr = regs[SCTLR_EL1];
+	wi.mair = regs[MAIR_EL1];
+	wi.el2_format = el2_format;
+	/* Only the nested VM's EL1&0 regime is behind the virtual stage 2 */
+	wi.s2 = regs == ctxt->sys_regs && (hcr & HCR_VM);
+
+	if ((wi.sctlr & SCTLR_ELx_M) && !(wi.s2 && (hcr & HCR_DC))) {
+		idx = srcu_read_lock(&vcpu->kvm->srcu);
+		ret = walk_nested_s1(vcpu, va, &wi, unpriv, write, &par);
+		srcu_read_unlock(&vcpu->kvm->srcu, idx);
+	}
+
+	if (!ret) {
+		vcpu->stat.nested_at_walk++;
+	} else {
+		kvm_call_hyp(__kvm_at_insn, vcpu, va, el2_format, sys_encoding);
+		par = vcpu_sys_reg(vcpu, PAR_EL1);
+	}
+
+	vcpu_sys_reg(vcpu, PAR_EL1) = par;
+	vcpu_shadow_reg_dirty(vcpu, PAR_EL1);
 }
 
 /*
@@ -293,14 +683,198 @@ int kvm_s2_handle_perm_fault(struct kvm_vcpu *vcpu, phys_addr_t fault_ipa,
 	return 0;
 }
 
+static bool nested_mmu_is_empty(struct kvm_nested_s2_mmu *nested_mmu)
+{
+	return nested_mmu->mapped_start >= nested_mmu->mapped_end;
+}
+
+/* expects kvm->mmu_lock to be held */
+void kvm_nested_s2_track_map(struct kvm *kvm, struct kvm_s2_mmu *mmu,
+			     phys_addr_t ipa, phys_addr_t size)
+{
+	struct kvm_nested_s2_mmu *nested_mmu;
+
+	nested_mmu = container_of(mmu, struct kvm_nested_s2_mmu, mmu);
+	if (nested_mmu_is_empty(nested_mmu)) {
+		nested_mmu->mapped_start = ipa;
+		nested_mmu->mapped_end = ipa + size;
+		return;
+	}
+
+	nested_mmu->mapped_start = min(nested_mmu->mapped_start, ipa);
+	nested_mmu->mapped_end = max(nested_mmu->mapped_end, ipa + size);
+}
+
+/*
+ * Unmap [start, start + size) from a shadow stage 2 page table, skipping the
+ * parts of the IPA space that were never populated.
+ * This function expects kvm->mmu_lock to be held.
+ */
+static void nested_mmu_unmap_range(struct kvm *kvm,
+				   struct kvm_nested_s2_mmu *nested_mmu,
+				   phys_addr_t start, u64 size)
+{
+	phys_addr_t end = start + size;
+
+	if (nested_mmu_is_empty(nested_mmu))
+		return;
+
+	start = max(start, nested_mmu->mapped_start);
+	end = min(end, nested_mmu->mapped_end);
+	if (start >= end)
+		return;
+
+	/*
+	 * Reset the range before unmapping: kvm_unmap_stage2_range() may drop
+	 * the lock, and whatever gets mapped meanwhile must be tracked again.
+	 */
+	if (start == nested_mmu->mapped_start &&
+	    end == nested_mmu->mapped_end)
+		nested_mmu->mapped_start = nested_mmu->mapped_end = 0;
+
+	kvm_unmap_stage2_range(kvm, &nested_mmu->mmu, start, end - start);
+}
+
+static void nested_mmu_unmap_all(struct kvm *kvm,
+				 struct kvm_nested_s2_mmu *nested_mmu)
+{
+	/* Nothing deferred is left to do once the whole table is gone */
+	nested_mmu->tlbi_all = false;
+	nested_mmu->tlbi_nr = 0;
+
+	nested_mmu_unmap_range(kvm, nested_mmu, 0, KVM_PHYS_SIZE);
+	nested_mmu->passthrough_pending = true;
+}
+
+static bool nested_mmu_tlbi_pending(struct kvm_nested_s2_mmu *nested_mmu)
+{
+	return READ_ONCE(nested_mmu->tlbi_all) || READ_ONCE(nested_mmu->tlbi_nr);
+}
+
+/*
+ * Apply the deferred invalidations of a shadow mmu.
+ * This function expects kvm->mmu_lock to be held.
+ */
+static void nested_mmu_flush_tlbi(struct kvm *kvm,
+				  struct kvm_nested_s2_mmu *nested_mmu)
+{
+	int i, nr;
+
+	if (nested_mmu->tlbi_all) {
+		nested_mmu_unmap_all(kvm, nested_mmu);
+		return;
+	}
+
+	/*
+	 * kvm_unmap_stage2_range() may drop the lock, so take the entries
+	 * off the queue one by one such that new ones can still be added.
+	 */
+	nr = nested_mmu->tlbi_nr;
+	for (i = 0; i < nr && nested_mmu->tlbi_nr; i++) {
+		phys_addr_t start, end;
+
+		nested_mmu->tlbi_nr--;
+		start = nested_mmu->tlbi_queue[nested_mmu->tlbi_nr].start;
+		end = nested_mmu->tlbi_queue[nested_mmu->tlbi_nr].end;
+		nested_mmu_unmap_range(kvm, nested_mmu, start, end - start);
+	}
+}
+
+/*
+ * A shadow stage 2 invalidation may be deferred when no vcpu other than the
+ * one executing the TLBI holds the shadow mmu: nobody can then run the nested
+ * VM with it before the invalidation gets applied by nested_mmu_hold() or by
+ * the fast path in get_s2_mmu_nested().
+ */
+static bool nested_mmu_can_defer_tlbi(struct kvm_vcpu *vcpu,
+				      struct kvm_nested_s2_mmu *nested_mmu)
+{
+	if (!nested_mmu->users)
+		return true;
+
+	return nested_mmu->users == 1 &&
+	       vcpu->arch.last_nested_mmu == nested_mmu;
+}
+
+/*
+ * Queue an invalidation of [start, start + size), merging it with queued
+ * ranges it overlaps or touches.
+ * This function expects kvm->mmu_lock to be held.
+ */
+static void nested_mmu_queue_tlbi(struct kvm *kvm,
+				  struct kvm_nested_s2_mmu *nested_mmu,
+				  phys_addr_t start, u64 size)
+{
+	phys_addr_t end = start + size;
+	int i;
+
+	if (nested_mmu->tlbi_all)
+		return;
+
+	if (start == 0 && size >= KVM_PHYS_SIZE) {
+		nested_mmu->tlbi_all = true;
+		nested_mmu->tlbi_nr = 0;
+		return;
+	}
+
+	for (i = 0; i < nested_mmu->tlbi_nr; i++) {
+		if (start <= nested_mmu->tlbi_queue[i].end &&
+		    end >= nested_mmu->tlbi_queue[i].start) {
+			nested_mmu->tlbi_queue[i].start =
+				min(nested_mmu->tlbi_queue[i].start, start);
+			nested_mmu->tlbi_queue[i].end =
+				max(nested_mmu->tlbi_queue[i].end, end);
+			return;
+		}
+	}
+
+	if (nested_mmu->tlbi_nr == NESTED_TLBI_QUEUE_LEN)
+		nested_mmu_flush_tlbi(kvm, nested_mmu);
+
+	i = nested_mmu->tlbi_nr++;
+	nested_mmu->tlbi_queue[i].start = start;
+	nested_mmu->tlbi_queue[i].end = end;
+}
+
+/*
+ * Invalidate [start, start + size) in a shadow stage 2 page table on behalf
+ * of a guest hypervisor TLBI executed by @vcpu, deferring it when possible.
+ * This function expects kvm->mmu_lock to be held.
+ */
+static void nested_mmu_tlbi(struct kvm_vcpu *vcpu,
+			    struct kvm_nested_s2_mmu *nested_mmu,
+			    phys_addr_t start, u64 size)
+{
+	struct kvm *kvm = vcpu->kvm;
+
+	if (nested_mmu_is_empty(nested_mmu))
+		return;
+
+	if (nested_mmu_can_defer_tlbi(vcpu, nested_mmu)) {
+		nested_mmu_queue_tlbi(kvm, nested_mmu, start, size);
+		return;
+	}
+
+	nested_mmu_flush_tlbi(kvm, nested_mmu);
+	if (start == 0 && size >= KVM_PHYS_SIZE)
+		nested_mmu_unmap_all(kvm, nested_mmu);
+	else
+		nested_mmu_unmap_range(kvm, nested_mmu, start, size);
+}
+
 /* expects kvm->mmu_lock to be held */
 void kvm_nested_s2_wp(struct kvm *kvm)
 {
 	struct kvm_nested_s2_mmu *nested_mmu;
 	struct list_head *nested_mmu_list = &kvm->arch.nested_mmu_list;
 
-	list_for_each_entry_rcu(nested_mmu, nested_mmu_list, list)
-		kvm_stage2_wp_range(kvm, &nested_mmu->mmu, 0, KVM_PHYS_SIZE);
+	list_for_each_entry_rcu(nested_mmu, nested_mmu_list, list) {
+		if (nested_mmu_is_empty(nested_mmu))
+			continue;
+		kvm_stage2_wp_range(kvm, &nested_mmu->mmu,
+				    nested_mmu->mapped_start,
+				    nested_mmu->mapped_end);
+	}
 }
 
 /* expects kvm->mmu_lock to be held */
@@ -310,7 +884,22 @@ void kvm_nested_s2_clear(struct kvm *kvm)
 	struct list_head *nested_mmu_list = &kvm->arch.nested_mmu_list;
 
 	list_for_each_entry_rcu(nested_mmu, nested_mmu_list, list)
-		kvm_unmap_stage2_range(kvm, &nested_mmu->mmu, 0, KVM_PHYS_SIZE);
+		nested_mmu_unmap_all(kvm, nested_mmu);
+}
+
+/*
+ * Clear all shadow stage 2 page tables on behalf of a guest hypervisor TLBI
+ * executed by @vcpu, deferring the work for the shadow mmus nobody else can
+ * enter in the meantime.
+ * This function expects kvm->mmu_lock to be held.
+ */
+void kvm_nested_s2_clear_all(struct kvm_vcpu *vcpu)
+{
+	struct kvm_nested_s2_mmu *nested_mmu;
+	struct list_head *nested_mmu_list = &vcpu->kvm->arch.nested_mmu_list;
+
+	list_for_each_entry_rcu(nested_mmu, nested_mmu_list, list)
+		nested_mmu_tlbi(vcpu, nested_mmu, 0, KVM_PHYS_SIZE);
 }
 
 void kvm_nested_s2_flush(struct kvm *kvm)
@@ -318,35 +907,239 @@ void kvm_nested_s2_flush(struct kvm *kvm)
 	struct kvm_nested_s2_mmu *nested_mmu;
 	struct list_head *nested_mmu_list = &kvm->arch.nested_mmu_list;
 
-	list_for_each_entry_rcu(nested_mmu, nested_mmu_list, list)
-		kvm_stage2_flush_range(&nested_mmu->mmu, 0, KVM_PHYS_SIZE);
+	list_for_each_entry_rcu(nested_mmu, nested_mmu_list, list) {
+		if (nested_mmu_is_empty(nested_mmu))
+			continue;
+		kvm_stage2_flush_range(kvm, &nested_mmu->mmu,
+				       nested_mmu->mapped_start,
+				       nested_mmu->mapped_end);
+	}
 }
 
-void kvm_nested_s2_free(struct kvm *kvm)
+/*
+ * Flush the TLB entries tagged with the shadow VMIDs of @kvm. Shadow mmus
+ * are only removed from the list when the VM is destroyed, so this doesn't
+ * need kvm->mmu_lock.
+ */
+void kvm_nested_s2_flush_tlbs(struct kvm *kvm)
 {
 	struct kvm_nested_s2_mmu *nested_mmu;
 	struct list_head *nested_mmu_list = &kvm->arch.nested_mmu_list;
 
-	list_for_each_entry_rcu(nested_mmu, nested_mmu_list, list)
+	rcu_read_lock();
+	list_for_each_entry_rcu(nested_mmu, nested_mmu_list, list) {
+		struct kvm_s2_mmu *mmu = &nested_mmu->mmu;
+
+		/* Never run, so nothing was tagged with its VMID */
+		if (!mmu->vmid.vmid)
+			continue;
+		kvm_call_hyp(__kvm_tlb_flush_vmid,
+			     kvm_get_vttbr(&mmu->vmid, mmu));
+	}
+	rcu_read_unlock();
+}
+
+void kvm_nested_s2_free(struct kvm *kvm)
+{
+	struct kvm_nested_s2_mmu *nested_mmu, *tmp;
+	struct list_head *nested_mmu_list = &kvm->arch.nested_mmu_list;
+
+	list_for_each_entry_safe(nested_mmu, tmp, nested_mmu_list, list) {
 		__kvm_free_stage2_pgd(kvm, &nested_mmu->mmu);
+		list_del(&nested_mmu->list);
+		kfree(nested_mmu);
+	}
+	kvm->stat.nested_mmu_count = 0;
+}
+
+/*
+ * Where the guest hypervisor has the GIC virtual CPU interface unless the VMM
+ * says otherwise: the GICv2 CPU interface of the mach-virt memory map.
+ */
+#define NESTED_VCPU_IF_ADDR	0x08010000
+
+void kvm_nested_s2_init(struct kvm *kvm)
+{
+	int i;
+
+	hash_init(kvm->arch.nested_mmu_hash);
+	kvm->arch.nested_mmu_max = nested_mmu_max;
+
+	for (i = 0; i < KVM_ARM_NESTED_PASSTHROUGH_NR; i++) {
+		kvm->arch.nested_passthrough[i].ipa =
+			KVM_ARM_NESTED_PASSTHROUGH_NONE;
+		kvm->arch.nested_passthrough[i].l2_ipa =
+			KVM_ARM_NESTED_PASSTHROUGH_NONE;
+	}
+	kvm->arch.nested_passthrough[KVM_ARM_NESTED_PASSTHROUGH_VGIC_VCPU].ipa =
+		NESTED_VCPU_IF_ADDR;
+}
+
+/* VTTBR_EL2.BADDR, the guest hypervisor's stage 2 root for a nested VM */
+static u64 get_baddr(u64 vttbr)
+{
+	return vttbr & GENMASK_ULL(47, 1);
+}
+
+/*
+ * A shadow mmu belongs to a virtual VMID and to the guest stage 2 root it
+ * translates through, so reusing a VMID for another nested VM never picks up
+ * the previous VM's shadow page tables.
+ */
+static bool nested_mmu_match(struct kvm_nested_s2_mmu *mmu, u64 vttbr)
+{
+	return get_vmid(mmu->virtual_vttbr) == get_vmid(vttbr) &&
+	       get_baddr(mmu->virtual_vttbr) == get_baddr(vttbr);
 }
 
 struct kvm_nested_s2_mmu *lookup_nested_mmu(struct kvm_vcpu *vcpu, u64 vttbr)
 {
 	struct kvm_nested_s2_mmu *mmu;
-	u64 virtual_vmid;
-	u64 target_vmid = get_vmid(vttbr);
-	struct list_head *nested_mmu_list = &vcpu->kvm->arch.nested_mmu_list;
 
-	/* Search a mmu in the list using the virtual VMID as a key */
-	list_for_each_entry_rcu(mmu, nested_mmu_list, list) {
-		virtual_vmid = get_vmid(mmu->virtual_vttbr);
-		if (target_vmid == virtual_vmid)
+	/*
+	 * A vcpu normally keeps entering the same nested VM, so check the
+	 * shadow mmu it used last time before going to the hash table.
+	 */
+	mmu = READ_ONCE(vcpu->arch.last_nested_mmu);
+	if (mmu && nested_mmu_match(mmu, vttbr))
+		return mmu;
+
+	/*
+	 * Search a mmu in the hash table using the virtual VMID as a key.
+	 *
+	 * A lockless walker may race with a shadow mmu being recycled for
+	 * another virtual VMID and miss an entry; callers that cannot
+	 * tolerate that hold kvm->mmu_lock.
+	 */
+	hash_for_each_possible_rcu(vcpu->kvm->arch.nested_mmu_hash, mmu,
+				   hash_node, get_vmid(vttbr)) {
+		if (nested_mmu_match(mmu, vttbr))
 			return mmu;
 	}
 	return NULL;
 }
 
+/*
+ * Make @nested_mmu the shadow mmu held by @vcpu. A held shadow mmu is never
+ * recycled, which keeps the vcpu from entering a nested VM with page tables
+ * that have been handed over to another virtual VMID.
+ * This function expects kvm->mmu_lock to be held.
+ */
+static void nested_mmu_hold(struct kvm_vcpu *vcpu,
+			    struct kvm_nested_s2_mmu *nested_mmu)
+{
+	struct kvm_nested_s2_mmu *old = vcpu->arch.last_nested_mmu;
+
+	if (old != nested_mmu) {
+		if (old)
+			old->users--;
+		nested_mmu->users++;
+		WRITE_ONCE(vcpu->arch.last_nested_mmu, nested_mmu);
+	}
+
+	/* From now on, nobody else defers invalidations for this mmu */
+	nested_mmu_flush_tlbi(vcpu->kvm, nested_mmu);
+}
+
+/*
+ * Find the least recently entered shadow mmu that no vcpu holds.
+ * This function expects kvm->mmu_lock to be held.
+ */
+static struct kvm_nested_s2_mmu *find_nested_mmu_victim(struct kvm *kvm)
+{
+	struct kvm_nested_s2_mmu *nested_mmu, *victim = NULL;
+
+	list_for_each_entry(nested_mmu, &kvm->arch.nested_mmu_list, list) {
+		if (nested_mmu->users)
+			continue;
+		if (!victim ||
+		    time_before(nested_mmu->last_used, victim->last_used))
+			victim = nested_mmu;
+	}
+
+	return victim;
+}
+
+/*
+ * Hand over a shadow mmu to a new virtual VMID once the per-VM limit has
+ * been reached. Returns NULL if the pool still has room or if every shadow
+ * mmu is held by a vcpu, in which case the caller allocates a new one.
+ * This function expects kvm->mmu_lock to be held.
+ */
+static struct kvm_nested_s2_mmu *recycle_nested_mmu(struct kvm_vcpu *vcpu,
+						    u64 vttbr)
+{
+	struct kvm *kvm = vcpu->kvm;
+	struct kvm_nested_s2_mmu *victim;
+
+	if (!kvm->arch.nested_mmu_max ||
+	    kvm->stat.nested_mmu_count < kvm->arch.nested_mmu_max)
+		return NULL;
+
+	victim = find_nested_mmu_victim(kvm);
+	if (!victim)
+		return NULL;
+
+	/*
+	 * Unmapping the whole range also invalidates the TLB entries of the
+	 * shadow VMID, so none of the previous nested VM's translations
+	 * survive the hand over.
+	 */
+	hash_del_rcu(&victim->hash_node);
+	nested_mmu_unmap_all(kvm, victim);
+
+	victim->virtual_vttbr = vttbr;
+	victim->prefault_next = 0;
+	hash_add_rcu(kvm->arch.nested_mmu_hash, &victim->hash_node,
+		     get_vmid(vttbr));
+	kvm->stat.nested_mmu_recycled++;
+
+	return victim;
+}
+
+/*
+ * Hand the shadow mmu of a nested VM over to the new virtual VMID the guest
+ * hypervisor gave it, e.g. after a VMID rollover in the guest, rather than
+ * recycling the shadow mmu of another nested VM. The old VMID's one is no
+ * longer entered once the guest moved the stage 2 root to the new VMID.
+ * Its mappings are dropped all the same: the guest may have changed its
+ * stage 2 tables without invalidating the old VMID, whose stale
+ * translations must not leak into the new one. Only a shadow mmu that no
+ * vcpu holds is taken over.
+ * This function expects kvm->mmu_lock to be held.
+ */
+static struct kvm_nested_s2_mmu *adopt_nested_mmu(struct kvm_vcpu *vcpu,
+						  u64 vttbr)
+{
+	struct kvm *kvm = vcpu->kvm;
+	struct kvm_nested_s2_mmu *nested_mmu;
+
+	list_for_each_entry(nested_mmu, &kvm->arch.nested_mmu_list, list) {
+		if (nested_mmu->users ||
+		    get_baddr(nested_mmu->virtual_vttbr) != get_baddr(vttbr))
+			continue;
+
+		hash_del_rcu(&nested_mmu->hash_node);
+		nested_mmu_unmap_all(kvm, nested_mmu);
+
+		nested_mmu->virtual_vttbr = vttbr;
+		nested_mmu->prefault_next = 0;
+		hash_add_rcu(kvm->arch.nested_mmu_hash, &nested_mmu->hash_node,
+			     get_vmid(vttbr));
+
+		/*
+		 * Get a fresh hardware VMID on the next entry, so that none of
+		 * the stage 1 TLB entries of the previous virtual VMID apply.
+		 */
+		WRITE_ONCE(nested_mmu->mmu.vmid.vmid_gen, 0);
+		kvm->stat.nested_mmu_adopted++;
+
+		return nested_mmu;
+	}
+
+	return NULL;
+}
+
 /*
  * Clear mappings in the shadow stage 2 page tables for the current VMID from
  * the perspective of the guest hypervisor.
@@ -366,71 +1159,387 @@ bool kvm_nested_s2_clear_curr_vmid(struct kvm_vcpu *vcpu, phys_addr_t start,
 	if (!nested_mmu)
 		return false;
 
-	kvm_unmap_stage2_range(vcpu->kvm, &nested_mmu->mmu, start, size);
+	nested_mmu_tlbi(vcpu, nested_mmu, start, size);
 	return true;
 }
 
+static struct kvm_nested_s2_mmu *alloc_nested_mmu(u64 vttbr)
+{
+	struct kvm_nested_s2_mmu *nested_mmu;
+
+	nested_mmu = kzalloc(sizeof(struct kvm_nested_s2_mmu), GFP_KERNEL);
+	if (!nested_mmu)
+		return NULL;
+
+	if (__kvm_alloc_stage2_pgd(&nested_mmu->mmu)) {
+		kfree(nested_mmu);
+		return NULL;
+	}
+
+	/* The virtual VMID will be used as a key when searching a mmu */
+	nested_mmu->virtual_vttbr = vttbr;
+	nested_mmu->last_used = jiffies;
+	nested_mmu->passthrough_pending = true;
+
+	return nested_mmu;
+}
+
+static void free_nested_mmu(struct kvm *kvm,
+			    struct kvm_nested_s2_mmu *nested_mmu)
+{
+	__kvm_free_stage2_pgd(kvm, &nested_mmu->mmu);
+	kfree(nested_mmu);
+}
+
+/* This function expects kvm->mmu_lock to be held. */
+static void add_nested_mmu(struct kvm *kvm,
+			   struct kvm_nested_s2_mmu *nested_mmu)
+{
+	list_add_rcu(&nested_mmu->list, &kvm->arch.nested_mmu_list);
+	hash_add_rcu(kvm->arch.nested_mmu_hash, &nested_mmu->hash_node,
+		     get_vmid(nested_mmu->virtual_vttbr));
+	kvm->stat.nested_mmu_count++;
+}
+
 /**
  * create_nested_mmu - create mmu for the given virtual VMID
  *
  * Called from setup_s2_mmu before entering the nested VM to ensure the shadow
- * stage 2 page table is allocated and it is valid to use.
+ * stage 2 page table is allocated and it is valid to use. When the VM already
+ * has nested_mmu_max shadow mmus, the least recently entered one is recycled
+ * instead of allocating a new one.
  */
 static struct kvm_nested_s2_mmu *create_nested_mmu(struct kvm_vcpu *vcpu,
 						   u64 vttbr)
 {
 	struct kvm_nested_s2_mmu *nested_mmu, *tmp_mmu;
-	struct list_head *nested_mmu_list = &vcpu->kvm->arch.nested_mmu_list;
 	bool need_free = false;
-	int ret;
 
-	nested_mmu = kzalloc(sizeof(struct kvm_nested_s2_mmu), GFP_KERNEL);
-	if (!nested_mmu)
-		return NULL;
+	kvm_mmu_write_lock(vcpu->kvm);
+	tmp_mmu = lookup_nested_mmu(vcpu, vttbr);
+	if (!tmp_mmu)
+		tmp_mmu = adopt_nested_mmu(vcpu, vttbr);
+	if (!tmp_mmu)
+		tmp_mmu = recycle_nested_mmu(vcpu, vttbr);
+	if (tmp_mmu) {
+		tmp_mmu->last_used = jiffies;
+		nested_mmu_hold(vcpu, tmp_mmu);
+	}
+	kvm_mmu_write_unlock(vcpu->kvm);
 
-	ret = __kvm_alloc_stage2_pgd(&nested_mmu->mmu);
-	if (ret) {
-		kfree(nested_mmu);
+	if (tmp_mmu)
+		return tmp_mmu;
+
+	nested_mmu = alloc_nested_mmu(vttbr);
+	if (!nested_mmu)
 		return NULL;
-	}
 
-	spin_lock(&vcpu->kvm->mmu_lock);
+	kvm_mmu_write_lock(vcpu->kvm);
 	tmp_mmu = lookup_nested_mmu(vcpu, vttbr);
 	if (!tmp_mmu) {
-		list_add_rcu(&nested_mmu->list, nested_mmu_list);
+		add_nested_mmu(vcpu->kvm, nested_mmu);
+		nested_mmu_hold(vcpu, nested_mmu);
 	} else {
 		/*
 		 * Somebody already put a new nested_mmu for this virtual VMID
 		 * to the list behind our back.
 		 */
 		need_free = true;
+		nested_mmu_hold(vcpu, tmp_mmu);
 	}
-	spin_unlock(&vcpu->kvm->mmu_lock);
+	kvm_mmu_write_unlock(vcpu->kvm);
 
 	if (need_free) {
-		__kvm_free_stage2_pgd(vcpu->kvm, &nested_mmu->mmu);
-		kfree(nested_mmu);
+		free_nested_mmu(vcpu->kvm, nested_mmu);
 		nested_mmu = tmp_mmu;
 	}
 
-	/* The virtual VMID will be used as a key when searching a mmu */
-	nested_mmu->virtual_vttbr = vttbr;
-
 	return nested_mmu;
 }
 
+/**
+ * kvm_nested_s2_get_hints - list the virtual VTTBRs of the shadow mmus
+ * @vcpu:	The vcpu the hints are taken through
+ * @vttbrs:	Where to store the virtual VTTBR_EL2 values
+ * @max:	Size of @vttbrs
+ *
+ * The shadow mmu held by @vcpu comes first, then the most recently created
+ * ones. Returns the number of entries stored in @vttbrs.
+ */
+unsigned int kvm_nested_s2_get_hints(struct kvm_vcpu *vcpu, u64 *vttbrs,
+				     unsigned int max)
+{
+	struct kvm_nested_s2_mmu *nested_mmu, *held;
+	unsigned int n = 0;
+
+	kvm_mmu_read_lock(vcpu);
+	held = vcpu->arch.last_nested_mmu;
+	if (held && max)
+		vttbrs[n++] = held->virtual_vttbr;
+
+	list_for_each_entry(nested_mmu, &vcpu->kvm->arch.nested_mmu_list,
+			    list) {
+		if (n == max)
+			break;
+		if (nested_mmu != held)
+			vttbrs[n++] = nested_mmu->virtual_vttbr;
+	}
+	kvm_mmu_read_unlock(vcpu->kvm);
+
+	return n;
+}
+
+/**
+ * kvm_nested_s2_add_hint - create a shadow mmu ahead of its first use
+ * @vcpu:	The vcpu the hint is given through
+ * @vttbr:	Virtual VTTBR_EL2 of the nested VM
+ *
+ * Used on the destination of a migration, so that the first entry into each
+ * nested VM finds its shadow mmu, which nobody holds until then. Nothing is
+ * recycled for a hint: once the VM has nested_mmu_max shadow mmus, this
+ * returns -ENOSPC.
+ */
+int kvm_nested_s2_add_hint(struct kvm_vcpu *vcpu, u64 vttbr)
+{
+	struct kvm *kvm = vcpu->kvm;
+	struct kvm_nested_s2_mmu *nested_mmu;
+	int ret = 0;
+
+	nested_mmu = alloc_nested_mmu(vttbr);
+	if (!nested_mmu)
+		return -ENOMEM;
+
+	kvm_mmu_write_lock(kvm);
+	/* Several vcpus may give the same hint */
+	if (!lookup_nested_mmu(vcpu, vttbr)) {
+		if (kvm->arch.nested_mmu_max &&
+		    kvm->stat.nested_mmu_count >= kvm->arch.nested_mmu_max) {
+			ret = -ENOSPC;
+		} else {
+			add_nested_mmu(kvm, nested_mmu);
+			nested_mmu = NULL;
+		}
+	}
+	kvm_mmu_write_unlock(kvm);
+
+	if (nested_mmu)
+		free_nested_mmu(kvm, nested_mmu);
+
+	return ret;
+}
+
 static struct kvm_s2_mmu *get_s2_mmu_nested(struct kvm_vcpu *vcpu)
 {
 	u64 vttbr = vcpu_sys_reg(vcpu, VTTBR_EL2);
 	struct kvm_nested_s2_mmu *nested_mmu;
 
-	nested_mmu = lookup_nested_mmu(vcpu, vttbr);
-	if (!nested_mmu)
-		nested_mmu = create_nested_mmu(vcpu, vttbr);
+	/* Fast path: the vcpu re-enters the nested VM it already holds */
+	nested_mmu = vcpu->arch.last_nested_mmu;
+	if (nested_mmu && nested_mmu_match(nested_mmu, vttbr)) {
+		/*
+		 * Only this vcpu may have deferred invalidations while holding
+		 * the mmu. The first lookup in the run loop is done from
+		 * preemptible context and applies them before the irqs-off
+		 * lookups right before entering the guest.
+		 */
+		if (unlikely(nested_mmu_tlbi_pending(nested_mmu))) {
+			kvm_mmu_write_lock(vcpu->kvm);
+			nested_mmu_flush_tlbi(vcpu->kvm, nested_mmu);
+			kvm_mmu_write_unlock(vcpu->kvm);
+		}
+
+		nested_mmu->last_used = jiffies;
+		nested_mmu->virtual_vttbr = vttbr;
+		return &nested_mmu->mmu;
+	}
+
+	nested_mmu = create_nested_mmu(vcpu, vttbr);
 
 	return &nested_mmu->mmu;
 }
 
+/*
+ * Return the shadow mmu of the current virtual VTTBR_EL2 if the vcpu already
+ * holds it with no deferred invalidation, i.e. if it can be entered without
+ * going through the preemptible part of the run loop. Otherwise return NULL.
+ */
+struct kvm_s2_mmu *kvm_nested_s2_held_mmu(struct kvm_vcpu *vcpu)
+{
+	struct kvm_nested_s2_mmu *nested_mmu = vcpu->arch.last_nested_mmu;
+
+	if (!nested_mmu ||
+	    !nested_mmu_match(nested_mmu, vcpu_sys_reg(vcpu, VTTBR_EL2)) ||
+	    nested_mmu_tlbi_pending(nested_mmu))
+		return NULL;
+
+	return &nested_mmu->mmu;
+}
+
+/*
+ * Size of the region covered by an invalid descriptor at @level of the guest
+ * hypervisor's stage 2 page tables, so the prefault walk can skip it at once.
+ */
+static phys_addr_t nested_s2_level_size(struct kvm_vcpu *vcpu, int level)
+{
+	u64 vtcr = vcpu->arch.ctxt.sys_regs[VTCR_EL2];
+	unsigned int pgshift;
+
+	switch (vtcr & VTCR_EL2_TG0_MASK) {
+	case VTCR_EL2_TG0_4K:
+		pgshift = 12;	 break;
+	case VTCR_EL2_TG0_16K:
+		pgshift = 14;	 break;
+	case VTCR_EL2_TG0_64K:
+	default:
+		pgshift = 16;	 break;
+	}
+
+	return 1ULL << ((3 - level) * (pgshift - 3) + pgshift);
+}
+
+/* The host region of a KVM_ARM_NESTED_PASSTHROUGH_* type, if there is one */
+static bool nested_passthrough_region(unsigned int type, phys_addr_t *pa,
+				      phys_addr_t *size)
+{
+	switch (type) {
+	case KVM_ARM_NESTED_PASSTHROUGH_VGIC_VCPU:
+		*pa = vgic_vcpu_base();
+		*size = KVM_VGIC_V2_CPU_SIZE;
+		return *pa != 0;
+	default:
+		return false;
+	}
+}
+
+/*
+ * Map the pages of [l2_base, l2_base + size) that the guest hypervisor's
+ * stage 2 translates to the passthrough region at @ipa to the host region at
+ * @pa. Pages translated elsewhere are left to the fault path, pages mapped
+ * already are skipped. Must be called with kvm->srcu held.
+ */
+static int nested_s2_map_passthrough(struct kvm_vcpu *vcpu,
+				     struct kvm_s2_mmu *mmu, phys_addr_t l2_base,
+				     phys_addr_t ipa, phys_addr_t pa,
+				     phys_addr_t size)
+{
+	struct kvm_s2_trans trans;
+	phys_addr_t off;
+	int ret;
+
+	for (off = 0; off < size; off += PAGE_SIZE) {
+		trans.esr = 0;
+		if (kvm_walk_nested_s2(vcpu, l2_base + off, &trans) ||
+		    !trans.readable || (trans.output & PAGE_MASK) != ipa + off)
+			continue;
+
+		ret = __kvm_phys_addr_ioremap(vcpu->kvm, mmu, l2_base + off,
+					      pa + off, PAGE_SIZE,
+					      trans.writable);
+		if (ret && ret != -EFAULT)
+			return ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Shadow page tables start empty: map each passthrough region where the last
+ * nested VM that faulted on it had it, as guest hypervisors tend to give all
+ * their nested VMs the same memory map. A wrong guess maps nothing.
+ */
+static void nested_s2_premap_passthrough(struct kvm_vcpu *vcpu,
+					 struct kvm_nested_s2_mmu *nested_mmu)
+{
+	struct kvm_nested_passthrough *pt = vcpu->kvm->arch.nested_passthrough;
+	phys_addr_t ipa, l2_ipa, pa, size;
+	unsigned int type;
+	int idx;
+
+	WRITE_ONCE(nested_mmu->passthrough_pending, false);
+
+	idx = srcu_read_lock(&vcpu->kvm->srcu);
+	for (type = 0; type < KVM_ARM_NESTED_PASSTHROUGH_NR; type++) {
+		ipa = READ_ONCE(pt[type].ipa);
+		l2_ipa = READ_ONCE(pt[type].l2_ipa);
+		if (ipa == KVM_ARM_NESTED_PASSTHROUGH_NONE ||
+		    l2_ipa == KVM_ARM_NESTED_PASSTHROUGH_NONE ||
+		    !nested_passthrough_region(type, &pa, &size))
+			continue;
+
+		nested_s2_map_passthrough(vcpu, &nested_mmu->mmu, l2_ipa, ipa,
+					  pa, size);
+	}
+	srcu_read_unlock(&vcpu->kvm->srcu, idx);
+}
+
+/**
+ * kvm_nested_s2_prefault - populate the shadow stage 2 of a new nested VM
+ * @vcpu:	The vcpu about to enter the nested VM
+ *
+ * Maps the passthrough regions into shadow page tables that were emptied,
+ * then walks the next kvm-arm.nested_prefault pages of the guest hypervisor's
+ * stage 2 and maps whatever they translate to in the shadow page tables, so
+ * the nested VM doesn't take a shadow fault on each page it touches while
+ * warming up. Invalid descriptors are skipped a whole level at a time.
+ *
+ * Called from the run loop in preemptible context, as mapping memory may
+ * sleep, right after the active shadow mmu has been looked up.
+ */
+void kvm_nested_s2_prefault(struct kvm_vcpu *vcpu)
+{
+	u64 vtcr = vcpu->arch.ctxt.sys_regs[VTCR_EL2];
+	struct kvm_nested_s2_mmu *nested_mmu;
+	struct kvm_s2_trans trans;
+	phys_addr_t ipa, limit;
+	unsigned int budget = nested_prefault_pages;
+	long size;
+	int idx, ret;
+
+	if (!kvm_is_shadow_s2_fault(vcpu))
+		return;
+
+	nested_mmu = vcpu->arch.last_nested_mmu;
+	if (!nested_mmu ||
+	    !nested_mmu_match(nested_mmu, vcpu_sys_reg(vcpu, VTTBR_EL2)))
+		return;
+
+	if (unlikely(READ_ONCE(nested_mmu->passthrough_pending)))
+		nested_s2_premap_passthrough(vcpu, nested_mmu);
+
+	limit = 1ULL << (64 - (vtcr & TCR_EL2_T0SZ_MASK));
+	ipa = nested_mmu->prefault_next;
+	if (!budget || ipa >= limit)
+		return;
+
+	idx = srcu_read_lock(&vcpu->kvm->srcu);
+	while (budget-- && ipa < limit) {
+		trans.esr = 0;
+		ret = kvm_walk_nested_s2(vcpu, ipa, &trans);
+		if (ret < 0) {
+			ipa = limit;
+			break;
+		}
+
+		if (ret) {
+			/* Skip the whole region the guest doesn't map */
+			size = nested_s2_level_size(vcpu, trans.esr & 3);
+			ipa = (ipa + size) & ~(size - 1);
+			continue;
+		}
+
+		size = kvm_s2_prefault(vcpu, &nested_mmu->mmu, ipa, &trans);
+		if (size < 0) {
+			/* Leave the rest to the fault path */
+			ipa = limit;
+			break;
+		}
+		ipa += size;
+	}
+	srcu_read_unlock(&vcpu->kvm->srcu, idx);
+
+	nested_mmu->prefault_next = ipa;
+}
+
 struct kvm_s2_mmu *vcpu_get_active_s2_mmu(struct kvm_vcpu *vcpu)
 {
 	if (is_hyp_ctxt(vcpu) || !vcpu_nested_stage2_enabled(vcpu))
@@ -439,31 +1548,85 @@ struct kvm_s2_mmu *vcpu_get_active_s2_mmu(struct kvm_vcpu *vcpu)
 	return get_s2_mmu_nested(vcpu);
 }
 
-/*
- * vcpu interface address. This address is supposed to come from the guest's
- * device tree via QEMU. Here we just hardcoded it, but should be fixed.
+/**
+ * kvm_nested_mmio_ondemand - map a passthrough region on a shadow fault
+ * @vcpu:	The vcpu that faulted
+ * @fault_ipa:	The faulting L2 IPA
+ * @ipa:	The guest hypervisor's translation of @fault_ipa
+ *
+ * Maps the whole region @ipa falls into, not only the faulting page, and
+ * remembers where the nested VM has it for the next shadow stage 2s. Returns
+ * 1 if @ipa is in a passthrough region, 0 if it isn't, or a negative error
+ * code. Must be called with kvm->srcu held.
  */
-#define NESTED_VCPU_IF_ADDR	0x08010000
 int kvm_nested_mmio_ondemand(struct kvm_vcpu *vcpu, phys_addr_t fault_ipa,
 			     phys_addr_t ipa)
 {
-	int ret = 0;
-	phys_addr_t vcpu_base = vgic_vcpu_base();
+	struct kvm_nested_passthrough *pt = vcpu->kvm->arch.nested_passthrough;
+	phys_addr_t base, l2_base, pa, size;
+	unsigned int type;
+	int ret;
 
 	if (!nested_virt_in_use(vcpu))
 		return 0;
 
 	/* Return if this fault is not from a nested VM */
 	if (vcpu->arch.hw_mmu == &vcpu->kvm->arch.mmu)
-		return ret;
+		return 0;
+
+	for (type = 0; type < KVM_ARM_NESTED_PASSTHROUGH_NR; type++) {
+		base = READ_ONCE(pt[type].ipa);
+		if (base == KVM_ARM_NESTED_PASSTHROUGH_NONE ||
+		    !nested_passthrough_region(type, &pa, &size) ||
+		    ipa < base || ipa - base >= size)
+			continue;
 
-	if (ipa == NESTED_VCPU_IF_ADDR)  {
-		ret = __kvm_phys_addr_ioremap(vcpu->kvm, vcpu->arch.hw_mmu,
-					      fault_ipa, vcpu_base,
-					      KVM_VGIC_V2_CPU_SIZE, true);
-		if (!ret)
-			ret = 1;
+		l2_base = (fault_ipa & PAGE_MASK) - ((ipa & PAGE_MASK) - base);
+		WRITE_ONCE(pt[type].l2_ipa, l2_base);
+
+		ret = nested_s2_map_passthrough(vcpu, vcpu->arch.hw_mmu,
+						l2_base, base, pa, size);
+		return ret ? ret : 1;
 	}
 
-	return ret;
+	return 0;
+}
+
+/**
+ * kvm_nested_set_passthrough - move a region passed through to nested VMs
+ * @kvm:	The VM
+ * @pt:		The KVM_ARM_NESTED_SET_PASSTHROUGH argument
+ *
+ * The shadow stage 2s are cleared, so that no nested VM keeps the region
+ * where the guest hypervisor used to have it.
+ */
+int kvm_nested_set_passthrough(struct kvm *kvm,
+			       struct kvm_arm_nested_passthrough *pt)
+{
+	struct kvm_nested_passthrough *region;
+	phys_addr_t pa, size;
+
+	if (pt->flags || pt->reserved[0] || pt->reserved[1] ||
+	    pt->type >= KVM_ARM_NESTED_PASSTHROUGH_NR)
+		return -EINVAL;
+
+	if (!nested_passthrough_region(pt->type, &pa, &size))
+		return -ENXIO;
+
+	if (pt->addr != KVM_ARM_NESTED_PASSTHROUGH_NONE) {
+		if (!PAGE_ALIGNED(pt->addr))
+			return -EINVAL;
+		if (pt->addr >= KVM_PHYS_SIZE || size > KVM_PHYS_SIZE - pt->addr)
+			return -E2BIG;
+	}
+
+	region = &kvm->arch.nested_passthrough[pt->type];
+
+	kvm_mmu_write_lock(kvm);
+	WRITE_ONCE(region->ipa, pt->addr);
+	WRITE_ONCE(region->l2_ipa, KVM_ARM_NESTED_PASSTHROUGH_NONE);
+	kvm_nested_s2_clear(kvm);
+	kvm_mmu_write_unlock(kvm);
+
+	return 0;
 }
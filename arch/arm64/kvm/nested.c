@@ -18,8 +18,13 @@
 #include <linux/kvm.h>
 #include <linux/kvm_host.h>
 
+#include <asm/kvm_coproc.h>
 #include <asm/kvm_emulate.h>
+#include <asm/kvm_mmu.h>
 #include <asm/kvm_nested_pv.h>
+#include <asm/kvm_rmap.h>
+
+#include "vgic.h"
 
 static bool nested_param;
 
@@ -30,6 +35,12 @@ int __init kvmarm_nested_cfg(char *buf)
 
 int init_nested_virt(void)
 {
+	int ret;
+
+	ret = kvm_rmap_init();
+	if (ret)
+		return ret;
+
 	if (nested_param && cpus_have_const_cap(ARM64_HAS_NESTED_VIRT))
 		kvm_info("Nested virtualization is supported\n");
 
@@ -40,6 +51,14 @@ int init_nested_virt(void)
 	return 0;
 }
 
+bool kvm_arm_nested_supported(void)
+{
+#ifdef CONFIG_KVM_ARM_NESTED_PV
+	return true;
+#endif
+	return nested_param && cpus_have_const_cap(ARM64_HAS_NESTED_VIRT);
+}
+
 bool nested_virt_in_use(struct kvm_vcpu *vcpu)
 {
 	if (nested_param && cpus_have_const_cap(ARM64_HAS_NESTED_VIRT)
@@ -93,14 +112,195 @@ int handle_wfx_nested(struct kvm_vcpu *vcpu, bool is_wfe)
 	return -EINVAL;
 }
 
-char *kvm_guest_state(struct kvm_vcpu *vcpu)
+/*
+ * The list registers are only written by the guest hypervisor, which cannot
+ * run while the nested VM is blocked: an interrupt it left pending there has
+ * to be taken at once, or it will be delayed until the next interrupt for
+ * the guest hypervisor itself.
+ */
+bool kvm_arm_nested_irq_pending(struct kvm_vcpu *vcpu)
+{
+	if (!nested_virt_in_use(vcpu) || vcpu_mode_el2(vcpu) ||
+	    !vcpu_el2_imo_is_set(vcpu))
+		return false;
+
+	if (kvm_vgic_global_state.type == VGIC_V3)
+		return vgic_v3_nested_irq_pending(vcpu);
+
+	return vgic_v2_nested_irq_pending(vcpu);
+}
+
+/*
+ * Block on a WFI from the nested VM. Only an interrupt for the guest
+ * hypervisor or one of the timers can wake it, which makes its halt times
+ * unrelated to the ones of the guest hypervisor: give it its own polling
+ * window, so that each side doesn't keep resetting the other's.
+ */
+void kvm_vcpu_block_nested(struct kvm_vcpu *vcpu)
+{
+	vcpu->stat.nested_wfi_exit++;
+
+	swap(vcpu->halt_poll_ns, vcpu->arch.nested_halt_poll_ns);
+	kvm_vcpu_block(vcpu);
+	swap(vcpu->halt_poll_ns, vcpu->arch.nested_halt_poll_ns);
+}
+
+int kvm_guest_ctxt(struct kvm_vcpu *vcpu)
+{
+	if (!nested_virt_in_use(vcpu))
+		return KVM_GUEST_CTXT_NONE;
+
+	if (is_hyp_ctxt(vcpu))
+		return KVM_GUEST_CTXT_L1_HYP;
+	if (vcpu_el2_imo_is_set(vcpu))
+		return KVM_GUEST_CTXT_L2_GUEST;
+	return KVM_GUEST_CTXT_L1_GUEST;
+}
+
+/* The KVM_ARM_NESTED_STATE_VGIC_* format of the virtual GICH interface */
+static u32 nested_state_vgic_flag(struct kvm_vcpu *vcpu)
+{
+	if (!irqchip_in_kernel(vcpu->kvm))
+		return 0;
+
+	switch (vcpu->kvm->arch.vgic.vgic_model) {
+	case KVM_DEV_TYPE_ARM_VGIC_V2:
+		return KVM_ARM_NESTED_STATE_VGIC_V2;
+	case KVM_DEV_TYPE_ARM_VGIC_V3:
+		return KVM_ARM_NESTED_STATE_VGIC_V3;
+	default:
+		return 0;
+	}
+}
+
+static void get_nested_vgic(struct kvm_vcpu *vcpu, u32 flag,
+			    struct kvm_arm_nested_vgic *state)
+{
+	struct vgic_cpu *vgic_cpu = &vcpu->arch.vgic_cpu;
+	int i;
+
+	if (flag == KVM_ARM_NESTED_STATE_VGIC_V2) {
+		struct vgic_v2_cpu_if *cpu_if = &vgic_cpu->nested_vgic_v2;
+
+		state->hcr = cpu_if->vgic_hcr;
+		state->vmcr = cpu_if->vgic_vmcr;
+		state->ap0r[0] = cpu_if->vgic_apr;
+		for (i = 0; i < kvm_vgic_global_state.nr_lr; i++)
+			state->lr[i] = cpu_if->vgic_lr[i];
+	} else {
+		struct vgic_v3_cpu_if *cpu_if = &vgic_cpu->nested_vgic_v3;
+
+		state->hcr = cpu_if->vgic_hcr;
+		state->vmcr = cpu_if->vgic_vmcr;
+		memcpy(state->ap0r, cpu_if->vgic_ap0r, sizeof(state->ap0r));
+		memcpy(state->ap1r, cpu_if->vgic_ap1r, sizeof(state->ap1r));
+		for (i = 0; i < kvm_vgic_global_state.nr_lr; i++)
+			state->lr[i] = cpu_if->vgic_lr[i];
+	}
+}
+
+static void set_nested_vgic(struct kvm_vcpu *vcpu, u32 flag,
+			    const struct kvm_arm_nested_vgic *state, int nr_lrs)
+{
+	struct vgic_cpu *vgic_cpu = &vcpu->arch.vgic_cpu;
+	int i;
+
+	if (flag == KVM_ARM_NESTED_STATE_VGIC_V2) {
+		struct vgic_v2_cpu_if *cpu_if = &vgic_cpu->nested_vgic_v2;
+
+		cpu_if->vgic_hcr = state->hcr;
+		cpu_if->vgic_vmcr = state->vmcr;
+		cpu_if->vgic_apr = state->ap0r[0];
+		for (i = 0; i < kvm_vgic_global_state.nr_lr; i++)
+			cpu_if->vgic_lr[i] = i < nr_lrs ? state->lr[i] : 0;
+
+		/* Translate all the LRs and their summary registers again */
+		vgic_init_nested(vcpu);
+	} else {
+		struct vgic_v3_cpu_if *cpu_if = &vgic_cpu->nested_vgic_v3;
+
+		cpu_if->vgic_hcr = state->hcr;
+		cpu_if->vgic_vmcr = state->vmcr;
+		memcpy(cpu_if->vgic_ap0r, state->ap0r, sizeof(state->ap0r));
+		memcpy(cpu_if->vgic_ap1r, state->ap1r, sizeof(state->ap1r));
+		for (i = 0; i < kvm_vgic_global_state.nr_lr; i++)
+			cpu_if->vgic_lr[i] = i < nr_lrs ? state->lr[i] : 0;
+	}
+}
+
+/**
+ * kvm_arm_get_nested_state - save the nested virtualization state of a vcpu
+ * @vcpu:	The vcpu, which is not running
+ * @state:	The KVM_ARM_GET_NESTED_STATE buffer, zeroed by the caller
+ *
+ * Only the state the guest hypervisor sees is saved: whatever KVM derives
+ * from it for the hardware, i.e. the shadow EL1 registers of the virtual EL2
+ * and the shadow GIC interface, is rebuilt on the next entry anyway.
+ */
+int kvm_arm_get_nested_state(struct kvm_vcpu *vcpu,
+			     struct kvm_arm_nested_state *state)
+{
+	if (!nested_virt_in_use(vcpu))
+		return -EINVAL;
+
+	state->nr_regs = kvm_arm_nested_get_regs(vcpu, state->regs);
+
+	state->flags = nested_state_vgic_flag(vcpu);
+	if (state->flags) {
+		state->nr_lrs = kvm_vgic_global_state.nr_lr;
+		get_nested_vgic(vcpu, state->flags, &state->vgic);
+	}
+
+	state->nr_hints = kvm_nested_s2_get_hints(vcpu, state->hints,
+						  KVM_ARM_NESTED_MAX_HINTS);
+	return 0;
+}
+
+/**
+ * kvm_arm_set_nested_state - restore the nested virtualization state of a vcpu
+ * @vcpu:	The vcpu, which is not running
+ * @state:	The KVM_ARM_SET_NESTED_STATE buffer
+ *
+ * The vGIC state is only restored if @state has the format of the VM's vGIC.
+ * Hints that don't fit in the shadow mmu pool are ignored.
+ */
+int kvm_arm_set_nested_state(struct kvm_vcpu *vcpu,
+			     const struct kvm_arm_nested_state *state)
 {
+	u32 vgic_flag = state->flags & (KVM_ARM_NESTED_STATE_VGIC_V2 |
+					KVM_ARM_NESTED_STATE_VGIC_V3);
+	unsigned int i;
+	int ret;
+
 	if (!nested_virt_in_use(vcpu))
-		return "";
+		return -EINVAL;
 
-       if (is_hyp_ctxt(vcpu))
-               return "L1 Hypervisor";
-       if (vcpu_el2_imo_is_set(vcpu))
-               return "L2 Guest";
-       return "L1 Guest";
+	if (state->flags & ~vgic_flag ||
+	    state->nr_regs > KVM_ARM_NESTED_MAX_REGS ||
+	    state->nr_hints > KVM_ARM_NESTED_MAX_HINTS)
+		return -EINVAL;
+
+	if (vgic_flag && (vgic_flag != nested_state_vgic_flag(vcpu) ||
+			  state->nr_lrs > kvm_vgic_global_state.nr_lr))
+		return -EINVAL;
+
+	ret = kvm_arm_nested_set_regs(vcpu, state->regs, state->nr_regs);
+	if (ret)
+		return ret;
+
+	if (vgic_flag)
+		set_nested_vgic(vcpu, vgic_flag, &state->vgic, state->nr_lrs);
+
+	/* Nothing cached from the guest hypervisor's tables can be trusted */
+	kvm_nested_s2_tlb_invalidate(vcpu->kvm);
+
+	for (i = 0; i < state->nr_hints; i++) {
+		ret = kvm_nested_s2_add_hint(vcpu, state->hints[i]);
+		if (ret == -ENOSPC)
+			break;
+		if (ret)
+			return ret;
+	}
+
+	return 0;
 }
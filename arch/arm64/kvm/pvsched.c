@@ -0,0 +1,214 @@
+/*
+ * Copyright (C) 2017 - Linaro Ltd
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/kvm_host.h>
+#include <linux/sched.h>
+#include <linux/uaccess.h>
+
+#include <asm/kvm_emulate.h>
+
+/*
+ * The state is accessed through the guest's userspace mapping, so that the
+ * host writes are dirty-logged like any other. Most accesses run with
+ * preemption disabled, some from the preempt notifiers: page faults are
+ * disabled, and an update is lost if the page isn't mapped at that time,
+ * which the guest has to cope with anyway for a page being migrated.
+ */
+static void pvsched_write(struct kvm_vcpu *vcpu, unsigned int offset,
+			  void *data, unsigned long len)
+{
+	int idx;
+
+	idx = srcu_read_lock(&vcpu->kvm->srcu);
+	pagefault_disable();
+	kvm_write_guest_offset_cached(vcpu->kvm, &vcpu->arch.pvsched_ghc,
+				      data, offset, len);
+	pagefault_enable();
+	srcu_read_unlock(&vcpu->kvm->srcu, idx);
+}
+
+#define pvsched_write_field(vcpu, field, val)				\
+	do {								\
+		typeof(((struct pvsched_vcpu_state *)0)->field) __v = (val); \
+									\
+		pvsched_write(vcpu,					\
+			      offsetof(struct pvsched_vcpu_state, field), \
+			      &__v, sizeof(__v));			\
+	} while (0)
+
+void kvm_pvsched_release(struct kvm_vcpu *vcpu)
+{
+	vcpu->arch.pvsched_enabled = false;
+}
+
+/*
+ * On load, current is the vcpu thread being scheduled in, and its run_delay
+ * already covers the time it just waited on the runqueue.
+ */
+void kvm_pvsched_vcpu_load(struct kvm_vcpu *vcpu)
+{
+	u64 run_delay;
+
+	if (!vcpu->arch.pvsched_enabled)
+		return;
+
+	run_delay = current->sched_info.run_delay;
+	vcpu->arch.pvsched_stolen_time += run_delay -
+					  vcpu->arch.pvsched_last_run_delay;
+	vcpu->arch.pvsched_last_run_delay = run_delay;
+
+	pvsched_write_field(vcpu, stolen_time,
+			    cpu_to_le64(vcpu->arch.pvsched_stolen_time));
+	pvsched_write_field(vcpu, preempted, 0);
+}
+
+void kvm_pvsched_vcpu_put(struct kvm_vcpu *vcpu)
+{
+	vcpu->arch.pvsched_deferred = false;
+
+	if (vcpu->arch.pvsched_enabled) {
+		pvsched_write_field(vcpu, preempted,
+				    cpu_to_le32(vcpu->preempted));
+		pvsched_write_field(vcpu, preempt_pending, 0);
+	}
+}
+
+/*
+ * Called after a guest exit, with preemption still disabled. If a reschedule
+ * is due while the guest asked for it to be held off, let the vcpu run on
+ * until its next exit instead, and tell the guest to exit once it is done.
+ * The deferral only lasts until that exit, where it is consumed: the vcpu
+ * loop then reschedules, even if the guest keeps preempt_delay set, and
+ * even without CONFIG_PREEMPT.
+ */
+bool kvm_pvsched_defer_preempt(struct kvm_vcpu *vcpu)
+{
+	struct pvsched_vcpu_state st;
+	int idx, ret;
+
+	if (vcpu->arch.pvsched_deferred) {
+		vcpu->arch.pvsched_deferred = false;
+		pvsched_write_field(vcpu, preempt_pending, 0);
+		return false;
+	}
+
+	if (!vcpu->arch.pvsched_enabled || !need_resched())
+		return false;
+
+	/* Only the head of the state, up to preempt_delay, is needed */
+	idx = srcu_read_lock(&vcpu->kvm->srcu);
+	pagefault_disable();
+	ret = kvm_read_guest_cached(vcpu->kvm, &vcpu->arch.pvsched_ghc, &st,
+			offsetofend(struct pvsched_vcpu_state, preempt_delay));
+	pagefault_enable();
+	srcu_read_unlock(&vcpu->kvm->srcu, idx);
+
+	if (ret || !st.preempt_delay)
+		return false;
+
+	vcpu->arch.pvsched_deferred = true;
+	vcpu->stat.pv_preempt_deferred++;
+	pvsched_write_field(vcpu, preempt_pending, cpu_to_le32(1));
+	return true;
+}
+
+static long pvsched_ipa_init(struct kvm_vcpu *vcpu, gpa_t gpa)
+{
+	struct gfn_to_hva_cache *ghc = &vcpu->arch.pvsched_ghc;
+	unsigned int start = offsetof(struct pvsched_vcpu_state, stolen_time);
+	unsigned int end = offsetofend(struct pvsched_vcpu_state,
+				       preempt_pending);
+	struct pvsched_vcpu_state st = { };
+	int idx, ret;
+
+	kvm_pvsched_release(vcpu);
+
+	if (!gpa)
+		return SMCCC_RET_SUCCESS;
+
+	if (!IS_ALIGNED(gpa, sizeof(struct pvsched_vcpu_state)))
+		return SMCCC_RET_NOT_SUPPORTED;
+
+	/* Clear the host's fields, preempt_delay is the guest's */
+	idx = srcu_read_lock(&vcpu->kvm->srcu);
+	ret = kvm_gfn_to_hva_cache_init(vcpu->kvm, ghc, gpa, sizeof(st));
+	if (!ret)
+		ret = kvm_write_guest_cached(vcpu->kvm, ghc, &st.preempted,
+					     sizeof(st.preempted));
+	if (!ret)
+		ret = kvm_write_guest_offset_cached(vcpu->kvm, ghc,
+						    (void *)&st + start,
+						    start, end - start);
+	srcu_read_unlock(&vcpu->kvm->srcu, idx);
+
+	if (ret)
+		return SMCCC_RET_NOT_SUPPORTED;
+
+	vcpu->arch.pvsched_stolen_time = 0;
+	vcpu->arch.pvsched_last_run_delay = current->sched_info.run_delay;
+	vcpu->arch.pvsched_enabled = true;
+
+	return SMCCC_RET_SUCCESS;
+}
+
+static long pvsched_yield(struct kvm_vcpu *vcpu, unsigned long mpidr)
+{
+	struct kvm_vcpu *target;
+
+	target = kvm_mpidr_to_vcpu(vcpu->kvm, mpidr);
+	if (!target || target == vcpu || !READ_ONCE(target->preempted))
+		return SMCCC_RET_NOT_REQUIRED;
+
+	vcpu->stat.pv_yield++;
+	if (kvm_vcpu_yield_to(target) <= 0)
+		return SMCCC_RET_NOT_REQUIRED;
+
+	return SMCCC_RET_SUCCESS;
+}
+
+/*
+ * Handle a paravirtualized scheduling call, see asm/pvsched-abi.h. Returns
+ * false if the HVC wasn't one, and is to be handled as a PSCI call.
+ */
+bool kvm_pvsched_call(struct kvm_vcpu *vcpu)
+{
+	u32 func = vcpu_get_reg(vcpu, 0);
+	unsigned long arg = vcpu_get_reg(vcpu, 1);
+	long val;
+
+	switch (func) {
+	case ARM_SMCCC_HV_CALL_UID:
+		val = ARM_SMCCC_HV_UID_KVM_0;
+		vcpu_set_reg(vcpu, 1, ARM_SMCCC_HV_UID_KVM_1);
+		vcpu_set_reg(vcpu, 2, ARM_SMCCC_HV_UID_KVM_2);
+		vcpu_set_reg(vcpu, 3, ARM_SMCCC_HV_UID_KVM_3);
+		break;
+	case ARM_SMCCC_HV_PV_SCHED_FEATURES:
+		val = kvm_pvsched_features(arg);
+		break;
+	case ARM_SMCCC_HV_PV_SCHED_IPA_INIT:
+		val = pvsched_ipa_init(vcpu, arg);
+		break;
+	case ARM_SMCCC_HV_PV_SCHED_YIELD:
+		val = pvsched_yield(vcpu, arg);
+		break;
+	default:
+		return false;
+	}
+
+	vcpu_set_reg(vcpu, 0, val);
+	return true;
+}
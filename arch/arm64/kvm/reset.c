@@ -86,6 +86,10 @@ int kvm_arch_dev_ioctl_check_extension(struct kvm *kvm, long ext)
 	case KVM_CAP_VCPU_ATTRIBUTES:
 		r = 1;
 		break;
+	case KVM_CAP_ARM_NESTED_STATE:
+	case KVM_CAP_ARM_NESTED_PASSTHROUGH:
+		r = kvm_arm_nested_supported();
+		break;
 	default:
 		r = 0;
 	}
@@ -127,6 +131,12 @@ int kvm_reset_vcpu(struct kvm_vcpu *vcpu)
 	/* Reset system registers */
 	kvm_reset_sys_regs(vcpu);
 
+	/* A reset guest hypervisor has to register its EL2 page again */
+	kvm_pv_el2_page_release(vcpu);
+
+	/* Same for the PV scheduling state */
+	kvm_pvsched_release(vcpu);
+
 	/* Reset PMU */
 	kvm_pmu_vcpu_reset(vcpu);
 
@@ -1,6 +1,49 @@
+#include <linux/slab.h>
+
 #include <asm/kvm_rmap.h>
 #include <asm/kvm_mmu.h>
 
+#include "trace.h"
+
+static struct kmem_cache *rmap_desc_cache;
+
+int kvm_rmap_init(void)
+{
+	rmap_desc_cache = kmem_cache_create("kvm_rmap_desc",
+					    sizeof(struct rmap_list_desc),
+					    0, 0, NULL);
+	if (!rmap_desc_cache)
+		return -ENOMEM;
+
+	return 0;
+}
+
+int kvm_rmap_topup_desc_cache(struct kvm_mmu_memory_cache *cache, int min)
+{
+	void *obj;
+
+	if (cache->nobjs >= min)
+		return 0;
+	while (cache->nobjs < min) {
+		obj = kmem_cache_zalloc(rmap_desc_cache, GFP_KERNEL);
+		if (!obj)
+			return -ENOMEM;
+		cache->objects[cache->nobjs++] = obj;
+	}
+	return 0;
+}
+
+void kvm_rmap_free_desc_cache(struct kvm_mmu_memory_cache *cache)
+{
+	while (cache->nobjs)
+		kmem_cache_free(rmap_desc_cache, cache->objects[--cache->nobjs]);
+}
+
+void kvm_mmu_free_rmap_list_desc(struct rmap_list_desc *rmap_list_desc)
+{
+	kmem_cache_free(rmap_desc_cache, rmap_list_desc);
+}
+
 struct kvm_rmap_head *gfn_to_rmap(struct kvm *kvm, gfn_t gfn)
 {
 	struct kvm_memory_slot *slot = gfn_to_memslot(kvm, gfn);
@@ -45,6 +88,7 @@ void cache_ipa(unsigned long table_addr, phys_addr_t fault_ipa, phys_addr_t ipa,
 }
 
 static struct kvm_rmap_head *search_rmap_entry(struct kvm *kvm,
+					       struct kvm_s2_mmu *mmu,
 					       unsigned long l1_ipa,
 					       unsigned long l2_ipa)
 {
@@ -52,9 +96,16 @@ static struct kvm_rmap_head *search_rmap_entry(struct kvm *kvm,
 	struct rmap_iterator iter;
 
 	rmap_head = gfn_to_rmap(kvm, gpa_to_gfn(l1_ipa));
+	if (!rmap_head)
+		return NULL;
 
+	/*
+	 * Nested VMs commonly share the same L2 IPA layout, so the mmu has to
+	 * match as well as the L2 IPA.
+	 */
 	for_each_rmap_head(rmap_head, &iter, rmap_curr) {
-		if (rmap_curr->val == l2_ipa)
+		if (rmap_curr->mmu == mmu &&
+		    rmap_l2_ipa(rmap_curr) == (l2_ipa & PAGE_MASK))
 			return rmap_curr;
 	}
 
@@ -85,7 +136,7 @@ static void clear_rmap(struct kvm *kvm, struct kvm_s2_mmu *mmu,
 	l2_ipa = addr;
 
 	/* remove rmap entry */
-	rmap_curr = search_rmap_entry(kvm, l1_ipa, l2_ipa);
+	rmap_curr = search_rmap_entry(kvm, mmu, l1_ipa, l2_ipa);
 	if (rmap_curr)
 		kvm_rmap_remove(kvm, rmap_curr, gpa_to_gfn(l1_ipa));
 
@@ -109,14 +160,15 @@ void clear_rmap_pmd(struct kvm *kvm, struct kvm_s2_mmu *mmu,
 static void set_rmap_entry(struct kvm_rmap_head *rmap_entry,
 			struct kvm_s2_mmu *mmu, gpa_t gpa, int last_level)
 {
-	rmap_entry->val = (unsigned long)gpa;
+	rmap_entry->val = ((unsigned long)gpa & PAGE_MASK) |
+			  ((unsigned long)last_level << RMAP_LEVEL_SHIFT);
 	rmap_entry->mmu = mmu;
-	rmap_entry->last_level = last_level;
 }
 
 static void clear_rmap_entry(struct kvm_rmap_head *rmap_head)
 {
-	set_rmap_entry(rmap_head, NULL, 0, 0);
+	rmap_head->val = 0;
+	rmap_head->mmu = NULL;
 }
 
 /*
@@ -135,8 +187,6 @@ static void rmap_list_add(struct kvm_rmap_head *rmap_head,
 	struct rmap_list_desc *desc;
 	int i;
 
-	l2_ipa = l2_ipa & PAGE_MASK;
-
 	if (!rmap_head->val) {
 		/* Set a mapping to an empty rmap entry. */
 		set_rmap_entry(rmap_head, mmu, l2_ipa, last_level);
@@ -153,15 +203,19 @@ static void rmap_list_add(struct kvm_rmap_head *rmap_head,
 		/* Denote that rmap head is pointing to a descriptor */
 		rmap_head->val = (unsigned long)desc | 1;
 	} else {
-		/* Search for the last descriptor starting from the first one */
+		/*
+		 * New mappings always go to the first descriptor, so adding
+		 * one doesn't depend on the length of the chain. If it is
+		 * full, put a new descriptor in front of it.
+		 */
 		desc = (struct rmap_list_desc *)(rmap_head->val & ~1ul);
-		while (desc->rmap_entries[RMAP_LIST_MAX-1].val && desc->more)
-			desc = desc->more;
-
-		/* If the last descriptor is full, create a new one */
 		if (desc->rmap_entries[RMAP_LIST_MAX-1].val) {
-			desc->more = kvm_mmu_memory_cache_alloc(rmap_cache);
-			desc = desc->more;
+			struct rmap_list_desc *new_desc;
+
+			new_desc = kvm_mmu_memory_cache_alloc(rmap_cache);
+			new_desc->more = desc;
+			rmap_head->val = (unsigned long)new_desc | 1;
+			desc = new_desc;
 		}
 
 		for (i = 0; desc->rmap_entries[i].val; ++i)
@@ -259,15 +313,22 @@ void rmap_add(struct kvm *kvm, struct kvm_s2_mmu *mmu,
 		struct kvm_mmu_memory_cache *rmap_cache)
 {
 	struct kvm_rmap_head *rmap_head;
-	bool first_entry;
+	u64 start = 0;
+
+	if (trace_kvm_nested_rmap_add_enabled())
+		start = ktime_get_ns();
 
 	/* Look up the rmap entry using L1 IPA as a key */
 	rmap_head = gfn_to_rmap(kvm, gpa_to_gfn(l1_ipa));
 	if (!rmap_head)
 		return;
 
-	first_entry = !rmap_head->val;
 	rmap_list_add(rmap_head, mmu, l2_ipa, last_level, rmap_cache);
+	kvm->stat.nested_rmap_add++;
+
+	if (trace_kvm_nested_rmap_add_enabled())
+		trace_kvm_nested_rmap_add(l2_ipa, l1_ipa, last_level,
+					  ktime_get_ns() - start);
 }
 
 void kvm_rmap_add_pmd(struct kvm *kvm, struct kvm_s2_mmu *mmu,
@@ -300,6 +361,7 @@ void kvm_rmap_remove(struct kvm *kvm, struct kvm_rmap_head *rmap_curr,
 		return;
 
 	rmap_list_remove(rmap_curr, rmap_head);
+	kvm->stat.nested_rmap_remove++;
 }
 
 /*
@@ -23,6 +23,7 @@
 #include <linux/bsearch.h>
 #include <linux/kvm_host.h>
 #include <linux/mm.h>
+#include <linux/slab.h>
 #include <linux/uaccess.h>
 
 #include <asm/cacheflush.h>
@@ -34,11 +35,13 @@
 #include <asm/kvm_coproc.h>
 #include <asm/kvm_emulate.h>
 #include <asm/kvm_host.h>
+#include <asm/kvm_hyp.h>
 #include <asm/kvm_mmu.h>
 #include <asm/perf_event.h>
 #include <asm/sysreg.h>
 
 #include <trace/events/kvm.h>
+#include <kvm/arm_lock_stat.h>
 
 #include "sys_regs.h"
 
@@ -75,6 +78,107 @@ static bool write_to_read_only(struct kvm_vcpu *vcpu,
 	return false;
 }
 
+/*
+ * While kvm_vcpu_load_sysregs() leaves the EL1 state of the vcpu on the CPU,
+ * these registers are accessed there, through their EL12 encoding.
+ */
+static bool __vcpu_read_sys_reg_from_cpu(int reg, u64 *val)
+{
+	switch (reg) {
+	case SCTLR_EL1:		*val = read_sysreg_el1(sctlr);		break;
+	case CPACR_EL1:		*val = read_sysreg_el1(cpacr);		break;
+	case TTBR0_EL1:		*val = read_sysreg_el1(ttbr0);		break;
+	case TTBR1_EL1:		*val = read_sysreg_el1(ttbr1);		break;
+	case TCR_EL1:		*val = read_sysreg_el1(tcr);		break;
+	case ESR_EL1:		*val = read_sysreg_el1(esr);		break;
+	case AFSR0_EL1:		*val = read_sysreg_el1(afsr0);		break;
+	case AFSR1_EL1:		*val = read_sysreg_el1(afsr1);		break;
+	case FAR_EL1:		*val = read_sysreg_el1(far);		break;
+	case MAIR_EL1:		*val = read_sysreg_el1(mair);		break;
+	case VBAR_EL1:		*val = read_sysreg_el1(vbar);		break;
+	case CONTEXTIDR_EL1:	*val = read_sysreg_el1(contextidr);	break;
+	case AMAIR_EL1:		*val = read_sysreg_el1(amair);		break;
+	case CNTKCTL_EL1:	*val = read_sysreg_el1(cntkctl);	break;
+	case PAR_EL1:		*val = read_sysreg(par_el1);		break;
+	default:		return false;
+	}
+
+	return true;
+}
+
+static bool __vcpu_write_sys_reg_to_cpu(u64 val, int reg)
+{
+	switch (reg) {
+	case SCTLR_EL1:		write_sysreg_el1(val, sctlr);		break;
+	case CPACR_EL1:		write_sysreg_el1(val, cpacr);		break;
+	case TTBR0_EL1:		write_sysreg_el1(val, ttbr0);		break;
+	case TTBR1_EL1:		write_sysreg_el1(val, ttbr1);		break;
+	case TCR_EL1:		write_sysreg_el1(val, tcr);		break;
+	case ESR_EL1:		write_sysreg_el1(val, esr);		break;
+	case AFSR0_EL1:		write_sysreg_el1(val, afsr0);		break;
+	case AFSR1_EL1:		write_sysreg_el1(val, afsr1);		break;
+	case FAR_EL1:		write_sysreg_el1(val, far);		break;
+	case MAIR_EL1:		write_sysreg_el1(val, mair);		break;
+	case VBAR_EL1:		write_sysreg_el1(val, vbar);		break;
+	case CONTEXTIDR_EL1:	write_sysreg_el1(val, contextidr);	break;
+	case AMAIR_EL1:		write_sysreg_el1(val, amair);		break;
+	case CNTKCTL_EL1:	write_sysreg_el1(val, cntkctl);		break;
+	case PAR_EL1:		write_sysreg(val, par_el1);		break;
+	case MPIDR_EL1:
+		/*
+		 * The guest can't change it, so the vcpu keeps the value
+		 * for everyone else to read, VMPIDR_EL2 being only a copy.
+		 */
+		write_sysreg(val, vmpidr_el2);
+		return false;
+	default:		return false;
+	}
+
+	return true;
+}
+
+u64 vcpu_read_sys_reg(struct kvm_vcpu *vcpu, int reg)
+{
+	u64 val;
+
+	preempt_disable();
+	if (!vcpu->arch.sysregs_loaded_on_cpu ||
+	    !__vcpu_read_sys_reg_from_cpu(reg, &val))
+		val = vcpu_sys_reg(vcpu, reg);
+	preempt_enable();
+
+	return val;
+}
+
+void vcpu_write_sys_reg(struct kvm_vcpu *vcpu, u64 val, int reg)
+{
+	preempt_disable();
+	if (!vcpu->arch.sysregs_loaded_on_cpu ||
+	    !__vcpu_write_sys_reg_to_cpu(val, reg))
+		vcpu_sys_reg(vcpu, reg) = val;
+	preempt_enable();
+}
+
+void vcpu_write_elr_el1(struct kvm_vcpu *vcpu, u64 val)
+{
+	preempt_disable();
+	if (vcpu->arch.sysregs_loaded_on_cpu)
+		write_sysreg_el1(val, elr);
+	else
+		vcpu_gp_regs(vcpu)->elr_el1 = val;
+	preempt_enable();
+}
+
+void vcpu_write_spsr_el1(struct kvm_vcpu *vcpu, u64 val)
+{
+	preempt_disable();
+	if (vcpu->arch.sysregs_loaded_on_cpu)
+		write_sysreg_el1(val, spsr);
+	else
+		vcpu_gp_regs(vcpu)->spsr[KVM_SPSR_EL1] = val;
+	preempt_enable();
+}
+
 /* 3 bits per cache level, as per CLIDR, but non-existent caches always 0 */
 static u32 cache_levels;
 
@@ -166,7 +270,7 @@ static bool access_vm_reg(struct kvm_vcpu *vcpu,
 			  const struct sys_reg_desc *r)
 {
 	bool was_enabled = vcpu_has_cache_enabled(vcpu);
-	u64 *sysreg = &vcpu_sys_reg(vcpu, r->reg);
+	int reg = r->reg;
 	int i;
 	const struct el1_el2_map *map;
 
@@ -184,7 +288,7 @@ static bool access_vm_reg(struct kvm_vcpu *vcpu,
 		for (i = 0; i < ARRAY_SIZE(vm_map); i++) {
 			map = &vm_map[i];
 			if (map->el1 == r->reg) {
-				sysreg = &vcpu_sys_reg(vcpu, map->el2);
+				reg = map->el2;
 				break;
 			}
 		}
@@ -193,12 +297,13 @@ static bool access_vm_reg(struct kvm_vcpu *vcpu,
 	BUG_ON(!vcpu_mode_el2(vcpu) && !p->is_write);
 
 	if (!p->is_write) {
-		p->regval = *sysreg;
+		p->regval = vcpu_read_sys_reg(vcpu, reg);
 		return true;
 	}
 
 	if (!p->is_aarch32) {
-		*sysreg = p->regval;
+		vcpu_write_sys_reg(vcpu, p->regval, reg);
+		vcpu_shadow_reg_dirty(vcpu, reg);
 	} else {
 		if (!p->is_32bit)
 			vcpu_cp15_64_high(vcpu, r->reg) = upper_32_bits(p->regval);
@@ -1086,6 +1191,108 @@ static bool trap_el2_regs(struct kvm_vcpu *vcpu,
 	return true;
 }
 
+/*
+ * The EL2 physical and virtual timers of the guest hypervisor both count
+ * with no offset, and are emulated the same way as its EL1 physical timer,
+ * with the background timer set by kvm_timer_emulate() on entry. The EL2
+ * virtual timer is only in the hardware while the vcpu runs in a VHE virtual
+ * EL2, which doesn't trap its CNTV_*_EL0 accesses: its state is in memory
+ * whenever we get here.
+ */
+static bool access_el2_timer_tval(struct kvm_vcpu *vcpu,
+				  struct sys_reg_params *p,
+				  struct arch_timer_context *timer_ctx)
+{
+	u64 now = kvm_phys_timer_read();
+
+	if (forward_nv_traps(vcpu))
+		return kvm_inject_nested_sync(vcpu, kvm_vcpu_get_hsr(vcpu));
+
+	if (p->is_write)
+		timer_ctx->cnt_cval = p->regval + now;
+	else
+		p->regval = timer_ctx->cnt_cval - now;
+
+	return true;
+}
+
+static bool access_el2_timer_ctl(struct kvm_vcpu *vcpu,
+				 struct sys_reg_params *p,
+				 struct arch_timer_context *timer_ctx)
+{
+	if (forward_nv_traps(vcpu))
+		return kvm_inject_nested_sync(vcpu, kvm_vcpu_get_hsr(vcpu));
+
+	if (p->is_write) {
+		/* ISTATUS bit is read-only */
+		timer_ctx->cnt_ctl = p->regval & ~ARCH_TIMER_CTRL_IT_STAT;
+	} else {
+		p->regval = timer_ctx->cnt_ctl;
+		/* Same ISTATUS convention as access_cntp_ctl() */
+		if (timer_ctx->cnt_cval <= kvm_phys_timer_read())
+			p->regval |= ARCH_TIMER_CTRL_IT_STAT;
+	}
+
+	return true;
+}
+
+static bool access_el2_timer_cval(struct kvm_vcpu *vcpu,
+				  struct sys_reg_params *p,
+				  struct arch_timer_context *timer_ctx)
+{
+	if (forward_nv_traps(vcpu))
+		return kvm_inject_nested_sync(vcpu, kvm_vcpu_get_hsr(vcpu));
+
+	if (p->is_write)
+		timer_ctx->cnt_cval = p->regval;
+	else
+		p->regval = timer_ctx->cnt_cval;
+
+	return true;
+}
+
+static bool access_cnthp_tval(struct kvm_vcpu *vcpu,
+		struct sys_reg_params *p,
+		const struct sys_reg_desc *r)
+{
+	return access_el2_timer_tval(vcpu, p, vcpu_hptimer(vcpu));
+}
+
+static bool access_cnthp_ctl(struct kvm_vcpu *vcpu,
+		struct sys_reg_params *p,
+		const struct sys_reg_desc *r)
+{
+	return access_el2_timer_ctl(vcpu, p, vcpu_hptimer(vcpu));
+}
+
+static bool access_cnthp_cval(struct kvm_vcpu *vcpu,
+		struct sys_reg_params *p,
+		const struct sys_reg_desc *r)
+{
+	return access_el2_timer_cval(vcpu, p, vcpu_hptimer(vcpu));
+}
+
+static bool access_cnthv_tval(struct kvm_vcpu *vcpu,
+		struct sys_reg_params *p,
+		const struct sys_reg_desc *r)
+{
+	return access_el2_timer_tval(vcpu, p, vcpu_hvtimer(vcpu));
+}
+
+static bool access_cnthv_ctl(struct kvm_vcpu *vcpu,
+		struct sys_reg_params *p,
+		const struct sys_reg_desc *r)
+{
+	return access_el2_timer_ctl(vcpu, p, vcpu_hvtimer(vcpu));
+}
+
+static bool access_cnthv_cval(struct kvm_vcpu *vcpu,
+		struct sys_reg_params *p,
+		const struct sys_reg_desc *r)
+{
+	return access_el2_timer_cval(vcpu, p, vcpu_hvtimer(vcpu));
+}
+
 /* This function is to support the recursive nested virtualization */
 static bool forward_nv1_traps(struct kvm_vcpu *vcpu, struct sys_reg_params *p)
 {
@@ -1159,10 +1366,12 @@ static bool access_cpacr(struct kvm_vcpu *vcpu,
 		u64 *sysreg = &vcpu_sys_reg(vcpu, CPTR_EL2);
 
 		/* We keep the value in ARMv8.0 CPTR_EL2 format. */
-		if (!p->is_write)
+		if (!p->is_write) {
 			p->regval = cptr_to_cpacr(*sysreg);
-		else
+		} else {
 			*sysreg	= cpacr_to_cptr(p->regval);
+			vcpu_shadow_reg_dirty(vcpu, CPTR_EL2);
+		}
 	} else /* CPACR_EL1 access with E2H == 0 or CPACR_EL12 access */
 		access_rw(p, &vcpu_sys_reg(vcpu, r->reg));
 
@@ -1272,6 +1481,82 @@ static int set_raz_id_reg(struct kvm_vcpu *vcpu, const struct sys_reg_desc *rd,
 	return __set_id_reg(rd, uaddr, true);
 }
 
+/*
+ * The EL2 timer state lives in the timer contexts rather than in sys_regs[],
+ * so it needs its own user accessors to be saved and restored. The TVAL
+ * registers are derived from the CVAL ones, and aren't exposed.
+ */
+static int get_el2_timer_ctl(struct arch_timer_context *timer_ctx,
+			     const struct kvm_one_reg *reg, void __user *uaddr)
+{
+	u64 val = timer_ctx->cnt_ctl;
+
+	return reg_to_user(uaddr, &val, reg->id);
+}
+
+static int set_el2_timer_ctl(struct arch_timer_context *timer_ctx,
+			     const struct kvm_one_reg *reg, void __user *uaddr)
+{
+	u64 val;
+	int err;
+
+	err = reg_from_user(&val, uaddr, reg->id);
+	if (err)
+		return err;
+
+	/* ISTATUS bit is read-only, see access_el2_timer_ctl() */
+	timer_ctx->cnt_ctl = val & ~ARCH_TIMER_CTRL_IT_STAT;
+	return 0;
+}
+
+static int get_cnthp_ctl(struct kvm_vcpu *vcpu, const struct sys_reg_desc *rd,
+			 const struct kvm_one_reg *reg, void __user *uaddr)
+{
+	return get_el2_timer_ctl(vcpu_hptimer(vcpu), reg, uaddr);
+}
+
+static int set_cnthp_ctl(struct kvm_vcpu *vcpu, const struct sys_reg_desc *rd,
+			 const struct kvm_one_reg *reg, void __user *uaddr)
+{
+	return set_el2_timer_ctl(vcpu_hptimer(vcpu), reg, uaddr);
+}
+
+static int get_cnthp_cval(struct kvm_vcpu *vcpu, const struct sys_reg_desc *rd,
+			  const struct kvm_one_reg *reg, void __user *uaddr)
+{
+	return reg_to_user(uaddr, &vcpu_hptimer(vcpu)->cnt_cval, reg->id);
+}
+
+static int set_cnthp_cval(struct kvm_vcpu *vcpu, const struct sys_reg_desc *rd,
+			  const struct kvm_one_reg *reg, void __user *uaddr)
+{
+	return reg_from_user(&vcpu_hptimer(vcpu)->cnt_cval, uaddr, reg->id);
+}
+
+static int get_cnthv_ctl(struct kvm_vcpu *vcpu, const struct sys_reg_desc *rd,
+			 const struct kvm_one_reg *reg, void __user *uaddr)
+{
+	return get_el2_timer_ctl(vcpu_hvtimer(vcpu), reg, uaddr);
+}
+
+static int set_cnthv_ctl(struct kvm_vcpu *vcpu, const struct sys_reg_desc *rd,
+			 const struct kvm_one_reg *reg, void __user *uaddr)
+{
+	return set_el2_timer_ctl(vcpu_hvtimer(vcpu), reg, uaddr);
+}
+
+static int get_cnthv_cval(struct kvm_vcpu *vcpu, const struct sys_reg_desc *rd,
+			  const struct kvm_one_reg *reg, void __user *uaddr)
+{
+	return reg_to_user(uaddr, &vcpu_hvtimer(vcpu)->cnt_cval, reg->id);
+}
+
+static int set_cnthv_cval(struct kvm_vcpu *vcpu, const struct sys_reg_desc *rd,
+			  const struct kvm_one_reg *reg, void __user *uaddr)
+{
+	return reg_from_user(&vcpu_hvtimer(vcpu)->cnt_cval, uaddr, reg->id);
+}
+
 /* sys_reg_desc initialiser for cpufeature ID register name_EL1 */
 #define _ID(name) {			\
 	SYS_DESC(SYS_##name##_EL1),	\
@@ -1605,11 +1890,52 @@ static const struct sys_reg_desc sys_reg_descs[] = {
 	{ SYS_DESC(SYS_RVBAR_EL2), trap_el2_regs, reset_val, RVBAR_EL2, 0 },
 	{ SYS_DESC(SYS_RMR_EL2), trap_el2_regs, reset_val, RMR_EL2, 0 },
 
+	{ SYS_DESC(SYS_ICH_AP0R0_EL2), access_gic_ich_reg },
+	{ SYS_DESC(SYS_ICH_AP0R1_EL2), access_gic_ich_reg },
+	{ SYS_DESC(SYS_ICH_AP0R2_EL2), access_gic_ich_reg },
+	{ SYS_DESC(SYS_ICH_AP0R3_EL2), access_gic_ich_reg },
+	{ SYS_DESC(SYS_ICH_AP1R0_EL2), access_gic_ich_reg },
+	{ SYS_DESC(SYS_ICH_AP1R1_EL2), access_gic_ich_reg },
+	{ SYS_DESC(SYS_ICH_AP1R2_EL2), access_gic_ich_reg },
+	{ SYS_DESC(SYS_ICH_AP1R3_EL2), access_gic_ich_reg },
+	{ SYS_DESC(SYS_ICH_HCR_EL2), access_gic_ich_reg },
+	{ SYS_DESC(SYS_ICH_VTR_EL2), access_gic_ich_reg },
+	{ SYS_DESC(SYS_ICH_MISR_EL2), access_gic_ich_reg },
+	{ SYS_DESC(SYS_ICH_EISR_EL2), access_gic_ich_reg },
+	{ SYS_DESC(SYS_ICH_ELSR_EL2), access_gic_ich_reg },
+	{ SYS_DESC(SYS_ICH_VMCR_EL2), access_gic_ich_reg },
+	{ SYS_DESC(SYS_ICH_LR0_EL2), access_gic_ich_reg },
+	{ SYS_DESC(SYS_ICH_LR1_EL2), access_gic_ich_reg },
+	{ SYS_DESC(SYS_ICH_LR2_EL2), access_gic_ich_reg },
+	{ SYS_DESC(SYS_ICH_LR3_EL2), access_gic_ich_reg },
+	{ SYS_DESC(SYS_ICH_LR4_EL2), access_gic_ich_reg },
+	{ SYS_DESC(SYS_ICH_LR5_EL2), access_gic_ich_reg },
+	{ SYS_DESC(SYS_ICH_LR6_EL2), access_gic_ich_reg },
+	{ SYS_DESC(SYS_ICH_LR7_EL2), access_gic_ich_reg },
+	{ SYS_DESC(SYS_ICH_LR8_EL2), access_gic_ich_reg },
+	{ SYS_DESC(SYS_ICH_LR9_EL2), access_gic_ich_reg },
+	{ SYS_DESC(SYS_ICH_LR10_EL2), access_gic_ich_reg },
+	{ SYS_DESC(SYS_ICH_LR11_EL2), access_gic_ich_reg },
+	{ SYS_DESC(SYS_ICH_LR12_EL2), access_gic_ich_reg },
+	{ SYS_DESC(SYS_ICH_LR13_EL2), access_gic_ich_reg },
+	{ SYS_DESC(SYS_ICH_LR14_EL2), access_gic_ich_reg },
+	{ SYS_DESC(SYS_ICH_LR15_EL2), access_gic_ich_reg },
+
 	{ SYS_DESC(SYS_CONTEXTIDR_EL2), trap_el2_regs, reset_val, CONTEXTIDR_EL2, 0 },
 	{ SYS_DESC(SYS_TPIDR_EL2), trap_el2_regs, reset_val, TPIDR_EL2, 0 },
 
 	{ SYS_DESC(SYS_CNTVOFF_EL2), trap_el2_regs, reset_val, CNTVOFF_EL2, 0 },
 	{ SYS_DESC(SYS_CNTHCTL_EL2), trap_el2_regs, reset_val, CNTHCTL_EL2, 0 },
+	{ SYS_DESC(SYS_CNTHP_TVAL_EL2), access_cnthp_tval },
+	{ SYS_DESC(SYS_CNTHP_CTL_EL2), access_cnthp_ctl,
+	  .get_user = get_cnthp_ctl, .set_user = set_cnthp_ctl },
+	{ SYS_DESC(SYS_CNTHP_CVAL_EL2), access_cnthp_cval,
+	  .get_user = get_cnthp_cval, .set_user = set_cnthp_cval },
+	{ SYS_DESC(SYS_CNTHV_TVAL_EL2), access_cnthv_tval },
+	{ SYS_DESC(SYS_CNTHV_CTL_EL2), access_cnthv_ctl,
+	  .get_user = get_cnthv_ctl, .set_user = set_cnthv_ctl },
+	{ SYS_DESC(SYS_CNTHV_CVAL_EL2), access_cnthv_cval,
+	  .get_user = get_cnthv_cval, .set_user = set_cnthv_cval },
 
 	{ SYS_DESC(sctlr_EL12), access_vm_reg, reset_val, SCTLR_EL1, 0x00C50078 },
 	{ SYS_DESC(cpacr_EL12), access_cpacr, reset_val, CPACR_EL1, 0 },
@@ -1654,7 +1980,7 @@ static bool handle_s1e01(struct kvm_vcpu *vcpu, struct sys_reg_params *p,
 
 	el2_format = vcpu_el2_format_used(vcpu);
 
-	kvm_call_hyp(__kvm_at_insn, vcpu, p->regval, el2_format, sys_encoding);
+	kvm_nested_at_s1(vcpu, p->regval, el2_format, sys_encoding);
 
 	return true;
 }
@@ -1670,7 +1996,7 @@ static bool handle_s1e2(struct kvm_vcpu *vcpu, struct sys_reg_params *p,
 	ctxt->hw_sys_regs = ctxt->shadow_sys_regs;
 	el2_format = !vcpu_el2_e2h_is_set(vcpu);
 
-	kvm_call_hyp(__kvm_at_insn, vcpu, p->regval, el2_format, sys_encoding);
+	kvm_nested_at_s1(vcpu, p->regval, el2_format, sys_encoding);
 	return true;
 }
 
@@ -1771,6 +2097,8 @@ static bool handle_alle2(struct kvm_vcpu *vcpu, struct sys_reg_params *p,
 	struct kvm_s2_mmu *mmu = &vcpu->kvm->arch.mmu;
 	u64 vttbr = kvm_get_vttbr(&mmu->el2_vmid, mmu);
 
+	vcpu->stat.nested_tlbi++;
+
 	/*
 	 * To emulate invalidating all EL2 regime stage 1 TLB entries,
 	 * invalidate EL1&0 regime stage 1 TLB entries with the virtual EL2's
@@ -1786,6 +2114,8 @@ static bool handle_alle2is(struct kvm_vcpu *vcpu, struct sys_reg_params *p,
 	struct kvm_s2_mmu *mmu = &vcpu->kvm->arch.mmu;
 	u64 vttbr = kvm_get_vttbr(&mmu->el2_vmid, mmu);
 
+	vcpu->stat.nested_tlbi++;
+
 	/*
 	 * To emulate invalidating all EL2 regime stage 1 TLB entries for all
 	 * PEs, executing TLBI VMALLE1IS is enough. But reuse the existing
@@ -1803,6 +2133,8 @@ static bool handle_vae2(struct kvm_vcpu *vcpu, struct sys_reg_params *p,
 	u64 vttbr = kvm_get_vttbr(&mmu->el2_vmid, mmu);
 	int sys_encoding = sys_insn(p->Op0, p->Op1, p->CRn, p->CRm, p->Op2);
 
+	vcpu->stat.nested_tlbi++;
+
 	/*
 	 * Based on the same principle as TLBI ALLE2 instruction emulation, we
 	 * emulate TLBI VAE2* instructions by executing corresponding TLBI VAE1*
@@ -1819,6 +2151,8 @@ static bool handle_alle1is(struct kvm_vcpu *vcpu, struct sys_reg_params *p,
 	struct kvm_s2_mmu *mmu = &vcpu->kvm->arch.mmu;
 	u64 vttbr = kvm_get_vttbr(&mmu->vmid, mmu);
 
+	vcpu->stat.nested_tlbi++;
+
 	if (vcpu->kvm->arch.mmu.vmid.vmid_gen) {
 		/*
 		 * Invalidate the stage 1 and 2 TLB entries for the host OS
@@ -1827,13 +2161,16 @@ static bool handle_alle1is(struct kvm_vcpu *vcpu, struct sys_reg_params *p,
 		kvm_call_hyp(__kvm_tlb_flush_vmid, vttbr);
 	}
 
-	spin_lock(&vcpu->kvm->mmu_lock);
+	kvm_nested_s2_tlb_invalidate(vcpu->kvm);
+
+	kvm_mmu_write_lock(vcpu->kvm);
 	/*
 	 * Clear all mappings in the shadow page tables and invalidate the stage
-	 * 1 and 2 TLB entries via kvm_tlb_flush_vmid_ipa().
+	 * 1 and 2 TLB entries via kvm_tlb_flush_vmid_ipa(). This may be
+	 * deferred until the next entry to the nested VMs.
 	 */
-	kvm_nested_s2_clear(vcpu->kvm);
-	spin_unlock(&vcpu->kvm->mmu_lock);
+	kvm_nested_s2_clear_all(vcpu);
+	kvm_mmu_write_unlock(vcpu->kvm);
 
 	return true;
 }
@@ -1845,14 +2182,18 @@ static bool handle_vmalls12e1is(struct kvm_vcpu *vcpu, struct sys_reg_params *p,
 	struct kvm_s2_mmu *mmu;
 	bool ret;
 
-	spin_lock(&vcpu->kvm->mmu_lock);
+	vcpu->stat.nested_tlbi++;
+
+	kvm_nested_s2_tlb_invalidate(vcpu->kvm);
+
+	kvm_mmu_write_lock(vcpu->kvm);
 	/*
 	 * Clear mappings in the shadow page tables and invalidate the stage
 	 * 1 and 2 TLB entries via kvm_tlb_flush_vmid_ipa() for the current
 	 * VMID.
 	 */
 	ret = kvm_nested_s2_clear_curr_vmid(vcpu, 0, KVM_PHYS_SIZE);
-	spin_unlock(&vcpu->kvm->mmu_lock);
+	kvm_mmu_write_unlock(vcpu->kvm);
 
 	if (!ret) {
 		/*
@@ -1874,14 +2215,18 @@ static bool handle_ipas2e1is(struct kvm_vcpu *vcpu, struct sys_reg_params *p,
 	struct kvm_s2_mmu *mmu;
 	bool ret;
 
-	spin_lock(&vcpu->kvm->mmu_lock);
+	vcpu->stat.nested_tlbi++;
+
+	kvm_nested_s2_tlb_invalidate(vcpu->kvm);
+
+	kvm_mmu_write_lock(vcpu->kvm);
 	/*
 	 * Clear a mapping in the shadow page tables and invalidate the stage
 	 * 2 TLB entries via kvm_tlb_flush_vmid_ipa() for the current
 	 * VMID and the given ipa.
 	 */
 	ret = kvm_nested_s2_clear_curr_vmid(vcpu, p->regval, PAGE_SIZE);
-	spin_unlock(&vcpu->kvm->mmu_lock);
+	kvm_mmu_write_unlock(vcpu->kvm);
 
 	if (!ret) {
 		/*
@@ -1906,6 +2251,8 @@ static bool handle_tlbi_el1(struct kvm_vcpu *vcpu, struct sys_reg_params *p,
 	struct kvm_s2_mmu *mmu = &vcpu->kvm->arch.mmu;
 	int sys_encoding = sys_insn(p->Op0, p->Op1, p->CRn, p->CRm, p->Op2);
 
+	vcpu->stat.nested_tlbi++;
+
 	nested_mmu = lookup_nested_mmu(vcpu, virtual_vttbr);
 	if (!nested_mmu) {
 		/*
@@ -1992,6 +2339,9 @@ static bool handle_tlbi_el1(struct kvm_vcpu *vcpu, struct sys_reg_params *p,
  * set, it means that a guest hypervisor would like to use EL2 page table format
  * for the EL1 translation regime. We emulate this by setting the physical
  * NV and NV1 bits.
+ *
+ * All of this is only the fallback of kvm_nested_at_s1(), which first tries
+ * to walk the stage-1 page tables in software.
  */
 
 #define SYS_INSN_TO_DESC(insn, access_fn, forward_fn)	\
@@ -2058,11 +2408,90 @@ static int match_sys_reg(const void *key, const void *elt)
 	return pval - reg_to_match_value(r);
 }
 
+/*
+ * Direct-indexed lookup of the AArch64 trap tables, built at init. The 16bit
+ * match value is split into Op0/Op1/CRn, selecting a second level array
+ * allocated only for the encodings used in the table, and CRm/Op2, indexing
+ * it. Entries hold the descriptor index plus one, 0 meaning no descriptor.
+ */
+#define SYS_REG_INDEX_L2_BITS	7
+#define SYS_REG_INDEX_L2_SIZE	(1 << SYS_REG_INDEX_L2_BITS)
+#define SYS_REG_INDEX_L1_SIZE	(1 << (16 - SYS_REG_INDEX_L2_BITS))
+
+struct sys_reg_index {
+	const struct sys_reg_desc *table;
+	u16 *l2[SYS_REG_INDEX_L1_SIZE];
+};
+
+static struct sys_reg_index sys_reg_descs_index;
+static struct sys_reg_index sys_insn_descs_index;
+
+static void free_sys_reg_index(struct sys_reg_index *index)
+{
+	int i;
+
+	for (i = 0; i < SYS_REG_INDEX_L1_SIZE; i++) {
+		kfree(index->l2[i]);
+		index->l2[i] = NULL;
+	}
+}
+
+static void build_sys_reg_index(struct sys_reg_index *index,
+				const struct sys_reg_desc table[],
+				unsigned int num)
+{
+	unsigned int i;
+
+	for (i = 0; i < num; i++) {
+		unsigned long val = reg_to_match_value(&table[i]);
+		u16 **l2 = &index->l2[val >> SYS_REG_INDEX_L2_BITS];
+
+		if (!*l2) {
+			*l2 = kcalloc(SYS_REG_INDEX_L2_SIZE, sizeof(u16),
+				      GFP_KERNEL);
+			if (!*l2) {
+				/* Keep using the binary search */
+				free_sys_reg_index(index);
+				return;
+			}
+		}
+
+		(*l2)[val & (SYS_REG_INDEX_L2_SIZE - 1)] = i + 1;
+	}
+
+	index->table = table;
+}
+
+static const struct sys_reg_index *
+get_sys_reg_index(const struct sys_reg_desc table[])
+{
+	const struct sys_reg_index *index = NULL;
+
+	if (table == sys_reg_descs)
+		index = &sys_reg_descs_index;
+	else if (table == sys_insn_descs)
+		index = &sys_insn_descs_index;
+
+	return index && index->table ? index : NULL;
+}
+
 static const struct sys_reg_desc *find_reg(const struct sys_reg_params *params,
 					 const struct sys_reg_desc table[],
 					 unsigned int num)
 {
 	unsigned long pval = reg_to_match_value(params);
+	const struct sys_reg_index *index = get_sys_reg_index(table);
+
+	if (likely(index)) {
+		const u16 *l2 = index->l2[pval >> SYS_REG_INDEX_L2_BITS];
+		u16 i;
+
+		if (!l2)
+			return NULL;
+
+		i = l2[pval & (SYS_REG_INDEX_L2_SIZE - 1)];
+		return i ? &table[i - 1] : NULL;
+	}
 
 	return bsearch((void *)pval, table, num, sizeof(table[0]), match_sys_reg);
 }
@@ -2082,6 +2511,10 @@ static void __perform_access(struct kvm_vcpu *vcpu,
 	/* Skip instruction if instructed so */
 	if (likely(r->access(vcpu, params, r)) && skip_instr)
 		kvm_skip_instr(vcpu, kvm_vcpu_trap_il_is32bit(vcpu));
+
+	/* AArch32 accesses index the cp15 view, which has no shadow state */
+	if (params->is_write && !params->is_aarch32)
+		vcpu_shadow_reg_dirty(vcpu, r->reg);
 }
 
 static void perform_access(struct kvm_vcpu *vcpu,
@@ -3025,12 +3458,95 @@ int kvm_arm_sys_reg_set_reg(struct kvm_vcpu *vcpu, const struct kvm_one_reg *reg
 	if (!r)
 		return set_invariant_sys_reg(reg->id, uaddr);
 
+	vcpu_shadow_invalidate(vcpu);
+
 	if (r->set_user)
 		return (r->set_user)(vcpu, r, reg, uaddr);
 
 	return reg_from_user(&vcpu_sys_reg(vcpu, r->reg), uaddr, reg->id);
 }
 
+/* SPSR_EL2, ELR_EL2 and SP_EL2 are not stored in the sys_regs array */
+static bool is_el2_special_reg(const struct sys_reg_desc *r)
+{
+	return r->reset == reset_special;
+}
+
+static bool is_nested_state_reg(const struct sys_reg_desc *r)
+{
+	return is_el2_special_reg(r) ||
+	       (r->reg >= VPIDR_EL2 && r->reg <= CNTHCTL_EL2);
+}
+
+static u64 *nested_state_reg(struct kvm_vcpu *vcpu,
+			     const struct sys_reg_desc *r)
+{
+	if (is_el2_special_reg(r))
+		return &vcpu_el2_sreg(vcpu, r->reg);
+
+	return &vcpu_sys_reg(vcpu, r->reg);
+}
+
+static const struct sys_reg_desc *nested_state_reg_desc(u64 id)
+{
+	struct sys_reg_params params;
+	const struct sys_reg_desc *r;
+
+	if ((id & KVM_REG_ARM_COPROC_MASK) != KVM_REG_ARM64_SYSREG)
+		return NULL;
+
+	r = find_reg_by_id(id, &params, sys_reg_descs,
+			   ARRAY_SIZE(sys_reg_descs));
+	if (!r || !is_nested_state_reg(r))
+		return NULL;
+
+	return r;
+}
+
+/*
+ * Fill @regs with the EL2 registers of @vcpu for KVM_ARM_GET_NESTED_STATE and
+ * return how many there are.
+ */
+unsigned int kvm_arm_nested_get_regs(struct kvm_vcpu *vcpu,
+				     struct kvm_arm_nested_reg *regs)
+{
+	unsigned int i, n = 0;
+
+	for (i = 0; i < ARRAY_SIZE(sys_reg_descs); i++) {
+		const struct sys_reg_desc *r = &sys_reg_descs[i];
+
+		if (!is_nested_state_reg(r))
+			continue;
+		if (WARN_ON(n == KVM_ARM_NESTED_MAX_REGS))
+			break;
+
+		regs[n].id = sys_reg_to_index(r);
+		regs[n].val = *nested_state_reg(vcpu, r);
+		n++;
+	}
+
+	return n;
+}
+
+/* Set the @nr EL2 registers of @regs, either all of them or none */
+int kvm_arm_nested_set_regs(struct kvm_vcpu *vcpu,
+			    const struct kvm_arm_nested_reg *regs,
+			    unsigned int nr)
+{
+	unsigned int i;
+
+	for (i = 0; i < nr; i++)
+		if (!nested_state_reg_desc(regs[i].id))
+			return -ENOENT;
+
+	for (i = 0; i < nr; i++)
+		*nested_state_reg(vcpu, nested_state_reg_desc(regs[i].id)) =
+			regs[i].val;
+
+	vcpu_shadow_invalidate(vcpu);
+	return 0;
+}
+
 static unsigned int num_demux_regs(void)
 {
 	unsigned int i, count = 0;
@@ -3186,6 +3702,13 @@ void kvm_sys_reg_table_init(void)
 	BUG_ON(check_sysreg_table(invariant_sys_regs, ARRAY_SIZE(invariant_sys_regs)));
 	BUG_ON(check_sysreg_table(sys_insn_descs, ARRAY_SIZE(sys_insn_descs)));
 
+	BUILD_BUG_ON(ARRAY_SIZE(sys_reg_descs) >= U16_MAX);
+	BUILD_BUG_ON(ARRAY_SIZE(sys_insn_descs) >= U16_MAX);
+	build_sys_reg_index(&sys_reg_descs_index, sys_reg_descs,
+			    ARRAY_SIZE(sys_reg_descs));
+	build_sys_reg_index(&sys_insn_descs_index, sys_insn_descs,
+			    ARRAY_SIZE(sys_insn_descs));
+
 	/* We abuse the reset function to overwrite the table itself. */
 	for (i = 0; i < ARRAY_SIZE(invariant_sys_regs); i++)
 		invariant_sys_regs[i].reset(NULL, &invariant_sys_regs[i]);
@@ -3239,4 +3762,6 @@ void kvm_reset_sys_regs(struct kvm_vcpu *vcpu)
 	for (num = 1; num < NR_EL2_SPECIAL_REGS; num++)
 		if (vcpu_el2_sreg(vcpu, num) == 0x4242424242424242)
 			panic("Didn't reset vcpu_el2_sreg(%zi)", num);
+
+	vcpu_shadow_invalidate(vcpu);
 }
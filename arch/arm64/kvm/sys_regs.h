@@ -145,6 +145,9 @@ const struct sys_reg_desc *find_reg_by_id(u64 id,
 	CRn(sys_reg_CRn(reg)), CRm(sys_reg_CRm(reg)),	\
 	Op2(sys_reg_Op2(reg))
 
+bool access_gic_ich_reg(struct kvm_vcpu *vcpu, struct sys_reg_params *p,
+			const struct sys_reg_desc *r);
+
 #ifdef CONFIG_KVM_ARM_NESTED_PV
 int __emulate_sys_instr(struct kvm_vcpu *vcpu, struct sys_reg_params *p, bool skip_instr);
 #endif
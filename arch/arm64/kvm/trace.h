@@ -259,6 +259,99 @@ TRACE_EVENT(kvm_nested_eret,
 	TP_printk("vcpu: %p, eret to elr_el2: 0x%016lx, with spsr_el2: 0x%08lx",
 		  __entry->vcpu, __entry->elr_el2, __entry->spsr_el2)
 );
+
+TRACE_EVENT(kvm_nested_s2_walk,
+	TP_PROTO(struct kvm_vcpu *vcpu, u64 ipa, u64 output, int ret,
+		 bool cached, u64 ns),
+	TP_ARGS(vcpu, ipa, output, ret, cached, ns),
+
+	TP_STRUCT__entry(
+		__field(struct kvm_vcpu *,	vcpu)
+		__field(u64,			ipa)
+		__field(u64,			output)
+		__field(int,			ret)
+		__field(bool,			cached)
+		__field(u64,			ns)
+	),
+
+	TP_fast_assign(
+		__entry->vcpu = vcpu;
+		__entry->ipa = ipa;
+		__entry->output = output;
+		__entry->ret = ret;
+		__entry->cached = cached;
+		__entry->ns = ns;
+	),
+
+	TP_printk("vcpu: %p, L2 IPA: 0x%016llx -> L1 IPA: 0x%016llx, ret: %d%s, %llu ns",
+		  __entry->vcpu, __entry->ipa, __entry->output, __entry->ret,
+		  __entry->cached ? " (cached)" : "", __entry->ns)
+);
+
+TRACE_EVENT(kvm_nested_rmap_add,
+	TP_PROTO(u64 l2_ipa, u64 l1_ipa, int level, u64 ns),
+	TP_ARGS(l2_ipa, l1_ipa, level, ns),
+
+	TP_STRUCT__entry(
+		__field(u64,	l2_ipa)
+		__field(u64,	l1_ipa)
+		__field(int,	level)
+		__field(u64,	ns)
+	),
+
+	TP_fast_assign(
+		__entry->l2_ipa = l2_ipa;
+		__entry->l1_ipa = l1_ipa;
+		__entry->level = level;
+		__entry->ns = ns;
+	),
+
+	TP_printk("L2 IPA: 0x%016llx, L1 IPA: 0x%016llx, level: %d, %llu ns",
+		  __entry->l2_ipa, __entry->l1_ipa, __entry->level, __entry->ns)
+);
+
+TRACE_EVENT(kvm_nested_pv,
+	TP_PROTO(struct kvm_vcpu *vcpu, u16 imm, int ret, u64 ns),
+	TP_ARGS(vcpu, imm, ret, ns),
+
+	TP_STRUCT__entry(
+		__field(struct kvm_vcpu *,	vcpu)
+		__field(u16,			imm)
+		__field(int,			ret)
+		__field(u64,			ns)
+	),
+
+	TP_fast_assign(
+		__entry->vcpu = vcpu;
+		__entry->imm = imm;
+		__entry->ret = ret;
+		__entry->ns = ns;
+	),
+
+	TP_printk("vcpu: %p, PV imm: %#06x, ret: %d, %llu ns",
+		  __entry->vcpu, __entry->imm, __entry->ret, __entry->ns)
+);
+
+TRACE_EVENT(kvm_nested_shadow_state,
+	TP_PROTO(struct kvm_vcpu *vcpu, bool hyp_ctxt, u64 ns),
+	TP_ARGS(vcpu, hyp_ctxt, ns),
+
+	TP_STRUCT__entry(
+		__field(struct kvm_vcpu *,	vcpu)
+		__field(bool,			hyp_ctxt)
+		__field(u64,			ns)
+	),
+
+	TP_fast_assign(
+		__entry->vcpu = vcpu;
+		__entry->hyp_ctxt = hyp_ctxt;
+		__entry->ns = ns;
+	),
+
+	TP_printk("vcpu: %p, set up %s shadow state in %llu ns",
+		  __entry->vcpu, __entry->hyp_ctxt ? "vEL2" : "EL1",
+		  __entry->ns)
+);
 #endif /* _TRACE_ARM64_KVM_H */
 
 #undef TRACE_INCLUDE_PATH
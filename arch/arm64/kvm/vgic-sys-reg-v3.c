@@ -14,6 +14,7 @@
 #include <linux/irqchip/arm-gic-v3.h>
 #include <linux/kvm.h>
 #include <linux/kvm_host.h>
+#include <asm/kvm_coproc.h>
 #include <asm/kvm_emulate.h>
 #include "vgic.h"
 #include "sys_regs.h"
@@ -329,3 +330,82 @@ int vgic_v3_cpu_sysregs_uaccess(struct kvm_vcpu *vcpu, bool is_write, u64 id,
 
 	return 0;
 }
+
+/*
+ * ICH_*_EL2 accesses from the virtual EL2 of a guest with a GICv3. They
+ * operate on nested_vgic_v3, which becomes the shadow state loaded in the
+ * hardware when the guest hypervisor runs its nested VM.
+ */
+bool access_gic_ich_reg(struct kvm_vcpu *vcpu, struct sys_reg_params *p,
+			const struct sys_reg_desc *r)
+{
+	struct vgic_v3_cpu_if *cpu_if = &vcpu->arch.vgic_cpu.nested_vgic_v3;
+	u32 reg = sys_reg(p->Op0, p->Op1, p->CRn, p->CRm, p->Op2);
+	int idx;
+
+	if (forward_nv_traps(vcpu))
+		return kvm_inject_nested_sync(vcpu, kvm_vcpu_get_hsr(vcpu));
+
+	if (vcpu->kvm->arch.vgic.vgic_model != KVM_DEV_TYPE_ARM_VGIC_V3)
+		goto undef;
+
+	switch (reg) {
+	case SYS_ICH_HCR_EL2:
+		if (p->is_write)
+			cpu_if->vgic_hcr = p->regval;
+		else
+			p->regval = cpu_if->vgic_hcr;
+		break;
+	case SYS_ICH_VMCR_EL2:
+		if (p->is_write)
+			cpu_if->vgic_vmcr = p->regval;
+		else
+			p->regval = cpu_if->vgic_vmcr;
+		break;
+	case SYS_ICH_AP0R0_EL2 ... SYS_ICH_AP0R3_EL2:
+		if (p->is_write)
+			cpu_if->vgic_ap0r[p->Op2] = p->regval;
+		else
+			p->regval = cpu_if->vgic_ap0r[p->Op2];
+		break;
+	case SYS_ICH_AP1R0_EL2 ... SYS_ICH_AP1R3_EL2:
+		if (p->is_write)
+			cpu_if->vgic_ap1r[p->Op2] = p->regval;
+		else
+			p->regval = cpu_if->vgic_ap1r[p->Op2];
+		break;
+	case SYS_ICH_LR0_EL2 ... SYS_ICH_LR15_EL2:
+		idx = ((p->CRm & 1) << 3) | p->Op2;
+		if (idx >= kvm_vgic_global_state.nr_lr)
+			goto undef;
+		if (p->is_write)
+			cpu_if->vgic_lr[idx] = p->regval;
+		else
+			p->regval = cpu_if->vgic_lr[idx];
+		break;
+	case SYS_ICH_VTR_EL2:
+	case SYS_ICH_MISR_EL2:
+	case SYS_ICH_EISR_EL2:
+	case SYS_ICH_ELSR_EL2:
+		/* Read-only, the state is computed from the other registers */
+		if (p->is_write)
+			goto undef;
+		if (reg == SYS_ICH_VTR_EL2)
+			p->regval = vgic_v3_nested_read_vtr(vcpu);
+		else if (reg == SYS_ICH_MISR_EL2)
+			p->regval = vgic_v3_nested_read_misr(vcpu);
+		else if (reg == SYS_ICH_EISR_EL2)
+			p->regval = vgic_v3_nested_read_eisr(vcpu);
+		else
+			p->regval = vgic_v3_nested_read_elrsr(vcpu);
+		break;
+	default:
+		goto undef;
+	}
+
+	return true;
+
+undef:
+	kvm_inject_undefined(vcpu);
+	return false;
+}
@@ -0,0 +1,151 @@
+/*
+ * arch/arm64/lib/lz4-neon.c
+ *
+ * Copyright (C) 2017 - Linaro Ltd
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <asm/neon.h>
+
+#include <arm_neon.h>
+
+/*
+ * This decodes the bulk of an LZ4 block 16 bytes at a time. It only takes
+ * the sequences that leave LZ4_NEON_MARGIN bytes at the end of both
+ * buffers, so that the copies can overrun, and leaves the end of the block
+ * to the generic decoder in lib/lz4. That one also gets to report whatever
+ * is wrong with a sequence this loop doesn't take. The caller in
+ * lz4_decompress.c takes care of kernel_neon_begin()/end().
+ */
+#define LZ4_NEON_MARGIN		32
+
+/* Index i % offset, to repeat the first offset bytes of a vector */
+static const u8 lz4_neon_pattern[16][16] = {
+	[1]  = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+	[2]  = { 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1 },
+	[3]  = { 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0 },
+	[4]  = { 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3 },
+	[5]  = { 0, 1, 2, 3, 4, 0, 1, 2, 3, 4, 0, 1, 2, 3, 4, 0 },
+	[6]  = { 0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 5, 0, 1, 2, 3 },
+	[7]  = { 0, 1, 2, 3, 4, 5, 6, 0, 1, 2, 3, 4, 5, 6, 0, 1 },
+	[8]  = { 0, 1, 2, 3, 4, 5, 6, 7, 0, 1, 2, 3, 4, 5, 6, 7 },
+	[9]  = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 0, 1, 2, 3, 4, 5, 6 },
+	[10] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 0, 1, 2, 3, 4, 5 },
+	[11] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 0, 1, 2, 3, 4 },
+	[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 0, 1, 2, 3 },
+	[13] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 0, 1, 2 },
+	[14] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 0, 1 },
+	[15] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 0 },
+};
+
+static inline void lz4_neon_copy(u8 *dst, const u8 *src, u8 *end)
+{
+	do {
+		vst1q_u8(dst, vld1q_u8(src));
+		dst += 16;
+		src += 16;
+	} while (dst < end);
+}
+
+/*
+ * A match closer than 16 bytes repeats a pattern of offset bytes, which a
+ * single vector holds. Storing it every multiple of offset that fits in 16
+ * bytes writes the match, and never reads what it hasn't written yet.
+ */
+static inline void lz4_neon_repeat(u8 *dst, const u8 *src, size_t offset,
+				   u8 *end)
+{
+	uint8x16_t v = vqtbl1q_u8(vld1q_u8(src),
+				  vld1q_u8(lz4_neon_pattern[offset]));
+	size_t step = 16 - 16 % offset;
+
+	do {
+		vst1q_u8(dst, v);
+		dst += step;
+	} while (dst < end);
+}
+
+/*
+ * Decode sequences from *src into *dst until the output reaches @ostop or
+ * a sequence comes too close to @iend or @oend. @low is the start of the
+ * output, before which no match can point. Returns -1 for such a match,
+ * 0 otherwise, with *src and *dst at the next sequence to decode.
+ */
+int LZ4_decompress_neon_inner(const u8 **src, u8 **dst, const u8 *iend,
+			      u8 *oend, const u8 *low, u8 *ostop)
+{
+	const u8 *ip = *src;
+	u8 *op = *dst;
+	int ret = 0;
+
+	while (op < ostop && iend - ip >= LZ4_NEON_MARGIN &&
+	       oend - op >= LZ4_NEON_MARGIN) {
+		unsigned int token = *ip;
+		size_t length = token >> 4;
+		size_t mlength = token & 15;
+		const u8 *lit = ip + 1, *next;
+		size_t offset;
+		unsigned int s;
+
+		if (length == 15) {
+			do {
+				if (iend - lit < LZ4_NEON_MARGIN)
+					goto out;
+				s = *lit++;
+				length += s;
+			} while (s == 255);
+		}
+
+		/* the literals, the offset and room to overrun */
+		if ((size_t)(iend - lit) < length + LZ4_NEON_MARGIN)
+			break;
+
+		next = lit + length;
+		offset = next[0] | next[1] << 8;
+		next += 2;
+
+		if (mlength == 15) {
+			do {
+				if (iend - next < LZ4_NEON_MARGIN)
+					goto out;
+				s = *next++;
+				mlength += s;
+			} while (s == 255);
+		}
+		mlength += 4;
+
+		if ((size_t)(oend - op) < length + mlength + LZ4_NEON_MARGIN ||
+		    !offset)
+			break;
+
+		if (offset > (size_t)(op + length - low)) {
+			ret = -1;
+			break;
+		}
+
+		lz4_neon_copy(op, lit, op + length);
+		op += length;
+
+		if (offset >= 16)
+			lz4_neon_copy(op, op - offset, op + mlength);
+		else
+			lz4_neon_repeat(op, op - offset, offset, op + mlength);
+		op += mlength;
+
+		ip = next;
+	}
+out:
+	*src = ip;
+	*dst = op;
+	return ret;
+}
+EXPORT_SYMBOL(LZ4_decompress_neon_inner);
+
+MODULE_AUTHOR("Linaro Ltd");
+MODULE_DESCRIPTION("ARMv8 NEON LZ4 decompression");
+MODULE_LICENSE("GPL");
@@ -19,6 +19,7 @@
 
 #include <linux/bitops.h>
 #include <linux/sched.h>
+#include <linux/seqlock.h>
 #include <linux/slab.h>
 #include <linux/mm.h>
 
@@ -37,6 +38,25 @@ static DEFINE_PER_CPU(atomic64_t, active_asids);
 static DEFINE_PER_CPU(u64, reserved_asids);
 static cpumask_t tlb_flush_pending;
 
+/*
+ * Each CPU grabs a few ASIDs at a time from asid_map, so that new mms can
+ * be given one without taking cpu_asid_lock. A batch is only valid for the
+ * generation it was allocated in.
+ */
+#define ASID_BATCH_MAX		16
+
+struct asid_batch {
+	u64		generation;
+	unsigned int	nr;
+	u16		asids[ASID_BATCH_MAX];
+};
+
+static DEFINE_PER_CPU(struct asid_batch, asid_batches);
+static unsigned int asid_batch_size;
+
+/* Odd while a rollover resets asid_map */
+static seqcount_t asid_rollover_seq = SEQCNT_ZERO(asid_rollover_seq);
+
 #define ASID_MASK		(~GENMASK(asid_bits - 1, 0))
 #define ASID_FIRST_VERSION	(1UL << asid_bits)
 #define NUM_USER_ASIDS		ASID_FIRST_VERSION
@@ -145,10 +165,25 @@ static bool check_update_reserved_asid(u64 asid, u64 newasid)
 	return hit;
 }
 
-static u64 new_context(struct mm_struct *mm, unsigned int cpu)
+/*
+ * asid_map is also updated without cpu_asid_lock by try_new_context(), so
+ * a free bit is only ours once we have atomically set it.
+ */
+static u64 find_free_asid(u64 from)
+{
+	u64 asid;
+
+	do {
+		asid = find_next_zero_bit(asid_map, NUM_USER_ASIDS, from);
+	} while (asid != NUM_USER_ASIDS && test_and_set_bit(asid, asid_map));
+
+	return asid;
+}
+
+static u64 new_context(u64 asid, unsigned int cpu)
 {
 	static u32 cur_idx = 1;
-	u64 asid = atomic64_read(&mm->context.id);
+	struct asid_batch *batch = &per_cpu(asid_batches, cpu);
 	u64 generation = atomic64_read(&asid_generation);
 
 	if (asid != 0) {
@@ -166,34 +201,126 @@ static u64 new_context(struct mm_struct *mm, unsigned int cpu)
 		 * it if possible.
 		 */
 		asid &= ~ASID_MASK;
-		if (!__test_and_set_bit(asid, asid_map))
+		if (!test_and_set_bit(asid, asid_map))
 			return newasid;
 	}
 
+	/* Use what is left of this CPU's batch first */
+	if (batch->nr && batch->generation == generation)
+		return generation | batch->asids[--batch->nr];
+
 	/*
 	 * Allocate a free ASID. If we can't find one, take a note of the
 	 * currently active ASIDs and mark the TLBs as requiring flushes.
 	 * We always count from ASID #1, as we use ASID #0 when setting a
 	 * reserved TTBR0 for the init_mm.
 	 */
-	asid = find_next_zero_bit(asid_map, NUM_USER_ASIDS, cur_idx);
-	if (asid != NUM_USER_ASIDS)
-		goto set_asid;
+	asid = find_free_asid(cur_idx);
+	if (asid == NUM_USER_ASIDS) {
+		/* We're out of ASIDs, so increment the global generation count */
+		raw_write_seqcount_begin(&asid_rollover_seq);
+		generation = atomic64_add_return_relaxed(ASID_FIRST_VERSION,
+							 &asid_generation);
+		flush_context(cpu);
+		raw_write_seqcount_end(&asid_rollover_seq);
+
+		/* We have more ASIDs than CPUs, so this will always succeed */
+		asid = find_free_asid(1);
+	}
+	cur_idx = asid;
 
-	/* We're out of ASIDs, so increment the global generation count */
-	generation = atomic64_add_return_relaxed(ASID_FIRST_VERSION,
-						 &asid_generation);
-	flush_context(cpu);
+	/* Stock up for the next mms this CPU switches to */
+	batch->generation = generation;
+	batch->nr = 0;
+	while (batch->nr < asid_batch_size) {
+		u64 idx = find_free_asid(cur_idx);
 
-	/* We have more ASIDs than CPUs, so this will always succeed */
-	asid = find_next_zero_bit(asid_map, NUM_USER_ASIDS, 1);
+		if (idx == NUM_USER_ASIDS)
+			break;
+		batch->asids[batch->nr++] = idx;
+		cur_idx = idx;
+	}
 
-set_asid:
-	__set_bit(asid, asid_map);
-	cur_idx = asid;
 	return asid | generation;
 }
 
+/*
+ * Give @mm a new ASID without taking cpu_asid_lock, either by re-using
+ * its previous one or out of this CPU's batch. Returns 0 whenever that
+ * isn't possible, and the caller must take the slow path.
+ *
+ * This is only safe when no rollover can be missed: the bitmap and the
+ * generation must be read within the same asid_rollover_seq section, and
+ * active_asids must still hold what this CPU last installed. The new ASID
+ * is published in active_asids before the mm, so that a rollover racing
+ * with us either zeroes active_asids first, making the cmpxchg fail, or
+ * sees the new ASID there and reserves it.
+ */
+static u64 try_new_context(struct mm_struct *mm, unsigned int cpu)
+{
+	struct asid_batch *batch = &per_cpu(asid_batches, cpu);
+	u64 active, asid, generation, idx;
+	unsigned long flags;
+	unsigned int seq;
+
+	/* Zero after a rollover, until this CPU takes the slow path */
+	active = atomic64_read(&per_cpu(active_asids, cpu));
+	if (!active)
+		return 0;
+
+	seq = raw_read_seqcount(&asid_rollover_seq);
+	if (seq & 1)
+		return 0;
+
+	generation = atomic64_read(&asid_generation);
+	asid = atomic64_read(&mm->context.id);
+
+	if (asid != 0) {
+		/*
+		 * A previous ASID which is still in use, or reserved by a
+		 * CPU that hasn't switched since the rollover, has its bit
+		 * set, and is dealt with by the slow path.
+		 */
+		idx = asid & ~ASID_MASK;
+		if (test_and_set_bit(idx, asid_map))
+			return 0;
+	} else {
+		if (!batch->nr || batch->generation != generation)
+			return 0;
+		idx = batch->asids[--batch->nr];
+	}
+
+	if (read_seqcount_retry(&asid_rollover_seq, seq))
+		goto out_release;
+
+	if (atomic64_cmpxchg_relaxed(&per_cpu(active_asids, cpu), active,
+				     generation | idx) != active)
+		goto out_release;
+
+	/* Another CPU may be switching to the same mm */
+	if (atomic64_cmpxchg_relaxed(&mm->context.id, asid,
+				     generation | idx) != asid) {
+		atomic64_cmpxchg_relaxed(&per_cpu(active_asids, cpu),
+					 generation | idx, active);
+		goto out_release;
+	}
+
+	return generation | idx;
+
+out_release:
+	/*
+	 * Give the ASID back to asid_map, unless a rollover happened since
+	 * the generation was read: the bit may then have been cleared and
+	 * set again for an ASID reserved by flush_context(). cpu_asid_lock
+	 * keeps a rollover from starting while we check.
+	 */
+	raw_spin_lock_irqsave(&cpu_asid_lock, flags);
+	if (atomic64_read(&asid_generation) == generation)
+		clear_bit(idx, asid_map);
+	raw_spin_unlock_irqrestore(&cpu_asid_lock, flags);
+	return 0;
+}
+
 void check_and_switch_context(struct mm_struct *mm, unsigned int cpu)
 {
 	unsigned long flags;
@@ -208,16 +335,27 @@ void check_and_switch_context(struct mm_struct *mm, unsigned int cpu)
 	 * parallel rollover (i.e. this pairs with the smp_wmb() in
 	 * flush_context).
 	 */
-	if (!((asid ^ atomic64_read(&asid_generation)) >> asid_bits)
-	    && atomic64_xchg_relaxed(&per_cpu(active_asids, cpu), asid))
+	if (!((asid ^ atomic64_read(&asid_generation)) >> asid_bits)) {
+		if (atomic64_xchg_relaxed(&per_cpu(active_asids, cpu), asid))
+			goto switch_mm_fastpath;
+	} else if (try_new_context(mm, cpu)) {
 		goto switch_mm_fastpath;
+	}
 
 	raw_spin_lock_irqsave(&cpu_asid_lock, flags);
 	/* Check that our ASID belongs to the current generation. */
 	asid = atomic64_read(&mm->context.id);
-	if ((asid ^ atomic64_read(&asid_generation)) >> asid_bits) {
-		asid = new_context(mm, cpu);
-		atomic64_set(&mm->context.id, asid);
+	while ((asid ^ atomic64_read(&asid_generation)) >> asid_bits) {
+		u64 newasid = new_context(asid, cpu);
+		u64 old = atomic64_cmpxchg_relaxed(&mm->context.id, asid,
+						   newasid);
+
+		/*
+		 * try_new_context() may have updated the mm in the meantime,
+		 * in which case we use its ASID, and go around again if a
+		 * rollover has made it stale.
+		 */
+		asid = (old == asid) ? newasid : old;
 	}
 
 	if (cpumask_test_and_clear_cpu(cpu, &tlb_flush_pending))
@@ -243,6 +381,9 @@ static int asids_init(void)
 	 * one more ASID than CPUs. ASID #0 is reserved for init_mm.
 	 */
 	WARN_ON(NUM_USER_ASIDS - 1 <= num_possible_cpus());
+	/* Don't let the batches hold more than a quarter of the ASID space */
+	asid_batch_size = min_t(unsigned long, ASID_BATCH_MAX,
+				NUM_USER_ASIDS / (4 * num_possible_cpus()));
 	atomic64_set(&asid_generation, ASID_FIRST_VERSION);
 	asid_map = kzalloc(BITS_TO_LONGS(NUM_USER_ASIDS) * sizeof(*asid_map),
 			   GFP_KERNEL);
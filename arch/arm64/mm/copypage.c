@@ -35,3 +35,25 @@ void __cpu_clear_user_page(void *kaddr, unsigned long vaddr)
 	clear_page(kaddr);
 }
 EXPORT_SYMBOL_GPL(__cpu_clear_user_page);
+
+void __cpu_copy_user_pages(void *kto, const void *kfrom, unsigned long vaddr,
+			   unsigned int nr)
+{
+	struct page *page = virt_to_page(kto);
+	unsigned int i;
+
+	__copy_pages(kto, kfrom, nr * PAGE_SIZE);
+	for (i = 0; i < nr; i++)
+		flush_dcache_page(page + i);
+}
+EXPORT_SYMBOL_GPL(__cpu_copy_user_pages);
+
+/*
+ * Only used for huge pages: clearing them through the cache would evict
+ * most of it for data that may not be accessed for a while.
+ */
+void __cpu_clear_user_pages(void *kaddr, unsigned long vaddr, unsigned int nr)
+{
+	__clear_pages_nocache(kaddr, nr * PAGE_SIZE);
+}
+EXPORT_SYMBOL_GPL(__cpu_clear_user_pages);
@@ -0,0 +1,38 @@
+/*
+ * Copyright (C) 2017 - Linaro Ltd
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/debugfs.h>
+#include <linux/export.h>
+#include <linux/init.h>
+
+#include <asm/tlbflush.h>
+
+/*
+ * Number of TLBIs above which a range flush gives up and invalidates the
+ * whole ASID (or the whole TLB, for kernel ranges) instead.
+ */
+unsigned long tlb_flush_ceiling __read_mostly = 1024;
+EXPORT_SYMBOL(tlb_flush_ceiling);
+
+#ifdef CONFIG_DEBUG_FS
+static int __init tlb_flush_debugfs_init(void)
+{
+	debugfs_create_ulong("tlb_single_page_flush_ceiling", 0600, NULL,
+			     &tlb_flush_ceiling);
+	return 0;
+}
+late_initcall(tlb_flush_debugfs_init);
+#endif
@@ -27,6 +27,7 @@
 #include <asm/byteorder.h>
 #include <asm/cacheflush.h>
 #include <asm/debug-monitors.h>
+#include <asm/module.h>
 #include <asm/set_memory.h>
 
 #include "bpf_jit.h"
@@ -68,6 +69,8 @@ struct jit_ctx {
 	int idx;
 	int epilogue_offset;
 	int *offset;
+	unsigned long *jmp_target;
+	bool far_calls;
 	u32 *image;
 };
 
@@ -79,23 +82,6 @@ static inline void emit(const u32 insn, struct jit_ctx *ctx)
 	ctx->idx++;
 }
 
-static inline void emit_a64_mov_i64(const int reg, const u64 val,
-				    struct jit_ctx *ctx)
-{
-	u64 tmp = val;
-	int shift = 0;
-
-	emit(A64_MOVZ(1, reg, tmp & 0xffff, shift), ctx);
-	tmp >>= 16;
-	shift += 16;
-	while (tmp) {
-		if (tmp & 0xffff)
-			emit(A64_MOVK(1, reg, tmp & 0xffff, shift), ctx);
-		tmp >>= 16;
-		shift += 16;
-	}
-}
-
 static inline void emit_a64_mov_i(const int is64, const int reg,
 				  const s32 val, struct jit_ctx *ctx)
 {
@@ -109,6 +95,8 @@ static inline void emit_a64_mov_i(const int is64, const int reg,
 			emit(A64_MOVN(is64, reg, (u16)~hi, 16), ctx);
 			emit(A64_MOVK(is64, reg, lo, 0), ctx);
 		}
+	} else if (hi && !lo) {
+		emit(A64_MOVZ(is64, reg, hi, 16), ctx);
 	} else {
 		emit(A64_MOVZ(is64, reg, lo, 0), ctx);
 		if (hi)
@@ -116,6 +104,99 @@ static inline void emit_a64_mov_i(const int is64, const int reg,
 	}
 }
 
+/* Number of 16-bit chunks of val that are not all zeros (or all ones) */
+static int i64_i16_blocks(const u64 val, bool inverse)
+{
+	const u16 skip = inverse ? 0xffff : 0x0000;
+
+	return (((val >>  0) & 0xffff) != skip) +
+	       (((val >> 16) & 0xffff) != skip) +
+	       (((val >> 32) & 0xffff) != skip) +
+	       (((val >> 48) & 0xffff) != skip);
+}
+
+/*
+ * Start from MOVN rather than MOVZ when more chunks are all ones than all
+ * zeros, and only MOVK the chunks that differ from the starting value.
+ */
+static inline void emit_a64_mov_i64(const int reg, const u64 val,
+				    struct jit_ctx *ctx)
+{
+	u64 nrm_tmp = val, rev_tmp = ~val;
+	bool inverse;
+	int shift;
+
+	if (!(nrm_tmp >> 32))
+		return emit_a64_mov_i(0, reg, (u32)val, ctx);
+
+	inverse = i64_i16_blocks(nrm_tmp, true) < i64_i16_blocks(nrm_tmp, false);
+	shift = max(round_down((inverse ? (fls64(rev_tmp) - 1) :
+					  (fls64(nrm_tmp) - 1)), 16), 0);
+	if (inverse)
+		emit(A64_MOVN(1, reg, (rev_tmp >> shift) & 0xffff, shift), ctx);
+	else
+		emit(A64_MOVZ(1, reg, (nrm_tmp >> shift) & 0xffff, shift), ctx);
+	shift -= 16;
+	while (shift >= 0) {
+		if (((nrm_tmp >> shift) & 0xffff) != (inverse ? 0xffff : 0x0000))
+			emit(A64_MOVK(1, reg, (nrm_tmp >> shift) & 0xffff,
+				      shift), ctx);
+		shift -= 16;
+	}
+}
+
+/*
+ * Helpers live in the kernel image. Unless the module region is
+ * randomized over the whole vmalloc space, every address in it is within
+ * BL range of the image, so calls from JITed code needn't go through a
+ * register.
+ */
+static bool is_bl_reachable(u64 target)
+{
+	const u64 lo = module_alloc_base;
+	const u64 hi = module_alloc_base + MODULES_VSIZE - sizeof(u32);
+
+	return (s64)(target - lo) >= -SZ_128M && (s64)(target - lo) < SZ_128M &&
+	       (s64)(target - hi) >= -SZ_128M && (s64)(target - hi) < SZ_128M;
+}
+
+static void emit_call(u64 target, struct jit_ctx *ctx)
+{
+	const u8 tmp = bpf2a64[TMP_REG_1];
+	s64 offset;
+
+	if (ctx->far_calls || !is_bl_reachable(target)) {
+		emit_a64_mov_i64(tmp, target, ctx);
+		emit(A64_BLR(tmp), ctx);
+		return;
+	}
+
+	/* offsets only matter once there is an image to write to */
+	offset = ctx->image ? target - (u64)&ctx->image[ctx->idx] : 0;
+	emit(A64_BL(offset >> 2), ctx);
+}
+
+/* Fits the unsigned immediate offset form of an access of 1 << scale bytes */
+static bool is_lsi_offset(s32 offset, int scale)
+{
+	if (offset < 0)
+		return false;
+
+	if (offset > (0xfff << scale))
+		return false;
+
+	if (offset & ((1 << scale) - 1))
+		return false;
+
+	return true;
+}
+
+/* Fits ADD/SUB (immediate), possibly after negating and swapping the op */
+static bool is_addsub_imm(s64 imm)
+{
+	return !(imm & ~0xfff);
+}
+
 static inline int bpf2a64_offset(int bpf_to, int bpf_from,
 				 const struct jit_ctx *ctx)
 {
@@ -233,17 +314,19 @@ static int emit_bpf_tail_call(struct jit_ctx *ctx)
 	 *     goto out;
 	 */
 	off = offsetof(struct bpf_array, map.max_entries);
-	emit_a64_mov_i64(tmp, off, ctx);
-	emit(A64_LDR32(tmp, r2, tmp), ctx);
+	BUILD_BUG_ON(off & 3 || off > 0xfff << 2);
+	emit(A64_LDR32I(tmp, r2, off), ctx);
+	/* index is a u32, its upper half must not reach ptrs[] below */
+	emit(A64_MOV(0, r3, r3), ctx);
 	emit(A64_CMP(0, r3, tmp), ctx);
-	emit(A64_B_(A64_COND_GE, jmp_offset), ctx);
+	emit(A64_B_(A64_COND_CS, jmp_offset), ctx);
 
 	/* if (tail_call_cnt > MAX_TAIL_CALL_CNT)
 	 *     goto out;
 	 * tail_call_cnt++;
 	 */
-	emit_a64_mov_i64(tmp, MAX_TAIL_CALL_CNT, ctx);
-	emit(A64_CMP(1, tcc, tmp), ctx);
+	BUILD_BUG_ON(MAX_TAIL_CALL_CNT > 0xfff);
+	emit(A64_CMP_I(1, tcc, MAX_TAIL_CALL_CNT), ctx);
 	emit(A64_B_(A64_COND_GT, jmp_offset), ctx);
 	emit(A64_ADD_I(1, tcc, tcc, 1), ctx);
 
@@ -252,15 +335,16 @@ static int emit_bpf_tail_call(struct jit_ctx *ctx)
 	 *     goto out;
 	 */
 	off = offsetof(struct bpf_array, ptrs);
-	emit_a64_mov_i64(tmp, off, ctx);
-	emit(A64_LDR64(tmp, r2, tmp), ctx);
-	emit(A64_LDR64(prg, tmp, r3), ctx);
+	BUILD_BUG_ON(off > 0xfff);
+	emit(A64_ADD_I(1, tmp, r2, off), ctx);
+	emit(A64_LSL(1, prg, r3, 3), ctx);
+	emit(A64_LDR64(prg, tmp, prg), ctx);
 	emit(A64_CBZ(1, prg, jmp_offset), ctx);
 
 	/* goto *(prog->bpf_func + prologue_size); */
 	off = offsetof(struct bpf_prog, bpf_func);
-	emit_a64_mov_i64(tmp, off, ctx);
-	emit(A64_LDR64(tmp, prg, tmp), ctx);
+	BUILD_BUG_ON(off & 7 || off > 0xfff << 3);
+	emit(A64_LDR64I(tmp, prg, off), ctx);
 	emit(A64_ADD_I(1, tmp, tmp, sizeof(u32) * PROLOGUE_OFFSET), ctx);
 	emit(A64_BR(tmp), ctx);
 
@@ -305,10 +389,67 @@ static void build_epilogue(struct jit_ctx *ctx)
 	emit(A64_RET(A64_LR), ctx);
 }
 
+/*
+ * Two 64-bit loads or stores of adjacent slots off the same base, as
+ * spilling, zeroing and reloading stack variables produces, are done with
+ * one LDP or STP. The second instruction then has no code of its own, so
+ * it must not be a jump target.
+ */
+static bool emit_ldst_pair(const struct bpf_insn *insn, struct jit_ctx *ctx)
+{
+	const struct bpf_insn *next = insn + 1;
+	const int i = insn - ctx->prog->insnsi;
+	const u8 code = insn->code;
+	const struct bpf_insn *lo, *hi;
+	s16 off;
+	u8 rn;
+
+	if (i + 1 >= ctx->prog->len || next->code != code ||
+	    test_bit(i + 1, ctx->jmp_target))
+		return false;
+
+	off = min(insn->off, next->off);
+	lo = insn->off == off ? insn : next;
+	hi = insn->off == off ? next : insn;
+	if (abs(insn->off - next->off) != 8 || (off & 7) ||
+	    off < -512 || off > 504)
+		return false;
+
+	switch (code) {
+	case BPF_LDX | BPF_MEM | BPF_DW:
+		/* the first load must leave the base of the second alone */
+		if (insn->src_reg != next->src_reg ||
+		    insn->dst_reg == insn->src_reg ||
+		    insn->dst_reg == next->dst_reg)
+			return false;
+		rn = bpf2a64[insn->src_reg];
+		emit(A64_LDP(bpf2a64[lo->dst_reg], bpf2a64[hi->dst_reg], rn,
+			     off), ctx);
+		return true;
+	case BPF_STX | BPF_MEM | BPF_DW:
+		if (insn->dst_reg != next->dst_reg)
+			return false;
+		rn = bpf2a64[insn->dst_reg];
+		emit(A64_STP(bpf2a64[lo->src_reg], bpf2a64[hi->src_reg], rn,
+			     off), ctx);
+		return true;
+	case BPF_ST | BPF_MEM | BPF_DW:
+		/* only zeroing, which needs no register for the value */
+		if (insn->dst_reg != next->dst_reg || insn->imm || next->imm)
+			return false;
+		rn = bpf2a64[insn->dst_reg];
+		emit(A64_STP(A64_ZR, A64_ZR, rn, off), ctx);
+		return true;
+	}
+
+	return false;
+}
+
 /* JITs an eBPF instruction.
  * Returns:
  * 0  - successfully JITed an 8-byte eBPF instruction.
- * >0 - successfully JITed a 16-byte eBPF instruction.
+ * >0 - successfully JITed a 16-byte eBPF instruction, or a pair of
+ *      instructions fused into one.
  * <0 - failed to JIT.
  */
 static int build_insn(const struct bpf_insn *insn, struct jit_ctx *ctx)
@@ -318,13 +459,14 @@ static int build_insn(const struct bpf_insn *insn, struct jit_ctx *ctx)
 	const u8 src = bpf2a64[insn->src_reg];
 	const u8 tmp = bpf2a64[TMP_REG_1];
 	const u8 tmp2 = bpf2a64[TMP_REG_2];
+	const u8 fp = bpf2a64[BPF_REG_FP];
 	const s16 off = insn->off;
 	const s32 imm = insn->imm;
 	const int i = insn - ctx->prog->insnsi;
 	const bool is64 = BPF_CLASS(code) == BPF_ALU64;
 	const bool isdw = BPF_SIZE(code) == BPF_DW;
-	u8 jmp_cond;
-	s32 jmp_offset;
+	u8 jmp_cond, dst_adj, src_adj;
+	s32 jmp_offset, off_adj;
 
 #define check_imm(bits, imm) do {				\
 	if ((((imm) > 0) && ((imm) >> (bits))) ||		\
@@ -461,13 +603,25 @@ static int build_insn(const struct bpf_insn *insn, struct jit_ctx *ctx)
 	/* dst = dst OP imm */
 	case BPF_ALU | BPF_ADD | BPF_K:
 	case BPF_ALU64 | BPF_ADD | BPF_K:
-		emit_a64_mov_i(is64, tmp, imm, ctx);
-		emit(A64_ADD(is64, dst, dst, tmp), ctx);
+		if (is_addsub_imm(imm)) {
+			emit(A64_ADD_I(is64, dst, dst, imm), ctx);
+		} else if (is_addsub_imm(-(s64)imm)) {
+			emit(A64_SUB_I(is64, dst, dst, -imm), ctx);
+		} else {
+			emit_a64_mov_i(is64, tmp, imm, ctx);
+			emit(A64_ADD(is64, dst, dst, tmp), ctx);
+		}
 		break;
 	case BPF_ALU | BPF_SUB | BPF_K:
 	case BPF_ALU64 | BPF_SUB | BPF_K:
-		emit_a64_mov_i(is64, tmp, imm, ctx);
-		emit(A64_SUB(is64, dst, dst, tmp), ctx);
+		if (is_addsub_imm(imm)) {
+			emit(A64_SUB_I(is64, dst, dst, imm), ctx);
+		} else if (is_addsub_imm(-(s64)imm)) {
+			emit(A64_ADD_I(is64, dst, dst, -imm), ctx);
+		} else {
+			emit_a64_mov_i(is64, tmp, imm, ctx);
+			emit(A64_SUB(is64, dst, dst, tmp), ctx);
+		}
 		break;
 	case BPF_ALU | BPF_AND | BPF_K:
 	case BPF_ALU64 | BPF_AND | BPF_K:
@@ -561,13 +715,30 @@ static int build_insn(const struct bpf_insn *insn, struct jit_ctx *ctx)
 		goto emit_cond_jmp;
 	/* IF (dst COND imm) JUMP off */
 	case BPF_JMP | BPF_JEQ | BPF_K:
+	case BPF_JMP | BPF_JNE | BPF_K:
+		if (imm == 0) {
+			/* compare against zero and branch in one */
+			jmp_offset = bpf2a64_offset(i + off, i, ctx);
+			check_imm19(jmp_offset);
+			if (BPF_OP(code) == BPF_JEQ)
+				emit(A64_CBZ(1, dst, jmp_offset), ctx);
+			else
+				emit(A64_CBNZ(1, dst, jmp_offset), ctx);
+			break;
+		}
+		/* fall through */
 	case BPF_JMP | BPF_JGT | BPF_K:
 	case BPF_JMP | BPF_JGE | BPF_K:
-	case BPF_JMP | BPF_JNE | BPF_K:
 	case BPF_JMP | BPF_JSGT | BPF_K:
 	case BPF_JMP | BPF_JSGE | BPF_K:
-		emit_a64_mov_i(1, tmp, imm, ctx);
-		emit(A64_CMP(1, dst, tmp), ctx);
+		if (is_addsub_imm(imm)) {
+			emit(A64_CMP_I(1, dst, imm), ctx);
+		} else if (is_addsub_imm(-(s64)imm)) {
+			emit(A64_CMN_I(1, dst, -imm), ctx);
+		} else {
+			emit_a64_mov_i(1, tmp, imm, ctx);
+			emit(A64_CMP(1, dst, tmp), ctx);
+		}
 		goto emit_cond_jmp;
 	case BPF_JMP | BPF_JSET | BPF_K:
 		emit_a64_mov_i(1, tmp, imm, ctx);
@@ -579,8 +750,7 @@ static int build_insn(const struct bpf_insn *insn, struct jit_ctx *ctx)
 		const u8 r0 = bpf2a64[BPF_REG_0];
 		const u64 func = (u64)__bpf_call_base + imm;
 
-		emit_a64_mov_i64(tmp, func, ctx);
-		emit(A64_BLR(tmp), ctx);
+		emit_call(func, ctx);
 		emit(A64_MOV(1, r0, A64_R(0)), ctx);
 		break;
 	}
@@ -617,19 +787,51 @@ static int build_insn(const struct bpf_insn *insn, struct jit_ctx *ctx)
 	case BPF_LDX | BPF_MEM | BPF_H:
 	case BPF_LDX | BPF_MEM | BPF_B:
 	case BPF_LDX | BPF_MEM | BPF_DW:
-		emit_a64_mov_i(1, tmp, off, ctx);
+		if (emit_ldst_pair(insn, ctx))
+			return 1;
+		/*
+		 * The BPF stack sits at a fixed distance above SP, where its
+		 * negative offsets from FP become positive.
+		 */
+		if (src == fp) {
+			src_adj = A64_SP;
+			off_adj = off + STACK_SIZE;
+		} else {
+			src_adj = src;
+			off_adj = off;
+		}
 		switch (BPF_SIZE(code)) {
 		case BPF_W:
-			emit(A64_LDR32(dst, src, tmp), ctx);
+			if (is_lsi_offset(off_adj, 2)) {
+				emit(A64_LDR32I(dst, src_adj, off_adj), ctx);
+			} else {
+				emit_a64_mov_i(1, tmp, off, ctx);
+				emit(A64_LDR32(dst, src, tmp), ctx);
+			}
 			break;
 		case BPF_H:
-			emit(A64_LDRH(dst, src, tmp), ctx);
+			if (is_lsi_offset(off_adj, 1)) {
+				emit(A64_LDRHI(dst, src_adj, off_adj), ctx);
+			} else {
+				emit_a64_mov_i(1, tmp, off, ctx);
+				emit(A64_LDRH(dst, src, tmp), ctx);
+			}
 			break;
 		case BPF_B:
-			emit(A64_LDRB(dst, src, tmp), ctx);
+			if (is_lsi_offset(off_adj, 0)) {
+				emit(A64_LDRBI(dst, src_adj, off_adj), ctx);
+			} else {
+				emit_a64_mov_i(1, tmp, off, ctx);
+				emit(A64_LDRB(dst, src, tmp), ctx);
+			}
 			break;
 		case BPF_DW:
-			emit(A64_LDR64(dst, src, tmp), ctx);
+			if (is_lsi_offset(off_adj, 3)) {
+				emit(A64_LDR64I(dst, src_adj, off_adj), ctx);
+			} else {
+				emit_a64_mov_i(1, tmp, off, ctx);
+				emit(A64_LDR64(dst, src, tmp), ctx);
+			}
 			break;
 		}
 		break;
@@ -639,43 +841,104 @@ static int build_insn(const struct bpf_insn *insn, struct jit_ctx *ctx)
 	case BPF_ST | BPF_MEM | BPF_H:
 	case BPF_ST | BPF_MEM | BPF_B:
 	case BPF_ST | BPF_MEM | BPF_DW:
-		/* Load imm to a register then store it */
-		emit_a64_mov_i(1, tmp2, off, ctx);
-		emit_a64_mov_i(1, tmp, imm, ctx);
+	{
+		/* Load imm to a register, unless it is zero, then store it */
+		const u8 val = imm ? tmp : A64_ZR;
+
+		if (emit_ldst_pair(insn, ctx))
+			return 1;
+		if (dst == fp) {
+			dst_adj = A64_SP;
+			off_adj = off + STACK_SIZE;
+		} else {
+			dst_adj = dst;
+			off_adj = off;
+		}
+		if (imm)
+			emit_a64_mov_i(1, tmp, imm, ctx);
 		switch (BPF_SIZE(code)) {
 		case BPF_W:
-			emit(A64_STR32(tmp, dst, tmp2), ctx);
+			if (is_lsi_offset(off_adj, 2)) {
+				emit(A64_STR32I(val, dst_adj, off_adj), ctx);
+			} else {
+				emit_a64_mov_i(1, tmp2, off, ctx);
+				emit(A64_STR32(val, dst, tmp2), ctx);
+			}
 			break;
 		case BPF_H:
-			emit(A64_STRH(tmp, dst, tmp2), ctx);
+			if (is_lsi_offset(off_adj, 1)) {
+				emit(A64_STRHI(val, dst_adj, off_adj), ctx);
+			} else {
+				emit_a64_mov_i(1, tmp2, off, ctx);
+				emit(A64_STRH(val, dst, tmp2), ctx);
+			}
 			break;
 		case BPF_B:
-			emit(A64_STRB(tmp, dst, tmp2), ctx);
+			if (is_lsi_offset(off_adj, 0)) {
+				emit(A64_STRBI(val, dst_adj, off_adj), ctx);
+			} else {
+				emit_a64_mov_i(1, tmp2, off, ctx);
+				emit(A64_STRB(val, dst, tmp2), ctx);
+			}
 			break;
 		case BPF_DW:
-			emit(A64_STR64(tmp, dst, tmp2), ctx);
+			if (is_lsi_offset(off_adj, 3)) {
+				emit(A64_STR64I(val, dst_adj, off_adj), ctx);
+			} else {
+				emit_a64_mov_i(1, tmp2, off, ctx);
+				emit(A64_STR64(val, dst, tmp2), ctx);
+			}
 			break;
 		}
 		break;
+	}
 
 	/* STX: *(size *)(dst + off) = src */
 	case BPF_STX | BPF_MEM | BPF_W:
 	case BPF_STX | BPF_MEM | BPF_H:
 	case BPF_STX | BPF_MEM | BPF_B:
 	case BPF_STX | BPF_MEM | BPF_DW:
-		emit_a64_mov_i(1, tmp, off, ctx);
+		if (emit_ldst_pair(insn, ctx))
+			return 1;
+		if (dst == fp) {
+			dst_adj = A64_SP;
+			off_adj = off + STACK_SIZE;
+		} else {
+			dst_adj = dst;
+			off_adj = off;
+		}
 		switch (BPF_SIZE(code)) {
 		case BPF_W:
-			emit(A64_STR32(src, dst, tmp), ctx);
+			if (is_lsi_offset(off_adj, 2)) {
+				emit(A64_STR32I(src, dst_adj, off_adj), ctx);
+			} else {
+				emit_a64_mov_i(1, tmp, off, ctx);
+				emit(A64_STR32(src, dst, tmp), ctx);
+			}
 			break;
 		case BPF_H:
-			emit(A64_STRH(src, dst, tmp), ctx);
+			if (is_lsi_offset(off_adj, 1)) {
+				emit(A64_STRHI(src, dst_adj, off_adj), ctx);
+			} else {
+				emit_a64_mov_i(1, tmp, off, ctx);
+				emit(A64_STRH(src, dst, tmp), ctx);
+			}
 			break;
 		case BPF_B:
-			emit(A64_STRB(src, dst, tmp), ctx);
+			if (is_lsi_offset(off_adj, 0)) {
+				emit(A64_STRBI(src, dst_adj, off_adj), ctx);
+			} else {
+				emit_a64_mov_i(1, tmp, off, ctx);
+				emit(A64_STRB(src, dst, tmp), ctx);
+			}
 			break;
 		case BPF_DW:
-			emit(A64_STR64(src, dst, tmp), ctx);
+			if (is_lsi_offset(off_adj, 3)) {
+				emit(A64_STR64I(src, dst_adj, off_adj), ctx);
+			} else {
+				emit_a64_mov_i(1, tmp, off, ctx);
+				emit(A64_STR64(src, dst, tmp), ctx);
+			}
 			break;
 		}
 		break;
@@ -683,8 +946,14 @@ static int build_insn(const struct bpf_insn *insn, struct jit_ctx *ctx)
 	case BPF_STX | BPF_XADD | BPF_W:
 	/* STX XADD: lock *(u64 *)(dst + off) += src */
 	case BPF_STX | BPF_XADD | BPF_DW:
-		emit_a64_mov_i(1, tmp, off, ctx);
-		emit(A64_ADD(1, tmp, tmp, dst), ctx);
+		if (is_addsub_imm(off)) {
+			emit(A64_ADD_I(1, tmp, dst, off), ctx);
+		} else if (is_addsub_imm(-off)) {
+			emit(A64_SUB_I(1, tmp, dst, -off), ctx);
+		} else {
+			emit_a64_mov_i(1, tmp, off, ctx);
+			emit(A64_ADD(1, tmp, tmp, dst), ctx);
+		}
 		emit(A64_PRFM(tmp, PST, L1, STRM), ctx);
 		emit(A64_LDXR(isdw, tmp2, tmp), ctx);
 		emit(A64_ADD(isdw, tmp2, tmp2, src), ctx);
@@ -705,7 +974,6 @@ static int build_insn(const struct bpf_insn *insn, struct jit_ctx *ctx)
 	{
 		const u8 r0 = bpf2a64[BPF_REG_0]; /* r0 = return value */
 		const u8 r6 = bpf2a64[BPF_REG_6]; /* r6 = pointer to sk_buff */
-		const u8 fp = bpf2a64[BPF_REG_FP];
 		const u8 r1 = bpf2a64[BPF_REG_1]; /* r1: struct sk_buff *skb */
 		const u8 r2 = bpf2a64[BPF_REG_2]; /* r2: int k */
 		const u8 r3 = bpf2a64[BPF_REG_3]; /* r3: unsigned int size */
@@ -732,8 +1000,7 @@ static int build_insn(const struct bpf_insn *insn, struct jit_ctx *ctx)
 		}
 		emit_a64_mov_i64(r3, size, ctx);
 		emit(A64_SUB_I(1, r4, fp, STACK_SIZE), ctx);
-		emit_a64_mov_i64(r5, (unsigned long)bpf_load_pointer, ctx);
-		emit(A64_BLR(r5), ctx);
+		emit_call((u64)bpf_load_pointer, ctx);
 		emit(A64_MOV(1, r0, A64_R(0)), ctx);
 
 		jmp_offset = epilogue_offset(ctx);
@@ -792,6 +1059,23 @@ static int build_body(struct jit_ctx *ctx)
 	return 0;
 }
 
+static void find_jmp_targets(struct jit_ctx *ctx)
+{
+	const struct bpf_prog *prog = ctx->prog;
+	int i;
+
+	for (i = 0; i < prog->len; i++) {
+		const struct bpf_insn *insn = &prog->insnsi[i];
+
+		if (BPF_CLASS(insn->code) != BPF_JMP ||
+		    BPF_OP(insn->code) == BPF_CALL ||
+		    BPF_OP(insn->code) == BPF_EXIT)
+			continue;
+
+		__set_bit(i + insn->off + 1, ctx->jmp_target);
+	}
+}
+
 static int validate_code(struct jit_ctx *ctx)
 {
 	int i;
@@ -843,7 +1127,17 @@ struct bpf_prog *bpf_int_jit_compile(struct bpf_prog *prog)
 		goto out;
 	}
 
+	ctx.jmp_target = kcalloc(BITS_TO_LONGS(prog->len), sizeof(long),
+				 GFP_KERNEL);
+	if (ctx.jmp_target == NULL) {
+		prog = orig_prog;
+		goto out_off;
+	}
+	find_jmp_targets(&ctx);
+
 	/* 1. Initial fake pass to compute ctx->idx. */
+fake_pass:
+	ctx.idx = 0;
 
 	/* Fake pass to fill in ctx->offset. */
 	if (build_body(&ctx)) {
@@ -868,6 +1162,19 @@ struct bpf_prog *bpf_int_jit_compile(struct bpf_prog *prog)
 		goto out_off;
 	}
 
+	/*
+	 * Direct calls were sized for an image in the module region, which
+	 * the allocation may have fallen back from. Redo the sizing without
+	 * them in that case.
+	 */
+	if (!ctx.far_calls &&
+	    ((u64)image_ptr < module_alloc_base ||
+	     (u64)image_ptr + image_size > module_alloc_base + MODULES_VSIZE)) {
+		bpf_jit_binary_free(header);
+		ctx.far_calls = true;
+		goto fake_pass;
+	}
+
 	/* 2. Now, the actual pass. */
 
 	ctx.image = (u32 *)image_ptr;
@@ -901,6 +1208,7 @@ struct bpf_prog *bpf_int_jit_compile(struct bpf_prog *prog)
 	prog->jited = 1;
 
 out_off:
+	kfree(ctx.jmp_target);
 	kfree(ctx.offset);
 out:
 	if (tmp_blinded)
@@ -98,5 +98,7 @@
 
 #define SO_COOKIE		57
 
+#define SO_ZEROCOPY		58
+
 #endif /* _ASM_SOCKET_H */
 
@@ -107,4 +107,6 @@
 
 #define SO_COOKIE		57
 
+#define SO_ZEROCOPY		58
+
 #endif /* _ASM_IA64_SOCKET_H */
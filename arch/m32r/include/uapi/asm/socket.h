@@ -98,4 +98,6 @@
 
 #define SO_COOKIE		57
 
+#define SO_ZEROCOPY		58
+
 #endif /* _ASM_M32R_SOCKET_H */
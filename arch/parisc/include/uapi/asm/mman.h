@@ -60,6 +60,8 @@
 					   overrides the coredump filter bits */
 #define MADV_DODUMP	70		/* Clear the MADV_NODUMP flag */
 
+#define MADV_COLLAPSE	73		/* Synchronous hugepage collapse */
+
 /* compatibility flags */
 #define MAP_FILE	0
 #define MAP_VARIABLE	0
@@ -97,4 +97,6 @@
 
 #define SO_COOKIE		0x4032
 
+#define SO_ZEROCOPY		0x4033
+
 #endif /* _UAPI_ASM_SOCKET_H */
@@ -94,6 +94,8 @@
 
 #define SO_COOKIE		0x003b
 
+#define SO_ZEROCOPY		0x003c
+
 /* Security levels - as per NRL IPv6 - don't actually do anything */
 #define SO_SECURITY_AUTHENTICATION		0x5001
 #define SO_SECURITY_ENCRYPTION_TRANSPORT	0x5002
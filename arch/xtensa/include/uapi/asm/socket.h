@@ -109,4 +109,6 @@
 
 #define SO_COOKIE		57
 
+#define SO_ZEROCOPY		58
+
 #endif	/* _XTENSA_SOCKET_H */
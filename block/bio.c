@@ -866,15 +866,17 @@ EXPORT_SYMBOL(bio_add_page);
  * @iter: iov iterator describing the region to be mapped
  *
  * Pins as many pages from *iter and appends them to @bio's bvec array. The
- * pages will have to be released using put_page() when done.
+ * pages will have to be released using put_page() when done, one for each
+ * page spanned by a bvec: physically contiguous pages share a bvec.
  */
 int bio_iov_iter_get_pages(struct bio *bio, struct iov_iter *iter)
 {
 	unsigned short nr_pages = bio->bi_max_vecs - bio->bi_vcnt;
 	struct bio_vec *bv = bio->bi_io_vec + bio->bi_vcnt;
-	struct page **pages = (struct page **)bv;
-	size_t offset, diff;
+	struct page **pages = (struct page **)(bv + nr_pages) - nr_pages;
+	size_t offset, left;
 	ssize_t size;
+	int i;
 
 	size = iov_iter_get_pages(iter, pages, LONG_MAX, nr_pages, &offset);
 	if (unlikely(size <= 0))
@@ -882,27 +884,42 @@ int bio_iov_iter_get_pages(struct bio *bio, struct iov_iter *iter)
 	nr_pages = (size + offset + PAGE_SIZE - 1) / PAGE_SIZE;
 
 	/*
-	 * Deep magic below:  We need to walk the pinned pages backwards
-	 * because we are abusing the space allocated for the bio_vecs
-	 * for the page array.  Because the bio_vecs are larger than the
-	 * page pointers by definition this will always work.  But it also
-	 * means we can't use bio_add_page, so any changes to it's semantics
-	 * need to be reflected here as well.
+	 * Deep magic below:  We are abusing the space allocated for the
+	 * bio_vecs for the page array, which sits in its second half.
+	 * Because the bio_vecs are larger than the page pointers by
+	 * definition, filling the bio_vecs front to back never overwrites a
+	 * page pointer not looked at yet.  But it also means we can't use
+	 * bio_add_page, so any changes to it's semantics need to be
+	 * reflected here as well.
+	 *
+	 * Only the pages pinned here are merged, the pages of a previous
+	 * call are left alone: a bio never spans more pages than it has
+	 * bvecs, which is what bio_clone_bioset() relies on.
 	 */
 	bio->bi_iter.bi_size += size;
-	bio->bi_vcnt += nr_pages;
 
-	diff = (nr_pages * PAGE_SIZE - offset) - size;
-	while (nr_pages--) {
-		bv[nr_pages].bv_page = pages[nr_pages];
-		bv[nr_pages].bv_len = PAGE_SIZE;
-		bv[nr_pages].bv_offset = 0;
-	}
+	bv->bv_page = pages[0];
+	bv->bv_offset = offset;
+	bv->bv_len = min_t(size_t, PAGE_SIZE - offset, size);
+	left = size - bv->bv_len;
+
+	for (i = 1; i < nr_pages; i++) {
+		struct page *page = pages[i];
+		unsigned int len = min_t(size_t, PAGE_SIZE, left);
 
-	bv[0].bv_offset += offset;
-	bv[0].bv_len -= offset;
-	if (diff)
-		bv[bio->bi_vcnt - 1].bv_len -= diff;
+		if (page == nth_page(bv->bv_page,
+				     (bv->bv_offset + bv->bv_len) >> PAGE_SHIFT)) {
+			bv->bv_len += len;
+			bio_set_flag(bio, BIO_MULTIPAGE);
+		} else {
+			bv++;
+			bv->bv_page = page;
+			bv->bv_offset = 0;
+			bv->bv_len = len;
+		}
+		left -= len;
+	}
+	bio->bi_vcnt = bv + 1 - bio->bi_io_vec;
 
 	iov_iter_advance(iter, size);
 	return 0;
@@ -1631,29 +1648,49 @@ struct bio *bio_copy_kern(struct request_queue *q, void *data, unsigned int len,
 void bio_set_pages_dirty(struct bio *bio)
 {
 	struct bio_vec *bvec;
-	int i;
+	struct page *page;
+	int i, j;
 
 	bio_for_each_segment_all(bvec, bio, i) {
-		struct page *page = bvec->bv_page;
+		if (!bvec->bv_page)
+			continue;
 
-		if (page && !PageCompound(page))
-			set_page_dirty_lock(page);
+		bvec_for_each_page(page, bvec, j)
+			if (!PageCompound(page))
+				set_page_dirty_lock(page);
 	}
 }
 
 static void bio_release_pages(struct bio *bio)
 {
 	struct bio_vec *bvec;
-	int i;
+	struct page *page;
+	int i, j;
 
 	bio_for_each_segment_all(bvec, bio, i) {
-		struct page *page = bvec->bv_page;
+		if (!bvec->bv_page)
+			continue;
 
-		if (page)
+		bvec_for_each_page(page, bvec, j)
 			put_page(page);
 	}
 }
 
+/**
+ * bio_put_pages - release the pages of a bio
+ * @bio: bio built by bio_iov_iter_get_pages()
+ * @mark_dirty: dirty the pages first, as after a read into them
+ *
+ * Drops the reference bio_iov_iter_get_pages() took on each page.
+ */
+void bio_put_pages(struct bio *bio, bool mark_dirty)
+{
+	if (mark_dirty)
+		bio_set_pages_dirty(bio);
+	bio_release_pages(bio);
+}
+EXPORT_SYMBOL_GPL(bio_put_pages);
+
 /*
  * bio_check_pages_dirty() will check that all the BIO's pages are still dirty.
  * If they are, then fine.  If, however, some pages are clean then they must
@@ -1694,6 +1731,18 @@ static void bio_dirty_fn(struct work_struct *work)
 	}
 }
 
+/* A bvec is only done with once all of its pages are */
+static bool bvec_pages_dirty(struct bio_vec *bvec)
+{
+	struct page *page;
+	int i;
+
+	bvec_for_each_page(page, bvec, i)
+		if (!PageDirty(page) && !PageCompound(page))
+			return false;
+	return true;
+}
+
 void bio_check_pages_dirty(struct bio *bio)
 {
 	struct bio_vec *bvec;
@@ -1701,10 +1750,12 @@ void bio_check_pages_dirty(struct bio *bio)
 	int i;
 
 	bio_for_each_segment_all(bvec, bio, i) {
-		struct page *page = bvec->bv_page;
+		struct page *page;
+		int j;
 
-		if (PageDirty(page) || PageCompound(page)) {
-			put_page(page);
+		if (bvec_pages_dirty(bvec)) {
+			bvec_for_each_page(page, bvec, j)
+				put_page(page);
 			bvec->bv_page = NULL;
 		} else {
 			nr_clean_pages++;
@@ -1823,6 +1874,7 @@ void bio_endio(struct bio *bio)
 	}
 
 	blk_throtl_bio_endio(bio);
+	blk_iolatency_done(bio);
 	if (bio->bi_end_io)
 		bio->bi_end_io(bio);
 }
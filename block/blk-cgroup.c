@@ -1160,11 +1160,20 @@ int blkcg_init_queue(struct request_queue *q)
 	q->root_rl.blkg = blkg;
 
 	ret = blk_throtl_init(q);
+	if (ret)
+		goto err_destroy_all;
+
+	ret = blk_iolatency_init(q);
 	if (ret) {
-		spin_lock_irq(q->queue_lock);
-		blkg_destroy_all(q);
-		spin_unlock_irq(q->queue_lock);
+		blk_throtl_exit(q);
+		goto err_destroy_all;
 	}
+	return 0;
+
+err_destroy_all:
+	spin_lock_irq(q->queue_lock);
+	blkg_destroy_all(q);
+	spin_unlock_irq(q->queue_lock);
 	return ret;
 }
 
@@ -1200,6 +1209,7 @@ void blkcg_exit_queue(struct request_queue *q)
 	blkg_destroy_all(q);
 	spin_unlock_irq(q->queue_lock);
 
+	blk_iolatency_exit(q);
 	blk_throtl_exit(q);
 }
 
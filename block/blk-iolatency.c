@@ -0,0 +1,474 @@
+/*
+ * Block cgroup I/O latency controller
+ *
+ * Copyright (C) 2017 - Linaro Ltd
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/*
+ * A group is given a completion latency target on a device through
+ * io.latency ("MAJ:MIN target=<usecs>"). Such a group is protected: the
+ * completion latency of its requests is sampled with a blk-stat callback,
+ * one bucket per protected group, and looked at every window. When a
+ * protected group's mean latency was above its target, all the groups
+ * with a looser target, or with none at all, get their number of
+ * requests in flight on that device halved. Once a window goes by
+ * without a miss, they get a quarter of the queue depth back at a time.
+ *
+ * The depth is enforced on bios entering blk_mq_make_request(), for
+ * blk-mq devices only. The groups are flat: a child doesn't inherit the
+ * target of its parent.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/wait.h>
+#include <linux/blkdev.h>
+#include <linux/blk-cgroup.h>
+
+#include "blk.h"
+#include "blk-stat.h"
+
+/* Protected groups per device, i.e. blk-stat buckets */
+#define IOLAT_MAX_GROUPS	16
+#define IOLAT_WINDOW_MSECS	100
+
+static struct blkcg_policy blkcg_policy_iolatency;
+
+struct blk_iolatency {
+	struct request_queue *q;
+	struct blk_stat_callback *cb;
+	bool cb_added;
+
+	/* protected by queue_lock */
+	struct iolatency_grp *slots[IOLAT_MAX_GROUPS];
+	unsigned int nr_protected;
+};
+
+struct iolatency_grp {
+	struct blkg_policy_data pd;
+
+	u64 target_nsec;		/* 0 if not protected */
+	int slot;			/* blk-stat bucket, or -1 */
+	unsigned long nr_missed;	/* windows above target */
+
+	unsigned int max_depth;		/* UINT_MAX if not throttled */
+	atomic_t inflight;
+	wait_queue_head_t wait;
+};
+
+static inline struct iolatency_grp *pd_to_iolg(struct blkg_policy_data *pd)
+{
+	return pd ? container_of(pd, struct iolatency_grp, pd) : NULL;
+}
+
+static inline struct iolatency_grp *blkg_to_iolg(struct blkcg_gq *blkg)
+{
+	return pd_to_iolg(blkg_to_pd(blkg, &blkcg_policy_iolatency));
+}
+
+static inline struct blkcg_gq *iolg_to_blkg(struct iolatency_grp *iolg)
+{
+	return pd_to_blkg(&iolg->pd);
+}
+
+static bool iolat_inc_below(atomic_t *v, unsigned int below)
+{
+	unsigned int cur = atomic_read(v);
+
+	for (;;) {
+		unsigned int old;
+
+		if (cur >= below)
+			return false;
+		old = atomic_cmpxchg(v, cur, cur + 1);
+		if (old == cur)
+			break;
+		cur = old;
+	}
+
+	return true;
+}
+
+static void iolatency_set_depth(struct iolatency_grp *iolg,
+				unsigned int depth)
+{
+	WRITE_ONCE(iolg->max_depth, depth);
+	wake_up_all(&iolg->wait);
+}
+
+static void iolatency_scale_down(struct iolatency_grp *iolg,
+				 unsigned int nr_requests)
+{
+	unsigned int depth = min(iolg->max_depth, nr_requests);
+
+	WRITE_ONCE(iolg->max_depth, max(depth / 2, 1U));
+}
+
+static void iolatency_scale_up(struct iolatency_grp *iolg,
+			       unsigned int nr_requests)
+{
+	unsigned int depth = iolg->max_depth;
+
+	if (depth == UINT_MAX)
+		return;
+
+	depth += max(nr_requests / 4, 1U);
+	iolatency_set_depth(iolg, depth >= nr_requests ? UINT_MAX : depth);
+}
+
+static int iolatency_bucket(const struct request *rq)
+{
+	struct iolatency_grp *iolg;
+
+	/* blk-mq samples requests before ending their bios */
+	if (!rq->bio)
+		return -1;
+
+	iolg = rq->bio->bi_iolat_private;
+	return iolg ? READ_ONCE(iolg->slot) : -1;
+}
+
+static void iolatency_timer_fn(struct blk_stat_callback *cb)
+{
+	struct blk_iolatency *iolat = cb->data;
+	struct request_queue *q = iolat->q;
+	unsigned int nr_requests = q->nr_requests;
+	u64 missed = U64_MAX;	/* tightest target that was missed */
+	struct blkcg_gq *blkg;
+	unsigned long flags;
+	bool throttled = false;
+	int i;
+
+	spin_lock_irqsave(q->queue_lock, flags);
+
+	for (i = 0; i < IOLAT_MAX_GROUPS; i++) {
+		struct iolatency_grp *iolg = iolat->slots[i];
+
+		if (!iolg || !cb->stat[i].nr_samples)
+			continue;
+		if (cb->stat[i].mean > iolg->target_nsec) {
+			iolg->nr_missed++;
+			missed = min(missed, iolg->target_nsec);
+		}
+	}
+
+	list_for_each_entry(blkg, &q->blkg_list, q_node) {
+		struct iolatency_grp *iolg = blkg_to_iolg(blkg);
+
+		if (!iolg)
+			continue;
+
+		if (!iolat->nr_protected)
+			iolatency_set_depth(iolg, UINT_MAX);
+		else if (missed != U64_MAX &&
+			 (!iolg->target_nsec || iolg->target_nsec > missed))
+			iolatency_scale_down(iolg, nr_requests);
+		else
+			iolatency_scale_up(iolg, nr_requests);
+
+		if (iolg->max_depth != UINT_MAX)
+			throttled = true;
+	}
+
+	if (iolat->nr_protected || throttled)
+		blk_stat_activate_msecs(cb, IOLAT_WINDOW_MSECS);
+
+	spin_unlock_irqrestore(q->queue_lock, flags);
+}
+
+/**
+ * blk_iolatency_throttle - wait for room in a group's depth
+ * @q:		queue @bio is submitted to
+ * @bio:	bio about to get a request
+ *
+ * Only does anything while a group is protected on @q. The bio then
+ * holds a reference on its group until blk_iolatency_done().
+ */
+void blk_iolatency_throttle(struct request_queue *q, struct bio *bio)
+{
+	struct blk_iolatency *iolat = q->iolat;
+	struct iolatency_grp *iolg;
+	struct blkcg_gq *blkg;
+	DEFINE_WAIT(wait);
+
+	if (!iolat || !READ_ONCE(iolat->nr_protected) || bio->bi_iolat_private)
+		return;
+
+	rcu_read_lock();
+	blkg = blkg_lookup(bio_blkcg(bio), q);
+	if (unlikely(!blkg)) {
+		rcu_read_unlock();
+		return;
+	}
+	blkg_get(blkg);
+	rcu_read_unlock();
+
+	iolg = blkg_to_iolg(blkg);
+	if (unlikely(!iolg)) {
+		blkg_put(blkg);
+		return;
+	}
+
+	if (!iolat_inc_below(&iolg->inflight, READ_ONCE(iolg->max_depth))) {
+		do {
+			prepare_to_wait_exclusive(&iolg->wait, &wait,
+						  TASK_UNINTERRUPTIBLE);
+			if (iolat_inc_below(&iolg->inflight,
+					    READ_ONCE(iolg->max_depth)))
+				break;
+			io_schedule();
+		} while (1);
+		finish_wait(&iolg->wait, &wait);
+	}
+
+	bio->bi_iolat_private = iolg;
+}
+
+/* Called from bio_endio(), or when @bio didn't get a request after all */
+void blk_iolatency_done(struct bio *bio)
+{
+	struct iolatency_grp *iolg = bio->bi_iolat_private;
+
+	if (!iolg)
+		return;
+	bio->bi_iolat_private = NULL;
+
+	if (atomic_dec_return(&iolg->inflight) < READ_ONCE(iolg->max_depth) &&
+	    waitqueue_active(&iolg->wait))
+		wake_up(&iolg->wait);
+
+	blkg_put(iolg_to_blkg(iolg));
+}
+
+static void iolatency_clear_target(struct blk_iolatency *iolat,
+				   struct iolatency_grp *iolg)
+{
+	lockdep_assert_held(iolat->q->queue_lock);
+
+	if (iolg->slot < 0)
+		return;
+
+	iolat->slots[iolg->slot] = NULL;
+	WRITE_ONCE(iolg->slot, -1);
+	iolg->target_nsec = 0;
+	iolat->nr_protected--;
+}
+
+static int iolatency_set_target(struct blk_iolatency *iolat,
+				struct iolatency_grp *iolg, u64 target_nsec)
+{
+	struct request_queue *q = iolat->q;
+	int i;
+
+	lockdep_assert_held(q->queue_lock);
+
+	if (iolg->slot < 0) {
+		for (i = 0; i < IOLAT_MAX_GROUPS; i++)
+			if (!iolat->slots[i])
+				break;
+		if (i == IOLAT_MAX_GROUPS)
+			return -ENOSPC;
+
+		iolat->slots[i] = iolg;
+		WRITE_ONCE(iolg->slot, i);
+		iolat->nr_protected++;
+	}
+	iolg->target_nsec = target_nsec;
+
+	if (!iolat->cb_added) {
+		blk_stat_add_callback(q, iolat->cb);
+		iolat->cb_added = true;
+	}
+	if (!blk_stat_is_active(iolat->cb))
+		blk_stat_activate_msecs(iolat->cb, IOLAT_WINDOW_MSECS);
+
+	return 0;
+}
+
+static u64 iolatency_prfill_target(struct seq_file *sf,
+				   struct blkg_policy_data *pd, int off)
+{
+	struct iolatency_grp *iolg = pd_to_iolg(pd);
+	const char *dname = blkg_dev_name(pd->blkg);
+
+	if (!dname || !iolg->target_nsec)
+		return 0;
+
+	seq_printf(sf, "%s target=%llu missed=%lu\n", dname,
+		   div_u64(iolg->target_nsec, NSEC_PER_USEC), iolg->nr_missed);
+	return 0;
+}
+
+static int iolatency_print_target(struct seq_file *sf, void *v)
+{
+	blkcg_print_blkgs(sf, css_to_blkcg(seq_css(sf)),
+			  iolatency_prfill_target, &blkcg_policy_iolatency,
+			  0, false);
+	return 0;
+}
+
+static ssize_t iolatency_write_target(struct kernfs_open_file *of,
+				      char *buf, size_t nbytes, loff_t off)
+{
+	struct blkcg *blkcg = css_to_blkcg(of_css(of));
+	struct blk_iolatency *iolat;
+	struct iolatency_grp *iolg;
+	struct blkg_conf_ctx ctx;
+	char tok[27];	/* target=18446744073709551616 */
+	u64 val = 0;
+	char *p;
+	int ret;
+
+	ret = blkg_conf_prep(blkcg, &blkcg_policy_iolatency, buf, &ctx);
+	if (ret)
+		return ret;
+
+	iolg = blkg_to_iolg(ctx.blkg);
+	iolat = ctx.blkg->q->iolat;
+
+	ret = -EINVAL;
+	if (sscanf(ctx.body, "%26s", tok) != 1)
+		goto out_finish;
+
+	p = tok;
+	strsep(&p, "=");
+	if (!p || strcmp(tok, "target"))
+		goto out_finish;
+	if (strcmp(p, "max") && (sscanf(p, "%llu", &val) != 1 || !val))
+		goto out_finish;
+
+	if (!val) {
+		iolatency_clear_target(iolat, iolg);
+		ret = 0;
+	} else {
+		ret = iolatency_set_target(iolat, iolg,
+					   val * NSEC_PER_USEC);
+	}
+out_finish:
+	blkg_conf_finish(&ctx);
+	return ret ?: nbytes;
+}
+
+static struct cftype iolatency_files[] = {
+	{
+		.name = "latency",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.seq_show = iolatency_print_target,
+		.write = iolatency_write_target,
+	},
+	{ }	/* terminate */
+};
+
+static struct cftype iolatency_legacy_files[] = {
+	{
+		.name = "latency_target",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.seq_show = iolatency_print_target,
+		.write = iolatency_write_target,
+	},
+	{ }	/* terminate */
+};
+
+static struct blkg_policy_data *iolatency_pd_alloc(gfp_t gfp, int node)
+{
+	struct iolatency_grp *iolg;
+
+	iolg = kzalloc_node(sizeof(*iolg), gfp, node);
+	if (!iolg)
+		return NULL;
+
+	return &iolg->pd;
+}
+
+static void iolatency_pd_init(struct blkg_policy_data *pd)
+{
+	struct iolatency_grp *iolg = pd_to_iolg(pd);
+
+	iolg->slot = -1;
+	iolg->max_depth = UINT_MAX;
+	atomic_set(&iolg->inflight, 0);
+	init_waitqueue_head(&iolg->wait);
+}
+
+static void iolatency_pd_offline(struct blkg_policy_data *pd)
+{
+	struct iolatency_grp *iolg = pd_to_iolg(pd);
+	struct blk_iolatency *iolat = pd->blkg->q->iolat;
+
+	if (iolat)
+		iolatency_clear_target(iolat, iolg);
+
+	/* Waiters hold a reference, let them go */
+	iolatency_set_depth(iolg, UINT_MAX);
+}
+
+static void iolatency_pd_free(struct blkg_policy_data *pd)
+{
+	kfree(pd_to_iolg(pd));
+}
+
+static struct blkcg_policy blkcg_policy_iolatency = {
+	.dfl_cftypes		= iolatency_files,
+	.legacy_cftypes		= iolatency_legacy_files,
+
+	.pd_alloc_fn		= iolatency_pd_alloc,
+	.pd_init_fn		= iolatency_pd_init,
+	.pd_offline_fn		= iolatency_pd_offline,
+	.pd_free_fn		= iolatency_pd_free,
+};
+
+int blk_iolatency_init(struct request_queue *q)
+{
+	struct blk_iolatency *iolat;
+	int ret;
+
+	iolat = kzalloc_node(sizeof(*iolat), GFP_KERNEL, q->node);
+	if (!iolat)
+		return -ENOMEM;
+
+	iolat->cb = blk_stat_alloc_callback(iolatency_timer_fn,
+					    iolatency_bucket,
+					    IOLAT_MAX_GROUPS, iolat);
+	if (!iolat->cb) {
+		kfree(iolat);
+		return -ENOMEM;
+	}
+
+	iolat->q = q;
+	q->iolat = iolat;
+
+	ret = blkcg_activate_policy(q, &blkcg_policy_iolatency);
+	if (ret) {
+		q->iolat = NULL;
+		blk_stat_free_callback(iolat->cb);
+		kfree(iolat);
+	}
+	return ret;
+}
+
+void blk_iolatency_exit(struct request_queue *q)
+{
+	struct blk_iolatency *iolat = q->iolat;
+
+	if (!iolat)
+		return;
+
+	blkcg_deactivate_policy(q, &blkcg_policy_iolatency);
+	if (iolat->cb_added)
+		blk_stat_remove_callback(q, iolat->cb);
+	blk_stat_free_callback(iolat->cb);
+	q->iolat = NULL;
+	kfree(iolat);
+}
+
+static int __init iolatency_init(void)
+{
+	return blkcg_policy_register(&blkcg_policy_iolatency);
+}
+
+module_init(iolatency_init);
@@ -84,6 +84,47 @@ static struct bio *blk_bio_write_same_split(struct request_queue *q,
 	return bio_split(bio, q->limits.max_write_same_sectors, GFP_NOIO, bs);
 }
 
+/*
+ * Return the first segment sized piece of @bv, which may span several
+ * pages. A piece doesn't cross a segment boundary, isn't longer than the
+ * max segment size and ends on a page boundary when cut short, so that
+ * the checks done between two pages still hold between two pieces.
+ * Single page bvecs are returned as is.
+ */
+static inline struct bio_vec blk_bvec_seg(struct request_queue *q,
+					  struct bio_vec bv)
+{
+	unsigned long mask = queue_segment_boundary(q);
+	unsigned int max_size = queue_max_segment_size(q);
+	unsigned long start;
+
+	if (likely(bv.bv_offset + bv.bv_len <= PAGE_SIZE))
+		return bv;
+
+	bv.bv_page = nth_page(bv.bv_page, bv.bv_offset >> PAGE_SHIFT);
+	bv.bv_offset = offset_in_page(bv.bv_offset);
+	if (bv.bv_len > max_size)
+		bv.bv_len = ((bv.bv_offset + max_size) & PAGE_MASK) -
+			    bv.bv_offset;
+
+	start = page_to_phys(bv.bv_page) + bv.bv_offset;
+	if (bv.bv_len - 1 > mask - (start & mask))
+		bv.bv_len = mask - (start & mask) + 1;
+
+	return bv;
+}
+
+/*
+ * Like bio_for_each_segment(), but physically contiguous pages come in
+ * pieces as large as the queue allows rather than one at a time.
+ */
+#define blk_bio_for_each_seg(q, bvl, bio, iter)				\
+	for (iter = (bio)->bi_iter;					\
+	     (iter).bi_size &&						\
+		((bvl = blk_bvec_seg((q),				\
+				     bio_iter_mp_iovec((bio), (iter)))), 1); \
+	     bio_advance_iter((bio), &(iter), (bvl).bv_len))
+
 static inline unsigned get_max_io_size(struct request_queue *q,
 				       struct bio *bio)
 {
@@ -110,7 +151,7 @@ static struct bio *blk_bio_segment_split(struct request_queue *q,
 	const unsigned max_sectors = get_max_io_size(q, bio);
 	unsigned bvecs = 0;
 
-	bio_for_each_segment(bv, bio, iter) {
+	blk_bio_for_each_seg(q, bv, bio, iter) {
 		/*
 		 * With arbitrary bio size, the incoming bio may be very
 		 * big. We have to split the bio into small bios so that
@@ -128,8 +169,11 @@ static struct bio *blk_bio_segment_split(struct request_queue *q,
 		 *
 		 * TODO: deal with bio bounce's bio_clone() gracefully
 		 * and convert the global limit into per-queue limit.
+		 *
+		 * bio_clone() allocates one bvec per page, count those.
 		 */
-		if (bvecs++ >= BIO_MAX_PAGES)
+		bvecs += DIV_ROUND_UP(bv.bv_offset + bv.bv_len, PAGE_SIZE);
+		if (bvecs > BIO_MAX_PAGES)
 			goto split;
 
 		/*
@@ -268,7 +312,7 @@ static unsigned int __blk_recalc_rq_segments(struct request_queue *q,
 	seg_size = 0;
 	nr_phys_segs = 0;
 	for_each_bio(bio) {
-		bio_for_each_segment(bv, bio, iter) {
+		blk_bio_for_each_seg(q, bv, bio, iter) {
 			/*
 			 * If SG merging is disabled, each bio vector is
 			 * a segment
@@ -323,8 +367,11 @@ void blk_recount_segments(struct request_queue *q, struct bio *bio)
 {
 	unsigned short seg_cnt;
 
-	/* estimate segment number by bi_vcnt for non-cloned bio */
-	if (bio_flagged(bio, BIO_CLONED))
+	/*
+	 * estimate segment number by bi_vcnt for non-cloned bio, unless
+	 * its bvecs span several pages
+	 */
+	if (bio_flagged(bio, BIO_CLONED) || bio_flagged(bio, BIO_MULTIPAGE))
 		seg_cnt = bio_segments(bio);
 	else
 		seg_cnt = bio->bi_vcnt;
@@ -435,7 +482,7 @@ static int __blk_bios_map_sg(struct request_queue *q, struct bio *bio,
 	int cluster = blk_queue_cluster(q), nsegs = 0;
 
 	for_each_bio(bio)
-		bio_for_each_segment(bvec, bio, iter)
+		blk_bio_for_each_seg(q, bvec, bio, iter)
 			__blk_segment_map_sg(q, &bvec, sglist, &bvprv, sg,
 					     &nsegs, &cluster);
 
@@ -677,6 +724,10 @@ static struct request *attempt_merge(struct request_queue *q,
 	if (req_op(req) != req_op(next))
 		return NULL;
 
+	/* polled and interrupt driven requests may sit on different queues */
+	if ((req->cmd_flags ^ next->cmd_flags) & REQ_HIPRI)
+		return NULL;
+
 	/*
 	 * not contiguous
 	 */
@@ -794,6 +845,9 @@ bool blk_rq_merge_ok(struct request *rq, struct bio *bio)
 	if (req_op(rq) != bio_op(bio))
 		return false;
 
+	if ((rq->cmd_flags ^ bio->bi_opf) & REQ_HIPRI)
+		return false;
+
 	/* different data direction or already started, don't merge */
 	if (bio_data_dir(bio) != rq_data_dir(rq))
 		return false;
@@ -34,7 +34,7 @@ static int get_first_sibling(unsigned int cpu)
 int blk_mq_map_queues(struct blk_mq_tag_set *set)
 {
 	unsigned int *map = set->mq_map;
-	unsigned int nr_queues = set->nr_hw_queues;
+	unsigned int nr_queues = set->nr_hw_queues - set->nr_poll_queues;
 	const struct cpumask *online_mask = cpu_online_mask;
 	unsigned int i, nr_cpus, nr_uniq_cpus, queue, first_sibling;
 	cpumask_var_t cpus;
@@ -89,6 +89,26 @@ int blk_mq_map_queues(struct blk_mq_tag_set *set)
 }
 EXPORT_SYMBOL_GPL(blk_mq_map_queues);
 
+/*
+ * Spread the CPUs over the poll queues, which come after the queues
+ * ->map_queues() dealt with. These have no interrupt, so there is no
+ * affinity to follow.
+ */
+void blk_mq_map_poll_queues(struct blk_mq_tag_set *set)
+{
+	unsigned int first = set->nr_hw_queues - set->nr_poll_queues;
+	unsigned int cpu, queue = 0;
+
+	if (!set->nr_poll_queues) {
+		memcpy(set->poll_map, set->mq_map,
+		       sizeof(*set->poll_map) * nr_cpu_ids);
+		return;
+	}
+
+	for_each_possible_cpu(cpu)
+		set->poll_map[cpu] = first + queue++ % set->nr_poll_queues;
+}
+
 /*
  * We have no quick way of doing reverse lookups. This is only used at
  * queue init time, so runtime isn't important.
@@ -75,6 +75,7 @@ static const char *const blk_queue_flag_name[] = {
 	QUEUE_FLAG_NAME(STATS),
 	QUEUE_FLAG_NAME(POLL_STATS),
 	QUEUE_FLAG_NAME(REGISTERED),
+	QUEUE_FLAG_NAME(LAT_HIST),
 };
 #undef QUEUE_FLAG_NAME
 
@@ -123,6 +124,55 @@ static ssize_t queue_state_write(void *data, const char __user *buf,
 	return count;
 }
 
+static int queue_lat_hist_show(void *data, struct seq_file *m)
+{
+	struct request_queue *q = data;
+
+	seq_printf(m, "%d\n", test_bit(QUEUE_FLAG_LAT_HIST, &q->queue_flags));
+	return 0;
+}
+
+/*
+ * The histograms are allocated on first enable and stay around until the
+ * hardware queue goes away, so the completion path never sees them freed.
+ */
+static ssize_t queue_lat_hist_write(void *data, const char __user *buf,
+				    size_t count, loff_t *ppos)
+{
+	struct request_queue *q = data;
+	struct blk_mq_hw_ctx *hctx;
+	bool enable;
+	int i, ret;
+
+	ret = kstrtobool_from_user(buf, count, &enable);
+	if (ret)
+		return ret;
+
+	if (!enable) {
+		queue_flag_clear_unlocked(QUEUE_FLAG_LAT_HIST, q);
+		return count;
+	}
+
+	mutex_lock(&q->sysfs_lock);
+	queue_for_each_hw_ctx(q, hctx, i) {
+		struct blk_mq_lat_hist __percpu *hist;
+
+		if (hctx->lat_hist)
+			continue;
+
+		hist = alloc_percpu(struct blk_mq_lat_hist);
+		if (!hist) {
+			mutex_unlock(&q->sysfs_lock);
+			return -ENOMEM;
+		}
+		smp_store_release(&hctx->lat_hist, hist);
+	}
+	queue_flag_set_unlocked(QUEUE_FLAG_LAT_HIST, q);
+	mutex_unlock(&q->sysfs_lock);
+
+	return count;
+}
+
 static void print_stat(struct seq_file *m, struct blk_rq_stat *stat)
 {
 	if (stat->nr_samples) {
@@ -206,6 +256,14 @@ static int hctx_flags_show(void *data, struct seq_file *m)
 	return 0;
 }
 
+static int hctx_type_show(void *data, struct seq_file *m)
+{
+	struct blk_mq_hw_ctx *hctx = data;
+
+	seq_puts(m, hctx->type == HCTX_TYPE_POLL ? "poll\n" : "default\n");
+	return 0;
+}
+
 #define REQ_OP_NAME(name) [REQ_OP_##name] = #name
 static const char *const op_name[] = {
 	REQ_OP_NAME(READ),
@@ -239,6 +297,7 @@ static const char *const cmd_flag_name[] = {
 	CMD_FLAG_NAME(PREFLUSH),
 	CMD_FLAG_NAME(RAHEAD),
 	CMD_FLAG_NAME(BACKGROUND),
+	CMD_FLAG_NAME(HIPRI),
 	CMD_FLAG_NAME(NOUNMAP),
 };
 #undef CMD_FLAG_NAME
@@ -264,6 +323,7 @@ static const char *const rqf_name[] = {
 	RQF_NAME(HASHED),
 	RQF_NAME(STATS),
 	RQF_NAME(SPECIAL_PAYLOAD),
+	RQF_NAME(LAT_HIST),
 };
 #undef RQF_NAME
 
@@ -503,6 +563,145 @@ static ssize_t hctx_run_write(void *data, const char __user *buf, size_t count,
 	return count;
 }
 
+static const char *const lat_op_name[] = {
+	[BLK_MQ_LAT_READ]	= "read",
+	[BLK_MQ_LAT_WRITE]	= "write",
+	[BLK_MQ_LAT_FLUSH]	= "flush",
+	[BLK_MQ_LAT_DISCARD]	= "discard",
+};
+
+static const char *const lat_stage_name[] = {
+	[BLK_MQ_LAT_SWQ]	= "swq",
+	[BLK_MQ_LAT_SCHED]	= "sched",
+	[BLK_MQ_LAT_DISPATCH]	= "dispatch",
+	[BLK_MQ_LAT_DEVICE]	= "device",
+	[BLK_MQ_LAT_TOTAL]	= "total",
+};
+
+static int lat_op(struct request *rq)
+{
+	if (rq->cmd_flags & REQ_PREFLUSH)
+		return BLK_MQ_LAT_FLUSH;
+
+	switch (req_op(rq)) {
+	case REQ_OP_READ:
+		return BLK_MQ_LAT_READ;
+	case REQ_OP_WRITE:
+	case REQ_OP_WRITE_SAME:
+	case REQ_OP_WRITE_ZEROES:
+		return BLK_MQ_LAT_WRITE;
+	case REQ_OP_FLUSH:
+		return BLK_MQ_LAT_FLUSH;
+	case REQ_OP_DISCARD:
+	case REQ_OP_SECURE_ERASE:
+		return BLK_MQ_LAT_DISCARD;
+	default:
+		return -1;
+	}
+}
+
+static void lat_add(unsigned long *buckets, u64 start, u64 end)
+{
+	u64 us;
+
+	if (!start || end < start)
+		return;
+
+	us = div_u64(end - start, NSEC_PER_USEC);
+	this_cpu_inc(buckets[min_t(int, fls64(us), BLK_MQ_LAT_BUCKETS - 1)]);
+}
+
+/* Called with RQF_LAT_HIST set, on completion */
+void __blk_mq_lat_done(struct request *rq)
+{
+	struct blk_mq_lat_hist __percpu *hist;
+	struct blk_mq_hw_ctx *hctx;
+	u64 now = ktime_get_ns();
+	int op = lat_op(rq);
+	int queued;
+
+	if (op < 0)
+		return;
+
+	hctx = blk_mq_map_queue(rq->q, rq->cmd_flags, rq->mq_ctx->cpu);
+	hist = smp_load_acquire(&hctx->lat_hist);
+	if (!hist)
+		return;
+
+	queued = rq->internal_tag != -1 ? BLK_MQ_LAT_SCHED : BLK_MQ_LAT_SWQ;
+
+	lat_add(hist->buckets[op][queued], rq->lat_alloc_ns,
+		rq->lat_dispatch_ns);
+	lat_add(hist->buckets[op][BLK_MQ_LAT_DISPATCH], rq->lat_dispatch_ns,
+		rq->lat_issue_ns);
+	lat_add(hist->buckets[op][BLK_MQ_LAT_DEVICE], rq->lat_issue_ns, now);
+	lat_add(hist->buckets[op][BLK_MQ_LAT_TOTAL], rq->lat_alloc_ns, now);
+}
+
+void blk_mq_lat_free(struct blk_mq_hw_ctx *hctx)
+{
+	free_percpu(hctx->lat_hist);
+	hctx->lat_hist = NULL;
+}
+
+static int hctx_latency_show(void *data, struct seq_file *m)
+{
+	struct blk_mq_hw_ctx *hctx = data;
+	struct request_queue *q = hctx->queue;
+	int op, stage, i, cpu, res;
+
+	res = mutex_lock_interruptible(&q->sysfs_lock);
+	if (res)
+		return res;
+	if (!hctx->lat_hist)
+		goto out;
+
+	seq_puts(m, "usecs:           <1");
+	for (i = 1; i < BLK_MQ_LAT_BUCKETS - 1; i++)
+		seq_printf(m, " <%lu", 1UL << i);
+	seq_printf(m, " >=%lu\n", 1UL << (i - 1));
+
+	for (op = 0; op < BLK_MQ_LAT_OPS; op++) {
+		for (stage = 0; stage < BLK_MQ_LAT_STAGES; stage++) {
+			seq_printf(m, "%-7s %-8s", lat_op_name[op],
+				   lat_stage_name[stage]);
+			for (i = 0; i < BLK_MQ_LAT_BUCKETS; i++) {
+				unsigned long sum = 0;
+
+				for_each_possible_cpu(cpu) {
+					struct blk_mq_lat_hist *hist;
+
+					hist = per_cpu_ptr(hctx->lat_hist, cpu);
+					sum += hist->buckets[op][stage][i];
+				}
+				seq_printf(m, " %lu", sum);
+			}
+			seq_puts(m, "\n");
+		}
+	}
+
+out:
+	mutex_unlock(&q->sysfs_lock);
+	return 0;
+}
+
+static ssize_t hctx_latency_write(void *data, const char __user *buf,
+				  size_t count, loff_t *ppos)
+{
+	struct blk_mq_hw_ctx *hctx = data;
+	struct request_queue *q = hctx->queue;
+	int cpu;
+
+	mutex_lock(&q->sysfs_lock);
+	if (hctx->lat_hist) {
+		for_each_possible_cpu(cpu)
+			memset(per_cpu_ptr(hctx->lat_hist, cpu), 0,
+			       sizeof(struct blk_mq_lat_hist));
+	}
+	mutex_unlock(&q->sysfs_lock);
+	return count;
+}
+
 static int hctx_active_show(void *data, struct seq_file *m)
 {
 	struct blk_mq_hw_ctx *hctx = data;
@@ -517,14 +716,14 @@ static void *ctx_rq_list_start(struct seq_file *m, loff_t *pos)
 	struct blk_mq_ctx *ctx = m->private;
 
 	spin_lock(&ctx->lock);
-	return seq_list_start(&ctx->rq_list, *pos);
+	return seq_list_start(&ctx->rq_lists[HCTX_TYPE_DEFAULT], *pos);
 }
 
 static void *ctx_rq_list_next(struct seq_file *m, void *v, loff_t *pos)
 {
 	struct blk_mq_ctx *ctx = m->private;
 
-	return seq_list_next(v, &ctx->rq_list, pos);
+	return seq_list_next(v, &ctx->rq_lists[HCTX_TYPE_DEFAULT], pos);
 }
 
 static void ctx_rq_list_stop(struct seq_file *m, void *v)
@@ -541,6 +740,29 @@ static const struct seq_operations ctx_rq_list_seq_ops = {
 	.stop	= ctx_rq_list_stop,
 	.show	= blk_mq_debugfs_rq_show,
 };
+
+static void *ctx_poll_rq_list_start(struct seq_file *m, loff_t *pos)
+	__acquires(&ctx->lock)
+{
+	struct blk_mq_ctx *ctx = m->private;
+
+	spin_lock(&ctx->lock);
+	return seq_list_start(&ctx->rq_lists[HCTX_TYPE_POLL], *pos);
+}
+
+static void *ctx_poll_rq_list_next(struct seq_file *m, void *v, loff_t *pos)
+{
+	struct blk_mq_ctx *ctx = m->private;
+
+	return seq_list_next(v, &ctx->rq_lists[HCTX_TYPE_POLL], pos);
+}
+
+static const struct seq_operations ctx_poll_rq_list_seq_ops = {
+	.start	= ctx_poll_rq_list_start,
+	.next	= ctx_poll_rq_list_next,
+	.stop	= ctx_rq_list_stop,
+	.show	= blk_mq_debugfs_rq_show,
+};
 static int ctx_dispatched_show(void *data, struct seq_file *m)
 {
 	struct blk_mq_ctx *ctx = data;
@@ -656,12 +878,14 @@ const struct file_operations blk_mq_debugfs_fops = {
 static const struct blk_mq_debugfs_attr blk_mq_debugfs_queue_attrs[] = {
 	{"poll_stat", 0400, queue_poll_stat_show},
 	{"state", 0600, queue_state_show, queue_state_write},
+	{"lat_hist", 0600, queue_lat_hist_show, queue_lat_hist_write},
 	{},
 };
 
 static const struct blk_mq_debugfs_attr blk_mq_debugfs_hctx_attrs[] = {
 	{"state", 0400, hctx_state_show},
 	{"flags", 0400, hctx_flags_show},
+	{"type", 0400, hctx_type_show},
 	{"dispatch", 0400, .seq_ops = &hctx_dispatch_seq_ops},
 	{"ctx_map", 0400, hctx_ctx_map_show},
 	{"tags", 0400, hctx_tags_show},
@@ -673,11 +897,13 @@ static const struct blk_mq_debugfs_attr blk_mq_debugfs_hctx_attrs[] = {
 	{"queued", 0600, hctx_queued_show, hctx_queued_write},
 	{"run", 0600, hctx_run_show, hctx_run_write},
 	{"active", 0400, hctx_active_show},
+	{"latency", 0600, hctx_latency_show, hctx_latency_write},
 	{},
 };
 
 static const struct blk_mq_debugfs_attr blk_mq_debugfs_ctx_attrs[] = {
 	{"rq_list", 0400, .seq_ops = &ctx_rq_list_seq_ops},
+	{"poll_rq_list", 0400, .seq_ops = &ctx_poll_rq_list_seq_ops},
 	{"dispatched", 0600, ctx_dispatched_show, ctx_dispatched_write},
 	{"merged", 0600, ctx_merged_show, ctx_merged_write},
 	{"completed", 0600, ctx_completed_show, ctx_completed_write},
@@ -4,6 +4,7 @@
 #ifdef CONFIG_BLK_DEBUG_FS
 
 #include <linux/seq_file.h>
+#include <linux/ktime.h>
 
 struct blk_mq_debugfs_attr {
 	const char *name;
@@ -30,6 +31,67 @@ void blk_mq_debugfs_unregister_sched(struct request_queue *q);
 int blk_mq_debugfs_register_sched_hctx(struct request_queue *q,
 				       struct blk_mq_hw_ctx *hctx);
 void blk_mq_debugfs_unregister_sched_hctx(struct blk_mq_hw_ctx *hctx);
+
+enum {
+	BLK_MQ_LAT_READ,
+	BLK_MQ_LAT_WRITE,
+	BLK_MQ_LAT_FLUSH,
+	BLK_MQ_LAT_DISCARD,
+	BLK_MQ_LAT_OPS,
+};
+
+/*
+ * Allocation to first dispatch is accounted as time in the software queue
+ * or in the scheduler, depending on which the request went through.
+ */
+enum {
+	BLK_MQ_LAT_SWQ,
+	BLK_MQ_LAT_SCHED,
+	BLK_MQ_LAT_DISPATCH,		/* first dispatch to last start */
+	BLK_MQ_LAT_DEVICE,		/* start to completion */
+	BLK_MQ_LAT_TOTAL,
+	BLK_MQ_LAT_STAGES,
+};
+
+/* Bucket 0 is < 1us, bucket n >= 1 is [2^(n-1), 2^n) us, the last open */
+#define BLK_MQ_LAT_BUCKETS	20
+
+struct blk_mq_lat_hist {
+	unsigned long buckets[BLK_MQ_LAT_OPS][BLK_MQ_LAT_STAGES]
+			     [BLK_MQ_LAT_BUCKETS];
+};
+
+void __blk_mq_lat_done(struct request *rq);
+void blk_mq_lat_free(struct blk_mq_hw_ctx *hctx);
+
+static inline void blk_mq_lat_init(struct request *rq)
+{
+	if (!test_bit(QUEUE_FLAG_LAT_HIST, &rq->q->queue_flags))
+		return;
+
+	rq->rq_flags |= RQF_LAT_HIST;
+	rq->lat_alloc_ns = ktime_get_ns();
+	rq->lat_dispatch_ns = 0;
+	rq->lat_issue_ns = 0;
+}
+
+static inline void blk_mq_lat_dispatch(struct request *rq)
+{
+	if ((rq->rq_flags & RQF_LAT_HIST) && !rq->lat_dispatch_ns)
+		rq->lat_dispatch_ns = ktime_get_ns();
+}
+
+static inline void blk_mq_lat_issue(struct request *rq)
+{
+	if (rq->rq_flags & RQF_LAT_HIST)
+		rq->lat_issue_ns = ktime_get_ns();
+}
+
+static inline void blk_mq_lat_done(struct request *rq)
+{
+	if (rq->rq_flags & RQF_LAT_HIST)
+		__blk_mq_lat_done(rq);
+}
 #else
 static inline int blk_mq_debugfs_register(struct request_queue *q)
 {
@@ -77,6 +139,26 @@ static inline int blk_mq_debugfs_register_sched_hctx(struct request_queue *q,
 static inline void blk_mq_debugfs_unregister_sched_hctx(struct blk_mq_hw_ctx *hctx)
 {
 }
+
+static inline void blk_mq_lat_free(struct blk_mq_hw_ctx *hctx)
+{
+}
+
+static inline void blk_mq_lat_init(struct request *rq)
+{
+}
+
+static inline void blk_mq_lat_dispatch(struct request *rq)
+{
+}
+
+static inline void blk_mq_lat_issue(struct request *rq)
+{
+}
+
+static inline void blk_mq_lat_done(struct request *rq)
+{
+}
 #endif
 
 #endif
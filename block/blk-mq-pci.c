@@ -26,14 +26,15 @@
  * interrupt vectors as @set has queues.  It will then query the vector
  * corresponding to each queue for it's affinity mask and built queue mapping
  * that maps a queue to the CPUs that have irq affinity for the corresponding
- * vector.
+ * vector. Poll queues have no vector, and are left to the core.
  */
 int blk_mq_pci_map_queues(struct blk_mq_tag_set *set, struct pci_dev *pdev)
 {
 	const struct cpumask *mask;
+	unsigned int nr_queues = set->nr_hw_queues - set->nr_poll_queues;
 	unsigned int queue, cpu;
 
-	for (queue = 0; queue < set->nr_hw_queues; queue++) {
+	for (queue = 0; queue < nr_queues; queue++) {
 		mask = pci_irq_get_affinity(pdev, queue);
 		if (!mask)
 			return -EINVAL;
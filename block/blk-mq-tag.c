@@ -135,6 +135,7 @@ unsigned int blk_mq_get_tag(struct blk_mq_alloc_data *data)
 	drop_ctx = data->ctx == NULL;
 	do {
 		prepare_to_wait(&ws->wait, &wait, TASK_UNINTERRUPTIBLE);
+		sbitmap_queue_wait_start(bt);
 
 		tag = __blk_mq_get_tag(data, bt);
 		if (tag != -1)
@@ -160,21 +161,25 @@ unsigned int blk_mq_get_tag(struct blk_mq_alloc_data *data)
 
 		io_schedule();
 
+		sbitmap_queue_wait_end(bt);
+		finish_wait(&ws->wait, &wait);
+
 		data->ctx = blk_mq_get_ctx(data->q);
-		data->hctx = blk_mq_map_queue(data->q, data->ctx->cpu);
+		data->hctx = blk_mq_map_queue(data->q, data->cmd_flags,
+					       data->ctx->cpu);
 		tags = blk_mq_tags_from_data(data);
 		if (data->flags & BLK_MQ_REQ_RESERVED)
 			bt = &tags->breserved_tags;
 		else
 			bt = &tags->bitmap_tags;
 
-		finish_wait(&ws->wait, &wait);
 		ws = bt_wait_ptr(bt, data->hctx);
 	} while (1);
 
 	if (drop_ctx && data->ctx)
 		blk_mq_put_ctx(data->ctx);
 
+	sbitmap_queue_wait_end(bt);
 	finish_wait(&ws->wait, &wait);
 
 found_tag:
@@ -341,11 +346,27 @@ void blk_mq_queue_tag_busy_iter(struct request_queue *q, busy_iter_fn *fn,
 
 }
 
+/*
+ * Deep enough tag maps cache a few tags per CPU, so that allocating and
+ * freeing a tag doesn't bounce the shared bitmap words between CPUs.
+ * Small maps would spend their whole depth in the caches.
+ */
+#define BLK_MQ_TAG_CACHE_DEPTH	128
+
 static int bt_alloc(struct sbitmap_queue *bt, unsigned int depth,
 		    bool round_robin, int node)
 {
-	return sbitmap_queue_init_node(bt, depth, -1, round_robin, GFP_KERNEL,
-				       node);
+	int ret;
+
+	ret = sbitmap_queue_init_node(bt, depth, -1, round_robin, GFP_KERNEL,
+				      node);
+	if (ret || depth < BLK_MQ_TAG_CACHE_DEPTH)
+		return ret;
+
+	ret = sbitmap_queue_init_cache(bt, GFP_KERNEL);
+	if (ret)
+		sbitmap_queue_free(bt);
+	return ret;
 }
 
 static struct blk_mq_tags *blk_mq_init_bitmap_tags(struct blk_mq_tags *tags,
@@ -468,7 +489,7 @@ u32 blk_mq_unique_tag(struct request *rq)
 	int hwq = 0;
 
 	if (q->mq_ops) {
-		hctx = blk_mq_map_queue(q, rq->mq_ctx->cpu);
+		hctx = blk_mq_map_queue(q, rq->cmd_flags, rq->mq_ctx->cpu);
 		hwq = hctx->queue_num;
 	}
 
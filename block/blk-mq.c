@@ -77,14 +77,16 @@ bool blk_mq_hctx_has_pending(struct blk_mq_hw_ctx *hctx)
 static void blk_mq_hctx_mark_pending(struct blk_mq_hw_ctx *hctx,
 				     struct blk_mq_ctx *ctx)
 {
-	if (!sbitmap_test_bit(&hctx->ctx_map, ctx->index_hw))
-		sbitmap_set_bit(&hctx->ctx_map, ctx->index_hw);
+	const int bit = ctx->index_hw[hctx->type];
+
+	if (!sbitmap_test_bit(&hctx->ctx_map, bit))
+		sbitmap_set_bit(&hctx->ctx_map, bit);
 }
 
 static void blk_mq_hctx_clear_pending(struct blk_mq_hw_ctx *hctx,
 				      struct blk_mq_ctx *ctx)
 {
-	sbitmap_clear_bit(&hctx->ctx_map, ctx->index_hw);
+	sbitmap_clear_bit(&hctx->ctx_map, ctx->index_hw[hctx->type]);
 }
 
 void blk_freeze_queue_start(struct request_queue *q)
@@ -241,6 +243,8 @@ void blk_mq_rq_ctx_init(struct request_queue *q, struct blk_mq_ctx *ctx,
 	rq->end_io_data = NULL;
 	rq->next_rq = NULL;
 
+	blk_mq_lat_init(rq);
+
 	ctx->rq_dispatched[op_is_sync(op)]++;
 }
 EXPORT_SYMBOL_GPL(blk_mq_rq_ctx_init);
@@ -384,7 +388,10 @@ static void blk_mq_finish_hctx_request(struct blk_mq_hw_ctx *hctx,
 
 void blk_mq_finish_request(struct request *rq)
 {
-	blk_mq_finish_hctx_request(blk_mq_map_queue(rq->q, rq->mq_ctx->cpu), rq);
+	struct blk_mq_hw_ctx *hctx;
+
+	hctx = blk_mq_map_queue(rq->q, rq->cmd_flags, rq->mq_ctx->cpu);
+	blk_mq_finish_hctx_request(hctx, rq);
 }
 EXPORT_SYMBOL_GPL(blk_mq_finish_request);
 
@@ -397,6 +404,7 @@ EXPORT_SYMBOL_GPL(blk_mq_free_request);
 inline void __blk_mq_end_request(struct request *rq, int error)
 {
 	blk_account_io_done(rq);
+	blk_mq_lat_done(rq);
 
 	if (rq->end_io) {
 		wbt_done(rq->q->rq_wb, &rq->issue_stat);
@@ -496,6 +504,8 @@ void blk_mq_start_request(struct request *rq)
 		wbt_issue(q->rq_wb, &rq->issue_stat);
 	}
 
+	blk_mq_lat_issue(rq);
+
 	blk_add_timer(rq);
 
 	/*
@@ -778,12 +788,14 @@ static void blk_mq_timeout_work(struct work_struct *work)
  * too much time checking for merges.
  */
 static bool blk_mq_attempt_merge(struct request_queue *q,
+				 struct blk_mq_hw_ctx *hctx,
 				 struct blk_mq_ctx *ctx, struct bio *bio)
 {
+	struct list_head *list = &ctx->rq_lists[hctx->type];
 	struct request *rq;
 	int checked = 8;
 
-	list_for_each_entry_reverse(rq, &ctx->rq_list, queuelist) {
+	list_for_each_entry_reverse(rq, list, queuelist) {
 		bool merged = false;
 
 		if (!checked--)
@@ -829,7 +841,7 @@ static bool flush_busy_ctx(struct sbitmap *sb, unsigned int bitnr, void *data)
 
 	sbitmap_clear_bit(sb, bitnr);
 	spin_lock(&ctx->lock);
-	list_splice_tail_init(&ctx->rq_list, flush_data->list);
+	list_splice_tail_init(&ctx->rq_lists[hctx->type], flush_data->list);
 	spin_unlock(&ctx->lock);
 	return true;
 }
@@ -862,8 +874,10 @@ bool blk_mq_get_driver_tag(struct request *rq, struct blk_mq_hw_ctx **hctx,
 {
 	struct blk_mq_alloc_data data = {
 		.q = rq->q,
-		.hctx = blk_mq_map_queue(rq->q, rq->mq_ctx->cpu),
+		.hctx = blk_mq_map_queue(rq->q, rq->cmd_flags,
+					 rq->mq_ctx->cpu),
 		.flags = wait ? 0 : BLK_MQ_REQ_NOWAIT,
+		.cmd_flags = rq->cmd_flags,
 	};
 
 	might_sleep_if(wait);
@@ -917,7 +931,7 @@ static void blk_mq_put_driver_tag(struct request *rq)
 	if (rq->tag == -1 || rq->internal_tag == -1)
 		return;
 
-	hctx = blk_mq_map_queue(rq->q, rq->mq_ctx->cpu);
+	hctx = blk_mq_map_queue(rq->q, rq->cmd_flags, rq->mq_ctx->cpu);
 	__blk_mq_put_driver_tag(hctx, rq);
 }
 
@@ -953,6 +967,7 @@ static int blk_mq_dispatch_wake(wait_queue_t *wait, unsigned mode, int flags,
 	hctx = container_of(wait, struct blk_mq_hw_ctx, dispatch_wait);
 
 	list_del(&wait->task_list);
+	sbitmap_queue_wait_end(&hctx->tags->bitmap_tags);
 	clear_bit_unlock(BLK_MQ_S_TAG_WAITING, &hctx->state);
 	blk_mq_run_hw_queue(hctx, true);
 	return 1;
@@ -979,6 +994,7 @@ static bool blk_mq_dispatch_wait_add(struct blk_mq_hw_ctx *hctx)
 	 * hctx->dispatch_wait, since a completion can wake up the wait queue
 	 * and unlock the bit.
 	 */
+	sbitmap_queue_wait_start(&hctx->tags->bitmap_tags);
 	add_wait_queue(&ws->wait, &hctx->dispatch_wait);
 	return true;
 }
@@ -988,6 +1004,7 @@ bool blk_mq_dispatch_rq_list(struct request_queue *q, struct list_head *list)
 	struct blk_mq_hw_ctx *hctx;
 	struct request *rq;
 	int errors, queued, ret = BLK_MQ_RQ_QUEUE_OK;
+	bool uncommitted = false;
 
 	if (list_empty(list))
 		return false;
@@ -1023,6 +1040,7 @@ bool blk_mq_dispatch_rq_list(struct request_queue *q, struct list_head *list)
 		list_del_init(&rq->queuelist);
 
 		bd.rq = rq;
+		blk_mq_lat_dispatch(rq);
 
 		/*
 		 * Flag last if we have no more requests, or if we have more
@@ -1041,6 +1059,7 @@ bool blk_mq_dispatch_rq_list(struct request_queue *q, struct list_head *list)
 		switch (ret) {
 		case BLK_MQ_RQ_QUEUE_OK:
 			queued++;
+			uncommitted = !bd.last;
 			break;
 		case BLK_MQ_RQ_QUEUE_BUSY:
 			blk_mq_put_driver_tag_hctx(hctx, rq);
@@ -1061,6 +1080,13 @@ bool blk_mq_dispatch_rq_list(struct request_queue *q, struct list_head *list)
 
 	hctx->dispatched[queued_to_index(queued)]++;
 
+	/*
+	 * The last request the driver took was flagged as having more
+	 * behind it, which didn't come: let the driver kick off what it has.
+	 */
+	if (uncommitted && q->mq_ops->commit_rqs)
+		q->mq_ops->commit_rqs(hctx);
+
 	/*
 	 * Any items that need requeuing? Stuff them into hctx->dispatch,
 	 * that is where we will continue on next queue run.
@@ -1339,9 +1365,9 @@ static inline void __blk_mq_insert_req_list(struct blk_mq_hw_ctx *hctx,
 	trace_block_rq_insert(hctx->queue, rq);
 
 	if (at_head)
-		list_add(&rq->queuelist, &ctx->rq_list);
+		list_add(&rq->queuelist, &ctx->rq_lists[hctx->type]);
 	else
-		list_add_tail(&rq->queuelist, &ctx->rq_list);
+		list_add_tail(&rq->queuelist, &ctx->rq_lists[hctx->type]);
 }
 
 void __blk_mq_insert_request(struct blk_mq_hw_ctx *hctx, struct request *rq,
@@ -1378,14 +1404,18 @@ static int plug_ctx_cmp(void *priv, struct list_head *a, struct list_head *b)
 {
 	struct request *rqa = container_of(a, struct request, queuelist);
 	struct request *rqb = container_of(b, struct request, queuelist);
+	unsigned int hipria = rqa->cmd_flags & REQ_HIPRI;
+	unsigned int hiprib = rqb->cmd_flags & REQ_HIPRI;
 
 	return !(rqa->mq_ctx < rqb->mq_ctx ||
 		 (rqa->mq_ctx == rqb->mq_ctx &&
-		  blk_rq_pos(rqa) < blk_rq_pos(rqb)));
+		  (hipria < hiprib ||
+		   (hipria == hiprib && blk_rq_pos(rqa) < blk_rq_pos(rqb)))));
 }
 
 void blk_mq_flush_plug_list(struct blk_plug *plug, bool from_schedule)
 {
+	struct blk_mq_hw_ctx *this_hctx, *hctx;
 	struct blk_mq_ctx *this_ctx;
 	struct request_queue *this_q;
 	struct request *rq;
@@ -1399,21 +1429,24 @@ void blk_mq_flush_plug_list(struct blk_plug *plug, bool from_schedule)
 
 	this_q = NULL;
 	this_ctx = NULL;
+	this_hctx = NULL;
 	depth = 0;
 
 	while (!list_empty(&list)) {
 		rq = list_entry_rq(list.next);
 		list_del_init(&rq->queuelist);
 		BUG_ON(!rq->q);
-		if (rq->mq_ctx != this_ctx) {
+		hctx = blk_mq_map_queue(rq->q, rq->cmd_flags, rq->mq_ctx->cpu);
+		if (rq->mq_ctx != this_ctx || hctx != this_hctx) {
 			if (this_ctx) {
 				trace_block_unplug(this_q, depth, from_schedule);
-				blk_mq_sched_insert_requests(this_q, this_ctx,
+				blk_mq_sched_insert_requests(this_hctx, this_ctx,
 								&ctx_list,
 								from_schedule);
 			}
 
 			this_ctx = rq->mq_ctx;
+			this_hctx = hctx;
 			this_q = rq->q;
 			depth = 0;
 		}
@@ -1428,7 +1461,7 @@ void blk_mq_flush_plug_list(struct blk_plug *plug, bool from_schedule)
 	 */
 	if (this_ctx) {
 		trace_block_unplug(this_q, depth, from_schedule);
-		blk_mq_sched_insert_requests(this_q, this_ctx, &ctx_list,
+		blk_mq_sched_insert_requests(this_hctx, this_ctx, &ctx_list,
 						from_schedule);
 	}
 }
@@ -1461,7 +1494,7 @@ static inline bool blk_mq_merge_queue_io(struct blk_mq_hw_ctx *hctx,
 		struct request_queue *q = hctx->queue;
 
 		spin_lock(&ctx->lock);
-		if (!blk_mq_attempt_merge(q, ctx, bio)) {
+		if (!blk_mq_attempt_merge(q, hctx, ctx, bio)) {
 			blk_mq_bio_to_request(rq, bio);
 			goto insert_rq;
 		}
@@ -1480,25 +1513,30 @@ static blk_qc_t request_to_qc_t(struct blk_mq_hw_ctx *hctx, struct request *rq)
 	return blk_tag_to_qc_t(rq->internal_tag, hctx->queue_num, true);
 }
 
-static void __blk_mq_try_issue_directly(struct request *rq, blk_qc_t *cookie,
-				      bool may_sleep)
+/*
+ * Returns BLK_MQ_RQ_QUEUE_BUSY if @rq couldn't be issued and has to be
+ * inserted for a later queue run.
+ */
+static int __blk_mq_issue_directly(struct request *rq, blk_qc_t *cookie,
+				   bool last)
 {
 	struct request_queue *q = rq->q;
 	struct blk_mq_queue_data bd = {
 		.rq = rq,
-		.last = true,
+		.last = last,
 	};
 	struct blk_mq_hw_ctx *hctx;
 	blk_qc_t new_cookie;
 	int ret;
 
 	if (q->elevator)
-		goto insert;
+		return BLK_MQ_RQ_QUEUE_BUSY;
 
 	if (!blk_mq_get_driver_tag(rq, &hctx, false))
-		goto insert;
+		return BLK_MQ_RQ_QUEUE_BUSY;
 
 	new_cookie = request_to_qc_t(hctx, rq);
+	blk_mq_lat_dispatch(rq);
 
 	/*
 	 * For OK queue, we are done. For error, kill it. Any other
@@ -1508,18 +1546,24 @@ static void __blk_mq_try_issue_directly(struct request *rq, blk_qc_t *cookie,
 	ret = q->mq_ops->queue_rq(hctx, &bd);
 	if (ret == BLK_MQ_RQ_QUEUE_OK) {
 		*cookie = new_cookie;
-		return;
+		return ret;
 	}
 
 	if (ret == BLK_MQ_RQ_QUEUE_ERROR) {
 		*cookie = BLK_QC_T_NONE;
 		blk_mq_end_request(rq, -EIO);
-		return;
+		return ret;
 	}
 
 	__blk_mq_requeue_request(rq);
-insert:
-	blk_mq_sched_insert_request(rq, false, true, false, may_sleep);
+	return BLK_MQ_RQ_QUEUE_BUSY;
+}
+
+static void __blk_mq_try_issue_directly(struct request *rq, blk_qc_t *cookie,
+				      bool may_sleep)
+{
+	if (__blk_mq_issue_directly(rq, cookie, true) == BLK_MQ_RQ_QUEUE_BUSY)
+		blk_mq_sched_insert_request(rq, false, true, false, may_sleep);
 }
 
 static void blk_mq_try_issue_directly(struct blk_mq_hw_ctx *hctx,
@@ -1540,6 +1584,62 @@ static void blk_mq_try_issue_directly(struct blk_mq_hw_ctx *hctx,
 	}
 }
 
+static void __blk_mq_try_issue_list_directly(struct blk_mq_hw_ctx *hctx,
+					     struct list_head *list)
+{
+	struct request_queue *q = hctx->queue;
+	bool uncommitted = false;
+	blk_qc_t cookie;
+
+	while (!list_empty(list)) {
+		struct request *rq = list_first_entry(list, struct request,
+						      queuelist);
+		bool last;
+		int ret;
+
+		list_del_init(&rq->queuelist);
+		last = list_empty(list);
+
+		ret = __blk_mq_issue_directly(rq, &cookie, last);
+		if (ret == BLK_MQ_RQ_QUEUE_BUSY) {
+			list_add(&rq->queuelist, list);
+			break;
+		}
+		if (ret == BLK_MQ_RQ_QUEUE_OK)
+			uncommitted = !last;
+	}
+
+	/* the driver was told more was coming, and nothing did */
+	if (uncommitted && q->mq_ops->commit_rqs)
+		q->mq_ops->commit_rqs(hctx);
+}
+
+/*
+ * Issue the requests of a plug flush to @hctx's driver one after the
+ * other, flagging only the last one as such. Whatever couldn't be issued
+ * is left on @list, for the caller to insert.
+ */
+void blk_mq_try_issue_list_directly(struct blk_mq_hw_ctx *hctx,
+				    struct list_head *list)
+{
+	if (blk_mq_hctx_stopped(hctx))
+		return;
+
+	if (!(hctx->flags & BLK_MQ_F_BLOCKING)) {
+		rcu_read_lock();
+		__blk_mq_try_issue_list_directly(hctx, list);
+		rcu_read_unlock();
+	} else {
+		unsigned int srcu_idx;
+
+		might_sleep();
+
+		srcu_idx = srcu_read_lock(&hctx->queue_rq_srcu);
+		__blk_mq_try_issue_list_directly(hctx, list);
+		srcu_read_unlock(&hctx->queue_rq_srcu, srcu_idx);
+	}
+}
+
 static blk_qc_t blk_mq_make_request(struct request_queue *q, struct bio *bio)
 {
 	const int is_sync = op_is_sync(bio->bi_opf);
@@ -1552,6 +1652,10 @@ static blk_qc_t blk_mq_make_request(struct request_queue *q, struct bio *bio)
 	blk_qc_t cookie;
 	unsigned int wb_acct;
 
+	/* Flushes are sequenced on the default hardware queues */
+	if (is_flush_fua)
+		bio->bi_opf &= ~REQ_HIPRI;
+
 	blk_queue_bounce(q, &bio);
 
 	blk_queue_split(q, &bio, q->bio_split);
@@ -1569,12 +1673,14 @@ static blk_qc_t blk_mq_make_request(struct request_queue *q, struct bio *bio)
 		return BLK_QC_T_NONE;
 
 	wb_acct = wbt_wait(q->rq_wb, bio, NULL);
+	blk_iolatency_throttle(q, bio);
 
 	trace_block_getrq(q, bio, bio->bi_opf);
 
 	rq = blk_mq_sched_get_request(q, bio, bio->bi_opf, &data);
 	if (unlikely(!rq)) {
 		__wbt_done(q->rq_wb, wb_acct);
+		blk_iolatency_done(bio);
 		return BLK_QC_T_NONE;
 	}
 
@@ -1593,7 +1699,8 @@ static blk_qc_t blk_mq_make_request(struct request_queue *q, struct bio *bio)
 			blk_insert_flush(rq);
 			blk_mq_run_hw_queue(data.hctx, true);
 		}
-	} else if (plug && q->nr_hw_queues == 1) {
+	} else if (plug && (q->nr_hw_queues == 1 ||
+			    blk_mq_direct_issue(data.hctx))) {
 		struct request *last = NULL;
 
 		blk_mq_put_ctx(data.ctx);
@@ -1641,7 +1748,8 @@ static blk_qc_t blk_mq_make_request(struct request_queue *q, struct bio *bio)
 		if (same_queue_rq)
 			blk_mq_try_issue_directly(data.hctx, same_queue_rq,
 					&cookie);
-	} else if (q->nr_hw_queues > 1 && is_sync) {
+	} else if ((q->nr_hw_queues > 1 && is_sync) ||
+		   blk_mq_direct_issue(data.hctx)) {
 		blk_mq_put_ctx(data.ctx);
 		blk_mq_bio_to_request(rq, bio);
 		blk_mq_try_issue_directly(data.hctx, rq, &cookie);
@@ -1835,8 +1943,8 @@ static int blk_mq_hctx_notify_dead(unsigned int cpu, struct hlist_node *node)
 	ctx = __blk_mq_get_ctx(hctx->queue, cpu);
 
 	spin_lock(&ctx->lock);
-	if (!list_empty(&ctx->rq_list)) {
-		list_splice_init(&ctx->rq_list, &tmp);
+	if (!list_empty(&ctx->rq_lists[hctx->type])) {
+		list_splice_init(&ctx->rq_lists[hctx->type], &tmp);
 		blk_mq_hctx_clear_pending(hctx, ctx);
 	}
 	spin_unlock(&ctx->lock);
@@ -1864,6 +1972,7 @@ static void blk_mq_exit_hctx(struct request_queue *q,
 		struct blk_mq_hw_ctx *hctx, unsigned int hctx_idx)
 {
 	blk_mq_debugfs_unregister_hctx(hctx);
+	blk_mq_lat_free(hctx);
 
 	blk_mq_tag_idle(hctx);
 
@@ -1979,17 +2088,19 @@ static void blk_mq_init_cpu_queues(struct request_queue *q,
 	for_each_possible_cpu(i) {
 		struct blk_mq_ctx *__ctx = per_cpu_ptr(q->queue_ctx, i);
 		struct blk_mq_hw_ctx *hctx;
+		int type;
 
 		__ctx->cpu = i;
 		spin_lock_init(&__ctx->lock);
-		INIT_LIST_HEAD(&__ctx->rq_list);
+		for (type = HCTX_TYPE_DEFAULT; type < HCTX_MAX_TYPES; type++)
+			INIT_LIST_HEAD(&__ctx->rq_lists[type]);
 		__ctx->queue = q;
 
 		/* If the cpu isn't online, the cpu is mapped to first hctx */
 		if (!cpu_online(i))
 			continue;
 
-		hctx = blk_mq_map_queue(q, i);
+		hctx = blk_mq_map_queue(q, 0, i);
 
 		/*
 		 * Set local node, IFF we have more than one hw queue. If
@@ -1997,6 +2108,10 @@ static void blk_mq_init_cpu_queues(struct request_queue *q,
 		 */
 		if (nr_hw_queues > 1 && hctx->numa_node == NUMA_NO_NODE)
 			hctx->numa_node = local_memory_node(cpu_to_node(i));
+
+		hctx = blk_mq_map_queue(q, REQ_HIPRI, i);
+		if (nr_hw_queues > 1 && hctx->numa_node == NUMA_NO_NODE)
+			hctx->numa_node = local_memory_node(cpu_to_node(i));
 	}
 }
 
@@ -2032,7 +2147,7 @@ static void blk_mq_free_map_and_requests(struct blk_mq_tag_set *set,
 static void blk_mq_map_swqueue(struct request_queue *q,
 			       const struct cpumask *online_mask)
 {
-	unsigned int i, hctx_idx;
+	unsigned int i, type, hctx_idx;
 	struct blk_mq_hw_ctx *hctx;
 	struct blk_mq_ctx *ctx;
 	struct blk_mq_tag_set *set = q->tag_set;
@@ -2045,35 +2160,51 @@ static void blk_mq_map_swqueue(struct request_queue *q,
 	queue_for_each_hw_ctx(q, hctx, i) {
 		cpumask_clear(hctx->cpumask);
 		hctx->nr_ctx = 0;
+		hctx->type = HCTX_TYPE_DEFAULT;
 	}
 
 	/*
-	 * Map software to hardware queues
+	 * Map software to hardware queues. Each ctx is mapped once per type,
+	 * unless both types share the hctx, as they do without poll queues.
 	 */
 	for_each_possible_cpu(i) {
 		/* If the cpu isn't online, the cpu is mapped to first hctx */
 		if (!cpumask_test_cpu(i, online_mask))
 			continue;
 
-		hctx_idx = q->mq_map[i];
-		/* unmapped hw queue can be remapped after CPU topo changed */
-		if (!set->tags[hctx_idx] &&
-		    !__blk_mq_alloc_rq_map(set, hctx_idx)) {
+		ctx = per_cpu_ptr(q->queue_ctx, i);
+
+		for (type = HCTX_TYPE_DEFAULT; type < HCTX_MAX_TYPES; type++) {
+			unsigned int *map = type == HCTX_TYPE_POLL ?
+					    q->poll_map : q->mq_map;
+
+			hctx_idx = map[i];
 			/*
-			 * If tags initialization fail for some hctx,
-			 * that hctx won't be brought online.  In this
-			 * case, remap the current ctx to hctx[0] which
-			 * is guaranteed to always have tags allocated
+			 * unmapped hw queue can be remapped after CPU topo
+			 * changed
 			 */
-			q->mq_map[i] = 0;
-		}
+			if (!set->tags[hctx_idx] &&
+			    !__blk_mq_alloc_rq_map(set, hctx_idx)) {
+				/*
+				 * If tags initialization fail for some hctx,
+				 * that hctx won't be brought online.  In this
+				 * case, remap the current ctx to hctx[0] which
+				 * is guaranteed to always have tags allocated,
+				 * or to its default hctx for polled requests.
+				 */
+				map[i] = type == HCTX_TYPE_POLL ?
+					 q->mq_map[i] : 0;
+			}
 
-		ctx = per_cpu_ptr(q->queue_ctx, i);
-		hctx = blk_mq_map_queue(q, i);
+			hctx = q->queue_hw_ctx[map[i]];
+			if (cpumask_test_cpu(i, hctx->cpumask))
+				continue;
 
-		cpumask_set_cpu(i, hctx->cpumask);
-		ctx->index_hw = hctx->nr_ctx;
-		hctx->ctxs[hctx->nr_ctx++] = ctx;
+			cpumask_set_cpu(i, hctx->cpumask);
+			hctx->type = type;
+			ctx->index_hw[type] = hctx->nr_ctx;
+			hctx->ctxs[hctx->nr_ctx++] = ctx;
+		}
 	}
 
 	mutex_unlock(&q->sysfs_lock);
@@ -2196,6 +2327,7 @@ void blk_mq_release(struct request_queue *q)
 	}
 
 	q->mq_map = NULL;
+	q->poll_map = NULL;
 
 	kfree(q->queue_hw_ctx);
 
@@ -2303,6 +2435,7 @@ struct request_queue *blk_mq_init_allocated_queue(struct blk_mq_tag_set *set,
 		goto err_percpu;
 
 	q->mq_map = set->mq_map;
+	q->poll_map = set->poll_map;
 
 	blk_mq_realloc_hw_ctxs(set, q);
 	if (!q->nr_hw_queues)
@@ -2523,10 +2656,21 @@ static int blk_mq_alloc_rq_maps(struct blk_mq_tag_set *set)
 
 static int blk_mq_update_queue_map(struct blk_mq_tag_set *set)
 {
+	int ret;
+
+	/* At least one queue has to take the requests that aren't polled */
+	if (set->nr_poll_queues >= set->nr_hw_queues)
+		set->nr_poll_queues = 0;
+
 	if (set->ops->map_queues)
-		return set->ops->map_queues(set);
+		ret = set->ops->map_queues(set);
 	else
-		return blk_mq_map_queues(set);
+		ret = blk_mq_map_queues(set);
+	if (ret)
+		return ret;
+
+	blk_mq_map_poll_queues(set);
+	return 0;
 }
 
 /*
@@ -2583,6 +2727,11 @@ int blk_mq_alloc_tag_set(struct blk_mq_tag_set *set)
 	if (!set->mq_map)
 		goto out_free_tags;
 
+	set->poll_map = kzalloc_node(sizeof(*set->poll_map) * nr_cpu_ids,
+			GFP_KERNEL, set->numa_node);
+	if (!set->poll_map)
+		goto out_free_mq_map;
+
 	ret = blk_mq_update_queue_map(set);
 	if (ret)
 		goto out_free_mq_map;
@@ -2597,6 +2746,8 @@ int blk_mq_alloc_tag_set(struct blk_mq_tag_set *set)
 	return 0;
 
 out_free_mq_map:
+	kfree(set->poll_map);
+	set->poll_map = NULL;
 	kfree(set->mq_map);
 	set->mq_map = NULL;
 out_free_tags:
@@ -2613,6 +2764,8 @@ void blk_mq_free_tag_set(struct blk_mq_tag_set *set)
 	for (i = 0; i < nr_cpu_ids; i++)
 		blk_mq_free_map_and_requests(set, i);
 
+	kfree(set->poll_map);
+	set->poll_map = NULL;
 	kfree(set->mq_map);
 	set->mq_map = NULL;
 
@@ -8,11 +8,11 @@ struct blk_mq_tag_set;
 struct blk_mq_ctx {
 	struct {
 		spinlock_t		lock;
-		struct list_head	rq_list;
+		struct list_head	rq_lists[HCTX_MAX_TYPES];
 	}  ____cacheline_aligned_in_smp;
 
 	unsigned int		cpu;
-	unsigned int		index_hw;
+	unsigned short		index_hw[HCTX_MAX_TYPES];
 
 	/* incremented at dispatch time */
 	unsigned long		rq_dispatched[2];
@@ -56,6 +56,8 @@ void __blk_mq_insert_request(struct blk_mq_hw_ctx *hctx, struct request *rq,
 				bool at_head);
 void blk_mq_insert_requests(struct blk_mq_hw_ctx *hctx, struct blk_mq_ctx *ctx,
 				struct list_head *list);
+void blk_mq_try_issue_list_directly(struct blk_mq_hw_ctx *hctx,
+				    struct list_head *list);
 /*
  * CPU hotplug helpers
  */
@@ -66,10 +68,17 @@ void blk_mq_disable_hotplug(void);
  * CPU -> queue mappings
  */
 extern int blk_mq_hw_queue_to_node(unsigned int *map, unsigned int);
+extern void blk_mq_map_poll_queues(struct blk_mq_tag_set *set);
 
+/*
+ * REQ_HIPRI requests go to the poll queues, if the driver has any. Without
+ * them, poll_map is a copy of mq_map.
+ */
 static inline struct blk_mq_hw_ctx *blk_mq_map_queue(struct request_queue *q,
-		int cpu)
+		unsigned int op, int cpu)
 {
+	if (op & REQ_HIPRI)
+		return q->queue_hw_ctx[q->poll_map[cpu]];
 	return q->queue_hw_ctx[q->mq_map[cpu]];
 }
 
@@ -114,6 +123,7 @@ struct blk_mq_alloc_data {
 	struct request_queue *q;
 	unsigned int flags;
 	unsigned int shallow_depth;
+	unsigned int cmd_flags;
 
 	/* input & output parameter */
 	struct blk_mq_ctx *ctx;
@@ -149,4 +159,15 @@ static inline bool blk_mq_hw_queue_mapped(struct blk_mq_hw_ctx *hctx)
 	return hctx->nr_ctx && hctx->tags;
 }
 
+/*
+ * Without a scheduler, a hardware queue that only one CPU submits to has
+ * nothing to gain from its software queue: requests go to the driver
+ * directly.
+ */
+static inline bool blk_mq_direct_issue(struct blk_mq_hw_ctx *hctx)
+{
+	return !hctx->queue->elevator && hctx->nr_ctx == 1 &&
+		!(hctx->flags & BLK_MQ_F_BLOCKING);
+}
+
 #endif
@@ -337,6 +337,17 @@ static void rwb_trace_step(struct rq_wb *rwb, const char *msg)
 			rwb->wb_background, rwb->wb_normal, rwb->wb_max);
 }
 
+/*
+ * Let the dirty throttling know how hard we are clamping writeback, so
+ * that the dirtiers back off instead of piling up behind the limits.
+ */
+static void rwb_update_bdi(struct rq_wb *rwb)
+{
+	struct backing_dev_info *bdi = rwb->queue->backing_dev_info;
+
+	WRITE_ONCE(bdi->lat_throttle, max(rwb->scale_step, 0));
+}
+
 static void scale_up(struct rq_wb *rwb)
 {
 	/*
@@ -349,6 +360,7 @@ static void scale_up(struct rq_wb *rwb)
 	rwb->unknown_cnt = 0;
 
 	rwb->scaled_max = calc_wb_limits(rwb);
+	rwb_update_bdi(rwb);
 
 	rwb_wake_all(rwb);
 
@@ -377,6 +389,7 @@ static void scale_down(struct rq_wb *rwb, bool hard_throttle)
 	rwb->scaled_max = false;
 	rwb->unknown_cnt = 0;
 	calc_wb_limits(rwb);
+	rwb_update_bdi(rwb);
 	rwb_trace_step(rwb, "step down");
 }
 
@@ -462,6 +475,7 @@ void wbt_update_limits(struct rq_wb *rwb)
 	rwb->scale_step = 0;
 	rwb->scaled_max = false;
 	calc_wb_limits(rwb);
+	rwb_update_bdi(rwb);
 
 	rwb_wake_all(rwb);
 }
@@ -752,6 +766,7 @@ void wbt_exit(struct request_queue *q)
 	if (rwb) {
 		blk_stat_remove_callback(q, rwb->cb);
 		blk_stat_free_callback(rwb->cb);
+		WRITE_ONCE(q->backing_dev_info->lat_throttle, 0);
 		q->rq_wb = NULL;
 		kfree(rwb);
 	}
@@ -44,7 +44,7 @@ static inline struct blk_flush_queue *blk_get_flush_queue(
 		struct request_queue *q, struct blk_mq_ctx *ctx)
 {
 	if (q->mq_ops)
-		return blk_mq_map_queue(q, ctx->cpu)->fq;
+		return blk_mq_map_queue(q, 0, ctx->cpu)->fq;
 	return q->fq;
 }
 
@@ -334,4 +334,20 @@ static inline void blk_throtl_bio_endio(struct bio *bio) { }
 static inline void blk_throtl_stat_add(struct request *rq, u64 time) { }
 #endif
 
+/*
+ * Internal I/O latency controller interface
+ */
+#ifdef CONFIG_BLK_CGROUP_IOLATENCY
+extern int blk_iolatency_init(struct request_queue *q);
+extern void blk_iolatency_exit(struct request_queue *q);
+extern void blk_iolatency_throttle(struct request_queue *q, struct bio *bio);
+extern void blk_iolatency_done(struct bio *bio);
+#else
+static inline int blk_iolatency_init(struct request_queue *q) { return 0; }
+static inline void blk_iolatency_exit(struct request_queue *q) { }
+static inline void blk_iolatency_throttle(struct request_queue *q,
+					  struct bio *bio) { }
+static inline void blk_iolatency_done(struct bio *bio) { }
+#endif
+
 #endif /* BLK_INTERNAL_H */
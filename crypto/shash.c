@@ -166,6 +166,57 @@ int crypto_shash_finup(struct shash_desc *desc, const u8 *data,
 }
 EXPORT_SYMBOL_GPL(crypto_shash_finup);
 
+static int shash_finup_mb_fallback(struct shash_desc *desc,
+				   const u8 * const data[], unsigned int len,
+				   u8 * const outs[], unsigned int num_msgs)
+{
+	struct crypto_shash *tfm = desc->tfm;
+	SHASH_DESC_ON_STACK(desc2, tfm);
+	unsigned int i;
+	int err = 0;
+
+	for (i = 0; i < num_msgs; i++) {
+		desc2->tfm = tfm;
+		desc2->flags = desc->flags;
+		memcpy(shash_desc_ctx(desc2), shash_desc_ctx(desc),
+		       crypto_shash_descsize(tfm));
+
+		err = crypto_shash_finup(desc2, data[i], len, outs[i]);
+		if (err)
+			break;
+	}
+
+	shash_desc_zero(desc2);
+	return err;
+}
+
+int crypto_shash_finup_mb(struct shash_desc *desc, const u8 * const data[],
+			  unsigned int len, u8 * const outs[],
+			  unsigned int num_msgs)
+{
+	struct crypto_shash *tfm = desc->tfm;
+	struct shash_alg *shash = crypto_shash_alg(tfm);
+	unsigned long alignmask = crypto_shash_alignmask(tfm);
+	unsigned int i;
+	int err;
+
+	if (num_msgs < 2 || num_msgs > shash->mb_max_msgs)
+		goto fallback;
+
+	for (i = 0; i < num_msgs; i++)
+		if (((unsigned long)data[i] | (unsigned long)outs[i]) &
+		    alignmask)
+			goto fallback;
+
+	err = shash->finup_mb(desc, data, len, outs, num_msgs);
+	if (err != -EOPNOTSUPP)
+		return err;
+
+fallback:
+	return shash_finup_mb_fallback(desc, data, len, outs, num_msgs);
+}
+EXPORT_SYMBOL_GPL(crypto_shash_finup_mb);
+
 static int shash_digest_unaligned(struct shash_desc *desc, const u8 *data,
 				  unsigned int len, u8 *out)
 {
@@ -458,6 +509,10 @@ static int shash_prepare_alg(struct shash_alg *alg)
 	}
 	if (!alg->setkey)
 		alg->setkey = shash_no_setkey;
+	if (!alg->finup_mb)
+		alg->mb_max_msgs = 1;
+	else if (alg->mb_max_msgs < 2)
+		return -EINVAL;
 
 	return 0;
 }
@@ -34488,4 +34488,76 @@ static const struct comp_testvec lz4hc_decomp_tv_template[] = {
 	},
 };
 
+static const struct comp_testvec zstd_comp_tv_template[] = {
+	{
+		.inlen	= 68,
+		.outlen	= 39,
+		.input	= "The algorithm is zstd. The algorithm is zstd. The"
+			 " algorithm is zstd.",
+		.output	= "\x28\xb5\x2f\xfd\x20\x44\xf5\x00\x00\xb8\x54\x68\x65"
+			  "\x20\x61\x6c\x67\x6f\x72\x69\x74\x68\x6d\x20\x69\x73"
+			  "\x20\x7a\x73\x74\x64\x2e\x20\x01\x00\x55\x73\x36\x01",
+	}, {
+		.inlen	= 244,
+		.outlen	= 188,
+		.input	= "zstd, short for Zstandard, is a fast lossless"
+			 " compression algorithm, targeting real-time"
+			 " compression scenarios at zlib-level and better"
+			 " compression ratios. The zstd compression library"
+			 " provides in-memory compression and decompression"
+			 " functions.",
+		.output	= "\x28\xb5\x2f\xfd\x20\xf4\x9d\x05\x00\xf2\x4a\x27\xf9"
+			  "\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00"
+			  "\x00\x00\x00\x50\x00\x00\x00\x00\x00\x22\x10\x00\x00"
+			  "\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00"
+			  "\x00\x00\x00\x10\x00\x00\x10\x00\x00\x04\x22\x34\x22"
+			  "\x24\x00\x43\x44\x10\x45\x41\x10\x02\x80\x63\xda\x1a"
+			  "\x48\x38\xca\xd8\xa0\xa2\x79\xea\x10\x68\x7e\x19\x2b"
+			  "\xa4\x0e\xac\x28\x69\x61\xe7\x4a\x02\x06\x3c\x6d\x49"
+			  "\xb5\x76\xab\xb0\x41\xf2\x55\xa1\x8e\x28\xec\x16\x2f"
+			  "\xf9\x69\x4a\x58\xc6\xeb\xd8\x12\x47\xa5\x46\xd0\xb6"
+			  "\x10\xa5\xf5\x70\x92\x35\x4d\xe4\xc8\x98\xf6\x97\x0e"
+			  "\x4e\x1a\xfe\xeb\xfe\x3c\xef\xe9\x30\xf9\xe6\xc1\x28"
+			  "\x19\xa4\xbd\xc0\x9a\x87\x57\x33\xb9\x07\xb3\x5f\x02"
+			  "\x06\x00\x35\x9c\x36\xf4\xe4\x01\x7a\x76\x64\x82\x24"
+			  "\xa9\x8e\xc7\xdc\xa1\xcc",
+	},
+};
+
+static const struct comp_testvec zstd_decomp_tv_template[] = {
+	{
+		.inlen	= 39,
+		.outlen	= 68,
+		.input	= "\x28\xb5\x2f\xfd\x20\x44\xf5\x00\x00\xb8\x54\x68\x65"
+			  "\x20\x61\x6c\x67\x6f\x72\x69\x74\x68\x6d\x20\x69\x73"
+			  "\x20\x7a\x73\x74\x64\x2e\x20\x01\x00\x55\x73\x36\x01",
+		.output	= "The algorithm is zstd. The algorithm is zstd. The"
+			 " algorithm is zstd.",
+	}, {
+		.inlen	= 188,
+		.outlen	= 244,
+		.input	= "\x28\xb5\x2f\xfd\x20\xf4\x9d\x05\x00\xf2\x4a\x27\xf9"
+			  "\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00"
+			  "\x00\x00\x00\x50\x00\x00\x00\x00\x00\x22\x10\x00\x00"
+			  "\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00"
+			  "\x00\x00\x00\x10\x00\x00\x10\x00\x00\x04\x22\x34\x22"
+			  "\x24\x00\x43\x44\x10\x45\x41\x10\x02\x80\x63\xda\x1a"
+			  "\x48\x38\xca\xd8\xa0\xa2\x79\xea\x10\x68\x7e\x19\x2b"
+			  "\xa4\x0e\xac\x28\x69\x61\xe7\x4a\x02\x06\x3c\x6d\x49"
+			  "\xb5\x76\xab\xb0\x41\xf2\x55\xa1\x8e\x28\xec\x16\x2f"
+			  "\xf9\x69\x4a\x58\xc6\xeb\xd8\x12\x47\xa5\x46\xd0\xb6"
+			  "\x10\xa5\xf5\x70\x92\x35\x4d\xe4\xc8\x98\xf6\x97\x0e"
+			  "\x4e\x1a\xfe\xeb\xfe\x3c\xef\xe9\x30\xf9\xe6\xc1\x28"
+			  "\x19\xa4\xbd\xc0\x9a\x87\x57\x33\xb9\x07\xb3\x5f\x02"
+			  "\x06\x00\x35\x9c\x36\xf4\xe4\x01\x7a\x76\x64\x82\x24"
+			  "\xa9\x8e\xc7\xdc\xa1\xcc",
+		.output	= "zstd, short for Zstandard, is a fast lossless"
+			 " compression algorithm, targeting real-time"
+			 " compression scenarios at zlib-level and better"
+			 " compression ratios. The zstd compression library"
+			 " provides in-memory compression and decompression"
+			 " functions.",
+	},
+};
+
 #endif	/* _CRYPTO_TESTMGR_H */
@@ -24,6 +24,11 @@ static DEFINE_IDA(vd_index_ida);
 
 static struct workqueue_struct *virtblk_wq;
 
+static unsigned int num_request_queues;
+module_param(num_request_queues, uint, 0444);
+MODULE_PARM_DESC(num_request_queues,
+		 "Limit the number of request queues; 0 - one per cpu");
+
 struct virtio_blk_vq {
 	struct virtqueue *vq;
 	spinlock_t lock;
@@ -214,6 +219,42 @@ static void virtblk_done(struct virtqueue *vq)
 	spin_unlock_irqrestore(&vblk->vqs[qid].lock, flags);
 }
 
+/*
+ * Reap the completions of a queue from blk_mq_poll(), without waiting for
+ * the interrupt. The callback stays enabled for the requests nobody polls,
+ * when it fires after we got there first it just finds the ring empty.
+ */
+static int virtblk_poll(struct blk_mq_hw_ctx *hctx, unsigned int tag)
+{
+	struct virtio_blk *vblk = hctx->queue->queuedata;
+	struct virtio_blk_vq *vq = &vblk->vqs[hctx->queue_num];
+	bool req_done = false;
+	struct virtblk_req *vbr;
+	unsigned long flags;
+	unsigned int len;
+	int found = 0;
+
+	/* A broken device completes nothing, stop spinning on it */
+	if (virtqueue_is_broken(vq->vq))
+		return -1;
+
+	spin_lock_irqsave(&vq->lock, flags);
+	while ((vbr = virtqueue_get_buf(vq->vq, &len)) != NULL) {
+		struct request *req = blk_mq_rq_from_pdu(vbr);
+
+		if (req->tag == tag)
+			found = 1;
+		blk_mq_complete_request(req);
+		req_done = true;
+	}
+
+	if (req_done)
+		blk_mq_start_stopped_hw_queues(vblk->disk->queue, true);
+	spin_unlock_irqrestore(&vq->lock, flags);
+
+	return found;
+}
+
 static int virtio_queue_rq(struct blk_mq_hw_ctx *hctx,
 			   const struct blk_mq_queue_data *bd)
 {
@@ -433,6 +474,15 @@ static int init_vq(struct virtio_blk *vblk)
 	if (err)
 		num_vqs = 1;
 
+	/*
+	 * Queues beyond one per cpu would never be mapped: spread the ones
+	 * we use over all cpus, as virtblk_map_queues() follows their
+	 * interrupt affinity.
+	 */
+	num_vqs = min_t(unsigned int, num_vqs, nr_cpu_ids);
+	if (num_request_queues)
+		num_vqs = min_t(unsigned int, num_vqs, num_request_queues);
+
 	vblk->vqs = kmalloc_array(num_vqs, sizeof(*vblk->vqs), GFP_KERNEL);
 	if (!vblk->vqs)
 		return -ENOMEM;
@@ -597,6 +647,7 @@ static const struct blk_mq_ops virtio_mq_ops = {
 	.complete	= virtblk_request_done,
 	.init_request	= virtblk_init_request,
 	.map_queues	= virtblk_map_queues,
+	.poll		= virtblk_poll,
 };
 
 static unsigned int virtblk_queue_depth;
@@ -223,8 +223,10 @@ static int get_set_conduit_method(struct device_node *np)
 
 	if (!strcmp("hvc", method)) {
 		invoke_psci_fn = __invoke_psci_fn_hvc;
+		psci_ops.conduit = PSCI_CONDUIT_HVC;
 	} else if (!strcmp("smc", method)) {
 		invoke_psci_fn = __invoke_psci_fn_smc;
+		psci_ops.conduit = PSCI_CONDUIT_SMC;
 	} else {
 		pr_warn("invalid \"method\" property: %s\n", method);
 		return -EINVAL;
@@ -651,10 +653,13 @@ int __init psci_acpi_init(void)
 
 	pr_info("probing for conduit method from ACPI.\n");
 
-	if (acpi_psci_use_hvc())
+	if (acpi_psci_use_hvc()) {
 		invoke_psci_fn = __invoke_psci_fn_hvc;
-	else
+		psci_ops.conduit = PSCI_CONDUIT_HVC;
+	} else {
 		invoke_psci_fn = __invoke_psci_fn_smc;
+		psci_ops.conduit = PSCI_CONDUIT_SMC;
+	}
 
 	return psci_probe();
 }
@@ -336,6 +336,7 @@
 
 /* Command queue */
 #define CMDQ_ENT_DWORDS			2
+#define CMDQ_BATCH_ENTRIES		64
 #define CMDQ_MAX_SZ_SHIFT		8
 
 #define CMDQ_ERR_SHIFT			24
@@ -516,6 +517,19 @@ struct arm_smmu_queue {
 struct arm_smmu_cmdq {
 	struct arm_smmu_queue		q;
 	spinlock_t			lock;
+
+	/*
+	 * Number of commands ever inserted, and that number right after the
+	 * last CMD_SYNC. Both are only written under the lock.
+	 */
+	u64				prod64;
+	u64				sync_prod64;
+};
+
+struct arm_smmu_cmdq_batch {
+	u64				cmds[CMDQ_BATCH_ENTRIES *
+					     CMDQ_ENT_DWORDS];
+	int				num;
 };
 
 struct arm_smmu_evtq {
@@ -646,6 +660,7 @@ struct arm_smmu_domain {
 
 	struct io_pgtable_ops		*pgtbl_ops;
 	spinlock_t			pgtbl_lock;
+	bool				non_strict;
 
 	enum arm_smmu_domain_stage	stage;
 	union {
@@ -723,11 +738,16 @@ static int queue_sync_prod(struct arm_smmu_queue *q)
 	return ret;
 }
 
+/* Advance the shadow prod only, queue_write_prod() publishes it */
 static void queue_inc_prod(struct arm_smmu_queue *q)
 {
 	u32 prod = (Q_WRP(q, q->prod) | Q_IDX(q, q->prod)) + 1;
 
 	q->prod = Q_OVF(q, q->prod) | Q_WRP(q, prod) | Q_IDX(q, prod);
+}
+
+static void queue_write_prod(struct arm_smmu_queue *q)
+{
 	writel(q->prod, q->prod_reg);
 }
 
@@ -762,16 +782,6 @@ static void queue_write(__le64 *dst, u64 *src, size_t n_dwords)
 		*dst++ = cpu_to_le64(*src++);
 }
 
-static int queue_insert_raw(struct arm_smmu_queue *q, u64 *ent)
-{
-	if (queue_full(q))
-		return -ENOSPC;
-
-	queue_write(Q_ENT(q, q->prod), ent, q->ent_dwords);
-	queue_inc_prod(q);
-	return 0;
-}
-
 static void queue_read(__le64 *dst, u64 *src, size_t n_dwords)
 {
 	int i;
@@ -907,13 +917,111 @@ static void arm_smmu_cmdq_skip_err(struct arm_smmu_device *smmu)
 	queue_write(Q_ENT(q, cons), cmd, q->ent_dwords);
 }
 
+/*
+ * Copy commands to the queue with the cmdq lock held, publishing prod once
+ * for the lot unless we have to wait for room. The lock only covers these
+ * copies: nobody waits for a CMD_SYNC to complete with it held.
+ */
+static void arm_smmu_cmdq_insert_cmds(struct arm_smmu_device *smmu,
+				      u64 *cmds, int n)
+{
+	struct arm_smmu_cmdq *cmdq = &smmu->cmdq;
+	struct arm_smmu_queue *q = &cmdq->q;
+	bool wfe = !!(smmu->features & ARM_SMMU_FEAT_SEV);
+	int i;
+
+	for (i = 0; i < n; i++) {
+		while (queue_full(q)) {
+			queue_write_prod(q);
+			if (queue_poll_cons(q, false, wfe))
+				dev_err_ratelimited(smmu->dev, "CMDQ timeout\n");
+		}
+
+		queue_write(Q_ENT(q, q->prod), &cmds[i * CMDQ_ENT_DWORDS],
+			    q->ent_dwords);
+		queue_inc_prod(q);
+		/* Never behind what the SMMU has been told, see below */
+		WRITE_ONCE(cmdq->prod64, cmdq->prod64 + 1);
+	}
+
+	queue_write_prod(q);
+}
+
+/*
+ * The SMMU reports cons modulo twice the queue size: extend it to the
+ * command count. As cons is read before prod64, it trails prod64 by no more
+ * than the queue size plus what the SMMU consumed between the two reads.
+ */
+static u64 arm_smmu_cmdq_cons64(struct arm_smmu_cmdq *cmdq)
+{
+	struct arm_smmu_queue *q = &cmdq->q;
+	u32 mask = (2U << q->max_n_shift) - 1;
+	u32 cons = readl(q->cons_reg);
+	u64 prod64 = READ_ONCE(cmdq->prod64);
+
+	return prod64 - (((u32)prod64 - cons) & mask);
+}
+
+static int arm_smmu_cmdq_poll_sync(struct arm_smmu_device *smmu, u64 target)
+{
+	ktime_t timeout = ktime_add_us(ktime_get(), ARM_SMMU_POLL_TIMEOUT_US);
+	bool wfe = !!(smmu->features & ARM_SMMU_FEAT_SEV);
+
+	while (arm_smmu_cmdq_cons64(&smmu->cmdq) < target) {
+		if (ktime_compare(ktime_get(), timeout) > 0)
+			return -ETIMEDOUT;
+
+		if (wfe) {
+			wfe();
+		} else {
+			cpu_relax();
+			udelay(1);
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Complete every command inserted so far. If the last command in the queue
+ * already is a CMD_SYNC, from another cpu or not, it covers ours too and we
+ * wait for it instead of adding another: concurrent invalidations end up
+ * sharing one sync.
+ */
+static void arm_smmu_cmdq_issue_sync(struct arm_smmu_device *smmu)
+{
+	struct arm_smmu_cmdq *cmdq = &smmu->cmdq;
+	struct arm_smmu_cmdq_ent ent = {
+		.opcode = CMDQ_OP_CMD_SYNC,
+	};
+	u64 cmd[CMDQ_ENT_DWORDS];
+	unsigned long flags;
+	u64 target;
+
+	arm_smmu_cmdq_build_cmd(cmd, &ent);
+
+	spin_lock_irqsave(&cmdq->lock, flags);
+	if (cmdq->sync_prod64 != cmdq->prod64) {
+		arm_smmu_cmdq_insert_cmds(smmu, cmd, 1);
+		cmdq->sync_prod64 = cmdq->prod64;
+	}
+	target = cmdq->sync_prod64;
+	spin_unlock_irqrestore(&cmdq->lock, flags);
+
+	if (arm_smmu_cmdq_poll_sync(smmu, target))
+		dev_err_ratelimited(smmu->dev, "CMD_SYNC timeout\n");
+}
+
 static void arm_smmu_cmdq_issue_cmd(struct arm_smmu_device *smmu,
 				    struct arm_smmu_cmdq_ent *ent)
 {
 	u64 cmd[CMDQ_ENT_DWORDS];
 	unsigned long flags;
-	bool wfe = !!(smmu->features & ARM_SMMU_FEAT_SEV);
-	struct arm_smmu_queue *q = &smmu->cmdq.q;
+
+	if (ent->opcode == CMDQ_OP_CMD_SYNC) {
+		arm_smmu_cmdq_issue_sync(smmu);
+		return;
+	}
 
 	if (arm_smmu_cmdq_build_cmd(cmd, ent)) {
 		dev_warn(smmu->dev, "ignoring unknown CMDQ opcode 0x%x\n",
@@ -922,14 +1030,40 @@ static void arm_smmu_cmdq_issue_cmd(struct arm_smmu_device *smmu,
 	}
 
 	spin_lock_irqsave(&smmu->cmdq.lock, flags);
-	while (queue_insert_raw(q, cmd) == -ENOSPC) {
-		if (queue_poll_cons(q, false, wfe))
-			dev_err_ratelimited(smmu->dev, "CMDQ timeout\n");
-	}
+	arm_smmu_cmdq_insert_cmds(smmu, cmd, 1);
+	spin_unlock_irqrestore(&smmu->cmdq.lock, flags);
+}
 
-	if (ent->opcode == CMDQ_OP_CMD_SYNC && queue_poll_cons(q, true, wfe))
-		dev_err_ratelimited(smmu->dev, "CMD_SYNC timeout\n");
+static void arm_smmu_cmdq_batch_submit(struct arm_smmu_device *smmu,
+				       struct arm_smmu_cmdq_batch *batch)
+{
+	unsigned long flags;
+
+	if (!batch->num)
+		return;
+
+	spin_lock_irqsave(&smmu->cmdq.lock, flags);
+	arm_smmu_cmdq_insert_cmds(smmu, batch->cmds, batch->num);
 	spin_unlock_irqrestore(&smmu->cmdq.lock, flags);
+	batch->num = 0;
+}
+
+/* Queue a command in the batch, submitting the batch when it is full */
+static void arm_smmu_cmdq_batch_add(struct arm_smmu_device *smmu,
+				    struct arm_smmu_cmdq_batch *batch,
+				    struct arm_smmu_cmdq_ent *ent)
+{
+	if (batch->num == CMDQ_BATCH_ENTRIES)
+		arm_smmu_cmdq_batch_submit(smmu, batch);
+
+	if (arm_smmu_cmdq_build_cmd(&batch->cmds[batch->num * CMDQ_ENT_DWORDS],
+				    ent)) {
+		dev_warn(smmu->dev, "ignoring unknown CMDQ opcode 0x%x\n",
+			 ent->opcode);
+		return;
+	}
+
+	batch->num++;
 }
 
 /* Context descriptor manipulation functions */
@@ -1341,6 +1475,7 @@ static void arm_smmu_tlb_inv_range_nosync(unsigned long iova, size_t size,
 {
 	struct arm_smmu_domain *smmu_domain = cookie;
 	struct arm_smmu_device *smmu = smmu_domain->smmu;
+	struct arm_smmu_cmdq_batch batch = { .num = 0 };
 	struct arm_smmu_cmdq_ent cmd = {
 		.tlbi = {
 			.leaf	= leaf,
@@ -1357,9 +1492,11 @@ static void arm_smmu_tlb_inv_range_nosync(unsigned long iova, size_t size,
 	}
 
 	do {
-		arm_smmu_cmdq_issue_cmd(smmu, &cmd);
+		arm_smmu_cmdq_batch_add(smmu, &batch, &cmd);
 		cmd.tlbi.addr += granule;
 	} while (size -= granule);
+
+	arm_smmu_cmdq_batch_submit(smmu, &batch);
 }
 
 static const struct iommu_gather_ops arm_smmu_gather_ops = {
@@ -1555,6 +1692,9 @@ static int arm_smmu_domain_finalise(struct iommu_domain *domain)
 		.iommu_dev	= smmu->dev,
 	};
 
+	if (smmu_domain->non_strict)
+		pgtbl_cfg.quirks |= IO_PGTABLE_QUIRK_NON_STRICT;
+
 	pgtbl_ops = alloc_io_pgtable_ops(fmt, &pgtbl_cfg, smmu_domain);
 	if (!pgtbl_ops)
 		return -ENOMEM;
@@ -1706,6 +1846,42 @@ arm_smmu_unmap(struct iommu_domain *domain, unsigned long iova, size_t size)
 	return ret;
 }
 
+static int arm_smmu_map_pages(struct iommu_domain *domain, unsigned long iova,
+			      phys_addr_t paddr, size_t pgsize, size_t pgcount,
+			      int prot, size_t *mapped)
+{
+	int ret;
+	unsigned long flags;
+	struct arm_smmu_domain *smmu_domain = to_smmu_domain(domain);
+	struct io_pgtable_ops *ops = smmu_domain->pgtbl_ops;
+
+	if (!ops)
+		return -ENODEV;
+
+	spin_lock_irqsave(&smmu_domain->pgtbl_lock, flags);
+	ret = ops->map_pages(ops, iova, paddr, pgsize, pgcount, prot, mapped);
+	spin_unlock_irqrestore(&smmu_domain->pgtbl_lock, flags);
+	return ret;
+}
+
+static size_t arm_smmu_unmap_pages(struct iommu_domain *domain,
+				   unsigned long iova, size_t pgsize,
+				   size_t pgcount)
+{
+	size_t ret;
+	unsigned long flags;
+	struct arm_smmu_domain *smmu_domain = to_smmu_domain(domain);
+	struct io_pgtable_ops *ops = smmu_domain->pgtbl_ops;
+
+	if (!ops)
+		return 0;
+
+	spin_lock_irqsave(&smmu_domain->pgtbl_lock, flags);
+	ret = ops->unmap_pages(ops, iova, pgsize, pgcount);
+	spin_unlock_irqrestore(&smmu_domain->pgtbl_lock, flags);
+	return ret;
+}
+
 static phys_addr_t
 arm_smmu_iova_to_phys(struct iommu_domain *domain, dma_addr_t iova)
 {
@@ -1850,15 +2026,26 @@ static int arm_smmu_domain_get_attr(struct iommu_domain *domain,
 {
 	struct arm_smmu_domain *smmu_domain = to_smmu_domain(domain);
 
-	if (domain->type != IOMMU_DOMAIN_UNMANAGED)
-		return -EINVAL;
-
-	switch (attr) {
-	case DOMAIN_ATTR_NESTING:
-		*(int *)data = (smmu_domain->stage == ARM_SMMU_DOMAIN_NESTED);
-		return 0;
+	switch (domain->type) {
+	case IOMMU_DOMAIN_UNMANAGED:
+		switch (attr) {
+		case DOMAIN_ATTR_NESTING:
+			*(int *)data =
+				(smmu_domain->stage == ARM_SMMU_DOMAIN_NESTED);
+			return 0;
+		default:
+			return -ENODEV;
+		}
+	case IOMMU_DOMAIN_DMA:
+		switch (attr) {
+		case DOMAIN_ATTR_DMA_USE_FLUSH_QUEUE:
+			*(int *)data = smmu_domain->non_strict;
+			return 0;
+		default:
+			return -ENODEV;
+		}
 	default:
-		return -ENODEV;
+		return -EINVAL;
 	}
 }
 
@@ -1868,16 +2055,23 @@ static int arm_smmu_domain_set_attr(struct iommu_domain *domain,
 	int ret = 0;
 	struct arm_smmu_domain *smmu_domain = to_smmu_domain(domain);
 
-	if (domain->type != IOMMU_DOMAIN_UNMANAGED)
+	if (domain->type != IOMMU_DOMAIN_UNMANAGED &&
+	    domain->type != IOMMU_DOMAIN_DMA)
 		return -EINVAL;
 
 	mutex_lock(&smmu_domain->init_mutex);
 
+	/* Both attributes shape the page tables, allocated on first attach */
+	if (smmu_domain->smmu) {
+		ret = -EPERM;
+		goto out_unlock;
+	}
+
 	switch (attr) {
 	case DOMAIN_ATTR_NESTING:
-		if (smmu_domain->smmu) {
-			ret = -EPERM;
-			goto out_unlock;
+		if (domain->type != IOMMU_DOMAIN_UNMANAGED) {
+			ret = -ENODEV;
+			break;
 		}
 
 		if (*(int *)data)
@@ -1885,6 +2079,14 @@ static int arm_smmu_domain_set_attr(struct iommu_domain *domain,
 		else
 			smmu_domain->stage = ARM_SMMU_DOMAIN_S1;
 
+		break;
+	case DOMAIN_ATTR_DMA_USE_FLUSH_QUEUE:
+		if (domain->type != IOMMU_DOMAIN_DMA) {
+			ret = -ENODEV;
+			break;
+		}
+
+		smmu_domain->non_strict = *(int *)data;
 		break;
 	default:
 		ret = -ENODEV;
@@ -1895,6 +2097,14 @@ static int arm_smmu_domain_set_attr(struct iommu_domain *domain,
 	return ret;
 }
 
+static void arm_smmu_flush_iotlb_all(struct iommu_domain *domain)
+{
+	struct arm_smmu_domain *smmu_domain = to_smmu_domain(domain);
+
+	if (smmu_domain->smmu)
+		arm_smmu_tlb_inv_context(smmu_domain);
+}
+
 static int arm_smmu_of_xlate(struct device *dev, struct of_phandle_args *args)
 {
 	return iommu_fwspec_add_ids(dev, args->args, 1);
@@ -1931,8 +2141,11 @@ static struct iommu_ops arm_smmu_ops = {
 	.domain_free		= arm_smmu_domain_free,
 	.attach_dev		= arm_smmu_attach_dev,
 	.map			= arm_smmu_map,
+	.map_pages		= arm_smmu_map_pages,
 	.unmap			= arm_smmu_unmap,
+	.unmap_pages		= arm_smmu_unmap_pages,
 	.map_sg			= default_iommu_map_sg,
+	.flush_iotlb_all	= arm_smmu_flush_iotlb_all,
 	.iova_to_phys		= arm_smmu_iova_to_phys,
 	.add_device		= arm_smmu_add_device,
 	.remove_device		= arm_smmu_remove_device,
@@ -52,6 +52,9 @@ struct iommu_dma_cookie {
 	};
 	struct list_head		msi_page_list;
 	spinlock_t			msi_lock;
+
+	/* Domain for flush queue callback; NULL if flush queue not in use */
+	struct iommu_domain		*fq_domain;
 };
 
 static inline size_t cookie_msi_granule(struct iommu_dma_cookie *cookie)
@@ -320,6 +323,7 @@ int iommu_dma_init_domain(struct iommu_domain *domain, dma_addr_t base,
 	}
 
 	init_iova_domain(iovad, 1UL << order, base_pfn, end_pfn);
+	iommu_dma_init_fq(domain, cookie);
 	if (!dev)
 		return 0;
 
@@ -327,6 +331,37 @@ int iommu_dma_init_domain(struct iommu_domain *domain, dma_addr_t base,
 }
 EXPORT_SYMBOL(iommu_dma_init_domain);
 
+static void iommu_dma_flush_iotlb_all(struct iova_domain *iovad)
+{
+	struct iommu_dma_cookie *cookie;
+
+	cookie = container_of(iovad, struct iommu_dma_cookie, iovad);
+	iommu_flush_tlb_all(cookie->fq_domain);
+}
+
+/*
+ * Non-strict mode: the driver leaves out the TLB invalidation of unmaps and
+ * the IOVAs go through a flush queue, so that a single IOTLB flush covers
+ * many unmaps before their IOVAs can be reused.
+ */
+static void iommu_dma_init_fq(struct iommu_domain *domain,
+			      struct iommu_dma_cookie *cookie)
+{
+	int attr;
+
+	if (iommu_domain_get_attr(domain, DOMAIN_ATTR_DMA_USE_FLUSH_QUEUE,
+				  &attr) || !attr)
+		return;
+
+	if (init_iova_flush_queue(&cookie->iovad, iommu_dma_flush_iotlb_all,
+				  NULL)) {
+		pr_warn("iova flush queue initialization failed\n");
+		return;
+	}
+
+	cookie->fq_domain = domain;
+}
+
 /**
  * dma_info_to_prot - Translate DMA API directions and attributes to IOMMU API
  *                    page flags.
@@ -416,7 +451,11 @@ static void __iommu_dma_unmap(struct iommu_domain *domain, dma_addr_t dma_addr,
 	size = iova_align(iovad, size + iova_off);
 
 	WARN_ON(iommu_unmap(domain, dma_addr, size) != size);
-	iommu_dma_free_iova(cookie, dma_addr, size);
+	if (cookie->fq_domain)
+		queue_iova(iovad, iova_pfn(iovad, dma_addr),
+			   size >> iova_shift(iovad), 0);
+	else
+		iommu_dma_free_iova(cookie, dma_addr, size);
 }
 
 static void __iommu_dma_free_pages(struct page **pages, int count)
@@ -72,6 +72,12 @@
 	(((u64)(a) >> ARM_LPAE_LVL_SHIFT(l,d)) &			\
 	 ((1 << ((d)->bits_per_level + ARM_LPAE_PGD_IDX(l,d))) - 1))
 
+/* Number of entries in a table at level l for pagetable in d. */
+#define ARM_LPAE_PTES_PER_TABLE(l,d)					\
+	((l) == ARM_LPAE_START_LVL(d) ?					\
+		(d)->pgd_size >> ilog2(sizeof(arm_lpae_iopte)) :	\
+		1UL << (d)->bits_per_level)
+
 /* Calculate the block/page mapping size at level l for pagetable in d. */
 #define ARM_LPAE_BLOCK_SIZE(l,d)					\
 	(1ULL << (ilog2(sizeof(arm_lpae_iopte)) +			\
@@ -249,44 +255,64 @@ static void __arm_lpae_free_pages(void *pages, size_t size,
 	free_pages_exact(pages, size);
 }
 
-static void __arm_lpae_set_pte(arm_lpae_iopte *ptep, arm_lpae_iopte pte,
-			       struct io_pgtable_cfg *cfg)
+static void __arm_lpae_sync_pte(arm_lpae_iopte *ptep, int num_entries,
+				struct io_pgtable_cfg *cfg)
 {
-	*ptep = pte;
-
 	if (!selftest_running)
 		dma_sync_single_for_device(cfg->iommu_dev,
 					   __arm_lpae_dma_addr(ptep),
-					   sizeof(pte), DMA_TO_DEVICE);
+					   sizeof(*ptep) * num_entries,
+					   DMA_TO_DEVICE);
+}
+
+static void __arm_lpae_set_pte(arm_lpae_iopte *ptep, arm_lpae_iopte pte,
+			       struct io_pgtable_cfg *cfg)
+{
+	*ptep = pte;
+	__arm_lpae_sync_pte(ptep, 1, cfg);
 }
 
-static int __arm_lpae_unmap(struct arm_lpae_io_pgtable *data,
-			    unsigned long iova, size_t size, int lvl,
-			    arm_lpae_iopte *ptep);
+static size_t __arm_lpae_unmap(struct arm_lpae_io_pgtable *data,
+			       unsigned long iova, size_t size, size_t pgcount,
+			       int lvl, arm_lpae_iopte *ptep);
 
+/*
+ * Install num_entries consecutive leaf entries at ptep, mapping paddr
+ * onwards. The entries are written first and pushed out to the walker with
+ * a single sync for the whole run.
+ */
 static int arm_lpae_init_pte(struct arm_lpae_io_pgtable *data,
 			     unsigned long iova, phys_addr_t paddr,
-			     arm_lpae_iopte prot, int lvl,
+			     arm_lpae_iopte prot, int lvl, int num_entries,
 			     arm_lpae_iopte *ptep)
 {
 	arm_lpae_iopte pte = prot;
 	struct io_pgtable_cfg *cfg = &data->iop.cfg;
+	size_t sz = ARM_LPAE_BLOCK_SIZE(lvl, data);
+	int i;
+
+	for (i = 0; i < num_entries; i++) {
+		if (iopte_leaf(ptep[i], lvl)) {
+			/* We require an unmap first */
+			WARN_ON(!selftest_running);
+			return -EEXIST;
+		}
+	}
 
-	if (iopte_leaf(*ptep, lvl)) {
-		/* We require an unmap first */
-		WARN_ON(!selftest_running);
-		return -EEXIST;
-	} else if (iopte_type(*ptep, lvl) == ARM_LPAE_PTE_TYPE_TABLE) {
-		/*
-		 * We need to unmap and free the old table before
-		 * overwriting it with a block entry.
-		 */
-		arm_lpae_iopte *tblp;
-		size_t sz = ARM_LPAE_BLOCK_SIZE(lvl, data);
-
-		tblp = ptep - ARM_LPAE_LVL_IDX(iova, lvl, data);
-		if (WARN_ON(__arm_lpae_unmap(data, iova, sz, lvl, tblp) != sz))
-			return -EINVAL;
+	for (i = 0; i < num_entries; i++) {
+		if (iopte_type(ptep[i], lvl) == ARM_LPAE_PTE_TYPE_TABLE) {
+			/*
+			 * We need to unmap and free the old table before
+			 * overwriting it with a block entry.
+			 */
+			arm_lpae_iopte *tblp;
+			unsigned long tbl_iova = iova + i * sz;
+
+			tblp = ptep - ARM_LPAE_LVL_IDX(iova, lvl, data);
+			if (WARN_ON(__arm_lpae_unmap(data, tbl_iova, sz, 1,
+						     lvl, tblp) != sz))
+				return -EINVAL;
+		}
 	}
 
 	if (cfg->quirks & IO_PGTABLE_QUIRK_ARM_NS)
@@ -298,26 +324,47 @@ static int arm_lpae_init_pte(struct arm_lpae_io_pgtable *data,
 		pte |= ARM_LPAE_PTE_TYPE_BLOCK;
 
 	pte |= ARM_LPAE_PTE_AF | ARM_LPAE_PTE_SH_IS;
-	pte |= pfn_to_iopte(paddr >> data->pg_shift, data);
 
-	__arm_lpae_set_pte(ptep, pte, cfg);
+	for (i = 0; i < num_entries; i++)
+		ptep[i] = pte | pfn_to_iopte((paddr + i * sz) >> data->pg_shift,
+					     data);
+
+	__arm_lpae_sync_pte(ptep, num_entries, cfg);
 	return 0;
 }
 
+/*
+ * Map up to pgcount pages of the given size. Only as many as fit in the
+ * leaf table reached by the walk are mapped, and reported in *mapped, so
+ * that the caller can restart the walk for the remainder.
+ */
 static int __arm_lpae_map(struct arm_lpae_io_pgtable *data, unsigned long iova,
-			  phys_addr_t paddr, size_t size, arm_lpae_iopte prot,
-			  int lvl, arm_lpae_iopte *ptep)
+			  phys_addr_t paddr, size_t size, size_t pgcount,
+			  arm_lpae_iopte prot, int lvl, arm_lpae_iopte *ptep,
+			  size_t *mapped)
 {
 	arm_lpae_iopte *cptep, pte;
 	size_t block_size = ARM_LPAE_BLOCK_SIZE(lvl, data);
 	struct io_pgtable_cfg *cfg = &data->iop.cfg;
+	int map_idx = ARM_LPAE_LVL_IDX(iova, lvl, data);
+	int ret;
 
 	/* Find our entry at the current level */
-	ptep += ARM_LPAE_LVL_IDX(iova, lvl, data);
+	ptep += map_idx;
+
+	/* If we can install leaf entries at this level, then do so */
+	if (size == block_size && (size & cfg->pgsize_bitmap)) {
+		size_t num_entries;
+
+		num_entries = min_t(size_t, pgcount,
+				    ARM_LPAE_PTES_PER_TABLE(lvl, data) - map_idx);
+		ret = arm_lpae_init_pte(data, iova, paddr, prot, lvl,
+					num_entries, ptep);
+		if (!ret && mapped)
+			*mapped += num_entries * size;
 
-	/* If we can install a leaf entry at this level, then do so */
-	if (size == block_size && (size & cfg->pgsize_bitmap))
-		return arm_lpae_init_pte(data, iova, paddr, prot, lvl, ptep);
+		return ret;
+	}
 
 	/* We can't allocate tables at the final level */
 	if (WARN_ON(lvl >= ARM_LPAE_MAX_LEVELS - 1))
@@ -344,7 +391,8 @@ static int __arm_lpae_map(struct arm_lpae_io_pgtable *data, unsigned long iova,
 	}
 
 	/* Rinse, repeat */
-	return __arm_lpae_map(data, iova, paddr, size, prot, lvl + 1, cptep);
+	return __arm_lpae_map(data, iova, paddr, size, pgcount, prot, lvl + 1,
+			      cptep, mapped);
 }
 
 static arm_lpae_iopte arm_lpae_prot_to_pte(struct arm_lpae_io_pgtable *data,
@@ -388,8 +436,9 @@ static arm_lpae_iopte arm_lpae_prot_to_pte(struct arm_lpae_io_pgtable *data,
 	return pte;
 }
 
-static int arm_lpae_map(struct io_pgtable_ops *ops, unsigned long iova,
-			phys_addr_t paddr, size_t size, int iommu_prot)
+static int arm_lpae_map_pages(struct io_pgtable_ops *ops, unsigned long iova,
+			      phys_addr_t paddr, size_t pgsize, size_t pgcount,
+			      int iommu_prot, size_t *mapped)
 {
 	struct arm_lpae_io_pgtable *data = io_pgtable_ops_to_data(ops);
 	arm_lpae_iopte *ptep = data->pgd;
@@ -400,8 +449,12 @@ static int arm_lpae_map(struct io_pgtable_ops *ops, unsigned long iova,
 	if (!(iommu_prot & (IOMMU_READ | IOMMU_WRITE)))
 		return 0;
 
+	if (WARN_ON(!pgcount))
+		return -EINVAL;
+
 	prot = arm_lpae_prot_to_pte(data, iommu_prot);
-	ret = __arm_lpae_map(data, iova, paddr, size, prot, lvl, ptep);
+	ret = __arm_lpae_map(data, iova, paddr, pgsize, pgcount, prot, lvl,
+			     ptep, mapped);
 	/*
 	 * Synchronise all PTE updates for the new mapping before there's
 	 * a chance for anything to kick off a table walk for the new iova.
@@ -411,6 +464,12 @@ static int arm_lpae_map(struct io_pgtable_ops *ops, unsigned long iova,
 	return ret;
 }
 
+static int arm_lpae_map(struct io_pgtable_ops *ops, unsigned long iova,
+			phys_addr_t paddr, size_t size, int iommu_prot)
+{
+	return arm_lpae_map_pages(ops, iova, paddr, size, 1, iommu_prot, NULL);
+}
+
 static void __arm_lpae_free_pgtable(struct arm_lpae_io_pgtable *data, int lvl,
 				    arm_lpae_iopte *ptep)
 {
@@ -450,30 +509,44 @@ static void arm_lpae_free_pgtable(struct io_pgtable *iop)
 	kfree(data);
 }
 
-static int arm_lpae_split_blk_unmap(struct arm_lpae_io_pgtable *data,
-				    unsigned long iova, size_t size,
-				    arm_lpae_iopte prot, int lvl,
-				    arm_lpae_iopte *ptep, size_t blk_size)
+static size_t arm_lpae_split_blk_unmap(struct arm_lpae_io_pgtable *data,
+				       unsigned long iova, size_t size,
+				       size_t pgcount, arm_lpae_iopte prot,
+				       int lvl, arm_lpae_iopte *ptep,
+				       size_t blk_size)
 {
-	unsigned long blk_start, blk_end;
+	unsigned long blk_start, blk_end, unmap_end, span;
 	phys_addr_t blk_paddr;
 	arm_lpae_iopte table = 0;
+	size_t num_entries;
 
 	blk_start = iova & ~(blk_size - 1);
 	blk_end = blk_start + blk_size;
 	blk_paddr = iopte_to_pfn(*ptep, data) << data->pg_shift;
 
-	for (; blk_start < blk_end; blk_start += size, blk_paddr += size) {
+	/* Unmap no further than the end of the table holding the pages */
+	span = size << data->bits_per_level;
+	num_entries = min_t(size_t, pgcount,
+			    (span - (iova & (span - 1))) / size);
+	unmap_end = iova + num_entries * size;
+
+	while (blk_start < blk_end) {
 		arm_lpae_iopte *tablep;
+		size_t count, mapped = 0;
 
 		/* Unmap! */
-		if (blk_start == iova)
+		if (blk_start == iova) {
+			blk_paddr += unmap_end - iova;
+			blk_start = unmap_end;
 			continue;
+		}
+
+		count = ((blk_start < iova ? iova : blk_end) - blk_start) / size;
 
 		/* __arm_lpae_map expects a pointer to the start of the table */
 		tablep = &table - ARM_LPAE_LVL_IDX(blk_start, lvl, data);
-		if (__arm_lpae_map(data, blk_start, blk_paddr, size, prot, lvl,
-				   tablep) < 0) {
+		if (__arm_lpae_map(data, blk_start, blk_paddr, size, count,
+				   prot, lvl, tablep, &mapped) < 0) {
 			if (table) {
 				/* Free the table we allocated */
 				tablep = iopte_deref(table, data);
@@ -481,77 +554,132 @@ static int arm_lpae_split_blk_unmap(struct arm_lpae_io_pgtable *data,
 			}
 			return 0; /* Bytes unmapped */
 		}
+
+		blk_start += mapped;
+		blk_paddr += mapped;
 	}
 
 	__arm_lpae_set_pte(ptep, table, &data->iop.cfg);
 	iova &= ~(blk_size - 1);
 	io_pgtable_tlb_add_flush(&data->iop, iova, blk_size, blk_size, true);
-	return size;
+	return num_entries * size;
 }
 
-static int __arm_lpae_unmap(struct arm_lpae_io_pgtable *data,
-			    unsigned long iova, size_t size, int lvl,
-			    arm_lpae_iopte *ptep)
+/*
+ * Unmap up to pgcount pages of the given size, stopping at the end of the
+ * table that holds them. The leaf entries cleared are synchronised and
+ * queued for invalidation as one range rather than one page at a time.
+ */
+static size_t __arm_lpae_unmap(struct arm_lpae_io_pgtable *data,
+			       unsigned long iova, size_t size, size_t pgcount,
+			       int lvl, arm_lpae_iopte *ptep)
 {
 	arm_lpae_iopte pte;
 	struct io_pgtable *iop = &data->iop;
 	size_t blk_size = ARM_LPAE_BLOCK_SIZE(lvl, data);
+	int unmap_idx;
 
 	/* Something went horribly wrong and we ran out of page table */
 	if (WARN_ON(lvl == ARM_LPAE_MAX_LEVELS))
 		return 0;
 
-	ptep += ARM_LPAE_LVL_IDX(iova, lvl, data);
+	unmap_idx = ARM_LPAE_LVL_IDX(iova, lvl, data);
+	ptep += unmap_idx;
 	pte = *ptep;
 	if (WARN_ON(!pte))
 		return 0;
 
 	/* If the size matches this level, we're in the right place */
 	if (size == blk_size) {
-		__arm_lpae_set_pte(ptep, 0, &iop->cfg);
+		size_t i, num_entries;
+		bool leaves = false;
+
+		num_entries = min_t(size_t, pgcount,
+				    ARM_LPAE_PTES_PER_TABLE(lvl, data) -
+				    unmap_idx);
+
+		for (i = 0; i < num_entries; i++) {
+			pte = ptep[i];
+			if (WARN_ON(!pte))
+				break;
+
+			if (iopte_leaf(pte, lvl)) {
+				ptep[i] = 0;
+				leaves = true;
+				continue;
+			}
+
+			__arm_lpae_set_pte(&ptep[i], 0, &iop->cfg);
 
-		if (!iopte_leaf(pte, lvl)) {
 			/* Also flush any partial walks */
-			io_pgtable_tlb_add_flush(iop, iova, size,
-						ARM_LPAE_GRANULE(data), false);
+			io_pgtable_tlb_add_flush(iop, iova + i * size, size,
+						 ARM_LPAE_GRANULE(data), false);
 			io_pgtable_tlb_sync(iop);
-			ptep = iopte_deref(pte, data);
-			__arm_lpae_free_pgtable(data, lvl + 1, ptep);
+			__arm_lpae_free_pgtable(data, lvl + 1,
+						iopte_deref(pte, data));
+		}
+
+		if (!i)
+			return 0;
+
+		__arm_lpae_sync_pte(ptep, i, &iop->cfg);
+
+		if (!leaves)
+			return i * size;
+
+		if (iop->cfg.quirks & IO_PGTABLE_QUIRK_NON_STRICT) {
+			/*
+			 * Order the PTE update against queueing the IOVA, so
+			 * that the walker sees the PTE cleared by the time
+			 * the TLB is flushed.
+			 */
+			smp_wmb();
 		} else {
-			io_pgtable_tlb_add_flush(iop, iova, size, size, true);
+			io_pgtable_tlb_add_flush(iop, iova, i * size, size,
+						 true);
 		}
 
-		return size;
+		return i * size;
 	} else if (iopte_leaf(pte, lvl)) {
 		/*
 		 * Insert a table at the next level to map the old region,
 		 * minus the part we want to unmap
 		 */
-		return arm_lpae_split_blk_unmap(data, iova, size,
+		return arm_lpae_split_blk_unmap(data, iova, size, pgcount,
 						iopte_prot(pte), lvl, ptep,
 						blk_size);
 	}
 
 	/* Keep on walkin' */
 	ptep = iopte_deref(pte, data);
-	return __arm_lpae_unmap(data, iova, size, lvl + 1, ptep);
+	return __arm_lpae_unmap(data, iova, size, pgcount, lvl + 1, ptep);
 }
 
-static int arm_lpae_unmap(struct io_pgtable_ops *ops, unsigned long iova,
-			  size_t size)
+static size_t arm_lpae_unmap_pages(struct io_pgtable_ops *ops,
+				   unsigned long iova, size_t pgsize,
+				   size_t pgcount)
 {
 	size_t unmapped;
 	struct arm_lpae_io_pgtable *data = io_pgtable_ops_to_data(ops);
 	arm_lpae_iopte *ptep = data->pgd;
 	int lvl = ARM_LPAE_START_LVL(data);
 
-	unmapped = __arm_lpae_unmap(data, iova, size, lvl, ptep);
-	if (unmapped)
+	if (WARN_ON(!pgcount))
+		return 0;
+
+	unmapped = __arm_lpae_unmap(data, iova, pgsize, pgcount, lvl, ptep);
+	if (unmapped && !(data->iop.cfg.quirks & IO_PGTABLE_QUIRK_NON_STRICT))
 		io_pgtable_tlb_sync(&data->iop);
 
 	return unmapped;
 }
 
+static int arm_lpae_unmap(struct io_pgtable_ops *ops, unsigned long iova,
+			  size_t size)
+{
+	return arm_lpae_unmap_pages(ops, iova, size, 1);
+}
+
 static phys_addr_t arm_lpae_iova_to_phys(struct io_pgtable_ops *ops,
 					 unsigned long iova)
 {
@@ -660,7 +788,9 @@ arm_lpae_alloc_pgtable(struct io_pgtable_cfg *cfg)
 
 	data->iop.ops = (struct io_pgtable_ops) {
 		.map		= arm_lpae_map,
+		.map_pages	= arm_lpae_map_pages,
 		.unmap		= arm_lpae_unmap,
+		.unmap_pages	= arm_lpae_unmap_pages,
 		.iova_to_phys	= arm_lpae_iova_to_phys,
 	};
 
@@ -673,7 +803,8 @@ arm_64_lpae_alloc_pgtable_s1(struct io_pgtable_cfg *cfg, void *cookie)
 	u64 reg;
 	struct arm_lpae_io_pgtable *data;
 
-	if (cfg->quirks & ~IO_PGTABLE_QUIRK_ARM_NS)
+	if (cfg->quirks & ~(IO_PGTABLE_QUIRK_ARM_NS |
+			    IO_PGTABLE_QUIRK_NON_STRICT))
 		return NULL;
 
 	data = arm_lpae_alloc_pgtable(cfg);
@@ -762,7 +893,7 @@ arm_64_lpae_alloc_pgtable_s2(struct io_pgtable_cfg *cfg, void *cookie)
 	struct arm_lpae_io_pgtable *data;
 
 	/* The NS quirk doesn't apply at stage 2 */
-	if (cfg->quirks)
+	if (cfg->quirks & ~IO_PGTABLE_QUIRK_NON_STRICT)
 		return NULL;
 
 	data = arm_lpae_alloc_pgtable(cfg);
@@ -957,7 +1088,7 @@ static int __init arm_lpae_run_tests(struct io_pgtable_cfg *cfg)
 
 	int i, j;
 	unsigned long iova;
-	size_t size;
+	size_t size, mapped;
 	struct io_pgtable_ops *ops;
 
 	selftest_running = true;
@@ -1043,6 +1174,29 @@ static int __init arm_lpae_run_tests(struct io_pgtable_cfg *cfg)
 			j = find_next_bit(&cfg->pgsize_bitmap, BITS_PER_LONG, j);
 		}
 
+		/* Runs of pages in one call */
+		size = 1UL << __ffs(cfg->pgsize_bitmap);
+		mapped = 0;
+		if (ops->map_pages(ops, iova, iova, size, 16, IOMMU_READ,
+				   &mapped) || mapped != 16 * size)
+			return __FAIL(ops, i);
+
+		if (ops->iova_to_phys(ops, iova + 15 * size + 42) !=
+		    (iova + 15 * size + 42))
+			return __FAIL(ops, i);
+
+		/* Partial unmap of a run */
+		if (ops->unmap_pages(ops, iova + size, size, 14) != 14 * size)
+			return __FAIL(ops, i);
+
+		if (ops->iova_to_phys(ops, iova + size + 42))
+			return __FAIL(ops, i);
+
+		if (ops->iova_to_phys(ops, iova + 42) != (iova + 42) ||
+		    ops->iova_to_phys(ops, iova + 15 * size + 42) !=
+		    (iova + 15 * size + 42))
+			return __FAIL(ops, i);
+
 		free_io_pgtable_ops(ops);
 	}
 
@@ -21,6 +21,7 @@
 #include <linux/cpu.h>
 #include <linux/delay.h>
 #include <linux/dma-iommu.h>
+#include <linux/idr.h>
 #include <linux/interrupt.h>
 #include <linux/irqdomain.h>
 #include <linux/log2.h>
@@ -36,6 +37,7 @@
 
 #include <linux/irqchip.h>
 #include <linux/irqchip/arm-gic-v3.h>
+#include <linux/irqchip/arm-gic-v4.h>
 
 #include <asm/cputype.h>
 #include <asm/exception.h>
@@ -88,6 +90,8 @@ struct its_node {
 	u32			ite_size;
 	u32			device_ids;
 	int			numa_node;
+	bool			is_v4;
+	struct irq_affinity_flush affinity_flush;
 };
 
 #define ITS_ITT_ALIGN		SZ_256
@@ -95,11 +99,31 @@ struct its_node {
 /* Convert page order to size in bytes */
 #define PAGE_ORDER_TO_SIZE(o)	(PAGE_SIZE << (o))
 
+/*
+ * We allocate 64kB for PROPBASE. That gives us at most 64K LPIs to
+ * deal with (one configuration byte per interrupt). PENDBASE has to
+ * be 64kB aligned (one bit per LPI, plus 8192 bits for SPI/PPI/SGI).
+ */
+#define LPI_PROPBASE_SZ		SZ_64K
+#define LPI_PENDBASE_SZ		(LPI_PROPBASE_SZ / 8 + SZ_1K)
+
+/*
+ * This is how many bits of ID we need, including the useless ones.
+ */
+#define LPI_NRBITS		ilog2(LPI_PROPBASE_SZ + SZ_8K)
+
+#define LPI_PROP_DEFAULT_PRIO	0xa0
+
 struct event_lpi_map {
 	unsigned long		*lpi_map;
 	u16			*col_map;
+	unsigned long		*movi_map;	/* MOVIs to send on flush */
 	irq_hw_number_t		lpi_base;
 	int			nr_lpis;
+	raw_spinlock_t		vlpi_lock;
+	struct its_vm		*vm;
+	struct its_vlpi_map	*vlpi_maps;
+	int			nr_vlpis;
 };
 
 /*
@@ -115,13 +139,32 @@ struct its_device {
 	u32			device_id;
 };
 
+/*
+ * The ITSList is only used by VMOVP, for the v4 ITSs that need to be
+ * told about a vPE move individually. An ITS that implements single
+ * VMOVP (GITS_TYPER.VMOVP) doesn't take part in it.
+ */
+#define GICv4_ITS_LIST_MAX		16
+
+/* vPE IDs are 16bit wide, and shared by all the v4 ITSs */
+#define ITS_MAX_VPEID_BITS		16
+#define ITS_MAX_VPEID			(1 << ITS_MAX_VPEID_BITS)
+
 static LIST_HEAD(its_nodes);
 static DEFINE_SPINLOCK(its_lock);
 static struct rdists *gic_rdists;
 static struct irq_domain *its_parent;
 
+static unsigned long its_list_map;
+static u32 its_nr_vpeids = ITS_MAX_VPEID;
+static u16 vmovp_seq_num;
+static DEFINE_RAW_SPINLOCK(vmovp_lock);
+
+static DEFINE_IDA(its_vpeid_ida);
+
 #define gic_data_rdist()		(raw_cpu_ptr(gic_rdists->rdist))
 #define gic_data_rdist_rd_base()	(gic_data_rdist()->rd_base)
+#define gic_data_rdist_vlpi_base()	(gic_data_rdist_rd_base() + SZ_128K)
 
 static struct its_collection *dev_event_to_col(struct its_device *its_dev,
 					       u32 event)
@@ -131,6 +174,12 @@ static struct its_collection *dev_event_to_col(struct its_device *its_dev,
 	return its->collections + its_dev->event_map.col_map[event];
 }
 
+static struct its_vlpi_map *dev_event_to_vlpi_map(struct its_device *its_dev,
+						  u32 event)
+{
+	return its_dev->event_map.vlpi_maps + event;
+}
+
 /*
  * ITS command descriptors - parameters to be encoded in a command
  * block.
@@ -147,6 +196,11 @@ struct its_cmd_desc {
 			u32 event_id;
 		} its_int_cmd;
 
+		struct {
+			struct its_device *dev;
+			u32 event_id;
+		} its_clear_cmd;
+
 		struct {
 			struct its_device *dev;
 			int valid;
@@ -177,6 +231,38 @@ struct its_cmd_desc {
 		struct {
 			struct its_collection *col;
 		} its_invall_cmd;
+
+		struct {
+			struct its_vpe *vpe;
+		} its_vinvall_cmd;
+
+		struct {
+			struct its_vpe *vpe;
+			struct its_collection *col;
+			bool valid;
+		} its_vmapp_cmd;
+
+		struct {
+			struct its_vpe *vpe;
+			struct its_device *dev;
+			u32 virt_id;
+			u32 event_id;
+			bool db_enabled;
+		} its_vmapti_cmd;
+
+		struct {
+			struct its_vpe *vpe;
+			struct its_device *dev;
+			u32 event_id;
+			bool db_enabled;
+		} its_vmovi_cmd;
+
+		struct {
+			struct its_vpe *vpe;
+			struct its_collection *col;
+			u16 seq_num;
+			u16 its_list;
+		} its_vmovp_cmd;
 	};
 };
 
@@ -193,6 +279,9 @@ struct its_cmd_block {
 typedef struct its_collection *(*its_cmd_builder_t)(struct its_cmd_block *,
 						    struct its_cmd_desc *);
 
+typedef struct its_vpe *(*its_cmd_vbuilder_t)(struct its_cmd_block *,
+					      struct its_cmd_desc *);
+
 static void its_mask_encode(u64 *raw_cmd, u64 val, int h, int l)
 {
 	u64 mask = GENMASK_ULL(h, l);
@@ -245,6 +334,46 @@ static void its_encode_collection(struct its_cmd_block *cmd, u16 col)
 	its_mask_encode(&cmd->raw_cmd[2], col, 15, 0);
 }
 
+static void its_encode_vpeid(struct its_cmd_block *cmd, u16 vpeid)
+{
+	its_mask_encode(&cmd->raw_cmd[1], vpeid, 47, 32);
+}
+
+static void its_encode_virt_id(struct its_cmd_block *cmd, u32 virt_id)
+{
+	its_mask_encode(&cmd->raw_cmd[2], virt_id, 31, 0);
+}
+
+static void its_encode_db_phys_id(struct its_cmd_block *cmd, u32 db_phys_id)
+{
+	its_mask_encode(&cmd->raw_cmd[2], db_phys_id, 63, 32);
+}
+
+static void its_encode_db_valid(struct its_cmd_block *cmd, bool db_valid)
+{
+	its_mask_encode(&cmd->raw_cmd[2], db_valid, 0, 0);
+}
+
+static void its_encode_seq_num(struct its_cmd_block *cmd, u16 seq_num)
+{
+	its_mask_encode(&cmd->raw_cmd[0], seq_num, 47, 32);
+}
+
+static void its_encode_its_list(struct its_cmd_block *cmd, u16 its_list)
+{
+	its_mask_encode(&cmd->raw_cmd[1], its_list, 15, 0);
+}
+
+static void its_encode_vpt_addr(struct its_cmd_block *cmd, u64 vpt_pa)
+{
+	its_mask_encode(&cmd->raw_cmd[3], vpt_pa >> 16, 50, 16);
+}
+
+static void its_encode_vpt_size(struct its_cmd_block *cmd, u8 vpt_size)
+{
+	its_mask_encode(&cmd->raw_cmd[3], vpt_size, 4, 0);
+}
+
 static inline void its_fixup_cmd(struct its_cmd_block *cmd)
 {
 	/* Let's fixup BE commands */
@@ -358,6 +487,40 @@ static struct its_collection *its_build_inv_cmd(struct its_cmd_block *cmd,
 	return col;
 }
 
+static struct its_collection *its_build_int_cmd(struct its_cmd_block *cmd,
+						struct its_cmd_desc *desc)
+{
+	struct its_collection *col;
+
+	col = dev_event_to_col(desc->its_int_cmd.dev,
+			       desc->its_int_cmd.event_id);
+
+	its_encode_cmd(cmd, GITS_CMD_INT);
+	its_encode_devid(cmd, desc->its_int_cmd.dev->device_id);
+	its_encode_event_id(cmd, desc->its_int_cmd.event_id);
+
+	its_fixup_cmd(cmd);
+
+	return col;
+}
+
+static struct its_collection *its_build_clear_cmd(struct its_cmd_block *cmd,
+						  struct its_cmd_desc *desc)
+{
+	struct its_collection *col;
+
+	col = dev_event_to_col(desc->its_clear_cmd.dev,
+			       desc->its_clear_cmd.event_id);
+
+	its_encode_cmd(cmd, GITS_CMD_CLEAR);
+	its_encode_devid(cmd, desc->its_clear_cmd.dev->device_id);
+	its_encode_event_id(cmd, desc->its_clear_cmd.event_id);
+
+	its_fixup_cmd(cmd);
+
+	return col;
+}
+
 static struct its_collection *its_build_invall_cmd(struct its_cmd_block *cmd,
 						   struct its_cmd_desc *desc)
 {
@@ -369,6 +532,151 @@ static struct its_collection *its_build_invall_cmd(struct its_cmd_block *cmd,
 	return NULL;
 }
 
+static struct its_vpe *its_build_vinvall_cmd(struct its_cmd_block *cmd,
+					     struct its_cmd_desc *desc)
+{
+	its_encode_cmd(cmd, GITS_CMD_VINVALL);
+	its_encode_vpeid(cmd, desc->its_vinvall_cmd.vpe->vpe_id);
+
+	its_fixup_cmd(cmd);
+
+	return desc->its_vinvall_cmd.vpe;
+}
+
+static struct its_vpe *its_build_vmapp_cmd(struct its_cmd_block *cmd,
+					   struct its_cmd_desc *desc)
+{
+	unsigned long vpt_addr;
+
+	vpt_addr = virt_to_phys(page_address(desc->its_vmapp_cmd.vpe->vpt_page));
+
+	its_encode_cmd(cmd, GITS_CMD_VMAPP);
+	its_encode_vpeid(cmd, desc->its_vmapp_cmd.vpe->vpe_id);
+	its_encode_valid(cmd, desc->its_vmapp_cmd.valid);
+	its_encode_target(cmd, desc->its_vmapp_cmd.col->target_address);
+	its_encode_vpt_addr(cmd, vpt_addr);
+	its_encode_vpt_size(cmd, LPI_NRBITS - 1);
+
+	its_fixup_cmd(cmd);
+
+	return desc->its_vmapp_cmd.vpe;
+}
+
+static struct its_vpe *its_build_vmapti_cmd(struct its_cmd_block *cmd,
+					    struct its_cmd_desc *desc)
+{
+	u32 db;
+
+	/* INTID 1023 tells the ITS not to generate any doorbell */
+	if (desc->its_vmapti_cmd.db_enabled)
+		db = desc->its_vmapti_cmd.vpe->vpe_db_lpi;
+	else
+		db = 1023;
+
+	its_encode_cmd(cmd, GITS_CMD_VMAPTI);
+	its_encode_devid(cmd, desc->its_vmapti_cmd.dev->device_id);
+	its_encode_vpeid(cmd, desc->its_vmapti_cmd.vpe->vpe_id);
+	its_encode_event_id(cmd, desc->its_vmapti_cmd.event_id);
+	its_encode_db_phys_id(cmd, db);
+	its_encode_virt_id(cmd, desc->its_vmapti_cmd.virt_id);
+
+	its_fixup_cmd(cmd);
+
+	return desc->its_vmapti_cmd.vpe;
+}
+
+static struct its_vpe *its_build_vmovi_cmd(struct its_cmd_block *cmd,
+					   struct its_cmd_desc *desc)
+{
+	u32 db;
+
+	if (desc->its_vmovi_cmd.db_enabled)
+		db = desc->its_vmovi_cmd.vpe->vpe_db_lpi;
+	else
+		db = 1023;
+
+	its_encode_cmd(cmd, GITS_CMD_VMOVI);
+	its_encode_devid(cmd, desc->its_vmovi_cmd.dev->device_id);
+	its_encode_vpeid(cmd, desc->its_vmovi_cmd.vpe->vpe_id);
+	its_encode_event_id(cmd, desc->its_vmovi_cmd.event_id);
+	its_encode_db_phys_id(cmd, db);
+	its_encode_db_valid(cmd, true);
+
+	its_fixup_cmd(cmd);
+
+	return desc->its_vmovi_cmd.vpe;
+}
+
+static struct its_vpe *its_build_vmovp_cmd(struct its_cmd_block *cmd,
+					   struct its_cmd_desc *desc)
+{
+	its_encode_cmd(cmd, GITS_CMD_VMOVP);
+	its_encode_seq_num(cmd, desc->its_vmovp_cmd.seq_num);
+	its_encode_its_list(cmd, desc->its_vmovp_cmd.its_list);
+	its_encode_vpeid(cmd, desc->its_vmovp_cmd.vpe->vpe_id);
+	its_encode_target(cmd, desc->its_vmovp_cmd.col->target_address);
+
+	its_fixup_cmd(cmd);
+
+	return desc->its_vmovp_cmd.vpe;
+}
+
+/*
+ * INV, INT and CLEAR work the same on a vLPI as on a physical LPI, but
+ * have to be followed by a VSYNC on the vPE rather than by a SYNC on
+ * the collection the event used to be mapped to.
+ */
+static struct its_vpe *its_build_vinv_cmd(struct its_cmd_block *cmd,
+					  struct its_cmd_desc *desc)
+{
+	struct its_vlpi_map *map;
+
+	map = dev_event_to_vlpi_map(desc->its_inv_cmd.dev,
+				    desc->its_inv_cmd.event_id);
+
+	its_encode_cmd(cmd, GITS_CMD_INV);
+	its_encode_devid(cmd, desc->its_inv_cmd.dev->device_id);
+	its_encode_event_id(cmd, desc->its_inv_cmd.event_id);
+
+	its_fixup_cmd(cmd);
+
+	return map->vpe;
+}
+
+static struct its_vpe *its_build_vint_cmd(struct its_cmd_block *cmd,
+					  struct its_cmd_desc *desc)
+{
+	struct its_vlpi_map *map;
+
+	map = dev_event_to_vlpi_map(desc->its_int_cmd.dev,
+				    desc->its_int_cmd.event_id);
+
+	its_encode_cmd(cmd, GITS_CMD_INT);
+	its_encode_devid(cmd, desc->its_int_cmd.dev->device_id);
+	its_encode_event_id(cmd, desc->its_int_cmd.event_id);
+
+	its_fixup_cmd(cmd);
+
+	return map->vpe;
+}
+
+static struct its_vpe *its_build_vclear_cmd(struct its_cmd_block *cmd,
+					    struct its_cmd_desc *desc)
+{
+	struct its_vlpi_map *map;
+
+	map = dev_event_to_vlpi_map(desc->its_clear_cmd.dev,
+				    desc->its_clear_cmd.event_id);
+
+	its_encode_cmd(cmd, GITS_CMD_CLEAR);
+	its_encode_devid(cmd, desc->its_clear_cmd.dev->device_id);
+	its_encode_event_id(cmd, desc->its_clear_cmd.event_id);
+
+	its_fixup_cmd(cmd);
+
+	return map->vpe;
+}
+
 static u64 its_cmd_ptr_to_offset(struct its_node *its,
 				 struct its_cmd_block *ptr)
 {
@@ -466,52 +774,221 @@ static void its_wait_for_range_completion(struct its_node *its,
 	}
 }
 
-static void its_send_single_command(struct its_node *its,
-				    its_cmd_builder_t builder,
-				    struct its_cmd_desc *desc)
+static void its_build_sync_cmd(struct its_cmd_block *sync_cmd,
+			       struct its_collection *sync_col)
 {
-	struct its_cmd_block *cmd, *sync_cmd, *next_cmd;
-	struct its_collection *sync_col;
-	unsigned long flags;
+	its_encode_cmd(sync_cmd, GITS_CMD_SYNC);
+	its_encode_target(sync_cmd, sync_col->target_address);
 
-	raw_spin_lock_irqsave(&its->lock, flags);
+	its_fixup_cmd(sync_cmd);
+}
 
-	cmd = its_allocate_entry(its);
+static void its_build_vsync_cmd(struct its_cmd_block *sync_cmd,
+				struct its_vpe *sync_vpe)
+{
+	its_encode_cmd(sync_cmd, GITS_CMD_VSYNC);
+	its_encode_vpeid(sync_cmd, sync_vpe->vpe_id);
+
+	its_fixup_cmd(sync_cmd);
+}
+
+/*
+ * A batch queues several commands under a single hold of the ITS lock,
+ * and only waits once for all of them. Each command still gets the
+ * synchronisation its builder asked for (a SYNC on a collection for
+ * physical commands, a VSYNC on a vPE for the virtual ones), but
+ * consecutive commands on the same collection or vPE share it.
+ *
+ * The commands are only posted to the ITS when the batch is finished,
+ * or when the queue is full.
+ */
+struct its_cmd_batch {
+	struct its_node		*its;
+	struct its_cmd_block	*last;
+	struct its_collection	*sync_col;
+	struct its_vpe		*sync_vpe;
+	unsigned long		flags;
+};
+
+static void its_batch_start(struct its_node *its, struct its_cmd_batch *batch)
+{
+	batch->its = its;
+	batch->last = NULL;
+	batch->sync_col = NULL;
+	batch->sync_vpe = NULL;
+
+	raw_spin_lock_irqsave(&its->lock, batch->flags);
+}
+
+static struct its_cmd_block *its_batch_alloc(struct its_cmd_batch *batch)
+{
+	struct its_cmd_block *cmd;
+
+	/* Let the ITS drain the commands queued so far */
+	if (its_queue_full(batch->its))
+		its_post_commands(batch->its);
+
+	cmd = its_allocate_entry(batch->its);
+	if (cmd)
+		batch->last = cmd;
+
+	return cmd;
+}
+
+static void its_batch_sync(struct its_cmd_batch *batch)
+{
+	struct its_cmd_block *sync_cmd;
+
+	if (!batch->sync_col)
+		return;
+
+	sync_cmd = its_batch_alloc(batch);
+	if (sync_cmd) {
+		its_build_sync_cmd(sync_cmd, batch->sync_col);
+		its_flush_cmd(batch->its, sync_cmd);
+	} else {
+		pr_err_ratelimited("ITS can't SYNC, skipping\n");
+	}
+
+	batch->sync_col = NULL;
+}
+
+static void its_batch_vsync(struct its_cmd_batch *batch)
+{
+	struct its_cmd_block *sync_cmd;
+
+	if (!batch->sync_vpe)
+		return;
+
+	sync_cmd = its_batch_alloc(batch);
+	if (sync_cmd) {
+		its_build_vsync_cmd(sync_cmd, batch->sync_vpe);
+		its_flush_cmd(batch->its, sync_cmd);
+	} else {
+		pr_err_ratelimited("ITS can't VSYNC, skipping\n");
+	}
+
+	batch->sync_vpe = NULL;
+}
+
+static void its_batch_command(struct its_cmd_batch *batch,
+			      its_cmd_builder_t builder,
+			      struct its_cmd_desc *desc)
+{
+	struct its_collection *sync_col;
+	struct its_cmd_block *cmd;
+
+	cmd = its_batch_alloc(batch);
 	if (!cmd) {		/* We're soooooo screewed... */
 		pr_err_ratelimited("ITS can't allocate, dropping command\n");
-		raw_spin_unlock_irqrestore(&its->lock, flags);
 		return;
 	}
+
 	sync_col = builder(cmd, desc);
-	its_flush_cmd(its, cmd);
+	its_flush_cmd(batch->its, cmd);
 
-	if (sync_col) {
-		sync_cmd = its_allocate_entry(its);
-		if (!sync_cmd) {
-			pr_err_ratelimited("ITS can't SYNC, skipping\n");
-			goto post;
-		}
-		its_encode_cmd(sync_cmd, GITS_CMD_SYNC);
-		its_encode_target(sync_cmd, sync_col->target_address);
-		its_fixup_cmd(sync_cmd);
-		its_flush_cmd(its, sync_cmd);
+	if (sync_col && sync_col != batch->sync_col) {
+		its_batch_sync(batch);
+		batch->sync_col = sync_col;
+	}
+}
+
+static void its_batch_vcommand(struct its_cmd_batch *batch,
+			       its_cmd_vbuilder_t builder,
+			       struct its_cmd_desc *desc)
+{
+	struct its_cmd_block *cmd;
+	struct its_vpe *sync_vpe;
+
+	cmd = its_batch_alloc(batch);
+	if (!cmd) {
+		pr_err_ratelimited("ITS can't allocate, dropping command\n");
+		return;
 	}
 
-post:
+	sync_vpe = builder(cmd, desc);
+	its_flush_cmd(batch->its, cmd);
+
+	if (sync_vpe && sync_vpe != batch->sync_vpe) {
+		its_batch_vsync(batch);
+		batch->sync_vpe = sync_vpe;
+	}
+}
+
+/*
+ * Post the batch, and wait for its last command to complete: as the
+ * ITS processes commands in order, the whole batch then has.
+ */
+static void its_batch_finish(struct its_cmd_batch *batch)
+{
+	struct its_node *its = batch->its;
+	struct its_cmd_block *next_cmd;
+
+	its_batch_sync(batch);
+	its_batch_vsync(batch);
+
 	next_cmd = its_post_commands(its);
-	raw_spin_unlock_irqrestore(&its->lock, flags);
+	raw_spin_unlock_irqrestore(&its->lock, batch->flags);
+
+	if (batch->last)
+		its_wait_for_range_completion(its, batch->last, next_cmd);
+}
 
-	its_wait_for_range_completion(its, cmd, next_cmd);
+static void its_send_single_command(struct its_node *its,
+				    its_cmd_builder_t builder,
+				    struct its_cmd_desc *desc)
+{
+	struct its_cmd_batch batch;
+
+	its_batch_start(its, &batch);
+	its_batch_command(&batch, builder, desc);
+	its_batch_finish(&batch);
+}
+
+static void its_send_single_vcommand(struct its_node *its,
+				     its_cmd_vbuilder_t builder,
+				     struct its_cmd_desc *desc)
+{
+	struct its_cmd_batch batch;
+
+	its_batch_start(its, &batch);
+	its_batch_vcommand(&batch, builder, desc);
+	its_batch_finish(&batch);
+}
+
+/*
+ * The senders taking a batch queue their command on it, or send it on
+ * its own if @batch is NULL.
+ */
+static void its_send_command(struct its_node *its, struct its_cmd_batch *batch,
+			     its_cmd_builder_t builder,
+			     struct its_cmd_desc *desc)
+{
+	if (batch)
+		its_batch_command(batch, builder, desc);
+	else
+		its_send_single_command(its, builder, desc);
+}
+
+static void its_send_vcommand(struct its_node *its, struct its_cmd_batch *batch,
+			      its_cmd_vbuilder_t builder,
+			      struct its_cmd_desc *desc)
+{
+	if (batch)
+		its_batch_vcommand(batch, builder, desc);
+	else
+		its_send_single_vcommand(its, builder, desc);
 }
 
-static void its_send_inv(struct its_device *dev, u32 event_id)
+static void its_send_inv(struct its_cmd_batch *batch, struct its_device *dev,
+			 u32 event_id)
 {
 	struct its_cmd_desc desc;
 
 	desc.its_inv_cmd.dev = dev;
 	desc.its_inv_cmd.event_id = event_id;
 
-	its_send_single_command(dev->its, its_build_inv_cmd, &desc);
+	its_send_command(dev->its, batch, its_build_inv_cmd, &desc);
 }
 
 static void its_send_mapd(struct its_device *dev, int valid)
@@ -524,18 +1001,19 @@ static void its_send_mapd(struct its_device *dev, int valid)
 	its_send_single_command(dev->its, its_build_mapd_cmd, &desc);
 }
 
-static void its_send_mapc(struct its_node *its, struct its_collection *col,
-			  int valid)
+static void its_send_mapc(struct its_cmd_batch *batch, struct its_node *its,
+			  struct its_collection *col, int valid)
 {
 	struct its_cmd_desc desc;
 
 	desc.its_mapc_cmd.col = col;
 	desc.its_mapc_cmd.valid = !!valid;
 
-	its_send_single_command(its, its_build_mapc_cmd, &desc);
+	its_send_command(its, batch, its_build_mapc_cmd, &desc);
 }
 
-static void its_send_mapti(struct its_device *dev, u32 irq_id, u32 id)
+static void its_send_mapti(struct its_cmd_batch *batch, struct its_device *dev,
+			   u32 irq_id, u32 id)
 {
 	struct its_cmd_desc desc;
 
@@ -543,7 +1021,7 @@ static void its_send_mapti(struct its_device *dev, u32 irq_id, u32 id)
 	desc.its_mapti_cmd.phys_id = irq_id;
 	desc.its_mapti_cmd.event_id = id;
 
-	its_send_single_command(dev->its, its_build_mapti_cmd, &desc);
+	its_send_command(dev->its, batch, its_build_mapti_cmd, &desc);
 }
 
 static void its_send_movi(struct its_device *dev,
@@ -558,23 +1036,174 @@ static void its_send_movi(struct its_device *dev,
 	its_send_single_command(dev->its, its_build_movi_cmd, &desc);
 }
 
-static void its_send_discard(struct its_device *dev, u32 id)
+static void its_send_discard(struct its_cmd_batch *batch,
+			     struct its_device *dev, u32 id)
 {
 	struct its_cmd_desc desc;
 
 	desc.its_discard_cmd.dev = dev;
 	desc.its_discard_cmd.event_id = id;
 
-	its_send_single_command(dev->its, its_build_discard_cmd, &desc);
+	its_send_command(dev->its, batch, its_build_discard_cmd, &desc);
 }
 
-static void its_send_invall(struct its_node *its, struct its_collection *col)
+static void its_send_int(struct its_device *dev, u32 event_id)
+{
+	struct its_cmd_desc desc;
+
+	desc.its_int_cmd.dev = dev;
+	desc.its_int_cmd.event_id = event_id;
+
+	its_send_single_command(dev->its, its_build_int_cmd, &desc);
+}
+
+static void its_send_clear(struct its_device *dev, u32 event_id)
+{
+	struct its_cmd_desc desc;
+
+	desc.its_clear_cmd.dev = dev;
+	desc.its_clear_cmd.event_id = event_id;
+
+	its_send_single_command(dev->its, its_build_clear_cmd, &desc);
+}
+
+static void its_send_invall(struct its_cmd_batch *batch, struct its_node *its,
+			    struct its_collection *col)
 {
 	struct its_cmd_desc desc;
 
 	desc.its_invall_cmd.col = col;
 
-	its_send_single_command(its, its_build_invall_cmd, &desc);
+	its_send_command(its, batch, its_build_invall_cmd, &desc);
+}
+
+static void its_send_vmapti(struct its_cmd_batch *batch,
+			    struct its_device *dev, u32 id)
+{
+	struct its_vlpi_map *map = dev_event_to_vlpi_map(dev, id);
+	struct its_cmd_desc desc;
+
+	desc.its_vmapti_cmd.vpe = map->vpe;
+	desc.its_vmapti_cmd.dev = dev;
+	desc.its_vmapti_cmd.virt_id = map->vintid;
+	desc.its_vmapti_cmd.event_id = id;
+	desc.its_vmapti_cmd.db_enabled = map->db_enabled;
+
+	its_send_vcommand(dev->its, batch, its_build_vmapti_cmd, &desc);
+}
+
+static void its_send_vmovi(struct its_cmd_batch *batch,
+			   struct its_device *dev, u32 id)
+{
+	struct its_vlpi_map *map = dev_event_to_vlpi_map(dev, id);
+	struct its_cmd_desc desc;
+
+	desc.its_vmovi_cmd.vpe = map->vpe;
+	desc.its_vmovi_cmd.dev = dev;
+	desc.its_vmovi_cmd.event_id = id;
+	desc.its_vmovi_cmd.db_enabled = map->db_enabled;
+
+	its_send_vcommand(dev->its, batch, its_build_vmovi_cmd, &desc);
+}
+
+static void its_send_vmapp(struct its_cmd_batch *batch, struct its_node *its,
+			   struct its_vpe *vpe, bool valid)
+{
+	struct its_cmd_desc desc;
+
+	desc.its_vmapp_cmd.vpe = vpe;
+	desc.its_vmapp_cmd.valid = valid;
+	desc.its_vmapp_cmd.col = &its->collections[vpe->col_idx];
+
+	its_send_vcommand(its, batch, its_build_vmapp_cmd, &desc);
+}
+
+static void its_send_vmovp(struct its_vpe *vpe)
+{
+	struct its_cmd_desc desc;
+	struct its_node *its;
+	unsigned long flags;
+	int col_id = vpe->col_idx;
+
+	desc.its_vmovp_cmd.vpe = vpe;
+	desc.its_vmovp_cmd.its_list = (u16)its_list_map;
+
+	if (!its_list_map) {
+		/*
+		 * All the v4 ITSs implement single VMOVP, and will
+		 * propagate the move between themselves. Any of them
+		 * will do.
+		 */
+		list_for_each_entry(its, &its_nodes, entry) {
+			if (!its->is_v4)
+				continue;
+
+			desc.its_vmovp_cmd.seq_num = 0;
+			desc.its_vmovp_cmd.col = &its->collections[col_id];
+			its_send_single_vcommand(its, its_build_vmovp_cmd, &desc);
+			return;
+		}
+	}
+
+	/*
+	 * Using the ITSList, every ITS must receive every VMOVP command,
+	 * and all in the same order. The only way to guarantee this is
+	 * to make VMOVP a serialisation point.
+	 */
+	raw_spin_lock_irqsave(&vmovp_lock, flags);
+
+	desc.its_vmovp_cmd.seq_num = vmovp_seq_num++;
+
+	list_for_each_entry(its, &its_nodes, entry) {
+		if (!its->is_v4)
+			continue;
+
+		desc.its_vmovp_cmd.col = &its->collections[col_id];
+		its_send_single_vcommand(its, its_build_vmovp_cmd, &desc);
+	}
+
+	raw_spin_unlock_irqrestore(&vmovp_lock, flags);
+}
+
+static void its_send_vinvall(struct its_cmd_batch *batch,
+			     struct its_node *its, struct its_vpe *vpe)
+{
+	struct its_cmd_desc desc;
+
+	desc.its_vinvall_cmd.vpe = vpe;
+
+	its_send_vcommand(its, batch, its_build_vinvall_cmd, &desc);
+}
+
+static void its_send_vinv(struct its_cmd_batch *batch, struct its_device *dev,
+			  u32 event_id)
+{
+	struct its_cmd_desc desc;
+
+	desc.its_inv_cmd.dev = dev;
+	desc.its_inv_cmd.event_id = event_id;
+
+	its_send_vcommand(dev->its, batch, its_build_vinv_cmd, &desc);
+}
+
+static void its_send_vint(struct its_device *dev, u32 event_id)
+{
+	struct its_cmd_desc desc;
+
+	desc.its_int_cmd.dev = dev;
+	desc.its_int_cmd.event_id = event_id;
+
+	its_send_single_vcommand(dev->its, its_build_vint_cmd, &desc);
+}
+
+static void its_send_vclear(struct its_device *dev, u32 event_id)
+{
+	struct its_cmd_desc desc;
+
+	desc.its_clear_cmd.dev = dev;
+	desc.its_clear_cmd.event_id = event_id;
+
+	its_send_single_vcommand(dev->its, its_build_vclear_cmd, &desc);
 }
 
 /*
@@ -587,17 +1216,31 @@ static inline u32 its_get_event_id(struct irq_data *d)
 	return d->hwirq - its_dev->event_map.lpi_base;
 }
 
-static void lpi_set_config(struct irq_data *d, bool enable)
+/*
+ * Update the configuration byte of an LPI. Once forwarded to a vPE,
+ * the interrupt is configured by its vLPI entry in the VM's property
+ * table rather than by the physical one.
+ */
+static void lpi_write_config(struct irq_data *d, u8 clr, u8 set)
 {
-	struct its_device *its_dev = irq_data_get_irq_chip_data(d);
-	irq_hw_number_t hwirq = d->hwirq;
-	u32 id = its_get_event_id(d);
-	u8 *cfg = page_address(gic_rdists->prop_page) + hwirq - 8192;
+	irq_hw_number_t hwirq;
+	struct page *prop_page;
+	u8 *cfg;
 
-	if (enable)
-		*cfg |= LPI_PROP_ENABLED;
-	else
-		*cfg &= ~LPI_PROP_ENABLED;
+	if (irqd_is_forwarded_to_vcpu(d)) {
+		struct its_device *its_dev = irq_data_get_irq_chip_data(d);
+		u32 event = its_get_event_id(d);
+
+		prop_page = its_dev->event_map.vm->vprop_page;
+		hwirq = dev_event_to_vlpi_map(its_dev, event)->vintid;
+	} else {
+		prop_page = gic_rdists->prop_page;
+		hwirq = d->hwirq;
+	}
+
+	cfg = page_address(prop_page) + hwirq - 8192;
+	*cfg &= ~clr;
+	*cfg |= set | LPI_PROP_GROUP1;
 
 	/*
 	 * Make the above write visible to the redistributors.
@@ -608,17 +1251,68 @@ static void lpi_set_config(struct irq_data *d, bool enable)
 		gic_flush_dcache_to_poc(cfg, sizeof(*cfg));
 	else
 		dsb(ishst);
-	its_send_inv(its_dev, id);
+}
+
+static void lpi_update_config(struct its_cmd_batch *batch, struct irq_data *d,
+			      u8 clr, u8 set)
+{
+	struct its_device *its_dev = irq_data_get_irq_chip_data(d);
+	u32 id = its_get_event_id(d);
+
+	lpi_write_config(d, clr, set);
+	if (irqd_is_forwarded_to_vcpu(d))
+		its_send_vinv(batch, its_dev, id);
+	else
+		its_send_inv(batch, its_dev, id);
+}
+
+static void its_vlpi_set_doorbell(struct its_cmd_batch *batch,
+				  struct irq_data *d, bool enable)
+{
+	struct its_device *its_dev = irq_data_get_irq_chip_data(d);
+	u32 event = its_get_event_id(d);
+	struct its_vlpi_map *map = dev_event_to_vlpi_map(its_dev, event);
+
+	if (map->db_enabled == enable)
+		return;
+
+	map->db_enabled = enable;
+
+	/*
+	 * There is no VMOVI variant that only changes the doorbell, so
+	 * "move" the vLPI to the vPE it already targets.
+	 */
+	its_send_vmovi(batch, its_dev, event);
 }
 
 static void its_mask_irq(struct irq_data *d)
 {
-	lpi_set_config(d, false);
+	struct its_device *its_dev = irq_data_get_irq_chip_data(d);
+	struct its_cmd_batch batch;
+
+	its_batch_start(its_dev->its, &batch);
+
+	if (irqd_is_forwarded_to_vcpu(d))
+		its_vlpi_set_doorbell(&batch, d, false);
+
+	lpi_update_config(&batch, d, LPI_PROP_ENABLED, 0);
+
+	its_batch_finish(&batch);
 }
 
 static void its_unmask_irq(struct irq_data *d)
 {
-	lpi_set_config(d, true);
+	struct its_device *its_dev = irq_data_get_irq_chip_data(d);
+	struct its_cmd_batch batch;
+
+	its_batch_start(its_dev->its, &batch);
+
+	if (irqd_is_forwarded_to_vcpu(d))
+		its_vlpi_set_doorbell(&batch, d, true);
+
+	lpi_update_config(&batch, d, 0, LPI_PROP_ENABLED);
+
+	its_batch_finish(&batch);
 }
 
 static int its_set_affinity(struct irq_data *d, const struct cpumask *mask_val,
@@ -630,6 +1324,10 @@ static int its_set_affinity(struct irq_data *d, const struct cpumask *mask_val,
 	struct its_collection *target_col;
 	u32 id = its_get_event_id(d);
 
+	/* A forwarded interrupt follows its vPE, not the host's affinity */
+	if (irqd_is_forwarded_to_vcpu(d))
+		return -EINVAL;
+
        /* lpi cannot be routed to a redistributor that is on a foreign node */
 	if (its_dev->its->flags & ITS_FLAGS_WORKAROUND_CAVIUM_23144) {
 		if (its_dev->its->numa_node >= 0) {
@@ -644,13 +1342,52 @@ static int its_set_affinity(struct irq_data *d, const struct cpumask *mask_val,
 	if (cpu >= nr_cpu_ids)
 		return -EINVAL;
 
-	target_col = &its_dev->its->collections[cpu];
-	its_send_movi(its_dev, target_col, id);
 	its_dev->event_map.col_map[id] = cpu;
 
+	if (irq_affinity_defer(&its_dev->its->affinity_flush)) {
+		set_bit(id, its_dev->event_map.movi_map);
+	} else {
+		target_col = &its_dev->its->collections[cpu];
+		its_send_movi(its_dev, target_col, id);
+	}
+
 	return IRQ_SET_MASK_OK_DONE;
 }
 
+/*
+ * Send the MOVIs deferred while the interrupts of a dying cpu were moved
+ * in one batch: it only has to wait once, and to SYNC once per target.
+ * This runs under stop_machine, so the devices can't go away meanwhile.
+ */
+static void its_affinity_flush(struct irq_affinity_flush *flush)
+{
+	struct its_node *its = container_of(flush, struct its_node,
+					    affinity_flush);
+	struct its_cmd_batch batch;
+	struct its_device *its_dev;
+
+	its_batch_start(its, &batch);
+
+	list_for_each_entry(its_dev, &its->its_device_list, entry) {
+		struct event_lpi_map *map = &its_dev->event_map;
+		struct its_cmd_desc desc;
+		u32 id;
+
+		for_each_set_bit(id, map->movi_map, map->nr_lpis) {
+			u16 cpu = map->col_map[id];
+
+			clear_bit(id, map->movi_map);
+
+			desc.its_movi_cmd.dev = its_dev;
+			desc.its_movi_cmd.col = &its->collections[cpu];
+			desc.its_movi_cmd.event_id = id;
+			its_batch_command(&batch, its_build_movi_cmd, &desc);
+		}
+	}
+
+	its_batch_finish(&batch);
+}
+
 static void its_irq_compose_msi_msg(struct irq_data *d, struct msi_msg *msg)
 {
 	struct its_device *its_dev = irq_data_get_irq_chip_data(d);
@@ -667,6 +1404,213 @@ static void its_irq_compose_msi_msg(struct irq_data *d, struct msi_msg *msg)
 	iommu_dma_map_msi_msg(d->irq, msg);
 }
 
+static int its_irq_set_irqchip_state(struct irq_data *d,
+				     enum irqchip_irq_state which,
+				     bool state)
+{
+	struct its_device *its_dev = irq_data_get_irq_chip_data(d);
+	u32 event = its_get_event_id(d);
+
+	if (which != IRQCHIP_STATE_PENDING)
+		return -EINVAL;
+
+	if (irqd_is_forwarded_to_vcpu(d)) {
+		if (state)
+			its_send_vint(its_dev, event);
+		else
+			its_send_vclear(its_dev, event);
+	} else {
+		if (state)
+			its_send_int(its_dev, event);
+		else
+			its_send_clear(its_dev, event);
+	}
+
+	return 0;
+}
+
+static int its_vlpi_map(struct irq_data *d, struct its_cmd_info *info)
+{
+	struct its_device *its_dev = irq_data_get_irq_chip_data(d);
+	u32 event = its_get_event_id(d);
+	struct its_cmd_batch batch;
+	unsigned long flags;
+	int ret = 0;
+
+	if (!info->map)
+		return -EINVAL;
+
+	raw_spin_lock_irqsave(&its_dev->event_map.vlpi_lock, flags);
+
+	if (!its_dev->event_map.vm) {
+		struct its_vlpi_map *maps;
+
+		maps = kcalloc(its_dev->event_map.nr_lpis, sizeof(*maps),
+			       GFP_ATOMIC);
+		if (!maps) {
+			ret = -ENOMEM;
+			goto out;
+		}
+
+		its_dev->event_map.vm = info->map->vm;
+		its_dev->event_map.vlpi_maps = maps;
+	} else if (its_dev->event_map.vm != info->map->vm) {
+		/* All the events of a device belong to the same VM */
+		ret = -EINVAL;
+		goto out;
+	}
+
+	/* Get our private copy of the mapping information */
+	its_dev->event_map.vlpi_maps[event] = *info->map;
+
+	its_batch_start(its_dev->its, &batch);
+
+	if (irqd_is_forwarded_to_vcpu(d)) {
+		/* Already mapped, move it around */
+		its_send_vmovi(&batch, its_dev, event);
+	} else {
+		/* Drop the physical mapping */
+		its_send_discard(&batch, its_dev, event);
+
+		/* and install the virtual one */
+		its_send_vmapti(&batch, its_dev, event);
+		irqd_set_forwarded_to_vcpu(d);
+
+		its_dev->event_map.nr_vlpis++;
+	}
+
+	/* Write out the vLPI configuration, and make the GIC see it */
+	lpi_update_config(&batch, d, 0xff, info->map->properties);
+
+	its_batch_finish(&batch);
+
+out:
+	raw_spin_unlock_irqrestore(&its_dev->event_map.vlpi_lock, flags);
+	return ret;
+}
+
+static int its_vlpi_get(struct irq_data *d, struct its_cmd_info *info)
+{
+	struct its_device *its_dev = irq_data_get_irq_chip_data(d);
+	u32 event = its_get_event_id(d);
+	unsigned long flags;
+	int ret = 0;
+
+	raw_spin_lock_irqsave(&its_dev->event_map.vlpi_lock, flags);
+
+	if (!its_dev->event_map.vm || !irqd_is_forwarded_to_vcpu(d)) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	/* Copy our mapping information to the incoming request */
+	*info->map = *dev_event_to_vlpi_map(its_dev, event);
+
+out:
+	raw_spin_unlock_irqrestore(&its_dev->event_map.vlpi_lock, flags);
+	return ret;
+}
+
+static int its_vlpi_unmap(struct irq_data *d)
+{
+	struct its_device *its_dev = irq_data_get_irq_chip_data(d);
+	u32 event = its_get_event_id(d);
+	struct its_cmd_batch batch;
+	unsigned long flags;
+	int ret = 0;
+
+	raw_spin_lock_irqsave(&its_dev->event_map.vlpi_lock, flags);
+
+	if (!its_dev->event_map.vm || !irqd_is_forwarded_to_vcpu(d)) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	its_batch_start(its_dev->its, &batch);
+
+	/* Drop the virtual mapping */
+	its_send_discard(&batch, its_dev, event);
+
+	/* and restore the physical one */
+	irqd_clr_forwarded_to_vcpu(d);
+	its_send_mapti(&batch, its_dev, d->hwirq, event);
+	lpi_update_config(&batch, d, LPI_PROP_ENABLED,
+			  irqd_irq_masked(d) ? 0 : LPI_PROP_ENABLED);
+
+	its_batch_finish(&batch);
+
+	/* Potential last vLPI on this device */
+	if (!--its_dev->event_map.nr_vlpis) {
+		its_dev->event_map.vm = NULL;
+		kfree(its_dev->event_map.vlpi_maps);
+		its_dev->event_map.vlpi_maps = NULL;
+	}
+
+out:
+	raw_spin_unlock_irqrestore(&its_dev->event_map.vlpi_lock, flags);
+	return ret;
+}
+
+static int its_vlpi_prop_update(struct irq_data *d, struct its_cmd_info *info)
+{
+	struct its_device *its_dev = irq_data_get_irq_chip_data(d);
+	struct its_cmd_batch batch;
+	unsigned long flags;
+	int ret = 0;
+
+	raw_spin_lock_irqsave(&its_dev->event_map.vlpi_lock, flags);
+
+	if (!its_dev->event_map.vm || !irqd_is_forwarded_to_vcpu(d)) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	its_batch_start(its_dev->its, &batch);
+
+	if (info->cmd_type == PROP_UPDATE_AND_INV_VLPI)
+		lpi_update_config(&batch, d, 0xff, info->config);
+	else
+		lpi_write_config(d, 0xff, info->config);
+
+	/* A disabled vLPI has no business ringing the doorbell */
+	its_vlpi_set_doorbell(&batch, d, !!(info->config & LPI_PROP_ENABLED));
+
+	its_batch_finish(&batch);
+
+out:
+	raw_spin_unlock_irqrestore(&its_dev->event_map.vlpi_lock, flags);
+	return ret;
+}
+
+static int its_irq_set_vcpu_affinity(struct irq_data *d, void *vcpu_info)
+{
+	struct its_device *its_dev = irq_data_get_irq_chip_data(d);
+	struct its_cmd_info *info = vcpu_info;
+
+	/* Need a v4 ITS */
+	if (!its_dev->its->is_v4)
+		return -EINVAL;
+
+	/* Unmap request? */
+	if (!info)
+		return its_vlpi_unmap(d);
+
+	switch (info->cmd_type) {
+	case MAP_VLPI:
+		return its_vlpi_map(d, info);
+
+	case GET_VLPI:
+		return its_vlpi_get(d, info);
+
+	case PROP_UPDATE_VLPI:
+	case PROP_UPDATE_AND_INV_VLPI:
+		return its_vlpi_prop_update(d, info);
+
+	default:
+		return -EINVAL;
+	}
+}
+
 static struct irq_chip its_irq_chip = {
 	.name			= "ITS",
 	.irq_mask		= its_mask_irq,
@@ -674,6 +1618,8 @@ static struct irq_chip its_irq_chip = {
 	.irq_eoi		= irq_chip_eoi_parent,
 	.irq_set_affinity	= its_set_affinity,
 	.irq_compose_msi_msg	= its_irq_compose_msi_msg,
+	.irq_set_irqchip_state	= its_irq_set_irqchip_state,
+	.irq_set_vcpu_affinity	= its_irq_set_vcpu_affinity,
 };
 
 /*
@@ -761,10 +1707,8 @@ static unsigned long *its_lpi_alloc_chunks(int nr_irqs, int *base, int *nr_ids)
 	return bitmap;
 }
 
-static void its_lpi_free(struct event_lpi_map *map)
+static void its_lpi_free_chunks(unsigned long *bitmap, int base, int nr_ids)
 {
-	int base = map->lpi_base;
-	int nr_ids = map->nr_lpis;
 	int lpi;
 
 	spin_lock(&lpi_lock);
@@ -779,33 +1723,48 @@ static void its_lpi_free(struct event_lpi_map *map)
 		}
 	}
 
-	spin_unlock(&lpi_lock);
+	spin_unlock(&lpi_lock);
+
+	kfree(bitmap);
+}
+
+static void its_lpi_free(struct event_lpi_map *map)
+{
+	its_lpi_free_chunks(map->lpi_map, map->lpi_base, map->nr_lpis);
+	kfree(map->col_map);
+	kfree(map->movi_map);
+}
+
+static struct page *its_allocate_prop_table(gfp_t gfp_flags)
+{
+	struct page *prop_page;
+
+	prop_page = alloc_pages(gfp_flags, get_order(LPI_PROPBASE_SZ));
+	if (!prop_page)
+		return NULL;
 
-	kfree(map->lpi_map);
-	kfree(map->col_map);
-}
+	/* Priority 0xa0, Group-1, disabled */
+	memset(page_address(prop_page),
+	       LPI_PROP_DEFAULT_PRIO | LPI_PROP_GROUP1,
+	       LPI_PROPBASE_SZ);
 
-/*
- * We allocate 64kB for PROPBASE. That gives us at most 64K LPIs to
- * deal with (one configuration byte per interrupt). PENDBASE has to
- * be 64kB aligned (one bit per LPI, plus 8192 bits for SPI/PPI/SGI).
- */
-#define LPI_PROPBASE_SZ		SZ_64K
-#define LPI_PENDBASE_SZ		(LPI_PROPBASE_SZ / 8 + SZ_1K)
+	/* Make sure the GIC will observe the written configuration */
+	gic_flush_dcache_to_poc(page_address(prop_page), LPI_PROPBASE_SZ);
 
-/*
- * This is how many bits of ID we need, including the useless ones.
- */
-#define LPI_NRBITS		ilog2(LPI_PROPBASE_SZ + SZ_8K)
+	return prop_page;
+}
 
-#define LPI_PROP_DEFAULT_PRIO	0xa0
+static void its_free_prop_table(struct page *prop_page)
+{
+	free_pages((unsigned long)page_address(prop_page),
+		   get_order(LPI_PROPBASE_SZ));
+}
 
 static int __init its_alloc_lpi_tables(void)
 {
 	phys_addr_t paddr;
 
-	gic_rdists->prop_page = alloc_pages(GFP_NOWAIT,
-					   get_order(LPI_PROPBASE_SZ));
+	gic_rdists->prop_page = its_allocate_prop_table(GFP_NOWAIT);
 	if (!gic_rdists->prop_page) {
 		pr_err("Failed to allocate PROPBASE\n");
 		return -ENOMEM;
@@ -814,14 +1773,6 @@ static int __init its_alloc_lpi_tables(void)
 	paddr = page_to_phys(gic_rdists->prop_page);
 	pr_info("GIC: using LPI property table @%pa\n", &paddr);
 
-	/* Priority 0xa0, Group-1, disabled */
-	memset(page_address(gic_rdists->prop_page),
-	       LPI_PROP_DEFAULT_PRIO | LPI_PROP_GROUP1,
-	       LPI_PROPBASE_SZ);
-
-	/* Make sure the GIC will observe the written configuration */
-	gic_flush_dcache_to_poc(page_address(gic_rdists->prop_page), LPI_PROPBASE_SZ);
-
 	return 0;
 }
 
@@ -1057,6 +2008,15 @@ static int its_alloc_tables(struct its_node *its)
 		if (type == GITS_BASER_TYPE_DEVICE)
 			indirect = its_parse_baser_device(its, baser, psz, &order);
 
+		/*
+		 * vPE IDs are allocated globally, so every v4 ITS must
+		 * be able to hold all of them in a flat table.
+		 */
+		if (type == GITS_BASER_TYPE_VCPU)
+			order = max_t(u32, order,
+				      get_order(GITS_BASER_ENTRY_SIZE(val) <<
+						ITS_MAX_VPEID_BITS));
+
 		err = its_setup_baser(its, baser, cache, shr, psz, order, indirect);
 		if (err < 0) {
 			its_free_tables(its);
@@ -1082,6 +2042,31 @@ static int its_alloc_collections(struct its_node *its)
 	return 0;
 }
 
+static struct page *its_allocate_pending_table(gfp_t gfp_flags)
+{
+	struct page *pend_page;
+
+	/*
+	 * The pending pages have to be at least 64kB aligned,
+	 * hence the 'max(LPI_PENDBASE_SZ, SZ_64K)' below.
+	 */
+	pend_page = alloc_pages(gfp_flags | __GFP_ZERO,
+				get_order(max_t(u32, LPI_PENDBASE_SZ, SZ_64K)));
+	if (!pend_page)
+		return NULL;
+
+	/* Make sure the GIC will observe the zero-ed page */
+	gic_flush_dcache_to_poc(page_address(pend_page), LPI_PENDBASE_SZ);
+
+	return pend_page;
+}
+
+static void its_free_pending_table(struct page *pt)
+{
+	free_pages((unsigned long)page_address(pt),
+		   get_order(max_t(u32, LPI_PENDBASE_SZ, SZ_64K)));
+}
+
 static void its_cpu_init_lpis(void)
 {
 	void __iomem *rbase = gic_data_rdist_rd_base();
@@ -1092,21 +2077,14 @@ static void its_cpu_init_lpis(void)
 	pend_page = gic_data_rdist()->pend_page;
 	if (!pend_page) {
 		phys_addr_t paddr;
-		/*
-		 * The pending pages have to be at least 64kB aligned,
-		 * hence the 'max(LPI_PENDBASE_SZ, SZ_64K)' below.
-		 */
-		pend_page = alloc_pages(GFP_NOWAIT | __GFP_ZERO,
-					get_order(max(LPI_PENDBASE_SZ, SZ_64K)));
+
+		pend_page = its_allocate_pending_table(GFP_NOWAIT);
 		if (!pend_page) {
 			pr_err("Failed to allocate PENDBASE for CPU%d\n",
 			       smp_processor_id());
 			return;
 		}
 
-		/* Make sure the GIC will observe the zero-ed page */
-		gic_flush_dcache_to_poc(page_address(pend_page), LPI_PENDBASE_SZ);
-
 		paddr = page_to_phys(pend_page);
 		pr_info("CPU%d: using LPI pending table @%pa\n",
 			smp_processor_id(), &paddr);
@@ -1178,6 +2156,7 @@ static void its_cpu_init_lpis(void)
 
 static void its_cpu_init_collection(void)
 {
+	struct its_cmd_batch batch;
 	struct its_node *its;
 	int cpu;
 
@@ -1219,8 +2198,10 @@ static void its_cpu_init_collection(void)
 		its->collections[cpu].target_address = target;
 		its->collections[cpu].col_id = cpu;
 
-		its_send_mapc(its, &its->collections[cpu], 1);
-		its_send_invall(its, &its->collections[cpu]);
+		its_batch_start(its, &batch);
+		its_send_mapc(&batch, its, &its->collections[cpu], 1);
+		its_send_invall(&batch, its, &its->collections[cpu]);
+		its_batch_finish(&batch);
 	}
 
 	spin_unlock(&its_lock);
@@ -1311,6 +2292,7 @@ static struct its_device *its_create_device(struct its_node *its, u32 dev_id,
 	struct its_device *dev;
 	unsigned long *lpi_map;
 	unsigned long flags;
+	unsigned long *movi_map = NULL;
 	u16 *col_map = NULL;
 	void *itt;
 	int lpi_base;
@@ -1332,14 +2314,18 @@ static struct its_device *its_create_device(struct its_node *its, u32 dev_id,
 	sz = max(sz, ITS_ITT_ALIGN) + ITS_ITT_ALIGN - 1;
 	itt = kzalloc(sz, GFP_KERNEL);
 	lpi_map = its_lpi_alloc_chunks(nvecs, &lpi_base, &nr_lpis);
-	if (lpi_map)
+	if (lpi_map) {
 		col_map = kzalloc(sizeof(*col_map) * nr_lpis, GFP_KERNEL);
+		movi_map = kcalloc(BITS_TO_LONGS(nr_lpis), sizeof(long),
+				   GFP_KERNEL);
+	}
 
-	if (!dev || !itt || !lpi_map || !col_map) {
+	if (!dev || !itt || !lpi_map || !col_map || !movi_map) {
 		kfree(dev);
 		kfree(itt);
 		kfree(lpi_map);
 		kfree(col_map);
+		kfree(movi_map);
 		return NULL;
 	}
 
@@ -1350,8 +2336,10 @@ static struct its_device *its_create_device(struct its_node *its, u32 dev_id,
 	dev->nr_ites = nr_ites;
 	dev->event_map.lpi_map = lpi_map;
 	dev->event_map.col_map = col_map;
+	dev->event_map.movi_map = movi_map;
 	dev->event_map.lpi_base = lpi_base;
 	dev->event_map.nr_lpis = nr_lpis;
+	raw_spin_lock_init(&dev->event_map.vlpi_lock);
 	dev->device_id = dev_id;
 	INIT_LIST_HEAD(&dev->entry);
 
@@ -1502,7 +2490,7 @@ static void its_irq_domain_activate(struct irq_domain *domain,
 	its_dev->event_map.col_map[event] = cpumask_first(cpu_mask);
 
 	/* Map the GIC IRQ and event to the device */
-	its_send_mapti(its_dev, d->hwirq, event);
+	its_send_mapti(NULL, its_dev, d->hwirq, event);
 }
 
 static void its_irq_domain_deactivate(struct irq_domain *domain,
@@ -1512,7 +2500,7 @@ static void its_irq_domain_deactivate(struct irq_domain *domain,
 	u32 event = its_get_event_id(d);
 
 	/* Stop the delivery of interrupts */
-	its_send_discard(its_dev, event);
+	its_send_discard(NULL, its_dev, event);
 }
 
 static void its_irq_domain_free(struct irq_domain *domain, unsigned int virq,
@@ -1554,6 +2542,363 @@ static const struct irq_domain_ops its_domain_ops = {
 	.deactivate		= its_irq_domain_deactivate,
 };
 
+/*
+ * GICv4 vPEs: each vPE is an interrupt of the VM's own domain, stacked
+ * on top of the doorbell LPI that the redistributor raises when one of
+ * the vPE's vLPIs becomes pending while it isn't resident. The
+ * doorbells are never mapped in an ITS: they are configured through the
+ * redistributor's DirectLPI interface.
+ */
+static void its_vpe_send_inv(struct irq_data *d)
+{
+	struct its_vpe *vpe = irq_data_get_irq_chip_data(d);
+	void __iomem *rdbase;
+
+	rdbase = per_cpu_ptr(gic_rdists->rdist, vpe->col_idx)->rd_base;
+	gic_write_lpir(vpe->vpe_db_lpi, rdbase + GICR_INVLPIR);
+	while (readl_relaxed(rdbase + GICR_SYNCR) & 1)
+		cpu_relax();
+}
+
+static void its_vpe_mask_irq(struct irq_data *d)
+{
+	/*
+	 * The doorbell LPI is described by the parent irq_data, whose
+	 * configuration byte lives in the physical property table.
+	 */
+	lpi_write_config(d->parent_data, LPI_PROP_ENABLED, 0);
+	its_vpe_send_inv(d);
+}
+
+static void its_vpe_unmask_irq(struct irq_data *d)
+{
+	lpi_write_config(d->parent_data, 0, LPI_PROP_ENABLED);
+	its_vpe_send_inv(d);
+}
+
+static int its_vpe_set_affinity(struct irq_data *d,
+				const struct cpumask *mask_val,
+				bool force)
+{
+	struct its_vpe *vpe = irq_data_get_irq_chip_data(d);
+	int cpu = cpumask_first(mask_val);
+
+	/*
+	 * Moving a vPE is a VMOVP on (potentially) every ITS, so only
+	 * do it if the target redistributor really changes.
+	 */
+	if (vpe->col_idx != cpu) {
+		vpe->col_idx = cpu;
+		its_send_vmovp(vpe);
+	}
+
+	return IRQ_SET_MASK_OK_DONE;
+}
+
+static void its_vpe_schedule(struct its_vpe *vpe)
+{
+	void __iomem *vlpi_base = gic_data_rdist_vlpi_base();
+	u64 val;
+
+	/* Schedule the vPE */
+	val  = virt_to_phys(page_address(vpe->its_vm->vprop_page)) &
+		GENMASK_ULL(51, 12);
+	val |= (LPI_NRBITS - 1) & GICR_VPROPBASER_IDBITS_MASK;
+	val |= GICR_VPROPBASER_RaWaWb;
+	val |= GICR_VPROPBASER_InnerShareable;
+	gits_write_vpropbaser(val, vlpi_base + GICR_VPROPBASER);
+
+	val  = virt_to_phys(page_address(vpe->vpt_page)) &
+		GENMASK_ULL(51, 16);
+	val |= GICR_VPENDBASER_RaWaWb;
+	val |= GICR_VPENDBASER_NonShareable;
+	/*
+	 * There is no cheap way of finding out whether the pending
+	 * table is empty, as we can race against the doorbell. So
+	 * pending_last is only a hint that something may be pending,
+	 * and we always let the redistributor scan the table.
+	 */
+	val |= GICR_VPENDBASER_PendingLast;
+	val |= vpe->idai ? GICR_VPENDBASER_IDAI : 0;
+	val |= GICR_VPENDBASER_Valid;
+	gits_write_vpendbaser(val, vlpi_base + GICR_VPENDBASER);
+}
+
+static void its_vpe_deschedule(struct its_vpe *vpe)
+{
+	void __iomem *vlpi_base = gic_data_rdist_vlpi_base();
+	u32 count = 1000000;	/* 1s! */
+	bool clean;
+	u64 val;
+
+	/* We're being scheduled out */
+	val = gits_read_vpendbaser(vlpi_base + GICR_VPENDBASER);
+	val &= ~GICR_VPENDBASER_Valid;
+	gits_write_vpendbaser(val, vlpi_base + GICR_VPENDBASER);
+
+	do {
+		val = gits_read_vpendbaser(vlpi_base + GICR_VPENDBASER);
+		clean = !(val & GICR_VPENDBASER_Dirty);
+		if (!clean) {
+			count--;
+			cpu_relax();
+			udelay(1);
+		}
+	} while (!clean && count);
+
+	if (unlikely(!clean)) {
+		pr_err_ratelimited("ITS virtual pending table not cleaning\n");
+		vpe->idai = false;
+		vpe->pending_last = true;
+	} else {
+		vpe->idai = !!(val & GICR_VPENDBASER_IDAI);
+		vpe->pending_last = !!(val & GICR_VPENDBASER_PendingLast);
+	}
+}
+
+static void its_vpe_invall(struct its_vpe *vpe)
+{
+	struct its_node *its;
+
+	list_for_each_entry(its, &its_nodes, entry) {
+		if (!its->is_v4)
+			continue;
+
+		/*
+		 * Sending a VINVALL to a single ITS is enough, as all
+		 * of them share the VM's property table.
+		 */
+		its_send_vinvall(NULL, its, vpe);
+		return;
+	}
+}
+
+static int its_vpe_set_vcpu_affinity(struct irq_data *d, void *vcpu_info)
+{
+	struct its_vpe *vpe = irq_data_get_irq_chip_data(d);
+	struct its_cmd_info *info = vcpu_info;
+
+	switch (info->cmd_type) {
+	case SCHEDULE_VPE:
+		its_vpe_schedule(vpe);
+		return 0;
+
+	case DESCHEDULE_VPE:
+		its_vpe_deschedule(vpe);
+		return 0;
+
+	case INVALL_VPE:
+		its_vpe_invall(vpe);
+		return 0;
+
+	default:
+		return -EINVAL;
+	}
+}
+
+static int its_vpe_set_irqchip_state(struct irq_data *d,
+				     enum irqchip_irq_state which,
+				     bool state)
+{
+	struct its_vpe *vpe = irq_data_get_irq_chip_data(d);
+	void __iomem *rdbase;
+
+	if (which != IRQCHIP_STATE_PENDING)
+		return -EINVAL;
+
+	rdbase = per_cpu_ptr(gic_rdists->rdist, vpe->col_idx)->rd_base;
+	if (state)
+		gic_write_lpir(vpe->vpe_db_lpi, rdbase + GICR_SETLPIR);
+	else
+		gic_write_lpir(vpe->vpe_db_lpi, rdbase + GICR_CLRLPIR);
+
+	while (readl_relaxed(rdbase + GICR_SYNCR) & 1)
+		cpu_relax();
+
+	return 0;
+}
+
+static struct irq_chip its_vpe_irq_chip = {
+	.name			= "GICv4-vpe",
+	.irq_mask		= its_vpe_mask_irq,
+	.irq_unmask		= its_vpe_unmask_irq,
+	.irq_eoi		= irq_chip_eoi_parent,
+	.irq_set_affinity	= its_vpe_set_affinity,
+	.irq_set_irqchip_state	= its_vpe_set_irqchip_state,
+	.irq_set_vcpu_affinity	= its_vpe_set_vcpu_affinity,
+};
+
+static int its_vpe_id_alloc(void)
+{
+	return ida_simple_get(&its_vpeid_ida, 0, its_nr_vpeids, GFP_KERNEL);
+}
+
+static void its_vpe_id_free(u16 id)
+{
+	ida_simple_remove(&its_vpeid_ida, id);
+}
+
+static int its_vpe_init(struct its_vpe *vpe)
+{
+	struct page *vpt_page;
+	int vpe_id;
+
+	/* Allocate vpe_id */
+	vpe_id = its_vpe_id_alloc();
+	if (vpe_id < 0)
+		return vpe_id;
+
+	/* Allocate VPT */
+	vpt_page = its_allocate_pending_table(GFP_KERNEL);
+	if (!vpt_page) {
+		its_vpe_id_free(vpe_id);
+		return -ENOMEM;
+	}
+
+	vpe->vpe_id = vpe_id;
+	vpe->vpt_page = vpt_page;
+
+	return 0;
+}
+
+static void its_vpe_teardown(struct its_vpe *vpe)
+{
+	its_vpe_id_free(vpe->vpe_id);
+	its_free_pending_table(vpe->vpt_page);
+}
+
+/*
+ * A vPE has to be mapped on the ITSs before any of its vLPIs, and
+ * before it can be scheduled. Its doorbell may never be started,
+ * so this is done on allocation rather than on activation.
+ */
+/* Map (or unmap) @nr_vpes vPEs on every v4 ITS, with one wait per ITS */
+static void its_vpe_map(struct its_vpe **vpes, int nr_vpes, bool valid)
+{
+	struct its_cmd_batch batch;
+	struct its_node *its;
+	int i;
+
+	list_for_each_entry(its, &its_nodes, entry) {
+		if (!its->is_v4)
+			continue;
+
+		its_batch_start(its, &batch);
+
+		for (i = 0; i < nr_vpes; i++) {
+			its_send_vmapp(&batch, its, vpes[i], valid);
+			if (valid)
+				its_send_vinvall(&batch, its, vpes[i]);
+		}
+
+		its_batch_finish(&batch);
+	}
+}
+
+static void its_vpe_irq_domain_free(struct irq_domain *domain,
+				    unsigned int virq,
+				    unsigned int nr_irqs)
+{
+	struct its_vm *vm = domain->host_data;
+	int i;
+
+	irq_domain_free_irqs_parent(domain, virq, nr_irqs);
+
+	for (i = 0; i < nr_irqs; i++) {
+		struct irq_data *data = irq_domain_get_irq_data(domain,
+								virq + i);
+		struct its_vpe *vpe = irq_data_get_irq_chip_data(data);
+
+		BUG_ON(vm != vpe->its_vm);
+
+		its_vpe_map(&vpe, 1, false);
+		clear_bit(data->hwirq, vm->db_bitmap);
+		its_vpe_teardown(vpe);
+		irq_domain_reset_irq_data(data);
+	}
+
+	if (bitmap_empty(vm->db_bitmap, vm->nr_db_lpis)) {
+		its_lpi_free_chunks(vm->db_bitmap, vm->db_lpi_base,
+				    vm->nr_db_lpis);
+		its_free_prop_table(vm->vprop_page);
+	}
+}
+
+static int its_vpe_irq_domain_alloc(struct irq_domain *domain,
+				    unsigned int virq,
+				    unsigned int nr_irqs, void *args)
+{
+	struct its_vm *vm = args;
+	unsigned long *bitmap;
+	struct page *vprop_page;
+	int base, nr_ids, i, err = 0;
+
+	BUG_ON(!vm);
+
+	bitmap = its_lpi_alloc_chunks(nr_irqs, &base, &nr_ids);
+	if (!bitmap)
+		return -ENOMEM;
+
+	if (nr_ids < nr_irqs) {
+		its_lpi_free_chunks(bitmap, base, nr_ids);
+		return -ENOMEM;
+	}
+
+	vprop_page = its_allocate_prop_table(GFP_KERNEL);
+	if (!vprop_page) {
+		its_lpi_free_chunks(bitmap, base, nr_ids);
+		return -ENOMEM;
+	}
+
+	vm->db_bitmap = bitmap;
+	vm->db_lpi_base = base;
+	vm->nr_db_lpis = nr_ids;
+	vm->vprop_page = vprop_page;
+
+	for (i = 0; i < nr_irqs; i++) {
+		struct its_vpe *vpe = vm->vpes[i];
+
+		vpe->vpe_db_lpi = base + i;
+		err = its_vpe_init(vpe);
+		if (err)
+			break;
+
+		err = its_irq_gic_domain_alloc(domain, virq + i,
+					       vpe->vpe_db_lpi);
+		if (err) {
+			its_vpe_teardown(vpe);
+			break;
+		}
+
+		irq_domain_set_hwirq_and_chip(domain, virq + i, i,
+					      &its_vpe_irq_chip, vpe);
+		set_bit(i, bitmap);
+
+		/* Map the vPE to the first possible CPU */
+		vpe->col_idx = cpumask_first(cpu_online_mask);
+	}
+
+	if (!err)
+		its_vpe_map(vm->vpes, nr_irqs, true);
+
+	if (err) {
+		if (i > 0) {
+			/* Releases the doorbells and the property table */
+			its_vpe_irq_domain_free(domain, virq, i);
+		} else {
+			its_lpi_free_chunks(bitmap, base, nr_ids);
+			its_free_prop_table(vprop_page);
+		}
+	}
+
+	return err;
+}
+
+static const struct irq_domain_ops its_vpe_domain_ops = {
+	.alloc			= its_vpe_irq_domain_alloc,
+	.free			= its_vpe_irq_domain_free,
+};
+
 static int its_force_quiescent(void __iomem *base)
 {
 	u32 count = 1000000;	/* 1s */
@@ -1670,13 +3015,50 @@ static int its_init_domain(struct fwnode_handle *handle, struct its_node *its)
 	return 0;
 }
 
+static int __init its_compute_its_list_map(struct resource *res,
+					   void __iomem *its_base)
+{
+	int its_number;
+	u32 ctlr;
+
+	/*
+	 * This is done while probing the ITSs, and is guaranteed to be
+	 * single-threaded, hence no locking.
+	 */
+	its_number = find_first_zero_bit(&its_list_map, GICv4_ITS_LIST_MAX);
+	if (its_number >= GICv4_ITS_LIST_MAX) {
+		pr_err("ITS@%pa: No ITSList entry available!\n",
+		       &res->start);
+		return -EINVAL;
+	}
+
+	ctlr = readl_relaxed(its_base + GITS_CTLR);
+	ctlr &= ~GITS_CTLR_ITS_NUMBER;
+	ctlr |= its_number << GITS_CTLR_ITS_NUMBER_SHIFT;
+	writel_relaxed(ctlr, its_base + GITS_CTLR);
+	ctlr = readl_relaxed(its_base + GITS_CTLR);
+	if ((ctlr & GITS_CTLR_ITS_NUMBER) != (its_number << GITS_CTLR_ITS_NUMBER_SHIFT)) {
+		/* The ITS number is fixed, use whatever it wants */
+		its_number = ctlr & GITS_CTLR_ITS_NUMBER;
+		its_number >>= GITS_CTLR_ITS_NUMBER_SHIFT;
+	}
+
+	if (test_and_set_bit(its_number, &its_list_map)) {
+		pr_err("ITS@%pa: Duplicate ITSList entry %d\n",
+		       &res->start, its_number);
+		return -EINVAL;
+	}
+
+	return its_number;
+}
+
 static int __init its_probe_one(struct resource *res,
 				struct fwnode_handle *handle, int numa_node)
 {
 	struct its_node *its;
 	void __iomem *its_base;
-	u32 val;
-	u64 baser, tmp;
+	u32 val, ctlr;
+	u64 baser, tmp, typer;
 	int err;
 
 	its_base = ioremap(res->start, resource_size(res));
@@ -1709,10 +3091,26 @@ static int __init its_probe_one(struct resource *res,
 	raw_spin_lock_init(&its->lock);
 	INIT_LIST_HEAD(&its->entry);
 	INIT_LIST_HEAD(&its->its_device_list);
+	INIT_LIST_HEAD(&its->affinity_flush.node);
+	its->affinity_flush.flush = its_affinity_flush;
+	typer = gic_read_typer(its_base + GITS_TYPER);
 	its->base = its_base;
 	its->phys_base = res->start;
-	its->ite_size = ((gic_read_typer(its_base + GITS_TYPER) >> 4) & 0xf) + 1;
+	its->ite_size = ((typer >> 4) & 0xf) + 1;
 	its->numa_node = numa_node;
+	its->is_v4 = !!(typer & GITS_TYPER_VLPIS);
+	if (its->is_v4) {
+		if (!(typer & GITS_TYPER_VMOVP)) {
+			err = its_compute_its_list_map(res, its_base);
+			if (err < 0)
+				goto out_free_its;
+
+			pr_info("ITS@%pa: Using ITS number %d\n",
+				&res->start, err);
+		} else {
+			pr_info("ITS@%pa: Single VMOVP capable\n", &res->start);
+		}
+	}
 
 	its->cmd_base = (void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO,
 						get_order(ITS_CMD_QUEUE_SZ));
@@ -1728,6 +3126,20 @@ static int __init its_probe_one(struct resource *res,
 	if (err)
 		goto out_free_cmd;
 
+	if (its->is_v4) {
+		struct its_baser *vpe_baser;
+
+		vpe_baser = its_get_baser(its, GITS_BASER_TYPE_VCPU);
+		if (vpe_baser) {
+			u32 nr_ids;
+
+			nr_ids = GITS_BASER_NR_PAGES(vpe_baser->val) *
+				 vpe_baser->psz /
+				 GITS_BASER_ENTRY_SIZE(vpe_baser->val);
+			its_nr_vpeids = min(its_nr_vpeids, nr_ids);
+		}
+	}
+
 	err = its_alloc_collections(its);
 	if (err)
 		goto out_free_tables;
@@ -1758,7 +3170,9 @@ static int __init its_probe_one(struct resource *res,
 	}
 
 	gits_write_cwriter(0, its->base + GITS_CWRITER);
-	writel_relaxed(GITS_CTLR_ENABLE, its->base + GITS_CTLR);
+	/* Preserve the ITS number programmed for the ITSList */
+	ctlr = readl_relaxed(its->base + GITS_CTLR);
+	writel_relaxed(ctlr | GITS_CTLR_ENABLE, its->base + GITS_CTLR);
 
 	err = its_init_domain(handle, its);
 	if (err)
@@ -1880,10 +3294,27 @@ static void __init its_acpi_probe(void)
 static void __init its_acpi_probe(void) { }
 #endif
 
+/*
+ * The vPE doorbells are invalidated through the redistributors, which
+ * requires DirectLPI. Without it, GICv4 stays disabled.
+ */
+static int __init its_init_vpe_domain(void)
+{
+	if (gic_rdists->has_direct_lpi) {
+		pr_info("ITS: Using DirectLPI for VPE invalidation\n");
+		return 0;
+	}
+
+	pr_warn("ITS: No DirectLPI support, can't manage vPE doorbells\n");
+	return -ENODEV;
+}
+
 int __init its_init(struct fwnode_handle *handle, struct rdists *rdists,
 		    struct irq_domain *parent_domain)
 {
 	struct device_node *of_node;
+	struct its_node *its;
+	bool has_v4 = false;
 
 	its_parent = parent_domain;
 	of_node = to_of_node(handle);
@@ -1901,5 +3332,18 @@ int __init its_init(struct fwnode_handle *handle, struct rdists *rdists,
 	its_alloc_lpi_tables();
 	its_lpi_init(rdists->id_bits);
 
+	list_for_each_entry(its, &its_nodes, entry)
+		has_v4 |= its->is_v4;
+
+	if (has_v4 & rdists->has_vlpis) {
+		if (its_init_vpe_domain() ||
+		    its_init_v4(parent_domain, &its_vpe_domain_ops)) {
+			rdists->has_vlpis = false;
+			pr_err("ITS: Disabling GICv4 support\n");
+		}
+	} else {
+		rdists->has_vlpis = false;
+	}
+
 	return 0;
 }
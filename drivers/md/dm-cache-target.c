@@ -12,6 +12,7 @@
 #include <linux/dm-io.h>
 #include <linux/dm-kcopyd.h>
 #include <linux/jiffies.h>
+#include <linux/ktime.h>
 #include <linux/init.h>
 #include <linux/mempool.h>
 #include <linux/module.h>
@@ -53,6 +54,14 @@ struct io_tracker {
 	 */
 	unsigned long idle_time;
 	unsigned long last_update_time;
+
+	/*
+	 * Moving average of the completion latency, in ns, and the lowest
+	 * value it took, which is slowly forgotten so that it follows the
+	 * device.
+	 */
+	u64 lat_avg;
+	u64 lat_floor;
 };
 
 static void iot_init(struct io_tracker *iot)
@@ -61,6 +70,8 @@ static void iot_init(struct io_tracker *iot)
 	iot->in_flight = 0ul;
 	iot->idle_time = 0ul;
 	iot->last_update_time = jiffies;
+	iot->lat_avg = 0;
+	iot->lat_floor = 0;
 }
 
 static bool __iot_idle_for(struct io_tracker *iot, unsigned long jifs)
@@ -92,22 +103,65 @@ static void iot_io_begin(struct io_tracker *iot, sector_t len)
 	spin_unlock_irqrestore(&iot->lock, flags);
 }
 
-static void __iot_io_end(struct io_tracker *iot, sector_t len)
+static void __iot_io_end(struct io_tracker *iot, sector_t len, u64 lat)
 {
 	iot->in_flight -= len;
 	if (!iot->in_flight)
 		iot->idle_time = jiffies;
+
+	if (!lat)
+		return;
+
+	if (iot->lat_avg)
+		iot->lat_avg += (s64)(lat - iot->lat_avg) / 8;
+	else
+		iot->lat_avg = lat;
+	if (!iot->lat_floor || iot->lat_avg < iot->lat_floor)
+		iot->lat_floor = iot->lat_avg;
 }
 
-static void iot_io_end(struct io_tracker *iot, sector_t len)
+/*
+ * @lat is the completion latency of the io, or 0 if it shouldn't be
+ * sampled.
+ */
+static void iot_io_end(struct io_tracker *iot, sector_t len, u64 lat)
 {
 	unsigned long flags;
 
 	spin_lock_irqsave(&iot->lock, flags);
-	__iot_io_end(iot, len);
+	__iot_io_end(iot, len, lat);
 	spin_unlock_irqrestore(&iot->lock, flags);
 }
 
+/*
+ * Called every COMMIT_PERIOD, lets the floor drift up by ~6% a period
+ * towards the current average.
+ */
+static void iot_age_latency(struct io_tracker *iot)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&iot->lock, flags);
+	iot->lat_floor = min(iot->lat_avg,
+			     iot->lat_floor + (iot->lat_floor >> 4));
+	spin_unlock_irqrestore(&iot->lock, flags);
+}
+
+/*
+ * Whether the latency went above @ratio percent of the floor.
+ */
+static bool iot_latency_high(struct io_tracker *iot, unsigned ratio)
+{
+	bool r;
+	unsigned long flags;
+
+	spin_lock_irqsave(&iot->lock, flags);
+	r = iot->lat_floor && iot->lat_avg * 100 > iot->lat_floor * ratio;
+	spin_unlock_irqrestore(&iot->lock, flags);
+
+	return r;
+}
+
 /*----------------------------------------------------------------*/
 
 /*
@@ -410,6 +464,7 @@ struct cache {
 	struct bio_list deferred_bios;
 	struct bio_list deferred_writethrough_bios;
 	sector_t migration_threshold;
+	unsigned migration_latency_ratio;
 	wait_queue_head_t migration_wait;
 	atomic_t nr_allocated_migrations;
 
@@ -488,6 +543,7 @@ struct per_bio_data {
 	struct dm_bio_prison_cell_v2 *cell;
 	struct dm_hook_info hook_info;
 	sector_t len;
+	u64 start_ns;
 
 	/*
 	 * writethrough fields.  These MUST remain at the end of this
@@ -912,16 +968,26 @@ static void accounted_begin(struct cache *cache, struct bio *bio)
 
 	if (accountable_bio(cache, bio)) {
 		pb->len = bio_sectors(bio);
+		pb->start_ns = ktime_get_ns();
 		iot_io_begin(&cache->origin_tracker, pb->len);
 	}
 }
 
-static void accounted_complete(struct cache *cache, struct bio *bio)
+/*
+ * @sample is false when the bio didn't actually complete, but is
+ * going to be accounted again.
+ */
+static void accounted_complete(struct cache *cache, struct bio *bio,
+			       bool sample)
 {
 	size_t pb_data_size = get_per_bio_data_size(cache);
 	struct per_bio_data *pb = get_per_bio_data(bio, pb_data_size);
+	u64 lat = 0;
+
+	if (sample && pb->len)
+		lat = max_t(u64, ktime_get_ns() - pb->start_ns, 1);
 
-	iot_io_end(&cache->origin_tracker, pb->len);
+	iot_io_end(&cache->origin_tracker, pb->len, lat);
 }
 
 static void accounted_request(struct cache *cache, struct bio *bio)
@@ -1720,12 +1786,23 @@ enum busy {
 	BUSY
 };
 
+/*
+ * With migration_latency_ratio set, a busy origin is given migrations for
+ * as long as its latency stays within that ratio of the lowest seen
+ * recently, whatever migration_threshold says. The threshold still bounds
+ * migrations to an idle origin.
+ */
 static enum busy spare_migration_bandwidth(struct cache *cache)
 {
 	bool idle = iot_idle_for(&cache->origin_tracker, HZ);
 	sector_t current_volume = (atomic_read(&cache->nr_io_migrations) + 1) *
 		cache->sectors_per_block;
 
+	if (!idle && cache->migration_latency_ratio)
+		return iot_latency_high(&cache->origin_tracker,
+					cache->migration_latency_ratio) ?
+			BUSY : MODERATE;
+
 	if (current_volume <= cache->migration_threshold)
 		return idle ? IDLE : MODERATE;
 	else
@@ -1866,7 +1943,7 @@ static int map_bio(struct cache *cache, struct bio *bio, dm_oblock_t block,
 		 * issue_after_commit will call accounted_begin a second time.  So
 		 * we call accounted_complete() to avoid double accounting.
 		 */
-		accounted_complete(cache, bio);
+		accounted_complete(cache, bio, false);
 		issue_after_commit(&cache->committer, bio);
 		*commit_needed = true;
 		return DM_MAPIO_SUBMITTED;
@@ -2031,6 +2108,7 @@ static void do_waker(struct work_struct *ws)
 	struct cache *cache = container_of(to_delayed_work(ws), struct cache, waker);
 
 	policy_tick(cache->policy, true);
+	iot_age_latency(&cache->origin_tracker);
 	wake_migration_worker(cache);
 	schedule_commit(&cache->committer);
 	queue_delayed_work(cache->wq, &cache->waker, COMMIT_PERIOD);
@@ -2423,6 +2501,15 @@ static int process_config_option(struct cache *cache, const char *key, const cha
 		return 0;
 	}
 
+	if (!strcasecmp(key, "migration_latency_ratio")) {
+		if (kstrtoul(value, 10, &tmp) || (tmp && tmp <= 100) ||
+		    tmp > UINT_MAX)
+			return -EINVAL;
+
+		cache->migration_latency_ratio = tmp;
+		return 0;
+	}
+
 	return NOT_CORE_OPTION;
 }
 
@@ -2837,7 +2924,7 @@ static int cache_end_io(struct dm_target *ti, struct bio *bio, int error)
 	}
 
 	bio_drop_shared_lock(cache, bio);
-	accounted_complete(cache, bio);
+	accounted_complete(cache, bio, true);
 
 	return 0;
 }
@@ -3257,7 +3344,9 @@ static void cache_status(struct dm_target *ti, status_type_t type,
 			goto err;
 		}
 
-		DMEMIT("2 migration_threshold %llu ", (unsigned long long) cache->migration_threshold);
+		DMEMIT("4 migration_threshold %llu migration_latency_ratio %u ",
+		       (unsigned long long) cache->migration_threshold,
+		       cache->migration_latency_ratio);
 
 		DMEMIT("%s ", dm_cache_policy_get_name(cache->policy));
 		if (sz < maxlen) {
@@ -3446,7 +3535,8 @@ static int process_invalidate_cblocks_message(struct cache *cache, unsigned coun
  * and
  *     "invalidate_cblocks [(<begin>)|(<begin>-<end>)]*
  *
- * The key migration_threshold is supported by the cache target core.
+ * The keys migration_threshold and migration_latency_ratio are supported
+ * by the cache target core.
  */
 static int cache_message(struct dm_target *ti, unsigned argc, char **argv)
 {
@@ -3514,7 +3604,7 @@ static void cache_io_hints(struct dm_target *ti, struct queue_limits *limits)
 
 static struct target_type cache_target = {
 	.name = "cache",
-	.version = {2, 0, 0},
+	.version = {2, 1, 0},
 	.module = THIS_MODULE,
 	.ctr = cache_ctr,
 	.dtr = cache_dtr,
@@ -35,6 +35,8 @@
 
 #define DM_VERITY_OPTS_MAX		(2 + DM_VERITY_OPTS_FEC)
 
+#define DM_VERITY_MB_MAX_DIGEST		64
+
 static unsigned dm_verity_prefetch_cluster = DM_VERITY_DEFAULT_PREFETCH_SIZE;
 
 module_param_named(prefetch_cluster, dm_verity_prefetch_cluster, uint, S_IRUGO | S_IWUSR);
@@ -473,6 +475,68 @@ static int verity_bv_zero(struct dm_verity *v, struct dm_verity_io *io,
 	return 0;
 }
 
+/*
+ * Verify data blocks io->block + b and io->block + b + 1 with a single
+ * multi-buffer hash. Returns 1 if both are correct, 0 if they have to be
+ * verified one by one (not mapped in one piece each, zero blocks, or a
+ * mismatch, which the slow path reports), or a negative error.
+ */
+static int verity_verify_mb(struct dm_verity *v, struct dm_verity_io *io,
+			    unsigned b)
+{
+	unsigned block_size = 1 << v->data_dev_block_bits;
+	struct bio *bio = dm_bio_from_per_bio_data(io, v->ti->per_io_data_size);
+	u8 want[2][DM_VERITY_MB_MAX_DIGEST], real[2][DM_VERITY_MB_MAX_DIGEST];
+	u8 * const outs[2] = { real[0], real[1] };
+	SHASH_DESC_ON_STACK(desc, v->mb_tfm);
+	struct bvec_iter iter = io->iter;
+	struct bio_vec bv[2];
+	const u8 *data[2];
+	u8 *page[2];
+	bool is_zero;
+	int i, r;
+
+	for (i = 0; i < 2; i++) {
+		r = verity_hash_for_block(v, io, io->block + b + i, want[i],
+					  &is_zero);
+		if (unlikely(r < 0))
+			return r;
+		if (is_zero)
+			return 0;
+
+		bv[i] = bio_iter_iovec(bio, iter);
+		if (bv[i].bv_len < block_size)
+			return 0;
+		bio_advance_iter(bio, &iter, block_size);
+	}
+
+	desc->tfm = v->mb_tfm;
+	desc->flags = 0;
+
+	page[0] = kmap_atomic(bv[0].bv_page);
+	page[1] = kmap_atomic(bv[1].bv_page);
+	data[0] = page[0] + bv[0].bv_offset;
+	data[1] = page[1] + bv[1].bv_offset;
+
+	r = crypto_shash_import(desc, v->mb_hashstate) ?:
+	    crypto_shash_finup_mb(desc, data, block_size, outs, 2);
+
+	kunmap_atomic(page[1]);
+	kunmap_atomic(page[0]);
+
+	if (unlikely(r < 0)) {
+		DMERR("verity_verify_mb crypto op failed: %d", r);
+		return r;
+	}
+
+	if (memcmp(real[0], want[0], v->digest_size) ||
+	    memcmp(real[1], want[1], v->digest_size))
+		return 0;
+
+	io->iter = iter;
+	return 1;
+}
+
 /*
  * Verify one "dm_verity_io" structure.
  */
@@ -488,6 +552,16 @@ static int verity_verify_io(struct dm_verity_io *io)
 		int r;
 		struct ahash_request *req = verity_io_hash_req(v, io);
 
+		if (v->mb_tfm && b + 1 < io->n_blocks) {
+			r = verity_verify_mb(v, io, b);
+			if (unlikely(r < 0))
+				return r;
+			if (r) {
+				b++;
+				continue;
+			}
+		}
+
 		r = verity_hash_for_block(v, io, io->block + b,
 					  verity_io_want_digest(v, io),
 					  &is_zero);
@@ -788,6 +862,10 @@ static void verity_dtr(struct dm_target *ti)
 	if (v->tfm)
 		crypto_free_ahash(v->tfm);
 
+	if (v->mb_tfm)
+		crypto_free_shash(v->mb_tfm);
+	kfree(v->mb_hashstate);
+
 	kfree(v->alg_name);
 
 	if (v->hash_dev)
@@ -832,6 +910,58 @@ static int verity_alloc_zero_digest(struct dm_verity *v)
 	return r;
 }
 
+static int verity_mb_salt_state(struct dm_verity *v, struct crypto_shash *tfm,
+				u8 *state)
+{
+	SHASH_DESC_ON_STACK(desc, tfm);
+
+	desc->tfm = tfm;
+	desc->flags = CRYPTO_TFM_REQ_MAY_SLEEP;
+
+	return crypto_shash_init(desc) ?:
+	       crypto_shash_update(desc, v->salt, v->salt_size) ?:
+	       crypto_shash_export(desc, state);
+}
+
+/*
+ * Data blocks are hashed two at a time if the hash has a multi-buffer
+ * implementation. This is only an optimization: if anything is missing,
+ * blocks are hashed one by one through v->tfm. The salt must come first,
+ * so that it can be hashed once, here.
+ */
+static void verity_setup_mb(struct dm_verity *v)
+{
+	struct crypto_shash *tfm;
+	u8 *state;
+
+	if (!v->version || v->digest_size > DM_VERITY_MB_MAX_DIGEST)
+		return;
+
+	tfm = crypto_alloc_shash(v->alg_name, 0, 0);
+	if (IS_ERR(tfm))
+		return;
+
+	if (crypto_shash_mb_max_msgs(tfm) < 2 ||
+	    crypto_shash_digestsize(tfm) != v->digest_size)
+		goto bad;
+
+	state = kmalloc(crypto_shash_statesize(tfm), GFP_KERNEL);
+	if (!state)
+		goto bad;
+
+	if (verity_mb_salt_state(v, tfm, state)) {
+		kfree(state);
+		goto bad;
+	}
+
+	v->mb_tfm = tfm;
+	v->mb_hashstate = state;
+	return;
+
+bad:
+	crypto_free_shash(tfm);
+}
+
 static int verity_parse_opt_args(struct dm_arg_set *as, struct dm_verity *v)
 {
 	int r;
@@ -1062,6 +1192,8 @@ static int verity_ctr(struct dm_target *ti, unsigned argc, char **argv)
 			goto bad;
 	}
 
+	verity_setup_mb(v);
+
 	v->hash_per_block_bits =
 		__fls((1 << v->hash_dev_block_bits) / v->digest_size);
 
@@ -38,6 +38,8 @@ struct dm_verity {
 	struct dm_bufio_client *bufio;
 	char *alg_name;
 	struct crypto_ahash *tfm;
+	struct crypto_shash *mb_tfm;	/* hashes several data blocks at once */
+	u8 *mb_hashstate;	/* mb_tfm state after hashing the salt */
 	u8 *root_digest;	/* digest of the root block */
 	u8 *salt;		/* salt: its size is salt_size */
 	u8 *zero_digest;	/* digest for a zero block */
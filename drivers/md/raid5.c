@@ -75,6 +75,10 @@ static bool devices_handle_discard_safely = false;
 module_param(devices_handle_discard_safely, bool, 0644);
 MODULE_PARM_DESC(devices_handle_discard_safely,
 		 "Set to Y if all devices in each array reliably return zeroes on reads from discarded regions");
+static int default_group_thread_cnt = -1;
+module_param(default_group_thread_cnt, int, 0644);
+MODULE_PARM_DESC(default_group_thread_cnt,
+		 "Worker threads per NUMA node for new arrays, -1 to size it from the number of CPUs");
 static struct workqueue_struct *raid5_wq;
 
 static inline struct hlist_head *stripe_hash(struct r5conf *conf, sector_t sect)
@@ -6655,6 +6659,28 @@ static int alloc_thread_groups(struct r5conf *conf, int cnt,
 	return 0;
 }
 
+/*
+ * raid5d alone can't keep up with fast devices once there are more than
+ * a handful of CPUs per node submitting stripes, so on large machines
+ * start with one worker per RAID5_CPUS_PER_WORKER CPUs in each node.
+ * Small machines keep handling stripes in raid5d only.
+ */
+#define RAID5_CPUS_PER_WORKER	8
+#define RAID5_MAX_AUTO_WORKERS	8
+
+static int raid5_default_thread_cnt(void)
+{
+	int cpus;
+
+	if (default_group_thread_cnt >= 0)
+		return default_group_thread_cnt;
+
+	cpus = num_online_cpus() / num_possible_nodes();
+	if (cpus < 2 * RAID5_CPUS_PER_WORKER)
+		return 0;
+	return min(cpus / RAID5_CPUS_PER_WORKER, RAID5_MAX_AUTO_WORKERS);
+}
+
 static void free_thread_groups(struct r5conf *conf)
 {
 	if (conf->worker_groups)
@@ -6862,8 +6888,8 @@ static struct r5conf *setup_conf(struct mddev *mddev)
 		goto abort;
 	for (i = 0; i < PENDING_IO_MAX; i++)
 		list_add(&conf->pending_data[i].sibling, &conf->free_list);
-	/* Don't enable multi-threading by default*/
-	if (!alloc_thread_groups(conf, 0, &group_cnt, &worker_cnt_per_group,
+	if (!alloc_thread_groups(conf, raid5_default_thread_cnt(),
+				 &group_cnt, &worker_cnt_per_group,
 				 &new_group)) {
 		conf->group_cnt = group_cnt;
 		conf->worker_cnt_per_group = worker_cnt_per_group;
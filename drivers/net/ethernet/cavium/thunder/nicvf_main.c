@@ -539,6 +539,7 @@ static inline bool nicvf_xdp_rx(struct nicvf *nic, struct bpf_prog *prog,
 	}
 
 	switch (action) {
+	case XDP_REDIRECT:
 	case XDP_PASS:
 		/* Check if it's a recycled page, if not
 		 * unmap the DMA mapping.
@@ -553,6 +554,13 @@ static inline bool nicvf_xdp_rx(struct nicvf *nic, struct bpf_prog *prog,
 					     DMA_ATTR_SKIP_CPU_SYNC);
 		}
 
+		/* The frame owns our page reference from here on */
+		if (action == XDP_REDIRECT) {
+			if (xdp_do_redirect(nic->netdev, &xdp, prog))
+				put_page(page);
+			return true;
+		}
+
 		/* Build SKB and pass on packet to network stack */
 		*skb = build_skb(xdp.data,
 				 RCV_FRAG_LEN - cqe_rx->align_pad + offset);
@@ -825,6 +833,10 @@ static int nicvf_cq_intr_handler(struct net_device *netdev, u8 cq_idx,
 		goto loop;
 
 done:
+	/* Send out whatever XDP_REDIRECT queued during this poll */
+	if (nic->xdp_prog)
+		xdp_do_flush_map();
+
 	/* Update SQ's descriptor free count */
 	if (subdesc_cnt)
 		nicvf_put_sq_desc(sq, subdesc_cnt);
@@ -66,6 +66,21 @@ static bool use_cmb_sqes = true;
 module_param(use_cmb_sqes, bool, 0644);
 MODULE_PARM_DESC(use_cmb_sqes, "use controller's memory buffer for I/O SQes");
 
+static unsigned int poll_queues;
+module_param(poll_queues, uint, 0644);
+MODULE_PARM_DESC(poll_queues,
+		 "number of I/O queues without interrupts, for polled I/O");
+
+static unsigned int cq_coalesce_entries;
+module_param(cq_coalesce_entries, uint, 0644);
+MODULE_PARM_DESC(cq_coalesce_entries,
+		 "completions to aggregate per interrupt (1-256, 0 to disable)");
+
+static unsigned int cq_coalesce_time;
+module_param(cq_coalesce_time, uint, 0644);
+MODULE_PARM_DESC(cq_coalesce_time,
+		 "max interrupt aggregation delay, in 100us units (1-255)");
+
 static struct workqueue_struct *nvme_workq;
 
 struct nvme_dev;
@@ -89,6 +104,7 @@ struct nvme_dev {
 	unsigned queue_count;
 	unsigned online_queues;
 	unsigned max_qid;
+	unsigned nr_poll_queues;
 	int q_depth;
 	u32 db_stride;
 	void __iomem *bar;
@@ -143,10 +159,12 @@ struct nvme_queue {
 	u16 q_depth;
 	s16 cq_vector;
 	u16 sq_tail;
+	u16 last_sq_tail;	/* as last written to the doorbell */
 	u16 cq_head;
 	u16 qid;
 	u8 cq_phase;
 	u8 cqe_seen;
+	bool polled;
 	u32 *dbbuf_sq_db;
 	u32 *dbbuf_cq_db;
 	u32 *dbbuf_sq_ei;
@@ -396,15 +414,39 @@ static int nvme_pci_map_queues(struct blk_mq_tag_set *set)
 	return blk_mq_pci_map_queues(set, to_pci_dev(dev->dev));
 }
 
+/*
+ * Ring the SQ doorbell, unless @write_sq is false and more commands are
+ * coming: those are then left for the last one, or for nvme_commit_rqs().
+ * The doorbell is still rung before the queue could fill up unseen.
+ */
+static void nvme_write_sq_db(struct nvme_queue *nvmeq, bool write_sq)
+{
+	if (!write_sq) {
+		u16 next_tail = nvmeq->sq_tail + 1;
+
+		if (next_tail == nvmeq->q_depth)
+			next_tail = 0;
+		if (next_tail != nvmeq->last_sq_tail)
+			return;
+	}
+
+	if (nvme_dbbuf_update_and_check_event(nvmeq->sq_tail,
+					      nvmeq->dbbuf_sq_db,
+					      nvmeq->dbbuf_sq_ei))
+		writel(nvmeq->sq_tail, nvmeq->q_db);
+	nvmeq->last_sq_tail = nvmeq->sq_tail;
+}
+
 /**
  * __nvme_submit_cmd() - Copy a command into a queue and ring the doorbell
  * @nvmeq: The queue to use
  * @cmd: The command to send
+ * @write_sq: whether to ring the doorbell now, see nvme_write_sq_db()
  *
  * Safe to use from interrupt context
  */
 static void __nvme_submit_cmd(struct nvme_queue *nvmeq,
-						struct nvme_command *cmd)
+			      struct nvme_command *cmd, bool write_sq)
 {
 	u16 tail = nvmeq->sq_tail;
 
@@ -415,10 +457,18 @@ static void __nvme_submit_cmd(struct nvme_queue *nvmeq,
 
 	if (++tail == nvmeq->q_depth)
 		tail = 0;
-	if (nvme_dbbuf_update_and_check_event(tail, nvmeq->dbbuf_sq_db,
-					      nvmeq->dbbuf_sq_ei))
-		writel(tail, nvmeq->q_db);
 	nvmeq->sq_tail = tail;
+	nvme_write_sq_db(nvmeq, write_sq);
+}
+
+static void nvme_commit_rqs(struct blk_mq_hw_ctx *hctx)
+{
+	struct nvme_queue *nvmeq = hctx->driver_data;
+
+	spin_lock_irq(&nvmeq->q_lock);
+	if (nvmeq->sq_tail != nvmeq->last_sq_tail)
+		nvme_write_sq_db(nvmeq, true);
+	spin_unlock_irq(&nvmeq->q_lock);
 }
 
 static __le64 **iod_list(struct request *req)
@@ -733,8 +783,9 @@ static int nvme_queue_rq(struct blk_mq_hw_ctx *hctx,
 		spin_unlock_irq(&nvmeq->q_lock);
 		goto out_cleanup_iod;
 	}
-	__nvme_submit_cmd(nvmeq, &cmnd);
-	nvme_process_cq(nvmeq);
+	__nvme_submit_cmd(nvmeq, &cmnd, bd->last);
+	if (bd->last)
+		nvme_process_cq(nvmeq);
 	spin_unlock_irq(&nvmeq->q_lock);
 	return BLK_MQ_RQ_QUEUE_OK;
 out_cleanup_iod:
@@ -872,7 +923,7 @@ static void nvme_pci_submit_async_event(struct nvme_ctrl *ctrl, int aer_idx)
 	c.common.command_id = NVME_AQ_BLKMQ_DEPTH + aer_idx;
 
 	spin_lock_irq(&nvmeq->q_lock);
-	__nvme_submit_cmd(nvmeq, &c);
+	__nvme_submit_cmd(nvmeq, &c, true);
 	spin_unlock_irq(&nvmeq->q_lock);
 }
 
@@ -891,7 +942,10 @@ static int adapter_alloc_cq(struct nvme_dev *dev, u16 qid,
 						struct nvme_queue *nvmeq)
 {
 	struct nvme_command c;
-	int flags = NVME_QUEUE_PHYS_CONTIG | NVME_CQ_IRQ_ENABLED;
+	int flags = NVME_QUEUE_PHYS_CONTIG;
+
+	if (!nvmeq->polled)
+		flags |= NVME_CQ_IRQ_ENABLED;
 
 	/*
 	 * Note: we (ab)use the fact the the prp fields survive if no data
@@ -903,7 +957,8 @@ static int adapter_alloc_cq(struct nvme_dev *dev, u16 qid,
 	c.create_cq.cqid = cpu_to_le16(qid);
 	c.create_cq.qsize = cpu_to_le16(nvmeq->q_depth - 1);
 	c.create_cq.cq_flags = cpu_to_le16(flags);
-	c.create_cq.irq_vector = cpu_to_le16(nvmeq->cq_vector);
+	if (!nvmeq->polled)
+		c.create_cq.irq_vector = cpu_to_le16(nvmeq->cq_vector);
 
 	return nvme_submit_sync_cmd(dev->ctrl.admin_q, &c, NULL, 0);
 }
@@ -1080,7 +1135,8 @@ static int nvme_suspend_queue(struct nvme_queue *nvmeq)
 	if (!nvmeq->qid && nvmeq->dev->ctrl.admin_q)
 		blk_mq_stop_hw_queues(nvmeq->dev->ctrl.admin_q);
 
-	pci_free_irq(to_pci_dev(nvmeq->dev->dev), vector, nvmeq);
+	if (!nvmeq->polled)
+		pci_free_irq(to_pci_dev(nvmeq->dev->dev), vector, nvmeq);
 
 	return 0;
 }
@@ -1205,6 +1261,7 @@ static void nvme_init_queue(struct nvme_queue *nvmeq, u16 qid)
 
 	spin_lock_irq(&nvmeq->q_lock);
 	nvmeq->sq_tail = 0;
+	nvmeq->last_sq_tail = 0;
 	nvmeq->cq_head = 0;
 	nvmeq->cq_phase = 1;
 	nvmeq->q_db = &dev->dbs[qid * 2 * dev->db_stride];
@@ -1214,12 +1271,23 @@ static void nvme_init_queue(struct nvme_queue *nvmeq, u16 qid)
 	spin_unlock_irq(&nvmeq->q_lock);
 }
 
+/*
+ * The poll queues come last, and have no interrupt vector: their completions
+ * are only reaped by nvme_poll(), or opportunistically from nvme_queue_rq().
+ */
+static bool nvme_queue_is_polled(struct nvme_dev *dev, int qid)
+{
+	return qid > dev->max_qid - dev->nr_poll_queues;
+}
+
 static int nvme_create_queue(struct nvme_queue *nvmeq, int qid)
 {
 	struct nvme_dev *dev = nvmeq->dev;
 	int result;
 
-	nvmeq->cq_vector = qid - 1;
+	/* A polled queue still needs a cq_vector >= 0 to be live */
+	nvmeq->polled = nvme_queue_is_polled(dev, qid);
+	nvmeq->cq_vector = nvmeq->polled ? 0 : qid - 1;
 	result = adapter_alloc_cq(dev, qid, nvmeq);
 	if (result < 0)
 		return result;
@@ -1228,9 +1296,11 @@ static int nvme_create_queue(struct nvme_queue *nvmeq, int qid)
 	if (result < 0)
 		goto release_cq;
 
-	result = queue_request_irq(nvmeq);
-	if (result < 0)
-		goto release_sq;
+	if (!nvmeq->polled) {
+		result = queue_request_irq(nvmeq);
+		if (result < 0)
+			goto release_sq;
+	}
 
 	nvme_init_queue(nvmeq, qid);
 	return result;
@@ -1244,6 +1314,7 @@ static int nvme_create_queue(struct nvme_queue *nvmeq, int qid)
 
 static const struct blk_mq_ops nvme_mq_admin_ops = {
 	.queue_rq	= nvme_queue_rq,
+	.commit_rqs	= nvme_commit_rqs,
 	.complete	= nvme_pci_complete_rq,
 	.init_hctx	= nvme_admin_init_hctx,
 	.exit_hctx      = nvme_admin_exit_hctx,
@@ -1253,6 +1324,7 @@ static const struct blk_mq_ops nvme_mq_admin_ops = {
 
 static const struct blk_mq_ops nvme_mq_ops = {
 	.queue_rq	= nvme_queue_rq,
+	.commit_rqs	= nvme_commit_rqs,
 	.complete	= nvme_pci_complete_rq,
 	.init_hctx	= nvme_init_hctx,
 	.init_request	= nvme_init_request,
@@ -1425,8 +1497,11 @@ static int nvme_create_io_queues(struct nvme_dev *dev)
 
 	for (i = dev->queue_count; i <= dev->max_qid; i++) {
 		/* vector == qid - 1, match nvme_create_queue */
-		if (!nvme_alloc_queue(dev, i, dev->q_depth,
-		     pci_irq_get_node(to_pci_dev(dev->dev), i - 1))) {
+		int node = nvme_queue_is_polled(dev, i) ?
+			dev_to_node(dev->dev) :
+			pci_irq_get_node(to_pci_dev(dev->dev), i - 1);
+
+		if (!nvme_alloc_queue(dev, i, dev->q_depth, node)) {
 			ret = -ENOMEM;
 			break;
 		}
@@ -1514,11 +1589,33 @@ static size_t db_bar_size(struct nvme_dev *dev, unsigned nr_io_queues)
 	return 4096 + ((nr_io_queues + 1) * 8 * dev->db_stride);
 }
 
+/*
+ * Interrupt coalescing is off unless asked for: it trades completion
+ * latency at low queue depths for fewer interrupts, and CQ head doorbell
+ * writes, at high ones.
+ */
+static void nvme_set_irq_coalescing(struct nvme_dev *dev)
+{
+	unsigned int entries = min(cq_coalesce_entries, 256U);
+	unsigned int time = min(cq_coalesce_time, 255U);
+	int status;
+
+	if (!entries || !time)
+		return;
+
+	/* the threshold is 0's based */
+	status = nvme_set_features(&dev->ctrl, NVME_FEAT_IRQ_COALESCE,
+				   (time << 8) | (entries - 1), NULL, 0, NULL);
+	if (status)
+		dev_warn(dev->ctrl.device,
+			 "failed to set interrupt coalescing: %d\n", status);
+}
+
 static int nvme_setup_io_queues(struct nvme_dev *dev)
 {
 	struct nvme_queue *adminq = dev->queues[0];
 	struct pci_dev *pdev = to_pci_dev(dev->dev);
-	int result, nr_io_queues, size;
+	int result, nr_io_queues, nr_poll_queues, size;
 
 	nr_io_queues = num_online_cpus();
 	result = nvme_set_queue_count(&dev->ctrl, &nr_io_queues);
@@ -1528,6 +1625,8 @@ static int nvme_setup_io_queues(struct nvme_dev *dev)
 	if (nr_io_queues == 0)
 		return 0;
 
+	nvme_set_irq_coalescing(dev);
+
 	if (dev->cmb && NVME_CMB_SQS(dev->cmbsz)) {
 		result = nvme_cmb_qdepth(dev, nr_io_queues,
 				sizeof(struct nvme_command));
@@ -1552,6 +1651,13 @@ static int nvme_setup_io_queues(struct nvme_dev *dev)
 		adminq->q_db = dev->dbs;
 	}
 
+	/*
+	 * The poll queues are carved out of the queues we got, as the
+	 * block layer doesn't take more than one queue per cpu. At least
+	 * one queue is left with an interrupt.
+	 */
+	nr_poll_queues = min_t(int, poll_queues, nr_io_queues - 1);
+
 	/* Deregister the admin queue's interrupt */
 	pci_free_irq(pdev, 0, adminq);
 
@@ -1560,11 +1666,13 @@ static int nvme_setup_io_queues(struct nvme_dev *dev)
 	 * setting up the full range we need.
 	 */
 	pci_free_irq_vectors(pdev);
-	nr_io_queues = pci_alloc_irq_vectors(pdev, 1, nr_io_queues,
+	nr_io_queues = pci_alloc_irq_vectors(pdev, 1,
+			nr_io_queues - nr_poll_queues,
 			PCI_IRQ_ALL_TYPES | PCI_IRQ_AFFINITY);
 	if (nr_io_queues <= 0)
 		return -EIO;
-	dev->max_qid = nr_io_queues;
+	dev->max_qid = nr_io_queues + nr_poll_queues;
+	dev->nr_poll_queues = nr_poll_queues;
 
 	/*
 	 * Should investigate if there's a performance win from allocating
@@ -1660,6 +1768,18 @@ static void nvme_disable_io_queues(struct nvme_dev *dev, int queues)
 	}
 }
 
+/*
+ * The poll queues that could be created, if queue creation stopped early.
+ */
+static unsigned nvme_online_poll_queues(struct nvme_dev *dev)
+{
+	unsigned irq_queues = dev->max_qid - dev->nr_poll_queues;
+
+	if (dev->online_queues - 1 <= irq_queues)
+		return 0;
+	return dev->online_queues - 1 - irq_queues;
+}
+
 /*
  * Return: error value if an error occurred setting up the queues or calling
  * Identify Device.  0 if these succeeded, even if adding some of the
@@ -1671,6 +1791,7 @@ static int nvme_dev_add(struct nvme_dev *dev)
 	if (!dev->ctrl.tagset) {
 		dev->tagset.ops = &nvme_mq_ops;
 		dev->tagset.nr_hw_queues = dev->online_queues - 1;
+		dev->tagset.nr_poll_queues = nvme_online_poll_queues(dev);
 		dev->tagset.timeout = NVME_IO_TIMEOUT;
 		dev->tagset.numa_node = dev_to_node(dev->dev);
 		dev->tagset.queue_depth =
@@ -1685,6 +1806,7 @@ static int nvme_dev_add(struct nvme_dev *dev)
 
 		nvme_dbbuf_set(dev);
 	} else {
+		dev->tagset.nr_poll_queues = nvme_online_poll_queues(dev);
 		blk_mq_update_nr_hw_queues(&dev->tagset, dev->online_queues - 1);
 
 		/* Free previously allocated queues that are no longer usable */
@@ -7,6 +7,7 @@
  */
 
 #include <linux/compat.h>
+#include <linux/debugfs.h>
 #include <linux/eventfd.h>
 #include <linux/vhost.h>
 #include <linux/virtio_net.h>
@@ -16,8 +17,8 @@
 #include <linux/mutex.h>
 #include <linux/workqueue.h>
 #include <linux/file.h>
+#include <linux/seq_file.h>
 #include <linux/slab.h>
-#include <linux/sched/clock.h>
 #include <linux/sched/signal.h>
 #include <linux/vmalloc.h>
 
@@ -38,10 +39,16 @@ module_param(experimental_zcopytx, int, 0444);
 MODULE_PARM_DESC(experimental_zcopytx, "Enable Zero Copy TX;"
 		                       " 1 -Enable; 0 - Disable");
 
+static struct dentry *vhost_net_debugfs_dir;
+static atomic_t vhost_net_debugfs_id = ATOMIC_INIT(0);
+
 /* Max number of bytes transferred before requeueing the job.
  * Using this limit prevents one virtqueue from starving others. */
 #define VHOST_NET_WEIGHT 0x80000
 
+/* Max number of used buffers batched before updating the used ring */
+#define VHOST_NET_BATCH 64
+
 /* MAX number of TX used buffers for outstanding zerocopy */
 #define VHOST_MAX_PEND 128
 #define VHOST_GOODCOPY_LEN 256
@@ -89,6 +96,8 @@ struct vhost_net_virtqueue {
 	struct vhost_virtqueue vq;
 	size_t vhost_hlen;
 	size_t sock_hlen;
+	/* Number of used buffers batched in vq->heads, unused for zerocopy */
+	int nheads;
 	/* vhost zerocopy support fields below: */
 	/* last used idx for outstanding DMA zerocopy buffers */
 	int upend_idx;
@@ -113,6 +122,7 @@ struct vhost_net {
 	unsigned tx_zcopy_err;
 	/* Flush in progress. Protected by tx vq lock. */
 	bool tx_flush;
+	struct dentry *debugfs_dentry;
 };
 
 static unsigned vhost_net_zcopy_mask __read_mostly;
@@ -198,6 +208,7 @@ static void vhost_net_vq_reset(struct vhost_net *n)
 	for (i = 0; i < VHOST_NET_VQ_MAX; i++) {
 		n->vqs[i].done_idx = 0;
 		n->vqs[i].upend_idx = 0;
+		n->vqs[i].nheads = 0;
 		n->vqs[i].ubufs = NULL;
 		n->vqs[i].vhost_hlen = 0;
 		n->vqs[i].sock_hlen = 0;
@@ -291,20 +302,6 @@ static void vhost_zerocopy_callback(struct ubuf_info *ubuf, bool success)
 	rcu_read_unlock_bh();
 }
 
-static inline unsigned long busy_clock(void)
-{
-	return local_clock() >> 10;
-}
-
-static bool vhost_can_busy_poll(struct vhost_dev *dev,
-				unsigned long endtime)
-{
-	return likely(!need_resched()) &&
-	       likely(!time_after(busy_clock(), endtime)) &&
-	       likely(!signal_pending(current)) &&
-	       !vhost_has_work(dev);
-}
-
 static void vhost_net_disable_vq(struct vhost_net *n,
 				 struct vhost_virtqueue *vq)
 {
@@ -331,24 +328,41 @@ static int vhost_net_enable_vq(struct vhost_net *n,
 	return vhost_poll_start(poll, sock->file);
 }
 
+/* Publish the batched used buffers with one used index update and signal */
+static void vhost_net_signal_used(struct vhost_net_virtqueue *nvq)
+{
+	struct vhost_virtqueue *vq = &nvq->vq;
+
+	if (!nvq->nheads)
+		return;
+
+	vhost_add_used_and_signal_n(vq->dev, vq, vq->heads, nvq->nheads);
+	nvq->nheads = 0;
+}
+
 static int vhost_net_tx_get_vq_desc(struct vhost_net *net,
 				    struct vhost_virtqueue *vq,
 				    struct iovec iov[], unsigned int iov_size,
 				    unsigned int *out_num, unsigned int *in_num)
 {
+	struct vhost_net_virtqueue *nvq = &net->vqs[VHOST_NET_VQ_TX];
 	unsigned long uninitialized_var(endtime);
+	unsigned int timeout = vhost_busy_poll_time(&nvq->vq);
 	int r = vhost_get_vq_desc(vq, vq->iov, ARRAY_SIZE(vq->iov),
 				  out_num, in_num, NULL, NULL);
 
-	if (r == vq->num && vq->busyloop_timeout) {
+	if (r == vq->num && timeout) {
+		/* Don't keep the guest waiting for buffers while we spin */
+		vhost_net_signal_used(nvq);
 		preempt_disable();
-		endtime = busy_clock() + vq->busyloop_timeout;
-		while (vhost_can_busy_poll(vq->dev, endtime) &&
+		endtime = busy_clock() + timeout;
+		while (vhost_can_busy_poll(vq, endtime) &&
 		       vhost_vq_avail_empty(vq->dev, vq))
 			cpu_relax();
 		preempt_enable();
 		r = vhost_get_vq_desc(vq, vq->iov, ARRAY_SIZE(vq->iov),
 				      out_num, in_num, NULL, NULL);
+		vhost_busy_poll_done(&nvq->vq, r != vq->num);
 	}
 
 	return r;
@@ -394,6 +408,7 @@ static void handle_tx(struct vhost_net *net)
 		goto out;
 
 	vhost_disable_notify(&net->dev, vq);
+	vhost_busy_poll_wake(&nvq->vq);
 
 	hdr_size = nvq->vhost_hlen;
 	zcopy = nvq->ubufs;
@@ -421,6 +436,7 @@ static void handle_tx(struct vhost_net *net)
 				vhost_disable_notify(&net->dev, vq);
 				continue;
 			}
+			vhost_busy_poll_idle(&nvq->vq);
 			break;
 		}
 		if (in) {
@@ -489,16 +505,23 @@ static void handle_tx(struct vhost_net *net)
 		if (err != len)
 			pr_debug("Truncated TX packet: "
 				 " len %d != %zd\n", err, len);
-		if (!zcopy_used)
-			vhost_add_used_and_signal(&net->dev, vq, head, 0);
-		else
+		if (zcopy_used) {
 			vhost_zerocopy_signal_used(net, vq);
+		} else if (zcopy) {
+			vhost_add_used_and_signal(&net->dev, vq, head, 0);
+		} else {
+			vq->heads[nvq->nheads].id = cpu_to_vhost32(vq, head);
+			vq->heads[nvq->nheads].len = 0;
+			if (++nvq->nheads >= VHOST_NET_BATCH)
+				vhost_net_signal_used(nvq);
+		}
 		vhost_net_tx_packet(net);
 		if (unlikely(total_len >= VHOST_NET_WEIGHT)) {
 			vhost_poll_queue(&vq->poll);
 			break;
 		}
 	}
+	vhost_net_signal_used(nvq);
 out:
 	mutex_unlock(&vq->mutex);
 }
@@ -535,22 +558,33 @@ static int sk_has_rx_data(struct sock *sk)
 	return skb_queue_empty(&sk->sk_receive_queue);
 }
 
+/*
+ * The rx socket is polled for the window of the rx vq, bounded by its own
+ * busyloop timeout. The tx ring is watched at the same time so that a tx
+ * kick does not have to wait for the poll to end.
+ */
 static int vhost_net_rx_peek_head_len(struct vhost_net *net, struct sock *sk)
 {
+	struct vhost_net_virtqueue *rnvq = &net->vqs[VHOST_NET_VQ_RX];
 	struct vhost_net_virtqueue *nvq = &net->vqs[VHOST_NET_VQ_TX];
 	struct vhost_virtqueue *vq = &nvq->vq;
 	unsigned long uninitialized_var(endtime);
+	unsigned int timeout = vhost_busy_poll_time(&rnvq->vq);
 	int len = peek_head_len(sk);
 
-	if (!len && vq->busyloop_timeout) {
+	if (!len && timeout) {
+		/* Don't keep the guest waiting for buffers while we spin */
+		vhost_net_signal_used(rnvq);
 		/* Both tx vq and rx socket were polled here */
 		mutex_lock(&vq->mutex);
 		vhost_disable_notify(&net->dev, vq);
 
 		preempt_disable();
-		endtime = busy_clock() + vq->busyloop_timeout;
+		endtime = busy_clock() + timeout;
 
-		while (vhost_can_busy_poll(&net->dev, endtime) &&
+		/* We hold the tx vq mutex: yield to work of either worker */
+		while (vhost_can_busy_poll(vq, endtime) &&
+		       !vhost_vq_has_work(&rnvq->vq) &&
 		       !sk_has_rx_data(sk) &&
 		       vhost_vq_avail_empty(&net->dev, vq))
 			cpu_relax();
@@ -562,6 +596,7 @@ static int vhost_net_rx_peek_head_len(struct vhost_net *net, struct sock *sk)
 		mutex_unlock(&vq->mutex);
 
 		len = peek_head_len(sk);
+		vhost_busy_poll_done(&rnvq->vq, len);
 	}
 
 	return len;
@@ -682,6 +717,7 @@ static void handle_rx(struct vhost_net *net)
 
 	vhost_disable_notify(&net->dev, vq);
 	vhost_net_disable_vq(net, vq);
+	vhost_busy_poll_wake(&nvq->vq);
 
 	vhost_hlen = nvq->vhost_hlen;
 	sock_hlen = nvq->sock_hlen;
@@ -693,14 +729,20 @@ static void handle_rx(struct vhost_net *net)
 	while ((sock_len = vhost_net_rx_peek_head_len(net, sock->sk))) {
 		sock_len += sock_hlen;
 		vhost_len = sock_len + vhost_hlen;
-		headcount = get_rx_bufs(vq, vq->heads, vhost_len,
+		headcount = get_rx_bufs(vq, vq->heads + nvq->nheads, vhost_len,
 					&in, vq_log, &log,
-					likely(mergeable) ? UIO_MAXIOV : 1);
+					likely(mergeable) ?
+					UIO_MAXIOV - nvq->nheads : 1);
 		/* On error, stop handling until the next kick. */
 		if (unlikely(headcount < 0))
 			goto out;
 		/* On overrun, truncate and discard */
 		if (unlikely(headcount > UIO_MAXIOV)) {
+			/* Unless the batched buffers took the room needed */
+			if (nvq->nheads) {
+				vhost_net_signal_used(nvq);
+				continue;
+			}
 			iov_iter_init(&msg.msg_iter, READ, vq->iov, 1, 1);
 			err = sock->ops->recvmsg(sock, &msg,
 						 1, MSG_DONTWAIT | MSG_TRUNC);
@@ -763,8 +805,9 @@ static void handle_rx(struct vhost_net *net)
 			vhost_discard_vq_desc(vq, headcount);
 			goto out;
 		}
-		vhost_add_used_and_signal_n(&net->dev, vq, vq->heads,
-					    headcount);
+		nvq->nheads += headcount;
+		if (nvq->nheads >= VHOST_NET_BATCH)
+			vhost_net_signal_used(nvq);
 		if (unlikely(vq_log))
 			vhost_log_write(vq, vq_log, log, vhost_len);
 		total_len += vhost_len;
@@ -773,8 +816,10 @@ static void handle_rx(struct vhost_net *net)
 			goto out;
 		}
 	}
+	vhost_busy_poll_idle(&nvq->vq);
 	vhost_net_enable_vq(net, vq);
 out:
+	vhost_net_signal_used(nvq);
 	mutex_unlock(&vq->mutex);
 }
 
@@ -810,6 +855,67 @@ static void handle_rx_net(struct vhost_work *work)
 	handle_rx(net);
 }
 
+static const char * const vhost_net_vq_names[VHOST_NET_VQ_MAX] = {
+	[VHOST_NET_VQ_RX]	= "rx",
+	[VHOST_NET_VQ_TX]	= "tx",
+};
+
+/*
+ * One line per virtqueue: busy polls that found work, those that timed out,
+ * and the current and maximum poll windows in us.
+ */
+static int vhost_net_busy_poll_show(struct seq_file *m, void *v)
+{
+	struct vhost_net *n = m->private;
+	int i;
+
+	seq_puts(m, "# vq hits misses window_us timeout_us\n");
+	for (i = 0; i < VHOST_NET_VQ_MAX; i++) {
+		struct vhost_net_virtqueue *nvq = &n->vqs[i];
+
+		seq_printf(m, "%s %llu %llu %u %u\n", vhost_net_vq_names[i],
+			   nvq->vq.busyloop_hits, nvq->vq.busyloop_misses,
+			   vhost_busy_poll_time(&nvq->vq),
+			   nvq->vq.busyloop_timeout);
+	}
+
+	return 0;
+}
+
+static int vhost_net_busy_poll_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, vhost_net_busy_poll_show, inode->i_private);
+}
+
+static const struct file_operations vhost_net_busy_poll_fops = {
+	.owner		= THIS_MODULE,
+	.open		= vhost_net_busy_poll_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+/* Statistics live in vhost-net/<pid of the opener>-<id>/ */
+static void vhost_net_debugfs_init(struct vhost_net *n)
+{
+	char name[32];
+
+	n->debugfs_dentry = NULL;
+	if (IS_ERR_OR_NULL(vhost_net_debugfs_dir))
+		return;
+
+	snprintf(name, sizeof(name), "%d-%d", task_tgid_nr(current),
+		 atomic_inc_return(&vhost_net_debugfs_id));
+	n->debugfs_dentry = debugfs_create_dir(name, vhost_net_debugfs_dir);
+	if (IS_ERR_OR_NULL(n->debugfs_dentry)) {
+		n->debugfs_dentry = NULL;
+		return;
+	}
+
+	debugfs_create_file("busy_poll", 0444, n->debugfs_dentry, n,
+			    &vhost_net_busy_poll_fops);
+}
+
 static int vhost_net_open(struct inode *inode, struct file *f)
 {
 	struct vhost_net *n;
@@ -836,13 +942,18 @@ static int vhost_net_open(struct inode *inode, struct file *f)
 		n->vqs[i].ubuf_info = NULL;
 		n->vqs[i].upend_idx = 0;
 		n->vqs[i].done_idx = 0;
+		n->vqs[i].nheads = 0;
 		n->vqs[i].vhost_hlen = 0;
 		n->vqs[i].sock_hlen = 0;
 	}
 	vhost_dev_init(dev, vqs, VHOST_NET_VQ_MAX);
 
-	vhost_poll_init(n->poll + VHOST_NET_VQ_TX, handle_tx_net, POLLOUT, dev);
-	vhost_poll_init(n->poll + VHOST_NET_VQ_RX, handle_rx_net, POLLIN, dev);
+	vhost_poll_init(n->poll + VHOST_NET_VQ_TX, handle_tx_net, POLLOUT, dev,
+			vqs[VHOST_NET_VQ_TX]);
+	vhost_poll_init(n->poll + VHOST_NET_VQ_RX, handle_rx_net, POLLIN, dev,
+			vqs[VHOST_NET_VQ_RX]);
+
+	vhost_net_debugfs_init(n);
 
 	f->private_data = n;
 
@@ -898,6 +1009,7 @@ static int vhost_net_release(struct inode *inode, struct file *f)
 	struct socket *tx_sock;
 	struct socket *rx_sock;
 
+	debugfs_remove_recursive(n->debugfs_dentry);
 	vhost_net_stop(n, &tx_sock, &rx_sock);
 	vhost_net_flush(n);
 	vhost_dev_stop(&n->dev);
@@ -1265,15 +1377,22 @@ static struct miscdevice vhost_net_misc = {
 
 static int vhost_net_init(void)
 {
+	int r;
+
 	if (experimental_zcopytx)
 		vhost_net_enable_zcopy(VHOST_NET_VQ_TX);
-	return misc_register(&vhost_net_misc);
+	vhost_net_debugfs_dir = debugfs_create_dir("vhost-net", NULL);
+	r = misc_register(&vhost_net_misc);
+	if (r)
+		debugfs_remove_recursive(vhost_net_debugfs_dir);
+	return r;
 }
 module_init(vhost_net_init);
 
 static void vhost_net_exit(void)
 {
 	misc_deregister(&vhost_net_misc);
+	debugfs_remove_recursive(vhost_net_debugfs_dir);
 }
 module_exit(vhost_net_exit);
 
@@ -184,6 +184,12 @@ struct vhost_scsi_virtqueue {
 	 * Writers must also take dev mutex and flush under it.
 	 */
 	int inflight_idx;
+	/*
+	 * Commands completed on this vq, sent back to the guest from the
+	 * worker handling the vq so that used ring updates stay on one thread
+	 */
+	struct vhost_work completion_work;
+	struct llist_head completion_list;
 };
 
 struct vhost_scsi {
@@ -194,9 +200,6 @@ struct vhost_scsi {
 	struct vhost_dev dev;
 	struct vhost_scsi_virtqueue vqs[VHOST_SCSI_MAX_VQ];
 
-	struct vhost_work vs_completion_work; /* cmd completion work item */
-	struct llist_head vs_completion_list; /* cmd completion queue */
-
 	struct vhost_work vs_event_work; /* evt injection work item */
 	struct llist_head vs_event_list; /* evt injection queue */
 
@@ -362,11 +365,12 @@ static int vhost_scsi_get_cmd_state(struct se_cmd *se_cmd)
 
 static void vhost_scsi_complete_cmd(struct vhost_scsi_cmd *cmd)
 {
-	struct vhost_scsi *vs = cmd->tvc_vhost;
+	struct vhost_scsi_virtqueue *svq = container_of(cmd->tvc_vq,
+					struct vhost_scsi_virtqueue, vq);
 
-	llist_add(&cmd->tvc_completion_list, &vs->vs_completion_list);
+	llist_add(&cmd->tvc_completion_list, &svq->completion_list);
 
-	vhost_work_queue(&vs->dev, &vs->vs_completion_work);
+	vhost_vq_work_queue(&svq->vq, &svq->completion_work);
 }
 
 static int vhost_scsi_queue_data_in(struct se_cmd *se_cmd)
@@ -517,18 +521,17 @@ static void vhost_scsi_evt_work(struct vhost_work *work)
  */
 static void vhost_scsi_complete_cmd_work(struct vhost_work *work)
 {
-	struct vhost_scsi *vs = container_of(work, struct vhost_scsi,
-					vs_completion_work);
-	DECLARE_BITMAP(signal, VHOST_SCSI_MAX_VQ);
+	struct vhost_scsi_virtqueue *svq = container_of(work,
+				struct vhost_scsi_virtqueue, completion_work);
 	struct virtio_scsi_cmd_resp v_rsp;
 	struct vhost_scsi_cmd *cmd;
 	struct llist_node *llnode;
 	struct se_cmd *se_cmd;
 	struct iov_iter iov_iter;
-	int ret, vq;
+	bool signal = false;
+	int ret;
 
-	bitmap_zero(signal, VHOST_SCSI_MAX_VQ);
-	llnode = llist_del_all(&vs->vs_completion_list);
+	llnode = llist_del_all(&svq->completion_list);
 	while (llnode) {
 		cmd = llist_entry(llnode, struct vhost_scsi_cmd,
 				     tvc_completion_list);
@@ -551,21 +554,16 @@ static void vhost_scsi_complete_cmd_work(struct vhost_work *work)
 			      cmd->tvc_in_iovs, sizeof(v_rsp));
 		ret = copy_to_iter(&v_rsp, sizeof(v_rsp), &iov_iter);
 		if (likely(ret == sizeof(v_rsp))) {
-			struct vhost_scsi_virtqueue *q;
 			vhost_add_used(cmd->tvc_vq, cmd->tvc_vq_desc, 0);
-			q = container_of(cmd->tvc_vq, struct vhost_scsi_virtqueue, vq);
-			vq = q - vs->vqs;
-			__set_bit(vq, signal);
+			signal = true;
 		} else
 			pr_err("Faulted on virtio_scsi_cmd_resp\n");
 
 		vhost_scsi_free_cmd(cmd);
 	}
 
-	vq = -1;
-	while ((vq = find_next_bit(signal, VHOST_SCSI_MAX_VQ, vq + 1))
-		< VHOST_SCSI_MAX_VQ)
-		vhost_signal(&vs->dev, &vs->vqs[vq].vq);
+	if (signal)
+		vhost_signal(svq->vq.dev, &svq->vq);
 }
 
 static struct vhost_scsi_cmd *
@@ -833,6 +831,34 @@ vhost_scsi_send_bad_target(struct vhost_scsi *vs,
 		pr_err("Faulted on virtio_scsi_cmd_resp\n");
 }
 
+/*
+ * Get the next request, busy polling the avail ring for up to the busyloop
+ * timeout of the vq if it is empty. The poll stops early for completions,
+ * which are queued on the same worker.
+ */
+static int vhost_scsi_get_desc(struct vhost_virtqueue *vq,
+			       unsigned int *out, unsigned int *in)
+{
+	unsigned long uninitialized_var(endtime);
+	unsigned int timeout = vhost_busy_poll_time(vq);
+	int head = vhost_get_vq_desc(vq, vq->iov, ARRAY_SIZE(vq->iov),
+				     out, in, NULL, NULL);
+
+	if (head == vq->num && timeout) {
+		preempt_disable();
+		endtime = busy_clock() + timeout;
+		while (vhost_can_busy_poll(vq, endtime) &&
+		       vhost_vq_avail_empty(vq->dev, vq))
+			cpu_relax();
+		preempt_enable();
+		head = vhost_get_vq_desc(vq, vq->iov, ARRAY_SIZE(vq->iov),
+					 out, in, NULL, NULL);
+		vhost_busy_poll_done(vq, head != vq->num);
+	}
+
+	return head;
+}
+
 static void
 vhost_scsi_handle_vq(struct vhost_scsi *vs, struct vhost_virtqueue *vq)
 {
@@ -861,12 +887,11 @@ vhost_scsi_handle_vq(struct vhost_scsi *vs, struct vhost_virtqueue *vq)
 	if (!vs_tpg)
 		goto out;
 
+	vhost_busy_poll_wake(vq);
 	vhost_disable_notify(&vs->dev, vq);
 
 	for (;;) {
-		head = vhost_get_vq_desc(vq, vq->iov,
-					 ARRAY_SIZE(vq->iov), &out, &in,
-					 NULL, NULL);
+		head = vhost_scsi_get_desc(vq, &out, &in);
 		pr_debug("vhost_get_vq_desc: head: %d, out: %u in: %u\n",
 			 head, out, in);
 		/* On error, stop handling until the next kick. */
@@ -874,6 +899,7 @@ vhost_scsi_handle_vq(struct vhost_scsi *vs, struct vhost_virtqueue *vq)
 			break;
 		/* Nothing new?  Wait for eventfd to tell us they refilled. */
 		if (head == vq->num) {
+			vhost_busy_poll_idle(vq);
 			if (unlikely(vhost_enable_notify(&vs->dev, vq))) {
 				vhost_disable_notify(&vs->dev, vq);
 				continue;
@@ -1163,10 +1189,12 @@ static void vhost_scsi_flush(struct vhost_scsi *vs)
 	for (i = 0; i < VHOST_SCSI_MAX_VQ; i++)
 		kref_put(&old_inflight[i]->kref, vhost_scsi_done_inflight);
 
-	/* Flush both the vhost poll and vhost work */
+	/*
+	 * Flush both the vhost poll and vhost work. Flushing a vq also flushes
+	 * its completion work, which runs on the same worker.
+	 */
 	for (i = 0; i < VHOST_SCSI_MAX_VQ; i++)
 		vhost_scsi_flush_vq(vs, i);
-	vhost_work_flush(&vs->dev, &vs->vs_completion_work);
 	vhost_work_flush(&vs->dev, &vs->vs_event_work);
 
 	/* Wait for all reqs issued before the flush to be finished */
@@ -1415,7 +1443,6 @@ static int vhost_scsi_open(struct inode *inode, struct file *f)
 	if (!vqs)
 		goto err_vqs;
 
-	vhost_work_init(&vs->vs_completion_work, vhost_scsi_complete_cmd_work);
 	vhost_work_init(&vs->vs_event_work, vhost_scsi_evt_work);
 
 	vs->vs_events_nr = 0;
@@ -1429,6 +1456,11 @@ static int vhost_scsi_open(struct inode *inode, struct file *f)
 		vqs[i] = &vs->vqs[i].vq;
 		vs->vqs[i].vq.handle_kick = vhost_scsi_handle_kick;
 	}
+	for (i = 0; i < VHOST_SCSI_MAX_VQ; i++) {
+		vhost_work_init(&vs->vqs[i].completion_work,
+				vhost_scsi_complete_cmd_work);
+		init_llist_head(&vs->vqs[i].completion_list);
+	}
 	vhost_dev_init(&vs->dev, vqs, VHOST_SCSI_MAX_VQ);
 
 	vhost_scsi_init_inflight(vs, NULL);
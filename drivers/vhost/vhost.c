@@ -42,6 +42,24 @@ module_param(max_iotlb_entries, int, 0444);
 MODULE_PARM_DESC(max_iotlb_entries,
 	"Maximum number of iotlb entries. (default: 2048)");
 
+/*
+ * The busy poll window of each virtqueue adapts to how long its ring or
+ * backend goes idle, between 0 and the busyloop timeout set by userspace.
+ */
+static unsigned int busyloop_grow = 2;
+module_param(busyloop_grow, uint, 0644);
+MODULE_PARM_DESC(busyloop_grow, "Factor the busy poll window grows by;"
+		 " 0 - Always poll for the whole busyloop timeout");
+
+static unsigned int busyloop_grow_start = 10;
+module_param(busyloop_grow_start, uint, 0644);
+MODULE_PARM_DESC(busyloop_grow_start, "First busy poll window, in us");
+
+static unsigned int busyloop_shrink;
+module_param(busyloop_shrink, uint, 0644);
+MODULE_PARM_DESC(busyloop_shrink, "Divisor the busy poll window shrinks by;"
+		 " 0 - Reset the window");
+
 enum {
 	VHOST_MEMORY_F_LOG = 0x1,
 };
@@ -185,14 +203,17 @@ void vhost_work_init(struct vhost_work *work, vhost_work_fn_t fn)
 }
 EXPORT_SYMBOL_GPL(vhost_work_init);
 
-/* Init poll structure */
+/* Init poll structure. Work for a poll tied to a virtqueue runs on the
+ * worker that virtqueue is attached to. */
 void vhost_poll_init(struct vhost_poll *poll, vhost_work_fn_t fn,
-		     unsigned long mask, struct vhost_dev *dev)
+		     unsigned long mask, struct vhost_dev *dev,
+		     struct vhost_virtqueue *vq)
 {
 	init_waitqueue_func_entry(&poll->wait, vhost_poll_wakeup);
 	init_poll_funcptr(&poll->table, vhost_poll_func);
 	poll->mask = mask;
 	poll->dev = dev;
+	poll->vq = vq;
 	poll->wqh = NULL;
 
 	vhost_work_init(&poll->work, fn);
@@ -233,54 +254,167 @@ void vhost_poll_stop(struct vhost_poll *poll)
 }
 EXPORT_SYMBOL_GPL(vhost_poll_stop);
 
-void vhost_work_flush(struct vhost_dev *dev, struct vhost_work *work)
+/* A virtqueue that was never attached to a worker uses the default one */
+static struct vhost_worker *vhost_vq_worker(struct vhost_virtqueue *vq)
+{
+	struct vhost_worker *worker = READ_ONCE(vq->worker);
+
+	return worker ? worker : vq->dev->worker;
+}
+
+static struct vhost_worker *vhost_poll_worker(struct vhost_poll *poll)
+{
+	return poll->vq ? vhost_vq_worker(poll->vq) : poll->dev->worker;
+}
+
+static void vhost_worker_queue(struct vhost_worker *worker,
+			       struct vhost_work *work)
+{
+	if (!worker)
+		return;
+
+	if (!test_and_set_bit(VHOST_WORK_QUEUED, &work->flags)) {
+		/* We can only add the work to the list after we're
+		 * sure it was not in the list.
+		 * test_and_set_bit() implies a memory barrier.
+		 */
+		llist_add(&work->node, &worker->work_list);
+		wake_up_process(worker->task);
+	}
+}
+
+static void vhost_worker_flush(struct vhost_worker *worker)
 {
 	struct vhost_flush_struct flush;
 
-	if (dev->worker) {
+	if (worker) {
 		init_completion(&flush.wait_event);
 		vhost_work_init(&flush.work, vhost_flush_work);
 
-		vhost_work_queue(dev, &flush.work);
+		vhost_worker_queue(worker, &flush.work);
 		wait_for_completion(&flush.wait_event);
 	}
 }
+
+void vhost_work_flush(struct vhost_dev *dev, struct vhost_work *work)
+{
+	vhost_worker_flush(dev->worker);
+}
 EXPORT_SYMBOL_GPL(vhost_work_flush);
 
 /* Flush any work that has been scheduled. When calling this, don't hold any
  * locks that are also used by the callback. */
 void vhost_poll_flush(struct vhost_poll *poll)
 {
-	vhost_work_flush(poll->dev, &poll->work);
+	vhost_worker_flush(vhost_poll_worker(poll));
 }
 EXPORT_SYMBOL_GPL(vhost_poll_flush);
 
+/* Queue work on the default worker of the device */
 void vhost_work_queue(struct vhost_dev *dev, struct vhost_work *work)
 {
-	if (!dev->worker)
-		return;
-
-	if (!test_and_set_bit(VHOST_WORK_QUEUED, &work->flags)) {
-		/* We can only add the work to the list after we're
-		 * sure it was not in the list.
-		 * test_and_set_bit() implies a memory barrier.
-		 */
-		llist_add(&work->node, &dev->work_list);
-		wake_up_process(dev->worker);
-	}
+	vhost_worker_queue(dev->worker, work);
 }
 EXPORT_SYMBOL_GPL(vhost_work_queue);
 
+/* Queue work on the worker handling @vq, flushed by vhost_poll_flush() */
+void vhost_vq_work_queue(struct vhost_virtqueue *vq, struct vhost_work *work)
+{
+	vhost_worker_queue(vhost_vq_worker(vq), work);
+}
+EXPORT_SYMBOL_GPL(vhost_vq_work_queue);
+
 /* A lockless hint for busy polling code to exit the loop */
 bool vhost_has_work(struct vhost_dev *dev)
 {
-	return !llist_empty(&dev->work_list);
+	return !llist_empty(&dev->worker->work_list);
 }
 EXPORT_SYMBOL_GPL(vhost_has_work);
 
+/* Same as vhost_has_work(), for the worker handling @vq */
+bool vhost_vq_has_work(struct vhost_virtqueue *vq)
+{
+	return !llist_empty(&vhost_vq_worker(vq)->work_list);
+}
+EXPORT_SYMBOL_GPL(vhost_vq_has_work);
+
+/* How long to busy poll @vq for, at most its busyloop timeout */
+unsigned int vhost_busy_poll_time(struct vhost_virtqueue *vq)
+{
+	unsigned int max = vq->busyloop_timeout;
+
+	if (!busyloop_grow)
+		return max;
+
+	return min(vq->busyloop_cur, max);
+}
+EXPORT_SYMBOL_GPL(vhost_busy_poll_time);
+
+static void vhost_busy_poll_grow(struct vhost_virtqueue *vq)
+{
+	unsigned int cur = vq->busyloop_cur;
+
+	cur = cur ? cur * busyloop_grow : busyloop_grow_start;
+	vq->busyloop_cur = min(cur, vq->busyloop_timeout);
+}
+
+static void vhost_busy_poll_shrink(struct vhost_virtqueue *vq)
+{
+	if (busyloop_shrink)
+		vq->busyloop_cur /= busyloop_shrink;
+	else
+		vq->busyloop_cur = 0;
+}
+
+/* A busy poll of @vq ended, @hit if it found work */
+void vhost_busy_poll_done(struct vhost_virtqueue *vq, bool hit)
+{
+	if (hit) {
+		vq->busyloop_hits++;
+	} else {
+		vq->busyloop_misses++;
+		if (busyloop_grow)
+			vhost_busy_poll_shrink(vq);
+	}
+}
+EXPORT_SYMBOL_GPL(vhost_busy_poll_done);
+
+/* The ring or backend ran dry and we are going to wait for a notification */
+void vhost_busy_poll_idle(struct vhost_virtqueue *vq)
+{
+	if (vq->busyloop_timeout)
+		vq->busyloop_idle = busy_clock() ? : 1;
+}
+EXPORT_SYMBOL_GPL(vhost_busy_poll_idle);
+
+/*
+ * Work arrived after we stopped polling. As halt_poll_ns does for vcpus,
+ * grow the window if a longer poll would have caught it, and shrink the
+ * window if no allowed poll would have.
+ */
+void vhost_busy_poll_wake(struct vhost_virtqueue *vq)
+{
+	unsigned long idle;
+
+	if (!vq->busyloop_idle)
+		return;
+
+	idle = busy_clock() - vq->busyloop_idle;
+	vq->busyloop_idle = 0;
+
+	if (!busyloop_grow)
+		return;
+
+	if (idle > vq->busyloop_timeout)
+		vhost_busy_poll_shrink(vq);
+	else if (idle > vq->busyloop_cur)
+		vhost_busy_poll_grow(vq);
+}
+EXPORT_SYMBOL_GPL(vhost_busy_poll_wake);
+
 void vhost_poll_queue(struct vhost_poll *poll)
 {
-	vhost_work_queue(poll->dev, &poll->work);
+	vhost_worker_queue(vhost_poll_worker(poll), &poll->work);
 }
 EXPORT_SYMBOL_GPL(vhost_poll_queue);
 
@@ -328,14 +462,21 @@ static void vhost_vq_reset(struct vhost_dev *dev,
 	vhost_reset_is_le(vq);
 	vhost_disable_cross_endian(vq);
 	vq->busyloop_timeout = 0;
+	vq->busyloop_cur = 0;
+	vq->busyloop_idle = 0;
+	vq->busyloop_hits = 0;
+	vq->busyloop_misses = 0;
 	vq->umem = NULL;
 	vq->iotlb = NULL;
+	vq->worker = NULL;
+	vq->avail_cache_num = 0;
 	__vhost_vq_meta_reset(vq);
 }
 
 static int vhost_worker(void *data)
 {
-	struct vhost_dev *dev = data;
+	struct vhost_worker *worker = data;
+	struct vhost_dev *dev = worker->dev;
 	struct vhost_work *work, *work_next;
 	struct llist_node *node;
 	mm_segment_t oldfs = get_fs();
@@ -352,7 +493,7 @@ static int vhost_worker(void *data)
 			break;
 		}
 
-		node = llist_del_all(&dev->work_list);
+		node = llist_del_all(&worker->work_list);
 		if (!node)
 			schedule();
 
@@ -380,6 +521,8 @@ static void vhost_vq_free_iovecs(struct vhost_virtqueue *vq)
 	vq->log = NULL;
 	kfree(vq->heads);
 	vq->heads = NULL;
+	kvfree(vq->desc_count);
+	vq->desc_count = NULL;
 }
 
 /* Helper to allocate iovec buffers for all vqs. */
@@ -428,7 +571,8 @@ void vhost_dev_init(struct vhost_dev *dev,
 	dev->iotlb = NULL;
 	dev->mm = NULL;
 	dev->worker = NULL;
-	init_llist_head(&dev->work_list);
+	dev->workers = NULL;
+	dev->nworkers = 0;
 	init_waitqueue_head(&dev->wait);
 	INIT_LIST_HEAD(&dev->read_list);
 	INIT_LIST_HEAD(&dev->pending_list);
@@ -440,12 +584,13 @@ void vhost_dev_init(struct vhost_dev *dev,
 		vq->log = NULL;
 		vq->indirect = NULL;
 		vq->heads = NULL;
+		vq->desc_count = NULL;
 		vq->dev = dev;
 		mutex_init(&vq->mutex);
 		vhost_vq_reset(dev, vq);
 		if (vq->handle_kick)
 			vhost_poll_init(&vq->poll, vq->handle_kick,
-					POLLIN, dev);
+					POLLIN, dev, vq);
 	}
 }
 EXPORT_SYMBOL_GPL(vhost_dev_init);
@@ -472,17 +617,108 @@ static void vhost_attach_cgroups_work(struct vhost_work *work)
 	s->ret = cgroup_attach_task_all(s->owner, current);
 }
 
-static int vhost_attach_cgroups(struct vhost_dev *dev)
+static int vhost_attach_cgroups(struct vhost_worker *worker)
 {
 	struct vhost_attach_cgroups_struct attach;
 
 	attach.owner = current;
 	vhost_work_init(&attach.work, vhost_attach_cgroups_work);
-	vhost_work_queue(dev, &attach.work);
-	vhost_work_flush(dev, &attach.work);
+	vhost_worker_queue(worker, &attach.work);
+	vhost_worker_flush(worker);
 	return attach.ret;
 }
 
+/* Caller should have device mutex. A negative cpu leaves the worker unbound. */
+static struct vhost_worker *vhost_worker_create(struct vhost_dev *dev, int cpu)
+{
+	struct vhost_worker *worker;
+	struct task_struct *task;
+	int id = dev->nworkers;
+	int err;
+
+	worker = kzalloc(sizeof(*worker), GFP_KERNEL);
+	if (!worker)
+		return ERR_PTR(-ENOMEM);
+
+	init_llist_head(&worker->work_list);
+	worker->dev = dev;
+	worker->id = id;
+
+	if (id)
+		task = kthread_create(vhost_worker, worker, "vhost-%d-%d",
+				      current->pid, id);
+	else
+		task = kthread_create(vhost_worker, worker, "vhost-%d",
+				      current->pid);
+	if (IS_ERR(task)) {
+		err = PTR_ERR(task);
+		goto err_task;
+	}
+
+	if (cpu >= 0)
+		kthread_bind(task, cpu);
+
+	worker->task = task;
+	wake_up_process(task);	/* avoid contributing to loadavg */
+
+	err = vhost_attach_cgroups(worker);
+	if (err)
+		goto err_cgroup;
+
+	dev->workers[dev->nworkers++] = worker;
+	return worker;
+err_cgroup:
+	kthread_stop(task);
+err_task:
+	kfree(worker);
+	return ERR_PTR(err);
+}
+
+static void vhost_dev_free_workers(struct vhost_dev *dev)
+{
+	int i;
+
+	for (i = 0; i < dev->nworkers; i++) {
+		struct vhost_worker *worker = dev->workers[i];
+
+		WARN_ON(!llist_empty(&worker->work_list));
+		kthread_stop(worker->task);
+		kfree(worker);
+	}
+
+	kfree(dev->workers);
+	dev->workers = NULL;
+	dev->nworkers = 0;
+	dev->worker = NULL;
+}
+
+/* Caller should have device mutex */
+static long vhost_dev_new_worker(struct vhost_dev *dev, void __user *argp)
+{
+	struct vhost_worker_state s;
+	struct vhost_worker *worker;
+
+	if (copy_from_user(&s, argp, sizeof(s)))
+		return -EFAULT;
+
+	if (s.cpu >= 0 && (s.cpu >= nr_cpu_ids || !cpu_online(s.cpu)))
+		return -EINVAL;
+
+	/* More workers than virtqueues, plus the default one, is pointless */
+	if (dev->nworkers > dev->nvqs)
+		return -ENOSPC;
+
+	worker = vhost_worker_create(dev, s.cpu);
+	if (IS_ERR(worker))
+		return PTR_ERR(worker);
+
+	s.worker_id = worker->id;
+	if (copy_to_user(argp, &s, sizeof(s)))
+		return -EFAULT;
+
+	return 0;
+}
+
 /* Caller should have device mutex */
 bool vhost_dev_has_owner(struct vhost_dev *dev)
 {
@@ -493,7 +729,7 @@ EXPORT_SYMBOL_GPL(vhost_dev_has_owner);
 /* Caller should have device mutex */
 long vhost_dev_set_owner(struct vhost_dev *dev)
 {
-	struct task_struct *worker;
+	struct vhost_worker *worker;
 	int err;
 
 	/* Is there an owner already? */
@@ -504,28 +740,28 @@ long vhost_dev_set_owner(struct vhost_dev *dev)
 
 	/* No owner, become one */
 	dev->mm = get_task_mm(current);
-	worker = kthread_create(vhost_worker, dev, "vhost-%d", current->pid);
+	dev->workers = kcalloc(dev->nvqs + 1, sizeof(*dev->workers),
+			       GFP_KERNEL);
+	if (!dev->workers) {
+		err = -ENOMEM;
+		goto err_worker;
+	}
+
+	worker = vhost_worker_create(dev, -1);
 	if (IS_ERR(worker)) {
 		err = PTR_ERR(worker);
 		goto err_worker;
 	}
 
 	dev->worker = worker;
-	wake_up_process(worker);	/* avoid contributing to loadavg */
-
-	err = vhost_attach_cgroups(dev);
-	if (err)
-		goto err_cgroup;
 
 	err = vhost_dev_alloc_iovecs(dev);
 	if (err)
-		goto err_cgroup;
+		goto err_worker;
 
 	return 0;
-err_cgroup:
-	kthread_stop(worker);
-	dev->worker = NULL;
 err_worker:
+	vhost_dev_free_workers(dev);
 	if (dev->mm)
 		mmput(dev->mm);
 	dev->mm = NULL;
@@ -644,11 +880,7 @@ void vhost_dev_cleanup(struct vhost_dev *dev, bool locked)
 	dev->iotlb = NULL;
 	vhost_clear_msg(dev);
 	wake_up_interruptible_poll(&dev->wait, POLLIN | POLLRDNORM);
-	WARN_ON(!llist_empty(&dev->work_list));
-	if (dev->worker) {
-		kthread_stop(dev->worker);
-		dev->worker = NULL;
-	}
+	vhost_dev_free_workers(dev);
 	if (dev->mm)
 		mmput(dev->mm);
 	dev->mm = NULL;
@@ -860,7 +1092,7 @@ static inline void __user *__vhost_get_user(struct vhost_virtqueue *vq,
 	return __vhost_get_user_slow(vq, addr, size, type);
 }
 
-#define vhost_put_user(vq, x, ptr)		\
+#define __vhost_put_user(vq, x, ptr, type)	\
 ({ \
 	int ret = -EFAULT; \
 	if (!vq->iotlb) { \
@@ -868,7 +1100,7 @@ static inline void __user *__vhost_get_user(struct vhost_virtqueue *vq,
 	} else { \
 		__typeof__(ptr) to = \
 			(__typeof__(ptr)) __vhost_get_user(vq, ptr,	\
-					  sizeof(*ptr), VHOST_ADDR_USED); \
+					  sizeof(*ptr), type); \
 		if (to != NULL) \
 			ret = __put_user(x, to); \
 		else \
@@ -901,6 +1133,30 @@ static inline void __user *__vhost_get_user(struct vhost_virtqueue *vq,
 #define vhost_get_used(vq, x, ptr) \
 	vhost_get_user(vq, x, ptr, VHOST_ADDR_USED)
 
+#define vhost_put_user(vq, x, ptr) \
+	__vhost_put_user(vq, x, ptr, VHOST_ADDR_USED)
+
+/* The device writes used descriptors back into a packed ring */
+#define vhost_get_desc(vq, x, ptr) \
+	vhost_get_user(vq, x, ptr, VHOST_ADDR_DESC)
+
+#define vhost_put_desc(vq, x, ptr) \
+	__vhost_put_user(vq, x, ptr, VHOST_ADDR_DESC)
+
+/* Packed ring indices run free like the split ones: the ring slot is the
+ * index modulo the ring size, and the wrap counter is set on even laps.
+ * As the size is a power of two this stays consistent across u16 overflow,
+ * so index arithmetic is the same as for the split ring. */
+static inline u16 vhost_packed_slot(struct vhost_virtqueue *vq, u16 idx)
+{
+	return idx & (vq->num - 1);
+}
+
+static inline bool vhost_packed_wrap(struct vhost_virtqueue *vq, u16 idx)
+{
+	return !(idx & vq->num);
+}
+
 static void vhost_dev_lock_vqs(struct vhost_dev *d)
 {
 	int i = 0;
@@ -1153,6 +1409,15 @@ static int vq_access_ok(struct vhost_virtqueue *vq, unsigned int num,
 {
 	size_t s = vhost_has_feature(vq, VIRTIO_RING_F_EVENT_IDX) ? 2 : 0;
 
+	/* Used descriptors are written back in place in a packed ring */
+	if (vhost_vq_is_packed(vq))
+		return access_ok(VERIFY_WRITE, desc,
+				 num * sizeof(struct vring_packed_desc)) &&
+		       access_ok(VERIFY_READ, avail,
+				 sizeof(struct vring_packed_desc_event)) &&
+		       access_ok(VERIFY_WRITE, used,
+				 sizeof(struct vring_packed_desc_event));
+
 	return access_ok(VERIFY_READ, desc, num * sizeof *desc) &&
 	       access_ok(VERIFY_READ, avail,
 			 sizeof *avail + num * sizeof *avail->ring + s) &&
@@ -1167,7 +1432,10 @@ static void vhost_vq_meta_update(struct vhost_virtqueue *vq,
 	int access = (type == VHOST_ADDR_USED) ?
 		     VHOST_ACCESS_WO : VHOST_ACCESS_RO;
 
-	if (likely(node->perm & access))
+	if (type == VHOST_ADDR_DESC && vhost_vq_is_packed(vq))
+		access = VHOST_ACCESS_RW;
+
+	if (likely((node->perm & access) == access))
 		vq->meta_iotlb[type] = node;
 }
 
@@ -1188,7 +1456,7 @@ static int iotlb_access_ok(struct vhost_virtqueue *vq,
 		if (node == NULL || node->start > addr) {
 			vhost_iotlb_miss(vq, addr, access);
 			return false;
-		} else if (!(node->perm & access)) {
+		} else if ((node->perm & access) != access) {
 			/* Report the possible access violation by
 			 * request another translation from userspace.
 			 */
@@ -1215,6 +1483,20 @@ int vq_iotlb_prefetch(struct vhost_virtqueue *vq)
 	if (!vq->iotlb)
 		return 1;
 
+	if (vhost_vq_is_packed(vq))
+		return iotlb_access_ok(vq, VHOST_ACCESS_RW,
+				       (u64)(uintptr_t)vq->desc_packed,
+				       num * sizeof(*vq->desc_packed),
+				       VHOST_ADDR_DESC) &&
+		       iotlb_access_ok(vq, VHOST_ACCESS_RO,
+				       (u64)(uintptr_t)vq->driver_event,
+				       sizeof(*vq->driver_event),
+				       VHOST_ADDR_AVAIL) &&
+		       iotlb_access_ok(vq, VHOST_ACCESS_WO,
+				       (u64)(uintptr_t)vq->device_event,
+				       sizeof(*vq->device_event),
+				       VHOST_ADDR_USED);
+
 	return iotlb_access_ok(vq, VHOST_ACCESS_RO, (u64)(uintptr_t)vq->desc,
 			       num * sizeof(*vq->desc), VHOST_ADDR_DESC) &&
 	       iotlb_access_ok(vq, VHOST_ACCESS_RO, (u64)(uintptr_t)vq->avail,
@@ -1242,18 +1524,26 @@ static int vq_log_access_ok(struct vhost_virtqueue *vq,
 			    void __user *log_base)
 {
 	size_t s = vhost_has_feature(vq, VIRTIO_RING_F_EVENT_IDX) ? 2 : 0;
+	size_t sz = sizeof *vq->used + vq->num * sizeof *vq->used->ring + s;
+
+	/* Only the descriptor ring is logged for a packed ring: the device
+	 * event area is written again whenever the ring is started. */
+	if (vhost_vq_is_packed(vq))
+		sz = vq->num * sizeof *vq->desc_packed;
 
 	return vq_memory_access_ok(log_base, vq->umem,
 				   vhost_has_feature(vq, VHOST_F_LOG_ALL)) &&
-		(!vq->log_used || log_access_ok(log_base, vq->log_addr,
-					sizeof *vq->used +
-					vq->num * sizeof *vq->used->ring + s));
+		(!vq->log_used || log_access_ok(log_base, vq->log_addr, sz));
 }
 
 /* Can we start vq? */
 /* Caller should have vq mutex and device mutex */
 int vhost_vq_access_ok(struct vhost_virtqueue *vq)
 {
+	/* A packed ring needs its size set before it can be used */
+	if (vhost_vq_is_packed(vq) && !vq->desc_count)
+		return 0;
+
 	if (vq->iotlb) {
 		/* When device IOTLB was used, the access validation
 		 * will be validated during prefetching.
@@ -1348,6 +1638,7 @@ static long vhost_set_memory(struct vhost_dev *d, struct vhost_memory __user *m)
 
 long vhost_vring_ioctl(struct vhost_dev *d, int ioctl, void __user *argp)
 {
+	struct vhost_worker *oldworker = NULL;
 	struct file *eventfp, *filep = NULL;
 	bool pollstart = false, pollstop = false;
 	struct eventfd_ctx *ctx = NULL;
@@ -1356,6 +1647,7 @@ long vhost_vring_ioctl(struct vhost_dev *d, int ioctl, void __user *argp)
 	struct vhost_vring_state s;
 	struct vhost_vring_file f;
 	struct vhost_vring_addr a;
+	u16 *desc_count;
 	u32 idx;
 	long r;
 
@@ -1385,6 +1677,16 @@ long vhost_vring_ioctl(struct vhost_dev *d, int ioctl, void __user *argp)
 			r = -EINVAL;
 			break;
 		}
+		/* Per buffer state, should the ring turn out to be packed */
+		desc_count = kvmalloc(2 * s.num * sizeof(*desc_count),
+				      GFP_KERNEL);
+		if (!desc_count) {
+			r = -ENOMEM;
+			break;
+		}
+		kvfree(vq->desc_count);
+		vq->desc_count = desc_count;
+		vq->chain_len = desc_count + s.num;
 		vq->num = s.num;
 		break;
 	case VHOST_SET_VRING_BASE:
@@ -1398,7 +1700,11 @@ long vhost_vring_ioctl(struct vhost_dev *d, int ioctl, void __user *argp)
 			r = -EFAULT;
 			break;
 		}
-		if (s.num > 0xffff) {
+		/* A packed ring has no used index to resume from, so its
+		 * last used index comes in the upper half. */
+		if (vhost_vq_is_packed(vq)) {
+			vq->last_used_idx = s.num >> 16;
+		} else if (s.num > 0xffff) {
 			r = -EINVAL;
 			break;
 		}
@@ -1409,6 +1715,8 @@ long vhost_vring_ioctl(struct vhost_dev *d, int ioctl, void __user *argp)
 	case VHOST_GET_VRING_BASE:
 		s.index = idx;
 		s.num = vq->last_avail_idx;
+		if (vhost_vq_is_packed(vq))
+			s.num |= (u32)vq->last_used_idx << 16;
 		if (copy_to_user(argp, &s, sizeof s))
 			r = -EFAULT;
 		break;
@@ -1439,6 +1747,16 @@ long vhost_vring_ioctl(struct vhost_dev *d, int ioctl, void __user *argp)
 			r = -EINVAL;
 			break;
 		}
+		/* The event areas are read and written as a whole */
+		if (vhost_vq_is_packed(vq) &&
+		    ((a.desc_user_addr & (VRING_DESC_ALIGN_SIZE - 1)) ||
+		     (a.avail_user_addr &
+		      (sizeof(struct vring_packed_desc_event) - 1)) ||
+		     (a.used_user_addr &
+		      (sizeof(struct vring_packed_desc_event) - 1)))) {
+			r = -EINVAL;
+			break;
+		}
 
 		/* We only verify access here if backend is configured.
 		 * If it is not, we don't as size might not have been setup.
@@ -1455,6 +1773,8 @@ long vhost_vring_ioctl(struct vhost_dev *d, int ioctl, void __user *argp)
 			/* Also validate log access for used ring if enabled. */
 			if ((a.flags & (0x1 << VHOST_VRING_F_LOG)) &&
 			    !log_access_ok(vq->log_base, a.log_guest_addr,
+					   vhost_vq_is_packed(vq) ?
+					   vq->num * sizeof *vq->desc_packed :
 					   sizeof *vq->used +
 					   vq->num * sizeof *vq->used->ring)) {
 				r = -EINVAL;
@@ -1541,6 +1861,24 @@ long vhost_vring_ioctl(struct vhost_dev *d, int ioctl, void __user *argp)
 		if (copy_to_user(argp, &s, sizeof(s)))
 			r = -EFAULT;
 		break;
+	case VHOST_ATTACH_VRING_WORKER:
+		if (copy_from_user(&s, argp, sizeof(s))) {
+			r = -EFAULT;
+			break;
+		}
+		if (s.num >= d->nworkers) {
+			r = -EINVAL;
+			break;
+		}
+		oldworker = vhost_vq_worker(vq);
+		WRITE_ONCE(vq->worker, d->workers[s.num]);
+		break;
+	case VHOST_GET_VRING_WORKER:
+		s.index = idx;
+		s.num = vhost_vq_worker(vq)->id;
+		if (copy_to_user(argp, &s, sizeof(s)))
+			r = -EFAULT;
+		break;
 	default:
 		r = -ENOIOCTLCMD;
 	}
@@ -1560,6 +1898,9 @@ long vhost_vring_ioctl(struct vhost_dev *d, int ioctl, void __user *argp)
 
 	if (pollstop && vq->handle_kick)
 		vhost_poll_flush(&vq->poll);
+	/* Work queued before the switch may still run on the old worker */
+	if (oldworker)
+		vhost_worker_flush(oldworker);
 	return r;
 }
 EXPORT_SYMBOL_GPL(vhost_vring_ioctl);
@@ -1612,6 +1953,9 @@ long vhost_dev_ioctl(struct vhost_dev *d, unsigned int ioctl, void __user *argp)
 	case VHOST_SET_MEM_TABLE:
 		r = vhost_set_memory(d, argp);
 		break;
+	case VHOST_NEW_WORKER:
+		r = vhost_dev_new_worker(d, argp);
+		break;
 	case VHOST_SET_LOG_BASE:
 		if (copy_from_user(&p, argp, sizeof p)) {
 			r = -EFAULT;
@@ -1785,6 +2129,43 @@ static int vhost_update_avail_event(struct vhost_virtqueue *vq, u16 avail_event)
 	return 0;
 }
 
+/* Tell the guest whether, and from which descriptor, we want kicks */
+static int vhost_update_device_event(struct vhost_virtqueue *vq)
+{
+	u16 flags = VRING_PACKED_EVENT_FLAG_ENABLE;
+	u16 off_wrap;
+
+	if (vq->used_flags & VRING_USED_F_NO_NOTIFY) {
+		flags = VRING_PACKED_EVENT_FLAG_DISABLE;
+	} else if (vhost_has_feature(vq, VIRTIO_RING_F_EVENT_IDX)) {
+		off_wrap = vhost_packed_slot(vq, vq->last_avail_idx) |
+			   vhost_packed_wrap(vq, vq->last_avail_idx) <<
+			   VRING_PACKED_EVENT_F_WRAP_CTR;
+		if (vhost_put_user(vq, cpu_to_le16(off_wrap),
+				   &vq->device_event->off_wrap))
+			return -EFAULT;
+		/* Make sure the offset is seen before the flags. */
+		smp_wmb();
+		flags = VRING_PACKED_EVENT_FLAG_DESC;
+	}
+
+	if (vhost_put_user(vq, cpu_to_le16(flags), &vq->device_event->flags))
+		return -EFAULT;
+	return 0;
+}
+
+static int vhost_vq_init_packed(struct vhost_virtqueue *vq)
+{
+	/* The packed layout only exists for virtio 1 devices */
+	if (!vhost_has_feature(vq, VIRTIO_F_VERSION_1))
+		return -EINVAL;
+
+	/* The used index was set along with the avail one, the device event
+	 * area is not logged so write it again. */
+	vq->signalled_used_valid = false;
+	return vhost_update_device_event(vq);
+}
+
 int vhost_vq_init_access(struct vhost_virtqueue *vq)
 {
 	__virtio16 last_used_idx;
@@ -1796,6 +2177,13 @@ int vhost_vq_init_access(struct vhost_virtqueue *vq)
 
 	vhost_init_is_le(vq);
 
+	if (vhost_vq_is_packed(vq)) {
+		r = vhost_vq_init_packed(vq);
+		if (r)
+			goto err;
+		return 0;
+	}
+
 	r = vhost_update_used_flags(vq);
 	if (r)
 		goto err;
@@ -1812,6 +2200,7 @@ int vhost_vq_init_access(struct vhost_virtqueue *vq)
 		goto err;
 	}
 	vq->last_used_idx = vhost16_to_cpu(vq, last_used_idx);
+	vq->avail_cache_num = 0;
 	return 0;
 
 err:
@@ -1985,6 +2374,271 @@ static int get_indirect(struct vhost_virtqueue *vq,
 	return 0;
 }
 
+/* Find out whether the guest made the packed ring descriptor at idx
+ * available to us: its avail flag matches the wrap counter, and its used
+ * flag doesn't. */
+static int vhost_packed_desc_avail(struct vhost_virtqueue *vq, u16 idx,
+				   bool *avail)
+{
+	struct vring_packed_desc __user *desc;
+	bool wrap = vhost_packed_wrap(vq, idx);
+	__le16 flags;
+
+	desc = vq->desc_packed + vhost_packed_slot(vq, idx);
+	if (unlikely(vhost_get_desc(vq, flags, &desc->flags))) {
+		vq_err(vq, "Failed to get descriptor flags at %p\n",
+		       &desc->flags);
+		return -EFAULT;
+	}
+
+	*avail = !!(flags & cpu_to_le16(1 << VRING_PACKED_DESC_F_AVAIL)) ==
+		 wrap &&
+		 !!(flags & cpu_to_le16(1 << VRING_PACKED_DESC_F_USED)) != wrap;
+	return 0;
+}
+
+/* Add what a packed ring descriptor points to to the iovec */
+static int translate_packed_desc(struct vhost_virtqueue *vq,
+				 struct vring_packed_desc *desc,
+				 struct iovec iov[], unsigned int iov_size,
+				 unsigned int *out_num, unsigned int *in_num,
+				 struct vhost_log *log, unsigned int *log_num)
+{
+	unsigned int iov_count = *in_num + *out_num;
+	u64 addr = le64_to_cpu(desc->addr);
+	u32 len = le32_to_cpu(desc->len);
+	int ret, access;
+
+	if (desc->flags & cpu_to_le16(VRING_DESC_F_WRITE))
+		access = VHOST_ACCESS_WO;
+	else
+		access = VHOST_ACCESS_RO;
+
+	ret = translate_desc(vq, addr, len, iov + iov_count,
+			     iov_size - iov_count, access);
+	if (unlikely(ret < 0)) {
+		if (ret != -EAGAIN)
+			vq_err(vq, "Translation failure %d descriptor "
+			       "addr 0x%llx\n", ret, (unsigned long long)addr);
+		return ret;
+	}
+	if (access == VHOST_ACCESS_WO) {
+		/* If this is an input descriptor,
+		 * increment that count. */
+		*in_num += ret;
+		if (unlikely(log)) {
+			log[*log_num].addr = addr;
+			log[*log_num].len = len;
+			++*log_num;
+		}
+	} else {
+		/* If it's an output descriptor, they're all supposed
+		 * to come before any input descriptors. */
+		if (unlikely(*in_num)) {
+			vq_err(vq, "Descriptor has out after in: "
+			       "addr 0x%llx\n", (unsigned long long)addr);
+			return -EINVAL;
+		}
+		*out_num += ret;
+	}
+	return 0;
+}
+
+/* An indirect table of a packed ring is a plain array of descriptors, all of
+ * which make up the buffer. */
+static int get_indirect_packed(struct vhost_virtqueue *vq,
+			       struct iovec iov[], unsigned int iov_size,
+			       unsigned int *out_num, unsigned int *in_num,
+			       struct vhost_log *log, unsigned int *log_num,
+			       struct vring_packed_desc *indirect)
+{
+	struct vring_packed_desc desc;
+	u64 addr = le64_to_cpu(indirect->addr);
+	u32 len = le32_to_cpu(indirect->len);
+	unsigned int i, count;
+	struct iov_iter from;
+	int ret;
+
+	/* Sanity check */
+	if (unlikely(len % sizeof desc)) {
+		vq_err(vq, "Invalid length in indirect descriptor: "
+		       "len 0x%llx not multiple of 0x%zx\n",
+		       (unsigned long long)len,
+		       sizeof desc);
+		return -EINVAL;
+	}
+
+	ret = translate_desc(vq, addr, len, vq->indirect, UIO_MAXIOV,
+			     VHOST_ACCESS_RO);
+	if (unlikely(ret < 0)) {
+		if (ret != -EAGAIN)
+			vq_err(vq, "Translation failure %d in indirect.\n",
+			       ret);
+		return ret;
+	}
+	iov_iter_init(&from, READ, vq->indirect, ret, len);
+
+	/* We will use the result as an address to read from, so most
+	 * architectures only need a compiler barrier here. */
+	read_barrier_depends();
+
+	count = len / sizeof desc;
+	if (unlikely(count > USHRT_MAX + 1)) {
+		vq_err(vq, "Indirect buffer length too big: %u\n", len);
+		return -E2BIG;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (unlikely(!copy_from_iter_full(&desc, sizeof(desc),
+						  &from))) {
+			vq_err(vq, "Failed indirect descriptor: idx %d, %zx\n",
+			       i, (size_t)addr + i * sizeof desc);
+			return -EINVAL;
+		}
+		if (unlikely(desc.flags &
+			     cpu_to_le16(VRING_DESC_F_INDIRECT))) {
+			vq_err(vq, "Nested indirect descriptor: idx %d, %zx\n",
+			       i, (size_t)addr + i * sizeof desc);
+			return -EINVAL;
+		}
+
+		ret = translate_packed_desc(vq, &desc, iov, iov_size,
+					    out_num, in_num, log, log_num);
+		if (unlikely(ret < 0))
+			return ret;
+	}
+	return 0;
+}
+
+/* The packed ring version of vhost_get_vq_desc: the buffer is made of the
+ * descriptors from last_avail_idx on, chained by VRING_DESC_F_NEXT, and its
+ * id is in the last one. */
+static int vhost_get_vq_desc_packed(struct vhost_virtqueue *vq,
+				    struct iovec iov[], unsigned int iov_size,
+				    unsigned int *out_num,
+				    unsigned int *in_num,
+				    struct vhost_log *log,
+				    unsigned int *log_num)
+{
+	struct vring_packed_desc __user *p;
+	struct vring_packed_desc desc;
+	u16 idx = vq->last_avail_idx;
+	unsigned int id, found = 0;
+	bool avail;
+	int ret;
+
+	ret = vhost_packed_desc_avail(vq, idx, &avail);
+	if (unlikely(ret))
+		return ret;
+	if (!avail)
+		return vq->num;
+
+	/* The guest makes the head descriptor available last: only read
+	 * the buffer after that. */
+	smp_rmb();
+
+	/* When we start there are none of either input nor output. */
+	*out_num = *in_num = 0;
+	if (unlikely(log))
+		*log_num = 0;
+
+	do {
+		if (unlikely(++found > vq->num)) {
+			vq_err(vq, "Loop detected: last one at %u "
+			       "vq size %u head %u\n",
+			       idx, vq->num, vq->last_avail_idx);
+			return -EINVAL;
+		}
+		p = vq->desc_packed + vhost_packed_slot(vq, idx);
+		ret = vhost_copy_from_user(vq, &desc, p, sizeof desc);
+		if (unlikely(ret)) {
+			vq_err(vq, "Failed to get descriptor: idx %d addr %p\n",
+			       idx, p);
+			return -EFAULT;
+		}
+		if (desc.flags & cpu_to_le16(VRING_DESC_F_INDIRECT)) {
+			if (unlikely(desc.flags &
+				     cpu_to_le16(VRING_DESC_F_NEXT))) {
+				vq_err(vq, "Chained indirect descriptor "
+				       "at idx %d\n", idx);
+				return -EINVAL;
+			}
+			ret = get_indirect_packed(vq, iov, iov_size,
+						  out_num, in_num,
+						  log, log_num, &desc);
+			if (unlikely(ret < 0)) {
+				if (ret != -EAGAIN)
+					vq_err(vq, "Failure detected in "
+					       "indirect descriptor "
+					       "at idx %d\n", idx);
+				return ret;
+			}
+		} else {
+			ret = translate_packed_desc(vq, &desc, iov, iov_size,
+						    out_num, in_num,
+						    log, log_num);
+			if (unlikely(ret < 0))
+				return ret;
+		}
+		idx++;
+	} while (desc.flags & cpu_to_le16(VRING_DESC_F_NEXT));
+
+	id = le16_to_cpu(desc.id);
+	if (unlikely(id >= vq->num)) {
+		vq_err(vq, "Guest says buffer id %u > %u is available",
+		       id, vq->num);
+		return -EINVAL;
+	}
+
+	/* Remember how many slots to skip when the buffer is used, and
+	 * how far to go back when it's discarded. */
+	vq->desc_count[id] = found;
+	vq->chain_len[vhost_packed_slot(vq, idx - 1)] = found;
+	vq->last_avail_idx = idx;
+
+	/* Assume notifications from guest are disabled at this point,
+	 * if they aren't we would need to update the device event. */
+	BUG_ON(!(vq->used_flags & VRING_USED_F_NO_NOTIFY));
+	return id;
+}
+
+/* Read ahead, in one access, the heads the guest made available from
+ * last_avail_idx on, stopping at the end of the ring. The entries between
+ * last_avail_idx and avail_idx belong to us until they are used, so the
+ * copies stay valid until then, or until the ring is set up again. */
+static int vhost_fetch_avail_heads(struct vhost_virtqueue *vq)
+{
+	u16 last_avail_idx = vq->last_avail_idx;
+	unsigned int start = last_avail_idx & (vq->num - 1);
+	unsigned int num = (u16)(vq->avail_idx - last_avail_idx);
+	__virtio16 __user *ring = &vq->avail->ring[start];
+	void __user *uaddr;
+	int ret;
+
+	num = min3(num, vq->num - start, (unsigned int)VHOST_AVAIL_BATCH);
+
+	if (!vq->iotlb) {
+		ret = __copy_from_user(vq->avail_cache, ring,
+				       num * sizeof(*ring));
+	} else {
+		uaddr = vhost_vq_meta_fetch(vq, (u64)(uintptr_t)ring,
+					    num * sizeof(*ring),
+					    VHOST_ADDR_AVAIL);
+		if (uaddr)
+			ret = __copy_from_user(vq->avail_cache, uaddr,
+					       num * sizeof(*ring));
+		else
+			ret = vhost_copy_from_user(vq, vq->avail_cache, ring,
+						   num * sizeof(*ring));
+	}
+	if (unlikely(ret))
+		return -EFAULT;
+
+	vq->avail_cache_idx = last_avail_idx;
+	vq->avail_cache_num = num;
+	return 0;
+}
+
 /* This looks in the virtqueue and for the first available buffer, and converts
  * it to an iovec for convenient access.  Since descriptors consist of some
  * number of output then some number of input descriptors, it's actually two
@@ -2005,6 +2659,11 @@ int vhost_get_vq_desc(struct vhost_virtqueue *vq,
 	__virtio16 ring_head;
 	int ret, access;
 
+	if (vhost_vq_is_packed(vq))
+		return vhost_get_vq_desc_packed(vq, iov, iov_size,
+						out_num, in_num,
+						log, log_num);
+
 	/* Check it isn't doing very strange things with descriptor numbers. */
 	last_avail_idx = vq->last_avail_idx;
 
@@ -2036,14 +2695,17 @@ int vhost_get_vq_desc(struct vhost_virtqueue *vq,
 
 	/* Grab the next descriptor number they're advertising, and increment
 	 * the index we've seen. */
-	if (unlikely(vhost_get_avail(vq, ring_head,
-		     &vq->avail->ring[last_avail_idx & (vq->num - 1)]))) {
+	if ((u16)(last_avail_idx - vq->avail_cache_idx) >=
+	    vq->avail_cache_num &&
+	    unlikely(vhost_fetch_avail_heads(vq))) {
 		vq_err(vq, "Failed to read head: idx %d address %p\n",
 		       last_avail_idx,
 		       &vq->avail->ring[last_avail_idx % vq->num]);
 		return -EFAULT;
 	}
 
+	ring_head = vq->avail_cache[(u16)(last_avail_idx -
+					  vq->avail_cache_idx)];
 	head = vhost16_to_cpu(vq, ring_head);
 
 	/* If their number is silly, that's an error. */
@@ -2139,7 +2801,18 @@ EXPORT_SYMBOL_GPL(vhost_get_vq_desc);
 /* Reverse the effect of vhost_get_vq_desc. Useful for error handling. */
 void vhost_discard_vq_desc(struct vhost_virtqueue *vq, int n)
 {
-	vq->last_avail_idx -= n;
+	u16 last;
+
+	if (!vhost_vq_is_packed(vq)) {
+		vq->last_avail_idx -= n;
+		return;
+	}
+
+	/* Walk back over the buffers from the last descriptor of each. */
+	while (n--) {
+		last = vhost_packed_slot(vq, vq->last_avail_idx - 1);
+		vq->last_avail_idx -= vq->chain_len[last];
+	}
 }
 EXPORT_SYMBOL_GPL(vhost_discard_vq_desc);
 
@@ -2199,6 +2872,84 @@ static int __vhost_add_used_n(struct vhost_virtqueue *vq,
 	return 0;
 }
 
+/* Mark the packed ring descriptor at idx used for a buffer of len bytes */
+static int vhost_put_used_flags_packed(struct vhost_virtqueue *vq, u16 idx,
+				       __virtio32 len)
+{
+	struct vring_packed_desc __user *desc;
+	u16 flags = 0;
+
+	desc = vq->desc_packed + vhost_packed_slot(vq, idx);
+	if (vhost_packed_wrap(vq, idx))
+		flags = 1 << VRING_PACKED_DESC_F_AVAIL |
+			1 << VRING_PACKED_DESC_F_USED;
+	if (len)
+		flags |= VRING_DESC_F_WRITE;
+
+	return vhost_put_desc(vq, cpu_to_le16(flags), &desc->flags);
+}
+
+/* A packed ring gets used buffers written back in order from last_used_idx,
+ * each taking as many slots as it was made available in. The flags of the
+ * first buffer go last so that the guest sees the whole batch at once. */
+static int vhost_add_used_n_packed(struct vhost_virtqueue *vq,
+				   struct vring_used_elem *heads,
+				   unsigned count)
+{
+	struct vring_packed_desc __user *desc;
+	u16 old = vq->last_used_idx, new = old;
+	unsigned int i, id;
+	u32 len;
+
+	for (i = 0; i < count; i++) {
+		id = vhost32_to_cpu(vq, heads[i].id);
+		len = vhost32_to_cpu(vq, heads[i].len);
+		desc = vq->desc_packed + vhost_packed_slot(vq, new);
+		if (vhost_put_desc(vq, cpu_to_le16(id), &desc->id) ||
+		    vhost_put_desc(vq, cpu_to_le32(len), &desc->len)) {
+			vq_err(vq, "Failed to write used descriptor");
+			return -EFAULT;
+		}
+		new += vq->desc_count[id];
+	}
+
+	/* Make sure buffer is written before we flip the flags. */
+	smp_wmb();
+	new = old + vq->desc_count[vhost32_to_cpu(vq, heads[0].id)];
+	for (i = 1; i < count; i++) {
+		if (vhost_put_used_flags_packed(vq, new, heads[i].len)) {
+			vq_err(vq, "Failed to write used flags");
+			return -EFAULT;
+		}
+		new += vq->desc_count[vhost32_to_cpu(vq, heads[i].id)];
+	}
+	smp_wmb();
+	if (vhost_put_used_flags_packed(vq, old, heads[0].len)) {
+		vq_err(vq, "Failed to write used flags");
+		return -EFAULT;
+	}
+
+	if (unlikely(vq->log_used)) {
+		/* Make sure data is seen before log. */
+		smp_wmb();
+		/* Log used descriptor writes, log_addr is the ring's. */
+		for (i = 0, new = old; i < count; i++) {
+			log_write(vq->log_base, vq->log_addr +
+				  vhost_packed_slot(vq, new) * sizeof *desc,
+				  sizeof *desc);
+			new += vq->desc_count[vhost32_to_cpu(vq, heads[i].id)];
+		}
+		if (vq->log_ctx)
+			eventfd_signal(vq->log_ctx, 1);
+	}
+
+	vq->last_used_idx = new;
+	/* Same as for the split ring, see __vhost_add_used_n. */
+	if (unlikely((u16)(new - vq->signalled_used) < (u16)(new - old)))
+		vq->signalled_used_valid = false;
+	return 0;
+}
+
 /* After we've used one of their buffers, we tell them about it.  We'll then
  * want to notify the guest, using eventfd. */
 int vhost_add_used_n(struct vhost_virtqueue *vq, struct vring_used_elem *heads,
@@ -2206,6 +2957,9 @@ int vhost_add_used_n(struct vhost_virtqueue *vq, struct vring_used_elem *heads,
 {
 	int start, n, r;
 
+	if (vhost_vq_is_packed(vq))
+		return count ? vhost_add_used_n_packed(vq, heads, count) : 0;
+
 	start = vq->last_used_idx & (vq->num - 1);
 	n = vq->num - start;
 	if (n < count) {
@@ -2236,12 +2990,74 @@ int vhost_add_used_n(struct vhost_virtqueue *vq, struct vring_used_elem *heads,
 }
 EXPORT_SYMBOL_GPL(vhost_add_used_n);
 
+/* Turn the slot and wrap counter of a packed ring event into the free
+ * running index closest to idx. */
+static u16 vhost_packed_event_idx(struct vhost_virtqueue *vq, u16 off_wrap,
+				  u16 idx)
+{
+	u16 lap = 2 * vq->num;
+	u16 event = (idx & ~(lap - 1)) +
+		    (off_wrap & ~(1 << VRING_PACKED_EVENT_F_WRAP_CTR));
+
+	if (!(off_wrap >> VRING_PACKED_EVENT_F_WRAP_CTR))
+		event += vq->num;
+	if ((s16)(event - idx) >= (int)vq->num)
+		event -= lap;
+	else if ((s16)(event - idx) < -(int)vq->num)
+		event += lap;
+	return event;
+}
+
+static bool vhost_notify_packed(struct vhost_dev *dev,
+				struct vhost_virtqueue *vq)
+{
+	__le16 flags, off_wrap;
+	__u16 old, new, event;
+	bool v;
+
+	/* Flush out used descriptor updates. This is paired
+	 * with the barrier that the Guest executes when enabling
+	 * interrupts. */
+	smp_mb();
+	if (vhost_get_avail(vq, flags, &vq->driver_event->flags)) {
+		vq_err(vq, "Failed to get driver event flags");
+		return true;
+	}
+
+	old = vq->signalled_used;
+	v = vq->signalled_used_valid;
+	new = vq->signalled_used = vq->last_used_idx;
+	vq->signalled_used_valid = true;
+
+	if (!vhost_has_feature(vq, VIRTIO_RING_F_EVENT_IDX) ||
+	    flags != cpu_to_le16(VRING_PACKED_EVENT_FLAG_DESC))
+		return flags != cpu_to_le16(VRING_PACKED_EVENT_FLAG_DISABLE);
+
+	if (unlikely(!v))
+		return true;
+
+	/* The guest writes the offset before the flags. */
+	smp_rmb();
+	if (vhost_get_avail(vq, off_wrap, &vq->driver_event->off_wrap)) {
+		vq_err(vq, "Failed to get driver event offset");
+		return true;
+	}
+	event = vhost_packed_event_idx(vq, le16_to_cpu(off_wrap), new);
+
+	return vring_need_event(event, new, old);
+}
+
 static bool vhost_notify(struct vhost_dev *dev, struct vhost_virtqueue *vq)
 {
 	__u16 old, new;
 	__virtio16 event;
 	bool v;
 
+	/* VIRTIO_F_NOTIFY_ON_EMPTY is legacy only, so it never comes
+	 * with a packed ring. */
+	if (vhost_vq_is_packed(vq))
+		return vhost_notify_packed(dev, vq);
+
 	if (vhost_has_feature(vq, VIRTIO_F_NOTIFY_ON_EMPTY) &&
 	    unlikely(vq->avail_idx == vq->last_avail_idx))
 		return true;
@@ -2321,8 +3137,14 @@ EXPORT_SYMBOL_GPL(vhost_add_used_and_signal_n);
 bool vhost_vq_avail_empty(struct vhost_dev *dev, struct vhost_virtqueue *vq)
 {
 	__virtio16 avail_idx;
+	bool avail;
 	int r;
 
+	if (vhost_vq_is_packed(vq)) {
+		r = vhost_packed_desc_avail(vq, vq->last_avail_idx, &avail);
+		return !r && !avail;
+	}
+
 	if (vq->avail_idx != vq->last_avail_idx)
 		return false;
 
@@ -2339,11 +3161,25 @@ EXPORT_SYMBOL_GPL(vhost_vq_avail_empty);
 bool vhost_enable_notify(struct vhost_dev *dev, struct vhost_virtqueue *vq)
 {
 	__virtio16 avail_idx;
+	bool avail;
 	int r;
 
 	if (!(vq->used_flags & VRING_USED_F_NO_NOTIFY))
 		return false;
 	vq->used_flags &= ~VRING_USED_F_NO_NOTIFY;
+	if (vhost_vq_is_packed(vq)) {
+		r = vhost_update_device_event(vq);
+		if (r) {
+			vq_err(vq, "Failed to enable notification at %p: %d\n",
+			       &vq->device_event->flags, r);
+			return false;
+		}
+		/* They could have slipped one in as we were doing that:
+		 * make sure it's written, then check again. */
+		smp_mb();
+		r = vhost_packed_desc_avail(vq, vq->last_avail_idx, &avail);
+		return !r && avail;
+	}
 	if (!vhost_has_feature(vq, VIRTIO_RING_F_EVENT_IDX)) {
 		r = vhost_update_used_flags(vq);
 		if (r) {
@@ -2381,6 +3217,13 @@ void vhost_disable_notify(struct vhost_dev *dev, struct vhost_virtqueue *vq)
 	if (vq->used_flags & VRING_USED_F_NO_NOTIFY)
 		return;
 	vq->used_flags |= VRING_USED_F_NO_NOTIFY;
+	if (vhost_vq_is_packed(vq)) {
+		r = vhost_update_device_event(vq);
+		if (r)
+			vq_err(vq, "Failed to disable notification at %p: %d\n",
+			       &vq->device_event->flags, r);
+		return;
+	}
 	if (!vhost_has_feature(vq, VIRTIO_RING_F_EVENT_IDX)) {
 		r = vhost_update_used_flags(vq);
 		if (r)
@@ -11,6 +11,8 @@
 #include <linux/virtio_config.h>
 #include <linux/virtio_ring.h>
 #include <linux/atomic.h>
+#include <linux/sched/clock.h>
+#include <linux/sched/signal.h>
 
 struct vhost_work;
 typedef void (*vhost_work_fn_t)(struct vhost_work *work);
@@ -35,14 +37,45 @@ struct vhost_poll {
 	struct vhost_work	  work;
 	unsigned long		  mask;
 	struct vhost_dev	 *dev;
+	struct vhost_virtqueue	 *vq;
+};
+
+/* A kernel thread running the work queued by the device or its virtqueues */
+struct vhost_worker {
+	struct task_struct	 *task;
+	struct llist_head	  work_list;
+	struct vhost_dev	 *dev;
+	int			  id;
 };
 
 void vhost_work_init(struct vhost_work *work, vhost_work_fn_t fn);
 void vhost_work_queue(struct vhost_dev *dev, struct vhost_work *work);
+void vhost_vq_work_queue(struct vhost_virtqueue *vq, struct vhost_work *work);
 bool vhost_has_work(struct vhost_dev *dev);
+bool vhost_vq_has_work(struct vhost_virtqueue *vq);
+
+unsigned int vhost_busy_poll_time(struct vhost_virtqueue *vq);
+void vhost_busy_poll_done(struct vhost_virtqueue *vq, bool hit);
+void vhost_busy_poll_idle(struct vhost_virtqueue *vq);
+void vhost_busy_poll_wake(struct vhost_virtqueue *vq);
+
+static inline unsigned long busy_clock(void)
+{
+	return local_clock() >> 10;
+}
+
+static inline bool vhost_can_busy_poll(struct vhost_virtqueue *vq,
+				       unsigned long endtime)
+{
+	return likely(!need_resched()) &&
+	       likely(!time_after(busy_clock(), endtime)) &&
+	       likely(!signal_pending(current)) &&
+	       !vhost_vq_has_work(vq);
+}
 
 void vhost_poll_init(struct vhost_poll *poll, vhost_work_fn_t fn,
-		     unsigned long mask, struct vhost_dev *dev);
+		     unsigned long mask, struct vhost_dev *dev,
+		     struct vhost_virtqueue *vq);
 int vhost_poll_start(struct vhost_poll *poll, struct file *file);
 void vhost_poll_stop(struct vhost_poll *poll);
 void vhost_poll_flush(struct vhost_poll *poll);
@@ -83,6 +116,9 @@ enum vhost_uaddr_type {
 	VHOST_NUM_ADDRS = 3,
 };
 
+/* Max number of avail ring entries read ahead in one access */
+#define VHOST_AVAIL_BATCH 64
+
 /* The virtqueue structure describes a queue attached to a device. */
 struct vhost_virtqueue {
 	struct vhost_dev *dev;
@@ -90,9 +126,21 @@ struct vhost_virtqueue {
 	/* The actual ring of buffers. */
 	struct mutex mutex;
 	unsigned int num;
-	struct vring_desc __user *desc;
-	struct vring_avail __user *avail;
-	struct vring_used __user *used;
+	/* A packed ring has the descriptor ring and the driver and device
+	 * event suppression areas in place of the split desc, avail and used
+	 * rings. */
+	union {
+		struct vring_desc __user *desc;
+		struct vring_packed_desc __user *desc_packed;
+	};
+	union {
+		struct vring_avail __user *avail;
+		struct vring_packed_desc_event __user *driver_event;
+	};
+	union {
+		struct vring_used __user *used;
+		struct vring_packed_desc_event __user *device_event;
+	};
 	const struct vhost_umem_node *meta_iotlb[VHOST_NUM_ADDRS];
 	struct file *kick;
 	struct file *call;
@@ -102,6 +150,8 @@ struct vhost_virtqueue {
 	struct eventfd_ctx *log_ctx;
 
 	struct vhost_poll poll;
+	/* Worker running poll, NULL for the default one of the device. */
+	struct vhost_worker *worker;
 
 	/* The routine to call when the Guest pings us, or timeout. */
 	vhost_work_fn_t handle_kick;
@@ -127,6 +177,16 @@ struct vhost_virtqueue {
 	/* Last used index value we have signalled on */
 	bool signalled_used_valid;
 
+	/* Packed ring: descriptors in each outstanding buffer, indexed by
+	 * buffer id and by the ring slot of the last descriptor in it */
+	u16 *desc_count;
+	u16 *chain_len;
+
+	/* Avail ring entries read ahead, from avail index avail_cache_idx */
+	__virtio16 avail_cache[VHOST_AVAIL_BATCH];
+	u16 avail_cache_idx;
+	u16 avail_cache_num;
+
 	/* Log writes to used structure. */
 	bool log_used;
 	u64 log_addr;
@@ -152,6 +212,13 @@ struct vhost_virtqueue {
 	bool user_be;
 #endif
 	u32 busyloop_timeout;
+	/* Current busy poll window, in busy_clock() units */
+	unsigned int busyloop_cur;
+	/* busy_clock() when the ring or backend went idle, 0 if it has not */
+	unsigned long busyloop_idle;
+	/* Busy polls that found work, and those that timed out */
+	u64 busyloop_hits;
+	u64 busyloop_misses;
 };
 
 struct vhost_msg_node {
@@ -167,8 +234,10 @@ struct vhost_dev {
 	int nvqs;
 	struct file *log_file;
 	struct eventfd_ctx *log_ctx;
-	struct llist_head work_list;
-	struct task_struct *worker;
+	/* The default worker, also found at workers[0] */
+	struct vhost_worker *worker;
+	struct vhost_worker **workers;
+	int nworkers;
 	struct vhost_umem *umem;
 	struct vhost_umem *iotlb;
 	spinlock_t iotlb_lock;
@@ -239,7 +308,8 @@ enum {
 			 (1ULL << VIRTIO_RING_F_EVENT_IDX) |
 			 (1ULL << VHOST_F_LOG_ALL) |
 			 (1ULL << VIRTIO_F_ANY_LAYOUT) |
-			 (1ULL << VIRTIO_F_VERSION_1)
+			 (1ULL << VIRTIO_F_VERSION_1) |
+			 (1ULL << VIRTIO_F_RING_PACKED)
 };
 
 static inline bool vhost_has_feature(struct vhost_virtqueue *vq, int bit)
@@ -247,6 +317,11 @@ static inline bool vhost_has_feature(struct vhost_virtqueue *vq, int bit)
 	return vq->acked_features & (1ULL << bit);
 }
 
+static inline bool vhost_vq_is_packed(struct vhost_virtqueue *vq)
+{
+	return vhost_has_feature(vq, VIRTIO_F_RING_PACKED);
+}
+
 #ifdef CONFIG_VHOST_CROSS_ENDIAN_LEGACY
 static inline bool vhost_is_little_endian(struct vhost_virtqueue *vq)
 {
@@ -21,6 +21,9 @@
 
 #define VHOST_VSOCK_DEFAULT_HOST_CID	2
 
+/* Max number of used buffers to collect before updating the used ring */
+#define VHOST_VSOCK_BATCH 64
+
 enum {
 	VHOST_VSOCK_FEATURES = VHOST_FEATURES,
 };
@@ -87,6 +90,8 @@ vhost_transport_do_send_pkt(struct vhost_vsock *vsock,
 	struct vhost_virtqueue *tx_vq = &vsock->vqs[VSOCK_VQ_TX];
 	bool added = false;
 	bool restart_tx = false;
+	unsigned int nheads = 0;
+	LIST_HEAD(pkts);
 
 	mutex_lock(&vq->mutex);
 
@@ -104,31 +109,30 @@ vhost_transport_do_send_pkt(struct vhost_vsock *vsock,
 		size_t len;
 		int head;
 
-		spin_lock_bh(&vsock->send_pkt_list_lock);
-		if (list_empty(&vsock->send_pkt_list)) {
+		/* Take all the pending packets with one lock round trip */
+		if (list_empty(&pkts)) {
+			spin_lock_bh(&vsock->send_pkt_list_lock);
+			list_splice_init(&vsock->send_pkt_list, &pkts);
 			spin_unlock_bh(&vsock->send_pkt_list_lock);
+		}
+
+		if (list_empty(&pkts)) {
 			vhost_enable_notify(&vsock->dev, vq);
 			break;
 		}
 
-		pkt = list_first_entry(&vsock->send_pkt_list,
-				       struct virtio_vsock_pkt, list);
+		pkt = list_first_entry(&pkts, struct virtio_vsock_pkt, list);
 		list_del_init(&pkt->list);
-		spin_unlock_bh(&vsock->send_pkt_list_lock);
 
 		head = vhost_get_vq_desc(vq, vq->iov, ARRAY_SIZE(vq->iov),
 					 &out, &in, NULL, NULL);
 		if (head < 0) {
-			spin_lock_bh(&vsock->send_pkt_list_lock);
-			list_add(&pkt->list, &vsock->send_pkt_list);
-			spin_unlock_bh(&vsock->send_pkt_list_lock);
+			list_add(&pkt->list, &pkts);
 			break;
 		}
 
 		if (head == vq->num) {
-			spin_lock_bh(&vsock->send_pkt_list_lock);
-			list_add(&pkt->list, &vsock->send_pkt_list);
-			spin_unlock_bh(&vsock->send_pkt_list_lock);
+			list_add(&pkt->list, &pkts);
 
 			/* We cannot finish yet if more buffers snuck in while
 			 * re-enabling notify.
@@ -163,7 +167,13 @@ vhost_transport_do_send_pkt(struct vhost_vsock *vsock,
 			break;
 		}
 
-		vhost_add_used(vq, head, sizeof(pkt->hdr) + pkt->len);
+		vq->heads[nheads].id = cpu_to_vhost32(vq, head);
+		vq->heads[nheads].len = cpu_to_vhost32(vq, sizeof(pkt->hdr) +
+						       pkt->len);
+		if (++nheads == VHOST_VSOCK_BATCH) {
+			vhost_add_used_n(vq, vq->heads, nheads);
+			nheads = 0;
+		}
 		added = true;
 
 		if (pkt->reply) {
@@ -183,9 +193,18 @@ vhost_transport_do_send_pkt(struct vhost_vsock *vsock,
 
 		virtio_transport_free_pkt(pkt);
 	}
+	if (nheads)
+		vhost_add_used_n(vq, vq->heads, nheads);
 	if (added)
 		vhost_signal(&vsock->dev, vq);
 
+	/* Whatever couldn't be sent goes back ahead of the newer packets */
+	if (!list_empty(&pkts)) {
+		spin_lock_bh(&vsock->send_pkt_list_lock);
+		list_splice(&pkts, &vsock->send_pkt_list);
+		spin_unlock_bh(&vsock->send_pkt_list_lock);
+	}
+
 out:
 	mutex_unlock(&vq->mutex);
 
@@ -224,7 +243,11 @@ vhost_transport_send_pkt(struct virtio_vsock_pkt *pkt)
 	list_add_tail(&pkt->list, &vsock->send_pkt_list);
 	spin_unlock_bh(&vsock->send_pkt_list_lock);
 
-	vhost_work_queue(&vsock->dev, &vsock->send_pkt_work);
+	/*
+	 * Run on the worker of the rx ring, which userspace can split from
+	 * the tx one with VHOST_ATTACH_VRING_WORKER.
+	 */
+	vhost_vq_work_queue(&vsock->vqs[VSOCK_VQ_RX], &vsock->send_pkt_work);
 	return len;
 }
 
@@ -348,6 +371,7 @@ static void vhost_vsock_handle_tx_kick(struct vhost_work *work)
 	struct virtio_vsock_pkt *pkt;
 	int head;
 	unsigned int out, in;
+	unsigned int nheads = 0;
 	bool added = false;
 
 	mutex_lock(&vq->mutex);
@@ -397,11 +421,19 @@ static void vhost_vsock_handle_tx_kick(struct vhost_work *work)
 		else
 			virtio_transport_free_pkt(pkt);
 
-		vhost_add_used(vq, head, sizeof(pkt->hdr) + len);
+		vq->heads[nheads].id = cpu_to_vhost32(vq, head);
+		vq->heads[nheads].len = cpu_to_vhost32(vq,
+						       sizeof(pkt->hdr) + len);
+		if (++nheads == VHOST_VSOCK_BATCH) {
+			vhost_add_used_n(vq, vq->heads, nheads);
+			nheads = 0;
+		}
 		added = true;
 	}
 
 no_more_replies:
+	if (nheads)
+		vhost_add_used_n(vq, vq->heads, nheads);
 	if (added)
 		vhost_signal(&vsock->dev, vq);
 
@@ -546,6 +578,7 @@ static void vhost_vsock_flush(struct vhost_vsock *vsock)
 {
 	int i;
 
+	/* send_pkt_work runs on the worker of the rx ring */
 	for (i = 0; i < ARRAY_SIZE(vsock->vqs); i++)
 		if (vsock->vqs[i].handle_kick)
 			vhost_poll_flush(&vsock->vqs[i].poll);
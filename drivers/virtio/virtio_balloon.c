@@ -32,6 +32,7 @@
 #include <linux/mm.h>
 #include <linux/mount.h>
 #include <linux/magic.h>
+#include <linux/page_reporting.h>
 
 /*
  * Balloon device works in 4K page units.  So each page is pointed to by
@@ -43,6 +44,11 @@
 #define OOM_VBALLOON_DEFAULT_PAGES 256
 #define VIRTBALLOON_OOM_NOTIFY_PRIORITY 80
 
+/* Free page hints are the largest blocks the buddy allocator has spare */
+#define VIRTIO_BALLOON_FREE_PAGE_ORDER (MAX_ORDER - 1)
+#define VIRTIO_BALLOON_FREE_PAGE_ALLOC_FLAG \
+	(__GFP_NORETRY | __GFP_NOWARN | __GFP_NOMEMALLOC)
+
 static int oom_pages = OOM_VBALLOON_DEFAULT_PAGES;
 module_param(oom_pages, int, S_IRUSR | S_IWUSR);
 MODULE_PARM_DESC(oom_pages, "pages to free on OOM");
@@ -53,11 +59,13 @@ static struct vfsmount *balloon_mnt;
 
 struct virtio_balloon {
 	struct virtio_device *vdev;
-	struct virtqueue *inflate_vq, *deflate_vq, *stats_vq;
+	struct virtqueue *inflate_vq, *deflate_vq, *stats_vq, *reporting_vq;
+	struct virtqueue *free_page_vq;
 
 	/* The balloon servicing is delegated to a freezable workqueue. */
 	struct work_struct update_balloon_stats_work;
 	struct work_struct update_balloon_size_work;
+	struct work_struct report_free_page_work;
 
 	/* Prevent updating balloon when it is being canceled. */
 	spinlock_t stop_update_lock;
@@ -88,6 +96,18 @@ struct virtio_balloon {
 
 	/* To register callback in oom notifier call chain */
 	struct notifier_block nb;
+
+	/* Free page reporting device */
+	struct page_reporting_dev_info pr_dev_info;
+
+	/* The last free page hint command id from the host */
+	u32 cmd_id_received;
+	/* The command id buffers the host reads off free_page_vq */
+	__virtio32 cmd_id_active;
+	__virtio32 cmd_id_stop;
+	/* The free page blocks hinted to the host, held until it is done */
+	struct list_head free_page_list;
+	unsigned long num_free_page_blocks;
 };
 
 static struct virtio_device_id id_table[] = {
@@ -133,6 +153,171 @@ static void tell_host(struct virtio_balloon *vb, struct virtqueue *vq)
 
 }
 
+/*
+ * Free pages are reported a batch at a time, each page a whole buffer in
+ * the single request on the reporting virtqueue. The host may discard their
+ * contents, and they are only given back to the page allocator once it has
+ * used the request.
+ */
+static int virtballoon_free_page_report(struct page_reporting_dev_info *prdev,
+					struct scatterlist *sg,
+					unsigned int nents)
+{
+	struct virtio_balloon *vb = container_of(prdev,
+			struct virtio_balloon, pr_dev_info);
+	struct virtqueue *vq = vb->reporting_vq;
+	unsigned int len;
+	int err;
+
+	/* An empty queue only fails on a ring smaller than the batch */
+	err = virtqueue_add_inbuf(vq, sg, nents, vb, GFP_NOWAIT | __GFP_NOWARN);
+	if (err)
+		return err;
+	virtqueue_kick(vq);
+
+	/* When host has used the pages, this completes via balloon_ack */
+	wait_event(vb->acked, virtqueue_get_buf(vq, &len));
+
+	return 0;
+}
+
+static void virtballoon_register_reporting(struct virtio_balloon *vb)
+{
+	int err;
+
+	if (!virtio_has_feature(vb->vdev, VIRTIO_BALLOON_F_REPORTING))
+		return;
+
+	vb->pr_dev_info.report = virtballoon_free_page_report;
+	err = page_reporting_register(&vb->pr_dev_info);
+	if (err)
+		dev_warn(&vb->vdev->dev, "free page reporting disabled: %d\n",
+			 err);
+}
+
+/*
+ * Free page hinting lets the host skip the guest's free memory while it
+ * migrates it. Once dirty logging has started, the host writes a new command
+ * id to the config space. The driver echoes the id on free_page_vq, then
+ * allocates the largest free blocks it can without reclaim and hands each
+ * one to the host as a buffer, and ends with VIRTIO_BALLOON_CMD_ID_STOP.
+ * The host skips the hinted blocks it hasn't sent yet, and any write the
+ * guest makes to them later is caught by the dirty log as usual.
+ *
+ * The blocks are held until the host writes VIRTIO_BALLOON_CMD_ID_DONE, so
+ * that none of them is reused while the host may still act on its hint. The
+ * host uses every buffer, and ignores those of a command id it is done with.
+ */
+static void return_free_pages_to_mm(struct virtio_balloon *vb)
+{
+	struct page *page, *next;
+
+	list_for_each_entry_safe(page, next, &vb->free_page_list, lru) {
+		list_del(&page->lru);
+		__free_pages(page, VIRTIO_BALLOON_FREE_PAGE_ORDER);
+	}
+	vb->num_free_page_blocks = 0;
+}
+
+static int send_cmd_id(struct virtio_balloon *vb, __virtio32 *cmd_id, u32 id)
+{
+	struct virtqueue *vq = vb->free_page_vq;
+	struct scatterlist sg;
+	int err;
+
+	*cmd_id = cpu_to_virtio32(vb->vdev, id);
+	sg_init_one(&sg, cmd_id, sizeof(*cmd_id));
+	err = virtqueue_add_outbuf(vq, &sg, 1, cmd_id, GFP_KERNEL);
+	if (!err)
+		virtqueue_kick(vq);
+	return err;
+}
+
+static int get_free_page_and_send(struct virtio_balloon *vb)
+{
+	struct virtqueue *vq = vb->free_page_vq;
+	struct scatterlist sg;
+	struct page *page;
+	unsigned int unused;
+	int err;
+
+	/* The blocks of the used buffers stay on free_page_list */
+	while (virtqueue_get_buf(vq, &unused))
+		;
+
+	/* Keep a slot for the stop command id */
+	if (vq->num_free <= 1)
+		return -ENOSPC;
+
+	page = alloc_pages(VIRTIO_BALLOON_FREE_PAGE_ALLOC_FLAG,
+			   VIRTIO_BALLOON_FREE_PAGE_ORDER);
+	if (!page)
+		return -ENOMEM;
+
+	sg_init_one(&sg, page_address(page),
+		    PAGE_SIZE << VIRTIO_BALLOON_FREE_PAGE_ORDER);
+	err = virtqueue_add_inbuf(vq, &sg, 1, page, GFP_KERNEL);
+	if (err) {
+		__free_pages(page, VIRTIO_BALLOON_FREE_PAGE_ORDER);
+		return err;
+	}
+	virtqueue_kick(vq);
+
+	list_add(&page->lru, &vb->free_page_list);
+	vb->num_free_page_blocks++;
+	return 0;
+}
+
+static void report_free_page_func(struct work_struct *work)
+{
+	struct virtio_balloon *vb = container_of(work, struct virtio_balloon,
+						 report_free_page_work);
+	u32 cmd_id = READ_ONCE(vb->cmd_id_received);
+	unsigned int unused;
+
+	/* A new report starts from scratch, the old hints are stale */
+	return_free_pages_to_mm(vb);
+	if (cmd_id == VIRTIO_BALLOON_CMD_ID_STOP ||
+	    cmd_id == VIRTIO_BALLOON_CMD_ID_DONE)
+		return;
+
+	/* Stale hints must not be read under the new command id */
+	while (virtqueue_get_buf(vb->free_page_vq, &unused))
+		;
+	if (vb->free_page_vq->num_free <
+	    virtqueue_get_vring_size(vb->free_page_vq))
+		return;
+
+	if (send_cmd_id(vb, &vb->cmd_id_active, cmd_id))
+		return;
+
+	/* Until memory runs out or the host changes its mind */
+	while (READ_ONCE(vb->cmd_id_received) == cmd_id &&
+	       !get_free_page_and_send(vb))
+		cond_resched();
+
+	send_cmd_id(vb, &vb->cmd_id_stop, VIRTIO_BALLOON_CMD_ID_STOP);
+}
+
+/* Called with stop_update_lock held */
+static void virtballoon_free_page_cmd(struct virtio_balloon *vb)
+{
+	u32 cmd_id;
+
+	virtio_cread(vb->vdev, struct virtio_balloon_config,
+		     free_page_hint_cmd_id, &cmd_id);
+
+	/* Legacy balloon config space is LE, unlike all other devices. */
+	if (!virtio_has_feature(vb->vdev, VIRTIO_F_VERSION_1))
+		cmd_id = le32_to_cpu((__force __le32)cmd_id);
+
+	if (cmd_id == vb->cmd_id_received)
+		return;
+
+	WRITE_ONCE(vb->cmd_id_received, cmd_id);
+	queue_work(system_freezable_wq, &vb->report_free_page_work);
+}
+
 static void set_page_pfns(struct virtio_balloon *vb,
 			  __virtio32 pfns[], struct page *page)
 {
@@ -313,8 +498,11 @@ static void virtballoon_changed(struct virtio_device *vdev)
 	unsigned long flags;
 
 	spin_lock_irqsave(&vb->stop_update_lock, flags);
-	if (!vb->stop_update)
+	if (!vb->stop_update) {
 		queue_work(system_freezable_wq, &vb->update_balloon_size_work);
+		if (virtio_has_feature(vdev, VIRTIO_BALLOON_F_FREE_PAGE_HINT))
+			virtballoon_free_page_cmd(vb);
+	}
 	spin_unlock_irqrestore(&vb->stop_update_lock, flags);
 }
 
@@ -408,22 +596,41 @@ static void update_balloon_size_func(struct work_struct *work)
 
 static int init_vqs(struct virtio_balloon *vb)
 {
-	struct virtqueue *vqs[3];
-	vq_callback_t *callbacks[] = { balloon_ack, balloon_ack, stats_request };
-	static const char * const names[] = { "inflate", "deflate", "stats" };
-	int err, nvqs;
+	struct virtqueue *vqs[5];
+	vq_callback_t *callbacks[5] = { balloon_ack, balloon_ack };
+	const char *names[5] = { "inflate", "deflate" };
+	int err, nvqs = 2, free_page = 0, reporting = 0;
 
 	/*
 	 * We expect two virtqueues: inflate and deflate, and
-	 * optionally stat.
+	 * optionally stat, free page hint and reporting, in that order.
 	 */
-	nvqs = virtio_has_feature(vb->vdev, VIRTIO_BALLOON_F_STATS_VQ) ? 3 : 2;
+	if (virtio_has_feature(vb->vdev, VIRTIO_BALLOON_F_STATS_VQ)) {
+		callbacks[nvqs] = stats_request;
+		names[nvqs++] = "stats";
+	}
+	if (virtio_has_feature(vb->vdev, VIRTIO_BALLOON_F_FREE_PAGE_HINT)) {
+		/* Polled for used buffers by the report, no interrupt */
+		free_page = nvqs;
+		callbacks[nvqs] = NULL;
+		names[nvqs++] = "free_page_vq";
+	}
+	if (virtio_has_feature(vb->vdev, VIRTIO_BALLOON_F_REPORTING)) {
+		reporting = nvqs;
+		callbacks[nvqs] = balloon_ack;
+		names[nvqs++] = "reporting_vq";
+	}
+
 	err = virtio_find_vqs(vb->vdev, nvqs, vqs, callbacks, names, NULL);
 	if (err)
 		return err;
 
 	vb->inflate_vq = vqs[0];
 	vb->deflate_vq = vqs[1];
+	if (free_page)
+		vb->free_page_vq = vqs[free_page];
+	if (reporting)
+		vb->reporting_vq = vqs[reporting];
 	if (virtio_has_feature(vb->vdev, VIRTIO_BALLOON_F_STATS_VQ)) {
 		struct scatterlist sg;
 		unsigned int num_stats;
@@ -544,12 +751,16 @@ static int virtballoon_probe(struct virtio_device *vdev)
 
 	INIT_WORK(&vb->update_balloon_stats_work, update_balloon_stats_func);
 	INIT_WORK(&vb->update_balloon_size_work, update_balloon_size_func);
+	INIT_WORK(&vb->report_free_page_work, report_free_page_func);
 	spin_lock_init(&vb->stop_update_lock);
 	vb->stop_update = false;
 	vb->num_pages = 0;
 	mutex_init(&vb->balloon_lock);
 	init_waitqueue_head(&vb->acked);
 	vb->vdev = vdev;
+	vb->cmd_id_received = VIRTIO_BALLOON_CMD_ID_STOP;
+	INIT_LIST_HEAD(&vb->free_page_list);
+	vb->num_free_page_blocks = 0;
 
 	balloon_devinfo_init(&vb->vb_dev_info);
 
@@ -584,6 +795,7 @@ static int virtballoon_probe(struct virtio_device *vdev)
 #endif
 
 	virtio_device_ready(vdev);
+	virtballoon_register_reporting(vb);
 
 	if (towards_target(vb))
 		virtballoon_changed(vdev);
@@ -599,6 +811,10 @@ static int virtballoon_probe(struct virtio_device *vdev)
 
 static void remove_common(struct virtio_balloon *vb)
 {
+	/* No report must be in flight when the queues go away */
+	page_reporting_unregister(&vb->pr_dev_info);
+	cancel_work_sync(&vb->report_free_page_work);
+
 	/* There might be pages left in the balloon: free them. */
 	while (vb->num_pages)
 		leak_balloon(vb, vb->num_pages);
@@ -608,6 +824,10 @@ static void remove_common(struct virtio_balloon *vb)
 	vb->vdev->config->reset(vb->vdev);
 
 	vb->vdev->config->del_vqs(vb->vdev);
+
+	/* The host can't read the hints anymore, and starts over on restore */
+	return_free_pages_to_mm(vb);
+	vb->cmd_id_received = VIRTIO_BALLOON_CMD_ID_STOP;
 }
 
 static void virtballoon_remove(struct virtio_device *vdev)
@@ -655,6 +875,7 @@ static int virtballoon_restore(struct virtio_device *vdev)
 		return ret;
 
 	virtio_device_ready(vdev);
+	virtballoon_register_reporting(vb);
 
 	if (towards_target(vb))
 		virtballoon_changed(vdev);
@@ -667,6 +888,8 @@ static unsigned int features[] = {
 	VIRTIO_BALLOON_F_MUST_TELL_HOST,
 	VIRTIO_BALLOON_F_STATS_VQ,
 	VIRTIO_BALLOON_F_DEFLATE_ON_OOM,
+	VIRTIO_BALLOON_F_FREE_PAGE_HINT,
+	VIRTIO_BALLOON_F_REPORTING,
 };
 
 static struct virtio_driver virtio_balloon_driver = {
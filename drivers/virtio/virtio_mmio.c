@@ -89,11 +89,16 @@ struct virtio_mmio_device {
 	struct platform_device *pdev;
 
 	void __iomem *base;
+	resource_size_t size;
 	unsigned long version;
 
 	/* a list of queues so we can dispatch IRQs */
 	spinlock_t lock;
 	struct list_head virtqueues;
+
+	/* the interrupt status word, with VIRTIO_MMIO_F_SHM_INTERRUPT */
+	u32 *int_status;
+	dma_addr_t int_status_dma;
 };
 
 struct virtio_mmio_vq_info {
@@ -102,6 +107,9 @@ struct virtio_mmio_vq_info {
 
 	/* the list node for the virtqueues list */
 	struct list_head node;
+
+	/* the queue's notification register */
+	void __iomem *notify;
 };
 
 
@@ -126,9 +134,20 @@ static u64 vm_get_features(struct virtio_device *vdev)
 static int vm_finalize_features(struct virtio_device *vdev)
 {
 	struct virtio_mmio_device *vm_dev = to_virtio_mmio_device(vdev);
+	u64 features = vdev->features;
 
 	/* Give virtio_ring a chance to accept features. */
 	vring_transport_features(vdev);
+	/* Legacy devices take the ring as a single page frame */
+	if (vm_dev->version == 1) {
+		__virtio_clear_bit(vdev, VIRTIO_F_RING_PACKED);
+	} else {
+		/* Keep the MMIO transport extensions */
+		if (features & BIT_ULL(VIRTIO_MMIO_F_SHM_INTERRUPT))
+			__virtio_set_bit(vdev, VIRTIO_MMIO_F_SHM_INTERRUPT);
+		if (features & BIT_ULL(VIRTIO_MMIO_F_QUEUE_NOTIFY_OFF))
+			__virtio_set_bit(vdev, VIRTIO_MMIO_F_QUEUE_NOTIFY_OFF);
+	}
 
 	/* Make sure there is are no mixed devices */
 	if (vm_dev->version == 2 &&
@@ -275,11 +294,11 @@ static void vm_reset(struct virtio_device *vdev)
 /* the notify function used when creating a virt queue */
 static bool vm_notify(struct virtqueue *vq)
 {
-	struct virtio_mmio_device *vm_dev = to_virtio_mmio_device(vq->vdev);
+	struct virtio_mmio_vq_info *info = vq->priv;
 
 	/* We write the queue's selector into the notification register to
 	 * signal the other end */
-	writel(vq->index, vm_dev->base + VIRTIO_MMIO_QUEUE_NOTIFY);
+	writel(vq->index, info->notify);
 	return true;
 }
 
@@ -293,8 +312,13 @@ static irqreturn_t vm_interrupt(int irq, void *opaque)
 	irqreturn_t ret = IRQ_NONE;
 
 	/* Read and acknowledge interrupts */
-	status = readl(vm_dev->base + VIRTIO_MMIO_INTERRUPT_STATUS);
-	writel(status, vm_dev->base + VIRTIO_MMIO_INTERRUPT_ACK);
+	if (vm_dev->int_status) {
+		status = le32_to_cpu((__force __le32)xchg(vm_dev->int_status,
+							  0));
+	} else {
+		status = readl(vm_dev->base + VIRTIO_MMIO_INTERRUPT_STATUS);
+		writel(status, vm_dev->base + VIRTIO_MMIO_INTERRUPT_ACK);
+	}
 
 	if (unlikely(status & VIRTIO_MMIO_INT_CONFIG)) {
 		virtio_config_changed(&vm_dev->vdev);
@@ -338,6 +362,41 @@ static void vm_del_vq(struct virtqueue *vq)
 	kfree(info);
 }
 
+/*
+ * With VIRTIO_MMIO_F_SHM_INTERRUPT, the device sets the interrupt flags in
+ * memory and the handler takes them with an atomic exchange, rather than
+ * with a trapped read and write of the status and acknowledge registers.
+ */
+static int vm_alloc_int_status(struct virtio_mmio_device *vm_dev)
+{
+	vm_dev->int_status = dma_alloc_coherent(&vm_dev->pdev->dev,
+						sizeof(*vm_dev->int_status),
+						&vm_dev->int_status_dma,
+						GFP_KERNEL);
+	if (!vm_dev->int_status)
+		return -ENOMEM;
+
+	*vm_dev->int_status = 0;
+	writel((u32)vm_dev->int_status_dma,
+			vm_dev->base + VIRTIO_MMIO_INTERRUPT_SHM_LOW);
+	writel((u32)((u64)vm_dev->int_status_dma >> 32),
+			vm_dev->base + VIRTIO_MMIO_INTERRUPT_SHM_HIGH);
+	return 0;
+}
+
+static void vm_free_int_status(struct virtio_mmio_device *vm_dev)
+{
+	if (!vm_dev->int_status)
+		return;
+
+	/* The device must not write to the word once it is freed */
+	writel(0, vm_dev->base + VIRTIO_MMIO_INTERRUPT_SHM_LOW);
+	writel(0, vm_dev->base + VIRTIO_MMIO_INTERRUPT_SHM_HIGH);
+	dma_free_coherent(&vm_dev->pdev->dev, sizeof(*vm_dev->int_status),
+			  vm_dev->int_status, vm_dev->int_status_dma);
+	vm_dev->int_status = NULL;
+}
+
 static void vm_del_vqs(struct virtio_device *vdev)
 {
 	struct virtio_mmio_device *vm_dev = to_virtio_mmio_device(vdev);
@@ -347,6 +406,7 @@ static void vm_del_vqs(struct virtio_device *vdev)
 		vm_del_vq(vq);
 
 	free_irq(platform_get_irq(vm_dev->pdev, 0), vm_dev);
+	vm_free_int_status(vm_dev);
 }
 
 static struct virtqueue *vm_setup_vq(struct virtio_device *vdev, unsigned index,
@@ -380,6 +440,17 @@ static struct virtqueue *vm_setup_vq(struct virtio_device *vdev, unsigned index,
 		goto error_kmalloc;
 	}
 
+	info->notify = vm_dev->base + VIRTIO_MMIO_QUEUE_NOTIFY;
+	if (virtio_has_feature(vdev, VIRTIO_MMIO_F_QUEUE_NOTIFY_OFF)) {
+		u32 off = readl(vm_dev->base + VIRTIO_MMIO_QUEUE_NOTIFY_OFF);
+
+		if (off % sizeof(u32) || off > vm_dev->size - sizeof(u32)) {
+			err = -EINVAL;
+			goto error_new_virtqueue;
+		}
+		info->notify = vm_dev->base + off;
+	}
+
 	num = readl(vm_dev->base + VIRTIO_MMIO_QUEUE_NUM_MAX);
 	if (num == 0) {
 		err = -ENOENT;
@@ -454,10 +525,18 @@ static int vm_find_vqs(struct virtio_device *vdev, unsigned nvqs,
 	unsigned int irq = platform_get_irq(vm_dev->pdev, 0);
 	int i, err;
 
+	if (virtio_has_feature(vdev, VIRTIO_MMIO_F_SHM_INTERRUPT)) {
+		err = vm_alloc_int_status(vm_dev);
+		if (err)
+			return err;
+	}
+
 	err = request_irq(irq, vm_interrupt, IRQF_SHARED,
 			dev_name(&vdev->dev), vm_dev);
-	if (err)
+	if (err) {
+		vm_free_int_status(vm_dev);
 		return err;
+	}
 
 	for (i = 0; i < nvqs; ++i) {
 		vqs[i] = vm_setup_vq(vdev, i, callbacks[i], names[i],
@@ -526,6 +605,7 @@ static int virtio_mmio_probe(struct platform_device *pdev)
 	vm_dev->base = devm_ioremap(&pdev->dev, mem->start, resource_size(mem));
 	if (vm_dev->base == NULL)
 		return -EFAULT;
+	vm_dev->size = resource_size(mem);
 
 	/* Check magic value */
 	magic = readl(vm_dev->base + VIRTIO_MMIO_MAGIC_VALUE);
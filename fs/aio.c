@@ -40,6 +40,12 @@
 #include <linux/ramfs.h>
 #include <linux/percpu-refcount.h>
 #include <linux/mount.h>
+#include <linux/kthread.h>
+#include <linux/cred.h>
+#include <linux/fdtable.h>
+#include <linux/vmalloc.h>
+#include <linux/sched/mm.h>
+#include <linux/log2.h>
 
 #include <asm/kmap_types.h>
 #include <linux/uaccess.h>
@@ -67,6 +73,9 @@ struct aio_ring {
 
 #define AIO_RING_PAGES	8
 
+#define AIO_SQ_MAX_ENTRIES	4096
+#define AIO_SQ_THREAD_IDLE_MS	1000
+
 struct kioctx_table {
 	struct rcu_head	rcu;
 	unsigned	nr;
@@ -154,6 +163,41 @@ struct kioctx {
 	struct file		*aio_ring_file;
 
 	unsigned		id;
+
+	unsigned		flags;		/* IOCTX_FLAG_* */
+
+	/*
+	 * IOCTX_FLAG_SQRING: the submission ring, pinned and mapped in the
+	 * kernel so that it can be looked at from any context. sq_head is
+	 * the trusted copy of its head, sq_lock serializes submissions.
+	 */
+	struct aio_sq_ring	*sq_ring;
+	struct aio_sq_ring __user *sq_user;
+	struct page		**sq_pages;
+	unsigned		sq_nr_pages;
+	unsigned		sq_entries;
+	unsigned		sq_head;
+	bool			sq_compat;
+	struct mutex		sq_lock;
+	struct mm_struct	*mm;		/* mmgrab()ed */
+
+	/* IOCTX_FLAG_SQTHREAD */
+	struct task_struct	*sq_thread;
+	wait_queue_head_t	sq_wait;
+	unsigned long		sq_thread_idle;	/* in jiffies */
+	struct files_struct	*sq_files;
+	const struct cred	*sq_creds;
+
+	/*
+	 * IOCTX_FLAG_IOPOLL: requests waiting to be polled for, and the
+	 * work reaping them once nobody is going to do it any more.
+	 */
+	struct {
+		spinlock_t	poll_lock;
+		struct list_head poll_list;
+		atomic_t	poll_inflight;
+		struct work_struct poll_work;
+	} ____cacheline_aligned_in_smp;
 };
 
 /*
@@ -186,6 +230,25 @@ struct aio_kiocb {
 	 * this is the underlying eventfd context to deliver events to.
 	 */
 	struct eventfd_ctx	*ki_eventfd;
+
+	/*
+	 * IOCTX_FLAG_IOPOLL requests are only flagged as done on completion,
+	 * the event is added to the ring by whoever polled for them.
+	 */
+	struct list_head	ki_poll_list;
+	long			ki_res;
+	long			ki_res2;
+	bool			ki_poll_done;
+};
+
+/* A buffered read that couldn't be done without blocking */
+struct aio_read_work {
+	struct work_struct	work;
+	struct aio_kiocb	*req;
+	struct iocb		iocb;
+	ssize_t			done;	/* already read without blocking */
+	bool			vectored;
+	bool			compat;
 };
 
 /*------ sysctl variables----*/
@@ -197,6 +260,8 @@ unsigned long aio_max_nr = 0x10000; /* system wide maximum number of aio request
 static struct kmem_cache	*kiocb_cachep;
 static struct kmem_cache	*kioctx_cachep;
 
+static struct workqueue_struct	*aio_wq;
+
 static struct vfsmount *aio_mnt;
 
 static const struct file_operations aio_ring_fops;
@@ -265,6 +330,10 @@ static int __init aio_setup(void)
 	kiocb_cachep = KMEM_CACHE(aio_kiocb, SLAB_HWCACHE_ALIGN|SLAB_PANIC);
 	kioctx_cachep = KMEM_CACHE(kioctx,SLAB_HWCACHE_ALIGN|SLAB_PANIC);
 
+	aio_wq = alloc_workqueue("aio", WQ_UNBOUND, 0);
+	if (!aio_wq)
+		panic("Failed to create aio workqueue.");
+
 	pr_debug("sizeof(struct page) = %zu\n", sizeof(struct page));
 
 	return 0;
@@ -539,6 +608,105 @@ static int aio_setup_ring(struct kioctx *ctx)
 	return 0;
 }
 
+/*
+ * The submission ring of an IOCTX_FLAG_SQRING context is in memory the
+ * application provided. It stays pinned, and mapped in the kernel, for the
+ * lifetime of the context so that it can be looked at without switching to
+ * the application's mm. aio_free_sq() cleans up after a failure.
+ */
+static int aio_setup_sq_ring(struct kioctx *ctx,
+			     struct aio_sq_ring __user *sq_ring)
+{
+	unsigned long addr = (unsigned long)sq_ring;
+	unsigned nr, idle;
+	int nr_pages, pinned;
+
+	if (!PAGE_ALIGNED(addr))
+		return -EINVAL;
+	if (get_user(nr, &sq_ring->nr) || get_user(idle, &sq_ring->thread_idle))
+		return -EFAULT;
+	if (!nr || nr > AIO_SQ_MAX_ENTRIES || !is_power_of_2(nr))
+		return -EINVAL;
+
+	nr_pages = PFN_UP(sizeof(struct aio_sq_ring) + nr * sizeof(struct iocb));
+	ctx->sq_pages = kcalloc(nr_pages, sizeof(struct page *), GFP_KERNEL);
+	if (!ctx->sq_pages)
+		return -ENOMEM;
+
+	pinned = get_user_pages_fast(addr, nr_pages, 1, ctx->sq_pages);
+	if (pinned < 0)
+		return pinned;
+	ctx->sq_nr_pages = pinned;
+	if (pinned != nr_pages)
+		return -EFAULT;
+
+	ctx->sq_ring = vmap(ctx->sq_pages, nr_pages, VM_MAP, PAGE_KERNEL);
+	if (!ctx->sq_ring)
+		return -ENOMEM;
+
+	ctx->sq_user = sq_ring;
+	ctx->sq_entries = nr;
+	ctx->sq_head = 0;
+	ctx->sq_ring->head = ctx->sq_ring->tail = 0;
+	ctx->sq_ring->flags = ctx->sq_ring->dropped = 0;
+	ctx->sq_thread_idle = msecs_to_jiffies(idle ? idle : AIO_SQ_THREAD_IDLE_MS);
+
+	/* For the submission thread and the buffered read workers */
+	mmgrab(current->mm);
+	ctx->mm = current->mm;
+	return 0;
+}
+
+static int aio_sq_thread(void *data);
+
+static int aio_start_sq_thread(struct kioctx *ctx)
+{
+	struct task_struct *p;
+
+	ctx->sq_files = get_files_struct(current);
+	ctx->sq_creds = get_current_cred();
+
+	/* Woken up by ioctx_alloc() once the context is complete */
+	p = kthread_create(aio_sq_thread, ctx, "aio_sq/%d",
+			   task_pid_nr(current));
+	if (IS_ERR(p))
+		return PTR_ERR(p);
+
+	ctx->sq_thread = p;
+	return 0;
+}
+
+static void aio_free_sq(struct kioctx *ctx)
+{
+	unsigned i;
+
+	if (ctx->sq_creds)
+		put_cred(ctx->sq_creds);
+	if (ctx->sq_files)
+		put_files_struct(ctx->sq_files);
+	if (ctx->mm)
+		mmdrop(ctx->mm);
+	if (ctx->sq_ring)
+		vunmap(ctx->sq_ring);
+
+	/* The kernel wrote to them behind the application's back */
+	for (i = 0; i < ctx->sq_nr_pages; i++) {
+		set_page_dirty_lock(ctx->sq_pages[i]);
+		put_page(ctx->sq_pages[i]);
+	}
+	kfree(ctx->sq_pages);
+}
+
+/* Never the last mmput() from a thread that kill_ioctx() waits for */
+static void aio_mmput(struct mm_struct *mm)
+{
+#ifdef CONFIG_MMU
+	mmput_async(mm);
+#else
+	mmput(mm);
+#endif
+}
+
 #define AIO_EVENTS_PER_PAGE	(PAGE_SIZE / sizeof(struct io_event))
 #define AIO_EVENTS_FIRST_PAGE	((PAGE_SIZE - sizeof(struct aio_ring)) / sizeof(struct io_event))
 #define AIO_EVENTS_OFFSET	(AIO_EVENTS_PER_PAGE - AIO_EVENTS_FIRST_PAGE)
@@ -587,7 +755,9 @@ static void free_ioctx(struct work_struct *work)
 
 	pr_debug("freeing %p\n", ctx);
 
+	cancel_work_sync(&ctx->poll_work);
 	aio_free_ring(ctx);
+	aio_free_sq(ctx);
 	free_percpu(ctx->cpu);
 	percpu_ref_exit(&ctx->reqs);
 	percpu_ref_exit(&ctx->users);
@@ -697,15 +867,31 @@ static void aio_nr_sub(unsigned nr)
 	spin_unlock(&aio_nr_lock);
 }
 
+static void aio_iopoll_work(struct work_struct *work);
+
 /* ioctx_alloc
  *	Allocates and initializes an ioctx.  Returns an ERR_PTR if it failed.
  */
-static struct kioctx *ioctx_alloc(unsigned nr_events)
+static struct kioctx *ioctx_alloc(unsigned nr_events, unsigned flags,
+				  struct aio_sq_ring __user *sq_ring,
+				  bool compat)
 {
 	struct mm_struct *mm = current->mm;
 	struct kioctx *ctx;
 	int err = -ENOMEM;
 
+	if (flags & ~IOCTX_FLAGS_ALL)
+		return ERR_PTR(-EINVAL);
+	if (!(flags & IOCTX_FLAG_SQRING) != !sq_ring)
+		return ERR_PTR(-EINVAL);
+	if (flags & IOCTX_FLAG_SQTHREAD) {
+		if (!(flags & IOCTX_FLAG_SQRING))
+			return ERR_PTR(-EINVAL);
+		/* It may keep a CPU busy polling the ring */
+		if (!capable(CAP_SYS_ADMIN))
+			return ERR_PTR(-EPERM);
+	}
+
 	/*
 	 * We keep track of the number of available ringbuffer slots, to prevent
 	 * overflow (reqs_available), and we also use percpu counters for this.
@@ -743,6 +929,14 @@ static struct kioctx *ioctx_alloc(unsigned nr_events)
 
 	INIT_LIST_HEAD(&ctx->active_reqs);
 
+	ctx->flags = flags;
+	ctx->sq_compat = compat;
+	mutex_init(&ctx->sq_lock);
+	init_waitqueue_head(&ctx->sq_wait);
+	spin_lock_init(&ctx->poll_lock);
+	INIT_LIST_HEAD(&ctx->poll_list);
+	INIT_WORK(&ctx->poll_work, aio_iopoll_work);
+
 	if (percpu_ref_init(&ctx->users, free_ioctx_users, 0, GFP_KERNEL))
 		goto err;
 
@@ -757,6 +951,14 @@ static struct kioctx *ioctx_alloc(unsigned nr_events)
 	if (err < 0)
 		goto err;
 
+	if (flags & IOCTX_FLAG_SQRING) {
+		err = aio_setup_sq_ring(ctx, sq_ring);
+		if (!err && (flags & IOCTX_FLAG_SQTHREAD))
+			err = aio_start_sq_thread(ctx);
+		if (err)
+			goto err_ctx;
+	}
+
 	atomic_set(&ctx->reqs_available, ctx->nr_events - 1);
 	ctx->req_batch = (ctx->nr_events - 1) / (num_possible_cpus() * 4);
 	if (ctx->req_batch < 1)
@@ -783,6 +985,9 @@ static struct kioctx *ioctx_alloc(unsigned nr_events)
 	/* Release the ring_lock mutex now that all setup is complete. */
 	mutex_unlock(&ctx->ring_lock);
 
+	if (ctx->sq_thread)
+		wake_up_process(ctx->sq_thread);
+
 	pr_debug("allocated ioctx %p[%ld]: mm=%p mask=0x%x\n",
 		 ctx, ctx->user_id, mm, ctx->nr_events);
 	return ctx;
@@ -791,6 +996,9 @@ static struct kioctx *ioctx_alloc(unsigned nr_events)
 	aio_nr_sub(ctx->max_reqs);
 err_ctx:
 	atomic_set(&ctx->dead, 1);
+	if (ctx->sq_thread)
+		kthread_stop(ctx->sq_thread);
+	aio_free_sq(ctx);
 	if (ctx->mmap_size)
 		vm_munmap(ctx->mmap_base, ctx->mmap_size);
 	aio_free_ring(ctx);
@@ -828,6 +1036,16 @@ static int kill_ioctx(struct mm_struct *mm, struct kioctx *ctx,
 	/* percpu_ref_kill() will do the necessary call_rcu() */
 	wake_up_all(&ctx->wait);
 
+	/* It must not submit anything once ctx->users is gone */
+	if (ctx->sq_thread) {
+		kthread_stop(ctx->sq_thread);
+		WRITE_ONCE(ctx->sq_thread, NULL);
+	}
+
+	/* Nobody is going to poll for what is in flight now */
+	if (ctx->flags & IOCTX_FLAG_IOPOLL)
+		queue_work(aio_wq, &ctx->poll_work);
+
 	/*
 	 * It'd be more correct to do this in free_ioctx(), after all
 	 * the outstanding kiocbs have finished - but by then io_destroy
@@ -1180,6 +1398,110 @@ static void aio_complete(struct kiocb *kiocb, long res, long res2)
 	percpu_ref_put(&ctx->reqs);
 }
 
+static bool aio_file_can_poll(struct kiocb *kiocb)
+{
+	struct inode *inode = kiocb->ki_filp->f_mapping->host;
+
+	return (kiocb->ki_flags & IOCB_DIRECT) && S_ISBLK(inode->i_mode) &&
+	       test_bit(QUEUE_FLAG_POLL,
+			&bdev_get_queue(I_BDEV(inode))->queue_flags);
+}
+
+/*
+ * ki_complete of IOCTX_FLAG_IOPOLL requests: they stay on ctx->poll_list
+ * until aio_iopoll() finds them done.
+ */
+static void aio_complete_iopoll(struct kiocb *kiocb, long res, long res2)
+{
+	struct aio_kiocb *iocb = container_of(kiocb, struct aio_kiocb, common);
+
+	iocb->ki_res = res;
+	iocb->ki_res2 = res2;
+	smp_store_release(&iocb->ki_poll_done, true);
+}
+
+static void aio_iopoll_add(struct aio_kiocb *iocb)
+{
+	struct kioctx *ctx = iocb->ki_ctx;
+	bool dead;
+
+	atomic_inc(&ctx->poll_inflight);
+
+	spin_lock(&ctx->poll_lock);
+	list_add_tail(&iocb->ki_poll_list, &ctx->poll_list);
+	dead = atomic_read(&ctx->dead);
+	spin_unlock(&ctx->poll_lock);
+
+	/* Have read_events() start polling, see aio_complete() */
+	smp_mb();
+	if (waitqueue_active(&ctx->wait))
+		wake_up(&ctx->wait);
+
+	/* We raced with kill_ioctx(), which may have reaped already */
+	if (unlikely(dead))
+		queue_work(aio_wq, &ctx->poll_work);
+}
+
+/* aio_iopoll
+ *	Adds the events of the IOCTX_FLAG_IOPOLL requests that are done to
+ *	the ring, polling once for the first one that isn't.  Returns the
+ *	number of requests that are still in flight: if there are none, ctx
+ *	may have been freed by the time it returns, unless the caller holds
+ *	a reference on ctx->users.
+ */
+static unsigned aio_iopoll(struct kioctx *ctx)
+{
+	struct aio_kiocb *iocb, *tmp;
+	unsigned left = 0;
+	bool polled = false;
+	LIST_HEAD(list);
+
+	spin_lock(&ctx->poll_lock);
+	list_splice_init(&ctx->poll_list, &list);
+	spin_unlock(&ctx->poll_lock);
+
+	list_for_each_entry_safe(iocb, tmp, &list, ki_poll_list) {
+		if (!smp_load_acquire(&iocb->ki_poll_done)) {
+			struct inode *inode = iocb->common.ki_filp->f_mapping->host;
+
+			if (!polled) {
+				polled = true;
+				blk_mq_poll(bdev_get_queue(I_BDEV(inode)),
+					    READ_ONCE(iocb->common.ki_cookie));
+			}
+			if (!smp_load_acquire(&iocb->ki_poll_done)) {
+				left++;
+				continue;
+			}
+		}
+
+		list_del(&iocb->ki_poll_list);
+		atomic_dec(&ctx->poll_inflight);
+		aio_complete(&iocb->common, iocb->ki_res, iocb->ki_res2);
+	}
+
+	/* These still hold a reference on ctx->reqs */
+	if (left) {
+		spin_lock(&ctx->poll_lock);
+		list_splice(&list, &ctx->poll_list);
+		spin_unlock(&ctx->poll_lock);
+	}
+
+	return left;
+}
+
+/*
+ * Once the context is dead, nobody calls io_getevents() any more but the
+ * requests must still be completed for it to go away.
+ */
+static void aio_iopoll_work(struct work_struct *work)
+{
+	struct kioctx *ctx = container_of(work, struct kioctx, poll_work);
+
+	if (aio_iopoll(ctx))
+		queue_work(aio_wq, &ctx->poll_work);
+}
+
 /* aio_read_events_ring
  *	Pull an event off of the ioctx's event ring.  Returns the number of
  *	events fetched
@@ -1282,6 +1604,49 @@ static bool aio_read_events(struct kioctx *ctx, long min_nr, long nr,
 	return ret < 0 || *i >= min_nr;
 }
 
+/*
+ * read_events() of IOCTX_FLAG_IOPOLL contexts without a submission thread:
+ * poll for completions as long as there are requests in flight, and sleep
+ * only when there are none.
+ */
+static long aio_iopoll_read_events(struct kioctx *ctx, long min_nr, long nr,
+				   struct io_event __user *event, ktime_t until)
+{
+	ktime_t end = ktime_add_safe(ktime_get(), until);
+	long ret = 0;
+
+	for (;;) {
+		if (atomic_read(&ctx->poll_inflight))
+			aio_iopoll(ctx);
+
+		if (aio_read_events(ctx, min_nr, nr, event, &ret))
+			break;
+		if (signal_pending(current))
+			break;
+		if (until != KTIME_MAX && !ktime_before(ktime_get(), end))
+			break;
+
+		if (!atomic_read(&ctx->poll_inflight)) {
+			ktime_t left = KTIME_MAX;
+
+			if (until != KTIME_MAX)
+				left = max_t(ktime_t, ktime_sub(end, ktime_get()), 0);
+			wait_event_interruptible_hrtimeout(ctx->wait,
+				atomic_read(&ctx->poll_inflight) ||
+				aio_read_events(ctx, min_nr, nr, event, &ret),
+				left);
+			continue;
+		}
+
+		cond_resched();
+	}
+
+	if (!ret && signal_pending(current))
+		ret = -EINTR;
+
+	return ret;
+}
+
 static long read_events(struct kioctx *ctx, long min_nr, long nr,
 			struct io_event __user *event,
 			struct timespec __user *timeout)
@@ -1298,6 +1663,9 @@ static long read_events(struct kioctx *ctx, long min_nr, long nr,
 		until = timespec_to_ktime(ts);
 	}
 
+	if ((ctx->flags & IOCTX_FLAG_IOPOLL) && !READ_ONCE(ctx->sq_thread))
+		return aio_iopoll_read_events(ctx, min_nr, nr, event, until);
+
 	/*
 	 * Note that aio_read_events() is being called as the conditional - i.e.
 	 * we're calling it after prepare_to_wait() has set task state to
@@ -1355,7 +1723,7 @@ SYSCALL_DEFINE2(io_setup, unsigned, nr_events, aio_context_t __user *, ctxp)
 		goto out;
 	}
 
-	ioctx = ioctx_alloc(nr_events);
+	ioctx = ioctx_alloc(nr_events, 0, NULL, false);
 	ret = PTR_ERR(ioctx);
 	if (!IS_ERR(ioctx)) {
 		ret = put_user(ioctx->user_id, ctxp);
@@ -1386,7 +1754,81 @@ COMPAT_SYSCALL_DEFINE2(io_setup, unsigned, nr_events, u32 __user *, ctx32p)
 		goto out;
 	}
 
-	ioctx = ioctx_alloc(nr_events);
+	ioctx = ioctx_alloc(nr_events, 0, NULL, false);
+	ret = PTR_ERR(ioctx);
+	if (!IS_ERR(ioctx)) {
+		/* truncating is ok because it's a user address */
+		ret = put_user((u32)ioctx->user_id, ctx32p);
+		if (ret)
+			kill_ioctx(current->mm, ioctx, NULL);
+		percpu_ref_put(&ioctx->users);
+	}
+
+out:
+	return ret;
+}
+#endif
+
+/* sys_io_setup2:
+ *	Like io_setup(), with the IOCTX_FLAG_* in flags selecting how iocbs
+ *	are submitted and completed, see include/uapi/linux/aio_abi.h.
+ *	sq_ring is the submission ring of an IOCTX_FLAG_SQRING context, and
+ *	must be NULL otherwise.  May fail with -EINVAL if flags are unknown
+ *	or inconsistent, or if sq_ring isn't a valid ring, and with -EPERM
+ *	if IOCTX_FLAG_SQTHREAD is asked for without CAP_SYS_ADMIN.  May fail
+ *	like io_setup() otherwise.
+ */
+SYSCALL_DEFINE4(io_setup2, unsigned, nr_events, unsigned, flags,
+		struct aio_sq_ring __user *, sq_ring, aio_context_t __user *, ctxp)
+{
+	struct kioctx *ioctx = NULL;
+	unsigned long ctx;
+	long ret;
+
+	ret = get_user(ctx, ctxp);
+	if (unlikely(ret))
+		goto out;
+
+	ret = -EINVAL;
+	if (unlikely(ctx || nr_events == 0)) {
+		pr_debug("EINVAL: ctx %lu nr_events %u\n",
+		         ctx, nr_events);
+		goto out;
+	}
+
+	ioctx = ioctx_alloc(nr_events, flags, sq_ring, false);
+	ret = PTR_ERR(ioctx);
+	if (!IS_ERR(ioctx)) {
+		ret = put_user(ioctx->user_id, ctxp);
+		if (ret)
+			kill_ioctx(current->mm, ioctx, NULL);
+		percpu_ref_put(&ioctx->users);
+	}
+
+out:
+	return ret;
+}
+
+#ifdef CONFIG_COMPAT
+COMPAT_SYSCALL_DEFINE4(io_setup2, u32, nr_events, u32, flags,
+		       compat_uptr_t, sq_ring, u32 __user *, ctx32p)
+{
+	struct kioctx *ioctx = NULL;
+	unsigned long ctx;
+	long ret;
+
+	ret = get_user(ctx, ctx32p);
+	if (unlikely(ret))
+		goto out;
+
+	ret = -EINVAL;
+	if (unlikely(ctx || nr_events == 0)) {
+		pr_debug("EINVAL: ctx %lu nr_events %u\n",
+		         ctx, nr_events);
+		goto out;
+	}
+
+	ioctx = ioctx_alloc(nr_events, flags, compat_ptr(sq_ring), true);
 	ret = PTR_ERR(ioctx);
 	if (!IS_ERR(ioctx)) {
 		/* truncating is ok because it's a user address */
@@ -1477,9 +1919,82 @@ static inline ssize_t aio_ret(struct kiocb *req, ssize_t ret)
 	}
 }
 
+static void aio_read_work(struct work_struct *work)
+{
+	struct aio_read_work *rw = container_of(work, struct aio_read_work,
+						work);
+	struct kiocb *req = &rw->req->common;
+	struct mm_struct *mm = rw->req->ki_ctx->mm;
+	struct iovec inline_vecs[UIO_FASTIOV], *iovec = inline_vecs;
+	struct iov_iter iter;
+	ssize_t ret = -EINTR;
+
+	/* The buffers are in the submitter's mm, unless it is exiting */
+	if (mmget_not_zero(mm)) {
+		mm_segment_t oldfs = get_fs();
+
+		use_mm(mm);
+		set_fs(USER_DS);
+		ret = aio_setup_rw(READ, &rw->iocb, &iovec, rw->vectored,
+				   rw->compat, &iter);
+		if (!ret) {
+			iov_iter_advance(&iter, rw->done);
+			ret = call_read_iter(req->ki_filp, req, &iter);
+			kfree(iovec);
+		}
+		set_fs(oldfs);
+		unuse_mm(mm);
+		aio_mmput(mm);
+	}
+
+	if (ret >= 0)
+		ret += rw->done;
+	else if (rw->done)
+		ret = rw->done;
+
+	aio_ret(req, ret);
+	kfree(rw);
+}
+
+/*
+ * Hands the rest of a buffered read that would have to wait for the page
+ * cache, after @done bytes, over to a worker so that the submitter doesn't
+ * block. Returns false if that wasn't possible.
+ */
+static bool aio_queue_read(struct aio_kiocb *req, struct iocb *iocb,
+			   bool vectored, bool compat, ssize_t done)
+{
+	struct aio_read_work *rw;
+
+	rw = kmalloc(sizeof(*rw), GFP_KERNEL);
+	if (!rw)
+		return false;
+
+	INIT_WORK(&rw->work, aio_read_work);
+	rw->req = req;
+	rw->iocb = *iocb;
+	rw->done = done;
+	rw->vectored = vectored;
+	rw->compat = compat;
+	queue_work(aio_wq, &rw->work);
+	return true;
+}
+
+/* Did an IOCB_NOWAIT read stop short of the end of the file? */
+static bool aio_read_stopped(struct kiocb *req, struct iov_iter *iter,
+			     ssize_t ret)
+{
+	if (ret == -EAGAIN)
+		return true;
+
+	return ret > 0 && iov_iter_count(iter) &&
+	       req->ki_pos < i_size_read(file_inode(req->ki_filp));
+}
+
 static ssize_t aio_read(struct kiocb *req, struct iocb *iocb, bool vectored,
 		bool compat)
 {
+	struct aio_kiocb *kiocb = container_of(req, struct aio_kiocb, common);
 	struct file *file = req->ki_filp;
 	struct iovec inline_vecs[UIO_FASTIOV], *iovec = inline_vecs;
 	struct iov_iter iter;
@@ -1494,8 +2009,25 @@ static ssize_t aio_read(struct kiocb *req, struct iocb *iocb, bool vectored,
 	if (ret)
 		return ret;
 	ret = rw_verify_area(READ, file, &req->ki_pos, iov_iter_count(&iter));
-	if (!ret)
-		ret = aio_ret(req, call_read_iter(file, req, &iter));
+	if (!ret) {
+		/* Only copy what is already in the page cache from here */
+		if ((kiocb->ki_ctx->flags & IOCTX_FLAG_SQRING) &&
+		    !(req->ki_flags & IOCB_DIRECT) &&
+		    S_ISREG(file_inode(file)->i_mode))
+			req->ki_flags |= IOCB_NOWAIT;
+
+		ret = call_read_iter(file, req, &iter);
+		if (req->ki_flags & IOCB_NOWAIT) {
+			req->ki_flags &= ~IOCB_NOWAIT;
+			if (aio_read_stopped(req, &iter, ret) &&
+			    aio_queue_read(kiocb, iocb, vectored, compat,
+					   max_t(ssize_t, ret, 0)))
+				ret = -EIOCBQUEUED;
+			else if (ret == -EAGAIN)
+				ret = call_read_iter(file, req, &iter);
+		}
+		ret = aio_ret(req, ret);
+	}
 	kfree(iovec);
 	return ret;
 }
@@ -1569,6 +2101,15 @@ static int io_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb,
 	req->common.ki_complete = aio_complete;
 	req->common.ki_flags = iocb_flags(req->common.ki_filp);
 
+	if (ctx->flags & IOCTX_FLAG_IOPOLL) {
+		if (!aio_file_can_poll(&req->common)) {
+			ret = -EOPNOTSUPP;
+			goto out_put_req;
+		}
+		req->common.ki_flags |= IOCB_HIPRI;
+		req->common.ki_complete = aio_complete_iopoll;
+	}
+
 	if (iocb->aio_flags & IOCB_FLAG_RESFD) {
 		/*
 		 * If the IOCB_FLAG_RESFD flag of aio_flags is set, get an
@@ -1616,7 +2157,9 @@ static int io_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb,
 	}
 	fput(file);
 
-	if (ret && ret != -EIOCBQUEUED)
+	if (ret == -EIOCBQUEUED && (ctx->flags & IOCTX_FLAG_IOPOLL))
+		aio_iopoll_add(req);
+	else if (ret && ret != -EIOCBQUEUED)
 		goto out_put_req;
 	return 0;
 out_put_req:
@@ -1626,6 +2169,193 @@ static int io_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb,
 	return ret;
 }
 
+/*
+ * Completes an iocb from the submission ring that io_submit_one() rejected
+ * with @res, as the ring has no other way to report it.
+ */
+static void aio_complete_error(struct kioctx *ctx, struct iocb __user *user_iocb,
+			       struct iocb *iocb, long res)
+{
+	struct aio_kiocb *req = aio_get_req(ctx);
+
+	if (unlikely(!req)) {
+		WRITE_ONCE(ctx->sq_ring->dropped, ctx->sq_ring->dropped + 1);
+		return;
+	}
+
+	req->ki_user_iocb = user_iocb;
+	req->ki_user_data = iocb->aio_data;
+	aio_complete(&req->common, res, 0);
+}
+
+/* aio_sq_submit
+ *	Submits up to nr iocbs from the submission ring.  Returns the number
+ *	of iocbs consumed, or -EAGAIN if the event ring is full.
+ */
+static long aio_sq_submit(struct kioctx *ctx, long nr, bool compat)
+{
+	struct aio_sq_ring *ring = ctx->sq_ring;
+	unsigned mask = ctx->sq_entries - 1;
+	unsigned head, tail;
+	struct blk_plug plug;
+	long i = 0;
+	int ret = 0;
+
+	mutex_lock(&ctx->sq_lock);
+
+	/* The entries are read after the tail that covers them */
+	head = ctx->sq_head;
+	tail = smp_load_acquire(&ring->tail);
+	if (tail - head > ctx->sq_entries)
+		tail = head + ctx->sq_entries;
+
+	blk_start_plug(&plug);
+	while (i < nr && head != tail) {
+		struct iocb __user *user_iocb = &ctx->sq_user->iocbs[head & mask];
+		struct iocb tmp;
+
+		/* The application can change it under our feet */
+		memcpy(&tmp, &ring->iocbs[head & mask], sizeof(tmp));
+
+		ret = io_submit_one(ctx, user_iocb, &tmp, compat);
+		if (ret == -EAGAIN)
+			break;
+		if (ret)
+			aio_complete_error(ctx, user_iocb, &tmp, ret);
+		head++;
+		i++;
+	}
+	blk_finish_plug(&plug);
+
+	/* Only hand the entries back once we are done reading them */
+	ctx->sq_head = head;
+	smp_store_release(&ring->head, head);
+
+	mutex_unlock(&ctx->sq_lock);
+
+	return i ? i : ret;
+}
+
+static bool aio_sq_pending(struct kioctx *ctx)
+{
+	return READ_ONCE(ctx->sq_ring->tail) != ctx->sq_head;
+}
+
+/*
+ * The IOCTX_FLAG_SQTHREAD thread submits from the ring on behalf of the
+ * application, and reaps IOCTX_FLAG_IOPOLL completions. Once it has had
+ * nothing to do for ctx->sq_thread_idle, it lets go of the mm, so that the
+ * process can exit, and sleeps until io_submit() wakes it up.
+ */
+static int aio_sq_thread(void *data)
+{
+	struct kioctx *ctx = data;
+	struct mm_struct *mm = NULL;
+	struct files_struct *old_files;
+	const struct cred *old_cred;
+	unsigned long timeout;
+	DEFINE_WAIT(wait);
+
+	task_lock(current);
+	old_files = current->files;
+	current->files = ctx->sq_files;
+	task_unlock(current);
+	old_cred = override_creds(ctx->sq_creds);
+	set_fs(USER_DS);
+
+	timeout = jiffies + ctx->sq_thread_idle;
+	while (!kthread_should_stop()) {
+		bool busy = false;
+
+		if (aio_sq_pending(ctx)) {
+			if (!mm) {
+				if (!mmget_not_zero(ctx->mm)) {
+					/* Exiting, kill_ioctx() will stop us */
+					set_current_state(TASK_INTERRUPTIBLE);
+					if (!kthread_should_stop())
+						schedule();
+					__set_current_state(TASK_RUNNING);
+					continue;
+				}
+				mm = ctx->mm;
+				use_mm(mm);
+			}
+			busy = aio_sq_submit(ctx, ctx->sq_entries,
+					     ctx->sq_compat) > 0;
+		}
+
+		if ((ctx->flags & IOCTX_FLAG_IOPOLL) &&
+		    atomic_read(&ctx->poll_inflight)) {
+			aio_iopoll(ctx);
+			busy = true;
+		}
+
+		if (busy || time_before(jiffies, timeout)) {
+			if (busy)
+				timeout = jiffies + ctx->sq_thread_idle;
+			cond_resched();
+			continue;
+		}
+
+		if (mm) {
+			unuse_mm(mm);
+			aio_mmput(mm);
+			mm = NULL;
+		}
+
+		prepare_to_wait(&ctx->sq_wait, &wait, TASK_INTERRUPTIBLE);
+		WRITE_ONCE(ctx->sq_ring->flags, AIO_SQ_NEED_WAKEUP);
+		/* Set the flag before looking at the tail, see io_submit() */
+		smp_mb();
+		if (!aio_sq_pending(ctx) && !kthread_should_stop())
+			schedule();
+		finish_wait(&ctx->sq_wait, &wait);
+		WRITE_ONCE(ctx->sq_ring->flags, 0);
+
+		timeout = jiffies + ctx->sq_thread_idle;
+	}
+
+	if (mm) {
+		unuse_mm(mm);
+		aio_mmput(mm);
+	}
+
+	revert_creds(old_cred);
+	task_lock(current);
+	current->files = old_files;
+	task_unlock(current);
+
+	return 0;
+}
+
+/*
+ * io_submit() with a NULL iocbpp, on an IOCTX_FLAG_SQRING context: submit
+ * from the ring, or just wake up the thread that does.
+ */
+static long io_submit_sq(aio_context_t ctx_id, long nr, bool compat)
+{
+	struct kioctx *ctx;
+	long ret;
+
+	ctx = lookup_ioctx(ctx_id);
+	if (unlikely(!ctx)) {
+		pr_debug("EINVAL: invalid context id\n");
+		return -EINVAL;
+	}
+
+	if (!ctx->sq_ring) {
+		ret = nr ? -EFAULT : 0;
+	} else if (ctx->flags & IOCTX_FLAG_SQTHREAD) {
+		wake_up(&ctx->sq_wait);
+		ret = 0;
+	} else {
+		ret = aio_sq_submit(ctx, nr, compat);
+	}
+
+	percpu_ref_put(&ctx->users);
+	return ret;
+}
+
 static long do_io_submit(aio_context_t ctx_id, long nr,
 			  struct iocb __user *__user *iocbpp, bool compat)
 {
@@ -1637,6 +2367,9 @@ static long do_io_submit(aio_context_t ctx_id, long nr,
 	if (unlikely(nr < 0))
 		return -EINVAL;
 
+	if (!iocbpp)
+		return io_submit_sq(ctx_id, nr, compat);
+
 	if (unlikely(nr > LONG_MAX/sizeof(*iocbpp)))
 		nr = LONG_MAX/sizeof(*iocbpp);
 
@@ -1724,6 +2457,9 @@ COMPAT_SYSCALL_DEFINE3(io_submit, compat_aio_context_t, ctx_id,
 	if (unlikely(nr < 0))
 		return -EINVAL;
 
+	if (!iocb)
+		return do_io_submit(ctx_id, nr, NULL, 1);
+
 	if (nr > MAX_AIO_SUBMITS)
 		nr = MAX_AIO_SUBMITS;
 
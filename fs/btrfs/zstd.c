@@ -0,0 +1,219 @@
+/*
+ * Copyright (C) 2017 - Linaro Ltd
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/init.h>
+#include <linux/err.h>
+#include <linux/sched.h>
+#include <linux/pagemap.h>
+#include <linux/bio.h>
+#include <linux/zstd.h>
+#include "compression.h"
+
+/*
+ * An extent holds a single zstd frame of its whole uncompressed range, so
+ * the data goes through linear buffers on both sides.
+ */
+struct workspace {
+	void *mem;	/* compressor scratch memory */
+	void *dmem;	/* decompressor scratch memory */
+	void *buf;	/* where decompressed data goes */
+	void *cbuf;	/* where compressed data goes */
+	struct list_head list;
+};
+
+static void zstd_free_workspace(struct list_head *ws)
+{
+	struct workspace *workspace = list_entry(ws, struct workspace, list);
+
+	vfree(workspace->buf);
+	vfree(workspace->cbuf);
+	vfree(workspace->dmem);
+	vfree(workspace->mem);
+	kfree(workspace);
+}
+
+static struct list_head *zstd_alloc_workspace(void)
+{
+	struct workspace *workspace;
+
+	workspace = kzalloc(sizeof(*workspace), GFP_NOFS);
+	if (!workspace)
+		return ERR_PTR(-ENOMEM);
+
+	workspace->mem = vmalloc(
+		zstd_compress_workspace_size(ZSTD_DEFAULT_CLEVEL));
+	workspace->dmem = vmalloc(zstd_decompress_workspace_size());
+	workspace->buf = vmalloc(BTRFS_MAX_UNCOMPRESSED);
+	workspace->cbuf = vmalloc(ZSTD_COMPRESS_BOUND(BTRFS_MAX_UNCOMPRESSED));
+	if (!workspace->mem || !workspace->dmem || !workspace->buf ||
+	    !workspace->cbuf)
+		goto fail;
+
+	INIT_LIST_HEAD(&workspace->list);
+
+	return &workspace->list;
+fail:
+	zstd_free_workspace(&workspace->list);
+	return ERR_PTR(-ENOMEM);
+}
+
+static int zstd_compress_pages(struct list_head *ws,
+			       struct address_space *mapping,
+			       u64 start,
+			       struct page **pages,
+			       unsigned long *out_pages,
+			       unsigned long *total_in,
+			       unsigned long *total_out)
+{
+	struct workspace *workspace = list_entry(ws, struct workspace, list);
+	unsigned long len = min_t(unsigned long, *total_out,
+				  BTRFS_MAX_UNCOMPRESSED);
+	unsigned long nr_dest_pages = *out_pages;
+	unsigned long nr_pages = 0;
+	unsigned long copied;
+	unsigned long bytes;
+	struct page *page;
+	size_t out_len;
+	char *kaddr;
+	int ret = 0;
+
+	*out_pages = 0;
+	*total_out = 0;
+	*total_in = 0;
+
+	for (copied = 0; copied < len; copied += bytes) {
+		page = find_get_page(mapping, (start + copied) >> PAGE_SHIFT);
+		bytes = min_t(unsigned long, len - copied, PAGE_SIZE);
+
+		kaddr = kmap(page);
+		memcpy(workspace->buf + copied, kaddr, bytes);
+		kunmap(page);
+		put_page(page);
+	}
+
+	/* we're making it bigger, give up */
+	out_len = min_t(unsigned long, nr_dest_pages * PAGE_SIZE, len);
+	ret = zstd_compress(workspace->buf, len, workspace->cbuf, &out_len,
+			    ZSTD_DEFAULT_CLEVEL, workspace->mem);
+	if (ret)
+		return -E2BIG;
+
+	for (copied = 0; copied < out_len; copied += bytes) {
+		page = alloc_page(GFP_NOFS | __GFP_HIGHMEM);
+		if (page == NULL) {
+			ret = -ENOMEM;
+			goto out;
+		}
+		pages[nr_pages++] = page;
+		bytes = min_t(unsigned long, out_len - copied, PAGE_SIZE);
+
+		kaddr = kmap(page);
+		memcpy(kaddr, workspace->cbuf + copied, bytes);
+		kunmap(page);
+	}
+
+	*total_out = out_len;
+	*total_in = len;
+out:
+	*out_pages = nr_pages;
+	return ret;
+}
+
+static int zstd_decompress_bio(struct list_head *ws,
+			       struct page **pages_in,
+			       u64 disk_start,
+			       struct bio *orig_bio,
+			       size_t srclen)
+{
+	struct workspace *workspace = list_entry(ws, struct workspace, list);
+	unsigned long total_pages_in = DIV_ROUND_UP(srclen, PAGE_SIZE);
+	unsigned long page_in_index;
+	unsigned long copied = 0;
+	unsigned long bytes;
+	size_t out_len = BTRFS_MAX_UNCOMPRESSED;
+	char *data_in;
+	int ret;
+
+	if (srclen > ZSTD_COMPRESS_BOUND(BTRFS_MAX_UNCOMPRESSED))
+		return -EIO;
+
+	for (page_in_index = 0; page_in_index < total_pages_in;
+	     page_in_index++) {
+		bytes = min_t(unsigned long, srclen - copied, PAGE_SIZE);
+
+		data_in = kmap(pages_in[page_in_index]);
+		memcpy(workspace->cbuf + copied, data_in, bytes);
+		kunmap(pages_in[page_in_index]);
+		copied += bytes;
+	}
+
+	/* the extent is padded to the sector size after the frame */
+	ret = zstd_decompress_frame(workspace->cbuf, &srclen, workspace->buf,
+				    &out_len, workspace->dmem);
+	if (ret) {
+		pr_warn("BTRFS: zstd decompress failed\n");
+		return -EIO;
+	}
+
+	btrfs_decompress_buf2page(workspace->buf, 0, out_len, disk_start,
+				  orig_bio);
+	zero_fill_bio(orig_bio);
+	return 0;
+}
+
+static int zstd_decompress_page(struct list_head *ws,
+				unsigned char *data_in,
+				struct page *dest_page,
+				unsigned long start_byte,
+				size_t srclen, size_t destlen)
+{
+	struct workspace *workspace = list_entry(ws, struct workspace, list);
+	size_t out_len = BTRFS_MAX_UNCOMPRESSED;
+	unsigned long bytes;
+	char *kaddr;
+	int ret;
+
+	ret = zstd_decompress_frame(data_in, &srclen, workspace->buf,
+				    &out_len, workspace->dmem);
+	if (ret) {
+		pr_warn("BTRFS: zstd decompress failed\n");
+		return -EIO;
+	}
+
+	if (out_len < start_byte)
+		return -EIO;
+
+	destlen = min_t(unsigned long, destlen, PAGE_SIZE);
+	bytes = min_t(unsigned long, destlen, out_len - start_byte);
+
+	kaddr = kmap_atomic(dest_page);
+	memcpy(kaddr, workspace->buf + start_byte, bytes);
+
+	/* cover anything missing from the decompressed data */
+	if (bytes < destlen)
+		memset(kaddr + bytes, 0, destlen - bytes);
+	kunmap_atomic(kaddr);
+
+	return 0;
+}
+
+const struct btrfs_compress_op btrfs_zstd_compress = {
+	.alloc_workspace	= zstd_alloc_workspace,
+	.free_workspace		= zstd_free_workspace,
+	.compress_pages		= zstd_compress_pages,
+	.decompress_bio		= zstd_decompress_bio,
+	.decompress		= zstd_decompress_page,
+};
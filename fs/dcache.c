@@ -84,6 +84,12 @@
 int sysctl_vfs_cache_pressure __read_mostly = 100;
 EXPORT_SYMBOL_GPL(sysctl_vfs_cache_pressure);
 
+/*
+ * Number of unused negative dentries a superblock may keep on its LRU, 0 for
+ * no limit.  Past it, the oldest ones are trimmed from a work item.
+ */
+unsigned long sysctl_negative_dentry_limit __read_mostly;
+
 __cacheline_aligned_in_smp DEFINE_SEQLOCK(rename_lock);
 
 EXPORT_SYMBOL(rename_lock);
@@ -277,6 +283,26 @@ static inline int dname_external(const struct dentry *dentry)
 	return dentry->d_name.name != dentry->d_iname;
 }
 
+/*
+ * sb->s_nr_negative counts the negative dentries with DCACHE_LRU_LIST set, it
+ * is updated under d_lock whenever either changes.
+ */
+static void d_negative_inc(struct dentry *dentry)
+{
+	struct super_block *sb = dentry->d_sb;
+	unsigned long limit = READ_ONCE(sysctl_negative_dentry_limit);
+
+	percpu_counter_inc(&sb->s_nr_negative);
+	if (unlikely(limit) &&
+	    percpu_counter_read_positive(&sb->s_nr_negative) > limit)
+		schedule_work(&sb->s_negative_trim_work);
+}
+
+static inline void d_negative_dec(struct dentry *dentry)
+{
+	percpu_counter_dec(&dentry->d_sb->s_nr_negative);
+}
+
 static inline void __d_set_inode_and_type(struct dentry *dentry,
 					  struct inode *inode,
 					  unsigned type_flags)
@@ -285,6 +311,8 @@ static inline void __d_set_inode_and_type(struct dentry *dentry,
 
 	dentry->d_inode = inode;
 	flags = READ_ONCE(dentry->d_flags);
+	if (flags & DCACHE_LRU_LIST)
+		d_negative_dec(dentry);
 	flags &= ~(DCACHE_ENTRY_TYPE | DCACHE_FALLTHRU);
 	flags |= type_flags;
 	WRITE_ONCE(dentry->d_flags, flags);
@@ -297,6 +325,8 @@ static inline void __d_clear_type_and_inode(struct dentry *dentry)
 	flags &= ~(DCACHE_ENTRY_TYPE | DCACHE_FALLTHRU);
 	WRITE_ONCE(dentry->d_flags, flags);
 	dentry->d_inode = NULL;
+	if (flags & DCACHE_LRU_LIST)
+		d_negative_inc(dentry);
 }
 
 static void dentry_free(struct dentry *dentry)
@@ -363,6 +393,8 @@ static void d_lru_add(struct dentry *dentry)
 	D_FLAG_VERIFY(dentry, 0);
 	dentry->d_flags |= DCACHE_LRU_LIST;
 	this_cpu_inc(nr_dentry_unused);
+	if (d_is_negative(dentry))
+		d_negative_inc(dentry);
 	WARN_ON_ONCE(!list_lru_add(&dentry->d_sb->s_dentry_lru, &dentry->d_lru));
 }
 
@@ -371,6 +403,8 @@ static void d_lru_del(struct dentry *dentry)
 	D_FLAG_VERIFY(dentry, DCACHE_LRU_LIST);
 	dentry->d_flags &= ~DCACHE_LRU_LIST;
 	this_cpu_dec(nr_dentry_unused);
+	if (d_is_negative(dentry))
+		d_negative_dec(dentry);
 	WARN_ON_ONCE(!list_lru_del(&dentry->d_sb->s_dentry_lru, &dentry->d_lru));
 }
 
@@ -380,6 +414,8 @@ static void d_shrink_del(struct dentry *dentry)
 	list_del_init(&dentry->d_lru);
 	dentry->d_flags &= ~(DCACHE_SHRINK_LIST | DCACHE_LRU_LIST);
 	this_cpu_dec(nr_dentry_unused);
+	if (d_is_negative(dentry))
+		d_negative_dec(dentry);
 }
 
 static void d_shrink_add(struct dentry *dentry, struct list_head *list)
@@ -388,6 +424,8 @@ static void d_shrink_add(struct dentry *dentry, struct list_head *list)
 	list_add(&dentry->d_lru, list);
 	dentry->d_flags |= DCACHE_SHRINK_LIST | DCACHE_LRU_LIST;
 	this_cpu_inc(nr_dentry_unused);
+	if (d_is_negative(dentry))
+		d_negative_inc(dentry);
 }
 
 /*
@@ -401,6 +439,8 @@ static void d_lru_isolate(struct list_lru_one *lru, struct dentry *dentry)
 	D_FLAG_VERIFY(dentry, DCACHE_LRU_LIST);
 	dentry->d_flags &= ~DCACHE_LRU_LIST;
 	this_cpu_dec(nr_dentry_unused);
+	if (d_is_negative(dentry))
+		d_negative_dec(dentry);
 	list_lru_isolate(lru, &dentry->d_lru);
 }
 
@@ -1097,6 +1137,75 @@ long prune_dcache_sb(struct super_block *sb, struct shrink_control *sc)
 	return freed;
 }
 
+struct negative_trim_data {
+	struct list_head dispose;
+	long nr_to_trim;
+};
+
+static enum lru_status dentry_lru_isolate_negative(struct list_head *item,
+		struct list_lru_one *lru, spinlock_t *lru_lock, void *arg)
+{
+	struct negative_trim_data *data = arg;
+	struct dentry	*dentry = container_of(item, struct dentry, d_lru);
+
+	if (data->nr_to_trim <= 0)
+		return LRU_SKIP;
+
+	if (!spin_trylock(&dentry->d_lock))
+		return LRU_SKIP;
+
+	if (!d_is_negative(dentry)) {
+		spin_unlock(&dentry->d_lock);
+		return LRU_SKIP;
+	}
+
+	/* The same aging as dentry_lru_isolate(), for negative ones only */
+	if (dentry->d_lockref.count) {
+		d_lru_isolate(lru, dentry);
+		spin_unlock(&dentry->d_lock);
+		return LRU_REMOVED;
+	}
+
+	if (dentry->d_flags & DCACHE_REFERENCED) {
+		dentry->d_flags &= ~DCACHE_REFERENCED;
+		spin_unlock(&dentry->d_lock);
+		return LRU_ROTATE;
+	}
+
+	d_lru_shrink_move(lru, dentry, &data->dispose);
+	data->nr_to_trim--;
+	spin_unlock(&dentry->d_lock);
+
+	return LRU_REMOVED;
+}
+
+/*
+ * Bring the unused negative dentries of a superblock back under
+ * sysctl_negative_dentry_limit, with some slack so that a steady stream of
+ * failed lookups doesn't requeue us right away.
+ */
+void d_trim_negative_work(struct work_struct *work)
+{
+	struct super_block *sb = container_of(work, struct super_block,
+					      s_negative_trim_work);
+	unsigned long limit = READ_ONCE(sysctl_negative_dentry_limit);
+	struct negative_trim_data data;
+
+	if (!limit || !trylock_super(sb))
+		return;
+
+	INIT_LIST_HEAD(&data.dispose);
+	data.nr_to_trim = percpu_counter_sum_positive(&sb->s_nr_negative) -
+			  (limit - limit / 4);
+	if (data.nr_to_trim > 0) {
+		list_lru_walk(&sb->s_dentry_lru, dentry_lru_isolate_negative,
+			      &data, list_lru_count(&sb->s_dentry_lru));
+		shrink_dentry_list(&data.dispose);
+	}
+
+	up_read(&sb->s_umount);
+}
+
 static enum lru_status dentry_lru_isolate_shrink(struct list_head *item,
 		struct list_lru_one *lru, spinlock_t *lru_lock, void *arg)
 {
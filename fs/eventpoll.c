@@ -50,14 +50,18 @@
  *
  * 1) epmutex (mutex)
  * 2) ep->mtx (mutex)
- * 3) ep->lock (spinlock)
+ * 3) ep->lock (rwlock)
  *
  * The acquire order is the one listed above, from 1 to 3.
- * We need a spinlock (ep->lock) because we manipulate objects
+ * We need a spinning lock (ep->lock) because we manipulate objects
  * from inside the poll callback, that might be triggered from
  * a wake_up() that in turn might be called from IRQ context.
  * So we can't sleep inside the poll callback and hence we need
- * a spinlock. During the event transfer loop (from kernel to
+ * a spinning lock. The poll callback only takes it for read, and
+ * appends to the ready lists locklessly, so that wakeups coming from
+ * many CPUs at once do not serialize; everything else that touches
+ * the ready lists takes it for write. ep->wq is protected by its own
+ * lock. During the event transfer loop (from kernel to
  * user space) we could end up sleeping due a copy_to_user(), so
  * we need a lock that will allow us to sleep. This lock is a
  * mutex (ep->mtx). It is acquired during the event transfer loop,
@@ -109,6 +113,9 @@
 
 #define EP_ITEM_COST (sizeof(struct epitem) + sizeof(struct eppoll_entry))
 
+/* Maximum number of NAPI contexts an epoll set busy polls on */
+#define EP_BUSY_POLL_MAX_NAPI 8
+
 struct epoll_filefd {
 	struct file *file;
 	int fd;
@@ -185,7 +192,7 @@ struct epitem {
  */
 struct eventpoll {
 	/* Protect the access to this structure */
-	spinlock_t lock;
+	rwlock_t lock;
 
 	/*
 	 * This mutex is used to ensure that files are not removed
@@ -227,8 +234,12 @@ struct eventpoll {
 	struct list_head visited_list_link;
 
 #ifdef CONFIG_NET_RX_BUSY_POLL
-	/* used to track busy poll napi_id */
-	unsigned int napi_id;
+	/* NAPI IDs of the sockets that most recently became ready */
+	unsigned int napi_ids[EP_BUSY_POLL_MAX_NAPI];
+	/* number of valid entries in napi_ids */
+	unsigned int napi_count;
+	/* entry replaced next once napi_ids is full */
+	unsigned int napi_next;
 #endif
 };
 
@@ -387,7 +398,8 @@ static void ep_nested_calls_init(struct nested_calls *ncalls)
  */
 static inline int ep_events_available(struct eventpoll *ep)
 {
-	return !list_empty(&ep->rdllist) || ep->ovflist != EP_UNACTIVE_PTR;
+	return !list_empty_careful(&ep->rdllist) ||
+		READ_ONCE(ep->ovflist) != EP_UNACTIVE_PTR;
 }
 
 #ifdef CONFIG_NET_RX_BUSY_POLL
@@ -397,6 +409,58 @@ static bool ep_busy_loop_end(void *p, unsigned long start_time)
 
 	return ep_events_available(ep) || busy_loop_timeout(start_time);
 }
+
+/* Used to share the busy poll budget between several NAPI contexts */
+struct ep_busy_loop_ctx {
+	struct eventpoll *ep;
+	unsigned long start_time;
+	unsigned long slice;
+};
+
+static bool ep_busy_loop_slice_end(void *p, unsigned long start_time)
+{
+	struct ep_busy_loop_ctx *ctx = p;
+
+	return ep_busy_loop_end(ctx->ep, ctx->start_time) ||
+	       time_after(busy_loop_current_time(), start_time + ctx->slice);
+}
+
+/*
+ * With several NAPI contexts behind the ready sockets, each one is polled
+ * in turn for a slice of the busy poll budget, until events show up or
+ * the whole budget is spent.
+ */
+static void ep_busy_loop_multi(struct eventpoll *ep, unsigned int count,
+			       int nonblock)
+{
+	struct ep_busy_loop_ctx ctx = {
+		.ep = ep,
+		.start_time = busy_loop_current_time(),
+	};
+	unsigned int i, napi_id;
+
+	ctx.slice = max(READ_ONCE(sysctl_net_busy_poll) / count, 1U);
+
+	for (;;) {
+		for (i = 0; i < count; i++) {
+			napi_id = READ_ONCE(ep->napi_ids[i]);
+			if (napi_id < MIN_NAPI_ID)
+				continue;
+
+			napi_busy_loop(napi_id,
+				       nonblock ? NULL : ep_busy_loop_slice_end,
+				       &ctx);
+			if (ep_events_available(ep))
+				return;
+		}
+
+		if (nonblock || ep_busy_loop_end(ep, ctx.start_time) ||
+		    signal_pending(current))
+			return;
+
+		cond_resched();
+	}
+}
 #endif /* CONFIG_NET_RX_BUSY_POLL */
 
 /*
@@ -408,9 +472,22 @@ static bool ep_busy_loop_end(void *p, unsigned long start_time)
 static void ep_busy_loop(struct eventpoll *ep, int nonblock)
 {
 #ifdef CONFIG_NET_RX_BUSY_POLL
-	unsigned int napi_id = READ_ONCE(ep->napi_id);
+	unsigned int count = READ_ONCE(ep->napi_count);
+	unsigned int napi_id;
+
+	if (!count || !net_busy_loop_on())
+		return;
+
+	/* Pairs with smp_wmb() in ep_set_busy_poll_napi_id() */
+	smp_rmb();
 
-	if ((napi_id >= MIN_NAPI_ID) && net_busy_loop_on())
+	if (count > 1) {
+		ep_busy_loop_multi(ep, count, nonblock);
+		return;
+	}
+
+	napi_id = READ_ONCE(ep->napi_ids[0]);
+	if (napi_id >= MIN_NAPI_ID)
 		napi_busy_loop(napi_id, nonblock ? NULL : ep_busy_loop_end, ep);
 #endif
 }
@@ -418,13 +495,17 @@ static void ep_busy_loop(struct eventpoll *ep, int nonblock)
 static inline void ep_reset_busy_poll_napi_id(struct eventpoll *ep)
 {
 #ifdef CONFIG_NET_RX_BUSY_POLL
-	if (ep->napi_id)
-		ep->napi_id = 0;
+	if (ep->napi_count) {
+		WRITE_ONCE(ep->napi_count, 0);
+		ep->napi_next = 0;
+	}
 #endif
 }
 
 /*
- * Set epoll busy poll NAPI ID from sk.
+ * Add the NAPI ID of sk to the epoll busy poll set, replacing the oldest
+ * entry once the set is full. Called with ep->lock held, possibly only for
+ * read: racing updates may drop an ID, which just costs a busy poll miss.
  */
 static inline void ep_set_busy_poll_napi_id(struct epitem *epi)
 {
@@ -433,7 +514,7 @@ static inline void ep_set_busy_poll_napi_id(struct epitem *epi)
 	unsigned int napi_id;
 	struct socket *sock;
 	struct sock *sk;
-	int err;
+	int err, i;
 
 	if (!net_busy_loop_on())
 		return;
@@ -449,15 +530,24 @@ static inline void ep_set_busy_poll_napi_id(struct epitem *epi)
 	napi_id = READ_ONCE(sk->sk_napi_id);
 	ep = epi->ep;
 
-	/* Non-NAPI IDs can be rejected
-	 *	or
-	 * Nothing to do if we already have this ID
-	 */
-	if (napi_id < MIN_NAPI_ID || napi_id == ep->napi_id)
+	/* Non-NAPI IDs can be rejected */
+	if (napi_id < MIN_NAPI_ID)
 		return;
 
+	/* Nothing to do if we already have this ID */
+	for (i = 0; i < ep->napi_count; i++)
+		if (ep->napi_ids[i] == napi_id)
+			return;
+
 	/* record NAPI ID for use in next busy poll */
-	ep->napi_id = napi_id;
+	if (ep->napi_count < EP_BUSY_POLL_MAX_NAPI) {
+		WRITE_ONCE(ep->napi_ids[ep->napi_count], napi_id);
+		smp_wmb();
+		WRITE_ONCE(ep->napi_count, ep->napi_count + 1);
+	} else {
+		WRITE_ONCE(ep->napi_ids[ep->napi_next], napi_id);
+		ep->napi_next = (ep->napi_next + 1) % EP_BUSY_POLL_MAX_NAPI;
+	}
 #endif
 }
 
@@ -697,17 +787,17 @@ static int ep_scan_ready_list(struct eventpoll *ep,
 	 * because we want the "sproc" callback to be able to do it
 	 * in a lockless way.
 	 */
-	spin_lock_irqsave(&ep->lock, flags);
+	write_lock_irqsave(&ep->lock, flags);
 	list_splice_init(&ep->rdllist, &txlist);
-	ep->ovflist = NULL;
-	spin_unlock_irqrestore(&ep->lock, flags);
+	WRITE_ONCE(ep->ovflist, NULL);
+	write_unlock_irqrestore(&ep->lock, flags);
 
 	/*
 	 * Now call the callback function.
 	 */
 	error = (*sproc)(ep, &txlist, priv);
 
-	spin_lock_irqsave(&ep->lock, flags);
+	write_lock_irqsave(&ep->lock, flags);
 	/*
 	 * During the time we spent inside the "sproc" callback, some
 	 * other events might have been queued by the poll callback.
@@ -731,7 +821,7 @@ static int ep_scan_ready_list(struct eventpoll *ep,
 	 * releasing the lock, events will be queued in the normal way inside
 	 * ep->rdllist.
 	 */
-	ep->ovflist = EP_UNACTIVE_PTR;
+	WRITE_ONCE(ep->ovflist, EP_UNACTIVE_PTR);
 
 	/*
 	 * Quickly re-inject items left on "txlist".
@@ -745,11 +835,11 @@ static int ep_scan_ready_list(struct eventpoll *ep,
 		 * the ->poll() wait list (delayed after we release the lock).
 		 */
 		if (waitqueue_active(&ep->wq))
-			wake_up_locked(&ep->wq);
+			wake_up(&ep->wq);
 		if (waitqueue_active(&ep->poll_wait))
 			pwake++;
 	}
-	spin_unlock_irqrestore(&ep->lock, flags);
+	write_unlock_irqrestore(&ep->lock, flags);
 
 	if (!ep_locked)
 		mutex_unlock(&ep->mtx);
@@ -793,10 +883,10 @@ static int ep_remove(struct eventpoll *ep, struct epitem *epi)
 
 	rb_erase(&epi->rbn, &ep->rbr);
 
-	spin_lock_irqsave(&ep->lock, flags);
+	write_lock_irqsave(&ep->lock, flags);
 	if (ep_is_linked(&epi->rdllink))
 		list_del_init(&epi->rdllink);
-	spin_unlock_irqrestore(&ep->lock, flags);
+	write_unlock_irqrestore(&ep->lock, flags);
 
 	wakeup_source_unregister(ep_wakeup_source(epi));
 	/*
@@ -1026,7 +1116,7 @@ static int ep_alloc(struct eventpoll **pep)
 	if (unlikely(!ep))
 		goto free_uid;
 
-	spin_lock_init(&ep->lock);
+	rwlock_init(&ep->lock);
 	mutex_init(&ep->mtx);
 	init_waitqueue_head(&ep->wq);
 	init_waitqueue_head(&ep->poll_wait);
@@ -1073,10 +1163,62 @@ static struct epitem *ep_find(struct eventpoll *ep, struct file *file, int fd)
 	return epir;
 }
 
+/*
+ * Add @new to the tail of @head, racing only with other callers of this
+ * function. Returns false if another CPU has just added the same element.
+ */
+static inline bool list_add_tail_lockless(struct list_head *new,
+					  struct list_head *head)
+{
+	struct list_head *prev;
+
+	/*
+	 * This is a simple 'new->next = head', but the cmpxchg() detects
+	 * that the element was just added from another CPU: the winner
+	 * sees new->next == new.
+	 */
+	if (cmpxchg(&new->next, new, head) != new)
+		return false;
+
+	/*
+	 * ->next of the new element is set before the tail is exchanged,
+	 * and xchg() orders it; the tail is exchanged before prev->next
+	 * is updated. Elements are only ever added at the tail, so it
+	 * is then safe to link prev and new.
+	 */
+	prev = xchg(&head->prev, new);
+	prev->next = new;
+	new->prev = prev;
+
+	return true;
+}
+
+/*
+ * Chain @epi onto ep->ovflist, racing only with other callers of this
+ * function. Returns false if it is chained already.
+ */
+static inline bool chain_epi_lockless(struct epitem *epi)
+{
+	struct eventpoll *ep = epi->ep;
+
+	/* Check that the same epi has not been just chained from another CPU */
+	if (cmpxchg(&epi->next, EP_UNACTIVE_PTR, NULL) != EP_UNACTIVE_PTR)
+		return false;
+
+	/* Atomically exchange the head */
+	epi->next = xchg(&ep->ovflist, epi);
+
+	return true;
+}
+
 /*
  * This is the callback that is passed to the wait queue wakeup
  * mechanism. It is called by the stored file descriptors when they
  * have events to report.
+ *
+ * ep->lock is only taken for read: concurrent callbacks add to the
+ * ready lists with the lockless helpers above, while ep->lock taken
+ * for write keeps them away from everybody else.
  */
 static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *key)
 {
@@ -1097,7 +1239,7 @@ static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *k
 		list_del_init(&wait->task_list);
 	}
 
-	spin_lock_irqsave(&ep->lock, flags);
+	read_lock_irqsave(&ep->lock, flags);
 
 	ep_set_busy_poll_napi_id(epi);
 
@@ -1125,10 +1267,8 @@ static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *k
 	 * semantics). All the events that happen during that period of time are
 	 * chained in ep->ovflist and requeued later on.
 	 */
-	if (unlikely(ep->ovflist != EP_UNACTIVE_PTR)) {
-		if (epi->next == EP_UNACTIVE_PTR) {
-			epi->next = ep->ovflist;
-			ep->ovflist = epi;
+	if (unlikely(READ_ONCE(ep->ovflist) != EP_UNACTIVE_PTR)) {
+		if (epi->next == EP_UNACTIVE_PTR && chain_epi_lockless(epi)) {
 			if (epi->ws) {
 				/*
 				 * Activate ep->ws since epi->ws may get
@@ -1136,20 +1276,20 @@ static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *k
 				 */
 				__pm_stay_awake(ep->ws);
 			}
-
 		}
 		goto out_unlock;
 	}
 
 	/* If this file is already in the ready list we exit soon */
-	if (!ep_is_linked(&epi->rdllink)) {
-		list_add_tail(&epi->rdllink, &ep->rdllist);
+	if (!ep_is_linked(&epi->rdllink) &&
+	    list_add_tail_lockless(&epi->rdllink, &ep->rdllist))
 		ep_pm_stay_awake_rcu(epi);
-	}
 
 	/*
 	 * Wake up ( if active ) both the eventpoll wait list and the ->poll()
-	 * wait list.
+	 * wait list. The xchg() above orders the ready list update against
+	 * the waitqueue_active() checks, pairing with set_current_state()
+	 * in ep_poll().
 	 */
 	if (waitqueue_active(&ep->wq)) {
 		if ((epi->event.events & EPOLLEXCLUSIVE) &&
@@ -1168,13 +1308,13 @@ static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *k
 				break;
 			}
 		}
-		wake_up_locked(&ep->wq);
+		wake_up(&ep->wq);
 	}
 	if (waitqueue_active(&ep->poll_wait))
 		pwake++;
 
 out_unlock:
-	spin_unlock_irqrestore(&ep->lock, flags);
+	read_unlock_irqrestore(&ep->lock, flags);
 
 	/* We have to call this outside the lock */
 	if (pwake)
@@ -1440,7 +1580,7 @@ static int ep_insert(struct eventpoll *ep, struct epoll_event *event,
 		goto error_remove_epi;
 
 	/* We have to drop the new item inside our item list to keep track of it */
-	spin_lock_irqsave(&ep->lock, flags);
+	write_lock_irqsave(&ep->lock, flags);
 
 	/* record NAPI ID of new item if present */
 	ep_set_busy_poll_napi_id(epi);
@@ -1452,12 +1592,12 @@ static int ep_insert(struct eventpoll *ep, struct epoll_event *event,
 
 		/* Notify waiting tasks that events are available */
 		if (waitqueue_active(&ep->wq))
-			wake_up_locked(&ep->wq);
+			wake_up(&ep->wq);
 		if (waitqueue_active(&ep->poll_wait))
 			pwake++;
 	}
 
-	spin_unlock_irqrestore(&ep->lock, flags);
+	write_unlock_irqrestore(&ep->lock, flags);
 
 	atomic_long_inc(&ep->user->epoll_watches);
 
@@ -1483,10 +1623,10 @@ static int ep_insert(struct eventpoll *ep, struct epoll_event *event,
 	 * list, since that is used/cleaned only inside a section bound by "mtx".
 	 * And ep_insert() is called with "mtx" held.
 	 */
-	spin_lock_irqsave(&ep->lock, flags);
+	write_lock_irqsave(&ep->lock, flags);
 	if (ep_is_linked(&epi->rdllink))
 		list_del_init(&epi->rdllink);
-	spin_unlock_irqrestore(&ep->lock, flags);
+	write_unlock_irqrestore(&ep->lock, flags);
 
 	wakeup_source_unregister(ep_wakeup_source(epi));
 
@@ -1553,18 +1693,18 @@ static int ep_modify(struct eventpoll *ep, struct epitem *epi, struct epoll_even
 	 * list, push it inside.
 	 */
 	if (revents & event->events) {
-		spin_lock_irq(&ep->lock);
+		write_lock_irq(&ep->lock);
 		if (!ep_is_linked(&epi->rdllink)) {
 			list_add_tail(&epi->rdllink, &ep->rdllist);
 			ep_pm_stay_awake(epi);
 
 			/* Notify waiting tasks that events are available */
 			if (waitqueue_active(&ep->wq))
-				wake_up_locked(&ep->wq);
+				wake_up(&ep->wq);
 			if (waitqueue_active(&ep->poll_wait))
 				pwake++;
 		}
-		spin_unlock_irq(&ep->lock);
+		write_unlock_irq(&ep->lock);
 	}
 
 	/* We have to call this outside the lock */
@@ -1714,7 +1854,6 @@ static int ep_poll(struct eventpoll *ep, struct epoll_event __user *events,
 		 * caller specified a non blocking operation.
 		 */
 		timed_out = 1;
-		spin_lock_irqsave(&ep->lock, flags);
 		goto check_events;
 	}
 
@@ -1723,15 +1862,15 @@ static int ep_poll(struct eventpoll *ep, struct epoll_event __user *events,
 	if (!ep_events_available(ep))
 		ep_busy_loop(ep, timed_out);
 
-	spin_lock_irqsave(&ep->lock, flags);
-
 	if (!ep_events_available(ep)) {
 		/*
 		 * Busy poll timed out.  Drop NAPI ID for now, we can add
 		 * it back in when we have moved a socket with a valid NAPI
 		 * ID onto the ready list.
 		 */
+		write_lock_irqsave(&ep->lock, flags);
 		ep_reset_busy_poll_napi_id(ep);
+		write_unlock_irqrestore(&ep->lock, flags);
 
 		/*
 		 * We don't have any available event to return to the caller.
@@ -1739,7 +1878,9 @@ static int ep_poll(struct eventpoll *ep, struct epoll_event __user *events,
 		 * ep_poll_callback() when events will become available.
 		 */
 		init_waitqueue_entry(&wait, current);
+		spin_lock_irqsave(&ep->wq.lock, flags);
 		__add_wait_queue_exclusive(&ep->wq, &wait);
+		spin_unlock_irqrestore(&ep->wq.lock, flags);
 
 		for (;;) {
 			/*
@@ -1755,22 +1896,19 @@ static int ep_poll(struct eventpoll *ep, struct epoll_event __user *events,
 				break;
 			}
 
-			spin_unlock_irqrestore(&ep->lock, flags);
 			if (!schedule_hrtimeout_range(to, slack, HRTIMER_MODE_ABS))
 				timed_out = 1;
-
-			spin_lock_irqsave(&ep->lock, flags);
 		}
 
+		spin_lock_irqsave(&ep->wq.lock, flags);
 		__remove_wait_queue(&ep->wq, &wait);
+		spin_unlock_irqrestore(&ep->wq.lock, flags);
 		__set_current_state(TASK_RUNNING);
 	}
 check_events:
 	/* Is it worth to try to dig for events ? */
 	eavail = ep_events_available(ep);
 
-	spin_unlock_irqrestore(&ep->lock, flags);
-
 	/*
 	 * Try to transfer events to user space. In case we get 0 events and
 	 * there's still timeout left over, we go trying again in search of
@@ -699,11 +699,15 @@ static void ext4_mb_mark_free_simple(struct super_block *sb,
 
 /*
  * Cache the order of the largest free extent we have available in this block
- * group.
+ * group, and keep the group on the matching s_mb_largest_free_orders list.
+ * Called with the group lock held.
  */
 static void
 mb_set_largest_free_order(struct super_block *sb, struct ext4_group_info *grp)
 {
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	int old = grp->bb_largest_free_order;
+	bool listed;
 	int i;
 	int bits;
 
@@ -716,6 +720,25 @@ mb_set_largest_free_order(struct super_block *sb, struct ext4_group_info *grp)
 			break;
 		}
 	}
+
+	/* Only take the list locks when the group actually moves */
+	listed = grp->bb_largest_free_order >= 0 && grp->bb_free;
+	if (grp->bb_largest_free_order == old &&
+	    listed == !list_empty(&grp->bb_largest_free_order_node))
+		return;
+
+	if (!list_empty(&grp->bb_largest_free_order_node)) {
+		write_lock(&sbi->s_mb_largest_free_orders_locks[old]);
+		list_del_init(&grp->bb_largest_free_order_node);
+		write_unlock(&sbi->s_mb_largest_free_orders_locks[old]);
+	}
+	if (listed) {
+		i = grp->bb_largest_free_order;
+		write_lock(&sbi->s_mb_largest_free_orders_locks[i]);
+		list_add_tail(&grp->bb_largest_free_order_node,
+			      &sbi->s_mb_largest_free_orders[i]);
+		write_unlock(&sbi->s_mb_largest_free_orders_locks[i]);
+	}
 }
 
 static noinline_for_stack
@@ -1682,10 +1705,10 @@ static void ext4_mb_use_best_found(struct ext4_allocation_context *ac,
 	get_page(ac->ac_buddy_page);
 	/* store last allocated for subsequent stream allocation */
 	if (ac->ac_flags & EXT4_MB_STREAM_ALLOC) {
-		spin_lock(&sbi->s_md_lock);
-		sbi->s_mb_last_group = ac->ac_f_ex.fe_group;
-		sbi->s_mb_last_start = ac->ac_f_ex.fe_start;
-		spin_unlock(&sbi->s_md_lock);
+		struct ext4_mb_stream *stream = raw_cpu_ptr(sbi->s_mb_stream);
+
+		stream->group = ac->ac_f_ex.fe_group;
+		stream->start = ac->ac_f_ex.fe_start;
 	}
 }
 
@@ -2108,6 +2131,49 @@ static int ext4_mb_good_group(struct ext4_allocation_context *ac,
 	return 0;
 }
 
+/*
+ * Find a group for a cr 0 scan on the largest free order lists: any
+ * group whose largest free extent is at least 2^ac_2order blocks will
+ * do.  Returns ngroups when there is none.
+ */
+static ext4_group_t
+ext4_mb_choose_group_cr0(struct ext4_allocation_context *ac,
+			 ext4_group_t ngroups)
+{
+	struct super_block *sb = ac->ac_sb;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	int flex_size = ext4_flex_bg_size(sbi);
+	struct ext4_group_info *grp;
+	ext4_group_t group = ngroups;
+	int i;
+
+	for (i = ac->ac_2order; i < MB_NUM_ORDERS(sb); i++) {
+		if (list_empty(&sbi->s_mb_largest_free_orders[i]))
+			continue;
+
+		read_lock(&sbi->s_mb_largest_free_orders_locks[i]);
+		list_for_each_entry(grp, &sbi->s_mb_largest_free_orders[i],
+				    bb_largest_free_order_node) {
+			if (grp->bb_group >= ngroups ||
+			    EXT4_MB_GRP_BBITMAP_CORRUPT(grp))
+				continue;
+			/* Same exclusion as ext4_mb_good_group() */
+			if ((ac->ac_flags & EXT4_MB_HINT_DATA) &&
+			    (flex_size >= EXT4_FLEX_SIZE_DIR_ALLOC_SCHEME) &&
+			    ((grp->bb_group % flex_size) == 0))
+				continue;
+			group = grp->bb_group;
+			break;
+		}
+		read_unlock(&sbi->s_mb_largest_free_orders_locks[i]);
+
+		if (group < ngroups)
+			break;
+	}
+
+	return group;
+}
+
 static noinline_for_stack int
 ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 {
@@ -2157,13 +2223,12 @@ ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 			ac->ac_2order = i - 1;
 	}
 
-	/* if stream allocation is enabled, use global goal */
+	/* if stream allocation is enabled, use this cpu's goal */
 	if (ac->ac_flags & EXT4_MB_STREAM_ALLOC) {
-		/* TBD: may be hot point */
-		spin_lock(&sbi->s_md_lock);
-		ac->ac_g_ex.fe_group = sbi->s_mb_last_group;
-		ac->ac_g_ex.fe_start = sbi->s_mb_last_start;
-		spin_unlock(&sbi->s_md_lock);
+		struct ext4_mb_stream *stream = raw_cpu_ptr(sbi->s_mb_stream);
+
+		ac->ac_g_ex.fe_group = READ_ONCE(stream->group);
+		ac->ac_g_ex.fe_start = READ_ONCE(stream->start);
 	}
 
 	/* Let's just scan groups to find more-less suitable blocks */
@@ -2184,6 +2249,15 @@ ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 		for (i = 0; i < ngroups; group++, i++) {
 			int ret = 0;
 			cond_resched();
+			/*
+			 * Groups fit for cr 0 are known without walking
+			 * them all; give up on cr 0 when there are none.
+			 */
+			if (cr == 0 && sbi->s_mb_optimize_scan) {
+				group = ext4_mb_choose_group_cr0(ac, ngroups);
+				if (group >= ngroups)
+					break;
+			}
 			/*
 			 * Artificially restricted ngroups for non-extent
 			 * files makes group > ngroups possible on first loop.
@@ -2463,6 +2537,8 @@ int ext4_mb_add_groupinfo(struct super_block *sb, ext4_group_t group,
 	}
 
 	INIT_LIST_HEAD(&meta_group_info[i]->bb_prealloc_list);
+	INIT_LIST_HEAD(&meta_group_info[i]->bb_largest_free_order_node);
+	meta_group_info[i]->bb_group = group;
 	init_rwsem(&meta_group_info[i]->alloc_sem);
 	meta_group_info[i]->bb_free_root = RB_ROOT;
 	meta_group_info[i]->bb_largest_free_order = -1;  /* uninit */
@@ -2636,6 +2712,22 @@ int ext4_mb_init(struct super_block *sb)
 		i++;
 	} while (i <= sb->s_blocksize_bits + 1);
 
+	sbi->s_mb_largest_free_orders =
+		kmalloc_array(MB_NUM_ORDERS(sb), sizeof(struct list_head),
+			      GFP_KERNEL);
+	sbi->s_mb_largest_free_orders_locks =
+		kmalloc_array(MB_NUM_ORDERS(sb), sizeof(rwlock_t),
+			      GFP_KERNEL);
+	if (!sbi->s_mb_largest_free_orders ||
+	    !sbi->s_mb_largest_free_orders_locks) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	for (i = 0; i < MB_NUM_ORDERS(sb); i++) {
+		INIT_LIST_HEAD(&sbi->s_mb_largest_free_orders[i]);
+		rwlock_init(&sbi->s_mb_largest_free_orders_locks[i]);
+	}
+
 	spin_lock_init(&sbi->s_md_lock);
 	spin_lock_init(&sbi->s_bal_lock);
 	sbi->s_mb_free_pending = 0;
@@ -2645,6 +2737,7 @@ int ext4_mb_init(struct super_block *sb)
 	sbi->s_mb_stats = MB_DEFAULT_STATS;
 	sbi->s_mb_stream_request = MB_DEFAULT_STREAM_THRESHOLD;
 	sbi->s_mb_order2_reqs = MB_DEFAULT_ORDER2_REQS;
+	sbi->s_mb_optimize_scan = MB_DEFAULT_OPTIMIZE_SCAN;
 	/*
 	 * The default group preallocation is 512, which for 4k block
 	 * sizes translates to 2 megabytes.  However for bigalloc file
@@ -2686,17 +2779,44 @@ int ext4_mb_init(struct super_block *sb)
 		spin_lock_init(&lg->lg_prealloc_lock);
 	}
 
+	/*
+	 * Spread the stream goals of the cpus over the filesystem, so that
+	 * parallel streaming writers start out in different groups.
+	 */
+	sbi->s_mb_stream = alloc_percpu(struct ext4_mb_stream);
+	if (sbi->s_mb_stream == NULL) {
+		ret = -ENOMEM;
+		goto out_free_locality_groups;
+	}
+	for_each_possible_cpu(i) {
+		struct ext4_mb_stream *stream = per_cpu_ptr(sbi->s_mb_stream, i);
+		ext4_group_t ngroups = ext4_get_groups_count(sb);
+
+		if (ngroups >= nr_cpu_ids)
+			stream->group = i * (ngroups / nr_cpu_ids);
+		else
+			stream->group = i % ngroups;
+		stream->start = 0;
+	}
+
 	/* init file for buddy data */
 	ret = ext4_mb_init_backend(sb);
 	if (ret != 0)
-		goto out_free_locality_groups;
+		goto out_free_stream;
 
 	return 0;
 
+out_free_stream:
+	free_percpu(sbi->s_mb_stream);
+	sbi->s_mb_stream = NULL;
 out_free_locality_groups:
 	free_percpu(sbi->s_locality_groups);
 	sbi->s_locality_groups = NULL;
 out:
+	kfree(sbi->s_mb_largest_free_orders);
+	sbi->s_mb_largest_free_orders = NULL;
+	kfree(sbi->s_mb_largest_free_orders_locks);
+	sbi->s_mb_largest_free_orders_locks = NULL;
 	kfree(sbi->s_mb_offsets);
 	sbi->s_mb_offsets = NULL;
 	kfree(sbi->s_mb_maxs);
@@ -2751,6 +2871,8 @@ int ext4_mb_release(struct super_block *sb)
 	}
 	kfree(sbi->s_mb_offsets);
 	kfree(sbi->s_mb_maxs);
+	kfree(sbi->s_mb_largest_free_orders);
+	kfree(sbi->s_mb_largest_free_orders_locks);
 	iput(sbi->s_buddy_cache);
 	if (sbi->s_mb_stats) {
 		ext4_msg(sb, KERN_INFO,
@@ -2777,6 +2899,7 @@ int ext4_mb_release(struct super_block *sb)
 	}
 
 	free_percpu(sbi->s_locality_groups);
+	free_percpu(sbi->s_mb_stream);
 
 	return 0;
 }
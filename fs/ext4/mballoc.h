@@ -76,6 +76,15 @@ do {									\
  */
 #define MB_DEFAULT_GROUP_PREALLOC	512
 
+/*
+ * pick cr 0 groups from the largest free order lists instead of
+ * scanning every group from the goal
+ */
+#define MB_DEFAULT_OPTIMIZE_SCAN	1
+
+/* number of buddy orders, order 0 being the bitmap itself */
+#define MB_NUM_ORDERS(sb)		((sb)->s_blocksize_bits + 2)
+
 
 struct ext4_free_data {
 	/* MUST be the first member */
@@ -146,6 +155,12 @@ struct ext4_locality_group {
 	spinlock_t		lg_prealloc_lock;
 };
 
+/* goal of the next stream allocation made on a cpu */
+struct ext4_mb_stream {
+	unsigned long		group;
+	unsigned long		start;
+};
+
 struct ext4_allocation_context {
 	struct inode *ac_inode;
 	struct super_block *ac_sb;
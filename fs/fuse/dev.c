@@ -21,6 +21,7 @@
 #include <linux/swap.h>
 #include <linux/splice.h>
 #include <linux/sched.h>
+#include <linux/percpu.h>
 
 MODULE_ALIAS_MISCDEV(FUSE_MINOR);
 MODULE_ALIAS("devname:fuse");
@@ -300,15 +301,45 @@ static unsigned len_args(unsigned numargs, struct fuse_arg *args)
 	return nbytes;
 }
 
+/* See fuse_conn_alloc_cpu_iq() for the stride */
 static u64 fuse_get_unique(struct fuse_iqueue *fiq)
 {
-	return ++fiq->reqctr;
+	fiq->reqctr += nr_cpu_ids + 1;
+	return fiq->reqctr;
+}
+
+/*
+ * Requests go to the issuing CPU's input queue if a device is bound to
+ * it, so that they are read and answered on that CPU.  Everything else,
+ * and interrupts and forgets always, goes through the shared queue.
+ *
+ * Returns with the queue's waitq.lock held.
+ */
+static struct fuse_iqueue *fuse_lock_iq(struct fuse_conn *fc)
+{
+	struct fuse_iqueue __percpu *cpu_iq = smp_load_acquire(&fc->cpu_iq);
+	struct fuse_iqueue *fiq;
+
+	if (cpu_iq) {
+		fiq = raw_cpu_ptr(cpu_iq);
+		if (READ_ONCE(fiq->readers)) {
+			spin_lock(&fiq->waitq.lock);
+			if (fiq->readers)
+				return fiq;
+			spin_unlock(&fiq->waitq.lock);
+		}
+	}
+
+	fiq = &fc->iq;
+	spin_lock(&fiq->waitq.lock);
+	return fiq;
 }
 
 static void queue_request(struct fuse_iqueue *fiq, struct fuse_req *req)
 {
 	req->in.h.len = sizeof(struct fuse_in_header) +
 		len_args(req->in.numargs, (struct fuse_arg *) req->in.args);
+	req->fiq = fiq;
 	list_add_tail(&req->list, &fiq->pending);
 	wake_up_locked(&fiq->waitq);
 	kill_fasync(&fiq->fasync, SIGIO, POLL_IN);
@@ -339,12 +370,12 @@ static void flush_bg_queue(struct fuse_conn *fc)
 	while (fc->active_background < fc->max_background &&
 	       !list_empty(&fc->bg_queue)) {
 		struct fuse_req *req;
-		struct fuse_iqueue *fiq = &fc->iq;
+		struct fuse_iqueue *fiq;
 
 		req = list_entry(fc->bg_queue.next, struct fuse_req, list);
 		list_del(&req->list);
 		fc->active_background++;
-		spin_lock(&fiq->waitq.lock);
+		fiq = fuse_lock_iq(fc);
 		req->in.h.unique = fuse_get_unique(fiq);
 		queue_request(fiq, req);
 		spin_unlock(&fiq->waitq.lock);
@@ -414,7 +445,7 @@ static void queue_interrupt(struct fuse_iqueue *fiq, struct fuse_req *req)
 
 static void request_wait_answer(struct fuse_conn *fc, struct fuse_req *req)
 {
-	struct fuse_iqueue *fiq = &fc->iq;
+	struct fuse_iqueue *fiq;
 	int err;
 
 	if (!fc->no_interrupt) {
@@ -428,7 +459,7 @@ static void request_wait_answer(struct fuse_conn *fc, struct fuse_req *req)
 		/* matches barrier in fuse_dev_do_read() */
 		smp_mb__after_atomic();
 		if (test_bit(FR_SENT, &req->flags))
-			queue_interrupt(fiq, req);
+			queue_interrupt(&fc->iq, req);
 	}
 
 	if (!test_bit(FR_FORCE, &req->flags)) {
@@ -438,7 +469,14 @@ static void request_wait_answer(struct fuse_conn *fc, struct fuse_req *req)
 		if (!err)
 			return;
 
-		spin_lock(&fiq->waitq.lock);
+		/* The request may be moved over by fuse_dev_unbind() */
+		for (;;) {
+			fiq = READ_ONCE(req->fiq);
+			spin_lock(&fiq->waitq.lock);
+			if (fiq == req->fiq)
+				break;
+			spin_unlock(&fiq->waitq.lock);
+		}
 		/* Request is not yet in userspace, bail out */
 		if (test_bit(FR_PENDING, &req->flags)) {
 			list_del(&req->list);
@@ -459,10 +497,10 @@ static void request_wait_answer(struct fuse_conn *fc, struct fuse_req *req)
 
 static void __fuse_request_send(struct fuse_conn *fc, struct fuse_req *req)
 {
-	struct fuse_iqueue *fiq = &fc->iq;
+	struct fuse_iqueue *fiq;
 
 	BUG_ON(test_bit(FR_BACKGROUND, &req->flags));
-	spin_lock(&fiq->waitq.lock);
+	fiq = fuse_lock_iq(fc);
 	if (!fiq->connected) {
 		spin_unlock(&fiq->waitq.lock);
 		req->out.h.error = -ENOTCONN;
@@ -1216,7 +1254,7 @@ static ssize_t fuse_dev_do_read(struct fuse_dev *fud, struct file *file,
 {
 	ssize_t err;
 	struct fuse_conn *fc = fud->fc;
-	struct fuse_iqueue *fiq = &fc->iq;
+	struct fuse_iqueue *fiq = READ_ONCE(fud->iq);
 	struct fuse_pqueue *fpq = &fud->pq;
 	struct fuse_req *req;
 	struct fuse_in *in;
@@ -1300,7 +1338,7 @@ static ssize_t fuse_dev_do_read(struct fuse_dev *fud, struct file *file,
 	/* matches barrier in request_wait_answer() */
 	smp_mb__after_atomic();
 	if (test_bit(FR_INTERRUPTED, &req->flags))
-		queue_interrupt(fiq, req);
+		queue_interrupt(&fc->iq, req);
 
 	return reqsize;
 
@@ -1658,7 +1696,7 @@ static int fuse_retrieve(struct fuse_conn *fc, struct inode *inode,
 		num = file_size - outarg->offset;
 
 	num_pages = (num + offset + PAGE_SIZE - 1) >> PAGE_SHIFT;
-	num_pages = min(num_pages, FUSE_MAX_PAGES_PER_REQ);
+	num_pages = min_t(int, num_pages, fc->max_pages);
 
 	req = fuse_get_req(fc, num_pages);
 	if (IS_ERR(req))
@@ -2012,7 +2050,7 @@ static unsigned fuse_dev_poll(struct file *file, poll_table *wait)
 	if (!fud)
 		return POLLERR;
 
-	fiq = &fud->fc->iq;
+	fiq = READ_ONCE(fud->iq);
 	poll_wait(file, &fiq->waitq, wait);
 
 	spin_lock(&fiq->waitq.lock);
@@ -2057,6 +2095,21 @@ static void end_polls(struct fuse_conn *fc)
 	}
 }
 
+/* Disconnect a per-CPU input queue, moving its pending requests to @head */
+static void fuse_iqueue_abort(struct fuse_iqueue *fiq, struct list_head *head)
+{
+	struct fuse_req *req;
+
+	spin_lock(&fiq->waitq.lock);
+	fiq->connected = 0;
+	list_for_each_entry(req, &fiq->pending, list)
+		clear_bit(FR_PENDING, &req->flags);
+	list_splice_tail_init(&fiq->pending, head);
+	wake_up_all_locked(&fiq->waitq);
+	spin_unlock(&fiq->waitq.lock);
+	kill_fasync(&fiq->fasync, SIGIO, POLL_IN);
+}
+
 /*
  * Abort all requests.
  *
@@ -2110,6 +2163,14 @@ void fuse_abort_conn(struct fuse_conn *fc)
 		fc->max_background = UINT_MAX;
 		flush_bg_queue(fc);
 
+		if (fc->cpu_iq) {
+			int cpu;
+
+			for_each_possible_cpu(cpu)
+				fuse_iqueue_abort(per_cpu_ptr(fc->cpu_iq, cpu),
+						  &to_end2);
+		}
+
 		spin_lock(&fiq->waitq.lock);
 		fiq->connected = 0;
 		list_splice_init(&fiq->pending, &to_end2);
@@ -2137,6 +2198,33 @@ void fuse_abort_conn(struct fuse_conn *fc)
 }
 EXPORT_SYMBOL_GPL(fuse_abort_conn);
 
+/*
+ * Drop a device's binding to a per-CPU input queue.  Requests left on
+ * the queue by the last bound device are handed to the shared queue;
+ * if that is disconnected already, fuse_abort_conn() ends them.
+ */
+static void fuse_dev_unbind(struct fuse_dev *fud)
+{
+	struct fuse_iqueue *fiq = fud->iq;
+	struct fuse_iqueue *shared = &fud->fc->iq;
+	struct fuse_req *req;
+
+	spin_lock(&fiq->waitq.lock);
+	if (!--fiq->readers && !list_empty(&fiq->pending)) {
+		spin_lock(&shared->waitq.lock);
+		if (shared->connected) {
+			list_for_each_entry(req, &fiq->pending, list)
+				WRITE_ONCE(req->fiq, shared);
+			list_splice_tail_init(&fiq->pending, &shared->pending);
+			wake_up_locked(&shared->waitq);
+		}
+		spin_unlock(&shared->waitq.lock);
+		kill_fasync(&shared->fasync, SIGIO, POLL_IN);
+	}
+	spin_unlock(&fiq->waitq.lock);
+	fud->iq = shared;
+}
+
 int fuse_dev_release(struct inode *inode, struct file *file)
 {
 	struct fuse_dev *fud = fuse_get_dev(file);
@@ -2147,6 +2235,8 @@ int fuse_dev_release(struct inode *inode, struct file *file)
 
 		WARN_ON(!list_empty(&fpq->io));
 		end_requests(fc, &fpq->processing);
+		if (fud->iq != &fc->iq)
+			fuse_dev_unbind(fud);
 		/* Are we the last open device? */
 		if (atomic_dec_and_test(&fc->dev_count)) {
 			WARN_ON(fc->iq.fasync != NULL);
@@ -2166,7 +2256,7 @@ static int fuse_dev_fasync(int fd, struct file *file, int on)
 		return -EPERM;
 
 	/* No locking - fasync_helper does its own locking */
-	return fasync_helper(fd, file, on, &fud->fc->iq.fasync);
+	return fasync_helper(fd, file, on, &fud->iq->fasync);
 }
 
 static int fuse_device_clone(struct fuse_conn *fc, struct file *new)
@@ -2186,6 +2276,40 @@ static int fuse_device_clone(struct fuse_conn *fc, struct file *new)
 	return 0;
 }
 
+/*
+ * Make the device read only the requests issued on @cpu.  The daemon
+ * thread reading it is expected to run on that CPU, and at least one
+ * unbound device must stay open for interrupts, forgets and requests
+ * from CPUs without a bound device.
+ */
+static int fuse_dev_bind_cpu(struct fuse_dev *fud, unsigned int cpu)
+{
+	struct fuse_conn *fc = fud->fc;
+	struct fuse_iqueue *fiq;
+	int err;
+
+	if (cpu >= nr_cpu_ids || !cpu_possible(cpu))
+		return -EINVAL;
+
+	err = fuse_conn_alloc_cpu_iq(fc);
+	if (err)
+		return err;
+
+	mutex_lock(&fuse_mutex);
+	err = -EBUSY;
+	if (fud->iq == &fc->iq) {
+		fiq = per_cpu_ptr(fc->cpu_iq, cpu);
+		spin_lock(&fiq->waitq.lock);
+		fiq->readers++;
+		spin_unlock(&fiq->waitq.lock);
+		WRITE_ONCE(fud->iq, fiq);
+		err = 0;
+	}
+	mutex_unlock(&fuse_mutex);
+
+	return err;
+}
+
 static long fuse_dev_ioctl(struct file *file, unsigned int cmd,
 			   unsigned long arg)
 {
@@ -2218,6 +2342,26 @@ static long fuse_dev_ioctl(struct file *file, unsigned int cmd,
 				fput(old);
 			}
 		}
+	} else if (cmd == FUSE_DEV_IOC_BIND_CPU) {
+		struct fuse_dev *fud = fuse_get_dev(file);
+		__u32 cpu;
+
+		err = -EPERM;
+		if (fud) {
+			err = -EFAULT;
+			if (!get_user(cpu, (__u32 __user *) arg))
+				err = fuse_dev_bind_cpu(fud, cpu);
+		}
+	} else if (cmd == FUSE_DEV_IOC_PASSTHROUGH_OPEN) {
+		struct fuse_dev *fud = fuse_get_dev(file);
+		__u32 fd;
+
+		err = -EPERM;
+		if (fud) {
+			err = -EFAULT;
+			if (!get_user(fd, (__u32 __user *) arg))
+				err = fuse_passthrough_open(fud->fc, fd);
+		}
 	}
 	return err;
 }
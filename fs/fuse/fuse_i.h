@@ -26,9 +26,13 @@
 #include <linux/xattr.h>
 #include <linux/pid_namespace.h>
 #include <linux/refcount.h>
+#include <linux/idr.h>
 
-/** Max number of pages that can be used in a single read request */
-#define FUSE_MAX_PAGES_PER_REQ 32
+/** Default max number of pages that can be used in a single read request */
+#define FUSE_DEFAULT_MAX_PAGES_PER_REQ 32
+
+/** Maximum of max_pages received in init_out */
+#define FUSE_MAX_MAX_PAGES 256
 
 /** Bias for fi->writectr, meaning new writepages must not be sent */
 #define FUSE_NOWRITE INT_MIN
@@ -153,10 +157,21 @@ struct fuse_file {
 	/** Wait queue head for poll */
 	wait_queue_head_t poll_wait;
 
+	/** Backing file, if read/write bypass the daemon */
+	struct fuse_passthrough passthrough;
+
 	/** Has flock been performed on this file? */
 	bool flock:1;
 };
 
+/** Backing file of a passthrough open */
+struct fuse_passthrough {
+	struct file *filp;
+
+	/** Credentials of the daemon that registered the file */
+	const struct cred *cred;
+};
+
 /** One input argument of a request */
 struct fuse_in_arg {
 	unsigned size;
@@ -307,6 +322,9 @@ struct fuse_req {
 	/** Entry on the interrupts list  */
 	struct list_head intr_entry;
 
+	/** Input queue the request was queued on */
+	struct fuse_iqueue *fiq;
+
 	/** refcount */
 	refcount_t count;
 
@@ -408,6 +426,9 @@ struct fuse_iqueue {
 
 	/** O_ASYNC requests */
 	struct fasync_struct *fasync;
+
+	/** Number of devices bound to this queue (per-CPU queues only) */
+	unsigned readers;
 };
 
 struct fuse_pqueue {
@@ -434,6 +455,9 @@ struct fuse_dev {
 	/** Processing queue */
 	struct fuse_pqueue pq;
 
+	/** Input queue read through this device */
+	struct fuse_iqueue *iq;
+
 	/** list entry on fc->devices */
 	struct list_head entry;
 };
@@ -472,9 +496,21 @@ struct fuse_conn {
 	/** Maximum write size */
 	unsigned max_write;
 
+	/** Maximum number of pages that can be used in a single request */
+	unsigned int max_pages;
+
 	/** Input queue */
 	struct fuse_iqueue iq;
 
+	/** Per-CPU input queues, allocated when a device is bound to a CPU */
+	struct fuse_iqueue __percpu *cpu_iq;
+
+	/** Backing files registered for passthrough, not yet opened */
+	struct idr passthrough_req;
+
+	/** Protects passthrough_req */
+	spinlock_t passthrough_req_lock;
+
 	/** The next unique kernel file handle */
 	u64 khctr;
 
@@ -621,6 +657,9 @@ struct fuse_conn {
 	/** Does the filesystem support posix acls? */
 	unsigned posix_acl:1;
 
+	/** Can opens pass read/write through to a backing file? */
+	unsigned passthrough:1;
+
 	/** Check permissions based on the file mode or not? */
 	unsigned default_permissions:1;
 
@@ -878,6 +917,7 @@ void fuse_conn_init(struct fuse_conn *fc);
 void fuse_conn_put(struct fuse_conn *fc);
 
 struct fuse_dev *fuse_dev_alloc(struct fuse_conn *fc);
+int fuse_conn_alloc_cpu_iq(struct fuse_conn *fc);
 void fuse_dev_free(struct fuse_dev *fud);
 
 /**
@@ -981,4 +1021,14 @@ struct posix_acl;
 struct posix_acl *fuse_get_acl(struct inode *inode, int type);
 int fuse_set_acl(struct inode *inode, struct posix_acl *acl, int type);
 
+/* passthrough.c */
+int fuse_passthrough_open(struct fuse_conn *fc, unsigned int fd);
+void fuse_passthrough_setup(struct fuse_conn *fc, struct fuse_file *ff,
+			    struct fuse_open_out *openarg);
+void fuse_passthrough_release(struct fuse_passthrough *passthrough);
+void fuse_passthrough_free_ids(struct fuse_conn *fc);
+ssize_t fuse_passthrough_read_iter(struct kiocb *iocb, struct iov_iter *to);
+ssize_t fuse_passthrough_write_iter(struct kiocb *iocb, struct iov_iter *from);
+int fuse_passthrough_mmap(struct file *file, struct vm_area_struct *vma);
+
 #endif /* _FS_FUSE_I_H */
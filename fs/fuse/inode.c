@@ -22,6 +22,7 @@
 #include <linux/exportfs.h>
 #include <linux/posix_acl.h>
 #include <linux/pid_namespace.h>
+#include <linux/percpu.h>
 
 MODULE_AUTHOR("Miklos Szeredi <miklos@szeredi.hu>");
 MODULE_DESCRIPTION("Filesystem in Userspace");
@@ -610,9 +611,12 @@ void fuse_conn_init(struct fuse_conn *fc)
 	INIT_LIST_HEAD(&fc->bg_queue);
 	INIT_LIST_HEAD(&fc->entry);
 	INIT_LIST_HEAD(&fc->devices);
+	idr_init(&fc->passthrough_req);
+	spin_lock_init(&fc->passthrough_req_lock);
 	atomic_set(&fc->num_waiting, 0);
 	fc->max_background = FUSE_DEFAULT_MAX_BACKGROUND;
 	fc->congestion_threshold = FUSE_DEFAULT_CONGESTION_THRESHOLD;
+	fc->max_pages = FUSE_DEFAULT_MAX_PAGES_PER_REQ;
 	fc->khctr = 0;
 	fc->polled_files = RB_ROOT;
 	fc->blocked = 0;
@@ -624,12 +628,52 @@ void fuse_conn_init(struct fuse_conn *fc)
 }
 EXPORT_SYMBOL_GPL(fuse_conn_init);
 
+/*
+ * Set up the per-CPU input queues on first use.  Unique ids are handed
+ * out with a stride of nr_cpu_ids + 1, the shared queue starting at 0
+ * and CPU n's queue at n + 1, so no two queues ever hand out the same id.
+ */
+int fuse_conn_alloc_cpu_iq(struct fuse_conn *fc)
+{
+	struct fuse_iqueue __percpu *cpu_iq;
+	int cpu;
+
+	if (READ_ONCE(fc->cpu_iq))
+		return 0;
+
+	cpu_iq = alloc_percpu(struct fuse_iqueue);
+	if (!cpu_iq)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		struct fuse_iqueue *fiq = per_cpu_ptr(cpu_iq, cpu);
+
+		fuse_iqueue_init(fiq);
+		fiq->reqctr = cpu + 1;
+	}
+
+	/* fuse_abort_conn() must either see the queues or never queue on them */
+	spin_lock(&fc->lock);
+	if (!fc->cpu_iq) {
+		for_each_possible_cpu(cpu)
+			per_cpu_ptr(cpu_iq, cpu)->connected = fc->connected;
+		smp_store_release(&fc->cpu_iq, cpu_iq);
+		cpu_iq = NULL;
+	}
+	spin_unlock(&fc->lock);
+	free_percpu(cpu_iq);
+
+	return 0;
+}
+
 void fuse_conn_put(struct fuse_conn *fc)
 {
 	if (refcount_dec_and_test(&fc->count)) {
 		if (fc->destroy_req)
 			fuse_request_free(fc->destroy_req);
 		put_pid_ns(fc->pid_ns);
+		free_percpu(fc->cpu_iq);
+		fuse_passthrough_free_ids(fc);
 		fc->release(fc);
 	}
 }
@@ -918,6 +962,17 @@ static void process_init_reply(struct fuse_conn *fc, struct fuse_req *req)
 				fc->posix_acl = 1;
 				fc->sb->s_xattr = fuse_acl_xattr_handlers;
 			}
+			if (arg->flags & FUSE_MAX_PAGES) {
+				fc->max_pages =
+					min_t(unsigned int, FUSE_MAX_MAX_PAGES,
+					max_t(unsigned int, arg->max_pages, 1));
+			}
+			if (arg->flags & FUSE_PASSTHROUGH) {
+				fc->passthrough = 1;
+				/* Backing files may not be fuse passthrough */
+				fc->sb->s_stack_depth =
+					FILESYSTEM_MAX_STACK_DEPTH;
+			}
 		} else {
 			ra_pages = fc->max_read / PAGE_SIZE;
 			fc->no_lock = 1;
@@ -948,7 +1003,8 @@ static void fuse_send_init(struct fuse_conn *fc, struct fuse_req *req)
 		FUSE_FLOCK_LOCKS | FUSE_HAS_IOCTL_DIR | FUSE_AUTO_INVAL_DATA |
 		FUSE_DO_READDIRPLUS | FUSE_READDIRPLUS_AUTO | FUSE_ASYNC_DIO |
 		FUSE_WRITEBACK_CACHE | FUSE_NO_OPEN_SUPPORT |
-		FUSE_PARALLEL_DIROPS | FUSE_HANDLE_KILLPRIV | FUSE_POSIX_ACL;
+		FUSE_PARALLEL_DIROPS | FUSE_HANDLE_KILLPRIV | FUSE_POSIX_ACL |
+		FUSE_PASSTHROUGH | FUSE_MAX_PAGES;
 	req->in.h.opcode = FUSE_INIT;
 	req->in.numargs = 1;
 	req->in.args[0].size = sizeof(*arg);
@@ -1010,6 +1066,7 @@ struct fuse_dev *fuse_dev_alloc(struct fuse_conn *fc)
 	fud = kzalloc(sizeof(struct fuse_dev), GFP_KERNEL);
 	if (fud) {
 		fud->fc = fuse_conn_get(fc);
+		fud->iq = &fc->iq;
 		fuse_pqueue_init(&fud->pq);
 
 		spin_lock(&fc->lock);
@@ -0,0 +1,228 @@
+/*
+ * FUSE: Filesystem in Userspace, read/write passthrough to a backing file
+ *
+ * Copyright (C) 2017 - Linaro Ltd
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include "fuse_i.h"
+
+#include <linux/file.h>
+#include <linux/idr.h>
+#include <linux/cred.h>
+#include <linux/uio.h>
+#include <linux/slab.h>
+
+/*
+ * Register @fd as a backing file.  The returned id is handed back by
+ * the daemon in fuse_open_out.passthrough_fh, which consumes it.
+ */
+int fuse_passthrough_open(struct fuse_conn *fc, unsigned int fd)
+{
+	struct fuse_passthrough *passthrough;
+	struct file *backing;
+	int id, err;
+
+	if (!fc->passthrough)
+		return -EPERM;
+
+	backing = fget(fd);
+	if (!backing)
+		return -EBADF;
+
+	err = -EINVAL;
+	if (!backing->f_op->read_iter || !backing->f_op->write_iter)
+		goto out_fput;
+
+	/* Don't let passthrough files nest, or be stacked on top of */
+	if (file_inode(backing)->i_sb->s_stack_depth >=
+	    FILESYSTEM_MAX_STACK_DEPTH)
+		goto out_fput;
+
+	err = -ENOMEM;
+	passthrough = kmalloc(sizeof(*passthrough), GFP_KERNEL);
+	if (!passthrough)
+		goto out_fput;
+
+	passthrough->filp = backing;
+	passthrough->cred = get_current_cred();
+
+	idr_preload(GFP_KERNEL);
+	spin_lock(&fc->passthrough_req_lock);
+	id = idr_alloc(&fc->passthrough_req, passthrough, 1, 0, GFP_ATOMIC);
+	spin_unlock(&fc->passthrough_req_lock);
+	idr_preload_end();
+
+	if (id > 0)
+		return id;
+
+	put_cred(passthrough->cred);
+	kfree(passthrough);
+	err = id;
+out_fput:
+	fput(backing);
+	return err;
+}
+
+/* Attach the backing file the daemon named in its open reply */
+void fuse_passthrough_setup(struct fuse_conn *fc, struct fuse_file *ff,
+			    struct fuse_open_out *openarg)
+{
+	struct fuse_passthrough *passthrough;
+
+	if (!fc->passthrough || !openarg->passthrough_fh)
+		return;
+
+	spin_lock(&fc->passthrough_req_lock);
+	passthrough = idr_remove(&fc->passthrough_req, openarg->passthrough_fh);
+	spin_unlock(&fc->passthrough_req_lock);
+
+	if (!passthrough)
+		return;
+
+	ff->passthrough = *passthrough;
+	kfree(passthrough);
+
+	/* The data path no longer goes through the daemon at all */
+	ff->open_flags &= ~FOPEN_DIRECT_IO;
+}
+
+void fuse_passthrough_release(struct fuse_passthrough *passthrough)
+{
+	if (passthrough->filp) {
+		fput(passthrough->filp);
+		passthrough->filp = NULL;
+	}
+	if (passthrough->cred) {
+		put_cred(passthrough->cred);
+		passthrough->cred = NULL;
+	}
+}
+
+static int fuse_passthrough_free_id(int id, void *p, void *data)
+{
+	struct fuse_passthrough *passthrough = p;
+
+	fuse_passthrough_release(passthrough);
+	kfree(passthrough);
+	return 0;
+}
+
+/* Drop the backing files registered but never claimed by an open */
+void fuse_passthrough_free_ids(struct fuse_conn *fc)
+{
+	idr_for_each(&fc->passthrough_req, fuse_passthrough_free_id, NULL);
+	idr_destroy(&fc->passthrough_req);
+}
+
+/* Mirror the size and times of the backing inode after I/O */
+static void fuse_passthrough_copyattr(struct inode *inode,
+				      struct file *backing)
+{
+	struct fuse_conn *fc = get_fuse_conn(inode);
+	struct inode *backing_inode = file_inode(backing);
+
+	spin_lock(&fc->lock);
+	inode->i_atime = backing_inode->i_atime;
+	inode->i_mtime = backing_inode->i_mtime;
+	inode->i_ctime = backing_inode->i_ctime;
+	i_size_write(inode, i_size_read(backing_inode));
+	spin_unlock(&fc->lock);
+}
+
+ssize_t fuse_passthrough_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct fuse_file *ff = iocb->ki_filp->private_data;
+	struct file *backing = ff->passthrough.filp;
+	const struct cred *old_cred;
+	ssize_t ret;
+
+	if (!(backing->f_mode & FMODE_READ))
+		return -EBADF;
+
+	if (!iov_iter_count(to))
+		return 0;
+
+	old_cred = override_creds(ff->passthrough.cred);
+	ret = vfs_iter_read(backing, to, &iocb->ki_pos);
+	revert_creds(old_cred);
+
+	if (ret >= 0)
+		fuse_passthrough_copyattr(file_inode(iocb->ki_filp), backing);
+
+	return ret;
+}
+
+ssize_t fuse_passthrough_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct file *file = iocb->ki_filp;
+	struct inode *inode = file_inode(file);
+	struct fuse_file *ff = file->private_data;
+	struct file *backing = ff->passthrough.filp;
+	const struct cred *old_cred;
+	ssize_t ret;
+
+	if (!(backing->f_mode & FMODE_WRITE))
+		return -EBADF;
+
+	if (!iov_iter_count(from))
+		return 0;
+
+	inode_lock(inode);
+	if (iocb->ki_flags & IOCB_APPEND)
+		iocb->ki_pos = i_size_read(file_inode(backing));
+
+	old_cred = override_creds(ff->passthrough.cred);
+	file_start_write(backing);
+	ret = vfs_iter_write(backing, from, &iocb->ki_pos);
+	file_end_write(backing);
+	revert_creds(old_cred);
+
+	fuse_passthrough_copyattr(inode, backing);
+	inode_unlock(inode);
+
+	/* Honour O_SYNC/O_DSYNC of the fuse file on the backing file */
+	if (ret > 0 && (iocb->ki_flags & IOCB_DSYNC)) {
+		int err = vfs_fsync_range(backing, iocb->ki_pos - ret,
+					  iocb->ki_pos - 1,
+					  !(iocb->ki_flags & IOCB_SYNC));
+		if (err)
+			ret = err;
+	}
+
+	return ret;
+}
+
+/* The mapping is of the backing file, the fuse page cache is not used */
+int fuse_passthrough_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct fuse_file *ff = file->private_data;
+	struct file *backing = ff->passthrough.filp;
+	const struct cred *old_cred;
+	int ret;
+
+	if (!backing->f_op->mmap)
+		return -ENODEV;
+
+	if (WARN_ON(file != vma->vm_file))
+		return -EIO;
+
+	vma->vm_file = get_file(backing);
+
+	old_cred = override_creds(ff->passthrough.cred);
+	ret = call_mmap(backing, vma);
+	revert_creds(old_cred);
+
+	if (ret) {
+		vma->vm_file = file;
+		fput(backing);
+	} else {
+		fput(file);
+	}
+
+	file_accessed(file);
+	return ret;
+}
@@ -141,6 +141,7 @@ extern int invalidate_inodes(struct super_block *, bool);
 extern struct dentry *__d_alloc(struct super_block *, const struct qstr *);
 extern int d_set_mounted(struct dentry *dentry);
 extern long prune_dcache_sb(struct super_block *sb, struct shrink_control *sc);
+extern void d_trim_negative_work(struct work_struct *work);
 extern struct dentry *d_alloc_cursor(struct dentry *);
 
 /*
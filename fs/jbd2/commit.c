@@ -362,8 +362,8 @@ void jbd2_journal_commit_transaction(journal_t *journal)
 	int flags;
 	int err;
 	unsigned long long blocknr;
-	ktime_t start_time;
-	u64 commit_time;
+	ktime_t start_time, flush_start;
+	u64 commit_time, flush_time;
 	char *tagp = NULL;
 	journal_block_tag_t *tag = NULL;
 	int space_left = 0;
@@ -866,6 +866,7 @@ void jbd2_journal_commit_transaction(journal_t *journal)
 	commit_transaction->t_state = T_COMMIT_JFLUSH;
 	write_unlock(&journal->j_state_lock);
 
+	flush_start = ktime_get();
 	if (!jbd2_has_feature_async_commit(journal)) {
 		err = journal_submit_commit_record(journal, commit_transaction,
 						&cbh, crc32_sum);
@@ -878,6 +879,7 @@ void jbd2_journal_commit_transaction(journal_t *journal)
 	    journal->j_flags & JBD2_BARRIER) {
 		blkdev_issue_flush(journal->j_dev, GFP_NOFS, NULL);
 	}
+	flush_time = ktime_to_ns(ktime_sub(ktime_get(), flush_start));
 
 	if (err)
 		jbd2_journal_abort(journal, err);
@@ -1098,6 +1100,12 @@ void jbd2_journal_commit_transaction(journal_t *journal)
 	else
 		journal->j_average_commit_time = commit_time;
 
+	if (likely(journal->j_average_flush_time))
+		journal->j_average_flush_time = (flush_time +
+				journal->j_average_flush_time*3) / 4;
+	else
+		journal->j_average_flush_time = flush_time;
+
 	write_unlock(&journal->j_state_lock);
 
 	if (journal->j_commit_callback)
@@ -1018,6 +1018,8 @@ static int jbd2_seq_info_show(struct seq_file *seq, void *v)
 	    jiffies_to_msecs(s->stats->run.rs_logging / s->stats->ts_tid));
 	seq_printf(seq, "  %lluus average transaction commit time\n",
 		   div_u64(s->journal->j_average_commit_time, 1000));
+	seq_printf(seq, "  %lluus average commit record flush time\n",
+		   div_u64(s->journal->j_average_flush_time, 1000));
 	seq_printf(seq, "  %lu handles per transaction\n",
 	    s->stats->run.rs_handle_count / s->stats->ts_tid);
 	seq_printf(seq, "  %lu blocks per transaction\n",
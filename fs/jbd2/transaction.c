@@ -1679,6 +1679,14 @@ int jbd2_journal_stop(handle_t *handle)
 	 * greatly helps super fast disks that would see slowdowns as
 	 * more threads started doing fsyncs.
 	 *
+	 * The commit time includes writing out the data and the log
+	 * blocks, which joiners add to rather than share; what a batch
+	 * saves is the commit record and its cache flush.  So once we
+	 * have measured it, that flush latency is what we wait for.
+	 * And if a commit is already in flight, ours cannot start
+	 * before it is done: joiners keep arriving meanwhile, and
+	 * sleeping would only add to our latency.
+	 *
 	 * But don't do this if this process was the most recent one
 	 * to perform a synchronous write.  We do this to detect the
 	 * case where a single process is doing a stream of sync
@@ -1690,11 +1698,14 @@ int jbd2_journal_stop(handle_t *handle)
 	if (handle->h_sync && journal->j_last_sync_writer != pid &&
 	    journal->j_max_batch_time) {
 		u64 commit_time, trans_time;
+		bool committing;
 
 		journal->j_last_sync_writer = pid;
 
 		read_lock(&journal->j_state_lock);
-		commit_time = journal->j_average_commit_time;
+		commit_time = journal->j_average_flush_time ?:
+			      journal->j_average_commit_time;
+		committing = journal->j_committing_transaction != NULL;
 		read_unlock(&journal->j_state_lock);
 
 		trans_time = ktime_to_ns(ktime_sub(ktime_get(),
@@ -1705,7 +1716,7 @@ int jbd2_journal_stop(handle_t *handle)
 		commit_time = min_t(u64, commit_time,
 				    1000*journal->j_max_batch_time);
 
-		if (trans_time < commit_time) {
+		if (!committing && trans_time < commit_time) {
 			ktime_t expires = ktime_add_ns(ktime_get(),
 						       commit_time);
 			set_current_state(TASK_UNINTERRUPTIBLE);
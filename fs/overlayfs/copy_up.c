@@ -208,6 +208,16 @@ static int ovl_set_timestamps(struct dentry *upperdentry, struct kstat *stat)
 	return notify_change(upperdentry, &attr, NULL);
 }
 
+static int ovl_set_size(struct dentry *upperdentry, struct kstat *stat)
+{
+	struct iattr attr = {
+		.ia_valid = ATTR_SIZE,
+		.ia_size = stat->size,
+	};
+
+	return notify_change(upperdentry, &attr, NULL);
+}
+
 int ovl_set_attr(struct dentry *upperdentry, struct kstat *stat)
 {
 	int err = 0;
@@ -309,7 +319,7 @@ static int ovl_set_origin(struct dentry *dentry, struct dentry *lower,
 static int ovl_copy_up_locked(struct dentry *workdir, struct dentry *upperdir,
 			      struct dentry *dentry, struct path *lowerpath,
 			      struct kstat *stat, const char *link,
-			      struct kstat *pstat, bool tmpfile)
+			      struct kstat *pstat, bool tmpfile, bool metacopy)
 {
 	struct inode *wdir = workdir->d_inode;
 	struct inode *udir = upperdir->d_inode;
@@ -359,7 +369,7 @@ static int ovl_copy_up_locked(struct dentry *workdir, struct dentry *upperdir,
 	if (err)
 		goto out2;
 
-	if (S_ISREG(stat->mode)) {
+	if (S_ISREG(stat->mode) && !metacopy) {
 		struct path upperpath;
 
 		ovl_path_upper(dentry, &upperpath);
@@ -385,11 +395,21 @@ static int ovl_copy_up_locked(struct dentry *workdir, struct dentry *upperdir,
 		goto out_cleanup;
 
 	inode_lock(temp->d_inode);
-	err = ovl_set_attr(temp, stat);
+	/* A sparse file of the right size stands in for the data */
+	if (metacopy)
+		err = ovl_set_size(temp, stat);
+	if (!err)
+		err = ovl_set_attr(temp, stat);
 	inode_unlock(temp->d_inode);
 	if (err)
 		goto out_cleanup;
 
+	if (metacopy) {
+		err = ovl_do_setxattr(temp, OVL_XATTR_METACOPY, NULL, 0, 0);
+		if (err)
+			goto out_cleanup;
+	}
+
 	/*
 	 * Store identifier of lower inode in upper inode xattr to
 	 * allow lookup of the copy up origin inode.
@@ -406,6 +426,11 @@ static int ovl_copy_up_locked(struct dentry *workdir, struct dentry *upperdir,
 		goto out_cleanup;
 
 	newdentry = dget(tmpfile ? upper : temp);
+	if (metacopy) {
+		struct ovl_entry *oe = dentry->d_fsdata;
+
+		oe->metacopy = true;
+	}
 	ovl_dentry_update(dentry, newdentry);
 	ovl_inode_update(d_inode(dentry), d_inode(newdentry));
 
@@ -424,6 +449,70 @@ static int ovl_copy_up_locked(struct dentry *workdir, struct dentry *upperdir,
 	goto out2;
 }
 
+/*
+ * Only copy up the inode and its attributes and leave the data on the lower
+ * file for as long as it isn't written to.  Reads keep hitting the page cache
+ * of the lower file, which is shared with all other users of that layer.
+ */
+static bool ovl_need_meta_copy_up(struct dentry *dentry, umode_t mode,
+				  int flags)
+{
+	struct ovl_fs *ofs = dentry->d_sb->s_fs_info;
+
+	if (!ofs->config.metacopy || !S_ISREG(mode))
+		return false;
+
+	if ((OPEN_FMODE(flags) & FMODE_WRITE) || (flags & O_TRUNC))
+		return false;
+
+	return true;
+}
+
+/* Copy up the data of a metacopy upper, in place */
+static int ovl_copy_up_meta_data(struct dentry *dentry, int flags)
+{
+	struct path lowerpath, upperpath;
+	struct kstat ustat;
+	loff_t len;
+	int err;
+
+	err = ovl_copy_up_start(dentry, true);
+	/* err < 0: interrupted, err > 0: raced with another copy-up */
+	if (unlikely(err))
+		return err < 0 ? err : 0;
+
+	ovl_path_lower(dentry, &lowerpath);
+	ovl_path_upper(dentry, &upperpath);
+
+	err = -EIO;
+	if (WARN_ON(!lowerpath.dentry))
+		goto out;
+
+	err = vfs_getattr(&upperpath, &ustat, STATX_SIZE | STATX_ATIME |
+			  STATX_MTIME, AT_STATX_SYNC_AS_STAT);
+	if (err)
+		goto out;
+
+	/* The data is about to be truncated away anyway */
+	len = (flags & O_TRUNC) ? 0 : ustat.size;
+	err = ovl_copy_up_data(&lowerpath, &upperpath, len);
+	if (err)
+		goto out;
+
+	inode_lock(d_inode(upperpath.dentry));
+	err = ovl_set_timestamps(upperpath.dentry, &ustat);
+	inode_unlock(d_inode(upperpath.dentry));
+	if (err)
+		goto out;
+
+	err = ovl_do_removexattr(upperpath.dentry, OVL_XATTR_METACOPY);
+	if (!err)
+		ovl_dentry_clear_metacopy(dentry);
+out:
+	ovl_copy_up_end(dentry);
+	return err;
+}
+
 /*
  * Copy up a single dentry
  *
@@ -434,7 +523,8 @@ static int ovl_copy_up_locked(struct dentry *workdir, struct dentry *upperdir,
  * the file will have already been copied up anyway.
  */
 static int ovl_copy_up_one(struct dentry *parent, struct dentry *dentry,
-			   struct path *lowerpath, struct kstat *stat)
+			   struct path *lowerpath, struct kstat *stat,
+			   int flags)
 {
 	DEFINE_DELAYED_CALL(done);
 	struct dentry *workdir = ovl_workdir(dentry);
@@ -445,6 +535,7 @@ static int ovl_copy_up_one(struct dentry *parent, struct dentry *dentry,
 	struct dentry *upperdir;
 	const char *link = NULL;
 	struct ovl_fs *ofs = dentry->d_sb->s_fs_info;
+	bool metacopy = ovl_need_meta_copy_up(dentry, stat->mode, flags);
 
 	if (WARN_ON(!workdir))
 		return -EROFS;
@@ -467,7 +558,7 @@ static int ovl_copy_up_one(struct dentry *parent, struct dentry *dentry,
 
 	/* Should we copyup with O_TMPFILE or with workdir? */
 	if (S_ISREG(stat->mode) && ofs->tmpfile) {
-		err = ovl_copy_up_start(dentry);
+		err = ovl_copy_up_start(dentry, false);
 		/* err < 0: interrupted, err > 0: raced with another copy-up */
 		if (unlikely(err)) {
 			pr_debug("ovl_copy_up_start(%pd2) = %i\n", dentry, err);
@@ -478,7 +569,7 @@ static int ovl_copy_up_one(struct dentry *parent, struct dentry *dentry,
 
 		inode_lock_nested(upperdir->d_inode, I_MUTEX_PARENT);
 		err = ovl_copy_up_locked(workdir, upperdir, dentry, lowerpath,
-					 stat, link, &pstat, true);
+					 stat, link, &pstat, true, metacopy);
 		inode_unlock(upperdir->d_inode);
 		ovl_copy_up_end(dentry);
 		goto out_done;
@@ -496,7 +587,7 @@ static int ovl_copy_up_one(struct dentry *parent, struct dentry *dentry,
 	}
 
 	err = ovl_copy_up_locked(workdir, upperdir, dentry, lowerpath,
-				 stat, link, &pstat, false);
+				 stat, link, &pstat, false, metacopy);
 out_unlock:
 	unlock_rename(workdir, upperdir);
 out_done:
@@ -540,11 +631,16 @@ int ovl_copy_up_flags(struct dentry *dentry, int flags)
 		if (flags & O_TRUNC)
 			stat.size = 0;
 		if (!err)
-			err = ovl_copy_up_one(parent, next, &lowerpath, &stat);
+			err = ovl_copy_up_one(parent, next, &lowerpath, &stat,
+					      flags);
 
 		dput(parent);
 		dput(next);
 	}
+
+	if (!err && ovl_dentry_has_metacopy(dentry) &&
+	    !ovl_need_meta_copy_up(dentry, d_inode(dentry)->i_mode, flags))
+		err = ovl_copy_up_meta_data(dentry, flags);
 	revert_creds(old_cred);
 
 	return err;
@@ -554,3 +650,8 @@ int ovl_copy_up(struct dentry *dentry)
 {
 	return ovl_copy_up_flags(dentry, 0);
 }
+
+int ovl_copy_up_with_data(struct dentry *dentry)
+{
+	return ovl_copy_up_flags(dentry, O_WRONLY);
+}
@@ -578,7 +578,8 @@ static int ovl_link(struct dentry *old, struct inode *newdir,
 	if (err)
 		goto out;
 
-	err = ovl_copy_up(old);
+	/* Metacopy data is found by name, a second name would lose it */
+	err = ovl_copy_up_with_data(old);
 	if (err)
 		goto out_drop_write;
 
@@ -901,7 +902,8 @@ static int ovl_rename(struct inode *olddir, struct dentry *old,
 	if (err)
 		goto out;
 
-	err = ovl_copy_up(old);
+	/* Metacopy data is found by name, so copy it up before the move */
+	err = ovl_copy_up_with_data(old);
 	if (err)
 		goto out_drop_write;
 
@@ -909,7 +911,7 @@ static int ovl_rename(struct inode *olddir, struct dentry *old,
 	if (err)
 		goto out_drop_write;
 	if (!overwrite) {
-		err = ovl_copy_up(new);
+		err = ovl_copy_up_with_data(new);
 		if (err)
 			goto out_drop_write;
 	}
@@ -37,7 +37,11 @@ int ovl_setattr(struct dentry *dentry, struct iattr *attr)
 	if (err)
 		goto out;
 
-	err = ovl_copy_up(dentry);
+	/* Truncate needs the data, other attributes are just metadata */
+	if (attr->ia_valid & ATTR_SIZE)
+		err = ovl_copy_up_with_data(dentry);
+	else
+		err = ovl_copy_up(dentry);
 	if (!err) {
 		upperdentry = ovl_dentry_upper(dentry);
 
@@ -126,6 +130,18 @@ int ovl_getattr(const struct path *path, struct kstat *stat,
 	if (is_dir && OVL_TYPE_MERGE(type))
 		stat->nlink = 1;
 
+	/* The upper of a metacopy is sparse, report the blocks of the data */
+	if ((request_mask & STATX_BLOCKS) && ovl_dentry_has_metacopy(dentry)) {
+		struct kstat lowerstat;
+
+		ovl_path_lower(dentry, &realpath);
+		err = vfs_getattr(&realpath, &lowerstat, STATX_BLOCKS, flags);
+		if (err)
+			goto out;
+
+		stat->blocks = lowerstat.blocks;
+	}
+
 out:
 	revert_creds(old_cred);
 
@@ -290,10 +306,11 @@ struct posix_acl *ovl_get_acl(struct inode *inode, int type)
 	return acl;
 }
 
-static bool ovl_open_need_copy_up(int flags, enum ovl_path_type type,
+static bool ovl_open_need_copy_up(struct dentry *dentry, int flags,
+				  enum ovl_path_type type,
 				  struct dentry *realdentry)
 {
-	if (OVL_TYPE_UPPER(type))
+	if (OVL_TYPE_UPPER(type) && !ovl_dentry_has_metacopy(dentry))
 		return false;
 
 	if (special_file(realdentry->d_inode->i_mode))
@@ -312,7 +329,7 @@ int ovl_open_maybe_copy_up(struct dentry *dentry, unsigned int file_flags)
 	enum ovl_path_type type;
 
 	type = ovl_path_real(dentry, &realpath);
-	if (ovl_open_need_copy_up(file_flags, type, realpath.dentry)) {
+	if (ovl_open_need_copy_up(dentry, file_flags, type, realpath.dentry)) {
 		err = ovl_want_write(dentry);
 		if (!err) {
 			err = ovl_copy_up_flags(dentry, file_flags);
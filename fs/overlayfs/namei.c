@@ -182,6 +182,24 @@ static bool ovl_is_opaquedir(struct dentry *dentry)
 	return false;
 }
 
+static bool ovl_is_metacopy(struct dentry *dentry)
+{
+	int res;
+
+	if (!d_is_reg(dentry))
+		return false;
+
+	res = vfs_getxattr(dentry, OVL_XATTR_METACOPY, NULL, 0);
+	if (res < 0) {
+		if (res != -ENODATA && res != -EOPNOTSUPP)
+			pr_warn_ratelimited("overlayfs: failed to get metacopy (%i)\n",
+					    res);
+		return false;
+	}
+
+	return true;
+}
+
 static int ovl_lookup_single(struct dentry *base, struct ovl_lookup_data *d,
 			     const char *name, unsigned int namelen,
 			     size_t prelen, const char *post,
@@ -352,6 +370,7 @@ struct dentry *ovl_lookup(struct inode *dir, struct dentry *dentry,
 	struct inode *inode = NULL;
 	bool upperopaque = false;
 	char *upperredirect = NULL;
+	bool metacopy = false;
 	struct dentry *this;
 	unsigned int i;
 	int err;
@@ -381,10 +400,16 @@ struct dentry *ovl_lookup(struct inode *dir, struct dentry *dentry,
 		}
 		if (upperdentry && !d.is_dir) {
 			BUG_ON(!d.stop || d.redirect);
-			err = ovl_check_origin(dentry, upperdentry,
-					       &stack, &ctr);
-			if (err)
-				goto out;
+			/* The data is in a lower layer, under the same name */
+			if (ovl_is_metacopy(upperdentry)) {
+				metacopy = true;
+				d.stop = false;
+			} else {
+				err = ovl_check_origin(dentry, upperdentry,
+						       &stack, &ctr);
+				if (err)
+					goto out;
+			}
 		}
 
 		if (d.redirect) {
@@ -416,6 +441,12 @@ struct dentry *ovl_lookup(struct inode *dir, struct dentry *dentry,
 		if (!this)
 			continue;
 
+		if (metacopy && !d_is_reg(this)) {
+			dput(this);
+			err = -EIO;
+			goto out_put;
+		}
+
 		stack[ctr].dentry = this;
 		stack[ctr].mnt = lowerpath.mnt;
 		ctr++;
@@ -435,6 +466,13 @@ struct dentry *ovl_lookup(struct inode *dir, struct dentry *dentry,
 		}
 	}
 
+	if (metacopy && !ctr) {
+		pr_warn_ratelimited("overlayfs: no lower data for metacopy (%pd2)\n",
+				    dentry);
+		err = -EIO;
+		goto out_put;
+	}
+
 	oe = ovl_alloc_entry(ctr);
 	err = -ENOMEM;
 	if (!oe)
@@ -463,6 +501,7 @@ struct dentry *ovl_lookup(struct inode *dir, struct dentry *dentry,
 
 	revert_creds(old_cred);
 	oe->opaque = upperopaque;
+	oe->metacopy = metacopy;
 	oe->redirect = upperredirect;
 	oe->__upperdentry = upperdentry;
 	memcpy(oe->lowerstack, stack, sizeof(struct path) * ctr);
@@ -14,6 +14,7 @@ struct ovl_config {
 	char *workdir;
 	bool default_permissions;
 	bool redirect_dir;
+	bool metacopy;
 };
 
 /* private information held for overlayfs's superblock */
@@ -43,6 +44,7 @@ struct ovl_entry {
 			const char *redirect;
 			bool opaque;
 			bool copying;
+			bool metacopy;	/* upper has no data yet */
 		};
 		struct rcu_head rcu;
 	};
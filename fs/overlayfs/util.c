@@ -274,7 +274,30 @@ struct file *ovl_path_open(struct path *path, int flags)
 	return dentry_open(path, flags | O_NOATIME, current_cred());
 }
 
-int ovl_copy_up_start(struct dentry *dentry)
+/*
+ * A metacopy upper holds the attributes of the file, but its data is still
+ * read from the lower file until the first open for write copies it up.
+ */
+bool ovl_dentry_has_metacopy(struct dentry *dentry)
+{
+	struct ovl_entry *oe = dentry->d_fsdata;
+
+	return smp_load_acquire(&oe->metacopy);
+}
+
+void ovl_dentry_clear_metacopy(struct dentry *dentry)
+{
+	struct ovl_entry *oe = dentry->d_fsdata;
+
+	/* Data copied up must be visible before lower data is dropped */
+	smp_store_release(&oe->metacopy, false);
+}
+
+/*
+ * Returns 1 if there is nothing left to copy up, either because the file is
+ * already upper, or because it is metacopy upper and !@data.
+ */
+int ovl_copy_up_start(struct dentry *dentry, bool data)
 {
 	struct ovl_fs *ofs = dentry->d_sb->s_fs_info;
 	struct ovl_entry *oe = dentry->d_fsdata;
@@ -283,7 +306,7 @@ int ovl_copy_up_start(struct dentry *dentry)
 	spin_lock(&ofs->copyup_wq.lock);
 	err = wait_event_interruptible_locked(ofs->copyup_wq, !oe->copying);
 	if (!err) {
-		if (oe->__upperdentry)
+		if (oe->__upperdentry && !(data && oe->metacopy))
 			err = 1; /* Already copied up */
 		else
 			oe->copying = true;
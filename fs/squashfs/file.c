@@ -38,6 +38,11 @@
  * Larger files use multiple slots, with 1.75 TiB files using all 8 slots.
  * The index cache is designed to be memory efficient, and by default uses
  * 16 KiB.
+ *
+ * Readahead batches the pages of the readahead window by datablock, and
+ * each datablock is read and decompressed by a separate work item, so
+ * that several can be decompressed in parallel on different CPUs when
+ * the decompressor allows it.
  */
 
 #include <linux/fs.h>
@@ -46,7 +51,9 @@
 #include <linux/slab.h>
 #include <linux/string.h>
 #include <linux/pagemap.h>
+#include <linux/mm_inline.h>
 #include <linux/mutex.h>
+#include <linux/workqueue.h>
 
 #include "squashfs_fs.h"
 #include "squashfs_fs_sb.h"
@@ -497,7 +504,141 @@ static int squashfs_readpage(struct file *file, struct page *page)
 	return 0;
 }
 
+/* The pages of a readahead window that fall into one datablock */
+struct squashfs_ra_block {
+	struct work_struct work;
+	struct inode *inode;
+	int index;
+	int nr_pages;
+	struct page *page[0];
+};
+
+static void squashfs_ra_read(struct squashfs_ra_block *rab)
+{
+	struct inode *inode = rab->inode;
+	struct squashfs_sb_info *msblk = inode->i_sb->s_fs_info;
+	int mask = (1 << (msblk->block_log - PAGE_SHIFT)) - 1;
+	int file_end = i_size_read(inode) >> msblk->block_log;
+	struct squashfs_cache_entry *buffer = NULL;
+	int i, bytes = 0, offset = 0, res = 0;
+	void *pageaddr;
+
+	if (rab->index < file_end || squashfs_i(inode)->fragment_block ==
+					SQUASHFS_INVALID_BLK) {
+		u64 block = 0;
+		int bsize = read_blocklist(inode, rab->index, &block);
+
+		if (bsize < 0)
+			res = bsize;
+		else if (bsize) {
+			buffer = squashfs_get_datablock(inode->i_sb, block,
+							bsize);
+			bytes = buffer->length;
+		}
+	} else {
+		buffer = squashfs_get_fragment(inode->i_sb,
+			squashfs_i(inode)->fragment_block,
+			squashfs_i(inode)->fragment_size);
+		bytes = i_size_read(inode) & (msblk->block_size - 1);
+		offset = squashfs_i(inode)->fragment_offset;
+	}
+
+	if (buffer && buffer->error)
+		res = buffer->error;
+
+	for (i = 0; i < rab->nr_pages; i++) {
+		struct page *page = rab->page[i];
+		int start = (page->index & mask) << PAGE_SHIFT;
+		int avail = clamp(bytes - start, 0, (int)PAGE_SIZE);
+
+		if (res) {
+			SetPageError(page);
+			continue;
+		}
+
+		pageaddr = kmap_atomic(page);
+		squashfs_copy_data(pageaddr, buffer, offset + start, avail);
+		memset(pageaddr + avail, 0, PAGE_SIZE - avail);
+		kunmap_atomic(pageaddr);
+		flush_dcache_page(page);
+		SetPageUptodate(page);
+	}
+
+	/*
+	 * Drop the cache entry before unlocking the pages: once they are
+	 * unlocked nothing stops the inode and the filesystem going away.
+	 */
+	if (buffer)
+		squashfs_cache_put(buffer);
+
+	for (i = 0; i < rab->nr_pages; i++) {
+		unlock_page(rab->page[i]);
+		put_page(rab->page[i]);
+	}
+
+	kfree(rab);
+}
+
+static void squashfs_ra_work(struct work_struct *work)
+{
+	squashfs_ra_read(container_of(work, struct squashfs_ra_block, work));
+}
+
+static int squashfs_readpages(struct file *file, struct address_space *mapping,
+	struct list_head *pages, unsigned int nr_pages)
+{
+	struct inode *inode = mapping->host;
+	struct squashfs_sb_info *msblk = inode->i_sb->s_fs_info;
+	int shift = msblk->block_log - PAGE_SHIFT;
+	gfp_t gfp = readahead_gfp_mask(mapping);
+	struct squashfs_ra_block *rab = NULL;
+	struct page *page;
+
+	TRACE("Entered squashfs_readpages, %u pages, start block %llx\n",
+				nr_pages, squashfs_i(inode)->start);
+
+	/* Pages come in ascending index order */
+	while (!list_empty(pages)) {
+		page = lru_to_page(pages);
+		list_del(&page->lru);
+		if (add_to_page_cache_lru(page, mapping, page->index, gfp)) {
+			put_page(page);
+			continue;
+		}
+
+		if (rab && rab->index != page->index >> shift) {
+			queue_work(system_unbound_wq, &rab->work);
+			rab = NULL;
+		}
+
+		if (rab == NULL) {
+			rab = kmalloc(sizeof(*rab) + (sizeof(struct page *) <<
+					shift), GFP_KERNEL);
+			if (rab == NULL) {
+				/* leave the page for ->readpage() */
+				unlock_page(page);
+				put_page(page);
+				continue;
+			}
+
+			INIT_WORK(&rab->work, squashfs_ra_work);
+			rab->inode = inode;
+			rab->index = page->index >> shift;
+			rab->nr_pages = 0;
+		}
+
+		rab->page[rab->nr_pages++] = page;
+	}
+
+	/* The last datablock is read here, the others in parallel with it */
+	if (rab)
+		squashfs_ra_read(rab);
+
+	return 0;
+}
+
 
 const struct address_space_operations squashfs_aops = {
-	.readpage = squashfs_readpage
+	.readpage = squashfs_readpage,
+	.readpages = squashfs_readpages
 };
@@ -164,6 +164,7 @@ static void destroy_super(struct super_block *s)
 {
 	list_lru_destroy(&s->s_dentry_lru);
 	list_lru_destroy(&s->s_inode_lru);
+	percpu_counter_destroy(&s->s_nr_negative);
 	security_sb_free(s);
 	WARN_ON(!list_empty(&s->s_mounts));
 	put_user_ns(s->s_user_ns);
@@ -220,6 +221,9 @@ static struct super_block *alloc_super(struct file_system_type *type, int flags,
 		goto fail;
 	if (list_lru_init_memcg(&s->s_inode_lru))
 		goto fail;
+	if (percpu_counter_init(&s->s_nr_negative, 0, GFP_KERNEL))
+		goto fail;
+	INIT_WORK(&s->s_negative_trim_work, d_trim_negative_work);
 
 	init_rwsem(&s->s_umount);
 	lockdep_set_class(&s->s_umount, &type->s_umount_key);
@@ -441,6 +445,8 @@ void generic_shutdown_super(struct super_block *sb)
 			   sb->s_id);
 		}
 	}
+	/* All dentries are gone, nothing can queue it again */
+	cancel_work_sync(&sb->s_negative_trim_work);
 	spin_lock(&sb_lock);
 	/* should be initialized for __put_super_and_need_restart() */
 	hlist_del_init(&sb->s_instances);
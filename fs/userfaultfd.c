@@ -29,6 +29,7 @@
 #include <linux/ioctl.h>
 #include <linux/security.h>
 #include <linux/hugetlb.h>
+#include <linux/uio.h>
 
 static struct kmem_cache *userfaultfd_ctx_cachep __read_mostly;
 
@@ -205,6 +206,8 @@ static inline struct uffd_msg userfault_msg(unsigned long address,
 		 * write protect fault.
 		 */
 		msg.arg.pagefault.flags |= UFFD_PAGEFAULT_FLAG_WP;
+	if (reason & VM_UFFD_MINOR)
+		msg.arg.pagefault.flags |= UFFD_PAGEFAULT_FLAG_MINOR;
 	return msg;
 }
 
@@ -349,8 +352,8 @@ int handle_userfault(struct vm_fault *vmf, unsigned long reason)
 
 	BUG_ON(ctx->mm != mm);
 
-	VM_BUG_ON(reason & ~(VM_UFFD_MISSING|VM_UFFD_WP));
-	VM_BUG_ON(!(reason & VM_UFFD_MISSING) ^ !!(reason & VM_UFFD_WP));
+	VM_BUG_ON(reason & ~__VM_UFFD_FLAGS);
+	VM_BUG_ON(hweight_long(reason) != 1);
 
 	/*
 	 * If it's already released don't get it. This avoids to loop
@@ -597,7 +600,7 @@ int dup_userfaultfd(struct vm_area_struct *vma, struct list_head *fcs)
 	octx = vma->vm_userfaultfd_ctx.ctx;
 	if (!octx || !(octx->features & UFFD_FEATURE_EVENT_FORK)) {
 		vma->vm_userfaultfd_ctx = NULL_VM_UFFD_CTX;
-		vma->vm_flags &= ~(VM_UFFD_WP | VM_UFFD_MISSING);
+		vma->vm_flags &= ~__VM_UFFD_FLAGS;
 		return 0;
 	}
 
@@ -807,12 +810,12 @@ static int userfaultfd_release(struct inode *inode, struct file *file)
 	for (vma = mm->mmap; vma; vma = vma->vm_next) {
 		cond_resched();
 		BUG_ON(!!vma->vm_userfaultfd_ctx.ctx ^
-		       !!(vma->vm_flags & (VM_UFFD_MISSING | VM_UFFD_WP)));
+		       !!(vma->vm_flags & __VM_UFFD_FLAGS));
 		if (vma->vm_userfaultfd_ctx.ctx != ctx) {
 			prev = vma;
 			continue;
 		}
-		new_flags = vma->vm_flags & ~(VM_UFFD_MISSING | VM_UFFD_WP);
+		new_flags = vma->vm_flags & ~__VM_UFFD_FLAGS;
 		prev = vma_merge(mm, prev, vma->vm_start, vma->vm_end,
 				 new_flags, vma->anon_vma,
 				 vma->vm_file, vma->vm_pgoff,
@@ -1099,25 +1102,27 @@ static ssize_t userfaultfd_read(struct file *file, char __user *buf,
 }
 
 static void __wake_userfault(struct userfaultfd_ctx *ctx,
-			     struct userfaultfd_wake_range *range)
+			     struct userfaultfd_wake_range *ranges,
+			     unsigned int nr)
 {
-	unsigned long start, end;
-
-	start = range->start;
-	end = range->start + range->len;
+	unsigned int i;
 
 	spin_lock(&ctx->fault_pending_wqh.lock);
-	/* wake all in the range and autoremove */
-	if (waitqueue_active(&ctx->fault_pending_wqh))
-		__wake_up_locked_key(&ctx->fault_pending_wqh, TASK_NORMAL,
-				     range);
-	if (waitqueue_active(&ctx->fault_wqh))
-		__wake_up_locked_key(&ctx->fault_wqh, TASK_NORMAL, range);
+	/* wake all in the ranges and autoremove */
+	for (i = 0; i < nr; i++) {
+		if (waitqueue_active(&ctx->fault_pending_wqh))
+			__wake_up_locked_key(&ctx->fault_pending_wqh,
+					     TASK_NORMAL, &ranges[i]);
+		if (waitqueue_active(&ctx->fault_wqh))
+			__wake_up_locked_key(&ctx->fault_wqh, TASK_NORMAL,
+					     &ranges[i]);
+	}
 	spin_unlock(&ctx->fault_pending_wqh.lock);
 }
 
-static __always_inline void wake_userfault(struct userfaultfd_ctx *ctx,
-					   struct userfaultfd_wake_range *range)
+static __always_inline void wake_userfault_ranges(struct userfaultfd_ctx *ctx,
+					struct userfaultfd_wake_range *ranges,
+					unsigned int nr)
 {
 	unsigned seq;
 	bool need_wakeup;
@@ -1144,7 +1149,13 @@ static __always_inline void wake_userfault(struct userfaultfd_ctx *ctx,
 		cond_resched();
 	} while (read_seqcount_retry(&ctx->refile_seq, seq));
 	if (need_wakeup)
-		__wake_userfault(ctx, range);
+		__wake_userfault(ctx, ranges, nr);
+}
+
+static __always_inline void wake_userfault(struct userfaultfd_ctx *ctx,
+					   struct userfaultfd_wake_range *range)
+{
+	wake_userfault_ranges(ctx, range, 1);
 }
 
 static __always_inline int validate_range(struct mm_struct *mm,
@@ -1197,7 +1208,8 @@ static int userfaultfd_register(struct userfaultfd_ctx *ctx,
 	if (!uffdio_register.mode)
 		goto out;
 	if (uffdio_register.mode & ~(UFFDIO_REGISTER_MODE_MISSING|
-				     UFFDIO_REGISTER_MODE_WP))
+				     UFFDIO_REGISTER_MODE_WP|
+				     UFFDIO_REGISTER_MODE_MINOR))
 		goto out;
 	vm_flags = 0;
 	if (uffdio_register.mode & UFFDIO_REGISTER_MODE_MISSING)
@@ -1211,6 +1223,8 @@ static int userfaultfd_register(struct userfaultfd_ctx *ctx,
 		ret = -EINVAL;
 		goto out;
 	}
+	if (uffdio_register.mode & UFFDIO_REGISTER_MODE_MINOR)
+		vm_flags |= VM_UFFD_MINOR;
 
 	ret = validate_range(mm, uffdio_register.range.start,
 			     uffdio_register.range.len);
@@ -1254,12 +1268,15 @@ static int userfaultfd_register(struct userfaultfd_ctx *ctx,
 		cond_resched();
 
 		BUG_ON(!!cur->vm_userfaultfd_ctx.ctx ^
-		       !!(cur->vm_flags & (VM_UFFD_MISSING | VM_UFFD_WP)));
+		       !!(cur->vm_flags & __VM_UFFD_FLAGS));
 
 		/* check not compatible vmas */
 		ret = -EINVAL;
 		if (!vma_can_userfault(cur))
 			goto out_unlock;
+		/* only shmem has page cache pages to map on minor faults */
+		if ((vm_flags & VM_UFFD_MINOR) && !vma_is_shmem(cur))
+			goto out_unlock;
 		/*
 		 * If this vma contains ending address, and huge pages
 		 * check alignment.
@@ -1343,8 +1360,10 @@ static int userfaultfd_register(struct userfaultfd_ctx *ctx,
 		 * the next vma was merged into the current one and
 		 * the current one has not been updated yet.
 		 */
+		vm_write_begin(vma);
 		vma->vm_flags = new_flags;
 		vma->vm_userfaultfd_ctx.ctx = ctx;
+		vm_write_end(vma);
 
 	skip:
 		prev = vma;
@@ -1355,14 +1374,18 @@ static int userfaultfd_register(struct userfaultfd_ctx *ctx,
 	up_write(&mm->mmap_sem);
 	mmput(mm);
 	if (!ret) {
+		__u64 ioctls_out;
+
 		/*
 		 * Now that we scanned all vmas we can already tell
 		 * userland which ioctls methods are guaranteed to
 		 * succeed on this range.
 		 */
-		if (put_user(non_anon_pages ? UFFD_API_RANGE_IOCTLS_BASIC :
-			     UFFD_API_RANGE_IOCTLS,
-			     &user_uffdio_register->ioctls))
+		ioctls_out = non_anon_pages ? UFFD_API_RANGE_IOCTLS_BASIC :
+			     UFFD_API_RANGE_IOCTLS;
+		if (!(uffdio_register.mode & UFFDIO_REGISTER_MODE_MINOR))
+			ioctls_out &= ~((__u64)1 << _UFFDIO_CONTINUE);
+		if (put_user(ioctls_out, &user_uffdio_register->ioctls))
 			ret = -EFAULT;
 	}
 out:
@@ -1427,7 +1450,7 @@ static int userfaultfd_unregister(struct userfaultfd_ctx *ctx,
 		cond_resched();
 
 		BUG_ON(!!cur->vm_userfaultfd_ctx.ctx ^
-		       !!(cur->vm_flags & (VM_UFFD_MISSING | VM_UFFD_WP)));
+		       !!(cur->vm_flags & __VM_UFFD_FLAGS));
 
 		/*
 		 * Check not compatible vmas, not strictly required
@@ -1463,7 +1486,7 @@ static int userfaultfd_unregister(struct userfaultfd_ctx *ctx,
 			start = vma->vm_start;
 		vma_end = min(end, vma->vm_end);
 
-		if (userfaultfd_missing(vma)) {
+		if (userfaultfd_missing(vma) || userfaultfd_minor(vma)) {
 			/*
 			 * Wake any concurrent pending userfault while
 			 * we unregister, so they will not hang
@@ -1476,7 +1499,7 @@ static int userfaultfd_unregister(struct userfaultfd_ctx *ctx,
 			wake_userfault(vma->vm_userfaultfd_ctx.ctx, &range);
 		}
 
-		new_flags = vma->vm_flags & ~(VM_UFFD_MISSING | VM_UFFD_WP);
+		new_flags = vma->vm_flags & ~__VM_UFFD_FLAGS;
 		prev = vma_merge(mm, prev, start, vma_end, new_flags,
 				 vma->anon_vma, vma->vm_file, vma->vm_pgoff,
 				 vma_policy(vma),
@@ -1649,6 +1672,133 @@ static int userfaultfd_zeropage(struct userfaultfd_ctx *ctx,
 	return ret;
 }
 
+/* Ranges copied by UFFDIO_COPYV between two wakeups of the faulting threads */
+#define UFFDIO_COPYV_WAKE_BATCH		16
+
+static int userfaultfd_copyv(struct userfaultfd_ctx *ctx,
+			     unsigned long arg)
+{
+	__s64 ret;
+	struct uffdio_copyv uffdio_copyv;
+	struct uffdio_copyv __user *user_uffdio_copyv;
+	struct uffdio_copy_iov __user *user_iov;
+	struct uffdio_copy_iov iov;
+	struct userfaultfd_wake_range ranges[UFFDIO_COPYV_WAKE_BATCH];
+	unsigned int nr_ranges = 0;
+	__s64 copied = 0;
+	__u64 i;
+
+	user_uffdio_copyv = (struct uffdio_copyv __user *) arg;
+
+	ret = -EFAULT;
+	if (copy_from_user(&uffdio_copyv, user_uffdio_copyv,
+			   /* don't copy "copy" last field */
+			   sizeof(uffdio_copyv)-sizeof(__s64)))
+		goto out;
+
+	ret = -EINVAL;
+	if (!uffdio_copyv.iovcnt || uffdio_copyv.iovcnt > UIO_MAXIOV)
+		goto out;
+	if (uffdio_copyv.mode & ~UFFDIO_COPYV_MODE_DONTWAKE)
+		goto out;
+	user_iov = u64_to_user_ptr(uffdio_copyv.iov);
+
+	if (!mmget_not_zero(ctx->mm))
+		return -ENOSPC;
+
+	for (i = 0; i < uffdio_copyv.iovcnt; i++) {
+		ret = -EFAULT;
+		if (copy_from_user(&iov, user_iov + i, sizeof(iov)))
+			break;
+
+		ret = validate_range(ctx->mm, iov.dst, iov.len);
+		if (ret)
+			break;
+		/* as in userfaultfd_copy() */
+		ret = -EINVAL;
+		if (iov.src + iov.len <= iov.src)
+			break;
+
+		ret = mcopy_atomic(ctx->mm, iov.dst, iov.src, iov.len);
+		if (ret < 0)
+			break;
+		BUG_ON(!ret);
+		copied += ret;
+
+		ranges[nr_ranges].start = iov.dst;
+		ranges[nr_ranges].len = ret;
+		if (++nr_ranges == UFFDIO_COPYV_WAKE_BATCH) {
+			if (!(uffdio_copyv.mode & UFFDIO_COPYV_MODE_DONTWAKE))
+				wake_userfault_ranges(ctx, ranges, nr_ranges);
+			nr_ranges = 0;
+		}
+
+		if (ret != iov.len) {
+			ret = -EAGAIN;
+			break;
+		}
+		ret = 0;
+	}
+	mmput(ctx->mm);
+
+	if (nr_ranges && !(uffdio_copyv.mode & UFFDIO_COPYV_MODE_DONTWAKE))
+		wake_userfault_ranges(ctx, ranges, nr_ranges);
+
+	if (unlikely(put_user(copied ? copied : ret, &user_uffdio_copyv->copy)))
+		return -EFAULT;
+	if (ret && copied)
+		ret = -EAGAIN;
+out:
+	return ret;
+}
+
+static int userfaultfd_continue(struct userfaultfd_ctx *ctx,
+				unsigned long arg)
+{
+	__s64 ret;
+	struct uffdio_continue uffdio_continue;
+	struct uffdio_continue __user *user_uffdio_continue;
+	struct userfaultfd_wake_range range;
+
+	user_uffdio_continue = (struct uffdio_continue __user *) arg;
+
+	ret = -EFAULT;
+	if (copy_from_user(&uffdio_continue, user_uffdio_continue,
+			   /* don't copy "mapped" last field */
+			   sizeof(uffdio_continue)-sizeof(__s64)))
+		goto out;
+
+	ret = validate_range(ctx->mm, uffdio_continue.range.start,
+			     uffdio_continue.range.len);
+	if (ret)
+		goto out;
+	ret = -EINVAL;
+	if (uffdio_continue.mode & ~UFFDIO_CONTINUE_MODE_DONTWAKE)
+		goto out;
+
+	if (mmget_not_zero(ctx->mm)) {
+		ret = mcontinue_atomic(ctx->mm, uffdio_continue.range.start,
+				       uffdio_continue.range.len);
+		mmput(ctx->mm);
+	} else {
+		return -ENOSPC;
+	}
+	if (unlikely(put_user(ret, &user_uffdio_continue->mapped)))
+		return -EFAULT;
+	if (ret < 0)
+		goto out;
+	/* len == 0 would wake all */
+	BUG_ON(!ret);
+	range.len = ret;
+	if (!(uffdio_continue.mode & UFFDIO_CONTINUE_MODE_DONTWAKE)) {
+		range.start = uffdio_continue.range.start;
+		wake_userfault(ctx, &range);
+	}
+	ret = range.len == uffdio_continue.range.len ? 0 : -EAGAIN;
+out:
+	return ret;
+}
+
 static inline unsigned int uffd_ctx_features(__u64 user_features)
 {
 	/*
@@ -1726,6 +1876,12 @@ static long userfaultfd_ioctl(struct file *file, unsigned cmd,
 	case UFFDIO_ZEROPAGE:
 		ret = userfaultfd_zeropage(ctx, arg);
 		break;
+	case UFFDIO_COPYV:
+		ret = userfaultfd_copyv(ctx, arg);
+		break;
+	case UFFDIO_CONTINUE:
+		ret = userfaultfd_continue(ctx, arg);
+		break;
 	}
 	return ret;
 }
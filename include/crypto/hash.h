@@ -162,11 +162,15 @@ struct shash_desc {
  * @export: see struct ahash_alg
  * @import: see struct ahash_alg
  * @setkey: see struct ahash_alg
+ * @finup_mb: Finish the hashing of several messages of the same length, each
+ *	      starting from the state in @desc, which is left unchanged. May
+ *	      return -EOPNOTSUPP for the caller to fall back to @finup.
  * @digestsize: see struct ahash_alg
  * @statesize: see struct ahash_alg
  * @descsize: Size of the operational state for the message digest. This state
  * 	      size is the memory size that needs to be allocated for
  *	      shash_desc.__ctx
+ * @mb_max_msgs: Number of messages @finup_mb handles at most, 1 if not set.
  * @base: internally used
  */
 struct shash_alg {
@@ -182,8 +186,12 @@ struct shash_alg {
 	int (*import)(struct shash_desc *desc, const void *in);
 	int (*setkey)(struct crypto_shash *tfm, const u8 *key,
 		      unsigned int keylen);
+	int (*finup_mb)(struct shash_desc *desc, const u8 * const data[],
+			unsigned int len, u8 * const outs[],
+			unsigned int num_msgs);
 
 	unsigned int descsize;
+	unsigned int mb_max_msgs;
 
 	/* These fields must match hash_alg_common. */
 	unsigned int digestsize
@@ -750,6 +758,17 @@ static inline unsigned int crypto_shash_statesize(struct crypto_shash *tfm)
 	return crypto_shash_alg(tfm)->statesize;
 }
 
+/**
+ * crypto_shash_mb_max_msgs() - obtain the multi-buffer hashing width
+ * @tfm: cipher handle
+ *
+ * Return: the number of messages crypto_shash_finup_mb() hashes at once
+ */
+static inline unsigned int crypto_shash_mb_max_msgs(struct crypto_shash *tfm)
+{
+	return crypto_shash_alg(tfm)->mb_max_msgs;
+}
+
 static inline u32 crypto_shash_get_flags(struct crypto_shash *tfm)
 {
 	return crypto_tfm_get_flags(crypto_shash_tfm(tfm));
@@ -916,6 +935,25 @@ int crypto_shash_final(struct shash_desc *desc, u8 *out);
 int crypto_shash_finup(struct shash_desc *desc, const u8 *data,
 		       unsigned int len, u8 *out);
 
+/**
+ * crypto_shash_finup_mb() - finish the hashing of several messages
+ * @desc: operational state handle, common to all the messages
+ * @data: the messages
+ * @len: the length of each message
+ * @outs: output buffers, one per message
+ * @num_msgs: number of messages
+ *
+ * This is crypto_shash_finup() on a copy of @desc for each message, but lets
+ * an implementation interleave the hashing of up to
+ * crypto_shash_mb_max_msgs() messages. @desc is left unchanged.
+ *
+ * Return: 0 if the message digest creation was successful; < 0 if an error
+ *	   occurred
+ */
+int crypto_shash_finup_mb(struct shash_desc *desc, const u8 * const data[],
+			  unsigned int len, u8 * const outs[],
+			  unsigned int num_msgs);
+
 static inline void shash_desc_zero(struct shash_desc *desc)
 {
 	memzero_explicit(desc,
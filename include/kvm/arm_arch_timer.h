@@ -42,6 +42,20 @@ struct arch_timer_cpu {
 	struct arch_timer_context	vtimer;
 	struct arch_timer_context	ptimer;
 
+	/* EL2 physical timer of a guest hypervisor, always emulated */
+	struct arch_timer_context	hptimer;
+
+	/*
+	 * EL2 virtual timer of a VHE guest hypervisor. It takes the place of
+	 * vtimer in the hardware EL1 virtual timer while the vcpu runs in
+	 * the virtual EL2, and vtimer is then emulated instead.
+	 */
+	struct arch_timer_context	hvtimer;
+	bool				hvtimer_loaded;
+
+	/* The hwirq of the host virtual timer, for mapping it to a vcpu IRQ */
+	int				phys_irq;
+
 	/* Background timer used when the guest is not running */
 	struct hrtimer			timer;
 
@@ -51,6 +65,9 @@ struct arch_timer_cpu {
 	/* Background timer active */
 	bool				armed;
 
+	/* Physical count the background timer is armed for, if emulating */
+	u64				emul_cval;
+
 	/* Is the timer enabled */
 	bool			enabled;
 };
@@ -73,6 +90,7 @@ int kvm_arm_timer_get_attr(struct kvm_vcpu *vcpu, struct kvm_device_attr *attr);
 int kvm_arm_timer_has_attr(struct kvm_vcpu *vcpu, struct kvm_device_attr *attr);
 
 bool kvm_timer_should_fire(struct kvm_vcpu *vcpu, struct arch_timer_context *timer_ctx);
+bool kvm_timer_needs_update(struct kvm_vcpu *vcpu);
 void kvm_timer_schedule(struct kvm_vcpu *vcpu);
 void kvm_timer_unschedule(struct kvm_vcpu *vcpu);
 
@@ -84,4 +102,10 @@ void kvm_timer_init_vhe(void);
 
 #define vcpu_vtimer(v)	(&(v)->arch.timer_cpu.vtimer)
 #define vcpu_ptimer(v)	(&(v)->arch.timer_cpu.ptimer)
+#define vcpu_hptimer(v)	(&(v)->arch.timer_cpu.hptimer)
+#define vcpu_hvtimer(v)	(&(v)->arch.timer_cpu.hvtimer)
+
+/* The context in the hardware EL1 virtual timer while the vcpu runs */
+#define vcpu_loaded_vtimer(v)					\
+	((v)->arch.timer_cpu.hvtimer_loaded ? vcpu_hvtimer(v) : vcpu_vtimer(v))
 #endif
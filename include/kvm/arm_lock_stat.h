@@ -0,0 +1,124 @@
+/*
+ * Contention statistics for the hot KVM/arm locks
+ *
+ * Copyright (C) 2017 - Linaro Ltd
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef __KVM_ARM_LOCK_STAT_H
+#define __KVM_ARM_LOCK_STAT_H
+
+#include <linux/kvm_host.h>
+#include <linux/sched/clock.h>
+
+u64 __kvm_arm_lock_waited(const char *name, unsigned long holder, u64 start);
+
+/*
+ * Take a lock with @lock if @trylock fails, and account the wait in the
+ * @contended and @wait_ns stats. Uncontended acquisitions only pay for the
+ * trylock. A stat is only ever updated by one context at a time: either
+ * under the lock it describes, or from the VCPU thread owning it.
+ *
+ * @holder is the sampled callsite of the current owner, if the lock keeps
+ * one, and is reported with each contended acquisition through the
+ * kvm_lock_contended tracepoint.
+ */
+#define kvm_arm_lock_stat(name, trylock, lock, holder, contended, wait_ns) \
+do {									\
+	if (unlikely(!(trylock))) {					\
+		unsigned long __holder = (holder);			\
+		u64 __start = local_clock();				\
+									\
+		lock;							\
+		(contended)++;						\
+		(wait_ns) += __kvm_arm_lock_waited(name, __holder,	\
+						   __start);		\
+	}								\
+} while (0)
+
+/* The write side of kvm->mmu_lock, with stats in the VM */
+static __always_inline void kvm_mmu_write_lock(struct kvm *kvm)
+{
+	kvm_arm_lock_stat("mmu_lock", write_trylock(&kvm->mmu_lock),
+			  write_lock(&kvm->mmu_lock),
+			  READ_ONCE(kvm->arch.mmu_lock_holder),
+			  kvm->stat.mmu_lock_contended,
+			  kvm->stat.mmu_lock_wait_ns);
+	kvm->arch.mmu_lock_holder = _THIS_IP_;
+}
+
+/* Forget the holder before letting the next writer in */
+static __always_inline void kvm_mmu_write_unlock(struct kvm *kvm)
+{
+	kvm->arch.mmu_lock_holder = 0;
+	write_unlock(&kvm->mmu_lock);
+}
+
+/* The read side, on behalf of @vcpu, with stats in the VCPU */
+static __always_inline void kvm_mmu_read_lock(struct kvm_vcpu *vcpu)
+{
+	struct kvm *kvm = vcpu->kvm;
+
+	kvm_arm_lock_stat("mmu_lock", read_trylock(&kvm->mmu_lock),
+			  read_lock(&kvm->mmu_lock),
+			  READ_ONCE(kvm->arch.mmu_lock_holder),
+			  vcpu->stat.mmu_lock_read_contended,
+			  vcpu->stat.mmu_lock_read_wait_ns);
+}
+
+static __always_inline void kvm_mmu_read_unlock(struct kvm *kvm)
+{
+	read_unlock(&kvm->mmu_lock);
+}
+
+/*
+ * The ap_list_lock of @vcpu, with stats in that VCPU. Interrupts must be
+ * disabled, as for all the vgic locks: see vgic_ap_list_lock_irqsave().
+ */
+static __always_inline void vgic_ap_list_lock(struct kvm_vcpu *vcpu)
+{
+	struct vgic_cpu *vgic_cpu = &vcpu->arch.vgic_cpu;
+
+	kvm_arm_lock_stat("ap_list_lock",
+			  raw_spin_trylock(&vgic_cpu->ap_list_lock),
+			  raw_spin_lock(&vgic_cpu->ap_list_lock),
+			  READ_ONCE(vgic_cpu->ap_list_holder),
+			  vcpu->stat.ap_list_lock_contended,
+			  vcpu->stat.ap_list_lock_wait_ns);
+	vgic_cpu->ap_list_holder = _THIS_IP_;
+}
+
+/*
+ * The lock of an interrupt on @vcpu's own list, from the VCPU thread, with
+ * interrupts disabled. The interrupt locks are too many to keep a holder
+ * each.
+ */
+static __always_inline void vgic_irq_lock(struct kvm_vcpu *vcpu,
+					  struct vgic_irq *irq)
+{
+	kvm_arm_lock_stat("irq_lock", raw_spin_trylock(&irq->irq_lock),
+			  raw_spin_lock(&irq->irq_lock), 0,
+			  vcpu->stat.irq_lock_contended,
+			  vcpu->stat.irq_lock_wait_ns);
+}
+
+/*
+ * The irqsave flavours, to be released with raw_spin_unlock_irqrestore().
+ * The vgic locks are taken from the irqfd wakeup, with interrupts disabled.
+ */
+#define vgic_ap_list_lock_irqsave(vcpu, flags)				\
+	do {								\
+		local_irq_save(flags);					\
+		vgic_ap_list_lock(vcpu);				\
+	} while (0)
+
+#define vgic_irq_lock_irqsave(vcpu, irq, flags)				\
+	do {								\
+		local_irq_save(flags);					\
+		vgic_irq_lock(vcpu, irq);				\
+	} while (0)
+
+#endif /* __KVM_ARM_LOCK_STAT_H */
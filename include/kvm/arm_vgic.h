@@ -26,6 +26,8 @@
 #include <linux/list.h>
 #include <linux/jump_label.h>
 
+#include <linux/irqchip/arm-gic-v4.h>
+
 #define VGIC_V3_MAX_CPUS	255
 #define VGIC_V2_MAX_CPUS	8
 #define VGIC_NR_IRQS_LEGACY     256
@@ -73,6 +75,9 @@ struct vgic_global {
 	/* Only needed for the legacy KVM_CREATE_IRQCHIP */
 	bool			can_emulate_gicv2;
 
+	/* Hardware has GICv4, and its use is enabled */
+	bool			has_gicv4;
+
 	/* GIC system register CPU interface */
 	struct static_key_false gicv3_cpuif;
 
@@ -91,8 +96,9 @@ enum vgic_irq_config {
 };
 
 struct vgic_irq {
-	spinlock_t irq_lock;		/* Protects the content of the struct */
+	raw_spinlock_t irq_lock;	/* Protects the content of the struct */
 	struct list_head lpi_list;	/* Used to link all LPIs together */
+	struct rcu_head rcu;		/* LPIs are freed after a grace period */
 	struct list_head ap_list;
 
 	struct kvm_vcpu *vcpu;		/* SGIs and PPIs: The VCPU
@@ -116,6 +122,7 @@ struct vgic_irq {
 	bool hw;			/* Tied to HW IRQ */
 	struct kref refcount;		/* Used for LPIs */
 	u32 hwintid;			/* HW INTID number */
+	unsigned int host_irq;		/* linux irq corresponding to hwintid */
 	union {
 		u8 targets;			/* GICv2 target VCPUs mask */
 		u32 mpidr;			/* GICv3 target VCPU */
@@ -126,6 +133,7 @@ struct vgic_irq {
 
 	void *owner;			/* Opaque pointer to reserve an interrupt
 					   for in-kernel devices. */
+	u64 queued_ns;			/* When queued, with kvm-arm.vgic_stats */
 };
 
 struct vgic_register_region;
@@ -151,6 +159,14 @@ struct vgic_io_device {
 	struct kvm_io_device dev;
 };
 
+#define VGIC_ITS_TRANSLATION_CACHE_SIZE	16
+
+struct vgic_translation_cache_entry {
+	u32			devid;
+	u32			eventid;
+	struct vgic_irq		*irq;
+};
+
 struct vgic_its {
 	/* The base address of the ITS control register frame */
 	gpa_t			vgic_its_base;
@@ -174,8 +190,17 @@ struct vgic_its {
 
 	/* Protects the device and collection lists */
 	struct mutex		its_lock;
+	unsigned long		its_lock_holder;	/* sampled callsite */
 	struct list_head	device_list;
 	struct list_head	collection_list;
+
+	/*
+	 * DevID/EventID pairs recently translated by MSI injection, most
+	 * recently used first.
+	 */
+	raw_spinlock_t		translation_cache_lock;
+	struct vgic_translation_cache_entry
+		translation_cache[VGIC_ITS_TRANSLATION_CACHE_SIZE];
 };
 
 struct vgic_state_iter;
@@ -229,12 +254,21 @@ struct vgic_dist {
 	u64			propbaser;
 
 	/* Protects the lpi_list and the count value below. */
-	spinlock_t		lpi_list_lock;
+	raw_spinlock_t		lpi_list_lock;
 	struct list_head	lpi_list_head;
 	int			lpi_list_count;
 
 	/* used by vgic-debug */
 	struct vgic_state_iter *iter;
+
+	/*
+	 * GICv4 ITS per-VM data, containing the IRQ domain, the VPE
+	 * array, the property table pointer as well as allocation
+	 * data. This essentially ties the Linux IRQ core and ITS
+	 * together, and avoids leaking KVM's data structures anywhere
+	 * else.
+	 */
+	struct its_vm		its_vm;
 };
 
 struct vgic_v2_cpu_if {
@@ -255,6 +289,26 @@ struct vgic_v3_cpu_if {
 	u64		vgic_lr[VGIC_V3_MAX_LRS];
 };
 
+#define VGIC_STATS_LR_BUCKETS		(VGIC_V3_MAX_LRS + 1)
+#define VGIC_STATS_AP_LIST_BUCKETS	8
+#define VGIC_STATS_LATENCY_BUCKETS	16
+
+/*
+ * Collected with kvm-arm.vgic_stats=1, see the VM's vgic-stats debugfs file.
+ * The LR histograms count the flushes (or, for the nested LRs, the entries
+ * into the nested guest) by number of LRs in use. The ap_list histogram is
+ * log2 of the ap_list length at flush time, and the latency one log2 of the
+ * usecs from queuing an interrupt to the first exit that finds it taken.
+ */
+struct vgic_cpu_stats {
+	u64 flushes;
+	u64 overflows;		/* ap_list longer than the LRs */
+	u64 lr_used[VGIC_STATS_LR_BUCKETS];
+	u64 nested_lr_used[VGIC_STATS_LR_BUCKETS];
+	u64 ap_list_len[VGIC_STATS_AP_LIST_BUCKETS];
+	u64 ack_latency[VGIC_STATS_LATENCY_BUCKETS];
+};
+
 struct vgic_cpu {
 	/* CPU vif control registers for world switch */
 	union {
@@ -285,7 +339,25 @@ struct vgic_cpu {
 		struct vgic_v3_cpu_if	*hw_v3_cpu_if;
 	};
 
-	spinlock_t ap_list_lock;	/* Protects the ap_list */
+	/*
+	 * Nested GICv2 LRs written by the guest hypervisor since their HW
+	 * interrupt was last translated, and the translated PHYSID field of
+	 * the others. A clear bit in nested_lr_mapped means the LR had no
+	 * real mapping and goes to the hardware without its HW bit.
+	 */
+	DECLARE_BITMAP(nested_lr_dirty, VGIC_V2_MAX_LRS);
+	u64 nested_lr_mapped;
+	u32 nested_lr_physid[VGIC_V2_MAX_LRS];
+
+	/*
+	 * The nested GICH_EISR and GICH_ELRSR, kept up to date with the
+	 * nested LRs so that reading them, or MISR, doesn't scan the LRs.
+	 */
+	u64 nested_eisr;
+	u64 nested_elrsr;
+
+	raw_spinlock_t ap_list_lock;	/* Protects the ap_list */
+	unsigned long ap_list_holder;	/* Sampled callsite of its owner */
 
 	/*
 	 * List of IRQs that this VCPU should consider because they are either
@@ -307,6 +379,15 @@ struct vgic_cpu {
 	/* Contains the attributes and gpa of the LPI pending tables. */
 	u64 pendbaser;
 
+	/*
+	 * GICv4 vPE of this vcpu. It only backs the vcpu's own LPIs, not
+	 * the ones of a nested guest, and so isn't part of the cpu_if.
+	 */
+	struct its_vpe its_vpe;
+
+	/* The vPE only waits on its doorbell while the vcpu blocks */
+	bool vpe_blocked;
+
 	bool lpis_enabled;
 
 	/* Cache guest priority bits */
@@ -314,6 +395,8 @@ struct vgic_cpu {
 
 	/* Cache guest interrupt ID bits */
 	u32 num_id_bits;
+
+	struct vgic_cpu_stats stats;
 };
 
 extern struct static_key_false vgic_v2_cpuif_trap;
@@ -344,6 +427,11 @@ void kvm_vgic_put(struct kvm_vcpu *vcpu);
 void vgic_v2_setup_shadow_state(struct kvm_vcpu *vcpu);
 void vgic_v2_restore_shadow_state(struct kvm_vcpu *vcpu);
 void vgic_handle_nested_maint_irq(struct kvm_vcpu *vcpu);
+bool vgic_v2_nested_irq_pending(struct kvm_vcpu *vcpu);
+void vgic_v3_setup_shadow_state(struct kvm_vcpu *vcpu);
+void vgic_v3_restore_shadow_state(struct kvm_vcpu *vcpu);
+void vgic_v3_handle_nested_maint_irq(struct kvm_vcpu *vcpu);
+bool vgic_v3_nested_irq_pending(struct kvm_vcpu *vcpu);
 
 #define irqchip_in_kernel(k)	(!!((k)->arch.vgic.in_kernel))
 #define vgic_initialized(k)	((k)->arch.vgic.initialized)
@@ -379,4 +467,15 @@ int kvm_vgic_setup_default_irq_routing(struct kvm *kvm);
 
 int kvm_vgic_set_owner(struct kvm_vcpu *vcpu, unsigned int intid, void *owner);
 
+struct kvm_kernel_irq_routing_entry;
+
+int kvm_vgic_v4_set_forwarding(struct kvm *kvm, int irq,
+			       struct kvm_kernel_irq_routing_entry *irq_entry);
+
+int kvm_vgic_v4_unset_forwarding(struct kvm *kvm, int irq,
+				 struct kvm_kernel_irq_routing_entry *irq_entry);
+
+void kvm_vgic_v4_enable_doorbell(struct kvm_vcpu *vcpu);
+void kvm_vgic_v4_disable_doorbell(struct kvm_vcpu *vcpu);
+
 #endif /* __KVM_ARM_VGIC_H */
@@ -159,6 +159,13 @@ struct backing_dev_info {
 	 */
 	atomic_long_t tot_write_bandwidth;
 
+	/*
+	 * How far the device's writeback throttling has scaled down to
+	 * keep read latency in check, 0 if it hasn't.  Dirtiers are slowed
+	 * down by as much again, see balance_dirty_pages().
+	 */
+	unsigned int lat_throttle;
+
 	struct bdi_writeback wb;  /* the root writeback info for this bdi */
 	struct list_head wb_list; /* list of all wbs */
 #ifdef CONFIG_CGROUP_WRITEBACK
@@ -46,6 +46,9 @@
 #define bio_iter_iovec(bio, iter)				\
 	bvec_iter_bvec((bio)->bi_io_vec, (iter))
 
+#define bio_iter_mp_iovec(bio, iter)				\
+	mp_bvec_iter_bvec((bio)->bi_io_vec, (iter))
+
 #define bio_iter_page(bio, iter)				\
 	bvec_iter_page((bio)->bi_io_vec, (iter))
 #define bio_iter_len(bio, iter)					\
@@ -181,6 +184,20 @@ static inline void bio_advance_iter(struct bio *bio, struct bvec_iter *iter,
 #define bio_for_each_segment(bvl, bio, iter)				\
 	__bio_for_each_segment(bvl, bio, iter, (bio)->bi_iter)
 
+/*
+ * Same as above, but a bvec spanning several pages is returned whole:
+ * for code that only cares about physical contiguity, like segment
+ * counting and mapping.
+ */
+#define __bio_for_each_bvec(bvl, bio, iter, start)			\
+	for (iter = (start);						\
+	     (iter).bi_size &&						\
+		((bvl = bio_iter_mp_iovec((bio), (iter))), 1);		\
+	     bio_advance_iter((bio), &(iter), (bvl).bv_len))
+
+#define bio_for_each_bvec(bvl, bio, iter)				\
+	__bio_for_each_bvec(bvl, bio, iter, (bio)->bi_iter)
+
 #define bio_iter_last(bvec, iter) ((iter).bi_size == (bvec).bv_len)
 
 static inline unsigned bio_segments(struct bio *bio)
@@ -286,6 +303,19 @@ static inline void bio_get_last_bvec(struct bio *bio, struct bio_vec *bv)
 	 */
 	if (iter.bi_bvec_done)
 		bv->bv_len = iter.bi_bvec_done;
+
+	/* only return the last page of a multi-page bvec */
+	if (unlikely(bv->bv_offset + bv->bv_len > PAGE_SIZE)) {
+		unsigned int end = bv->bv_offset + bv->bv_len;
+		unsigned int start = (end - 1) & PAGE_MASK;
+
+		bv->bv_page = nth_page(bv->bv_page, start >> PAGE_SHIFT);
+		if (bv->bv_offset > start)
+			bv->bv_offset -= start;
+		else
+			bv->bv_offset = 0;
+		bv->bv_len = end - start - bv->bv_offset;
+	}
 }
 
 enum bip_flags {
@@ -442,6 +472,7 @@ extern struct bio *bio_map_kern(struct request_queue *, void *, unsigned int,
 extern struct bio *bio_copy_kern(struct request_queue *, void *, unsigned int,
 				 gfp_t, int);
 extern void bio_set_pages_dirty(struct bio *bio);
+extern void bio_put_pages(struct bio *bio, bool mark_dirty);
 extern void bio_check_pages_dirty(struct bio *bio);
 
 void generic_start_io_acct(int rw, unsigned long sectors,
@@ -7,6 +7,18 @@
 
 struct blk_mq_tags;
 struct blk_flush_queue;
+struct blk_mq_lat_hist;
+
+/*
+ * A hardware queue either takes any request, or only REQ_HIPRI ones, whose
+ * completion is polled for.
+ */
+enum hctx_type {
+	HCTX_TYPE_DEFAULT,
+	HCTX_TYPE_POLL,
+
+	HCTX_MAX_TYPES,
+};
 
 struct blk_mq_hw_ctx {
 	struct {
@@ -21,6 +33,7 @@ struct blk_mq_hw_ctx {
 	int			next_cpu_batch;
 
 	unsigned long		flags;		/* BLK_MQ_F_* flags */
+	unsigned short		type;		/* enum hctx_type */
 
 	void			*sched_data;
 	struct request_queue	*queue;
@@ -61,13 +74,16 @@ struct blk_mq_hw_ctx {
 #ifdef CONFIG_BLK_DEBUG_FS
 	struct dentry		*debugfs_dir;
 	struct dentry		*sched_debugfs_dir;
+	struct blk_mq_lat_hist __percpu *lat_hist;
 #endif
 };
 
 struct blk_mq_tag_set {
 	unsigned int		*mq_map;
+	unsigned int		*poll_map;	/* same as mq_map, for REQ_HIPRI */
 	const struct blk_mq_ops	*ops;
 	unsigned int		nr_hw_queues;
+	unsigned int		nr_poll_queues;	/* last queues, only polled */
 	unsigned int		queue_depth;	/* max hw supported */
 	unsigned int		reserved_tags;
 	unsigned int		cmd_size;	/* per-request extra data */
@@ -88,6 +104,7 @@ struct blk_mq_queue_data {
 };
 
 typedef int (queue_rq_fn)(struct blk_mq_hw_ctx *, const struct blk_mq_queue_data *);
+typedef void (commit_rqs_fn)(struct blk_mq_hw_ctx *);
 typedef enum blk_eh_timer_return (timeout_fn)(struct request *, bool);
 typedef int (init_hctx_fn)(struct blk_mq_hw_ctx *, void *, unsigned int);
 typedef void (exit_hctx_fn)(struct blk_mq_hw_ctx *, unsigned int);
@@ -110,6 +127,13 @@ struct blk_mq_ops {
 	 */
 	queue_rq_fn		*queue_rq;
 
+	/*
+	 * If a request was queued with bd->last clear and the block layer
+	 * then has nothing more to send, it calls this so the driver can
+	 * start what it held back, e.g. by ringing a doorbell.
+	 */
+	commit_rqs_fn		*commit_rqs;
+
 	/*
 	 * Called on request timeout
 	 */
@@ -25,6 +25,11 @@ struct bpf_map_ops {
 	void (*map_release)(struct bpf_map *map, struct file *map_file);
 	void (*map_free)(struct bpf_map *map);
 	int (*map_get_next_key)(struct bpf_map *map, void *key, void *next_key);
+	int (*map_lookup_batch)(struct bpf_map *map, const union bpf_attr *attr,
+				union bpf_attr __user *uattr);
+	int (*map_lookup_and_delete_batch)(struct bpf_map *map,
+					   const union bpf_attr *attr,
+					   union bpf_attr __user *uattr);
 
 	/* funcs callable from userspace and from eBPF programs */
 	void *(*map_lookup_elem)(struct bpf_map *map, void *key);
@@ -338,6 +343,70 @@ static inline void __bpf_prog_uncharge(struct user_struct *user, u32 pages)
 }
 #endif /* CONFIG_BPF_SYSCALL */
 
+/* XDP_REDIRECT targets, only called from NAPI context */
+struct bpf_dtab_netdev;
+struct bpf_cpu_map_entry;
+struct xdp_frame;
+struct xdp_sock;
+
+#if defined(CONFIG_BPF_SYSCALL) && defined(CONFIG_NET)
+struct bpf_dtab_netdev *__dev_map_lookup_elem(struct bpf_map *map, u32 key);
+struct net_device *dev_map_netdev(struct bpf_dtab_netdev *dst);
+int dev_map_enqueue(struct bpf_dtab_netdev *dst, struct xdp_frame *frame);
+void __dev_map_flush(void);
+
+struct bpf_cpu_map_entry *__cpu_map_lookup_elem(struct bpf_map *map, u32 key);
+int cpu_map_enqueue(struct bpf_cpu_map_entry *rcpu, struct xdp_frame *frame);
+void __cpu_map_flush(void);
+#else
+static inline struct bpf_dtab_netdev *__dev_map_lookup_elem(struct bpf_map *map,
+							    u32 key)
+{
+	return NULL;
+}
+
+static inline struct net_device *dev_map_netdev(struct bpf_dtab_netdev *dst)
+{
+	return NULL;
+}
+
+static inline int dev_map_enqueue(struct bpf_dtab_netdev *dst,
+				  struct xdp_frame *frame)
+{
+	return -EOPNOTSUPP;
+}
+
+static inline void __dev_map_flush(void)
+{
+}
+
+static inline
+struct bpf_cpu_map_entry *__cpu_map_lookup_elem(struct bpf_map *map, u32 key)
+{
+	return NULL;
+}
+
+static inline int cpu_map_enqueue(struct bpf_cpu_map_entry *rcpu,
+				  struct xdp_frame *frame)
+{
+	return -EOPNOTSUPP;
+}
+
+static inline void __cpu_map_flush(void)
+{
+}
+#endif
+
+#ifdef CONFIG_XDP_SOCKETS
+struct xdp_sock *__xsk_map_lookup_elem(struct bpf_map *map, u32 key);
+#else
+static inline struct xdp_sock *__xsk_map_lookup_elem(struct bpf_map *map,
+						     u32 key)
+{
+	return NULL;
+}
+#endif
+
 /* verifier prototypes for helper functions called from eBPF programs */
 extern const struct bpf_func_proto bpf_map_lookup_elem_proto;
 extern const struct bpf_func_proto bpf_map_update_elem_proto;
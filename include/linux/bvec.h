@@ -22,9 +22,14 @@
 
 #include <linux/kernel.h>
 #include <linux/bug.h>
+#include <linux/mm.h>
 
 /*
  * was unsigned short, but we might as well be ready for > 64kB I/O pages
+ *
+ * A bvec can cover several physically contiguous pages, bv_offset and
+ * bv_len being relative to bv_page. The iterators below still hand out
+ * one page at a time, the mp_ variants the whole bvec.
  */
 struct bio_vec {
 	struct page	*bv_page;
@@ -49,16 +54,34 @@ struct bvec_iter {
  */
 #define __bvec_iter_bvec(bvec, iter)	(&(bvec)[(iter).bi_idx])
 
-#define bvec_iter_page(bvec, iter)				\
+#define mp_bvec_iter_page(bvec, iter)				\
 	(__bvec_iter_bvec((bvec), (iter))->bv_page)
 
-#define bvec_iter_len(bvec, iter)				\
+#define mp_bvec_iter_len(bvec, iter)				\
 	min((iter).bi_size,					\
 	    __bvec_iter_bvec((bvec), (iter))->bv_len - (iter).bi_bvec_done)
 
-#define bvec_iter_offset(bvec, iter)				\
+#define mp_bvec_iter_offset(bvec, iter)				\
 	(__bvec_iter_bvec((bvec), (iter))->bv_offset + (iter).bi_bvec_done)
 
+#define mp_bvec_iter_bvec(bvec, iter)				\
+((struct bio_vec) {						\
+	.bv_page	= mp_bvec_iter_page((bvec), (iter)),	\
+	.bv_len		= mp_bvec_iter_len((bvec), (iter)),	\
+	.bv_offset	= mp_bvec_iter_offset((bvec), (iter)),	\
+})
+
+#define bvec_iter_page(bvec, iter)				\
+	nth_page(mp_bvec_iter_page((bvec), (iter)),		\
+		 mp_bvec_iter_offset((bvec), (iter)) >> PAGE_SHIFT)
+
+#define bvec_iter_len(bvec, iter)				\
+	min_t(unsigned, mp_bvec_iter_len((bvec), (iter)),	\
+	      PAGE_SIZE - bvec_iter_offset((bvec), (iter)))
+
+#define bvec_iter_offset(bvec, iter)				\
+	offset_in_page(mp_bvec_iter_offset((bvec), (iter)))
+
 #define bvec_iter_bvec(bvec, iter)				\
 ((struct bio_vec) {						\
 	.bv_page	= bvec_iter_page((bvec), (iter)),	\
@@ -74,7 +97,7 @@ static inline void bvec_iter_advance(const struct bio_vec *bv,
 		  "Attempted to advance past end of bvec iter\n");
 
 	while (bytes) {
-		unsigned iter_len = bvec_iter_len(bv, *iter);
+		unsigned iter_len = mp_bvec_iter_len(bv, *iter);
 		unsigned len = min(bytes, iter_len);
 
 		bytes -= len;
@@ -94,4 +117,14 @@ static inline void bvec_iter_advance(const struct bio_vec *bv,
 		((bvl = bvec_iter_bvec((bio_vec), (iter))), 1);	\
 	     bvec_iter_advance((bio_vec), &(iter), (bvl).bv_len))
 
+/*
+ * Walk the pages spanned by a bvec, e.g. to release the ones pinned by
+ * bio_iov_iter_get_pages().
+ */
+#define bvec_for_each_page(pg, bv, i)					\
+	for (i = (bv)->bv_offset >> PAGE_SHIFT;				\
+	     i <= ((bv)->bv_offset + (bv)->bv_len - 1) >> PAGE_SHIFT &&	\
+		((pg = nth_page((bv)->bv_page, i)), 1);			\
+	     i++)
+
 #endif /* __LINUX_BVEC_ITER_H */
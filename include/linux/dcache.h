@@ -495,6 +495,7 @@ static inline bool d_is_fallthru(const struct dentry *dentry)
 
 
 extern int sysctl_vfs_cache_pressure;
+extern unsigned long sysctl_negative_dentry_limit;
 
 static inline unsigned long vfs_pressure_ratio(unsigned long val)
 {
@@ -452,6 +452,38 @@ struct xdp_buff {
 	void *data_hard_start;
 };
 
+/* A packet handed off by XDP_REDIRECT. It is stored in the headroom of the
+ * packet itself, the buffer is a page fragment that now belongs to whoever
+ * the frame was passed to, and must be released with xdp_return_frame().
+ */
+struct xdp_frame {
+	void *data;
+	u16 len;
+	u16 headroom;
+	struct net_device *dev_rx;
+};
+
+/* ndo_xdp_xmit() flags */
+#define XDP_XMIT_FLUSH		(1U << 0)
+
+static inline struct xdp_frame *convert_to_xdp_frame(struct xdp_buff *xdp,
+						     struct net_device *dev)
+{
+	struct xdp_frame *frame = xdp->data_hard_start;
+	int headroom = xdp->data - xdp->data_hard_start;
+
+	if (unlikely(headroom < (int)sizeof(*frame)))
+		return NULL;
+
+	frame->data = xdp->data;
+	frame->len = xdp->data_end - xdp->data;
+	frame->headroom = headroom - sizeof(*frame);
+	frame->dev_rx = dev;
+	return frame;
+}
+
+void xdp_return_frame(struct xdp_frame *frame);
+
 /* compute the linear packet data range [data, data_end) which
  * will be accessed by cls_bpf, act_bpf and lwt programs
  */
@@ -525,6 +557,19 @@ static __always_inline u32 bpf_prog_run_xdp(const struct bpf_prog *prog,
 	return BPF_PROG_RUN(prog, xdp);
 }
 
+/* The driver owns the packet buffer again when xdp_do_redirect() fails.
+ * On success it must call xdp_do_flush_map() before leaving its NAPI
+ * poll routine. xdp_do_generic_redirect() always consumes the skb.
+ */
+int xdp_do_redirect(struct net_device *dev, struct xdp_buff *xdp,
+		    struct bpf_prog *prog);
+void xdp_do_flush_map(void);
+int xdp_do_generic_redirect(struct net_device *dev, struct sk_buff *skb,
+			    struct bpf_prog *prog);
+struct sk_buff *xdp_frame_to_skb(struct xdp_frame *frame,
+				 struct net_device *dev);
+void xdp_frame_xmit_skb(struct xdp_frame *frame, struct net_device *dev);
+
 static inline u32 bpf_prog_insn_size(const struct bpf_prog *prog)
 {
 	return prog->len * sizeof(struct bpf_insn);
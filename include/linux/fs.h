@@ -28,6 +28,7 @@
 #include <linux/uidgid.h>
 #include <linux/lockdep.h>
 #include <linux/percpu-rwsem.h>
+#include <linux/percpu_counter.h>
 #include <linux/workqueue.h>
 #include <linux/delayed_call.h>
 
@@ -268,6 +269,7 @@ struct writeback_control;
 #define IOCB_DSYNC		(1 << 4)
 #define IOCB_SYNC		(1 << 5)
 #define IOCB_WRITE		(1 << 6)
+#define IOCB_NOWAIT		(1 << 7)
 
 struct kiocb {
 	struct file		*ki_filp;
@@ -275,6 +277,7 @@ struct kiocb {
 	void (*ki_complete)(struct kiocb *iocb, long ret, long ret2);
 	void			*private;
 	int			ki_flags;
+	unsigned int		ki_cookie; /* blk_qc_t of an async IOCB_HIPRI request */
 };
 
 static inline bool is_sync_kiocb(struct kiocb *kiocb)
@@ -1368,6 +1371,10 @@ struct super_block {
 	/* Number of inodes with nlink == 0 but still referenced */
 	atomic_long_t s_remove_count;
 
+	/* Negative dentries on s_dentry_lru, trimmed past the sysctl limit */
+	struct percpu_counter s_nr_negative;
+	struct work_struct s_negative_trim_work;
+
 	/* Being remounted read-only */
 	int s_readonly_remount;
 
@@ -480,6 +480,30 @@ extern int irq_set_vcpu_affinity(unsigned int irq, void *vcpu_info);
 
 extern void irq_migrate_all_off_this_cpu(void);
 
+/**
+ * struct irq_affinity_flush - deferred affinity reprogramming of a chip
+ * @node:	link in the list of flushes to run, initialized empty
+ * @flush:	callback reprogramming the hardware for all deferred changes
+ *
+ * While irq_migrate_all_off_this_cpu() moves all the interrupts of the
+ * dying cpu, a chip whose affinity changes each cost a round trip to the
+ * hardware can record them, and defer the hardware update to a single
+ * @flush call at the end.
+ */
+struct irq_affinity_flush {
+	struct list_head	node;
+	void			(*flush)(struct irq_affinity_flush *flush);
+};
+
+#ifdef CONFIG_GENERIC_IRQ_MIGRATION
+extern bool irq_affinity_defer(struct irq_affinity_flush *flush);
+#else
+static inline bool irq_affinity_defer(struct irq_affinity_flush *flush)
+{
+	return false;
+}
+#endif
+
 #if defined(CONFIG_SMP) && defined(CONFIG_GENERIC_PENDING_IRQ)
 void irq_move_irq(struct irq_data *data);
 void irq_move_masked_irq(struct irq_data *data);
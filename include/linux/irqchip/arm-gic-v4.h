@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2017 - Linaro Ltd
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LINUX_IRQCHIP_ARM_GIC_V4_H
+#define __LINUX_IRQCHIP_ARM_GIC_V4_H
+
+#include <linux/errno.h>
+#include <linux/types.h>
+
+struct fwnode_handle;
+struct irq_domain;
+struct irq_domain_ops;
+struct page;
+struct its_vpe;
+
+/*
+ * A VM, as seen by the ITS: a property table shared by all its vPEs,
+ * the vPEs themselves, and the range of doorbell LPIs allocated to them.
+ */
+struct its_vm {
+	struct fwnode_handle	*fwnode;
+	struct irq_domain	*domain;
+	struct page		*vprop_page;
+	struct its_vpe		**vpes;
+	int			nr_vpes;
+	irq_hw_number_t		db_lpi_base;
+	unsigned long		*db_bitmap;
+	int			nr_db_lpis;
+};
+
+/* Embedded in kvm_vcpu.arch */
+struct its_vpe {
+	struct page 		*vpt_page;
+	struct its_vm		*its_vm;
+	/* Doorbell interrupt */
+	int			irq;
+	irq_hw_number_t		vpe_db_lpi;
+	/*
+	 * This collection ID is used to indirect the target
+	 * redistributor for this vPE. The ID itself isn't involved in
+	 * programming of the ITS.
+	 */
+	u16			col_idx;
+	/* Unique (system-wide) VPE identifier */
+	u16			vpe_id;
+	/* Implementation Defined Area Invalid */
+	bool			idai;
+	/* Pending VLPIs on schedule out? */
+	bool			pending_last;
+	/* Currently resident on a redistributor */
+	bool			resident;
+};
+
+/*
+ * struct its_vlpi_map: structure describing the mapping of a
+ * VLPI. Only to be interpreted in the context of a physical interrupt
+ * it complements. To be used as the vcpu_info passed to
+ * irq_set_vcpu_affinity().
+ *
+ * @vm:		Pointer to the GICv4 notion of a VM
+ * @vpe:	Pointer to the GICv4 notion of a virtual CPU (VPE)
+ * @vintid:	Virtual LPI number
+ * @properties:	Priority and enable bits (as written in the prop table)
+ * @db_enabled:	Is the VPE doorbell to be generated?
+ */
+struct its_vlpi_map {
+	struct its_vm		*vm;
+	struct its_vpe		*vpe;
+	u32			vintid;
+	u8			properties;
+	bool			db_enabled;
+};
+
+enum its_vcpu_info_cmd_type {
+	MAP_VLPI,
+	GET_VLPI,
+	PROP_UPDATE_VLPI,
+	PROP_UPDATE_AND_INV_VLPI,
+	SCHEDULE_VPE,
+	DESCHEDULE_VPE,
+	INVALL_VPE,
+};
+
+struct its_cmd_info {
+	enum its_vcpu_info_cmd_type	cmd_type;
+	union {
+		struct its_vlpi_map	*map;
+		u8			config;
+	};
+};
+
+#ifdef CONFIG_ARM_GIC_V3_ITS
+int its_alloc_vcpu_irqs(struct its_vm *vm);
+void its_free_vcpu_irqs(struct its_vm *vm);
+int its_make_vpe_resident(struct its_vpe *vpe);
+int its_make_vpe_non_resident(struct its_vpe *vpe, bool db);
+int its_invall_vpe(struct its_vpe *vpe);
+int its_map_vlpi(int irq, struct its_vlpi_map *map);
+int its_get_vlpi(int irq, struct its_vlpi_map *map);
+int its_unmap_vlpi(int irq);
+int its_prop_update_vlpi(int irq, u8 config, bool inv);
+
+int its_init_v4(struct irq_domain *domain,
+		const struct irq_domain_ops *ops);
+#else
+/* Without an ITS, GICv4 is never reported to KVM */
+static inline int its_alloc_vcpu_irqs(struct its_vm *vm) { return -ENODEV; }
+static inline void its_free_vcpu_irqs(struct its_vm *vm) { }
+static inline int its_make_vpe_resident(struct its_vpe *vpe) { return -ENODEV; }
+static inline int its_make_vpe_non_resident(struct its_vpe *vpe, bool db)
+{
+	return -ENODEV;
+}
+static inline int its_invall_vpe(struct its_vpe *vpe) { return -ENODEV; }
+static inline int its_map_vlpi(int irq, struct its_vlpi_map *map)
+{
+	return -ENODEV;
+}
+static inline int its_get_vlpi(int irq, struct its_vlpi_map *map)
+{
+	return -ENODEV;
+}
+static inline int its_unmap_vlpi(int irq) { return -ENODEV; }
+static inline int its_prop_update_vlpi(int irq, u8 config, bool inv)
+{
+	return -ENODEV;
+}
+#endif
+
+#endif
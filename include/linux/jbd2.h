@@ -1001,6 +1001,12 @@ struct journal_s
 	 */
 	u64			j_average_commit_time;
 
+	/*
+	 * the average amount of time in nanoseconds it takes to write the
+	 * commit record and flush the device cache. [j_state_lock]
+	 */
+	u64			j_average_flush_time;
+
 	/*
 	 * minimum and maximum times that we should wait for
 	 * additional filesystem operations to get batched into a
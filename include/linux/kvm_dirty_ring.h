@@ -0,0 +1,81 @@
+#ifndef KVM_DIRTY_RING_H
+#define KVM_DIRTY_RING_H
+
+#include <linux/kvm.h>
+
+/*
+ * A per-vcpu ring of the gfns dirtied by that vcpu, shared with userspace
+ * through an mmap of the vcpu fd at KVM_DIRTY_LOG_PAGE_OFFSET.
+ *
+ * @dirty_index: free running index of the next entry to be filled by KVM
+ * @reset_index: free running index of the next entry to be recycled, once
+ *               userspace has marked it as collected
+ * @size:        number of entries, a power of two
+ * @soft_limit:  number of used entries from which the vcpu exits to
+ *               userspace with KVM_EXIT_DIRTY_RING_FULL, leaving room for
+ *               what may still be dirtied before it gets there
+ * @dirty_gfns:  the entries themselves
+ * @index:       vcpu index of the owner
+ */
+struct kvm_dirty_ring {
+	u32 dirty_index;
+	u32 reset_index;
+	u32 size;
+	u32 soft_limit;
+	struct kvm_dirty_gfn *dirty_gfns;
+	int index;
+};
+
+#ifndef KVM_DIRTY_LOG_PAGE_OFFSET
+#define KVM_DIRTY_LOG_PAGE_OFFSET 0
+#endif
+
+/* Entries kept free past the soft limit */
+#define KVM_DIRTY_RING_RSVD_ENTRIES	64
+#define KVM_DIRTY_RING_MAX_ENTRIES	65536
+
+struct kvm;
+
+#ifdef CONFIG_HAVE_KVM_DIRTY_RING
+int kvm_dirty_ring_alloc(struct kvm_dirty_ring *ring, int index, u32 size);
+void kvm_dirty_ring_free(struct kvm_dirty_ring *ring);
+bool kvm_dirty_ring_push(struct kvm_dirty_ring *ring, u32 slot, u64 offset);
+bool kvm_dirty_ring_soft_full(struct kvm_dirty_ring *ring);
+int kvm_dirty_ring_reset(struct kvm *kvm, struct kvm_dirty_ring *ring);
+struct page *kvm_dirty_ring_get_page(struct kvm_dirty_ring *ring, u32 offset);
+#else
+static inline int kvm_dirty_ring_alloc(struct kvm_dirty_ring *ring,
+				       int index, u32 size)
+{
+	return 0;
+}
+
+static inline void kvm_dirty_ring_free(struct kvm_dirty_ring *ring)
+{
+}
+
+static inline bool kvm_dirty_ring_push(struct kvm_dirty_ring *ring,
+				       u32 slot, u64 offset)
+{
+	return false;
+}
+
+static inline bool kvm_dirty_ring_soft_full(struct kvm_dirty_ring *ring)
+{
+	return false;
+}
+
+static inline int kvm_dirty_ring_reset(struct kvm *kvm,
+				       struct kvm_dirty_ring *ring)
+{
+	return 0;
+}
+
+static inline struct page *kvm_dirty_ring_get_page(struct kvm_dirty_ring *ring,
+						   u32 offset)
+{
+	return NULL;
+}
+#endif /* CONFIG_HAVE_KVM_DIRTY_RING */
+
+#endif /* KVM_DIRTY_RING_H */
@@ -33,6 +33,7 @@
 #include <linux/kvm_para.h>
 
 #include <linux/kvm_types.h>
+#include <linux/kvm_dirty_ring.h>
 
 #include <asm/kvm_host.h>
 
@@ -170,8 +171,12 @@ int kvm_io_bus_write_cookie(struct kvm_vcpu *vcpu, enum kvm_bus bus_idx,
 			    gpa_t addr, int len, const void *val, long cookie);
 int kvm_io_bus_read(struct kvm_vcpu *vcpu, enum kvm_bus bus_idx, gpa_t addr,
 		    int len, void *val);
+int kvm_io_bus_read_cookie(struct kvm_vcpu *vcpu, enum kvm_bus bus_idx,
+			   gpa_t addr, int len, void *val, long cookie);
 int kvm_io_bus_register_dev(struct kvm *kvm, enum kvm_bus bus_idx, gpa_t addr,
 			    int len, struct kvm_io_device *dev);
+int kvm_io_bus_register_devs(struct kvm *kvm, enum kvm_bus bus_idx,
+			     const struct kvm_io_range *ranges, int nr);
 void kvm_io_bus_unregister_dev(struct kvm *kvm, enum kvm_bus bus_idx,
 			       struct kvm_io_device *dev);
 struct kvm_io_device *kvm_io_bus_get_dev(struct kvm *kvm, enum kvm_bus bus_idx,
@@ -272,6 +277,7 @@ struct kvm_vcpu {
 	} spin_loop;
 #endif
 	bool preempted;
+	struct kvm_dirty_ring dirty_ring;
 	struct kvm_vcpu_arch arch;
 	struct dentry *debugfs_dentry;
 };
@@ -297,6 +303,7 @@ struct kvm_memory_slot {
 	gfn_t base_gfn;
 	unsigned long npages;
 	unsigned long *dirty_bitmap;
+	unsigned long *access_bitmap;
 	struct kvm_arch_memory_slot arch;
 	unsigned long userspace_addr;
 	u32 flags;
@@ -387,7 +394,11 @@ struct kvm_memslots {
 };
 
 struct kvm {
+#ifdef KVM_HAVE_MMU_RWLOCK
+	rwlock_t mmu_lock;
+#else
 	spinlock_t mmu_lock;
+#endif
 	struct mutex slots_lock;
 	struct mm_struct *mm; /* userspace tied to this vm */
 	struct kvm_memslots *memslots[KVM_ADDRESS_SPACE_NUM];
@@ -445,6 +456,11 @@ struct kvm {
 	struct kvm_stat_data **debugfs_stat_data;
 	struct srcu_struct srcu;
 	struct srcu_struct irq_srcu;
+	/* Size in bytes of each vcpu dirty ring, 0 when they are not used */
+	u32 dirty_ring_size;
+	/* Per-VM halt polling limit, set with KVM_CAP_HALT_POLL */
+	bool override_halt_poll_ns;
+	unsigned int max_halt_poll_ns;
 };
 
 #define kvm_err(fmt, ...) \
@@ -739,6 +755,21 @@ void kvm_arch_mmu_enable_log_dirty_pt_masked(struct kvm *kvm,
 					gfn_t gfn_offset,
 					unsigned long mask);
 
+/*
+ * With KVM_MEM_LOG_ACCESS, the arch marks each page the guest faults in, and
+ * unmaps the pages whose bits are read back so that they fault again.
+ */
+static inline void kvm_mark_page_touched(struct kvm_memory_slot *memslot,
+					 gfn_t gfn)
+{
+	if (memslot->access_bitmap)
+		set_bit_le(gfn - memslot->base_gfn, memslot->access_bitmap);
+}
+
+void kvm_arch_mmu_clear_access_masked(struct kvm *kvm,
+				      struct kvm_memory_slot *slot,
+				      gfn_t gfn_offset, unsigned long mask);
+
 int kvm_vm_ioctl_get_dirty_log(struct kvm *kvm,
 				struct kvm_dirty_log *log);
 
@@ -895,6 +926,8 @@ int kvm_arch_set_irq_inatomic(struct kvm_kernel_irq_routing_entry *e,
 bool kvm_irq_has_notifier(struct kvm *kvm, unsigned irqchip, unsigned pin);
 void kvm_notify_acked_gsi(struct kvm *kvm, int gsi);
 void kvm_notify_acked_irq(struct kvm *kvm, unsigned irqchip, unsigned pin);
+void kvm_notify_acked_irqs(struct kvm *kvm, unsigned irqchip,
+			   const unsigned *pins, int nr);
 void kvm_register_irq_ack_notifier(struct kvm *kvm,
 				   struct kvm_irq_ack_notifier *kian);
 void kvm_unregister_irq_ack_notifier(struct kvm *kvm,
@@ -998,6 +1031,9 @@ struct kvm_stats_debugfs_item {
 	const char *name;
 	int offset;
 	enum kvm_stat_kind kind;
+	/* KVM_GET_STATS_FD descriptor, a plain cumulative count if left 0 */
+	u32 desc_flags;
+	s16 exponent;
 };
 extern struct kvm_stats_debugfs_item debugfs_entries[];
 extern struct dentry *kvm_debugfs_dir;
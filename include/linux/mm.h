@@ -188,6 +188,7 @@ extern unsigned int kobjsize(const void *objp);
 #define VM_ACCOUNT	0x00100000	/* Is a VM accounted object */
 #define VM_NORESERVE	0x00200000	/* should the VM suppress accounting */
 #define VM_HUGETLB	0x00400000	/* Huge TLB Page VM */
+#define VM_UFFD_MINOR	0x00800000	/* minor faults tracking */
 #define VM_ARCH_1	0x01000000	/* Architecture-specific flag */
 #define VM_ARCH_2	0x02000000
 #define VM_DONTDUMP	0x04000000	/* Do not include in the core dump */
@@ -1306,6 +1307,32 @@ static inline int fixup_user_fault(struct task_struct *tsk,
 }
 #endif
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+extern int handle_speculative_fault(struct mm_struct *mm,
+				    unsigned long address, unsigned int flags,
+				    unsigned long vm_flags);
+
+/* Callers hold mmap_sem for write, which serializes the writers */
+static inline void vm_write_begin(struct vm_area_struct *vma)
+{
+	raw_write_seqcount_begin(&vma->vm_sequence);
+}
+static inline void vm_write_end(struct vm_area_struct *vma)
+{
+	raw_write_seqcount_end(&vma->vm_sequence);
+}
+#else
+static inline int handle_speculative_fault(struct mm_struct *mm,
+					   unsigned long address,
+					   unsigned int flags,
+					   unsigned long vm_flags)
+{
+	return VM_FAULT_RETRY;
+}
+static inline void vm_write_begin(struct vm_area_struct *vma) {}
+static inline void vm_write_end(struct vm_area_struct *vma) {}
+#endif
+
 extern int access_process_vm(struct task_struct *tsk, unsigned long addr, void *buf, int len,
 		unsigned int gup_flags);
 extern int access_remote_vm(struct mm_struct *mm, unsigned long addr,
@@ -1775,6 +1802,45 @@ static inline void pgtable_page_dtor(struct page *page)
 #define pte_alloc(mm, pmd, address)			\
 	(unlikely(pmd_none(*(pmd))) && __pte_alloc(mm, pmd, address))
 
+#ifdef CONFIG_SHARE_PTE_TABLES
+/* A pte table that fork left to several mms, see copy_pmd_range() */
+static inline bool pmd_shared_table(pmd_t pmd)
+{
+	return !pmd_none(pmd) && !pmd_bad(pmd) && !pmd_table_write(pmd);
+}
+
+extern int unshare_pte_table(struct vm_area_struct *vma, pmd_t *pmd,
+			     unsigned long addr);
+extern int unshare_pte_tables(struct vm_area_struct *vma, unsigned long start,
+			      unsigned long end);
+#else
+static inline bool pmd_shared_table(pmd_t pmd)
+{
+	return false;
+}
+
+static inline int unshare_pte_table(struct vm_area_struct *vma, pmd_t *pmd,
+				    unsigned long addr)
+{
+	return 0;
+}
+
+static inline int unshare_pte_tables(struct vm_area_struct *vma,
+				     unsigned long start, unsigned long end)
+{
+	return 0;
+}
+#endif
+
+/* A shared pte table must map a single vma, unshare it before a split */
+static inline int split_shared_pte_table(struct vm_area_struct *vma,
+					 unsigned long addr)
+{
+	if (!(addr & ~PMD_MASK))
+		return 0;
+	return unshare_pte_tables(vma, addr, addr + PAGE_SIZE);
+}
+
 #define pte_alloc_map(mm, pmd, address)			\
 	(pte_alloc(mm, pmd, address) ? NULL : pte_offset_map(pmd, address))
 
@@ -8,6 +8,7 @@
 #include <linux/spinlock.h>
 #include <linux/rbtree.h>
 #include <linux/rwsem.h>
+#include <linux/seqlock.h>
 #include <linux/completion.h>
 #include <linux/cpumask.h>
 #include <linux/uprobes.h>
@@ -22,6 +23,7 @@
 #define AT_VECTOR_SIZE (2*(AT_VECTOR_SIZE_ARCH + AT_VECTOR_SIZE_BASE + 1))
 
 struct address_space;
+struct page_pool;
 struct mem_cgroup;
 
 /*
@@ -59,6 +61,8 @@ struct page {
 		pgoff_t index;		/* Our offset within mapping. */
 		void *freelist;		/* sl[aou]b first free object */
 		/* page_deferred_list().prev	-- second tail page */
+		unsigned long pt_share_count;	/* mms sharing a pte table,
+						 * under its ptl */
 	};
 
 	union {
@@ -136,6 +140,10 @@ struct page {
 		struct rcu_head rcu_head;	/* Used by SLAB
 						 * when destroying via RCU
 						 */
+		struct {		/* page_pool, for network drivers */
+			struct page_pool *pp;
+			unsigned long dma_addr;	/* See page_pool_map() */
+		};
 		/* Tail pages of compound page */
 		struct {
 			unsigned long compound_head; /* If bit zero is set */
@@ -342,6 +350,14 @@ struct vm_area_struct {
 	struct mempolicy *vm_policy;	/* NUMA policy for the VMA */
 #endif
 	struct vm_userfaultfd_ctx vm_userfaultfd_ctx;
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	/*
+	 * Odd while the fields a speculative fault relies on are being
+	 * changed, and forever once the VMA is detached from the mm.
+	 */
+	seqcount_t vm_sequence;
+	struct rcu_head vm_rcu;		/* VMAs are freed after a grace period */
+#endif
 };
 
 struct core_thread {
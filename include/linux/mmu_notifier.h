@@ -75,6 +75,19 @@ struct mmu_notifier_ops {
 			   unsigned long start,
 			   unsigned long end);
 
+	/*
+	 * clear_young_bitmap is a batched clear_young, for ranges of at
+	 * most BITS_PER_LONG pages. Bit n of @young selects the page at
+	 * start + n * PAGE_SIZE on entry, and is left set on return only
+	 * if the secondary pte of that page was young. The young bitflag
+	 * of the pages that aren't selected must be left alone.
+	 */
+	void (*clear_young_bitmap)(struct mmu_notifier *mn,
+				   struct mm_struct *mm,
+				   unsigned long start,
+				   unsigned long end,
+				   unsigned long *young);
+
 	/*
 	 * test_young is called to check the young/accessed bitflag in
 	 * the secondary pte. This is used to know if the page is
@@ -216,6 +229,10 @@ extern int __mmu_notifier_clear_flush_young(struct mm_struct *mm,
 extern int __mmu_notifier_clear_young(struct mm_struct *mm,
 				      unsigned long start,
 				      unsigned long end);
+extern bool __mmu_notifier_clear_young_bitmap(struct mm_struct *mm,
+					      unsigned long start,
+					      unsigned long end,
+					      unsigned long *young);
 extern int __mmu_notifier_test_young(struct mm_struct *mm,
 				     unsigned long address);
 extern void __mmu_notifier_change_pte(struct mm_struct *mm,
@@ -253,6 +270,21 @@ static inline int mmu_notifier_clear_young(struct mm_struct *mm,
 	return 0;
 }
 
+/*
+ * Returns false, without touching the secondary ptes, if one of the
+ * secondary MMUs can only age the pages one range at a time.
+ */
+static inline bool mmu_notifier_clear_young_bitmap(struct mm_struct *mm,
+						   unsigned long start,
+						   unsigned long end,
+						   unsigned long *young)
+{
+	if (mm_has_notifiers(mm))
+		return __mmu_notifier_clear_young_bitmap(mm, start, end, young);
+	*young = 0;
+	return true;
+}
+
 static inline int mmu_notifier_test_young(struct mm_struct *mm,
 					  unsigned long address)
 {
@@ -431,6 +463,15 @@ static inline int mmu_notifier_clear_flush_young(struct mm_struct *mm,
 	return 0;
 }
 
+static inline bool mmu_notifier_clear_young_bitmap(struct mm_struct *mm,
+						   unsigned long start,
+						   unsigned long end,
+						   unsigned long *young)
+{
+	*young = 0;
+	return true;
+}
+
 static inline int mmu_notifier_test_young(struct mm_struct *mm,
 					  unsigned long address)
 {
@@ -270,6 +270,12 @@ struct per_cpu_pages {
 
 	/* Lists of pages, one per migrate type stored on the pcp-lists */
 	struct list_head lists[MIGRATE_PCPTYPES];
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	/* Movable HPAGE_PMD_ORDER pages, not accounted in count */
+	int thp_count;
+	struct list_head thp_list;
+#endif
 };
 
 struct per_cpu_pageset {
@@ -104,6 +104,9 @@ enum pageflags {
 #if defined(CONFIG_IDLE_PAGE_TRACKING) && defined(CONFIG_64BIT)
 	PG_young,
 	PG_idle,
+#endif
+#ifdef CONFIG_PAGE_PREZERO
+	PG_zeroed,		/* Free page known to be filled with zeroes */
 #endif
 	__NR_PAGEFLAGS,
 
@@ -135,6 +138,9 @@ enum pageflags {
 
 	/* non-lru isolated movable page */
 	PG_isolated = PG_reclaim,
+
+	/* Free pages reported to the host, see mm/page_reporting.c */
+	PG_reported = PG_uptodate,
 };
 
 #ifndef __GENERATING_BOUNDS_H
@@ -249,6 +255,9 @@ static inline void ClearPage##uname(struct page *page) {  }
 #define __CLEARPAGEFLAG_NOOP(uname)					\
 static inline void __ClearPage##uname(struct page *page) {  }
 
+#define __SETPAGEFLAG_NOOP(uname)					\
+static inline void __SetPage##uname(struct page *page) {  }
+
 #define TESTSETFLAG_FALSE(uname)					\
 static inline int TestSetPage##uname(struct page *page) { return 0; }
 
@@ -370,6 +379,30 @@ TESTCLEARFLAG(Young, young, PF_ANY)
 PAGEFLAG(Idle, idle, PF_ANY)
 #endif
 
+/*
+ * Only ever set on free pages, by the page allocator: see
+ * mm/page_prezero.c.
+ */
+#ifdef CONFIG_PAGE_PREZERO
+__PAGEFLAG(Zeroed, zeroed, PF_ANY)
+#define __PG_ZEROED		(1UL << PG_zeroed)
+#else
+TESTPAGEFLAG_FALSE(Zeroed)
+__SETPAGEFLAG_NOOP(Zeroed) __CLEARPAGEFLAG_NOOP(Zeroed)
+#define __PG_ZEROED		0
+#endif
+
+/*
+ * Only ever set on free pages, by the page allocator: see
+ * mm/page_reporting.c.
+ */
+#ifdef CONFIG_PAGE_REPORTING
+__PAGEFLAG(Reported, reported, PF_NO_COMPOUND)
+#else
+TESTPAGEFLAG_FALSE(Reported)
+__SETPAGEFLAG_NOOP(Reported) __CLEARPAGEFLAG_NOOP(Reported)
+#endif
+
 /*
  * On an anonymous page mapped into a user virtual memory area,
  * page->mapping points to its anon_vma, not to a struct address_space;
@@ -722,7 +755,8 @@ static inline void ClearPageSlabPfmemalloc(struct page *page)
 	 1UL << PG_private	| 1UL << PG_private_2	|	\
 	 1UL << PG_writeback	| 1UL << PG_reserved	|	\
 	 1UL << PG_slab		| 1UL << PG_active 	|	\
-	 1UL << PG_unevictable	| __PG_MLOCKED)
+	 1UL << PG_unevictable	| __PG_MLOCKED		|	\
+	 __PG_ZEROED)
 
 /*
  * Flags checked when a page is prepped for return by the page allocator.
@@ -730,10 +764,11 @@ static inline void ClearPageSlabPfmemalloc(struct page *page)
  * there has been a kernel bug or struct page corruption.
  *
  * __PG_HWPOISON is exceptional because it needs to be kept beyond page's
- * alloc-free cycle to prevent from reusing the page.
+ * alloc-free cycle to prevent from reusing the page. __PG_ZEROED is set on
+ * free pages, and only cleared by prep_new_page().
  */
 #define PAGE_FLAGS_CHECK_AT_PREP	\
-	(((1UL << NR_PAGEFLAGS) - 1) & ~__PG_HWPOISON)
+	(((1UL << NR_PAGEFLAGS) - 1) & ~(__PG_HWPOISON | __PG_ZEROED))
 
 #define PAGE_FLAGS_PRIVATE				\
 	(1UL << PG_private | 1UL << PG_private_2)
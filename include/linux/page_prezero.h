@@ -0,0 +1,25 @@
+#ifndef _LINUX_MM_PAGE_PREZERO_H
+#define _LINUX_MM_PAGE_PREZERO_H
+
+#include <linux/jump_label.h>
+
+#ifdef CONFIG_PAGE_PREZERO
+extern struct static_key_false page_prezero_key;
+
+/*
+ * True when free pages of HPAGE_PMD_ORDER and above are zeroed in the
+ * background, so that __GFP_ZERO allocations of those can mostly skip
+ * clearing them.
+ */
+static inline bool page_prezero_enabled(void)
+{
+	return static_branch_unlikely(&page_prezero_key);
+}
+#else
+static inline bool page_prezero_enabled(void)
+{
+	return false;
+}
+#endif
+
+#endif /* _LINUX_MM_PAGE_PREZERO_H */
@@ -0,0 +1,64 @@
+#ifndef _LINUX_MM_PAGE_REPORTING_H
+#define _LINUX_MM_PAGE_REPORTING_H
+
+#include <linux/mmzone.h>
+#include <linux/jump_label.h>
+#include <linux/scatterlist.h>
+#include <linux/workqueue.h>
+
+/* Free pages of this order and above are reported */
+#define PAGE_REPORTING_MIN_ORDER	pageblock_order
+
+/* Most pages in a single report */
+#define PAGE_REPORTING_CAPACITY		32
+
+struct page_reporting_dev_info {
+	/*
+	 * Tell the host about the @nents free pages of @sg, each of them
+	 * PAGE_SIZE << PAGE_REPORTING_MIN_ORDER or larger. It may sleep, the
+	 * pages stay off the free lists until it returns.
+	 */
+	int (*report)(struct page_reporting_dev_info *prdev,
+		      struct scatterlist *sg, unsigned int nents);
+
+	/* Private to mm/page_reporting.c */
+	struct delayed_work work;
+	atomic_t state;
+};
+
+#ifdef CONFIG_PAGE_REPORTING
+extern struct static_key_false page_reporting_key;
+
+int page_reporting_register(struct page_reporting_dev_info *prdev);
+void page_reporting_unregister(struct page_reporting_dev_info *prdev);
+void __page_reporting_notify(void);
+
+/*
+ * Called by the page allocator with the zone lock held, when a page of
+ * @order goes back to the free lists.
+ */
+static inline void page_reporting_notify_free(unsigned int order)
+{
+	if (!static_branch_unlikely(&page_reporting_key))
+		return;
+
+	if (order >= PAGE_REPORTING_MIN_ORDER)
+		__page_reporting_notify();
+}
+#else
+static inline int page_reporting_register(struct page_reporting_dev_info *prdev)
+{
+	return -EOPNOTSUPP;
+}
+
+static inline void
+page_reporting_unregister(struct page_reporting_dev_info *prdev)
+{
+}
+
+static inline void page_reporting_notify_free(unsigned int order)
+{
+}
+#endif
+
+#endif /* _LINUX_MM_PAGE_REPORTING_H */
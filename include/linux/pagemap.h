@@ -589,6 +589,9 @@ int add_to_page_cache_lru(struct page *page, struct address_space *mapping,
 				pgoff_t index, gfp_t gfp_mask);
 extern void delete_from_page_cache(struct page *page);
 extern void __delete_from_page_cache(struct page *page, void *shadow);
+struct pagevec;
+extern void delete_from_page_cache_batch(struct address_space *mapping,
+					 struct pagevec *pvec);
 int replace_page_cache_page(struct page *old, struct page *new, gfp_t gfp_mask);
 
 /*
@@ -69,6 +69,16 @@ struct sbitmap {
 #define SBQ_WAIT_QUEUES 8
 #define SBQ_WAKE_BATCH 8
 
+/*
+ * The per-cpu bit cache of a &struct sbitmap_queue holds up to
+ * SBQ_CACHE_BATCH bits from one aligned group in a single word: the low
+ * SBQ_CACHE_SHIFT bits are a mask of cached bits, the rest is the index
+ * of the group.
+ */
+#define SBQ_CACHE_BATCH 8
+#define SBQ_CACHE_SHIFT 8
+#define SBQ_CACHE_MASK ((1UL << SBQ_CACHE_SHIFT) - 1)
+
 /**
  * struct sbq_wait_state - Wait queue in a &struct sbitmap_queue.
  */
@@ -107,6 +117,18 @@ struct sbitmap_queue {
 	 */
 	unsigned int __percpu *alloc_hint;
 
+	/**
+	 * @cache: Optional per-cpu cache of allocated but unused bits, see
+	 * sbitmap_queue_init_cache().
+	 */
+	unsigned long __percpu *cache;
+
+	/**
+	 * @ws_active: Number of waiters that must see every freed bit. Bits are
+	 * only freed into @cache while this is zero.
+	 */
+	atomic_t ws_active;
+
 	/**
 	 * @wake_batch: Number of bits which must be freed before we wake up any
 	 * waiters.
@@ -319,11 +341,40 @@ int sbitmap_queue_init_node(struct sbitmap_queue *sbq, unsigned int depth,
  */
 static inline void sbitmap_queue_free(struct sbitmap_queue *sbq)
 {
+	free_percpu(sbq->cache);
 	kfree(sbq->ws);
 	free_percpu(sbq->alloc_hint);
 	sbitmap_free(&sbq->sb);
 }
 
+/**
+ * sbitmap_queue_init_cache() - Enable per-cpu bit caching on a &struct
+ * sbitmap_queue.
+ * @sbq: Bitmap queue to cache bits from.
+ * @flags: Allocation flags.
+ *
+ * With a cache, __sbitmap_queue_get() takes a group of up to SBQ_CACHE_BATCH
+ * bits from the bitmap at once and hands them out from a per-cpu word, and
+ * sbitmap_queue_clear() puts bits back into the cache of the freeing CPU when
+ * they belong to the same group, so the shared bitmap words are touched once
+ * per batch instead of once per bit. Cached bits are given back to the bitmap
+ * when the bitmap runs out of free bits, so they are never lost to other CPUs.
+ *
+ * Anyone sleeping on one of the wait queues must be accounted in @ws_active,
+ * see sbitmap_queue_wait_start(). Round-robin queues and bitmaps with less
+ * than SBQ_CACHE_BATCH bits per word are left without a cache.
+ *
+ * Return: Zero on success or negative errno on failure.
+ */
+int sbitmap_queue_init_cache(struct sbitmap_queue *sbq, gfp_t flags);
+
+/**
+ * sbitmap_queue_flush_cache() - Give back all cached bits of a &struct
+ * sbitmap_queue to the bitmap and wake up waiters.
+ * @sbq: Bitmap queue to flush.
+ */
+void sbitmap_queue_flush_cache(struct sbitmap_queue *sbq);
+
 /**
  * sbitmap_queue_resize() - Resize a &struct sbitmap_queue.
  * @sbq: Bitmap queue to resize.
@@ -438,6 +489,30 @@ static inline struct sbq_wait_state *sbq_wait_ptr(struct sbitmap_queue *sbq,
 	return ws;
 }
 
+/**
+ * sbitmap_queue_wait_start() - Account a waiter on a &struct sbitmap_queue.
+ * @sbq: Bitmap queue about to be waited on.
+ *
+ * Must be called before the waiter retries the allocation one last time and
+ * goes to sleep, so that bits freed from then on are not kept in a per-cpu
+ * cache. Pairs with sbitmap_queue_wait_end().
+ */
+static inline void sbitmap_queue_wait_start(struct sbitmap_queue *sbq)
+{
+	atomic_inc(&sbq->ws_active);
+	smp_mb__after_atomic();
+}
+
+/**
+ * sbitmap_queue_wait_end() - Drop a waiter accounted with
+ * sbitmap_queue_wait_start().
+ * @sbq: Bitmap queue that was waited on.
+ */
+static inline void sbitmap_queue_wait_end(struct sbitmap_queue *sbq)
+{
+	atomic_dec(&sbq->ws_active);
+}
+
 /**
  * sbitmap_queue_wake_all() - Wake up everything waiting on a &struct
  * sbitmap_queue.
@@ -137,9 +137,15 @@ extern int shmem_mcopy_atomic_pte(struct mm_struct *dst_mm, pmd_t *dst_pmd,
 				  unsigned long dst_addr,
 				  unsigned long src_addr,
 				  struct page **pagep);
+extern int shmem_mcontinue_atomic_pte(struct mm_struct *dst_mm,
+				      pmd_t *dst_pmd,
+				      struct vm_area_struct *dst_vma,
+				      unsigned long dst_addr);
 #else
 #define shmem_mcopy_atomic_pte(dst_mm, dst_pte, dst_vma, dst_addr, \
 			       src_addr, pagep)        ({ BUG(); 0; })
+#define shmem_mcontinue_atomic_pte(dst_mm, dst_pte, dst_vma, dst_addr) \
+					({ BUG(); 0; })
 #endif
 
 #endif
@@ -35,6 +35,9 @@ enum stat_item {
 	CPU_PARTIAL_FREE,	/* Refill cpu partial on free */
 	CPU_PARTIAL_NODE,	/* Refill cpu partial from node partial */
 	CPU_PARTIAL_DRAIN,	/* Drain cpu partial to node partial */
+	ALLOC_SHEAF,		/* Allocation from the cpu sheaf */
+	FREE_SHEAF,		/* Free to the cpu sheaf */
+	SHEAF_FLUSH,		/* Objects of a full cpu sheaf freed in bulk */
 	NR_SLUB_STAT_ITEMS };
 
 struct kmem_cache_cpu {
@@ -47,6 +50,16 @@ struct kmem_cache_cpu {
 #endif
 };
 
+/*
+ * Optional per cpu array of free objects, in front of the cpu slab.
+ * Only accessed with interrupts disabled.
+ */
+struct slub_sheaf {
+	unsigned int capacity;
+	unsigned int count;
+	void *objects[];
+};
+
 /*
  * Word size structure that can be atomically updated or read and that
  * contains both the order and the number of objects that a slab of the
@@ -61,6 +74,7 @@ struct kmem_cache_order_objects {
  */
 struct kmem_cache {
 	struct kmem_cache_cpu __percpu *cpu_slab;
+	struct slub_sheaf __percpu *cpu_sheaf;	/* NULL unless enabled */
 	/* Used for retriving partial slabs etc */
 	unsigned long flags;
 	unsigned long min_partial;
@@ -15,6 +15,7 @@ struct epoll_event;
 struct iattr;
 struct inode;
 struct iocb;
+struct aio_sq_ring;
 struct io_event;
 struct iovec;
 struct itimerspec;
@@ -498,6 +499,9 @@ asmlinkage long sys_ioctl(unsigned int fd, unsigned int cmd,
 				unsigned long arg);
 asmlinkage long sys_flock(unsigned int fd, unsigned int cmd);
 asmlinkage long sys_io_setup(unsigned nr_reqs, aio_context_t __user *ctx);
+asmlinkage long sys_io_setup2(unsigned nr_reqs, unsigned flags,
+			      struct aio_sq_ring __user *sq_ring,
+			      aio_context_t __user *ctx);
 asmlinkage long sys_io_destroy(aio_context_t ctx);
 asmlinkage long sys_io_getevents(aio_context_t ctx_id,
 				long min_nr,
@@ -302,4 +302,18 @@ extern long strncpy_from_unsafe(char *dst, const void *unsafe_addr, long count);
 #define unsafe_put_user(x, ptr, err) do { if (unlikely(__put_user(x, ptr))) goto err; } while (0)
 #endif
 
+/*
+ * A run of copies to or from user buffers already checked with
+ * access_ok() can be made with unsafe_copy_{to,from}_user() between
+ * user_copy_begin() and user_copy_end(), for architectures to enable
+ * user access only once for all of them. Nothing that may sleep can be
+ * called in between, other than through the copies faulting.
+ */
+#ifndef user_copy_begin
+#define user_copy_begin() do { } while (0)
+#define user_copy_end() do { } while (0)
+#define unsafe_copy_from_user(to, from, n) raw_copy_from_user(to, from, n)
+#define unsafe_copy_to_user(to, from, n) raw_copy_to_user(to, from, n)
+#endif
+
 #endif		/* __LINUX_UACCESS_H__ */
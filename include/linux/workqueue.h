@@ -12,8 +12,10 @@
 #include <linux/threads.h>
 #include <linux/atomic.h>
 #include <linux/cpumask.h>
+#include <linux/llist.h>
 
 struct workqueue_struct;
+struct pool_workqueue;
 
 struct work_struct;
 typedef void (*work_func_t)(struct work_struct *work);
@@ -99,7 +101,14 @@ enum {
 
 struct work_struct {
 	atomic_long_t data;
-	struct list_head entry;
+	union {
+		struct list_head entry;
+		/* while queued locklessly from the pool's cpu */
+		struct {
+			struct llist_node llnode;
+			struct pool_workqueue *llpwq;
+		};
+	};
 	work_func_t func;
 #ifdef CONFIG_LOCKDEP
 	struct lockdep_map lockdep_map;
@@ -0,0 +1,9 @@
+#ifndef _LINUX_XXHASH_H
+#define _LINUX_XXHASH_H
+
+#include <linux/types.h>
+
+/* The 64-bit xxHash of @len bytes at @input, as used by Zstandard frames */
+u64 xxh64(const void *input, size_t len, u64 seed);
+
+#endif /* _LINUX_XXHASH_H */
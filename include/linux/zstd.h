@@ -0,0 +1,29 @@
+#ifndef _LINUX_ZSTD_H
+#define _LINUX_ZSTD_H
+
+#include <linux/types.h>
+
+/*
+ * Zstandard (RFC 8478) compression of whole buffers. The compressor emits
+ * single frames without dictionary or checksum, the decompressor takes any
+ * sequence of frames and skippable frames that don't need a dictionary.
+ */
+
+#define ZSTD_MIN_CLEVEL		1
+#define ZSTD_MAX_CLEVEL		9
+#define ZSTD_DEFAULT_CLEVEL	3
+
+/* Largest frame zstd_compress() can produce for @len bytes */
+#define ZSTD_COMPRESS_BOUND(len)	((len) + 3 * ((len) >> 17) + 20)
+
+size_t zstd_compress_workspace_size(int level);
+int zstd_compress(const void *src, size_t src_len, void *dst, size_t *dst_len,
+		  int level, void *wrkmem);
+
+size_t zstd_decompress_workspace_size(void);
+int zstd_decompress(const void *src, size_t src_len, void *dst,
+		    size_t *dst_len, void *wrkmem);
+int zstd_decompress_frame(const void *src, size_t *src_len, void *dst,
+			  size_t *dst_len, void *wrkmem);
+
+#endif /* _LINUX_ZSTD_H */
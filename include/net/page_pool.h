@@ -0,0 +1,156 @@
+/*
+ * page_pool: recycling of RX pages for network drivers
+ *
+ * Copyright (C) 2017 - Linaro Ltd
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/*
+ * A page pool hands out pages to a single RX queue, and takes them back
+ * once the driver, XDP or the stack is done with them. Pages returned
+ * from the queue's own NAPI poll go to a small array only touched from
+ * that context, which needs no locking. Pages returned from anywhere
+ * else go through a ptr_ring. The pages keep their DMA mapping across
+ * recycles when PP_FLAG_DMA_MAP is set; the driver still has to sync
+ * them for the device before handing them to the hardware.
+ *
+ * A page is only recycled when the pool holds the last reference to
+ * it. Otherwise it is unmapped, detached from the pool and released to
+ * the page allocator by its last user as any other page.
+ *
+ * The driver marks the skbs it builds around pool pages with
+ * skb_mark_for_recycle(), so that freeing the skb returns the head and
+ * fragments to the pool. XDP frames are always returned to their pool.
+ */
+
+#ifndef _NET_PAGE_POOL_H
+#define _NET_PAGE_POOL_H
+
+#include <linux/mm.h>
+#include <linux/ptr_ring.h>
+#include <linux/dma-direction.h>
+#include <linux/workqueue.h>
+
+#define PP_FLAG_DMA_MAP	BIT(0) /* Should page_pool do the DMA map/unmap */
+#define PP_FLAG_ALL	PP_FLAG_DMA_MAP
+
+/* Stored in page->private of the pages a pool owns */
+#define PP_SIGNATURE	(0x40 + POISON_POINTER_DELTA)
+
+/*
+ * Fast allocation side cache array/stack
+ *
+ * The cache size and refill watermark is related to the network
+ * use-case. The NAPI budget is 64 packets. After a NAPI poll the RX
+ * ring is usually refilled and the max consumed elements will be 64,
+ * thus a natural max size of objects needed in the cache.
+ *
+ * Keeping room for more objects, is due to XDP_DROP use-case. As
+ * XDP_DROP allows the opportunity to recycle objects directly into
+ * this array, as it shares the same softirq/NAPI protection. If
+ * cache is already full (or partly full) then the XDP_DROP recycles
+ * would have to take a slower code path.
+ */
+#define PP_ALLOC_CACHE_SIZE	128
+#define PP_ALLOC_CACHE_REFILL	64
+struct pp_alloc_cache {
+	u32 count;
+	void *cache[PP_ALLOC_CACHE_SIZE];
+};
+
+struct page_pool_params {
+	unsigned int	flags;
+	unsigned int	order;
+	unsigned int	pool_size;
+	int		nid;  /* NUMA node to allocate the pages from */
+	struct device	*dev; /* device, for DMA pre-mapping purposes */
+	enum dma_data_direction dma_dir; /* DMA mapping direction */
+};
+
+struct page_pool {
+	struct page_pool_params p;
+
+	u32 pages_state_hold_cnt;
+	struct delayed_work release_dw;
+
+	/*
+	 * Data structure for allocation side
+	 *
+	 * Drivers allocation side usually already perform some kind
+	 * of resource protection.  Piggyback on this protection, and
+	 * require driver to protect allocation side.
+	 *
+	 * For NIC drivers this means, allocate a page_pool per
+	 * RX-queue. As the RX-queue is already protected by
+	 * Softirq/BH scheduling and napi_schedule. NAPI schedule
+	 * guarantee that a single napi_struct will only be scheduled
+	 * on a single CPU (see napi_schedule).
+	 */
+	struct pp_alloc_cache alloc ____cacheline_aligned_in_smp;
+
+	/*
+	 * Data structure for freeing side
+	 *
+	 * Returned or recycled pages, need to be able to be returned
+	 * from remote CPUs, and from process context.
+	 */
+	struct ptr_ring ring;
+
+	atomic_t pages_state_release_cnt;
+};
+
+struct page *page_pool_alloc_pages(struct page_pool *pool, gfp_t gfp);
+
+static inline struct page *page_pool_dev_alloc_pages(struct page_pool *pool)
+{
+	gfp_t gfp = (GFP_ATOMIC | __GFP_NOWARN);
+
+	return page_pool_alloc_pages(pool, gfp);
+}
+
+struct page_pool *page_pool_create(const struct page_pool_params *params);
+void page_pool_destroy(struct page_pool *pool);
+
+/* Never call this directly, use helpers below */
+void __page_pool_put_page(struct page_pool *pool, struct page *page,
+			  bool allow_direct);
+
+static inline void page_pool_put_page(struct page_pool *pool,
+				      struct page *page)
+{
+	__page_pool_put_page(pool, page, false);
+}
+
+/* Very limited use-cases allow recycle direct, from the pool's NAPI poll */
+static inline void page_pool_recycle_direct(struct page_pool *pool,
+					    struct page *page)
+{
+	__page_pool_put_page(pool, page, true);
+}
+
+/* Disconnect a page from its pool, when it is handed on for good */
+void page_pool_release_page(struct page_pool *pool, struct page *page);
+
+static inline dma_addr_t page_pool_get_dma_addr(struct page *page)
+{
+	return (dma_addr_t)page->dma_addr;
+}
+
+static inline bool page_pool_owned(struct page *page)
+{
+	return page_private(page) == PP_SIGNATURE;
+}
+
+#ifdef CONFIG_PAGE_POOL
+bool page_pool_return_page(struct page *page);
+#else
+static inline bool page_pool_return_page(struct page *page)
+{
+	return false;
+}
+#endif
+
+#endif /* _NET_PAGE_POOL_H */
@@ -272,6 +272,7 @@ void udp_err(struct sk_buff *, u32);
 int udp_abort(struct sock *sk, int err);
 int udp_sendmsg(struct sock *sk, struct msghdr *msg, size_t len);
 int udp_push_pending_frames(struct sock *sk);
+int udp_cmsg_send(struct sock *sk, struct msghdr *msg, u16 *gso_size);
 void udp_flush_pending_frames(struct sock *sk);
 void udp4_hwcsum(struct sk_buff *skb, __be32 src, __be32 dst);
 int udp_rcv(struct sk_buff *skb);
@@ -283,6 +284,8 @@ unsigned int udp_poll(struct file *file, struct socket *sock, poll_table *wait);
 struct sk_buff *skb_udp_tunnel_segment(struct sk_buff *skb,
 				       netdev_features_t features,
 				       bool is_ipv6);
+struct sk_buff *__udp_gso_segment(struct sk_buff *gso_skb,
+				  netdev_features_t features);
 int udp_lib_getsockopt(struct sock *sk, int level, int optname,
 		       char __user *optval, int __user *optlen);
 int udp_lib_setsockopt(struct sock *sk, int level, int optname,
@@ -338,6 +341,36 @@ do {									\
 #define __UDPX_INC_STATS(sk, field) __UDP_INC_STATS(sock_net(sk), field, 0)
 #endif
 
+/*
+ * Split a GRO packet that reached a socket which did not enable UDP_GRO
+ * back into the datagrams it was built from. skb->data must point at the
+ * network header.
+ */
+static inline struct sk_buff *udp_rcv_segment(struct sock *sk,
+					      struct sk_buff *skb)
+{
+	netdev_features_t features = NETIF_F_SG;
+	struct sk_buff *segs;
+
+	/* Avoid recomputing the checksums, they were checked by GRO,
+	 * unless the socket asked to see them converted.
+	 */
+	if (!inet_get_convert_csum(sk))
+		features |= NETIF_F_IP_CSUM | NETIF_F_IPV6_CSUM;
+
+	/* The GSO CB lies after the UDP one, nothing to save */
+	segs = __skb_gso_segment(skb, features, false);
+	if (unlikely(IS_ERR_OR_NULL(segs))) {
+		atomic_add(skb_shinfo(skb)->gso_segs, &sk->sk_drops);
+		__UDPX_INC_STATS(sk, UDP_MIB_INERRORS);
+		kfree_skb(skb);
+		return NULL;
+	}
+
+	consume_skb(skb);
+	return segs;
+}
+
 /* /proc */
 int udp_seq_open(struct inode *inode, struct file *file);
 
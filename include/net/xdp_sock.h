@@ -0,0 +1,72 @@
+/*
+ * AF_XDP internal functions
+ *
+ * Copyright (C) 2017 - Linaro Ltd
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef _LINUX_XDP_SOCK_H
+#define _LINUX_XDP_SOCK_H
+
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <net/sock.h>
+
+struct net_device;
+struct xdp_buff;
+struct xsk_queue;
+struct xdp_umem;
+struct xsk_flush_node;
+
+struct xdp_sock {
+	/* struct sock must be the first member of struct xdp_sock */
+	struct sock sk;
+	struct xsk_queue *rx;
+	struct net_device *dev;
+	struct xdp_umem *umem;
+	/* Pending wakeup, per CPU doing the redirect */
+	struct xsk_flush_node __percpu *flush_node;
+	/* Protects the RX ring and the UMEM fill ring, which are filled by
+	 * whichever CPU runs the XDP program redirecting to the socket.
+	 */
+	spinlock_t rx_lock;
+	u64 rx_dropped;
+	struct xsk_queue *tx ____cacheline_aligned_in_smp;
+	/* Protects the completion ring, fed by skb destructors */
+	spinlock_t tx_completion_lock;
+	/* Protects the socket setup, bind and sendmsg */
+	struct mutex mutex;
+};
+
+static inline struct xdp_sock *xdp_sk(struct sock *sk)
+{
+	return (struct xdp_sock *)sk;
+}
+
+#ifdef CONFIG_XDP_SOCKETS
+int xsk_rcv(struct xdp_sock *xs, struct xdp_buff *xdp, struct net_device *dev);
+int xsk_generic_rcv(struct xdp_sock *xs, struct xdp_buff *xdp,
+		    struct net_device *dev);
+void __xsk_map_flush(void);
+#else
+static inline int xsk_rcv(struct xdp_sock *xs, struct xdp_buff *xdp,
+			  struct net_device *dev)
+{
+	return -ENOTSUPP;
+}
+
+static inline int xsk_generic_rcv(struct xdp_sock *xs, struct xdp_buff *xdp,
+				  struct net_device *dev)
+{
+	return -ENOTSUPP;
+}
+
+static inline void __xsk_map_flush(void)
+{
+}
+#endif /* CONFIG_XDP_SOCKETS */
+
+#endif /* _LINUX_XDP_SOCK_H */
@@ -104,6 +104,55 @@ struct iocb {
 	__u32	aio_resfd;
 }; /* 64 bytes */
 
+/*
+ * Flags for io_setup2().
+ *
+ * IOCTX_FLAG_SQRING	- iocbs are submitted through the struct aio_sq_ring
+ *			  passed to io_setup2(), and io_submit() is called
+ *			  with a NULL iocbpp to have the kernel consume up
+ *			  to nr of them. Buffered reads that would have to
+ *			  wait for the page cache are completed from a
+ *			  worker instead of blocking the submitter.
+ * IOCTX_FLAG_SQTHREAD	- a kernel thread consumes the submission ring as
+ *			  it is filled, needs IOCTX_FLAG_SQRING and
+ *			  CAP_SYS_ADMIN. Once the thread has been idle for
+ *			  aio_sq_ring.thread_idle milliseconds it sets
+ *			  AIO_SQ_NEED_WAKEUP and sleeps until io_submit()
+ *			  is called.
+ * IOCTX_FLAG_IOPOLL	- the completion of O_DIRECT I/O to a block device
+ *			  that supports polling is polled for, from
+ *			  io_getevents() or from the submission thread,
+ *			  instead of waiting for its interrupt. Other I/O
+ *			  fails with -EOPNOTSUPP.
+ */
+#define IOCTX_FLAG_SQRING	(1 << 0)
+#define IOCTX_FLAG_SQTHREAD	(1 << 1)
+#define IOCTX_FLAG_IOPOLL	(1 << 2)
+
+#define IOCTX_FLAGS_ALL		(IOCTX_FLAG_SQRING | IOCTX_FLAG_SQTHREAD | \
+				 IOCTX_FLAG_IOPOLL)
+
+/*
+ * Submission ring of an IOCTX_FLAG_SQRING context, in page aligned memory
+ * provided by the application, which must set nr (a power of 2) before
+ * calling io_setup2(). The application fills iocbs[tail & (nr - 1)] and
+ * then increments tail, the kernel increments head once it has read an
+ * entry. Completions go to the usual event ring, which the application
+ * can read directly.
+ */
+struct aio_sq_ring {
+	__u32	head;		/* written by the kernel */
+	__u32	tail;		/* written by the application */
+	__u32	nr;		/* number of entries */
+	__u32	flags;		/* AIO_SQ_* */
+	__u32	dropped;	/* entries that could not even be completed */
+	__u32	thread_idle;	/* IOCTX_FLAG_SQTHREAD idle time, in ms */
+	__u32	resv[10];
+	struct iocb iocbs[0];
+}; /* 64 bytes + ring */
+
+#define AIO_SQ_NEED_WAKEUP	(1 << 0)	/* thread needs io_submit() */
+
 #undef IFBIG
 #undef IFLITTLE
 
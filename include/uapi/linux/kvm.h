@@ -108,6 +108,7 @@ struct kvm_userspace_memory_region {
  */
 #define KVM_MEM_LOG_DIRTY_PAGES	(1UL << 0)
 #define KVM_MEM_READONLY	(1UL << 1)
+#define KVM_MEM_LOG_ACCESS	(1UL << 2)
 
 /* for KVM_IRQ_LINE */
 struct kvm_irq_level {
@@ -205,6 +206,7 @@ struct kvm_hyperv_exit {
 #define KVM_EXIT_S390_STSI        25
 #define KVM_EXIT_IOAPIC_EOI       26
 #define KVM_EXIT_HYPERV           27
+#define KVM_EXIT_DIRTY_RING_FULL  28
 
 /* For KVM_EXIT_INTERNAL_ERROR */
 /* Emulate instruction failed. */
@@ -405,6 +407,61 @@ struct kvm_coalesced_mmio_ring {
 	((PAGE_SIZE - sizeof(struct kvm_coalesced_mmio_ring)) / \
 	 sizeof(struct kvm_coalesced_mmio))
 
+/*
+ * One entry of a vcpu dirty ring, mapped at KVM_DIRTY_LOG_PAGE_OFFSET of the
+ * vcpu fd. KVM publishes a dirty gfn with KVM_DIRTY_GFN_F_DIRTY set; userspace
+ * sets KVM_DIRTY_GFN_F_RESET once it has collected it, and the entry is
+ * recycled by the next KVM_RESET_DIRTY_RINGS.
+ */
+struct kvm_dirty_gfn {
+	__u32 flags;
+	__u32 slot; /* as_id | slot_id */
+	__u64 offset;
+};
+
+#define KVM_DIRTY_GFN_F_DIRTY           (1 << 0)
+#define KVM_DIRTY_GFN_F_RESET           (1 << 1)
+#define KVM_DIRTY_GFN_F_MASK            0x3
+
+/*
+ * Layout of the file returned by KVM_GET_STATS_FD on a VM or vcpu fd: the
+ * header, then the id string, then num_desc descriptors each followed by a
+ * name of name_size bytes, then the values as an array of __u64. All but the
+ * values are fixed for the life of the fd, so a reader parses them once and
+ * then preads data_offset onwards.
+ */
+struct kvm_stats_header {
+	__u32 flags;
+	__u32 name_size;
+	__u32 num_desc;
+	__u32 id_offset;
+	__u32 desc_offset;
+	__u32 data_offset;
+};
+
+#define KVM_STATS_NAME_SIZE		48
+
+#define KVM_STATS_TYPE_SHIFT		0
+#define KVM_STATS_TYPE_MASK		(0xf << KVM_STATS_TYPE_SHIFT)
+#define KVM_STATS_TYPE_CUMULATIVE	(0x0 << KVM_STATS_TYPE_SHIFT)
+#define KVM_STATS_TYPE_INSTANT		(0x1 << KVM_STATS_TYPE_SHIFT)
+
+#define KVM_STATS_UNIT_SHIFT		4
+#define KVM_STATS_UNIT_MASK		(0xf << KVM_STATS_UNIT_SHIFT)
+#define KVM_STATS_UNIT_NONE		(0x0 << KVM_STATS_UNIT_SHIFT)
+#define KVM_STATS_UNIT_BYTES		(0x1 << KVM_STATS_UNIT_SHIFT)
+#define KVM_STATS_UNIT_SECONDS		(0x2 << KVM_STATS_UNIT_SHIFT)
+#define KVM_STATS_UNIT_CYCLES		(0x3 << KVM_STATS_UNIT_SHIFT)
+
+struct kvm_stats_desc {
+	__u32 flags;		/* KVM_STATS_TYPE_* | KVM_STATS_UNIT_* */
+	__s16 exponent;		/* the value is in unit * 10^exponent */
+	__u16 size;		/* number of __u64 values */
+	__u32 offset;		/* of the values, from data_offset */
+	__u32 reserved;
+	char name[];
+};
+
 /* for KVM_TRANSLATE */
 struct kvm_translation {
 	/* in */
@@ -895,6 +952,12 @@ struct kvm_ppc_resize_hpt {
 #define KVM_CAP_SPAPR_TCE_VFIO 142
 #define KVM_CAP_X86_GUEST_MWAIT 143
 #define KVM_CAP_ARM_USER_IRQ 144
+#define KVM_CAP_DIRTY_LOG_RING 145
+#define KVM_CAP_HALT_POLL 146
+#define KVM_CAP_BINARY_STATS_FD 147
+#define KVM_CAP_ARM_NESTED_STATE 148
+#define KVM_CAP_ACCESS_LOG 149
+#define KVM_CAP_ARM_NESTED_PASSTHROUGH 150
 
 #ifdef KVM_CAP_IRQ_ROUTING
 
@@ -1318,6 +1381,18 @@ struct kvm_s390_ucas_mapping {
 #define KVM_S390_GET_IRQ_STATE	  _IOW(KVMIO, 0xb6, struct kvm_s390_irq_state)
 /* Available with KVM_CAP_X86_SMM */
 #define KVM_SMI                   _IO(KVMIO,   0xb7)
+/* Available with KVM_CAP_DIRTY_LOG_RING */
+#define KVM_RESET_DIRTY_RINGS     _IO(KVMIO,   0xb8)
+/* Available with KVM_CAP_BINARY_STATS_FD */
+#define KVM_GET_STATS_FD          _IO(KVMIO,   0xb9)
+/* Available with KVM_CAP_ARM_NESTED_STATE */
+#define KVM_ARM_GET_NESTED_STATE  _IOR(KVMIO, 0xba, struct kvm_arm_nested_state)
+#define KVM_ARM_SET_NESTED_STATE  _IOW(KVMIO, 0xbb, struct kvm_arm_nested_state)
+/* Available with KVM_CAP_ACCESS_LOG */
+#define KVM_GET_ACCESS_LOG        _IOW(KVMIO,  0xbc, struct kvm_dirty_log)
+/* Available with KVM_CAP_ARM_NESTED_PASSTHROUGH */
+#define KVM_ARM_NESTED_SET_PASSTHROUGH \
+	_IOW(KVMIO, 0xbd, struct kvm_arm_nested_passthrough)
 
 #define KVM_DEV_ASSIGN_ENABLE_IOMMU	(1 << 0)
 #define KVM_DEV_ASSIGN_PCI_2_3		(1 << 1)
@@ -197,4 +197,11 @@ struct prctl_mm_map {
 # define PR_CAP_AMBIENT_LOWER		3
 # define PR_CAP_AMBIENT_CLEAR_ALL	4
 
+/*
+ * Let fork share the page tables of private anonymous memory with the
+ * child, copying them on first write
+ */
+#define PR_SET_FORK_SHARE_PTE		48
+#define PR_GET_FORK_SHARE_PTE		49
+
 #endif /* _LINUX_PRCTL_H */
@@ -21,6 +21,13 @@ struct vhost_vring_state {
 	unsigned int num;
 };
 
+struct vhost_worker_state {
+	/* Out: id to pass to VHOST_ATTACH_VRING_WORKER */
+	__u32 worker_id;
+	/* In: cpu to bind the worker to, or -1 to leave it unbound */
+	__s32 cpu;
+};
+
 struct vhost_vring_file {
 	unsigned int index;
 	int fd; /* Pass -1 to unbind from file. */
@@ -45,6 +52,11 @@ struct vhost_vring_addr {
 	/* Log writes to used structure, at offset calculated from specified
 	 * address. Address must be 32 bit aligned. */
 	__u64 log_guest_addr;
+	/* With VIRTIO_F_RING_PACKED the descriptor ring is at desc_user_addr
+	 * and must be 128 bit aligned, the driver and device event
+	 * suppression areas are at avail_user_addr and used_user_addr and
+	 * must be 32 bit aligned, and log_guest_addr is the descriptor
+	 * ring's. */
 };
 
 /* no alignment requirement */
@@ -118,13 +130,20 @@ struct vhost_memory {
 /* Specify an eventfd file descriptor to signal on log write. */
 #define VHOST_SET_LOG_FD _IOW(VHOST_VIRTIO, 0x07, int)
 
+/* Each device starts with one worker thread, id 0, running the work of all
+ * its rings. Create another one, at most one per ring. */
+#define VHOST_NEW_WORKER _IOWR(VHOST_VIRTIO, 0x08, struct vhost_worker_state)
+
 /* Ring setup. */
 /* Set number of descriptors in ring. This parameter can not
  * be modified while ring is running (bound to a device). */
 #define VHOST_SET_VRING_NUM _IOW(VHOST_VIRTIO, 0x10, struct vhost_vring_state)
 /* Set addresses for the ring. */
 #define VHOST_SET_VRING_ADDR _IOW(VHOST_VIRTIO, 0x11, struct vhost_vring_addr)
-/* Base value where queue looks for available descriptors */
+/* Base value where queue looks for available descriptors. With
+ * VIRTIO_F_RING_PACKED the upper 16 bits are where it puts used descriptors.
+ * Packed ring indices run free: the slot is the index modulo the ring size,
+ * and the wrap counter is set on even laps around the ring. */
 #define VHOST_SET_VRING_BASE _IOW(VHOST_VIRTIO, 0x12, struct vhost_vring_state)
 /* Get accessor: reads index, writes value in num */
 #define VHOST_GET_VRING_BASE _IOWR(VHOST_VIRTIO, 0x12, struct vhost_vring_state)
@@ -158,6 +177,12 @@ struct vhost_memory {
 /* Get busy loop timeout (in us) */
 #define VHOST_GET_VRING_BUSYLOOP_TIMEOUT _IOW(VHOST_VIRTIO, 0x24,	\
 					 struct vhost_vring_state)
+/* Run the work of a ring on the worker whose id is in num */
+#define VHOST_ATTACH_VRING_WORKER _IOW(VHOST_VIRTIO, 0x25,		\
+					 struct vhost_vring_state)
+/* Get the id of the worker running the work of a ring */
+#define VHOST_GET_VRING_WORKER _IOWR(VHOST_VIRTIO, 0x25,		\
+					 struct vhost_vring_state)
 
 /* VHOST_NET specific defines */
 
@@ -122,6 +122,13 @@
 #define VIRTIO_MMIO_QUEUE_USED_LOW	0x0a0
 #define VIRTIO_MMIO_QUEUE_USED_HIGH	0x0a4
 
+/* Selected queue's notifier offset in the device window - Read Only */
+#define VIRTIO_MMIO_QUEUE_NOTIFY_OFF	0x0b0
+
+/* Shared interrupt status word address, 64 bits in two halves */
+#define VIRTIO_MMIO_INTERRUPT_SHM_LOW	0x0c0
+#define VIRTIO_MMIO_INTERRUPT_SHM_HIGH	0x0c4
+
 /* Configuration atomicity value */
 #define VIRTIO_MMIO_CONFIG_GENERATION	0x0fc
 
@@ -138,4 +145,27 @@
 #define VIRTIO_MMIO_INT_VRING		(1 << 0)
 #define VIRTIO_MMIO_INT_CONFIG		(1 << 1)
 
+
+
+/*
+ * Transport feature bits, version 2 devices only. These are an extension
+ * to the virtio 1.0 MMIO transport, each saving a trap per event.
+ */
+
+/*
+ * The driver writes the address of a 32-bit little-endian word to the
+ * INTERRUPT_SHM registers before DRIVER_OK. The device sets the interrupt
+ * flags in that word instead of the interrupt status register and raises an
+ * edge-triggered interrupt; the driver acknowledges them by clearing the
+ * word, without touching the INTERRUPT_STATUS or INTERRUPT_ACK registers.
+ */
+#define VIRTIO_MMIO_F_SHM_INTERRUPT	36
+
+/*
+ * Each queue is notified by writing its index at QUEUE_NOTIFY_OFF in the
+ * device window, rather than at QUEUE_NOTIFY, so that the device can match
+ * the notification to the queue by its address alone.
+ */
+#define VIRTIO_MMIO_F_QUEUE_NOTIFY_OFF	37
+
 #endif
@@ -0,0 +1,416 @@
+/*
+ * CPU map, moving XDP_REDIRECT frames to other CPUs
+ *
+ * Copyright (C) 2017 - Linaro Ltd
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/*
+ * A cpumap is indexed by CPU number, the value is the size of a queue
+ * feeding a kthread bound to that CPU. bpf_redirect_map() on it hands the
+ * frame to that kthread, which builds an skb and passes it up the stack,
+ * so an XDP program can spread the cost of the network stack over CPUs
+ * other than the one taking the interrupts.
+ *
+ * Frames are gathered in a per-cpu bulk queue and moved to the ptr_ring of
+ * the target CPU up to CPU_MAP_BULK_SIZE at a time, taking the producer
+ * lock once per batch and waking the kthread once per NAPI poll.
+ */
+
+#include <linux/bpf.h>
+#include <linux/filter.h>
+#include <linux/netdevice.h>
+#include <linux/etherdevice.h>
+#include <linux/kthread.h>
+#include <linux/ptr_ring.h>
+#include <linux/workqueue.h>
+#include <linux/slab.h>
+
+#define CPU_MAP_BULK_SIZE	8
+#define CPU_MAP_BUDGET		64
+#define CPU_MAP_MAX_QSIZE	16384
+
+struct xdp_cpu_bulk_queue {
+	void *q[CPU_MAP_BULK_SIZE];
+	struct list_head flush_node;
+	struct bpf_cpu_map_entry *obj;
+	unsigned int count;
+};
+
+struct bpf_cpu_map_entry {
+	u32 cpu;
+	u32 qsize;
+	struct xdp_cpu_bulk_queue __percpu *bulkq;
+	struct ptr_ring queue;
+	struct task_struct *kthread;
+	struct rcu_head rcu;
+	struct work_struct free_work;
+};
+
+struct bpf_cpu_map {
+	struct bpf_map map;
+	struct bpf_cpu_map_entry **cpu_map;
+};
+
+static DEFINE_PER_CPU(struct list_head, cpu_map_flush_list);
+
+static struct bpf_map *cpu_map_alloc(union bpf_attr *attr)
+{
+	struct bpf_cpu_map *cmap;
+	u64 cost;
+	int err;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return ERR_PTR(-EPERM);
+
+	/* check sanity of attributes */
+	if (attr->max_entries == 0 || attr->key_size != 4 ||
+	    attr->value_size != 4 || attr->map_flags)
+		return ERR_PTR(-EINVAL);
+
+	/* Pre-limit array size based on NR_CPUS, not final CPU check */
+	if (attr->max_entries > NR_CPUS)
+		return ERR_PTR(-E2BIG);
+
+	cmap = kzalloc(sizeof(*cmap), GFP_USER);
+	if (!cmap)
+		return ERR_PTR(-ENOMEM);
+
+	cmap->map.map_type = attr->map_type;
+	cmap->map.key_size = attr->key_size;
+	cmap->map.value_size = attr->value_size;
+	cmap->map.max_entries = attr->max_entries;
+	cmap->map.map_flags = attr->map_flags;
+
+	cost = (u64)cmap->map.max_entries * sizeof(struct bpf_cpu_map_entry *);
+	cmap->map.pages = round_up(cost, PAGE_SIZE) >> PAGE_SHIFT;
+
+	err = bpf_map_precharge_memlock(cmap->map.pages);
+	if (err)
+		goto free_cmap;
+
+	err = -ENOMEM;
+	cmap->cpu_map = bpf_map_area_alloc(cost);
+	if (!cmap->cpu_map)
+		goto free_cmap;
+
+	return &cmap->map;
+
+free_cmap:
+	kfree(cmap);
+	return ERR_PTR(err);
+}
+
+static void cpu_map_rx(struct xdp_frame *frame)
+{
+	struct net_device *dev = frame->dev_rx;
+	struct sk_buff *skb;
+
+	skb = xdp_frame_to_skb(frame, dev);
+	if (skb) {
+		skb->protocol = eth_type_trans(skb, dev);
+		netif_receive_skb(skb);
+	}
+
+	/* Taken in cpu_map_enqueue() */
+	dev_put(dev);
+}
+
+static int cpu_map_kthread_run(void *data)
+{
+	struct bpf_cpu_map_entry *rcpu = data;
+
+	set_current_state(TASK_INTERRUPTIBLE);
+
+	/* Only exit once the queue is drained, the frames hold references */
+	while (!kthread_should_stop() || !__ptr_ring_empty(&rcpu->queue)) {
+		struct xdp_frame *frame;
+		unsigned int processed = 0;
+
+		if (__ptr_ring_empty(&rcpu->queue)) {
+			schedule();
+			set_current_state(TASK_INTERRUPTIBLE);
+			continue;
+		}
+		__set_current_state(TASK_RUNNING);
+
+		/* netif_receive_skb() expects to run with BH disabled */
+		local_bh_disable();
+		while (processed < CPU_MAP_BUDGET &&
+		       (frame = __ptr_ring_consume(&rcpu->queue))) {
+			cpu_map_rx(frame);
+			processed++;
+		}
+		local_bh_enable();
+
+		cond_resched();
+		set_current_state(TASK_INTERRUPTIBLE);
+	}
+	__set_current_state(TASK_RUNNING);
+
+	return 0;
+}
+
+static void cpu_map_entry_free_work(struct work_struct *work)
+{
+	struct bpf_cpu_map_entry *rcpu;
+
+	rcpu = container_of(work, struct bpf_cpu_map_entry, free_work);
+
+	kthread_stop(rcpu->kthread);
+	ptr_ring_cleanup(&rcpu->queue, NULL);
+	free_percpu(rcpu->bulkq);
+	kfree(rcpu);
+}
+
+static void cpu_map_entry_free_sched(struct rcu_head *rcu)
+{
+	struct bpf_cpu_map_entry *rcpu;
+
+	/* The bulk queues are empty now, the kthread may need to sleep */
+	rcpu = container_of(rcu, struct bpf_cpu_map_entry, rcu);
+	schedule_work(&rcpu->free_work);
+}
+
+static void cpu_map_entry_free_rcu(struct rcu_head *rcu)
+{
+	call_rcu_sched(rcu, cpu_map_entry_free_sched);
+}
+
+static struct bpf_cpu_map_entry *cpu_map_entry_alloc(u32 qsize, u32 cpu)
+{
+	gfp_t gfp = GFP_KERNEL | __GFP_NOWARN;
+	struct bpf_cpu_map_entry *rcpu;
+	int i;
+
+	rcpu = kzalloc_node(sizeof(*rcpu), gfp, cpu_to_node(cpu));
+	if (!rcpu)
+		return NULL;
+
+	rcpu->bulkq = __alloc_percpu_gfp(sizeof(*rcpu->bulkq),
+					 sizeof(void *), gfp);
+	if (!rcpu->bulkq)
+		goto free_rcpu;
+
+	for_each_possible_cpu(i) {
+		struct xdp_cpu_bulk_queue *bq = per_cpu_ptr(rcpu->bulkq, i);
+
+		INIT_LIST_HEAD(&bq->flush_node);
+		bq->obj = rcpu;
+		bq->count = 0;
+	}
+
+	if (ptr_ring_init(&rcpu->queue, qsize, gfp))
+		goto free_bulkq;
+
+	rcpu->cpu = cpu;
+	rcpu->qsize = qsize;
+	INIT_WORK(&rcpu->free_work, cpu_map_entry_free_work);
+
+	rcpu->kthread = kthread_create_on_node(cpu_map_kthread_run, rcpu,
+					       cpu_to_node(cpu),
+					       "cpumap/%d", cpu);
+	if (IS_ERR(rcpu->kthread))
+		goto free_queue;
+
+	kthread_bind(rcpu->kthread, cpu);
+	wake_up_process(rcpu->kthread);
+
+	return rcpu;
+
+free_queue:
+	ptr_ring_cleanup(&rcpu->queue, NULL);
+free_bulkq:
+	free_percpu(rcpu->bulkq);
+free_rcpu:
+	kfree(rcpu);
+	return NULL;
+}
+
+static void cpu_map_entry_put(struct bpf_cpu_map_entry *rcpu)
+{
+	call_rcu(&rcpu->rcu, cpu_map_entry_free_rcu);
+}
+
+static void cpu_map_free(struct bpf_map *map)
+{
+	struct bpf_cpu_map *cmap = container_of(map, struct bpf_cpu_map, map);
+	int i;
+
+	/* Let NAPI pollers flush what they queued on the entries */
+	synchronize_sched();
+
+	for (i = 0; i < cmap->map.max_entries; i++) {
+		struct bpf_cpu_map_entry *rcpu = cmap->cpu_map[i];
+
+		if (rcpu)
+			cpu_map_entry_free_work(&rcpu->free_work);
+	}
+
+	bpf_map_area_free(cmap->cpu_map);
+	kfree(cmap);
+}
+
+static int cpu_map_get_next_key(struct bpf_map *map, void *key, void *next_key)
+{
+	u32 index = key ? *(u32 *)key : U32_MAX;
+	u32 *next = next_key;
+
+	if (index >= map->max_entries) {
+		*next = 0;
+		return 0;
+	}
+
+	if (index == map->max_entries - 1)
+		return -ENOENT;
+
+	*next = index + 1;
+	return 0;
+}
+
+struct bpf_cpu_map_entry *__cpu_map_lookup_elem(struct bpf_map *map, u32 key)
+{
+	struct bpf_cpu_map *cmap = container_of(map, struct bpf_cpu_map, map);
+
+	if (unlikely(key >= map->max_entries))
+		return NULL;
+
+	return READ_ONCE(cmap->cpu_map[key]);
+}
+
+/* Called from syscall only, programs can't look up a cpumap */
+static void *cpu_map_lookup_elem(struct bpf_map *map, void *key)
+{
+	struct bpf_cpu_map_entry *rcpu = __cpu_map_lookup_elem(map,
+							       *(u32 *)key);
+
+	return rcpu ? &rcpu->qsize : NULL;
+}
+
+/* Called from syscall, without preemption disabled so we can sleep */
+static int cpu_map_update_elem(struct bpf_map *map, void *key, void *value,
+			       u64 map_flags)
+{
+	struct bpf_cpu_map *cmap = container_of(map, struct bpf_cpu_map, map);
+	struct bpf_cpu_map_entry *rcpu = NULL, *old_rcpu;
+	u32 key_cpu = *(u32 *)key;
+	u32 qsize = *(u32 *)value;
+
+	if (unlikely(map_flags > BPF_EXIST))
+		return -EINVAL;
+	if (unlikely(key_cpu >= map->max_entries))
+		return -E2BIG;
+	if (unlikely(map_flags == BPF_NOEXIST))
+		return -EEXIST;
+	if (unlikely(qsize > CPU_MAP_MAX_QSIZE))
+		return -EOVERFLOW;
+
+	/* A queue size of zero clears the entry */
+	if (qsize) {
+		if (key_cpu >= nr_cpumask_bits || !cpu_possible(key_cpu))
+			return -ENODEV;
+
+		rcpu = cpu_map_entry_alloc(qsize, key_cpu);
+		if (!rcpu)
+			return -ENOMEM;
+	}
+
+	old_rcpu = xchg(&cmap->cpu_map[key_cpu], rcpu);
+	if (old_rcpu)
+		cpu_map_entry_put(old_rcpu);
+
+	return 0;
+}
+
+static int cpu_map_delete_elem(struct bpf_map *map, void *key)
+{
+	struct bpf_cpu_map *cmap = container_of(map, struct bpf_cpu_map, map);
+	struct bpf_cpu_map_entry *old_rcpu;
+	u32 key_cpu = *(u32 *)key;
+
+	if (key_cpu >= map->max_entries)
+		return -EINVAL;
+
+	old_rcpu = xchg(&cmap->cpu_map[key_cpu], NULL);
+	if (old_rcpu)
+		cpu_map_entry_put(old_rcpu);
+
+	return 0;
+}
+
+const struct bpf_map_ops cpu_map_ops = {
+	.map_alloc = cpu_map_alloc,
+	.map_free = cpu_map_free,
+	.map_get_next_key = cpu_map_get_next_key,
+	.map_lookup_elem = cpu_map_lookup_elem,
+	.map_update_elem = cpu_map_update_elem,
+	.map_delete_elem = cpu_map_delete_elem,
+};
+
+static void bq_flush_to_queue(struct xdp_cpu_bulk_queue *bq)
+{
+	struct ptr_ring *q = &bq->obj->queue;
+	int i;
+
+	if (unlikely(!bq->count))
+		return;
+
+	spin_lock(&q->producer_lock);
+	for (i = 0; i < bq->count; i++) {
+		struct xdp_frame *frame = bq->q[i];
+
+		/* The target CPU can't keep up, drop */
+		if (__ptr_ring_produce(q, frame)) {
+			dev_put(frame->dev_rx);
+			xdp_return_frame(frame);
+		}
+	}
+	spin_unlock(&q->producer_lock);
+
+	bq->count = 0;
+}
+
+int cpu_map_enqueue(struct bpf_cpu_map_entry *rcpu, struct xdp_frame *frame)
+{
+	struct xdp_cpu_bulk_queue *bq = this_cpu_ptr(rcpu->bulkq);
+
+	/* eth_type_trans() on the other side needs an Ethernet header */
+	if (unlikely(frame->len < ETH_HLEN))
+		return -EINVAL;
+
+	if (unlikely(bq->count == CPU_MAP_BULK_SIZE))
+		bq_flush_to_queue(bq);
+
+	if (list_empty(&bq->flush_node))
+		list_add(&bq->flush_node, this_cpu_ptr(&cpu_map_flush_list));
+
+	/* The frame may outlive the NAPI poll that received it */
+	dev_hold(frame->dev_rx);
+	bq->q[bq->count++] = frame;
+	return 0;
+}
+
+void __cpu_map_flush(void)
+{
+	struct list_head *flush_list = this_cpu_ptr(&cpu_map_flush_list);
+	struct xdp_cpu_bulk_queue *bq, *tmp;
+
+	list_for_each_entry_safe(bq, tmp, flush_list, flush_node) {
+		bq_flush_to_queue(bq);
+		list_del_init(&bq->flush_node);
+		wake_up_process(bq->obj->kthread);
+	}
+}
+
+static int __init cpu_map_init(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		INIT_LIST_HEAD(per_cpu_ptr(&cpu_map_flush_list, cpu));
+	return 0;
+}
+subsys_initcall(cpu_map_init);
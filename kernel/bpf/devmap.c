@@ -0,0 +1,368 @@
+/*
+ * Device map, holding the net devices XDP_REDIRECT can transmit on
+ *
+ * Copyright (C) 2017 - Linaro Ltd
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/*
+ * A devmap is an array of ifindexes. bpf_redirect_map() on it picks the
+ * device an XDP frame is sent out of. Frames aren't handed to the device
+ * one by one: each entry has a per-cpu queue of up to DEV_MAP_BULK_SIZE
+ * frames, and the queues used during a NAPI poll are flushed through a
+ * single ndo_xdp_xmit() call when the driver calls xdp_do_flush_map().
+ *
+ * Entries are only used from NAPI context, so they are freed after both
+ * an RCU and an RCU-sched grace period: the first one covers lookups from
+ * the syscall and generic XDP, the second one the frames still sitting in
+ * a bulk queue until the end of the NAPI poll.
+ */
+
+#include <linux/bpf.h>
+#include <linux/filter.h>
+#include <linux/netdevice.h>
+#include <linux/etherdevice.h>
+#include <linux/nsproxy.h>
+#include <linux/slab.h>
+
+#define DEV_MAP_BULK_SIZE	16
+
+struct xdp_bulk_queue {
+	struct xdp_frame *q[DEV_MAP_BULK_SIZE];
+	struct list_head flush_node;
+	struct bpf_dtab_netdev *obj;
+	unsigned int count;
+};
+
+struct bpf_dtab_netdev {
+	struct net_device *dev;
+	struct xdp_bulk_queue __percpu *bulkq;
+	struct rcu_head rcu;
+};
+
+struct bpf_dtab {
+	struct bpf_map map;
+	struct bpf_dtab_netdev **netdev_map;
+	struct list_head list;
+};
+
+/* Protects dev_map_list, walked when a device goes away */
+static DEFINE_SPINLOCK(dev_map_lock);
+static LIST_HEAD(dev_map_list);
+
+static DEFINE_PER_CPU(struct list_head, dev_flush_list);
+
+static struct bpf_map *dev_map_alloc(union bpf_attr *attr)
+{
+	struct bpf_dtab *dtab;
+	u64 cost;
+	int err;
+
+	if (!capable(CAP_NET_ADMIN))
+		return ERR_PTR(-EPERM);
+
+	/* check sanity of attributes */
+	if (attr->max_entries == 0 || attr->key_size != 4 ||
+	    attr->value_size != 4 || attr->map_flags)
+		return ERR_PTR(-EINVAL);
+
+	dtab = kzalloc(sizeof(*dtab), GFP_USER);
+	if (!dtab)
+		return ERR_PTR(-ENOMEM);
+
+	dtab->map.map_type = attr->map_type;
+	dtab->map.key_size = attr->key_size;
+	dtab->map.value_size = attr->value_size;
+	dtab->map.max_entries = attr->max_entries;
+	dtab->map.map_flags = attr->map_flags;
+
+	cost = (u64)dtab->map.max_entries * sizeof(struct bpf_dtab_netdev *);
+	if (cost >= U32_MAX - PAGE_SIZE) {
+		err = -ENOMEM;
+		goto free_dtab;
+	}
+	dtab->map.pages = round_up(cost, PAGE_SIZE) >> PAGE_SHIFT;
+
+	err = bpf_map_precharge_memlock(dtab->map.pages);
+	if (err)
+		goto free_dtab;
+
+	err = -ENOMEM;
+	dtab->netdev_map = bpf_map_area_alloc(cost);
+	if (!dtab->netdev_map)
+		goto free_dtab;
+
+	spin_lock(&dev_map_lock);
+	list_add_tail(&dtab->list, &dev_map_list);
+	spin_unlock(&dev_map_lock);
+
+	return &dtab->map;
+
+free_dtab:
+	kfree(dtab);
+	return ERR_PTR(err);
+}
+
+static void __dev_map_entry_free(struct bpf_dtab_netdev *dev)
+{
+	free_percpu(dev->bulkq);
+	dev_put(dev->dev);
+	kfree(dev);
+}
+
+static void dev_map_entry_free_sched(struct rcu_head *rcu)
+{
+	__dev_map_entry_free(container_of(rcu, struct bpf_dtab_netdev, rcu));
+}
+
+static void dev_map_entry_free_rcu(struct rcu_head *rcu)
+{
+	call_rcu_sched(rcu, dev_map_entry_free_sched);
+}
+
+static void dev_map_entry_put(struct bpf_dtab_netdev *dev)
+{
+	call_rcu(&dev->rcu, dev_map_entry_free_rcu);
+}
+
+static void dev_map_free(struct bpf_map *map)
+{
+	struct bpf_dtab *dtab = container_of(map, struct bpf_dtab, map);
+	int i;
+
+	spin_lock(&dev_map_lock);
+	list_del(&dtab->list);
+	spin_unlock(&dev_map_lock);
+
+	/* No program uses the map anymore, but NAPI pollers may still have
+	 * frames queued on its entries until they call xdp_do_flush_map().
+	 */
+	synchronize_sched();
+
+	for (i = 0; i < dtab->map.max_entries; i++) {
+		struct bpf_dtab_netdev *dev = dtab->netdev_map[i];
+
+		if (dev)
+			__dev_map_entry_free(dev);
+	}
+
+	bpf_map_area_free(dtab->netdev_map);
+	kfree(dtab);
+}
+
+static int dev_map_get_next_key(struct bpf_map *map, void *key, void *next_key)
+{
+	u32 index = key ? *(u32 *)key : U32_MAX;
+	u32 *next = next_key;
+
+	if (index >= map->max_entries) {
+		*next = 0;
+		return 0;
+	}
+
+	if (index == map->max_entries - 1)
+		return -ENOENT;
+
+	*next = index + 1;
+	return 0;
+}
+
+struct bpf_dtab_netdev *__dev_map_lookup_elem(struct bpf_map *map, u32 key)
+{
+	struct bpf_dtab *dtab = container_of(map, struct bpf_dtab, map);
+
+	if (unlikely(key >= map->max_entries))
+		return NULL;
+
+	return READ_ONCE(dtab->netdev_map[key]);
+}
+
+struct net_device *dev_map_netdev(struct bpf_dtab_netdev *dst)
+{
+	return dst->dev;
+}
+
+/* Called from syscall only, programs can't look up a devmap */
+static void *dev_map_lookup_elem(struct bpf_map *map, void *key)
+{
+	struct bpf_dtab_netdev *dev = __dev_map_lookup_elem(map, *(u32 *)key);
+
+	return dev ? &dev->dev->ifindex : NULL;
+}
+
+static int dev_map_update_elem(struct bpf_map *map, void *key, void *value,
+			       u64 map_flags)
+{
+	struct bpf_dtab *dtab = container_of(map, struct bpf_dtab, map);
+	struct net *net = current->nsproxy->net_ns;
+	struct bpf_dtab_netdev *dev = NULL, *old_dev;
+	u32 i = *(u32 *)key;
+	u32 ifindex = *(u32 *)value;
+	int cpu;
+
+	if (unlikely(map_flags > BPF_EXIST))
+		return -EINVAL;
+	if (unlikely(i >= map->max_entries))
+		return -E2BIG;
+	if (unlikely(map_flags == BPF_NOEXIST))
+		return -EEXIST;
+
+	/* An ifindex of zero clears the entry */
+	if (ifindex) {
+		dev = kmalloc(sizeof(*dev), GFP_ATOMIC | __GFP_NOWARN);
+		if (!dev)
+			return -ENOMEM;
+
+		dev->bulkq = __alloc_percpu_gfp(sizeof(*dev->bulkq),
+						sizeof(void *),
+						GFP_ATOMIC | __GFP_NOWARN);
+		if (!dev->bulkq) {
+			kfree(dev);
+			return -ENOMEM;
+		}
+
+		for_each_possible_cpu(cpu) {
+			struct xdp_bulk_queue *bq = per_cpu_ptr(dev->bulkq, cpu);
+
+			INIT_LIST_HEAD(&bq->flush_node);
+			bq->obj = dev;
+			bq->count = 0;
+		}
+
+		dev->dev = dev_get_by_index(net, ifindex);
+		if (!dev->dev) {
+			free_percpu(dev->bulkq);
+			kfree(dev);
+			return -EINVAL;
+		}
+	}
+
+	old_dev = xchg(&dtab->netdev_map[i], dev);
+	if (old_dev)
+		dev_map_entry_put(old_dev);
+
+	return 0;
+}
+
+static int dev_map_delete_elem(struct bpf_map *map, void *key)
+{
+	struct bpf_dtab *dtab = container_of(map, struct bpf_dtab, map);
+	struct bpf_dtab_netdev *old_dev;
+	u32 i = *(u32 *)key;
+
+	if (i >= map->max_entries)
+		return -EINVAL;
+
+	old_dev = xchg(&dtab->netdev_map[i], NULL);
+	if (old_dev)
+		dev_map_entry_put(old_dev);
+
+	return 0;
+}
+
+const struct bpf_map_ops dev_map_ops = {
+	.map_alloc = dev_map_alloc,
+	.map_free = dev_map_free,
+	.map_get_next_key = dev_map_get_next_key,
+	.map_lookup_elem = dev_map_lookup_elem,
+	.map_update_elem = dev_map_update_elem,
+	.map_delete_elem = dev_map_delete_elem,
+};
+
+static void bq_xmit_all(struct xdp_bulk_queue *bq, u32 flags)
+{
+	struct net_device *dev = bq->obj->dev;
+	int sent = 0, i;
+
+	if (unlikely(!bq->count))
+		return;
+
+	if (likely(dev->netdev_ops->ndo_xdp_xmit)) {
+		sent = dev->netdev_ops->ndo_xdp_xmit(dev, bq->count, bq->q,
+						     flags);
+		if (sent < 0)
+			sent = 0;
+
+		for (i = sent; i < bq->count; i++)
+			xdp_return_frame(bq->q[i]);
+	} else {
+		for (i = 0; i < bq->count; i++)
+			xdp_frame_xmit_skb(bq->q[i], dev);
+	}
+
+	bq->count = 0;
+}
+
+int dev_map_enqueue(struct bpf_dtab_netdev *dst, struct xdp_frame *frame)
+{
+	struct xdp_bulk_queue *bq = this_cpu_ptr(dst->bulkq);
+
+	if (unlikely(bq->count == DEV_MAP_BULK_SIZE))
+		bq_xmit_all(bq, 0);
+
+	if (list_empty(&bq->flush_node))
+		list_add(&bq->flush_node, this_cpu_ptr(&dev_flush_list));
+
+	bq->q[bq->count++] = frame;
+	return 0;
+}
+
+void __dev_map_flush(void)
+{
+	struct list_head *flush_list = this_cpu_ptr(&dev_flush_list);
+	struct xdp_bulk_queue *bq, *tmp;
+
+	list_for_each_entry_safe(bq, tmp, flush_list, flush_node) {
+		bq_xmit_all(bq, XDP_XMIT_FLUSH);
+		list_del_init(&bq->flush_node);
+	}
+}
+
+static int dev_map_notification(struct notifier_block *notifier,
+				unsigned long event, void *ptr)
+{
+	struct net_device *netdev = netdev_notifier_info_to_dev(ptr);
+	struct bpf_dtab *dtab;
+	int i;
+
+	if (event != NETDEV_UNREGISTER)
+		return NOTIFY_OK;
+
+	/* Drop the references the maps hold on the device going away */
+	spin_lock(&dev_map_lock);
+	list_for_each_entry(dtab, &dev_map_list, list) {
+		for (i = 0; i < dtab->map.max_entries; i++) {
+			struct bpf_dtab_netdev *dev, *old_dev;
+
+			dev = READ_ONCE(dtab->netdev_map[i]);
+			if (!dev || dev->dev != netdev)
+				continue;
+
+			old_dev = cmpxchg(&dtab->netdev_map[i], dev, NULL);
+			if (old_dev == dev)
+				dev_map_entry_put(dev);
+		}
+	}
+	spin_unlock(&dev_map_lock);
+
+	return NOTIFY_OK;
+}
+
+static struct notifier_block dev_map_notifier = {
+	.notifier_call = dev_map_notification,
+};
+
+static int __init dev_map_init(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		INIT_LIST_HEAD(per_cpu_ptr(&dev_flush_list, cpu));
+
+	register_netdevice_notifier(&dev_map_notifier);
+	return 0;
+}
+subsys_initcall(dev_map_init);
@@ -0,0 +1,219 @@
+/*
+ * XDP socket map, holding the AF_XDP sockets XDP_REDIRECT can deliver to
+ *
+ * Copyright (C) 2017 - Linaro Ltd
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/*
+ * Updates take a socket fd as the value. As with the device map, the
+ * entries are only used from NAPI context, and are freed after both an
+ * RCU and an RCU-sched grace period.
+ */
+
+#include <linux/bpf.h>
+#include <linux/capability.h>
+#include <linux/slab.h>
+#include <linux/net.h>
+#include <net/xdp_sock.h>
+
+struct xsk_map_node {
+	struct xdp_sock *xs;
+	struct rcu_head rcu;
+};
+
+struct xsk_map {
+	struct bpf_map map;
+	struct xsk_map_node **xsk_map;
+};
+
+static struct bpf_map *xsk_map_alloc(union bpf_attr *attr)
+{
+	struct xsk_map *m;
+	u64 cost;
+	int err;
+
+	if (!capable(CAP_NET_ADMIN))
+		return ERR_PTR(-EPERM);
+
+	if (attr->max_entries == 0 || attr->key_size != 4 ||
+	    attr->value_size != 4 || attr->map_flags)
+		return ERR_PTR(-EINVAL);
+
+	m = kzalloc(sizeof(*m), GFP_USER);
+	if (!m)
+		return ERR_PTR(-ENOMEM);
+
+	m->map.map_type = attr->map_type;
+	m->map.key_size = attr->key_size;
+	m->map.value_size = attr->value_size;
+	m->map.max_entries = attr->max_entries;
+	m->map.map_flags = attr->map_flags;
+
+	cost = (u64)m->map.max_entries * sizeof(struct xsk_map_node *);
+	if (cost >= U32_MAX - PAGE_SIZE) {
+		err = -ENOMEM;
+		goto free_m;
+	}
+	m->map.pages = round_up(cost, PAGE_SIZE) >> PAGE_SHIFT;
+
+	err = bpf_map_precharge_memlock(m->map.pages);
+	if (err)
+		goto free_m;
+
+	err = -ENOMEM;
+	m->xsk_map = bpf_map_area_alloc(cost);
+	if (!m->xsk_map)
+		goto free_m;
+
+	return &m->map;
+
+free_m:
+	kfree(m);
+	return ERR_PTR(err);
+}
+
+static void __xsk_map_node_free(struct xsk_map_node *node)
+{
+	sock_put(&node->xs->sk);
+	kfree(node);
+}
+
+static void xsk_map_node_free_sched(struct rcu_head *rcu)
+{
+	__xsk_map_node_free(container_of(rcu, struct xsk_map_node, rcu));
+}
+
+static void xsk_map_node_free_rcu(struct rcu_head *rcu)
+{
+	call_rcu_sched(rcu, xsk_map_node_free_sched);
+}
+
+static void xsk_map_node_put(struct xsk_map_node *node)
+{
+	call_rcu(&node->rcu, xsk_map_node_free_rcu);
+}
+
+static void xsk_map_free(struct bpf_map *map)
+{
+	struct xsk_map *m = container_of(map, struct xsk_map, map);
+	int i;
+
+	/* Wait for NAPI pollers still holding entries of the map */
+	synchronize_sched();
+
+	for (i = 0; i < map->max_entries; i++) {
+		struct xsk_map_node *node = m->xsk_map[i];
+
+		if (node)
+			__xsk_map_node_free(node);
+	}
+
+	bpf_map_area_free(m->xsk_map);
+	kfree(m);
+}
+
+static int xsk_map_get_next_key(struct bpf_map *map, void *key, void *next_key)
+{
+	u32 index = key ? *(u32 *)key : U32_MAX;
+	u32 *next = next_key;
+
+	if (index >= map->max_entries) {
+		*next = 0;
+		return 0;
+	}
+
+	if (index == map->max_entries - 1)
+		return -ENOENT;
+
+	*next = index + 1;
+	return 0;
+}
+
+struct xdp_sock *__xsk_map_lookup_elem(struct bpf_map *map, u32 key)
+{
+	struct xsk_map *m = container_of(map, struct xsk_map, map);
+	struct xsk_map_node *node;
+
+	if (unlikely(key >= map->max_entries))
+		return NULL;
+
+	node = READ_ONCE(m->xsk_map[key]);
+	return node ? node->xs : NULL;
+}
+
+/* Socket fds only make sense to the process that put them there */
+static void *xsk_map_lookup_elem(struct bpf_map *map, void *key)
+{
+	return NULL;
+}
+
+static int xsk_map_update_elem(struct bpf_map *map, void *key, void *value,
+			       u64 map_flags)
+{
+	struct xsk_map *m = container_of(map, struct xsk_map, map);
+	struct xsk_map_node *node, *old_node;
+	u32 i = *(u32 *)key, fd = *(u32 *)value;
+	struct socket *sock;
+	int err;
+
+	if (unlikely(map_flags > BPF_EXIST))
+		return -EINVAL;
+	if (unlikely(i >= map->max_entries))
+		return -E2BIG;
+	if (unlikely(map_flags == BPF_NOEXIST))
+		return -EEXIST;
+
+	sock = sockfd_lookup(fd, &err);
+	if (!sock)
+		return err;
+
+	if (sock->sk->sk_family != PF_XDP) {
+		sockfd_put(sock);
+		return -EOPNOTSUPP;
+	}
+
+	node = kmalloc(sizeof(*node), GFP_ATOMIC | __GFP_NOWARN);
+	if (!node) {
+		sockfd_put(sock);
+		return -ENOMEM;
+	}
+
+	sock_hold(sock->sk);
+	node->xs = xdp_sk(sock->sk);
+	sockfd_put(sock);
+
+	old_node = xchg(&m->xsk_map[i], node);
+	if (old_node)
+		xsk_map_node_put(old_node);
+
+	return 0;
+}
+
+static int xsk_map_delete_elem(struct bpf_map *map, void *key)
+{
+	struct xsk_map *m = container_of(map, struct xsk_map, map);
+	struct xsk_map_node *old_node;
+	u32 i = *(u32 *)key;
+
+	if (i >= map->max_entries)
+		return -EINVAL;
+
+	old_node = xchg(&m->xsk_map[i], NULL);
+	if (old_node)
+		xsk_map_node_put(old_node);
+
+	return 0;
+}
+
+const struct bpf_map_ops xsk_map_ops = {
+	.map_alloc = xsk_map_alloc,
+	.map_free = xsk_map_free,
+	.map_get_next_key = xsk_map_get_next_key,
+	.map_lookup_elem = xsk_map_lookup_elem,
+	.map_update_elem = xsk_map_update_elem,
+	.map_delete_elem = xsk_map_delete_elem,
+};
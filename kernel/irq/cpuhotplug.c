@@ -14,6 +14,38 @@
 
 #include "internals.h"
 
+/* Only touched by the task migrating the interrupts, under stop_machine */
+static struct task_struct *irq_affinity_batcher;
+static LIST_HEAD(irq_affinity_flushes);
+
+/**
+ * irq_affinity_defer - defer the hardware update of an affinity change
+ * @flush:	the chip's flush, queued to run once all interrupts are moved
+ *
+ * Called by a chip's irq_set_affinity(), with the descriptor locked.
+ * Returns true if the chip is to record the change for @flush to apply,
+ * false if it is to reprogram the hardware right away.
+ */
+bool irq_affinity_defer(struct irq_affinity_flush *flush)
+{
+	if (irq_affinity_batcher != current)
+		return false;
+
+	if (list_empty(&flush->node))
+		list_add_tail(&flush->node, &irq_affinity_flushes);
+	return true;
+}
+
+static void irq_affinity_run_flushes(void)
+{
+	struct irq_affinity_flush *flush, *tmp;
+
+	list_for_each_entry_safe(flush, tmp, &irq_affinity_flushes, node) {
+		list_del_init(&flush->node);
+		flush->flush(flush);
+	}
+}
+
 static bool migrate_one_irq(struct irq_desc *desc)
 {
 	struct irq_data *d = irq_desc_get_irq_data(desc);
@@ -64,6 +96,7 @@ void irq_migrate_all_off_this_cpu(void)
 	unsigned long flags;
 
 	local_irq_save(flags);
+	irq_affinity_batcher = current;
 
 	for_each_active_irq(irq) {
 		bool affinity_broken;
@@ -78,5 +111,7 @@ void irq_migrate_all_off_this_cpu(void)
 					    irq, smp_processor_id());
 	}
 
+	irq_affinity_batcher = NULL;
+	irq_affinity_run_flushes();
 	local_irq_restore(flags);
 }
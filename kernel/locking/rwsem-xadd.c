@@ -93,6 +93,12 @@ void __init_rwsem(struct rw_semaphore *sem, const char *name,
 
 EXPORT_SYMBOL(__init_rwsem);
 
+/*
+ * How long a writer at the head of the queue lets spinners steal the lock
+ * before it asks for the lock to be handed over to it.
+ */
+#define RWSEM_WAIT_TIMEOUT	DIV_ROUND_UP(HZ, 250)
+
 enum rwsem_waiter_type {
 	RWSEM_WAITING_FOR_WRITE,
 	RWSEM_WAITING_FOR_READ
@@ -218,6 +224,9 @@ static void __rwsem_mark_wake(struct rw_semaphore *sem,
 		atomic_long_add(adjustment, &sem->count);
 }
 
+static bool rwsem_can_spin_read(struct rw_semaphore *sem);
+static bool rwsem_optimistic_spin_read(struct rw_semaphore *sem);
+
 /*
  * Wait for the read lock to be granted
  */
@@ -226,14 +235,28 @@ struct rw_semaphore __sched *rwsem_down_read_failed(struct rw_semaphore *sem)
 {
 	long count, adjustment = -RWSEM_ACTIVE_READ_BIAS;
 	struct rwsem_waiter waiter;
+	bool first = false;
 	DEFINE_WAKE_Q(wake_q);
 
+	/*
+	 * If a running writer holds the lock and nobody is queued, spin
+	 * for it rather than sleeping, no longer actively locking.
+	 */
+	if (rwsem_can_spin_read(sem)) {
+		atomic_long_add(-RWSEM_ACTIVE_READ_BIAS, &sem->count);
+		if (rwsem_optimistic_spin_read(sem))
+			return sem;
+		adjustment = 0;
+	}
+
 	waiter.task = current;
 	waiter.type = RWSEM_WAITING_FOR_READ;
 
 	raw_spin_lock_irq(&sem->wait_lock);
-	if (list_empty(&sem->wait_list))
+	if (list_empty(&sem->wait_list)) {
 		adjustment += RWSEM_WAITING_BIAS;
+		first = true;
+	}
 	list_add_tail(&waiter.list, &sem->wait_list);
 
 	/* we're now waiting on the lock, but no longer actively locking */
@@ -246,8 +269,7 @@ struct rw_semaphore __sched *rwsem_down_read_failed(struct rw_semaphore *sem)
 	 * wake our own waiter to join the existing active readers !
 	 */
 	if (count == RWSEM_WAITING_BIAS ||
-	    (count > RWSEM_WAITING_BIAS &&
-	     adjustment != -RWSEM_ACTIVE_READ_BIAS))
+	    (count > RWSEM_WAITING_BIAS && first))
 		__rwsem_mark_wake(sem, RWSEM_WAKE_ANY, &wake_q);
 
 	raw_spin_unlock_irq(&sem->wait_lock);
@@ -440,6 +462,120 @@ static bool rwsem_optimistic_spin(struct rw_semaphore *sem)
 	return taken;
 }
 
+/*
+ * Try to acquire read lock before the reader has been put on wait queue,
+ * as long as there is neither a writer nor anyone waiting.
+ */
+static inline bool rwsem_try_read_lock_unqueued(struct rw_semaphore *sem)
+{
+	long old, count = atomic_long_read(&sem->count);
+
+	while (count >= 0) {
+		old = atomic_long_cmpxchg_acquire(&sem->count, count,
+				      count + RWSEM_ACTIVE_READ_BIAS);
+		if (old == count) {
+			rwsem_set_reader_owned(sem);
+			return true;
+		}
+
+		count = old;
+	}
+
+	return false;
+}
+
+/*
+ * Readers only spin on a running writer, and only if they wouldn't jump
+ * the queue: a reader finding waiters, or readers owning the lock with a
+ * writer queued, sleeps right away.
+ */
+static bool rwsem_can_spin_read(struct rw_semaphore *sem)
+{
+	if (!list_empty(&sem->wait_list))
+		return false;
+
+	if (!rwsem_owner_is_writer(READ_ONCE(sem->owner)))
+		return false;
+
+	return rwsem_can_spin_on_owner(sem);
+}
+
+static bool rwsem_optimistic_spin_read(struct rw_semaphore *sem)
+{
+	bool taken = false;
+
+	preempt_disable();
+
+	if (!osq_lock(&sem->osq))
+		goto done;
+
+	while (rwsem_spin_on_owner(sem)) {
+		if (rwsem_try_read_lock_unqueued(sem)) {
+			taken = true;
+			break;
+		}
+
+		/* Queue up behind anyone who started waiting meanwhile */
+		if (!list_empty(&sem->wait_list))
+			break;
+
+		/* See rwsem_optimistic_spin() */
+		if (!sem->owner && (need_resched() || rt_task(current)))
+			break;
+
+		cpu_relax();
+	}
+
+	/* The writer may have handed the lock over to readers */
+	if (!taken)
+		taken = rwsem_try_read_lock_unqueued(sem);
+
+	osq_unlock(&sem->osq);
+done:
+	preempt_enable();
+	return taken;
+}
+
+/*
+ * A writer at the head of the queue that has waited for long enough
+ * spins for the lock instead of sleeping, holding the osq: no other task
+ * can spin and steal the lock from it meanwhile, the lock is handed over.
+ * Returns true with the wait_lock held if the lock was taken.
+ */
+static bool rwsem_handoff_spin(struct rw_semaphore *sem)
+{
+	bool taken = false;
+
+	preempt_disable();
+
+	if (!osq_lock(&sem->osq))
+		goto done;
+
+	while (true) {
+		if (!(atomic_long_read(&sem->count) & RWSEM_ACTIVE_MASK)) {
+			raw_spin_lock_irq(&sem->wait_lock);
+			taken = rwsem_try_write_lock(atomic_long_read(&sem->count),
+						     sem);
+			if (taken)
+				break;
+			raw_spin_unlock_irq(&sem->wait_lock);
+		}
+
+		if (!rwsem_spin_on_owner(sem))
+			break;
+
+		if (!sem->owner && (need_resched() || rt_task(current)))
+			break;
+
+		cpu_relax();
+	}
+
+	osq_unlock(&sem->osq);
+done:
+	preempt_enable();
+	return taken;
+}
+
 /*
  * Return true if the rwsem has active spinner
  */
@@ -454,6 +590,21 @@ static bool rwsem_optimistic_spin(struct rw_semaphore *sem)
 	return false;
 }
 
+static bool rwsem_can_spin_read(struct rw_semaphore *sem)
+{
+	return false;
+}
+
+static bool rwsem_optimistic_spin_read(struct rw_semaphore *sem)
+{
+	return false;
+}
+
+static bool rwsem_handoff_spin(struct rw_semaphore *sem)
+{
+	return false;
+}
+
 static inline bool rwsem_has_spinner(struct rw_semaphore *sem)
 {
 	return false;
@@ -469,6 +620,7 @@ __rwsem_down_write_failed_common(struct rw_semaphore *sem, int state)
 	long count;
 	bool waiting = true; /* any queued threads before us */
 	struct rwsem_waiter waiter;
+	unsigned long timeout;
 	struct rw_semaphore *ret = sem;
 	DEFINE_WAKE_Q(wake_q);
 
@@ -524,6 +676,7 @@ __rwsem_down_write_failed_common(struct rw_semaphore *sem, int state)
 		count = atomic_long_add_return(RWSEM_WAITING_BIAS, &sem->count);
 
 	/* wait until we successfully acquire the lock */
+	timeout = jiffies + RWSEM_WAIT_TIMEOUT;
 	set_current_state(state);
 	while (true) {
 		if (rwsem_try_write_lock(count, sem))
@@ -535,12 +688,27 @@ __rwsem_down_write_failed_common(struct rw_semaphore *sem, int state)
 			if (signal_pending_state(state, current))
 				goto out_nolock;
 
+			/* Only our own waiter is compared, not dereferenced */
+			if (time_after(jiffies, timeout) &&
+			    READ_ONCE(sem->wait_list.next) == &waiter.list) {
+				__set_current_state(TASK_RUNNING);
+				if (rwsem_handoff_spin(sem))
+					goto locked;
+
+				/* A wakeup may have been missed while running */
+				set_current_state(state);
+				if (!(atomic_long_read(&sem->count) &
+				      RWSEM_ACTIVE_MASK))
+					continue;
+			}
+
 			schedule();
 			set_current_state(state);
 		} while ((count = atomic_long_read(&sem->count)) & RWSEM_ACTIVE_MASK);
 
 		raw_spin_lock_irq(&sem->wait_lock);
 	}
+locked:
 	__set_current_state(TASK_RUNNING);
 	list_del(&waiter.list);
 	raw_spin_unlock_irq(&sem->wait_lock);
@@ -557,6 +557,13 @@ module_param(rcu_kick_kthreads, bool, 0644);
 static ulong jiffies_till_sched_qs = HZ / 20;
 module_param(jiffies_till_sched_qs, ulong, 0644);
 
+/*
+ * How long callbacks that are ready may wait for a CPU that keeps running
+ * a vcpu, instead of interrupting the guest from the tick, 0 to disable.
+ */
+static ulong jiffies_till_guest_cbs;
+module_param(jiffies_till_guest_cbs, ulong, 0644);
+
 static bool rcu_start_gp_advanced(struct rcu_state *rsp, struct rcu_node *rnp,
 				  struct rcu_data *rdp);
 static void force_qs_rnp(struct rcu_state *rsp,
@@ -1232,6 +1239,22 @@ static int rcu_is_cpu_rrupt_from_idle(void)
 	return __this_cpu_read(rcu_dynticks.dynticks_nesting) <= 1;
 }
 
+/*
+ * rcu_is_cpu_rrupt_from_guest - see if interrupted right out of a guest
+ *
+ * KVM holds no RCU references between entering the guest and calling
+ * guest_exit(), the same reason rcu_virt_note_context_switch() is called
+ * on guest entry.  So if a vcpu thread took a first-level interrupt outside
+ * of softirq and bh-disabled code, it was in a quiescent state.  The caller
+ * must be in hardirq context.
+ */
+static bool rcu_is_cpu_rrupt_from_guest(void)
+{
+	return (current->flags & PF_VCPU) &&
+	       (preempt_count() & (HARDIRQ_MASK | SOFTIRQ_MASK)) ==
+	       HARDIRQ_OFFSET;
+}
+
 /*
  * Snapshot the specified CPU's dynticks counter so that we can later
  * credit them with an implicit quiescent state.  Return 1 if this CPU
@@ -2787,6 +2810,7 @@ static void rcu_do_batch(struct rcu_state *rsp, struct rcu_data *rdp)
 	 */
 	local_irq_save(flags);
 	WARN_ON_ONCE(cpu_is_offline(smp_processor_id()));
+	rdp->guest_cbs_deferring = false;
 	bl = rdp->blimit;
 	trace_rcu_batch_start(rsp->name, rcu_segcblist_n_lazy_cbs(&rdp->cblist),
 			      rcu_segcblist_n_cbs(&rdp->cblist), bl);
@@ -2852,13 +2876,14 @@ void rcu_check_callbacks(int user)
 {
 	trace_rcu_utilization(TPS("Start scheduler-tick"));
 	increment_cpu_stall_ticks();
-	if (user || rcu_is_cpu_rrupt_from_idle()) {
+	if (user || rcu_is_cpu_rrupt_from_idle() ||
+	    rcu_is_cpu_rrupt_from_guest()) {
 
 		/*
 		 * Get here if this CPU took its interrupt from user
-		 * mode or from the idle loop, and if this is not a
-		 * nested interrupt.  In this case, the CPU is in
-		 * a quiescent state, so note it.
+		 * mode, from the idle loop or from a guest, and if this
+		 * is not a nested interrupt.  In this case, the CPU is
+		 * in a quiescent state, so note it.
 		 *
 		 * No memory barrier is required here because both
 		 * rcu_sched_qs() and rcu_bh_qs() reference only CPU-local
@@ -3433,6 +3458,35 @@ void cond_synchronize_sched(unsigned long oldstate)
 }
 EXPORT_SYMBOL_GPL(cond_synchronize_sched);
 
+/*
+ * Should the invocation of ready callbacks be left for later, because the
+ * tick interrupted a vcpu?  They are then run along with the next other RCU
+ * core work of this CPU, or once jiffies_till_guest_cbs has passed, or as
+ * soon as there are more than qhimark of them.
+ */
+static bool rcu_defer_guest_cbs(struct rcu_data *rdp)
+{
+	ulong delay = READ_ONCE(jiffies_till_guest_cbs);
+
+	if (!delay || !(current->flags & PF_VCPU) ||
+	    rcu_segcblist_n_cbs(&rdp->cblist) > qhimark) {
+		rdp->guest_cbs_deferring = false;
+		return false;
+	}
+
+	if (!rdp->guest_cbs_deferring) {
+		rdp->guest_cbs_deferring = true;
+		rdp->guest_cbs_deferred = jiffies;
+		return true;
+	}
+
+	if (time_before(jiffies, rdp->guest_cbs_deferred + delay))
+		return true;
+
+	rdp->guest_cbs_deferring = false;
+	return false;
+}
+
 /*
  * Check to see if there is any immediate RCU-related work to be done
  * by the current CPU, for the specified type of RCU, returning 1 if so.
@@ -3464,7 +3518,8 @@ static int __rcu_pending(struct rcu_state *rsp, struct rcu_data *rdp)
 	}
 
 	/* Does this CPU have callbacks ready to invoke? */
-	if (rcu_segcblist_ready_cbs(&rdp->cblist)) {
+	if (rcu_segcblist_ready_cbs(&rdp->cblist) &&
+	    !rcu_defer_guest_cbs(rdp)) {
 		rdp->n_rp_cb_ready++;
 		return 1;
 	}
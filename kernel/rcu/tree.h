@@ -245,6 +245,10 @@ struct rcu_data {
 	unsigned long	n_force_qs_snap;
 					/* did other CPU force QS recently? */
 	long		blimit;		/* Upper limit on a processed batch */
+	unsigned long	guest_cbs_deferred;
+					/* When ready cbs were first held */
+					/*  back for a running vcpu, if */
+	bool		guest_cbs_deferring; /*  they still are. */
 
 	/* 3) dynticks interface. */
 	struct rcu_dynticks *dynticks;	/* Shared per-CPU dynticks state. */
@@ -5806,9 +5806,31 @@ static inline int select_idle_smt(struct task_struct *p, struct sched_domain *sd
  * comparing the average scan cost (tracked in sd->avg_scan_cost) against the
  * average idle time for this rq (as found in rq->avg_idle).
  */
+/*
+ * Keep sd_llc_shared->idle_cpus_span in sync with the CPUs running their idle
+ * task, so that select_idle_cpu() only has to look at those.  Only write when
+ * the bit changes, the mask is shared by the whole LLC.
+ */
+void update_idle_cpumask(struct rq *rq, bool idle)
+{
+	struct sched_domain_shared *sds;
+	int cpu = cpu_of(rq);
+
+	rcu_read_lock();
+	sds = rcu_dereference(per_cpu(sd_llc_shared, cpu));
+	if (sds && cpumask_test_cpu(cpu, sds_idle_cpus(sds)) != idle) {
+		if (idle)
+			cpumask_set_cpu(cpu, sds_idle_cpus(sds));
+		else
+			cpumask_clear_cpu(cpu, sds_idle_cpus(sds));
+	}
+	rcu_read_unlock();
+}
+
 static int select_idle_cpu(struct task_struct *p, struct sched_domain *sd, int target)
 {
 	struct sched_domain *this_sd;
+	struct cpumask *cpus = sched_domain_span(sd);
 	u64 avg_cost, avg_idle = this_rq()->avg_idle;
 	u64 time, cost;
 	s64 delta;
@@ -5829,9 +5851,15 @@ static int select_idle_cpu(struct task_struct *p, struct sched_domain *sd, int t
 
 	time = local_clock();
 
-	for_each_cpu_wrap(cpu, sched_domain_span(sd), target, wrap) {
+	if (sched_feat(SIS_IDLE_MASK) && sd->shared)
+		cpus = sds_idle_cpus(sd->shared);
+
+	for_each_cpu_wrap(cpu, cpus, target, wrap) {
 		if (!cpumask_test_cpu(cpu, &p->cpus_allowed))
 			continue;
+		/* The idle mask may hold CPUs that just left the domain */
+		if (!cpumask_test_cpu(cpu, sched_domain_span(sd)))
+			continue;
 		if (idle_cpu(cpu))
 			break;
 	}
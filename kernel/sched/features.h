@@ -56,6 +56,12 @@ SCHED_FEAT(TTWU_QUEUE, true)
  */
 SCHED_FEAT(SIS_AVG_CPU, false)
 
+/*
+ * When doing wakeups, only scan the CPUs of the LLC that were idle last we
+ * heard, rather than all of them.
+ */
+SCHED_FEAT(SIS_IDLE_MASK, true)
+
 /*
  * Issue a WARN when we do multiple update_rq_clock() calls
  * in a single rq->lock section. Default disabled because the
@@ -784,6 +784,12 @@ static inline void update_idle_core(struct rq *rq)
 static inline void update_idle_core(struct rq *rq) { }
 #endif
 
+#ifdef CONFIG_SMP
+extern void update_idle_cpumask(struct rq *rq, bool idle);
+#else
+static inline void update_idle_cpumask(struct rq *rq, bool idle) { }
+#endif
+
 DECLARE_PER_CPU_SHARED_ALIGNED(struct rq, runqueues);
 
 #define cpu_rq(cpu)		(&per_cpu(runqueues, (cpu)))
@@ -391,6 +391,9 @@ static void update_top_cache_domain(int cpu)
 	per_cpu(sd_llc_size, cpu) = size;
 	per_cpu(sd_llc_id, cpu) = id;
 	rcu_assign_pointer(per_cpu(sd_llc_shared, cpu), sds);
+	/* Already idle CPUs won't pass through idle entry to get marked */
+	if (sds && idle_cpu(cpu))
+		cpumask_set_cpu(cpu, sds_idle_cpus(sds));
 
 	sd = lowest_flag_domain(cpu, SD_NUMA);
 	rcu_assign_pointer(per_cpu(sd_numa, cpu), sd);
@@ -1287,8 +1290,8 @@ static int __sdt_alloc(const struct cpumask *cpu_map)
 
 			*per_cpu_ptr(sdd->sd, j) = sd;
 
-			sds = kzalloc_node(sizeof(struct sched_domain_shared),
-					GFP_KERNEL, cpu_to_node(j));
+			sds = kzalloc_node(sizeof(struct sched_domain_shared) +
+					cpumask_size(), GFP_KERNEL, cpu_to_node(j));
 			if (!sds)
 				return -ENOMEM;
 
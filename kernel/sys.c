@@ -2295,6 +2295,22 @@ SYSCALL_DEFINE5(prctl, int, option, unsigned long, arg2, unsigned long, arg3,
 	case PR_GET_FP_MODE:
 		error = GET_FP_MODE(me);
 		break;
+	case PR_SET_FORK_SHARE_PTE:
+		if (arg3 || arg4 || arg5)
+			return -EINVAL;
+		if (!IS_ENABLED(CONFIG_SHARE_PTE_TABLES) ||
+		    !USE_SPLIT_PTE_PTLOCKS)
+			return -EINVAL;
+		if (arg2)
+			set_bit(MMF_SHARE_PTE, &me->mm->flags);
+		else
+			clear_bit(MMF_SHARE_PTE, &me->mm->flags);
+		break;
+	case PR_GET_FORK_SHARE_PTE:
+		if (arg2 || arg3 || arg4 || arg5)
+			return -EINVAL;
+		error = test_bit(MMF_SHARE_PTE, &me->mm->flags);
+		break;
 	default:
 		error = -EINVAL;
 		break;
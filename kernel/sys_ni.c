@@ -146,11 +146,13 @@ cond_syscall(compat_sys_ipc);
 cond_syscall(compat_sys_sysctl);
 cond_syscall(sys_flock);
 cond_syscall(sys_io_setup);
+cond_syscall(sys_io_setup2);
 cond_syscall(sys_io_destroy);
 cond_syscall(sys_io_submit);
 cond_syscall(sys_io_cancel);
 cond_syscall(sys_io_getevents);
 cond_syscall(compat_sys_io_setup);
+cond_syscall(compat_sys_io_setup2);
 cond_syscall(compat_sys_io_submit);
 cond_syscall(compat_sys_io_getevents);
 cond_syscall(sys_sysfs);
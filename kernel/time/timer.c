@@ -184,6 +184,9 @@ EXPORT_SYMBOL(jiffies_64);
  */
 #define WHEEL_SIZE	(LVL_SIZE * LVL_DEPTH)
 
+/* The number of timers run by one invocation of the timer softirq */
+#define TIMER_EXPIRE_BATCH	1024
+
 #ifdef CONFIG_NO_HZ_COMMON
 # define NR_BASES	2
 # define BASE_STD	0
@@ -199,6 +202,8 @@ struct timer_base {
 	struct timer_list	*running_timer;
 	unsigned long		clk;
 	unsigned long		next_expiry;
+	/* Odd while collected timers are off the wheel, see __run_timers() */
+	seqcount_t		expiry_seq;
 	unsigned int		cpu;
 	bool			migration_enabled;
 	bool			nohz_active;
@@ -922,6 +927,47 @@ static struct timer_base *lock_timer_base(struct timer_list *timer,
 	}
 }
 
+/*
+ * A pending timer fires when its bucket is reached, which is never before
+ * the expiry of any timer it would hold at the current base clock. So if a
+ * later expiry maps to the same bucket, only ->expires has to change, and
+ * that can be done without the base lock:
+ *
+ * - A stale base clock only makes the comparison conservative, as long as
+ *   the bucket hasn't been reached since the clock was read. A bucket
+ *   reached before the clock was read may still have its timers on the
+ *   expiry list, pending and with their flags unchanged: the expiry
+ *   sequence of the base tells that such a list may exist.
+ * - If the timer is dequeued, requeued or migrated meanwhile, the recheck
+ *   of the pending state and the flags after the update fails, and the
+ *   caller redoes it under the lock.
+ */
+static bool mod_timer_later_lockless(struct timer_list *timer,
+				     unsigned long expires)
+{
+	u32 tflags = READ_ONCE(timer->flags);
+	struct timer_base *base;
+	unsigned int idx, seq;
+
+	if (tflags & TIMER_MIGRATING)
+		return false;
+
+	base = get_timer_base(tflags);
+	seq = raw_read_seqcount(&base->expiry_seq);
+	if (seq & 1)
+		return false;
+
+	idx = calc_wheel_index(expires, READ_ONCE(base->clk));
+	if (idx != ((tflags & TIMER_ARRAYMASK) >> TIMER_ARRAYSHIFT))
+		return false;
+
+	WRITE_ONCE(timer->expires, expires);
+	smp_mb();
+
+	return timer_pending(timer) && READ_ONCE(timer->flags) == tflags &&
+	       !read_seqcount_retry(&base->expiry_seq, seq);
+}
+
 static inline int
 __mod_timer(struct timer_list *timer, unsigned long expires, bool pending_only)
 {
@@ -941,6 +987,14 @@ __mod_timer(struct timer_list *timer, unsigned long expires, bool pending_only)
 		if (timer->expires == expires)
 			return 1;
 
+		/*
+		 * Pushing the deadline out is what TCP does on every packet:
+		 * try that without the base lock when it keeps the bucket.
+		 */
+		if (time_after(expires, timer->expires) &&
+		    mod_timer_later_lockless(timer, expires))
+			return 1;
+
 		/*
 		 * We lock timer base and calculate the bucket index right
 		 * here. If the timer ends up in the same bucket, then we
@@ -1283,13 +1337,36 @@ static void call_timer_fn(struct timer_list *timer, void (*fn)(unsigned long),
 	}
 }
 
-static void expire_timers(struct timer_base *base, struct hlist_head *head)
+/*
+ * Put expired timers back into the wheel, so that they are the first ones
+ * run by the next invocation of the timer softirq.
+ */
+static void requeue_timers(struct timer_base *base, struct hlist_head *head)
+{
+	while (!hlist_empty(head)) {
+		struct timer_list *timer;
+
+		timer = hlist_entry(head->first, struct timer_list, entry);
+		__hlist_del(&timer->entry);
+		enqueue_timer(base, timer,
+			      calc_wheel_index(timer->expires, base->clk));
+	}
+}
+
+static void expire_timers(struct timer_base *base, struct hlist_head *head,
+			  int *budget)
 {
 	while (!hlist_empty(head)) {
 		struct timer_list *timer;
 		void (*fn)(unsigned long);
 		unsigned long data;
 
+		if (*budget <= 0) {
+			requeue_timers(base, head);
+			return;
+		}
+		(*budget)--;
+
 		timer = hlist_entry(head->first, struct timer_list, entry);
 
 		base->running_timer = timer;
@@ -1585,6 +1662,7 @@ void update_process_times(int user_tick)
 static inline void __run_timers(struct timer_base *base)
 {
 	struct hlist_head heads[LVL_DEPTH];
+	int budget = TIMER_EXPIRE_BATCH;
 	int levels;
 
 	if (!time_after_eq(jiffies, base->clk))
@@ -1592,15 +1670,33 @@ static inline void __run_timers(struct timer_base *base)
 
 	spin_lock_irq(&base->lock);
 
+	/*
+	 * Collected timers stay pending on heads[] while the lock is dropped
+	 * for the callbacks: keep mod_timer_later_lockless() off them until
+	 * they have run or gone back to the wheel. The clock is only
+	 * advanced after this, so that a lockless reader which sees the new
+	 * clock sees the sequence change as well.
+	 */
+	raw_write_seqcount_begin(&base->expiry_seq);
+
 	while (time_after_eq(jiffies, base->clk)) {
+		/*
+		 * Leave the rest of a long burst to the next softirq run, the
+		 * softirq code hands it over to ksoftirqd if it keeps coming.
+		 */
+		if (budget <= 0) {
+			raise_softirq_irqoff(TIMER_SOFTIRQ);
+			break;
+		}
 
 		levels = collect_expired_timers(base, heads);
 		base->clk++;
 
 		while (levels--)
-			expire_timers(base, heads + levels);
+			expire_timers(base, heads + levels, &budget);
 	}
 	base->running_timer = NULL;
+	raw_write_seqcount_end(&base->expiry_seq);
 	spin_unlock_irq(&base->lock);
 }
 
@@ -1812,6 +1908,7 @@ static void __init init_timer_cpu(int cpu)
 		base = per_cpu_ptr(&timer_bases[i], cpu);
 		base->cpu = cpu;
 		spin_lock_init(&base->lock);
+		seqcount_init(&base->expiry_seq);
 		base->clk = jiffies;
 	}
 }
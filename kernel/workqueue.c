@@ -151,6 +151,7 @@ struct worker_pool {
 	unsigned long		watchdog_ts;	/* L: watchdog timestamp */
 
 	struct list_head	worklist;	/* L: list of pending works */
+	struct llist_head	staged;		/* works queued locklessly */
 	int			nr_workers;	/* L: total number of workers */
 
 	/* nr_idle includes the ones off idle_list for rebinding */
@@ -904,7 +905,7 @@ struct task_struct *wq_worker_sleeping(struct task_struct *task)
 	 * lock is safe.
 	 */
 	if (atomic_dec_and_test(&pool->nr_running) &&
-	    !list_empty(&pool->worklist))
+	    (!list_empty(&pool->worklist) || !llist_empty(&pool->staged)))
 		to_wakeup = first_idle_worker(pool);
 	return to_wakeup ? to_wakeup->task : NULL;
 }
@@ -1237,6 +1238,7 @@ static int try_to_grab_pending(struct work_struct *work, bool is_dwork,
 		goto fail;
 
 	spin_lock(&pool->lock);
+	pool_drain_staged(pool);
 	/*
 	 * work->data is guaranteed to point to pwq only while the work
 	 * item is queued on pwq->wq, and both updating work->data to point
@@ -1360,13 +1362,102 @@ static int wq_select_unbound_cpu(int cpu)
 	return new_cpu;
 }
 
+/*
+ * Queue @work on @pwq, with its pool locked: this is where it gets its
+ * flush color and is accounted as active, or is delayed.
+ */
+static void __queue_work_locked(struct pool_workqueue *pwq,
+				struct work_struct *work)
+{
+	struct list_head *worklist;
+	unsigned int work_flags;
+
+	pwq->nr_in_flight[pwq->work_color]++;
+	work_flags = work_color_to_flags(pwq->work_color);
+
+	if (likely(pwq->nr_active < pwq->max_active)) {
+		trace_workqueue_activate_work(work);
+		pwq->nr_active++;
+		worklist = &pwq->pool->worklist;
+		if (list_empty(worklist))
+			pwq->pool->watchdog_ts = jiffies;
+	} else {
+		work_flags |= WORK_STRUCT_DELAYED;
+		worklist = &pwq->delayed_works;
+	}
+
+	insert_work(pwq, work, worklist, work_flags);
+}
+
+/**
+ * pool_drain_staged - queue the works staged on a pool
+ * @pool: the target pool
+ *
+ * Move the works queued locklessly on @pool by queue_work_staged() to
+ * their worklists, in the order they were queued.  This has to be done
+ * before looking at @pool's worklists, or at where a work item is queued.
+ *
+ * CONTEXT:
+ * spin_lock_irq(pool->lock).
+ */
+static void pool_drain_staged(struct worker_pool *pool)
+{
+	struct work_struct *work, *n;
+	struct llist_node *first;
+
+	lockdep_assert_held(&pool->lock);
+
+	if (llist_empty(&pool->staged))
+		return;
+
+	first = llist_reverse_order(llist_del_all(&pool->staged));
+	llist_for_each_entry_safe(work, n, first, llnode)
+		__queue_work_locked(work->llpwq, work);
+}
+
+/*
+ * Queue @work on the per-cpu @pwq of the local cpu, without taking the
+ * pool lock as long as one of its workers is running: that worker moves
+ * the work to its worklist once done with the current one.  Otherwise the
+ * works staged so far are queued, and a worker woken up, in one go.
+ *
+ * Workers of a per-cpu pool only run on its cpu, and with irqs disabled
+ * while holding the pool lock.  So they can't miss a work staged here
+ * right before they go to sleep, and wq_worker_sleeping() sees it if the
+ * running worker blocks.  Once the cpu goes down, nr_running stays 0.
+ *
+ * @work->data keeps pointing to the pool rather than to @pwq: it is only
+ * made to point to @pwq when the work is actually queued, with the pool
+ * locked.  Those looking up where the work is queued, with the pool locked
+ * too, drain the staged works first.
+ */
+static void queue_work_staged(struct pool_workqueue *pwq,
+			      struct work_struct *work)
+{
+	struct worker_pool *pool = pwq->pool;
+
+	work->llpwq = pwq;
+	set_work_pool_and_keep_pending(work, pool->id);
+
+	/*
+	 * llist_add() implies a full barrier, pairing with the dec_and_test
+	 * of nr_running, see insert_work().
+	 */
+	llist_add(&work->llnode, &pool->staged);
+
+	if (atomic_read(&pool->nr_running))
+		return;
+
+	spin_lock(&pool->lock);
+	pool_drain_staged(pool);
+	spin_unlock(&pool->lock);
+}
+
 static void __queue_work(int cpu, struct workqueue_struct *wq,
 			 struct work_struct *work)
 {
 	struct pool_workqueue *pwq;
 	struct worker_pool *last_pool;
-	struct list_head *worklist;
-	unsigned int work_flags;
 	unsigned int req_cpu = cpu;
 
 	/*
@@ -1399,6 +1490,16 @@ static void __queue_work(int cpu, struct workqueue_struct *wq,
 	 * pool to guarantee non-reentrancy.
 	 */
 	last_pool = get_work_pool(work);
+
+	if (!(wq->flags & WQ_UNBOUND) && cpu == smp_processor_id() &&
+	    (!last_pool || last_pool == pwq->pool)) {
+		trace_workqueue_queue_work(req_cpu, pwq, work);
+		if (WARN_ON(!list_empty(&work->entry)))
+			return;
+		queue_work_staged(pwq, work);
+		return;
+	}
+
 	if (last_pool && last_pool != pwq->pool) {
 		struct worker *worker;
 
@@ -1444,21 +1545,7 @@ static void __queue_work(int cpu, struct workqueue_struct *wq,
 		return;
 	}
 
-	pwq->nr_in_flight[pwq->work_color]++;
-	work_flags = work_color_to_flags(pwq->work_color);
-
-	if (likely(pwq->nr_active < pwq->max_active)) {
-		trace_workqueue_activate_work(work);
-		pwq->nr_active++;
-		worklist = &pwq->pool->worklist;
-		if (list_empty(worklist))
-			pwq->pool->watchdog_ts = jiffies;
-	} else {
-		work_flags |= WORK_STRUCT_DELAYED;
-		worklist = &pwq->delayed_works;
-	}
-
-	insert_work(pwq, work, worklist, work_flags);
+	__queue_work_locked(pwq, work);
 
 	spin_unlock(&pwq->pool->lock);
 }
@@ -2195,6 +2282,8 @@ static int worker_thread(void *__worker)
 
 	worker_leave_idle(worker);
 recheck:
+	pool_drain_staged(pool);
+
 	/* no more worker necessary? */
 	if (!need_more_worker(pool))
 		goto sleep;
@@ -2235,6 +2324,8 @@ static int worker_thread(void *__worker)
 			move_linked_works(work, &worker->scheduled, NULL);
 			process_scheduled_works(worker);
 		}
+
+		pool_drain_staged(pool);
 	} while (keep_working(pool));
 
 	worker_set_flags(worker, WORKER_PREP);
@@ -2543,6 +2634,7 @@ static bool flush_workqueue_prep_pwqs(struct workqueue_struct *wq,
 		struct worker_pool *pool = pwq->pool;
 
 		spin_lock_irq(&pool->lock);
+		pool_drain_staged(pool);
 
 		if (flush_color >= 0) {
 			WARN_ON_ONCE(pwq->flush_color != -1);
@@ -2760,6 +2852,7 @@ void drain_workqueue(struct workqueue_struct *wq)
 		bool drained;
 
 		spin_lock_irq(&pwq->pool->lock);
+		pool_drain_staged(pwq->pool);
 		drained = !pwq->nr_active && list_empty(&pwq->delayed_works);
 		spin_unlock_irq(&pwq->pool->lock);
 
@@ -2797,6 +2890,7 @@ static bool start_flush_work(struct work_struct *work, struct wq_barrier *barr)
 	}
 
 	spin_lock(&pool->lock);
+	pool_drain_staged(pool);
 	/* see the comment in try_to_grab_pending() with the same code */
 	pwq = get_work_pwq(work);
 	if (pwq) {
@@ -3206,6 +3300,7 @@ static int init_worker_pool(struct worker_pool *pool)
 	pool->flags |= POOL_DISASSOCIATED;
 	pool->watchdog_ts = jiffies;
 	INIT_LIST_HEAD(&pool->worklist);
+	init_llist_head(&pool->staged);
 	INIT_LIST_HEAD(&pool->idle_list);
 	hash_init(pool->busy_hash);
 
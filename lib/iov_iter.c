@@ -130,6 +130,73 @@
 	}							\
 }
 
+#define iterate_iovec_and_advance(i, n, v, I) {			\
+	if (unlikely(i->count < n))				\
+		n = i->count;					\
+	if (i->count) {						\
+		size_t skip = i->iov_offset;			\
+		const struct iovec *iov;			\
+		struct iovec v;					\
+		iterate_iovec(i, n, v, iov, skip, (I))		\
+		if (skip == iov->iov_len) {			\
+			iov++;					\
+			skip = 0;				\
+		}						\
+		i->nr_segs -= iov - i->iov;			\
+		i->iov = iov;					\
+		i->count -= n;					\
+		i->iov_offset = skip;				\
+	}							\
+}
+
+/*
+ * The segments of an iovec were checked with access_ok() when it was
+ * imported, so the whole of it can be copied in a single user access
+ * section, with the kernel buffer checked once for all of them.
+ */
+static size_t copy_to_iter_iovec(const void *addr, size_t bytes,
+				 struct iov_iter *i)
+{
+	const char *from = addr;
+
+	if (unlikely(i->count < bytes))
+		bytes = i->count;
+
+	might_fault();
+	kasan_check_read(addr, bytes);
+	check_object_size(addr, bytes, true);
+
+	user_copy_begin();
+	iterate_iovec_and_advance(i, bytes, v,
+		unsafe_copy_to_user(v.iov_base,
+				    (from += v.iov_len) - v.iov_len,
+				    v.iov_len))
+	user_copy_end();
+
+	return bytes;
+}
+
+static size_t copy_from_iter_iovec(void *addr, size_t bytes,
+				   struct iov_iter *i)
+{
+	char *to = addr;
+
+	if (unlikely(i->count < bytes))
+		bytes = i->count;
+
+	might_fault();
+	kasan_check_write(addr, bytes);
+	check_object_size(addr, bytes, false);
+
+	user_copy_begin();
+	iterate_iovec_and_advance(i, bytes, v,
+		unsafe_copy_from_user((to += v.iov_len) - v.iov_len,
+				      v.iov_base, v.iov_len))
+	user_copy_end();
+
+	return bytes;
+}
+
 static size_t copy_page_to_iter_iovec(struct page *page, size_t offset, size_t bytes,
 			 struct iov_iter *i)
 {
@@ -540,6 +607,8 @@ size_t copy_to_iter(const void *addr, size_t bytes, struct iov_iter *i)
 	const char *from = addr;
 	if (unlikely(i->type & ITER_PIPE))
 		return copy_pipe_to_iter(addr, bytes, i);
+	if (iter_is_iovec(i))
+		return copy_to_iter_iovec(addr, bytes, i);
 	iterate_and_advance(i, bytes, v,
 		__copy_to_user(v.iov_base, (from += v.iov_len) - v.iov_len,
 			       v.iov_len),
@@ -559,6 +628,8 @@ size_t copy_from_iter(void *addr, size_t bytes, struct iov_iter *i)
 		WARN_ON(1);
 		return 0;
 	}
+	if (iter_is_iovec(i))
+		return copy_from_iter_iovec(addr, bytes, i);
 	iterate_and_advance(i, bytes, v,
 		__copy_from_user((to += v.iov_len) - v.iov_len, v.iov_base,
 				 v.iov_len),
@@ -647,9 +718,13 @@ size_t copy_page_to_iter(struct page *page, size_t offset, size_t bytes,
 		size_t wanted = copy_to_iter(kaddr + offset, bytes, i);
 		kunmap_atomic(kaddr);
 		return wanted;
-	} else if (likely(!(i->type & ITER_PIPE)))
+	} else if (likely(!(i->type & ITER_PIPE))) {
+		/* Without highmem, there is no kmap_atomic() to try first */
+		if (!IS_ENABLED(CONFIG_HIGHMEM))
+			return copy_to_iter_iovec(page_address(page) + offset,
+						  bytes, i);
 		return copy_page_to_iter_iovec(page, offset, bytes, i);
-	else
+	} else
 		return copy_page_to_iter_pipe(page, offset, bytes, i);
 }
 EXPORT_SYMBOL(copy_page_to_iter);
@@ -666,8 +741,11 @@ size_t copy_page_from_iter(struct page *page, size_t offset, size_t bytes,
 		size_t wanted = copy_from_iter(kaddr + offset, bytes, i);
 		kunmap_atomic(kaddr);
 		return wanted;
-	} else
-		return copy_page_from_iter_iovec(page, offset, bytes, i);
+	}
+	if (!IS_ENABLED(CONFIG_HIGHMEM))
+		return copy_from_iter_iovec(page_address(page) + offset,
+					    bytes, i);
+	return copy_page_from_iter_iovec(page, offset, bytes, i);
 }
 EXPORT_SYMBOL(copy_page_from_iter);
 
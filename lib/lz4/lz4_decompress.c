@@ -40,6 +40,21 @@
 #include <linux/kernel.h>
 #include <asm/unaligned.h>
 
+/*
+ * arm64 decodes most of LZ4_decompress_safe() blocks with NEON, see
+ * arch/arm64/lib/lz4-neon.c, but not in the pre-boot environment.
+ */
+#if defined(CONFIG_ARM64) && defined(CONFIG_KERNEL_MODE_NEON) && \
+	!defined(STATIC)
+#include <asm/neon.h>
+#define LZ4_NEON 1
+
+int LZ4_decompress_neon_inner(const BYTE **src, BYTE **dst,
+	const BYTE *iend, BYTE *oend, const BYTE *low, BYTE *ostop);
+#else
+#define LZ4_NEON 0
+#endif
+
 /*-*****************************
  *	Decompression functions
  *******************************/
@@ -334,9 +349,57 @@ static FORCE_INLINE int LZ4_decompress_generic(
 	return -1;
 }
 
+#if LZ4_NEON
+/*
+ * Output handed to NEON at a time, which is as long as preemption stays
+ * disabled.
+ */
+#define LZ4_NEON_CHUNK (64 * KB)
+
+static int LZ4_decompress_safe_neon(const char *source, char *dest,
+	int compressedSize, int maxDecompressedSize)
+{
+	const BYTE *ip = (const BYTE *) source;
+	const BYTE * const iend = ip + compressedSize;
+	BYTE *op = (BYTE *) dest;
+	BYTE * const oend = op + maxDecompressedSize;
+	BYTE *ostop;
+	int ret;
+
+	do {
+		ostop = oend - op > LZ4_NEON_CHUNK ? op + LZ4_NEON_CHUNK : oend;
+
+		kernel_neon_begin();
+		ret = LZ4_decompress_neon_inner(&ip, &op, iend, oend,
+			(BYTE *)dest, ostop);
+		kernel_neon_end();
+
+		if (ret)
+			return -1;
+	} while (op >= ostop && ostop != oend);
+
+	/*
+	 * The generic decoder takes over where NEON stopped, with the
+	 * output decoded so far as the prefix the matches can point to.
+	 */
+	ret = LZ4_decompress_generic((const char *)ip, (char *)op,
+		iend - ip, oend - op, endOnInputSize, full, 0,
+		noDict, (BYTE *)dest, NULL, 0);
+	if (ret < 0)
+		return ret;
+
+	return ret + (int)(op - (BYTE *)dest);
+}
+#endif
+
 int LZ4_decompress_safe(const char *source, char *dest,
 	int compressedSize, int maxDecompressedSize)
 {
+#if LZ4_NEON
+	if (cpu_has_neon())
+		return LZ4_decompress_safe_neon(source, dest, compressedSize,
+			maxDecompressedSize);
+#endif
 	return LZ4_decompress_generic(source, dest, compressedSize,
 		maxDecompressedSize, endOnInputSize, full, 0,
 		noDict, (BYTE *)dest, NULL, 0);
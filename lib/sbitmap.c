@@ -173,6 +173,55 @@ int sbitmap_get_shallow(struct sbitmap *sb, unsigned int alloc_hint,
 }
 EXPORT_SYMBOL_GPL(sbitmap_get_shallow);
 
+/*
+ * Grab all free bits of one SBQ_CACHE_BATCH aligned group of bits, starting
+ * the search at the group of @alloc_hint. Returns the first bit of the group,
+ * with the bits taken in @mask, or -1 if the bitmap is full.
+ */
+static int sbitmap_get_batch(struct sbitmap *sb, unsigned int alloc_hint,
+			     unsigned long *mask)
+{
+	unsigned int i, j, index, group, nr_groups;
+
+	index = SB_NR_TO_INDEX(sb, alloc_hint);
+	group = SB_NR_TO_BIT(sb, alloc_hint) / SBQ_CACHE_BATCH;
+
+	for (i = 0; i < sb->map_nr; i++) {
+		struct sbitmap_word *map = &sb->map[index];
+		unsigned long depth = READ_ONCE(map->depth);
+
+		nr_groups = DIV_ROUND_UP(depth, SBQ_CACHE_BATCH);
+		for (j = 0; j < nr_groups; j++, group++) {
+			unsigned long word, avail;
+			unsigned int bit;
+
+			if (group >= nr_groups)
+				group = 0;
+			bit = group * SBQ_CACHE_BATCH;
+			avail = (1UL << min_t(unsigned long, SBQ_CACHE_BATCH,
+					      depth - bit)) - 1;
+
+			do {
+				word = READ_ONCE(map->word);
+				*mask = ~(word >> bit) & avail;
+				if (!*mask)
+					break;
+			} while (cmpxchg(&map->word, word,
+					 word | (*mask << bit)) != word);
+
+			if (*mask)
+				return (index << sb->shift) + bit;
+		}
+
+		/* Jump to next index. */
+		group = 0;
+		if (++index >= sb->map_nr)
+			index = 0;
+	}
+
+	return -1;
+}
+
 bool sbitmap_any_bit_set(const struct sbitmap *sb)
 {
 	unsigned int i;
@@ -307,6 +356,9 @@ int sbitmap_queue_init_node(struct sbitmap_queue *sbq, unsigned int depth,
 			*per_cpu_ptr(sbq->alloc_hint, i) = prandom_u32() % depth;
 	}
 
+	sbq->cache = NULL;
+	atomic_set(&sbq->ws_active, 0);
+
 	sbq->wake_batch = sbq_calc_wake_batch(depth);
 	atomic_set(&sbq->wake_index, 0);
 
@@ -327,6 +379,113 @@ int sbitmap_queue_init_node(struct sbitmap_queue *sbq, unsigned int depth,
 }
 EXPORT_SYMBOL_GPL(sbitmap_queue_init_node);
 
+static void sbq_wake_up(struct sbitmap_queue *sbq);
+
+int sbitmap_queue_init_cache(struct sbitmap_queue *sbq, gfp_t flags)
+{
+	if (sbq->round_robin || (1U << sbq->sb.shift) < SBQ_CACHE_BATCH)
+		return 0;
+
+	sbq->cache = alloc_percpu_gfp(unsigned long, flags);
+	if (!sbq->cache)
+		return -ENOMEM;
+	return 0;
+}
+EXPORT_SYMBOL_GPL(sbitmap_queue_init_cache);
+
+/* Free the bits of a cache word taken out of the per-cpu cache */
+static void sbq_cache_release(struct sbitmap_queue *sbq, unsigned long val)
+{
+	unsigned int base = (val >> SBQ_CACHE_SHIFT) * SBQ_CACHE_BATCH;
+	unsigned long mask = val & SBQ_CACHE_MASK;
+
+	while (mask) {
+		sbitmap_clear_bit(&sbq->sb, base + __ffs(mask));
+		sbq_wake_up(sbq);
+		mask &= mask - 1;
+	}
+}
+
+void sbitmap_queue_flush_cache(struct sbitmap_queue *sbq)
+{
+	int cpu;
+
+	if (!sbq->cache)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		unsigned long *cache = per_cpu_ptr(sbq->cache, cpu);
+
+		if (READ_ONCE(*cache) & SBQ_CACHE_MASK)
+			sbq_cache_release(sbq, xchg(cache, 0));
+	}
+}
+EXPORT_SYMBOL_GPL(sbitmap_queue_flush_cache);
+
+static int sbq_cache_get(struct sbitmap_queue *sbq, unsigned int hint)
+{
+	unsigned long *cache = this_cpu_ptr(sbq->cache);
+	unsigned long old, new, mask;
+	unsigned int depth;
+	int nr;
+
+	do {
+		old = READ_ONCE(*cache);
+		if (!(old & SBQ_CACHE_MASK))
+			goto refill;
+		new = old & (old - 1);
+	} while (cmpxchg(cache, old, new) != old);
+
+	return (old >> SBQ_CACHE_SHIFT) * SBQ_CACHE_BATCH + __ffs(old);
+
+refill:
+	nr = sbitmap_get_batch(&sbq->sb, hint, &mask);
+	if (nr == -1) {
+		/* Out of bits, take back what the other CPUs are sitting on. */
+		this_cpu_write(*sbq->alloc_hint, 0);
+		sbitmap_queue_flush_cache(sbq);
+		return sbitmap_get(&sbq->sb, hint, false);
+	}
+
+	depth = READ_ONCE(sbq->sb.depth);
+	hint = nr + SBQ_CACHE_BATCH;
+	if (hint >= depth)
+		hint = 0;
+	this_cpu_write(*sbq->alloc_hint, hint);
+
+	/* Keep the first bit, cache the rest unless someone is waiting. */
+	old = ((unsigned long)nr / SBQ_CACHE_BATCH) << SBQ_CACHE_SHIFT;
+	new = old | (mask & (mask - 1));
+	if (unlikely(atomic_read(&sbq->ws_active)))
+		sbq_cache_release(sbq, new);
+	else
+		sbq_cache_release(sbq, xchg(cache, new));
+
+	return nr + __ffs(mask);
+}
+
+static bool sbq_cache_put(struct sbitmap_queue *sbq, unsigned int nr)
+{
+	unsigned long *cache = raw_cpu_ptr(sbq->cache);
+	unsigned long old;
+
+	do {
+		old = READ_ONCE(*cache);
+		if ((old >> SBQ_CACHE_SHIFT) != nr / SBQ_CACHE_BATCH)
+			return false;
+	} while (cmpxchg(cache, old,
+			 old | BIT(nr % SBQ_CACHE_BATCH)) != old);
+
+	/*
+	 * A waiter showing up between the ws_active check in the caller and
+	 * here may already have flushed the caches and gone to sleep, it
+	 * would never see this bit.
+	 */
+	if (unlikely(atomic_read(&sbq->ws_active)))
+		sbq_cache_release(sbq, xchg(cache, 0));
+	return true;
+}
+
 void sbitmap_queue_resize(struct sbitmap_queue *sbq, unsigned int depth)
 {
 	unsigned int wake_batch = sbq_calc_wake_batch(depth);
@@ -342,6 +501,7 @@ void sbitmap_queue_resize(struct sbitmap_queue *sbq, unsigned int depth)
 		for (i = 0; i < SBQ_WAIT_QUEUES; i++)
 			atomic_set(&sbq->ws[i].wait_cnt, 1);
 	}
+	sbitmap_queue_flush_cache(sbq);
 	sbitmap_resize(&sbq->sb, depth);
 }
 EXPORT_SYMBOL_GPL(sbitmap_queue_resize);
@@ -357,6 +517,9 @@ int __sbitmap_queue_get(struct sbitmap_queue *sbq)
 		hint = depth ? prandom_u32() % depth : 0;
 		this_cpu_write(*sbq->alloc_hint, hint);
 	}
+	if (sbq->cache)
+		return sbq_cache_get(sbq, hint);
+
 	nr = sbitmap_get(&sbq->sb, hint, sbq->round_robin);
 
 	if (nr == -1) {
@@ -387,6 +550,10 @@ int __sbitmap_queue_get_shallow(struct sbitmap_queue *sbq,
 		this_cpu_write(*sbq->alloc_hint, hint);
 	}
 	nr = sbitmap_get_shallow(&sbq->sb, hint, shallow_depth);
+	if (nr == -1 && sbq->cache) {
+		sbitmap_queue_flush_cache(sbq);
+		nr = sbitmap_get_shallow(&sbq->sb, hint, shallow_depth);
+	}
 
 	if (nr == -1) {
 		/* If the map is full, a hint won't do us much good. */
@@ -469,6 +636,10 @@ static void sbq_wake_up(struct sbitmap_queue *sbq)
 void sbitmap_queue_clear(struct sbitmap_queue *sbq, unsigned int nr,
 			 unsigned int cpu)
 {
+	if (sbq->cache && likely(nr < sbq->sb.depth) &&
+	    !atomic_read(&sbq->ws_active) && sbq_cache_put(sbq, nr))
+		return;
+
 	sbitmap_clear_bit(&sbq->sb, nr);
 	sbq_wake_up(sbq);
 	if (likely(!sbq->round_robin && nr < sbq->sb.depth))
@@ -528,5 +699,7 @@ void sbitmap_queue_show(struct sbitmap_queue *sbq, struct seq_file *m)
 	seq_puts(m, "}\n");
 
 	seq_printf(m, "round_robin=%d\n", sbq->round_robin);
+	seq_printf(m, "cache=%d\n", !!sbq->cache);
+	seq_printf(m, "ws_active=%d\n", atomic_read(&sbq->ws_active));
 }
 EXPORT_SYMBOL_GPL(sbitmap_queue_show);
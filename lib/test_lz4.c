@@ -0,0 +1,179 @@
+/*
+ * Test and benchmark for the LZ4 decompressors
+ *
+ * Copyright (C) 2017 - Linaro Ltd
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/random.h>
+#include <linux/string.h>
+#include <linux/timekeeping.h>
+#include <linux/vmalloc.h>
+#include <linux/lz4.h>
+
+#define TEST_LZ4_SIZE	(128 * 1024)
+
+static unsigned int runs = 100;
+module_param(runs, uint, 0444);
+MODULE_PARM_DESC(runs, "Number of decompressions to time per data set");
+
+/*
+ * Data sets with matches at all sorts of distances, short ones included
+ * since that is where overlapping copies happen.
+ */
+enum {
+	TEST_LZ4_TEXT,		/* small alphabet, mostly short matches */
+	TEST_LZ4_NEAR,		/* matches closer than 16 bytes */
+	TEST_LZ4_MIXED,		/* matches up to 4KB away */
+	TEST_LZ4_RANDOM,	/* incompressible */
+	TEST_LZ4_NR,
+};
+
+static const char * const test_lz4_names[TEST_LZ4_NR] = {
+	[TEST_LZ4_TEXT]		= "text",
+	[TEST_LZ4_NEAR]		= "near",
+	[TEST_LZ4_MIXED]	= "mixed",
+	[TEST_LZ4_RANDOM]	= "random",
+};
+
+static void __init test_lz4_fill(u8 *buf, size_t len, int type,
+				 struct rnd_state *rnd)
+{
+	size_t i = 0, off, n;
+
+	while (i < len) {
+		u32 r = prandom_u32_state(rnd);
+
+		switch (type) {
+		case TEST_LZ4_TEXT:
+			off = r % 3 ? 0 : 1 + (r >> 8) % 256;
+			break;
+		case TEST_LZ4_NEAR:
+			off = r % 4 ? 1 + (r >> 8) % 15 : 0;
+			break;
+		case TEST_LZ4_MIXED:
+			off = r % 2 ? 1 + (r >> 8) % 4096 : 0;
+			break;
+		default:
+			off = 0;
+			break;
+		}
+
+		if (!off || off > i) {
+			buf[i++] = type == TEST_LZ4_TEXT ? 'a' + r % 8 : r;
+			continue;
+		}
+
+		for (n = 4 + (r >> 20) % 64; n && i < len; n--, i++)
+			buf[i] = buf[i - off];
+	}
+}
+
+static u64 __init test_lz4_mbps(u64 ns)
+{
+	return div64_u64((u64)TEST_LZ4_SIZE * runs * NSEC_PER_SEC,
+			 (ns ?: 1) << 20);
+}
+
+/*
+ * LZ4_decompress_safe_usingDict() without a dictionary always takes the
+ * generic path, which is the baseline for any accelerated one.
+ */
+static int __init test_lz4_one(int type, u8 *src, char *comp, char *dst,
+			       void *wrkmem, struct rnd_state *rnd)
+{
+	int clen, ret, i;
+	u64 start, fast, generic;
+
+	test_lz4_fill(src, TEST_LZ4_SIZE, type, rnd);
+
+	clen = LZ4_compress_default((char *)src, comp, TEST_LZ4_SIZE,
+				    LZ4_compressBound(TEST_LZ4_SIZE), wrkmem);
+	if (clen <= 0) {
+		pr_err("%s: compression failed\n", test_lz4_names[type]);
+		return -EINVAL;
+	}
+
+	memset(dst, 0, TEST_LZ4_SIZE);
+	ret = LZ4_decompress_safe(comp, dst, clen, TEST_LZ4_SIZE);
+	if (ret != TEST_LZ4_SIZE || memcmp(src, dst, TEST_LZ4_SIZE)) {
+		pr_err("%s: LZ4_decompress_safe() failed: %d\n",
+		       test_lz4_names[type], ret);
+		return -EINVAL;
+	}
+
+	/* An output buffer one byte short must be caught */
+	ret = LZ4_decompress_safe(comp, dst, clen, TEST_LZ4_SIZE - 1);
+	if (ret >= 0) {
+		pr_err("%s: overflow not detected\n", test_lz4_names[type]);
+		return -EINVAL;
+	}
+
+	start = ktime_get_ns();
+	for (i = 0; i < runs; i++)
+		LZ4_decompress_safe(comp, dst, clen, TEST_LZ4_SIZE);
+	fast = ktime_get_ns() - start;
+
+	start = ktime_get_ns();
+	for (i = 0; i < runs; i++)
+		LZ4_decompress_safe_usingDict(comp, dst, clen, TEST_LZ4_SIZE,
+					      NULL, 0);
+	generic = ktime_get_ns() - start;
+
+	pr_info("%-6s: ratio %3d%%, %llu MB/s, generic %llu MB/s\n",
+		test_lz4_names[type], clen * 100 / TEST_LZ4_SIZE,
+		test_lz4_mbps(fast), test_lz4_mbps(generic));
+
+	return 0;
+}
+
+static int __init test_lz4_init(void)
+{
+	char *comp, *dst;
+	void *wrkmem;
+	u8 *src;
+	struct rnd_state rnd;
+	int type, err = -ENOMEM;
+
+	src = vmalloc(TEST_LZ4_SIZE);
+	comp = vmalloc(LZ4_compressBound(TEST_LZ4_SIZE));
+	dst = vmalloc(TEST_LZ4_SIZE);
+	wrkmem = vmalloc(LZ4_MEM_COMPRESS);
+	if (!src || !comp || !dst || !wrkmem)
+		goto out;
+
+	prandom_seed_state(&rnd, 3141592653589793238ULL);
+
+	for (type = 0; type < TEST_LZ4_NR; type++) {
+		err = test_lz4_one(type, src, comp, dst, wrkmem, &rnd);
+		if (err)
+			goto out;
+	}
+
+	pr_info("all tests passed\n");
+out:
+	vfree(wrkmem);
+	vfree(dst);
+	vfree(comp);
+	vfree(src);
+	return err;
+}
+
+static void __exit test_lz4_exit(void)
+{
+}
+
+module_init(test_lz4_init);
+module_exit(test_lz4_exit);
+
+MODULE_AUTHOR("Linaro Ltd");
+MODULE_DESCRIPTION("LZ4 decompression test and benchmark");
+MODULE_LICENSE("GPL");
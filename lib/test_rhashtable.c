@@ -18,11 +18,13 @@
 #include <linux/kernel.h>
 #include <linux/kthread.h>
 #include <linux/module.h>
+#include <linux/random.h>
 #include <linux/rcupdate.h>
 #include <linux/rhashtable.h>
 #include <linux/semaphore.h>
 #include <linux/slab.h>
 #include <linux/sched.h>
+#include <linux/delay.h>
 #include <linux/vmalloc.h>
 
 #define MAX_ENTRIES	1000000
@@ -56,6 +58,30 @@ static bool enomem_retry = false;
 module_param(enomem_retry, bool, 0);
 MODULE_PARM_DESC(enomem_retry, "Retry insert even if -ENOMEM was returned (default: off)");
 
+static bool bench = false;
+module_param(bench, bool, 0);
+MODULE_PARM_DESC(bench, "Run the multi-threaded benchmark instead of the tests (default: off)");
+
+static int bench_threads = 0;
+module_param(bench_threads, int, 0);
+MODULE_PARM_DESC(bench_threads, "Benchmark threads, one bound per CPU (default: one per online CPU)");
+
+static int bench_keys = 1 << 18;
+module_param(bench_keys, int, 0);
+MODULE_PARM_DESC(bench_keys, "Size of the benchmark key space (default: 262144)");
+
+static int bench_ms = 2000;
+module_param(bench_ms, int, 0);
+MODULE_PARM_DESC(bench_ms, "Duration of each benchmark scenario in ms (default: 2000)");
+
+static int bench_read = 90;
+module_param(bench_read, int, 0);
+MODULE_PARM_DESC(bench_read, "Percentage of lookups in the mixed scenario (default: 90)");
+
+static int bench_insert = 5;
+module_param(bench_insert, int, 0);
+MODULE_PARM_DESC(bench_insert, "Percentage of inserts in the mixed scenario, the rest are deletes (default: 5)");
+
 struct test_obj {
 	int			value;
 	struct rhash_head	node;
@@ -323,6 +349,386 @@ static int threadfunc(void *data)
 	return err;
 }
 
+/**************************************************************************
+ * Benchmark
+ **************************************************************************/
+
+enum {
+	BENCH_LOOKUP,
+	BENCH_INSERT,
+	BENCH_DELETE,
+	BENCH_OPS,
+};
+
+static const char *const bench_op_name[BENCH_OPS] = {
+	"lookup", "insert", "delete",
+};
+
+/*
+ * Latencies are kept in log-linear buckets: values below 4ns get a bucket
+ * each, then every power of two is split in four. One op in 2^time_shift
+ * is timed, to keep the clock reads from dominating the fast lookups.
+ */
+#define BENCH_HIST_SUB_SHIFT	2
+#define BENCH_HIST_BUCKETS	(64 << BENCH_HIST_SUB_SHIFT)
+#define BENCH_TIME_SHIFT	3
+
+struct bench_scenario {
+	const char *name;
+	int prefill;			/* percentage of the keys present */
+	int read;			/* percentage of lookups */
+	int insert;			/* percentage of inserts */
+	bool shrinking;
+};
+
+struct bench_thread {
+	int id;
+	struct task_struct *task;
+	struct rnd_state rnd;
+	u64 ops[BENCH_OPS];
+	u64 failed;
+	u32 hist[BENCH_OPS][BENCH_HIST_BUCKETS];
+};
+
+static struct rhashtable_params bench_rht_params = {
+	.head_offset = offsetof(struct test_obj, node),
+	.key_offset = offsetof(struct test_obj, value),
+	.key_len = sizeof(int),
+	.hashfn = jhash,
+	.nulls_base = (3U << RHT_BASE_SHIFT),
+};
+
+static const struct bench_scenario *bench_sc;
+static struct test_obj *bench_objs;
+/* Key is in the table, and key is being inserted or deleted by a thread */
+static unsigned long *bench_present, *bench_busy;
+static bool bench_stop;
+
+static unsigned int bench_bucket(u64 ns)
+{
+	int msb;
+
+	if (ns < (1 << BENCH_HIST_SUB_SHIFT))
+		return ns;
+
+	msb = fls64(ns) - 1;
+	return ((msb - BENCH_HIST_SUB_SHIFT + 1) << BENCH_HIST_SUB_SHIFT) |
+	       ((ns >> (msb - BENCH_HIST_SUB_SHIFT)) &
+		((1 << BENCH_HIST_SUB_SHIFT) - 1));
+}
+
+/* Upper bound of the values in bucket @b */
+static u64 bench_bucket_max(unsigned int b)
+{
+	unsigned int mant = b & ((1 << BENCH_HIST_SUB_SHIFT) - 1);
+	int msb;
+
+	if (b < (1 << BENCH_HIST_SUB_SHIFT))
+		return b;
+
+	msb = (b >> BENCH_HIST_SUB_SHIFT) + BENCH_HIST_SUB_SHIFT - 1;
+	return ((u64)((1 << BENCH_HIST_SUB_SHIFT) | mant) <<
+		(msb - BENCH_HIST_SUB_SHIFT)) +
+	       (1ULL << (msb - BENCH_HIST_SUB_SHIFT)) - 1;
+}
+
+/*
+ * A key is only ever inserted or deleted by the thread holding its busy
+ * bit, so the present bit is stable under it. The objects are not freed
+ * until the table is destroyed, so a deleted object can be reinserted
+ * without waiting for a grace period: concurrent lookups may then miss
+ * an entry, but never see freed memory.
+ */
+static int bench_update(int key, int op)
+{
+	struct test_obj *obj = &bench_objs[key];
+	int err = 0;
+
+	if (test_and_set_bit_lock(key, bench_busy))
+		return 0;
+
+	if (op == BENCH_INSERT && !test_bit(key, bench_present)) {
+		err = rhashtable_insert_fast(&ht, &obj->node, bench_rht_params);
+		if (!err)
+			__set_bit(key, bench_present);
+	} else if (op == BENCH_DELETE && test_bit(key, bench_present)) {
+		err = rhashtable_remove_fast(&ht, &obj->node, bench_rht_params);
+		if (!err)
+			__clear_bit(key, bench_present);
+	}
+
+	clear_bit_unlock(key, bench_busy);
+	return err;
+}
+
+static int bench_op(struct bench_thread *t, int op)
+{
+	int key = prandom_u32_state(&t->rnd) % bench_keys;
+
+	if (op == BENCH_LOOKUP) {
+		rcu_read_lock();
+		rhashtable_lookup_fast(&ht, &key, bench_rht_params);
+		rcu_read_unlock();
+		return 0;
+	}
+
+	return bench_update(key, op);
+}
+
+static int bench_threadfunc(void *data)
+{
+	const struct bench_scenario *sc = bench_sc;
+	struct bench_thread *t = data;
+	unsigned long n = 0;
+
+	up(&prestart_sem);
+	if (down_interruptible(&startup_sem))
+		pr_err("  bench[%d]: down_interruptible failed\n", t->id);
+
+	while (!READ_ONCE(bench_stop)) {
+		u32 pick = prandom_u32_state(&t->rnd) % 100;
+		int op;
+		u64 start = 0;
+
+		if (pick < sc->read)
+			op = BENCH_LOOKUP;
+		else if (pick < sc->read + sc->insert)
+			op = BENCH_INSERT;
+		else
+			op = BENCH_DELETE;
+
+		if (!(n & ((1 << BENCH_TIME_SHIFT) - 1)))
+			start = ktime_get_ns();
+
+		if (bench_op(t, op))
+			t->failed++;
+
+		if (start)
+			t->hist[op][bench_bucket(ktime_get_ns() - start)]++;
+
+		t->ops[op]++;
+		if (!(++n & 1023))
+			cond_resched();
+	}
+
+	while (!kthread_should_stop()) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		schedule();
+	}
+	return 0;
+}
+
+static void __init bench_report(struct bench_thread *threads, int nr,
+				u64 ns)
+{
+	static const int pct[] = { 500, 900, 990, 999 };
+	u64 ops[BENCH_OPS] = { }, total = 0, failed = 0;
+	int op, i, b;
+
+	for (i = 0; i < nr; i++) {
+		for (op = 0; op < BENCH_OPS; op++)
+			ops[op] += threads[i].ops[op];
+		failed += threads[i].failed;
+	}
+	for (op = 0; op < BENCH_OPS; op++)
+		total += ops[op];
+
+	pr_info("  %llu ops/s over %d threads, %llu updates failed\n",
+		div64_u64(total * NSEC_PER_SEC, ns), nr, failed);
+
+	for (op = 0; op < BENCH_OPS; op++) {
+		u64 samples = 0, seen = 0, lat[ARRAY_SIZE(pct)] = { };
+		u64 max = 0;
+		int p = 0;
+
+		if (!ops[op])
+			continue;
+
+		for (b = 0; b < BENCH_HIST_BUCKETS; b++)
+			for (i = 0; i < nr; i++)
+				samples += threads[i].hist[op][b];
+
+		for (b = 0; b < BENCH_HIST_BUCKETS; b++) {
+			u64 count = 0;
+
+			for (i = 0; i < nr; i++)
+				count += threads[i].hist[op][b];
+			if (!count)
+				continue;
+
+			seen += count;
+			max = bench_bucket_max(b);
+			while (p < ARRAY_SIZE(pct) &&
+			       seen * 1000 >= samples * pct[p])
+				lat[p++] = max;
+		}
+
+		pr_info("  %-6s %llu ops/s, ns p50 %llu p90 %llu p99 %llu p99.9 %llu max %llu\n",
+			bench_op_name[op],
+			div64_u64(ops[op] * NSEC_PER_SEC, ns),
+			lat[0], lat[1], lat[2], lat[3], max);
+	}
+}
+
+static int __init bench_run(struct bench_thread *threads, int nr,
+			    const struct bench_scenario *sc)
+{
+	unsigned int tbl_size, resizes = 0, start_size;
+	unsigned long deadline;
+	int i, key, err, prefill;
+	u64 start;
+
+	pr_info("Benchmark %s: %d%% lookup, %d%% insert, %d%% delete, %d%% prefilled\n",
+		sc->name, sc->read, sc->insert, 100 - sc->read - sc->insert,
+		sc->prefill);
+
+	bench_rht_params.automatic_shrinking = sc->shrinking;
+	bench_rht_params.max_size = max_size ? :
+				    roundup_pow_of_two(bench_keys);
+	bench_rht_params.nelem_hint = size;
+	err = rhashtable_init(&ht, &bench_rht_params);
+	if (err)
+		return err;
+
+	bitmap_zero(bench_present, bench_keys);
+	prefill = div_u64((u64)bench_keys * sc->prefill, 100);
+	for (key = 0; key < prefill; key++) {
+		err = insert_retry(&ht, &bench_objs[key].node,
+				   bench_rht_params);
+		if (err < 0)
+			goto out;
+		__set_bit(key, bench_present);
+	}
+
+	bench_sc = sc;
+	WRITE_ONCE(bench_stop, false);
+	sema_init(&prestart_sem, 1 - nr);
+	for (i = 0; i < nr; i++) {
+		struct bench_thread *t = &threads[i];
+		int cpu = cpumask_local_spread(i, NUMA_NO_NODE);
+
+		memset(t, 0, sizeof(*t));
+		t->id = i;
+		prandom_seed_state(&t->rnd, get_random_long() ^ i);
+		t->task = kthread_create_on_node(bench_threadfunc, t,
+						 cpu_to_node(cpu),
+						 "rhashtable_bench[%d]", i);
+		if (IS_ERR(t->task)) {
+			err = PTR_ERR(t->task);
+			WRITE_ONCE(bench_stop, true);
+			while (i--) {
+				up(&startup_sem);
+				kthread_stop(threads[i].task);
+			}
+			goto out;
+		}
+		kthread_bind(t->task, cpu);
+		wake_up_process(t->task);
+	}
+
+	if (down_interruptible(&prestart_sem))
+		pr_err("  down interruptible failed\n");
+
+	rcu_read_lock();
+	start_size = tbl_size = rht_dereference_rcu(ht.tbl, &ht)->size;
+	rcu_read_unlock();
+
+	start = ktime_get_ns();
+	deadline = jiffies + msecs_to_jiffies(bench_ms);
+	for (i = 0; i < nr; i++)
+		up(&startup_sem);
+
+	/* Sample the table size to see the resizes happening under load */
+	while (time_before(jiffies, deadline)) {
+		unsigned int now;
+
+		msleep(1);
+		rcu_read_lock();
+		now = rht_dereference_rcu(ht.tbl, &ht)->size;
+		rcu_read_unlock();
+		if (now != tbl_size) {
+			resizes++;
+			tbl_size = now;
+		}
+	}
+	WRITE_ONCE(bench_stop, true);
+	start = ktime_get_ns() - start;
+
+	for (i = 0; i < nr; i++)
+		kthread_stop(threads[i].task);
+
+	pr_info("  table size %u -> %u, %u resizes seen, %u entries\n",
+		start_size, tbl_size, resizes, atomic_read(&ht.nelems));
+	bench_report(threads, nr, start);
+	err = 0;
+out:
+	rhashtable_destroy(&ht);
+	return err;
+}
+
+static int __init test_rht_bench(void)
+{
+	const struct bench_scenario scenarios[] = {
+		{
+			.name = "mixed",
+			.prefill = 50,
+			.read = bench_read,
+			.insert = bench_insert,
+			.shrinking = shrinking,
+		},
+		/* Both grow from a near empty and shrink from a full table */
+		{
+			.name = "grow",
+			.prefill = 0,
+			.read = 50,
+			.insert = 50,
+		},
+		{
+			.name = "shrink",
+			.prefill = 100,
+			.read = 50,
+			.insert = 0,
+			.shrinking = true,
+		},
+	};
+	struct bench_thread *threads;
+	int i, key, nr, err = 0;
+
+	if (bench_read < 0 || bench_insert < 0 ||
+	    bench_read + bench_insert > 100 || bench_keys <= 0 ||
+	    bench_ms <= 0)
+		return -EINVAL;
+
+	nr = bench_threads ? : num_online_cpus();
+	threads = vzalloc(nr * sizeof(*threads));
+	bench_objs = vzalloc(bench_keys * sizeof(*bench_objs));
+	bench_present = vzalloc(BITS_TO_LONGS(bench_keys) * sizeof(long));
+	bench_busy = vzalloc(BITS_TO_LONGS(bench_keys) * sizeof(long));
+	if (!threads || !bench_objs || !bench_present || !bench_busy) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	for (key = 0; key < bench_keys; key++)
+		bench_objs[key].value = key;
+
+	for (i = 0; i < ARRAY_SIZE(scenarios); i++) {
+		err = bench_run(threads, nr, &scenarios[i]);
+		if (err) {
+			pr_warn("Benchmark %s failed: %d\n",
+				scenarios[i].name, err);
+			break;
+		}
+	}
+
+out:
+	vfree(bench_busy);
+	vfree(bench_present);
+	vfree(bench_objs);
+	vfree(threads);
+	return err;
+}
+
 static int __init test_rht_init(void)
 {
 	int i, err, started_threads = 0, failed_threads = 0;
@@ -330,6 +736,9 @@ static int __init test_rht_init(void)
 	struct thread_data *tdata;
 	struct test_obj *objs;
 
+	if (bench)
+		return test_rht_bench();
+
 	entries = min(entries, MAX_ENTRIES);
 
 	test_rht_params.automatic_shrinking = shrinking;
@@ -18,6 +18,8 @@
 
 #define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
 
+#include <linux/ktime.h>
+#include <linux/math64.h>
 #include <linux/mman.h>
 #include <linux/module.h>
 #include <linux/sched.h>
@@ -50,6 +52,126 @@
 	cond;				\
 })
 
+#define LARGE_COPY_SIZE		(128 * 1024)
+
+static int __init test_large_copies(void)
+{
+	static const size_t sizes[] = { 32 * 1024 - 1, 32 * 1024,
+					64 * 1024 + 77, LARGE_COPY_SIZE - 16 };
+	unsigned long user_addr;
+	char __user *usermem;
+	char *src, *dst;
+	int ret = 0;
+	int i, off;
+
+	src = vmalloc(LARGE_COPY_SIZE);
+	dst = vmalloc(LARGE_COPY_SIZE);
+	if (!src || !dst) {
+		ret = -ENOMEM;
+		goto out_free;
+	}
+
+	user_addr = vm_mmap(NULL, 0, LARGE_COPY_SIZE, PROT_READ | PROT_WRITE,
+			    MAP_ANONYMOUS | MAP_PRIVATE, 0);
+	if (user_addr >= (unsigned long)(TASK_SIZE)) {
+		pr_warn("Failed to allocate user memory\n");
+		ret = -ENOMEM;
+		goto out_free;
+	}
+	usermem = (char __user *)user_addr;
+
+	for (i = 0; i < LARGE_COPY_SIZE; i++)
+		src[i] = i ^ (i >> 8);
+
+	for (i = 0; i < ARRAY_SIZE(sizes); i++) {
+		for (off = 0; off < 16; off += 5) {
+			size_t len = sizes[i] - off;
+
+			memset(dst, 0, LARGE_COPY_SIZE);
+			ret |= test(copy_to_user(usermem + off, src, len),
+				    "large copy_to_user failed");
+			ret |= test(copy_from_user(dst + 15 - off,
+						   usermem + off, len),
+				    "large copy_from_user failed");
+			ret |= test(memcmp(dst + 15 - off, src, len),
+				    "large usercopy failed to copy data");
+		}
+	}
+
+	vm_munmap(user_addr, LARGE_COPY_SIZE);
+out_free:
+	vfree(dst);
+	vfree(src);
+
+	return ret;
+}
+
+static bool bench;
+module_param(bench, bool, 0444);
+MODULE_PARM_DESC(bench, "Also report the throughput of large copies");
+
+#define BENCH_COPY_SIZE		(4 * 1024 * 1024)
+#define BENCH_COPY_BYTES	(256 * 1024 * 1024)
+
+/*
+ * Throughput of copies either side of the sizes at which architectures
+ * switch copy loops, such as the 32kB from which arm64 streams the stores.
+ */
+static void __init bench_large_copies(void)
+{
+	static const size_t sizes[] = { 4 * 1024, 16 * 1024, 32 * 1024 - 64,
+					32 * 1024, 256 * 1024,
+					BENCH_COPY_SIZE };
+	unsigned long user_addr, left;
+	char __user *usermem;
+	u64 start, to_ns, from_ns;
+	char *kmem;
+	int i, n;
+
+	kmem = vmalloc(BENCH_COPY_SIZE);
+	if (!kmem)
+		return;
+
+	user_addr = vm_mmap(NULL, 0, BENCH_COPY_SIZE, PROT_READ | PROT_WRITE,
+			    MAP_ANONYMOUS | MAP_PRIVATE, 0);
+	if (user_addr >= (unsigned long)(TASK_SIZE)) {
+		pr_warn("Failed to allocate user memory\n");
+		goto out_free;
+	}
+	usermem = (char __user *)user_addr;
+
+	/* Fault everything in, so that only the copies get timed. */
+	memset(kmem, 0x5a, BENCH_COPY_SIZE);
+	left = copy_to_user(usermem, kmem, BENCH_COPY_SIZE);
+
+	for (i = 0; i < ARRAY_SIZE(sizes) && !left; i++) {
+		n = BENCH_COPY_BYTES / sizes[i];
+
+		start = ktime_get_ns();
+		for (; n && !left; n--)
+			left = copy_to_user(usermem, kmem, sizes[i]);
+		to_ns = ktime_get_ns() - start;
+
+		n = BENCH_COPY_BYTES / sizes[i];
+		start = ktime_get_ns();
+		for (; n && !left; n--)
+			left = copy_from_user(kmem, usermem, sizes[i]);
+		from_ns = ktime_get_ns() - start;
+
+		pr_info("%zu byte copies: to user %llu MB/s, from user %llu MB/s\n",
+			sizes[i],
+			div64_u64(BENCH_COPY_BYTES * 1000ULL, to_ns ?: 1),
+			div64_u64(BENCH_COPY_BYTES * 1000ULL, from_ns ?: 1));
+		cond_resched();
+	}
+	if (left)
+		pr_warn("benchmark copy failed\n");
+
+	vm_munmap(user_addr, BENCH_COPY_SIZE);
+out_free:
+	vfree(kmem);
+}
+
 static int __init test_user_copy_init(void)
 {
 	int ret = 0;
@@ -92,6 +214,12 @@ static int __init test_user_copy_init(void)
 	ret |= test(memcmp(kmem, kmem + PAGE_SIZE, PAGE_SIZE),
 		    "legitimate usercopy failed to copy data");
 
+	/*
+	 * Large copies, at various alignments, as some architectures
+	 * switch to a different copy loop above a size threshold.
+	 */
+	ret |= test_large_copies();
+
 #define test_legit(size, check)						  \
 	do {								  \
 		val_##size = check;					  \
@@ -178,6 +306,9 @@ static int __init test_user_copy_init(void)
 	vm_munmap(user_addr, PAGE_SIZE * 2);
 	kfree(kmem);
 
+	if (bench)
+		bench_large_copies();
+
 	if (ret == 0) {
 		pr_info("tests passed.\n");
 		return 0;
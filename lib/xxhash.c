@@ -0,0 +1,94 @@
+/*
+ * xxHash, a fast non-cryptographic hash (64-bit variant)
+ *
+ * Copyright (C) 2017 - Linaro Ltd
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/bitops.h>
+#include <linux/xxhash.h>
+#include <asm/unaligned.h>
+
+#define PRIME64_1	11400714785074694791ULL
+#define PRIME64_2	14029467366897019727ULL
+#define PRIME64_3	1609587929392839161ULL
+#define PRIME64_4	9650029242287828579ULL
+#define PRIME64_5	2870177450012600261ULL
+
+static u64 xxh64_round(u64 acc, u64 input)
+{
+	acc += input * PRIME64_2;
+	acc = rol64(acc, 31);
+	return acc * PRIME64_1;
+}
+
+static u64 xxh64_merge_round(u64 acc, u64 val)
+{
+	acc ^= xxh64_round(0, val);
+	return acc * PRIME64_1 + PRIME64_4;
+}
+
+u64 xxh64(const void *input, size_t len, u64 seed)
+{
+	const u8 *p = input;
+	const u8 *end = p + len;
+	u64 h;
+
+	if (len >= 32) {
+		u64 v1 = seed + PRIME64_1 + PRIME64_2;
+		u64 v2 = seed + PRIME64_2;
+		u64 v3 = seed;
+		u64 v4 = seed - PRIME64_1;
+
+		do {
+			v1 = xxh64_round(v1, get_unaligned_le64(p));
+			v2 = xxh64_round(v2, get_unaligned_le64(p + 8));
+			v3 = xxh64_round(v3, get_unaligned_le64(p + 16));
+			v4 = xxh64_round(v4, get_unaligned_le64(p + 24));
+			p += 32;
+		} while (p + 32 <= end);
+
+		h = rol64(v1, 1) + rol64(v2, 7) + rol64(v3, 12) + rol64(v4, 18);
+		h = xxh64_merge_round(h, v1);
+		h = xxh64_merge_round(h, v2);
+		h = xxh64_merge_round(h, v3);
+		h = xxh64_merge_round(h, v4);
+	} else {
+		h = seed + PRIME64_5;
+	}
+
+	h += len;
+
+	for (; p + 8 <= end; p += 8) {
+		h ^= xxh64_round(0, get_unaligned_le64(p));
+		h = rol64(h, 27) * PRIME64_1 + PRIME64_4;
+	}
+
+	if (p + 4 <= end) {
+		h ^= (u64)get_unaligned_le32(p) * PRIME64_1;
+		h = rol64(h, 23) * PRIME64_2 + PRIME64_3;
+		p += 4;
+	}
+
+	for (; p < end; p++) {
+		h ^= *p * PRIME64_5;
+		h = rol64(h, 11) * PRIME64_1;
+	}
+
+	h ^= h >> 33;
+	h *= PRIME64_2;
+	h ^= h >> 29;
+	h *= PRIME64_3;
+	h ^= h >> 32;
+
+	return h;
+}
+EXPORT_SYMBOL(xxh64);
+
+MODULE_LICENSE("GPL v2");
+MODULE_DESCRIPTION("xxHash");
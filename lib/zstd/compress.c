@@ -0,0 +1,1228 @@
+/*
+ * Zstandard compressor
+ *
+ * Copyright (C) 2017 - Linaro Ltd
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/sort.h>
+#include <linux/string.h>
+#include <linux/zstd.h>
+#include <asm/unaligned.h>
+
+#include "zstd_internal.h"
+
+/*
+ * Matches are found with a hash chain over the whole input, which the
+ * levels search more or less deeply, and lazily at the higher levels.
+ * Each 128KB block then gets its literals Huffman coded and its sequences
+ * FSE coded, with the predefined or their own distribution, whichever is
+ * cheaper. A block that doesn't shrink is stored raw.
+ */
+
+/* Matches are at least this long, and at most this far */
+#define ZSTD_FIND_MIN		4
+#define ZSTD_WINDOW_LOG		23
+#define ZSTD_WINDOW_SIZE	(1U << ZSTD_WINDOW_LOG)
+
+#define ZSTD_MAX_SEQ		(ZSTD_BLOCK_MAX / ZSTD_FIND_MIN)
+
+/* Fewer literals aren't worth a Huffman table */
+#define ZSTD_HUF_MIN_LITERALS	64
+
+#define ZSTD_HASH_MIN_LOG	10
+
+struct zstd_level {
+	u8 hash_log;
+	u8 chain_log;		/* 0 to keep a single position per hash */
+	u8 lazy;		/* positions to look ahead for a better match */
+	u8 skip_log;		/* speed up in incompressible data */
+	u16 depth;		/* positions looked at per hash chain */
+};
+
+static const struct zstd_level zstd_levels[ZSTD_MAX_CLEVEL + 1] = {
+	[1] = { .hash_log = 14, .chain_log = 0,  .depth = 1,   .lazy = 0,
+		.skip_log = 5 },
+	[2] = { .hash_log = 15, .chain_log = 15, .depth = 2,   .lazy = 0,
+		.skip_log = 6 },
+	[3] = { .hash_log = 16, .chain_log = 16, .depth = 6,   .lazy = 0,
+		.skip_log = 7 },
+	[4] = { .hash_log = 16, .chain_log = 16, .depth = 8,   .lazy = 1,
+		.skip_log = 8 },
+	[5] = { .hash_log = 17, .chain_log = 17, .depth = 16,  .lazy = 1,
+		.skip_log = 8 },
+	[6] = { .hash_log = 17, .chain_log = 17, .depth = 32,  .lazy = 1,
+		.skip_log = 8 },
+	[7] = { .hash_log = 17, .chain_log = 17, .depth = 64,  .lazy = 2,
+		.skip_log = 8 },
+	[8] = { .hash_log = 17, .chain_log = 18, .depth = 128, .lazy = 2,
+		.skip_log = 8 },
+	[9] = { .hash_log = 18, .chain_log = 18, .depth = 256, .lazy = 2,
+		.skip_log = 8 },
+};
+
+struct zstd_seq {
+	u32 lit_len;
+	u32 match_len;
+	u32 off;		/* Offset_Value, 1 to 3 repeat an offset */
+};
+
+struct zstd_fse_ctable {
+	u16 state[1 << ZSTD_LL_MAX_LOG];
+	u32 delta_nb[ZSTD_FSE_MAX_SYMBOL + 1];
+	s32 delta_find[ZSTD_FSE_MAX_SYMBOL + 1];
+	unsigned int log;	/* 0 for a single symbol, coded in no bits */
+};
+
+struct zstd_cctx {
+	const struct zstd_level *level;
+	const u8 *src;
+	size_t src_len;
+	unsigned int hash_log, chain_log;
+	u32 *hash;
+	u32 *chain;
+	u32 next_insert;
+	u32 rep[3];
+
+	struct zstd_seq *seqs;
+	unsigned int nb_seq;
+	u8 *lits;
+	size_t nb_lits;
+	u8 *ll_codes, *of_codes, *ml_codes;
+
+	struct zstd_fse_ctable ll_table, of_table, ml_table;
+	u16 huf_code[ZSTD_HUF_MAX_SYMBOL + 1];
+	u8 huf_len[ZSTD_HUF_MAX_SYMBOL + 1];
+};
+
+/* Bitstream written forwards, the decoder reads it backwards */
+struct zstd_bitwr {
+	u64 acc;
+	unsigned int nb;
+	u8 *p, *end;
+	bool overflow;
+};
+
+static void bitwr_init(struct zstd_bitwr *bw, u8 *dst, size_t cap)
+{
+	bw->acc = 0;
+	bw->nb = 0;
+	bw->p = dst;
+	bw->end = dst + cap;
+	bw->overflow = false;
+}
+
+static void bitwr_flush(struct zstd_bitwr *bw)
+{
+	while (bw->nb >= 8) {
+		if (bw->p < bw->end)
+			*bw->p++ = bw->acc;
+		else
+			bw->overflow = true;
+		bw->acc >>= 8;
+		bw->nb -= 8;
+	}
+}
+
+/* @n is below 32 */
+static void bitwr_add(struct zstd_bitwr *bw, u32 v, unsigned int n)
+{
+	if (bw->nb + n >= 64)
+		bitwr_flush(bw);
+	bw->acc |= (u64)(v & ((1U << n) - 1)) << bw->nb;
+	bw->nb += n;
+}
+
+/* Adds the marker bit, returns the size of the stream */
+static int bitwr_close(struct zstd_bitwr *bw, u8 *start)
+{
+	bitwr_add(bw, 1, 1);
+	bitwr_flush(bw);
+	if (bw->nb) {
+		bw->nb = 8;
+		bitwr_flush(bw);
+	}
+
+	return bw->overflow ? -ENOSPC : bw->p - start;
+}
+
+static bool fse_build_ctable(struct zstd_fse_ctable *ct, const s16 *norm,
+			     unsigned int max_sym, unsigned int log)
+{
+	u8 symbols[1 << ZSTD_LL_MAX_LOG];
+	u16 cumul[ZSTD_FSE_MAX_SYMBOL + 2];
+	unsigned int size = 1U << log, u, s, total = 0;
+
+	if (!zstd_fse_spread(symbols, norm, max_sym, log))
+		return false;
+
+	cumul[0] = 0;
+	for (s = 0; s <= max_sym; s++)
+		cumul[s + 1] = cumul[s] + (norm[s] == -1 ? 1 : norm[s]);
+	for (u = 0; u < size; u++)
+		ct->state[cumul[symbols[u]]++] = size + u;
+
+	for (s = 0; s <= max_sym; s++) {
+		int n = norm[s];
+
+		if (!n)
+			continue;
+
+		if (n == -1 || n == 1) {
+			ct->delta_nb[s] = (log << 16) - size;
+			ct->delta_find[s] = total - 1;
+			total++;
+		} else {
+			unsigned int max_out = log - __fls(n - 1);
+
+			ct->delta_nb[s] = (max_out << 16) - (n << max_out);
+			ct->delta_find[s] = total - n;
+			total += n;
+		}
+	}
+
+	ct->log = log;
+	return true;
+}
+
+static u32 fse_init_state(const struct zstd_fse_ctable *ct, unsigned int s)
+{
+	u32 nb, value;
+
+	if (!ct->log)
+		return 0;
+
+	nb = (ct->delta_nb[s] + (1 << 15)) >> 16;
+	value = (nb << 16) - ct->delta_nb[s];
+	return ct->state[(value >> nb) + ct->delta_find[s]];
+}
+
+static void fse_encode(struct zstd_bitwr *bw, const struct zstd_fse_ctable *ct,
+		       u32 *state, unsigned int s)
+{
+	u32 nb;
+
+	if (!ct->log)
+		return;
+
+	nb = (*state + ct->delta_nb[s]) >> 16;
+	bitwr_add(bw, *state, nb);
+	*state = ct->state[(*state >> nb) + ct->delta_find[s]];
+}
+
+static void fse_flush(struct zstd_bitwr *bw, const struct zstd_fse_ctable *ct,
+		      u32 state)
+{
+	bitwr_add(bw, state, ct->log);
+}
+
+/* Bits taken by @codes, backwards as they are coded */
+static u32 fse_cost(const struct zstd_fse_ctable *ct, const u8 *codes,
+		    unsigned int nb)
+{
+	u32 state = fse_init_state(ct, codes[nb - 1]);
+	u32 bits = ct->log;
+	int i;
+
+	for (i = nb - 2; i >= 0; i--) {
+		u32 n = (state + ct->delta_nb[codes[i]]) >> 16;
+
+		bits += n;
+		state = ct->state[(state >> n) + ct->delta_find[codes[i]]];
+	}
+
+	return bits;
+}
+
+/*
+ * Scale @count to probabilities adding up to 1 << @log, none of them
+ * above @cap if it isn't 0.
+ */
+static void fse_normalize(s16 *norm, const u32 *count, unsigned int max_sym,
+			  u32 total, unsigned int log, int cap)
+{
+	int size = 1 << log, sum = 0, big = -1, s;
+
+	for (s = 0; s <= max_sym; s++) {
+		int n;
+
+		if (!count[s]) {
+			norm[s] = 0;
+			continue;
+		}
+
+		n = (((u64)count[s] << log) + total / 2) / total;
+		norm[s] = max(n, 1);
+		sum += norm[s];
+		if (big < 0 || norm[s] > norm[big])
+			big = s;
+	}
+
+	while (sum > size) {
+		int d = min(sum - size, norm[big] - 1);
+
+		norm[big] -= d;
+		sum -= d;
+		for (s = 0; s <= max_sym; s++)
+			if (norm[s] > norm[big])
+				big = s;
+	}
+	norm[big] += size - sum;
+
+	/* Give the excess away, one state to each other symbol in turn */
+	while (cap && norm[big] > cap) {
+		for (s = 0; s <= max_sym && norm[big] > cap; s++) {
+			if (s != big && norm[s]) {
+				norm[s]++;
+				norm[big]--;
+			}
+		}
+	}
+}
+
+/* The FSE_Table_Description of @norm, returns its size */
+static int fse_write_ncount(u8 *dst, size_t cap, const s16 *norm,
+			    unsigned int log)
+{
+	int remaining = (1 << log) + 1, threshold = 1 << log, count, max;
+	unsigned int nb_bits = log + 1, nb = 4, sym = 0, start;
+	u64 acc = log - ZSTD_FSE_MIN_LOG;
+	bool prev0 = false;
+	size_t pos = 0;
+
+#define NCOUNT_FLUSH()							\
+	do {								\
+		while (nb >= 8) {					\
+			if (pos >= cap)					\
+				return -ENOSPC;				\
+			dst[pos++] = acc;				\
+			acc >>= 8;					\
+			nb -= 8;					\
+		}							\
+	} while (0)
+
+	while (remaining > 1) {
+		if (prev0) {
+			start = sym;
+			while (!norm[sym])
+				sym++;
+			while (sym >= start + 24) {
+				start += 24;
+				acc |= 0xFFFFULL << nb;
+				nb += 16;
+				NCOUNT_FLUSH();
+			}
+			while (sym >= start + 3) {
+				start += 3;
+				acc |= 3ULL << nb;
+				nb += 2;
+			}
+			acc |= (u64)(sym - start) << nb;
+			nb += 2;
+			NCOUNT_FLUSH();
+		}
+
+		count = norm[sym++];
+		max = (2 * threshold - 1) - remaining;
+		remaining -= abs(count);
+		count++;
+		if (count >= threshold)
+			count += max;
+		acc |= (u64)count << nb;
+		nb += nb_bits - (count < max);
+		prev0 = count == 1;
+
+		while (remaining < threshold) {
+			nb_bits--;
+			threshold >>= 1;
+		}
+		NCOUNT_FLUSH();
+	}
+
+	if (nb) {
+		nb = 8;
+		NCOUNT_FLUSH();
+	}
+#undef NCOUNT_FLUSH
+
+	return pos;
+}
+
+struct zstd_huf_node {
+	u32 key;
+	u32 sym;
+};
+
+static int huf_node_cmp(const void *a, const void *b)
+{
+	const struct zstd_huf_node *x = a, *y = b;
+
+	if (x->key != y->key)
+		return x->key < y->key ? -1 : 1;
+	return x->sym < y->sym ? -1 : 1;
+}
+
+/*
+ * Huffman code lengths of at most ZSTD_HUF_MAX_LOG bits for the symbols
+ * of @count, at least two of them. Returns the longest.
+ */
+static unsigned int huf_build_lengths(const u32 *count, unsigned int max_sym,
+				      u8 *len)
+{
+	struct zstd_huf_node a[ZSTD_HUF_MAX_SYMBOL + 1];
+	unsigned int num[ZSTD_HUF_MAX_SYMBOL + 1] = { 0 };
+	int n = 0, root, leaf, next, avail, used, depth, i, longest = 0;
+	u32 total = 0;
+
+	for (i = 0; i <= max_sym; i++) {
+		len[i] = 0;
+		if (count[i]) {
+			a[n].key = count[i];
+			a[n].sym = i;
+			n++;
+		}
+	}
+	sort(a, n, sizeof(a[0]), huf_node_cmp, NULL);
+
+	/* Moffat and Katajainen, in place over the sorted counts */
+	a[0].key += a[1].key;
+	root = 0;
+	leaf = 2;
+	for (next = 1; next < n - 1; next++) {
+		if (leaf >= n || a[root].key < a[leaf].key) {
+			a[next].key = a[root].key;
+			a[root++].key = next;
+		} else {
+			a[next].key = a[leaf++].key;
+		}
+
+		if (leaf >= n || (root < next && a[root].key < a[leaf].key)) {
+			a[next].key += a[root].key;
+			a[root++].key = next;
+		} else {
+			a[next].key += a[leaf++].key;
+		}
+	}
+
+	a[n - 2].key = 0;
+	for (next = n - 3; next >= 0; next--)
+		a[next].key = a[a[next].key].key + 1;
+
+	avail = 1;
+	used = depth = 0;
+	root = n - 2;
+	next = n - 1;
+	while (avail > 0) {
+		while (root >= 0 && a[root].key == depth) {
+			used++;
+			root--;
+		}
+		while (avail > used) {
+			a[next--].key = depth;
+			avail--;
+		}
+		avail = 2 * used;
+		depth++;
+		used = 0;
+	}
+
+	/* Fold the lengths above the limit back into the Kraft sum */
+	for (i = 0; i < n; i++)
+		num[min_t(u32, a[i].key, ZSTD_HUF_MAX_LOG)]++;
+	for (i = ZSTD_HUF_MAX_LOG; i > 0; i--)
+		total += num[i] << (ZSTD_HUF_MAX_LOG - i);
+	while (total != 1U << ZSTD_HUF_MAX_LOG) {
+		num[ZSTD_HUF_MAX_LOG]--;
+		for (i = ZSTD_HUF_MAX_LOG - 1; i > 0; i--) {
+			if (num[i]) {
+				num[i]--;
+				num[i + 1] += 2;
+				break;
+			}
+		}
+		total--;
+	}
+
+	/* The most frequent symbols, at the end, get the shortest codes */
+	next = n - 1;
+	for (i = 1; i <= ZSTD_HUF_MAX_LOG; i++) {
+		for (; num[i]; num[i]--) {
+			len[a[next--].sym] = i;
+			longest = i;
+		}
+	}
+
+	return longest;
+}
+
+/* Header of raw or RLE literals, returns its size */
+static size_t lit_write_header(u8 *dst, unsigned int type, size_t n)
+{
+	u32 v;
+
+	if (n < 32) {
+		dst[0] = type | n << 3;
+		return 1;
+	}
+
+	if (n < 4096) {
+		put_unaligned_le16(type | 1 << 2 | n << 4, dst);
+		return 2;
+	}
+
+	v = type | 3 << 2 | n << 4;
+	dst[0] = v;
+	dst[1] = v >> 8;
+	dst[2] = v >> 16;
+	return 3;
+}
+
+static size_t lit_header_size(size_t n)
+{
+	return n < 32 ? 1 : n < 4096 ? 2 : 3;
+}
+
+/*
+ * Huffman tree description of the weights of all the symbols before
+ * @max_sym, returns its size.
+ */
+static int huf_write_weights(const u8 *len, unsigned int max_bits,
+			     unsigned int max_sym, u8 *dst, size_t cap)
+{
+	u8 w[ZSTD_HUF_MAX_SYMBOL + 1];
+	u32 count[ZSTD_HUF_MAX_LOG + 1] = { 0 };
+	s16 norm[ZSTD_HUF_MAX_LOG + 1];
+	struct zstd_fse_ctable ct;
+	unsigned int s, max_w = 0, distinct = 0;
+	struct zstd_bitwr bw;
+	u32 s1, s2;
+	int i, ret, size;
+
+	for (s = 0; s < max_sym; s++)
+		w[s] = len[s] ? max_bits + 1 - len[s] : 0;
+
+	if (max_sym <= 128) {
+		if (1 + DIV_ROUND_UP(max_sym, 2) > cap)
+			return -ENOSPC;
+		dst[0] = 127 + max_sym;
+		for (s = 0; s < max_sym; s += 2)
+			dst[1 + s / 2] = w[s] << 4 |
+					 (s + 1 < max_sym ? w[s + 1] : 0);
+		return 1 + DIV_ROUND_UP(max_sym, 2);
+	}
+
+	for (s = 0; s < max_sym; s++) {
+		if (!count[w[s]]++)
+			distinct++;
+		max_w = max_t(unsigned int, max_w, w[s]);
+	}
+	if (distinct < 2 || cap < 2)
+		return -ENOSPC;
+
+	/*
+	 * No weight gets more than half of the states, so that the last
+	 * state update of the decoder always reads past the stream, which is
+	 * how it knows that there are no more weights.
+	 */
+	fse_normalize(norm, count, max_w, max_sym, ZSTD_HUF_WEIGHTS_LOG,
+		      1 << (ZSTD_HUF_WEIGHTS_LOG - 1));
+	if (!fse_build_ctable(&ct, norm, max_w, ZSTD_HUF_WEIGHTS_LOG))
+		return -EINVAL;
+
+	ret = fse_write_ncount(dst + 1, cap - 1, norm, ZSTD_HUF_WEIGHTS_LOG);
+	if (ret < 0)
+		return ret;
+	bitwr_init(&bw, dst + 1 + ret, cap - 1 - ret);
+
+	/* The first state decodes the even weights, the second the odd ones */
+	i = max_sym - 1;
+	if (max_sym & 1) {
+		s1 = fse_init_state(&ct, w[i--]);
+		s2 = fse_init_state(&ct, w[i--]);
+		fse_encode(&bw, &ct, &s1, w[i--]);
+	} else {
+		s2 = fse_init_state(&ct, w[i--]);
+		s1 = fse_init_state(&ct, w[i--]);
+	}
+	for (; i > 0; i -= 2) {
+		fse_encode(&bw, &ct, &s2, w[i]);
+		fse_encode(&bw, &ct, &s1, w[i - 1]);
+	}
+	fse_flush(&bw, &ct, s2);
+	fse_flush(&bw, &ct, s1);
+
+	size = bitwr_close(&bw, dst + 1 + ret);
+	if (size < 0)
+		return size;
+	size += ret;
+	if (size >= 128)
+		return -ENOSPC;
+
+	dst[0] = size;
+	return 1 + size;
+}
+
+static int huf_encode_stream(const struct zstd_cctx *cc, const u8 *src,
+			     size_t n, u8 *dst, size_t cap)
+{
+	struct zstd_bitwr bw;
+
+	/* Backwards, the decoder gets the first literal first */
+	bitwr_init(&bw, dst, cap);
+	while (n--)
+		bitwr_add(&bw, cc->huf_code[src[n]], cc->huf_len[src[n]]);
+
+	return bitwr_close(&bw, dst);
+}
+
+static int huf_compress_literals(struct zstd_cctx *cc, const u32 *count,
+				 unsigned int max_sym, u8 *dst, size_t cap)
+{
+	unsigned int max_bits, w, s, format, hdr, bits;
+	const u8 *lits = cc->lits;
+	size_t n = cc->nb_lits, comp, seg, i;
+	u32 pos = 0;
+	u8 *body;
+	u64 v;
+	int ret;
+
+	/* Room for the largest header, the body is moved after it */
+	if (cap < 5 + 6)
+		return -ENOSPC;
+	body = dst + 5;
+	cap -= 5;
+
+	max_bits = huf_build_lengths(count, max_sym, cc->huf_len);
+
+	/* Canonical codes, in the order of the decoding table */
+	for (w = 1; w <= max_bits; w++) {
+		for (s = 0; s <= max_sym; s++) {
+			if (!cc->huf_len[s] ||
+			    max_bits + 1 - cc->huf_len[s] != w)
+				continue;
+			cc->huf_code[s] = pos >> (w - 1);
+			pos += 1U << (w - 1);
+		}
+	}
+
+	ret = huf_write_weights(cc->huf_len, max_bits, max_sym, body, cap);
+	if (ret < 0)
+		return ret;
+	comp = ret;
+
+	if (n < 256) {
+		ret = huf_encode_stream(cc, lits, n, body + comp, cap - comp);
+		if (ret < 0)
+			return ret;
+		comp += ret;
+		format = 0;
+	} else {
+		u8 *jump = body + comp;
+
+		if (cap - comp < 6)
+			return -ENOSPC;
+		comp += 6;
+
+		seg = DIV_ROUND_UP(n, 4);
+		for (i = 0; i < 4; i++) {
+			size_t len = i < 3 ? seg : n - 3 * seg;
+
+			ret = huf_encode_stream(cc, lits + i * seg, len,
+						body + comp, cap - comp);
+			if (ret < 0)
+				return ret;
+			if (i < 3) {
+				if (ret > U16_MAX)
+					return -ENOSPC;
+				put_unaligned_le16(ret, jump + i * 2);
+			}
+			comp += ret;
+		}
+		format = max(n, comp) < 1024 ? 1 : max(n, comp) < 16384 ? 2 : 3;
+	}
+
+	hdr = format < 2 ? 3 : format + 2;
+	bits = format < 2 ? 10 : format * 4 + 6;
+	v = ZSTD_LIT_COMPRESSED | format << 2 | (u64)n << 4 |
+	    (u64)comp << (4 + bits);
+	memmove(dst + hdr, body, comp);
+	for (i = 0; i < hdr; i++)
+		dst[i] = v >> (i * 8);
+
+	return hdr + comp;
+}
+
+static int compress_literals(struct zstd_cctx *cc, u8 *dst, size_t cap)
+{
+	u32 count[ZSTD_HUF_MAX_SYMBOL + 1] = { 0 };
+	unsigned int max_sym = 0, distinct = 0, s;
+	size_t n = cc->nb_lits, raw, i;
+	int ret;
+
+	for (i = 0; i < n; i++)
+		count[cc->lits[i]]++;
+	for (s = 0; s <= ZSTD_HUF_MAX_SYMBOL; s++) {
+		if (count[s]) {
+			max_sym = s;
+			distinct++;
+		}
+	}
+
+	raw = lit_header_size(n) + n;
+
+	if (distinct == 1 && n > 2) {
+		if (lit_header_size(n) + 1 > cap)
+			return -ENOSPC;
+		ret = lit_write_header(dst, ZSTD_LIT_RLE, n);
+		dst[ret] = cc->lits[0];
+		return ret + 1;
+	}
+
+	if (n >= ZSTD_HUF_MIN_LITERALS && distinct > 1) {
+		ret = huf_compress_literals(cc, count, max_sym, dst,
+					    min(cap, raw - 1));
+		if (ret > 0)
+			return ret;
+	}
+
+	if (raw > cap)
+		return -ENOSPC;
+	ret = lit_write_header(dst, ZSTD_LIT_RAW, n);
+	memcpy(dst + ret, cc->lits, n);
+	return raw;
+}
+
+static unsigned int zstd_ll_code(u32 ll)
+{
+	unsigned int code = 16;
+
+	if (ll < 16)
+		return ll;
+	if (ll >= 64)
+		return __fls(ll) + 19;
+
+	while (zstd_ll_base[code + 1] <= ll)
+		code++;
+	return code;
+}
+
+static unsigned int zstd_ml_code(u32 ml)
+{
+	unsigned int code = 32;
+
+	if (ml < 35)
+		return ml - ZSTD_MIN_MATCH;
+	if (ml >= 131)
+		return __fls(ml - ZSTD_MIN_MATCH) + 36;
+
+	while (zstd_ml_base[code + 1] <= ml)
+		code++;
+	return code;
+}
+
+/*
+ * Pick the cheapest way to code @codes, and write the table it needs.
+ * Returns the size of the table.
+ */
+static int seq_write_table(struct zstd_fse_ctable *ct, unsigned int *mode,
+			   const u8 *codes, unsigned int nb,
+			   const s16 *default_norm, unsigned int default_max,
+			   unsigned int default_log, unsigned int max_log,
+			   u8 *dst, size_t cap)
+{
+	u32 count[ZSTD_FSE_MAX_SYMBOL + 1] = { 0 };
+	s16 norm[ZSTD_FSE_MAX_SYMBOL + 1];
+	unsigned int max_sym = 0, distinct = 0, i;
+	u32 best = U32_MAX, cost;
+	int log, ret = 0;
+
+	for (i = 0; i < nb; i++)
+		count[codes[i]]++;
+	for (i = 0; i <= ZSTD_FSE_MAX_SYMBOL; i++) {
+		if (count[i]) {
+			max_sym = i;
+			distinct++;
+		}
+	}
+
+	if (max_sym <= default_max) {
+		fse_build_ctable(ct, default_norm, default_max, default_log);
+		best = fse_cost(ct, codes, nb);
+		*mode = ZSTD_SEQ_PREDEFINED;
+	}
+
+	if (distinct == 1) {
+		if (best <= 8)
+			return 0;
+		if (!cap)
+			return -ENOSPC;
+		dst[0] = codes[0];
+		ct->log = 0;
+		*mode = ZSTD_SEQ_RLE;
+		return 1;
+	}
+
+	/* The table size FSE_optimalTableLog() would pick */
+	log = min_t(int, max_log, (int)__fls(nb - 1) - 2);
+	log = max_t(int, log, min(__fls(nb) + 1, __fls(max_sym) + 2));
+	log = clamp_t(int, log, ZSTD_FSE_MIN_LOG, max_log);
+
+	fse_normalize(norm, count, max_sym, nb, log, 0);
+	ret = fse_write_ncount(dst, cap, norm, log);
+	if (ret >= 0 && fse_build_ctable(ct, norm, max_sym, log)) {
+		cost = fse_cost(ct, codes, nb) + ret * 8;
+		if (cost < best) {
+			*mode = ZSTD_SEQ_FSE;
+			return ret;
+		}
+	}
+
+	if (best == U32_MAX)
+		return -ENOSPC;
+
+	fse_build_ctable(ct, default_norm, default_max, default_log);
+	*mode = ZSTD_SEQ_PREDEFINED;
+	return 0;
+}
+
+static int compress_sequences(struct zstd_cctx *cc, u8 *dst, size_t cap)
+{
+	const struct zstd_seq *seqs = cc->seqs;
+	unsigned int nb = cc->nb_seq, mode, modes = 0;
+	u32 ll_s, of_s, ml_s;
+	struct zstd_bitwr bw;
+	size_t pos = 0, modes_pos;
+	int i, ret;
+
+	if (cap < 4)
+		return -ENOSPC;
+
+	if (nb < 128) {
+		dst[pos++] = nb;
+	} else if (nb < 0x7F00) {
+		dst[pos++] = (nb >> 8) + 128;
+		dst[pos++] = nb;
+	} else {
+		dst[pos++] = 255;
+		put_unaligned_le16(nb - 0x7F00, dst + pos);
+		pos += 2;
+	}
+	if (!nb)
+		return pos;
+
+	for (i = 0; i < nb; i++) {
+		cc->ll_codes[i] = zstd_ll_code(seqs[i].lit_len);
+		cc->of_codes[i] = __fls(seqs[i].off);
+		cc->ml_codes[i] = zstd_ml_code(seqs[i].match_len);
+	}
+
+	modes_pos = pos++;
+	ret = seq_write_table(&cc->ll_table, &mode, cc->ll_codes, nb,
+			      zstd_ll_default_norm, ZSTD_LL_MAX_SYMBOL,
+			      ZSTD_LL_DEFAULT_LOG, ZSTD_LL_MAX_LOG,
+			      dst + pos, cap - pos);
+	if (ret < 0)
+		return ret;
+	pos += ret;
+	modes |= mode << 6;
+
+	ret = seq_write_table(&cc->of_table, &mode, cc->of_codes, nb,
+			      zstd_of_default_norm, ZSTD_OF_DEFAULT_MAX,
+			      ZSTD_OF_DEFAULT_LOG, ZSTD_OF_MAX_LOG,
+			      dst + pos, cap - pos);
+	if (ret < 0)
+		return ret;
+	pos += ret;
+	modes |= mode << 4;
+
+	ret = seq_write_table(&cc->ml_table, &mode, cc->ml_codes, nb,
+			      zstd_ml_default_norm, ZSTD_ML_MAX_SYMBOL,
+			      ZSTD_ML_DEFAULT_LOG, ZSTD_ML_MAX_LOG,
+			      dst + pos, cap - pos);
+	if (ret < 0)
+		return ret;
+	pos += ret;
+	modes |= mode << 2;
+
+	dst[modes_pos] = modes;
+
+	/*
+	 * Last sequence first, so that the decoder starts with the first
+	 * one: the states and extra bits are read back in reverse order.
+	 */
+	bitwr_init(&bw, dst + pos, cap - pos);
+	i = nb - 1;
+	ml_s = fse_init_state(&cc->ml_table, cc->ml_codes[i]);
+	of_s = fse_init_state(&cc->of_table, cc->of_codes[i]);
+	ll_s = fse_init_state(&cc->ll_table, cc->ll_codes[i]);
+	for (;;) {
+		const struct zstd_seq *seq = &seqs[i];
+		unsigned int ll = cc->ll_codes[i], ml = cc->ml_codes[i];
+		unsigned int of = cc->of_codes[i];
+
+		bitwr_add(&bw, seq->lit_len - zstd_ll_base[ll],
+			  zstd_ll_bits[ll]);
+		bitwr_add(&bw, seq->match_len - zstd_ml_base[ml],
+			  zstd_ml_bits[ml]);
+		bitwr_add(&bw, seq->off - (1U << of), of);
+
+		if (!i--)
+			break;
+
+		fse_encode(&bw, &cc->of_table, &of_s, cc->of_codes[i]);
+		fse_encode(&bw, &cc->ml_table, &ml_s, cc->ml_codes[i]);
+		fse_encode(&bw, &cc->ll_table, &ll_s, cc->ll_codes[i]);
+	}
+	fse_flush(&bw, &cc->ml_table, ml_s);
+	fse_flush(&bw, &cc->of_table, of_s);
+	fse_flush(&bw, &cc->ll_table, ll_s);
+
+	ret = bitwr_close(&bw, dst + pos);
+	if (ret < 0)
+		return ret;
+
+	return pos + ret;
+}
+
+struct zstd_match {
+	u32 len;
+	u32 off;
+};
+
+static int zstd_gain(const struct zstd_match *m)
+{
+	return m->len * 4 - __fls(m->off);
+}
+
+static u32 zstd_hash(const u8 *p, unsigned int log)
+{
+	return (get_unaligned_le32(p) * 2654435761U) >> (32 - log);
+}
+
+static size_t zstd_count(const u8 *ip, const u8 *match, const u8 *end)
+{
+	const u8 *start = ip;
+
+	while (ip + 8 <= end) {
+		u64 diff = get_unaligned_le64(ip) ^ get_unaligned_le64(match);
+
+		if (diff)
+			return ip - start + (__ffs64(diff) >> 3);
+		ip += 8;
+		match += 8;
+	}
+
+	while (ip < end && *ip == *match) {
+		ip++;
+		match++;
+	}
+
+	return ip - start;
+}
+
+static void zstd_insert(struct zstd_cctx *cc, u32 pos)
+{
+	u32 h = zstd_hash(cc->src + pos, cc->hash_log);
+
+	if (cc->chain_log)
+		cc->chain[pos & ((1U << cc->chain_log) - 1)] = cc->hash[h];
+	cc->hash[h] = pos;
+}
+
+/*
+ * The best match at @pos that ends by @end, after @lit_len literals. The
+ * positions are looked up and inserted in increasing order.
+ */
+static void zstd_find(struct zstd_cctx *cc, u32 pos, u32 end, u32 lit_len,
+		      struct zstd_match *best)
+{
+	const u8 *ip = cc->src + pos, *iend = cc->src + end;
+	u32 chain_size = 1U << cc->chain_log;
+	unsigned int depth = cc->level->depth;
+	u32 rep, cand, len, next, limit;
+
+	best->len = 0;
+
+	/* What Offset_Value 1 means, depending on the literals before */
+	rep = cc->rep[lit_len ? 0 : 1];
+	if (rep <= pos) {
+		len = zstd_count(ip, ip - rep, iend);
+		if (len >= ZSTD_FIND_MIN) {
+			best->len = len;
+			best->off = 1;
+		}
+	}
+
+	if (cc->chain_log) {
+		while (cc->next_insert < pos)
+			zstd_insert(cc, cc->next_insert++);
+		cand = cc->hash[zstd_hash(ip, cc->hash_log)];
+		zstd_insert(cc, cc->next_insert++);
+	} else {
+		u32 h = zstd_hash(ip, cc->hash_log);
+
+		cand = cc->hash[h];
+		cc->hash[h] = pos;
+	}
+
+	limit = pos > ZSTD_WINDOW_SIZE ? pos - ZSTD_WINDOW_SIZE : 0;
+	while (depth-- && cand >= limit && cand < pos) {
+		const u8 *match = cc->src + cand;
+
+		/* Only a longer match is worth counting */
+		if (match[best->len] == ip[best->len] &&
+		    ip + best->len < iend) {
+			len = zstd_count(ip, match, iend);
+			if (len > best->len && len >= ZSTD_FIND_MIN) {
+				best->len = len;
+				best->off = pos - cand + 3;
+				if (ip + len == iend)
+					break;
+			}
+		}
+
+		if (!cc->chain_log || pos - cand >= chain_size)
+			break;
+		next = cc->chain[cand & (chain_size - 1)];
+		if (next >= cand)
+			break;
+		cand = next;
+	}
+}
+
+/* Store a sequence, and update the repeated offsets like the decoder */
+static void zstd_emit(struct zstd_cctx *cc, u32 anchor, u32 pos,
+		      const struct zstd_match *m)
+{
+	struct zstd_seq *seq = &cc->seqs[cc->nb_seq++];
+	u32 ll = pos - anchor;
+
+	memcpy(cc->lits + cc->nb_lits, cc->src + anchor, ll);
+	cc->nb_lits += ll;
+
+	seq->lit_len = ll;
+	seq->match_len = m->len;
+	seq->off = m->off;
+
+	if (m->off > 3) {
+		cc->rep[2] = cc->rep[1];
+		cc->rep[1] = cc->rep[0];
+		cc->rep[0] = m->off - 3;
+	} else if (!ll) {
+		swap(cc->rep[0], cc->rep[1]);
+	}
+}
+
+static void zstd_find_sequences(struct zstd_cctx *cc, u32 start, u32 end)
+{
+	const struct zstd_level *level = cc->level;
+	u32 pos = max(start, 1U), anchor = start;
+	struct zstd_match best, next;
+	unsigned int i;
+
+	cc->nb_seq = 0;
+	cc->nb_lits = 0;
+
+	while (pos + ZSTD_FIND_MIN <= end) {
+		zstd_find(cc, pos, end, pos - anchor, &best);
+		if (!best.len) {
+			pos += 1 + ((pos - anchor) >> level->skip_log);
+			continue;
+		}
+
+		for (i = 0; i < level->lazy; i++) {
+			if (pos + 1 + ZSTD_FIND_MIN > end)
+				break;
+			zstd_find(cc, pos + 1, end, pos + 1 - anchor, &next);
+			if (!next.len ||
+			    zstd_gain(&next) <= zstd_gain(&best) + 4)
+				break;
+			best = next;
+			pos++;
+		}
+
+		zstd_emit(cc, anchor, pos, &best);
+		pos += best.len;
+		anchor = pos;
+
+		/* Without chains, keep at least one position of the match */
+		if (!cc->chain_log && pos + ZSTD_FIND_MIN <= end)
+			zstd_insert(cc, pos - 2);
+	}
+
+	memcpy(cc->lits + cc->nb_lits, cc->src + anchor, end - anchor);
+	cc->nb_lits += end - anchor;
+}
+
+static int zstd_compress_block(struct zstd_cctx *cc, u8 *dst, size_t cap)
+{
+	int lit, seq;
+
+	lit = compress_literals(cc, dst, cap);
+	if (lit < 0)
+		return lit;
+
+	seq = compress_sequences(cc, dst + lit, cap - lit);
+	if (seq < 0)
+		return seq;
+
+	return lit + seq;
+}
+
+static size_t zstd_workspace(const struct zstd_level *level,
+			     unsigned int hash_log, unsigned int chain_log,
+			     struct zstd_cctx *cc)
+{
+	size_t size = sizeof(*cc);
+	u8 *p = (u8 *)(cc + 1);
+
+	if (cc) {
+		cc->hash = (u32 *)p;
+		cc->chain = (u32 *)(p + (sizeof(u32) << hash_log));
+	}
+	size += sizeof(u32) << hash_log;
+	if (chain_log)
+		size += sizeof(u32) << chain_log;
+
+	if (cc) {
+		cc->seqs = (struct zstd_seq *)((u8 *)cc + size);
+		cc->lits = (u8 *)(cc->seqs + ZSTD_MAX_SEQ);
+		cc->ll_codes = cc->lits + ZSTD_BLOCK_MAX;
+		cc->of_codes = cc->ll_codes + ZSTD_MAX_SEQ;
+		cc->ml_codes = cc->of_codes + ZSTD_MAX_SEQ;
+	}
+	size += ZSTD_MAX_SEQ * sizeof(struct zstd_seq) + ZSTD_BLOCK_MAX +
+		3 * ZSTD_MAX_SEQ;
+
+	return size;
+}
+
+/**
+ * zstd_compress_workspace_size - scratch memory for zstd_compress()
+ * @level:	Compression level, between ZSTD_MIN_CLEVEL and ZSTD_MAX_CLEVEL
+ *
+ * Returns 0 for a level that doesn't exist.
+ */
+size_t zstd_compress_workspace_size(int level)
+{
+	const struct zstd_level *l;
+
+	if (level < ZSTD_MIN_CLEVEL || level > ZSTD_MAX_CLEVEL)
+		return 0;
+
+	l = &zstd_levels[level];
+	return zstd_workspace(l, l->hash_log, l->chain_log, NULL);
+}
+EXPORT_SYMBOL(zstd_compress_workspace_size);
+
+/**
+ * zstd_compress - compress a buffer into a single Zstandard frame
+ * @src:	The data to compress
+ * @src_len:	Size of @src, below 4GB
+ * @dst:	Where to write the frame
+ * @dst_len:	The size of @dst, updated to the size of the frame. Up to
+ *		ZSTD_COMPRESS_BOUND(@src_len) bytes may be needed.
+ * @level:	Compression level, between ZSTD_MIN_CLEVEL and ZSTD_MAX_CLEVEL
+ * @wrkmem:	zstd_compress_workspace_size(@level) bytes of scratch memory
+ *
+ * Returns 0, or -ENOSPC if the frame doesn't fit in @dst.
+ */
+int zstd_compress(const void *src, size_t src_len, void *dst, size_t *dst_len,
+		  int level, void *wrkmem)
+{
+	struct zstd_cctx *cc = wrkmem;
+	const struct zstd_level *l;
+	unsigned int bits, fcs_flag, fcs_len, i;
+	size_t cap = *dst_len, out = 0, pos = 0;
+	bool single = src_len <= ZSTD_WINDOW_SIZE;
+	u8 *op = dst;
+
+	if (level < ZSTD_MIN_CLEVEL || level > ZSTD_MAX_CLEVEL ||
+	    src_len >= U32_MAX)
+		return -EINVAL;
+
+	/* No need for tables larger than the input */
+	l = &zstd_levels[level];
+	bits = src_len ? __fls(src_len) + 2 : 0;
+	cc->level = l;
+	cc->src = src;
+	cc->src_len = src_len;
+	cc->hash_log = clamp_t(unsigned int, bits, ZSTD_HASH_MIN_LOG,
+			       l->hash_log);
+	cc->chain_log = l->chain_log ?
+			clamp_t(unsigned int, bits, ZSTD_HASH_MIN_LOG,
+				l->chain_log) : 0;
+	zstd_workspace(l, cc->hash_log, cc->chain_log, cc);
+	memset(cc->hash, 0, sizeof(u32) << cc->hash_log);
+	cc->next_insert = 0;
+	cc->rep[0] = 1;
+	cc->rep[1] = 4;
+	cc->rep[2] = 8;
+
+	/* Frame header, with the content size */
+	if (src_len < 256 && single)
+		fcs_flag = 0;
+	else if (src_len < 65536 + 256)
+		fcs_flag = 1;
+	else
+		fcs_flag = 2;
+	fcs_len = fcs_flag ? 1 << fcs_flag : 1;
+
+	if (cap < 6 + fcs_len)
+		return -ENOSPC;
+	put_unaligned_le32(ZSTD_MAGIC, op);
+	op[4] = fcs_flag << 6 | single << 5;
+	out = 5;
+	if (!single)
+		op[out++] = (ZSTD_WINDOW_LOG - 10) << 3;
+	for (i = 0; i < fcs_len; i++)
+		op[out++] = (src_len - (fcs_flag == 1 ? 256 : 0)) >> (i * 8);
+
+	do {
+		size_t len = min_t(size_t, src_len - pos, ZSTD_BLOCK_MAX);
+		bool last = pos + len == src_len;
+		u32 rep[3], type;
+		int ret = -ENOSPC;
+
+		if (cap - out < ZSTD_BLOCK_HEADER_SIZE)
+			return -ENOSPC;
+
+		memcpy(rep, cc->rep, sizeof(rep));
+		if (len) {
+			zstd_find_sequences(cc, pos, pos + len);
+			ret = zstd_compress_block(cc, op + out + 3,
+					min(cap - out - 3, len - 1));
+		}
+
+		if (ret > 0) {
+			type = ZSTD_BLOCK_COMPRESSED;
+		} else {
+			/* The decoder won't see the sequences of this block */
+			memcpy(cc->rep, rep, sizeof(rep));
+			if (cap - out - 3 < len)
+				return -ENOSPC;
+			memcpy(op + out + 3, (const u8 *)src + pos, len);
+			type = ZSTD_BLOCK_RAW;
+			ret = len;
+		}
+
+		i = last | type << 1 | ret << 3;
+		op[out] = i;
+		op[out + 1] = i >> 8;
+		op[out + 2] = i >> 16;
+		out += 3 + ret;
+		pos += len;
+	} while (pos < src_len);
+
+	*dst_len = out;
+	return 0;
+}
+EXPORT_SYMBOL(zstd_compress);
+
+MODULE_LICENSE("GPL v2");
+MODULE_DESCRIPTION("Zstandard compressor");
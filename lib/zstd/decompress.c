@@ -0,0 +1,863 @@
+/*
+ * Zstandard decompressor
+ *
+ * Copyright (C) 2017 - Linaro Ltd
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/string.h>
+#include <linux/xxhash.h>
+#include <linux/zstd.h>
+#include <asm/unaligned.h>
+
+#include "zstd_internal.h"
+
+/*
+ * The whole output is in memory, so there is no window to keep: matches
+ * are copied from what was already decompressed. The workspace only has
+ * the entropy tables, which later blocks of a frame may repeat, and the
+ * literals of the current block.
+ */
+
+struct zstd_fse_entry {
+	u16 base;
+	u8 symbol;
+	u8 nb_bits;
+};
+
+struct zstd_huf_entry {
+	u8 symbol;
+	u8 nb_bits;
+};
+
+struct zstd_dctx {
+	struct zstd_fse_entry ll_table[1 << ZSTD_LL_MAX_LOG];
+	struct zstd_fse_entry of_table[1 << ZSTD_OF_MAX_LOG];
+	struct zstd_fse_entry ml_table[1 << ZSTD_ML_MAX_LOG];
+	struct zstd_huf_entry huf_table[1 << ZSTD_HUF_MAX_LOG];
+	unsigned int huf_log;
+	unsigned int ll_log, of_log, ml_log;
+	bool huf_valid;
+	bool ll_valid, of_valid, ml_valid;
+	u32 rep[3];
+	u8 literals[ZSTD_BLOCK_MAX];
+};
+
+/* A bitstream read backwards, from the marker bit of its last byte */
+struct zstd_bitrd {
+	const u8 *buf;
+	size_t len;
+	long pos;
+};
+
+static int bitrd_init(struct zstd_bitrd *br, const u8 *buf, size_t len)
+{
+	if (!len || !buf[len - 1])
+		return -EINVAL;
+
+	br->buf = buf;
+	br->len = len;
+	br->pos = (len - 1) * 8 + __fls(buf[len - 1]);
+	return 0;
+}
+
+/* Eight bytes at @off, zeroes past the end of @buf */
+static u64 zstd_load64(const u8 *buf, size_t len, size_t off)
+{
+	u64 w = 0;
+	int i;
+
+	if (off + 8 <= len)
+		return get_unaligned_le64(buf + off);
+
+	for (i = 0; off + i < len; i++)
+		w |= (u64)buf[off + i] << (i * 8);
+	return w;
+}
+
+/*
+ * The next @n (at most 32) bits, the first one read being the most
+ * significant. Bits before the start of the stream read as zeroes.
+ */
+static u32 bitrd_peek(const struct zstd_bitrd *br, unsigned int n)
+{
+	long lo = br->pos - n;
+	u64 w;
+
+	if (!n || br->pos <= 0)
+		return 0;
+
+	if (lo >= 0) {
+		w = zstd_load64(br->buf, br->len, lo >> 3) >> (lo & 7);
+		return w & ((1ULL << n) - 1);
+	}
+
+	w = zstd_load64(br->buf, br->len, 0) & ((1ULL << br->pos) - 1);
+	return w << -lo;
+}
+
+static u32 bitrd_read(struct zstd_bitrd *br, unsigned int n)
+{
+	u32 v = bitrd_peek(br, n);
+
+	br->pos -= n;
+	return v;
+}
+
+/*
+ * Read the FSE_Table_Description at @src into the @norm probabilities of
+ * up to *@max_sym + 1 symbols. Returns its size in bytes.
+ */
+static int fse_read_ncount(s16 *norm, unsigned int *max_sym,
+			   unsigned int *log, unsigned int max_log,
+			   const u8 *src, size_t len)
+{
+	unsigned int bitpos = 0, sym = 0, nb_bits, threshold;
+	int remaining, count, max, i;
+	u32 v;
+
+#define NCOUNT_PEEK(n)							\
+	((u32)(zstd_load64(src, len, bitpos >> 3) >> (bitpos & 7)) &	\
+	 ((1U << (n)) - 1))
+
+	if (!len)
+		return -EINVAL;
+
+	*log = NCOUNT_PEEK(4) + ZSTD_FSE_MIN_LOG;
+	bitpos += 4;
+	if (*log > max_log)
+		return -EINVAL;
+
+	remaining = (1 << *log) + 1;
+	threshold = 1 << *log;
+	nb_bits = *log + 1;
+
+	while (remaining > 1) {
+		if (sym > *max_sym)
+			return -EINVAL;
+
+		max = (2 * threshold - 1) - remaining;
+		v = NCOUNT_PEEK(nb_bits);
+		if ((v & (threshold - 1)) < max) {
+			count = v & (threshold - 1);
+			bitpos += nb_bits - 1;
+		} else {
+			count = v & (2 * threshold - 1);
+			if (count >= threshold)
+				count -= max;
+			bitpos += nb_bits;
+		}
+
+		count--;
+		remaining -= abs(count);
+		if (remaining < 1)
+			return -EINVAL;
+		norm[sym++] = count;
+
+		/* A zero probability is followed by a count of more zeroes */
+		if (!count) {
+			do {
+				v = NCOUNT_PEEK(2);
+				bitpos += 2;
+				for (i = 0; i < v; i++) {
+					if (sym > *max_sym)
+						return -EINVAL;
+					norm[sym++] = 0;
+				}
+			} while (v == 3 && bitpos <= len * 8);
+		}
+
+		while (remaining < threshold) {
+			nb_bits--;
+			threshold >>= 1;
+		}
+
+		if (bitpos > len * 8)
+			return -EINVAL;
+	}
+#undef NCOUNT_PEEK
+
+	if (remaining != 1)
+		return -EINVAL;
+
+	*max_sym = sym - 1;
+	return DIV_ROUND_UP(bitpos, 8);
+}
+
+static int fse_build_table(struct zstd_fse_entry *table, const s16 *norm,
+			   unsigned int max_sym, unsigned int log)
+{
+	u8 symbols[1 << ZSTD_LL_MAX_LOG];
+	u16 next[ZSTD_FSE_MAX_SYMBOL + 1];
+	unsigned int size = 1U << log, u, s;
+
+	if (!zstd_fse_spread(symbols, norm, max_sym, log))
+		return -EINVAL;
+
+	for (s = 0; s <= max_sym; s++)
+		next[s] = norm[s] == -1 ? 1 : norm[s];
+
+	for (u = 0; u < size; u++) {
+		unsigned int state = next[symbols[u]]++;
+		unsigned int nb_bits = log - __fls(state);
+
+		table[u].symbol = symbols[u];
+		table[u].nb_bits = nb_bits;
+		table[u].base = (state << nb_bits) - size;
+	}
+
+	return 0;
+}
+
+static int huf_build_table(struct zstd_dctx *dctx, u8 *weights,
+			   unsigned int nb_weights)
+{
+	unsigned int sum = 0, rest, max_bits, w, s, i, pos = 0;
+
+	for (s = 0; s < nb_weights; s++) {
+		if (weights[s] > ZSTD_HUF_MAX_LOG)
+			return -EINVAL;
+		if (weights[s])
+			sum += 1U << (weights[s] - 1);
+	}
+	if (!sum)
+		return -EINVAL;
+
+	/* The weight of the last symbol is what completes a power of two */
+	max_bits = __fls(sum) + 1;
+	if (max_bits > ZSTD_HUF_MAX_LOG)
+		return -EINVAL;
+	rest = (1U << max_bits) - sum;
+	if (rest & (rest - 1))
+		return -EINVAL;
+	weights[nb_weights++] = __fls(rest) + 1;
+
+	/* The longest prefixes come first in the table */
+	for (w = 1; w <= max_bits; w++) {
+		for (s = 0; s < nb_weights; s++) {
+			if (weights[s] != w)
+				continue;
+			for (i = 0; i < 1U << (w - 1); i++) {
+				dctx->huf_table[pos].symbol = s;
+				dctx->huf_table[pos].nb_bits = max_bits + 1 - w;
+				pos++;
+			}
+		}
+	}
+
+	dctx->huf_log = max_bits;
+	dctx->huf_valid = true;
+	return 0;
+}
+
+/* Huffman tree description, returns its size */
+static int huf_read_tree(struct zstd_dctx *dctx, const u8 *src, size_t len)
+{
+	u8 weights[ZSTD_HUF_MAX_SYMBOL + 1];
+	unsigned int nb = 0, header, i;
+	struct zstd_fse_entry table[1 << ZSTD_HUF_WEIGHTS_LOG];
+	struct zstd_bitrd br;
+	unsigned int max_sym = ZSTD_HUF_MAX_LOG, log, s1, s2;
+	s16 norm[ZSTD_HUF_MAX_LOG + 1];
+	int ret;
+
+	if (!len)
+		return -EINVAL;
+	header = src[0];
+
+	if (header >= 128) {
+		/* Direct representation, two weights per byte */
+		nb = header - 127;
+		if (1 + DIV_ROUND_UP(nb, 2) > len)
+			return -EINVAL;
+		for (i = 0; i < nb; i++)
+			weights[i] = i & 1 ? src[1 + i / 2] & 0xf :
+					     src[1 + i / 2] >> 4;
+		ret = huf_build_table(dctx, weights, nb);
+		return ret ? : 1 + DIV_ROUND_UP(nb, 2);
+	}
+
+	/* FSE compressed weights, with two states over one bitstream */
+	if (!header || 1 + header > len)
+		return -EINVAL;
+	src++;
+
+	ret = fse_read_ncount(norm, &max_sym, &log, ZSTD_HUF_WEIGHTS_LOG,
+			      src, header);
+	if (ret < 0)
+		return ret;
+	if (fse_build_table(table, norm, max_sym, log))
+		return -EINVAL;
+	if (bitrd_init(&br, src + ret, header - ret))
+		return -EINVAL;
+
+	s1 = bitrd_read(&br, log);
+	s2 = bitrd_read(&br, log);
+	for (;;) {
+		if (nb >= ZSTD_HUF_MAX_SYMBOL - 1)
+			return -EINVAL;
+
+		weights[nb++] = table[s1].symbol;
+		s1 = table[s1].base + bitrd_read(&br, table[s1].nb_bits);
+		if (br.pos < 0) {
+			weights[nb++] = table[s2].symbol;
+			break;
+		}
+
+		weights[nb++] = table[s2].symbol;
+		s2 = table[s2].base + bitrd_read(&br, table[s2].nb_bits);
+		if (br.pos < 0) {
+			weights[nb++] = table[s1].symbol;
+			break;
+		}
+	}
+
+	ret = huf_build_table(dctx, weights, nb);
+	return ret ? : 1 + header;
+}
+
+static int huf_decode_stream(struct zstd_dctx *dctx, u8 *out, size_t n,
+			     const u8 *src, size_t len)
+{
+	const struct zstd_huf_entry *table = dctx->huf_table;
+	unsigned int log = dctx->huf_log;
+	struct zstd_bitrd br;
+	size_t i;
+
+	if (bitrd_init(&br, src, len))
+		return -EINVAL;
+
+	for (i = 0; i < n; i++) {
+		const struct zstd_huf_entry *e = &table[bitrd_peek(&br, log)];
+
+		out[i] = e->symbol;
+		br.pos -= e->nb_bits;
+	}
+
+	return br.pos ? -EINVAL : 0;
+}
+
+/*
+ * Literals section of a compressed block, returns its size. *@lit points
+ * to the *@lit_len literals once decoded.
+ */
+static int decode_literals(struct zstd_dctx *dctx, const u8 *src, size_t len,
+			   const u8 **lit, size_t *lit_len)
+{
+	unsigned int type, format, hdr, bits, streams;
+	size_t regen, comp, size, seg, off;
+	u64 v = 0;
+	int ret, i;
+
+	if (!len)
+		return -EINVAL;
+	type = src[0] & 3;
+	format = (src[0] >> 2) & 3;
+
+	if (type == ZSTD_LIT_RAW || type == ZSTD_LIT_RLE) {
+		switch (format) {
+		case 1:
+			hdr = 2;
+			break;
+		case 3:
+			hdr = 3;
+			break;
+		default:
+			hdr = 1;
+		}
+		if (hdr > len)
+			return -EINVAL;
+		for (i = 0; i < hdr; i++)
+			v |= (u64)src[i] << (i * 8);
+		regen = hdr == 1 ? v >> 3 : v >> 4;
+
+		if (type == ZSTD_LIT_RAW) {
+			if (hdr + regen > len)
+				return -EINVAL;
+			*lit = src + hdr;
+			*lit_len = regen;
+			return hdr + regen;
+		}
+
+		if (hdr + 1 > len || regen > ZSTD_BLOCK_MAX)
+			return -EINVAL;
+		memset(dctx->literals, src[hdr], regen);
+		*lit = dctx->literals;
+		*lit_len = regen;
+		return hdr + 1;
+	}
+
+	hdr = format < 2 ? 3 : format + 2;
+	bits = format < 2 ? 10 : format * 4 + 6;
+	streams = format ? 4 : 1;
+	if (hdr > len)
+		return -EINVAL;
+	for (i = 0; i < hdr; i++)
+		v |= (u64)src[i] << (i * 8);
+	regen = (v >> 4) & ((1U << bits) - 1);
+	comp = (v >> (4 + bits)) & ((1U << bits) - 1);
+	if (regen > ZSTD_BLOCK_MAX || hdr + comp > len)
+		return -EINVAL;
+	src += hdr;
+	size = hdr + comp;
+
+	if (type == ZSTD_LIT_COMPRESSED) {
+		ret = huf_read_tree(dctx, src, comp);
+		if (ret < 0)
+			return ret;
+		src += ret;
+		comp -= ret;
+	} else if (!dctx->huf_valid) {
+		return -EINVAL;
+	}
+
+	if (streams == 1) {
+		ret = huf_decode_stream(dctx, dctx->literals, regen, src, comp);
+	} else {
+		size_t sizes[4];
+
+		seg = DIV_ROUND_UP(regen, 4);
+		if (comp < 6 || regen < 3 * seg)
+			return -EINVAL;
+		sizes[0] = get_unaligned_le16(src);
+		sizes[1] = get_unaligned_le16(src + 2);
+		sizes[2] = get_unaligned_le16(src + 4);
+		if (sizes[0] + sizes[1] + sizes[2] > comp - 6)
+			return -EINVAL;
+		sizes[3] = comp - 6 - sizes[0] - sizes[1] - sizes[2];
+
+		off = 6;
+		ret = 0;
+		for (i = 0; i < 4 && !ret; i++) {
+			size_t n = i < 3 ? seg : regen - 3 * seg;
+
+			ret = huf_decode_stream(dctx, dctx->literals + i * seg,
+						n, src + off, sizes[i]);
+			off += sizes[i];
+		}
+	}
+	if (ret)
+		return ret;
+
+	*lit = dctx->literals;
+	*lit_len = regen;
+	return size;
+}
+
+/* One of the three tables of the sequences section, returns its size */
+static int decode_seq_table(struct zstd_fse_entry *table, unsigned int *log,
+			    bool *valid, unsigned int mode,
+			    const s16 *default_norm,
+			    unsigned int default_max, unsigned int default_log,
+			    unsigned int max_sym, unsigned int max_log,
+			    const u8 *src, size_t len)
+{
+	s16 norm[ZSTD_FSE_MAX_SYMBOL + 1];
+	int ret;
+
+	switch (mode) {
+	case ZSTD_SEQ_PREDEFINED:
+		*log = default_log;
+		ret = fse_build_table(table, default_norm, default_max,
+				      default_log);
+		break;
+	case ZSTD_SEQ_RLE:
+		if (!len || src[0] > max_sym)
+			return -EINVAL;
+		table[0].symbol = src[0];
+		table[0].nb_bits = 0;
+		table[0].base = 0;
+		*log = 0;
+		ret = 1;
+		break;
+	case ZSTD_SEQ_FSE:
+		ret = fse_read_ncount(norm, &max_sym, log, max_log, src, len);
+		if (ret >= 0 && fse_build_table(table, norm, max_sym, *log))
+			ret = -EINVAL;
+		break;
+	default:
+		return *valid ? 0 : -EINVAL;
+	}
+
+	*valid = ret >= 0;
+	return ret;
+}
+
+static void copy_match(u8 *op, size_t offset, size_t len)
+{
+	const u8 *match = op - offset;
+
+	if (offset >= len) {
+		memcpy(op, match, len);
+		return;
+	}
+
+	/* Overlapping, each byte may come from the ones just written */
+	while (len--)
+		*op++ = *match++;
+}
+
+/*
+ * Execute the sequences section of a compressed block at @src, with the
+ * @lit literals. Returns the number of bytes written at @op, which is
+ * followed by @cap bytes of room and preceded by @hist decompressed bytes
+ * of the frame.
+ */
+static long decode_sequences(struct zstd_dctx *dctx, const u8 *src,
+			     size_t len, const u8 *lit, size_t lit_len,
+			     u8 *op, size_t cap, size_t hist)
+{
+	const struct zstd_fse_entry *ll_e, *of_e, *ml_e;
+	unsigned int nb_seq, modes, ll_s, of_s, ml_s;
+	const u8 *lit_end = lit + lit_len;
+	u8 *start = op, *end = op + cap;
+	struct zstd_bitrd br;
+	size_t pos = 0;
+	int ret;
+
+	if (!len)
+		return -EINVAL;
+
+	nb_seq = src[pos++];
+	if (nb_seq >= 128) {
+		if (pos >= len)
+			return -EINVAL;
+		if (nb_seq < 255) {
+			nb_seq = ((nb_seq - 128) << 8) + src[pos++];
+		} else {
+			if (pos + 2 > len)
+				return -EINVAL;
+			nb_seq = get_unaligned_le16(src + pos) + 0x7F00;
+			pos += 2;
+		}
+	}
+
+	if (!nb_seq) {
+		if (pos != len || lit_len > cap)
+			return -EINVAL;
+		memcpy(op, lit, lit_len);
+		return lit_len;
+	}
+
+	if (pos >= len)
+		return -EINVAL;
+	modes = src[pos++];
+	if (modes & 3)
+		return -EINVAL;
+
+	ret = decode_seq_table(dctx->ll_table, &dctx->ll_log,
+			       &dctx->ll_valid, modes >> 6,
+			       zstd_ll_default_norm, ZSTD_LL_MAX_SYMBOL,
+			       ZSTD_LL_DEFAULT_LOG, ZSTD_LL_MAX_SYMBOL,
+			       ZSTD_LL_MAX_LOG, src + pos, len - pos);
+	if (ret < 0)
+		return ret;
+	pos += ret;
+
+	ret = decode_seq_table(dctx->of_table, &dctx->of_log,
+			       &dctx->of_valid, (modes >> 4) & 3,
+			       zstd_of_default_norm,
+			       ZSTD_OF_DEFAULT_MAX, ZSTD_OF_DEFAULT_LOG,
+			       ZSTD_OF_MAX_SYMBOL, ZSTD_OF_MAX_LOG,
+			       src + pos, len - pos);
+	if (ret < 0)
+		return ret;
+	pos += ret;
+
+	ret = decode_seq_table(dctx->ml_table, &dctx->ml_log,
+			       &dctx->ml_valid, (modes >> 2) & 3,
+			       zstd_ml_default_norm,
+			       ZSTD_ML_MAX_SYMBOL, ZSTD_ML_DEFAULT_LOG,
+			       ZSTD_ML_MAX_SYMBOL, ZSTD_ML_MAX_LOG,
+			       src + pos, len - pos);
+	if (ret < 0)
+		return ret;
+	pos += ret;
+
+	if (bitrd_init(&br, src + pos, len - pos))
+		return -EINVAL;
+
+	ll_s = bitrd_read(&br, dctx->ll_log);
+	of_s = bitrd_read(&br, dctx->of_log);
+	ml_s = bitrd_read(&br, dctx->ml_log);
+
+	while (nb_seq--) {
+		u32 ll, ml, off, of_code;
+
+		ll_e = &dctx->ll_table[ll_s];
+		of_e = &dctx->of_table[of_s];
+		ml_e = &dctx->ml_table[ml_s];
+
+		of_code = of_e->symbol;
+		off = (1U << of_code) + bitrd_read(&br, of_code);
+		ml = zstd_ml_base[ml_e->symbol] +
+		     bitrd_read(&br, zstd_ml_bits[ml_e->symbol]);
+		ll = zstd_ll_base[ll_e->symbol] +
+		     bitrd_read(&br, zstd_ll_bits[ll_e->symbol]);
+
+		/* Offsets 1 to 3 repeat the recent ones */
+		if (off > 3) {
+			off -= 3;
+			dctx->rep[2] = dctx->rep[1];
+			dctx->rep[1] = dctx->rep[0];
+			dctx->rep[0] = off;
+		} else {
+			unsigned int idx = off - 1 + !ll;
+
+			if (idx) {
+				off = idx == 3 ? dctx->rep[0] - 1 :
+						 dctx->rep[idx];
+				if (idx != 1)
+					dctx->rep[2] = dctx->rep[1];
+				dctx->rep[1] = dctx->rep[0];
+				dctx->rep[0] = off;
+			} else {
+				off = dctx->rep[0];
+			}
+		}
+
+		if (nb_seq) {
+			ll_s = ll_e->base + bitrd_read(&br, ll_e->nb_bits);
+			ml_s = ml_e->base + bitrd_read(&br, ml_e->nb_bits);
+			of_s = of_e->base + bitrd_read(&br, of_e->nb_bits);
+		}
+
+		if (br.pos < 0 || ll > lit_end - lit || ll + ml > end - op ||
+		    !off || off > hist + (op - start) + ll)
+			return -EINVAL;
+
+		memcpy(op, lit, ll);
+		op += ll;
+		lit += ll;
+		copy_match(op, off, ml);
+		op += ml;
+	}
+
+	if (br.pos || lit_end - lit > end - op)
+		return -EINVAL;
+
+	memcpy(op, lit, lit_end - lit);
+	op += lit_end - lit;
+
+	return op - start;
+}
+
+static long decode_block(struct zstd_dctx *dctx, const u8 *src, size_t len,
+			 u8 *op, size_t cap, size_t hist)
+{
+	const u8 *lit;
+	size_t lit_len;
+	int ret;
+
+	ret = decode_literals(dctx, src, len, &lit, &lit_len);
+	if (ret < 0)
+		return ret;
+
+	return decode_sequences(dctx, src + ret, len - ret, lit, lit_len,
+				op, cap, hist);
+}
+
+/* One frame at @src, returns its size and adds its content to *@out */
+static long decode_frame(struct zstd_dctx *dctx, const u8 *src, size_t len,
+			 u8 *dst, size_t dst_len, size_t *out)
+{
+	static const u8 did_size[4] = { 0, 1, 2, 4 };
+	unsigned int fhd, fcs_flag, single, did_flag, fcs_len, last;
+	u64 fcs = 0, did = 0;
+	size_t pos = 5, start = *out;
+	long ret;
+	int i;
+
+	if (len < 5)
+		return -EINVAL;
+
+	fhd = src[4];
+	fcs_flag = fhd >> 6;
+	single = (fhd >> 5) & 1;
+	did_flag = fhd & 3;
+	if (fhd & 0x08)
+		return -EINVAL;
+
+	/* The window doesn't matter with the whole output in memory */
+	if (!single)
+		pos++;
+
+	fcs_len = fcs_flag ? 1 << fcs_flag : single;
+	if (pos + did_size[did_flag] + fcs_len > len)
+		return -EINVAL;
+
+	for (i = 0; i < did_size[did_flag]; i++)
+		did |= (u64)src[pos++] << (i * 8);
+	if (did)
+		return -EOPNOTSUPP;
+
+	for (i = 0; i < fcs_len; i++)
+		fcs |= (u64)src[pos++] << (i * 8);
+	if (fcs_len == 2)
+		fcs += 256;
+	if (fcs_len && fcs > dst_len - start)
+		return -ENOSPC;
+
+	dctx->huf_valid = false;
+	dctx->ll_valid = dctx->of_valid = dctx->ml_valid = false;
+	dctx->rep[0] = 1;
+	dctx->rep[1] = 4;
+	dctx->rep[2] = 8;
+
+	do {
+		u32 bh, size, type;
+
+		if (pos + ZSTD_BLOCK_HEADER_SIZE > len)
+			return -EINVAL;
+		bh = src[pos] | src[pos + 1] << 8 | src[pos + 2] << 16;
+		pos += ZSTD_BLOCK_HEADER_SIZE;
+
+		last = bh & 1;
+		type = (bh >> 1) & 3;
+		size = bh >> 3;
+		if (size > ZSTD_BLOCK_MAX)
+			return -EINVAL;
+
+		switch (type) {
+		case ZSTD_BLOCK_RAW:
+			if (pos + size > len)
+				return -EINVAL;
+			if (size > dst_len - *out)
+				return -ENOSPC;
+			memcpy(dst + *out, src + pos, size);
+			ret = size;
+			pos += size;
+			break;
+		case ZSTD_BLOCK_RLE:
+			if (pos + 1 > len)
+				return -EINVAL;
+			if (size > dst_len - *out)
+				return -ENOSPC;
+			memset(dst + *out, src[pos], size);
+			ret = size;
+			pos++;
+			break;
+		case ZSTD_BLOCK_COMPRESSED:
+			if (pos + size > len)
+				return -EINVAL;
+			ret = decode_block(dctx, src + pos, size, dst + *out,
+					   dst_len - *out, *out - start);
+			if (ret < 0)
+				return ret;
+			pos += size;
+			break;
+		default:
+			return -EINVAL;
+		}
+
+		*out += ret;
+	} while (!last);
+
+	if (fcs_len && *out - start != fcs)
+		return -EINVAL;
+
+	if (fhd & 0x04) {
+		if (pos + 4 > len)
+			return -EINVAL;
+		if (get_unaligned_le32(src + pos) !=
+		    (u32)xxh64(dst + start, *out - start, 0))
+			return -EINVAL;
+		pos += 4;
+	}
+
+	return pos;
+}
+
+size_t zstd_decompress_workspace_size(void)
+{
+	return sizeof(struct zstd_dctx);
+}
+EXPORT_SYMBOL(zstd_decompress_workspace_size);
+
+/**
+ * zstd_decompress - decompress a buffer of Zstandard frames
+ * @src:	The frames, and the skippable frames to ignore
+ * @src_len:	Size of @src
+ * @dst:	Where to write the content of the frames
+ * @dst_len:	The size of @dst, updated to the size of the content
+ * @wrkmem:	zstd_decompress_workspace_size() bytes of scratch memory
+ *
+ * Returns 0, -ENOSPC if @dst is too small, -EOPNOTSUPP for a frame that
+ * needs a dictionary and -EINVAL if @src is corrupted.
+ */
+int zstd_decompress(const void *src, size_t src_len, void *dst,
+		    size_t *dst_len, void *wrkmem)
+{
+	const u8 *ip = src;
+	size_t out = 0;
+	long ret;
+
+	if (!src_len)
+		return -EINVAL;
+
+	while (src_len) {
+		u32 magic;
+
+		if (src_len < 4)
+			return -EINVAL;
+		magic = get_unaligned_le32(ip);
+
+		if ((magic & ZSTD_SKIPPABLE_MASK) == ZSTD_SKIPPABLE_MAGIC) {
+			if (src_len < 8 ||
+			    get_unaligned_le32(ip + 4) > src_len - 8)
+				return -EINVAL;
+			ret = 8 + get_unaligned_le32(ip + 4);
+		} else if (magic == ZSTD_MAGIC) {
+			ret = decode_frame(wrkmem, ip, src_len, dst, *dst_len,
+					   &out);
+			if (ret < 0)
+				return ret;
+		} else {
+			return -EINVAL;
+		}
+
+		ip += ret;
+		src_len -= ret;
+	}
+
+	*dst_len = out;
+	return 0;
+}
+EXPORT_SYMBOL(zstd_decompress);
+
+/**
+ * zstd_decompress_frame - decompress the Zstandard frame a buffer starts with
+ * @src:	The frame, possibly followed by unrelated data like padding
+ * @src_len:	Size of @src, updated to the size of the frame
+ * @dst:	Where to write the content of the frame
+ * @dst_len:	The size of @dst, updated to the size of the content
+ * @wrkmem:	zstd_decompress_workspace_size() bytes of scratch memory
+ *
+ * Returns the same errors as zstd_decompress().
+ */
+int zstd_decompress_frame(const void *src, size_t *src_len, void *dst,
+			  size_t *dst_len, void *wrkmem)
+{
+	size_t out = 0;
+	long ret;
+
+	if (*src_len < 4 || get_unaligned_le32(src) != ZSTD_MAGIC)
+		return -EINVAL;
+
+	ret = decode_frame(wrkmem, src, *src_len, dst, *dst_len, &out);
+	if (ret < 0)
+		return ret;
+
+	*src_len = ret;
+	*dst_len = out;
+	return 0;
+}
+EXPORT_SYMBOL(zstd_decompress_frame);
+
+MODULE_LICENSE("GPL v2");
+MODULE_DESCRIPTION("Zstandard decompressor");
@@ -0,0 +1,146 @@
+/*
+ * Zstandard format definitions shared by the compressor and decompressor
+ *
+ * Copyright (C) 2017 - Linaro Ltd
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef __LIB_ZSTD_INTERNAL_H
+#define __LIB_ZSTD_INTERNAL_H
+
+#include <linux/types.h>
+#include <linux/bitops.h>
+
+#define ZSTD_MAGIC		0xFD2FB528U
+#define ZSTD_SKIPPABLE_MAGIC	0x184D2A50U
+#define ZSTD_SKIPPABLE_MASK	0xFFFFFFF0U
+
+#define ZSTD_BLOCK_MAX		(128 * 1024)
+#define ZSTD_BLOCK_HEADER_SIZE	3
+
+enum {
+	ZSTD_BLOCK_RAW,
+	ZSTD_BLOCK_RLE,
+	ZSTD_BLOCK_COMPRESSED,
+	ZSTD_BLOCK_RESERVED,
+};
+
+/* Literals_Block_Type */
+enum {
+	ZSTD_LIT_RAW,
+	ZSTD_LIT_RLE,
+	ZSTD_LIT_COMPRESSED,
+	ZSTD_LIT_TREELESS,
+};
+
+/* Symbol compression modes of the sequences section */
+enum {
+	ZSTD_SEQ_PREDEFINED,
+	ZSTD_SEQ_RLE,
+	ZSTD_SEQ_FSE,
+	ZSTD_SEQ_REPEAT,
+};
+
+#define ZSTD_HUF_MAX_LOG	11
+#define ZSTD_HUF_MAX_SYMBOL	255
+#define ZSTD_HUF_WEIGHTS_LOG	6
+
+#define ZSTD_FSE_MIN_LOG	5
+#define ZSTD_FSE_MAX_SYMBOL	52
+
+#define ZSTD_LL_MAX_SYMBOL	35
+#define ZSTD_ML_MAX_SYMBOL	52
+#define ZSTD_OF_MAX_SYMBOL	31
+#define ZSTD_LL_MAX_LOG		9
+#define ZSTD_ML_MAX_LOG		9
+#define ZSTD_OF_MAX_LOG		8
+
+#define ZSTD_LL_DEFAULT_LOG	6
+#define ZSTD_ML_DEFAULT_LOG	6
+#define ZSTD_OF_DEFAULT_LOG	5
+#define ZSTD_OF_DEFAULT_MAX	28
+
+#define ZSTD_MIN_MATCH		3
+
+static const u32 zstd_ll_base[ZSTD_LL_MAX_SYMBOL + 1] = {
+	0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+	16, 18, 20, 22, 24, 28, 32, 40, 48, 64, 128, 256, 512,
+	1024, 2048, 4096, 8192, 16384, 32768, 65536,
+};
+
+static const u8 zstd_ll_bits[ZSTD_LL_MAX_SYMBOL + 1] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	1, 1, 1, 1, 2, 2, 3, 3, 4, 6, 7, 8, 9,
+	10, 11, 12, 13, 14, 15, 16,
+};
+
+static const u32 zstd_ml_base[ZSTD_ML_MAX_SYMBOL + 1] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18,
+	19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34,
+	35, 37, 39, 41, 43, 47, 51, 59, 67, 83, 99, 131, 259, 515,
+	1027, 2051, 4099, 8195, 16387, 32771, 65539,
+};
+
+static const u8 zstd_ml_bits[ZSTD_ML_MAX_SYMBOL + 1] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	1, 1, 1, 1, 2, 2, 3, 3, 4, 4, 5, 7, 8, 9,
+	10, 11, 12, 13, 14, 15, 16,
+};
+
+/* The predefined distributions, -1 is a probability "less than 1" */
+static const s16 zstd_ll_default_norm[ZSTD_LL_MAX_SYMBOL + 1] = {
+	4, 3, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1,
+	2, 2, 2, 2, 2, 2, 2, 2, 2, 3, 2, 1, 1, 1, 1, 1,
+	-1, -1, -1, -1,
+};
+
+static const s16 zstd_ml_default_norm[ZSTD_ML_MAX_SYMBOL + 1] = {
+	1, 4, 3, 2, 2, 2, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, -1, -1,
+	-1, -1, -1, -1, -1,
+};
+
+static const s16 zstd_of_default_norm[ZSTD_OF_DEFAULT_MAX + 1] = {
+	1, 1, 1, 1, 1, 1, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, -1, -1, -1, -1, -1,
+};
+
+/*
+ * Lay out the symbols of a FSE table of 1 << @log states with the @norm
+ * probabilities, the same way for encoding and decoding. Returns false if
+ * @norm doesn't fill the table exactly.
+ */
+static inline bool zstd_fse_spread(u8 *symbols, const s16 *norm,
+				  unsigned int max_sym, unsigned int log)
+{
+	unsigned int size = 1U << log, mask = size - 1;
+	unsigned int step = (size >> 1) + (size >> 3) + 3;
+	unsigned int high = size - 1, pos = 0, s;
+	int i;
+
+	for (s = 0; s <= max_sym; s++) {
+		if (norm[s] != -1)
+			continue;
+		if (!high)
+			return false;
+		symbols[high--] = s;
+	}
+
+	for (s = 0; s <= max_sym; s++) {
+		for (i = 0; i < norm[s]; i++) {
+			symbols[pos] = s;
+			do {
+				pos = (pos + step) & mask;
+			} while (pos > high);
+		}
+	}
+
+	return !pos;
+}
+
+#endif /* __LIB_ZSTD_INTERNAL_H */
@@ -82,6 +82,9 @@ static struct page *follow_page_pte(struct vm_area_struct *vma,
 retry:
 	if (unlikely(pmd_bad(*pmd)))
 		return no_page_table(vma, flags);
+	/* Let the fault give us our own copy of the table */
+	if ((flags & FOLL_WRITE) && pmd_shared_table(*pmd))
+		return NULL;
 
 	ptep = pte_offset_map_lock(mm, pmd, address, &ptl);
 	pte = *ptep;
@@ -1496,6 +1499,9 @@ static int gup_pmd_range(pud_t pud, unsigned long addr, unsigned long end,
 			if (!gup_huge_pd(__hugepd(pmd_val(pmd)), addr,
 					 PMD_SHIFT, next, write, pages, nr))
 				return 0;
+		} else if (write && pmd_shared_table(pmd)) {
+			/* The table has to be unshared first */
+			return 0;
 		} else if (!gup_pte_range(pmd, addr, next, write, pages, nr))
 				return 0;
 	} while (pmdp++, addr = next, addr != end);
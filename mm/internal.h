@@ -168,6 +168,20 @@ extern void post_alloc_hook(struct page *page, unsigned int order,
 					gfp_t gfp_flags);
 extern int user_min_free_kbytes;
 
+#ifdef CONFIG_PAGE_PREZERO
+extern struct page *isolate_unzeroed_page(struct zone *zone,
+					  unsigned int order);
+extern void putback_zeroed_page(struct page *page, unsigned int order);
+#endif
+
+#ifdef CONFIG_PAGE_REPORTING
+extern struct page *isolate_unreported_page(struct zone *zone,
+					    unsigned int order,
+					    int migratetype);
+extern void putback_reported_page(struct page *page, unsigned int order,
+				  bool reported);
+#endif
+
 #if defined CONFIG_COMPACTION || defined CONFIG_CMA
 
 /*
@@ -283,6 +297,12 @@ static inline bool is_data_mapping(vm_flags_t flags)
 void __vma_link_list(struct mm_struct *mm, struct vm_area_struct *vma,
 		struct vm_area_struct *prev, struct rb_node *rb_parent);
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+/* mm/mmap.c */
+extern struct vm_area_struct *find_vma_rcu(struct mm_struct *mm,
+					   unsigned long addr);
+#endif
+
 #ifdef CONFIG_MMU
 extern long populate_vma_page_range(struct vm_area_struct *vma,
 		unsigned long start, unsigned long end, int *nonblocking);
@@ -105,6 +105,22 @@ static struct khugepaged_scan khugepaged_scan = {
 	.mm_head = LIST_HEAD_INIT(khugepaged_scan.mm_head),
 };
 
+/**
+ * struct collapse_control - state of a collapse, from khugepaged or madvise
+ * @is_khugepaged: apply the khugepaged sysfs settings, otherwise collapse
+ *		   whatever can be
+ * @node_load: number of pages scanned from each node, for the allocation
+ *	       of the huge page
+ */
+struct collapse_control {
+	bool is_khugepaged;
+	int node_load[MAX_NUMNODES];
+};
+
+static struct collapse_control khugepaged_collapse_control = {
+	.is_khugepaged = true,
+};
+
 #ifdef CONFIG_SYSFS
 static ssize_t scan_sleep_millisecs_show(struct kobject *kobj,
 					 struct kobj_attribute *attr,
@@ -499,7 +515,8 @@ static void release_pte_pages(pte_t *pte, pte_t *_pte)
 
 static int __collapse_huge_page_isolate(struct vm_area_struct *vma,
 					unsigned long address,
-					pte_t *pte)
+					pte_t *pte,
+					struct collapse_control *cc)
 {
 	struct page *page = NULL;
 	pte_t *_pte;
@@ -511,8 +528,10 @@ static int __collapse_huge_page_isolate(struct vm_area_struct *vma,
 		pte_t pteval = *_pte;
 		if (pte_none(pteval) || (pte_present(pteval) &&
 				is_zero_pfn(pte_pfn(pteval)))) {
+			++none_or_zero;
 			if (!userfaultfd_armed(vma) &&
-			    ++none_or_zero <= khugepaged_max_ptes_none) {
+			    (!cc->is_khugepaged ||
+			     none_or_zero <= khugepaged_max_ptes_none)) {
 				continue;
 			} else {
 				result = SCAN_EXCEED_NONE_PTE;
@@ -589,7 +608,7 @@ static int __collapse_huge_page_isolate(struct vm_area_struct *vma,
 			referenced++;
 	}
 	if (likely(writable)) {
-		if (likely(referenced)) {
+		if (likely(referenced || !cc->is_khugepaged)) {
 			result = SCAN_SUCCEED;
 			trace_mm_collapse_huge_page_isolate(page, none_or_zero,
 							    referenced, writable, result);
@@ -666,9 +685,7 @@ static void khugepaged_alloc_sleep(void)
 	remove_wait_queue(&khugepaged_wait, &wait);
 }
 
-static int khugepaged_node_load[MAX_NUMNODES];
-
-static bool khugepaged_scan_abort(int nid)
+static bool khugepaged_scan_abort(int nid, struct collapse_control *cc)
 {
 	int i;
 
@@ -680,11 +697,11 @@ static bool khugepaged_scan_abort(int nid)
 		return false;
 
 	/* If there is a count for this node already, it must be acceptable */
-	if (khugepaged_node_load[nid])
+	if (cc->node_load[nid])
 		return false;
 
 	for (i = 0; i < MAX_NUMNODES; i++) {
-		if (!khugepaged_node_load[i])
+		if (!cc->node_load[i])
 			continue;
 		if (node_distance(nid, i) > RECLAIM_DISTANCE)
 			return true;
@@ -698,16 +715,23 @@ static inline gfp_t alloc_hugepage_khugepaged_gfpmask(void)
 	return khugepaged_defrag() ? GFP_TRANSHUGE : GFP_TRANSHUGE_LIGHT;
 }
 
+/* MADV_COLLAPSE always tries hard, it runs on behalf of the caller */
+static inline gfp_t alloc_hugepage_collapse_gfpmask(struct collapse_control *cc)
+{
+	return cc->is_khugepaged ? alloc_hugepage_khugepaged_gfpmask() :
+				   GFP_TRANSHUGE;
+}
+
 #ifdef CONFIG_NUMA
-static int khugepaged_find_target_node(void)
+static int khugepaged_find_target_node(struct collapse_control *cc)
 {
 	static int last_khugepaged_target_node = NUMA_NO_NODE;
 	int nid, target_node = 0, max_value = 0;
 
 	/* find first node with max normal pages hit */
 	for (nid = 0; nid < MAX_NUMNODES; nid++)
-		if (khugepaged_node_load[nid] > max_value) {
-			max_value = khugepaged_node_load[nid];
+		if (cc->node_load[nid] > max_value) {
+			max_value = cc->node_load[nid];
 			target_node = nid;
 		}
 
@@ -715,7 +739,7 @@ static int khugepaged_find_target_node(void)
 	if (target_node <= last_khugepaged_target_node)
 		for (nid = last_khugepaged_target_node + 1; nid < MAX_NUMNODES;
 				nid++)
-			if (max_value == khugepaged_node_load[nid]) {
+			if (max_value == cc->node_load[nid]) {
 				target_node = nid;
 				break;
 			}
@@ -757,8 +781,18 @@ khugepaged_alloc_page(struct page **hpage, gfp_t gfp, int node)
 	count_vm_event(THP_COLLAPSE_ALLOC);
 	return *hpage;
 }
+
+/* collapse_huge_page() allocates the page itself, on the target node */
+static bool madvise_collapse_prealloc_page(struct page **hpage)
+{
+	if (!IS_ERR_OR_NULL(*hpage))
+		put_page(*hpage);
+	*hpage = NULL;
+
+	return true;
+}
 #else
-static int khugepaged_find_target_node(void)
+static int khugepaged_find_target_node(struct collapse_control *cc)
 {
 	return 0;
 }
@@ -812,12 +846,32 @@ khugepaged_alloc_page(struct page **hpage, gfp_t gfp, int node)
 
 	return  *hpage;
 }
+
+static bool madvise_collapse_prealloc_page(struct page **hpage)
+{
+	if (*hpage)
+		return true;
+
+	*hpage = alloc_pages(GFP_TRANSHUGE, HPAGE_PMD_ORDER);
+	if (unlikely(!*hpage)) {
+		count_vm_event(THP_COLLAPSE_ALLOC_FAILED);
+		return false;
+	}
+
+	prep_transhuge_page(*hpage);
+	count_vm_event(THP_COLLAPSE_ALLOC);
+	return true;
+}
 #endif
 
-static bool hugepage_vma_check(struct vm_area_struct *vma)
+static bool hugepage_vma_check(struct vm_area_struct *vma,
+			       struct collapse_control *cc)
 {
-	if ((!(vma->vm_flags & VM_HUGEPAGE) && !khugepaged_always()) ||
-	    (vma->vm_flags & VM_NOHUGEPAGE))
+	if (vma->vm_flags & VM_NOHUGEPAGE)
+		return false;
+	/* MADV_COLLAPSE doesn't depend on the sysfs "enabled" setting */
+	if (cc->is_khugepaged && !(vma->vm_flags & VM_HUGEPAGE) &&
+	    !khugepaged_always())
 		return false;
 	if (shmem_file(vma->vm_file)) {
 		if (!IS_ENABLED(CONFIG_TRANSPARENT_HUGE_PAGECACHE))
@@ -840,7 +894,7 @@ static bool hugepage_vma_check(struct vm_area_struct *vma)
  */
 
 static int hugepage_vma_revalidate(struct mm_struct *mm, unsigned long address,
-		struct vm_area_struct **vmap)
+		struct vm_area_struct **vmap, struct collapse_control *cc)
 {
 	struct vm_area_struct *vma;
 	unsigned long hstart, hend;
@@ -856,7 +910,7 @@ static int hugepage_vma_revalidate(struct mm_struct *mm, unsigned long address,
 	hend = vma->vm_end & HPAGE_PMD_MASK;
 	if (address < hstart || address + HPAGE_PMD_SIZE > hend)
 		return SCAN_ADDRESS_RANGE;
-	if (!hugepage_vma_check(vma))
+	if (!hugepage_vma_check(vma, cc))
 		return SCAN_VMA_CHECK;
 	return 0;
 }
@@ -872,7 +926,8 @@ static int hugepage_vma_revalidate(struct mm_struct *mm, unsigned long address,
 static bool __collapse_huge_page_swapin(struct mm_struct *mm,
 					struct vm_area_struct *vma,
 					unsigned long address, pmd_t *pmd,
-					int referenced)
+					int referenced,
+					struct collapse_control *cc)
 {
 	int swapped_in = 0, ret = 0;
 	struct vm_fault vmf = {
@@ -884,7 +939,7 @@ static bool __collapse_huge_page_swapin(struct mm_struct *mm,
 	};
 
 	/* we only decide to swapin, if there is enough young ptes */
-	if (referenced < HPAGE_PMD_NR/2) {
+	if (cc->is_khugepaged && referenced < HPAGE_PMD_NR/2) {
 		trace_mm_collapse_huge_page_swapin(mm, swapped_in, referenced, 0);
 		return false;
 	}
@@ -900,7 +955,7 @@ static bool __collapse_huge_page_swapin(struct mm_struct *mm,
 		/* do_swap_page returns VM_FAULT_RETRY with released mmap_sem */
 		if (ret & VM_FAULT_RETRY) {
 			down_read(&mm->mmap_sem);
-			if (hugepage_vma_revalidate(mm, address, &vmf.vma)) {
+			if (hugepage_vma_revalidate(mm, address, &vmf.vma, cc)) {
 				/* vma is no longer available, don't continue to swapin */
 				trace_mm_collapse_huge_page_swapin(mm, swapped_in, referenced, 0);
 				return false;
@@ -924,10 +979,15 @@ static bool __collapse_huge_page_swapin(struct mm_struct *mm,
 	return true;
 }
 
-static void collapse_huge_page(struct mm_struct *mm,
+/*
+ * Called with mmap_sem held for reading, returns with it released, and
+ * the SCAN_* result of the collapse.
+ */
+static int collapse_huge_page(struct mm_struct *mm,
 				   unsigned long address,
 				   struct page **hpage,
-				   int node, int referenced)
+				   int node, int referenced,
+				   struct collapse_control *cc)
 {
 	pmd_t *pmd, _pmd;
 	pte_t *pte;
@@ -944,7 +1004,7 @@ static void collapse_huge_page(struct mm_struct *mm,
 	VM_BUG_ON(address & ~HPAGE_PMD_MASK);
 
 	/* Only allocate from the target node */
-	gfp = alloc_hugepage_khugepaged_gfpmask() | __GFP_THISNODE;
+	gfp = alloc_hugepage_collapse_gfpmask(cc) | __GFP_THISNODE;
 
 	/*
 	 * Before allocating the hugepage, release the mmap_sem read lock.
@@ -965,7 +1025,7 @@ static void collapse_huge_page(struct mm_struct *mm,
 	}
 
 	down_read(&mm->mmap_sem);
-	result = hugepage_vma_revalidate(mm, address, &vma);
+	result = hugepage_vma_revalidate(mm, address, &vma, cc);
 	if (result) {
 		mem_cgroup_cancel_charge(new_page, memcg, true);
 		up_read(&mm->mmap_sem);
@@ -973,7 +1033,7 @@ static void collapse_huge_page(struct mm_struct *mm,
 	}
 
 	pmd = mm_find_pmd(mm, address);
-	if (!pmd) {
+	if (!pmd || pmd_shared_table(*pmd)) {
 		result = SCAN_PMD_NULL;
 		mem_cgroup_cancel_charge(new_page, memcg, true);
 		up_read(&mm->mmap_sem);
@@ -985,7 +1045,8 @@ static void collapse_huge_page(struct mm_struct *mm,
 	 * If it fails, we release mmap_sem and jump out_nolock.
 	 * Continuing to collapse causes inconsistency.
 	 */
-	if (!__collapse_huge_page_swapin(mm, vma, address, pmd, referenced)) {
+	if (!__collapse_huge_page_swapin(mm, vma, address, pmd, referenced,
+					 cc)) {
 		mem_cgroup_cancel_charge(new_page, memcg, true);
 		up_read(&mm->mmap_sem);
 		goto out_nolock;
@@ -998,11 +1059,11 @@ static void collapse_huge_page(struct mm_struct *mm,
 	 * handled by the anon_vma lock + PG_lock.
 	 */
 	down_write(&mm->mmap_sem);
-	result = hugepage_vma_revalidate(mm, address, &vma);
+	result = hugepage_vma_revalidate(mm, address, &vma, cc);
 	if (result)
 		goto out;
 	/* check if the pmd is still valid */
-	if (mm_find_pmd(mm, address) != pmd)
+	if (mm_find_pmd(mm, address) != pmd || pmd_shared_table(*pmd))
 		goto out;
 
 	anon_vma_lock_write(vma->anon_vma);
@@ -1025,7 +1086,7 @@ static void collapse_huge_page(struct mm_struct *mm,
 	mmu_notifier_invalidate_range_end(mm, mmun_start, mmun_end);
 
 	spin_lock(pte_ptl);
-	isolated = __collapse_huge_page_isolate(vma, address, pte);
+	isolated = __collapse_huge_page_isolate(vma, address, pte, cc);
 	spin_unlock(pte_ptl);
 
 	if (unlikely(!isolated)) {
@@ -1077,22 +1138,28 @@ static void collapse_huge_page(struct mm_struct *mm,
 
 	*hpage = NULL;
 
-	khugepaged_pages_collapsed++;
+	if (cc->is_khugepaged)
+		khugepaged_pages_collapsed++;
 	result = SCAN_SUCCEED;
 out_up_write:
 	up_write(&mm->mmap_sem);
 out_nolock:
 	trace_mm_collapse_huge_page(mm, isolated, result);
-	return;
+	return result;
 out:
 	mem_cgroup_cancel_charge(new_page, memcg, true);
 	goto out_up_write;
 }
 
+/*
+ * Called with mmap_sem held for reading. If a collapse is attempted, it is
+ * released and *mmap_locked cleared. Returns the SCAN_* result.
+ */
 static int khugepaged_scan_pmd(struct mm_struct *mm,
 			       struct vm_area_struct *vma,
-			       unsigned long address,
-			       struct page **hpage)
+			       unsigned long address, bool *mmap_locked,
+			       struct page **hpage,
+			       struct collapse_control *cc)
 {
 	pmd_t *pmd;
 	pte_t *pte, *_pte;
@@ -1106,18 +1173,19 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 	VM_BUG_ON(address & ~HPAGE_PMD_MASK);
 
 	pmd = mm_find_pmd(mm, address);
-	if (!pmd) {
+	if (!pmd || pmd_shared_table(*pmd)) {
 		result = SCAN_PMD_NULL;
 		goto out;
 	}
 
-	memset(khugepaged_node_load, 0, sizeof(khugepaged_node_load));
+	memset(cc->node_load, 0, sizeof(cc->node_load));
 	pte = pte_offset_map_lock(mm, pmd, address, &ptl);
 	for (_address = address, _pte = pte; _pte < pte+HPAGE_PMD_NR;
 	     _pte++, _address += PAGE_SIZE) {
 		pte_t pteval = *_pte;
 		if (is_swap_pte(pteval)) {
-			if (++unmapped <= khugepaged_max_ptes_swap) {
+			if (++unmapped <= khugepaged_max_ptes_swap ||
+			    !cc->is_khugepaged) {
 				continue;
 			} else {
 				result = SCAN_EXCEED_SWAP_PTE;
@@ -1125,8 +1193,10 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 			}
 		}
 		if (pte_none(pteval) || is_zero_pfn(pte_pfn(pteval))) {
+			++none_or_zero;
 			if (!userfaultfd_armed(vma) &&
-			    ++none_or_zero <= khugepaged_max_ptes_none) {
+			    (!cc->is_khugepaged ||
+			     none_or_zero <= khugepaged_max_ptes_none)) {
 				continue;
 			} else {
 				result = SCAN_EXCEED_NONE_PTE;
@@ -1154,16 +1224,16 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 
 		/*
 		 * Record which node the original page is from and save this
-		 * information to khugepaged_node_load[].
+		 * information to cc->node_load[].
 		 * Khupaged will allocate hugepage from the node has the max
 		 * hit record.
 		 */
 		node = page_to_nid(page);
-		if (khugepaged_scan_abort(node)) {
+		if (khugepaged_scan_abort(node, cc)) {
 			result = SCAN_SCAN_ABORT;
 			goto out_unmap;
 		}
-		khugepaged_node_load[node]++;
+		cc->node_load[node]++;
 		if (!PageLRU(page)) {
 			result = SCAN_PAGE_LRU;
 			goto out_unmap;
@@ -1192,7 +1262,7 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 			referenced++;
 	}
 	if (writable) {
-		if (referenced) {
+		if (referenced || !cc->is_khugepaged) {
 			result = SCAN_SUCCEED;
 			ret = 1;
 		} else {
@@ -1204,14 +1274,19 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 out_unmap:
 	pte_unmap_unlock(pte, ptl);
 	if (ret) {
-		node = khugepaged_find_target_node();
+		node = khugepaged_find_target_node(cc);
+		/* Swapping in is part of what MADV_COLLAPSE asked for */
+		if (!cc->is_khugepaged)
+			referenced = HPAGE_PMD_NR;
 		/* collapse_huge_page will return with the mmap_sem released */
-		collapse_huge_page(mm, address, hpage, node, referenced);
+		result = collapse_huge_page(mm, address, hpage, node,
+					    referenced, cc);
+		*mmap_locked = false;
 	}
 out:
 	trace_mm_khugepaged_scan_pmd(mm, page, writable, referenced,
 				     none_or_zero, result, unmapped);
-	return ret;
+	return result;
 }
 
 static void collect_mm_slot(struct mm_slot *mm_slot)
@@ -1561,7 +1636,8 @@ static void collapse_shmem(struct mm_struct *mm,
 
 static void khugepaged_scan_shmem(struct mm_struct *mm,
 		struct address_space *mapping,
-		pgoff_t start, struct page **hpage)
+		pgoff_t start, struct page **hpage,
+		struct collapse_control *cc)
 {
 	struct page *page = NULL;
 	struct radix_tree_iter iter;
@@ -1572,7 +1648,7 @@ static void khugepaged_scan_shmem(struct mm_struct *mm,
 
 	present = 0;
 	swap = 0;
-	memset(khugepaged_node_load, 0, sizeof(khugepaged_node_load));
+	memset(cc->node_load, 0, sizeof(cc->node_load));
 	rcu_read_lock();
 	radix_tree_for_each_slot(slot, &mapping->page_tree, &iter, start) {
 		if (iter.index >= start + HPAGE_PMD_NR)
@@ -1598,11 +1674,11 @@ static void khugepaged_scan_shmem(struct mm_struct *mm,
 		}
 
 		node = page_to_nid(page);
-		if (khugepaged_scan_abort(node)) {
+		if (khugepaged_scan_abort(node, cc)) {
 			result = SCAN_SCAN_ABORT;
 			break;
 		}
-		khugepaged_node_load[node]++;
+		cc->node_load[node]++;
 
 		if (!PageLRU(page)) {
 			result = SCAN_PAGE_LRU;
@@ -1633,7 +1709,7 @@ static void khugepaged_scan_shmem(struct mm_struct *mm,
 		if (present < HPAGE_PMD_NR - khugepaged_max_ptes_none) {
 			result = SCAN_EXCEED_NONE_PTE;
 		} else {
-			node = khugepaged_find_target_node();
+			node = khugepaged_find_target_node(cc);
 			collapse_shmem(mm, mapping, start, hpage, node);
 		}
 	}
@@ -1643,7 +1719,8 @@ static void khugepaged_scan_shmem(struct mm_struct *mm,
 #else
 static void khugepaged_scan_shmem(struct mm_struct *mm,
 		struct address_space *mapping,
-		pgoff_t start, struct page **hpage)
+		pgoff_t start, struct page **hpage,
+		struct collapse_control *cc)
 {
 	BUILD_BUG();
 }
@@ -1654,6 +1731,7 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 	__releases(&khugepaged_mm_lock)
 	__acquires(&khugepaged_mm_lock)
 {
+	struct collapse_control *cc = &khugepaged_collapse_control;
 	struct mm_slot *mm_slot;
 	struct mm_struct *mm;
 	struct vm_area_struct *vma;
@@ -1688,7 +1766,7 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 			progress++;
 			break;
 		}
-		if (!hugepage_vma_check(vma)) {
+		if (!hugepage_vma_check(vma, cc)) {
 skip:
 			progress++;
 			continue;
@@ -1704,7 +1782,8 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 		VM_BUG_ON(khugepaged_scan.address & ~HPAGE_PMD_MASK);
 
 		while (khugepaged_scan.address < hend) {
-			int ret;
+			bool mmap_locked = true;
+
 			cond_resched();
 			if (unlikely(khugepaged_test_exit(mm)))
 				goto breakouterloop;
@@ -1720,19 +1799,19 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 					goto skip;
 				file = get_file(vma->vm_file);
 				up_read(&mm->mmap_sem);
-				ret = 1;
+				mmap_locked = false;
 				khugepaged_scan_shmem(mm, file->f_mapping,
-						pgoff, hpage);
+						pgoff, hpage, cc);
 				fput(file);
 			} else {
-				ret = khugepaged_scan_pmd(mm, vma,
+				khugepaged_scan_pmd(mm, vma,
 						khugepaged_scan.address,
-						hpage);
+						&mmap_locked, hpage, cc);
 			}
 			/* move to next address */
 			khugepaged_scan.address += HPAGE_PMD_SIZE;
 			progress += HPAGE_PMD_NR;
-			if (ret)
+			if (!mmap_locked)
 				/* we released mmap_sem so break loop */
 				goto breakouterloop_mmap_sem;
 			if (progress >= pages)
@@ -1771,6 +1850,102 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 	return progress;
 }
 
+/*
+ * MADV_COLLAPSE: collapse the anonymous memory in [start, end) to huge pages
+ * right away, in the caller's context. The range is handled like
+ * khugepaged would, but without its sysfs limits on the number of empty or
+ * swapped out ptes, and without waiting for the pages to be referenced.
+ *
+ * Called with mmap_sem held for reading, and returns with it held. If it
+ * had to be dropped, *prev is cleared.
+ */
+int madvise_collapse(struct vm_area_struct *vma, struct vm_area_struct **prev,
+		     unsigned long start, unsigned long end)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	struct collapse_control *cc;
+	struct page *hpage = NULL;
+	unsigned long hstart, hend, addr;
+	int result, last_fail = SCAN_SUCCEED;
+	bool mmap_locked = true, mmap_dropped = false;
+
+	*prev = vma;
+
+	/* shmem is left to khugepaged */
+	if (vma->vm_file)
+		return -EINVAL;
+
+	cc = kmalloc(sizeof(*cc), GFP_KERNEL);
+	if (!cc)
+		return -ENOMEM;
+	cc->is_khugepaged = false;
+
+	if (!hugepage_vma_check(vma, cc)) {
+		kfree(cc);
+		return -EINVAL;
+	}
+
+	hstart = (start + ~HPAGE_PMD_MASK) & HPAGE_PMD_MASK;
+	hend = end & HPAGE_PMD_MASK;
+
+	/* Pages still in the per-cpu pagevecs are not on the LRU */
+	lru_add_drain_all();
+
+	for (addr = hstart; addr < hend; addr += HPAGE_PMD_SIZE) {
+		cond_resched();
+
+		if (!mmap_locked) {
+			down_read(&mm->mmap_sem);
+			mmap_locked = true;
+			mmap_dropped = true;
+			result = hugepage_vma_revalidate(mm, addr, &vma, cc);
+			if (result) {
+				last_fail = result;
+				break;
+			}
+		}
+
+		if (!madvise_collapse_prealloc_page(&hpage)) {
+			last_fail = SCAN_ALLOC_HUGE_PAGE_FAIL;
+			break;
+		}
+
+		result = khugepaged_scan_pmd(mm, vma, addr, &mmap_locked,
+					     &hpage, cc);
+		/* SCAN_PMD_NULL: nothing mapped, or a huge page already */
+		if (result != SCAN_SUCCEED && result != SCAN_PMD_NULL)
+			last_fail = result;
+	}
+
+	if (!IS_ERR_OR_NULL(hpage))
+		put_page(hpage);
+	kfree(cc);
+
+	if (!mmap_locked) {
+		down_read(&mm->mmap_sem);
+		mmap_dropped = true;
+	}
+	if (mmap_dropped)
+		*prev = NULL;
+
+	switch (last_fail) {
+	case SCAN_SUCCEED:
+		return 0;
+	case SCAN_ALLOC_HUGE_PAGE_FAIL:
+	case SCAN_CGROUP_CHARGE_FAIL:
+		return -ENOMEM;
+	case SCAN_FAIL:
+	case SCAN_PAGE_COUNT:
+	case SCAN_PAGE_LRU:
+	case SCAN_PAGE_LOCK:
+	case SCAN_DEL_PAGE_LRU:
+		/* Pages in use by someone else, may work next time */
+		return -EAGAIN;
+	default:
+		return -EINVAL;
+	}
+}
+
 static int khugepaged_has_work(void)
 {
 	return !list_empty(&khugepaged_scan.mm_head) &&
@@ -131,6 +131,7 @@ struct ksm_scan {
  * @list: linked into migrate_nodes, pending placement in the proper node tree
  * @hlist: hlist head of rmap_items using this ksm page
  * @kpfn: page frame number of this ksm page (perhaps temporarily on wrong nid)
+ * @checksum: checksum of the ksm page, which the stable tree is sorted by first
  * @nid: NUMA node id of stable tree in which linked (may not match kpfn)
  */
 struct stable_node {
@@ -143,6 +144,7 @@ struct stable_node {
 	};
 	struct hlist_head hlist;
 	unsigned long kpfn;
+	u32 checksum;
 #ifdef CONFIG_NUMA
 	int nid;
 #endif
@@ -155,7 +157,8 @@ struct stable_node {
  * @nid: NUMA node id of unstable tree in which linked (may not match page)
  * @mm: the memory structure this rmap_item is pointing into
  * @address: the virtual address this rmap_item tracks (+ flags in low bits)
- * @oldchecksum: previous checksum of the page at that virtual address
+ * @oldchecksum: previous checksum of the page at that virtual address,
+ *		 which the unstable tree is sorted by first
  * @node: rb node of this rmap_item in the unstable tree
  * @head: pointer to stable_node heading this list in the stable tree
  * @hlist: link into hlist of rmap_items hanging off that stable_node
@@ -219,6 +222,18 @@ static unsigned long ksm_pages_unshared;
 /* The number of rmap_items in use: to calculate pages_volatile */
 static unsigned long ksm_rmap_items;
 
+/* The number of pages merged with a page of the stable tree */
+static unsigned long ksm_stable_merges;
+
+/* The number of pairs of pages merged from the unstable tree */
+static unsigned long ksm_unstable_merges;
+
+/* The number of tree nodes told apart by their checksum alone */
+static unsigned long ksm_checksum_skips;
+
+/* The number of tree nodes that needed their page compared */
+static unsigned long ksm_page_compares;
+
 /* Number of pages ksmd should scan in one batch */
 static unsigned int ksm_thread_pages_to_scan = 100;
 
@@ -854,6 +869,28 @@ static inline int pages_identical(struct page *page1, struct page *page2)
 	return !memcmp_pages(page1, page2);
 }
 
+/*
+ * The stable and unstable trees are sorted by checksum first, and only
+ * by contents for equal checksums: most nodes are then passed with no
+ * more than an integer comparison, instead of mapping and comparing a
+ * whole page. Returns 0 when the pages have to be compared, else which
+ * side of the tree node to go down.
+ */
+static int compare_checksums(u32 checksum, u32 tree_checksum)
+{
+	if (checksum == tree_checksum)
+		return 0;
+
+	ksm_checksum_skips++;
+	return checksum < tree_checksum ? -1 : 1;
+}
+
+static int memcmp_tree_page(struct page *page, struct page *tree_page)
+{
+	ksm_page_compares++;
+	return memcmp_pages(page, tree_page);
+}
+
 static int write_protect_page(struct vm_area_struct *vma, struct page *page,
 			      pte_t *orig_pte)
 {
@@ -881,6 +918,8 @@ static int write_protect_page(struct vm_area_struct *vma, struct page *page,
 		goto out_mn;
 	if (WARN_ONCE(!pvmw.pte, "Unexpected PMD mapping?"))
 		goto out_unlock;
+	if (pmd_shared_table(*pvmw.pmd))
+		goto out_unlock;
 
 	if (pte_write(*pvmw.pte) || pte_dirty(*pvmw.pte) ||
 	    (pte_protnone(*pvmw.pte) && pte_savedwrite(*pvmw.pte))) {
@@ -1148,7 +1187,7 @@ static struct page *try_to_merge_two_pages(struct rmap_item *rmap_item,
  * This function returns the stable tree node of identical content if found,
  * NULL otherwise.
  */
-static struct page *stable_tree_search(struct page *page)
+static struct page *stable_tree_search(struct page *page, u32 checksum)
 {
 	int nid;
 	struct rb_root *root;
@@ -1176,6 +1215,13 @@ static struct page *stable_tree_search(struct page *page)
 
 		cond_resched();
 		stable_node = rb_entry(*new, struct stable_node, node);
+		ret = compare_checksums(checksum, stable_node->checksum);
+		if (ret) {
+			parent = *new;
+			new = ret < 0 ? &parent->rb_left : &parent->rb_right;
+			continue;
+		}
+
 		tree_page = get_ksm_page(stable_node, false);
 		if (!tree_page) {
 			/*
@@ -1190,7 +1236,7 @@ static struct page *stable_tree_search(struct page *page)
 			goto again;
 		}
 
-		ret = memcmp_pages(page, tree_page);
+		ret = memcmp_tree_page(page, tree_page);
 		put_page(tree_page);
 
 		parent = *new;
@@ -1266,10 +1312,14 @@ static struct stable_node *stable_tree_insert(struct page *kpage)
 	struct rb_node **new;
 	struct rb_node *parent;
 	struct stable_node *stable_node;
+	u32 checksum;
 
 	kpfn = page_to_pfn(kpage);
 	nid = get_kpfn_nid(kpfn);
 	root = root_stable_tree + nid;
+
+	/* kpage is write-protected now, unlike when its rmap_item was hashed */
+	checksum = calc_checksum(kpage);
 again:
 	parent = NULL;
 	new = &root->rb_node;
@@ -1280,6 +1330,13 @@ static struct stable_node *stable_tree_insert(struct page *kpage)
 
 		cond_resched();
 		stable_node = rb_entry(*new, struct stable_node, node);
+		ret = compare_checksums(checksum, stable_node->checksum);
+		if (ret) {
+			parent = *new;
+			new = ret < 0 ? &parent->rb_left : &parent->rb_right;
+			continue;
+		}
+
 		tree_page = get_ksm_page(stable_node, false);
 		if (!tree_page) {
 			/*
@@ -1294,7 +1351,7 @@ static struct stable_node *stable_tree_insert(struct page *kpage)
 			goto again;
 		}
 
-		ret = memcmp_pages(kpage, tree_page);
+		ret = memcmp_tree_page(kpage, tree_page);
 		put_page(tree_page);
 
 		parent = *new;
@@ -1318,6 +1375,7 @@ static struct stable_node *stable_tree_insert(struct page *kpage)
 
 	INIT_HLIST_HEAD(&stable_node->hlist);
 	stable_node->kpfn = kpfn;
+	stable_node->checksum = checksum;
 	set_page_stable_node(kpage, stable_node);
 	DO_NUMA(stable_node->nid = nid);
 	rb_link_node(&stable_node->node, parent, new);
@@ -1361,6 +1419,14 @@ struct rmap_item *unstable_tree_search_insert(struct rmap_item *rmap_item,
 
 		cond_resched();
 		tree_rmap_item = rb_entry(*new, struct rmap_item, node);
+		ret = compare_checksums(rmap_item->oldchecksum,
+					tree_rmap_item->oldchecksum);
+		if (ret) {
+			parent = *new;
+			new = ret < 0 ? &parent->rb_left : &parent->rb_right;
+			continue;
+		}
+
 		tree_page = get_mergeable_page(tree_rmap_item);
 		if (!tree_page)
 			return NULL;
@@ -1373,7 +1439,7 @@ struct rmap_item *unstable_tree_search_insert(struct rmap_item *rmap_item,
 			return NULL;
 		}
 
-		ret = memcmp_pages(page, tree_page);
+		ret = memcmp_tree_page(page, tree_page);
 
 		parent = *new;
 		if (ret < 0) {
@@ -1457,8 +1523,10 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 			return;
 	}
 
+	checksum = calc_checksum(page);
+
 	/* We first start with searching the page inside the stable tree */
-	kpage = stable_tree_search(page);
+	kpage = stable_tree_search(page, checksum);
 	if (kpage == page && rmap_item->head == stable_node) {
 		put_page(kpage);
 		return;
@@ -1473,6 +1541,7 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 			 * The page was successfully merged:
 			 * add its rmap_item to the stable tree.
 			 */
+			ksm_stable_merges++;
 			lock_page(kpage);
 			stable_tree_append(rmap_item, page_stable_node(kpage));
 			unlock_page(kpage);
@@ -1487,7 +1556,6 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 	 * don't want to insert it in the unstable tree, and we don't want
 	 * to waste our time searching for something identical to it there.
 	 */
-	checksum = calc_checksum(page);
 	if (rmap_item->oldchecksum != checksum) {
 		rmap_item->oldchecksum = checksum;
 		return;
@@ -1524,6 +1592,7 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 			lock_page(kpage);
 			stable_node = stable_tree_insert(kpage);
 			if (stable_node) {
+				ksm_unstable_merges++;
 				stable_tree_append(tree_rmap_item, stable_node);
 				stable_tree_append(rmap_item, stable_node);
 			}
@@ -2339,6 +2408,34 @@ static ssize_t full_scans_show(struct kobject *kobj,
 }
 KSM_ATTR_RO(full_scans);
 
+static ssize_t stable_merges_show(struct kobject *kobj,
+				  struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_stable_merges);
+}
+KSM_ATTR_RO(stable_merges);
+
+static ssize_t unstable_merges_show(struct kobject *kobj,
+				    struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_unstable_merges);
+}
+KSM_ATTR_RO(unstable_merges);
+
+static ssize_t checksum_skips_show(struct kobject *kobj,
+				   struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_checksum_skips);
+}
+KSM_ATTR_RO(checksum_skips);
+
+static ssize_t page_compares_show(struct kobject *kobj,
+				  struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_page_compares);
+}
+KSM_ATTR_RO(page_compares);
+
 static struct attribute *ksm_attrs[] = {
 	&sleep_millisecs_attr.attr,
 	&pages_to_scan_attr.attr,
@@ -2348,6 +2445,10 @@ static struct attribute *ksm_attrs[] = {
 	&pages_unshared_attr.attr,
 	&pages_volatile_attr.attr,
 	&full_scans_attr.attr,
+	&stable_merges_attr.attr,
+	&unstable_merges_attr.attr,
+	&checksum_skips_attr.attr,
+	&page_compares_attr.attr,
 #ifdef CONFIG_NUMA
 	&merge_across_nodes_attr.attr,
 #endif
@@ -68,6 +68,7 @@
 #include <linux/debugfs.h>
 #include <linux/userfaultfd_k.h>
 #include <linux/dax.h>
+#include <linux/sizes.h>
 
 #include <asm/io.h>
 #include <asm/mmu_context.h>
@@ -370,6 +371,17 @@ void tlb_table_flush(struct mmu_gather *tlb)
 	}
 }
 
+/*
+ * Architectures may defer the invalidation of the page walk caches for
+ * the tables they free to the next TLB flush, which has to happen before
+ * a table is freed outside of the batch.
+ */
+static void tlb_table_invalidate(struct mmu_gather *tlb)
+{
+	if (tlb->freed_tables)
+		tlb_flush_mmu_tlbonly(tlb);
+}
+
 void tlb_remove_table(struct mmu_gather *tlb, void *table)
 {
 	struct mmu_table_batch **batch = &tlb->batch;
@@ -379,6 +391,7 @@ void tlb_remove_table(struct mmu_gather *tlb, void *table)
 	 * concurrent page-table walk.
 	 */
 	if (atomic_read(&tlb->mm->mm_users) < 2) {
+		tlb_table_invalidate(tlb);
 		__tlb_remove_table(table);
 		return;
 	}
@@ -386,6 +399,7 @@ void tlb_remove_table(struct mmu_gather *tlb, void *table)
 	if (*batch == NULL) {
 		*batch = (struct mmu_table_batch *)__get_free_page(GFP_NOWAIT | __GFP_NOWARN);
 		if (*batch == NULL) {
+			tlb_table_invalidate(tlb);
 			tlb_remove_table_one(table);
 			return;
 		}
@@ -1023,6 +1037,358 @@ static int copy_pte_range(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 	return 0;
 }
 
+#ifdef CONFIG_SHARE_PTE_TABLES
+/*
+ * With MMF_SHARE_PTE, fork hands the pte tables of private anonymous
+ * memory to the child instead of copying them. A shared table is
+ * write-protected as a whole, in the pmd of every mm using it, so that
+ * the ptes it holds can't change, and they are accounted in the rss of
+ * each of those mms. Before anything changes a pte, it replaces the table
+ * it sees with a copy of its own, doing what copy_pte_range() would have
+ * done at fork: unshare_pte_table().
+ *
+ * The mms using a table are counted in its pt_share_count, which is only
+ * valid while the table is write-protected and is protected by the
+ * ptl of the table. The last mm standing makes the table writable again.
+ */
+static bool can_share_pte_table(struct mm_struct *src_mm,
+				struct vm_area_struct *vma,
+				unsigned long addr, unsigned long end)
+{
+	if (!USE_SPLIT_PTE_PTLOCKS || !test_bit(MMF_SHARE_PTE, &src_mm->flags))
+		return false;
+
+	if (!vma_is_anonymous(vma) || !is_cow_mapping(vma->vm_flags) ||
+	    (vma->vm_flags & (VM_LOCKED | VM_UFFD_MISSING | VM_UFFD_WP)))
+		return false;
+
+	/* The table must not map anything but this vma */
+	return !(addr & ~PMD_MASK) && end - addr == PMD_SIZE;
+}
+
+/*
+ * Count what the ptes of a table map, as copy_one_pte() would. Fails on
+ * migration entries: remove_migration_ptes() has to rewrite those.
+ */
+static bool pte_table_rss(struct vm_area_struct *vma, pmd_t *pmd,
+			  unsigned long addr, int *rss)
+{
+	unsigned long end = addr + PMD_SIZE;
+	pte_t *start_pte, *pte;
+	bool ret = true;
+
+	start_pte = pte = pte_offset_map(pmd, addr);
+	do {
+		pte_t ptent = *pte;
+		struct page *page;
+		swp_entry_t entry;
+
+		if (pte_none(ptent))
+			continue;
+
+		if (pte_present(ptent)) {
+			page = vm_normal_page(vma, addr, ptent);
+			if (page)
+				rss[mm_counter(page)]++;
+			continue;
+		}
+
+		entry = pte_to_swp_entry(ptent);
+		if (!non_swap_entry(entry)) {
+			rss[MM_SWAPENTS]++;
+		} else if (is_migration_entry(entry)) {
+			ret = false;
+			break;
+		}
+	} while (pte++, addr += PAGE_SIZE, addr != end);
+	pte_unmap(start_pte);
+
+	return ret;
+}
+
+static bool share_pte_table(struct mm_struct *dst_mm, struct mm_struct *src_mm,
+			    pmd_t *dst_pmd, pmd_t *src_pmd,
+			    struct vm_area_struct *vma, unsigned long addr)
+{
+	int rss[NR_MM_COUNTERS];
+	spinlock_t *pml, *ptl;
+	struct page *table;
+
+	init_rss_vec(rss);
+
+	pml = pmd_lock(src_mm, src_pmd);
+	ptl = pte_lockptr(src_mm, src_pmd);
+	spin_lock_nested(ptl, SINGLE_DEPTH_NESTING);
+	if (!pte_table_rss(vma, src_pmd, addr, rss)) {
+		spin_unlock(ptl);
+		spin_unlock(pml);
+		return false;
+	}
+
+	/* dup_mmap() flushes the parent's TLB once done */
+	table = pmd_page(*src_pmd);
+	if (pmd_table_write(*src_pmd)) {
+		table->pt_share_count = 1;
+		set_pmd(src_pmd, pmd_table_wrprotect(*src_pmd));
+	}
+	table->pt_share_count++;
+	set_pmd(dst_pmd, *src_pmd);
+	spin_unlock(ptl);
+	spin_unlock(pml);
+
+	atomic_long_inc(&dst_mm->nr_ptes);
+	add_mm_rss_vec(dst_mm, rss);
+
+	/* make sure dst_mm is on swapoff's mmlist. */
+	if (rss[MM_SWAPENTS] && unlikely(list_empty(&dst_mm->mmlist))) {
+		spin_lock(&mmlist_lock);
+		if (list_empty(&dst_mm->mmlist))
+			list_add(&dst_mm->mmlist, &src_mm->mmlist);
+		spin_unlock(&mmlist_lock);
+	}
+
+	return true;
+}
+
+/* Drop what copy_one_pte() took for the ptes of a detached table */
+static void unshare_pte_table_undo(struct vm_area_struct *vma, pte_t *pte,
+				   unsigned long addr, unsigned long end)
+{
+	for (; addr != end; pte++, addr += PAGE_SIZE) {
+		pte_t ptent = *pte;
+		struct page *page;
+
+		if (pte_none(ptent))
+			continue;
+
+		if (pte_present(ptent)) {
+			page = vm_normal_page(vma, addr, ptent);
+			if (page) {
+				page_remove_rmap(page, false);
+				put_page(page);
+			}
+		} else if (!non_swap_entry(pte_to_swp_entry(ptent))) {
+			swap_free(pte_to_swp_entry(ptent));
+		}
+	}
+}
+
+/**
+ * unshare_pte_table - Give a vma its own copy of a shared pte table
+ * @vma:	The vma the table maps
+ * @pmd:	The pmd pointing to the table
+ * @addr:	An address the table maps
+ *
+ * Returns 0 once the table at @pmd is writable, -ENOMEM if it could not
+ * be copied.
+ */
+int unshare_pte_table(struct vm_area_struct *vma, pmd_t *pmd,
+		      unsigned long addr)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long start = addr & PMD_MASK, end = start + PMD_SIZE;
+	pte_t *orig_src_pte, *orig_dst_pte;
+	pte_t *src_pte, *dst_pte;
+	swp_entry_t entry = (swp_entry_t){0};
+	int rss[NR_MM_COUNTERS];
+	spinlock_t *pml, *ptl;
+	struct page *table;
+	bool flush = false;
+	pgtable_t new;
+	int ret = 0;
+
+	new = pte_alloc_one(mm, start);
+	if (!new)
+		return -ENOMEM;
+
+	mmu_notifier_invalidate_range_start(mm, start, end);
+
+	pml = pmd_lock(mm, pmd);
+	if (!pmd_shared_table(*pmd))
+		goto out_unlock_pmd;
+
+	table = pmd_page(*pmd);
+	ptl = pte_lockptr(mm, pmd);
+	spin_lock_nested(ptl, SINGLE_DEPTH_NESTING);
+	flush = true;
+
+	/* Everybody else is gone, take the table back */
+	if (table->pt_share_count == 1) {
+		set_pmd(pmd, pmd_table_mkwrite(*pmd));
+		goto out_unlock;
+	}
+
+	/*
+	 * The pages mapped by the table are already accounted to mm, only
+	 * the references of the new mapping are missing.
+	 */
+	init_rss_vec(rss);
+	orig_src_pte = src_pte = pte_offset_map(pmd, start);
+	orig_dst_pte = dst_pte = kmap_atomic(new);
+	addr = start;
+	arch_enter_lazy_mmu_mode();
+	do {
+		if (pte_none(*src_pte))
+			continue;
+		entry.val = copy_one_pte(mm, mm, dst_pte, src_pte, vma, addr,
+					 rss);
+		if (entry.val)
+			break;
+	} while (dst_pte++, src_pte++, addr += PAGE_SIZE, addr != end);
+	arch_leave_lazy_mmu_mode();
+
+	if (entry.val) {
+		unshare_pte_table_undo(vma, orig_dst_pte, start, addr);
+		ret = -ENOMEM;
+	}
+	kunmap_atomic(orig_dst_pte);
+	pte_unmap(orig_src_pte);
+
+	if (!ret) {
+		table->pt_share_count--;
+		smp_wmb(); /* See comment in __pte_alloc() */
+		pmd_populate(mm, pmd, new);
+		new = NULL;
+	}
+out_unlock:
+	spin_unlock(ptl);
+out_unlock_pmd:
+	spin_unlock(pml);
+
+	if (flush)
+		flush_tlb_range(vma, start, end);
+	mmu_notifier_invalidate_range_end(mm, start, end);
+	if (new)
+		pte_free(mm, new);
+
+	return ret;
+}
+
+/**
+ * unshare_pte_tables - Give a vma its own copy of the tables of a range
+ * @vma:	The vma the tables map
+ * @start:	Start of the range
+ * @end:	End of the range
+ *
+ * For callers that can't have the page table walk unshare the tables
+ * as it goes, because it has no way to fail. They have to hold mmap_sem
+ * so that fork can't share the tables again. Returns 0 once none of the
+ * tables mapping the range is shared, -ENOMEM if one could not be copied.
+ */
+int unshare_pte_tables(struct vm_area_struct *vma, unsigned long start,
+		       unsigned long end)
+{
+	unsigned long addr;
+	pmd_t *pmd;
+	int ret;
+
+	if (!vma_is_anonymous(vma) || !is_cow_mapping(vma->vm_flags))
+		return 0;
+
+	for (addr = start & PMD_MASK; addr < end; addr += PMD_SIZE) {
+		pmd = mm_find_pmd(vma->vm_mm, addr);
+		if (pmd && pmd_shared_table(*pmd)) {
+			ret = unshare_pte_table(vma, pmd, addr);
+			if (ret)
+				return ret;
+		}
+		cond_resched();
+	}
+
+	return 0;
+}
+
+/*
+ * Drop this mm's use of a shared table when the whole of it goes. The
+ * table stays with the other mms, and so do the pages it maps. Returns
+ * true if there is nothing left for zap_pte_range() to do.
+ */
+static bool zap_shared_pte_table(struct mmu_gather *tlb,
+				 struct vm_area_struct *vma, pmd_t *pmd,
+				 unsigned long addr, unsigned long end)
+{
+	struct mm_struct *mm = tlb->mm;
+	int rss[NR_MM_COUNTERS], i;
+	spinlock_t *pml, *ptl;
+	struct page *table;
+	bool dropped = false;
+
+	if (end - addr != PMD_SIZE && !tlb->fullmm) {
+		/* The oom reaper must not block, exit_mmap() will do it */
+		if (test_bit(MMF_UNSTABLE, &mm->flags))
+			return true;
+		/*
+		 * The callers unshare the tables they only zap part of, see
+		 * madvise_dontneed() and split_vma(). Leave the ptes be if
+		 * one got here anyway and there is no memory for a copy.
+		 */
+		if (WARN_ON_ONCE(unshare_pte_table(vma, pmd, addr)))
+			return true;
+		return false;
+	}
+
+	init_rss_vec(rss);
+
+	pml = pmd_lock(mm, pmd);
+	if (!pmd_shared_table(*pmd))
+		goto out;
+
+	table = pmd_page(*pmd);
+	ptl = pte_lockptr(mm, pmd);
+	spin_lock_nested(ptl, SINGLE_DEPTH_NESTING);
+	if (table->pt_share_count == 1) {
+		set_pmd(pmd, pmd_table_mkwrite(*pmd));
+	} else {
+		pte_table_rss(vma, pmd, addr & PMD_MASK, rss);
+		table->pt_share_count--;
+		pmd_clear(pmd);
+		dropped = true;
+	}
+	spin_unlock(ptl);
+out:
+	spin_unlock(pml);
+
+	if (!dropped) {
+		/* zap_pte_range() only flushes what it zaps */
+		if (!tlb->fullmm)
+			flush_tlb_range(vma, addr, end);
+		return false;
+	}
+
+	for (i = 0; i < NR_MM_COUNTERS; i++)
+		rss[i] = -rss[i];
+	add_mm_rss_vec(mm, rss);
+	atomic_long_dec(&mm->nr_ptes);
+
+	tlb->freed_tables = 1;
+	__tlb_adjust_range(tlb, addr, end - addr);
+	return true;
+}
+#else
+static inline bool can_share_pte_table(struct mm_struct *src_mm,
+				       struct vm_area_struct *vma,
+				       unsigned long addr, unsigned long end)
+{
+	return false;
+}
+
+static inline bool share_pte_table(struct mm_struct *dst_mm,
+				   struct mm_struct *src_mm,
+				   pmd_t *dst_pmd, pmd_t *src_pmd,
+				   struct vm_area_struct *vma,
+				   unsigned long addr)
+{
+	return false;
+}
+
+static inline bool zap_shared_pte_table(struct mmu_gather *tlb,
+					struct vm_area_struct *vma, pmd_t *pmd,
+					unsigned long addr, unsigned long end)
+{
+	return false;
+}
+#endif /* CONFIG_SHARE_PTE_TABLES */
+
 static inline int copy_pmd_range(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 		pud_t *dst_pud, pud_t *src_pud, struct vm_area_struct *vma,
 		unsigned long addr, unsigned long end)
@@ -1049,6 +1415,9 @@ static inline int copy_pmd_range(struct mm_struct *dst_mm, struct mm_struct *src
 		}
 		if (pmd_none_or_clear_bad(src_pmd))
 			continue;
+		if (can_share_pte_table(src_mm, vma, addr, next) &&
+		    share_pte_table(dst_mm, src_mm, dst_pmd, src_pmd, vma, addr))
+			continue;
 		if (copy_pte_range(dst_mm, src_mm, dst_pmd, src_pmd,
 						vma, addr, next))
 			return -ENOMEM;
@@ -1314,6 +1683,9 @@ static inline unsigned long zap_pmd_range(struct mmu_gather *tlb,
 		 */
 		if (pmd_none_or_trans_huge_or_clear_bad(pmd))
 			goto next;
+		if (unlikely(pmd_shared_table(*pmd)) &&
+		    zap_shared_pte_table(tlb, vma, pmd, addr, next))
+			goto next;
 		next = zap_pte_range(tlb, vma, pmd, addr, next, details);
 next:
 		cond_resched();
@@ -3382,9 +3754,11 @@ static int do_read_fault(struct vm_fault *vmf)
 	/*
 	 * Let's call ->map_pages() first and use ->fault() as fallback
 	 * if page by the offset is not ready to be mapped (cold cache or
-	 * something).
+	 * something). Minor faults tracking wants to see all the faults on
+	 * cached pages, so no fault-around then.
 	 */
-	if (vma->vm_ops->map_pages && fault_around_bytes >> PAGE_SHIFT > 1) {
+	if (vma->vm_ops->map_pages && fault_around_bytes >> PAGE_SHIFT > 1 &&
+	    likely(!userfaultfd_minor(vma))) {
 		ret = do_fault_around(vmf);
 		if (ret)
 			return ret;
@@ -3838,6 +4212,11 @@ static int __handle_mm_fault(struct vm_area_struct *vma, unsigned long address,
 		}
 	}
 
+	/* Whatever the fault, it is going to change a pte */
+	if (unlikely(pmd_shared_table(*vmf.pmd)) &&
+	    unshare_pte_table(vma, vmf.pmd, address))
+		return VM_FAULT_OOM;
+
 	return handle_pte_fault(&vmf);
 }
 
@@ -3906,6 +4285,238 @@ int handle_mm_fault(struct vm_area_struct *vma, unsigned long address,
 }
 EXPORT_SYMBOL_GPL(handle_mm_fault);
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+/*
+ * Speculative faults handle the first touch of private anonymous memory
+ * without mmap_sem, so that faulting threads don't wait for a writer.
+ *
+ * The VMA is looked up under RCU, and copied while its vm_sequence is
+ * stable. The copy is what the fault relies on: after allocating the
+ * page, the VMA is looked up again and compared to it, and vm_sequence
+ * is checked once more under the pte lock. The writers bump vm_sequence
+ * before touching the VMA and before zapping or freeing page tables,
+ * which needs the pte lock, so that the pte is either set before they
+ * get to it, or not at all. Page tables are freed after an RCU-sched
+ * grace period (HAVE_RCU_TABLE_FREE), hence the walk with interrupts
+ * disabled.
+ *
+ * Anything else, or a race with a writer, returns VM_FAULT_RETRY, and
+ * the fault is then handled under mmap_sem.
+ */
+static bool spf_vma_snapshot(struct vm_area_struct *vma,
+			     struct vm_area_struct *copy, unsigned int *seq)
+{
+	*seq = raw_read_seqcount(&vma->vm_sequence);
+	if (*seq & 1)
+		return false;
+
+	*copy = *vma;
+	return !read_seqcount_retry(&vma->vm_sequence, *seq);
+}
+
+static bool spf_vma_usable(struct vm_area_struct *vma, struct mm_struct *mm,
+			   unsigned long address, unsigned int flags,
+			   unsigned long vm_flags)
+{
+	if (vma->vm_mm != mm ||
+	    address < vma->vm_start || address >= vma->vm_end)
+		return false;
+
+	/* Private anonymous memory only, that has been faulted in before */
+	if (!vma_is_anonymous(vma) || vma->vm_file || !vma->anon_vma)
+		return false;
+
+	/* No stack expansion, userfaultfd or VMA policy */
+	if (vma->vm_flags & (VM_SHARED | VM_GROWSDOWN | VM_GROWSUP |
+			     VM_UFFD_MISSING))
+		return false;
+	if (vma_policy(vma))
+		return false;
+
+	return (vma->vm_flags & vm_flags) &&
+		arch_vma_access_permitted(vma, flags & FAULT_FLAG_WRITE,
+					  flags & FAULT_FLAG_INSTRUCTION,
+					  flags & FAULT_FLAG_REMOTE);
+}
+
+static bool spf_vma_unchanged(struct vm_area_struct *vma,
+			      struct vm_area_struct *copy, unsigned int *seq)
+{
+	*seq = raw_read_seqcount(&vma->vm_sequence);
+	if (*seq & 1)
+		return false;
+
+	return vma->vm_mm == copy->vm_mm &&
+		vma->vm_start == copy->vm_start &&
+		vma->vm_end == copy->vm_end &&
+		vma->vm_pgoff == copy->vm_pgoff &&
+		vma->vm_flags == copy->vm_flags &&
+		pgprot_val(vma->vm_page_prot) == pgprot_val(copy->vm_page_prot) &&
+		vma->anon_vma == copy->anon_vma &&
+		vma->vm_ops == copy->vm_ops &&
+		vma->vm_file == copy->vm_file &&
+		vma_policy(vma) == vma_policy(copy);
+}
+
+/**
+ * handle_speculative_fault - Try to handle a page fault without mmap_sem
+ * @mm:		The faulting task's mm
+ * @address:	The faulting address
+ * @flags:	FAULT_FLAG_xxx flags, as passed to handle_mm_fault()
+ * @vm_flags:	The access is allowed if the VMA has any of these flags
+ *
+ * Returns VM_FAULT_RETRY if the fault must be handled under mmap_sem,
+ * 0 otherwise, the faulting address being mapped with the permissions
+ * the access needs.
+ */
+int handle_speculative_fault(struct mm_struct *mm, unsigned long address,
+			     unsigned int flags, unsigned long vm_flags)
+{
+	struct vm_area_struct *vma, copy;
+	struct mem_cgroup *memcg;
+	struct page *page = NULL;
+	pgd_t pgd;
+	p4d_t p4d;
+	pud_t pud;
+	pmd_t *pmdp, pmd;
+	pte_t *pte, entry;
+	spinlock_t *ptl;
+	unsigned int seq;
+	bool ok, raced;
+
+	address &= PAGE_MASK;
+
+	/* The oom reaper may be tearing the address space down */
+	if (test_bit(MMF_UNSTABLE, &mm->flags))
+		return VM_FAULT_RETRY;
+
+	rcu_read_lock();
+	vma = find_vma_rcu(mm, address);
+	ok = vma && spf_vma_snapshot(vma, &copy, &seq);
+	rcu_read_unlock();
+
+	if (!ok || !spf_vma_usable(&copy, mm, address, flags, vm_flags))
+		return VM_FAULT_RETRY;
+
+	/* As in do_anonymous_page(), read faults map the zero page */
+	if (!(flags & FAULT_FLAG_WRITE) && !mm_forbids_zeropage(mm)) {
+		entry = pte_mkspecial(pfn_pte(my_zero_pfn(address),
+					      copy.vm_page_prot));
+	} else {
+		/* The copy has no policy, the task's one applies */
+		page = alloc_zeroed_user_highpage_movable(&copy, address);
+		if (!page)
+			return VM_FAULT_RETRY;
+
+		if (mem_cgroup_try_charge(page, mm, GFP_KERNEL, &memcg, false)) {
+			put_page(page);
+			return VM_FAULT_RETRY;
+		}
+
+		__SetPageUptodate(page);
+
+		entry = mk_pte(page, copy.vm_page_prot);
+		if (copy.vm_flags & VM_WRITE)
+			entry = pte_mkwrite(pte_mkdirty(entry));
+	}
+
+	rcu_read_lock();
+	local_irq_disable();
+
+	vma = find_vma_rcu(mm, address);
+	if (!vma || !spf_vma_unchanged(vma, &copy, &seq))
+		goto out_walk;
+
+	/* Only populate existing page tables, like the fast GUP walk */
+	pgd = READ_ONCE(*pgd_offset(mm, address));
+	if (pgd_none(pgd) || pgd_bad(pgd))
+		goto out_walk;
+	p4d = READ_ONCE(*p4d_offset(&pgd, address));
+	if (p4d_none(p4d) || p4d_bad(p4d))
+		goto out_walk;
+	pud = READ_ONCE(*pud_offset(&p4d, address));
+	if (pud_none(pud) || pud_bad(pud))
+		goto out_walk;
+	pmdp = pmd_offset(&pud, address);
+	pmd = READ_ONCE(*pmdp);
+	if (pmd_none(pmd) || pmd_trans_huge(pmd) || pmd_bad(pmd) ||
+	    pmd_shared_table(pmd))
+		goto out_walk;
+
+	/*
+	 * Only trylock: spinning with interrupts disabled would hold off
+	 * the grace period page tables are freed after.
+	 */
+	ptl = pte_lockptr(mm, &pmd);
+	pte = pte_offset_map(&pmd, address);
+	if (!spin_trylock(ptl)) {
+		pte_unmap(pte);
+		goto out_walk;
+	}
+
+	if (pmd_val(READ_ONCE(*pmdp)) != pmd_val(pmd) ||
+	    read_seqcount_retry(&vma->vm_sequence, seq)) {
+		pte_unmap_unlock(pte, ptl);
+		goto out_walk;
+	}
+
+	/* The pte lock now holds off the writers */
+	local_irq_enable();
+	rcu_read_unlock();
+
+	/*
+	 * Raced with another fault on the same address. Unless that one
+	 * already allows the access, this is a write to the zero page or to
+	 * a COW page, a swap or a NUMA hinting entry: those all need the
+	 * full fault path.
+	 */
+	raced = !pte_none(*pte);
+	if (raced && (!pte_present(*pte) || pte_protnone(*pte) ||
+		      ((flags & FAULT_FLAG_WRITE) && !pte_write(*pte)))) {
+		pte_unmap_unlock(pte, ptl);
+		goto out_page;
+	}
+
+	__set_current_state(TASK_RUNNING);
+	count_vm_event(PGFAULT);
+	count_vm_event(SPECULATIVE_PGFAULT);
+	mem_cgroup_count_vm_event(mm, PGFAULT);
+	check_sync_rss_stat(current);
+
+	if (raced) {
+		pte_unmap_unlock(pte, ptl);
+		if (page) {
+			mem_cgroup_cancel_charge(page, memcg, false);
+			put_page(page);
+		}
+		return 0;
+	}
+
+	if (page) {
+		inc_mm_counter_fast(mm, MM_ANONPAGES);
+		page_add_new_anon_rmap(page, &copy, address, false);
+		mem_cgroup_commit_charge(page, memcg, false, false);
+		lru_cache_add_active_or_unevictable(page, &copy);
+	}
+	set_pte_at(mm, address, pte, entry);
+
+	/* No need to invalidate - it was non-present before */
+	update_mmu_cache(&copy, address, pte);
+	pte_unmap_unlock(pte, ptl);
+	return 0;
+
+out_walk:
+	local_irq_enable();
+	rcu_read_unlock();
+out_page:
+	if (page) {
+		mem_cgroup_cancel_charge(page, memcg, false);
+		put_page(page);
+	}
+	return VM_FAULT_RETRY;
+}
+#endif /* CONFIG_SPECULATIVE_PAGE_FAULT */
+
 #ifndef __PAGETABLE_P4D_FOLDED
 /*
  * Allocate p4d page table.
@@ -4312,6 +4923,39 @@ EXPORT_SYMBOL(__might_fault);
 #endif
 
 #if defined(CONFIG_TRANSPARENT_HUGEPAGE) || defined(CONFIG_HUGETLBFS)
+/*
+ * The architecture may clear and copy runs of subpages in one go, which it
+ * can do better than page by page. Below MAX_ORDER, the subpages are
+ * contiguous in the linear map. The runs are kept short enough not to
+ * hold off rescheduling for too long.
+ */
+#ifdef clear_user_pages
+#define HUGE_PAGE_RUN	(SZ_256K >> PAGE_SHIFT ? : 1)
+#else
+#define HUGE_PAGE_RUN	1
+#endif
+
+static void clear_subpages(struct page *page, unsigned long addr,
+			   unsigned int nr)
+{
+#ifdef clear_user_pages
+	clear_user_pages(page_address(page), addr, page, nr);
+#else
+	clear_user_highpage(page, addr);
+#endif
+}
+
+static void copy_subpages(struct page *dst, struct page *src,
+			  unsigned long addr, struct vm_area_struct *vma,
+			  unsigned int nr)
+{
+#ifdef clear_user_pages
+	copy_user_pages(page_address(dst), page_address(src), addr, dst, nr);
+#else
+	copy_user_highpage(dst, src, addr, vma);
+#endif
+}
+
 static void clear_gigantic_page(struct page *page,
 				unsigned long addr,
 				unsigned int pages_per_huge_page)
@@ -4337,9 +4981,11 @@ void clear_huge_page(struct page *page,
 	}
 
 	might_sleep();
-	for (i = 0; i < pages_per_huge_page; i++) {
+	for (i = 0; i < pages_per_huge_page; i += HUGE_PAGE_RUN) {
 		cond_resched();
-		clear_user_highpage(page + i, addr + i * PAGE_SIZE);
+		clear_subpages(page + i, addr + i * PAGE_SIZE,
+			       min_t(int, HUGE_PAGE_RUN,
+				     pages_per_huge_page - i));
 	}
 }
 
@@ -4375,9 +5021,11 @@ void copy_user_huge_page(struct page *dst, struct page *src,
 	}
 
 	might_sleep();
-	for (i = 0; i < pages_per_huge_page; i++) {
+	for (i = 0; i < pages_per_huge_page; i += HUGE_PAGE_RUN) {
 		cond_resched();
-		copy_user_highpage(dst + i, src + i, addr + i*PAGE_SIZE, vma);
+		copy_subpages(dst + i, src + i, addr + i*PAGE_SIZE, vma,
+			      min_t(int, HUGE_PAGE_RUN,
+				    pages_per_huge_page - i));
 	}
 }
 
@@ -159,6 +159,29 @@ void unlink_file_vma(struct vm_area_struct *vma)
 	}
 }
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+static void __vm_area_free(struct rcu_head *head)
+{
+	kmem_cache_free(vm_area_cachep,
+			container_of(head, struct vm_area_struct, vm_rcu));
+}
+
+/*
+ * handle_speculative_fault() looks VMAs up without mmap_sem, so those
+ * that have been linked in the rbtree may only be freed after a grace
+ * period.
+ */
+static void vm_area_free(struct vm_area_struct *vma)
+{
+	call_rcu(&vma->vm_rcu, __vm_area_free);
+}
+#else
+static void vm_area_free(struct vm_area_struct *vma)
+{
+	kmem_cache_free(vm_area_cachep, vma);
+}
+#endif
+
 /*
  * Close a vm structure and free it, returning the next.
  */
@@ -172,7 +195,7 @@ static struct vm_area_struct *remove_vma(struct vm_area_struct *vma)
 	if (vma->vm_file)
 		fput(vma->vm_file);
 	mpol_put(vma_policy(vma));
-	kmem_cache_free(vm_area_cachep, vma);
+	vm_area_free(vma);
 	return next;
 }
 
@@ -747,6 +770,14 @@ int __vma_adjust(struct vm_area_struct *vma, unsigned long start,
 			VM_WARN_ON(expand != importer);
 		}
 
+		/* A shared pte table must not end up mapping both vmas */
+		if (adjust_next) {
+			int error = split_shared_pte_table(exporter, end);
+
+			if (error)
+				return error;
+		}
+
 		/*
 		 * Easily overlooked: when mprotect shifts the boundary,
 		 * make sure the expanding vma has anon_vma set if the
@@ -762,6 +793,11 @@ int __vma_adjust(struct vm_area_struct *vma, unsigned long start,
 		}
 	}
 again:
+	/* A removed next is left odd, it is about to be freed */
+	vm_write_begin(vma);
+	if (adjust_next || remove_next)
+		vm_write_begin(next);
+
 	vma_adjust_trans_huge(orig_vma, start, end, adjust_next);
 
 	if (file) {
@@ -871,6 +907,10 @@ int __vma_adjust(struct vm_area_struct *vma, unsigned long start,
 	if (mapping)
 		i_mmap_unlock_write(mapping);
 
+	vm_write_end(vma);
+	if (adjust_next)
+		vm_write_end(next);
+
 	if (root) {
 		uprobe_mmap(vma);
 
@@ -887,7 +927,7 @@ int __vma_adjust(struct vm_area_struct *vma, unsigned long start,
 			anon_vma_merge(vma, next);
 		mm->map_count--;
 		mpol_put(vma_policy(next));
-		kmem_cache_free(vm_area_cachep, next);
+		vm_area_free(next);
 		/*
 		 * In mprotect's case 6 (see comments on vma_merge),
 		 * we must remove another next too. It would clutter
@@ -2127,6 +2167,36 @@ struct vm_area_struct *find_vma(struct mm_struct *mm, unsigned long addr)
 
 EXPORT_SYMBOL(find_vma);
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+/*
+ * Like find_vma(), without mmap_sem but under rcu_read_lock(). The
+ * rbtree may be rebalanced under us, in which case the lookup can miss
+ * the VMA, or return one that is being removed: the caller has to
+ * validate the result against vma->vm_sequence.
+ */
+struct vm_area_struct *find_vma_rcu(struct mm_struct *mm, unsigned long addr)
+{
+	struct rb_node *rb_node = READ_ONCE(mm->mm_rb.rb_node);
+	struct vm_area_struct *vma = NULL;
+
+	while (rb_node) {
+		struct vm_area_struct *tmp;
+
+		tmp = rb_entry(rb_node, struct vm_area_struct, vm_rb);
+
+		if (READ_ONCE(tmp->vm_end) > addr) {
+			vma = tmp;
+			if (READ_ONCE(tmp->vm_start) <= addr)
+				break;
+			rb_node = READ_ONCE(rb_node->rb_left);
+		} else
+			rb_node = READ_ONCE(rb_node->rb_right);
+	}
+
+	return vma;
+}
+#endif
+
 /*
  * Same as find_vma, but also return a pointer to the previous VMA in *pprev.
  */
@@ -2481,6 +2551,8 @@ detach_vmas_to_be_unmapped(struct mm_struct *mm, struct vm_area_struct *vma,
 	insertion_point = (prev ? &prev->vm_next : &mm->mmap);
 	vma->vm_prev = NULL;
 	do {
+		/* Never ended, the VMA is freed by remove_vma() */
+		vm_write_begin(vma);
 		vma_rb_erase(vma, &mm->mm_rb);
 		mm->map_count--;
 		tail_vma = vma;
@@ -2512,6 +2584,10 @@ int __split_vma(struct mm_struct *mm, struct vm_area_struct *vma,
 					~(huge_page_mask(hstate_vma(vma)))))
 		return -EINVAL;
 
+	err = split_shared_pte_table(vma, addr);
+	if (err)
+		return err;
+
 	new = kmem_cache_alloc(vm_area_cachep, GFP_KERNEL);
 	if (!new)
 		return -ENOMEM;
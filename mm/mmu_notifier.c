@@ -141,6 +141,37 @@ int __mmu_notifier_clear_young(struct mm_struct *mm,
 	return young;
 }
 
+bool __mmu_notifier_clear_young_bitmap(struct mm_struct *mm,
+				       unsigned long start,
+				       unsigned long end,
+				       unsigned long *young)
+{
+	struct mmu_notifier *mn;
+	unsigned long mask = *young, tmp;
+	bool ret = false;
+	int id;
+
+	id = srcu_read_lock(&srcu);
+	hlist_for_each_entry_rcu(mn, &mm->mmu_notifier_mm->list, hlist) {
+		if (mn->ops->clear_young && !mn->ops->clear_young_bitmap)
+			goto out;
+	}
+
+	*young = 0;
+	hlist_for_each_entry_rcu(mn, &mm->mmu_notifier_mm->list, hlist) {
+		if (mn->ops->clear_young_bitmap) {
+			tmp = mask;
+			mn->ops->clear_young_bitmap(mn, mm, start, end, &tmp);
+			*young |= tmp;
+		}
+	}
+	ret = true;
+out:
+	srcu_read_unlock(&srcu, id);
+
+	return ret;
+}
+
 int __mmu_notifier_test_young(struct mm_struct *mm,
 			      unsigned long address)
 {
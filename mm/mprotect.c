@@ -179,6 +179,14 @@ static inline unsigned long change_pmd_range(struct vm_area_struct *vma,
 			}
 			/* fall through, the trans huge pmd just split */
 		}
+		if (unlikely(pmd_shared_table(*pmd))) {
+			/* Not worth a copy of the table for NUMA hinting */
+			if (prot_numa)
+				continue;
+			/* mprotect_fixup() already unshared them */
+			if (WARN_ON_ONCE(unshare_pte_table(vma, pmd, addr)))
+				continue;
+		}
 		this_pages = change_pte_range(vma, pmd, addr, next, newprot,
 				 dirty_accountable, prot_numa);
 		pages += this_pages;
@@ -313,6 +321,11 @@ mprotect_fixup(struct vm_area_struct *vma, struct vm_area_struct **pprev,
 		}
 	}
 
+	/* change_protection() has no way to fail, copy shared tables now */
+	error = unshare_pte_tables(vma, start, end);
+	if (error)
+		goto fail;
+
 	/*
 	 * First try to merge with previous and/or next vma.
 	 */
@@ -345,9 +358,11 @@ mprotect_fixup(struct vm_area_struct *vma, struct vm_area_struct **pprev,
 	 * vm_flags and vm_page_prot are protected by the mmap_sem
 	 * held in write mode.
 	 */
+	vm_write_begin(vma);
 	vma->vm_flags = newflags;
 	dirty_accountable = vma_wants_writenotify(vma, vma->vm_page_prot);
 	vma_set_page_prot(vma);
+	vm_write_end(vma);
 
 	change_protection(vma, start, end, vma->vm_page_prot,
 			  dirty_accountable, 0);
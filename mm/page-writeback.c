@@ -60,6 +60,9 @@
 
 #define RATELIMIT_CALC_SHIFT	10
 
+/* Don't slow dirtiers below 1/16th of their rate for read latency's sake */
+#define LAT_THROTTLE_MAX_SHIFT	4U
+
 /*
  * After a CPU has dirtied this many pages, balance_dirty_pages_ratelimited
  * will look to see if it needs to force writeback or throttling.
@@ -1578,6 +1581,7 @@ static void balance_dirty_pages(struct address_space *mapping,
 	bool dirty_exceeded = false;
 	unsigned long task_ratelimit;
 	unsigned long dirty_ratelimit;
+	unsigned int lat_throttle;
 	struct backing_dev_info *bdi = wb->bdi;
 	bool strictlimit = bdi->capabilities & BDI_CAP_STRICTLIMIT;
 	unsigned long start_time = jiffies;
@@ -1714,6 +1718,14 @@ static void balance_dirty_pages(struct address_space *mapping,
 		dirty_ratelimit = wb->dirty_ratelimit;
 		task_ratelimit = ((u64)dirty_ratelimit * sdtc->pos_ratio) >>
 							RATELIMIT_CALC_SHIFT;
+		/*
+		 * The device is throttling writeback to protect its read
+		 * latency.  Halve the dirty rate for every step, rather than
+		 * letting the dirtiers run up to the limits and stall there.
+		 */
+		lat_throttle = READ_ONCE(bdi->lat_throttle);
+		if (lat_throttle)
+			task_ratelimit >>= min(lat_throttle, LAT_THROTTLE_MAX_SHIFT);
 		max_pause = wb_max_pause(wb, sdtc->wb_dirty);
 		min_pause = wb_min_pause(wb, max_pause,
 					 task_ratelimit, dirty_ratelimit,
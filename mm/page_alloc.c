@@ -66,6 +66,9 @@
 #include <linux/kthread.h>
 #include <linux/memcontrol.h>
 #include <linux/ftrace.h>
+#include <linux/sizes.h>
+#include <linux/page_prezero.h>
+#include <linux/page_reporting.h>
 
 #include <asm/sections.h>
 #include <asm/tlbflush.h>
@@ -714,6 +717,8 @@ static inline void set_page_order(struct page *page, unsigned int order)
 static inline void rmv_page_order(struct page *page)
 {
 	__ClearPageBuddy(page);
+	__ClearPageZeroed(page);
+	__ClearPageReported(page);
 	set_page_private(page, 0);
 }
 
@@ -788,12 +793,13 @@ static inline int page_is_buddy(struct page *page, struct page *buddy,
 static inline void __free_one_page(struct page *page,
 		unsigned long pfn,
 		struct zone *zone, unsigned int order,
-		int migratetype)
+		int migratetype, bool report)
 {
 	unsigned long combined_pfn;
 	unsigned long uninitialized_var(buddy_pfn);
 	struct page *buddy;
 	unsigned int max_order;
+	bool zeroed = PageZeroed(page);
 
 	max_order = min_t(unsigned int, MAX_ORDER, pageblock_order + 1);
 
@@ -818,8 +824,13 @@ static inline void __free_one_page(struct page *page,
 			goto done_merging;
 		/*
 		 * Our buddy is free or it is CONFIG_DEBUG_PAGEALLOC guard page,
-		 * merge with it and move up one order.
+		 * merge with it and move up one order. The result is only known
+		 * to be zeroed if both halves are.
 		 */
+		if (unlikely(zeroed)) {
+			zeroed = PageZeroed(buddy);
+			__ClearPageZeroed(page);
+		}
 		if (page_is_guard(buddy)) {
 			clear_page_guard(zone, buddy, order, migratetype);
 		} else {
@@ -860,6 +871,14 @@ static inline void __free_one_page(struct page *page,
 done_merging:
 	set_page_order(page, order);
 
+	/* Zeroed pages are kept at the tail, for __rmqueue_prezeroed() */
+	if (unlikely(zeroed)) {
+		__SetPageZeroed(page);
+		list_add_tail(&page->lru,
+			&zone->free_area[order].free_list[migratetype]);
+		goto out;
+	}
+
 	/*
 	 * If this is not the largest possible page, check if the buddy
 	 * of the next-highest order is free. If it is, it's possible
@@ -885,6 +904,9 @@ static inline void __free_one_page(struct page *page,
 	list_add(&page->lru, &zone->free_area[order].free_list[migratetype]);
 out:
 	zone->free_area[order].nr_free++;
+
+	if (report)
+		page_reporting_notify_free(order);
 }
 
 /*
@@ -1135,7 +1157,8 @@ static void free_pcppages_bulk(struct zone *zone, int count,
 			if (bulkfree_pcp_prepare(page))
 				continue;
 
-			__free_one_page(page, page_to_pfn(page), zone, 0, mt);
+			__free_one_page(page, page_to_pfn(page), zone, 0, mt,
+					true);
 			trace_mm_page_pcpu_drain(page, 0, mt);
 		} while (--count && --batch_free && !list_empty(list));
 	}
@@ -1152,10 +1175,94 @@ static void free_one_page(struct zone *zone,
 		is_migrate_isolate(migratetype))) {
 		migratetype = get_pfnblock_migratetype(page, pfn);
 	}
-	__free_one_page(page, pfn, zone, order, migratetype);
+	__free_one_page(page, pfn, zone, order, migratetype, true);
+	spin_unlock(&zone->lock);
+}
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/*
+ * PMD-sized pages, as used for THPs and for the block mappings KVM
+ * builds on top of them, are cached on the pcp lists as well, so that a
+ * CPU recycling them doesn't go through the zone lock each time. Only a
+ * few of them are kept per CPU, and only if they are no larger than 2MB.
+ */
+#define PCP_THP_HIGH	4
+#define PCP_THP_BATCH	2
+
+static inline bool pcp_thp_order(unsigned int order, int migratetype)
+{
+	return order == HPAGE_PMD_ORDER && HPAGE_PMD_SIZE <= SZ_2M &&
+	       migratetype == MIGRATE_MOVABLE;
+}
+
+/*
+ * Frees count pages from the pcp THP list, oldest first. The pages have
+ * been checked by free_pages_prepare() already.
+ */
+static void free_pcp_thp_bulk(struct zone *zone, int count,
+			      struct per_cpu_pages *pcp)
+{
+	bool isolated_pageblocks;
+
+	spin_lock(&zone->lock);
+	isolated_pageblocks = has_isolate_pageblock(zone);
+
+	while (count-- && !list_empty(&pcp->thp_list)) {
+		struct page *page;
+		int mt;
+
+		page = list_last_entry(&pcp->thp_list, struct page, lru);
+		list_del(&page->lru);
+		pcp->thp_count--;
+
+		mt = get_pcppage_migratetype(page);
+		/* Pageblock could have been isolated meanwhile */
+		if (unlikely(isolated_pageblocks))
+			mt = get_pageblock_migratetype(page);
+
+		__free_one_page(page, page_to_pfn(page), zone,
+				HPAGE_PMD_ORDER, mt, true);
+		trace_mm_page_pcpu_drain(page, HPAGE_PMD_ORDER, mt);
+	}
 	spin_unlock(&zone->lock);
 }
 
+/* Must be called with interrupts disabled */
+static void free_pcp_thp(struct zone *zone, struct page *page,
+			 int migratetype)
+{
+	struct per_cpu_pages *pcp = &this_cpu_ptr(zone->pageset)->pcp;
+
+	set_pcppage_migratetype(page, migratetype);
+	list_add(&page->lru, &pcp->thp_list);
+	if (++pcp->thp_count >= PCP_THP_HIGH)
+		free_pcp_thp_bulk(zone, PCP_THP_BATCH, pcp);
+}
+
+static inline int pcp_thp_count(struct per_cpu_pages *pcp)
+{
+	return pcp->thp_count;
+}
+
+static inline void pcp_thp_init(struct per_cpu_pages *pcp)
+{
+	pcp->thp_count = 0;
+	INIT_LIST_HEAD(&pcp->thp_list);
+}
+#else
+static inline bool pcp_thp_order(unsigned int order, int migratetype)
+{
+	return false;
+}
+
+static inline void free_pcp_thp_bulk(struct zone *zone, int count,
+				     struct per_cpu_pages *pcp) { }
+static inline void free_pcp_thp(struct zone *zone, struct page *page,
+				int migratetype) { }
+static inline int pcp_thp_count(struct per_cpu_pages *pcp) { return 0; }
+static inline void pcp_thp_init(struct per_cpu_pages *pcp) { }
+#endif
+
 static void __meminit __init_single_page(struct page *page, unsigned long pfn,
 				unsigned long zone, int nid)
 {
@@ -1241,11 +1348,16 @@ static void __free_pages_ok(struct page *page, unsigned int order)
 	migratetype = get_pfnblock_migratetype(page, pfn);
 	local_irq_save(flags);
 	__count_vm_events(PGFREE, 1 << order);
-	free_one_page(page_zone(page), page, pfn, order, migratetype);
+	if (pcp_thp_order(order, migratetype))
+		free_pcp_thp(page_zone(page), page, migratetype);
+	else
+		free_one_page(page_zone(page), page, pfn, order, migratetype);
 	local_irq_restore(flags);
 }
 
-static void __init __free_pages_boot_core(struct page *page, unsigned int order)
+/* Leaves zone->managed_pages to the caller */
+static void __init __free_pages_boot_nocount(struct page *page,
+					     unsigned int order)
 {
 	unsigned int nr_pages = 1 << order;
 	struct page *p = page;
@@ -1260,11 +1372,16 @@ static void __init __free_pages_boot_core(struct page *page, unsigned int order)
 	__ClearPageReserved(p);
 	set_page_count(p, 0);
 
-	page_zone(page)->managed_pages += nr_pages;
 	set_page_refcounted(page);
 	__free_pages(page, order);
 }
 
+static void __init __free_pages_boot_core(struct page *page, unsigned int order)
+{
+	page_zone(page)->managed_pages += 1 << order;
+	__free_pages_boot_nocount(page, order);
+}
+
 #if defined(CONFIG_HAVE_ARCH_EARLY_PFN_TO_NID) || \
 	defined(CONFIG_HAVE_MEMBLOCK_NODE_MAP)
 
@@ -1407,14 +1524,14 @@ static void __init deferred_free_range(struct page *page,
 	if (nr_pages == pageblock_nr_pages &&
 	    (pfn & (pageblock_nr_pages - 1)) == 0) {
 		set_pageblock_migratetype(page, MIGRATE_MOVABLE);
-		__free_pages_boot_core(page, pageblock_order);
+		__free_pages_boot_nocount(page, pageblock_order);
 		return;
 	}
 
 	for (i = 0; i < nr_pages; i++, page++, pfn++) {
 		if ((pfn & (pageblock_nr_pages - 1)) == 0)
 			set_pageblock_migratetype(page, MIGRATE_MOVABLE);
-		__free_pages_boot_core(page, 0);
+		__free_pages_boot_nocount(page, 0);
 	}
 }
 
@@ -1428,56 +1545,33 @@ static inline void __init pgdat_init_report_one_done(void)
 		complete(&pgdat_init_all_done_comp);
 }
 
-/* Initialise remaining memory on a node */
-static int __init deferred_init_memmap(void *data)
+/*
+ * Initialise the struct pages of the memory of a node between start_pfn
+ * and end_pfn, handing them to the page allocator. Returns the number of
+ * pages freed, which are left to the caller to account to the zone.
+ */
+static unsigned long __init deferred_init_range(pg_data_t *pgdat,
+						struct zone *zone,
+						unsigned long start_pfn,
+						unsigned long end_pfn)
 {
-	pg_data_t *pgdat = data;
-	int nid = pgdat->node_id;
 	struct mminit_pfnnid_cache nid_init_state = { };
-	unsigned long start = jiffies;
-	unsigned long nr_pages = 0;
+	int nid = pgdat->node_id, zid = zone_idx(zone);
 	unsigned long walk_start, walk_end;
-	int i, zid;
-	struct zone *zone;
-	unsigned long first_init_pfn = pgdat->first_deferred_pfn;
-	const struct cpumask *cpumask = cpumask_of_node(pgdat->node_id);
-
-	if (first_init_pfn == ULONG_MAX) {
-		pgdat_init_report_one_done();
-		return 0;
-	}
-
-	/* Bind memory initialisation thread to a local node if possible */
-	if (!cpumask_empty(cpumask))
-		set_cpus_allowed_ptr(current, cpumask);
-
-	/* Sanity check boundaries */
-	BUG_ON(pgdat->first_deferred_pfn < pgdat->node_start_pfn);
-	BUG_ON(pgdat->first_deferred_pfn > pgdat_end_pfn(pgdat));
-	pgdat->first_deferred_pfn = ULONG_MAX;
-
-	/* Only the highest zone is deferred so find it */
-	for (zid = 0; zid < MAX_NR_ZONES; zid++) {
-		zone = pgdat->node_zones + zid;
-		if (first_init_pfn < zone_end_pfn(zone))
-			break;
-	}
+	unsigned long nr_pages = 0;
+	int i;
 
 	for_each_mem_pfn_range(i, nid, &walk_start, &walk_end, NULL) {
-		unsigned long pfn, end_pfn;
+		unsigned long pfn, end;
 		struct page *page = NULL;
 		struct page *free_base_page = NULL;
 		unsigned long free_base_pfn = 0;
 		int nr_to_free = 0;
 
-		end_pfn = min(walk_end, zone_end_pfn(zone));
-		pfn = first_init_pfn;
-		if (pfn < walk_start)
-			pfn = walk_start;
-		if (pfn < zone->zone_start_pfn)
-			pfn = zone->zone_start_pfn;
+		end = min(walk_end, end_pfn);
+		pfn = max(walk_start, start_pfn);
 
-		for (; pfn < end_pfn; pfn++) {
+		for (; pfn < end; pfn++) {
 			if (!pfn_valid_within(pfn))
 				goto free_range;
 
@@ -1537,15 +1631,148 @@ static int __init deferred_init_memmap(void *data)
 		/* Free the last block of pages to allocator */
 		nr_pages += nr_to_free;
 		deferred_free_range(free_base_page, free_base_pfn, nr_to_free);
+	}
+
+	return nr_pages;
+}
+
+/*
+ * The deferred memory of a node is split in this many sections at least
+ * per thread, to make spawning one worthwhile.
+ */
+#define DEFERRED_INIT_MIN_SECTIONS	1
+
+struct deferred_init_chunk {
+	pg_data_t *pgdat;
+	struct zone *zone;
+	unsigned long start_pfn;
+	unsigned long end_pfn;
+	unsigned long nr_pages;
+	atomic_t *nr_undone;
+	struct completion *done;
+};
+
+static int __init deferred_init_chunk_fn(void *data)
+{
+	struct deferred_init_chunk *chunk = data;
+
+	chunk->nr_pages = deferred_init_range(chunk->pgdat, chunk->zone,
+					      chunk->start_pfn, chunk->end_pfn);
 
-		first_init_pfn = max(end_pfn, first_init_pfn);
+	/* The threads of a node all free pages to the same zone */
+	spin_lock(&managed_page_count_lock);
+	chunk->zone->managed_pages += chunk->nr_pages;
+	spin_unlock(&managed_page_count_lock);
+
+	if (atomic_dec_and_test(chunk->nr_undone))
+		complete(chunk->done);
+	return 0;
+}
+
+/*
+ * Initialise remaining memory on a node, splitting it between as many
+ * threads as the node has CPUs. The chunks are whole sections, so that
+ * each pageblock, and each block of the largest order, is freed by a
+ * single thread.
+ */
+static int __init deferred_init_memmap(void *data)
+{
+	pg_data_t *pgdat = data;
+	int nid = pgdat->node_id;
+	unsigned long start = jiffies;
+	unsigned long nr_pages, end_pfn, chunk_pages, base_pfn;
+	struct deferred_init_chunk *chunks, chunk0;
+	DECLARE_COMPLETION_ONSTACK(done);
+	atomic_t nr_undone;
+	int i, zid, nr_chunks;
+	struct zone *zone;
+	unsigned long first_init_pfn = pgdat->first_deferred_pfn;
+	const struct cpumask *cpumask = cpumask_of_node(pgdat->node_id);
+
+	if (first_init_pfn == ULONG_MAX) {
+		pgdat_init_report_one_done();
+		return 0;
 	}
 
+	/* Bind memory initialisation thread to a local node if possible */
+	if (!cpumask_empty(cpumask))
+		set_cpus_allowed_ptr(current, cpumask);
+
+	/* Sanity check boundaries */
+	BUG_ON(pgdat->first_deferred_pfn < pgdat->node_start_pfn);
+	BUG_ON(pgdat->first_deferred_pfn > pgdat_end_pfn(pgdat));
+	pgdat->first_deferred_pfn = ULONG_MAX;
+
+	/* Only the highest zone is deferred so find it */
+	for (zid = 0; zid < MAX_NR_ZONES; zid++) {
+		zone = pgdat->node_zones + zid;
+		if (first_init_pfn < zone_end_pfn(zone))
+			break;
+	}
+	first_init_pfn = max(first_init_pfn, zone->zone_start_pfn);
+	end_pfn = zone_end_pfn(zone);
+	base_pfn = round_down(first_init_pfn, PAGES_PER_SECTION);
+
+	nr_chunks = DIV_ROUND_UP(end_pfn - base_pfn,
+				 DEFERRED_INIT_MIN_SECTIONS * PAGES_PER_SECTION);
+	nr_chunks = clamp(nr_chunks, 1, max_t(int, cpumask_weight(cpumask), 1));
+	chunks = NULL;
+	if (nr_chunks > 1)
+		chunks = kcalloc(nr_chunks, sizeof(*chunks), GFP_KERNEL);
+	if (!chunks) {
+		chunks = &chunk0;
+		nr_chunks = 1;
+	}
+
+	/*
+	 * The zone may start in the middle of a section, so the chunks are
+	 * laid out from the section below it. Only the first one can then
+	 * start unaligned, and no other thread touches that section.
+	 */
+	chunk_pages = roundup(DIV_ROUND_UP(end_pfn - base_pfn, nr_chunks),
+			      PAGES_PER_SECTION);
+	atomic_set(&nr_undone, nr_chunks);
+	for (i = 0; i < nr_chunks; i++) {
+		chunks[i].pgdat = pgdat;
+		chunks[i].zone = zone;
+		chunks[i].start_pfn = clamp(base_pfn + i * chunk_pages,
+					    first_init_pfn, end_pfn);
+		chunks[i].end_pfn = min(base_pfn + (i + 1) * chunk_pages,
+					end_pfn);
+		chunks[i].nr_undone = &nr_undone;
+		chunks[i].done = &done;
+	}
+
+	/* This thread takes the first chunk, helpers the others */
+	for (i = 1; i < nr_chunks; i++) {
+		struct task_struct *tsk;
+
+		tsk = kthread_create_on_node(deferred_init_chunk_fn,
+					     &chunks[i], nid, "pgdatinit%d.%d",
+					     nid, i);
+		if (IS_ERR(tsk)) {
+			/* Do it here, then */
+			deferred_init_chunk_fn(&chunks[i]);
+			continue;
+		}
+		if (!cpumask_empty(cpumask))
+			kthread_bind_mask(tsk, cpumask);
+		wake_up_process(tsk);
+	}
+	deferred_init_chunk_fn(&chunks[0]);
+	wait_for_completion(&done);
+
+	nr_pages = 0;
+	for (i = 0; i < nr_chunks; i++)
+		nr_pages += chunks[i].nr_pages;
+	if (chunks != &chunk0)
+		kfree(chunks);
+
 	/* Sanity check that the next zone really is unpopulated */
 	WARN_ON(++zid < MAX_NR_ZONES && populated_zone(++zone));
 
-	pr_info("node %d initialised, %lu pages in %ums\n", nid, nr_pages,
-					jiffies_to_msecs(jiffies - start));
+	pr_info("node %d initialised, %lu pages in %ums\n", nid,
+		nr_pages, jiffies_to_msecs(jiffies - start));
 
 	pgdat_init_report_one_done();
 	return 0;
@@ -1746,11 +1973,17 @@ inline void post_alloc_hook(struct page *page, unsigned int order,
 static void prep_new_page(struct page *page, unsigned int order, gfp_t gfp_flags,
 							unsigned int alloc_flags)
 {
+	bool zeroed = free_pages_prezeroed();
 	int i;
 
+	if (PageZeroed(page)) {
+		__ClearPageZeroed(page);
+		zeroed = true;
+	}
+
 	post_alloc_hook(page, order, gfp_flags);
 
-	if (!free_pages_prezeroed() && (gfp_flags & __GFP_ZERO))
+	if (!zeroed && (gfp_flags & __GFP_ZERO))
 		for (i = 0; i < (1 << order); i++)
 			clear_highpage(page + i);
 
@@ -1799,6 +2032,142 @@ struct page *__rmqueue_smallest(struct zone *zone, unsigned int order,
 	return NULL;
 }
 
+#ifdef CONFIG_PAGE_PREZERO
+static inline bool want_prezeroed_page(unsigned int order)
+{
+	return page_prezero_enabled() && order >= HPAGE_PMD_ORDER;
+}
+
+/*
+ * Same as __rmqueue_smallest(), but only takes pages zeroed by the prezero
+ * thread, which sit at the tail of the free lists. The page is returned
+ * with PG_zeroed set, for prep_new_page().
+ */
+static struct page *__rmqueue_prezeroed(struct zone *zone, unsigned int order,
+					int migratetype)
+{
+	unsigned int current_order;
+	struct free_area *area;
+	struct page *page;
+
+	for (current_order = order; current_order < MAX_ORDER; ++current_order) {
+		area = &(zone->free_area[current_order]);
+		if (list_empty(&area->free_list[migratetype]))
+			continue;
+		page = list_last_entry(&area->free_list[migratetype],
+				       struct page, lru);
+		if (!PageZeroed(page))
+			continue;
+		list_del(&page->lru);
+		rmv_page_order(page);
+		area->nr_free--;
+		expand(zone, page, order, current_order, area, migratetype);
+		set_pcppage_migratetype(page, migratetype);
+		__SetPageZeroed(page);
+		return page;
+	}
+
+	return NULL;
+}
+
+/*
+ * Takes a free page of @order that isn't zeroed yet off the movable free
+ * list of @zone, for the prezero thread to zero it and give it back with
+ * putback_zeroed_page(). Returns NULL if there is no such page, or if the
+ * zone is too low on free memory. Pages reported to the host are left
+ * alone, zeroing them would only get the host to back them again.
+ */
+struct page *isolate_unzeroed_page(struct zone *zone, unsigned int order)
+{
+	struct free_area *area = &zone->free_area[order];
+	struct page *page;
+	unsigned long flags;
+
+	spin_lock_irqsave(&zone->lock, flags);
+	page = list_first_entry_or_null(&area->free_list[MIGRATE_MOVABLE],
+					struct page, lru);
+	if (page && (PageZeroed(page) || PageReported(page) ||
+		     !__isolate_free_page(page, order)))
+		page = NULL;
+	spin_unlock_irqrestore(&zone->lock, flags);
+
+	return page;
+}
+
+void putback_zeroed_page(struct page *page, unsigned int order)
+{
+	unsigned long pfn = page_to_pfn(page);
+	unsigned long flags;
+
+	__SetPageZeroed(page);
+	local_irq_save(flags);
+	free_one_page(page_zone(page), page, pfn, order,
+		      get_pfnblock_migratetype(page, pfn));
+	local_irq_restore(flags);
+}
+#else
+static inline bool want_prezeroed_page(unsigned int order)
+{
+	return false;
+}
+
+static inline struct page *__rmqueue_prezeroed(struct zone *zone,
+				unsigned int order, int migratetype)
+{
+	return NULL;
+}
+#endif
+
+
+#ifdef CONFIG_PAGE_REPORTING
+/*
+ * Takes the page at the head of the @order, @migratetype free list of @zone
+ * off it for the page reporting worker, unless it has been reported already.
+ * putback_reported_page() gives it back. Returns NULL if there is no such
+ * page, or if the zone is too low on free memory.
+ */
+struct page *isolate_unreported_page(struct zone *zone, unsigned int order,
+				     int migratetype)
+{
+	struct free_area *area = &zone->free_area[order];
+	struct page *page;
+	unsigned long flags;
+
+	spin_lock_irqsave(&zone->lock, flags);
+	page = list_first_entry_or_null(&area->free_list[migratetype],
+					struct page, lru);
+	if (page && (PageReported(page) || !__isolate_free_page(page, order)))
+		page = NULL;
+	spin_unlock_irqrestore(&zone->lock, flags);
+
+	return page;
+}
+
+/*
+ * The page is only marked as reported if it didn't merge with its buddy on
+ * the way back, or the larger page would look reported as a whole. Reported
+ * pages are kept at the tail of the free lists, out of the way of both the
+ * allocator and isolate_unreported_page().
+ */
+void putback_reported_page(struct page *page, unsigned int order,
+			   bool reported)
+{
+	struct zone *zone = page_zone(page);
+	unsigned long pfn = page_to_pfn(page);
+	unsigned long flags;
+	int mt;
+
+	spin_lock_irqsave(&zone->lock, flags);
+	mt = get_pfnblock_migratetype(page, pfn);
+	__free_one_page(page, pfn, zone, order, mt, false);
+	if (reported && PageBuddy(page) && page_order(page) == order) {
+		list_move_tail(&page->lru,
+			       &zone->free_area[order].free_list[mt]);
+		__SetPageReported(page);
+	}
+	spin_unlock_irqrestore(&zone->lock, flags);
+}
+#endif
 
 /*
  * This array describes the order lists are fallen back to when
@@ -2323,6 +2692,8 @@ void drain_zone_pages(struct zone *zone, struct per_cpu_pages *pcp)
 		free_pcppages_bulk(zone, to_drain, pcp);
 		pcp->count -= to_drain;
 	}
+	if (pcp_thp_count(pcp))
+		free_pcp_thp_bulk(zone, pcp_thp_count(pcp), pcp);
 	local_irq_restore(flags);
 }
 #endif
@@ -2348,6 +2719,8 @@ static void drain_pages_zone(unsigned int cpu, struct zone *zone)
 		free_pcppages_bulk(zone, pcp->count, pcp);
 		pcp->count = 0;
 	}
+	if (pcp_thp_count(pcp))
+		free_pcp_thp_bulk(zone, pcp_thp_count(pcp), pcp);
 	local_irq_restore(flags);
 }
 
@@ -2449,12 +2822,12 @@ void drain_all_pages(struct zone *zone)
 
 		if (zone) {
 			pcp = per_cpu_ptr(zone->pageset, cpu);
-			if (pcp->pcp.count)
+			if (pcp->pcp.count || pcp_thp_count(&pcp->pcp))
 				has_pcps = true;
 		} else {
 			for_each_populated_zone(z) {
 				pcp = per_cpu_ptr(z->pageset, cpu);
-				if (pcp->pcp.count) {
+				if (pcp->pcp.count || pcp_thp_count(&pcp->pcp)) {
 					has_pcps = true;
 					break;
 				}
@@ -2735,8 +3108,50 @@ static struct page *rmqueue_pcplist(struct zone *preferred_zone,
 	return page;
 }
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/* Lock and remove a PMD-sized page from the per-cpu THP list */
+static struct page *rmqueue_pcp_thp(struct zone *preferred_zone,
+			struct zone *zone)
+{
+	struct per_cpu_pages *pcp;
+	struct page *page;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	pcp = &this_cpu_ptr(zone->pageset)->pcp;
+	do {
+		if (list_empty(&pcp->thp_list)) {
+			pcp->thp_count += rmqueue_bulk(zone, HPAGE_PMD_ORDER,
+					PCP_THP_BATCH, &pcp->thp_list,
+					MIGRATE_MOVABLE, false);
+			if (unlikely(list_empty(&pcp->thp_list))) {
+				page = NULL;
+				goto out;
+			}
+		}
+
+		page = list_first_entry(&pcp->thp_list, struct page, lru);
+		list_del(&page->lru);
+		pcp->thp_count--;
+	} while (check_new_pcp(page));
+
+	__count_zid_vm_events(PGALLOC, page_zonenum(page), HPAGE_PMD_NR);
+	zone_statistics(preferred_zone, zone);
+out:
+	local_irq_restore(flags);
+	return page;
+}
+#else
+static inline struct page *rmqueue_pcp_thp(struct zone *preferred_zone,
+			struct zone *zone)
+{
+	return NULL;
+}
+#endif
+
 /*
- * Allocate a page from the given zone. Use pcplists for order-0 allocations.
+ * Allocate a page from the given zone. Use pcplists for order-0 allocations,
+ * and for movable PMD-sized ones.
  */
 static inline
 struct page *rmqueue(struct zone *preferred_zone,
@@ -2746,6 +3161,7 @@ struct page *rmqueue(struct zone *preferred_zone,
 {
 	unsigned long flags;
 	struct page *page;
+	bool prezeroed;
 
 	if (likely(order == 0)) {
 		page = rmqueue_pcplist(preferred_zone, zone, order,
@@ -2753,6 +3169,17 @@ struct page *rmqueue(struct zone *preferred_zone,
 		goto out;
 	}
 
+	/*
+	 * Pages zeroed in the background are worth a trip through the zone
+	 * lock, they are never cached on the pcp lists.
+	 */
+	prezeroed = (gfp_flags & __GFP_ZERO) && want_prezeroed_page(order);
+
+	if (pcp_thp_order(order, migratetype) && !prezeroed) {
+		page = rmqueue_pcp_thp(preferred_zone, zone);
+		goto out;
+	}
+
 	/*
 	 * We most definitely don't want callers attempting to
 	 * allocate greater than order-1 page units with __GFP_NOFAIL.
@@ -2762,7 +3189,9 @@ struct page *rmqueue(struct zone *preferred_zone,
 
 	do {
 		page = NULL;
-		if (alloc_flags & ALLOC_HARDER) {
+		if (prezeroed)
+			page = __rmqueue_prezeroed(zone, order, migratetype);
+		if (!page && (alloc_flags & ALLOC_HARDER)) {
 			page = __rmqueue_smallest(zone, order, MIGRATE_HIGHATOMIC);
 			if (page)
 				trace_mm_page_alloc_zone_locked(page, order, migratetype);
@@ -5434,6 +5863,7 @@ static void pageset_init(struct per_cpu_pageset *p)
 	pcp->count = 0;
 	for (migratetype = 0; migratetype < MIGRATE_PCPTYPES; migratetype++)
 		INIT_LIST_HEAD(&pcp->lists[migratetype]);
+	pcp_thp_init(pcp);
 }
 
 static void setup_pageset(struct per_cpu_pageset *p, unsigned long batch)
@@ -63,7 +63,10 @@ static bool page_idle_clear_pte_refs_one(struct page *page,
 
 	while (page_vma_mapped_walk(&pvmw)) {
 		addr = pvmw.address;
-		if (pvmw.pte) {
+		if (pvmw.pte && pmd_shared_table(*pvmw.pmd)) {
+			/* Other mms use these ptes too, leave them alone */
+			referenced = true;
+		} else if (pvmw.pte) {
 			referenced = ptep_clear_young_notify(vma, addr,
 					pvmw.pte);
 		} else if (IS_ENABLED(CONFIG_TRANSPARENT_HUGEPAGE)) {
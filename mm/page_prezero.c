@@ -0,0 +1,114 @@
+/*
+ * Background zeroing of free huge pages
+ *
+ * Copyright (C) 2017 - Linaro Ltd
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/kernel.h>
+#include <linux/mm.h>
+#include <linux/mmzone.h>
+#include <linux/highmem.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
+#include <linux/sched.h>
+#include <linux/page_prezero.h>
+
+#include <uapi/linux/sched/types.h>
+
+#include "internal.h"
+
+/*
+ * A huge page fault spends most of its time clearing the page it got.
+ * Instead, kprezerod takes free pages of HPAGE_PMD_ORDER and above off
+ * the movable free lists, zeroes them and puts them back at the tail of
+ * the lists with PG_zeroed set. __GFP_ZERO allocations of those orders
+ * look for such pages first, and prep_new_page() doesn't clear them.
+ *
+ * The information is lost as soon as a zeroed page is split or merged
+ * with a page that isn't, it is only a hint. The thread runs as
+ * SCHED_IDLE, so it only zeroes pages when there is nothing else to do,
+ * and rescans the free lists every PREZERO_SCAN_INTERVAL.
+ */
+
+#define PREZERO_SCAN_INTERVAL	(10 * HZ)
+
+DEFINE_STATIC_KEY_FALSE(page_prezero_key);
+
+static bool want_page_prezero __initdata;
+
+static int __init early_page_prezero_param(char *buf)
+{
+	if (!buf)
+		return -EINVAL;
+	return strtobool(buf, &want_page_prezero);
+}
+early_param("page_prezero", early_page_prezero_param);
+
+static void prezero_zone(struct zone *zone)
+{
+	int order, i;
+
+	for (order = MAX_ORDER - 1; order >= HPAGE_PMD_ORDER; order--) {
+		struct page *page;
+
+		while (!kthread_should_stop() && !freezing(current)) {
+			page = isolate_unzeroed_page(zone, order);
+			if (!page)
+				break;
+
+			for (i = 0; i < (1 << order); i++) {
+				clear_highpage(page + i);
+				cond_resched();
+			}
+
+			putback_zeroed_page(page, order);
+		}
+	}
+}
+
+static int kprezerod(void *unused)
+{
+	struct sched_param param = { .sched_priority = 0 };
+	struct zone *zone;
+
+	sched_setscheduler_nocheck(current, SCHED_IDLE, &param);
+	set_freezable();
+
+	while (!kthread_should_stop()) {
+		for_each_populated_zone(zone)
+			prezero_zone(zone);
+
+		try_to_freeze();
+		schedule_timeout_interruptible(PREZERO_SCAN_INTERVAL);
+	}
+
+	return 0;
+}
+
+static int __init page_prezero_init(void)
+{
+	struct task_struct *task;
+
+	if (!want_page_prezero)
+		return 0;
+
+	/* Both expect free pages to be left untouched */
+	if (debug_pagealloc_enabled() || page_poisoning_enabled()) {
+		pr_info("page_prezero: disabled by page poisoning or debug_pagealloc\n");
+		return 0;
+	}
+
+	task = kthread_run(kprezerod, NULL, "kprezerod");
+	if (IS_ERR(task)) {
+		pr_err("page_prezero: failed to start kprezerod\n");
+		return PTR_ERR(task);
+	}
+
+	static_branch_enable(&page_prezero_key);
+	return 0;
+}
+late_initcall(page_prezero_init);
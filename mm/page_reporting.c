@@ -0,0 +1,202 @@
+/*
+ * Free page reporting
+ *
+ * Copyright (C) 2017 - Linaro Ltd
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/kernel.h>
+#include <linux/mm.h>
+#include <linux/mmzone.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
+#include <linux/slab.h>
+#include <linux/export.h>
+#include <linux/page_reporting.h>
+
+#include "internal.h"
+
+/*
+ * A balloon driver can tell the host about the memory the guest doesn't
+ * use without inflating the balloon, so that the host can discard it until
+ * the guest touches it again.
+ *
+ * Each time a page of PAGE_REPORTING_MIN_ORDER or above goes back to the
+ * free lists, the page allocator asks for a reporting pass, which runs
+ * PAGE_REPORTING_DELAY later so that frees are reported in bulk. The pass
+ * takes the pages that haven't been reported yet off the head of the free
+ * lists, PAGE_REPORTING_CAPACITY at a time, hands them to the driver and puts
+ * them back at the tail of the lists with PG_reported set. Nothing can
+ * allocate a page while it is being reported.
+ *
+ * The flag is only a hint on free pages, lost as soon as a page is
+ * allocated or merged with its buddy. The driver reports the merged page
+ * again on a later pass.
+ */
+
+#define PAGE_REPORTING_DELAY	(2 * HZ)
+
+enum {
+	PAGE_REPORTING_IDLE,
+	PAGE_REPORTING_REQUESTED,
+	PAGE_REPORTING_ACTIVE,
+};
+
+DEFINE_STATIC_KEY_FALSE(page_reporting_key);
+
+static struct page_reporting_dev_info __rcu *pr_dev_info;
+static DEFINE_MUTEX(page_reporting_mutex);
+
+void __page_reporting_notify(void)
+{
+	struct page_reporting_dev_info *prdev;
+
+	rcu_read_lock();
+	prdev = rcu_dereference(pr_dev_info);
+
+	/* A pass that is running already gets to go again */
+	if (prdev && atomic_read(&prdev->state) != PAGE_REPORTING_REQUESTED &&
+	    atomic_xchg(&prdev->state, PAGE_REPORTING_REQUESTED) ==
+	    PAGE_REPORTING_IDLE)
+		schedule_delayed_work(&prdev->work, PAGE_REPORTING_DELAY);
+	rcu_read_unlock();
+}
+
+static int page_reporting_cycle(struct page_reporting_dev_info *prdev,
+				struct zone *zone, unsigned int order,
+				int migratetype, struct scatterlist *sg)
+{
+	unsigned int i, nents;
+	struct page *page;
+	int err = 0;
+
+	do {
+		nents = 0;
+		while (nents < PAGE_REPORTING_CAPACITY) {
+			page = isolate_unreported_page(zone, order,
+						       migratetype);
+			if (!page)
+				break;
+			sg_set_page(&sg[nents++], page, PAGE_SIZE << order, 0);
+		}
+
+		if (!nents)
+			break;
+
+		sg_mark_end(&sg[nents - 1]);
+		err = prdev->report(prdev, sg, nents);
+
+		for (i = 0; i < nents; i++)
+			putback_reported_page(sg_page(&sg[i]), order, !err);
+		sg_init_table(sg, PAGE_REPORTING_CAPACITY);
+
+		cond_resched();
+	} while (!err && nents == PAGE_REPORTING_CAPACITY);
+
+	return err;
+}
+
+static void page_reporting_process(struct work_struct *work)
+{
+	struct page_reporting_dev_info *prdev =
+		container_of(to_delayed_work(work),
+			     struct page_reporting_dev_info, work);
+	struct scatterlist *sg;
+	struct zone *zone;
+	unsigned int order;
+	int mt, err = -ENOMEM;
+
+	atomic_set(&prdev->state, PAGE_REPORTING_ACTIVE);
+
+	sg = kmalloc_array(PAGE_REPORTING_CAPACITY, sizeof(*sg), GFP_KERNEL);
+	if (!sg)
+		goto out;
+	sg_init_table(sg, PAGE_REPORTING_CAPACITY);
+
+	/*
+	 * Lowest order first: a page that merged with its buddy on the way
+	 * back shows up on a list that is still to be walked.
+	 */
+	err = 0;
+	for_each_populated_zone(zone) {
+		for (order = PAGE_REPORTING_MIN_ORDER; order < MAX_ORDER;
+		     order++) {
+			for (mt = 0; mt < MIGRATE_TYPES; mt++) {
+				if (is_migrate_isolate(mt))
+					continue;
+
+				err = page_reporting_cycle(prdev, zone, order,
+							   mt, sg);
+				if (err)
+					goto out_free;
+			}
+		}
+	}
+
+out_free:
+	kfree(sg);
+out:
+	/* Pages freed meanwhile get another pass, an error waits for them */
+	if (err)
+		atomic_set(&prdev->state, PAGE_REPORTING_IDLE);
+	else if (atomic_cmpxchg(&prdev->state, PAGE_REPORTING_ACTIVE,
+				PAGE_REPORTING_IDLE) != PAGE_REPORTING_ACTIVE)
+		schedule_delayed_work(&prdev->work, PAGE_REPORTING_DELAY);
+}
+
+/**
+ * page_reporting_register - start reporting free pages to a device
+ * @prdev:	The device, with its report callback set
+ *
+ * Only one device can be registered at a time. Reporting is refused with
+ * page poisoning or debug_pagealloc, which expect free pages to keep their
+ * contents.
+ */
+int page_reporting_register(struct page_reporting_dev_info *prdev)
+{
+	int err = 0;
+
+	if (debug_pagealloc_enabled() || page_poisoning_enabled())
+		return -EOPNOTSUPP;
+
+	mutex_lock(&page_reporting_mutex);
+	if (rcu_access_pointer(pr_dev_info)) {
+		err = -EBUSY;
+		goto out;
+	}
+
+	atomic_set(&prdev->state, PAGE_REPORTING_IDLE);
+	INIT_DELAYED_WORK(&prdev->work, page_reporting_process);
+	rcu_assign_pointer(pr_dev_info, prdev);
+	static_branch_enable(&page_reporting_key);
+
+	/* Report what is free already */
+	__page_reporting_notify();
+out:
+	mutex_unlock(&page_reporting_mutex);
+	return err;
+}
+EXPORT_SYMBOL_GPL(page_reporting_register);
+
+/**
+ * page_reporting_unregister - stop reporting free pages to a device
+ * @prdev:	The device given to page_reporting_register()
+ *
+ * No report is in progress for @prdev once this returns. Calling it for a
+ * device that isn't registered is harmless.
+ */
+void page_reporting_unregister(struct page_reporting_dev_info *prdev)
+{
+	mutex_lock(&page_reporting_mutex);
+	if (rcu_access_pointer(pr_dev_info) == prdev) {
+		static_branch_disable(&page_reporting_key);
+		RCU_INIT_POINTER(pr_dev_info, NULL);
+		synchronize_rcu();
+		cancel_delayed_work_sync(&prdev->work);
+	}
+	mutex_unlock(&page_reporting_mutex);
+}
+EXPORT_SYMBOL_GPL(page_reporting_unregister);
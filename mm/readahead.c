@@ -19,6 +19,7 @@
 #include <linux/syscalls.h>
 #include <linux/file.h>
 #include <linux/mm_inline.h>
+#include <linux/cpuset.h>
 
 #include "internal.h"
 
@@ -147,6 +148,43 @@ static int read_pages(struct address_space *mapping, struct file *filp,
  *
  * Returns the number of pages requested, or the maximum amount of I/O allowed.
  */
+/*
+ * Readahead pages are allocated in physically contiguous batches where
+ * that is cheap, so that the bios built from consecutive pages need one
+ * segment per batch rather than one per page, and the page allocator is
+ * entered once per batch.
+ */
+#define RA_BATCH_ORDER	PAGE_ALLOC_COSTLY_ORDER
+
+struct ra_batch {
+	struct page *page;
+	unsigned int nr;
+};
+
+static struct page *ra_alloc_page(struct ra_batch *batch, gfp_t gfp_mask,
+				  unsigned long wanted)
+{
+	if (!batch->nr && wanted >= (1UL << RA_BATCH_ORDER) &&
+	    !cpuset_do_page_mem_spread()) {
+		/* Don't stall in compaction for it, order-0 will do */
+		struct page *page = alloc_pages(gfp_mask & ~__GFP_DIRECT_RECLAIM,
+						RA_BATCH_ORDER);
+
+		if (page) {
+			split_page(page, RA_BATCH_ORDER);
+			batch->page = page;
+			batch->nr = 1 << RA_BATCH_ORDER;
+		}
+	}
+
+	if (batch->nr) {
+		batch->nr--;
+		return batch->page++;
+	}
+
+	return __page_cache_alloc(gfp_mask);
+}
+
 int __do_page_cache_readahead(struct address_space *mapping, struct file *filp,
 			pgoff_t offset, unsigned long nr_to_read,
 			unsigned long lookahead_size)
@@ -155,6 +193,7 @@ int __do_page_cache_readahead(struct address_space *mapping, struct file *filp,
 	struct page *page;
 	unsigned long end_index;	/* The last page we want to read */
 	LIST_HEAD(page_pool);
+	struct ra_batch batch = { NULL, 0 };
 	int page_idx;
 	int ret = 0;
 	loff_t isize = i_size_read(inode);
@@ -180,7 +219,7 @@ int __do_page_cache_readahead(struct address_space *mapping, struct file *filp,
 		if (page && !radix_tree_exceptional_entry(page))
 			continue;
 
-		page = __page_cache_alloc(gfp_mask);
+		page = ra_alloc_page(&batch, gfp_mask, nr_to_read - page_idx);
 		if (!page)
 			break;
 		page->index = page_offset;
@@ -190,6 +229,10 @@ int __do_page_cache_readahead(struct address_space *mapping, struct file *filp,
 		ret++;
 	}
 
+	/* Free what is left of the last batch */
+	while (batch.nr--)
+		put_page(batch.page++);
+
 	/*
 	 * Now start the IO.  We ignore I/O errors - if the page is not
 	 * uptodate then the caller will launch readpage again, and
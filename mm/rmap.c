@@ -724,6 +724,85 @@ struct page_referenced_arg {
 /*
  * arg: page_referenced_arg will be passed
  */
+/*
+ * Reclaim walks the rmap of each page it looks at, to find out whether it
+ * was accessed. When a young pte is found, the ptes around it are likely
+ * to be young too: look at them while the page table is at hand, and
+ * activate the inactive pages they map if they were accessed, so that
+ * reclaim doesn't have to walk the rmap of those pages to find out. The
+ * secondary MMUs are asked about all of them at once, which saves a walk
+ * of KVM's stage 2 and shadow stage 2 tables per page.
+ *
+ * Only the pages that are on an inactive list are aged: the others are
+ * either being reclaimed already, or will be looked at by the active
+ * list scan, which needs their young bitflags.
+ */
+#define LOOKAROUND_PAGES	BITS_PER_LONG
+
+static struct page *lookaround_page(struct vm_area_struct *vma,
+				    unsigned long addr, pte_t pte)
+{
+	struct page *page;
+
+	if (!pte_present(pte))
+		return NULL;
+
+	page = vm_normal_page(vma, addr, pte);
+	if (!page || !PageLRU(page) || PageActive(page) ||
+	    PageUnevictable(page))
+		return NULL;
+
+	return page;
+}
+
+static void page_referenced_lookaround(struct vm_area_struct *vma,
+				       unsigned long address, pte_t *ptep)
+{
+	unsigned long start, end, addr, young = 0;
+	struct page *page;
+	pte_t *pte;
+	int i;
+
+	if (vma->vm_flags & (VM_SEQ_READ | VM_RAND_READ))
+		return;
+
+	start = max(address & PMD_MASK, vma->vm_start);
+	end = pmd_addr_end(address, vma->vm_end);
+	if (address - start > LOOKAROUND_PAGES / 2 * PAGE_SIZE)
+		start = address - LOOKAROUND_PAGES / 2 * PAGE_SIZE;
+	end = min(end, start + LOOKAROUND_PAGES * PAGE_SIZE);
+
+	pte = ptep - ((address - start) >> PAGE_SHIFT);
+	for (i = 0, addr = start; addr != end; i++, addr += PAGE_SIZE) {
+		if (addr == address)
+			continue;
+
+		page = lookaround_page(vma, addr, pte[i]);
+		if (!page)
+			continue;
+
+		if (ptep_test_and_clear_young(vma, addr, pte + i)) {
+			clear_page_idle(page);
+			activate_page(page);
+		} else {
+			__set_bit(i, &young);
+		}
+	}
+
+	if (!young || !mmu_notifier_clear_young_bitmap(vma->vm_mm, start, end,
+						       &young))
+		return;
+
+	for_each_set_bit(i, &young, LOOKAROUND_PAGES) {
+		addr = start + i * PAGE_SIZE;
+		page = lookaround_page(vma, addr, pte[i]);
+		if (page) {
+			clear_page_idle(page);
+			activate_page(page);
+		}
+	}
+}
+
 static bool page_referenced_one(struct page *page, struct vm_area_struct *vma,
 			unsigned long address, void *arg)
 {
@@ -734,6 +813,7 @@ static bool page_referenced_one(struct page *page, struct vm_area_struct *vma,
 		.address = address,
 	};
 	int referenced = 0;
+	bool lookaround = false;
 
 	while (page_vma_mapped_walk(&pvmw)) {
 		address = pvmw.address;
@@ -744,9 +824,18 @@ static bool page_referenced_one(struct page *page, struct vm_area_struct *vma,
 			return false; /* To break the loop */
 		}
 
-		if (pvmw.pte) {
+		if (pvmw.pte && pmd_shared_table(*pvmw.pmd)) {
+			/* Other mms use these ptes too, leave them alone */
+			referenced++;
+		} else if (pvmw.pte) {
 			if (ptep_clear_flush_young_notify(vma, address,
 						pvmw.pte)) {
+				/* Once for all the subpages of a THP */
+				if (!lookaround) {
+					page_referenced_lookaround(vma, address,
+								   pvmw.pte);
+					lookaround = true;
+				}
 				/*
 				 * Don't treat a reference through
 				 * a sequentially read mapping as such.
@@ -1340,6 +1429,13 @@ static bool try_to_unmap_one(struct page *page, struct vm_area_struct *vma,
 		/* Unexpected PMD-mapped THP? */
 		VM_BUG_ON_PAGE(!pvmw.pte, page);
 
+		/* The pte must stay until the table is unshared */
+		if (pmd_shared_table(*pvmw.pmd)) {
+			ret = false;
+			page_vma_mapped_walk_done(&pvmw);
+			break;
+		}
+
 		subpage = page - page_to_pfn(page) + pte_pfn(*pvmw.pte);
 		address = pvmw.address;
 
@@ -1625,6 +1625,20 @@ static int shmem_getpage_gfp(struct inode *inode, pgoff_t index,
 		put_page(page);
 		page = NULL;
 	}
+
+	/*
+	 * With minor fault tracking, userland maps the pages that are
+	 * already in the page cache, or in swap, by itself.
+	 */
+	if ((page || swap.val) && vma && userfaultfd_minor(vma)) {
+		if (page) {
+			unlock_page(page);
+			put_page(page);
+		}
+		*fault_type = handle_userfault(vmf, VM_UFFD_MINOR);
+		return 0;
+	}
+
 	if (page || (sgp == SGP_READ && !swap.val)) {
 		*pagep = page;
 		return 0;
@@ -2312,6 +2326,60 @@ int shmem_mcopy_atomic_pte(struct mm_struct *dst_mm,
 	goto out;
 }
 
+/*
+ * Maps the page cache page at @dst_addr of a shmem vma registered for
+ * minor faults, which userland populated through another mapping.
+ */
+int shmem_mcontinue_atomic_pte(struct mm_struct *dst_mm,
+			       pmd_t *dst_pmd,
+			       struct vm_area_struct *dst_vma,
+			       unsigned long dst_addr)
+{
+	struct inode *inode = file_inode(dst_vma->vm_file);
+	pgoff_t pgoff = linear_page_index(dst_vma, dst_addr);
+	spinlock_t *ptl;
+	struct page *page;
+	pte_t _dst_pte, *dst_pte;
+	int ret;
+
+	ret = shmem_getpage(inode, pgoff, &page, SGP_READ);
+	if (ret)
+		goto out;
+	ret = -EFAULT;
+	if (!page)
+		goto out;
+
+	/* a private mapping gets its own copy on the next write fault */
+	_dst_pte = mk_pte(page, dst_vma->vm_page_prot);
+	if ((dst_vma->vm_flags & (VM_SHARED | VM_WRITE)) ==
+	    (VM_SHARED | VM_WRITE))
+		_dst_pte = pte_mkwrite(pte_mkdirty(_dst_pte));
+
+	dst_pte = pte_offset_map_lock(dst_mm, dst_pmd, dst_addr, &ptl);
+	if (unlikely(((loff_t)pgoff << PAGE_SHIFT) >= i_size_read(inode)))
+		goto out_release_unlock;
+	ret = -EEXIST;
+	if (!pte_none(*dst_pte))
+		goto out_release_unlock;
+
+	inc_mm_counter(dst_mm, mm_counter_file(page));
+	page_add_file_rmap(page, false);
+	set_pte_at(dst_mm, dst_addr, dst_pte, _dst_pte);
+
+	/* No need to invalidate - it was non-present before */
+	update_mmu_cache(dst_vma, dst_addr, dst_pte);
+	pte_unmap_unlock(dst_pte, ptl);
+	unlock_page(page);
+	ret = 0;
+out:
+	return ret;
+out_release_unlock:
+	pte_unmap_unlock(dst_pte, ptl);
+	unlock_page(page);
+	put_page(page);
+	goto out;
+}
+
 #ifdef CONFIG_TMPFS
 static const struct inode_operations shmem_symlink_inode_operations;
 static const struct inode_operations shmem_short_symlink_operations;
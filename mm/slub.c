@@ -2273,6 +2273,254 @@ static inline void flush_slab(struct kmem_cache *s, struct kmem_cache_cpu *c)
 	c->freelist = NULL;
 }
 
+/********************************************************************
+ *			Sheaves
+ *******************************************************************/
+
+/*
+ * A sheaf is an optional per cpu array of free objects, enabled per cache
+ * with the sheaf_capacity sysfs attribute, or for all of them with
+ * slub_sheaf_capacity=. Objects freed on a cpu go to its sheaf, whichever
+ * cpu allocated them, and allocations on that cpu take them back first,
+ * without touching the slab pages. Once the sheaf is full, its older half
+ * is freed in bulk, with a detached freelist per slab page: a stream of
+ * remote frees costs a few __slab_free() cmpxchgs and list_lock round
+ * trips per sheaf flush, instead of one per object.
+ *
+ * Sheaves are only accessed with interrupts or preemption disabled, which
+ * is what set_sheaf_capacity() waits for before flushing and freeing them. Debug,
+ * KASAN and memcg caches don't have any, and only the objects of the local
+ * node go to a sheaf.
+ */
+#define SLUB_MAX_SHEAF_CAPACITY	128
+
+static int slub_sheaf_capacity;
+static bool slub_sheaves_ready;
+static DEFINE_MUTEX(slub_sheaf_mutex);
+
+static void sheaf_free_objects(struct kmem_cache *s, void **p, size_t size);
+
+static inline bool sheaves_allowed(struct kmem_cache *s)
+{
+	return !kmem_cache_debug(s) && !(s->flags & SLAB_KASAN) &&
+		is_root_cache(s);
+}
+
+static inline bool sheaf_node_match(struct page *page)
+{
+	return !IS_ENABLED(CONFIG_NUMA) || page_to_nid(page) == numa_mem_id();
+}
+
+static void *alloc_from_sheaf(struct kmem_cache *s, int node)
+{
+	struct slub_sheaf __percpu *pcs;
+	struct slub_sheaf *sheaf;
+	unsigned long flags;
+	void *object = NULL;
+
+	if (!READ_ONCE(s->cpu_sheaf) ||
+	    (node != NUMA_NO_NODE && node != numa_mem_id()))
+		return NULL;
+
+	local_irq_save(flags);
+	pcs = READ_ONCE(s->cpu_sheaf);
+	if (likely(pcs)) {
+		sheaf = this_cpu_ptr(pcs);
+		if (sheaf->count)
+			object = sheaf->objects[--sheaf->count];
+	}
+	local_irq_restore(flags);
+
+	if (object)
+		stat(s, ALLOC_SHEAF);
+	return object;
+}
+
+/* Called with interrupts disabled, fills @p from the start */
+static size_t alloc_bulk_from_sheaf(struct kmem_cache *s, size_t size,
+				    void **p)
+{
+	struct slub_sheaf __percpu *pcs = READ_ONCE(s->cpu_sheaf);
+	struct slub_sheaf *sheaf;
+	size_t i = 0;
+
+	if (!pcs)
+		return 0;
+
+	sheaf = this_cpu_ptr(pcs);
+	while (i < size && sheaf->count) {
+		p[i++] = sheaf->objects[--sheaf->count];
+		stat(s, ALLOC_SHEAF);
+	}
+
+	return i;
+}
+
+/*
+ * Frees the @nr oldest objects of @sheaf, keeping the cache hot ones. Called
+ * with interrupts disabled, or on a sheaf nobody can access anymore.
+ */
+static void sheaf_flush(struct kmem_cache *s, struct slub_sheaf *sheaf,
+			unsigned int nr)
+{
+	sheaf_free_objects(s, sheaf->objects, nr);
+	sheaf->count -= nr;
+	memmove(sheaf->objects, sheaf->objects + nr,
+		sheaf->count * sizeof(void *));
+	stat(s, SHEAF_FLUSH);
+}
+
+static bool free_to_sheaf(struct kmem_cache *s, struct page *page,
+			  void *object)
+{
+	struct slub_sheaf __percpu *pcs;
+	struct slub_sheaf *sheaf;
+	unsigned long flags;
+
+	if (!READ_ONCE(s->cpu_sheaf) || !sheaf_node_match(page))
+		return false;
+
+	local_irq_save(flags);
+	pcs = READ_ONCE(s->cpu_sheaf);
+	if (unlikely(!pcs)) {
+		local_irq_restore(flags);
+		return false;
+	}
+
+	sheaf = this_cpu_ptr(pcs);
+	if (unlikely(sheaf->count == sheaf->capacity))
+		sheaf_flush(s, sheaf, DIV_ROUND_UP(sheaf->count, 2));
+	sheaf->objects[sheaf->count++] = object;
+	local_irq_restore(flags);
+
+	stat(s, FREE_SHEAF);
+	return true;
+}
+
+/*
+ * Moves objects from the end of @p to the local sheaf while it has room,
+ * returns the number of objects left to free.
+ */
+static size_t free_bulk_to_sheaf(struct kmem_cache *s, size_t size, void **p)
+{
+	struct slub_sheaf __percpu *pcs;
+	struct slub_sheaf *sheaf;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	pcs = READ_ONCE(s->cpu_sheaf);
+	if (unlikely(!pcs))
+		goto out;
+
+	sheaf = this_cpu_ptr(pcs);
+	while (size && sheaf->count < sheaf->capacity) {
+		void *object = p[size - 1];
+		struct page *page;
+
+		if (unlikely(!object)) {
+			size--;
+			continue;
+		}
+
+		/* memcg objects belong to another cache */
+		page = virt_to_head_page(object);
+		if (unlikely(!PageSlab(page) || page->slab_cache != s ||
+			     !sheaf_node_match(page)))
+			break;
+
+		slab_free_freelist_hook(s, object, NULL);
+		sheaf->objects[sheaf->count++] = object;
+		size--;
+		stat(s, FREE_SHEAF);
+	}
+out:
+	local_irq_restore(flags);
+	return size;
+}
+
+/* Called with interrupts disabled, or for a dead cpu */
+static void flush_cpu_sheaf(struct kmem_cache *s, int cpu)
+{
+	struct slub_sheaf __percpu *pcs = READ_ONCE(s->cpu_sheaf);
+	struct slub_sheaf *sheaf;
+
+	if (!pcs)
+		return;
+
+	sheaf = per_cpu_ptr(pcs, cpu);
+	if (sheaf->count)
+		sheaf_flush(s, sheaf, sheaf->count);
+}
+
+/* Called with preemption disabled */
+static bool has_cpu_sheaf(struct kmem_cache *s, int cpu)
+{
+	struct slub_sheaf __percpu *pcs = READ_ONCE(s->cpu_sheaf);
+
+	return pcs && per_cpu_ptr(pcs, cpu)->count;
+}
+
+/*
+ * Replaces the sheaves of @s with sheaves of @capacity objects, none if 0.
+ * The sysfs attribute may be propagated to memcg caches under slab_mutex,
+ * the sheaves have their own.
+ */
+static int set_sheaf_capacity(struct kmem_cache *s, unsigned int capacity)
+{
+	struct slub_sheaf __percpu *old, *new = NULL;
+	int cpu;
+
+	if (capacity > SLUB_MAX_SHEAF_CAPACITY ||
+	    (capacity && !sheaves_allowed(s)))
+		return -EINVAL;
+
+	if (capacity) {
+		new = __alloc_percpu(sizeof(struct slub_sheaf) +
+				     capacity * sizeof(void *),
+				     __alignof__(struct slub_sheaf));
+		if (!new)
+			return -ENOMEM;
+
+		for_each_possible_cpu(cpu)
+			per_cpu_ptr(new, cpu)->capacity = capacity;
+	}
+
+	mutex_lock(&slub_sheaf_mutex);
+	old = s->cpu_sheaf;
+	if (old) {
+		WRITE_ONCE(s->cpu_sheaf, NULL);
+		synchronize_sched();
+
+		for_each_possible_cpu(cpu) {
+			struct slub_sheaf *sheaf = per_cpu_ptr(old, cpu);
+
+			if (sheaf->count)
+				sheaf_flush(s, sheaf, sheaf->count);
+		}
+		free_percpu(old);
+	}
+
+	/* Publish the capacities along with the sheaves */
+	smp_wmb();
+	WRITE_ONCE(s->cpu_sheaf, new);
+	mutex_unlock(&slub_sheaf_mutex);
+	return 0;
+}
+
+static unsigned int sheaf_capacity(struct kmem_cache *s)
+{
+	struct slub_sheaf __percpu *pcs;
+	unsigned int capacity = 0;
+
+	mutex_lock(&slub_sheaf_mutex);
+	pcs = s->cpu_sheaf;
+	if (pcs)
+		capacity = per_cpu_ptr(pcs, 0)->capacity;
+	mutex_unlock(&slub_sheaf_mutex);
+
+	return capacity;
+}
+
 /*
  * Flush cpu slab.
  *
@@ -2282,6 +2530,9 @@ static inline void __flush_cpu_slab(struct kmem_cache *s, int cpu)
 {
 	struct kmem_cache_cpu *c = per_cpu_ptr(s->cpu_slab, cpu);
 
+	/* The objects may go to the cpu slab, flush the sheaf first */
+	flush_cpu_sheaf(s, cpu);
+
 	if (likely(c)) {
 		if (c->page)
 			flush_slab(s, c);
@@ -2302,7 +2553,7 @@ static bool has_cpu_slab(int cpu, void *info)
 	struct kmem_cache *s = info;
 	struct kmem_cache_cpu *c = per_cpu_ptr(s->cpu_slab, cpu);
 
-	return c->page || c->partial;
+	return c->page || c->partial || has_cpu_sheaf(s, cpu);
 }
 
 static void flush_all(struct kmem_cache *s)
@@ -2644,6 +2895,10 @@ static __always_inline void *slab_alloc_node(struct kmem_cache *s,
 	s = slab_pre_alloc_hook(s, gfpflags);
 	if (!s)
 		return NULL;
+
+	object = alloc_from_sheaf(s, node);
+	if (object)
+		goto out;
 redo:
 	/*
 	 * Must read kmem_cache cpu data via this cpu ptr. Preemption is
@@ -2712,6 +2967,7 @@ static __always_inline void *slab_alloc_node(struct kmem_cache *s,
 		stat(s, ALLOC_FASTPATH);
 	}
 
+out:
 	if (unlikely(gfpflags & __GFP_ZERO) && object)
 		memset(object, 0, s->object_size);
 
@@ -2965,6 +3221,8 @@ static __always_inline void slab_free(struct kmem_cache *s, struct page *page,
 	 */
 	if (s->flags & SLAB_KASAN && !(s->flags & SLAB_TYPESAFE_BY_RCU))
 		return;
+	if (!tail && free_to_sheaf(s, page, head))
+		return;
 	do_slab_free(s, page, head, tail, cnt, addr);
 }
 
@@ -3076,12 +3334,36 @@ int build_detached_freelist(struct kmem_cache *s, size_t size,
 	return first_skipped_index;
 }
 
+/*
+ * Frees objects that went through slab_free_hook() already, from a sheaf.
+ * Unlike kmem_cache_free_bulk(), this doesn't need interrupts enabled.
+ */
+static void sheaf_free_objects(struct kmem_cache *s, void **p, size_t size)
+{
+	do {
+		struct detached_freelist df;
+
+		size = build_detached_freelist(s, size, p, &df);
+		if (!df.page)
+			continue;
+
+		do_slab_free(df.s, df.page, df.freelist, df.tail, df.cnt,
+			     _RET_IP_);
+	} while (likely(size));
+}
+
 /* Note that interrupts must be enabled when calling this function. */
 void kmem_cache_free_bulk(struct kmem_cache *s, size_t size, void **p)
 {
 	if (WARN_ON(!size))
 		return;
 
+	if (s && READ_ONCE(s->cpu_sheaf)) {
+		size = free_bulk_to_sheaf(s, size, p);
+		if (!size)
+			return;
+	}
+
 	do {
 		struct detached_freelist df;
 
@@ -3111,9 +3393,10 @@ int kmem_cache_alloc_bulk(struct kmem_cache *s, gfp_t flags, size_t size,
 	 * handlers invoking normal fastpath.
 	 */
 	local_irq_disable();
+	i = alloc_bulk_from_sheaf(s, size, p);
 	c = this_cpu_ptr(s->cpu_slab);
 
-	for (i = 0; i < size; i++) {
+	for (; i < size; i++) {
 		void *object = c->freelist;
 
 		if (unlikely(!object)) {
@@ -3372,6 +3655,7 @@ static void free_kmem_cache_nodes(struct kmem_cache *s)
 void __kmem_cache_release(struct kmem_cache *s)
 {
 	cache_random_seq_destroy(s);
+	free_percpu(s->cpu_sheaf);
 	free_percpu(s->cpu_slab);
 	free_kmem_cache_nodes(s);
 }
@@ -3609,8 +3893,13 @@ static int kmem_cache_open(struct kmem_cache *s, unsigned long flags)
 	if (!init_kmem_cache_nodes(s))
 		goto error;
 
-	if (alloc_kmem_cache_cpus(s))
+	if (alloc_kmem_cache_cpus(s)) {
+		/* The boot caches get theirs in kmem_cache_init_late() */
+		if (slub_sheaves_ready && slub_sheaf_capacity &&
+		    sheaves_allowed(s))
+			set_sheaf_capacity(s, slub_sheaf_capacity);
 		return 0;
+	}
 
 	free_kmem_cache_nodes(s);
 error:
@@ -3725,6 +4014,17 @@ static int __init setup_slub_min_objects(char *str)
 
 __setup("slub_min_objects=", setup_slub_min_objects);
 
+static int __init setup_slub_sheaf_capacity(char *str)
+{
+	get_option(&str, &slub_sheaf_capacity);
+	slub_sheaf_capacity = clamp(slub_sheaf_capacity, 0,
+				    SLUB_MAX_SHEAF_CAPACITY);
+
+	return 1;
+}
+
+__setup("slub_sheaf_capacity=", setup_slub_sheaf_capacity);
+
 void *__kmalloc(size_t size, gfp_t flags)
 {
 	struct kmem_cache *s;
@@ -4201,8 +4501,19 @@ void __init kmem_cache_init(void)
 		nr_cpu_ids, nr_node_ids);
 }
 
+/* The percpu allocator is fully up, the boot caches can get sheaves */
 void __init kmem_cache_init_late(void)
 {
+	struct kmem_cache *s;
+
+	mutex_lock(&slab_mutex);
+	if (slub_sheaf_capacity) {
+		list_for_each_entry(s, &slab_caches, list)
+			if (sheaves_allowed(s))
+				set_sheaf_capacity(s, slub_sheaf_capacity);
+	}
+	slub_sheaves_ready = true;
+	mutex_unlock(&slab_mutex);
 }
 
 struct kmem_cache *
@@ -4942,6 +5253,26 @@ static ssize_t cpu_partial_store(struct kmem_cache *s, const char *buf,
 }
 SLAB_ATTR(cpu_partial);
 
+static ssize_t sheaf_capacity_show(struct kmem_cache *s, char *buf)
+{
+	return sprintf(buf, "%u\n", sheaf_capacity(s));
+}
+
+static ssize_t sheaf_capacity_store(struct kmem_cache *s, const char *buf,
+				    size_t length)
+{
+	unsigned int capacity;
+	int err;
+
+	err = kstrtouint(buf, 10, &capacity);
+	if (err)
+		return err;
+
+	err = set_sheaf_capacity(s, capacity);
+	return err ? err : length;
+}
+SLAB_ATTR(sheaf_capacity);
+
 static ssize_t ctor_show(struct kmem_cache *s, char *buf)
 {
 	if (!s->ctor)
@@ -5343,6 +5674,9 @@ STAT_ATTR(CPU_PARTIAL_ALLOC, cpu_partial_alloc);
 STAT_ATTR(CPU_PARTIAL_FREE, cpu_partial_free);
 STAT_ATTR(CPU_PARTIAL_NODE, cpu_partial_node);
 STAT_ATTR(CPU_PARTIAL_DRAIN, cpu_partial_drain);
+STAT_ATTR(ALLOC_SHEAF, alloc_sheaf);
+STAT_ATTR(FREE_SHEAF, free_sheaf);
+STAT_ATTR(SHEAF_FLUSH, sheaf_flush);
 #endif
 
 static struct attribute *slab_attrs[] = {
@@ -5352,6 +5686,7 @@ static struct attribute *slab_attrs[] = {
 	&order_attr.attr,
 	&min_partial_attr.attr,
 	&cpu_partial_attr.attr,
+	&sheaf_capacity_attr.attr,
 	&objects_attr.attr,
 	&objects_partial_attr.attr,
 	&partial_attr.attr,
@@ -5410,6 +5745,9 @@ static struct attribute *slab_attrs[] = {
 	&cpu_partial_free_attr.attr,
 	&cpu_partial_node_attr.attr,
 	&cpu_partial_drain_attr.attr,
+	&alloc_sheaf_attr.attr,
+	&free_sheaf_attr.attr,
+	&sheaf_flush_attr.attr,
 #endif
 #ifdef CONFIG_FAILSLAB
 	&failslab_attr.attr,
@@ -371,11 +371,20 @@ extern ssize_t __mcopy_atomic_hugetlb(struct mm_struct *dst_mm,
 				      bool zeropage);
 #endif /* CONFIG_HUGETLB_PAGE */
 
+enum mcopy_atomic_mode {
+	/* A normal copy_from_user into the destination range */
+	MCOPY_ATOMIC_NORMAL,
+	/* Don't copy; map the destination range to the zero page */
+	MCOPY_ATOMIC_ZEROPAGE,
+	/* Just install pte(s) for the existing page cache page(s) */
+	MCOPY_ATOMIC_CONTINUE,
+};
+
 static __always_inline ssize_t __mcopy_atomic(struct mm_struct *dst_mm,
 					      unsigned long dst_start,
 					      unsigned long src_start,
 					      unsigned long len,
-					      bool zeropage)
+					      enum mcopy_atomic_mode mode)
 {
 	struct vm_area_struct *dst_vma;
 	ssize_t err;
@@ -437,12 +446,18 @@ static __always_inline ssize_t __mcopy_atomic(struct mm_struct *dst_mm,
 	/*
 	 * If this is a HUGETLB vma, pass off to appropriate routine
 	 */
-	if (is_vm_hugetlb_page(dst_vma))
+	if (is_vm_hugetlb_page(dst_vma)) {
+		if (mode == MCOPY_ATOMIC_CONTINUE)
+			goto out_unlock;
 		return  __mcopy_atomic_hugetlb(dst_mm, dst_vma, dst_start,
-						src_start, len, zeropage);
+					       src_start, len,
+					       mode == MCOPY_ATOMIC_ZEROPAGE);
+	}
 
 	if (!vma_is_anonymous(dst_vma) && !vma_is_shmem(dst_vma))
 		goto out_unlock;
+	if (mode == MCOPY_ATOMIC_CONTINUE && !vma_is_shmem(dst_vma))
+		goto out_unlock;
 
 	/*
 	 * Ensure the dst_vma has a anon_vma or this page
@@ -487,17 +502,26 @@ static __always_inline ssize_t __mcopy_atomic(struct mm_struct *dst_mm,
 		BUG_ON(pmd_none(*dst_pmd));
 		BUG_ON(pmd_trans_huge(*dst_pmd));
 
+		if (unlikely(pmd_shared_table(*dst_pmd)) &&
+		    unshare_pte_table(dst_vma, dst_pmd, dst_addr)) {
+			err = -ENOMEM;
+			break;
+		}
+
 		if (vma_is_anonymous(dst_vma)) {
-			if (!zeropage)
+			if (mode == MCOPY_ATOMIC_NORMAL)
 				err = mcopy_atomic_pte(dst_mm, dst_pmd, dst_vma,
 						       dst_addr, src_addr,
 						       &page);
 			else
 				err = mfill_zeropage_pte(dst_mm, dst_pmd,
 							 dst_vma, dst_addr);
+		} else if (mode == MCOPY_ATOMIC_CONTINUE) {
+			err = shmem_mcontinue_atomic_pte(dst_mm, dst_pmd,
+							 dst_vma, dst_addr);
 		} else {
 			err = -EINVAL; /* if zeropage is true return -EINVAL */
-			if (likely(!zeropage))
+			if (likely(mode == MCOPY_ATOMIC_NORMAL))
 				err = shmem_mcopy_atomic_pte(dst_mm, dst_pmd,
 							     dst_vma, dst_addr,
 							     src_addr, &page);
@@ -505,7 +529,8 @@ static __always_inline ssize_t __mcopy_atomic(struct mm_struct *dst_mm,
 
 		cond_resched();
 
-		if (unlikely(err == -EFAULT)) {
+		/* for a continue, -EFAULT means there was no page to map */
+		if (unlikely(err == -EFAULT) && mode != MCOPY_ATOMIC_CONTINUE) {
 			void *page_kaddr;
 
 			up_read(&dst_mm->mmap_sem);
@@ -550,11 +575,18 @@ static __always_inline ssize_t __mcopy_atomic(struct mm_struct *dst_mm,
 ssize_t mcopy_atomic(struct mm_struct *dst_mm, unsigned long dst_start,
 		     unsigned long src_start, unsigned long len)
 {
-	return __mcopy_atomic(dst_mm, dst_start, src_start, len, false);
+	return __mcopy_atomic(dst_mm, dst_start, src_start, len,
+			      MCOPY_ATOMIC_NORMAL);
 }
 
 ssize_t mfill_zeropage(struct mm_struct *dst_mm, unsigned long start,
 		       unsigned long len)
 {
-	return __mcopy_atomic(dst_mm, start, 0, len, true);
+	return __mcopy_atomic(dst_mm, start, 0, len, MCOPY_ATOMIC_ZEROPAGE);
+}
+
+ssize_t mcontinue_atomic(struct mm_struct *dst_mm, unsigned long start,
+			 unsigned long len)
+{
+	return __mcopy_atomic(dst_mm, start, 0, len, MCOPY_ATOMIC_CONTINUE);
 }
@@ -995,6 +995,9 @@ const char * const vmstat_text[] = {
 
 	"pgfault",
 	"pgmajfault",
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	"speculative_pgfault",
+#endif
 	"pglazyfreed",
 
 	"pgrefill",
@@ -48,12 +48,15 @@
 #include <linux/seccomp.h>
 #include <linux/if_vlan.h>
 #include <linux/bpf.h>
+#include <linux/bpf_trace.h>
 #include <net/sch_generic.h>
 #include <net/cls_cgroup.h>
 #include <net/dst_metadata.h>
 #include <net/dst.h>
 #include <net/sock_reuseport.h>
 #include <net/busy_poll.h>
+#include <net/xdp_sock.h>
+#include <net/page_pool.h>
 
 /**
  *	sk_filter_trim_cap - run a packet through a socket filter
@@ -1769,6 +1772,7 @@ static const struct bpf_func_proto bpf_clone_redirect_proto = {
 struct redirect_info {
 	u32 ifindex;
 	u32 flags;
+	struct bpf_map *map;
 };
 
 static DEFINE_PER_CPU(struct redirect_info, redirect_info);
@@ -1782,6 +1786,7 @@ BPF_CALL_2(bpf_redirect, u32, ifindex, u64, flags)
 
 	ri->ifindex = ifindex;
 	ri->flags = flags;
+	ri->map = NULL;
 
 	return TC_ACT_REDIRECT;
 }
@@ -2272,6 +2277,258 @@ static const struct bpf_func_proto bpf_xdp_adjust_head_proto = {
 	.arg2_type	= ARG_ANYTHING,
 };
 
+/* Frames in page_pool pages go back to their pool */
+static void __xdp_return(void *data)
+{
+	if (!page_pool_return_page(virt_to_head_page(data)))
+		page_frag_free(data);
+}
+
+void xdp_return_frame(struct xdp_frame *frame)
+{
+	__xdp_return(frame->data);
+}
+EXPORT_SYMBOL_GPL(xdp_return_frame);
+
+/* Copy a frame into a new skb for @dev, and release the frame */
+struct sk_buff *xdp_frame_to_skb(struct xdp_frame *frame,
+				 struct net_device *dev)
+{
+	struct sk_buff *skb;
+
+	skb = netdev_alloc_skb(dev, frame->len + NET_IP_ALIGN);
+	if (likely(skb)) {
+		skb_reserve(skb, NET_IP_ALIGN);
+		memcpy(skb_put(skb, frame->len), frame->data, frame->len);
+	}
+
+	xdp_return_frame(frame);
+	return skb;
+}
+
+/* Devices without ndo_xdp_xmit() get a copy of the frame through the stack */
+void xdp_frame_xmit_skb(struct xdp_frame *frame, struct net_device *dev)
+{
+	struct sk_buff *skb;
+
+	if (unlikely(frame->len < ETH_HLEN)) {
+		xdp_return_frame(frame);
+		return;
+	}
+
+	skb = xdp_frame_to_skb(frame, dev);
+	if (!skb)
+		return;
+
+	skb_reset_mac_header(skb);
+	skb->protocol = eth_hdr(skb)->h_proto;
+	dev_queue_xmit(skb);
+}
+
+static int __xdp_map_enqueue(struct bpf_map *map, u32 index,
+			     struct xdp_frame *frame)
+{
+	switch (map->map_type) {
+	case BPF_MAP_TYPE_DEVMAP: {
+		struct bpf_dtab_netdev *dst = __dev_map_lookup_elem(map, index);
+
+		if (unlikely(!dst))
+			return -EINVAL;
+		return dev_map_enqueue(dst, frame);
+	}
+	case BPF_MAP_TYPE_CPUMAP: {
+		struct bpf_cpu_map_entry *rcpu = __cpu_map_lookup_elem(map,
+								       index);
+
+		if (unlikely(!rcpu))
+			return -EINVAL;
+		return cpu_map_enqueue(rcpu, frame);
+	}
+	default:
+		return -EBADRQC;
+	}
+}
+
+int xdp_do_redirect(struct net_device *dev, struct xdp_buff *xdp,
+		    struct bpf_prog *prog)
+{
+	struct redirect_info *ri = this_cpu_ptr(&redirect_info);
+	struct bpf_map *map = ri->map;
+	u32 index = ri->ifindex;
+	struct xdp_frame *frame;
+	struct net_device *fwd;
+	int err;
+
+	ri->ifindex = 0;
+	ri->map = NULL;
+
+	/* Sockets get a copy of the packet, the buffer is released here */
+	if (map && map->map_type == BPF_MAP_TYPE_XSKMAP) {
+		struct xdp_sock *xs = __xsk_map_lookup_elem(map, index);
+
+		err = xs ? xsk_rcv(xs, xdp, dev) : -EINVAL;
+		if (likely(!err)) {
+			__xdp_return(xdp->data);
+			return 0;
+		}
+		goto err;
+	}
+
+	frame = convert_to_xdp_frame(xdp, dev);
+	if (unlikely(!frame)) {
+		err = -EOVERFLOW;
+		goto err;
+	}
+
+	if (map) {
+		err = __xdp_map_enqueue(map, index, frame);
+	} else {
+		rcu_read_lock();
+		fwd = dev_get_by_index_rcu(dev_net(dev), index);
+		err = 0;
+		if (unlikely(!fwd))
+			err = -EINVAL;
+		else if (unlikely(!fwd->netdev_ops->ndo_xdp_xmit))
+			xdp_frame_xmit_skb(frame, fwd);
+		else if (fwd->netdev_ops->ndo_xdp_xmit(fwd, 1, &frame,
+						       XDP_XMIT_FLUSH) != 1)
+			err = -ENOSPC;
+		rcu_read_unlock();
+	}
+
+	if (likely(!err))
+		return 0;
+err:
+	trace_xdp_exception(dev, prog, XDP_REDIRECT);
+	return err;
+}
+EXPORT_SYMBOL_GPL(xdp_do_redirect);
+
+void xdp_do_flush_map(void)
+{
+	__dev_map_flush();
+	__cpu_map_flush();
+	__xsk_map_flush();
+}
+EXPORT_SYMBOL_GPL(xdp_do_flush_map);
+
+/* Called with rcu_read_lock() held, consumes the skb */
+int xdp_do_generic_redirect(struct net_device *dev, struct sk_buff *skb,
+			    struct bpf_prog *prog)
+{
+	struct redirect_info *ri = this_cpu_ptr(&redirect_info);
+	struct bpf_map *map = ri->map;
+	u32 index = ri->ifindex;
+	struct net_device *fwd = NULL;
+	unsigned int len;
+	int err = -EINVAL;
+
+	ri->ifindex = 0;
+	ri->map = NULL;
+
+	if (map) {
+		struct bpf_dtab_netdev *dst;
+		struct xdp_sock *xs;
+		struct xdp_buff xdp;
+
+		switch (map->map_type) {
+		case BPF_MAP_TYPE_DEVMAP:
+			dst = __dev_map_lookup_elem(map, index);
+			if (dst)
+				fwd = dev_map_netdev(dst);
+			break;
+		case BPF_MAP_TYPE_XSKMAP:
+			xs = __xsk_map_lookup_elem(map, index);
+			if (unlikely(!xs))
+				goto err;
+
+			/* Linearized by netif_receive_generic_xdp() */
+			xdp.data = skb->data;
+			xdp.data_end = skb->data + skb_headlen(skb);
+			xdp.data_hard_start = skb->head;
+			err = xsk_generic_rcv(xs, &xdp, dev);
+			if (err)
+				goto err;
+
+			consume_skb(skb);
+			return 0;
+		default:
+			/* There are no frames to hand to another CPU here */
+			err = -EOPNOTSUPP;
+			goto err;
+		}
+	} else {
+		fwd = dev_get_by_index_rcu(dev_net(dev), index);
+	}
+	if (unlikely(!fwd))
+		goto err;
+
+	if (unlikely(!(fwd->flags & IFF_UP))) {
+		err = -ENETDOWN;
+		goto err;
+	}
+
+	len = fwd->mtu + fwd->hard_header_len + VLAN_HLEN;
+	if (unlikely(skb->len > len)) {
+		err = -EMSGSIZE;
+		goto err;
+	}
+
+	skb->dev = fwd;
+	generic_xdp_tx(skb, prog);
+	return 0;
+err:
+	trace_xdp_exception(dev, prog, XDP_REDIRECT);
+	kfree_skb(skb);
+	return err;
+}
+EXPORT_SYMBOL_GPL(xdp_do_generic_redirect);
+
+BPF_CALL_2(bpf_xdp_redirect, u32, ifindex, u64, flags)
+{
+	struct redirect_info *ri = this_cpu_ptr(&redirect_info);
+
+	if (unlikely(flags))
+		return XDP_ABORTED;
+
+	ri->ifindex = ifindex;
+	ri->flags = flags;
+	ri->map = NULL;
+
+	return XDP_REDIRECT;
+}
+
+static const struct bpf_func_proto bpf_xdp_redirect_proto = {
+	.func		= bpf_xdp_redirect,
+	.gpl_only	= false,
+	.ret_type	= RET_INTEGER,
+	.arg1_type	= ARG_ANYTHING,
+	.arg2_type	= ARG_ANYTHING,
+};
+
+BPF_CALL_3(bpf_xdp_redirect_map, struct bpf_map *, map, u32, key, u64, flags)
+{
+	struct redirect_info *ri = this_cpu_ptr(&redirect_info);
+
+	if (unlikely(flags))
+		return XDP_ABORTED;
+
+	ri->ifindex = key;
+	ri->flags = flags;
+	ri->map = map;
+
+	return XDP_REDIRECT;
+}
+
+static const struct bpf_func_proto bpf_xdp_redirect_map_proto = {
+	.func		= bpf_xdp_redirect_map,
+	.gpl_only	= false,
+	.ret_type	= RET_INTEGER,
+	.arg1_type	= ARG_CONST_MAP_PTR,
+	.arg2_type	= ARG_ANYTHING,
+	.arg3_type	= ARG_ANYTHING,
+};
+
 bool bpf_helper_changes_pkt_data(void *func)
 {
 	if (func == bpf_skb_vlan_push ||
@@ -2760,6 +3017,10 @@ xdp_func_proto(enum bpf_func_id func_id)
 		return &bpf_get_smp_processor_id_proto;
 	case BPF_FUNC_xdp_adjust_head:
 		return &bpf_xdp_adjust_head_proto;
+	case BPF_FUNC_redirect:
+		return &bpf_xdp_redirect_proto;
+	case BPF_FUNC_redirect_map:
+		return &bpf_xdp_redirect_map_proto;
 	default:
 		return bpf_base_func_proto(func_id);
 	}
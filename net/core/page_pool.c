@@ -0,0 +1,355 @@
+/*
+ * page_pool: recycling of RX pages for network drivers
+ *
+ * Copyright (C) 2017 - Linaro Ltd
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/device.h>
+#include <linux/dma-mapping.h>
+#include <linux/page-flags.h>
+#include <linux/mm.h>
+
+#include <net/page_pool.h>
+
+#define PP_RING_SIZE_DEFAULT	1024
+#define PP_RING_SIZE_MAX	32768
+
+#define PP_RELEASE_RETRY	(HZ / 10)
+
+static int page_pool_init(struct page_pool *pool,
+			  const struct page_pool_params *params)
+{
+	unsigned int ring_qsize = PP_RING_SIZE_DEFAULT;
+
+	memcpy(&pool->p, params, sizeof(pool->p));
+
+	/* Validate only known flags were used */
+	if (pool->p.flags & ~(PP_FLAG_ALL))
+		return -EINVAL;
+
+	if (pool->p.pool_size)
+		ring_qsize = pool->p.pool_size;
+
+	/* Sanity limit mem that can be pinned down */
+	if (ring_qsize > PP_RING_SIZE_MAX)
+		return -E2BIG;
+
+	/* DMA direction is either DMA_FROM_DEVICE or DMA_BIDIRECTIONAL.
+	 * DMA_BIDIRECTIONAL is for allowing page used for DMA sending,
+	 * which is the XDP_TX use-case.
+	 */
+	if ((pool->p.dma_dir != DMA_FROM_DEVICE) &&
+	    (pool->p.dma_dir != DMA_BIDIRECTIONAL))
+		return -EINVAL;
+
+	if (ptr_ring_init(&pool->ring, ring_qsize, GFP_KERNEL) < 0)
+		return -ENOMEM;
+
+	atomic_set(&pool->pages_state_release_cnt, 0);
+	return 0;
+}
+
+struct page_pool *page_pool_create(const struct page_pool_params *params)
+{
+	struct page_pool *pool;
+	int err;
+
+	pool = kzalloc_node(sizeof(*pool), GFP_KERNEL, params->nid);
+	if (!pool)
+		return ERR_PTR(-ENOMEM);
+
+	err = page_pool_init(pool, params);
+	if (err < 0) {
+		pr_warn("%s() gave up with errno %d\n", __func__, err);
+		kfree(pool);
+		return ERR_PTR(err);
+	}
+
+	return pool;
+}
+EXPORT_SYMBOL(page_pool_create);
+
+/* fast path */
+static struct page *__page_pool_get_cached(struct page_pool *pool)
+{
+	struct ptr_ring *r = &pool->ring;
+	struct page *page;
+
+	/* Caller guarantees a safe context for accessing alloc.cache */
+	if (likely(pool->alloc.count))
+		return pool->alloc.cache[--pool->alloc.count];
+
+	/* Refill the cache in one go. The consumer side of the ring is
+	 * only shared with page_pool_destroy().
+	 */
+	spin_lock(&r->consumer_lock);
+	while (pool->alloc.count < PP_ALLOC_CACHE_REFILL) {
+		page = __ptr_ring_consume(r);
+		if (!page)
+			break;
+		pool->alloc.cache[pool->alloc.count++] = page;
+	}
+	spin_unlock(&r->consumer_lock);
+
+	if (pool->alloc.count)
+		return pool->alloc.cache[--pool->alloc.count];
+
+	return NULL;
+}
+
+/*
+ * page->dma_addr is an unsigned long, to keep struct page from growing
+ * where dma_addr_t is wider. Such mappings are refused.
+ */
+static bool page_pool_map(struct page_pool *pool, struct page *page)
+{
+	dma_addr_t dma;
+
+	dma = dma_map_page_attrs(pool->p.dev, page, 0,
+				 (PAGE_SIZE << pool->p.order),
+				 pool->p.dma_dir, DMA_ATTR_SKIP_CPU_SYNC);
+	if (dma_mapping_error(pool->p.dev, dma))
+		return false;
+
+	if (unlikely((dma_addr_t)(unsigned long)dma != dma)) {
+		dma_unmap_page_attrs(pool->p.dev, dma,
+				     PAGE_SIZE << pool->p.order,
+				     pool->p.dma_dir, DMA_ATTR_SKIP_CPU_SYNC);
+		return false;
+	}
+
+	page->dma_addr = dma;
+	return true;
+}
+
+/* slow path */
+static noinline
+struct page *__page_pool_alloc_pages_slow(struct page_pool *pool, gfp_t gfp)
+{
+	struct page *page;
+
+	/* We could always set __GFP_COMP, and avoid this branch, as
+	 * prep_new_page() can handle order-0 with __GFP_COMP.
+	 */
+	if (pool->p.order)
+		gfp |= __GFP_COMP;
+
+	page = alloc_pages_node(pool->p.nid, gfp, pool->p.order);
+	if (!page)
+		return NULL;
+
+	if ((pool->p.flags & PP_FLAG_DMA_MAP) && !page_pool_map(pool, page)) {
+		put_page(page);
+		return NULL;
+	}
+
+	page->pp = pool;
+	set_page_private(page, PP_SIGNATURE);
+	pool->pages_state_hold_cnt++;
+
+	return page;
+}
+
+/* For using page_pool replace: alloc_pages() API calls, but provide
+ * synchronization guarantee for allocation side.
+ */
+struct page *page_pool_alloc_pages(struct page_pool *pool, gfp_t gfp)
+{
+	struct page *page;
+
+	/* Fast-path: Get a page from cache */
+	page = __page_pool_get_cached(pool);
+	if (page)
+		return page;
+
+	/* Slow-path: cache empty, do real allocation */
+	return __page_pool_alloc_pages_slow(pool, gfp);
+}
+EXPORT_SYMBOL(page_pool_alloc_pages);
+
+static s32 page_pool_inflight(struct page_pool *pool)
+{
+	u32 release_cnt = atomic_read(&pool->pages_state_release_cnt);
+
+	return (s32)(pool->pages_state_hold_cnt - release_cnt);
+}
+
+/* Cleanup page_pool state from page. The pool may go away as soon as
+ * the release count is bumped, it must not be touched afterwards.
+ */
+static void __page_pool_clean_page(struct page_pool *pool, struct page *page)
+{
+	if (pool->p.flags & PP_FLAG_DMA_MAP) {
+		dma_unmap_page_attrs(pool->p.dev,
+				     page_pool_get_dma_addr(page),
+				     PAGE_SIZE << pool->p.order,
+				     pool->p.dma_dir, DMA_ATTR_SKIP_CPU_SYNC);
+		page->dma_addr = 0;
+	}
+
+	page->pp = NULL;
+	set_page_private(page, 0);
+	atomic_inc(&pool->pages_state_release_cnt);
+}
+
+void page_pool_release_page(struct page_pool *pool, struct page *page)
+{
+	__page_pool_clean_page(pool, page);
+}
+EXPORT_SYMBOL(page_pool_release_page);
+
+/* Return a page to the page allocator, cleaning up our state */
+static void __page_pool_return_page(struct page_pool *pool, struct page *page)
+{
+	__page_pool_clean_page(pool, page);
+	put_page(page);
+}
+
+static bool __page_pool_recycle_into_ring(struct page_pool *pool,
+					  struct page *page)
+{
+	int ret;
+
+	/* BH protection not needed if current is serving softirq */
+	if (in_serving_softirq())
+		ret = ptr_ring_produce(&pool->ring, page);
+	else
+		ret = ptr_ring_produce_bh(&pool->ring, page);
+
+	return ret == 0;
+}
+
+/* Only allow direct recycling in special circumstances, into the
+ * alloc side cache. E.g. during RX-NAPI processing for XDP_DROP use-case.
+ *
+ * Caller must provide appropriate safe context.
+ */
+static bool __page_pool_recycle_direct(struct page *page,
+				       struct page_pool *pool)
+{
+	if (unlikely(pool->alloc.count == PP_ALLOC_CACHE_SIZE))
+		return false;
+
+	/* Caller MUST have verified/know (page_ref_count(page) == 1) */
+	pool->alloc.cache[pool->alloc.count++] = page;
+	return true;
+}
+
+void __page_pool_put_page(struct page_pool *pool,
+			  struct page *page, bool allow_direct)
+{
+	/* This allocator is optimized for the XDP mode that uses
+	 * one-frame-per-page, but have fallbacks that act like the
+	 * regular page allocator APIs.
+	 *
+	 * refcnt == 1 means page_pool owns page, and can recycle it.
+	 */
+	if (likely(page_ref_count(page) == 1)) {
+		/* Read barrier done in page_ref_count / READ_ONCE */
+
+		if (allow_direct && in_serving_softirq())
+			if (__page_pool_recycle_direct(page, pool))
+				return;
+
+		if (__page_pool_recycle_into_ring(pool, page))
+			return;
+
+		/* Cache full, fallback to free pages */
+		__page_pool_return_page(pool, page);
+		return;
+	}
+	/* Fallback/non-XDP mode: API user have elevated refcnt.
+	 *
+	 * Many drivers split up the page into fragments, and some
+	 * want to keep doing this to save memory and do refcnt based
+	 * recycling. Support this use case too, to ease drivers
+	 * switching between XDP/non-XDP.
+	 *
+	 * The unmap and detach happen before the reference is dropped,
+	 * so whoever holds the last one frees a plain page.
+	 */
+	__page_pool_return_page(pool, page);
+}
+EXPORT_SYMBOL(__page_pool_put_page);
+
+/* Called for the pages of skbs marked for recycling, and of XDP frames */
+bool page_pool_return_page(struct page *page)
+{
+	page = compound_head(page);
+	if (!page_pool_owned(page))
+		return false;
+
+	page_pool_put_page(page->pp, page);
+	return true;
+}
+EXPORT_SYMBOL(page_pool_return_page);
+
+static void __page_pool_empty_ring(struct page_pool *pool)
+{
+	struct page *page;
+
+	/* Empty recycle ring */
+	while ((page = ptr_ring_consume_bh(&pool->ring)))
+		__page_pool_return_page(pool, page);
+}
+
+static void __page_pool_free(struct page_pool *pool)
+{
+	WARN(pool->alloc.count, "API usage violation");
+
+	ptr_ring_cleanup(&pool->ring, NULL);
+	kfree(pool);
+}
+
+/* Pages returned after page_pool_destroy() keep landing in the ring */
+static void page_pool_release_retry(struct work_struct *wq)
+{
+	struct delayed_work *dwq = to_delayed_work(wq);
+	struct page_pool *pool = container_of(dwq, struct page_pool,
+					      release_dw);
+
+	__page_pool_empty_ring(pool);
+	if (page_pool_inflight(pool) > 0) {
+		schedule_delayed_work(&pool->release_dw, PP_RELEASE_RETRY);
+		return;
+	}
+
+	__page_pool_free(pool);
+}
+
+/* Called once the pool's RX queue is stopped, and its NAPI disabled */
+void page_pool_destroy(struct page_pool *pool)
+{
+	struct page *page;
+
+	if (!pool)
+		return;
+
+	/* Empty alloc cache, assume caller made sure this is
+	 * no-longer in use, and page_pool_alloc_pages() cannot be
+	 * called concurrently.
+	 */
+	while (pool->alloc.count) {
+		page = pool->alloc.cache[--pool->alloc.count];
+		__page_pool_return_page(pool, page);
+	}
+
+	__page_pool_empty_ring(pool);
+
+	/* Pages still held by skbs or XDP frames come back later */
+	if (page_pool_inflight(pool) > 0) {
+		INIT_DELAYED_WORK(&pool->release_dw, page_pool_release_retry);
+		schedule_delayed_work(&pool->release_dw, PP_RELEASE_RETRY);
+		return;
+	}
+
+	__page_pool_free(pool);
+}
+EXPORT_SYMBOL(page_pool_destroy);
@@ -867,6 +867,12 @@ int inet_csk_listen_start(struct sock *sk, int backlog)
 	struct inet_sock *inet = inet_sk(sk);
 	int err = -EADDRINUSE;
 
+	/* An upper layer protocol's state is per connection, and cannot be
+	 * inherited by the children of a listener.
+	 */
+	if (icsk->icsk_ulp_ops)
+		return -EINVAL;
+
 	reqsk_queue_alloc(&icsk->icsk_accept_queue);
 
 	sk->sk_max_ack_backlog = backlog;
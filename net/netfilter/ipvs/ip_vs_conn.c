@@ -37,6 +37,8 @@
 #include <linux/seq_file.h>
 #include <linux/jhash.h>
 #include <linux/random.h>
+#include <linux/seqlock.h>
+#include <linux/workqueue.h>
 
 #include <net/net_namespace.h>
 #include <net/ip_vs.h>
@@ -46,13 +48,21 @@
 #define CONFIG_IP_VS_TAB_BITS	12
 #endif
 
+#define IP_VS_CONN_TAB_MAX_BITS	20
+
 /*
  * Connection hash size. Default is what was selected at compile time.
+ * The table grows with the number of connections up to conn_tab_max_bits,
+ * and shrinks back down to conn_tab_bits.
 */
 static int ip_vs_conn_tab_bits = CONFIG_IP_VS_TAB_BITS;
 module_param_named(conn_tab_bits, ip_vs_conn_tab_bits, int, 0444);
 MODULE_PARM_DESC(conn_tab_bits, "Set connections' hash size");
 
+static int ip_vs_conn_tab_max_bits = IP_VS_CONN_TAB_MAX_BITS;
+module_param_named(conn_tab_max_bits, ip_vs_conn_tab_max_bits, int, 0444);
+MODULE_PARM_DESC(conn_tab_max_bits, "Set connections' maximum hash size");
+
 /* size and mask values */
 int ip_vs_conn_tab_size __read_mostly;
 static int ip_vs_conn_tab_mask __read_mostly;
@@ -62,6 +72,20 @@ static int ip_vs_conn_tab_mask __read_mostly;
  */
 static struct hlist_head *ip_vs_conn_tab __read_mostly;
 
+/*
+ *  The table is replaced with all the bucket locks held, inside a write
+ *  section of ip_vs_conn_tab_seq. Lookups take a consistent snapshot of
+ *  the table and its mask, and retry a miss that raced with a resize:
+ *  entries were moved to the new table under their feet.
+ */
+static seqcount_t ip_vs_conn_tab_seq;
+
+/*  number of hashed connections, in all the netns */
+static atomic_t ip_vs_conn_hashed = ATOMIC_INIT(0);
+
+static void ip_vs_conn_resize_work_handler(struct work_struct *work);
+static DECLARE_WORK(ip_vs_conn_resize_work, ip_vs_conn_resize_work_handler);
+
 /*  SLAB cache for IPVS connections */
 static struct kmem_cache *ip_vs_conn_cachep __read_mostly;
 
@@ -94,9 +118,25 @@ struct ip_vs_aligned_lock
 static struct ip_vs_aligned_lock
 __ip_vs_conntbl_lock_array[CT_LOCKARRAY_SIZE] __cacheline_aligned;
 
+/* Taken, with ct_locks_all set, by a resize that needs all the locks */
+static DEFINE_SPINLOCK(ct_locks_all_lock);
+static bool ct_locks_all __read_mostly;
+
 static inline void ct_write_lock_bh(unsigned int key)
 {
-	spin_lock_bh(&__ip_vs_conntbl_lock_array[key&CT_LOCKARRAY_MASK].l);
+	spinlock_t *lock = &__ip_vs_conntbl_lock_array[key&CT_LOCKARRAY_MASK].l;
+
+	spin_lock_bh(lock);
+
+	/* Pairs with the smp_store_release() in ct_unlock_all_bh() */
+	if (likely(!smp_load_acquire(&ct_locks_all)))
+		return;
+
+	/* A resize is in progress, wait for it behind the global lock */
+	spin_unlock(lock);
+	spin_lock(&ct_locks_all_lock);
+	spin_lock(lock);
+	spin_unlock(&ct_locks_all_lock);
 }
 
 static inline void ct_write_unlock_bh(unsigned int key)
@@ -104,10 +144,48 @@ static inline void ct_write_unlock_bh(unsigned int key)
 	spin_unlock_bh(&__ip_vs_conntbl_lock_array[key&CT_LOCKARRAY_MASK].l);
 }
 
+static void ct_lock_all_bh(void)
+{
+	int i;
+
+	spin_lock_bh(&ct_locks_all_lock);
+	ct_locks_all = true;
+
+	for (i = 0; i < CT_LOCKARRAY_SIZE; i++) {
+		/* The unlock makes ct_locks_all visible to the next owner */
+		spin_lock(&__ip_vs_conntbl_lock_array[i].l);
+		spin_unlock(&__ip_vs_conntbl_lock_array[i].l);
+	}
+}
+
+static void ct_unlock_all_bh(void)
+{
+	/* The table update must be complete before the flag is cleared */
+	smp_store_release(&ct_locks_all, false);
+	spin_unlock_bh(&ct_locks_all_lock);
+}
+
+/* Table and mask to look hash up in, stable until rcu_read_unlock() */
+static inline struct hlist_head *ip_vs_conn_bucket(unsigned int hash,
+						   unsigned int *seq)
+{
+	struct hlist_head *tab;
+	unsigned int mask;
+
+	do {
+		*seq = read_seqcount_begin(&ip_vs_conn_tab_seq);
+		tab = ip_vs_conn_tab;
+		mask = ip_vs_conn_tab_mask;
+	} while (read_seqcount_retry(&ip_vs_conn_tab_seq, *seq));
+
+	return &tab[hash & mask];
+}
+
 static void ip_vs_conn_expire(unsigned long data);
 
 /*
- *	Returns hash value for IPVS connection entry
+ *	Returns hash value for IPVS connection entry, it is masked with
+ *	ip_vs_conn_tab_mask to get the bucket
  */
 static unsigned int ip_vs_conn_hashkey(struct netns_ipvs *ipvs, int af, unsigned int proto,
 				       const union nf_inet_addr *addr,
@@ -115,13 +193,13 @@ static unsigned int ip_vs_conn_hashkey(struct netns_ipvs *ipvs, int af, unsigned
 {
 #ifdef CONFIG_IP_VS_IPV6
 	if (af == AF_INET6)
-		return (jhash_3words(jhash(addr, 16, ip_vs_conn_rnd),
+		return jhash_3words(jhash(addr, 16, ip_vs_conn_rnd),
 				    (__force u32)port, proto, ip_vs_conn_rnd) ^
-			((size_t)ipvs>>8)) & ip_vs_conn_tab_mask;
+			((size_t)ipvs>>8);
 #endif
-	return (jhash_3words((__force u32)addr->ip, (__force u32)port, proto,
+	return jhash_3words((__force u32)addr->ip, (__force u32)port, proto,
 			    ip_vs_conn_rnd) ^
-		((size_t)ipvs>>8)) & ip_vs_conn_tab_mask;
+		((size_t)ipvs>>8);
 }
 
 static unsigned int ip_vs_conn_hashkey_param(const struct ip_vs_conn_param *p,
@@ -131,8 +209,7 @@ static unsigned int ip_vs_conn_hashkey_param(const struct ip_vs_conn_param *p,
 	__be16 port;
 
 	if (p->pe_data && p->pe->hashkey_raw)
-		return p->pe->hashkey_raw(p, ip_vs_conn_rnd, inverse) &
-			ip_vs_conn_tab_mask;
+		return p->pe->hashkey_raw(p, ip_vs_conn_rnd, inverse);
 
 	if (likely(!inverse)) {
 		addr = p->caddr;
@@ -161,6 +238,14 @@ static unsigned int ip_vs_conn_hashkey_conn(const struct ip_vs_conn *cp)
 	return ip_vs_conn_hashkey_param(&p, false);
 }
 
+static inline void ip_vs_conn_hashed_dec(void)
+{
+	/* Shrink only down to the size picked at load time */
+	if (atomic_dec_return(&ip_vs_conn_hashed) < ip_vs_conn_tab_size / 8 &&
+	    ip_vs_conn_tab_size > (1 << ip_vs_conn_tab_bits))
+		schedule_work(&ip_vs_conn_resize_work);
+}
+
 /*
  *	Hashes ip_vs_conn in ip_vs_conn_tab by netns,proto,addr,port.
  *	returns bool success.
@@ -182,7 +267,8 @@ static inline int ip_vs_conn_hash(struct ip_vs_conn *cp)
 	if (!(cp->flags & IP_VS_CONN_F_HASHED)) {
 		cp->flags |= IP_VS_CONN_F_HASHED;
 		refcount_inc(&cp->refcnt);
-		hlist_add_head_rcu(&cp->c_list, &ip_vs_conn_tab[hash]);
+		hlist_add_head_rcu(&cp->c_list,
+				   &ip_vs_conn_tab[hash & ip_vs_conn_tab_mask]);
 		ret = 1;
 	} else {
 		pr_err("%s(): request for already hashed, called from %pF\n",
@@ -193,6 +279,11 @@ static inline int ip_vs_conn_hash(struct ip_vs_conn *cp)
 	spin_unlock(&cp->lock);
 	ct_write_unlock_bh(hash);
 
+	if (ret &&
+	    atomic_inc_return(&ip_vs_conn_hashed) > 2 * ip_vs_conn_tab_size &&
+	    ip_vs_conn_tab_size < (1 << ip_vs_conn_tab_max_bits))
+		schedule_work(&ip_vs_conn_resize_work);
+
 	return ret;
 }
 
@@ -223,6 +314,9 @@ static inline int ip_vs_conn_unhash(struct ip_vs_conn *cp)
 	spin_unlock(&cp->lock);
 	ct_write_unlock_bh(hash);
 
+	if (ret)
+		ip_vs_conn_hashed_dec();
+
 	return ret;
 }
 
@@ -245,6 +339,7 @@ static inline bool ip_vs_conn_unlink(struct ip_vs_conn *cp)
 		if (refcount_dec_if_one(&cp->refcnt)) {
 			hlist_del_rcu(&cp->c_list);
 			cp->flags &= ~IP_VS_CONN_F_HASHED;
+			ip_vs_conn_hashed_dec();
 			ret = true;
 		}
 	} else
@@ -266,14 +361,17 @@ static inline bool ip_vs_conn_unlink(struct ip_vs_conn *cp)
 static inline struct ip_vs_conn *
 __ip_vs_conn_in_get(const struct ip_vs_conn_param *p)
 {
-	unsigned int hash;
+	unsigned int hash, seq;
+	struct hlist_head *head;
 	struct ip_vs_conn *cp;
 
 	hash = ip_vs_conn_hashkey_param(p, false);
 
 	rcu_read_lock();
 
-	hlist_for_each_entry_rcu(cp, &ip_vs_conn_tab[hash], c_list) {
+retry:
+	head = ip_vs_conn_bucket(hash, &seq);
+	hlist_for_each_entry_rcu(cp, head, c_list) {
 		if (p->cport == cp->cport && p->vport == cp->vport &&
 		    cp->af == p->af &&
 		    ip_vs_addr_equal(p->af, p->caddr, &cp->caddr) &&
@@ -289,6 +387,9 @@ __ip_vs_conn_in_get(const struct ip_vs_conn_param *p)
 		}
 	}
 
+	if (read_seqcount_retry(&ip_vs_conn_tab_seq, seq))
+		goto retry;
+
 	rcu_read_unlock();
 
 	return NULL;
@@ -352,14 +453,17 @@ EXPORT_SYMBOL_GPL(ip_vs_conn_in_get_proto);
 /* Get reference to connection template */
 struct ip_vs_conn *ip_vs_ct_in_get(const struct ip_vs_conn_param *p)
 {
-	unsigned int hash;
+	unsigned int hash, seq;
+	struct hlist_head *head;
 	struct ip_vs_conn *cp;
 
 	hash = ip_vs_conn_hashkey_param(p, false);
 
 	rcu_read_lock();
 
-	hlist_for_each_entry_rcu(cp, &ip_vs_conn_tab[hash], c_list) {
+retry:
+	head = ip_vs_conn_bucket(hash, &seq);
+	hlist_for_each_entry_rcu(cp, head, c_list) {
 		if (unlikely(p->pe_data && p->pe->ct_match)) {
 			if (cp->ipvs != p->ipvs)
 				continue;
@@ -384,6 +488,8 @@ struct ip_vs_conn *ip_vs_ct_in_get(const struct ip_vs_conn_param *p)
 				goto out;
 		}
 	}
+	if (read_seqcount_retry(&ip_vs_conn_tab_seq, seq))
+		goto retry;
 	cp = NULL;
 
   out:
@@ -404,7 +510,8 @@ struct ip_vs_conn *ip_vs_ct_in_get(const struct ip_vs_conn_param *p)
  *	p->vaddr, p->vport: pkt dest address (foreign host) */
 struct ip_vs_conn *ip_vs_conn_out_get(const struct ip_vs_conn_param *p)
 {
-	unsigned int hash;
+	unsigned int hash, seq;
+	struct hlist_head *head;
 	struct ip_vs_conn *cp, *ret=NULL;
 
 	/*
@@ -414,7 +521,9 @@ struct ip_vs_conn *ip_vs_conn_out_get(const struct ip_vs_conn_param *p)
 
 	rcu_read_lock();
 
-	hlist_for_each_entry_rcu(cp, &ip_vs_conn_tab[hash], c_list) {
+retry:
+	head = ip_vs_conn_bucket(hash, &seq);
+	hlist_for_each_entry_rcu(cp, head, c_list) {
 		if (p->vport == cp->cport && p->cport == cp->dport &&
 		    cp->af == p->af &&
 		    ip_vs_addr_equal(p->af, p->vaddr, &cp->caddr) &&
@@ -429,6 +538,9 @@ struct ip_vs_conn *ip_vs_conn_out_get(const struct ip_vs_conn_param *p)
 		}
 	}
 
+	if (!ret && read_seqcount_retry(&ip_vs_conn_tab_seq, seq))
+		goto retry;
+
 	rcu_read_unlock();
 
 	IP_VS_DBG_BUF(9, "lookup/out %s %s:%d->%s:%d %s\n",
@@ -1002,25 +1114,49 @@ ip_vs_conn_new(const struct ip_vs_conn_param *p, int dest_af,
 struct ip_vs_iter_state {
 	struct seq_net_private	p;
 	struct hlist_head	*l;
+	/* the table walked, and its generation */
+	struct hlist_head	*tab;
+	unsigned int		size;
+	unsigned int		seq;
 };
 
+static void ip_vs_conn_iter_tab(struct ip_vs_iter_state *iter)
+{
+	do {
+		iter->seq = read_seqcount_begin(&ip_vs_conn_tab_seq);
+		iter->tab = ip_vs_conn_tab;
+		iter->size = ip_vs_conn_tab_size;
+	} while (read_seqcount_retry(&ip_vs_conn_tab_seq, iter->seq));
+}
+
+/* The table may be replaced and freed while the RCU lock is dropped,
+ * the walk then goes on through the new one.
+ */
+static void ip_vs_conn_iter_resched(struct ip_vs_iter_state *iter)
+{
+	cond_resched_rcu();
+	if (unlikely(read_seqcount_retry(&ip_vs_conn_tab_seq, iter->seq)))
+		ip_vs_conn_iter_tab(iter);
+}
+
 static void *ip_vs_conn_array(struct seq_file *seq, loff_t pos)
 {
 	int idx;
 	struct ip_vs_conn *cp;
 	struct ip_vs_iter_state *iter = seq->private;
 
-	for (idx = 0; idx < ip_vs_conn_tab_size; idx++) {
-		hlist_for_each_entry_rcu(cp, &ip_vs_conn_tab[idx], c_list) {
+	ip_vs_conn_iter_tab(iter);
+	for (idx = 0; idx < iter->size; idx++) {
+		hlist_for_each_entry_rcu(cp, &iter->tab[idx], c_list) {
 			/* __ip_vs_conn_get() is not needed by
 			 * ip_vs_conn_seq_show and ip_vs_conn_sync_seq_show
 			 */
 			if (pos-- == 0) {
-				iter->l = &ip_vs_conn_tab[idx];
+				iter->l = &iter->tab[idx];
 				return cp;
 			}
 		}
-		cond_resched_rcu();
+		ip_vs_conn_iter_resched(iter);
 	}
 
 	return NULL;
@@ -1053,13 +1189,13 @@ static void *ip_vs_conn_seq_next(struct seq_file *seq, void *v, loff_t *pos)
 	if (e)
 		return hlist_entry(e, struct ip_vs_conn, c_list);
 
-	idx = l - ip_vs_conn_tab;
-	while (++idx < ip_vs_conn_tab_size) {
-		hlist_for_each_entry_rcu(cp, &ip_vs_conn_tab[idx], c_list) {
-			iter->l = &ip_vs_conn_tab[idx];
+	idx = l - iter->tab;
+	while (++idx < iter->size) {
+		hlist_for_each_entry_rcu(cp, &iter->tab[idx], c_list) {
+			iter->l = &iter->tab[idx];
 			return cp;
 		}
-		cond_resched_rcu();
+		ip_vs_conn_iter_resched(iter);
 	}
 	iter->l = NULL;
 	return NULL;
@@ -1277,15 +1413,17 @@ void ip_vs_random_dropentry(struct netns_ipvs *ipvs)
 {
 	int idx;
 	struct ip_vs_conn *cp, *cp_c;
+	unsigned int seq;
 
 	rcu_read_lock();
 	/*
 	 * Randomly scan 1/32 of the whole table every second
 	 */
 	for (idx = 0; idx < (ip_vs_conn_tab_size>>5); idx++) {
-		unsigned int hash = prandom_u32() & ip_vs_conn_tab_mask;
+		struct hlist_head *head = ip_vs_conn_bucket(prandom_u32(),
+							    &seq);
 
-		hlist_for_each_entry_rcu(cp, &ip_vs_conn_tab[hash], c_list) {
+		hlist_for_each_entry_rcu(cp, head, c_list) {
 			if (cp->ipvs != ipvs)
 				continue;
 			if (cp->flags & IP_VS_CONN_F_TEMPLATE) {
@@ -1351,12 +1489,17 @@ static void ip_vs_conn_flush(struct netns_ipvs *ipvs)
 {
 	int idx;
 	struct ip_vs_conn *cp, *cp_c;
+	unsigned int seq;
 
 flush_again:
 	rcu_read_lock();
 	for (idx = 0; idx < ip_vs_conn_tab_size; idx++) {
+		/* The table may be resized while the RCU lock is dropped,
+		 * what the walk misses is caught by the conn_count check.
+		 */
+		struct hlist_head *head = ip_vs_conn_bucket(idx, &seq);
 
-		hlist_for_each_entry_rcu(cp, &ip_vs_conn_tab[idx], c_list) {
+		hlist_for_each_entry_rcu(cp, head, c_list) {
 			if (cp->ipvs != ipvs)
 				continue;
 			IP_VS_DBG(4, "del connection\n");
@@ -1380,6 +1523,75 @@ static void ip_vs_conn_flush(struct netns_ipvs *ipvs)
 		goto flush_again;
 	}
 }
+static struct hlist_head *ip_vs_conn_tab_alloc(unsigned int size)
+{
+	struct hlist_head *tab;
+	unsigned int idx;
+
+	tab = kvmalloc_array(size, sizeof(*tab), GFP_KERNEL);
+	if (!tab)
+		return NULL;
+
+	for (idx = 0; idx < size; idx++)
+		INIT_HLIST_HEAD(&tab[idx]);
+
+	return tab;
+}
+
+/* Move all the connections to a table of 1 << bits buckets */
+static void ip_vs_conn_tab_resize(int bits)
+{
+	unsigned int size = 1U << bits, old_size, idx;
+	struct hlist_head *tab, *old_tab;
+	struct ip_vs_conn *cp;
+	struct hlist_node *n;
+
+	tab = ip_vs_conn_tab_alloc(size);
+	if (!tab)
+		return;
+
+	ct_lock_all_bh();
+	write_seqcount_begin(&ip_vs_conn_tab_seq);
+
+	old_tab = ip_vs_conn_tab;
+	old_size = ip_vs_conn_tab_size;
+	for (idx = 0; idx < old_size; idx++) {
+		hlist_for_each_entry_safe(cp, n, &old_tab[idx], c_list) {
+			unsigned int hash = ip_vs_conn_hashkey_conn(cp);
+
+			hlist_del_rcu(&cp->c_list);
+			hlist_add_head_rcu(&cp->c_list, &tab[hash & (size - 1)]);
+		}
+	}
+
+	ip_vs_conn_tab = tab;
+	ip_vs_conn_tab_size = size;
+	ip_vs_conn_tab_mask = size - 1;
+
+	write_seqcount_end(&ip_vs_conn_tab_seq);
+	ct_unlock_all_bh();
+
+	IP_VS_DBG(1, "Connection hash table resized (size=%u, was %u)\n",
+		  size, old_size);
+
+	/* Wait for the lookups still walking the old table */
+	synchronize_net();
+	kvfree(old_tab);
+}
+
+/* Size the table for about one connection per bucket */
+static void ip_vs_conn_resize_work_handler(struct work_struct *work)
+{
+	unsigned int count = atomic_read(&ip_vs_conn_hashed);
+	int bits;
+
+	bits = count ? ilog2(roundup_pow_of_two(count)) : 0;
+	bits = clamp(bits, ip_vs_conn_tab_bits, ip_vs_conn_tab_max_bits);
+
+	if ((1 << bits) != ip_vs_conn_tab_size)
+		ip_vs_conn_tab_resize(bits);
+}
+
 /*
  * per netns init and exit
  */
@@ -1405,14 +1617,18 @@ int __init ip_vs_conn_init(void)
 {
 	int idx;
 
+	ip_vs_conn_tab_max_bits = clamp(ip_vs_conn_tab_max_bits,
+					ip_vs_conn_tab_bits, 30);
+
 	/* Compute size and mask */
 	ip_vs_conn_tab_size = 1 << ip_vs_conn_tab_bits;
 	ip_vs_conn_tab_mask = ip_vs_conn_tab_size - 1;
+	seqcount_init(&ip_vs_conn_tab_seq);
 
 	/*
 	 * Allocate the connection hash table and initialize its list heads
 	 */
-	ip_vs_conn_tab = vmalloc(ip_vs_conn_tab_size * sizeof(*ip_vs_conn_tab));
+	ip_vs_conn_tab = ip_vs_conn_tab_alloc(ip_vs_conn_tab_size);
 	if (!ip_vs_conn_tab)
 		return -ENOMEM;
 
@@ -1421,7 +1637,7 @@ int __init ip_vs_conn_init(void)
 					      sizeof(struct ip_vs_conn), 0,
 					      SLAB_HWCACHE_ALIGN, NULL);
 	if (!ip_vs_conn_cachep) {
-		vfree(ip_vs_conn_tab);
+		kvfree(ip_vs_conn_tab);
 		return -ENOMEM;
 	}
 
@@ -1432,9 +1648,6 @@ int __init ip_vs_conn_init(void)
 	IP_VS_DBG(0, "Each connection entry needs %zd bytes at least\n",
 		  sizeof(struct ip_vs_conn));
 
-	for (idx = 0; idx < ip_vs_conn_tab_size; idx++)
-		INIT_HLIST_HEAD(&ip_vs_conn_tab[idx]);
-
 	for (idx = 0; idx < CT_LOCKARRAY_SIZE; idx++)  {
 		spin_lock_init(&__ip_vs_conntbl_lock_array[idx].l);
 	}
@@ -1447,9 +1660,10 @@ int __init ip_vs_conn_init(void)
 
 void ip_vs_conn_cleanup(void)
 {
+	cancel_work_sync(&ip_vs_conn_resize_work);
 	/* Wait all ip_vs_conn_rcu_free() callbacks to complete */
 	rcu_barrier();
 	/* Release the empty cache */
 	kmem_cache_destroy(ip_vs_conn_cachep);
-	vfree(ip_vs_conn_tab);
+	kvfree(ip_vs_conn_tab);
 }
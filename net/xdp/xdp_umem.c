@@ -0,0 +1,170 @@
+/*
+ * XDP user-space packet buffer
+ *
+ * Copyright (C) 2017 - Linaro Ltd
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/init.h>
+#include <linux/if_ether.h>
+#include <linux/sched/mm.h>
+#include <linux/sched/signal.h>
+#include <linux/sched/task.h>
+#include <linux/uaccess.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+
+#include "xdp_umem.h"
+
+#define XDP_UMEM_MIN_FRAME_SIZE 2048
+
+static void xdp_umem_unpin_pages(struct xdp_umem *umem, u32 npgs)
+{
+	u32 i;
+
+	for (i = 0; i < npgs; i++) {
+		set_page_dirty_lock(umem->pages[i]);
+		put_page(umem->pages[i]);
+	}
+}
+
+static int xdp_umem_pin_pages(struct xdp_umem *umem, unsigned long address)
+{
+	long npgs;
+
+	umem->pages = kcalloc(umem->npgs, sizeof(*umem->pages), GFP_KERNEL);
+	if (!umem->pages)
+		return -ENOMEM;
+
+	down_write(&current->mm->mmap_sem);
+	npgs = get_user_pages(address, umem->npgs, FOLL_WRITE, umem->pages,
+			      NULL);
+	up_write(&current->mm->mmap_sem);
+
+	if (npgs != umem->npgs) {
+		if (npgs > 0)
+			xdp_umem_unpin_pages(umem, npgs);
+		kfree(umem->pages);
+		umem->pages = NULL;
+		return npgs < 0 ? npgs : -ENOMEM;
+	}
+
+	return 0;
+}
+
+/* Charged to RLIMIT_MEMLOCK the way BPF maps are */
+static int xdp_umem_account_pages(struct xdp_umem *umem)
+{
+	unsigned long lock_limit;
+
+	if (capable(CAP_IPC_LOCK))
+		return 0;
+
+	lock_limit = rlimit(RLIMIT_MEMLOCK) >> PAGE_SHIFT;
+	umem->user = get_current_user();
+	if (atomic_long_add_return(umem->npgs, &umem->user->locked_vm) >
+	    lock_limit) {
+		atomic_long_sub(umem->npgs, &umem->user->locked_vm);
+		free_uid(umem->user);
+		umem->user = NULL;
+		return -ENOBUFS;
+	}
+
+	return 0;
+}
+
+static void xdp_umem_unaccount_pages(struct xdp_umem *umem)
+{
+	if (umem->user) {
+		atomic_long_sub(umem->npgs, &umem->user->locked_vm);
+		free_uid(umem->user);
+	}
+}
+
+static int xdp_umem_reg(struct xdp_umem *umem, struct xdp_umem_reg *mr)
+{
+	u32 frame_size = mr->frame_size, frame_headroom = mr->frame_headroom;
+	u64 addr = mr->addr, size = mr->len;
+	int err;
+
+	if (!is_power_of_2(frame_size) ||
+	    frame_size < XDP_UMEM_MIN_FRAME_SIZE || frame_size > PAGE_SIZE)
+		return -EINVAL;
+
+	if (!PAGE_ALIGNED(addr) || !size || (size & (PAGE_SIZE - 1)))
+		return -EINVAL;
+
+	if ((addr + size) < addr || (size >> PAGE_SHIFT) > U32_MAX)
+		return -EINVAL;
+
+	/* Leave room for at least a minimum sized Ethernet frame */
+	if (frame_headroom > frame_size - ETH_ZLEN)
+		return -EINVAL;
+
+	umem->size = size;
+	umem->frame_size = frame_size;
+	umem->frame_headroom = frame_headroom;
+	umem->npgs = size >> PAGE_SHIFT;
+
+	err = xdp_umem_account_pages(umem);
+	if (err)
+		return err;
+
+	err = xdp_umem_pin_pages(umem, (unsigned long)addr);
+	if (err) {
+		xdp_umem_unaccount_pages(umem);
+		return err;
+	}
+
+	return 0;
+}
+
+struct xdp_umem *xdp_umem_create(struct xdp_umem_reg *mr)
+{
+	struct xdp_umem *umem;
+	int err;
+
+	umem = kzalloc(sizeof(*umem), GFP_KERNEL);
+	if (!umem)
+		return ERR_PTR(-ENOMEM);
+
+	err = xdp_umem_reg(umem, mr);
+	if (err) {
+		kfree(umem);
+		return ERR_PTR(err);
+	}
+
+	return umem;
+}
+
+static void xdp_umem_release_deferred(struct work_struct *work)
+{
+	struct xdp_umem *umem = container_of(work, struct xdp_umem, work);
+
+	xskq_destroy(umem->fq);
+	xskq_destroy(umem->cq);
+
+	xdp_umem_unpin_pages(umem, umem->npgs);
+	kfree(umem->pages);
+	xdp_umem_unaccount_pages(umem);
+
+	kfree(umem);
+}
+
+/*
+ * The socket can go away from the last TX completion, in softirq
+ * context, and dirtying the pages takes the page lock.
+ */
+void xdp_umem_destroy(struct xdp_umem *umem)
+{
+	INIT_WORK(&umem->work, xdp_umem_release_deferred);
+	schedule_work(&umem->work);
+}
+
+bool xdp_umem_validate_queues(struct xdp_umem *umem)
+{
+	return umem->fq && umem->cq;
+}
@@ -0,0 +1,43 @@
+/*
+ * XDP user-space packet buffer
+ *
+ * Copyright (C) 2017 - Linaro Ltd
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef XDP_UMEM_H_
+#define XDP_UMEM_H_
+
+#include <linux/mm.h>
+#include <linux/workqueue.h>
+#include <linux/if_xdp.h>
+
+#include "xsk_queue.h"
+
+struct xdp_umem {
+	struct xsk_queue *fq;
+	struct xsk_queue *cq;
+	struct page **pages;
+	u64 size;
+	u32 frame_size;
+	u32 frame_headroom;
+	u32 npgs;
+	struct user_struct *user;
+	struct work_struct work;
+};
+
+/* Frames never cross a page, see xdp_umem_reg() */
+static inline char *xdp_umem_get_data(struct xdp_umem *umem, u64 addr)
+{
+	return page_address(umem->pages[addr >> PAGE_SHIFT]) +
+	       (addr & ~PAGE_MASK);
+}
+
+bool xdp_umem_validate_queues(struct xdp_umem *umem);
+struct xdp_umem *xdp_umem_create(struct xdp_umem_reg *mr);
+void xdp_umem_destroy(struct xdp_umem *umem);
+
+#endif /* XDP_UMEM_H_ */
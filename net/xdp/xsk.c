@@ -0,0 +1,699 @@
+/*
+ * XDP sockets
+ *
+ * Copyright (C) 2017 - Linaro Ltd
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/*
+ * AF_XDP sockets deliver packets to user space without an skb. User
+ * space registers a packet buffer area (the UMEM) split into frames, and
+ * hands free frames to the kernel through the fill ring. An XDP program
+ * redirecting to the socket through a BPF_MAP_TYPE_XSKMAP gets the packet
+ * copied straight into the next free frame, and its descriptor posted to
+ * the RX ring. Sending works the other way around: descriptors posted to
+ * the TX ring are sent on sendmsg(), and the frames come back through the
+ * completion ring once the driver is done with them.
+ *
+ * All four rings are mmap()ed by user space. The kernel only publishes
+ * its ring index once per batch, and the socket is woken up once per
+ * NAPI poll, from xdp_do_flush_map().
+ */
+
+#include <linux/if_xdp.h>
+#include <linux/if_ether.h>
+#include <linux/init.h>
+#include <linux/sched/mm.h>
+#include <linux/sched/signal.h>
+#include <linux/sched/task.h>
+#include <linux/socket.h>
+#include <linux/file.h>
+#include <linux/uaccess.h>
+#include <linux/net.h>
+#include <linux/netdevice.h>
+#include <linux/filter.h>
+#include <net/xdp_sock.h>
+
+#include "xsk_queue.h"
+#include "xdp_umem.h"
+
+#define TX_BATCH_SIZE 16
+
+struct xsk_flush_node {
+	struct list_head list;
+	struct xdp_sock *xs;
+};
+
+static DEFINE_PER_CPU(struct list_head, xsk_flush_list);
+
+static int __xsk_rcv(struct xdp_sock *xs, struct xdp_buff *xdp)
+{
+	struct xdp_umem *umem = xs->umem;
+	u32 len = xdp->data_end - xdp->data;
+	u64 addr;
+	int err;
+
+	if (!xskq_peek_addr(umem->fq, &addr) ||
+	    len > umem->frame_size - umem->frame_headroom) {
+		xs->rx_dropped++;
+		return -ENOSPC;
+	}
+
+	addr += umem->frame_headroom;
+	memcpy(xdp_umem_get_data(umem, addr), xdp->data, len);
+
+	err = xskq_produce_batch_desc(xs->rx, addr, len);
+	if (err) {
+		xs->rx_dropped++;
+		return err;
+	}
+
+	xskq_discard_addr(umem->fq);
+	return 0;
+}
+
+static bool xsk_is_bound(struct xdp_sock *xs, struct net_device *dev)
+{
+	/* Pairs with the barrier in xsk_bind() */
+	if (READ_ONCE(xs->dev) != dev)
+		return false;
+	smp_rmb();
+
+	return xs->rx;
+}
+
+/* Called from the driver's NAPI poll, through xdp_do_redirect() */
+int xsk_rcv(struct xdp_sock *xs, struct xdp_buff *xdp, struct net_device *dev)
+{
+	struct xsk_flush_node *node;
+	int err;
+
+	if (!xsk_is_bound(xs, dev))
+		return -EINVAL;
+
+	spin_lock(&xs->rx_lock);
+	err = __xsk_rcv(xs, xdp);
+	spin_unlock(&xs->rx_lock);
+	if (err)
+		return err;
+
+	node = this_cpu_ptr(xs->flush_node);
+	if (list_empty(&node->list))
+		list_add(&node->list, this_cpu_ptr(&xsk_flush_list));
+
+	return 0;
+}
+
+static void xsk_flush(struct xdp_sock *xs)
+{
+	spin_lock(&xs->rx_lock);
+	xskq_produce_flush_desc(xs->rx);
+	spin_unlock(&xs->rx_lock);
+
+	xs->sk.sk_data_ready(&xs->sk);
+}
+
+void __xsk_map_flush(void)
+{
+	struct list_head *flush_list = this_cpu_ptr(&xsk_flush_list);
+	struct xsk_flush_node *node, *tmp;
+
+	list_for_each_entry_safe(node, tmp, flush_list, list) {
+		xsk_flush(node->xs);
+		list_del_init(&node->list);
+	}
+}
+
+/* Generic XDP has no NAPI poll to batch over, publish right away */
+int xsk_generic_rcv(struct xdp_sock *xs, struct xdp_buff *xdp,
+		    struct net_device *dev)
+{
+	int err;
+
+	if (!xsk_is_bound(xs, dev))
+		return -EINVAL;
+
+	spin_lock(&xs->rx_lock);
+	err = __xsk_rcv(xs, xdp);
+	if (!err)
+		xskq_produce_flush_desc(xs->rx);
+	spin_unlock(&xs->rx_lock);
+
+	if (!err)
+		xs->sk.sk_data_ready(&xs->sk);
+	return err;
+}
+
+static void xsk_destruct_skb(struct sk_buff *skb)
+{
+	u64 addr = (u64)(long)skb_shinfo(skb)->destructor_arg;
+	struct xdp_sock *xs = xdp_sk(skb->sk);
+	unsigned long flags;
+
+	spin_lock_irqsave(&xs->tx_completion_lock, flags);
+	xskq_produce_addr(xs->umem->cq, addr);
+	spin_unlock_irqrestore(&xs->tx_completion_lock, flags);
+
+	sock_wfree(skb);
+}
+
+/*
+ * Called with the socket mutex held. A descriptor too large for the
+ * device is left on the ring, and the error reported to the sender.
+ */
+static int xsk_generic_xmit(struct sock *sk)
+{
+	struct xdp_sock *xs = xdp_sk(sk);
+	struct net_device *dev = xs->dev;
+	u32 max_batch = TX_BATCH_SIZE;
+	struct xdp_desc desc;
+	struct sk_buff *skb;
+	int err = 0;
+
+	if (unlikely(!(dev->flags & IFF_UP)))
+		return -ENETDOWN;
+
+	while (xskq_peek_desc(xs->tx, &desc)) {
+		u32 len = desc.len;
+
+		if (max_batch-- == 0) {
+			err = -EAGAIN;
+			break;
+		}
+
+		if (unlikely(len < ETH_HLEN ||
+			     len > dev->mtu + dev->hard_header_len)) {
+			err = -EMSGSIZE;
+			break;
+		}
+
+		/* Make sure the frame can be handed back once sent */
+		if (xskq_reserve_addr(xs->umem->cq)) {
+			err = -EAGAIN;
+			break;
+		}
+
+		skb = sock_alloc_send_skb(sk, len, 1, &err);
+		if (unlikely(!skb)) {
+			xs->umem->cq->prod_head--;
+			err = -EAGAIN;
+			break;
+		}
+
+		memcpy(skb_put(skb, len), xdp_umem_get_data(xs->umem, desc.addr),
+		       len);
+		skb_reset_mac_header(skb);
+		skb->protocol = eth_hdr(skb)->h_proto;
+		skb->dev = dev;
+		skb->priority = sk->sk_priority;
+		skb->mark = sk->sk_mark;
+		skb_shinfo(skb)->destructor_arg = (void *)(long)desc.addr;
+		skb->destructor = xsk_destruct_skb;
+
+		/* The frame is owned by the skb from here on */
+		xskq_discard_desc(xs->tx);
+
+		err = net_xmit_errno(dev_queue_xmit(skb));
+		if (err)
+			break;
+	}
+
+	xskq_release(xs->tx);
+	return err;
+}
+
+static int xsk_sendmsg(struct socket *sock, struct msghdr *m, size_t total_len)
+{
+	struct sock *sk = sock->sk;
+	struct xdp_sock *xs = xdp_sk(sk);
+	int err;
+
+	/* sendmsg() only kicks the TX ring, there is nothing to wait for */
+	if (!(m->msg_flags & MSG_DONTWAIT))
+		return -EOPNOTSUPP;
+
+	mutex_lock(&xs->mutex);
+	if (unlikely(!xs->dev))
+		err = -ENXIO;
+	else if (unlikely(!xs->tx))
+		err = -ENOBUFS;
+	else
+		err = xsk_generic_xmit(sk);
+	mutex_unlock(&xs->mutex);
+
+	return err;
+}
+
+static unsigned int xsk_poll(struct file *file, struct socket *sock,
+			     struct poll_table_struct *wait)
+{
+	unsigned int mask = datagram_poll(file, sock, wait);
+	struct xdp_sock *xs = xdp_sk(sock->sk);
+	struct xsk_queue *rx = READ_ONCE(xs->rx), *tx = READ_ONCE(xs->tx);
+
+	if (rx && !xskq_empty_desc(rx))
+		mask |= POLLIN | POLLRDNORM;
+	if (tx && !xskq_full_desc(tx))
+		mask |= POLLOUT | POLLWRNORM;
+
+	return mask;
+}
+
+static int xsk_init_queue(u32 entries, struct xsk_queue **queue,
+			  bool umem_queue)
+{
+	struct xsk_queue *q;
+
+	if (entries == 0 || *queue || !is_power_of_2(entries))
+		return -EINVAL;
+
+	q = xskq_create(entries, umem_queue);
+	if (!q)
+		return -ENOMEM;
+
+	/* Make sure queue is ready before it can be seen by others */
+	smp_wmb();
+	WRITE_ONCE(*queue, q);
+	return 0;
+}
+
+static int xsk_release(struct socket *sock)
+{
+	struct sock *sk = sock->sk;
+	struct xdp_sock *xs;
+	struct net_device *dev;
+	struct net *net;
+
+	if (!sk)
+		return 0;
+
+	xs = xdp_sk(sk);
+	net = sock_net(sk);
+
+	local_bh_disable();
+	sock_prot_inuse_add(net, sk->sk_prot, -1);
+	local_bh_enable();
+
+	mutex_lock(&xs->mutex);
+	dev = xs->dev;
+	WRITE_ONCE(xs->dev, NULL);
+	mutex_unlock(&xs->mutex);
+
+	if (dev) {
+		/* Wait for redirects in flight, and their flushes, which
+		 * all run from NAPI or softirq context.
+		 */
+		synchronize_sched();
+		dev_put(dev);
+	}
+
+	sock_orphan(sk);
+	sock->sk = NULL;
+
+	sock_put(sk);
+	return 0;
+}
+
+static int xsk_bind(struct socket *sock, struct sockaddr *addr, int addr_len)
+{
+	struct sockaddr_xdp *sxdp = (struct sockaddr_xdp *)addr;
+	struct sock *sk = sock->sk;
+	struct xdp_sock *xs = xdp_sk(sk);
+	struct net_device *dev;
+	int err = 0;
+
+	if (addr_len < sizeof(struct sockaddr_xdp))
+		return -EINVAL;
+	if (sxdp->sxdp_family != AF_XDP)
+		return -EINVAL;
+	/* Packets are always copied to and from the UMEM for now */
+	if (sxdp->sxdp_flags)
+		return -EINVAL;
+
+	mutex_lock(&xs->mutex);
+	if (xs->dev) {
+		err = -EBUSY;
+		goto out_release;
+	}
+
+	dev = dev_get_by_index(sock_net(sk), sxdp->sxdp_ifindex);
+	if (!dev) {
+		err = -ENODEV;
+		goto out_release;
+	}
+
+	if ((!xs->rx && !xs->tx) || !xs->umem ||
+	    !xdp_umem_validate_queues(xs->umem)) {
+		err = -EINVAL;
+		goto out_unlock;
+	}
+
+	xskq_set_umem(xs->tx, xs->umem->size, xs->umem->frame_size);
+
+	/* Everything set up above must be visible before the device is */
+	smp_wmb();
+	WRITE_ONCE(xs->dev, dev);
+	goto out_release;
+
+out_unlock:
+	dev_put(dev);
+out_release:
+	mutex_unlock(&xs->mutex);
+	return err;
+}
+
+static int xsk_setsockopt(struct socket *sock, int level, int optname,
+			  char __user *optval, unsigned int optlen)
+{
+	struct sock *sk = sock->sk;
+	struct xdp_sock *xs = xdp_sk(sk);
+	int err;
+
+	if (level != SOL_XDP)
+		return -ENOPROTOOPT;
+
+	switch (optname) {
+	case XDP_RX_RING:
+	case XDP_TX_RING:
+	{
+		struct xsk_queue **q;
+		int entries;
+
+		if (optlen < sizeof(entries))
+			return -EINVAL;
+		if (copy_from_user(&entries, optval, sizeof(entries)))
+			return -EFAULT;
+
+		mutex_lock(&xs->mutex);
+		if (xs->dev) {
+			err = -EBUSY;
+		} else {
+			q = (optname == XDP_TX_RING) ? &xs->tx : &xs->rx;
+			err = xsk_init_queue(entries, q, false);
+		}
+		mutex_unlock(&xs->mutex);
+		return err;
+	}
+	case XDP_UMEM_REG:
+	{
+		struct xdp_umem_reg mr;
+		struct xdp_umem *umem;
+
+		if (optlen < sizeof(mr))
+			return -EINVAL;
+		if (copy_from_user(&mr, optval, sizeof(mr)))
+			return -EFAULT;
+
+		mutex_lock(&xs->mutex);
+		if (xs->umem) {
+			mutex_unlock(&xs->mutex);
+			return -EBUSY;
+		}
+
+		umem = xdp_umem_create(&mr);
+		if (IS_ERR(umem)) {
+			mutex_unlock(&xs->mutex);
+			return PTR_ERR(umem);
+		}
+
+		/* Make sure umem is ready before it can be seen by others */
+		smp_wmb();
+		WRITE_ONCE(xs->umem, umem);
+		mutex_unlock(&xs->mutex);
+		return 0;
+	}
+	case XDP_UMEM_FILL_RING:
+	case XDP_UMEM_COMPLETION_RING:
+	{
+		struct xsk_queue **q;
+		int entries;
+
+		if (optlen < sizeof(entries))
+			return -EINVAL;
+		if (copy_from_user(&entries, optval, sizeof(entries)))
+			return -EFAULT;
+
+		mutex_lock(&xs->mutex);
+		if (!xs->umem) {
+			err = -EINVAL;
+		} else if (xs->dev) {
+			err = -EBUSY;
+		} else {
+			q = (optname == XDP_UMEM_FILL_RING) ? &xs->umem->fq :
+							      &xs->umem->cq;
+			err = xsk_init_queue(entries, q, true);
+			if (!err)
+				xskq_set_umem(*q, xs->umem->size,
+					      xs->umem->frame_size);
+		}
+		mutex_unlock(&xs->mutex);
+		return err;
+	}
+	default:
+		break;
+	}
+
+	return -ENOPROTOOPT;
+}
+
+static int xsk_getsockopt(struct socket *sock, int level, int optname,
+			  char __user *optval, int __user *optlen)
+{
+	struct sock *sk = sock->sk;
+	struct xdp_sock *xs = xdp_sk(sk);
+	int len;
+
+	if (level != SOL_XDP)
+		return -ENOPROTOOPT;
+
+	if (get_user(len, optlen))
+		return -EFAULT;
+	if (len < 0)
+		return -EINVAL;
+
+	switch (optname) {
+	case XDP_STATISTICS:
+	{
+		struct xdp_statistics stats;
+
+		if (len < sizeof(stats))
+			return -EINVAL;
+
+		mutex_lock(&xs->mutex);
+		stats.rx_dropped = xs->rx_dropped;
+		stats.rx_invalid_descs =
+			xs->umem ? xskq_nb_invalid_descs(xs->umem->fq) : 0;
+		stats.tx_invalid_descs = xskq_nb_invalid_descs(xs->tx);
+		mutex_unlock(&xs->mutex);
+
+		if (copy_to_user(optval, &stats, sizeof(stats)))
+			return -EFAULT;
+		if (put_user(sizeof(stats), optlen))
+			return -EFAULT;
+
+		return 0;
+	}
+	case XDP_MMAP_OFFSETS:
+	{
+		struct xdp_mmap_offsets off;
+
+		if (len < sizeof(off))
+			return -EINVAL;
+
+		off.rx.producer = offsetof(struct xdp_rxtx_ring, ptrs.producer);
+		off.rx.consumer = offsetof(struct xdp_rxtx_ring, ptrs.consumer);
+		off.rx.desc	= offsetof(struct xdp_rxtx_ring, desc);
+		off.tx.producer = offsetof(struct xdp_rxtx_ring, ptrs.producer);
+		off.tx.consumer = offsetof(struct xdp_rxtx_ring, ptrs.consumer);
+		off.tx.desc	= offsetof(struct xdp_rxtx_ring, desc);
+
+		off.fr.producer = offsetof(struct xdp_umem_ring, ptrs.producer);
+		off.fr.consumer = offsetof(struct xdp_umem_ring, ptrs.consumer);
+		off.fr.desc	= offsetof(struct xdp_umem_ring, desc);
+		off.cr.producer = offsetof(struct xdp_umem_ring, ptrs.producer);
+		off.cr.consumer = offsetof(struct xdp_umem_ring, ptrs.consumer);
+		off.cr.desc	= offsetof(struct xdp_umem_ring, desc);
+
+		len = sizeof(off);
+		if (copy_to_user(optval, &off, len))
+			return -EFAULT;
+		if (put_user(len, optlen))
+			return -EFAULT;
+
+		return 0;
+	}
+	default:
+		break;
+	}
+
+	return -EOPNOTSUPP;
+}
+
+static int xsk_mmap(struct file *file, struct socket *sock,
+		    struct vm_area_struct *vma)
+{
+	u64 offset = (u64)vma->vm_pgoff << PAGE_SHIFT;
+	unsigned long size = vma->vm_end - vma->vm_start;
+	struct xdp_sock *xs = xdp_sk(sock->sk);
+	struct xsk_queue *q = NULL;
+	struct xdp_umem *umem;
+	unsigned long pfn;
+	struct page *qpg;
+
+	if (offset == XDP_PGOFF_RX_RING) {
+		q = READ_ONCE(xs->rx);
+	} else if (offset == XDP_PGOFF_TX_RING) {
+		q = READ_ONCE(xs->tx);
+	} else {
+		umem = READ_ONCE(xs->umem);
+		if (!umem)
+			return -EINVAL;
+
+		/* Matches the smp_wmb() in XDP_UMEM_REG */
+		smp_rmb();
+		if (offset == XDP_UMEM_PGOFF_FILL_RING)
+			q = READ_ONCE(umem->fq);
+		else if (offset == XDP_UMEM_PGOFF_COMPLETION_RING)
+			q = READ_ONCE(umem->cq);
+	}
+
+	if (!q)
+		return -EINVAL;
+
+	/* Matches the smp_wmb() in xsk_init_queue */
+	smp_rmb();
+	qpg = virt_to_head_page(q->ring);
+	if (size > (PAGE_SIZE << compound_order(qpg)))
+		return -EINVAL;
+
+	pfn = virt_to_phys(q->ring) >> PAGE_SHIFT;
+	return remap_pfn_range(vma, vma->vm_start, pfn,
+			       size, vma->vm_page_prot);
+}
+
+static struct proto xsk_proto = {
+	.name =		"XDP",
+	.owner =	THIS_MODULE,
+	.obj_size =	sizeof(struct xdp_sock),
+};
+
+static const struct proto_ops xsk_proto_ops = {
+	.family		= PF_XDP,
+	.owner		= THIS_MODULE,
+	.release	= xsk_release,
+	.bind		= xsk_bind,
+	.connect	= sock_no_connect,
+	.socketpair	= sock_no_socketpair,
+	.accept		= sock_no_accept,
+	.getname	= sock_no_getname,
+	.poll		= xsk_poll,
+	.ioctl		= sock_no_ioctl,
+	.listen		= sock_no_listen,
+	.shutdown	= sock_no_shutdown,
+	.setsockopt	= xsk_setsockopt,
+	.getsockopt	= xsk_getsockopt,
+	.sendmsg	= xsk_sendmsg,
+	.recvmsg	= sock_no_recvmsg,
+	.mmap		= xsk_mmap,
+	.sendpage	= sock_no_sendpage,
+};
+
+static void xsk_destruct(struct sock *sk)
+{
+	struct xdp_sock *xs = xdp_sk(sk);
+
+	if (!sock_flag(sk, SOCK_DEAD))
+		return;
+
+	xskq_destroy(xs->rx);
+	xskq_destroy(xs->tx);
+	if (xs->umem)
+		xdp_umem_destroy(xs->umem);
+	free_percpu(xs->flush_node);
+}
+
+static int xsk_create(struct net *net, struct socket *sock, int protocol,
+		      int kern)
+{
+	struct xsk_flush_node *node;
+	struct xdp_sock *xs;
+	struct sock *sk;
+	int cpu;
+
+	if (!ns_capable(net->user_ns, CAP_NET_RAW))
+		return -EPERM;
+	if (sock->type != SOCK_RAW)
+		return -ESOCKTNOSUPPORT;
+
+	if (protocol)
+		return -EPROTONOSUPPORT;
+
+	sock->state = SS_UNCONNECTED;
+
+	sk = sk_alloc(net, PF_XDP, GFP_KERNEL, &xsk_proto, kern);
+	if (!sk)
+		return -ENOBUFS;
+
+	xs = xdp_sk(sk);
+	xs->flush_node = alloc_percpu(struct xsk_flush_node);
+	if (!xs->flush_node) {
+		sk_free(sk);
+		return -ENOMEM;
+	}
+
+	for_each_possible_cpu(cpu) {
+		node = per_cpu_ptr(xs->flush_node, cpu);
+		INIT_LIST_HEAD(&node->list);
+		node->xs = xs;
+	}
+
+	sock->ops = &xsk_proto_ops;
+	sock_init_data(sock, sk);
+
+	sk->sk_family = PF_XDP;
+	sk->sk_destruct = xsk_destruct;
+
+	mutex_init(&xs->mutex);
+	spin_lock_init(&xs->rx_lock);
+	spin_lock_init(&xs->tx_completion_lock);
+
+	local_bh_disable();
+	sock_prot_inuse_add(net, &xsk_proto, 1);
+	local_bh_enable();
+
+	return 0;
+}
+
+static const struct net_proto_family xsk_family_ops = {
+	.family = PF_XDP,
+	.create = xsk_create,
+	.owner	= THIS_MODULE,
+};
+
+static int __init xsk_init(void)
+{
+	int err, cpu;
+
+	for_each_possible_cpu(cpu)
+		INIT_LIST_HEAD(per_cpu_ptr(&xsk_flush_list, cpu));
+
+	err = proto_register(&xsk_proto, 0 /* no slab */);
+	if (err)
+		goto out;
+
+	err = sock_register(&xsk_family_ops);
+	if (err)
+		goto out_proto;
+
+	return 0;
+
+out_proto:
+	proto_unregister(&xsk_proto);
+out:
+	return err;
+}
+
+fs_initcall(xsk_init);
@@ -0,0 +1,88 @@
+#ifndef ARCH_PERF_ARM64_EXCEPTION_TYPES_H
+#define ARCH_PERF_ARM64_EXCEPTION_TYPES_H
+
+/* Per asm/kvm_asm.h */
+#define ARM_EXCEPTION_IRQ		0
+#define ARM_EXCEPTION_EL1_SERROR	1
+#define ARM_EXCEPTION_TRAP		2
+/* A pending SError is flagged on top of any of the above */
+#define ARM_EXCEPTION_CODE(x)		((x) & ~(1U << 31))
+
+#define kvm_arm_exception_type				\
+	{ARM_EXCEPTION_IRQ,		"IRQ" },	\
+	{ARM_EXCEPTION_EL1_SERROR,	"SERROR" },	\
+	{ARM_EXCEPTION_TRAP,		"TRAP" }
+
+/* Per asm/esr.h */
+#define ESR_ELx_EC_UNKNOWN	(0x00)
+#define ESR_ELx_EC_WFx		(0x01)
+#define ESR_ELx_EC_CP15_32	(0x03)
+#define ESR_ELx_EC_CP15_64	(0x04)
+#define ESR_ELx_EC_CP14_MR	(0x05)
+#define ESR_ELx_EC_CP14_LS	(0x06)
+#define ESR_ELx_EC_FP_ASIMD	(0x07)
+#define ESR_ELx_EC_CP10_ID	(0x08)
+#define ESR_ELx_EC_CP14_64	(0x0C)
+#define ESR_ELx_EC_ILL		(0x0E)
+#define ESR_ELx_EC_SVC32	(0x11)
+#define ESR_ELx_EC_HVC32	(0x12)
+#define ESR_ELx_EC_SMC32	(0x13)
+#define ESR_ELx_EC_SVC64	(0x15)
+#define ESR_ELx_EC_HVC64	(0x16)
+#define ESR_ELx_EC_SMC64	(0x17)
+#define ESR_ELx_EC_SYS64	(0x18)
+#define ESR_ELx_EC_ERET		(0x1A)
+#define ESR_ELx_EC_IMP_DEF	(0x1f)
+#define ESR_ELx_EC_IABT_LOW	(0x20)
+#define ESR_ELx_EC_IABT_CUR	(0x21)
+#define ESR_ELx_EC_PC_ALIGN	(0x22)
+#define ESR_ELx_EC_DABT_LOW	(0x24)
+#define ESR_ELx_EC_DABT_CUR	(0x25)
+#define ESR_ELx_EC_SP_ALIGN	(0x26)
+#define ESR_ELx_EC_FP_EXC32	(0x28)
+#define ESR_ELx_EC_FP_EXC64	(0x2C)
+#define ESR_ELx_EC_SERROR	(0x2F)
+#define ESR_ELx_EC_BREAKPT_LOW	(0x30)
+#define ESR_ELx_EC_BREAKPT_CUR	(0x31)
+#define ESR_ELx_EC_SOFTSTP_LOW	(0x32)
+#define ESR_ELx_EC_SOFTSTP_CUR	(0x33)
+#define ESR_ELx_EC_WATCHPT_LOW	(0x34)
+#define ESR_ELx_EC_WATCHPT_CUR	(0x35)
+#define ESR_ELx_EC_BKPT32	(0x38)
+#define ESR_ELx_EC_VECTOR32	(0x3A)
+#define ESR_ELx_EC_BRK64	(0x3C)
+
+#define ECN(x) { ESR_ELx_EC_##x, #x }
+
+#define kvm_arm_exception_class \
+	ECN(UNKNOWN), ECN(WFx), ECN(CP15_32), ECN(CP15_64), ECN(CP14_MR), \
+	ECN(CP14_LS), ECN(FP_ASIMD), ECN(CP10_ID), ECN(CP14_64), ECN(ILL), \
+	ECN(SVC32), ECN(HVC32), ECN(SMC32), ECN(SVC64), ECN(HVC64), \
+	ECN(SMC64), ECN(SYS64), ECN(ERET), ECN(IMP_DEF), ECN(IABT_LOW), \
+	ECN(IABT_CUR), ECN(PC_ALIGN), ECN(DABT_LOW), ECN(DABT_CUR), \
+	ECN(SP_ALIGN), ECN(FP_EXC32), ECN(FP_EXC64), ECN(SERROR), \
+	ECN(BREAKPT_LOW), ECN(BREAKPT_CUR), ECN(SOFTSTP_LOW), \
+	ECN(SOFTSTP_CUR), ECN(WATCHPT_LOW), ECN(WATCHPT_CUR), \
+	ECN(BKPT32), ECN(VECTOR32), ECN(BRK64)
+
+/* Per asm/kvm_nested_pv_encoding.h, the top bits of the PV HVC immediate */
+#define PV_INSTR_SHIFT	13
+
+#define kvm_arm_pv_instr		\
+	{0x0,	"HVC_NPV" },		\
+	{0x1,	"MRS_PV" },		\
+	{0x2,	"MSR_REG_PV" },		\
+	{0x3,	"MSR_IMM_PV" },		\
+	{0x4,	"ERET_PV" },		\
+	{0x5,	"TLBI_PV" },		\
+	{0x6,	"HVC_PV" },		\
+	{0x7,	"BATCH_PV" }
+
+/* Per asm/kvm_arm.h */
+#define KVM_GUEST_CTXT_NONE	0
+#define KVM_GUEST_CTXT_L1_GUEST	1
+#define KVM_GUEST_CTXT_L1_HYP	2
+#define KVM_GUEST_CTXT_L2_GUEST	3
+#define KVM_GUEST_CTXT_NR	4
+
+#endif /* ARCH_PERF_ARM64_EXCEPTION_TYPES_H */
@@ -0,0 +1,145 @@
+/*
+ * Arch specific functions for perf kvm stat.
+ *
+ * Copyright (C) 2017 - Linaro Ltd
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <errno.h>
+#include "../../util/kvm-stat.h"
+#include "arm64_exception_types.h"
+
+define_exit_reasons_table(arm64_exit_reasons, kvm_arm_exception_type);
+define_exit_reasons_table(arm64_trap_exit_reasons, kvm_arm_exception_class);
+define_exit_reasons_table(arm64_pv_exit_reasons, kvm_arm_pv_instr);
+
+const char *vcpu_id_str = "vcpu_id";
+const int decode_str_len = 24;
+const char *kvm_exit_reason = "exit_reason";
+const char *kvm_entry_trace = "kvm:kvm_entry";
+const char *kvm_exit_trace = "kvm:kvm_exit";
+
+/*
+ * The exception class, the exception type and the PV instruction are all
+ * small integers, so key->info tells them, and the context the vcpu ran
+ * in, apart.
+ */
+#define EXIT_KIND_EXCEPTION	0
+#define EXIT_KIND_TRAP		1
+#define EXIT_KIND_PV		2
+#define EXIT_KIND_BITS		2
+
+#define exit_info(ctxt, kind)	(((ctxt) << EXIT_KIND_BITS) | (kind))
+#define exit_info_ctxt(info)	((info) >> EXIT_KIND_BITS)
+
+static const char * const guest_ctxt_names[KVM_GUEST_CTXT_NR] = {
+	[KVM_GUEST_CTXT_NONE]		= NULL,
+	[KVM_GUEST_CTXT_L1_GUEST]	= "L1",
+	[KVM_GUEST_CTXT_L1_HYP]		= "L1 hyp",
+	[KVM_GUEST_CTXT_L2_GUEST]	= "L2",
+};
+
+static void event_exit_get_key(struct perf_evsel *evsel,
+			       struct perf_sample *sample,
+			       struct event_key *key)
+{
+	u64 idx = ARM_EXCEPTION_CODE(perf_evsel__intval(evsel, sample, "idx"));
+	int ctxt = perf_evsel__intval(evsel, sample, "ctxt");
+
+	if (ctxt < 0 || ctxt >= KVM_GUEST_CTXT_NR)
+		ctxt = KVM_GUEST_CTXT_NONE;
+
+	if (idx == ARM_EXCEPTION_TRAP) {
+		key->key = perf_evsel__intval(evsel, sample, kvm_exit_reason);
+		key->info = exit_info(ctxt, EXIT_KIND_TRAP);
+		key->exit_reasons = arm64_trap_exit_reasons;
+	} else {
+		key->key = idx;
+		key->info = exit_info(ctxt, EXIT_KIND_EXCEPTION);
+		key->exit_reasons = arm64_exit_reasons;
+	}
+}
+
+static bool event_exit_begin(struct perf_evsel *evsel,
+			     struct perf_sample *sample,
+			     struct event_key *key)
+{
+	if (kvm_exit_event(evsel)) {
+		event_exit_get_key(evsel, sample, key);
+		return true;
+	}
+
+	return false;
+}
+
+/* A PV HVC is only ever issued by the guest hypervisor */
+static void event_nested_pv_get_key(struct perf_evsel *evsel,
+				    struct perf_sample *sample,
+				    struct event_key *key)
+{
+	u64 imm = perf_evsel__intval(evsel, sample, "imm");
+
+	key->key = imm >> PV_INSTR_SHIFT;
+	key->info = exit_info(KVM_GUEST_CTXT_L1_HYP, EXIT_KIND_PV);
+	key->exit_reasons = arm64_pv_exit_reasons;
+}
+
+static void event_exit_decode_key(struct perf_kvm_stat *kvm,
+				  struct event_key *key,
+				  char *decode)
+{
+	const char *ctxt = guest_ctxt_names[exit_info_ctxt(key->info)];
+	char reason[decode_str_len];
+
+	exit_event_decode_key(kvm, key, reason);
+	if (ctxt)
+		scnprintf(decode, decode_str_len, "%s (%s)", reason, ctxt);
+	else
+		scnprintf(decode, decode_str_len, "%s", reason);
+}
+
+static struct child_event_ops child_events[] = {
+	{ .name = "kvm:kvm_nested_pv",
+	  .get_key = event_nested_pv_get_key },
+	{ NULL, NULL },
+};
+
+static struct kvm_events_ops exit_events = {
+	.is_begin_event = event_exit_begin,
+	.is_end_event = exit_event_end,
+	.child_ops = child_events,
+	.decode_key = event_exit_decode_key,
+	.name = "VM-EXIT"
+};
+
+const char *kvm_events_tp[] = {
+	"kvm:kvm_entry",
+	"kvm:kvm_exit",
+	"kvm:kvm_nested_pv",
+	NULL,
+};
+
+struct kvm_reg_events_ops kvm_reg_events_ops[] = {
+	{ .name = "vmexit", .ops = &exit_events },
+	{ NULL, NULL },
+};
+
+/* Waiting for an interrupt is idle time, wherever the vcpu waits */
+const char * const kvm_skip_events[] = {
+	"WFx",
+	"WFx (L1)",
+	"WFx (L1 hyp)",
+	"WFx (L2)",
+	NULL,
+};
+
+int cpu_isa_init(struct perf_kvm_stat *kvm, const char *cpuid __maybe_unused)
+{
+	kvm->exit_reasons = arm64_exit_reasons;
+	kvm->exit_reasons_isa = "arm64";
+
+	return 0;
+}
@@ -158,10 +158,13 @@ static void clear_events_cache_stats(struct list_head *kvm_events_cache)
 			/* reset stats for event */
 			event->total.time = 0;
 			init_stats(&event->total.stats);
+			memset(event->total.hist, 0, sizeof(event->total.hist));
 
 			for (j = 0; j < event->max_vcpu; ++j) {
 				event->vcpu[j].time = 0;
 				init_stats(&event->vcpu[j].stats);
+				memset(event->vcpu[j].hist, 0,
+				       sizeof(event->vcpu[j].hist));
 			}
 		}
 	}
@@ -252,8 +255,17 @@ static bool handle_begin_event(struct perf_kvm_stat *kvm,
 static void
 kvm_update_event_stats(struct kvm_event_stats *kvm_stats, u64 time_diff)
 {
+	u64 usecs = time_diff / NSEC_PER_USEC;
+	int bucket = 0;
+
 	kvm_stats->time += time_diff;
 	update_stats(&kvm_stats->stats, time_diff);
+
+	while (usecs && bucket < KVM_EVENT_HIST_BUCKETS - 1) {
+		usecs >>= 1;
+		bucket++;
+	}
+	kvm_stats->hist[bucket]++;
 }
 
 static double kvm_event_rel_stddev(int vcpu_id, struct kvm_event *event)
@@ -594,6 +606,41 @@ static void show_timeofday(void)
 	return;
 }
 
+#define HIST_BAR_WIDTH	40
+
+static void print_hist(struct kvm_event *event, int vcpu)
+{
+	static const char bar[] = "****************************************";
+	struct kvm_event_stats *kvm_stats = &event->total;
+	u64 peak = 0;
+	int i, last = 0;
+
+	if (vcpu != -1)
+		kvm_stats = &event->vcpu[vcpu];
+
+	for (i = 0; i < KVM_EVENT_HIST_BUCKETS; i++) {
+		if (!kvm_stats->hist[i])
+			continue;
+		peak = max(peak, kvm_stats->hist[i]);
+		last = i;
+	}
+
+	for (i = 0; i <= last; i++) {
+		u64 count = kvm_stats->hist[i];
+		int len = count * HIST_BAR_WIDTH / peak;
+
+		pr_info("%*s %8llu", decode_str_len, "",
+			i ? 1ULL << (i - 1) : 0ULL);
+		if (i < KVM_EVENT_HIST_BUCKETS - 1)
+			pr_info(" -> %-8llu", 1ULL << i);
+		else
+			pr_info(" -> %-8s", "");
+		pr_info(" us %10llu |%-*.*s|\n", (unsigned long long)count,
+			HIST_BAR_WIDTH, len, bar);
+	}
+	pr_info("\n");
+}
+
 static void print_result(struct perf_kvm_stat *kvm)
 {
 	char decode[decode_str_len];
@@ -635,6 +682,9 @@ static void print_result(struct perf_kvm_stat *kvm)
 		pr_info("%9.2fus ( +-%7.2f%% )", (double)etime / ecount / NSEC_PER_USEC,
 			kvm_event_rel_stddev(vcpu, event));
 		pr_info("\n");
+
+		if (kvm->hist)
+			print_hist(event, vcpu);
 	}
 
 	pr_info("\nTotal Samples:%" PRIu64 ", Total events handled time:%.2fus.\n\n",
@@ -1248,6 +1298,8 @@ kvm_events_report(struct perf_kvm_stat *kvm, int argc, const char **argv)
 		OPT_STRING('p', "pid", &kvm->opts.target.pid, "pid",
 			   "analyze events only for given process id(s)"),
 		OPT_BOOLEAN('f', "force", &kvm->force, "don't complain, do it"),
+		OPT_BOOLEAN(0, "hist", &kvm->hist,
+			    "show a histogram of the duration of each event"),
 		OPT_END()
 	};
 
@@ -1353,6 +1405,8 @@ static int kvm_events_live(struct perf_kvm_stat *kvm,
 			" that take longer than duration usecs"),
 		OPT_UINTEGER(0, "proc-map-timeout", &kvm->opts.proc_map_timeout,
 				"per thread proc mmap processing timeout in ms"),
+		OPT_BOOLEAN(0, "hist", &kvm->hist,
+			    "show a histogram of the duration of each event"),
 		OPT_END()
 	};
 	const char * const live_usage[] = {
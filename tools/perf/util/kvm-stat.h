@@ -15,9 +15,13 @@ struct event_key {
 	struct exit_reasons_table *exit_reasons;
 };
 
+#define KVM_EVENT_HIST_BUCKETS	16
+
 struct kvm_event_stats {
 	u64 time;
 	struct stats stats;
+	/* Bucket i counts the events that took [2^(i-1), 2^i) usecs */
+	u64 hist[KVM_EVENT_HIST_BUCKETS];
 };
 
 struct kvm_event {
@@ -100,6 +104,7 @@ struct perf_kvm_stat {
 	unsigned int display_time;
 	bool live;
 	bool force;
+	bool hist;
 };
 
 struct kvm_reg_events_ops {
@@ -239,6 +239,112 @@ static void test_hashmap_percpu(int task, void *data)
 	close(fd);
 }
 
+static void test_hashmap_batch(int task, void *data)
+{
+	static const int types[] = {
+		BPF_MAP_TYPE_HASH,
+		BPF_MAP_TYPE_PERCPU_HASH,
+		BPF_MAP_TYPE_LRU_HASH,
+		BPF_MAP_TYPE_LRU_PERCPU_HASH,
+	};
+	unsigned int nr_cpus = bpf_num_possible_cpus();
+	const int max_entries = 1000;
+	long long *keys, *values;
+	int i, j, t, fd, err, ncpus;
+	__u32 batch, count, total;
+	char *visited;
+
+	keys = calloc(max_entries, sizeof(*keys));
+	values = calloc(max_entries * nr_cpus, sizeof(*values));
+	visited = calloc(max_entries, 1);
+	assert(keys && values && visited);
+
+	for (t = 0; t < sizeof(types) / sizeof(types[0]); t++) {
+		int percpu = types[t] == BPF_MAP_TYPE_PERCPU_HASH ||
+			      types[t] == BPF_MAP_TYPE_LRU_PERCPU_HASH;
+		int lru = types[t] == BPF_MAP_TYPE_LRU_HASH ||
+			   types[t] == BPF_MAP_TYPE_LRU_PERCPU_HASH;
+
+		ncpus = percpu ? nr_cpus : 1;
+
+		/* leave LRU maps enough room not to evict anything */
+		fd = bpf_create_map(types[t], sizeof(*keys), sizeof(*values),
+				    lru ? 2 * max_entries : max_entries,
+				    lru ? 0 : map_flags);
+		if (fd < 0) {
+			printf("Failed to create hashmap '%s'!\n",
+			       strerror(errno));
+			exit(1);
+		}
+
+		for (i = 0; i < max_entries; i++) {
+			keys[i] = i;
+			for (j = 0; j < ncpus; j++)
+				values[i * ncpus + j] = i + j;
+		}
+
+		count = max_entries;
+		assert(bpf_map_update_batch(fd, keys, values, &count,
+					    BPF_NOEXIST) == 0 &&
+		       count == max_entries);
+
+		/* Inserting any of them again must stop at the first one. */
+		count = max_entries;
+		assert(bpf_map_update_batch(fd, keys, values, &count,
+					    BPF_NOEXIST) == -1 &&
+		       errno == EEXIST && count == 0);
+
+		/* Walk the map in small steps, seeing every element once. */
+		memset(keys, 0, max_entries * sizeof(*keys));
+		memset(values, 0, max_entries * nr_cpus * sizeof(*values));
+		memset(visited, 0, max_entries);
+		total = 0;
+		do {
+			count = 16;
+			err = bpf_map_lookup_batch(fd, total ? &batch : NULL,
+						   &batch, keys + total,
+						   values + total * ncpus,
+						   &count);
+			assert(!err || errno == ENOENT);
+			total += count;
+			assert(total <= max_entries);
+		} while (!err);
+		assert(total == max_entries);
+
+		for (i = 0; i < max_entries; i++) {
+			assert(keys[i] >= 0 && keys[i] < max_entries &&
+			       !visited[keys[i]]);
+			visited[keys[i]] = 1;
+			for (j = 0; j < ncpus; j++)
+				assert(values[i * ncpus + j] == keys[i] + j);
+		}
+
+		/* Drain everything in a single call. */
+		count = max_entries;
+		assert(bpf_map_lookup_and_delete_batch(fd, NULL, &batch, keys,
+						       values, &count) == -1 &&
+		       errno == ENOENT && count == max_entries);
+		assert(bpf_map_get_next_key(fd, NULL, &keys[0]) == -1 &&
+		       errno == ENOENT);
+
+		/* Refill and remove by key. */
+		count = max_entries;
+		assert(bpf_map_update_batch(fd, keys, values, &count,
+					    BPF_ANY) == 0);
+		count = max_entries;
+		assert(bpf_map_delete_batch(fd, keys, &count) == 0 &&
+		       count == max_entries);
+		assert(bpf_map_get_next_key(fd, NULL, &keys[0]) == -1 &&
+		       errno == ENOENT);
+
+		close(fd);
+	}
+
+	free(visited);
+	free(values);
+	free(keys);
+}
+
 static void test_arraymap(int task, void *data)
 {
 	int key, next_key, fd;
@@ -549,6 +655,7 @@ static void run_all_tests(void)
 {
 	test_hashmap(0, NULL);
 	test_hashmap_percpu(0, NULL);
+	test_hashmap_batch(0, NULL);
 
 	test_arraymap(0, NULL);
 	test_arraymap_percpu(0, NULL);
@@ -0,0 +1,349 @@
+/*
+ * Nested virtualization microbenchmarks
+ *
+ * Copyright (C) 2017 - Linaro Ltd
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Runs a small guest hypervisor at virtual EL2 that times the operations a
+ * nested hypervisor keeps trapping on, and reports the cost of each. With
+ * -p, the guest hypervisor uses the paravirtualized HVC encodings of a
+ * CONFIG_KVM_ARM_NESTED_PV host instead of the native instructions, which
+ * need kvm-arm.nested=1 on hardware with ARMv8.3 nested virtualization.
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <linux/kvm.h>
+
+#include "../kselftest.h"
+#include "nested_bench.h"
+
+#define GUEST_BASE		0x40000000UL
+#define GUEST_SIZE		(16UL << 20)
+#define GUEST_S2_TABLES		0x10000UL	/* L1, L2, then the L3s */
+#define GUEST_FAULT_PAGES	(8UL << 20)
+#define MAX_FAULT_PAGES		((GUEST_SIZE - GUEST_FAULT_PAGES) >> 12)
+
+#define REPORT_BASE		0x0a000000UL
+
+#define VGIC_DIST_BASE		0x08000000UL
+#define VGIC_CPU_BASE		0x08010000UL
+#define VGIC_REDIST_BASE	0x080a0000UL
+/* Where KVM puts the virtual GICH, see vgic-v2-nested.c */
+#define VGIC_GICH_LR0		(0x08030000UL + 0x100)
+
+/* Stage 2 descriptors: table, and RW normal WB inner shareable page */
+#define S2_TABLE		3UL
+#define S2_PAGE			(3UL | (0xfUL << 2) | (3UL << 6) | \
+				 (3UL << 8) | (1UL << 10))
+
+/* 39bit IPA, 4K granule starting at level 1, 40bit PA */
+#define GUEST_VTCR		(25UL | (1UL << 6) | (1UL << 8) | \
+				 (1UL << 10) | (3UL << 12) | (2UL << 16) | \
+				 (1UL << 31))
+#define GUEST_VTTBR		((1UL << 48) | (GUEST_BASE + GUEST_S2_TABLES))
+
+extern char guest_native_start[], guest_native_end[];
+extern char guest_pv_start[], guest_pv_end[];
+
+static const char * const bench_names[BENCH_NR] = {
+	[BENCH_ERET]		= "eret/hvc round trip",
+	[BENCH_MRS]		= "el2 sysreg read",
+	[BENCH_MSR]		= "el2 sysreg write",
+	[BENCH_TLBI]		= "tlbi vmalls12e1is",
+	[BENCH_S2_FAULT]	= "shadow stage 2 fault",
+	[BENCH_GICH_LR]		= "gich lr read",
+};
+
+static void *guest_mem;
+
+static uint64_t core_reg_id(size_t off)
+{
+	return KVM_REG_ARM64 | KVM_REG_SIZE_U64 | KVM_REG_ARM_CORE |
+	       (off / sizeof(__u32));
+}
+
+static int set_core_reg(int vcpu_fd, size_t off, uint64_t val)
+{
+	struct kvm_one_reg reg = {
+		.id	= core_reg_id(off),
+		.addr	= (uint64_t)&val,
+	};
+
+	return ioctl(vcpu_fd, KVM_SET_ONE_REG, &reg);
+}
+
+#define set_xreg(fd, n, val)						\
+	set_core_reg(fd, offsetof(struct kvm_regs, regs.regs[n]), val)
+
+static int set_vgic_attr(int dev_fd, uint32_t group, uint64_t attr,
+			 uint64_t *val)
+{
+	struct kvm_device_attr da = {
+		.group	= group,
+		.attr	= attr,
+		.addr	= (uint64_t)val,
+	};
+
+	return ioctl(dev_fd, KVM_SET_DEVICE_ATTR, &da);
+}
+
+/*
+ * Give the VM a GIC that the guest hypervisor can program list registers
+ * of: a GICv2, whose GICH KVM emulates for either encoding, or else a GICv3
+ * for native system register accesses. Returns the device fd, or -1.
+ */
+static int create_vgic(int vm_fd, bool pv, unsigned int *flags)
+{
+	struct kvm_create_device cd = {
+		.type	= KVM_DEV_TYPE_ARM_VGIC_V2,
+	};
+
+	if (!ioctl(vm_fd, KVM_CREATE_DEVICE, &cd)) {
+		*flags |= BENCH_F_GICV2;
+		return cd.fd;
+	}
+
+	cd.type = KVM_DEV_TYPE_ARM_VGIC_V3;
+	if (!pv && !ioctl(vm_fd, KVM_CREATE_DEVICE, &cd)) {
+		*flags |= BENCH_F_GICV3;
+		return cd.fd;
+	}
+
+	return -1;
+}
+
+static int init_vgic(int dev_fd, unsigned int flags)
+{
+	uint64_t addr;
+	int ret;
+
+	if (flags & BENCH_F_GICV2) {
+		addr = VGIC_DIST_BASE;
+		ret = set_vgic_attr(dev_fd, KVM_DEV_ARM_VGIC_GRP_ADDR,
+				    KVM_VGIC_V2_ADDR_TYPE_DIST, &addr);
+		addr = VGIC_CPU_BASE;
+		ret = ret ?: set_vgic_attr(dev_fd, KVM_DEV_ARM_VGIC_GRP_ADDR,
+					   KVM_VGIC_V2_ADDR_TYPE_CPU, &addr);
+	} else {
+		addr = VGIC_DIST_BASE;
+		ret = set_vgic_attr(dev_fd, KVM_DEV_ARM_VGIC_GRP_ADDR,
+				    KVM_VGIC_V3_ADDR_TYPE_DIST, &addr);
+		addr = VGIC_REDIST_BASE;
+		ret = ret ?: set_vgic_attr(dev_fd, KVM_DEV_ARM_VGIC_GRP_ADDR,
+					   KVM_VGIC_V3_ADDR_TYPE_REDIST, &addr);
+	}
+
+	return ret ?: set_vgic_attr(dev_fd, KVM_DEV_ARM_VGIC_GRP_CTRL,
+				    KVM_DEV_ARM_VGIC_CTRL_INIT, NULL);
+}
+
+/* Identity map all of the guest memory with pages, for the L2 side */
+static void build_stage2(void)
+{
+	uint64_t *l1 = guest_mem + GUEST_S2_TABLES;
+	uint64_t *l2 = l1 + 512;
+	uint64_t *l3 = l2 + 512;
+	uint64_t ipa = GUEST_BASE, table = GUEST_BASE + GUEST_S2_TABLES;
+	unsigned long i, tables = GUEST_SIZE >> 21;
+
+	l1[GUEST_BASE >> 30] = (table + 4096) | S2_TABLE;
+	for (i = 0; i < tables; i++)
+		l2[((GUEST_BASE >> 21) & 511) + i] =
+			(table + 8192 + i * 4096) | S2_TABLE;
+	for (i = 0; i < tables * 512; i++, ipa += 4096)
+		l3[i] = ipa | S2_PAGE;
+}
+
+static uint64_t read_cntfrq(void)
+{
+	uint64_t val;
+
+	asm volatile("mrs %0, cntfrq_el0" : "=r" (val));
+	return val;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-p] [-n iterations] [-f fault pages]\n",
+		name);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long iters = 100000, fault_pages = 1024;
+	uint64_t results[BENCH_NR], freq;
+	bool done[BENCH_NR] = { false };
+	struct kvm_userspace_memory_region region;
+	struct kvm_vcpu_init init;
+	unsigned int flags = 0;
+	char *start, *end;
+	struct kvm_run *run;
+	int kvm_fd, vm_fd, vcpu_fd, vgic_fd, run_size, i, opt;
+	bool pv = false;
+
+	while ((opt = getopt(argc, argv, "pn:f:")) != -1) {
+		switch (opt) {
+		case 'p':
+			pv = true;
+			break;
+		case 'n':
+			iters = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			fault_pages = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!iters || !fault_pages || fault_pages > MAX_FAULT_PAGES)
+		usage(argv[0]);
+
+	kvm_fd = open("/dev/kvm", O_RDWR);
+	if (kvm_fd < 0) {
+		printf("Cannot open /dev/kvm: %s\n", strerror(errno));
+		return ksft_exit_skip();
+	}
+
+	vm_fd = ioctl(kvm_fd, KVM_CREATE_VM, 0);
+	if (vm_fd < 0) {
+		perror("KVM_CREATE_VM");
+		return ksft_exit_fail();
+	}
+
+	guest_mem = mmap(NULL, GUEST_SIZE, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (guest_mem == MAP_FAILED) {
+		perror("mmap");
+		return ksft_exit_fail();
+	}
+
+	start = pv ? guest_pv_start : guest_native_start;
+	end = pv ? guest_pv_end : guest_native_end;
+	memcpy(guest_mem, start, end - start);
+	build_stage2();
+	/* Populate the pages, the host faulting them in isn't measured */
+	memset(guest_mem + GUEST_FAULT_PAGES, 0,
+	       GUEST_SIZE - GUEST_FAULT_PAGES);
+
+	region = (struct kvm_userspace_memory_region) {
+		.slot			= 0,
+		.guest_phys_addr	= GUEST_BASE,
+		.memory_size		= GUEST_SIZE,
+		.userspace_addr		= (uint64_t)guest_mem,
+	};
+	if (ioctl(vm_fd, KVM_SET_USER_MEMORY_REGION, &region)) {
+		perror("KVM_SET_USER_MEMORY_REGION");
+		return ksft_exit_fail();
+	}
+
+	vgic_fd = create_vgic(vm_fd, pv, &flags);
+
+	vcpu_fd = ioctl(vm_fd, KVM_CREATE_VCPU, 0);
+	if (vcpu_fd < 0) {
+		perror("KVM_CREATE_VCPU");
+		return ksft_exit_fail();
+	}
+
+	if (ioctl(vm_fd, KVM_ARM_PREFERRED_TARGET, &init)) {
+		perror("KVM_ARM_PREFERRED_TARGET");
+		return ksft_exit_fail();
+	}
+	init.features[0] |= 1 << KVM_ARM_VCPU_NESTED_VIRT;
+	if (ioctl(vcpu_fd, KVM_ARM_VCPU_INIT, &init)) {
+		printf("No nested virtualization: %s\n", strerror(errno));
+		return ksft_exit_skip();
+	}
+
+	if (vgic_fd >= 0 && init_vgic(vgic_fd, flags)) {
+		perror("vgic init");
+		return ksft_exit_fail();
+	}
+
+	if (set_core_reg(vcpu_fd, offsetof(struct kvm_regs, regs.pc),
+			 GUEST_BASE) ||
+	    set_xreg(vcpu_fd, 0, iters) ||
+	    set_xreg(vcpu_fd, 1, REPORT_BASE) ||
+	    set_xreg(vcpu_fd, 2, flags) ||
+	    set_xreg(vcpu_fd, 3, GUEST_VTTBR) ||
+	    set_xreg(vcpu_fd, 4, GUEST_VTCR) ||
+	    set_xreg(vcpu_fd, 5, GUEST_BASE + GUEST_FAULT_PAGES) ||
+	    set_xreg(vcpu_fd, 6, fault_pages) ||
+	    set_xreg(vcpu_fd, 7, VGIC_GICH_LR0)) {
+		perror("KVM_SET_ONE_REG");
+		return ksft_exit_fail();
+	}
+
+	run_size = ioctl(kvm_fd, KVM_GET_VCPU_MMAP_SIZE, 0);
+	run = mmap(NULL, run_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		   vcpu_fd, 0);
+	if (run == MAP_FAILED) {
+		perror("mmap kvm_run");
+		return ksft_exit_fail();
+	}
+
+	for (;;) {
+		uint64_t id, val = 0;
+
+		if (ioctl(vcpu_fd, KVM_RUN, 0)) {
+			perror("KVM_RUN");
+			return ksft_exit_fail();
+		}
+
+		if (run->exit_reason != KVM_EXIT_MMIO ||
+		    !run->mmio.is_write || run->mmio.len != 8 ||
+		    run->mmio.phys_addr - REPORT_BASE >= 4096) {
+			printf("Unexpected exit %u at %llx\n", run->exit_reason,
+			       (unsigned long long)run->mmio.phys_addr);
+			return ksft_exit_fail();
+		}
+
+		memcpy(&val, run->mmio.data, sizeof(val));
+		id = (run->mmio.phys_addr - REPORT_BASE) / 8;
+		if (id == BENCH_DONE)
+			break;
+		if (id == BENCH_ERROR || id >= BENCH_NR) {
+			printf("Guest hypervisor took exception %#llx\n",
+			       (unsigned long long)val);
+			return ksft_exit_fail();
+		}
+		results[id] = val;
+		done[id] = true;
+	}
+
+	freq = read_cntfrq();
+	printf("%s encodings, %lu iterations, %lu fault pages\n",
+	       pv ? "PV" : "Native", iters, fault_pages);
+	for (i = 0; i < BENCH_NR; i++) {
+		unsigned long nr = i == BENCH_S2_FAULT ? fault_pages : iters;
+		double ticks;
+
+		if (!done[i]) {
+			printf("%-24s %12s\n", bench_names[i], "skipped");
+			continue;
+		}
+
+		ticks = (double)results[i] / nr;
+		printf("%-24s %12.1f ticks/op %12.1f ns/op\n", bench_names[i],
+		       ticks, ticks * 1e9 / freq);
+	}
+
+	return ksft_exit_pass();
+}
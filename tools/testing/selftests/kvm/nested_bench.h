@@ -0,0 +1,38 @@
+/*
+ * Nested virtualization microbenchmarks, shared with the guest payload
+ *
+ * Copyright (C) 2017 - Linaro Ltd
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef __SELFTESTS_KVM_NESTED_BENCH_H
+#define __SELFTESTS_KVM_NESTED_BENCH_H
+
+/* Results, stored by the guest at BENCH_REPORT_ID() in the report page */
+#define BENCH_ERET		0
+#define BENCH_MRS		1
+#define BENCH_MSR		2
+#define BENCH_TLBI		3
+#define BENCH_S2_FAULT		4
+#define BENCH_GICH_LR		5
+#define BENCH_NR		6
+
+/* Unexpected exception, the value is the vector offset */
+#define BENCH_ERROR		30
+#define BENCH_DONE		31
+
+#define BENCH_REPORT_ID(id)	((id) * 8)
+
+/* How the guest hypervisor can get to the list registers */
+#define BENCH_F_GICV2_SHIFT	0
+#define BENCH_F_GICV3_SHIFT	1
+#define BENCH_F_GICV2		(1 << BENCH_F_GICV2_SHIFT)
+#define BENCH_F_GICV3		(1 << BENCH_F_GICV3_SHIFT)
+
+#define HCR_VM			(1 << 0)
+#define HCR_RW			(1 << 31)
+
+#endif /* __SELFTESTS_KVM_NESTED_BENCH_H */
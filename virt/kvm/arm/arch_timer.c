@@ -47,9 +47,19 @@ static const struct kvm_irq_level default_vtimer_irq = {
 	.level	= 1,
 };
 
+static const struct kvm_irq_level default_hptimer_irq = {
+	.irq	= 26,
+	.level	= 1,
+};
+
+static const struct kvm_irq_level default_hvtimer_irq = {
+	.irq	= 28,
+	.level	= 1,
+};
+
 void kvm_timer_vcpu_put(struct kvm_vcpu *vcpu)
 {
-	vcpu_vtimer(vcpu)->active_cleared_last = false;
+	vcpu_loaded_vtimer(vcpu)->active_cleared_last = false;
 }
 
 u64 kvm_phys_timer_read(void)
@@ -146,6 +156,22 @@ static bool kvm_timer_irq_can_fire(struct arch_timer_context *timer_ctx)
 		(timer_ctx->cnt_ctl & ARCH_TIMER_CTRL_ENABLE);
 }
 
+/* Only a guest hypervisor has the EL2 physical and virtual timers */
+static bool kvm_timer_has_el2_timers(struct kvm_vcpu *vcpu)
+{
+	return nested_virt_in_use(vcpu);
+}
+
+/*
+ * The physical count at which @timer_ctx fires, to compare timers with
+ * different offsets.
+ */
+static u64 kvm_timer_expiry(struct kvm_vcpu *vcpu,
+			    struct arch_timer_context *timer_ctx)
+{
+	return timer_ctx->cnt_cval + kvm_timer_cntvoff(vcpu, timer_ctx);
+}
+
 /*
  * Returns the earliest expiration time in ns among guest timers.
  * Note that it will return 0 if none of timers can fire.
@@ -155,6 +181,8 @@ static u64 kvm_timer_earliest_exp(struct kvm_vcpu *vcpu)
 	u64 min_virt = ULLONG_MAX, min_phys = ULLONG_MAX;
 	struct arch_timer_context *vtimer = vcpu_vtimer(vcpu);
 	struct arch_timer_context *ptimer = vcpu_ptimer(vcpu);
+	struct arch_timer_context *hptimer = vcpu_hptimer(vcpu);
+	struct arch_timer_context *hvtimer = vcpu_hvtimer(vcpu);
 
 	if (kvm_timer_irq_can_fire(vtimer))
 		min_virt = kvm_timer_compute_delta(vcpu, vtimer);
@@ -162,6 +190,15 @@ static u64 kvm_timer_earliest_exp(struct kvm_vcpu *vcpu)
 	if (kvm_timer_irq_can_fire(ptimer))
 		min_phys = kvm_timer_compute_delta(vcpu, ptimer);
 
+	if (kvm_timer_has_el2_timers(vcpu)) {
+		if (kvm_timer_irq_can_fire(hptimer))
+			min_phys = min(min_phys,
+				       kvm_timer_compute_delta(vcpu, hptimer));
+		if (kvm_timer_irq_can_fire(hvtimer))
+			min_virt = min(min_virt,
+				       kvm_timer_compute_delta(vcpu, hvtimer));
+	}
+
 	/* If none of timers can fire, then return 0 */
 	if ((min_virt == ULLONG_MAX) && (min_phys == ULLONG_MAX))
 		return 0;
@@ -231,6 +268,8 @@ static void kvm_timer_update_irq(struct kvm_vcpu *vcpu, bool new_level,
 
 	timer_ctx->active_cleared_last = false;
 	timer_ctx->irq.level = new_level;
+	if (new_level)
+		vcpu->stat.timer_irq++;
 	trace_kvm_timer_update_irq(vcpu->vcpu_id, timer_ctx->irq.irq,
 				   timer_ctx->irq.level);
 
@@ -267,22 +306,124 @@ static void kvm_timer_update_state(struct kvm_vcpu *vcpu)
 
 	if (kvm_timer_should_fire(vcpu, ptimer) != ptimer->irq.level)
 		kvm_timer_update_irq(vcpu, !ptimer->irq.level, ptimer);
+
+	if (kvm_timer_has_el2_timers(vcpu)) {
+		struct arch_timer_context *hptimer = vcpu_hptimer(vcpu);
+		struct arch_timer_context *hvtimer = vcpu_hvtimer(vcpu);
+
+		if (kvm_timer_should_fire(vcpu, hptimer) != hptimer->irq.level)
+			kvm_timer_update_irq(vcpu, !hptimer->irq.level,
+					     hptimer);
+
+		if (kvm_timer_should_fire(vcpu, hvtimer) != hvtimer->irq.level)
+			kvm_timer_update_irq(vcpu, !hvtimer->irq.level,
+					     hvtimer);
+	}
+}
+
+static bool kvm_timer_level_stale(struct kvm_vcpu *vcpu,
+				  struct arch_timer_context *timer_ctx)
+{
+	return kvm_timer_should_fire(vcpu, timer_ctx) != timer_ctx->irq.level;
+}
+
+/*
+ * Check if kvm_timer_update_state() would change a timer line level, for
+ * paths that re-enter the guest without flushing the timer state.
+ */
+bool kvm_timer_needs_update(struct kvm_vcpu *vcpu)
+{
+	if (unlikely(!vcpu->arch.timer_cpu.enabled))
+		return false;
+
+	return kvm_timer_level_stale(vcpu, vcpu_vtimer(vcpu)) ||
+	       kvm_timer_level_stale(vcpu, vcpu_ptimer(vcpu)) ||
+	       (kvm_timer_has_el2_timers(vcpu) &&
+		(kvm_timer_level_stale(vcpu, vcpu_hptimer(vcpu)) ||
+		 kvm_timer_level_stale(vcpu, vcpu_hvtimer(vcpu))));
+}
+
+/* An emulated timer which has not yet expired, but is going to */
+static bool kvm_timer_emulated_pending(struct kvm_vcpu *vcpu,
+				       struct arch_timer_context *timer_ctx)
+{
+	return !kvm_timer_should_fire(vcpu, timer_ctx) &&
+	       kvm_timer_irq_can_fire(timer_ctx);
+}
+
+/* Returns whichever of @next and @timer_ctx is the first to fire */
+static struct arch_timer_context *
+kvm_timer_emulated_earlier(struct kvm_vcpu *vcpu,
+			   struct arch_timer_context *next,
+			   struct arch_timer_context *timer_ctx)
+{
+	if (!kvm_timer_emulated_pending(vcpu, timer_ctx))
+		return next;
+
+	if (next &&
+	    kvm_timer_expiry(vcpu, next) <= kvm_timer_expiry(vcpu, timer_ctx))
+		return next;
+
+	return timer_ctx;
+}
+
+/*
+ * Returns the earliest to expire of the emulated timers, or NULL if none of
+ * them is to fire. Those are the physical timer, and for a guest hypervisor
+ * the EL2 physical timer and whichever virtual timer isn't loaded.
+ */
+static struct arch_timer_context *kvm_timer_emulated_next(struct kvm_vcpu *vcpu)
+{
+	struct arch_timer_context *next;
+
+	next = kvm_timer_emulated_earlier(vcpu, NULL, vcpu_ptimer(vcpu));
+
+	if (kvm_timer_has_el2_timers(vcpu)) {
+		struct arch_timer_context *unloaded;
+
+		unloaded = vcpu->arch.timer_cpu.hvtimer_loaded ?
+			   vcpu_vtimer(vcpu) : vcpu_hvtimer(vcpu);
+
+		next = kvm_timer_emulated_earlier(vcpu, next,
+						  vcpu_hptimer(vcpu));
+		next = kvm_timer_emulated_earlier(vcpu, next, unloaded);
+	}
+
+	return next;
 }
 
-/* Schedule the background timer for the emulated timer. */
-static void kvm_timer_emulate(struct kvm_vcpu *vcpu,
-			      struct arch_timer_context *timer_ctx)
+/*
+ * Schedule the background timer for the emulated timers. The timer is left
+ * armed across guest exits: it only needs to be cancelled and re-armed when
+ * the guest has reprogrammed the emulated timers, or when it was used for
+ * blocking the vcpu in between.
+ */
+static void kvm_timer_emulate(struct kvm_vcpu *vcpu)
 {
 	struct arch_timer_cpu *timer = &vcpu->arch.timer_cpu;
+	struct arch_timer_context *next = kvm_timer_emulated_next(vcpu);
 
-	if (kvm_timer_should_fire(vcpu, timer_ctx))
+	if (timer_is_armed(timer) && next &&
+	    timer->emul_cval == kvm_timer_expiry(vcpu, next))
 		return;
 
-	if (!kvm_timer_irq_can_fire(timer_ctx))
+	timer_disarm(timer);
+
+	if (!next)
 		return;
 
 	/*  The timer has not yet expired, schedule a background timer */
-	timer_arm(timer, kvm_timer_compute_delta(vcpu, timer_ctx));
+	timer->emul_cval = kvm_timer_expiry(vcpu, next);
+	timer_arm(timer, kvm_timer_compute_delta(vcpu, next));
+}
+
+static bool kvm_timer_any_should_fire(struct kvm_vcpu *vcpu)
+{
+	return kvm_timer_should_fire(vcpu, vcpu_vtimer(vcpu)) ||
+	       kvm_timer_should_fire(vcpu, vcpu_ptimer(vcpu)) ||
+	       (kvm_timer_has_el2_timers(vcpu) &&
+		(kvm_timer_should_fire(vcpu, vcpu_hptimer(vcpu)) ||
+		 kvm_timer_should_fire(vcpu, vcpu_hvtimer(vcpu))));
 }
 
 /*
@@ -293,31 +434,33 @@ static void kvm_timer_emulate(struct kvm_vcpu *vcpu,
 void kvm_timer_schedule(struct kvm_vcpu *vcpu)
 {
 	struct arch_timer_cpu *timer = &vcpu->arch.timer_cpu;
-	struct arch_timer_context *vtimer = vcpu_vtimer(vcpu);
-	struct arch_timer_context *ptimer = vcpu_ptimer(vcpu);
+	u64 ns;
 
-	BUG_ON(timer_is_armed(timer));
+	/* This may still be armed for the emulated timers of the last run */
+	timer_disarm(timer);
 
 	/*
 	 * No need to schedule a background timer if any guest timer has
 	 * already expired, because kvm_vcpu_block will return before putting
 	 * the thread to sleep.
 	 */
-	if (kvm_timer_should_fire(vcpu, vtimer) || kvm_timer_should_fire(vcpu, ptimer))
+	if (kvm_timer_any_should_fire(vcpu))
 		return;
 
 	/*
-	 * If both timers are not capable of raising interrupts (disabled or
-	 * masked), then there's no more work for us to do.
+	 * If none of the timers are capable of raising interrupts (disabled
+	 * or masked), then there's no more work for us to do.
 	 */
-	if (!kvm_timer_irq_can_fire(vtimer) && !kvm_timer_irq_can_fire(ptimer))
+	ns = kvm_timer_earliest_exp(vcpu);
+	if (!ns)
 		return;
 
 	/*
 	 * The guest timers have not yet expired, schedule a background timer.
 	 * Set the earliest expiration time among the guest timers.
 	 */
-	timer_arm(timer, kvm_timer_earliest_exp(vcpu));
+	timer->emul_cval = 0;
+	timer_arm(timer, ns);
 }
 
 void kvm_timer_unschedule(struct kvm_vcpu *vcpu)
@@ -328,7 +471,7 @@ void kvm_timer_unschedule(struct kvm_vcpu *vcpu)
 
 static void kvm_timer_flush_hwstate_vgic(struct kvm_vcpu *vcpu)
 {
-	struct arch_timer_context *vtimer = vcpu_vtimer(vcpu);
+	struct arch_timer_context *vtimer = vcpu_loaded_vtimer(vcpu);
 	bool phys_active;
 	int ret;
 
@@ -417,6 +560,37 @@ static void kvm_timer_flush_hwstate_user(struct kvm_vcpu *vcpu)
 		enable_percpu_irq(host_vtimer_irq, 0);
 }
 
+/*
+ * Load the EL2 virtual timer into the hardware EL1 virtual timer while a VHE
+ * guest hypervisor runs in the virtual EL2, where its CNTV_*_EL0 accesses
+ * are CNTHV_*_EL2 ones, and the EL1 virtual timer otherwise. The host
+ * virtual timer interrupt is mapped to the IRQ of the loaded context, and
+ * the other is emulated with the background timer.
+ */
+static void kvm_timer_load_nested(struct kvm_vcpu *vcpu)
+{
+	struct arch_timer_cpu *timer = &vcpu->arch.timer_cpu;
+	struct arch_timer_context *old, *new;
+	bool load_hvtimer;
+
+	load_hvtimer = vcpu_mode_el2(vcpu) && vcpu_el2_e2h_is_set(vcpu);
+	if (load_hvtimer == timer->hvtimer_loaded)
+		return;
+
+	old = vcpu_loaded_vtimer(vcpu);
+	timer->hvtimer_loaded = load_hvtimer;
+	new = vcpu_loaded_vtimer(vcpu);
+
+	if (likely(irqchip_in_kernel(vcpu->kvm))) {
+		WARN_ON(kvm_vgic_unmap_phys_irq(vcpu, old->irq.irq));
+		WARN_ON(kvm_vgic_map_phys_irq(vcpu, new->irq.irq,
+					      timer->phys_irq));
+	}
+
+	/* The physical active state is for the new context now */
+	new->active_cleared_last = false;
+}
+
 /**
  * kvm_timer_flush_hwstate - prepare timers before running the vcpu
  * @vcpu: The vcpu pointer
@@ -433,10 +607,13 @@ void kvm_timer_flush_hwstate(struct kvm_vcpu *vcpu)
 	if (unlikely(!timer->enabled))
 		return;
 
+	if (kvm_timer_has_el2_timers(vcpu))
+		kvm_timer_load_nested(vcpu);
+
 	kvm_timer_update_state(vcpu);
 
-	/* Set the background timer for the physical timer emulation. */
-	kvm_timer_emulate(vcpu, vcpu_ptimer(vcpu));
+	/* Set the background timer for the physical timers emulation. */
+	kvm_timer_emulate(vcpu);
 
 	if (unlikely(!irqchip_in_kernel(vcpu->kvm)))
 		kvm_timer_flush_hwstate_user(vcpu);
@@ -453,15 +630,11 @@ void kvm_timer_flush_hwstate(struct kvm_vcpu *vcpu)
  */
 void kvm_timer_sync_hwstate(struct kvm_vcpu *vcpu)
 {
-	struct arch_timer_cpu *timer = &vcpu->arch.timer_cpu;
-
-	/*
-	 * This is to cancel the background timer for the physical timer
-	 * emulation if it is set.
-	 */
-	timer_disarm(timer);
-
 	/*
+	 * The background timer for the physical timers emulation is kept
+	 * armed, the next kvm_timer_flush_hwstate() only re-arms it if the
+	 * guest reprogrammed them.
+	 *
 	 * The guest could have modified the timer registers or the timer
 	 * could have expired, update the timer state.
 	 */
@@ -481,6 +654,8 @@ int kvm_timer_vcpu_reset(struct kvm_vcpu *vcpu)
 	 */
 	vtimer->cnt_ctl = 0;
 	ptimer->cnt_ctl = 0;
+	vcpu_hptimer(vcpu)->cnt_ctl = 0;
+	vcpu_hvtimer(vcpu)->cnt_ctl = 0;
 	kvm_timer_update_state(vcpu);
 
 	return 0;
@@ -514,6 +689,8 @@ void kvm_timer_vcpu_init(struct kvm_vcpu *vcpu)
 	/* Synchronize cntvoff across all vtimers of a VM. */
 	update_vtimer_cntvoff(vcpu, kvm_phys_timer_read());
 	vcpu_ptimer(vcpu)->cntvoff = 0;
+	vcpu_hptimer(vcpu)->cntvoff = 0;
+	vcpu_hvtimer(vcpu)->cntvoff = 0;
 
 	INIT_WORK(&timer->expired, kvm_timer_inject_irq_work);
 	hrtimer_init(&timer->timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
@@ -521,6 +698,8 @@ void kvm_timer_vcpu_init(struct kvm_vcpu *vcpu)
 
 	vtimer->irq.irq = default_vtimer_irq.irq;
 	ptimer->irq.irq = default_ptimer_irq.irq;
+	vcpu_hptimer(vcpu)->irq.irq = default_hptimer_irq.irq;
+	vcpu_hvtimer(vcpu)->irq.irq = default_hvtimer_irq.irq;
 }
 
 static void kvm_timer_init_interrupt(void *info)
@@ -624,7 +803,7 @@ int kvm_timer_hyp_init(void)
 void kvm_timer_vcpu_terminate(struct kvm_vcpu *vcpu)
 {
 	struct arch_timer_cpu *timer = &vcpu->arch.timer_cpu;
-	struct arch_timer_context *vtimer = vcpu_vtimer(vcpu);
+	struct arch_timer_context *vtimer = vcpu_loaded_vtimer(vcpu);
 
 	timer_disarm(timer);
 	kvm_vgic_unmap_phys_irq(vcpu, vtimer->irq.irq);
@@ -645,6 +824,18 @@ static bool timer_irqs_are_valid(struct kvm_vcpu *vcpu)
 	if (ret)
 		return false;
 
+	if (kvm_timer_has_el2_timers(vcpu)) {
+		ret = kvm_vgic_set_owner(vcpu, vcpu_hptimer(vcpu)->irq.irq,
+					 vcpu_hptimer(vcpu));
+		if (ret)
+			return false;
+
+		ret = kvm_vgic_set_owner(vcpu, vcpu_hvtimer(vcpu)->irq.irq,
+					 vcpu_hvtimer(vcpu));
+		if (ret)
+			return false;
+	}
+
 	kvm_for_each_vcpu(i, vcpu, vcpu->kvm) {
 		if (vcpu_vtimer(vcpu)->irq.irq != vtimer_irq ||
 		    vcpu_ptimer(vcpu)->irq.irq != ptimer_irq)
@@ -692,6 +883,7 @@ int kvm_timer_enable(struct kvm_vcpu *vcpu)
 		data = data->parent_data;
 
 	phys_irq = data->hwirq;
+	timer->phys_irq = phys_irq;
 
 	/*
 	 * Tell the VGIC that the virtual interrupt is tied to a
@@ -26,9 +26,13 @@
 #include <linux/fs.h>
 #include <linux/mman.h>
 #include <linux/sched.h>
+#include <linux/sched/clock.h>
 #include <linux/kvm.h>
+#include <linux/kvm_irqfd.h>
+#include <linux/irqbypass.h>
 #include <trace/events/kvm.h>
 #include <kvm/arm_pmu.h>
+#include <kvm/arm_lock_stat.h>
 
 #define CREATE_TRACE_POINTS
 #include "trace.h"
@@ -57,11 +61,22 @@ static kvm_cpu_context_t __percpu *kvm_host_cpu_state;
 /* Per-CPU variable containing the currently running vcpu. */
 static DEFINE_PER_CPU(struct kvm_vcpu *, kvm_arm_running_vcpu);
 
-/* The VMID used in the VTTBR */
-static atomic64_t kvm_vmid_gen = ATOMIC64_INIT(1);
-static u32 kvm_next_vmid;
+/*
+ * The VMID used in the VTTBR, allocated the same way as the ASIDs of
+ * arch/arm64/mm/context.c: the generation lives in the bits above the VMID,
+ * and the VMID each CPU runs with is kept across a rollover.
+ */
+static atomic64_t kvm_vmid_gen;
 static unsigned int kvm_vmid_bits __read_mostly;
 static DEFINE_SPINLOCK(kvm_vmid_lock);
+static unsigned long *kvm_vmid_map;
+
+static DEFINE_PER_CPU(atomic64_t, kvm_active_vmids);
+static DEFINE_PER_CPU(u64, kvm_reserved_vmids);
+
+#define VMID_FIRST_VERSION	(1ULL << kvm_vmid_bits)
+#define NUM_VMIDS		(1UL << kvm_vmid_bits)
+#define vmid2idx(id)		((id) & (NUM_VMIDS - 1))
 
 static bool vgic_present;
 
@@ -132,6 +147,8 @@ int kvm_arch_init_vm(struct kvm *kvm, unsigned long type)
 	for_each_possible_cpu(cpu)
 		*per_cpu_ptr(kvm->arch.last_vcpu_ran, cpu) = -1;
 
+	kvm_s2_pool_init(kvm);
+
 	ret = kvm_alloc_stage2_pgd(kvm);
 	if (ret)
 		goto out_fail_alloc;
@@ -146,6 +163,7 @@ int kvm_arch_init_vm(struct kvm *kvm, unsigned long type)
 	kvm->arch.mmu.vmid.vmid_gen = 0;
 	kvm->arch.mmu.el2_vmid.vmid_gen = 0;
 	INIT_LIST_HEAD(&kvm->arch.nested_mmu_list);
+	kvm_nested_s2_init(kvm);
 
 	/* The maximum number of VCPUs is limited by the host's GIC model */
 	kvm->arch.max_vcpus = vgic_present ?
@@ -162,12 +180,12 @@ int kvm_arch_init_vm(struct kvm *kvm, unsigned long type)
 
 bool kvm_arch_has_vcpu_debugfs(void)
 {
-	return false;
+	return kvm_arm_has_vcpu_debugfs();
 }
 
 int kvm_arch_create_vcpu_debugfs(struct kvm_vcpu *vcpu)
 {
-	return 0;
+	return kvm_arm_create_vcpu_debugfs(vcpu);
 }
 
 int kvm_arch_vcpu_fault(struct kvm_vcpu *vcpu, struct vm_fault *vmf)
@@ -197,6 +215,7 @@ void kvm_arch_destroy_vm(struct kvm *kvm)
 	}
 
 	kvm_vgic_destroy(kvm);
+	kvm_s2_pool_destroy(kvm);
 }
 
 int kvm_vm_ioctl_check_extension(struct kvm *kvm, long ext)
@@ -299,10 +318,15 @@ struct kvm_vcpu *kvm_arch_vcpu_create(struct kvm *kvm, unsigned int id)
 void kvm_arch_vcpu_postcreate(struct kvm_vcpu *vcpu)
 {
 	kvm_vgic_vcpu_early_init(vcpu);
+
+	/* The VM's debugfs directory only exists once its fd was handed out */
+	if (kvm_get_vcpu(vcpu->kvm, 0) == vcpu)
+		kvm_arm_create_vm_debugfs(vcpu->kvm);
 }
 
 void kvm_arch_vcpu_free(struct kvm_vcpu *vcpu)
 {
+	kvm_arm_async_pf_clear(vcpu);
 	kvm_mmu_free_memory_caches(vcpu);
 	kvm_timer_vcpu_terminate(vcpu);
 	kvm_vgic_vcpu_destroy(vcpu);
@@ -325,11 +349,13 @@ int kvm_cpu_has_pending_timer(struct kvm_vcpu *vcpu)
 void kvm_arch_vcpu_blocking(struct kvm_vcpu *vcpu)
 {
 	kvm_timer_schedule(vcpu);
+	kvm_vgic_v4_enable_doorbell(vcpu);
 }
 
 void kvm_arch_vcpu_unblocking(struct kvm_vcpu *vcpu)
 {
 	kvm_timer_unschedule(vcpu);
+	kvm_vgic_v4_disable_doorbell(vcpu);
 }
 
 int kvm_arch_vcpu_init(struct kvm_vcpu *vcpu)
@@ -379,10 +405,16 @@ void kvm_arch_vcpu_load(struct kvm_vcpu *vcpu, int cpu)
 	kvm_arm_set_running_vcpu(vcpu);
 
 	kvm_vgic_load(vcpu);
+	kvm_arch_vcpu_load_fp(vcpu);
+	kvm_pvsched_vcpu_load(vcpu);
 }
 
 void kvm_arch_vcpu_put(struct kvm_vcpu *vcpu)
 {
+	/* Let the guest know, not to spin waiting on this vcpu */
+	kvm_pvsched_vcpu_put(vcpu);
+	kvm_vcpu_put_sysregs(vcpu);
+	kvm_arch_vcpu_put_fp(vcpu);
 	kvm_vgic_put(vcpu);
 
 	vcpu->cpu = -1;
@@ -435,7 +467,8 @@ int kvm_arch_vcpu_ioctl_set_mpstate(struct kvm_vcpu *vcpu,
  */
 int kvm_arch_vcpu_runnable(struct kvm_vcpu *v)
 {
-	return ((!!v->arch.irq_lines || kvm_vgic_vcpu_pending_irq(v))
+	return ((!!v->arch.irq_lines || kvm_vgic_vcpu_pending_irq(v) ||
+		 kvm_arm_nested_irq_pending(v) || kvm_arm_async_pf_done(v))
 		&& !v->arch.power_off && !v->arch.pause);
 }
 
@@ -465,7 +498,136 @@ void force_vm_exit(const cpumask_t *mask)
  */
 static bool need_new_vmid_gen(struct kvm_s2_vmid *vmid)
 {
-	return unlikely(vmid->vmid_gen != atomic64_read(&kvm_vmid_gen));
+	return unlikely(READ_ONCE(vmid->vmid_gen) !=
+			atomic64_read(&kvm_vmid_gen));
+}
+
+/*
+ * The generation is read first and the VMID is published before it, so a
+ * VMID of the current generation is never mixed up with an older one.
+ */
+static u64 vmid_id(struct kvm_s2_vmid *vmid)
+{
+	u64 gen = READ_ONCE(vmid->vmid_gen);
+
+	smp_rmb();
+	return gen | READ_ONCE(vmid->vmid);
+}
+
+static void vmid_set_id(struct kvm_s2_vmid *vmid, u64 id)
+{
+	WRITE_ONCE(vmid->vmid, vmid2idx(id));
+	smp_wmb();
+	WRITE_ONCE(vmid->vmid_gen, id & ~(VMID_FIRST_VERSION - 1));
+}
+
+/*
+ * Start a new generation: only the VMIDs the CPUs are running with survive
+ * it, as reserved VMIDs. The broadcast invalidation keeps the other vcpus
+ * running, instead of kicking all of them out of their guests.
+ */
+static void flush_context(void)
+{
+	int cpu;
+	u64 id;
+
+	bitmap_clear(kvm_vmid_map, 0, NUM_VMIDS);
+
+	for_each_possible_cpu(cpu) {
+		id = atomic64_xchg_relaxed(&per_cpu(kvm_active_vmids, cpu), 0);
+		/*
+		 * If this CPU has already been through a rollover, but hasn't
+		 * run another guest yet, preserve its reserved VMID, as it
+		 * may still have TLB entries tagged with it.
+		 */
+		if (id == 0)
+			id = per_cpu(kvm_reserved_vmids, cpu);
+		__set_bit(vmid2idx(id), kvm_vmid_map);
+		per_cpu(kvm_reserved_vmids, cpu) = id;
+	}
+
+	kvm_call_hyp(__kvm_flush_vm_context);
+}
+
+static bool check_update_reserved_vmid(u64 id, u64 newid)
+{
+	bool hit = false;
+	int cpu;
+
+	/*
+	 * Iterate over the set of reserved VMIDs looking for a match, and
+	 * update them all to the new generation: several CPUs may be running
+	 * the same VM, with the VMID reserved on each of them.
+	 */
+	for_each_possible_cpu(cpu) {
+		if (per_cpu(kvm_reserved_vmids, cpu) == id) {
+			hit = true;
+			per_cpu(kvm_reserved_vmids, cpu) = newid;
+		}
+	}
+
+	return hit;
+}
+
+/* Called with kvm_vmid_lock held */
+static u64 new_vmid(struct kvm_s2_vmid *vmid)
+{
+	static u32 cur_idx = 1;
+	u64 id = vmid_id(vmid);
+	u64 generation = atomic64_read(&kvm_vmid_gen);
+	u32 idx;
+
+	/* A zero generation asks for a VMID nobody used since the last flush */
+	if (vmid->vmid_gen) {
+		u64 newid = generation | vmid2idx(id);
+
+		/* A VMID still live on a CPU across a rollover stays ours */
+		if (check_update_reserved_vmid(id, newid))
+			return newid;
+
+		/* Otherwise keep our old VMID if it is still free */
+		if (!__test_and_set_bit(vmid2idx(id), kvm_vmid_map))
+			return newid;
+	}
+
+	/* VMID 0 is the host's, it is never handed out */
+	idx = find_next_zero_bit(kvm_vmid_map, NUM_VMIDS, cur_idx);
+	if (idx != NUM_VMIDS)
+		goto set_vmid;
+
+	/* We're out of VMIDs, so increment the global generation count */
+	generation = atomic64_add_return_relaxed(VMID_FIRST_VERSION,
+						 &kvm_vmid_gen);
+	flush_context();
+
+	/* We have more VMIDs than CPUs, so this will always succeed */
+	idx = find_next_zero_bit(kvm_vmid_map, NUM_VMIDS, 1);
+
+set_vmid:
+	__set_bit(idx, kvm_vmid_map);
+	cur_idx = idx;
+	return idx | generation;
+}
+
+/*
+ * Make @vmid the VMID this CPU runs with, if it is valid in the current
+ * generation, without taking kvm_vmid_lock. Called with preemption disabled.
+ */
+static bool kvm_vmid_activate_fast(struct kvm_s2_vmid *vmid)
+{
+	atomic64_t *active = this_cpu_ptr(&kvm_active_vmids);
+	u64 id = vmid_id(vmid);
+	u64 old_active;
+
+	/*
+	 * The cmpxchg races with a concurrent rollover setting the active
+	 * VMID to 0, in which case we take the lock to find out about the
+	 * new generation.
+	 */
+	old_active = atomic64_read(active);
+	return old_active &&
+	       !((id ^ atomic64_read(&kvm_vmid_gen)) >> kvm_vmid_bits) &&
+	       atomic64_cmpxchg_relaxed(active, old_active, id);
 }
 
 /**
@@ -473,61 +635,39 @@ static bool need_new_vmid_gen(struct kvm_s2_vmid *vmid)
  * @kvm: The guest that we are about to run
  * @vmid: The stage-2 VMID information struct
  *
- * Called from kvm_arch_vcpu_ioctl_run before entering the guest to ensure the
- * VM has a valid VMID, otherwise assigns a new one and flushes corresponding
- * caches and TLBs.
+ * Called from kvm_arch_vcpu_ioctl_run before entering the guest, with
+ * preemption disabled, to ensure the VM has a valid VMID, otherwise assigns
+ * a new one.
  */
 static void update_vttbr(struct kvm *kvm, struct kvm_s2_vmid *vmid)
 {
 	struct kvm_s2_mmu *mmu = &kvm->arch.mmu;
 	struct kvm_vcpu *vcpu;
 	int i = 0;
-	u64 new_vttbr;
+	u64 id, new_vttbr;
 
-	if (!need_new_vmid_gen(vmid))
+	if (kvm_vmid_activate_fast(vmid))
 		return;
 
 	spin_lock(&kvm_vmid_lock);
 
 	/*
-	 * We need to re-check the vmid_gen here to ensure that if another vcpu
-	 * already allocated a valid vmid for this vm, then this vcpu should
-	 * use the same vmid.
+	 * We need to re-check the generation here to ensure that if another
+	 * vcpu already allocated a valid vmid for this vm, then this vcpu
+	 * should use the same vmid.
 	 */
-	if (!need_new_vmid_gen(vmid)) {
-		spin_unlock(&kvm_vmid_lock);
-		return;
-	}
-
-	/* First user of a new VMID generation? */
-	if (unlikely(kvm_next_vmid == 0)) {
-		atomic64_inc(&kvm_vmid_gen);
-		kvm_next_vmid = 1;
-
-		/*
-		 * On SMP we know no other CPUs can use this CPU's or each
-		 * other's VMID after force_vm_exit returns since the
-		 * kvm_vmid_lock blocks them from reentry to the guest.
-		 */
-		force_vm_exit(cpu_all_mask);
-		/*
-		 * Now broadcast TLB + ICACHE invalidation over the inner
-		 * shareable domain to make sure all data structures are
-		 * clean.
-		 */
-		kvm_call_hyp(__kvm_flush_vm_context);
-	}
-
-	vmid->vmid_gen = atomic64_read(&kvm_vmid_gen);
-	vmid->vmid = kvm_next_vmid;
-	kvm_next_vmid++;
-	kvm_next_vmid &= (1 << kvm_vmid_bits) - 1;
-
-	new_vttbr = kvm_get_vttbr(&mmu->vmid, mmu);
-	kvm_for_each_vcpu(i, vcpu, kvm) {
-		vcpu->arch.hw_vttbr = new_vttbr;
+	id = vmid_id(vmid);
+	if ((id ^ atomic64_read(&kvm_vmid_gen)) >> kvm_vmid_bits) {
+		id = new_vmid(vmid);
+		vmid_set_id(vmid, id);
+
+		new_vttbr = kvm_get_vttbr(&mmu->vmid, mmu);
+		kvm_for_each_vcpu(i, vcpu, kvm) {
+			vcpu->arch.hw_vttbr = new_vttbr;
+		}
 	}
 
+	atomic64_set(this_cpu_ptr(&kvm_active_vmids), id);
 	spin_unlock(&kvm_vmid_lock);
 }
 
@@ -618,6 +758,55 @@ static void check_vcpu_requests(struct kvm_vcpu *vcpu)
 	}
 }
 
+/*
+ * Called with interrupts still disabled after an exit. The only exit handled
+ * here is an ERET from the virtual EL2 into a nested VM that can be entered
+ * right away. Emulating it and re-entering the guest from here, instead of
+ * going through the whole run loop and its shadow state teardown, makes the
+ * common guest hypervisor to nested VM switch much cheaper.
+ *
+ * That skips the vgic, timer and PMU flush, which is where an interrupt of
+ * the guest hypervisor pending at that point would turn into an IRQ
+ * exception to the virtual EL2. So any pending interrupt, or interrupt line
+ * change the flush would pick up, takes the run loop.
+ */
+static bool kvm_vcpu_fast_reenter(struct kvm_vcpu *vcpu, int exception_index)
+{
+	struct kvm_s2_mmu *mmu = kvm_arm_fast_eret_mmu(vcpu, exception_index);
+
+	if (!mmu)
+		return false;
+
+	if (kvm_timer_needs_update(vcpu) || kvm_pmu_needs_update(vcpu) ||
+	    kvm_vgic_vcpu_pending_irq(vcpu))
+		return false;
+
+	/* Ordered against kvm_vcpu_exiting_guest_mode() as in the run loop */
+	smp_store_mb(vcpu->mode, IN_GUEST_MODE);
+
+	if (signal_pending(current) || need_resched() ||
+	    !kvm_vmid_activate_fast(&mmu->vmid) || kvm_request_pending(vcpu)) {
+		vcpu->mode = OUTSIDE_GUEST_MODE;
+		return false;
+	}
+
+	trace_kvm_exit(exception_index, kvm_vcpu_trap_get_class(vcpu),
+		       *vcpu_pc(vcpu), kvm_guest_ctxt(vcpu));
+	guest_exit_irqoff();
+
+	kvm_arm_fast_eret(vcpu);
+	return true;
+}
+
+/* Slow path of kvm_arm_lock_stat(), once the contended lock is taken */
+u64 __kvm_arm_lock_waited(const char *name, unsigned long holder, u64 start)
+{
+	u64 wait_ns = local_clock() - start;
+
+	trace_kvm_lock_contended(name, holder, wait_ns);
+	return wait_ns;
+}
+
 /**
  * kvm_arch_vcpu_ioctl_run - the main VCPU run function to execute guest code
  * @vcpu:	The VCPU pointer
@@ -641,6 +830,9 @@ int kvm_arch_vcpu_ioctl_run(struct kvm_vcpu *vcpu, struct kvm_run *run)
 	u32 esr;
 	u8 esr_ec;
 	u32 mode;
+	u64 entry_ns = 0;
+	u32 run_vmid = 0;
+	int run_ctxt = 0;
 	
 
 	if (unlikely(!kvm_vcpu_initialized(vcpu)))
@@ -650,6 +842,10 @@ int kvm_arch_vcpu_ioctl_run(struct kvm_vcpu *vcpu, struct kvm_run *run)
 	if (ret)
 		return ret;
 
+	ret = kvm_arch_vcpu_run_map_fp(vcpu);
+	if (ret)
+		return ret;
+
 	if (run->exit_reason == KVM_EXIT_MMIO) {
 		ret = kvm_handle_mmio_return(vcpu, vcpu->run);
 		if (ret)
@@ -666,21 +862,36 @@ int kvm_arch_vcpu_ioctl_run(struct kvm_vcpu *vcpu, struct kvm_run *run)
 	run->exit_reason = KVM_EXIT_UNKNOWN;
 	while (ret > 0) {
 		/*
-		 * Check conditions before entering the guest
+		 * Check conditions before entering the guest. A reschedule
+		 * deferred on the guest's request waits for the next exit.
 		 */
-		cond_resched();
-
-		update_vttbr(vcpu->kvm, vcpu_get_active_vmid(vcpu));
+		if (!kvm_pvsched_preempt_deferred(vcpu))
+			cond_resched();
 
 		check_vcpu_requests(vcpu);
 
+		/* Let userspace collect the dirty ring before it overflows */
+		if (vcpu->kvm->dirty_ring_size &&
+		    kvm_dirty_ring_soft_full(&vcpu->dirty_ring)) {
+			run->exit_reason = KVM_EXIT_DIRTY_RING_FULL;
+			ret = 0;
+			break;
+		}
+
+		kvm_arm_async_pf_wait(vcpu);
+
+		kvm_nested_s2_prefault(vcpu);
+
 		/*
 		 * Preparing the interrupts to be injected also
 		 * involves poking the GIC, which must be done in a
-		 * non-preemptible context.
+		 * non-preemptible context. So does picking the VMID, which
+		 * is tracked per CPU.
 		 */
 		preempt_disable();
 
+		update_vttbr(vcpu->kvm, vcpu_get_active_vmid(vcpu));
+
 		kvm_pmu_flush_hwstate(vcpu);
 
 		kvm_timer_flush_hwstate(vcpu);
@@ -721,29 +932,53 @@ int kvm_arch_vcpu_ioctl_run(struct kvm_vcpu *vcpu, struct kvm_run *run)
 			continue;
 		}
 
-		kvm_arm_setup_debug(vcpu);
-		kvm_arm_setup_shadow_state(vcpu);
+		kvm_arch_vcpu_ctxflush_fp(vcpu);
 
-		/**************************************************************
-		 * Enter the guest
-		 */
-		trace_kvm_entry(*vcpu_pc(vcpu), kvm_guest_state(vcpu));
-		guest_enter_irqoff();
+		do {
+			kvm_arm_setup_debug(vcpu);
+			kvm_arm_setup_shadow_state(vcpu);
 
-		ret = kvm_call_hyp(__kvm_vcpu_run, vcpu);
-	
-		exception_index = ret;
-		pc = *vcpu_pc(vcpu);
-		esr = kvm_vcpu_get_hsr(vcpu);
+			/******************************************************
+			 * Enter the guest
+			 */
+			trace_kvm_entry(vcpu->vcpu_id, *vcpu_pc(vcpu),
+					kvm_guest_ctxt(vcpu));
+			guest_enter_irqoff();
 
-		vcpu->mode = OUTSIDE_GUEST_MODE;
-		vcpu->stat.exits++;
-		/*
-		 * Back from guest
-		 *************************************************************/
+			if (trace_kvm_world_switch_enabled()) {
+				run_ctxt = kvm_guest_ctxt(vcpu);
+				run_vmid = vcpu_get_active_vmid(vcpu)->vmid;
+				entry_ns = local_clock();
+			}
+
+			ret = kvm_call_hyp(__kvm_vcpu_run, vcpu);
+
+			exception_index = ret;
+			pc = *vcpu_pc(vcpu);
+			esr = kvm_vcpu_get_hsr(vcpu);
+
+			if (entry_ns) {
+				u64 exit_ns = local_clock();
 
-		kvm_arm_restore_shadow_state(vcpu);
-		kvm_arm_clear_debug(vcpu);
+				/* RCU may not be watching, in guest context */
+				trace_kvm_world_switch_rcuidle(vcpu->vcpu_id,
+					run_ctxt, run_vmid, ret, esr,
+					kvm_vcpu_trap_get_class(vcpu),
+					entry_ns, exit_ns);
+				entry_ns = 0;
+			}
+
+			vcpu->mode = OUTSIDE_GUEST_MODE;
+			vcpu->stat.exits++;
+			/*
+			 * Back from guest
+			 *****************************************************/
+
+			kvm_arm_restore_shadow_state(vcpu);
+			kvm_arm_clear_debug(vcpu);
+		} while (kvm_vcpu_fast_reenter(vcpu, ret));
+
+		kvm_arch_vcpu_ctxsync_fp(vcpu);
 
 		/*
 		 * We may have taken a host interrupt in HYP mode (ie
@@ -767,7 +1002,8 @@ int kvm_arch_vcpu_ioctl_run(struct kvm_vcpu *vcpu, struct kvm_run *run)
 		 */
 		guest_exit();
 		esr_ec = kvm_vcpu_trap_get_class(vcpu);
-		trace_kvm_exit(ret, kvm_vcpu_trap_get_class(vcpu), *vcpu_pc(vcpu));
+		trace_kvm_exit(ret, kvm_vcpu_trap_get_class(vcpu), *vcpu_pc(vcpu),
+			       kvm_guest_ctxt(vcpu));
 
 		/*
 		 * We must sync the PMU and timer state before the vgic state so
@@ -779,7 +1015,10 @@ int kvm_arch_vcpu_ioctl_run(struct kvm_vcpu *vcpu, struct kvm_run *run)
 
 		kvm_vgic_sync_hwstate(vcpu);
 
-		preempt_enable();
+		if (kvm_pvsched_defer_preempt(vcpu))
+			preempt_enable_no_resched();
+		else
+			preempt_enable();
 
 		
 #ifdef CONFIG_ARM64
@@ -1092,7 +1331,7 @@ long kvm_arch_vcpu_ioctl(struct file *filp,
 		return kvm_arm_vcpu_has_attr(vcpu, &attr);
 	}
 	default:
-		return -EINVAL;
+		return kvm_arm_vcpu_arch_ioctl(vcpu, ioctl, argp);
 	}
 }
 
@@ -1104,6 +1343,9 @@ long kvm_arch_vcpu_ioctl(struct file *filp,
  * Steps 1-4 below provide general overview of dirty page logging. See
  * kvm_get_dirty_log_protect() function description for additional details.
  *
+ * With kvm-arm.stage2_dbm, the pages the hardware marked dirty in stage 2
+ * are first added to the dirty bitmap, and step 2 leaves pages writable-clean.
+ *
  * We call kvm_get_dirty_log_protect() to handle steps 1-3, upon return we
  * always flush the TLB (step 4) even if previous step failed  and the dirty
  * bitmap may be corrupt. Regardless of previous outcome the KVM logging API
@@ -1122,6 +1364,7 @@ int kvm_vm_ioctl_get_dirty_log(struct kvm *kvm, struct kvm_dirty_log *log)
 
 	mutex_lock(&kvm->slots_lock);
 
+	kvm_mmu_sync_dirty_log(kvm, log->slot);
 	r = kvm_get_dirty_log_protect(kvm, log, &is_dirty);
 
 	if (is_dirty)
@@ -1188,7 +1431,7 @@ long kvm_arch_vm_ioctl(struct file *filp,
 		return 0;
 	}
 	default:
-		return -EINVAL;
+		return kvm_arm_vm_arch_ioctl(kvm, ioctl, argp);
 	}
 }
 
@@ -1321,6 +1564,7 @@ static inline void hyp_cpu_pm_exit(void)
 
 static void teardown_common_resources(void)
 {
+	kfree(kvm_vmid_map);
 	free_percpu(kvm_host_cpu_state);
 }
 
@@ -1336,6 +1580,15 @@ static int init_common_resources(void)
 	kvm_vmid_bits = kvm_get_vmid_bits();
 	kvm_info("%d-bit VMID\n", kvm_vmid_bits);
 
+	kvm_vmid_map = kcalloc(BITS_TO_LONGS(NUM_VMIDS), sizeof(*kvm_vmid_map),
+			       GFP_KERNEL);
+	if (!kvm_vmid_map) {
+		kvm_err("Cannot allocate VMID bitmap\n");
+		free_percpu(kvm_host_cpu_state);
+		return -ENOMEM;
+	}
+	atomic64_set(&kvm_vmid_gen, VMID_FIRST_VERSION);
+
 	return 0;
 }
 
@@ -1525,6 +1778,53 @@ struct kvm_vcpu *kvm_mpidr_to_vcpu(struct kvm *kvm, unsigned long mpidr)
 	return NULL;
 }
 
+bool kvm_arch_has_irq_bypass(void)
+{
+	return true;
+}
+
+int kvm_arch_irq_bypass_add_producer(struct irq_bypass_consumer *cons,
+				      struct irq_bypass_producer *prod)
+{
+	struct kvm_kernel_irqfd *irqfd =
+		container_of(cons, struct kvm_kernel_irqfd, consumer);
+
+	if (irqfd->irq_entry.type != KVM_IRQ_ROUTING_MSI)
+		return 0;
+
+	return kvm_vgic_v4_set_forwarding(irqfd->kvm, prod->irq,
+					  &irqfd->irq_entry);
+}
+
+void kvm_arch_irq_bypass_del_producer(struct irq_bypass_consumer *cons,
+				      struct irq_bypass_producer *prod)
+{
+	struct kvm_kernel_irqfd *irqfd =
+		container_of(cons, struct kvm_kernel_irqfd, consumer);
+
+	if (irqfd->irq_entry.type != KVM_IRQ_ROUTING_MSI)
+		return;
+
+	kvm_vgic_v4_unset_forwarding(irqfd->kvm, prod->irq,
+				     &irqfd->irq_entry);
+}
+
+void kvm_arch_irq_bypass_stop(struct irq_bypass_consumer *cons)
+{
+	struct kvm_kernel_irqfd *irqfd =
+		container_of(cons, struct kvm_kernel_irqfd, consumer);
+
+	kvm_arm_halt_guest(irqfd->kvm);
+}
+
+void kvm_arch_irq_bypass_start(struct irq_bypass_consumer *cons)
+{
+	struct kvm_kernel_irqfd *irqfd =
+		container_of(cons, struct kvm_kernel_irqfd, consumer);
+
+	kvm_arm_resume_guest(irqfd->kvm);
+}
+
 /**
  * Initialize Hyp-mode and memory mappings on all CPUs.
  */
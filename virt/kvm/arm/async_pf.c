@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2017 - Linaro Ltd
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/kvm_host.h>
+#include <trace/events/kvm.h>
+
+/*
+ * A stage 2 fault on a page that is not resident (swapped out, or still to
+ * be fetched by a userfaultfd handler) is resolved by a worker instead of the
+ * vcpu thread. The vcpu resumes the guest without mapping anything, and then
+ * waits for the worker in kvm_arm_async_pf_wait(), blocked as if in WFI. It
+ * stays preemptible, handles signals and requests, and still enters the guest
+ * to deliver interrupts, after which the guest faults on the page again.
+ */
+bool kvm_arm_setup_async_pf(struct kvm_vcpu *vcpu, phys_addr_t ipa,
+			    gfn_t gfn, unsigned long hva)
+{
+	struct kvm_arch_async_pf arch = { .gfn = gfn };
+
+	return kvm_setup_async_pf(vcpu, ipa, hva, &arch);
+}
+
+bool kvm_arm_async_pf_done(struct kvm_vcpu *vcpu)
+{
+	return !list_empty_careful(&vcpu->async_pf.done);
+}
+
+/* Called from the run loop before entering the guest */
+void kvm_arm_async_pf_wait(struct kvm_vcpu *vcpu)
+{
+	kvm_check_async_pf_completion(vcpu);
+
+	if (!vcpu->async_pf.queued || kvm_arch_vcpu_runnable(vcpu))
+		return;
+
+	kvm_vcpu_block(vcpu);
+	kvm_check_request(KVM_REQ_UNHALT, vcpu);
+	kvm_check_async_pf_completion(vcpu);
+}
+
+void kvm_arm_async_pf_clear(struct kvm_vcpu *vcpu)
+{
+	kvm_clear_async_pf_completion_queue(vcpu);
+}
+
+void kvm_arch_async_page_not_present(struct kvm_vcpu *vcpu,
+				     struct kvm_async_pf *work)
+{
+	trace_kvm_async_pf_not_present(work->arch.gfn, work->gva);
+}
+
+void kvm_arch_async_page_present(struct kvm_vcpu *vcpu,
+				 struct kvm_async_pf *work)
+{
+	trace_kvm_async_pf_ready(work->arch.gfn, work->gva);
+}
+
+/* The guest faults on the page again, and finds it resident by then */
+void kvm_arch_async_page_ready(struct kvm_vcpu *vcpu,
+			       struct kvm_async_pf *work)
+{
+}
+
+bool kvm_arch_can_inject_async_page_present(struct kvm_vcpu *vcpu)
+{
+	return true;
+}
@@ -26,7 +26,7 @@
 void __hyp_text __timer_save_state(struct kvm_vcpu *vcpu)
 {
 	struct arch_timer_cpu *timer = &vcpu->arch.timer_cpu;
-	struct arch_timer_context *vtimer = vcpu_vtimer(vcpu);
+	struct arch_timer_context *vtimer = vcpu_loaded_vtimer(vcpu);
 	u64 val;
 
 	if (timer->enabled) {
@@ -55,9 +55,9 @@ void __hyp_text __timer_save_state(struct kvm_vcpu *vcpu)
 void __hyp_text __timer_restore_state(struct kvm_vcpu *vcpu)
 {
 	struct arch_timer_cpu *timer = &vcpu->arch.timer_cpu;
-	struct arch_timer_context *vtimer = vcpu_vtimer(vcpu);
+	struct arch_timer_context *vtimer = vcpu_loaded_vtimer(vcpu);
 	u64 val;
-	u64 cntvoff;
+	u64 cntvoff = 0;
 
 	/* Those bits are already configured at boot on VHE-system */
 	if (!has_vhe()) {
@@ -72,7 +72,9 @@ void __hyp_text __timer_restore_state(struct kvm_vcpu *vcpu)
 	}
 
 	if (timer->enabled) {
-		cntvoff = vtimer->cntvoff + kvm_get_vcntvoff(vcpu);
+		/* The EL2 virtual timer counts with no offset */
+		if (!timer->hvtimer_loaded)
+			cntvoff = vtimer->cntvoff + kvm_get_vcntvoff(vcpu);
 		write_sysreg(cntvoff, cntvoff_el2);
 		write_sysreg_el0(vtimer->cnt_cval, cntv_cval);
 		isb();
@@ -26,6 +26,30 @@
 #define vtr_to_nr_pre_bits(v)		((((u32)(v) >> 26) & 7) + 1)
 #define vtr_to_nr_apr_regs(v)		(1 << (vtr_to_nr_pre_bits(v) - 5))
 
+static __hyp_text struct vgic_v3_cpu_if *__hyp_get_cpu_if(struct kvm_vcpu *vcpu)
+{
+	return kern_hyp_va(vcpu->arch.vgic_cpu.hw_v3_cpu_if);
+}
+
+static __hyp_text bool __hyp_cpu_if_is_shadow(struct kvm_vcpu *vcpu,
+					      struct vgic_v3_cpu_if *cpu_if)
+{
+	return cpu_if != &vcpu->arch.vgic_cpu.vgic_v3;
+}
+
+/*
+ * The shadow interface of a nested VM holds whatever LRs the guest hypervisor
+ * programmed, not only the ones we populated.
+ */
+static __hyp_text u64 __hyp_get_used_lrs(struct kvm_vcpu *vcpu,
+					 struct vgic_v3_cpu_if *cpu_if)
+{
+	if (__hyp_cpu_if_is_shadow(vcpu, cpu_if))
+		return (kern_hyp_va(&kvm_vgic_global_state))->nr_lr;
+
+	return vcpu->arch.vgic_cpu.used_lrs;
+}
+
 static u64 __hyp_text __gic_v3_get_lr(unsigned int lr)
 {
 	switch (lr & 0xf) {
@@ -206,8 +230,8 @@ static u32 __hyp_text __vgic_v3_read_ap1rn(int n)
 
 void __hyp_text __vgic_v3_save_state(struct kvm_vcpu *vcpu)
 {
-	struct vgic_v3_cpu_if *cpu_if = &vcpu->arch.vgic_cpu.vgic_v3;
-	u64 used_lrs = vcpu->arch.vgic_cpu.used_lrs;
+	struct vgic_v3_cpu_if *cpu_if = __hyp_get_cpu_if(vcpu);
+	u64 used_lrs = __hyp_get_used_lrs(vcpu, cpu_if);
 	u64 val;
 
 	/*
@@ -272,6 +296,13 @@ void __hyp_text __vgic_v3_save_state(struct kvm_vcpu *vcpu)
 		cpu_if->vgic_ap1r[3] = 0;
 	}
 
+	/* Give the guest hypervisor its own VMCR back, see the restore path */
+	if (cpu_if->vgic_sre && __hyp_cpu_if_is_shadow(vcpu, cpu_if)) {
+		cpu_if->vgic_vmcr = read_gicreg(ICH_VMCR_EL2);
+		write_gicreg(vcpu->arch.vgic_cpu.vgic_v3.vgic_vmcr,
+			     ICH_VMCR_EL2);
+	}
+
 	val = read_gicreg(ICC_SRE_EL2);
 	write_gicreg(val | ICC_SRE_EL2_ENABLE, ICC_SRE_EL2);
 
@@ -284,8 +315,8 @@ void __hyp_text __vgic_v3_save_state(struct kvm_vcpu *vcpu)
 
 void __hyp_text __vgic_v3_restore_state(struct kvm_vcpu *vcpu)
 {
-	struct vgic_v3_cpu_if *cpu_if = &vcpu->arch.vgic_cpu.vgic_v3;
-	u64 used_lrs = vcpu->arch.vgic_cpu.used_lrs;
+	struct vgic_v3_cpu_if *cpu_if = __hyp_get_cpu_if(vcpu);
+	u64 used_lrs = __hyp_get_used_lrs(vcpu, cpu_if);
 	u64 val;
 	u32 nr_pre_bits;
 	int i;
@@ -303,6 +334,14 @@ void __hyp_text __vgic_v3_restore_state(struct kvm_vcpu *vcpu)
 		write_gicreg(0, ICC_SRE_EL1);
 		isb();
 		write_gicreg(cpu_if->vgic_vmcr, ICH_VMCR_EL2);
+	} else if (__hyp_cpu_if_is_shadow(vcpu, cpu_if)) {
+		/*
+		 * With SRE, the VMCR is only switched on vcpu load/put, and
+		 * the live one belongs to the guest hypervisor. Park it
+		 * while the nested VM runs on the shadow VMCR.
+		 */
+		vcpu->arch.vgic_cpu.vgic_v3.vgic_vmcr = read_gicreg(ICH_VMCR_EL2);
+		write_gicreg(cpu_if->vgic_vmcr, ICH_VMCR_EL2);
 	}
 
 	val = read_gicreg(ICH_VTR_EL2);
@@ -407,7 +446,8 @@ static int __hyp_text __vgic_v3_highest_priority_lr(struct kvm_vcpu *vcpu,
 						    u32 vmcr,
 						    u64 *lr_val)
 {
-	unsigned int used_lrs = vcpu->arch.vgic_cpu.used_lrs;
+	struct vgic_v3_cpu_if *cpu_if = __hyp_get_cpu_if(vcpu);
+	unsigned int used_lrs = __hyp_get_used_lrs(vcpu, cpu_if);
 	u8 priority = GICv3_IDLE_PRIORITY;
 	int i, lr = -1;
 
@@ -446,7 +486,8 @@ static int __hyp_text __vgic_v3_highest_priority_lr(struct kvm_vcpu *vcpu,
 static int __hyp_text __vgic_v3_find_active_lr(struct kvm_vcpu *vcpu,
 					       int intid, u64 *lr_val)
 {
-	unsigned int used_lrs = vcpu->arch.vgic_cpu.used_lrs;
+	struct vgic_v3_cpu_if *cpu_if = __hyp_get_cpu_if(vcpu);
+	unsigned int used_lrs = __hyp_get_used_lrs(vcpu, cpu_if);
 	int i;
 
 	for (i = 0; i < used_lrs; i++) {
@@ -185,14 +185,24 @@ int io_mem_abort(struct kvm_vcpu *vcpu, struct kvm_run *run,
 		trace_kvm_mmio(KVM_TRACE_MMIO_WRITE, len, ipa, data);
 		kvm_mmio_write_buf(data_buf, len, data);
 
-		ret = kvm_io_bus_write(vcpu, KVM_MMIO_BUS, ipa, len,
-				       data_buf);
+		ret = kvm_io_bus_write_cookie(vcpu, KVM_MMIO_BUS, ipa, len,
+					      data_buf, vcpu->arch.mmio_cookie);
 	} else {
 		trace_kvm_mmio(KVM_TRACE_MMIO_READ_UNSATISFIED, len,
 			       ipa, 0);
 
-		ret = kvm_io_bus_read(vcpu, KVM_MMIO_BUS, ipa, len,
-				      data_buf);
+		ret = kvm_io_bus_read_cookie(vcpu, KVM_MMIO_BUS, ipa, len,
+					     data_buf, vcpu->arch.mmio_cookie);
+	}
+
+	/*
+	 * Guests tend to hit the same device over and over, the GIC
+	 * distributor or their redistributor: remember it, so that the next
+	 * access skips the search of the bus if it is for the same device.
+	 */
+	if (ret >= 0) {
+		vcpu->arch.mmio_cookie = ret;
+		ret = 0;
 	}
 
 	/* Now prepare kvm_run for the potential return to userland. */
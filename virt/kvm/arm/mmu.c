@@ -20,6 +20,7 @@
 #include <linux/kvm_host.h>
 #include <linux/io.h>
 #include <linux/hugetlb.h>
+#include <linux/sizes.h>
 #include <linux/sched/signal.h>
 #include <trace/events/kvm.h>
 #include <asm/pgalloc.h>
@@ -31,6 +32,7 @@
 #include <asm/kvm_emulate.h>
 #include <asm/virt.h>
 #include <asm/kvm_rmap.h>
+#include <kvm/arm_lock_stat.h>
 
 #include "trace.h"
 
@@ -49,11 +51,61 @@ static phys_addr_t hyp_idmap_vector;
 #define KVM_S2PTE_FLAG_IS_IOMAP		(1UL << 0)
 #define KVM_S2_FLAG_LOGGING_ACTIVE	(1UL << 1)
 
+/*
+ * Log dirty pages with the hardware dirty state of stage 2 instead of write
+ * faults, where all CPUs have it: pages stay writable-clean and
+ * KVM_GET_DIRTY_LOG scans stage 2 for the ones the guest wrote to.
+ */
+static bool stage2_dbm;
+
+static int __init early_stage2_dbm_cfg(char *buf)
+{
+	return strtobool(buf, &stage2_dbm);
+}
+early_param("kvm-arm.stage2_dbm", early_stage2_dbm_cfg);
+
+/* The dirty ring is only fed by faults */
+static bool stage2_dbm_enabled(struct kvm *kvm)
+{
+	return stage2_dbm && !kvm->dirty_ring_size;
+}
+
+/*
+ * cond_resched_lock() for the write side of kvm->mmu_lock. The rwlock can't
+ * tell whether it is contended, so only a pending reschedule breaks it.
+ */
+static void stage2_resched_lock(struct kvm *kvm)
+{
+	kvm_mmu_write_unlock(kvm);
+	cond_resched();
+	kvm_mmu_write_lock(kvm);
+}
+
+static void stage2_cond_resched_lock(struct kvm *kvm)
+{
+	if (need_resched())
+		stage2_resched_lock(kvm);
+}
+
 static bool memslot_is_logging(struct kvm_memory_slot *memslot)
 {
 	return memslot->dirty_bitmap && !(memslot->flags & KVM_MEM_READONLY);
 }
 
+static void kvm_tlb_flush_vmid(struct kvm_s2_mmu *mmu)
+{
+	u64 vttbr = kvm_get_vttbr(&mmu->vmid, mmu);
+
+	kvm_call_hyp(__kvm_tlb_flush_vmid, vttbr);
+
+	if (!mmu->el2_vmid.vmid) {
+		/* Nothing to do more for a non-nested guest */
+		return;
+	}
+	vttbr = kvm_get_vttbr(&mmu->el2_vmid, mmu);
+	kvm_call_hyp(__kvm_tlb_flush_vmid, vttbr);
+}
+
 /**
  * kvm_flush_remote_tlbs() - flush all VM TLB entries for v7/8
  * @kvm:	pointer to kvm structure.
@@ -62,27 +114,17 @@ static bool memslot_is_logging(struct kvm_memory_slot *memslot)
  */
 void kvm_flush_remote_tlbs(struct kvm *kvm)
 {
-	struct kvm_s2_mmu *mmu = &kvm->arch.mmu;
-	u64 vttbr = kvm_get_vttbr(&mmu->vmid, mmu);
-
-	if (!mmu->el2_vmid.vmid) {
-		/*
-		 * For a normal (i.e. non-nested) guest, flush entries for the
-		 * given VMID *
-		 */
-		kvm_call_hyp(__kvm_tlb_flush_vmid, vttbr);
-	} else {
-		/*
-		 * When supporting nested virtualization, we can have multiple
-		 * VMIDs in play for each VCPU in the VM, so it's really not
-		 * worth it to try to quiesce the system and flush all the
-		 * VMIDs that may be in use, instead just nuke the whole thing.
-		 */
-		kvm_call_hyp(__kvm_flush_vm_context);
-	}
+	/*
+	 * A nested guest has more VMIDs in play than its own: the one of its
+	 * virtual EL2 and the shadow VMIDs of its nested VMs. Flush exactly
+	 * those, rather than the TLBs of every VM on the system.
+	 */
+	kvm_tlb_flush_vmid(&kvm->arch.mmu);
+	kvm_nested_s2_flush_tlbs(kvm);
 }
 
-static void kvm_tlb_flush_vmid_ipa(struct kvm_s2_mmu *mmu, phys_addr_t ipa)
+static void kvm_tlb_flush_vmid_ipa_nodefer(struct kvm_s2_mmu *mmu,
+					   phys_addr_t ipa)
 {
 	u64 vttbr = kvm_get_vttbr(&mmu->vmid, mmu);
 
@@ -96,6 +138,36 @@ static void kvm_tlb_flush_vmid_ipa(struct kvm_s2_mmu *mmu, phys_addr_t ipa)
 	kvm_call_hyp(__kvm_tlb_flush_vmid_ipa, vttbr, ipa);
 }
 
+/*
+ * Invalidate the TLB entries for a leaf mapping. While a large unmap is in
+ * progress, only record that a flush is needed and let the unmap invalidate
+ * the whole VMID once it is done.
+ */
+static void kvm_tlb_flush_vmid_ipa(struct kvm_s2_mmu *mmu, phys_addr_t ipa)
+{
+	if (mmu->tlb_flush_deferred) {
+		mmu->tlb_flush_pending = true;
+		return;
+	}
+
+	kvm_tlb_flush_vmid_ipa_nodefer(mmu, ipa);
+}
+
+static void stage2_defer_tlb_flush(struct kvm_s2_mmu *mmu, bool defer)
+{
+	mmu->tlb_flush_deferred = defer;
+}
+
+/* Must be called before kvm->mmu_lock is dropped while flushes are deferred */
+static void stage2_flush_deferred_tlb(struct kvm_s2_mmu *mmu)
+{
+	mmu->tlb_flush_deferred = false;
+	if (mmu->tlb_flush_pending) {
+		mmu->tlb_flush_pending = false;
+		kvm_tlb_flush_vmid(mmu);
+	}
+}
+
 /*
  * D-Cache management functions. They take the page table entries by
  * value, as they are flushing the cache using the kernel mapping (or
@@ -173,14 +245,179 @@ void *kvm_mmu_memory_cache_alloc(struct kvm_mmu_memory_cache *mc)
 	return p;
 }
 
-struct rmap_list_desc *kvm_mmu_alloc_rmap_list_desc(struct kvm_vcpu *vcpu)
+/*
+ * The pool starts empty, filled on first use, with a target of what a vcpu
+ * cache takes in one go, below which it never shrinks. Each refill doubles
+ * the target if faults found the pool empty since the previous refill, and
+ * halves it if the pool took more than a second to drain.
+ */
+#define S2_POOL_MIN_PAGES	KVM_NR_MEM_OBJS
+#define S2_POOL_MAX_PAGES	1024
+
+static void kvm_s2_pool_refill(struct work_struct *work)
+{
+	struct kvm_s2_page_pool *pool = container_of(work,
+						     struct kvm_s2_page_pool,
+						     refill);
+	struct page *page, *tmp;
+	int nr = 0, delta;
+	LIST_HEAD(pages);
+
+	spin_lock(&pool->lock);
+	if (pool->nr_missed)
+		pool->target = min_t(unsigned int, pool->target * 2,
+				     S2_POOL_MAX_PAGES);
+	else if (time_after(jiffies, pool->last_refill + HZ))
+		pool->target = max_t(unsigned int, pool->target / 2,
+				     S2_POOL_MIN_PAGES);
+	pool->nr_missed = 0;
+	pool->last_refill = jiffies;
+	delta = pool->target - pool->nr_pages;
+
+	/* Give back what the target no longer covers */
+	for (; delta < 0; delta++) {
+		page = list_first_entry(&pool->pages, struct page, lru);
+		list_move(&page->lru, &pages);
+		pool->nr_pages--;
+	}
+	spin_unlock(&pool->lock);
+
+	list_for_each_entry_safe(page, tmp, &pages, lru)
+		__free_page(page);
+	INIT_LIST_HEAD(&pages);
+
+	for (; nr < delta; nr++) {
+		page = alloc_page(PGALLOC_GFP);
+		if (!page)
+			break;
+		list_add(&page->lru, &pages);
+	}
+
+	if (!nr)
+		return;
+
+	spin_lock(&pool->lock);
+	list_splice(&pages, &pool->pages);
+	pool->nr_pages += nr;
+	spin_unlock(&pool->lock);
+}
+
+/* Move up to @max pages from the VM pool into @cache, without allocating */
+static void kvm_s2_pool_take(struct kvm *kvm,
+			     struct kvm_mmu_memory_cache *cache, int max)
 {
-	return kvm_mmu_memory_cache_alloc(&vcpu->arch.mmu_rmap_list_desc_cache);
+	struct kvm_s2_page_pool *pool = &kvm->arch.s2_pool;
+	struct page *page;
+	bool refill;
+
+	spin_lock(&pool->lock);
+	while (cache->nobjs < max && pool->nr_pages) {
+		page = list_first_entry(&pool->pages, struct page, lru);
+		list_del(&page->lru);
+		pool->nr_pages--;
+		cache->objects[cache->nobjs++] = page_address(page);
+	}
+	refill = pool->nr_pages < pool->target / 2;
+	spin_unlock(&pool->lock);
+
+	if (refill)
+		schedule_work(&pool->refill);
 }
 
-void kvm_mmu_free_rmap_list_desc(struct rmap_list_desc *rmap_list_desc)
+/*
+ * Top up the vcpu cache used by stage 2 faults, from the VM pool if it can
+ * and from the page allocator otherwise, which the next refill takes into
+ * account.
+ */
+static int stage2_topup_fault_cache(struct kvm *kvm,
+				    struct kvm_mmu_memory_cache *cache)
 {
-	free_page((unsigned long)rmap_list_desc);
+	struct kvm_s2_page_pool *pool = &kvm->arch.s2_pool;
+
+	if (cache->nobjs >= KVM_MMU_CACHE_MIN_PAGES)
+		return 0;
+
+	kvm_s2_pool_take(kvm, cache, KVM_NR_MEM_OBJS);
+	if (cache->nobjs < KVM_MMU_CACHE_MIN_PAGES) {
+		spin_lock(&pool->lock);
+		pool->nr_missed++;
+		spin_unlock(&pool->lock);
+	}
+
+	return mmu_topup_memory_cache(cache, KVM_MMU_CACHE_MIN_PAGES,
+				      KVM_NR_MEM_OBJS);
+}
+
+/*
+ * Make the pages a fault takes off the top of a topped up @cache come from
+ * node @nid, the one of the memory they are about to map, so that walks of
+ * the new tables stay on the node of the data. Pages from other nodes are
+ * swapped with local ones further down the cache, or replaced when there
+ * are none left.
+ */
+static void stage2_localize_fault_cache(struct kvm_vcpu *vcpu,
+					struct kvm_mmu_memory_cache *cache,
+					int nid)
+{
+	int i, j, top;
+	struct page *page;
+
+	if (nr_online_nodes == 1)
+		return;
+
+	top = cache->nobjs - KVM_MMU_CACHE_MIN_PAGES;
+	for (i = cache->nobjs - 1, j = top - 1; i >= top; i--) {
+		if (page_to_nid(virt_to_page(cache->objects[i])) == nid)
+			continue;
+
+		while (j >= 0 &&
+		       page_to_nid(virt_to_page(cache->objects[j])) != nid)
+			j--;
+		if (j >= 0) {
+			swap(cache->objects[i], cache->objects[j--]);
+			continue;
+		}
+
+		page = alloc_pages_node(nid, PGALLOC_GFP | __GFP_THISNODE |
+					__GFP_NOWARN, 0);
+		if (!page) {
+			vcpu->stat.s2_remote_table++;
+			continue;
+		}
+		free_page((unsigned long)cache->objects[i]);
+		cache->objects[i] = page_address(page);
+	}
+}
+
+void kvm_s2_pool_init(struct kvm *kvm)
+{
+	struct kvm_s2_page_pool *pool = &kvm->arch.s2_pool;
+
+	spin_lock_init(&pool->lock);
+	INIT_LIST_HEAD(&pool->pages);
+	pool->nr_pages = 0;
+	pool->target = S2_POOL_MIN_PAGES;
+	pool->nr_missed = 0;
+	pool->last_refill = jiffies;
+	INIT_WORK(&pool->refill, kvm_s2_pool_refill);
+}
+
+void kvm_s2_pool_destroy(struct kvm *kvm)
+{
+	struct kvm_s2_page_pool *pool = &kvm->arch.s2_pool;
+	struct page *page, *tmp;
+
+	cancel_work_sync(&pool->refill);
+
+	list_for_each_entry_safe(page, tmp, &pool->pages, lru)
+		__free_page(page);
+	INIT_LIST_HEAD(&pool->pages);
+	pool->nr_pages = 0;
+}
+
+struct rmap_list_desc *kvm_mmu_alloc_rmap_list_desc(struct kvm_vcpu *vcpu)
+{
+	return kvm_mmu_memory_cache_alloc(&vcpu->arch.mmu_rmap_list_desc_cache);
 }
 
 static void clear_stage2_pgd_entry(struct kvm_s2_mmu *mmu,
@@ -188,7 +425,7 @@ static void clear_stage2_pgd_entry(struct kvm_s2_mmu *mmu,
 {
 	pud_t *pud_table __maybe_unused = stage2_pud_offset(pgd, 0UL);
 	stage2_pgd_clear(pgd);
-	kvm_tlb_flush_vmid_ipa(mmu, addr);
+	kvm_tlb_flush_vmid_ipa_nodefer(mmu, addr);
 	stage2_pud_free(pud_table);
 	put_page(virt_to_page(pgd));
 }
@@ -200,7 +437,7 @@ static void clear_stage2_pud_entry(struct kvm *kvm, struct kvm_s2_mmu *mmu,
 	unsigned long *l1_ipas;
 	VM_BUG_ON(stage2_pud_huge(*pud));
 	stage2_pud_clear(pud);
-	kvm_tlb_flush_vmid_ipa(mmu, addr);
+	kvm_tlb_flush_vmid_ipa_nodefer(mmu, addr);
 
 	/* If this is a shadow page table */
 	if (mmu !=  &kvm->arch.mmu) {
@@ -223,7 +460,7 @@ static void clear_stage2_pmd_entry(struct kvm *kvm, struct kvm_s2_mmu *mmu,
 	unsigned long *l1_ipas;
 	VM_BUG_ON(pmd_thp_or_huge(*pmd));
 	pmd_clear(pmd);
-	kvm_tlb_flush_vmid_ipa(mmu, addr);
+	kvm_tlb_flush_vmid_ipa_nodefer(mmu, addr);
 
 	/* If this is a shadow page table */
 	if (mmu !=  &kvm->arch.mmu) {
@@ -361,8 +598,19 @@ void kvm_unmap_stage2_range(struct kvm *kvm, struct kvm_s2_mmu *mmu,
 	pgd_t *pgd;
 	phys_addr_t addr = start, end = start + size;
 	phys_addr_t next;
+	bool defer;
+
+	lockdep_assert_held(&kvm->mmu_lock);
+
+	/*
+	 * Shadow stage 2 tables get torn down in bulk on guest hypervisor
+	 * TLBIs. Rather than issuing one TLBI per leaf entry, invalidate the
+	 * whole shadow VMID once the range has been unmapped. Page table
+	 * pages are still invalidated by IPA before being freed.
+	 */
+	defer = mmu != &kvm->arch.mmu && size > PMD_SIZE;
+	stage2_defer_tlb_flush(mmu, defer);
 
-	assert_spin_locked(&kvm->mmu_lock);
 	pgd = mmu->pgd + stage2_pgd_index(addr);
 	do {
 		/*
@@ -377,11 +625,17 @@ void kvm_unmap_stage2_range(struct kvm *kvm, struct kvm_s2_mmu *mmu,
 			unmap_stage2_puds(kvm, mmu, pgd, addr, next);
 		/*
 		 * If the range is too large, release the kvm->mmu_lock
-		 * to prevent starvation and lockup detector warnings.
+		 * to prevent starvation and lockup detector warnings. The
+		 * deferred TLB flush must be done by then, so decide once.
 		 */
-		if (next != end)
-			cond_resched_lock(&kvm->mmu_lock);
+		if (next != end && need_resched()) {
+			stage2_flush_deferred_tlb(mmu);
+			stage2_resched_lock(kvm);
+			stage2_defer_tlb_flush(mmu, defer);
+		}
 	} while (pgd++, addr = next, addr != end);
+
+	stage2_flush_deferred_tlb(mmu);
 }
 
 static void stage2_flush_ptes(pmd_t *pmd, phys_addr_t addr, phys_addr_t end)
@@ -429,7 +683,7 @@ static void stage2_flush_puds(pgd_t *pgd, phys_addr_t addr, phys_addr_t end)
 	} while (pud++, addr = next, addr != end);
 }
 
-void kvm_stage2_flush_range(struct kvm_s2_mmu *mmu,
+void kvm_stage2_flush_range(struct kvm *kvm, struct kvm_s2_mmu *mmu,
 			    phys_addr_t start, phys_addr_t end)
 {
 	phys_addr_t addr = start;
@@ -438,17 +692,22 @@ void kvm_stage2_flush_range(struct kvm_s2_mmu *mmu,
 
 	pgd = mmu->pgd + stage2_pgd_index(addr);
 	do {
+		if (!READ_ONCE(mmu->pgd))
+			break;
 		next = stage2_pgd_addr_end(addr, end);
 		stage2_flush_puds(pgd, addr, next);
+		/* Cleaning is idempotent, so the lock can go between entries */
+		if (next != end)
+			stage2_cond_resched_lock(kvm);
 	} while (pgd++, addr = next, addr != end);
 }
 
-static void stage2_flush_memslot(struct kvm_s2_mmu *mmu,
+static void stage2_flush_memslot(struct kvm *kvm, struct kvm_s2_mmu *mmu,
 		struct kvm_memory_slot *memslot)
 {
 	phys_addr_t start = memslot->base_gfn << PAGE_SHIFT;
 	phys_addr_t end = start + PAGE_SIZE * memslot->npages;
-	kvm_stage2_flush_range(mmu, start, end);
+	kvm_stage2_flush_range(kvm, mmu, start, end);
 }
 
 /**
@@ -465,15 +724,15 @@ static void stage2_flush_vm(struct kvm *kvm)
 	int idx;
 
 	idx = srcu_read_lock(&kvm->srcu);
-	spin_lock(&kvm->mmu_lock);
+	kvm_mmu_write_lock(kvm);
 
 	slots = kvm_memslots(kvm);
 	kvm_for_each_memslot(memslot, slots)
-		stage2_flush_memslot(&kvm->arch.mmu, memslot);
+		stage2_flush_memslot(kvm, &kvm->arch.mmu, memslot);
 
 	kvm_nested_s2_flush(kvm);
 
-	spin_unlock(&kvm->mmu_lock);
+	kvm_mmu_write_unlock(kvm);
 	srcu_read_unlock(&kvm->srcu, idx);
 }
 
@@ -486,23 +745,18 @@ static void stage2_flush_vcpu(struct kvm_vcpu *vcpu)
 	struct kvm_memslots *slots;
 	struct kvm_memory_slot *memslot;
 	int idx;
-	struct kvm_nested_s2_mmu __maybe_unused *nested_mmu;
 
 	idx = srcu_read_lock(&kvm->srcu);
-	spin_lock(&kvm->mmu_lock);
+	kvm_mmu_write_lock(kvm);
 
 	slots = kvm_memslots(kvm);
 	kvm_for_each_memslot(memslot, slots)
-		stage2_flush_memslot(&kvm->arch.mmu, memslot);
+		stage2_flush_memslot(kvm, &kvm->arch.mmu, memslot);
 
-	if (nested_virt_in_use(vcpu)) {
-		list_for_each_entry_rcu(nested_mmu, &vcpu->kvm->arch.nested_mmu_list,
-				list) {
-			kvm_stage2_flush_range(&nested_mmu->mmu, 0, KVM_PHYS_SIZE);
-		}
-	}
+	if (nested_virt_in_use(vcpu))
+		kvm_nested_s2_flush(kvm);
 
-	spin_unlock(&kvm->mmu_lock);
+	kvm_mmu_write_unlock(kvm);
 	srcu_read_unlock(&kvm->srcu, idx);
 }
 
@@ -929,13 +1183,13 @@ void stage2_unmap_vm(struct kvm *kvm)
 
 	idx = srcu_read_lock(&kvm->srcu);
 	down_read(&current->mm->mmap_sem);
-	spin_lock(&kvm->mmu_lock);
+	kvm_mmu_write_lock(kvm);
 
 	slots = kvm_memslots(kvm);
 	kvm_for_each_memslot(memslot, slots)
 		stage2_unmap_memslot(kvm, memslot);
 
-	spin_unlock(&kvm->mmu_lock);
+	kvm_mmu_write_unlock(kvm);
 	up_read(&current->mm->mmap_sem);
 	srcu_read_unlock(&kvm->srcu, idx);
 }
@@ -944,13 +1198,13 @@ void __kvm_free_stage2_pgd(struct kvm *kvm, struct kvm_s2_mmu *mmu)
 {
 	void *pgd = NULL;
 
-	spin_lock(&kvm->mmu_lock);
+	kvm_mmu_write_lock(kvm);
 	if (mmu->pgd) {
 		kvm_unmap_stage2_range(kvm, mmu, 0, KVM_PHYS_SIZE);
 		pgd = READ_ONCE(mmu->pgd);
 		mmu->pgd = NULL;
 	}
-	spin_unlock(&kvm->mmu_lock);
+	kvm_mmu_write_unlock(kvm);
 
 	/* Free the HW pgd, one page at a time */
 	if (pgd)
@@ -1051,6 +1305,8 @@ static int stage2_set_pmd_huge(struct kvm *kvm, struct kvm_s2_mmu *mmu,
 	if (mmu != &kvm->arch.mmu) {
 		kvm_rmap_add_pmd(kvm, mmu, fault_ipa, ipa, rmap_cache);
 		cache_ipa((unsigned long)pmd, fault_ipa, ipa, true);
+		kvm_nested_s2_track_map(kvm, mmu, fault_ipa & PMD_MASK,
+					PMD_SIZE);
 	}
 
 	kvm_set_pmd(pmd, *new_pmd);
@@ -1119,6 +1375,9 @@ static int stage2_set_pte(struct kvm *kvm, struct kvm_s2_mmu *mmu,
 		get_page(virt_to_page(pte));
 	}
 
+	if (mmu != &kvm->arch.mmu)
+		kvm_nested_s2_track_map(kvm, mmu, addr & PAGE_MASK, PAGE_SIZE);
+
 	if (rmap_cache && (mmu != &kvm->arch.mmu)) {
 		kvm_rmap_add_pte(kvm, mmu, addr, ipa, rmap_cache);
 		cache_ipa((unsigned long)pte, addr, ipa, false);
@@ -1128,6 +1387,119 @@ static int stage2_set_pte(struct kvm *kvm, struct kvm_s2_mmu *mmu,
 	return 0;
 }
 
+/*
+ * Faults on the canonical stage 2 only hold the read side of kvm->mmu_lock,
+ * so that vcpus can fault concurrently. They may only fill empty entries,
+ * either with a new table or a leaf, which they do with cmpxchg: the loser
+ * of a race on a table uses the winner's, the loser of a race on a leaf is
+ * done if the winner mapped the same thing. Anything else, such as relaxing
+ * permissions or replacing a table with a block, returns -EAGAIN, and the
+ * fault is retried with the write side held. Tables are only ever freed
+ * with the write side held.
+ */
+static bool stage2_cmpxchg_entry(void *entry, u64 new)
+{
+	if (cmpxchg64((u64 *)entry, 0, new))
+		return false;
+
+	dsb(ishst);
+	return true;
+}
+
+static void stage2_cache_return(struct kvm_mmu_memory_cache *cache, void *obj)
+{
+	cache->objects[cache->nobjs++] = obj;
+}
+
+static pmd_t *stage2_get_pmd_shared(struct kvm_s2_mmu *mmu,
+				    struct kvm_mmu_memory_cache *cache,
+				    phys_addr_t addr)
+{
+	pud_t *pud, new_pud;
+	pmd_t *pmd;
+
+	pud = stage2_get_pud(mmu, NULL, addr);
+	if (!pud)
+		return NULL;
+
+	if (stage2_pud_none(*pud)) {
+		pmd = kvm_mmu_memory_cache_alloc(cache);
+		stage2_pud_populate(&new_pud, pmd);
+		if (stage2_cmpxchg_entry(pud, pud_val(new_pud)))
+			get_page(virt_to_page(pud));
+		else
+			stage2_cache_return(cache, pmd);
+	}
+
+	return stage2_pmd_offset(pud, addr);
+}
+
+static int stage2_set_pmd_huge_shared(struct kvm *kvm,
+				      struct kvm_mmu_memory_cache *cache,
+				      phys_addr_t addr, const pmd_t *new_pmd)
+{
+	pmd_t *pmd;
+
+	pmd = stage2_get_pmd_shared(&kvm->arch.mmu, cache, addr);
+	if (!pmd)
+		return -EAGAIN;
+
+	if (stage2_cmpxchg_entry(pmd, pmd_val(*new_pmd))) {
+		get_page(virt_to_page(pmd));
+		return 0;
+	}
+
+	return pmd_val(READ_ONCE(*pmd)) == pmd_val(*new_pmd) ? 0 : -EAGAIN;
+}
+
+static int stage2_set_pte_shared(struct kvm *kvm,
+				 struct kvm_mmu_memory_cache *cache,
+				 phys_addr_t addr, const pte_t *new_pte)
+{
+	pmd_t *pmd, new_pmd;
+	pte_t *pte;
+	unsigned long *l1_ipas;
+
+	pmd = stage2_get_pmd_shared(&kvm->arch.mmu, cache, addr);
+	if (!pmd)
+		return -EAGAIN;
+
+	if (pmd_none(*pmd)) {
+		pte = kvm_mmu_memory_cache_alloc(cache);
+		pmd_populate_kernel(NULL, &new_pmd, pte);
+		if (stage2_cmpxchg_entry(pmd, pmd_val(new_pmd))) {
+			get_page(virt_to_page(pmd));
+			l1_ipas = kvm_mmu_memory_cache_alloc(cache);
+			get_page(virt_to_page(l1_ipas));
+			set_page_private(virt_to_page(pte),
+					 (unsigned long)l1_ipas);
+		} else {
+			stage2_cache_return(cache, pte);
+		}
+	}
+
+	/* A block has to be dissolved first */
+	if (pmd_thp_or_huge(READ_ONCE(*pmd)))
+		return -EAGAIN;
+
+	pte = pte_offset_kernel(pmd, addr);
+	if (stage2_cmpxchg_entry(pte, pte_val(*new_pte))) {
+		get_page(virt_to_page(pte));
+		return 0;
+	}
+
+	return pte_val(READ_ONCE(*pte)) == pte_val(*new_pte) ? 0 : -EAGAIN;
+}
+
+/* Trade the read side of kvm->mmu_lock for the write side */
+static bool stage2_lock_exclusive(struct kvm *kvm, unsigned long mmu_seq)
+{
+	kvm_mmu_read_unlock(kvm);
+	kvm_mmu_write_lock(kvm);
+
+	return !mmu_notifier_retry(kvm, mmu_seq);
+}
+
 #ifndef __HAVE_ARCH_PTEP_TEST_AND_CLEAR_YOUNG
 static int stage2_ptep_test_and_clear_young(pte_t *pte)
 {
@@ -1181,14 +1553,14 @@ int __kvm_phys_addr_ioremap(struct kvm *kvm, struct kvm_s2_mmu *mmu,
 		if (ret)
 			goto out;
 
-		ret = mmu_topup_memory_cache(&rmap_cache, 1, 1);
+		ret = kvm_rmap_topup_desc_cache(&rmap_cache, 1);
 		if (ret)
 			goto out;
 
-		spin_lock(&kvm->mmu_lock);
+		kvm_mmu_write_lock(kvm);
 		ret = stage2_set_pte(kvm, mmu, &cache, addr, 0, &pte,
 				     KVM_S2PTE_FLAG_IS_IOMAP, &rmap_cache);
-		spin_unlock(&kvm->mmu_lock);
+		kvm_mmu_write_unlock(kvm);
 		if (ret)
 			goto out;
 
@@ -1197,6 +1569,7 @@ int __kvm_phys_addr_ioremap(struct kvm *kvm, struct kvm_s2_mmu *mmu,
 
 out:
 	mmu_free_memory_cache(&cache);
+	kvm_rmap_free_desc_cache(&rmap_cache);
 	return ret;
 }
 
@@ -1255,15 +1628,21 @@ static bool transparent_hugepage_adjust(kvm_pfn_t *pfnp, phys_addr_t *ipap,
  * @pmd:	pointer to pmd entry
  * @addr:	range start address
  * @end:	range end address
+ * @dbm:	make writable pages writable-clean rather than read-only
  */
-static void stage2_wp_ptes(pmd_t *pmd, phys_addr_t addr, phys_addr_t end)
+static void stage2_wp_ptes(pmd_t *pmd, phys_addr_t addr, phys_addr_t end,
+			   bool dbm)
 {
 	pte_t *pte;
 
 	pte = pte_offset_kernel(pmd, addr);
 	do {
 		if (!pte_none(*pte)) {
-			if (!kvm_s2pte_readonly(pte))
+			if (kvm_s2pte_readonly(pte))
+				continue;
+			if (dbm)
+				kvm_set_s2pte_clean(pte);
+			else
 				kvm_set_s2pte_readonly(pte);
 		}
 	} while (pte++, addr += PAGE_SIZE, addr != end);
@@ -1274,8 +1653,13 @@ static void stage2_wp_ptes(pmd_t *pmd, phys_addr_t addr, phys_addr_t end)
  * @pud:	pointer to pud entry
  * @addr:	range start address
  * @end:	range end address
+ * @dbm:	make writable pages writable-clean rather than read-only
+ *
+ * The hardware dirty state of a block would say too little about which of
+ * its pages were written to, blocks are always made read-only.
  */
-static void stage2_wp_pmds(pud_t *pud, phys_addr_t addr, phys_addr_t end)
+static void stage2_wp_pmds(pud_t *pud, phys_addr_t addr, phys_addr_t end,
+			   bool dbm)
 {
 	pmd_t *pmd;
 	phys_addr_t next;
@@ -1289,7 +1673,7 @@ static void stage2_wp_pmds(pud_t *pud, phys_addr_t addr, phys_addr_t end)
 				if (!kvm_s2pmd_readonly(pmd))
 					kvm_set_s2pmd_readonly(pmd);
 			} else {
-				stage2_wp_ptes(pmd, addr, next);
+				stage2_wp_ptes(pmd, addr, next, dbm);
 			}
 		}
 	} while (pmd++, addr = next, addr != end);
@@ -1300,10 +1684,12 @@ static void stage2_wp_pmds(pud_t *pud, phys_addr_t addr, phys_addr_t end)
   * @pgd:	pointer to pgd entry
   * @addr:	range start address
   * @end:	range end address
+  * @dbm:	make writable pages writable-clean rather than read-only
   *
   * Process PUD entries, for a huge PUD we cause a panic.
   */
-static void  stage2_wp_puds(pgd_t *pgd, phys_addr_t addr, phys_addr_t end)
+static void  stage2_wp_puds(pgd_t *pgd, phys_addr_t addr, phys_addr_t end,
+			    bool dbm)
 {
 	pud_t *pud;
 	phys_addr_t next;
@@ -1314,7 +1700,7 @@ static void  stage2_wp_puds(pgd_t *pgd, phys_addr_t addr, phys_addr_t end)
 		if (!stage2_pud_none(*pud)) {
 			/* TODO:PUD not supported, revisit later if supported */
 			BUG_ON(stage2_pud_huge(*pud));
-			stage2_wp_pmds(pud, addr, next);
+			stage2_wp_pmds(pud, addr, next, dbm);
 		}
 	} while (pud++, addr = next, addr != end);
 }
@@ -1324,10 +1710,15 @@ static void  stage2_wp_puds(pgd_t *pgd, phys_addr_t addr, phys_addr_t end)
  * @kvm:	The KVM pointer
  * @addr:	Start address of range
  * @end:	End address of range
+ *
+ * With kvm-arm.stage2_dbm, the pages of the VM's own stage 2 are only made
+ * writable-clean. Shadow stage 2 entries are never mapped with DBM, as only
+ * the VM's stage 2 is scanned for dirty pages.
  */
 void kvm_stage2_wp_range(struct kvm *kvm, struct kvm_s2_mmu *mmu,
 			    phys_addr_t addr, phys_addr_t end)
 {
+	bool dbm = mmu == &kvm->arch.mmu && stage2_dbm_enabled(kvm);
 	pgd_t *pgd;
 	phys_addr_t next;
 
@@ -1342,15 +1733,89 @@ void kvm_stage2_wp_range(struct kvm *kvm, struct kvm_s2_mmu *mmu,
 		 * that the page tables are not freed while we released
 		 * the lock.
 		 */
-		cond_resched_lock(&kvm->mmu_lock);
+		stage2_cond_resched_lock(kvm);
 		if (!READ_ONCE(mmu->pgd))
 			break;
 		next = stage2_pgd_addr_end(addr, end);
 		if (stage2_pgd_present(*pgd))
-			stage2_wp_puds(pgd, addr, next);
+			stage2_wp_puds(pgd, addr, next, dbm);
 	} while (pgd++, addr = next, addr != end);
 }
 
+/*
+ * Replace the block mapping of @pmd with a table of read-only page mappings
+ * of the same memory: the pages are write protected, as the caller is about
+ * to start dirty logging. With @dbm, the pages of a writable block are
+ * mapped writable-clean instead.
+ */
+static void stage2_split_pmd(struct kvm_s2_mmu *mmu, pmd_t *pmd,
+			     phys_addr_t addr,
+			     struct kvm_mmu_memory_cache *cache, bool dbm)
+{
+	kvm_pfn_t pfn = pmd_pfn(*pmd);
+	pte_t *pte = kvm_mmu_memory_cache_alloc(cache);
+	pte_t new_pte;
+	int i;
+
+	dbm = dbm && !kvm_s2pmd_readonly(pmd);
+	for (i = 0; i < PTRS_PER_PTE; i++) {
+		new_pte = pfn_pte(pfn + i, PAGE_S2);
+		if (dbm)
+			new_pte = kvm_s2pte_mkdbm(new_pte);
+		kvm_set_pte(pte + i, new_pte);
+	}
+	page_ref_add(virt_to_page(pte), PTRS_PER_PTE);
+
+	/* The pmd keeps its reference, it now points to a table instead */
+	pmd_clear(pmd);
+	kvm_tlb_flush_vmid_ipa(mmu, addr);
+	pmd_populate_kernel(NULL, pmd, pte);
+}
+
+/*
+ * Split the block mappings of [@addr, @end) into page mappings ahead of dirty
+ * logging, rather than taking a write fault per block for its dissolution
+ * while the vcpus run. kvm->mmu_lock is only taken for as many blocks as the
+ * page cache topped up outside of it can split, and is dropped whenever
+ * somebody else needs it or we need to reschedule.
+ */
+static void kvm_stage2_split_range(struct kvm *kvm, phys_addr_t addr,
+				   phys_addr_t end)
+{
+	struct kvm_mmu_memory_cache cache = { 0, };
+	struct kvm_s2_mmu *mmu = &kvm->arch.mmu;
+	bool dbm = stage2_dbm_enabled(kvm);
+	phys_addr_t next;
+	pmd_t *pmd;
+
+	while (addr < end) {
+		if (mmu_topup_memory_cache(&cache, 1, KVM_NR_MEM_OBJS))
+			break;
+
+		kvm_mmu_write_lock(kvm);
+		while (addr < end && cache.nobjs) {
+			if (!READ_ONCE(mmu->pgd)) {
+				addr = end;
+				break;
+			}
+
+			next = min(end, (addr + S2_PMD_SIZE) & S2_PMD_MASK);
+			pmd = stage2_get_pmd(kvm, mmu, NULL, addr);
+			if (pmd && pmd_thp_or_huge(*pmd))
+				stage2_split_pmd(mmu, pmd, addr & S2_PMD_MASK,
+						 &cache, dbm);
+			addr = next;
+
+			if (need_resched())
+				break;
+		}
+		kvm_mmu_write_unlock(kvm);
+		cond_resched();
+	}
+
+	mmu_free_memory_cache(&cache);
+}
+
 /**
  * kvm_mmu_wp_memory_region() - write protect stage 2 entries for memory slot
  * @kvm:	The KVM pointer
@@ -1371,10 +1836,12 @@ void kvm_mmu_wp_memory_region(struct kvm *kvm, int slot)
 	phys_addr_t start = memslot->base_gfn << PAGE_SHIFT;
 	phys_addr_t end = (memslot->base_gfn + memslot->npages) << PAGE_SHIFT;
 
-	spin_lock(&kvm->mmu_lock);
+	kvm_stage2_split_range(kvm, start, end);
+
+	kvm_mmu_write_lock(kvm);
 	kvm_stage2_wp_range(kvm, &kvm->arch.mmu, start, end);
 	kvm_nested_s2_wp(kvm);
-	spin_unlock(&kvm->mmu_lock);
+	kvm_mmu_write_unlock(kvm);
 	kvm_flush_remote_tlbs(kvm);
 }
 
@@ -1415,6 +1882,148 @@ void kvm_arch_mmu_enable_log_dirty_pt_masked(struct kvm *kvm,
 	kvm_nested_s2_wp(kvm);
 }
 
+/*
+ * A memslot is scanned for hardware dirty state in chunks of this size,
+ * shared out between the caller and a worker per other online CPU.
+ */
+#define STAGE2_DIRTY_SCAN_CHUNK	SZ_1G
+
+struct stage2_dirty_scan {
+	struct kvm *kvm;
+	struct kvm_memory_slot *memslot;
+	unsigned int nr_chunks;
+	atomic_t next_chunk;
+};
+
+struct stage2_dirty_scan_work {
+	struct work_struct work;
+	struct stage2_dirty_scan *scan;
+};
+
+static void stage2_scan_dirty_ptes(struct kvm_memory_slot *memslot,
+				   pmd_t *pmd, phys_addr_t addr,
+				   phys_addr_t end)
+{
+	pte_t *pte = pte_offset_kernel(pmd, addr);
+
+	do {
+		if (kvm_s2pte_dbm_dirty(pte))
+			set_bit_le((addr >> PAGE_SHIFT) - memslot->base_gfn,
+				   memslot->dirty_bitmap);
+	} while (pte++, addr += PAGE_SIZE, addr != end);
+}
+
+/*
+ * Faults only populate stage 2 under the read side of kvm->mmu_lock, and
+ * nothing is torn down without the write side, so the chunks can be scanned
+ * under the read side concurrently with faults and with each other.
+ */
+static void stage2_scan_dirty_range(struct kvm *kvm,
+				    struct kvm_memory_slot *memslot,
+				    phys_addr_t addr, phys_addr_t end)
+{
+	struct kvm_s2_mmu *mmu = &kvm->arch.mmu;
+	phys_addr_t next;
+	pmd_t *pmd;
+
+	read_lock(&kvm->mmu_lock);
+	while (addr < end) {
+		if (!READ_ONCE(mmu->pgd))
+			break;
+
+		next = min(end, (addr + S2_PMD_SIZE) & S2_PMD_MASK);
+		pmd = stage2_get_pmd(kvm, mmu, NULL, addr);
+		if (pmd && !pmd_none(*pmd) && !pmd_thp_or_huge(*pmd))
+			stage2_scan_dirty_ptes(memslot, pmd, addr, next);
+		addr = next;
+
+		if (need_resched()) {
+			kvm_mmu_read_unlock(kvm);
+			cond_resched();
+			read_lock(&kvm->mmu_lock);
+		}
+	}
+	kvm_mmu_read_unlock(kvm);
+}
+
+static void stage2_dirty_scan_run(struct stage2_dirty_scan *scan)
+{
+	struct kvm_memory_slot *memslot = scan->memslot;
+	phys_addr_t base = memslot->base_gfn << PAGE_SHIFT;
+	phys_addr_t end = base + ((phys_addr_t)memslot->npages << PAGE_SHIFT);
+	phys_addr_t start, chunk_end;
+	unsigned int chunk;
+
+	for (;;) {
+		chunk = atomic_inc_return(&scan->next_chunk) - 1;
+		if (chunk >= scan->nr_chunks)
+			break;
+
+		start = base + (phys_addr_t)chunk * STAGE2_DIRTY_SCAN_CHUNK;
+		chunk_end = min(end, start + STAGE2_DIRTY_SCAN_CHUNK);
+		stage2_scan_dirty_range(scan->kvm, memslot, start, chunk_end);
+	}
+}
+
+static void stage2_dirty_scan_work_fn(struct work_struct *work)
+{
+	struct stage2_dirty_scan_work *scan_work =
+		container_of(work, struct stage2_dirty_scan_work, work);
+
+	stage2_dirty_scan_run(scan_work->scan);
+}
+
+/**
+ * kvm_mmu_sync_dirty_log() - log the pages the hardware found dirty
+ * @kvm:	The KVM pointer
+ * @slot:	The slot of a KVM_GET_DIRTY_LOG call
+ *
+ * Adds the pages the guest wrote to through writable-clean stage 2 entries
+ * to the dirty bitmap of the memslot, for kvm_get_dirty_log_protect() to
+ * report them and make them clean again. Does nothing without
+ * kvm-arm.stage2_dbm. Called with kvm->slots_lock held.
+ */
+void kvm_mmu_sync_dirty_log(struct kvm *kvm, u32 slot)
+{
+	struct stage2_dirty_scan_work *works = NULL;
+	struct kvm_memory_slot *memslot;
+	struct stage2_dirty_scan scan;
+	unsigned int i, nr_works = 0;
+
+	if (!stage2_dbm_enabled(kvm) || (slot >> 16) ||
+	    (u16)slot >= KVM_USER_MEM_SLOTS)
+		return;
+
+	memslot = id_to_memslot(kvm_memslots(kvm), (u16)slot);
+	if (!memslot->dirty_bitmap)
+		return;
+
+	scan.kvm = kvm;
+	scan.memslot = memslot;
+	scan.nr_chunks = DIV_ROUND_UP_ULL((u64)memslot->npages << PAGE_SHIFT,
+					  STAGE2_DIRTY_SCAN_CHUNK);
+	atomic_set(&scan.next_chunk, 0);
+
+	if (scan.nr_chunks > 1 && num_online_cpus() > 1) {
+		nr_works = min(scan.nr_chunks, num_online_cpus()) - 1;
+		works = kcalloc(nr_works, sizeof(*works), GFP_KERNEL);
+		if (!works)
+			nr_works = 0;
+	}
+
+	for (i = 0; i < nr_works; i++) {
+		INIT_WORK(&works[i].work, stage2_dirty_scan_work_fn);
+		works[i].scan = &scan;
+		queue_work(system_unbound_wq, &works[i].work);
+	}
+
+	stage2_dirty_scan_run(&scan);
+
+	for (i = 0; i < nr_works; i++)
+		flush_work(&works[i].work);
+	kfree(works);
+}
+
 static void coherent_cache_guest_page(struct kvm_vcpu *vcpu, kvm_pfn_t pfn,
 				      unsigned long size)
 {
@@ -1439,13 +2048,19 @@ static void kvm_send_hwpoison_signal(unsigned long address,
 	send_sig_info(SIGBUS, &info, current);
 }
 
-static int user_mem_abort(struct kvm_vcpu *vcpu, phys_addr_t fault_ipa,
-			  struct kvm_s2_trans *nested,
-			  struct kvm_memory_slot *memslot,
-			  unsigned long hva, unsigned long fault_status)
+/*
+ * Map the page backing @fault_ipa in @mmu. @nested is the guest hypervisor's
+ * translation of @fault_ipa when @mmu is a shadow stage 2, NULL otherwise.
+ * With @can_async, a page that isn't resident is faulted in asynchronously,
+ * and the guest is resumed without a mapping.
+ */
+static int __user_mem_abort(struct kvm_vcpu *vcpu, struct kvm_s2_mmu *mmu,
+			    phys_addr_t fault_ipa, struct kvm_s2_trans *nested,
+			    struct kvm_memory_slot *memslot,
+			    unsigned long hva, bool write_fault, bool can_async)
 {
 	int ret;
-	bool write_fault, writable, hugetlb = false, force_pte = false;
+	bool writable, hugetlb = false, force_pte = false;
 	unsigned long mmu_seq;
 	phys_addr_t ipa = fault_ipa;
 	gfn_t gfn;
@@ -1455,15 +2070,11 @@ static int user_mem_abort(struct kvm_vcpu *vcpu, phys_addr_t fault_ipa,
 	kvm_pfn_t pfn;
 	pgprot_t mem_type = PAGE_S2;
 	bool logging_active = memslot_is_logging(memslot);
+	bool dbm = false;
 	unsigned long flags = 0;
-	struct kvm_s2_mmu *mmu = vcpu->arch.hw_mmu;
 	struct kvm_mmu_memory_cache *rmap_cache;
-
-	write_fault = kvm_is_write_fault(vcpu);
-	if (fault_status == FSC_PERM && !write_fault) {
-		kvm_err("Unexpected L2 read permission error\n");
-		return -EFAULT;
-	}
+	/* Shadow stage 2 faults update the rmap, which needs the write side */
+	bool shared = mmu == &kvm->arch.mmu;
 
 	/* Let's check if we will get back a huge page backed by hugetlbfs */
 	down_read(&current->mm->mmap_sem);
@@ -1474,21 +2085,29 @@ static int user_mem_abort(struct kvm_vcpu *vcpu, phys_addr_t fault_ipa,
 		return -EFAULT;
 	}
 
-	if (kvm_is_shadow_s2_fault(vcpu)) {
+	if (nested) {
 		ipa = nested->output;
 
 		/*
 		 * If we're about to create a shadow stage 2 entry, then we
 		 * can only create huge mapings if the guest hypervior also
-		 * uses a huge mapping.
+		 * uses a block mapping covering at least a PMD. A PUD block
+		 * in the guest stage 2 maps every PMD-sized chunk it
+		 * contains with the same attributes and with the L2 and L1
+		 * IPAs congruent modulo PMD_SIZE, so we can shadow it with
+		 * PMD blocks (our stage 2 doesn't use PUD blocks).
 		 */
-		if (nested->block_size != PMD_SIZE)
+		if (nested->block_size < PMD_SIZE)
 			force_pte = true;
 	}
 	gfn = ipa >> PAGE_SHIFT;
 
+	/* Each page has to fault on its own to be logged as touched */
+	if (memslot->access_bitmap)
+		force_pte = true;
 
-	if (!force_pte && is_vm_hugetlb_page(vma) && !logging_active) {
+	if (!force_pte && is_vm_hugetlb_page(vma) && !logging_active &&
+	    vma_kernel_pagesize(vma) >= PMD_SIZE) {
 		hugetlb = true;
 		gfn = (ipa & PMD_MASK) >> PAGE_SHIFT;
 	} else {
@@ -1508,16 +2127,14 @@ static int user_mem_abort(struct kvm_vcpu *vcpu, phys_addr_t fault_ipa,
 	up_read(&current->mm->mmap_sem);
 
 	/* We need minimum second+third level pages + two more pages to cache mappings */
-	ret = mmu_topup_memory_cache(memcache, KVM_MMU_CACHE_MIN_PAGES,
-				     KVM_NR_MEM_OBJS);
+	ret = stage2_topup_fault_cache(kvm, memcache);
 	if (ret)
 		return ret;
 
 	/*
-	 * We need at most one page for rmap descriptor if the current one is
-	 * full.
+	 * We need at most one rmap descriptor if the current one is full.
 	 */
-	ret = mmu_topup_memory_cache(&vcpu->arch.mmu_rmap_list_desc_cache, 1, 1);
+	ret = kvm_rmap_topup_desc_cache(&vcpu->arch.mmu_rmap_list_desc_cache, 1);
 	if (ret)
 		return ret;
 
@@ -1533,7 +2150,20 @@ static int user_mem_abort(struct kvm_vcpu *vcpu, phys_addr_t fault_ipa,
 	 */
 	smp_rmb();
 
-	pfn = gfn_to_pfn_prot(kvm, gfn, write_fault, &writable);
+	if (IS_ENABLED(CONFIG_KVM_ASYNC_PF) && can_async) {
+		bool async = false;
+
+		pfn = __gfn_to_pfn_memslot(memslot, gfn, false, &async,
+					   write_fault, &writable);
+		if (async) {
+			if (kvm_arm_setup_async_pf(vcpu, fault_ipa, gfn, hva))
+				return 0;
+			pfn = gfn_to_pfn_prot(kvm, gfn, write_fault, &writable);
+		}
+	} else {
+		pfn = gfn_to_pfn_prot(kvm, gfn, write_fault, &writable);
+	}
+
 	if (pfn == KVM_PFN_ERR_HWPOISON) {
 		kvm_send_hwpoison_signal(hva, vma);
 		return 0;
@@ -1555,16 +2185,34 @@ static int user_mem_abort(struct kvm_vcpu *vcpu, phys_addr_t fault_ipa,
 
 		/*
 		 * Only actually map the page as writable if this was a write
-		 * fault.
+		 * fault. With hardware dirty bit management, a page we may
+		 * write to is mapped writable-clean otherwise, so that the
+		 * first write is logged without a fault.
 		 */
+		dbm = writable && mmu == &kvm->arch.mmu &&
+		      stage2_dbm_enabled(kvm);
 		if (!write_fault)
 			writable = false;
 	}
 
-	spin_lock(&kvm->mmu_lock);
+	/* Never grant more than the guest hypervisor does */
+	if (nested && !nested->writable)
+		writable = false;
+
+	if (!(flags & KVM_S2PTE_FLAG_IS_IOMAP))
+		stage2_localize_fault_cache(vcpu, memcache,
+					    page_to_nid(pfn_to_page(pfn)));
+
+	if (shared)
+		kvm_mmu_read_lock(vcpu);
+	else
+		kvm_mmu_write_lock(kvm);
 	if (mmu_notifier_retry(kvm, mmu_seq))
 		goto out_unlock;
 
+	/* Under the mmu_lock, see kvm_vm_ioctl_get_access_log() */
+	kvm_mark_page_touched(memslot, gfn);
+
 	if (!hugetlb && !force_pte)
 		hugetlb = transparent_hugepage_adjust(&pfn, &ipa, &fault_ipa);
 
@@ -1577,6 +2225,20 @@ static int user_mem_abort(struct kvm_vcpu *vcpu, phys_addr_t fault_ipa,
 			kvm_set_pfn_dirty(pfn);
 		}
 		coherent_cache_guest_page(vcpu, pfn, PMD_SIZE);
+		/* Record the block, not the faulting page, in the rmap */
+		fault_ipa &= PMD_MASK;
+		ipa &= PMD_MASK;
+		if (shared) {
+			ret = stage2_set_pmd_huge_shared(kvm, memcache,
+							 fault_ipa, &new_pmd);
+			if (ret != -EAGAIN)
+				goto out_unlock;
+
+			shared = false;
+			ret = 0;
+			if (!stage2_lock_exclusive(kvm, mmu_seq))
+				goto out_unlock;
+		}
 		ret = stage2_set_pmd_huge(kvm, mmu, memcache, fault_ipa, ipa,
 					  &new_pmd, rmap_cache);
 	} else {
@@ -1585,20 +2247,130 @@ static int user_mem_abort(struct kvm_vcpu *vcpu, phys_addr_t fault_ipa,
 		if (writable) {
 			new_pte = kvm_s2pte_mkwrite(new_pte);
 			kvm_set_pfn_dirty(pfn);
-			mark_page_dirty(kvm, gfn);
+			kvm_vcpu_mark_page_dirty(vcpu, gfn);
+		}
+		if (dbm) {
+			/* The hardware may write to it, behind our back */
+			new_pte = kvm_s2pte_mkdbm(new_pte);
+			kvm_set_pfn_dirty(pfn);
 		}
 		coherent_cache_guest_page(vcpu, pfn, PAGE_SIZE);
+		if (shared) {
+			ret = stage2_set_pte_shared(kvm, memcache, fault_ipa,
+						    &new_pte);
+			if (ret != -EAGAIN)
+				goto out_unlock;
+
+			shared = false;
+			ret = 0;
+			if (!stage2_lock_exclusive(kvm, mmu_seq))
+				goto out_unlock;
+		}
 		ret = stage2_set_pte(vcpu->kvm, mmu, memcache, fault_ipa, ipa,
 				     &new_pte, flags, rmap_cache);
 	}
 
 out_unlock:
-	spin_unlock(&kvm->mmu_lock);
+	if (shared)
+		kvm_mmu_read_unlock(kvm);
+	else
+		kvm_mmu_write_unlock(kvm);
 	kvm_set_pfn_accessed(pfn);
 	kvm_release_pfn_clean(pfn);
 	return ret;
 }
 
+static int user_mem_abort(struct kvm_vcpu *vcpu, phys_addr_t fault_ipa,
+			  struct kvm_s2_trans *nested,
+			  struct kvm_memory_slot *memslot,
+			  unsigned long hva, unsigned long fault_status)
+{
+	bool write_fault = kvm_is_write_fault(vcpu);
+
+	if (fault_status == FSC_PERM && !write_fault) {
+		kvm_err("Unexpected L2 read permission error\n");
+		return -EFAULT;
+	}
+
+	return __user_mem_abort(vcpu, vcpu->arch.hw_mmu, fault_ipa,
+				kvm_is_shadow_s2_fault(vcpu) ? nested : NULL,
+				memslot, hva, write_fault, true);
+}
+
+/*
+ * Returns the size of the shadow mapping covering @addr, 0 if there is none.
+ * This function expects kvm->mmu_lock to be held.
+ */
+static phys_addr_t stage2_mapping_size(struct kvm *kvm, struct kvm_s2_mmu *mmu,
+				       phys_addr_t addr)
+{
+	pmd_t *pmd;
+	pte_t *pte;
+
+	pmd = stage2_get_pmd(kvm, mmu, NULL, addr);
+	if (!pmd || pmd_none(*pmd))
+		return 0;
+
+	if (pmd_thp_or_huge(*pmd))
+		return PMD_SIZE;
+
+	pte = pte_offset_kernel(pmd, addr);
+	return pte_none(*pte) ? 0 : PAGE_SIZE;
+}
+
+/**
+ * kvm_s2_prefault - populate a shadow stage 2 entry ahead of a fault
+ * @vcpu:	The vcpu whose guest hypervisor translated @l2_ipa
+ * @mmu:	The shadow stage 2 mmu to populate
+ * @l2_ipa:	The page aligned L2 IPA to map
+ * @trans:	The guest hypervisor's translation of @l2_ipa
+ *
+ * Maps @l2_ipa the same way a read fault on it would, except that MMIO and
+ * addresses outside of any memslot are left to the fault path. Returns the
+ * number of bytes from @l2_ipa onwards known to be mapped or skipped, or a
+ * negative error code. Must be called with kvm->srcu held.
+ */
+long kvm_s2_prefault(struct kvm_vcpu *vcpu, struct kvm_s2_mmu *mmu,
+		     phys_addr_t l2_ipa, struct kvm_s2_trans *trans)
+{
+	struct kvm *kvm = vcpu->kvm;
+	struct kvm_memory_slot *memslot;
+	phys_addr_t size;
+	unsigned long hva;
+	bool writable;
+	gfn_t gfn;
+	int ret;
+
+	if (!trans->readable)
+		return PAGE_SIZE;
+
+	kvm_mmu_write_lock(kvm);
+	size = stage2_mapping_size(kvm, mmu, l2_ipa);
+	kvm_mmu_write_unlock(kvm);
+	if (size)
+		goto out;
+
+	gfn = trans->output >> PAGE_SHIFT;
+	memslot = gfn_to_memslot(kvm, gfn);
+	hva = gfn_to_hva_memslot_prot(memslot, gfn, &writable);
+	if (kvm_is_error_hva(hva))
+		return PAGE_SIZE;
+
+	ret = __user_mem_abort(vcpu, mmu, l2_ipa, trans, memslot, hva, false,
+			       false);
+	if (ret)
+		return ret;
+
+	kvm_mmu_write_lock(kvm);
+	size = stage2_mapping_size(kvm, mmu, l2_ipa);
+	kvm_mmu_write_unlock(kvm);
+out:
+	/* Report the remainder of the block from l2_ipa onwards */
+	if (size > PAGE_SIZE)
+		return size - (l2_ipa & (size - 1));
+	return PAGE_SIZE;
+}
+
 /*
  * Resolve the access fault by making the page young again.
  * Note that because the faulting entry is guaranteed not to be
@@ -1615,7 +2387,7 @@ static void handle_access_fault(struct kvm_vcpu *vcpu, phys_addr_t fault_ipa)
 
 	trace_kvm_access_fault(fault_ipa);
 
-	spin_lock(&vcpu->kvm->mmu_lock);
+	kvm_mmu_write_lock(vcpu->kvm);
 
 	pmd = stage2_get_pmd(vcpu->kvm, vcpu->arch.hw_mmu, NULL, fault_ipa);
 	if (!pmd || pmd_none(*pmd))	/* Nothing there */
@@ -1636,11 +2408,33 @@ static void handle_access_fault(struct kvm_vcpu *vcpu, phys_addr_t fault_ipa)
 	pfn = pte_pfn(*pte);
 	pfn_valid = true;
 out:
-	spin_unlock(&vcpu->kvm->mmu_lock);
+	kvm_mmu_write_unlock(vcpu->kvm);
 	if (pfn_valid)
 		kvm_set_pfn_accessed(pfn);
 }
 
+/*
+ * A zero-length ioeventfd (typically a virtio-mmio QueueNotify doorbell) is
+ * also registered on KVM_FAST_MMIO_BUS, and ignores the value being written.
+ * A plain store to such an address can be completed by signalling the
+ * eventfd and skipping the instruction, without decoding the access or
+ * looking up the memslots.
+ */
+static bool kvm_handle_fast_mmio(struct kvm_vcpu *vcpu, phys_addr_t ipa)
+{
+	if (!kvm_vcpu_dabt_isvalid(vcpu) || kvm_vcpu_dabt_iss1tw(vcpu) ||
+	    !kvm_vcpu_dabt_iswrite(vcpu) || kvm_vcpu_dabt_is_cm(vcpu))
+		return false;
+
+	ipa |= kvm_vcpu_get_hfar(vcpu) & ((1 << 12) - 1);
+	if (kvm_io_bus_write(vcpu, KVM_FAST_MMIO_BUS, ipa, 0, NULL))
+		return false;
+
+	kvm_skip_instr(vcpu, kvm_vcpu_trap_il_is32bit(vcpu));
+	vcpu->stat.mmio_exit_kernel++;
+	return true;
+}
+
 /**
  * kvm_handle_guest_abort - handles all 2nd stage aborts
  * @vcpu:	the VCPU pointer
@@ -1705,6 +2499,7 @@ int kvm_handle_guest_abort(struct kvm_vcpu *vcpu, struct kvm_run *run)
 	 * this to the guest and carry on.
 	 */
 	if (kvm_is_shadow_s2_fault(vcpu)) {
+		vcpu->stat.nested_s2_fault++;
 		nested_trans.esr = 0;
 		ret = kvm_walk_nested_s2(vcpu, fault_ipa, &nested_trans);
 		if (nested_trans.esr)
@@ -1722,6 +2517,12 @@ int kvm_handle_guest_abort(struct kvm_vcpu *vcpu, struct kvm_run *run)
 		ipa = nested_trans.output;
 	}
 
+	if (!is_iabt && fault_status == FSC_FAULT &&
+	    kvm_handle_fast_mmio(vcpu, ipa)) {
+		ret = 1;
+		goto out_unlock;
+	}
+
 	gfn = ipa >> PAGE_SHIFT;
 	memslot = gfn_to_memslot(vcpu->kvm, gfn);
 	hva = gfn_to_hva_memslot_prot(memslot, gfn, &writable);
@@ -1824,7 +2625,7 @@ static inline unsigned long level_to_mapping_size(int last_level)
 		mapping_size = S2_PMD_SIZE;
 	else if (last_level == 1)
 		mapping_size = S2_PUD_SIZE;
-	else
+	else if (last_level != 3)
 		WARN(1, "The last translation level can't be 0.\n");
 
 	return mapping_size;
@@ -1854,13 +2655,34 @@ void unmap_shadow_stage2_range(struct kvm *kvm, gpa_t gpa, u64 size)
 
 		map_size = PAGE_SIZE;
 		while ((rmap_curr = rmap_get_first(rmap_head, &iter))) {
-			map_size = level_to_mapping_size(rmap_curr->last_level);
+			map_size = level_to_mapping_size(rmap_last_level(rmap_curr));
 			kvm_unmap_stage2_range(kvm, rmap_curr->mmu,
-					       rmap_curr->val, map_size);
+					       rmap_l2_ipa(rmap_curr), map_size);
 		}
 	} while (gfn += map_size/PAGE_SIZE, gfn < gfn_end);
 }
 
+/*
+ * kvm_arch_mmu_clear_access_masked - unmap the selected touched pages
+ *
+ * Unmaps the pages of @mask from the guest and any shadow stage 2 so that
+ * their next access faults and logs them as touched again. Only called for
+ * slots with access logging, which are always mapped at page granularity.
+ */
+void kvm_arch_mmu_clear_access_masked(struct kvm *kvm,
+				      struct kvm_memory_slot *slot,
+				      gfn_t gfn_offset, unsigned long mask)
+{
+	phys_addr_t gpa;
+	int bit;
+
+	for_each_set_bit(bit, &mask, BITS_PER_LONG) {
+		gpa = (slot->base_gfn + gfn_offset + bit) << PAGE_SHIFT;
+		unmap_shadow_stage2_range(kvm, gpa, PAGE_SIZE);
+		kvm_unmap_stage2_range(kvm, &kvm->arch.mmu, gpa, PAGE_SIZE);
+	}
+}
+
 static int kvm_unmap_hva_handler(struct kvm *kvm, gpa_t gpa, u64 size, void *data)
 {
 	unmap_shadow_stage2_range(kvm, gpa, size);
@@ -1895,8 +2717,6 @@ int kvm_unmap_hva_range(struct kvm *kvm,
 static int kvm_set_spte_handler(struct kvm *kvm, gpa_t gpa, u64 size, void *data)
 {
 	pte_t *pte = (pte_t *)data;
-	struct kvm_rmap_head *rmap_head, *rmap_curr;
-	struct rmap_iterator iter;
 
 	WARN_ON(size != PAGE_SIZE);
 	/*
@@ -1905,17 +2725,14 @@ static int kvm_set_spte_handler(struct kvm *kvm, gpa_t gpa, u64 size, void *data
 	 * calling ->change_pte() (which in turn calls kvm_set_spte_hva()) and
 	 * therefore stage2_set_pte() never needs to clear out a huge PMD
 	 * through this calling path.
+	 *
+	 * For the same reason, there is nothing to update in the shadow
+	 * stage 2 tables: the invalidation has unmapped the page from all
+	 * of them, along with their rmap entries, and the nested guests
+	 * fault it back in through the canonical stage 2 when they need it.
 	 */
 	stage2_set_pte(kvm, &kvm->arch.mmu, NULL, gpa, 0, pte, 0, NULL);
 
-	rmap_head = gfn_to_rmap(kvm, gpa_to_gfn(gpa));
-	if (!rmap_head)
-		return 0;
-
-	for_each_rmap_head(rmap_head, &iter, rmap_curr)
-		stage2_set_pte(kvm, rmap_curr->mmu, NULL, rmap_curr->val, gpa,
-			       pte, 0, NULL);
-
 	return 0;
 }
 
@@ -1933,92 +2750,118 @@ void kvm_set_spte_hva(struct kvm *kvm, unsigned long hva, pte_t pte)
 	handle_hva_to_gpa(kvm, hva, end, &kvm_set_spte_handler, &stage2_pte);
 }
 
-static int handle_nested_s2(struct kvm *kvm, gpa_t gpa, u64 size,
-			    int (*handler)(struct kvm *kvm,
-					  struct kvm_s2_mmu *mmu,
-					  gpa_t gpa, u64 size, void *data),
-			    void *data)
-{
-	struct kvm_rmap_head *rmap_head, *rmap_curr;
-	struct rmap_iterator iter;
-	int ret = 0;
-
-	rmap_head = gfn_to_rmap(kvm, gpa_to_gfn(gpa));
-	if (!rmap_head)
-		return ret;
-
-	for_each_rmap_head(rmap_head, &iter, rmap_curr)
-		ret |= handler(kvm, rmap_curr->mmu, rmap_curr->val, size, data);
-
-	return ret;
-}
-
-static int __kvm_age_hva_handler(struct kvm *kvm, struct kvm_s2_mmu *mmu,
-				 gpa_t gpa, u64 size, void *data)
+/* Test, and clear if @clear, the access flag of the mapping of @addr */
+static int stage2_pmd_age(pmd_t *pmd, gpa_t addr, bool clear)
 {
-	pmd_t *pmd;
 	pte_t *pte;
 
-	WARN_ON(size != PAGE_SIZE && size != PMD_SIZE);
-
-	pmd = stage2_get_pmd(kvm, mmu, NULL, gpa);
-
 	if (!pmd || pmd_none(*pmd))	/* Nothing there */
 		return 0;
 
-	if (pmd_thp_or_huge(*pmd))		/* THP, HugeTLB */
-		return stage2_pmdp_test_and_clear_young(pmd);
+	if (pmd_thp_or_huge(*pmd))	/* THP, HugeTLB */
+		return clear ? stage2_pmdp_test_and_clear_young(pmd) :
+			       pmd_young(*pmd);
 
-	pte = pte_offset_kernel(pmd, gpa);
+	pte = pte_offset_kernel(pmd, addr);
 	if (pte_none(*pte))
 		return 0;
 
-	return stage2_ptep_test_and_clear_young(pte);
+	return clear ? stage2_ptep_test_and_clear_young(pte) : pte_young(*pte);
 }
 
-static int kvm_age_hva_handler(struct kvm *kvm, gpa_t gpa, u64 size, void *data)
+/*
+ * The last stage 2 pud looked up by nested_s2_age_range(). Consecutive L1
+ * pages are usually mapped at neighbouring L2 IPAs of the same shadow
+ * stage 2, so most shadow mappings are found without walking the tables
+ * from the pgd again.
+ */
+struct nested_s2_age_walk {
+	struct kvm_s2_mmu	*mmu;
+	gpa_t			addr;
+	pud_t			*pud;
+};
+
+static pmd_t *nested_s2_age_get_pmd(struct nested_s2_age_walk *walk,
+				    struct kvm_s2_mmu *mmu, gpa_t addr)
+{
+	if (walk->mmu != mmu || ((walk->addr ^ addr) & S2_PUD_MASK)) {
+		walk->mmu = mmu;
+		walk->addr = addr;
+		walk->pud = stage2_get_pud(mmu, NULL, addr);
+	}
+
+	if (!walk->pud || stage2_pud_none(*walk->pud))
+		return NULL;
+
+	return stage2_pmd_offset(walk->pud, addr);
+}
+
+/*
+ * Age the shadow stage 2 mappings of the L1 IPA range [@gpa, @gpa + @size),
+ * or only test them if !@clear, which stops at the first young one. The
+ * rmap of each page of the range is walked, as a block the host maps from a
+ * single L1 IPA can be mapped by pages of the shadow stage 2.
+ * Expects kvm->mmu_lock to be held.
+ */
+static int nested_s2_age_range(struct kvm *kvm, gpa_t gpa, u64 size,
+			       bool clear)
 {
+	struct nested_s2_age_walk walk = { };
+	struct kvm_rmap_head *rmap_head, *rmap_curr;
+	struct rmap_iterator iter;
+	gfn_t gfn, end;
+	int young = 0;
 
-	int young;
+	if (list_empty(&kvm->arch.nested_mmu_list))
+		return 0;
 
-	young = __kvm_age_hva_handler(kvm, &kvm->arch.mmu, gpa, size, data);
+	end = gpa_to_gfn(gpa + size);
+	for (gfn = gpa_to_gfn(gpa); gfn < end; gfn++) {
+		rmap_head = gfn_to_rmap(kvm, gfn);
+		if (!rmap_head)
+			break;
 
-	young |= handle_nested_s2(kvm, gpa, size, __kvm_age_hva_handler, data);
+		for_each_rmap_head(rmap_head, &iter, rmap_curr) {
+			gpa_t l2_ipa = rmap_l2_ipa(rmap_curr);
+			pmd_t *pmd;
+
+			pmd = nested_s2_age_get_pmd(&walk, rmap_curr->mmu,
+						    l2_ipa);
+			young |= stage2_pmd_age(pmd, l2_ipa, clear);
+			if (young && !clear)
+				return young;
+		}
+	}
 
 	return young;
 }
 
-static int __kvm_test_age_hva_handler(struct kvm *kvm, struct kvm_s2_mmu *mmu, gpa_t gpa, u64 size, void *data)
+static int kvm_age_hva_handler(struct kvm *kvm, gpa_t gpa, u64 size, void *data)
 {
 	pmd_t *pmd;
-	pte_t *pte;
+	int young;
 
 	WARN_ON(size != PAGE_SIZE && size != PMD_SIZE);
 
-	pmd = stage2_get_pmd(kvm, mmu, NULL, gpa);
+	pmd = stage2_get_pmd(kvm, &kvm->arch.mmu, NULL, gpa);
+	young = stage2_pmd_age(pmd, gpa, true);
 
-	if (!pmd || pmd_none(*pmd))	/* Nothing there */
-		return 0;
+	young |= nested_s2_age_range(kvm, gpa, size, true);
 
-	if (pmd_thp_or_huge(*pmd))	/* THP, HugeTLB */
-		return pmd_young(*pmd);
-
-	pte = pte_offset_kernel(pmd, gpa);
-	if (!pte_none(*pte))		/* Just a page... */
-		return pte_young(*pte);
-
-	return 0;
+	return young;
 }
 
 static int kvm_test_age_hva_handler(struct kvm *kvm, gpa_t gpa, u64 size, void *data)
 {
-	int young;
+	pmd_t *pmd;
 
-	young = __kvm_test_age_hva_handler(kvm, &kvm->arch.mmu, gpa, size, data);
+	WARN_ON(size != PAGE_SIZE && size != PMD_SIZE);
 
-	young |= handle_nested_s2(kvm, gpa, size, __kvm_test_age_hva_handler, data);
+	pmd = stage2_get_pmd(kvm, &kvm->arch.mmu, NULL, gpa);
+	if (stage2_pmd_age(pmd, gpa, false))
+		return 1;
 
-	return young;
+	return nested_s2_age_range(kvm, gpa, size, false);
 }
 
 int kvm_age_hva(struct kvm *kvm, unsigned long start, unsigned long end)
@@ -2033,10 +2876,57 @@ int kvm_test_age_hva(struct kvm *kvm, unsigned long hva)
 	return handle_hva_to_gpa(kvm, hva, hva, kvm_test_age_hva_handler, NULL);
 }
 
+/*
+ * Age the pages of [@start, @end) selected in @young, one bit per page,
+ * and leave set the bits of those that were young. Only the pages mapped
+ * by the host's ptes are aged this way, so the stage 2 mappings are pages
+ * too, and the stage 2 pmd is only looked up again when the walk crosses
+ * into the next one.
+ */
+void kvm_age_hva_bitmap(struct kvm *kvm, unsigned long start,
+			unsigned long end, unsigned long *young)
+{
+	struct kvm_memslots *slots = kvm_memslots(kvm);
+	struct kvm_memory_slot *memslot;
+	unsigned long mask = *young;
+
+	trace_kvm_age_hva(start, end);
+	*young = 0;
+
+	kvm_for_each_memslot(memslot, slots) {
+		unsigned long hva_start, hva_end, hva;
+		pmd_t *pmd = NULL;
+		gpa_t pmd_addr = 0;
+
+		hva_start = max(start, memslot->userspace_addr);
+		hva_end = min(end, memslot->userspace_addr +
+					(memslot->npages << PAGE_SHIFT));
+
+		for (hva = hva_start; hva < hva_end; hva += PAGE_SIZE) {
+			int bit = (hva - start) >> PAGE_SHIFT;
+			gpa_t gpa;
+
+			if (!test_bit(bit, &mask))
+				continue;
+
+			gpa = hva_to_gfn_memslot(hva, memslot) << PAGE_SHIFT;
+			if (!pmd || ((gpa ^ pmd_addr) & S2_PMD_MASK)) {
+				pmd = stage2_get_pmd(kvm, &kvm->arch.mmu,
+						     NULL, gpa);
+				pmd_addr = gpa;
+			}
+
+			if (stage2_pmd_age(pmd, gpa, true) |
+			    nested_s2_age_range(kvm, gpa, PAGE_SIZE, true))
+				__set_bit(bit, young);
+		}
+	}
+}
+
 void kvm_mmu_free_memory_caches(struct kvm_vcpu *vcpu)
 {
 	mmu_free_memory_cache(&vcpu->arch.mmu_page_cache);
-	mmu_free_memory_cache(&vcpu->arch.mmu_rmap_list_desc_cache);
+	kvm_rmap_free_desc_cache(&vcpu->arch.mmu_rmap_list_desc_cache);
 }
 
 phys_addr_t kvm_mmu_get_httbr(void)
@@ -2131,6 +3021,11 @@ int kvm_mmu_init(void)
 			goto out;
 	}
 
+	if (stage2_dbm && !kvm_stage2_has_dbm()) {
+		kvm_info("Stage 2 DBM not supported, ignoring stage2_dbm\n");
+		stage2_dbm = false;
+	}
+
 	return 0;
 out:
 	free_hyp_pgds();
@@ -2150,6 +3045,20 @@ void kvm_arch_commit_memory_region(struct kvm *kvm,
 	 */
 	if (change != KVM_MR_DELETE && mem->flags & KVM_MEM_LOG_DIRTY_PAGES)
 		kvm_mmu_wp_memory_region(kvm, mem->slot);
+
+	/*
+	 * Pages that were mapped before access logging was enabled would never
+	 * fault again to be logged.
+	 */
+	if (change == KVM_MR_FLAGS_ONLY &&
+	    (new->flags & ~old->flags & KVM_MEM_LOG_ACCESS)) {
+		kvm_mmu_write_lock(kvm);
+		kvm_unmap_stage2_range(kvm, &kvm->arch.mmu,
+				       new->base_gfn << PAGE_SHIFT,
+				       new->npages << PAGE_SHIFT);
+		kvm_nested_s2_clear(kvm);
+		kvm_mmu_write_unlock(kvm);
+	}
 }
 
 int kvm_arch_prepare_memory_region(struct kvm *kvm,
@@ -2235,13 +3144,13 @@ int kvm_arch_prepare_memory_region(struct kvm *kvm,
 	if (change == KVM_MR_FLAGS_ONLY)
 		goto out;
 
-	spin_lock(&kvm->mmu_lock);
+	kvm_mmu_write_lock(kvm);
 	if (ret)
 		kvm_unmap_stage2_range(kvm, &kvm->arch.mmu,
 				       mem->guest_phys_addr, mem->memory_size);
 	else
-		stage2_flush_memslot(&kvm->arch.mmu, memslot);
-	spin_unlock(&kvm->mmu_lock);
+		stage2_flush_memslot(kvm, &kvm->arch.mmu, memslot);
+	kvm_mmu_write_unlock(kvm);
 out:
 	up_read(&current->mm->mmap_sem);
 	return ret;
@@ -2284,10 +3193,10 @@ void kvm_arch_flush_shadow_memslot(struct kvm *kvm,
 	gpa_t gpa = slot->base_gfn << PAGE_SHIFT;
 	phys_addr_t size = slot->npages << PAGE_SHIFT;
 
-	spin_lock(&kvm->mmu_lock);
+	kvm_mmu_write_lock(kvm);
 	kvm_unmap_stage2_range(kvm, &kvm->arch.mmu, gpa, size);
 	kvm_nested_s2_clear(kvm);
-	spin_unlock(&kvm->mmu_lock);
+	kvm_mmu_write_unlock(kvm);
 }
 
 /*
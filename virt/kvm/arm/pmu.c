@@ -57,11 +57,15 @@ u64 kvm_pmu_get_counter_value(struct kvm_vcpu *vcpu, u64 select_idx)
  */
 void kvm_pmu_set_counter_value(struct kvm_vcpu *vcpu, u64 select_idx, u64 val)
 {
+	struct kvm_pmc *pmc = &vcpu->arch.pmu.pmc[select_idx];
 	u64 reg;
 
 	reg = (select_idx == ARMV8_PMU_CYCLE_IDX)
 	      ? PMCCNTR_EL0 : PMEVCNTR0_EL0 + select_idx;
 	vcpu_sys_reg(vcpu, reg) += (s64)val - kvm_pmu_get_counter_value(vcpu, select_idx);
+
+	/* The sample period of the perf event doesn't match anymore */
+	pmc->period_stale = true;
 }
 
 /**
@@ -242,6 +246,18 @@ static void kvm_pmu_update_state(struct kvm_vcpu *vcpu)
 	kvm_pmu_check_overflow(vcpu);
 }
 
+/*
+ * Check if kvm_pmu_update_state() would change the overflow interrupt level,
+ * for paths that re-enter the guest without flushing the PMU state.
+ */
+bool kvm_pmu_needs_update(struct kvm_vcpu *vcpu)
+{
+	if (!kvm_arm_pmu_v3_ready(vcpu))
+		return false;
+
+	return vcpu->arch.pmu.irq_level != !!kvm_pmu_overflow_status(vcpu);
+}
+
 bool kvm_pmu_should_notify_user(struct kvm_vcpu *vcpu)
 {
 	struct kvm_pmu *pmu = &vcpu->arch.pmu;
@@ -376,6 +392,8 @@ void kvm_pmu_handle_pmcr(struct kvm_vcpu *vcpu, u64 val)
 
 	if (val & ARMV8_PMU_PMCR_LC) {
 		pmc = &pmu->pmc[ARMV8_PMU_CYCLE_IDX];
+		if (pmc->bitmask != 0xffffffffffffffffUL)
+			pmc->period_stale = true;
 		pmc->bitmask = 0xffffffffffffffffUL;
 	}
 }
@@ -403,10 +421,24 @@ void kvm_pmu_set_counter_event_type(struct kvm_vcpu *vcpu, u64 data,
 	struct kvm_pmc *pmc = &pmu->pmc[select_idx];
 	struct perf_event *event;
 	struct perf_event_attr attr;
-	u64 eventsel, counter;
+	u64 eventsel, evtype, counter;
 
-	kvm_pmu_stop_counter(vcpu, pmc);
 	eventsel = data & ARMV8_PMU_EVTYPE_EVENT;
+	evtype = data & (ARMV8_PMU_EXCLUDE_EL1 | ARMV8_PMU_EXCLUDE_EL0);
+	if (select_idx != ARMV8_PMU_CYCLE_IDX)
+		evtype |= eventsel;
+
+	/*
+	 * Guests tend to write the same event type again each time they
+	 * reprogram a counter. The perf event already counts this, and is
+	 * paused and resumed along with the counter enable, so keep it
+	 * rather than releasing and creating it again, unless its sample
+	 * period has to follow a new counter value.
+	 */
+	if (pmc->perf_event && pmc->evtype == evtype && !pmc->period_stale)
+		return;
+
+	kvm_pmu_stop_counter(vcpu, pmc);
 
 	/* Software increment event does't need to be backed by a perf event */
 	if (eventsel == ARMV8_PMUV3_PERFCTR_SW_INCR &&
@@ -438,6 +470,8 @@ void kvm_pmu_set_counter_event_type(struct kvm_vcpu *vcpu, u64 data,
 	}
 
 	pmc->perf_event = event;
+	pmc->evtype = evtype;
+	pmc->period_stale = false;
 }
 
 bool kvm_arm_support_pmu_v3(void)
@@ -64,6 +64,12 @@ static unsigned long kvm_psci_vcpu_suspend(struct kvm_vcpu *vcpu)
 
 static void kvm_psci_vcpu_off(struct kvm_vcpu *vcpu)
 {
+	/*
+	 * Once off, the vcpu may be reset by another one through CPU_ON
+	 * before it is put, so its state must be in memory by then.
+	 */
+	kvm_vcpu_put_sysregs(vcpu);
+
 	vcpu->arch.power_off = true;
 	kvm_make_request(KVM_REQ_SLEEP, vcpu);
 	kvm_vcpu_kick(vcpu);
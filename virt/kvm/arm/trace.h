@@ -10,43 +10,115 @@
  * Tracepoints for entry/exit to guest
  */
 TRACE_EVENT(kvm_entry,
-	TP_PROTO(unsigned long vcpu_pc, char *state),
-	TP_ARGS(vcpu_pc, state),
+	TP_PROTO(unsigned int vcpu_id, unsigned long vcpu_pc, int ctxt),
+	TP_ARGS(vcpu_id, vcpu_pc, ctxt),
 
 	TP_STRUCT__entry(
+		__field(	unsigned int,	vcpu_id		)
 		__field(	unsigned long,	vcpu_pc		)
-		__field(		char*,	state		)
+		__field(	int,		ctxt		)
 	),
 
 	TP_fast_assign(
+		__entry->vcpu_id		= vcpu_id;
 		__entry->vcpu_pc		= vcpu_pc;
-		__entry->state			= state;
+		__entry->ctxt			= ctxt;
 	),
 
-	TP_printk("PC: 0x%08lx (%s)", __entry->vcpu_pc, __entry->state)
+	TP_printk("vcpu %u, PC: 0x%08lx (%s)", __entry->vcpu_id,
+		  __entry->vcpu_pc,
+		  __print_symbolic(__entry->ctxt, kvm_arm_guest_ctxt))
 );
 
 TRACE_EVENT(kvm_exit,
-	TP_PROTO(int idx, unsigned int exit_reason, unsigned long vcpu_pc),
-	TP_ARGS(idx, exit_reason, vcpu_pc),
+	TP_PROTO(int idx, unsigned int exit_reason, unsigned long vcpu_pc,
+		 int ctxt),
+	TP_ARGS(idx, exit_reason, vcpu_pc, ctxt),
 
 	TP_STRUCT__entry(
 		__field(	int,		idx		)
 		__field(	unsigned int,	exit_reason	)
 		__field(	unsigned long,	vcpu_pc		)
+		__field(	int,		ctxt		)
 	),
 
 	TP_fast_assign(
 		__entry->idx			= idx;
 		__entry->exit_reason		= exit_reason;
 		__entry->vcpu_pc		= vcpu_pc;
+		__entry->ctxt			= ctxt;
 	),
 
-	TP_printk("%s: HSR_EC: 0x%04x (%s), PC: 0x%08lx",
+	TP_printk("%s: HSR_EC: 0x%04x (%s), PC: 0x%08lx (%s)",
 		  __print_symbolic(__entry->idx, kvm_arm_exception_type),
 		  __entry->exit_reason,
 		  __print_symbolic(__entry->exit_reason, kvm_arm_exception_class),
-		  __entry->vcpu_pc)
+		  __entry->vcpu_pc,
+		  __print_symbolic(__entry->ctxt, kvm_arm_guest_ctxt))
+);
+
+/*
+ * One event per round trip through the guest, including the ones
+ * kvm_vcpu_fast_reenter() handles without going back to the run loop.
+ * All fields are fixed size so that BPF programs can consume them
+ * directly, and the timestamps are local_clock() ones, only taken while
+ * the event is enabled.
+ */
+TRACE_EVENT(kvm_world_switch,
+	TP_PROTO(unsigned int vcpu_id, int ctxt, u32 vmid, int idx, u32 esr,
+		 u8 ec, u64 entry_ns, u64 exit_ns),
+	TP_ARGS(vcpu_id, ctxt, vmid, idx, esr, ec, entry_ns, exit_ns),
+
+	TP_STRUCT__entry(
+		__field(	unsigned int,	vcpu_id		)
+		__field(	int,		ctxt		)
+		__field(	u32,		vmid		)
+		__field(	int,		idx		)
+		__field(	u32,		esr		)
+		__field(	u8,		ec		)
+		__field(	u64,		entry_ns	)
+		__field(	u64,		exit_ns		)
+	),
+
+	TP_fast_assign(
+		__entry->vcpu_id		= vcpu_id;
+		__entry->ctxt			= ctxt;
+		__entry->vmid			= vmid;
+		__entry->idx			= idx;
+		__entry->esr			= esr;
+		__entry->ec			= ec;
+		__entry->entry_ns		= entry_ns;
+		__entry->exit_ns		= exit_ns;
+	),
+
+	TP_printk("vcpu %u (%s) vmid %u: %s ESR 0x%08x (%s) after %llu ns",
+		  __entry->vcpu_id,
+		  __print_symbolic(__entry->ctxt, kvm_arm_guest_ctxt),
+		  __entry->vmid,
+		  __print_symbolic(__entry->idx, kvm_arm_exception_type),
+		  __entry->esr,
+		  __print_symbolic(__entry->ec, kvm_arm_exception_class),
+		  __entry->exit_ns - __entry->entry_ns)
+);
+
+TRACE_EVENT(kvm_lock_contended,
+	TP_PROTO(const char *name, unsigned long holder, u64 wait_ns),
+	TP_ARGS(name, holder, wait_ns),
+
+	TP_STRUCT__entry(
+		__string(	name,		name		)
+		__field(	unsigned long,	holder		)
+		__field(	u64,		wait_ns		)
+	),
+
+	TP_fast_assign(
+		__assign_str(name, name);
+		__entry->holder			= holder;
+		__entry->wait_ns		= wait_ns;
+	),
+
+	TP_printk("%s: waited %llu ns, held from %pS", __get_str(name),
+		  __entry->wait_ns, (void *)__entry->holder)
 );
 
 TRACE_EVENT(kvm_guest_fault,
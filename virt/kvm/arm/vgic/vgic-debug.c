@@ -211,6 +211,7 @@ static int vgic_debug_show(struct seq_file *s, void *v)
 	struct vgic_state_iter *iter = (struct vgic_state_iter *)v;
 	struct vgic_irq *irq;
 	struct kvm_vcpu *vcpu = NULL;
+	unsigned long flags;
 
 	if (iter->dist_id == 0) {
 		print_dist_state(s, &kvm->arch.vgic);
@@ -227,9 +228,9 @@ static int vgic_debug_show(struct seq_file *s, void *v)
 		irq = &kvm->arch.vgic.spis[iter->intid - VGIC_NR_PRIVATE_IRQS];
 	}
 
-	spin_lock(&irq->irq_lock);
+	raw_spin_lock_irqsave(&irq->irq_lock, flags);
 	print_irq_state(s, irq, vcpu);
-	spin_unlock(&irq->irq_lock);
+	raw_spin_unlock_irqrestore(&irq->irq_lock, flags);
 
 	return 0;
 }
@@ -263,6 +264,127 @@ static struct file_operations vgic_debug_fops = {
 	.release = seq_release
 };
 
+/*
+ * Interrupt delivery statistics, off by default as timing each interrupt
+ * costs two clock reads.
+ */
+bool vgic_stats;
+
+static int __init early_vgic_stats_cfg(char *buf)
+{
+	return strtobool(buf, &vgic_stats);
+}
+early_param("kvm-arm.vgic_stats", early_vgic_stats_cfg);
+
+/* Requires the VCPU's ap_list_lock to be held. */
+void vgic_stats_flush(struct kvm_vcpu *vcpu, int used_lrs, bool overflow)
+{
+	struct vgic_cpu *vgic_cpu = &vcpu->arch.vgic_cpu;
+	struct vgic_cpu_stats *stats = &vgic_cpu->stats;
+	struct list_head *entry;
+	int len = 0;
+
+	list_for_each(entry, &vgic_cpu->ap_list_head)
+		len++;
+
+	stats->flushes++;
+	if (overflow)
+		stats->overflows++;
+	stats->lr_used[min(used_lrs, VGIC_STATS_LR_BUCKETS - 1)]++;
+	stats->ap_list_len[min(fls(len - 1),
+			       VGIC_STATS_AP_LIST_BUCKETS - 1)]++;
+}
+
+void vgic_stats_nested(struct kvm_vcpu *vcpu, int used_lrs)
+{
+	struct vgic_cpu_stats *stats = &vcpu->arch.vgic_cpu.stats;
+
+	stats->nested_lr_used[min(used_lrs, VGIC_STATS_LR_BUCKETS - 1)]++;
+}
+
+/* Requires the irq to be locked already */
+void __vgic_stats_acked(struct kvm_vcpu *vcpu, struct vgic_irq *irq)
+{
+	struct vgic_cpu_stats *stats = &vcpu->arch.vgic_cpu.stats;
+	u64 us = (ktime_get_ns() - irq->queued_ns) / NSEC_PER_USEC;
+
+	stats->ack_latency[min(fls64(us), VGIC_STATS_LATENCY_BUCKETS - 1)]++;
+	irq->queued_ns = 0;
+}
+
+static void print_stats_hist(struct seq_file *s, const char *name,
+			     u64 *hist, int nr)
+{
+	int i;
+
+	seq_printf(s, "  %-15s", name);
+	for (i = 0; i < nr; i++)
+		seq_printf(s, " %llu", hist[i]);
+	seq_putc(s, '\n');
+}
+
+static int vgic_stats_show(struct seq_file *s, void *v)
+{
+	struct kvm *kvm = s->private;
+	struct kvm_vcpu *vcpu;
+	int i;
+
+	if (!vgic_stats) {
+		seq_puts(s, "disabled, boot with kvm-arm.vgic_stats=1\n");
+		return 0;
+	}
+
+	seq_puts(s, "lr_used:     flushes by LRs in use, 0 to 16+\n");
+	seq_puts(s, "ap_list_len: flushes by ap_list length, 1 2 3-4 .. 65+\n");
+	seq_puts(s, "ack_latency: IRQs by usecs to ack, <1 <2 <4 .. more\n");
+
+	kvm_for_each_vcpu(i, vcpu, kvm) {
+		struct vgic_cpu_stats *stats = &vcpu->arch.vgic_cpu.stats;
+
+		seq_printf(s, "\nVCPU %d: flushes %llu overflows %llu\n",
+			   vcpu->vcpu_id, stats->flushes, stats->overflows);
+		print_stats_hist(s, "lr_used", stats->lr_used,
+				 VGIC_STATS_LR_BUCKETS);
+		print_stats_hist(s, "nested_lr_used", stats->nested_lr_used,
+				 VGIC_STATS_LR_BUCKETS);
+		print_stats_hist(s, "ap_list_len", stats->ap_list_len,
+				 VGIC_STATS_AP_LIST_BUCKETS);
+		print_stats_hist(s, "ack_latency", stats->ack_latency,
+				 VGIC_STATS_LATENCY_BUCKETS);
+	}
+
+	return 0;
+}
+
+static int vgic_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, vgic_stats_show, inode->i_private);
+}
+
+/* Any write clears the statistics */
+static ssize_t vgic_stats_write(struct file *file, const char __user *buf,
+				size_t len, loff_t *ppos)
+{
+	struct kvm *kvm = file_inode(file)->i_private;
+	struct kvm_vcpu *vcpu;
+	int i;
+
+	kvm_for_each_vcpu(i, vcpu, kvm)
+		memset(&vcpu->arch.vgic_cpu.stats, 0,
+		       sizeof(vcpu->arch.vgic_cpu.stats));
+
+	return len;
+}
+
+static const struct file_operations vgic_stats_fops = {
+	.owner		= THIS_MODULE,
+	.open		= vgic_stats_open,
+	.read		= seq_read,
+	.write		= vgic_stats_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 int vgic_debug_init(struct kvm *kvm)
 {
 	if (!kvm->debugfs_dentry)
@@ -274,6 +396,12 @@ int vgic_debug_init(struct kvm *kvm)
 				 &vgic_debug_fops))
 		return -ENOMEM;
 
+	if (!debugfs_create_file("vgic-stats", 0644,
+				 kvm->debugfs_dentry,
+				 kvm,
+				 &vgic_stats_fops))
+		return -ENOMEM;
+
 	return 0;
 }
 
@@ -105,6 +105,37 @@ int kvm_set_msi(struct kvm_kernel_irq_routing_entry *e,
 	return vgic_its_inject_msi(kvm, &msi);
 }
 
+/**
+ * kvm_arch_set_irq_inatomic: fast-path for irqfd injection
+ *
+ * Called from the irqfd wakeup with interrupts disabled. Only MSIs whose
+ * ITS translation is cached are injected directly, anything else is left
+ * to kvm_set_msi() from the irqfd workqueue.
+ *
+ * The eventfd wait queue lock is hardirq safe, which is why all the vgic
+ * locks taken from here are raw spinlocks taken with interrupts disabled.
+ */
+int kvm_arch_set_irq_inatomic(struct kvm_kernel_irq_routing_entry *e,
+			      struct kvm *kvm, int irq_source_id, int level,
+			      bool line_status)
+{
+	struct kvm_msi msi;
+
+	if (e->type != KVM_IRQ_ROUTING_MSI || !level)
+		return -EWOULDBLOCK;
+
+	msi.address_lo = e->msi.address_lo;
+	msi.address_hi = e->msi.address_hi;
+	msi.data = e->msi.data;
+	msi.flags = e->msi.flags;
+	msi.devid = e->msi.devid;
+
+	if (vgic_its_inject_cached_msi(kvm, &msi))
+		return -EWOULDBLOCK;
+
+	return 0;
+}
+
 int kvm_vgic_setup_default_irq_routing(struct kvm *kvm)
 {
 	struct kvm_irq_routing_entry *entries;
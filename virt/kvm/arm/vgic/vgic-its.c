@@ -38,7 +38,7 @@ static int vgic_its_save_tables_v0(struct vgic_its *its);
 static int vgic_its_restore_tables_v0(struct vgic_its *its);
 static int vgic_its_commit_v0(struct vgic_its *its);
 static int update_lpi_config(struct kvm *kvm, struct vgic_irq *irq,
-			     struct kvm_vcpu *filter_vcpu);
+			     struct kvm_vcpu *filter_vcpu, bool needs_inv);
 
 /*
  * Creates a new (reference to a) struct vgic_irq for a given LPI.
@@ -53,6 +53,7 @@ static struct vgic_irq *vgic_add_lpi(struct kvm *kvm, u32 intid,
 	struct vgic_dist *dist = &kvm->arch.vgic;
 	struct vgic_irq *irq = vgic_get_irq(kvm, NULL, intid), *oldirq;
 	int ret;
+	unsigned long flags;
 
 	/* In this case there is no put, since we keep the reference. */
 	if (irq)
@@ -64,14 +65,14 @@ static struct vgic_irq *vgic_add_lpi(struct kvm *kvm, u32 intid,
 
 	INIT_LIST_HEAD(&irq->lpi_list);
 	INIT_LIST_HEAD(&irq->ap_list);
-	spin_lock_init(&irq->irq_lock);
+	raw_spin_lock_init(&irq->irq_lock);
 
 	irq->config = VGIC_CONFIG_EDGE;
 	kref_init(&irq->refcount);
 	irq->intid = intid;
 	irq->target_vcpu = vcpu;
 
-	spin_lock(&dist->lpi_list_lock);
+	raw_spin_lock_irqsave(&dist->lpi_list_lock, flags);
 
 	/*
 	 * There could be a race with another vgic_add_lpi(), so we need to
@@ -95,18 +96,18 @@ static struct vgic_irq *vgic_add_lpi(struct kvm *kvm, u32 intid,
 		goto out_unlock;
 	}
 
-	list_add_tail(&irq->lpi_list, &dist->lpi_list_head);
+	list_add_tail_rcu(&irq->lpi_list, &dist->lpi_list_head);
 	dist->lpi_list_count++;
 
 out_unlock:
-	spin_unlock(&dist->lpi_list_lock);
+	raw_spin_unlock_irqrestore(&dist->lpi_list_lock, flags);
 
 	/*
 	 * We "cache" the configuration table entries in our struct vgic_irq's.
 	 * However we only have those structs for mapped IRQs, so we read in
 	 * the respective config data from memory here upon mapping the LPI.
 	 */
-	ret = update_lpi_config(kvm, irq, NULL);
+	ret = update_lpi_config(kvm, irq, NULL, false);
 	if (ret)
 		return ERR_PTR(ret);
 
@@ -274,11 +275,12 @@ static struct its_collection *find_collection(struct vgic_its *its, int coll_id)
  * VCPU. Unconditionally applies if filter_vcpu is NULL.
  */
 static int update_lpi_config(struct kvm *kvm, struct vgic_irq *irq,
-			     struct kvm_vcpu *filter_vcpu)
+			     struct kvm_vcpu *filter_vcpu, bool needs_inv)
 {
 	u64 propbase = GICR_PROPBASER_ADDRESS(kvm->arch.vgic.propbaser);
 	u8 prop;
 	int ret;
+	unsigned long flags;
 
 	ret = kvm_read_guest(kvm, propbase + irq->intid - GIC_LPI_OFFSET,
 			     &prop, 1);
@@ -286,17 +288,24 @@ static int update_lpi_config(struct kvm *kvm, struct vgic_irq *irq,
 	if (ret)
 		return ret;
 
-	spin_lock(&irq->irq_lock);
+	raw_spin_lock_irqsave(&irq->irq_lock, flags);
 
 	if (!filter_vcpu || filter_vcpu == irq->target_vcpu) {
 		irq->priority = LPI_PROP_PRIORITY(prop);
 		irq->enabled = LPI_PROP_ENABLE_BIT(prop);
 
-		vgic_queue_irq_unlock(kvm, irq);
-	} else {
-		spin_unlock(&irq->irq_lock);
+		if (!irq->hw) {
+			vgic_queue_irq_unlock(kvm, irq, flags);
+			return 0;
+		}
 	}
 
+	raw_spin_unlock_irqrestore(&irq->irq_lock, flags);
+
+	/* A forwarded LPI lives in the GICv4 property table */
+	if (irq->hw)
+		return its_prop_update_vlpi(irq->host_irq, prop, needs_inv);
+
 	return 0;
 }
 
@@ -311,6 +320,7 @@ static int vgic_copy_lpi_list(struct kvm_vcpu *vcpu, u32 **intid_ptr)
 	struct vgic_irq *irq;
 	u32 *intids;
 	int irq_count = dist->lpi_list_count, i = 0;
+	unsigned long flags;
 
 	/*
 	 * We use the current value of the list length, which may change
@@ -323,19 +333,46 @@ static int vgic_copy_lpi_list(struct kvm_vcpu *vcpu, u32 **intid_ptr)
 	if (!intids)
 		return -ENOMEM;
 
-	spin_lock(&dist->lpi_list_lock);
+	raw_spin_lock_irqsave(&dist->lpi_list_lock, flags);
 	list_for_each_entry(irq, &dist->lpi_list_head, lpi_list) {
 		/* We don't need to "get" the IRQ, as we hold the list lock. */
 		if (irq->target_vcpu != vcpu)
 			continue;
 		intids[i++] = irq->intid;
 	}
-	spin_unlock(&dist->lpi_list_lock);
+	raw_spin_unlock_irqrestore(&dist->lpi_list_lock, flags);
 
 	*intid_ptr = intids;
 	return i;
 }
 
+/*
+ * Sets the target VCPU of an LPI. Must be called with the its_lock mutex
+ * held, or the lpi_list_lock, as for MOVALL.
+ */
+static int update_affinity(struct vgic_irq *irq, struct kvm_vcpu *vcpu)
+{
+	struct its_vlpi_map map;
+	int ret;
+	unsigned long flags;
+
+	raw_spin_lock_irqsave(&irq->irq_lock, flags);
+	irq->target_vcpu = vcpu;
+	raw_spin_unlock_irqrestore(&irq->irq_lock, flags);
+
+	if (!irq->hw)
+		return 0;
+
+	/* A forwarded LPI also has to follow the vcpu on the host ITS */
+	ret = its_get_vlpi(irq->host_irq, &map);
+	if (ret)
+		return ret;
+
+	map.vpe = &vcpu->arch.vgic_cpu.its_vpe;
+
+	return its_map_vlpi(irq->host_irq, &map);
+}
+
 /*
  * Promotes the ITS view of affinity of an ITTE (which redistributor this LPI
  * is targeting) to the VGIC's view, which deals with target VCPUs.
@@ -350,10 +387,7 @@ static void update_affinity_ite(struct kvm *kvm, struct its_ite *ite)
 		return;
 
 	vcpu = kvm_get_vcpu(kvm, ite->collection->target_addr);
-
-	spin_lock(&ite->irq->irq_lock);
-	ite->irq->target_vcpu = vcpu;
-	spin_unlock(&ite->irq->irq_lock);
+	update_affinity(ite->irq, vcpu);
 }
 
 /*
@@ -394,6 +428,7 @@ static int its_sync_lpi_pending_table(struct kvm_vcpu *vcpu)
 	int ret = 0;
 	u32 *intids;
 	int nr_irqs, i;
+	unsigned long flags;
 
 	nr_irqs = vgic_copy_lpi_list(vcpu, &intids);
 	if (nr_irqs < 0)
@@ -421,9 +456,9 @@ static int its_sync_lpi_pending_table(struct kvm_vcpu *vcpu)
 		}
 
 		irq = vgic_get_irq(vcpu->kvm, NULL, intids[i]);
-		spin_lock(&irq->irq_lock);
+		raw_spin_lock_irqsave(&irq->irq_lock, flags);
 		irq->pending_latch = pendmask & (1U << bit_nr);
-		vgic_queue_irq_unlock(vcpu->kvm, irq);
+		vgic_queue_irq_unlock(vcpu->kvm, irq, flags);
 		vgic_put_irq(vcpu->kvm, irq);
 	}
 
@@ -505,14 +540,123 @@ static unsigned long vgic_mmio_read_its_idregs(struct kvm *kvm,
 }
 
 /*
- * Find the target VCPU and the LPI number for a given devid/eventid pair
- * and make this IRQ pending, possibly injecting it.
+ * The translation cache holds a reference on the struct vgic_irq of the
+ * last DevID/EventID pairs that were translated for an MSI, so that most
+ * injections need neither the its_lock nor a walk of the ITS lists. Its
+ * entries are only added with the its_lock held, and any command that could
+ * change a cached translation empties it, with the its_lock held too.
+ */
+static struct vgic_irq *vgic_its_check_cache(struct vgic_its *its,
+					     u32 devid, u32 eventid)
+{
+	struct vgic_translation_cache_entry *cache = its->translation_cache;
+	struct vgic_translation_cache_entry entry;
+	struct vgic_irq *irq = NULL;
+	int i;
+	unsigned long flags;
+
+	raw_spin_lock_irqsave(&its->translation_cache_lock, flags);
+
+	for (i = 0; i < VGIC_ITS_TRANSLATION_CACHE_SIZE && cache[i].irq; i++) {
+		if (cache[i].devid != devid || cache[i].eventid != eventid)
+			continue;
+
+		irq = cache[i].irq;
+		vgic_get_irq_kref(irq);
+
+		/* Move the entry to the front, keeping the rest in order */
+		entry = cache[i];
+		memmove(&cache[1], &cache[0], i * sizeof(*cache));
+		cache[0] = entry;
+		break;
+	}
+
+	raw_spin_unlock_irqrestore(&its->translation_cache_lock, flags);
+
+	return irq;
+}
+
+/* Must be called with the its_lock mutex held. */
+static void vgic_its_cache_translation(struct kvm *kvm, struct vgic_its *its,
+				       u32 devid, u32 eventid,
+				       struct vgic_irq *irq)
+{
+	struct vgic_translation_cache_entry *cache = its->translation_cache;
+	int last = VGIC_ITS_TRANSLATION_CACHE_SIZE - 1;
+	struct vgic_irq *evicted;
+	int i;
+	unsigned long flags;
+
+	raw_spin_lock_irqsave(&its->translation_cache_lock, flags);
+
+	/* Another injection may have got there first */
+	for (i = 0; i < VGIC_ITS_TRANSLATION_CACHE_SIZE && cache[i].irq; i++) {
+		if (cache[i].devid == devid && cache[i].eventid == eventid) {
+			raw_spin_unlock_irqrestore(&its->translation_cache_lock,
+						   flags);
+			return;
+		}
+	}
+
+	/* This reference is dropped when the entry goes */
+	vgic_get_irq_kref(irq);
+
+	evicted = cache[last].irq;
+	memmove(&cache[1], &cache[0], last * sizeof(*cache));
+	cache[0].devid = devid;
+	cache[0].eventid = eventid;
+	cache[0].irq = irq;
+
+	raw_spin_unlock_irqrestore(&its->translation_cache_lock, flags);
+
+	if (evicted)
+		vgic_put_irq(kvm, evicted);
+}
+
+/* Must be called with the its_lock mutex held. */
+static void vgic_its_invalidate_cache(struct kvm *kvm, struct vgic_its *its)
+{
+	struct vgic_translation_cache_entry cache[VGIC_ITS_TRANSLATION_CACHE_SIZE];
+	int i;
+	unsigned long flags;
+
+	raw_spin_lock_irqsave(&its->translation_cache_lock, flags);
+	memcpy(cache, its->translation_cache, sizeof(cache));
+	memset(its->translation_cache, 0, sizeof(cache));
+	raw_spin_unlock_irqrestore(&its->translation_cache_lock, flags);
+
+	for (i = 0; i < VGIC_ITS_TRANSLATION_CACHE_SIZE && cache[i].irq; i++)
+		vgic_put_irq(kvm, cache[i].irq);
+}
+
+/*
+ * Makes an LPI pending. A forwarded one is made pending on the host ITS,
+ * which either delivers it to the resident vPE or rings its doorbell.
+ */
+static int vgic_its_inject_lpi(struct kvm *kvm, struct vgic_irq *irq)
+{
+	unsigned long flags;
+
+	if (irq->hw)
+		return irq_set_irqchip_state(irq->host_irq,
+					     IRQCHIP_STATE_PENDING, true);
+
+	raw_spin_lock_irqsave(&irq->irq_lock, flags);
+	irq->pending_latch = true;
+	vgic_queue_irq_unlock(kvm, irq, flags);
+
+	return 0;
+}
+
+/*
+ * Find the LPI a given devid/eventid pair translates to, checking that it
+ * can be delivered to its target VCPU.
  * Must be called with the its_lock mutex held.
  * Returns 0 on success, a positive error value for any ITS mapping
  * related errors and negative error values for generic errors.
  */
-static int vgic_its_trigger_msi(struct kvm *kvm, struct vgic_its *its,
-				u32 devid, u32 eventid)
+int vgic_its_resolve_lpi(struct kvm *kvm, struct vgic_its *its,
+			 u32 devid, u32 eventid, struct vgic_irq **irq)
 {
 	struct kvm_vcpu *vcpu;
 	struct its_ite *ite;
@@ -531,13 +675,30 @@ static int vgic_its_trigger_msi(struct kvm *kvm, struct vgic_its *its,
 	if (!vcpu->arch.vgic_cpu.lpis_enabled)
 		return -EBUSY;
 
-	spin_lock(&ite->irq->irq_lock);
-	ite->irq->pending_latch = true;
-	vgic_queue_irq_unlock(kvm, ite->irq);
-
+	*irq = ite->irq;
 	return 0;
 }
 
+/*
+ * Find the target VCPU and the LPI number for a given devid/eventid pair
+ * and make this IRQ pending, possibly injecting it.
+ * Must be called with the its_lock mutex held.
+ */
+static int vgic_its_trigger_msi(struct kvm *kvm, struct vgic_its *its,
+				u32 devid, u32 eventid)
+{
+	struct vgic_irq *irq = NULL;
+	int ret;
+
+	ret = vgic_its_resolve_lpi(kvm, its, devid, eventid, &irq);
+	if (ret)
+		return ret;
+
+	vgic_its_cache_translation(kvm, its, devid, eventid, irq);
+
+	return vgic_its_inject_lpi(kvm, irq);
+}
+
 static struct vgic_io_device *vgic_get_its_iodev(struct kvm_io_device *dev)
 {
 	struct vgic_io_device *iodev;
@@ -556,35 +717,104 @@ static struct vgic_io_device *vgic_get_its_iodev(struct kvm_io_device *dev)
 /*
  * Queries the KVM IO bus framework to get the ITS pointer from the given
  * doorbell address.
- * We then call vgic_its_trigger_msi() with the decoded data.
- * According to the KVM_SIGNAL_MSI API description returns 1 on success.
  */
-int vgic_its_inject_msi(struct kvm *kvm, struct kvm_msi *msi)
+struct vgic_its *vgic_msi_to_its(struct kvm *kvm, struct kvm_msi *msi)
 {
 	u64 address;
 	struct kvm_io_device *kvm_io_dev;
 	struct vgic_io_device *iodev;
-	int ret;
 
 	if (!vgic_has_its(kvm))
-		return -ENODEV;
+		return ERR_PTR(-ENODEV);
 
 	if (!(msi->flags & KVM_MSI_VALID_DEVID))
-		return -EINVAL;
+		return ERR_PTR(-EINVAL);
 
 	address = (u64)msi->address_hi << 32 | msi->address_lo;
 
 	kvm_io_dev = kvm_io_bus_get_dev(kvm, KVM_MMIO_BUS, address);
 	if (!kvm_io_dev)
-		return -EINVAL;
+		return ERR_PTR(-EINVAL);
 
 	iodev = vgic_get_its_iodev(kvm_io_dev);
 	if (!iodev)
-		return -EINVAL;
+		return ERR_PTR(-EINVAL);
 
-	mutex_lock(&iodev->its->its_lock);
-	ret = vgic_its_trigger_msi(kvm, iodev->its, msi->devid, msi->data);
-	mutex_unlock(&iodev->its->its_lock);
+	return iodev->its;
+}
+
+/*
+ * Makes the LPI of a cached translation pending, without taking the
+ * its_lock. A cached translation implies an enabled ITS, a mapped
+ * collection and LPIs enabled on its target, which can't be disabled again.
+ * Returns -EWOULDBLOCK if the translation isn't cached.
+ */
+static int vgic_its_inject_cached_translation(struct kvm *kvm,
+					      struct vgic_its *its,
+					      u32 devid, u32 eventid)
+{
+	struct vgic_irq *irq;
+	int ret;
+
+	irq = vgic_its_check_cache(its, devid, eventid);
+	if (!irq)
+		return -EWOULDBLOCK;
+
+	ret = vgic_its_inject_lpi(kvm, irq);
+	vgic_put_irq(kvm, irq);
+
+	return ret;
+}
+
+/*
+ * Injects an MSI only if its translation is cached, as it can't sleep.
+ * Returns 0 on success and a negative error, -EWOULDBLOCK if the
+ * translation isn't cached, otherwise.
+ */
+int vgic_its_inject_cached_msi(struct kvm *kvm, struct kvm_msi *msi)
+{
+	struct vgic_its *its = vgic_msi_to_its(kvm, msi);
+
+	if (IS_ERR(its))
+		return PTR_ERR(its);
+
+	return vgic_its_inject_cached_translation(kvm, its, msi->devid,
+						  msi->data);
+}
+
+/* The its_lock on the MSI and command paths, with stats in the VM */
+static void vgic_its_lock(struct kvm *kvm, struct vgic_its *its)
+{
+	kvm_arm_lock_stat("its_lock", mutex_trylock(&its->its_lock),
+			  mutex_lock(&its->its_lock),
+			  READ_ONCE(its->its_lock_holder),
+			  kvm->stat.its_lock_contended,
+			  kvm->stat.its_lock_wait_ns);
+	its->its_lock_holder = _RET_IP_;
+}
+
+/*
+ * Finds the ITS from the doorbell address, then calls
+ * vgic_its_trigger_msi() with the decoded data, unless the translation is
+ * cached.
+ * According to the KVM_SIGNAL_MSI API description returns 1 on success.
+ */
+int vgic_its_inject_msi(struct kvm *kvm, struct kvm_msi *msi)
+{
+	struct vgic_its *its;
+	int ret;
+
+	its = vgic_msi_to_its(kvm, msi);
+	if (IS_ERR(its))
+		return PTR_ERR(its);
+
+	if (!vgic_its_inject_cached_translation(kvm, its, msi->devid,
+						msi->data))
+		return 1;
+
+	vgic_its_lock(kvm, its);
+	ret = vgic_its_trigger_msi(kvm, its, msi->devid, msi->data);
+	mutex_unlock(&its->its_lock);
 
 	if (ret < 0)
 		return ret;
@@ -606,8 +836,14 @@ static void its_free_ite(struct kvm *kvm, struct its_ite *ite)
 	list_del(&ite->ite_list);
 
 	/* This put matches the get in vgic_add_lpi. */
-	if (ite->irq)
+	if (ite->irq) {
+		if (ite->irq->hw) {
+			ite->irq->hw = false;
+			WARN_ON(its_unmap_vlpi(ite->irq->host_irq));
+		}
+
 		vgic_put_irq(kvm, ite->irq);
+	}
 
 	kfree(ite);
 }
@@ -641,6 +877,8 @@ static int vgic_its_cmd_handle_discard(struct kvm *kvm, struct vgic_its *its,
 
 	ite = find_ite(its, device_id, event_id);
 	if (ite && ite->collection) {
+		vgic_its_invalidate_cache(kvm, its);
+
 		/*
 		 * Though the spec talks about removing the pending state, we
 		 * don't bother here since we clear the ITTE anyway and the
@@ -678,14 +916,12 @@ static int vgic_its_cmd_handle_movi(struct kvm *kvm, struct vgic_its *its,
 	if (!its_is_collection_mapped(collection))
 		return E_ITS_MOVI_UNMAPPED_COLLECTION;
 
+	vgic_its_invalidate_cache(kvm, its);
+
 	ite->collection = collection;
 	vcpu = kvm_get_vcpu(kvm, collection->target_addr);
 
-	spin_lock(&ite->irq->irq_lock);
-	ite->irq->target_vcpu = vcpu;
-	spin_unlock(&ite->irq->irq_lock);
-
-	return 0;
+	return update_affinity(ite->irq, vcpu);
 }
 
 /*
@@ -958,8 +1194,10 @@ static int vgic_its_cmd_handle_mapd(struct kvm *kvm, struct vgic_its *its,
 	 * invalidates all cached data for this device. We implement this
 	 * by removing the mapping and re-establishing it.
 	 */
-	if (device)
+	if (device) {
+		vgic_its_invalidate_cache(kvm, its);
 		vgic_its_unmap_device(kvm, device);
+	}
 
 	/*
 	 * The spec does not say whether unmapping a not-mapped device
@@ -995,6 +1233,8 @@ static int vgic_its_cmd_handle_mapc(struct kvm *kvm, struct vgic_its *its,
 	if (target_addr >= atomic_read(&kvm->online_vcpus))
 		return E_ITS_MAPC_PROCNUM_OOR;
 
+	vgic_its_invalidate_cache(kvm, its);
+
 	if (!valid) {
 		vgic_its_free_collection(its, coll_id);
 	} else {
@@ -1054,7 +1294,7 @@ static int vgic_its_cmd_handle_inv(struct kvm *kvm, struct vgic_its *its,
 	if (!ite)
 		return E_ITS_INV_UNMAPPED_INTERRUPT;
 
-	return update_lpi_config(kvm, ite->irq, NULL);
+	return update_lpi_config(kvm, ite->irq, NULL, true);
 }
 
 /*
@@ -1089,12 +1329,16 @@ static int vgic_its_cmd_handle_invall(struct kvm *kvm, struct vgic_its *its,
 		irq = vgic_get_irq(kvm, NULL, intids[i]);
 		if (!irq)
 			continue;
-		update_lpi_config(kvm, irq, vcpu);
+		update_lpi_config(kvm, irq, vcpu, false);
 		vgic_put_irq(kvm, irq);
 	}
 
 	kfree(intids);
 
+	/* One invalidation covers all the forwarded LPIs of this vcpu */
+	if (vcpu->arch.vgic_cpu.its_vpe.its_vm)
+		its_invall_vpe(&vcpu->arch.vgic_cpu.its_vpe);
+
 	return 0;
 }
 
@@ -1114,6 +1358,7 @@ static int vgic_its_cmd_handle_movall(struct kvm *kvm, struct vgic_its *its,
 	u32 target2_addr = its_cmd_mask_field(its_cmd, 3, 16, 32);
 	struct kvm_vcpu *vcpu1, *vcpu2;
 	struct vgic_irq *irq;
+	unsigned long flags;
 
 	if (target1_addr >= atomic_read(&kvm->online_vcpus) ||
 	    target2_addr >= atomic_read(&kvm->online_vcpus))
@@ -1125,18 +1370,16 @@ static int vgic_its_cmd_handle_movall(struct kvm *kvm, struct vgic_its *its,
 	vcpu1 = kvm_get_vcpu(kvm, target1_addr);
 	vcpu2 = kvm_get_vcpu(kvm, target2_addr);
 
-	spin_lock(&dist->lpi_list_lock);
+	vgic_its_invalidate_cache(kvm, its);
 
-	list_for_each_entry(irq, &dist->lpi_list_head, lpi_list) {
-		spin_lock(&irq->irq_lock);
+	raw_spin_lock_irqsave(&dist->lpi_list_lock, flags);
 
+	list_for_each_entry(irq, &dist->lpi_list_head, lpi_list) {
 		if (irq->target_vcpu == vcpu1)
-			irq->target_vcpu = vcpu2;
-
-		spin_unlock(&irq->irq_lock);
+			update_affinity(irq, vcpu2);
 	}
 
-	spin_unlock(&dist->lpi_list_lock);
+	raw_spin_unlock_irqrestore(&dist->lpi_list_lock, flags);
 
 	return 0;
 }
@@ -1163,7 +1406,7 @@ static int vgic_its_handle_command(struct kvm *kvm, struct vgic_its *its,
 {
 	int ret = -ENODEV;
 
-	mutex_lock(&its->its_lock);
+	vgic_its_lock(kvm, its);
 	switch (its_cmd_get_command(its_cmd)) {
 	case GITS_CMD_MAPD:
 		ret = vgic_its_cmd_handle_mapd(kvm, its, its_cmd);
@@ -1470,6 +1713,13 @@ static void vgic_mmio_write_its_ctlr(struct kvm *kvm, struct vgic_its *its,
 
 	its->enabled = !!(val & GITS_CTLR_ENABLE);
 
+	/* Injections must not find the translations of a disabled ITS */
+	if (!its->enabled) {
+		mutex_lock(&its->its_lock);
+		vgic_its_invalidate_cache(kvm, its);
+		mutex_unlock(&its->its_lock);
+	}
+
 	/*
 	 * Try to process any pending commands. This function bails out early
 	 * if the ITS is disabled or no commands have been queued.
@@ -1590,8 +1840,19 @@ static int vgic_its_create(struct kvm_device *dev, u32 type)
 	if (!its)
 		return -ENOMEM;
 
+	/* The vgic may already be initialized, without the vPEs */
+	if (kvm_vgic_global_state.has_gicv4 && vgic_initialized(dev->kvm)) {
+		int ret = vgic_v4_init(dev->kvm);
+
+		if (ret < 0) {
+			kfree(its);
+			return ret;
+		}
+	}
+
 	mutex_init(&its->its_lock);
 	mutex_init(&its->cmd_lock);
+	raw_spin_lock_init(&its->translation_cache_lock);
 
 	its->vgic_its_base = VGIC_ADDR_UNDEF;
 
@@ -1637,6 +1898,7 @@ static void vgic_its_destroy(struct kvm_device *kvm_dev)
 		return;
 
 	mutex_lock(&its->its_lock);
+	vgic_its_invalidate_cache(kvm, its);
 	list_for_each_safe(cur, temp, &its->device_list) {
 		struct its_device *dev;
 
@@ -1802,28 +2064,47 @@ typedef int (*entry_fn_t)(struct vgic_its *its, u32 id, void *entry,
 static int scan_its_table(struct vgic_its *its, gpa_t base, int size, int esz,
 			  int start_id, entry_fn_t fn, void *opaque)
 {
-	void *entry = kzalloc(esz, GFP_KERNEL);
+	void *buf = kmalloc(PAGE_SIZE, GFP_KERNEL);
 	struct kvm *kvm = its->dev->kvm;
 	unsigned long len = size;
+	size_t buf_len = 0;
+	gpa_t buf_gpa = 0;
 	int id = start_id;
 	gpa_t gpa = base;
 	int ret;
 
+	if (!buf)
+		return -ENOMEM;
+
 	while (len > 0) {
 		int next_offset;
 		size_t byte_offset;
 
-		ret = kvm_read_guest(kvm, gpa, entry, esz);
-		if (ret)
-			goto out;
+		/*
+		 * Read the table up to the end of the page holding the entry
+		 * at once, instead of one entry at a time.
+		 */
+		if (gpa < buf_gpa || gpa + esz > buf_gpa + buf_len) {
+			buf_gpa = gpa;
+			buf_len = min_t(unsigned long, len,
+					PAGE_SIZE - offset_in_page(gpa));
+			buf_len = max_t(size_t, buf_len, esz);
 
-		next_offset = fn(its, id, entry, opaque);
+			ret = kvm_read_guest(kvm, buf_gpa, buf, buf_len);
+			if (ret)
+				goto out;
+		}
+
+		next_offset = fn(its, id, buf + (gpa - buf_gpa), opaque);
 		if (next_offset <= 0) {
 			ret = next_offset;
 			goto out;
 		}
 
 		byte_offset = next_offset * esz;
+		if (byte_offset >= len)
+			break;
+
 		id += next_offset;
 		gpa += byte_offset;
 		len -= byte_offset;
@@ -1831,17 +2112,83 @@ static int scan_its_table(struct vgic_its *its, gpa_t base, int size, int esz,
 	ret =  1;
 
 out:
-	kfree(entry);
+	kfree(buf);
 	return ret;
 }
 
+/*
+ * Entries of a table being saved are staged in a buffer covering at most a
+ * page of guest memory, which is written with a single kvm_write_guest()
+ * once an entry falls outside of it. The gaps between staged entries are
+ * written as zeroes, which is an invalid entry of any of the tables.
+ */
+struct its_table_writer {
+	struct kvm	*kvm;
+	void		*buf;
+	gpa_t		base;	/* GPA of buf, if len */
+	size_t		len;	/* bytes staged */
+};
+
+static int its_table_writer_init(struct its_table_writer *w, struct kvm *kvm)
+{
+	w->kvm = kvm;
+	w->len = 0;
+	w->buf = kmalloc(PAGE_SIZE, GFP_KERNEL);
+
+	return w->buf ? 0 : -ENOMEM;
+}
+
+static int its_table_flush(struct its_table_writer *w)
+{
+	int ret = 0;
+
+	if (w->len)
+		ret = kvm_write_guest(w->kvm, w->base, w->buf, w->len);
+	w->len = 0;
+
+	return ret;
+}
+
+/* Flushes the staged entries and frees the buffer */
+static int its_table_writer_finish(struct its_table_writer *w)
+{
+	int ret = its_table_flush(w);
+
+	kfree(w->buf);
+	return ret;
+}
+
+static int its_table_write(struct its_table_writer *w, gpa_t gpa,
+			   u64 val, int esz)
+{
+	size_t gap;
+	int ret;
+
+	if (w->len && (gpa < w->base + w->len ||
+		       gpa + esz > w->base - offset_in_page(w->base) +
+				   PAGE_SIZE)) {
+		ret = its_table_flush(w);
+		if (ret)
+			return ret;
+	}
+
+	if (!w->len)
+		w->base = gpa;
+
+	gap = gpa - (w->base + w->len);
+	memset(w->buf + w->len, 0, gap);
+	memcpy(w->buf + w->len + gap, &val, esz);
+	w->len += gap + esz;
+
+	return 0;
+}
+
 /**
  * vgic_its_save_ite - Save an interrupt translation entry at @gpa
  */
-static int vgic_its_save_ite(struct vgic_its *its, struct its_device *dev,
-			      struct its_ite *ite, gpa_t gpa, int ite_esz)
+static int vgic_its_save_ite(struct its_table_writer *w, struct its_device *dev,
+			     struct its_ite *ite, gpa_t gpa, int ite_esz)
 {
-	struct kvm *kvm = its->dev->kvm;
 	u32 next_offset;
 	u64 val;
 
@@ -1850,7 +2197,7 @@ static int vgic_its_save_ite(struct vgic_its *its, struct its_device *dev,
 	       ((u64)ite->lpi << KVM_ITS_ITE_PINTID_SHIFT) |
 		ite->collection->collection_id;
 	val = cpu_to_le64(val);
-	return kvm_write_guest(kvm, gpa, &val, ite_esz);
+	return its_table_write(w, gpa, val, ite_esz);
 }
 
 /**
@@ -1921,7 +2268,8 @@ static int vgic_its_ite_cmp(void *priv, struct list_head *a,
 		return 1;
 }
 
-static int vgic_its_save_itt(struct vgic_its *its, struct its_device *device)
+static int vgic_its_save_itt(struct vgic_its *its, struct its_device *device,
+			     struct its_table_writer *w)
 {
 	const struct vgic_its_abi *abi = vgic_its_get_abi(its);
 	gpa_t base = device->itt_addr;
@@ -1934,11 +2282,11 @@ static int vgic_its_save_itt(struct vgic_its *its, struct its_device *device)
 	list_for_each_entry(ite, &device->itt_head, ite_list) {
 		gpa_t gpa = base + ite->event_id * ite_esz;
 
-		ret = vgic_its_save_ite(its, device, ite, gpa, ite_esz);
+		ret = vgic_its_save_ite(w, device, ite, gpa, ite_esz);
 		if (ret)
 			return ret;
 	}
-	return 0;
+	return its_table_flush(w);
 }
 
 static int vgic_its_restore_itt(struct vgic_its *its, struct its_device *dev)
@@ -1960,12 +2308,12 @@ static int vgic_its_restore_itt(struct vgic_its *its, struct its_device *dev)
  *
  * @its: ITS handle
  * @dev: ITS device
+ * @w: writer staging the device table
  * @ptr: GPA
  */
 static int vgic_its_save_dte(struct vgic_its *its, struct its_device *dev,
-			     gpa_t ptr, int dte_esz)
+			     struct its_table_writer *w, gpa_t ptr, int dte_esz)
 {
-	struct kvm *kvm = its->dev->kvm;
 	u64 val, itt_addr_field;
 	u32 next_offset;
 
@@ -1976,7 +2324,7 @@ static int vgic_its_save_dte(struct vgic_its *its, struct its_device *dev,
 	       (itt_addr_field << KVM_ITS_DTE_ITTADDR_SHIFT) |
 		(dev->num_eventid_bits - 1));
 	val = cpu_to_le64(val);
-	return kvm_write_guest(kvm, ptr, &val, dte_esz);
+	return its_table_write(w, ptr, val, dte_esz);
 }
 
 /**
@@ -2049,31 +2397,49 @@ static int vgic_its_device_cmp(void *priv, struct list_head *a,
 static int vgic_its_save_device_tables(struct vgic_its *its)
 {
 	const struct vgic_its_abi *abi = vgic_its_get_abi(its);
+	struct its_table_writer dt, itt;
 	struct its_device *dev;
 	int dte_esz = abi->dte_esz;
 	u64 baser;
+	int ret;
 
 	baser = its->baser_device_table;
 
 	list_sort(NULL, &its->device_list, vgic_its_device_cmp);
 
+	ret = its_table_writer_init(&dt, its->dev->kvm);
+	if (ret)
+		return ret;
+
+	ret = its_table_writer_init(&itt, its->dev->kvm);
+	if (ret)
+		goto out;
+
 	list_for_each_entry(dev, &its->device_list, dev_list) {
-		int ret;
 		gpa_t eaddr;
 
 		if (!vgic_its_check_id(its, baser,
-				       dev->device_id, &eaddr))
-			return -EINVAL;
+				       dev->device_id, &eaddr)) {
+			ret = -EINVAL;
+			break;
+		}
 
-		ret = vgic_its_save_itt(its, dev);
+		ret = vgic_its_save_itt(its, dev, &itt);
 		if (ret)
-			return ret;
+			break;
 
-		ret = vgic_its_save_dte(its, dev, eaddr, dte_esz);
+		ret = vgic_its_save_dte(its, dev, &dt, eaddr, dte_esz);
 		if (ret)
-			return ret;
+			break;
 	}
-	return 0;
+
+	kfree(itt.buf);
+out:
+	if (ret)
+		kfree(dt.buf);
+	else
+		ret = its_table_writer_finish(&dt);
+	return ret;
 }
 
 /**
@@ -2147,7 +2513,7 @@ static int vgic_its_restore_device_tables(struct vgic_its *its)
 	return ret;
 }
 
-static int vgic_its_save_cte(struct vgic_its *its,
+static int vgic_its_save_cte(struct its_table_writer *w,
 			     struct its_collection *collection,
 			     gpa_t gpa, int esz)
 {
@@ -2157,7 +2523,7 @@ static int vgic_its_save_cte(struct vgic_its *its,
 	       ((u64)collection->target_addr << KVM_ITS_CTE_RDBASE_SHIFT) |
 	       collection->collection_id);
 	val = cpu_to_le64(val);
-	return kvm_write_guest(its->dev->kvm, gpa, &val, esz);
+	return its_table_write(w, gpa, val, esz);
 }
 
 static int vgic_its_restore_cte(struct vgic_its *its, gpa_t gpa, int esz)
@@ -2200,7 +2566,7 @@ static int vgic_its_save_collection_table(struct vgic_its *its)
 {
 	const struct vgic_its_abi *abi = vgic_its_get_abi(its);
 	struct its_collection *collection;
-	u64 val;
+	struct its_table_writer w;
 	gpa_t gpa;
 	size_t max_size, filled = 0;
 	int ret, cte_esz = abi->cte_esz;
@@ -2211,25 +2577,33 @@ static int vgic_its_save_collection_table(struct vgic_its *its)
 
 	max_size = GITS_BASER_NR_PAGES(its->baser_coll_table) * SZ_64K;
 
+	ret = its_table_writer_init(&w, its->dev->kvm);
+	if (ret)
+		return ret;
+
 	list_for_each_entry(collection, &its->collection_list, coll_list) {
-		ret = vgic_its_save_cte(its, collection, gpa, cte_esz);
+		ret = vgic_its_save_cte(&w, collection, gpa, cte_esz);
 		if (ret)
-			return ret;
+			goto out;
 		gpa += cte_esz;
 		filled += cte_esz;
 	}
 
-	if (filled == max_size)
-		return 0;
-
 	/*
 	 * table is not fully filled, add a last dummy element
 	 * with valid bit unset
 	 */
-	val = 0;
-	BUG_ON(cte_esz > sizeof(val));
-	ret = kvm_write_guest(its->dev->kvm, gpa, &val, cte_esz);
-	return ret;
+	if (filled != max_size) {
+		BUG_ON(cte_esz > sizeof(u64));
+		ret = its_table_write(&w, gpa, 0, cte_esz);
+	}
+
+out:
+	if (ret) {
+		kfree(w.buf);
+		return ret;
+	}
+	return its_table_writer_finish(&w);
 }
 
 /**
@@ -2312,6 +2686,8 @@ static int vgic_its_restore_tables_v0(struct vgic_its *its)
 		return -EBUSY;
 	}
 
+	vgic_its_invalidate_cache(kvm, its);
+
 	ret = vgic_its_restore_collection_table(its);
 	if (ret)
 		goto out;
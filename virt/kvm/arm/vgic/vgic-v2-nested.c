@@ -46,81 +46,74 @@ static inline bool lr_triggers_eoi(u32 lr)
 	return !(lr & (GICH_LR_STATE | GICH_LR_HW)) && (lr & GICH_LR_EOI);
 }
 
-static unsigned long get_eisr(struct kvm_vcpu *vcpu, bool upper_reg)
+/* Update the summary registers after nested LR @i changed */
+static void vgic_v2_nested_lr_changed(struct kvm_vcpu *vcpu, int i)
 {
-	struct vgic_v2_cpu_if *cpu_if = vcpu_nested_if(vcpu);
-	int max_lr = upper_reg ? 64 : 32;
-	int min_lr = upper_reg ? 32 : 0;
-	int nr_lr = min(kvm_vgic_global_state.nr_lr, max_lr);
-	int i;
-	u32 reg = 0;
+	struct vgic_cpu *vgic_cpu = &vcpu->arch.vgic_cpu;
+	u32 lr = vcpu_nested_if(vcpu)->vgic_lr[i];
 
-	for (i = min_lr; i < nr_lr; i++) {
-		if (lr_triggers_eoi(cpu_if->vgic_lr[i]))
-			reg |= BIT(i - min_lr);
-	}
+	/* LRs beyond the ones we advertise are never reported */
+	if (i >= kvm_vgic_global_state.nr_lr)
+		return;
 
-	return reg;
+	if (lr_triggers_eoi(lr))
+		vgic_cpu->nested_eisr |= BIT_ULL(i);
+	else
+		vgic_cpu->nested_eisr &= ~BIT_ULL(i);
+
+	if (!(lr & GICH_LR_STATE))
+		vgic_cpu->nested_elrsr |= BIT_ULL(i);
+	else
+		vgic_cpu->nested_elrsr &= ~BIT_ULL(i);
 }
 
-static unsigned long vgic_mmio_read_v2_eisr0(struct kvm_vcpu *vcpu,
-					     gpa_t addr, unsigned int len)
+static void vgic_v2_nested_lrs_changed(struct kvm_vcpu *vcpu)
 {
-	return get_eisr(vcpu, false);
+	int i;
+
+	for (i = 0; i < kvm_vgic_global_state.nr_lr; i++)
+		vgic_v2_nested_lr_changed(vcpu, i);
 }
 
-static unsigned long vgic_mmio_read_v2_eisr1(struct kvm_vcpu *vcpu,
+static unsigned long vgic_mmio_read_v2_eisr0(struct kvm_vcpu *vcpu,
 					     gpa_t addr, unsigned int len)
 {
-	return get_eisr(vcpu, true);
+	return lower_32_bits(vcpu->arch.vgic_cpu.nested_eisr);
 }
 
-static u32 get_elrsr(struct kvm_vcpu *vcpu, bool upper_reg)
+static unsigned long vgic_mmio_read_v2_eisr1(struct kvm_vcpu *vcpu,
+					     gpa_t addr, unsigned int len)
 {
-	struct vgic_v2_cpu_if *cpu_if = vcpu_nested_if(vcpu);
-	int max_lr = upper_reg ? 64 : 32;
-	int min_lr = upper_reg ? 32 : 0;
-	int nr_lr = min(kvm_vgic_global_state.nr_lr, max_lr);
-	u32 reg = 0;
-	int i;
-
-	for (i = min_lr; i < nr_lr; i++) {
-		if (!(cpu_if->vgic_lr[i] & GICH_LR_STATE))
-			reg |= BIT(i - min_lr);
-	}
-
-	return reg;
+	return upper_32_bits(vcpu->arch.vgic_cpu.nested_eisr);
 }
 
 static unsigned long vgic_mmio_read_v2_elrsr0(struct kvm_vcpu *vcpu,
 					      gpa_t addr, unsigned int len)
 {
-	return get_elrsr(vcpu, false);
+	return lower_32_bits(vcpu->arch.vgic_cpu.nested_elrsr);
 }
 
 static unsigned long vgic_mmio_read_v2_elrsr1(struct kvm_vcpu *vcpu,
 					      gpa_t addr, unsigned int len)
 {
-	return get_elrsr(vcpu, true);
+	return upper_32_bits(vcpu->arch.vgic_cpu.nested_elrsr);
 }
 
 static unsigned long vgic_mmio_read_v2_misr(struct kvm_vcpu *vcpu,
 					    gpa_t addr, unsigned int len)
 {
+	struct vgic_cpu *vgic_cpu = &vcpu->arch.vgic_cpu;
 	struct vgic_v2_cpu_if *cpu_if = vcpu_nested_if(vcpu);
 	int nr_lr = kvm_vgic_global_state.nr_lr;
 	u32 reg = 0;
 
-	if (vgic_mmio_read_v2_eisr0(vcpu, addr, len) ||
-			vgic_mmio_read_v2_eisr1(vcpu, addr, len))
+	if (vgic_cpu->nested_eisr)
 		reg |= GICH_MISR_EOI;
 
 	if (cpu_if->vgic_hcr & GICH_HCR_UIE) {
-		u32 elrsr0 = vgic_mmio_read_v2_elrsr0(vcpu, addr, len);
-		u32 elrsr1 = vgic_mmio_read_v2_elrsr1(vcpu, addr, len);
 		int used_lrs;
 
-		used_lrs = nr_lr - (hweight32(elrsr0) + hweight32(elrsr1));
+		used_lrs = nr_lr - hweight64(vgic_cpu->nested_elrsr);
 		if (used_lrs <= 1)
 			reg |= GICH_MISR_U;
 	}
@@ -173,6 +166,8 @@ static void vgic_mmio_write_v2_gich(struct kvm_vcpu *vcpu,
 		break;
 	case GICH_LR0 ... (GICH_LR0 + 4 * (VGIC_V2_MAX_LRS - 1)):
 		cpu_if->vgic_lr[(addr & 0xff) >> 2] = val;
+		set_bit((addr & 0xff) >> 2, vcpu->arch.vgic_cpu.nested_lr_dirty);
+		vgic_v2_nested_lr_changed(vcpu, (addr & 0xff) >> 2);
 		break;
 	}
 }
@@ -237,6 +232,44 @@ int vgic_register_gich_iodev(struct kvm *kvm, struct vgic_dist *dist)
 	return ret;
 }
 
+/*
+ * Translate the HW interrupt of a nested LR, looking up the virtual interrupt
+ * the guest hypervisor named, and cache the result until the LR is written
+ * again or the mapping changes.
+ *
+ * The caller has already cleared the dirty bit of the LR, so a mapping change
+ * that races with the translation marks it dirty again rather than getting
+ * lost. The mapping is read under the irq_lock, which it is updated under.
+ */
+static void vgic_v2_translate_nested_lr(struct kvm_vcpu *vcpu, int i, u32 lr)
+{
+	struct vgic_cpu *vgic_cpu = &vcpu->arch.vgic_cpu;
+	struct vgic_irq *irq;
+	unsigned long flags;
+	u32 hwintid = 0;
+	bool hw;
+	int l1_irq;
+
+	l1_irq = (lr & GICH_LR_PHYSID_CPUID) >> GICH_LR_PHYSID_CPUID_SHIFT;
+	irq = vgic_get_irq(vcpu->kvm, vcpu, l1_irq);
+
+	raw_spin_lock_irqsave(&irq->irq_lock, flags);
+	hw = irq->hw;
+	if (hw)
+		hwintid = irq->hwintid;
+	raw_spin_unlock_irqrestore(&irq->irq_lock, flags);
+
+	if (hw) {
+		vgic_cpu->nested_lr_physid[i] = hwintid <<
+			GICH_LR_PHYSID_CPUID_SHIFT;
+		vgic_cpu->nested_lr_mapped |= BIT_ULL(i);
+	} else {
+		vgic_cpu->nested_lr_mapped &= ~BIT_ULL(i);
+	}
+
+	vgic_put_irq(vcpu->kvm, irq);
+}
+
 /*
  * For LRs which have HW bit set such as timer interrupts, we modify them to
  * have the host hardware interrupt number instead of the virtual one programmed
@@ -245,36 +278,35 @@ int vgic_register_gich_iodev(struct kvm *kvm, struct vgic_dist *dist)
 static void vgic_v2_create_shadow_lr(struct kvm_vcpu *vcpu)
 {
 	int i;
+	struct vgic_cpu *vgic_cpu = &vcpu->arch.vgic_cpu;
 	struct vgic_v2_cpu_if *cpu_if = vcpu_nested_if(vcpu);
 	struct vgic_v2_cpu_if *s_cpu_if = vcpu_shadow_if(vcpu);
-	struct vgic_irq *irq;
 
 	int nr_lr = kvm_vgic_global_state.nr_lr;
 
 	for (i = 0; i < nr_lr; i++) {
 		u32 lr = cpu_if->vgic_lr[i];
-		int l1_irq;
 
 		if (!(lr & GICH_LR_HW))
 			goto next;
 
 		/* We have the HW bit set */
-		l1_irq = (lr & GICH_LR_PHYSID_CPUID) >>
-			GICH_LR_PHYSID_CPUID_SHIFT;
-		irq = vgic_get_irq(vcpu->kvm, vcpu, l1_irq);
+		if (test_and_clear_bit(i, vgic_cpu->nested_lr_dirty)) {
+			/* Pairs with vgic_v2_nested_lrs_dirty() */
+			smp_mb__after_atomic();
+			vgic_v2_translate_nested_lr(vcpu, i, lr);
+		}
 
-		if (!irq->hw) {
+		if (!(vgic_cpu->nested_lr_mapped & BIT_ULL(i))) {
 			/* There was no real mapping, so nuke the HW bit */
 			lr &= ~GICH_LR_HW;
-			vgic_put_irq(vcpu->kvm, irq);
 			goto next;
 		}
 
 		/* Translate the virtual mapping to the real one */
 		lr &= ~GICH_LR_EOI;
 		lr &= ~GICH_LR_PHYSID_CPUID;
-		lr |= irq->hwintid << GICH_LR_PHYSID_CPUID_SHIFT;
-		vgic_put_irq(vcpu->kvm, irq);
+		lr |= vgic_cpu->nested_lr_physid[i];
 
 next:
 		s_cpu_if->vgic_lr[i] = lr;
@@ -282,21 +314,58 @@ static void vgic_v2_create_shadow_lr(struct kvm_vcpu *vcpu)
 }
 
 /*
- * Change the shadow HWIRQ field back to the virtual value before copying over
- * the entire shadow struct to the nested state.
+ * Change the shadow HW fields back to the virtual values before copying over
+ * the entire shadow struct to the nested state. Only LRs with the HW bit set
+ * were changed, the hardware doesn't touch these fields.
  */
 static void vgic_v2_restore_shadow_lr(struct kvm_vcpu *vcpu)
 {
 	struct vgic_v2_cpu_if *cpu_if = vcpu_nested_if(vcpu);
 	struct vgic_v2_cpu_if *s_cpu_if = vcpu_shadow_if(vcpu);
 	int nr_lr = kvm_vgic_global_state.nr_lr;
+	u32 mask = GICH_LR_HW | GICH_LR_PHYSID_CPUID;
 	int lr;
 
 	for (lr = 0; lr < nr_lr; lr++) {
-		s_cpu_if->vgic_lr[lr] &= ~GICH_LR_PHYSID_CPUID;
-		s_cpu_if->vgic_lr[lr] |= cpu_if->vgic_lr[lr] &
-			GICH_LR_PHYSID_CPUID;
+		if (!(cpu_if->vgic_lr[lr] & GICH_LR_HW))
+			continue;
+
+		s_cpu_if->vgic_lr[lr] &= ~mask;
+		s_cpu_if->vgic_lr[lr] |= cpu_if->vgic_lr[lr] & mask;
+	}
+}
+
+/*
+ * Mark all the nested LRs of @vcpu dirty. This can run on another CPU than
+ * the one translating them, so the bits are set atomically: a non-atomic
+ * store could undo a concurrent test_and_clear_bit(), or be undone by it.
+ */
+static void vgic_v2_nested_lrs_dirty(struct kvm_vcpu *vcpu)
+{
+	int i;
+
+	/* Order the new mapping before the dirty bits */
+	smp_mb__before_atomic();
+	for (i = 0; i < VGIC_V2_MAX_LRS; i++)
+		set_bit(i, vcpu->arch.vgic_cpu.nested_lr_dirty);
+}
+
+/*
+ * The HW mapping of @intid changed: translate the HW nested LRs of the vcpus
+ * that can see it again.
+ */
+void vgic_v2_nested_mapping_changed(struct kvm_vcpu *vcpu, u32 intid)
+{
+	struct kvm_vcpu *tmp;
+	int i;
+
+	if (intid < VGIC_NR_PRIVATE_IRQS) {
+		vgic_v2_nested_lrs_dirty(vcpu);
+		return;
 	}
+
+	kvm_for_each_vcpu(i, tmp, vcpu->kvm)
+		vgic_v2_nested_lrs_dirty(tmp);
 }
 
 void vgic_v2_setup_shadow_state(struct kvm_vcpu *vcpu)
@@ -313,6 +382,10 @@ void vgic_v2_setup_shadow_state(struct kvm_vcpu *vcpu)
 		vgic_cpu->shadow_vgic_v2 = vgic_cpu->nested_vgic_v2;
 		vgic_v2_create_shadow_lr(vcpu);
 		cpu_if = vcpu_shadow_if(vcpu);
+
+		if (unlikely(vgic_stats))
+			vgic_stats_nested(vcpu, kvm_vgic_global_state.nr_lr -
+					  hweight64(vgic_cpu->nested_elrsr));
 	} else {
 		cpu_if = &vgic_cpu->vgic_v2;
 	}
@@ -337,6 +410,7 @@ void vgic_v2_restore_shadow_state(struct kvm_vcpu *vcpu)
 	 */
 	vgic_v2_restore_shadow_lr(vcpu);
 	vgic_cpu->nested_vgic_v2 = vgic_cpu->shadow_vgic_v2;
+	vgic_v2_nested_lrs_changed(vcpu);
 }
 
 void vgic_handle_nested_maint_irq(struct kvm_vcpu *vcpu)
@@ -358,6 +432,38 @@ void vgic_handle_nested_maint_irq(struct kvm_vcpu *vcpu)
 		kvm_inject_nested_irq(vcpu);
 }
 
+/*
+ * Whether the nested VM has to be woken up from WFI by the state the guest
+ * hypervisor left in its list registers: a pending interrupt the nested VM
+ * can take, or a maintenance interrupt for the guest hypervisor itself. The
+ * running priority is ignored, a WFI with an interrupt active is unusual.
+ */
+bool vgic_v2_nested_irq_pending(struct kvm_vcpu *vcpu)
+{
+	struct vgic_v2_cpu_if *cpu_if = vcpu_nested_if(vcpu);
+	u32 vmcr = cpu_if->vgic_vmcr;
+	u32 pmr = (vmcr & GICH_VMCR_PRIMASK_MASK) >> GICH_VMCR_PRIMASK_SHIFT;
+	int i;
+
+	if (!(cpu_if->vgic_hcr & GICH_HCR_EN))
+		return false;
+
+	if (vgic_mmio_read_v2_misr(vcpu, 0, 0))
+		return true;
+
+	for (i = 0; i < kvm_vgic_global_state.nr_lr; i++) {
+		u32 lr = cpu_if->vgic_lr[i];
+		u32 enable = (lr & GICH_LR_GROUP1) ? GICH_VMCR_ENABLE_GRP1_MASK :
+						     GICH_VMCR_ENABLE_GRP0_MASK;
+
+		if ((lr & GICH_LR_PENDING_BIT) && (vmcr & enable) &&
+		    ((lr >> GICH_LR_PRIORITY_SHIFT) & 0x1f) < pmr)
+			return true;
+	}
+
+	return false;
+}
+
 void vgic_init_nested(struct kvm_vcpu *vcpu)
 {
 	struct vgic_cpu *vgic_cpu = &vcpu->arch.vgic_cpu;
@@ -367,5 +473,7 @@ void vgic_init_nested(struct kvm_vcpu *vcpu)
 		return;
 	}
 
+	bitmap_fill(vgic_cpu->nested_lr_dirty, VGIC_V2_MAX_LRS);
+	vgic_v2_nested_lrs_changed(vcpu);
 	vgic_v2_setup_shadow_state(vcpu);
 }
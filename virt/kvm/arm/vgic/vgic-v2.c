@@ -61,7 +61,9 @@ void vgic_v2_fold_lr_state(struct kvm_vcpu *vcpu)
 {
 	struct vgic_cpu *vgic_cpu = &vcpu->arch.vgic_cpu;
 	struct vgic_v2_cpu_if *cpuif = &vgic_cpu->vgic_v2;
-	int lr;
+	unsigned int acked[VGIC_V2_MAX_LRS];
+	int lr, nr_acked = 0;
+	unsigned long flags;
 
 	cpuif->vgic_hcr &= ~GICH_HCR_UIE;
 
@@ -72,16 +74,18 @@ void vgic_v2_fold_lr_state(struct kvm_vcpu *vcpu)
 
 		/* Notify fds when the guest EOI'ed a level-triggered SPI */
 		if (lr_signals_eoi_mi(val) && vgic_valid_spi(vcpu->kvm, intid))
-			kvm_notify_acked_irq(vcpu->kvm, 0,
-					     intid - VGIC_NR_PRIVATE_IRQS);
+			acked[nr_acked++] = intid - VGIC_NR_PRIVATE_IRQS;
 
 		irq = vgic_get_irq(vcpu->kvm, vcpu, intid);
 
-		spin_lock(&irq->irq_lock);
+		vgic_irq_lock_irqsave(vcpu, irq, flags);
 
 		/* Always preserve the active bit */
 		irq->active = !!(val & GICH_LR_ACTIVE_BIT);
 
+		if (!(val & GICH_LR_PENDING_BIT))
+			vgic_stats_acked(vcpu, irq);
+
 		/* Edge is the only case where we preserve the pending bit */
 		if (irq->config == VGIC_CONFIG_EDGE &&
 		    (val & GICH_LR_PENDING_BIT)) {
@@ -104,11 +108,14 @@ void vgic_v2_fold_lr_state(struct kvm_vcpu *vcpu)
 				irq->pending_latch = false;
 		}
 
-		spin_unlock(&irq->irq_lock);
+		raw_spin_unlock_irqrestore(&irq->irq_lock, flags);
 		vgic_put_irq(vcpu->kvm, irq);
 	}
 
 	vgic_cpu->used_lrs = 0;
+
+	if (nr_acked)
+		kvm_notify_acked_irqs(vcpu->kvm, 0, acked, nr_acked);
 }
 
 u32 vgic_v2_get_lr(struct kvm_vcpu *vcpu, int lr)
@@ -161,7 +168,7 @@ void vgic_v2_populate_lr(struct kvm_vcpu *vcpu, struct vgic_irq *irq, int lr)
 		if (irq->active && irq_is_pending(irq))
 			val &= ~GICH_LR_PENDING_BIT;
 	} else {
-		if (irq->config == VGIC_CONFIG_LEVEL)
+		if (vgic_irq_needs_eoi(vcpu->kvm, irq))
 			val |= GICH_LR_EOI;
 	}
 
@@ -0,0 +1,320 @@
+/*
+ * Copyright (C) 2017 - Linaro Ltd
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/kvm.h>
+#include <linux/kvm_host.h>
+
+#include <linux/irqchip/arm-gic-v3.h>
+
+#include <asm/kvm_emulate.h>
+#include <asm/kvm_arm.h>
+#include <kvm/arm_vgic.h>
+
+#include "vgic.h"
+
+/*
+ * The GICv3 flavour of vgic-v2-nested.c: the guest hypervisor programs its
+ * virtual CPU interface through trapped ICH_*_EL2 system register accesses,
+ * which read and write nested_vgic_v3. While a nested VM runs with the
+ * virtual IMO bit set, the hardware is loaded with shadow_vgic_v3 instead,
+ * a copy of it with the HW interrupt numbers translated.
+ */
+
+/* The traps the host sets for itself, see vgic_v3_enable() */
+#define ICH_HCR_HOST_TRAPS	(ICH_HCR_TC | ICH_HCR_TALL0 | ICH_HCR_TALL1 | \
+				 ICH_HCR_TDIR)
+
+static inline struct vgic_v3_cpu_if *vcpu_nested_if(struct kvm_vcpu *vcpu)
+{
+	return &vcpu->arch.vgic_cpu.nested_vgic_v3;
+}
+
+static inline struct vgic_v3_cpu_if *vcpu_shadow_if(struct kvm_vcpu *vcpu)
+{
+	return &vcpu->arch.vgic_cpu.shadow_vgic_v3;
+}
+
+/* Only a guest with a GICv3 sees a system register hypervisor interface */
+static inline bool vgic_v3_nested_in_use(struct kvm_vcpu *vcpu)
+{
+	return nested_virt_in_use(vcpu) &&
+	       vcpu->kvm->arch.vgic.vgic_model == KVM_DEV_TYPE_ARM_VGIC_V3;
+}
+
+static inline bool lr_triggers_eoi(u64 lr)
+{
+	return !(lr & (ICH_LR_STATE | ICH_LR_HW)) && (lr & ICH_LR_EOI);
+}
+
+u64 vgic_v3_nested_read_vtr(struct kvm_vcpu *vcpu)
+{
+	u64 vtr = kvm_vgic_global_state.ich_vtr_el2;
+
+	/* We don't emulate any locally generated SEIs */
+	vtr &= ~ICH_VTR_SEIS_MASK;
+
+	return vtr;
+}
+
+u32 vgic_v3_nested_read_eisr(struct kvm_vcpu *vcpu)
+{
+	struct vgic_v3_cpu_if *cpu_if = vcpu_nested_if(vcpu);
+	u32 reg = 0;
+	int i;
+
+	for (i = 0; i < kvm_vgic_global_state.nr_lr; i++) {
+		if (lr_triggers_eoi(cpu_if->vgic_lr[i]))
+			reg |= BIT(i);
+	}
+
+	return reg;
+}
+
+u32 vgic_v3_nested_read_elrsr(struct kvm_vcpu *vcpu)
+{
+	struct vgic_v3_cpu_if *cpu_if = vcpu_nested_if(vcpu);
+	u32 reg = 0;
+	int i;
+
+	for (i = 0; i < kvm_vgic_global_state.nr_lr; i++) {
+		u64 lr = cpu_if->vgic_lr[i];
+
+		if (!(lr & ICH_LR_STATE) && !lr_triggers_eoi(lr))
+			reg |= BIT(i);
+	}
+
+	return reg;
+}
+
+u32 vgic_v3_nested_read_misr(struct kvm_vcpu *vcpu)
+{
+	struct vgic_v3_cpu_if *cpu_if = vcpu_nested_if(vcpu);
+	int nr_lr = kvm_vgic_global_state.nr_lr;
+	u32 hcr = cpu_if->vgic_hcr;
+	u32 vmcr = cpu_if->vgic_vmcr;
+	bool pending = false;
+	int i, valid = 0;
+	u32 reg = 0;
+
+	for (i = 0; i < nr_lr; i++) {
+		u64 lr = cpu_if->vgic_lr[i];
+
+		if (lr & ICH_LR_STATE)
+			valid++;
+		if ((lr & ICH_LR_STATE) == ICH_LR_PENDING_BIT)
+			pending = true;
+	}
+
+	if (vgic_v3_nested_read_eisr(vcpu))
+		reg |= ICH_MISR_EOI;
+
+	if ((hcr & ICH_HCR_UIE) && valid <= 1)
+		reg |= ICH_MISR_U;
+
+	if ((hcr & ICH_HCR_LRENPIE) && (hcr & ICH_HCR_EOIcount_MASK))
+		reg |= ICH_MISR_LRENP;
+
+	if ((hcr & ICH_HCR_NPIE) && !pending)
+		reg |= ICH_MISR_NP;
+
+	if ((hcr & ICH_HCR_VGRP0EIE) && (vmcr & ICH_VMCR_ENG0_MASK))
+		reg |= ICH_MISR_VGRP0E;
+
+	if ((hcr & ICH_HCR_VGRP0DIE) && !(vmcr & ICH_VMCR_ENG0_MASK))
+		reg |= ICH_MISR_VGRP0D;
+
+	if ((hcr & ICH_HCR_VGRP1EIE) && (vmcr & ICH_VMCR_ENG1_MASK))
+		reg |= ICH_MISR_VGRP1E;
+
+	if ((hcr & ICH_HCR_VGRP1DIE) && !(vmcr & ICH_VMCR_ENG1_MASK))
+		reg |= ICH_MISR_VGRP1D;
+
+	return reg;
+}
+
+/*
+ * For LRs which have HW bit set such as timer interrupts, we modify them to
+ * have the host hardware interrupt number instead of the virtual one programmed
+ * by the guest hypervisor.
+ */
+static void vgic_v3_create_shadow_lr(struct kvm_vcpu *vcpu)
+{
+	struct vgic_v3_cpu_if *cpu_if = vcpu_nested_if(vcpu);
+	struct vgic_v3_cpu_if *s_cpu_if = vcpu_shadow_if(vcpu);
+	int nr_lr = kvm_vgic_global_state.nr_lr;
+	struct vgic_irq *irq;
+	int i;
+
+	for (i = 0; i < nr_lr; i++) {
+		u64 lr = cpu_if->vgic_lr[i];
+		int l1_irq;
+
+		if (!(lr & ICH_LR_HW))
+			goto next;
+
+		/* We have the HW bit set */
+		l1_irq = (lr & ICH_LR_PHYS_ID_MASK) >> ICH_LR_PHYS_ID_SHIFT;
+		irq = vgic_get_irq(vcpu->kvm, vcpu, l1_irq);
+
+		if (!irq || !irq->hw) {
+			/*
+			 * There was no real mapping, so nuke the HW bit, and
+			 * the pINTID with it as that field holds EOI otherwise.
+			 */
+			lr &= ~(ICH_LR_HW | ICH_LR_PHYS_ID_MASK);
+			if (irq)
+				vgic_put_irq(vcpu->kvm, irq);
+			goto next;
+		}
+
+		/* Translate the virtual mapping to the real one */
+		lr &= ~ICH_LR_PHYS_ID_MASK;
+		lr |= (u64)irq->hwintid << ICH_LR_PHYS_ID_SHIFT;
+		vgic_put_irq(vcpu->kvm, irq);
+
+next:
+		s_cpu_if->vgic_lr[i] = lr;
+	}
+}
+
+/*
+ * Change the shadow HW fields back to the virtual values before copying over
+ * the entire shadow struct to the nested state.
+ */
+static void vgic_v3_restore_shadow_lr(struct kvm_vcpu *vcpu)
+{
+	struct vgic_v3_cpu_if *cpu_if = vcpu_nested_if(vcpu);
+	struct vgic_v3_cpu_if *s_cpu_if = vcpu_shadow_if(vcpu);
+	int nr_lr = kvm_vgic_global_state.nr_lr;
+	u64 mask = ICH_LR_HW | ICH_LR_PHYS_ID_MASK;
+	int lr;
+
+	for (lr = 0; lr < nr_lr; lr++) {
+		s_cpu_if->vgic_lr[lr] &= ~mask;
+		s_cpu_if->vgic_lr[lr] |= cpu_if->vgic_lr[lr] & mask;
+	}
+}
+
+void vgic_v3_setup_shadow_state(struct kvm_vcpu *vcpu)
+{
+	struct vgic_cpu *vgic_cpu = &vcpu->arch.vgic_cpu;
+	struct vgic_v3_cpu_if *cpu_if;
+
+	if (vgic_v3_nested_in_use(vcpu) &&
+	    vcpu_el2_imo_is_set(vcpu) && !vcpu_mode_el2(vcpu)) {
+		vgic_cpu->shadow_vgic_v3 = vgic_cpu->nested_vgic_v3;
+		/* The nested VM uses the same system register interface */
+		vgic_cpu->shadow_vgic_v3.vgic_sre = vgic_cpu->vgic_v3.vgic_sre;
+		/* Nor does it get out of the traps the host relies on */
+		vgic_cpu->shadow_vgic_v3.vgic_hcr |= vgic_cpu->vgic_v3.vgic_hcr &
+						     ICH_HCR_HOST_TRAPS;
+		vgic_v3_create_shadow_lr(vcpu);
+		cpu_if = vcpu_shadow_if(vcpu);
+
+		if (unlikely(vgic_stats)) {
+			u32 elrsr = vgic_v3_nested_read_elrsr(vcpu);
+
+			vgic_stats_nested(vcpu, kvm_vgic_global_state.nr_lr -
+					  hweight32(elrsr));
+		}
+
+		/*
+		 * A resident vPE would signal the vLPIs of the guest
+		 * hypervisor to the nested VM. Rely on the doorbell instead.
+		 */
+		WARN_ON(vgic_v4_put(vcpu, true));
+	} else {
+		cpu_if = &vgic_cpu->vgic_v3;
+		WARN_ON(vgic_v4_load(vcpu));
+	}
+
+	vgic_cpu->hw_v3_cpu_if = cpu_if;
+}
+
+void vgic_v3_restore_shadow_state(struct kvm_vcpu *vcpu)
+{
+	struct vgic_cpu *vgic_cpu = &vcpu->arch.vgic_cpu;
+	u32 hcr = vgic_cpu->nested_vgic_v3.vgic_hcr;
+
+	/* Not using shadow state: Nothing to do... */
+	if (vgic_cpu->hw_v3_cpu_if == &vgic_cpu->vgic_v3)
+		return;
+
+	/*
+	 * Translate the shadow state HW fields back to the virtual ones
+	 * before copying the shadow struct back to the nested one.
+	 */
+	vgic_v3_restore_shadow_lr(vcpu);
+	vgic_cpu->nested_vgic_v3 = vgic_cpu->shadow_vgic_v3;
+	/* Without the host traps, which the hardware doesn't change */
+	vgic_cpu->nested_vgic_v3.vgic_hcr = hcr;
+}
+
+void vgic_v3_handle_nested_maint_irq(struct kvm_vcpu *vcpu)
+{
+	struct vgic_v3_cpu_if *cpu_if = vcpu_nested_if(vcpu);
+	struct its_vpe *vpe = &vcpu->arch.vgic_cpu.its_vpe;
+
+	if (!vgic_v3_nested_in_use(vcpu))
+		return;
+
+	/*
+	 * If we exit a nested VM with a pending maintenance interrupt from the
+	 * GIC, then we need to forward this to the guest hypervisor so that it
+	 * can re-sync the appropriate LRs and sample level triggered interrupts
+	 * again.
+	 */
+	if (vcpu_el2_imo_is_set(vcpu) && !vcpu_mode_el2(vcpu) &&
+	    (cpu_if->vgic_hcr & ICH_HCR_EN) &&
+	    vgic_v3_nested_read_misr(vcpu))
+		kvm_inject_nested_irq(vcpu);
+
+	/*
+	 * The same goes for a vLPI that rang the doorbell of the vPE, which
+	 * is put while the nested VM runs: only the guest hypervisor can
+	 * take it.
+	 */
+	if (vcpu_el2_imo_is_set(vcpu) && !vcpu_mode_el2(vcpu) &&
+	    !vpe->resident && vpe->pending_last)
+		kvm_inject_nested_irq(vcpu);
+}
+
+/* See vgic_v2_nested_irq_pending() */
+bool vgic_v3_nested_irq_pending(struct kvm_vcpu *vcpu)
+{
+	struct vgic_v3_cpu_if *cpu_if = vcpu_nested_if(vcpu);
+	u32 vmcr = cpu_if->vgic_vmcr;
+	u64 pmr = (vmcr & ICH_VMCR_PMR_MASK) >> ICH_VMCR_PMR_SHIFT;
+	int i;
+
+	if (!vgic_v3_nested_in_use(vcpu) || !(cpu_if->vgic_hcr & ICH_HCR_EN))
+		return false;
+
+	if (vgic_v3_nested_read_misr(vcpu))
+		return true;
+
+	for (i = 0; i < kvm_vgic_global_state.nr_lr; i++) {
+		u64 lr = cpu_if->vgic_lr[i];
+		u32 enable = (lr & ICH_LR_GROUP) ? ICH_VMCR_ENG1_MASK :
+						   ICH_VMCR_ENG0_MASK;
+
+		if ((lr & ICH_LR_PENDING_BIT) && (vmcr & enable) &&
+		    ((lr & ICH_LR_PRIORITY_MASK) >> ICH_LR_PRIORITY_SHIFT) < pmr)
+			return true;
+	}
+
+	return false;
+}
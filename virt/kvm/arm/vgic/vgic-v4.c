@@ -0,0 +1,352 @@
+/*
+ * Copyright (C) 2017 - Linaro Ltd
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/interrupt.h>
+#include <linux/irq.h>
+#include <linux/irqdomain.h>
+#include <linux/kvm_host.h>
+#include <linux/irqchip/arm-gic-v3.h>
+
+#include "vgic.h"
+
+/*
+ * With GICv4, an MSI of a device assigned to the guest is delivered by
+ * the host ITS straight to the target vcpu, as a vLPI, instead of being
+ * taken by the host and injected by KVM.
+ *
+ * Each vcpu gets a vPE, which is made resident on the physical CPU the
+ * vcpu runs on, so that its vLPIs are signalled to it. When the vcpu
+ * blocks, the vPE is made non-resident with its doorbell enabled: a vLPI
+ * then raises the doorbell, which wakes the vcpu up. When the vcpu is
+ * only preempted, the doorbell isn't needed, as it is runnable anyway.
+ *
+ * The vLPIs live in the guest's view of the ITS, and all the ITS commands
+ * affecting a forwarded LPI are replayed on the host ITS: property
+ * updates, invalidations, moves and unmaps.
+ *
+ * Direct injection is only used for the vcpus' own LPIs: a nested guest
+ * runs on the same hardware interface, so the vPE is put, with its
+ * doorbell, while it does.
+ */
+
+static bool vgic_v4_enable;
+
+static int __init early_vgic_v4_enable(char *buf)
+{
+	return strtobool(buf, &vgic_v4_enable);
+}
+early_param("kvm-arm.vgic_v4_enable", early_vgic_v4_enable);
+
+bool vgic_v4_enabled(void)
+{
+	return vgic_v4_enable;
+}
+
+static irqreturn_t vgic_v4_doorbell_handler(int irq, void *info)
+{
+	struct kvm_vcpu *vcpu = info;
+
+	/* The doorbell is enabled again when the vcpu blocks next time */
+	if (!irqd_irq_disabled(&irq_to_desc(irq)->irq_data))
+		disable_irq_nosync(irq);
+
+	vcpu->arch.vgic_cpu.its_vpe.pending_last = true;
+	kvm_make_request(KVM_REQ_IRQ_PENDING, vcpu);
+	kvm_vcpu_kick(vcpu);
+
+	return IRQ_HANDLED;
+}
+
+/**
+ * vgic_v4_init - Initialize the GICv4 data structures
+ * @kvm:	Pointer to the VM being initialized
+ *
+ * We may be called each time a vITS is created, or when the
+ * vgic is initialized. This relies on kvm->lock to be
+ * held. In both cases, the number of vcpus should now be
+ * fixed.
+ */
+int vgic_v4_init(struct kvm *kvm)
+{
+	struct vgic_dist *dist = &kvm->arch.vgic;
+	struct kvm_vcpu *vcpu;
+	int i, nr_vcpus, ret;
+
+	if (dist->its_vm.vpes)
+		return 0;
+
+	nr_vcpus = atomic_read(&kvm->online_vcpus);
+
+	dist->its_vm.vpes = kcalloc(nr_vcpus, sizeof(*dist->its_vm.vpes),
+				    GFP_KERNEL);
+	if (!dist->its_vm.vpes)
+		return -ENOMEM;
+
+	dist->its_vm.nr_vpes = nr_vcpus;
+
+	kvm_for_each_vcpu(i, vcpu, kvm)
+		dist->its_vm.vpes[i] = &vcpu->arch.vgic_cpu.its_vpe;
+
+	ret = its_alloc_vcpu_irqs(&dist->its_vm);
+	if (ret < 0) {
+		kvm_err("VPE IRQ allocation failure\n");
+		kfree(dist->its_vm.vpes);
+		dist->its_vm.nr_vpes = 0;
+		dist->its_vm.vpes = NULL;
+		return ret;
+	}
+
+	kvm_for_each_vcpu(i, vcpu, kvm) {
+		int irq = dist->its_vm.vpes[i]->irq;
+
+		/*
+		 * Don't automatically enable the doorbell, as we're
+		 * flipping it back and forth when the vcpu gets
+		 * blocked. Also disable the lazy disabling, as the
+		 * doorbell could kick us out of the guest too
+		 * early...
+		 */
+		irq_set_status_flags(irq, IRQ_NOAUTOEN | IRQ_DISABLE_UNLAZY);
+		ret = request_irq(irq, vgic_v4_doorbell_handler, 0, "vcpu", vcpu);
+		if (ret) {
+			kvm_err("failed to allocate vcpu IRQ%d\n", irq);
+			break;
+		}
+	}
+
+	if (ret) {
+		while (--i >= 0)
+			free_irq(dist->its_vm.vpes[i]->irq,
+				 kvm_get_vcpu(kvm, i));
+		its_free_vcpu_irqs(&dist->its_vm);
+		kfree(dist->its_vm.vpes);
+		dist->its_vm.nr_vpes = 0;
+		dist->its_vm.vpes = NULL;
+	}
+
+	return ret;
+}
+
+/**
+ * vgic_v4_teardown - Free the GICv4 data structures
+ * @kvm:	Pointer to the VM being destroyed
+ *
+ * Relies on kvm->lock to be held.
+ */
+void vgic_v4_teardown(struct kvm *kvm)
+{
+	struct its_vm *its_vm = &kvm->arch.vgic.its_vm;
+	int i;
+
+	if (!its_vm->vpes)
+		return;
+
+	for (i = 0; i < its_vm->nr_vpes; i++)
+		free_irq(its_vm->vpes[i]->irq, kvm_get_vcpu(kvm, i));
+
+	its_free_vcpu_irqs(its_vm);
+	kfree(its_vm->vpes);
+	its_vm->nr_vpes = 0;
+	its_vm->vpes = NULL;
+}
+
+/*
+ * Makes the vPE of @vcpu resident on the local CPU. Must be called with
+ * preemption disabled, and is a no-op while the vcpu blocks.
+ */
+int vgic_v4_load(struct kvm_vcpu *vcpu)
+{
+	struct its_vpe *vpe = &vcpu->arch.vgic_cpu.its_vpe;
+	int ret;
+
+	if (!vgic_supports_direct_msis(vcpu->kvm) || !vpe->its_vm ||
+	    vpe->resident || vcpu->arch.vgic_cpu.vpe_blocked)
+		return 0;
+
+	/* The vPE is mapped to the redistributor its doorbell targets */
+	ret = irq_set_affinity(vpe->irq, cpumask_of(smp_processor_id()));
+	if (ret)
+		return ret;
+
+	ret = its_make_vpe_resident(vpe);
+	if (ret)
+		return ret;
+
+	/*
+	 * Now that the vPE is resident, get rid of a potential doorbell
+	 * interrupt that would still be pending, and of the doorbell itself.
+	 */
+	if (!irqd_irq_disabled(&irq_to_desc(vpe->irq)->irq_data))
+		disable_irq_nosync(vpe->irq);
+
+	return irq_set_irqchip_state(vpe->irq, IRQCHIP_STATE_PENDING, false);
+}
+
+/*
+ * Makes the vPE of @vcpu non-resident, with its doorbell enabled if
+ * @need_db. Must be called with preemption disabled.
+ */
+int vgic_v4_put(struct kvm_vcpu *vcpu, bool need_db)
+{
+	struct its_vpe *vpe = &vcpu->arch.vgic_cpu.its_vpe;
+
+	if (!vgic_supports_direct_msis(vcpu->kvm) || !vpe->its_vm ||
+	    !vpe->resident)
+		return 0;
+
+	return its_make_vpe_non_resident(vpe, need_db);
+}
+
+void kvm_vgic_v4_enable_doorbell(struct kvm_vcpu *vcpu)
+{
+	if (!vgic_supports_direct_msis(vcpu->kvm))
+		return;
+
+	preempt_disable();
+	vcpu->arch.vgic_cpu.vpe_blocked = true;
+	WARN_ON(vgic_v4_put(vcpu, true));
+	preempt_enable();
+}
+
+void kvm_vgic_v4_disable_doorbell(struct kvm_vcpu *vcpu)
+{
+	if (!vgic_supports_direct_msis(vcpu->kvm))
+		return;
+
+	preempt_disable();
+	vcpu->arch.vgic_cpu.vpe_blocked = false;
+	WARN_ON(vgic_v4_load(vcpu));
+	preempt_enable();
+}
+
+static struct vgic_its *vgic_get_its(struct kvm *kvm,
+				     struct kvm_kernel_irq_routing_entry *irq_entry)
+{
+	struct kvm_msi msi  = (struct kvm_msi) {
+		.address_lo	= irq_entry->msi.address_lo,
+		.address_hi	= irq_entry->msi.address_hi,
+		.data		= irq_entry->msi.data,
+		.flags		= irq_entry->msi.flags,
+		.devid		= irq_entry->msi.devid,
+	};
+
+	return vgic_msi_to_its(kvm, &msi);
+}
+
+/**
+ * kvm_vgic_v4_set_forwarding - Forward an MSI to the guest as a vLPI
+ * @kvm:	Pointer to the VM
+ * @virq:	Host interrupt of the assigned device's MSI
+ * @irq_entry:	Guest routing entry of that MSI
+ *
+ * Replaces the host's physical LPI mapping with a vLPI of the vcpu the
+ * guest's ITS currently targets. The LPI must already be mapped by the
+ * guest, or nothing is forwarded and the MSI keeps going through the
+ * irqfd.
+ */
+int kvm_vgic_v4_set_forwarding(struct kvm *kvm, int virq,
+			       struct kvm_kernel_irq_routing_entry *irq_entry)
+{
+	struct vgic_its *its;
+	struct vgic_irq *irq;
+	struct its_vlpi_map map;
+	bool pending;
+	int ret;
+	unsigned long flags;
+
+	if (!vgic_supports_direct_msis(kvm))
+		return 0;
+
+	its = vgic_get_its(kvm, irq_entry);
+	if (IS_ERR(its))
+		return 0;
+
+	mutex_lock(&its->its_lock);
+
+	ret = vgic_its_resolve_lpi(kvm, its, irq_entry->msi.devid,
+				   irq_entry->msi.data, &irq);
+	if (ret)
+		goto out;
+
+	map = (struct its_vlpi_map) {
+		.vm		= &kvm->arch.vgic.its_vm,
+		.vpe		= &irq->target_vcpu->arch.vgic_cpu.its_vpe,
+		.vintid		= irq->intid,
+		.properties	= ((irq->priority & 0xfc) |
+				   (irq->enabled ? LPI_PROP_ENABLED : 0) |
+				   LPI_PROP_GROUP1),
+		.db_enabled	= true,
+	};
+
+	ret = its_map_vlpi(virq, &map);
+	if (ret)
+		goto out;
+
+	/* Injections now go through the host ITS, pending state included */
+	raw_spin_lock_irqsave(&irq->irq_lock, flags);
+	irq->hw = true;
+	irq->host_irq = virq;
+	pending = irq->pending_latch;
+	irq->pending_latch = false;
+	raw_spin_unlock_irqrestore(&irq->irq_lock, flags);
+
+	if (pending)
+		ret = irq_set_irqchip_state(virq, IRQCHIP_STATE_PENDING, true);
+
+out:
+	mutex_unlock(&its->its_lock);
+	return ret;
+}
+
+/**
+ * kvm_vgic_v4_unset_forwarding - Stop forwarding an MSI to the guest
+ * @kvm:	Pointer to the VM
+ * @virq:	Host interrupt of the assigned device's MSI
+ * @irq_entry:	Guest routing entry of that MSI
+ *
+ * Restores the host's physical LPI mapping of @virq.
+ */
+int kvm_vgic_v4_unset_forwarding(struct kvm *kvm, int virq,
+				 struct kvm_kernel_irq_routing_entry *irq_entry)
+{
+	struct vgic_its *its;
+	struct vgic_irq *irq;
+	int ret;
+
+	if (!vgic_supports_direct_msis(kvm))
+		return 0;
+
+	its = vgic_get_its(kvm, irq_entry);
+	if (IS_ERR(its))
+		return 0;
+
+	mutex_lock(&its->its_lock);
+
+	ret = vgic_its_resolve_lpi(kvm, its, irq_entry->msi.devid,
+				   irq_entry->msi.data, &irq);
+	if (ret)
+		goto out;
+
+	if (!irq->hw || irq->host_irq != virq)
+		goto out;
+
+	irq->hw = false;
+	ret = its_unmap_vlpi(virq);
+
+out:
+	mutex_unlock(&its->its_lock);
+	return ret;
+}
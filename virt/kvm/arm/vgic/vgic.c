@@ -16,7 +16,6 @@
 
 #include <linux/kvm.h>
 #include <linux/kvm_host.h>
-#include <linux/list_sort.h>
 #include <asm/kvm_emulate.h>
 #include <linux/irqchip/arm-gic.h>
 
@@ -53,8 +52,12 @@ struct vgic_global kvm_vgic_global_state __ro_after_init = {
  * When taking more than one ap_list_lock at the same time, always take the
  * lowest numbered VCPU's ap_list_lock first, so:
  *   vcpuX->vcpu_id < vcpuY->vcpu_id:
- *     spin_lock(vcpuX->arch.vgic_cpu.ap_list_lock);
- *     spin_lock(vcpuY->arch.vgic_cpu.ap_list_lock);
+ *     raw_spin_lock(vcpuX->arch.vgic_cpu.ap_list_lock);
+ *     raw_spin_lock(vcpuY->arch.vgic_cpu.ap_list_lock);
+ *
+ * The spinlocks are raw and always taken with interrupts disabled, since
+ * an irqfd injects MSIs from its wakeup, under the hardirq safe eventfd
+ * wait queue lock: see kvm_arch_set_irq_inatomic().
  */
 
 /*
@@ -64,11 +67,16 @@ struct vgic_global kvm_vgic_global_state __ro_after_init = {
 static struct vgic_irq *vgic_get_lpi(struct kvm *kvm, u32 intid)
 {
 	struct vgic_dist *dist = &kvm->arch.vgic;
-	struct vgic_irq *irq = NULL;
+	struct vgic_irq *irq;
 
-	spin_lock(&dist->lpi_list_lock);
+	/*
+	 * The lookup doesn't take the lpi_list_lock: the list is RCU
+	 * protected, and an LPI whose last reference is being dropped is
+	 * skipped, see vgic_put_irq().
+	 */
+	rcu_read_lock();
 
-	list_for_each_entry(irq, &dist->lpi_list_head, lpi_list) {
+	list_for_each_entry_rcu(irq, &dist->lpi_list_head, lpi_list) {
 		if (irq->intid != intid)
 			continue;
 
@@ -76,13 +84,14 @@ static struct vgic_irq *vgic_get_lpi(struct kvm *kvm, u32 intid)
 		 * This increases the refcount, the caller is expected to
 		 * call vgic_put_irq() later once it's finished with the IRQ.
 		 */
-		vgic_get_irq_kref(irq);
-		goto out_unlock;
+		if (kref_get_unless_zero(&irq->refcount))
+			goto out_unlock;
+		break;
 	}
 	irq = NULL;
 
 out_unlock:
-	spin_unlock(&dist->lpi_list_lock);
+	rcu_read_unlock();
 
 	return irq;
 }
@@ -113,8 +122,9 @@ struct vgic_irq *vgic_get_irq(struct kvm *kvm, struct kvm_vcpu *vcpu,
 
 /*
  * We can't do anything in here, because we lack the kvm pointer to
- * lock and remove the item from the lpi_list. So we keep this function
- * empty and use the return value of kref_put() to trigger the freeing.
+ * remove the item from the lpi_list. So we keep this function empty
+ * and use the return value of kref_put() to trigger the freeing,
+ * the lpi_list_lock being then held.
  */
 static void vgic_irq_release(struct kref *ref)
 {
@@ -123,21 +133,30 @@ static void vgic_irq_release(struct kref *ref)
 void vgic_put_irq(struct kvm *kvm, struct vgic_irq *irq)
 {
 	struct vgic_dist *dist = &kvm->arch.vgic;
+	unsigned long flags;
 
 	if (irq->intid < VGIC_MIN_LPI)
 		return;
 
-	spin_lock(&dist->lpi_list_lock);
+	/*
+	 * Only the last reference is dropped with the lpi_list_lock held,
+	 * so lock holders never find an LPI with a zero refcount. This is
+	 * kref_put_lock(), which has no raw spinlock flavour.
+	 */
+	if (refcount_dec_not_one(&irq->refcount.refcount))
+		return;
+
+	raw_spin_lock_irqsave(&dist->lpi_list_lock, flags);
 	if (!kref_put(&irq->refcount, vgic_irq_release)) {
-		spin_unlock(&dist->lpi_list_lock);
+		raw_spin_unlock_irqrestore(&dist->lpi_list_lock, flags);
 		return;
-	};
+	}
 
-	list_del(&irq->lpi_list);
+	list_del_rcu(&irq->lpi_list);
 	dist->lpi_list_count--;
-	spin_unlock(&dist->lpi_list_lock);
+	raw_spin_unlock_irqrestore(&dist->lpi_list_lock, flags);
 
-	kfree(irq);
+	kfree_rcu(irq, rcu);
 }
 
 /**
@@ -153,7 +172,7 @@ void vgic_put_irq(struct kvm *kvm, struct vgic_irq *irq)
  */
 static struct kvm_vcpu *vgic_target_oracle(struct vgic_irq *irq)
 {
-	DEBUG_SPINLOCK_BUG_ON(!spin_is_locked(&irq->irq_lock));
+	DEBUG_SPINLOCK_BUG_ON(!raw_spin_is_locked(&irq->irq_lock));
 
 	/* If the interrupt is active, it must stay on the current vcpu */
 	if (irq->active)
@@ -191,48 +210,75 @@ static struct kvm_vcpu *vgic_target_oracle(struct vgic_irq *irq)
  * Otherwise things should be sorted by the priority field and the GIC
  * hardware support will take care of preemption of priority groups etc.
  *
- * Return negative if "a" sorts before "b", 0 to preserve order, and positive
- * to sort "b" before "a".
+ * Return the sort key of an IRQ, lower keys going first. Must be called with
+ * the irq_lock held.
  */
-static int vgic_irq_cmp(void *priv, struct list_head *a, struct list_head *b)
+static u16 vgic_irq_sort_key(struct vgic_irq *irq)
 {
-	struct vgic_irq *irqa = container_of(a, struct vgic_irq, ap_list);
-	struct vgic_irq *irqb = container_of(b, struct vgic_irq, ap_list);
-	bool penda, pendb;
-	int ret;
-
-	spin_lock(&irqa->irq_lock);
-	spin_lock_nested(&irqb->irq_lock, SINGLE_DEPTH_NESTING);
-
-	if (irqa->active || irqb->active) {
-		ret = (int)irqb->active - (int)irqa->active;
-		goto out;
-	}
-
-	penda = irqa->enabled && irq_is_pending(irqa);
-	pendb = irqb->enabled && irq_is_pending(irqb);
+	if (irq->active)
+		return 0;
 
-	if (!penda || !pendb) {
-		ret = (int)pendb - (int)penda;
-		goto out;
-	}
+	if (irq->enabled && irq_is_pending(irq))
+		return 1 + irq->priority;
 
-	/* Both pending and enabled, sort by priority */
-	ret = irqa->priority - irqb->priority;
-out:
-	spin_unlock(&irqb->irq_lock);
-	spin_unlock(&irqa->irq_lock);
-	return ret;
+	return U16_MAX;
 }
 
-/* Must be called with the ap_list_lock held */
-static void vgic_sort_ap_list(struct kvm_vcpu *vcpu)
+/*
+ * Only the first nr_lr entries of the ap_list make it into the LRs, so
+ * there is no need to sort the whole list. Pick the nr_lr IRQs with the
+ * lowest sort keys in a single pass, keeping the list order between equal
+ * keys, and move them to the head of the list.
+ *
+ * Returns the number of LRs the ap_list needs, SGIs with several sources
+ * counting for more than one. Nothing is moved if they all fit.
+ *
+ * Must be called with the ap_list_lock held.
+ */
+static int vgic_sort_ap_list(struct kvm_vcpu *vcpu)
 {
 	struct vgic_cpu *vgic_cpu = &vcpu->arch.vgic_cpu;
+	int nr_lr = kvm_vgic_global_state.nr_lr;
+	struct vgic_irq *top[VGIC_V2_MAX_LRS];
+	u16 keys[VGIC_V2_MAX_LRS];
+	struct vgic_irq *irq;
+	int count = 0;
+	int nr = 0;
+	int i;
+
+	DEBUG_SPINLOCK_BUG_ON(!raw_spin_is_locked(&vgic_cpu->ap_list_lock));
+
+	list_for_each_entry(irq, &vgic_cpu->ap_list_head, ap_list) {
+		u16 key;
+
+		raw_spin_lock(&irq->irq_lock);
+		/* GICv2 SGIs can count for more than one... */
+		if (vgic_irq_is_sgi(irq->intid) && irq->source)
+			count += hweight8(irq->source);
+		else
+			count++;
+		key = vgic_irq_sort_key(irq);
+		raw_spin_unlock(&irq->irq_lock);
+
+		if (nr == nr_lr && key >= keys[nr - 1])
+			continue;
+
+		/* Insert after the selected IRQs with the same key */
+		i = (nr < nr_lr) ? nr++ : nr - 1;
+		for (; i > 0 && keys[i - 1] > key; i--) {
+			keys[i] = keys[i - 1];
+			top[i] = top[i - 1];
+		}
+		keys[i] = key;
+		top[i] = irq;
+	}
 
-	DEBUG_SPINLOCK_BUG_ON(!spin_is_locked(&vgic_cpu->ap_list_lock));
+	if (count > nr_lr) {
+		for (i = nr - 1; i >= 0; i--)
+			list_move(&top[i]->ap_list, &vgic_cpu->ap_list_head);
+	}
 
-	list_sort(NULL, &vgic_cpu->ap_list_head, vgic_irq_cmp);
+	return count;
 }
 
 /*
@@ -260,14 +306,38 @@ static bool vgic_validate_injection(struct vgic_irq *irq, bool level, void *owne
  * Do the queuing if necessary, taking the right locks in the right order.
  * Returns true when the IRQ was queued, false otherwise.
  *
- * Needs to be entered with the IRQ lock already held, but will return
- * with all locks dropped.
+ * Needs to be entered with the IRQ lock already held, taken with
+ * raw_spin_lock_irqsave() and @flags, but will return with all locks
+ * dropped and interrupts restored.
  */
-bool vgic_queue_irq_unlock(struct kvm *kvm, struct vgic_irq *irq)
+/*
+ * Whether the guest's EOI of @irq should raise a maintenance interrupt,
+ * which is only the case for a level interrupt that is still asserted, so
+ * that it gets pending again straight away, or whose SPI is resampled by
+ * an irqfd. Otherwise the LR deactivates it on its own and the guest
+ * doesn't have to exit. Called with the irq_lock held.
+ */
+bool vgic_irq_needs_eoi(struct kvm *kvm, struct vgic_irq *irq)
+{
+	if (irq->config != VGIC_CONFIG_LEVEL || irq->hw)
+		return false;
+
+	if (irq->line_level)
+		return true;
+
+	if (!vgic_valid_spi(kvm, irq->intid) ||
+	    hlist_empty(&kvm->irq_ack_notifier_list))
+		return false;
+
+	return kvm_irq_has_notifier(kvm, 0, irq->intid - VGIC_NR_PRIVATE_IRQS);
+}
+
+bool vgic_queue_irq_unlock(struct kvm *kvm, struct vgic_irq *irq,
+			   unsigned long flags)
 {
 	struct kvm_vcpu *vcpu;
 
-	DEBUG_SPINLOCK_BUG_ON(!spin_is_locked(&irq->irq_lock));
+	DEBUG_SPINLOCK_BUG_ON(!raw_spin_is_locked(&irq->irq_lock));
 
 retry:
 	vcpu = vgic_target_oracle(irq);
@@ -281,14 +351,15 @@ bool vgic_queue_irq_unlock(struct kvm *kvm, struct vgic_irq *irq)
 		 * not need to be inserted into an ap_list and there is also
 		 * no more work for us to do.
 		 */
-		spin_unlock(&irq->irq_lock);
+		raw_spin_unlock_irqrestore(&irq->irq_lock, flags);
 
 		/*
 		 * We have to kick the VCPU here, because we could be
-		 * queueing an edge-triggered interrupt for which we
-		 * get no EOI maintenance interrupt. In that case,
-		 * while the IRQ is already on the VCPU's AP list, the
-		 * VCPU could have EOI'ed the original interrupt and
+		 * queueing an edge-triggered interrupt, or a level one
+		 * whose EOI we didn't ask to see (vgic_irq_needs_eoi()),
+		 * for which we get no EOI maintenance interrupt. In that
+		 * case, while the IRQ is already on the VCPU's AP list,
+		 * the VCPU could have EOI'ed the original interrupt and
 		 * won't see this one until it exits for some other
 		 * reason.
 		 */
@@ -303,12 +374,12 @@ bool vgic_queue_irq_unlock(struct kvm *kvm, struct vgic_irq *irq)
 	 * We must unlock the irq lock to take the ap_list_lock where
 	 * we are going to insert this new pending interrupt.
 	 */
-	spin_unlock(&irq->irq_lock);
+	raw_spin_unlock_irqrestore(&irq->irq_lock, flags);
 
 	/* someone can do stuff here, which we re-check below */
 
-	spin_lock(&vcpu->arch.vgic_cpu.ap_list_lock);
-	spin_lock(&irq->irq_lock);
+	vgic_ap_list_lock_irqsave(vcpu, flags);
+	raw_spin_lock(&irq->irq_lock);
 
 	/*
 	 * Did something change behind our backs?
@@ -323,10 +394,11 @@ bool vgic_queue_irq_unlock(struct kvm *kvm, struct vgic_irq *irq)
 	 */
 
 	if (unlikely(irq->vcpu || vcpu != vgic_target_oracle(irq))) {
-		spin_unlock(&irq->irq_lock);
-		spin_unlock(&vcpu->arch.vgic_cpu.ap_list_lock);
+		raw_spin_unlock(&irq->irq_lock);
+		raw_spin_unlock_irqrestore(&vcpu->arch.vgic_cpu.ap_list_lock,
+					   flags);
 
-		spin_lock(&irq->irq_lock);
+		raw_spin_lock_irqsave(&irq->irq_lock, flags);
 		goto retry;
 	}
 
@@ -337,9 +409,10 @@ bool vgic_queue_irq_unlock(struct kvm *kvm, struct vgic_irq *irq)
 	vgic_get_irq_kref(irq);
 	list_add_tail(&irq->ap_list, &vcpu->arch.vgic_cpu.ap_list_head);
 	irq->vcpu = vcpu;
+	vgic_stats_queued(irq);
 
-	spin_unlock(&irq->irq_lock);
-	spin_unlock(&vcpu->arch.vgic_cpu.ap_list_lock);
+	raw_spin_unlock(&irq->irq_lock);
+	raw_spin_unlock_irqrestore(&vcpu->arch.vgic_cpu.ap_list_lock, flags);
 
 	kvm_make_request(KVM_REQ_IRQ_PENDING, vcpu);
 	kvm_vcpu_kick(vcpu);
@@ -369,6 +442,7 @@ int kvm_vgic_inject_irq(struct kvm *kvm, int cpuid, unsigned int intid,
 {
 	struct kvm_vcpu *vcpu;
 	struct vgic_irq *irq;
+	unsigned long flags;
 	int ret;
 
 	trace_vgic_update_irq_pending(cpuid, intid, level);
@@ -385,11 +459,11 @@ int kvm_vgic_inject_irq(struct kvm *kvm, int cpuid, unsigned int intid,
 	if (!irq)
 		return -EINVAL;
 
-	spin_lock(&irq->irq_lock);
+	raw_spin_lock_irqsave(&irq->irq_lock, flags);
 
 	if (!vgic_validate_injection(irq, level, owner)) {
 		/* Nothing to see here, move along... */
-		spin_unlock(&irq->irq_lock);
+		raw_spin_unlock_irqrestore(&irq->irq_lock, flags);
 		vgic_put_irq(kvm, irq);
 		return 0;
 	}
@@ -399,7 +473,7 @@ int kvm_vgic_inject_irq(struct kvm *kvm, int cpuid, unsigned int intid,
 	else
 		irq->pending_latch = true;
 
-	vgic_queue_irq_unlock(kvm, irq);
+	vgic_queue_irq_unlock(kvm, irq, flags);
 	vgic_put_irq(kvm, irq);
 
 	return 0;
@@ -408,23 +482,28 @@ int kvm_vgic_inject_irq(struct kvm *kvm, int cpuid, unsigned int intid,
 int kvm_vgic_map_phys_irq(struct kvm_vcpu *vcpu, u32 virt_irq, u32 phys_irq)
 {
 	struct vgic_irq *irq = vgic_get_irq(vcpu->kvm, vcpu, virt_irq);
+	unsigned long flags;
 
 	BUG_ON(!irq);
 
-	spin_lock(&irq->irq_lock);
+	raw_spin_lock_irqsave(&irq->irq_lock, flags);
 
 	irq->hw = true;
 	irq->hwintid = phys_irq;
 
-	spin_unlock(&irq->irq_lock);
+	raw_spin_unlock_irqrestore(&irq->irq_lock, flags);
 	vgic_put_irq(vcpu->kvm, irq);
 
+	if (nested_virt_in_use(vcpu))
+		vgic_v2_nested_mapping_changed(vcpu, virt_irq);
+
 	return 0;
 }
 
 int kvm_vgic_unmap_phys_irq(struct kvm_vcpu *vcpu, unsigned int virt_irq)
 {
 	struct vgic_irq *irq;
+	unsigned long flags;
 
 	if (!vgic_initialized(vcpu->kvm))
 		return -EAGAIN;
@@ -432,14 +511,17 @@ int kvm_vgic_unmap_phys_irq(struct kvm_vcpu *vcpu, unsigned int virt_irq)
 	irq = vgic_get_irq(vcpu->kvm, vcpu, virt_irq);
 	BUG_ON(!irq);
 
-	spin_lock(&irq->irq_lock);
+	raw_spin_lock_irqsave(&irq->irq_lock, flags);
 
 	irq->hw = false;
 	irq->hwintid = 0;
 
-	spin_unlock(&irq->irq_lock);
+	raw_spin_unlock_irqrestore(&irq->irq_lock, flags);
 	vgic_put_irq(vcpu->kvm, irq);
 
+	if (nested_virt_in_use(vcpu))
+		vgic_v2_nested_mapping_changed(vcpu, virt_irq);
+
 	return 0;
 }
 
@@ -456,6 +538,7 @@ int kvm_vgic_unmap_phys_irq(struct kvm_vcpu *vcpu, unsigned int virt_irq)
 int kvm_vgic_set_owner(struct kvm_vcpu *vcpu, unsigned int intid, void *owner)
 {
 	struct vgic_irq *irq;
+	unsigned long flags;
 	int ret = 0;
 
 	if (!vgic_initialized(vcpu->kvm))
@@ -466,12 +549,12 @@ int kvm_vgic_set_owner(struct kvm_vcpu *vcpu, unsigned int intid, void *owner)
 		return -EINVAL;
 
 	irq = vgic_get_irq(vcpu->kvm, vcpu, intid);
-	spin_lock(&irq->irq_lock);
+	raw_spin_lock_irqsave(&irq->irq_lock, flags);
 	if (irq->owner && irq->owner != owner)
 		ret = -EEXIST;
 	else
 		irq->owner = owner;
-	spin_unlock(&irq->irq_lock);
+	raw_spin_unlock_irqrestore(&irq->irq_lock, flags);
 
 	return ret;
 }
@@ -488,14 +571,15 @@ static void vgic_prune_ap_list(struct kvm_vcpu *vcpu)
 {
 	struct vgic_cpu *vgic_cpu = &vcpu->arch.vgic_cpu;
 	struct vgic_irq *irq, *tmp;
+	unsigned long flags;
 
 retry:
-	spin_lock(&vgic_cpu->ap_list_lock);
+	vgic_ap_list_lock_irqsave(vcpu, flags);
 
 	list_for_each_entry_safe(irq, tmp, &vgic_cpu->ap_list_head, ap_list) {
 		struct kvm_vcpu *target_vcpu, *vcpuA, *vcpuB;
 
-		spin_lock(&irq->irq_lock);
+		vgic_irq_lock(vcpu, irq);
 
 		BUG_ON(vcpu != irq->vcpu);
 
@@ -508,7 +592,7 @@ static void vgic_prune_ap_list(struct kvm_vcpu *vcpu)
 			 */
 			list_del(&irq->ap_list);
 			irq->vcpu = NULL;
-			spin_unlock(&irq->irq_lock);
+			raw_spin_unlock(&irq->irq_lock);
 
 			/*
 			 * This vgic_put_irq call matches the
@@ -523,14 +607,14 @@ static void vgic_prune_ap_list(struct kvm_vcpu *vcpu)
 
 		if (target_vcpu == vcpu) {
 			/* We're on the right CPU */
-			spin_unlock(&irq->irq_lock);
+			raw_spin_unlock(&irq->irq_lock);
 			continue;
 		}
 
 		/* This interrupt looks like it has to be migrated. */
 
-		spin_unlock(&irq->irq_lock);
-		spin_unlock(&vgic_cpu->ap_list_lock);
+		raw_spin_unlock(&irq->irq_lock);
+		raw_spin_unlock_irqrestore(&vgic_cpu->ap_list_lock, flags);
 
 		/*
 		 * Ensure locking order by always locking the smallest
@@ -544,10 +628,11 @@ static void vgic_prune_ap_list(struct kvm_vcpu *vcpu)
 			vcpuB = vcpu;
 		}
 
-		spin_lock(&vcpuA->arch.vgic_cpu.ap_list_lock);
-		spin_lock_nested(&vcpuB->arch.vgic_cpu.ap_list_lock,
-				 SINGLE_DEPTH_NESTING);
-		spin_lock(&irq->irq_lock);
+		raw_spin_lock_irqsave(&vcpuA->arch.vgic_cpu.ap_list_lock,
+				      flags);
+		raw_spin_lock_nested(&vcpuB->arch.vgic_cpu.ap_list_lock,
+				     SINGLE_DEPTH_NESTING);
+		raw_spin_lock(&irq->irq_lock);
 
 		/*
 		 * If the affinity has been preserved, move the
@@ -566,13 +651,14 @@ static void vgic_prune_ap_list(struct kvm_vcpu *vcpu)
 			list_add_tail(&irq->ap_list, &new_cpu->ap_list_head);
 		}
 
-		spin_unlock(&irq->irq_lock);
-		spin_unlock(&vcpuB->arch.vgic_cpu.ap_list_lock);
-		spin_unlock(&vcpuA->arch.vgic_cpu.ap_list_lock);
+		raw_spin_unlock(&irq->irq_lock);
+		raw_spin_unlock(&vcpuB->arch.vgic_cpu.ap_list_lock);
+		raw_spin_unlock_irqrestore(&vcpuA->arch.vgic_cpu.ap_list_lock,
+					   flags);
 		goto retry;
 	}
 
-	spin_unlock(&vgic_cpu->ap_list_lock);
+	raw_spin_unlock_irqrestore(&vgic_cpu->ap_list_lock, flags);
 }
 
 static inline void vgic_fold_lr_state(struct kvm_vcpu *vcpu)
@@ -587,7 +673,7 @@ static inline void vgic_fold_lr_state(struct kvm_vcpu *vcpu)
 static inline void vgic_populate_lr(struct kvm_vcpu *vcpu,
 				    struct vgic_irq *irq, int lr)
 {
-	DEBUG_SPINLOCK_BUG_ON(!spin_is_locked(&irq->irq_lock));
+	DEBUG_SPINLOCK_BUG_ON(!raw_spin_is_locked(&irq->irq_lock));
 
 	if (kvm_vgic_global_state.type == VGIC_V2)
 		vgic_v2_populate_lr(vcpu, irq, lr);
@@ -620,42 +706,21 @@ static inline u32 vgic_get_lr(struct kvm_vcpu *vcpu, int lr)
 	return 0;
 }
 
-/* Requires the ap_list_lock to be held. */
-static int compute_ap_list_depth(struct kvm_vcpu *vcpu)
-{
-	struct vgic_cpu *vgic_cpu = &vcpu->arch.vgic_cpu;
-	struct vgic_irq *irq;
-	int count = 0;
-
-	DEBUG_SPINLOCK_BUG_ON(!spin_is_locked(&vgic_cpu->ap_list_lock));
-
-	list_for_each_entry(irq, &vgic_cpu->ap_list_head, ap_list) {
-		spin_lock(&irq->irq_lock);
-		/* GICv2 SGIs can count for more than one... */
-		if (vgic_irq_is_sgi(irq->intid) && irq->source)
-			count += hweight8(irq->source);
-		else
-			count++;
-		spin_unlock(&irq->irq_lock);
-	}
-	return count;
-}
-
 /* Requires the VCPU's ap_list_lock to be held. */
 static void vgic_flush_lr_state(struct kvm_vcpu *vcpu)
 {
 	struct vgic_cpu *vgic_cpu = &vcpu->arch.vgic_cpu;
 	struct vgic_irq *irq;
+	bool overflow = false;
 	int count = 0;
 	int i = 0;
 
-	DEBUG_SPINLOCK_BUG_ON(!spin_is_locked(&vgic_cpu->ap_list_lock));
+	DEBUG_SPINLOCK_BUG_ON(!raw_spin_is_locked(&vgic_cpu->ap_list_lock));
 
-	if (compute_ap_list_depth(vcpu) > kvm_vgic_global_state.nr_lr)
-		vgic_sort_ap_list(vcpu);
+	vgic_sort_ap_list(vcpu);
 
 	list_for_each_entry(irq, &vgic_cpu->ap_list_head, ap_list) {
-		spin_lock(&irq->irq_lock);
+		vgic_irq_lock(vcpu, irq);
 
 		if (unlikely(vgic_target_oracle(irq) != vcpu))
 			goto next;
@@ -669,18 +734,24 @@ static void vgic_flush_lr_state(struct kvm_vcpu *vcpu)
 		} while (irq->source && count < kvm_vgic_global_state.nr_lr);
 
 next:
-		spin_unlock(&irq->irq_lock);
+		raw_spin_unlock(&irq->irq_lock);
 
 		if (count == kvm_vgic_global_state.nr_lr) {
 			if (!list_is_last(&irq->ap_list,
-					  &vgic_cpu->ap_list_head))
+					  &vgic_cpu->ap_list_head)) {
 				vgic_set_underflow(vcpu);
+				vcpu->stat.vgic_lr_underflow++;
+				overflow = true;
+			}
 			break;
 		}
 	}
 
 	vcpu->arch.vgic_cpu.used_lrs = count;
 
+	if (unlikely(vgic_stats))
+		vgic_stats_flush(vcpu, count, overflow);
+
 	/* Nuke remaining LRs */
 	for ( ; count < kvm_vgic_global_state.nr_lr; count++)
 		vgic_clear_lr(vcpu, count);
@@ -720,6 +791,8 @@ void kvm_vgic_sync_hwstate(struct kvm_vcpu *vcpu)
 /* Flush our emulation state into the GIC hardware before entering the guest. */
 void kvm_vgic_flush_hwstate(struct kvm_vcpu *vcpu)
 {
+	unsigned long flags;
+
 	/*
 	 * If there are no virtual interrupts active or pending for this
 	 * VCPU, then there is no work to do and we can bail out without
@@ -732,9 +805,9 @@ void kvm_vgic_flush_hwstate(struct kvm_vcpu *vcpu)
 	if (list_empty(&vcpu->arch.vgic_cpu.ap_list_head))
 		return;
 
-	spin_lock(&vcpu->arch.vgic_cpu.ap_list_lock);
+	vgic_ap_list_lock_irqsave(vcpu, flags);
 	vgic_flush_lr_state(vcpu);
-	spin_unlock(&vcpu->arch.vgic_cpu.ap_list_lock);
+	raw_spin_unlock_irqrestore(&vcpu->arch.vgic_cpu.ap_list_lock, flags);
 }
 
 void kvm_vgic_load(struct kvm_vcpu *vcpu)
@@ -764,22 +837,27 @@ int kvm_vgic_vcpu_pending_irq(struct kvm_vcpu *vcpu)
 	struct vgic_cpu *vgic_cpu = &vcpu->arch.vgic_cpu;
 	struct vgic_irq *irq;
 	bool pending = false;
+	unsigned long flags;
 
 	if (!vcpu->kvm->arch.vgic.enabled)
 		return false;
 
-	spin_lock(&vgic_cpu->ap_list_lock);
+	/* A vLPI was signalled to the vPE while it wasn't resident */
+	if (vgic_cpu->its_vpe.pending_last)
+		return true;
+
+	vgic_ap_list_lock_irqsave(vcpu, flags);
 
 	list_for_each_entry(irq, &vgic_cpu->ap_list_head, ap_list) {
-		spin_lock(&irq->irq_lock);
+		raw_spin_lock(&irq->irq_lock);
 		pending = irq_is_pending(irq) && irq->enabled;
-		spin_unlock(&irq->irq_lock);
+		raw_spin_unlock(&irq->irq_lock);
 
 		if (pending)
 			break;
 	}
 
-	spin_unlock(&vgic_cpu->ap_list_lock);
+	raw_spin_unlock_irqrestore(&vgic_cpu->ap_list_lock, flags);
 
 	return pending;
 }
@@ -805,10 +883,11 @@ bool kvm_vgic_map_is_active(struct kvm_vcpu *vcpu, unsigned int virt_irq)
 {
 	struct vgic_irq *irq = vgic_get_irq(vcpu->kvm, vcpu, virt_irq);
 	bool map_is_active;
+	unsigned long flags;
 
-	spin_lock(&irq->irq_lock);
+	raw_spin_lock_irqsave(&irq->irq_lock, flags);
 	map_is_active = irq->hw && irq->active;
-	spin_unlock(&irq->irq_lock);
+	raw_spin_unlock_irqrestore(&irq->irq_lock, flags);
 	vgic_put_irq(vcpu->kvm, irq);
 
 	return map_is_active;
@@ -17,6 +17,7 @@
 #define __KVM_ARM_VGIC_NEW_H__
 
 #include <linux/irqchip/arm-gic-common.h>
+#include <kvm/arm_lock_stat.h>
 
 #define PRODUCT_ID_KVM		0x4b	/* ASCII code K */
 #define IMPLEMENTER_ARM		0x43b
@@ -140,7 +141,9 @@ vgic_get_mmio_region(struct kvm_vcpu *vcpu, struct vgic_io_device *iodev,
 struct vgic_irq *vgic_get_irq(struct kvm *kvm, struct kvm_vcpu *vcpu,
 			      u32 intid);
 void vgic_put_irq(struct kvm *kvm, struct vgic_irq *irq);
-bool vgic_queue_irq_unlock(struct kvm *kvm, struct vgic_irq *irq);
+bool vgic_queue_irq_unlock(struct kvm *kvm, struct vgic_irq *irq,
+			   unsigned long flags);
+bool vgic_irq_needs_eoi(struct kvm *kvm, struct vgic_irq *irq);
 void vgic_kick_vcpus(struct kvm *kvm);
 
 int vgic_check_ioaddr(struct kvm *kvm, phys_addr_t *ioaddr,
@@ -198,6 +201,10 @@ bool vgic_has_its(struct kvm *kvm);
 int kvm_vgic_register_its_device(void);
 void vgic_enable_lpis(struct kvm_vcpu *vcpu);
 int vgic_its_inject_msi(struct kvm *kvm, struct kvm_msi *msi);
+int vgic_its_inject_cached_msi(struct kvm *kvm, struct kvm_msi *msi);
+struct vgic_its *vgic_msi_to_its(struct kvm *kvm, struct kvm_msi *msi);
+int vgic_its_resolve_lpi(struct kvm *kvm, struct vgic_its *its,
+			 u32 devid, u32 eventid, struct vgic_irq **irq);
 int vgic_v3_has_attr_regs(struct kvm_device *dev, struct kvm_device_attr *attr);
 int vgic_v3_dist_uaccess(struct kvm_vcpu *vcpu, bool is_write,
 			 int offset, u32 *val);
@@ -218,10 +225,47 @@ int vgic_init(struct kvm *kvm);
 int vgic_debug_init(struct kvm *kvm);
 int vgic_debug_destroy(struct kvm *kvm);
 
+extern bool vgic_stats;
+
+void vgic_stats_flush(struct kvm_vcpu *vcpu, int used_lrs, bool overflow);
+void vgic_stats_nested(struct kvm_vcpu *vcpu, int used_lrs);
+void __vgic_stats_acked(struct kvm_vcpu *vcpu, struct vgic_irq *irq);
+
+static inline void vgic_stats_queued(struct vgic_irq *irq)
+{
+	if (unlikely(vgic_stats))
+		irq->queued_ns = ktime_get_ns();
+}
+
+/* The guest took @irq, if it was pending when the LR was written */
+static inline void vgic_stats_acked(struct kvm_vcpu *vcpu,
+				    struct vgic_irq *irq)
+{
+	if (unlikely(irq->queued_ns))
+		__vgic_stats_acked(vcpu, irq);
+}
+
 bool lock_all_vcpus(struct kvm *kvm);
 void unlock_all_vcpus(struct kvm *kvm);
 
 int vgic_register_gich_iodev(struct kvm *kvm, struct vgic_dist *dist);
 void vgic_init_nested(struct kvm_vcpu *vcpu);
+void vgic_v2_nested_mapping_changed(struct kvm_vcpu *vcpu, u32 intid);
+
+u64 vgic_v3_nested_read_vtr(struct kvm_vcpu *vcpu);
+u32 vgic_v3_nested_read_eisr(struct kvm_vcpu *vcpu);
+u32 vgic_v3_nested_read_elrsr(struct kvm_vcpu *vcpu);
+u32 vgic_v3_nested_read_misr(struct kvm_vcpu *vcpu);
+
+bool vgic_v4_enabled(void);
+int vgic_v4_init(struct kvm *kvm);
+void vgic_v4_teardown(struct kvm *kvm);
+int vgic_v4_load(struct kvm_vcpu *vcpu);
+int vgic_v4_put(struct kvm_vcpu *vcpu, bool need_db);
+
+static inline bool vgic_supports_direct_msis(struct kvm *kvm)
+{
+	return kvm_vgic_global_state.has_gicv4 && vgic_has_its(kvm);
+}
 
 #endif
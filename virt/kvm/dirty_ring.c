@@ -0,0 +1,157 @@
+/*
+ * KVM dirty ring implementation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/kvm_host.h>
+#include <linux/kvm.h>
+#include <linux/vmalloc.h>
+#include <linux/kvm_dirty_ring.h>
+
+#include "mmu_lock.h"
+
+static u32 kvm_dirty_ring_used(struct kvm_dirty_ring *ring)
+{
+	return READ_ONCE(ring->dirty_index) - READ_ONCE(ring->reset_index);
+}
+
+bool kvm_dirty_ring_soft_full(struct kvm_dirty_ring *ring)
+{
+	return kvm_dirty_ring_used(ring) >= ring->soft_limit;
+}
+
+static bool kvm_dirty_ring_full(struct kvm_dirty_ring *ring)
+{
+	return kvm_dirty_ring_used(ring) >= ring->size;
+}
+
+int kvm_dirty_ring_alloc(struct kvm_dirty_ring *ring, int index, u32 size)
+{
+	ring->dirty_gfns = vzalloc(size);
+	if (!ring->dirty_gfns)
+		return -ENOMEM;
+
+	ring->size = size / sizeof(struct kvm_dirty_gfn);
+	ring->soft_limit = ring->size - KVM_DIRTY_RING_RSVD_ENTRIES;
+	ring->dirty_index = 0;
+	ring->reset_index = 0;
+	ring->index = index;
+
+	return 0;
+}
+
+void kvm_dirty_ring_free(struct kvm_dirty_ring *ring)
+{
+	vfree(ring->dirty_gfns);
+	ring->dirty_gfns = NULL;
+}
+
+/* Write protect again the pages of @slot at @offset + the bits of @mask */
+static void kvm_reset_dirty_gfn(struct kvm *kvm, u32 slot, u64 offset,
+				unsigned long mask)
+{
+	struct kvm_memory_slot *memslot;
+	int as_id = slot >> 16;
+	int id = (u16)slot;
+
+	if (!mask)
+		return;
+
+	if (as_id >= KVM_ADDRESS_SPACE_NUM || id >= KVM_USER_MEM_SLOTS)
+		return;
+
+	memslot = id_to_memslot(__kvm_memslots(kvm, as_id), id);
+	if (!memslot->dirty_bitmap ||
+	    offset + __fls(mask) >= memslot->npages)
+		return;
+
+	KVM_MMU_LOCK(kvm);
+	kvm_arch_mmu_enable_log_dirty_pt_masked(kvm, memslot, offset, mask);
+	KVM_MMU_UNLOCK(kvm);
+}
+
+/*
+ * Recycle the entries userspace has collected, in order, stopping at the
+ * first one it has not. Consecutive entries of the same slot that fall in a
+ * BITS_PER_LONG window are write protected again in one go, which is what a
+ * guest dirtying memory sequentially produces. Called with slots_lock held,
+ * returns the number of entries recycled.
+ */
+int kvm_dirty_ring_reset(struct kvm *kvm, struct kvm_dirty_ring *ring)
+{
+	u32 cur_slot = 0, next_slot;
+	u64 cur_offset = 0, next_offset;
+	unsigned long mask = 0;
+	struct kvm_dirty_gfn *entry;
+	int count = 0;
+
+	while (true) {
+		entry = &ring->dirty_gfns[ring->reset_index & (ring->size - 1)];
+
+		if (!(smp_load_acquire(&entry->flags) & KVM_DIRTY_GFN_F_RESET))
+			break;
+
+		next_slot = READ_ONCE(entry->slot);
+		next_offset = READ_ONCE(entry->offset);
+
+		WRITE_ONCE(entry->flags, 0);
+		ring->reset_index++;
+		count++;
+
+		if (mask && next_slot == cur_slot) {
+			s64 delta = next_offset - cur_offset;
+
+			if (delta >= 0 && delta < BITS_PER_LONG) {
+				mask |= 1UL << delta;
+				continue;
+			}
+
+			/* Going backwards, as long as nothing falls off */
+			if (delta > -BITS_PER_LONG && delta < 0 &&
+			    (mask << -delta >> -delta) == mask) {
+				cur_offset = next_offset;
+				mask = (mask << -delta) | 1;
+				continue;
+			}
+		}
+
+		kvm_reset_dirty_gfn(kvm, cur_slot, cur_offset, mask);
+		cur_slot = next_slot;
+		cur_offset = next_offset;
+		mask = 1;
+	}
+
+	kvm_reset_dirty_gfn(kvm, cur_slot, cur_offset, mask);
+
+	return count;
+}
+
+/*
+ * Returns false if the ring is full, which the soft limit should prevent, in
+ * which case the caller has to log the page some other way.
+ */
+bool kvm_dirty_ring_push(struct kvm_dirty_ring *ring, u32 slot, u64 offset)
+{
+	struct kvm_dirty_gfn *entry;
+
+	if (WARN_ON_ONCE(kvm_dirty_ring_full(ring)))
+		return false;
+
+	entry = &ring->dirty_gfns[ring->dirty_index & (ring->size - 1)];
+
+	entry->slot = slot;
+	entry->offset = offset;
+	/* Publish the entry only once userspace can read its content */
+	smp_store_release(&entry->flags, KVM_DIRTY_GFN_F_DIRTY);
+	ring->dirty_index++;
+
+	return true;
+}
+
+struct page *kvm_dirty_ring_get_page(struct kvm_dirty_ring *ring, u32 offset)
+{
+	return vmalloc_to_page((void *)ring->dirty_gfns + offset * PAGE_SIZE);
+}
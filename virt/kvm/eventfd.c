@@ -484,6 +484,22 @@ void kvm_notify_acked_irq(struct kvm *kvm, unsigned irqchip, unsigned pin)
 	srcu_read_unlock(&kvm->irq_srcu, idx);
 }
 
+/* Same as kvm_notify_acked_irq() for @nr pins, under a single SRCU section */
+void kvm_notify_acked_irqs(struct kvm *kvm, unsigned irqchip,
+			   const unsigned *pins, int nr)
+{
+	int i, gsi, idx;
+
+	idx = srcu_read_lock(&kvm->irq_srcu);
+	for (i = 0; i < nr; i++) {
+		trace_kvm_ack_irq(irqchip, pins[i]);
+		gsi = kvm_irq_map_chip_pin(kvm, irqchip, pins[i]);
+		if (gsi != -1)
+			kvm_notify_acked_gsi(kvm, gsi);
+	}
+	srcu_read_unlock(&kvm->irq_srcu, idx);
+}
+
 void kvm_register_irq_ack_notifier(struct kvm *kvm,
 				   struct kvm_irq_ack_notifier *kian)
 {
@@ -60,6 +60,7 @@
 
 #include "coalesced_mmio.h"
 #include "async_pf.h"
+#include "mmu_lock.h"
 #include "vfio.h"
 
 #define CREATE_TRACE_POINTS
@@ -279,11 +280,20 @@ int kvm_vcpu_init(struct kvm_vcpu *vcpu, struct kvm *kvm, unsigned id)
 	kvm_vcpu_set_dy_eligible(vcpu, false);
 	vcpu->preempted = false;
 
+	if (kvm->dirty_ring_size) {
+		r = kvm_dirty_ring_alloc(&vcpu->dirty_ring, id,
+					 kvm->dirty_ring_size);
+		if (r)
+			goto fail_free_run;
+	}
+
 	r = kvm_arch_vcpu_init(vcpu);
 	if (r < 0)
-		goto fail_free_run;
+		goto fail_free_ring;
 	return 0;
 
+fail_free_ring:
+	kvm_dirty_ring_free(&vcpu->dirty_ring);
 fail_free_run:
 	free_page((unsigned long)vcpu->run);
 fail:
@@ -295,6 +305,7 @@ void kvm_vcpu_uninit(struct kvm_vcpu *vcpu)
 {
 	put_pid(vcpu->pid);
 	kvm_arch_vcpu_uninit(vcpu);
+	kvm_dirty_ring_free(&vcpu->dirty_ring);
 	free_page((unsigned long)vcpu->run);
 }
 EXPORT_SYMBOL_GPL(kvm_vcpu_uninit);
@@ -331,7 +342,7 @@ static void kvm_mmu_notifier_invalidate_page(struct mmu_notifier *mn,
 	 * is going to be freed.
 	 */
 	idx = srcu_read_lock(&kvm->srcu);
-	spin_lock(&kvm->mmu_lock);
+	KVM_MMU_LOCK(kvm);
 
 	kvm->mmu_notifier_seq++;
 	need_tlb_flush = kvm_unmap_hva(kvm, address) | kvm->tlbs_dirty;
@@ -339,7 +350,7 @@ static void kvm_mmu_notifier_invalidate_page(struct mmu_notifier *mn,
 	if (need_tlb_flush)
 		kvm_flush_remote_tlbs(kvm);
 
-	spin_unlock(&kvm->mmu_lock);
+	KVM_MMU_UNLOCK(kvm);
 
 	kvm_arch_mmu_notifier_invalidate_page(kvm, address);
 
@@ -355,10 +366,10 @@ static void kvm_mmu_notifier_change_pte(struct mmu_notifier *mn,
 	int idx;
 
 	idx = srcu_read_lock(&kvm->srcu);
-	spin_lock(&kvm->mmu_lock);
+	KVM_MMU_LOCK(kvm);
 	kvm->mmu_notifier_seq++;
 	kvm_set_spte_hva(kvm, address, pte);
-	spin_unlock(&kvm->mmu_lock);
+	KVM_MMU_UNLOCK(kvm);
 	srcu_read_unlock(&kvm->srcu, idx);
 }
 
@@ -371,7 +382,7 @@ static void kvm_mmu_notifier_invalidate_range_start(struct mmu_notifier *mn,
 	int need_tlb_flush = 0, idx;
 
 	idx = srcu_read_lock(&kvm->srcu);
-	spin_lock(&kvm->mmu_lock);
+	KVM_MMU_LOCK(kvm);
 	/*
 	 * The count increase must become visible at unlock time as no
 	 * spte can be established without taking the mmu_lock and
@@ -384,7 +395,7 @@ static void kvm_mmu_notifier_invalidate_range_start(struct mmu_notifier *mn,
 	if (need_tlb_flush)
 		kvm_flush_remote_tlbs(kvm);
 
-	spin_unlock(&kvm->mmu_lock);
+	KVM_MMU_UNLOCK(kvm);
 	srcu_read_unlock(&kvm->srcu, idx);
 }
 
@@ -395,7 +406,7 @@ static void kvm_mmu_notifier_invalidate_range_end(struct mmu_notifier *mn,
 {
 	struct kvm *kvm = mmu_notifier_to_kvm(mn);
 
-	spin_lock(&kvm->mmu_lock);
+	KVM_MMU_LOCK(kvm);
 	/*
 	 * This sequence increase will notify the kvm page fault that
 	 * the page that is going to be mapped in the spte could have
@@ -409,7 +420,7 @@ static void kvm_mmu_notifier_invalidate_range_end(struct mmu_notifier *mn,
 	 * in conjunction with the smp_rmb in mmu_notifier_retry().
 	 */
 	kvm->mmu_notifier_count--;
-	spin_unlock(&kvm->mmu_lock);
+	KVM_MMU_UNLOCK(kvm);
 
 	BUG_ON(kvm->mmu_notifier_count < 0);
 }
@@ -423,13 +434,13 @@ static int kvm_mmu_notifier_clear_flush_young(struct mmu_notifier *mn,
 	int young, idx;
 
 	idx = srcu_read_lock(&kvm->srcu);
-	spin_lock(&kvm->mmu_lock);
+	KVM_MMU_LOCK(kvm);
 
 	young = kvm_age_hva(kvm, start, end);
 	if (young)
 		kvm_flush_remote_tlbs(kvm);
 
-	spin_unlock(&kvm->mmu_lock);
+	KVM_MMU_UNLOCK(kvm);
 	srcu_read_unlock(&kvm->srcu, idx);
 
 	return young;
@@ -444,7 +455,7 @@ static int kvm_mmu_notifier_clear_young(struct mmu_notifier *mn,
 	int young, idx;
 
 	idx = srcu_read_lock(&kvm->srcu);
-	spin_lock(&kvm->mmu_lock);
+	KVM_MMU_LOCK(kvm);
 	/*
 	 * Even though we do not flush TLB, this will still adversely
 	 * affect performance on pre-Haswell Intel EPT, where there is
@@ -459,12 +470,30 @@ static int kvm_mmu_notifier_clear_young(struct mmu_notifier *mn,
 	 * more sophisticated heuristic later.
 	 */
 	young = kvm_age_hva(kvm, start, end);
-	spin_unlock(&kvm->mmu_lock);
+	KVM_MMU_UNLOCK(kvm);
 	srcu_read_unlock(&kvm->srcu, idx);
 
 	return young;
 }
 
+#ifdef KVM_ARCH_WANT_AGE_HVA_BITMAP
+static void kvm_mmu_notifier_clear_young_bitmap(struct mmu_notifier *mn,
+						struct mm_struct *mm,
+						unsigned long start,
+						unsigned long end,
+						unsigned long *young)
+{
+	struct kvm *kvm = mmu_notifier_to_kvm(mn);
+	int idx;
+
+	idx = srcu_read_lock(&kvm->srcu);
+	KVM_MMU_LOCK(kvm);
+	kvm_age_hva_bitmap(kvm, start, end, young);
+	KVM_MMU_UNLOCK(kvm);
+	srcu_read_unlock(&kvm->srcu, idx);
+}
+#endif
+
 static int kvm_mmu_notifier_test_young(struct mmu_notifier *mn,
 				       struct mm_struct *mm,
 				       unsigned long address)
@@ -473,9 +502,9 @@ static int kvm_mmu_notifier_test_young(struct mmu_notifier *mn,
 	int young, idx;
 
 	idx = srcu_read_lock(&kvm->srcu);
-	spin_lock(&kvm->mmu_lock);
+	KVM_MMU_LOCK(kvm);
 	young = kvm_test_age_hva(kvm, address);
-	spin_unlock(&kvm->mmu_lock);
+	KVM_MMU_UNLOCK(kvm);
 	srcu_read_unlock(&kvm->srcu, idx);
 
 	return young;
@@ -498,6 +527,9 @@ static const struct mmu_notifier_ops kvm_mmu_notifier_ops = {
 	.invalidate_range_end	= kvm_mmu_notifier_invalidate_range_end,
 	.clear_flush_young	= kvm_mmu_notifier_clear_flush_young,
 	.clear_young		= kvm_mmu_notifier_clear_young,
+#ifdef KVM_ARCH_WANT_AGE_HVA_BITMAP
+	.clear_young_bitmap	= kvm_mmu_notifier_clear_young_bitmap,
+#endif
 	.test_young		= kvm_mmu_notifier_test_young,
 	.change_pte		= kvm_mmu_notifier_change_pte,
 	.release		= kvm_mmu_notifier_release,
@@ -542,6 +574,15 @@ static void kvm_destroy_dirty_bitmap(struct kvm_memory_slot *memslot)
 	memslot->dirty_bitmap = NULL;
 }
 
+static void kvm_destroy_access_bitmap(struct kvm_memory_slot *memslot)
+{
+	if (!memslot->access_bitmap)
+		return;
+
+	kvfree(memslot->access_bitmap);
+	memslot->access_bitmap = NULL;
+}
+
 /*
  * Free any memory in @free but not in @dont.
  */
@@ -550,6 +591,8 @@ static void kvm_free_memslot(struct kvm *kvm, struct kvm_memory_slot *free,
 {
 	if (!dont || free->dirty_bitmap != dont->dirty_bitmap)
 		kvm_destroy_dirty_bitmap(free);
+	if (!dont || free->access_bitmap != dont->access_bitmap)
+		kvm_destroy_access_bitmap(free);
 
 	kvm_arch_free_memslot(kvm, free, dont);
 
@@ -631,7 +674,7 @@ static struct kvm *kvm_create_vm(unsigned long type)
 	if (!kvm)
 		return ERR_PTR(-ENOMEM);
 
-	spin_lock_init(&kvm->mmu_lock);
+	KVM_MMU_LOCK_INIT(kvm);
 	mmgrab(current->mm);
 	kvm->mm = current->mm;
 	kvm_eventfd_init(kvm);
@@ -796,6 +839,21 @@ static int kvm_create_dirty_bitmap(struct kvm_memory_slot *memslot)
 	return 0;
 }
 
+/*
+ * Allocation size is twice as large as the actual access bitmap size, as
+ * with the dirty bitmap. See kvm_vm_ioctl_get_access_log() why this is needed.
+ */
+static int kvm_create_access_bitmap(struct kvm_memory_slot *memslot)
+{
+	unsigned long access_bytes = 2 * kvm_dirty_bitmap_bytes(memslot);
+
+	memslot->access_bitmap = kvzalloc(access_bytes, GFP_KERNEL);
+	if (!memslot->access_bitmap)
+		return -ENOMEM;
+
+	return 0;
+}
+
 /*
  * Insert memslot and re-sort memslots based on their GFN,
  * so binary search could be used to lookup GFN.
@@ -859,6 +917,10 @@ static int check_memory_region_flags(const struct kvm_userspace_memory_region *m
 	valid_flags |= KVM_MEM_READONLY;
 #endif
 
+#ifdef CONFIG_HAVE_KVM_ACCESS_LOG
+	valid_flags |= KVM_MEM_LOG_ACCESS;
+#endif
+
 	if (mem->flags & ~valid_flags)
 		return -EINVAL;
 
@@ -1000,6 +1062,8 @@ int __kvm_set_memory_region(struct kvm *kvm,
 	/* Free page dirty bitmap if unneeded */
 	if (!(new.flags & KVM_MEM_LOG_DIRTY_PAGES))
 		new.dirty_bitmap = NULL;
+	if (!(new.flags & KVM_MEM_LOG_ACCESS))
+		new.access_bitmap = NULL;
 
 	r = -ENOMEM;
 	if (change == KVM_MR_CREATE) {
@@ -1015,6 +1079,12 @@ int __kvm_set_memory_region(struct kvm *kvm,
 			goto out_free;
 	}
 
+	/* Allocate page access bitmap if needed */
+	if ((new.flags & KVM_MEM_LOG_ACCESS) && !new.access_bitmap) {
+		if (kvm_create_access_bitmap(&new) < 0)
+			goto out_free;
+	}
+
 	slots = kvzalloc(sizeof(struct kvm_memslots), GFP_KERNEL);
 	if (!slots)
 		goto out_free;
@@ -1050,6 +1120,7 @@ int __kvm_set_memory_region(struct kvm *kvm,
 	/* actual memory is freed via old in kvm_free_memslot below */
 	if (change == KVM_MR_DELETE) {
 		new.dirty_bitmap = NULL;
+		new.access_bitmap = NULL;
 		memset(&new.arch, 0, sizeof(new.arch));
 	}
 
@@ -1175,7 +1246,7 @@ int kvm_get_dirty_log_protect(struct kvm *kvm,
 	dirty_bitmap_buffer = dirty_bitmap + n / sizeof(long);
 	memset(dirty_bitmap_buffer, 0, n);
 
-	spin_lock(&kvm->mmu_lock);
+	KVM_MMU_LOCK(kvm);
 	*is_dirty = false;
 	for (i = 0; i < n / sizeof(long); i++) {
 		unsigned long mask;
@@ -1196,7 +1267,7 @@ int kvm_get_dirty_log_protect(struct kvm *kvm,
 		}
 	}
 
-	spin_unlock(&kvm->mmu_lock);
+	KVM_MMU_UNLOCK(kvm);
 	if (copy_to_user(log->dirty_bitmap, dirty_bitmap_buffer, n))
 		return -EFAULT;
 	return 0;
@@ -1204,6 +1275,75 @@ int kvm_get_dirty_log_protect(struct kvm *kvm,
 EXPORT_SYMBOL_GPL(kvm_get_dirty_log_protect);
 #endif
 
+#ifdef CONFIG_HAVE_KVM_ACCESS_LOG
+/**
+ * kvm_vm_ioctl_get_access_log - get and clear the log of touched pages
+ * @kvm: pointer to kvm instance
+ * @log: slot id and address to which we copy the log
+ *
+ * Reports the pages of a KVM_MEM_LOG_ACCESS slot that the guest has faulted
+ * in since logging was enabled on the slot, or since the last call. Each
+ * reported page is unmapped from the guest again, so that its next access
+ * shows up in the next call.
+ *
+ * Mapping a page and marking it touched happen under the mmu_lock, so a
+ * page can't end up mapped with its bit cleared. As with the dirty log, the
+ * bits are taken out of the first half of the bitmap before being copied to
+ * userspace from the second half, so that the vcpus keep running meanwhile.
+ */
+static int kvm_vm_ioctl_get_access_log(struct kvm *kvm,
+				       struct kvm_dirty_log *log)
+{
+	struct kvm_memslots *slots;
+	struct kvm_memory_slot *memslot;
+	int i, as_id, id, r;
+	unsigned long n;
+	unsigned long *access_bitmap;
+	unsigned long *access_bitmap_buffer;
+
+	as_id = log->slot >> 16;
+	id = (u16)log->slot;
+	if (as_id >= KVM_ADDRESS_SPACE_NUM || id >= KVM_USER_MEM_SLOTS)
+		return -EINVAL;
+
+	mutex_lock(&kvm->slots_lock);
+
+	slots = __kvm_memslots(kvm, as_id);
+	memslot = id_to_memslot(slots, id);
+
+	r = -ENOENT;
+	access_bitmap = memslot->access_bitmap;
+	if (!access_bitmap)
+		goto out;
+
+	n = kvm_dirty_bitmap_bytes(memslot);
+
+	access_bitmap_buffer = access_bitmap + n / sizeof(long);
+	memset(access_bitmap_buffer, 0, n);
+
+	KVM_MMU_LOCK(kvm);
+	for (i = 0; i < n / sizeof(long); i++) {
+		unsigned long mask;
+
+		if (!access_bitmap[i])
+			continue;
+
+		mask = xchg(&access_bitmap[i], 0);
+		access_bitmap_buffer[i] = mask;
+		kvm_arch_mmu_clear_access_masked(kvm, memslot,
+						 i * BITS_PER_LONG, mask);
+	}
+	KVM_MMU_UNLOCK(kvm);
+
+	r = 0;
+	if (copy_to_user(log->dirty_bitmap, access_bitmap_buffer, n))
+		r = -EFAULT;
+out:
+	mutex_unlock(&kvm->slots_lock);
+	return r;
+}
+#endif
+
 bool kvm_largepages_enabled(void)
 {
 	return largepages_enabled;
@@ -1403,7 +1543,17 @@ static int hva_to_pfn_slow(unsigned long addr, bool *async, bool write_fault,
 	if (writable)
 		*writable = write_fault;
 
-	if (async) {
+	/*
+	 * Guest memory that was never touched is usually private anonymous
+	 * memory: try to fault it in without mmap_sem, which the vcpus
+	 * would otherwise contend on with the VMM, and pin it locklessly.
+	 */
+	if (!handle_speculative_fault(current->mm, addr,
+				      write_fault ? FAULT_FLAG_WRITE : 0,
+				      write_fault ? VM_WRITE : VM_READ) &&
+	    __get_user_pages_fast(addr, 1, write_fault, page) == 1) {
+		npages = 1;
+	} else if (async) {
 		down_read(&current->mm->mmap_sem);
 		npages = get_user_page_nowait(addr, write_fault, page);
 		up_read(&current->mm->mmap_sem);
@@ -2076,16 +2226,37 @@ void mark_page_dirty(struct kvm *kvm, gfn_t gfn)
 }
 EXPORT_SYMBOL_GPL(mark_page_dirty);
 
+/*
+ * With dirty rings enabled, the pages a vcpu dirties go into its own ring
+ * rather than the slot bitmap. The bitmap still collects what is dirtied
+ * without a vcpu at hand.
+ */
 void kvm_vcpu_mark_page_dirty(struct kvm_vcpu *vcpu, gfn_t gfn)
 {
 	struct kvm_memory_slot *memslot;
 
 	memslot = kvm_vcpu_gfn_to_memslot(vcpu, gfn);
+	if (vcpu->kvm->dirty_ring_size && memslot && memslot->dirty_bitmap) {
+		u32 slot = (kvm_arch_vcpu_memslots_id(vcpu) << 16) | memslot->id;
+
+		if (kvm_dirty_ring_push(&vcpu->dirty_ring, slot,
+					gfn - memslot->base_gfn))
+			return;
+	}
+
 	mark_page_dirty_in_slot(memslot, gfn);
 }
 EXPORT_SYMBOL_GPL(kvm_vcpu_mark_page_dirty);
 
-static void grow_halt_poll_ns(struct kvm_vcpu *vcpu)
+static unsigned int kvm_max_halt_poll_ns(struct kvm *kvm)
+{
+	if (READ_ONCE(kvm->override_halt_poll_ns))
+		return READ_ONCE(kvm->max_halt_poll_ns);
+
+	return READ_ONCE(halt_poll_ns);
+}
+
+static void grow_halt_poll_ns(struct kvm_vcpu *vcpu, unsigned int max)
 {
 	unsigned int old, val, grow;
 
@@ -2097,8 +2268,8 @@ static void grow_halt_poll_ns(struct kvm_vcpu *vcpu)
 	else
 		val *= grow;
 
-	if (val > halt_poll_ns)
-		val = halt_poll_ns;
+	if (val > max)
+		val = max;
 
 	vcpu->halt_poll_ns = val;
 	trace_kvm_halt_poll_ns_grow(vcpu->vcpu_id, val, old);
@@ -2138,12 +2309,13 @@ static int kvm_vcpu_check_block(struct kvm_vcpu *vcpu)
  */
 void kvm_vcpu_block(struct kvm_vcpu *vcpu)
 {
-	ktime_t start, cur;
+	unsigned int max_halt_poll_ns = kvm_max_halt_poll_ns(vcpu->kvm);
+	ktime_t start, cur, poll_end;
 	DECLARE_SWAITQUEUE(wait);
 	bool waited = false;
 	u64 block_ns;
 
-	start = cur = ktime_get();
+	start = cur = poll_end = ktime_get();
 	if (vcpu->halt_poll_ns) {
 		ktime_t stop = ktime_add_ns(ktime_get(), vcpu->halt_poll_ns);
 
@@ -2159,7 +2331,7 @@ void kvm_vcpu_block(struct kvm_vcpu *vcpu)
 					++vcpu->stat.halt_poll_invalid;
 				goto out;
 			}
-			cur = ktime_get();
+			poll_end = cur = ktime_get();
 		} while (single_task_running() && ktime_before(cur, stop));
 	}
 
@@ -2182,18 +2354,27 @@ void kvm_vcpu_block(struct kvm_vcpu *vcpu)
 out:
 	block_ns = ktime_to_ns(cur) - ktime_to_ns(start);
 
+	/* Time spent polling, whether or not the poll caught the wakeup */
+	if (vcpu->halt_poll_ns) {
+		if (waited)
+			vcpu->stat.halt_poll_fail_ns +=
+				ktime_to_ns(poll_end) - ktime_to_ns(start);
+		else
+			vcpu->stat.halt_poll_success_ns += block_ns;
+	}
+
 	if (!vcpu_valid_wakeup(vcpu))
 		shrink_halt_poll_ns(vcpu);
-	else if (halt_poll_ns) {
+	else if (max_halt_poll_ns) {
 		if (block_ns <= vcpu->halt_poll_ns)
 			;
 		/* we had a long block, shrink polling */
-		else if (vcpu->halt_poll_ns && block_ns > halt_poll_ns)
+		else if (vcpu->halt_poll_ns && block_ns > max_halt_poll_ns)
 			shrink_halt_poll_ns(vcpu);
 		/* we had a short halt and our poll time is too small */
-		else if (vcpu->halt_poll_ns < halt_poll_ns &&
-			block_ns < halt_poll_ns)
-			grow_halt_poll_ns(vcpu);
+		else if (vcpu->halt_poll_ns < max_halt_poll_ns &&
+			block_ns < max_halt_poll_ns)
+			grow_halt_poll_ns(vcpu, max_halt_poll_ns);
 	} else
 		vcpu->halt_poll_ns = 0;
 
@@ -2349,6 +2530,16 @@ void kvm_vcpu_on_spin(struct kvm_vcpu *me)
 }
 EXPORT_SYMBOL_GPL(kvm_vcpu_on_spin);
 
+static bool kvm_page_in_dirty_ring(struct kvm *kvm, unsigned long pgoff)
+{
+#if KVM_DIRTY_LOG_PAGE_OFFSET > 0
+	return pgoff >= KVM_DIRTY_LOG_PAGE_OFFSET &&
+	       pgoff < KVM_DIRTY_LOG_PAGE_OFFSET + kvm->dirty_ring_size / PAGE_SIZE;
+#else
+	return false;
+#endif
+}
+
 static int kvm_vcpu_fault(struct vm_fault *vmf)
 {
 	struct kvm_vcpu *vcpu = vmf->vma->vm_file->private_data;
@@ -2364,6 +2555,9 @@ static int kvm_vcpu_fault(struct vm_fault *vmf)
 	else if (vmf->pgoff == KVM_COALESCED_MMIO_PAGE_OFFSET)
 		page = virt_to_page(vcpu->kvm->coalesced_mmio_ring);
 #endif
+	else if (kvm_page_in_dirty_ring(vcpu->kvm, vmf->pgoff))
+		page = kvm_dirty_ring_get_page(&vcpu->dirty_ring,
+				vmf->pgoff - KVM_DIRTY_LOG_PAGE_OFFSET);
 	else
 		return kvm_arch_vcpu_fault(vcpu, vmf);
 	get_page(page);
@@ -2377,6 +2571,15 @@ static const struct vm_operations_struct kvm_vcpu_vm_ops = {
 
 static int kvm_vcpu_mmap(struct file *file, struct vm_area_struct *vma)
 {
+	struct kvm_vcpu *vcpu = file->private_data;
+
+	/* The dirty ring is only ever shared, and never executed */
+	if ((kvm_page_in_dirty_ring(vcpu->kvm, vma->vm_pgoff) ||
+	     kvm_page_in_dirty_ring(vcpu->kvm,
+				    vma->vm_pgoff + vma_pages(vma) - 1)) &&
+	    ((vma->vm_flags & VM_EXEC) || !(vma->vm_flags & VM_SHARED)))
+		return -EINVAL;
+
 	vma->vm_ops = &kvm_vcpu_vm_ops;
 	return 0;
 }
@@ -2522,6 +2725,224 @@ static int kvm_vcpu_ioctl_set_sigmask(struct kvm_vcpu *vcpu, sigset_t *sigset)
 	return 0;
 }
 
+/*
+ * Binary statistics: the same counters as debugfs_entries, but a reader gets
+ * all of a VM's or of a vcpu's values with a single pread on an fd it holds,
+ * and needs neither debugfs nor string parsing.
+ */
+struct kvm_stats_descs {
+	u32 num_desc;
+	void *descs;		/* each followed by its name */
+};
+
+static struct kvm_stats_descs kvm_stats_descs[] = {
+	[KVM_STAT_VM]	= { 0, NULL },
+	[KVM_STAT_VCPU]	= { 0, NULL },
+};
+
+struct kvm_stats_file {
+	struct kvm *kvm;
+	struct kvm_vcpu *vcpu;		/* NULL for the VM stats */
+	enum kvm_stat_kind kind;
+	struct kvm_stats_header header;
+	char id[KVM_STATS_NAME_SIZE];
+};
+
+#define KVM_STATS_DESC_SIZE	(sizeof(struct kvm_stats_desc) + \
+				 KVM_STATS_NAME_SIZE)
+
+static int kvm_init_stats(void)
+{
+	struct kvm_stats_debugfs_item *p;
+	struct kvm_stats_desc *desc;
+	int kind;
+
+	for (p = debugfs_entries; p->name; p++)
+		kvm_stats_descs[p->kind].num_desc++;
+
+	for (kind = 0; kind < ARRAY_SIZE(kvm_stats_descs); kind++) {
+		struct kvm_stats_descs *descs = &kvm_stats_descs[kind];
+		u32 i = 0;
+
+		if (!descs->num_desc)
+			continue;
+
+		descs->descs = kcalloc(descs->num_desc, KVM_STATS_DESC_SIZE,
+				       GFP_KERNEL);
+		if (!descs->descs)
+			goto out_free;
+
+		for (p = debugfs_entries; p->name; p++) {
+			if (p->kind != kind)
+				continue;
+
+			desc = descs->descs + i * KVM_STATS_DESC_SIZE;
+			desc->flags = p->desc_flags;
+			desc->exponent = p->exponent;
+			desc->size = 1;
+			desc->offset = i * sizeof(u64);
+			strlcpy(desc->name, p->name, KVM_STATS_NAME_SIZE);
+			i++;
+		}
+	}
+
+	return 0;
+
+out_free:
+	for (kind = 0; kind < ARRAY_SIZE(kvm_stats_descs); kind++)
+		kfree(kvm_stats_descs[kind].descs);
+	return -ENOMEM;
+}
+
+static void kvm_exit_stats(void)
+{
+	int kind;
+
+	for (kind = 0; kind < ARRAY_SIZE(kvm_stats_descs); kind++)
+		kfree(kvm_stats_descs[kind].descs);
+}
+
+/* Copy what falls within the read window of the @len bytes at @start */
+static int kvm_stats_copy(char __user **buf, loff_t *pos, size_t *remain,
+			  const void *src, loff_t start, size_t len)
+{
+	size_t skip, n;
+
+	if (!*remain || *pos < start || *pos >= start + len)
+		return 0;
+
+	skip = *pos - start;
+	n = min(len - skip, *remain);
+	if (copy_to_user(*buf, src + skip, n))
+		return -EFAULT;
+
+	*buf += n;
+	*pos += n;
+	*remain -= n;
+	return 0;
+}
+
+static u64 kvm_stats_value(struct kvm_stats_file *sf,
+			   struct kvm_stats_debugfs_item *p)
+{
+	if (sf->vcpu)
+		return *(u64 *)((void *)sf->vcpu + p->offset);
+
+	return *(ulong *)((void *)sf->kvm + p->offset);
+}
+
+static ssize_t kvm_stats_read(struct file *file, char __user *buf,
+			      size_t size, loff_t *ppos)
+{
+	struct kvm_stats_file *sf = file->private_data;
+	struct kvm_stats_header *header = &sf->header;
+	struct kvm_stats_debugfs_item *p;
+	loff_t pos = *ppos, start;
+	size_t remain, len;
+	int r;
+
+	len = header->data_offset + header->num_desc * sizeof(u64);
+	if (pos < 0 || pos >= len)
+		return 0;
+	remain = min_t(size_t, size, len - pos);
+	size = remain;
+
+	r = kvm_stats_copy(&buf, &pos, &remain, header, 0, sizeof(*header));
+	if (r)
+		return r;
+	r = kvm_stats_copy(&buf, &pos, &remain, sf->id, header->id_offset,
+			   header->name_size);
+	if (r)
+		return r;
+	r = kvm_stats_copy(&buf, &pos, &remain,
+			   kvm_stats_descs[sf->kind].descs, header->desc_offset,
+			   header->num_desc * KVM_STATS_DESC_SIZE);
+	if (r)
+		return r;
+
+	start = header->data_offset;
+	for (p = debugfs_entries; p->name && remain; p++) {
+		u64 val;
+
+		if (p->kind != sf->kind)
+			continue;
+
+		if (pos < start + sizeof(val)) {
+			val = kvm_stats_value(sf, p);
+			r = kvm_stats_copy(&buf, &pos, &remain, &val, start,
+					   sizeof(val));
+			if (r)
+				return r;
+		}
+		start += sizeof(val);
+	}
+
+	*ppos = pos;
+	return size - remain;
+}
+
+static int kvm_stats_release(struct inode *inode, struct file *file)
+{
+	struct kvm_stats_file *sf = file->private_data;
+
+	kvm_put_kvm(sf->kvm);
+	kfree(sf);
+	return 0;
+}
+
+static const struct file_operations kvm_stats_fops = {
+	.read		= kvm_stats_read,
+	.release	= kvm_stats_release,
+	.llseek		= noop_llseek,
+};
+
+static int kvm_get_stats_fd(struct kvm *kvm, struct kvm_vcpu *vcpu)
+{
+	enum kvm_stat_kind kind = vcpu ? KVM_STAT_VCPU : KVM_STAT_VM;
+	struct kvm_stats_file *sf;
+	struct file *file;
+	int fd;
+
+	sf = kzalloc(sizeof(*sf), GFP_KERNEL);
+	if (!sf)
+		return -ENOMEM;
+
+	sf->kvm = kvm;
+	sf->vcpu = vcpu;
+	sf->kind = kind;
+	if (vcpu)
+		snprintf(sf->id, sizeof(sf->id), "kvm-%d/vcpu-%d",
+			 task_pid_nr(current), vcpu->vcpu_id);
+	else
+		snprintf(sf->id, sizeof(sf->id), "kvm-%d",
+			 task_pid_nr(current));
+
+	sf->header.name_size = KVM_STATS_NAME_SIZE;
+	sf->header.num_desc = kvm_stats_descs[kind].num_desc;
+	sf->header.id_offset = sizeof(sf->header);
+	sf->header.desc_offset = sf->header.id_offset + KVM_STATS_NAME_SIZE;
+	sf->header.data_offset = sf->header.desc_offset +
+				 sf->header.num_desc * KVM_STATS_DESC_SIZE;
+
+	fd = get_unused_fd_flags(O_CLOEXEC);
+	if (fd < 0) {
+		kfree(sf);
+		return fd;
+	}
+
+	file = anon_inode_getfile("kvm-stats", &kvm_stats_fops, sf, O_RDONLY);
+	if (IS_ERR(file)) {
+		put_unused_fd(fd);
+		kfree(sf);
+		return PTR_ERR(file);
+	}
+	file->f_mode |= FMODE_PREAD;
+
+	kvm_get_kvm(kvm);
+	fd_install(fd, file);
+	return fd;
+}
+
 static long kvm_vcpu_ioctl(struct file *filp,
 			   unsigned int ioctl, unsigned long arg)
 {
@@ -2715,6 +3136,9 @@ static long kvm_vcpu_ioctl(struct file *filp,
 		r = kvm_arch_vcpu_ioctl_set_fpu(vcpu, fpu);
 		break;
 	}
+	case KVM_GET_STATS_FD:
+		r = kvm_get_stats_fd(vcpu->kvm, vcpu);
+		break;
 	default:
 		r = kvm_arch_vcpu_ioctl(filp, ioctl, arg);
 	}
@@ -2939,12 +3363,93 @@ static long kvm_vm_ioctl_check_extension_generic(struct kvm *kvm, long arg)
 #endif
 	case KVM_CAP_MAX_VCPU_ID:
 		return KVM_MAX_VCPU_ID;
+	case KVM_CAP_HALT_POLL:
+	case KVM_CAP_BINARY_STATS_FD:
+		return 1;
+#ifdef CONFIG_HAVE_KVM_DIRTY_RING
+	case KVM_CAP_DIRTY_LOG_RING:
+		return KVM_DIRTY_RING_MAX_ENTRIES * sizeof(struct kvm_dirty_gfn);
+#endif
+#ifdef CONFIG_HAVE_KVM_ACCESS_LOG
+	case KVM_CAP_ACCESS_LOG:
+		return 1;
+#endif
 	default:
 		break;
 	}
 	return kvm_vm_ioctl_check_extension(kvm, arg);
 }
 
+#ifdef CONFIG_HAVE_KVM_DIRTY_RING
+static int kvm_vm_ioctl_enable_dirty_log_ring(struct kvm *kvm, u32 size)
+{
+	int r;
+
+	/* A power of two, no smaller than a page nor the reserved entries */
+	if (!size || (size & (size - 1)) || size < PAGE_SIZE ||
+	    size < KVM_DIRTY_RING_RSVD_ENTRIES * sizeof(struct kvm_dirty_gfn))
+		return -EINVAL;
+
+	if (size > KVM_DIRTY_RING_MAX_ENTRIES * sizeof(struct kvm_dirty_gfn))
+		return -E2BIG;
+
+	mutex_lock(&kvm->lock);
+	/* The rings are allocated with the vcpus, and sized only once */
+	if (kvm->created_vcpus || kvm->dirty_ring_size) {
+		r = -EINVAL;
+	} else {
+		kvm->dirty_ring_size = size;
+		r = 0;
+	}
+	mutex_unlock(&kvm->lock);
+
+	return r;
+}
+
+static int kvm_vm_ioctl_reset_dirty_rings(struct kvm *kvm)
+{
+	struct kvm_vcpu *vcpu;
+	int i, cleared = 0;
+
+	if (!kvm->dirty_ring_size)
+		return -EINVAL;
+
+	mutex_lock(&kvm->slots_lock);
+	kvm_for_each_vcpu(i, vcpu, kvm)
+		cleared += kvm_dirty_ring_reset(kvm, &vcpu->dirty_ring);
+	mutex_unlock(&kvm->slots_lock);
+
+	if (cleared)
+		kvm_flush_remote_tlbs(kvm);
+
+	return cleared;
+}
+#endif
+
+/* Returns -ENOTTY for the capabilities the architecture enables */
+static int kvm_vm_ioctl_enable_cap_generic(struct kvm *kvm,
+					   struct kvm_enable_cap *cap)
+{
+	switch (cap->cap) {
+	case KVM_CAP_HALT_POLL:
+		if (cap->flags || cap->args[0] != (unsigned int)cap->args[0])
+			return -EINVAL;
+
+		WRITE_ONCE(kvm->max_halt_poll_ns, cap->args[0]);
+		WRITE_ONCE(kvm->override_halt_poll_ns, true);
+		return 0;
+#ifdef CONFIG_HAVE_KVM_DIRTY_RING
+	case KVM_CAP_DIRTY_LOG_RING:
+		if (cap->flags)
+			return -EINVAL;
+
+		return kvm_vm_ioctl_enable_dirty_log_ring(kvm, cap->args[0]);
+#endif
+	default:
+		return -ENOTTY;
+	}
+}
+
 static long kvm_vm_ioctl(struct file *filp,
 			   unsigned int ioctl, unsigned long arg)
 {
@@ -2978,6 +3483,17 @@ static long kvm_vm_ioctl(struct file *filp,
 		r = kvm_vm_ioctl_get_dirty_log(kvm, &log);
 		break;
 	}
+#ifdef CONFIG_HAVE_KVM_ACCESS_LOG
+	case KVM_GET_ACCESS_LOG: {
+		struct kvm_dirty_log log;
+
+		r = -EFAULT;
+		if (copy_from_user(&log, argp, sizeof(log)))
+			goto out;
+		r = kvm_vm_ioctl_get_access_log(kvm, &log);
+		break;
+	}
+#endif
 #ifdef CONFIG_KVM_MMIO
 	case KVM_REGISTER_COALESCED_MMIO: {
 		struct kvm_coalesced_mmio_zone zone;
@@ -3106,6 +3622,26 @@ static long kvm_vm_ioctl(struct file *filp,
 	case KVM_CHECK_EXTENSION:
 		r = kvm_vm_ioctl_check_extension_generic(kvm, arg);
 		break;
+	case KVM_ENABLE_CAP: {
+		struct kvm_enable_cap cap;
+
+		r = -EFAULT;
+		if (copy_from_user(&cap, argp, sizeof(cap)))
+			goto out;
+
+		r = kvm_vm_ioctl_enable_cap_generic(kvm, &cap);
+		if (r == -ENOTTY)
+			r = kvm_arch_vm_ioctl(filp, ioctl, arg);
+		break;
+	}
+#ifdef CONFIG_HAVE_KVM_DIRTY_RING
+	case KVM_RESET_DIRTY_RINGS:
+		r = kvm_vm_ioctl_reset_dirty_rings(kvm);
+		break;
+#endif
+	case KVM_GET_STATS_FD:
+		r = kvm_get_stats_fd(kvm, NULL);
+		break;
 	default:
 		r = kvm_arch_vm_ioctl(filp, ioctl, arg);
 	}
@@ -3132,7 +3668,11 @@ static long kvm_vm_compat_ioctl(struct file *filp,
 	if (kvm->mm != current->mm)
 		return -EIO;
 	switch (ioctl) {
-	case KVM_GET_DIRTY_LOG: {
+	case KVM_GET_DIRTY_LOG:
+#ifdef CONFIG_HAVE_KVM_ACCESS_LOG
+	case KVM_GET_ACCESS_LOG:
+#endif
+	{
 		struct compat_kvm_dirty_log compat_log;
 		struct kvm_dirty_log log;
 
@@ -3144,6 +3684,12 @@ static long kvm_vm_compat_ioctl(struct file *filp,
 		log.padding2	 = compat_log.padding2;
 		log.dirty_bitmap = compat_ptr(compat_log.dirty_bitmap);
 
+#ifdef CONFIG_HAVE_KVM_ACCESS_LOG
+		if (ioctl == KVM_GET_ACCESS_LOG) {
+			r = kvm_vm_ioctl_get_access_log(kvm, &log);
+			break;
+		}
+#endif
 		r = kvm_vm_ioctl_get_dirty_log(kvm, &log);
 		break;
 	}
@@ -3400,21 +3946,6 @@ static int kvm_io_bus_sort_cmp(const void *p1, const void *p2)
 	return kvm_io_bus_cmp(p1, p2);
 }
 
-static int kvm_io_bus_insert_dev(struct kvm_io_bus *bus, struct kvm_io_device *dev,
-			  gpa_t addr, int len)
-{
-	bus->range[bus->dev_count++] = (struct kvm_io_range) {
-		.addr = addr,
-		.len = len,
-		.dev = dev,
-	};
-
-	sort(bus->range, bus->dev_count, sizeof(struct kvm_io_range),
-		kvm_io_bus_sort_cmp, NULL);
-
-	return 0;
-}
-
 static int kvm_io_bus_get_first_dev(struct kvm_io_bus *bus,
 			     gpa_t addr, int len)
 {
@@ -3550,10 +4081,43 @@ int kvm_io_bus_read(struct kvm_vcpu *vcpu, enum kvm_bus bus_idx, gpa_t addr,
 	return r < 0 ? r : 0;
 }
 
+/* kvm_io_bus_read_cookie - called under kvm->slots_lock */
+int kvm_io_bus_read_cookie(struct kvm_vcpu *vcpu, enum kvm_bus bus_idx,
+			   gpa_t addr, int len, void *val, long cookie)
+{
+	struct kvm_io_bus *bus;
+	struct kvm_io_range range;
 
-/* Caller must hold slots_lock. */
-int kvm_io_bus_register_dev(struct kvm *kvm, enum kvm_bus bus_idx, gpa_t addr,
-			    int len, struct kvm_io_device *dev)
+	range = (struct kvm_io_range) {
+		.addr = addr,
+		.len = len,
+	};
+
+	bus = srcu_dereference(vcpu->kvm->buses[bus_idx], &vcpu->kvm->srcu);
+	if (!bus)
+		return -ENOMEM;
+
+	/* First try the device referenced by cookie. */
+	if ((cookie >= 0) && (cookie < bus->dev_count) &&
+	    (kvm_io_bus_cmp(&range, &bus->range[cookie]) == 0))
+		if (!kvm_iodevice_read(vcpu, bus->range[cookie].dev, addr, len,
+				       val))
+			return cookie;
+
+	/*
+	 * cookie contained garbage; fall back to search and return the
+	 * correct cookie value.
+	 */
+	return __kvm_io_bus_read(vcpu, bus, &range, val);
+}
+
+
+/*
+ * Register @nr devices at once, at the cost of a single bus copy and SRCU
+ * grace period. Caller must hold slots_lock.
+ */
+int kvm_io_bus_register_devs(struct kvm *kvm, enum kvm_bus bus_idx,
+			     const struct kvm_io_range *ranges, int nr)
 {
 	struct kvm_io_bus *new_bus, *bus;
 
@@ -3562,16 +4126,20 @@ int kvm_io_bus_register_dev(struct kvm *kvm, enum kvm_bus bus_idx, gpa_t addr,
 		return -ENOMEM;
 
 	/* exclude ioeventfd which is limited by maximum fd */
-	if (bus->dev_count - bus->ioeventfd_count > NR_IOBUS_DEVS - 1)
+	if (bus->dev_count - bus->ioeventfd_count > NR_IOBUS_DEVS - nr)
 		return -ENOSPC;
 
-	new_bus = kmalloc(sizeof(*bus) + ((bus->dev_count + 1) *
+	new_bus = kmalloc(sizeof(*bus) + ((bus->dev_count + nr) *
 			  sizeof(struct kvm_io_range)), GFP_KERNEL);
 	if (!new_bus)
 		return -ENOMEM;
 	memcpy(new_bus, bus, sizeof(*bus) + (bus->dev_count *
 	       sizeof(struct kvm_io_range)));
-	kvm_io_bus_insert_dev(new_bus, dev, addr, len);
+	memcpy(new_bus->range + new_bus->dev_count, ranges,
+	       nr * sizeof(struct kvm_io_range));
+	new_bus->dev_count += nr;
+	sort(new_bus->range, new_bus->dev_count, sizeof(struct kvm_io_range),
+		kvm_io_bus_sort_cmp, NULL);
 	rcu_assign_pointer(kvm->buses[bus_idx], new_bus);
 	synchronize_srcu_expedited(&kvm->srcu);
 	kfree(bus);
@@ -3579,6 +4147,19 @@ int kvm_io_bus_register_dev(struct kvm *kvm, enum kvm_bus bus_idx, gpa_t addr,
 	return 0;
 }
 
+/* Caller must hold slots_lock. */
+int kvm_io_bus_register_dev(struct kvm *kvm, enum kvm_bus bus_idx, gpa_t addr,
+			    int len, struct kvm_io_device *dev)
+{
+	struct kvm_io_range range = {
+		.addr = addr,
+		.len = len,
+		.dev = dev,
+	};
+
+	return kvm_io_bus_register_devs(kvm, bus_idx, &range, 1);
+}
+
 /* Caller must hold slots_lock. */
 void kvm_io_bus_unregister_dev(struct kvm *kvm, enum kvm_bus bus_idx,
 			       struct kvm_io_device *dev)
@@ -3994,10 +4575,14 @@ int kvm_init(void *opaque, unsigned vcpu_size, unsigned vcpu_align,
 	kvm_preempt_ops.sched_in = kvm_sched_in;
 	kvm_preempt_ops.sched_out = kvm_sched_out;
 
+	r = kvm_init_stats();
+	if (r)
+		goto out_undebugfs;
+
 	r = kvm_init_debug();
 	if (r) {
 		pr_err("kvm: create debugfs files failed\n");
-		goto out_undebugfs;
+		goto out_unstats;
 	}
 
 	r = kvm_vfio_ops_init();
@@ -4005,6 +4590,8 @@ int kvm_init(void *opaque, unsigned vcpu_size, unsigned vcpu_align,
 
 	return 0;
 
+out_unstats:
+	kvm_exit_stats();
 out_undebugfs:
 	unregister_syscore_ops(&kvm_syscore_ops);
 	misc_deregister(&kvm_dev);
@@ -4032,6 +4619,7 @@ EXPORT_SYMBOL_GPL(kvm_init);
 void kvm_exit(void)
 {
 	debugfs_remove_recursive(kvm_debugfs_dir);
+	kvm_exit_stats();
 	misc_deregister(&kvm_dev);
 	kmem_cache_destroy(kvm_vcpu_cache);
 	kvm_async_pf_deinit();
@@ -0,0 +1,26 @@
+#ifndef KVM_MMU_LOCK_H
+#define KVM_MMU_LOCK_H 1
+
+/*
+ * An architecture may make kvm->mmu_lock an rwlock, so that its own page
+ * fault handling can run concurrently under the read side. Common code only
+ * ever takes it exclusively, through these.
+ */
+#ifdef KVM_HAVE_MMU_RWLOCK
+#define KVM_MMU_LOCK_INIT(kvm)	rwlock_init(&(kvm)->mmu_lock)
+#ifdef KVM_HAVE_MMU_LOCK_STAT
+/* Accounts contention in the arch's kvm_vm_stat, see kvm/arm_lock_stat.h */
+#include <kvm/arm_lock_stat.h>
+#define KVM_MMU_LOCK(kvm)	kvm_mmu_write_lock(kvm)
+#define KVM_MMU_UNLOCK(kvm)	kvm_mmu_write_unlock(kvm)
+#else
+#define KVM_MMU_LOCK(kvm)	write_lock(&(kvm)->mmu_lock)
+#define KVM_MMU_UNLOCK(kvm)	write_unlock(&(kvm)->mmu_lock)
+#endif
+#else
+#define KVM_MMU_LOCK_INIT(kvm)	spin_lock_init(&(kvm)->mmu_lock)
+#define KVM_MMU_LOCK(kvm)	spin_lock(&(kvm)->mmu_lock)
+#define KVM_MMU_UNLOCK(kvm)	spin_unlock(&(kvm)->mmu_lock)
+#endif /* KVM_HAVE_MMU_RWLOCK */
+
+#endif